@@ -21,6 +21,20 @@ newtest:
 
 .PHONY: newtest
 
+# Build and run the Bench* programs of the tests directories. These
+# time the kernels rather than check them, so 'make check' skips them.
+bench:
+	@for dir in $(SUBDIRS); do \
+	  test "$$dir" = . || ! grep -q '^bench:' $$dir/Makefile || \
+	    (cd $$dir && $(MAKE) $(AM_MAKEFLAGS) bench) || exit 1; \
+	done
+	@if test -n "$(BENCHMARKS)"; then \
+	  $(MAKE) $(AM_MAKEFLAGS) $(check_LTLIBRARIES) $(BENCHMARKS) || exit 1; \
+	  for b in $(BENCHMARKS); do ./$$b || exit 1; done; \
+	fi
+
+.PHONY: bench
+
 SUFFIXES = .totallyfakeplaceholder
 include $(top_srcdir)/thirdparty/autotroll.mak
 
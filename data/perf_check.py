@@ -0,0 +1,236 @@
+#!/usr/bin/env python
+# __BEGIN_LICENSE__
+#  Copyright (c) 2009-2013, United States Government as represented by the
+#  Administrator of the National Aeronautics and Space Administration. All
+#  rights reserved.
+#
+#  The NGT platform is licensed under the Apache License, Version 2.0 (the
+#  "License"); you may not use this file except in compliance with the
+#  License. You may obtain a copy of the License at
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+# __END_LICENSE__
+
+# Run stereo, one stage at a time, and point2dem on the example data
+# sets of this directory, with the settings of their stereo files and
+# a fixed number of threads. Record the time and peak memory of each
+# stage, and compare them with a baseline from an earlier run. Exit
+# with a non-zero status if a stage became slower or bigger than the
+# tolerance allows. Run with 'make perf-check'.
+#
+# The data sets whose inputs are not present are skipped. Their inputs
+# are made by 'make' in their directory, see the Makefile there.
+#
+# A baseline is recorded on a given machine with --update-baseline,
+# and is only meaningful when compared with runs on the same machine.
+
+import sys, os, time, json, socket, optparse, subprocess
+import os.path as P
+
+# The stages of stereo, by entry point
+STEREO_STAGES = ['pprc', 'corr', 'rfne', 'fltr', 'tri']
+
+# For each data set, its stereo inputs, stereo file, and the options
+# of point2dem, if its point cloud is in a planetary frame.
+DATASETS = [
+    {'name': 'K10',
+     'dir': 'K10',
+     'inputs': ['left4.png', 'right4.png', 'black_left.tsai', 'black_right.tsai'],
+     'stereo_file': 'stereo.default',
+     'point2dem': None},
+    {'name': 'MER',
+     'dir': 'MER',
+     'inputs': ['1n270487304eff90cip1952l0m1.img', '1n270487304eff90cip1952r0m1.img',
+                '1n270487304eff90cip1952l0m1.cahvor', '1n270487304eff90cip1952r0m1.cahvor'],
+     'stereo_file': 'stereo.default',
+     'point2dem': None},
+    {'name': 'MOC',
+     'dir': 'MOC',
+     'inputs': ['M0100115.cub', 'E0201461.cub'],
+     'stereo_file': 'stereo.nonmap',
+     'point2dem': ['-r', 'mars', '--nodata', '-32767']},
+    {'name': 'CTX',
+     'dir': 'CTX',
+     'inputs': ['P02_001981_1823_XI_02N356W.cal.cub', 'P03_002258_1817_XI_01N356W.cal.cub'],
+     'stereo_file': 'stereo.nonmap',
+     'point2dem': ['-r', 'mars', '--nodata', '-32767']},
+    {'name': 'HiRISE',
+     'dir': 'HiRISE',
+     'inputs': ['PSP_005913_1640_RED.mos_hijitreged.norm.crop.cub',
+                'PSP_005201_1640_RED.mos_hijitreged.norm.crop.cub'],
+     'stereo_file': 'stereo.nonmap',
+     'point2dem': ['-r', 'mars', '--nodata', '-32767']},
+    ]
+
+def run_stage(cmd, cwd, log):
+    '''Run a command, with its output going to the log. Return its
+    exit status, wall time in seconds, and peak memory in MB of it
+    and the processes it waited for.'''
+    log.write('\n' + ' '.join(cmd) + '\n')
+    log.flush()
+    start = time.time()
+    try:
+        proc = subprocess.Popen(cmd, cwd=cwd, stdout=log, stderr=subprocess.STDOUT)
+    except OSError as e:
+        log.write('Failed to start: ' + str(e) + '\n')
+        return (-1, 0.0, 0.0)
+    (pid, status, usage) = os.wait4(proc.pid, 0)
+    elapsed = time.time() - start
+    # ru_maxrss is in kilobytes on Linux and in bytes on OSX
+    max_rss = usage.ru_maxrss/1024.0
+    if sys.platform == 'darwin':
+        max_rss /= 1024.0
+    return (status, elapsed, max_rss)
+
+def run_dataset(dataset, options):
+    '''Run all stages of a data set. Return the timings by stage, or
+    None if the data set was skipped.'''
+
+    data_dir = P.join(options.data_dir, dataset['dir'])
+    missing = [f for f in dataset['inputs'] if not P.exists(P.join(data_dir, f))]
+    if len(missing) > 0:
+        print('%-8s skipped, missing: %s (run make in %s)' %
+              (dataset['name'], ' '.join(missing), data_dir))
+        return None
+
+    out_dir = 'perf'
+    prefix  = P.join(out_dir, 'run')
+    if not P.exists(P.join(data_dir, out_dir)):
+        os.makedirs(P.join(data_dir, out_dir))
+    log_file = P.join(data_dir, out_dir, 'perf-check-log.txt')
+    log = open(log_file, 'w')
+
+    stereo = P.join(options.bin_dir, 'stereo') if options.bin_dir else 'stereo'
+    stages = []
+    for k in range(len(STEREO_STAGES)):
+        cmd = [stereo] + dataset['inputs'] + [prefix, '-s', dataset['stereo_file'],
+                                              '--threads', str(options.threads),
+                                              '--entry-point', str(k),
+                                              '--stop-point', str(k+1)]
+        stages.append(('stereo_' + STEREO_STAGES[k], cmd))
+    if dataset['point2dem'] is not None:
+        point2dem = P.join(options.bin_dir, 'point2dem') if options.bin_dir else 'point2dem'
+        stages.append(('point2dem', [point2dem] + dataset['point2dem'] +
+                       ['--threads', str(options.threads), prefix + '-PC.tif']))
+
+    results = {}
+    for (name, cmd) in stages:
+        (status, elapsed, max_rss) = run_stage(cmd, data_dir, log)
+        if status != 0:
+            log.close()
+            raise Exception('%s: stage %s failed, see %s' % (dataset['name'], name, log_file))
+        results[name] = {'seconds': round(elapsed, 2), 'max_rss_mb': round(max_rss, 1)}
+        print('%-8s %-12s %10.2f s %10.1f MB' % (dataset['name'], name, elapsed, max_rss))
+    log.close()
+    return results
+
+def compare(results, baseline, options):
+    '''Return the list of the stages which regressed.'''
+    regressions = []
+    for name in sorted(results.keys()):
+        if name not in baseline:
+            print('%-8s not in the baseline' % name)
+            continue
+        for stage in sorted(results[name].keys()):
+            if stage not in baseline[name]:
+                continue
+            new = results[name][stage]
+            old = baseline[name][stage]
+            # Small absolute changes are noise, whatever their ratio
+            if (new['seconds'] > old['seconds']*(1.0 + options.tolerance) and
+                new['seconds'] - old['seconds'] > options.min_seconds):
+                regressions.append('%s %s: %.2f s, was %.2f s' %
+                                   (name, stage, new['seconds'], old['seconds']))
+            if (new['max_rss_mb'] > old['max_rss_mb']*(1.0 + options.tolerance) and
+                new['max_rss_mb'] - old['max_rss_mb'] > options.min_mb):
+                regressions.append('%s %s: %.1f MB, was %.1f MB' %
+                                   (name, stage, new['max_rss_mb'], old['max_rss_mb']))
+    return regressions
+
+def main():
+
+    usage = '''perf_check.py [options]
+
+Run stereo and point2dem on the example data sets with fixed settings,
+record the time and peak memory of each stage, and flag the stages
+slower or bigger than in the baseline by more than the tolerance.'''
+
+    data_dir = P.dirname(P.abspath(__file__))
+    parser = optparse.OptionParser(usage=usage)
+    parser.add_option('--data-dir', dest='data_dir', default=data_dir,
+                      help='The directory having the data sets [default: %default].')
+    parser.add_option('--bin-dir', dest='bin_dir', default='',
+                      help='Where to find stereo and point2dem, if not in the path.')
+    parser.add_option('--datasets', dest='datasets', default='',
+                      help='Run only these data sets, separated by commas.')
+    parser.add_option('--threads', dest='threads', type='int', default=4,
+                      help='The number of threads of each tool [default: %default].')
+    parser.add_option('--baseline', dest='baseline',
+                      default=P.join(data_dir, 'perf_baseline.json'),
+                      help='The timings to compare with [default: %default].')
+    parser.add_option('--output', dest='output', default='perf-results.json',
+                      help='Save the timings here [default: %default].')
+    parser.add_option('--tolerance', dest='tolerance', type='float', default=0.25,
+                      help='Flag a stage slower or bigger than the baseline by '
+                      'more than this fraction [default: %default].')
+    parser.add_option('--min-seconds', dest='min_seconds', type='float', default=2.0,
+                      help='Ignore slowdowns of fewer seconds [default: %default].')
+    parser.add_option('--min-mb', dest='min_mb', type='float', default=50.0,
+                      help='Ignore memory growth of fewer MB [default: %default].')
+    parser.add_option('--update-baseline', dest='update_baseline', action='store_true',
+                      default=False, help='Save the timings as the new baseline.')
+    (options, args) = parser.parse_args()
+
+    datasets = DATASETS
+    if options.datasets != '':
+        names = options.datasets.split(',')
+        datasets = [d for d in DATASETS if d['name'] in names]
+
+    results = {}
+    for dataset in datasets:
+        r = run_dataset(dataset, options)
+        if r is not None:
+            results[dataset['name']] = r
+
+    report = {'host': socket.gethostname(), 'date': time.strftime('%Y-%m-%d %H:%M:%S'),
+              'threads': options.threads, 'datasets': results}
+    out = open(options.output, 'w')
+    json.dump(report, out, indent=2, sort_keys=True)
+    out.close()
+    print('Wrote: ' + options.output)
+
+    if options.update_baseline:
+        out = open(options.baseline, 'w')
+        json.dump(report, out, indent=2, sort_keys=True)
+        out.close()
+        print('Wrote the baseline: ' + options.baseline)
+        return 0
+
+    if not P.exists(options.baseline):
+        print('No baseline at %s, nothing to compare with. Record one with --update-baseline.'
+              % options.baseline)
+        return 0
+
+    baseline = json.load(open(options.baseline))
+    if baseline.get('threads') != options.threads:
+        print('Warning: the baseline used %s threads, this run %d.' %
+              (baseline.get('threads'), options.threads))
+    regressions = compare(results, baseline['datasets'], options)
+    if len(regressions) > 0:
+        print('Regressions against the baseline from %s, %s:' %
+              (baseline.get('host'), baseline.get('date')))
+        for r in regressions:
+            print('  ' + r)
+        return 1
+
+    print('No regressions against the baseline from %s, %s.' %
+          (baseline.get('host'), baseline.get('date')))
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -107,12 +107,69 @@ namespace asp {
     return smooth_position_adjustments.get_indices_of_largest_weights(bound_t);
   }
   
+  // Interpolate between two neighboring samples of a dense adjustment table.
+  inline vw::Vector3 interp_table_values(vw::Vector3 const& a, vw::Vector3 const& b,
+                                         double alpha){
+    return a + alpha*(b - a);
+  }
+  inline vw::Quat interp_table_values(vw::Quat const& a, vw::Quat const& b,
+                                      double alpha){
+    return vw::math::slerp(alpha, a, b, 0);
+  }
+
+  // The number of samples of a dense adjustment table, one per image line
+  // between the adjustment bounds.
+  inline int dense_adjustment_table_size(vw::Vector2 const& adjustment_bounds){
+    return std::max(2, (int)ceil(std::abs(adjustment_bounds[1] - adjustment_bounds[0])) + 1);
+  }
+
+  // The smooth interpolation of the adjustments is a Gaussian-weighted
+  // sum over the neighboring ones, recomputed for every pixel query.
+  // When a camera is used for many queries, such as in triangulation,
+  // it is cheaper to sample the interpolated adjustments once per image
+  // line, and then just linearly interpolate into this table.
+  template <class ValueT>
+  class DenseAdjustmentTable {
+  public:
+    DenseAdjustmentTable(): m_t0(0.0), m_dt(0.0) {}
+
+    // Sample the given interpolator num_samples times between t0 and tend.
+    template <class InterpT>
+    void build(InterpT const& interp, double t0, double tend, int num_samples){
+      m_values.clear();
+      if (num_samples < 2 || !(tend > t0))
+        return;
+      m_t0 = t0;
+      m_dt = (tend - t0)/(num_samples - 1.0);
+      m_values.resize(num_samples);
+      for (int i = 0; i < num_samples; i++) {
+        double t = std::min(t0 + i*m_dt, TINY_ADJ*tend);
+        m_values[i] = interp(t);
+      }
+    }
+
+    bool empty() const { return m_values.empty(); }
+
+    // The input t must be within the bounds the table was built with.
+    ValueT operator()(double t) const {
+      double ratio = (t - m_t0)/m_dt;
+      int i = (int)floor(ratio);
+      i = std::max(0, std::min(i, (int)m_values.size() - 2));
+      double alpha = std::max(0.0, std::min(ratio - i, 1.0));
+      return interp_table_values(m_values[i], m_values[i+1], alpha);
+    }
+
+  private:
+    double m_t0, m_dt;
+    std::vector<ValueT> m_values;
+  };
+
   class AdjustablePosition {
   public:
     AdjustablePosition(int interp_type,
                        vw::Vector2 const& adjustment_bounds,
                        std::vector<vw::Vector3> const& position_adjustments,
-                       int num_wts, double sigma):
+                       int num_wts, double sigma, int num_table_samples = 0):
       m_interp_type(static_cast<PiecewiseAdjustmentInterpType>(interp_type)) {
 
       // We will need to be able to linearly interpolate into the adjustments.
@@ -129,6 +186,9 @@ namespace asp {
         m_smooth_position_adjustments
           = vw::camera::SmoothPiecewisePositionInterpolation(position_adjustments,
                                                              t0, dt, num_wts, sigma);
+        if (num_table_samples > 0)
+          m_table.build(m_smooth_position_adjustments, t0,
+                        m_smooth_position_adjustments.get_tend(), num_table_samples);
       }
     }
 
@@ -149,6 +209,8 @@ namespace asp {
       double bound_t = t;
       bound_t = std::max(bound_t, m_smooth_position_adjustments.get_t0());
       bound_t = std::min(bound_t, TINY_ADJ*m_smooth_position_adjustments.get_tend());
+      if (!m_table.empty())
+        return m_table(bound_t);
       return m_smooth_position_adjustments(bound_t);
     }
 
@@ -163,6 +225,7 @@ namespace asp {
     PiecewiseAdjustmentInterpType m_interp_type;
     vw::camera::LinearPiecewisePositionInterpolation m_linear_position_adjustments;
     vw::camera::SmoothPiecewisePositionInterpolation m_smooth_position_adjustments;
+    DenseAdjustmentTable<vw::Vector3> m_table;
   };
 
   class AdjustablePose {
@@ -170,7 +233,7 @@ namespace asp {
     AdjustablePose(int interp_type,
                    vw::Vector2 const& adjustment_bounds,
                    std::vector<vw::Quat> const& pose_adjustments,
-                   int num_wts, double sigma):
+                   int num_wts, double sigma, int num_table_samples = 0):
       m_interp_type(static_cast<PiecewiseAdjustmentInterpType>(interp_type)) {
 
       // We will need to be able to linearly interpolate into the adjustments.
@@ -185,6 +248,9 @@ namespace asp {
         m_smooth_pose_adjustments
           = vw::camera::SmoothSLERPPoseInterpolation(pose_adjustments, t0, dt,
                                                      num_wts, sigma);
+        if (num_table_samples > 0)
+          m_table.build(m_smooth_pose_adjustments, t0,
+                        m_smooth_pose_adjustments.get_tend(), num_table_samples);
       }
     }
 
@@ -207,6 +273,8 @@ namespace asp {
       double bound_t = t;
       bound_t = std::max(bound_t, m_smooth_pose_adjustments.get_t0());
       bound_t = std::min(bound_t, TINY_ADJ*m_smooth_pose_adjustments.get_tend());
+      if (!m_table.empty())
+        return m_table(bound_t);
       return m_smooth_pose_adjustments(bound_t);
     }
 
@@ -214,6 +282,7 @@ namespace asp {
     PiecewiseAdjustmentInterpType m_interp_type;
     vw::camera::SLERPPoseInterpolation       m_linear_pose_adjustments;
     vw::camera::SmoothSLERPPoseInterpolation m_smooth_pose_adjustments;
+    DenseAdjustmentTable<vw::Quat> m_table;
   };
 
   // This class is similar to AdjustedCameraModel, which has one rotation
@@ -226,6 +295,10 @@ namespace asp {
   // A point X gets mapped by the pieceiwe adjusted camera at pixel pix as
   // m_adj_pose(pix.y()) * ( X - m_cam.camera_center(pix) ) 
   //    + m_cam.camera_center(pix) + m_adj_position(pix.y())  
+
+  // With use_dense_table, smooth adjustments are sampled once per image
+  // line at construction, which pays off when the camera is queried for
+  // many pixels, but not when it is rebuilt for every query.
   class PiecewiseAdjustedLinescanModel: public vw::camera::CameraModel {
 
   public:
@@ -237,11 +310,14 @@ namespace asp {
                                    vw::Vector2               const& adjustment_bounds,
                                    std::vector<vw::Vector3>  const& position_adjustments,
                                    std::vector<vw::Quat>     const& pose_adjustments,
-                                   vw::Vector2i              const& image_size):
+                                   vw::Vector2i              const& image_size,
+                                   bool use_dense_table = false):
       m_adj_position(interp_type, adjustment_bounds, position_adjustments,
-                     g_num_wts, g_sigma),
+                     g_num_wts, g_sigma,
+                     use_dense_table ? dense_adjustment_table_size(adjustment_bounds) : 0),
       m_adj_pose(interp_type, adjustment_bounds, pose_adjustments,
-                 g_num_wts, g_sigma),
+                 g_num_wts, g_sigma,
+                 use_dense_table ? dense_adjustment_table_size(adjustment_bounds) : 0),
       // The line below is very important. We must make sure to keep track of
       // the smart pointer to the original camera, so it does not go out of scope.
       m_cam(cam), m_image_size(image_size)
@@ -321,7 +397,7 @@ namespace asp {
                        int interp_type,
                        vw::Vector2 const& adjustment_bounds,
                        std::vector<vw::Vector3> const& position_adjustments,
-                       int num_wts, double sigma):
+                       int num_wts, double sigma, int num_table_samples = 0):
       m_cam_ptr(cam_ptr),
       m_interp_type(static_cast<PiecewiseAdjustmentInterpType>(interp_type)) {
 
@@ -340,11 +416,14 @@ namespace asp {
         m_smooth_position_adjustments
           = vw::camera::SmoothPiecewisePositionInterpolation(position_adjustments,
                                                              t0, dt, num_wts, sigma);
+        if (num_table_samples > 0)
+          m_table.build(m_smooth_position_adjustments, t0,
+                        m_smooth_position_adjustments.get_tend(), num_table_samples);
       }
     }
 
-    // Return the original position plus the interpolated adjustment.
-    vw::Vector3 operator()(double t) const {
+    // Return just the interpolated adjustment.
+    vw::Vector3 adjustment(double t) const {
 
       // The adjustments by design can be applied only to t
       // corresponding to between first and last lines, as that's
@@ -354,13 +433,20 @@ namespace asp {
         double bound_t = t;
         bound_t = std::max(bound_t, m_linear_position_adjustments.get_t0());
         bound_t = std::min(bound_t, TINY_ADJ*m_linear_position_adjustments.get_tend());
-        return m_linear_position_adjustments(bound_t) + m_cam_ptr->get_camera_center_at_time(t);
+        return m_linear_position_adjustments(bound_t);
       }
 
       double bound_t = t;
       bound_t = std::max(bound_t, m_smooth_position_adjustments.get_t0());
       bound_t = std::min(bound_t, TINY_ADJ*m_smooth_position_adjustments.get_tend());
-      return m_smooth_position_adjustments(bound_t) + m_cam_ptr->get_camera_center_at_time(t);
+      if (!m_table.empty())
+        return m_table(bound_t);
+      return m_smooth_position_adjustments(bound_t);
+    }
+
+    // Return the original position plus the interpolated adjustment.
+    vw::Vector3 operator()(double t) const {
+      return adjustment(t) + m_cam_ptr->get_camera_center_at_time(t);
     }
 
     // Return the closest piecewise adjustment camera indices to given time.
@@ -375,6 +461,7 @@ namespace asp {
     PiecewiseAdjustmentInterpType m_interp_type;
     vw::camera::LinearPiecewisePositionInterpolation m_linear_position_adjustments;
     vw::camera::SmoothPiecewisePositionInterpolation m_smooth_position_adjustments;
+    DenseAdjustmentTable<vw::Vector3> m_table;
   };
 
   class AdjustableDGPose {
@@ -383,7 +470,7 @@ namespace asp {
                    int interp_type,
                    vw::Vector2 const& adjustment_bounds,
                    std::vector<vw::Quat> const& pose_adjustments,
-                   int num_wts, double sigma):
+                   int num_wts, double sigma, int num_table_samples = 0):
       m_cam_ptr(cam_ptr),
       m_interp_type(static_cast<PiecewiseAdjustmentInterpType>(interp_type)) {
 
@@ -399,12 +486,14 @@ namespace asp {
       }else{
         m_smooth_pose_adjustments
           = vw::camera::SmoothSLERPPoseInterpolation(pose_adjustments, t0, dt, num_wts, sigma);
+        if (num_table_samples > 0)
+          m_table.build(m_smooth_pose_adjustments, t0,
+                        m_smooth_pose_adjustments.get_tend(), num_table_samples);
       }
     }
 
-    // Take the original rotation, and apply the adjustment on top of it. Both are
-    // interpolated.
-    vw::Quat operator()(double t) const {
+    // Return just the interpolated rotation adjustment.
+    vw::Quat adjustment(double t) const {
 
       // The adjustments by design can be applied only to t
       // corresponding to between first and last lines, as that's
@@ -415,13 +504,21 @@ namespace asp {
         double bound_t = t;
         bound_t = std::max(bound_t, m_linear_pose_adjustments.get_t0());
         bound_t = std::min(bound_t, TINY_ADJ*m_linear_pose_adjustments.get_tend());
-        return m_linear_pose_adjustments(bound_t) * m_cam_ptr->get_camera_pose_at_time(t);
+        return m_linear_pose_adjustments(bound_t);
       }
 
       double bound_t = t;
       bound_t = std::max(bound_t, m_smooth_pose_adjustments.get_t0());
       bound_t = std::min(bound_t, TINY_ADJ*m_smooth_pose_adjustments.get_tend());
-      return m_smooth_pose_adjustments(bound_t) * m_cam_ptr->get_camera_pose_at_time(t);
+      if (!m_table.empty())
+        return m_table(bound_t);
+      return m_smooth_pose_adjustments(bound_t);
+    }
+
+    // Take the original rotation, and apply the adjustment on top of it. Both are
+    // interpolated.
+    vw::Quat operator()(double t) const {
+      return adjustment(t) * m_cam_ptr->get_camera_pose_at_time(t);
     }
 
   private:
@@ -429,6 +526,7 @@ namespace asp {
     PiecewiseAdjustmentInterpType m_interp_type;
     vw::camera::SLERPPoseInterpolation       m_linear_pose_adjustments;
     vw::camera::SmoothSLERPPoseInterpolation m_smooth_pose_adjustments;
+    DenseAdjustmentTable<vw::Quat> m_table;
   };
 
   // This class will have adjustable position and pose. Those are obtained by applying
@@ -451,14 +549,17 @@ namespace asp {
                             vw::Vector2 const& adjustment_bounds,
                             std::vector<vw::Vector3> const& position_adjustments,
                             std::vector<vw::Quat>    const& pose_adjustments,
-			    vw::Vector2i              const& image_size):
+			    vw::Vector2i              const& image_size,
+                            bool use_dense_table = false):
       // Initialize the base
       LinescanDGModel<AdjustableDGPosition, AdjustableDGPose>
     (AdjustableDGPosition(get_dg_ptr(cam), interp_type, adjustment_bounds,
-			  position_adjustments, g_num_wts, g_sigma),
+			  position_adjustments, g_num_wts, g_sigma,
+                          use_dense_table ? dense_adjustment_table_size(adjustment_bounds) : 0),
      get_dg_ptr(cam)->get_velocity_func(),
      AdjustableDGPose(get_dg_ptr(cam), interp_type, adjustment_bounds,
-		      pose_adjustments, g_num_wts, g_sigma),
+		      pose_adjustments, g_num_wts, g_sigma,
+                      use_dense_table ? dense_adjustment_table_size(adjustment_bounds) : 0),
      get_dg_ptr(cam)->get_time_func(),
      get_dg_ptr(cam)->get_image_size(),
      get_dg_ptr(cam)->get_detector_origin(),
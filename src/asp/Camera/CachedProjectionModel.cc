@@ -0,0 +1,226 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Camera/LinescanModel.h>
+#include <asp/Camera/CachedProjectionModel.h>
+
+#include <limits>
+#include <cmath>
+
+using namespace vw;
+
+namespace asp {
+
+namespace {
+
+  // Catmull-Rom cubic weights for a fractional offset t in [0, 1]
+  inline void cubic_weights(double t, double w[4]) {
+    double t2 = t*t, t3 = t2*t;
+    w[0] = 0.5*(-t3 + 2*t2 - t);
+    w[1] = 0.5*(3*t3 - 5*t2 + 2);
+    w[2] = 0.5*(-3*t3 + 4*t2 + t);
+    w[3] = 0.5*(t3 - t2);
+  }
+
+  inline bool is_valid(Vector2 const& pix) {
+    return pix[0] == pix[0] && pix[1] == pix[1]; // false for NaN
+  }
+
+  // Bicubic interpolation in a lattice of pixels, with the neighbors
+  // clamped at the lattice boundary. Returns a NaN pixel if any of the
+  // nodes used is invalid.
+  Vector2 bicubic(ImageView<Vector2> const& nodes, int i, int j, double s, double t) {
+    double wx[4], wy[4];
+    cubic_weights(s, wx);
+    cubic_weights(t, wy);
+    Vector2 result;
+    for (int dj = 0; dj < 4; dj++) {
+      int jj = std::min(std::max(j + dj - 1, 0), nodes.rows() - 1);
+      for (int di = 0; di < 4; di++) {
+        int ii = std::min(std::max(i + di - 1, 0), nodes.cols() - 1);
+        result += (wx[di]*wy[dj])*nodes(ii, jj);
+      }
+    }
+    return result;
+  }
+}
+
+CachedProjectionModel::CachedProjectionModel(boost::shared_ptr<camera::CameraModel> exact_model,
+                                             cartography::Datum const& datum,
+                                             BBox2   const& lonlat_box,
+                                             Vector2 const& height_range,
+                                             Vector3i const& num_samples,
+                                             double max_pixel_error):
+  m_exact_model(exact_model), m_datum(datum), m_lonlat_box(lonlat_box),
+  m_height_range(height_range), m_num_samples(num_samples) {
+
+  if (!m_exact_model)
+    vw_throw( ArgumentErr() << "CachedProjectionModel: Expecting a valid camera model.\n" );
+  if (m_lonlat_box.empty() || m_height_range[1] < m_height_range[0])
+    vw_throw( ArgumentErr() << "CachedProjectionModel: Invalid lon-lat box or height range.\n" );
+
+  // Need at least two nodes in lon and lat to interpolate, and at least one in height.
+  m_num_samples[0] = std::max(m_num_samples[0], 2);
+  m_num_samples[1] = std::max(m_num_samples[1], 2);
+  m_num_samples[2] = std::max(m_num_samples[2], 1);
+  if (m_height_range[1] == m_height_range[0])
+    m_num_samples[2] = 1;
+
+  m_spacing = Vector3(m_lonlat_box.width()  / (m_num_samples[0] - 1.0),
+                      m_lonlat_box.height() / (m_num_samples[1] - 1.0),
+                      0.0);
+  if (m_num_samples[2] > 1)
+    m_spacing[2] = (m_height_range[1] - m_height_range[0]) / (m_num_samples[2] - 1.0);
+
+  m_is_linescan = (dynamic_cast<camera::LinescanModel*>(m_exact_model.get()) != NULL);
+
+  // Compute the exact projections at the lattice nodes. Each node is
+  // used as a seed for its neighbor along the row.
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  m_pixels.resize(m_num_samples[2]);
+  for (int k = 0; k < m_num_samples[2]; k++) {
+    m_pixels[k].set_size(m_num_samples[0], m_num_samples[1]);
+    for (int j = 0; j < m_num_samples[1]; j++) {
+      Vector2 guess(nan, nan);
+      for (int i = 0; i < m_num_samples[0]; i++) {
+        Vector3 xyz = m_datum.geodetic_to_cartesian(lattice_to_llh(i, j, k));
+        Vector2 pix(nan, nan);
+        try {
+          pix = exact_point_to_pixel(xyz, guess);
+        } catch(...) {}
+        m_pixels[k](i, j) = pix;
+        guess = pix;
+      }
+    }
+  }
+
+  // Validate each cell by comparing the interpolated and exact pixel at
+  // its center. With a single height level the cells are 2D.
+  int num_intervals = std::max(m_num_samples[2] - 1, 1);
+  m_valid_cells.resize(num_intervals);
+  for (int k = 0; k < num_intervals; k++) {
+    m_valid_cells[k].set_size(m_num_samples[0] - 1, m_num_samples[1] - 1);
+    double dk = (m_num_samples[2] > 1) ? 0.5 : 0.0;
+    for (int j = 0; j < m_num_samples[1] - 1; j++) {
+      for (int i = 0; i < m_num_samples[0] - 1; i++) {
+        m_valid_cells[k](i, j) = 1; // Needed by interpolate() below
+        Vector3 llh = lattice_to_llh(i + 0.5, j + 0.5, k + dk);
+        Vector2 interp_pix;
+        bool success = interpolate(llh, interp_pix);
+        if (success) {
+          try {
+            Vector2 exact_pix
+              = exact_point_to_pixel(m_datum.geodetic_to_cartesian(llh), interp_pix);
+            success = (norm_2(exact_pix - interp_pix) <= max_pixel_error);
+          } catch(...) {
+            success = false;
+          }
+        }
+        m_valid_cells[k](i, j) = success;
+      }
+    }
+  }
+
+  vw_out() << "Cached projection: using interpolation for "
+           << 100.0*fraction_of_valid_cells() << "% of the lattice cells.\n";
+}
+
+Vector3 CachedProjectionModel::lattice_to_llh(double i, double j, double k) const {
+  return Vector3(m_lonlat_box.min().x() + i*m_spacing[0],
+                 m_lonlat_box.min().y() + j*m_spacing[1],
+                 m_height_range[0]      + k*m_spacing[2]);
+}
+
+double CachedProjectionModel::fraction_of_valid_cells() const {
+  double num_valid = 0, num_total = 0;
+  for (size_t k = 0; k < m_valid_cells.size(); k++) {
+    for (int j = 0; j < m_valid_cells[k].rows(); j++) {
+      for (int i = 0; i < m_valid_cells[k].cols(); i++) {
+        num_valid += m_valid_cells[k](i, j);
+        num_total += 1;
+      }
+    }
+  }
+  if (num_total == 0)
+    return 0.0;
+  return num_valid / num_total;
+}
+
+Vector2 CachedProjectionModel::exact_point_to_pixel(Vector3 const& point,
+                                                    Vector2 const& guess) const {
+  if (m_is_linescan && is_valid(guess))
+    return dynamic_cast<camera::LinescanModel*>(m_exact_model.get())->point_to_pixel(point, guess[1]);
+  return m_exact_model->point_to_pixel(point);
+}
+
+bool CachedProjectionModel::interpolate(Vector3 const& llh, Vector2 & pix) const {
+
+  // Fractional lattice position
+  double x = (llh[0] - m_lonlat_box.min().x()) / m_spacing[0];
+  double y = (llh[1] - m_lonlat_box.min().y()) / m_spacing[1];
+  double z = 0.0;
+  if (m_num_samples[2] > 1)
+    z = (llh[2] - m_height_range[0]) / m_spacing[2];
+
+  // Points outside the lattice are not handled. With a single height
+  // level, the height must match it up to numerical error.
+  if (x < 0 || y < 0 || x > m_num_samples[0] - 1 || y > m_num_samples[1] - 1)
+    return false;
+  if (m_num_samples[2] > 1) {
+    if (z < 0 || z > m_num_samples[2] - 1)
+      return false;
+  } else if (std::abs(llh[2] - m_height_range[0]) > 1e-3) {
+    return false;
+  }
+
+  int i = std::min(int(floor(x)), m_num_samples[0] - 2);
+  int j = std::min(int(floor(y)), m_num_samples[1] - 2);
+  int k = std::min(int(floor(z)), std::max(m_num_samples[2] - 2, 0));
+
+  if (!m_valid_cells[k](i, j))
+    return false;
+
+  pix = bicubic(m_pixels[k], i, j, x - i, y - j);
+  if (m_num_samples[2] > 1) {
+    Vector2 pix2 = bicubic(m_pixels[k+1], i, j, x - i, y - j);
+    pix += (z - k)*(pix2 - pix);
+  }
+
+  return is_valid(pix);
+}
+
+Vector2 CachedProjectionModel::point_to_pixel(Vector3 const& point) const {
+
+  Vector3 llh = m_datum.cartesian_to_geodetic(point);
+
+  // Bring the longitude in the same 360 degree range as the lattice
+  double mid_lon = (m_lonlat_box.min().x() + m_lonlat_box.max().x())/2.0;
+  while (llh[0] < mid_lon - 180.0) llh[0] += 360.0;
+  while (llh[0] > mid_lon + 180.0) llh[0] -= 360.0;
+
+  Vector2 pix;
+  if (interpolate(llh, pix))
+    return pix;
+
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  return exact_point_to_pixel(point, Vector2(nan, nan));
+}
+
+} // namespace asp
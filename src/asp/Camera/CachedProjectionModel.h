@@ -0,0 +1,114 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file CachedProjectionModel.h
+///
+/// A camera model wrapper which speeds up point_to_pixel() by
+/// interpolating into a precomputed lattice of exact projections.
+///
+/// For linescan cameras, point_to_pixel() requires an iterative solver,
+/// which dominates the run-time of mapprojection and of any other
+/// operation which projects many ground points into the camera. The
+/// ground footprint is sampled at a coarse lon-lat-height lattice, the
+/// exact pixel is found at each lattice node, and in between the nodes
+/// bicubic interpolation in lon-lat and linear interpolation in height
+/// is used. Lattice cells whose interpolation error, measured at cell
+/// centers, exceeds a given bound, as well as points outside the
+/// lattice, fall back to the exact model.
+
+#ifndef __STEREO_CAMERA_CACHED_PROJECTION_MODEL_H__
+#define __STEREO_CAMERA_CACHED_PROJECTION_MODEL_H__
+
+#include <vw/Math/Vector.h>
+#include <vw/Math/BBox.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Camera/CameraModel.h>
+#include <vw/Cartography/Datum.h>
+
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
+namespace asp {
+
+  class CachedProjectionModel : public vw::camera::CameraModel {
+  public:
+
+    /// Sample the exact model over the given lon-lat box and height range.
+    /// - num_samples is the number of lattice nodes in lon, lat, and height.
+    /// - max_pixel_error is the largest interpolation error, in pixels,
+    ///   allowed in a lattice cell for the cell to be used.
+    CachedProjectionModel(boost::shared_ptr<vw::camera::CameraModel> exact_model,
+                          vw::cartography::Datum const& datum,
+                          vw::BBox2   const& lonlat_box,
+                          vw::Vector2 const& height_range,
+                          vw::Vector3i const& num_samples = vw::Vector3i(64, 64, 3),
+                          double max_pixel_error = 0.01);
+
+    virtual ~CachedProjectionModel() {}
+    virtual std::string type() const { return "CachedProjection"; }
+
+    virtual vw::Vector2 point_to_pixel(vw::Vector3 const& point) const;
+
+    // The remaining functions are not sped up, just passed through.
+    virtual vw::Vector3 pixel_to_vector(vw::Vector2 const& pix) const {
+      return m_exact_model->pixel_to_vector(pix);
+    }
+    virtual vw::Vector3 camera_center(vw::Vector2 const& pix = vw::Vector2()) const {
+      return m_exact_model->camera_center(pix);
+    }
+    virtual vw::Quat camera_pose(vw::Vector2 const& pix = vw::Vector2()) const {
+      return m_exact_model->camera_pose(pix);
+    }
+
+    boost::shared_ptr<vw::camera::CameraModel> exact_model() const { return m_exact_model; }
+
+    /// The fraction of lattice cells where interpolation is used.
+    double fraction_of_valid_cells() const;
+
+  private:
+
+    /// Find the pixel by interpolation. Return false if the point is
+    /// outside the lattice or in a cell which failed the error check.
+    bool interpolate(vw::Vector3 const& llh, vw::Vector2 & pix) const;
+
+    /// Project with the exact model, seeding the solver if possible.
+    vw::Vector2 exact_point_to_pixel(vw::Vector3 const& point, vw::Vector2 const& guess) const;
+
+    /// Lon-lat-height at the given fractional lattice position.
+    vw::Vector3 lattice_to_llh(double i, double j, double k) const;
+
+    boost::shared_ptr<vw::camera::CameraModel> m_exact_model;
+    vw::cartography::Datum m_datum;
+    vw::BBox2    m_lonlat_box;
+    vw::Vector2  m_height_range;
+    vw::Vector3i m_num_samples;
+    vw::Vector3  m_spacing;     ///< Lattice spacing in lon, lat, height
+    bool         m_is_linescan; ///< If the exact model can accept a seed line
+
+    /// One image of exact pixel values per height level. Nodes where
+    /// the projection failed are NaN.
+    std::vector< vw::ImageView<vw::Vector2> > m_pixels;
+
+    /// For each lattice cell, if interpolation is accurate enough in it.
+    /// There is one image per interval between height levels.
+    std::vector< vw::ImageView<vw::uint8> > m_valid_cells;
+  };
+
+} // namespace asp
+
+#endif//__STEREO_CAMERA_CACHED_PROJECTION_MODEL_H__
@@ -0,0 +1,285 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <asp/Camera/CameraCache.h>
+#include <boost/filesystem.hpp>
+#include <boost/functional/hash.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iterator>
+
+namespace fs = boost::filesystem;
+using namespace vw;
+
+namespace asp {
+
+namespace {
+
+  // Changes whenever the layout of the cache files changes
+  const std::string CACHE_MAGIC = "ASP_CAMERA_CACHE_1";
+
+  template <class T>
+  void write_pod(std::ostream & os, T const& val) {
+    os.write(reinterpret_cast<const char*>(&val), sizeof(T));
+  }
+  template <class T>
+  void read_pod(std::istream & is, T & val) {
+    is.read(reinterpret_cast<char*>(&val), sizeof(T));
+  }
+
+  // Vectors and quaternions, element by element
+  template <class VecT>
+  void write_vec(std::ostream & os, VecT const& vec, int len) {
+    for (int i = 0; i < len; i++)
+      write_pod(os, double(vec[i]));
+  }
+  template <class VecT>
+  void read_vec(std::istream & is, VecT & vec, int len) {
+    for (int i = 0; i < len; i++) {
+      double val = 0;
+      read_pod(is, val);
+      vec[i] = val;
+    }
+  }
+
+  template <class VecT>
+  void write_vec_list(std::ostream & os, std::vector<VecT> const& vals, int len) {
+    write_pod(os, vw::uint64(vals.size()));
+    for (size_t i = 0; i < vals.size(); i++)
+      write_vec(os, vals[i], len);
+  }
+  template <class VecT>
+  void read_vec_list(std::istream & is, std::vector<VecT> & vals, int len) {
+    vw::uint64 num = 0;
+    read_pod(is, num);
+    if (!is || num > (vw::uint64(1) << 32))
+      vw_throw(IOErr() << "Invalid camera cache file.\n");
+    vals.resize(num);
+    for (size_t i = 0; i < vals.size(); i++)
+      read_vec(is, vals[i], len);
+  }
+
+  void write_string(std::ostream & os, std::string const& str) {
+    write_pod(os, vw::uint64(str.size()));
+    os.write(str.data(), str.size());
+  }
+  void read_string(std::istream & is, std::string & str) {
+    vw::uint64 num = 0;
+    read_pod(is, num);
+    if (!is || num > (vw::uint64(1) << 20))
+      vw_throw(IOErr() << "Invalid camera cache file.\n");
+    str.resize(num);
+    if (num > 0)
+      is.read(&str[0], num);
+  }
+
+  // Open a cache file and check its header
+  bool open_cache(std::string const& cache_file, std::string const& camera_type,
+                  std::ifstream & is) {
+    if (cache_file == "" || !fs::exists(cache_file))
+      return false;
+    is.open(cache_file.c_str(), std::ios::binary);
+    std::string magic, type;
+    try {
+      read_string(is, magic);
+      read_string(is, type);
+    } catch (...) {
+      return false;
+    }
+    return is && magic == CACHE_MAGIC && type == camera_type;
+  }
+
+  // Write a cache file under a temporary name, then rename it
+  template <class WriteFuncT>
+  void write_cache(std::string const& cache_file, std::string const& camera_type,
+                   WriteFuncT const& write_func) {
+    if (cache_file == "")
+      return;
+    try {
+      fs::path tmp_file = fs::path(cache_file).parent_path() /
+        fs::unique_path(fs::path(cache_file).filename().string() + ".tmp-%%%%-%%%%");
+      {
+        std::ofstream os(tmp_file.string().c_str(), std::ios::binary);
+        write_string(os, CACHE_MAGIC);
+        write_string(os, camera_type);
+        write_func(os);
+        if (!os)
+          vw_throw(IOErr() << "Failed to write: " << tmp_file.string() << "\n");
+      }
+      fs::rename(tmp_file, cache_file);
+    } catch (const std::exception& e) {
+      vw_out(WarningMessage) << "Could not save the camera model cache file "
+                             << cache_file << ": " << e.what() << std::endl;
+    }
+  }
+
+  struct DGWriter {
+    DGCameraParams const& p;
+    DGWriter(DGCameraParams const& params): p(params) {}
+    void operator()(std::ostream & os) const {
+      write_vec_list(os, p.positions,  3);
+      write_vec_list(os, p.velocities, 3);
+      write_vec_list(os, p.poses,      4);
+      write_pod(os, p.position_t0);
+      write_pod(os, p.position_dt);
+      write_pod(os, p.pose_t0);
+      write_pod(os, p.pose_dt);
+      write_pod(os, vw::uint64(p.tlc.size()));
+      for (size_t i = 0; i < p.tlc.size(); i++) {
+        write_pod(os, p.tlc[i].first);
+        write_pod(os, p.tlc[i].second);
+      }
+      write_pod(os, p.tlc_t0);
+      write_vec(os, p.image_size, 2);
+      write_vec(os, p.detector_origin, 2);
+      write_pod(os, p.focal_length);
+    }
+  };
+
+  struct RPCWriter {
+    RPCModel const& m;
+    RPCWriter(RPCModel const& model): m(model) {}
+    void operator()(std::ostream & os) const {
+      cartography::Datum const& d = m.datum();
+      write_string(os, d.name());
+      write_string(os, d.spheroid_name());
+      write_string(os, d.meridian_name());
+      write_pod(os, d.semi_major_axis());
+      write_pod(os, d.semi_minor_axis());
+      write_pod(os, d.meridian_offset());
+      write_vec(os, m.line_num_coeff(),   20);
+      write_vec(os, m.line_den_coeff(),   20);
+      write_vec(os, m.sample_num_coeff(), 20);
+      write_vec(os, m.sample_den_coeff(), 20);
+      write_vec(os, m.xy_offset(),           2);
+      write_vec(os, m.xy_scale(),            2);
+      write_vec(os, m.lonlatheight_offset(), 3);
+      write_vec(os, m.lonlatheight_scale(),  3);
+    }
+  };
+
+} // end anonymous namespace
+
+std::string camera_cache_file(std::string const& cache_dir,
+                              std::string const& xml_file,
+                              std::string const& camera_type) {
+  if (cache_dir == "")
+    return "";
+
+  // Hashing the contents takes a small fraction of the time parsing
+  // them would, and catches changed files with the same time stamp.
+  std::ifstream is(xml_file.c_str(), std::ios::binary);
+  if (!is)
+    return "";
+  std::string contents((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+  std::size_t key = boost::hash_range(contents.begin(), contents.end());
+  boost::hash_combine(key, camera_type);
+
+  std::ostringstream name;
+  name << fs::path(xml_file).stem().string() << "-" << std::hex << std::setw(16)
+       << std::setfill('0') << key << "." << camera_type << ".cache";
+  try {
+    fs::create_directories(cache_dir);
+  } catch (const std::exception& e) {
+    vw_out(WarningMessage) << "Could not create the camera model cache directory "
+                           << cache_dir << ": " << e.what() << std::endl;
+    return "";
+  }
+  return (fs::path(cache_dir) / name.str()).string();
+}
+
+bool read_cached_dg_params(std::string const& cache_file, DGCameraParams & p) {
+  std::ifstream is;
+  if (!open_cache(cache_file, "dg", is))
+    return false;
+  try {
+    read_vec_list(is, p.positions,  3);
+    read_vec_list(is, p.velocities, 3);
+    read_vec_list(is, p.poses,      4);
+    read_pod(is, p.position_t0);
+    read_pod(is, p.position_dt);
+    read_pod(is, p.pose_t0);
+    read_pod(is, p.pose_dt);
+    vw::uint64 num = 0;
+    read_pod(is, num);
+    if (!is || num > (vw::uint64(1) << 32))
+      return false;
+    p.tlc.resize(num);
+    for (size_t i = 0; i < p.tlc.size(); i++) {
+      read_pod(is, p.tlc[i].first);
+      read_pod(is, p.tlc[i].second);
+    }
+    read_pod(is, p.tlc_t0);
+    read_vec(is, p.image_size, 2);
+    read_vec(is, p.detector_origin, 2);
+    read_pod(is, p.focal_length);
+  } catch (...) {
+    return false;
+  }
+  return bool(is);
+}
+
+void write_cached_dg_params(std::string const& cache_file, DGCameraParams const& params) {
+  write_cache(cache_file, "dg", DGWriter(params));
+}
+
+bool read_cached_rpc_model(std::string const& cache_file,
+                           boost::shared_ptr<RPCModel> & model) {
+  std::ifstream is;
+  if (!open_cache(cache_file, "rpc", is))
+    return false;
+  try {
+    std::string name, spheroid_name, meridian_name;
+    double semi_major = 0, semi_minor = 0, meridian_offset = 0;
+    read_string(is, name);
+    read_string(is, spheroid_name);
+    read_string(is, meridian_name);
+    read_pod(is, semi_major);
+    read_pod(is, semi_minor);
+    read_pod(is, meridian_offset);
+    RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
+    Vector2 xy_offset, xy_scale;
+    Vector3 llh_offset, llh_scale;
+    read_vec(is, line_num, 20);
+    read_vec(is, line_den, 20);
+    read_vec(is, samp_num, 20);
+    read_vec(is, samp_den, 20);
+    read_vec(is, xy_offset,  2);
+    read_vec(is, xy_scale,   2);
+    read_vec(is, llh_offset, 3);
+    read_vec(is, llh_scale,  3);
+    if (!is)
+      return false;
+    cartography::Datum datum(name, spheroid_name, meridian_name,
+                             semi_major, semi_minor, meridian_offset);
+    model.reset(new RPCModel(datum, line_num, line_den, samp_num, samp_den,
+                             xy_offset, xy_scale, llh_offset, llh_scale));
+  } catch (...) {
+    return false;
+  }
+  return true;
+}
+
+void write_cached_rpc_model(std::string const& cache_file, RPCModel const& model) {
+  write_cache(cache_file, "rpc", RPCWriter(model));
+}
+
+} // namespace asp
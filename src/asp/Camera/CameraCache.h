@@ -0,0 +1,61 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file CameraCache.h
+///
+/// A cache of camera models loaded from XML files, saved in a compact
+/// binary form, so that the many processes of a run which load the
+/// same cameras parse the XML only once. Each cache file is named after
+/// a hash of the contents of the XML file, so a changed XML file is
+/// parsed again. The binary form is meant to be read on the machine
+/// which wrote it, and it is not a portable exchange format.
+
+#ifndef __ASP_CAMERA_CAMERA_CACHE_H__
+#define __ASP_CAMERA_CAMERA_CACHE_H__
+
+#include <asp/Camera/LinescanDGModel.h>
+#include <asp/Camera/RPCModel.h>
+#include <boost/shared_ptr.hpp>
+#include <string>
+
+namespace asp {
+
+  /// The file in the cache directory for the camera of the given type
+  /// read from the given XML file.
+  std::string camera_cache_file(std::string const& cache_dir,
+                                std::string const& xml_file,
+                                std::string const& camera_type);
+
+  /// Read the DG camera values from a cache file. Returns false if the
+  /// file does not exist or is not valid.
+  bool read_cached_dg_params(std::string const& cache_file, DGCameraParams & params);
+
+  /// Save the DG camera values to a cache file. The file is written
+  /// under a temporary name and then renamed, so that processes
+  /// reading it at the same time never see a partial file.
+  void write_cached_dg_params(std::string const& cache_file, DGCameraParams const& params);
+
+  /// As read_cached_dg_params(), for an RPC camera.
+  bool read_cached_rpc_model(std::string const& cache_file,
+                             boost::shared_ptr<RPCModel> & model);
+
+  /// As write_cached_dg_params(), for an RPC camera.
+  void write_cached_rpc_model(std::string const& cache_file, RPCModel const& model);
+
+} // namespace asp
+
+#endif//__ASP_CAMERA_CAMERA_CACHE_H__
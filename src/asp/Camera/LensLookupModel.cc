@@ -0,0 +1,242 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Thread.h>
+#include <vw/Camera/LensDistortion.h>
+#include <asp/Camera/LensLookupModel.h>
+
+#include <limits>
+#include <cmath>
+#include <map>
+#include <sstream>
+#include <typeinfo>
+
+using namespace vw;
+
+namespace asp {
+
+namespace {
+
+  inline bool is_valid(Vector2 const& pix) {
+    return pix[0] == pix[0] && pix[1] == pix[1]; // false for NaN
+  }
+
+  // The exact maps which are tabulated. Both go through the ray of the
+  // pixel, as the pinhole model has no direct lens distortion interface
+  // in pixel units.
+  struct UndistortFunctor {
+    camera::PinholeModel const& m_exact, & m_ideal;
+    UndistortFunctor(camera::PinholeModel const& exact, camera::PinholeModel const& ideal):
+      m_exact(exact), m_ideal(ideal) {}
+    Vector2 operator()(Vector2 const& pix) const {
+      return m_ideal.point_to_pixel(m_exact.camera_center(pix) + m_exact.pixel_to_vector(pix));
+    }
+  };
+
+  struct DistortFunctor {
+    camera::PinholeModel const& m_exact, & m_ideal;
+    DistortFunctor(camera::PinholeModel const& exact, camera::PinholeModel const& ideal):
+      m_exact(exact), m_ideal(ideal) {}
+    Vector2 operator()(Vector2 const& pix) const {
+      return m_exact.point_to_pixel(m_ideal.camera_center(pix) + m_ideal.pixel_to_vector(pix));
+    }
+  };
+
+  // Evaluate the exact map at the grid nodes, then validate each cell
+  // by comparing the interpolated and exact values at its center.
+  template <class FunctorT>
+  void fill_grid(FunctorT const& func, double max_pixel_error, PixelLookupGrid & grid) {
+
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    ImageView<Vector2> & nodes = grid.nodes();
+    for (int j = 0; j < nodes.rows(); j++) {
+      for (int i = 0; i < nodes.cols(); i++) {
+        Vector2 val(nan, nan);
+        try {
+          val = func(grid.node_position(i, j));
+        } catch(...) {}
+        nodes(i, j) = val;
+      }
+    }
+
+    ImageView<uint8> & valid_cells = grid.valid_cells();
+    for (int j = 0; j < valid_cells.rows(); j++) {
+      for (int i = 0; i < valid_cells.cols(); i++) {
+        valid_cells(i, j) = 1; // Needed by interpolate() below
+        Vector2 pix = grid.node_position(i + 0.5, j + 0.5);
+        Vector2 interp_val;
+        bool success = grid.interpolate(pix, interp_val);
+        if (success) {
+          try {
+            success = (norm_2(func(pix) - interp_val) <= max_pixel_error);
+          } catch(...) {
+            success = false;
+          }
+        }
+        valid_cells(i, j) = success;
+      }
+    }
+  }
+
+  // The tables made so far, by intrinsics
+  Mutex g_lens_table_mutex;
+  std::map<std::string, boost::shared_ptr<LensLookupTable const> > g_lens_tables;
+}
+
+void PixelLookupGrid::set_box(BBox2 const& box, double spacing) {
+  if (box.empty() || spacing <= 0)
+    vw_throw( ArgumentErr() << "PixelLookupGrid: Invalid box or spacing.\n" );
+  m_origin  = box.min();
+  m_spacing = spacing;
+  // Need at least two nodes in each direction to interpolate
+  int cols = std::max(int(ceil(box.width()  / spacing)) + 1, 2);
+  int rows = std::max(int(ceil(box.height() / spacing)) + 1, 2);
+  m_nodes.set_size(cols, rows);
+  m_valid_cells.set_size(cols - 1, rows - 1);
+  for (int j = 0; j < m_valid_cells.rows(); j++)
+    for (int i = 0; i < m_valid_cells.cols(); i++)
+      m_valid_cells(i, j) = 0;
+}
+
+bool PixelLookupGrid::interpolate(Vector2 const& pix, Vector2 & value) const {
+
+  if (m_nodes.cols() < 2 || m_nodes.rows() < 2)
+    return false;
+
+  // Fractional grid position
+  double x = (pix[0] - m_origin[0]) / m_spacing;
+  double y = (pix[1] - m_origin[1]) / m_spacing;
+  if (!(x >= 0 && y >= 0 && x <= m_nodes.cols() - 1 && y <= m_nodes.rows() - 1))
+    return false;
+
+  int i = std::min(int(floor(x)), m_nodes.cols() - 2);
+  int j = std::min(int(floor(y)), m_nodes.rows() - 2);
+  if (!m_valid_cells(i, j))
+    return false;
+
+  double s = x - i, t = y - j;
+  value = (1-s)*(1-t)*m_nodes(i, j  ) + s*(1-t)*m_nodes(i+1, j  )
+        + (1-s)*t    *m_nodes(i, j+1) + s*t    *m_nodes(i+1, j+1);
+
+  return is_valid(value);
+}
+
+double PixelLookupGrid::fraction_of_valid_cells() const {
+  double num_total = double(m_valid_cells.cols()) * m_valid_cells.rows();
+  if (num_total == 0)
+    return 0.0;
+  double num_valid = 0;
+  for (int j = 0; j < m_valid_cells.rows(); j++)
+    for (int i = 0; i < m_valid_cells.cols(); i++)
+      num_valid += m_valid_cells(i, j);
+  return num_valid / num_total;
+}
+
+LensLookupTable::LensLookupTable(camera::PinholeModel const& model,
+                                 BBox2i const& image_box,
+                                 double spacing, double max_pixel_error) {
+
+  camera::PinholeModel ideal_model = model;
+  ideal_model.set_lens_distortion(camera::NullLensDistortion());
+
+  // Sample a bit beyond the image, as features and disparities can be
+  // there, and so that the pixels at the boundary have a full cell.
+  BBox2 box(image_box.min(), image_box.max());
+  box.expand(spacing);
+  m_undistort.set_box(box, spacing);
+  fill_grid(UndistortFunctor(model, ideal_model), max_pixel_error, m_undistort);
+
+  // The distortion table covers the undistorted image
+  BBox2 undist_box;
+  ImageView<Vector2> const& nodes = m_undistort.nodes();
+  for (int j = 0; j < nodes.rows(); j++)
+    for (int i = 0; i < nodes.cols(); i++)
+      if (is_valid(nodes(i, j)))
+        undist_box.grow(nodes(i, j));
+  if (undist_box.empty())
+    vw_throw( ArgumentErr() << "LensLookupTable: Could not undistort any pixels.\n" );
+  m_distort.set_box(undist_box, spacing);
+  fill_grid(DistortFunctor(model, ideal_model), max_pixel_error, m_distort);
+
+  vw_out() << "Lens lookup table: using interpolation for "
+           << 100.0*m_undistort.fraction_of_valid_cells() << "% of undistortion and "
+           << 100.0*m_distort.fraction_of_valid_cells()   << "% of distortion cells.\n";
+}
+
+LensLookupModel::LensLookupModel(boost::shared_ptr<camera::PinholeModel> exact_model,
+                                 boost::shared_ptr<LensLookupTable const> table):
+  m_exact_model(exact_model), m_table(table) {
+  if (!m_exact_model || !m_table)
+    vw_throw( ArgumentErr() << "LensLookupModel: Expecting a valid camera and table.\n" );
+  m_ideal_model = *m_exact_model;
+  m_ideal_model.set_lens_distortion(camera::NullLensDistortion());
+}
+
+Vector2 LensLookupModel::point_to_pixel(Vector3 const& point) const {
+  Vector2 pix;
+  if (m_table->distort(m_ideal_model.point_to_pixel(point), pix))
+    return pix;
+  return m_exact_model->point_to_pixel(point);
+}
+
+Vector3 LensLookupModel::pixel_to_vector(Vector2 const& pix) const {
+  Vector2 undist_pix;
+  if (m_table->undistort(pix, undist_pix))
+    return m_ideal_model.pixel_to_vector(undist_pix);
+  return m_exact_model->pixel_to_vector(pix);
+}
+
+boost::shared_ptr<camera::CameraModel>
+lens_lookup_model(boost::shared_ptr<camera::CameraModel> cam,
+                  BBox2i const& image_box,
+                  double spacing, double max_pixel_error) {
+
+  boost::shared_ptr<camera::PinholeModel> pin
+    = boost::dynamic_pointer_cast<camera::PinholeModel>(cam);
+  if (!pin || spacing <= 0)
+    return cam;
+  camera::LensDistortion const* distortion = pin->lens_distortion();
+  if (distortion == NULL ||
+      dynamic_cast<camera::NullLensDistortion const*>(distortion) != NULL)
+    return cam; // Nothing to speed up
+
+  // The table depends only on the intrinsics, not on the pose
+  std::ostringstream key;
+  key.precision(17);
+  key << typeid(*distortion).name() << " " << distortion->distortion_parameters() << " "
+      << pin->focal_length() << " " << pin->point_offset() << " " << pin->pixel_pitch() << " "
+      << image_box << " " << spacing << " " << max_pixel_error;
+
+  boost::shared_ptr<LensLookupTable const> table;
+  {
+    Mutex::Lock lock(g_lens_table_mutex);
+    std::map<std::string, boost::shared_ptr<LensLookupTable const> >::iterator it
+      = g_lens_tables.find(key.str());
+    if (it != g_lens_tables.end()) {
+      table = it->second;
+    } else {
+      table.reset(new LensLookupTable(*pin, image_box, spacing, max_pixel_error));
+      g_lens_tables[key.str()] = table;
+    }
+  }
+
+  return boost::shared_ptr<camera::CameraModel>(new LensLookupModel(pin, table));
+}
+
+} // namespace asp
@@ -0,0 +1,142 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+/// \file LensLookupModel.h
+///
+/// A pinhole camera wrapper which replaces the lens distortion model,
+/// and in particular its iterative inversion, with lookup tables.
+///
+/// For most lens distortion models going in one direction, between the
+/// distorted and undistorted pixels, requires an iterative solver, which
+/// is invoked for every pixel during alignment, triangulation, and
+/// mapprojection. Both directions only depend on the intrinsics, so they
+/// are sampled once on a grid over the image and shared by all cameras
+/// with the same intrinsics, such as frames taken with the same lens.
+/// In between the grid nodes bilinear interpolation is used. Grid cells
+/// whose interpolation error, measured at cell centers, exceeds a given
+/// bound, as well as pixels outside the grid, fall back to the exact model.
+
+#ifndef __STEREO_CAMERA_LENS_LOOKUP_MODEL_H__
+#define __STEREO_CAMERA_LENS_LOOKUP_MODEL_H__
+
+#include <vw/Math/Vector.h>
+#include <vw/Math/BBox.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Camera/CameraModel.h>
+#include <vw/Camera/PinholeModel.h>
+
+#include <boost/shared_ptr.hpp>
+
+namespace asp {
+
+  /// A grid of pixel values with bilinear interpolation and a per-cell
+  /// validity flag.
+  class PixelLookupGrid {
+  public:
+    PixelLookupGrid(): m_spacing(1.0) {}
+
+    /// Allocate the nodes covering the given box. All start as invalid.
+    void set_box(vw::BBox2 const& box, double spacing);
+
+    /// The pixel position of a node.
+    vw::Vector2 node_position(double i, double j) const {
+      return m_origin + m_spacing*vw::Vector2(i, j);
+    }
+
+    vw::ImageView<vw::Vector2>       & nodes()       { return m_nodes; }
+    vw::ImageView<vw::Vector2> const & nodes() const { return m_nodes; }
+    vw::ImageView<vw::uint8>         & valid_cells()       { return m_valid_cells; }
+
+    /// Interpolate at the given pixel. Return false outside the grid or
+    /// in a cell which is not valid.
+    bool interpolate(vw::Vector2 const& pix, vw::Vector2 & value) const;
+
+    /// The fraction of cells where interpolation is used.
+    double fraction_of_valid_cells() const;
+
+  private:
+    vw::Vector2 m_origin;
+    double      m_spacing;
+    vw::ImageView<vw::Vector2> m_nodes;       ///< NaN where the exact model failed
+    vw::ImageView<vw::uint8>   m_valid_cells;
+  };
+
+  /// Undistort and distort pixels of a pinhole camera by interpolation.
+  class LensLookupTable {
+  public:
+
+    /// Sample the lens distortion of the given camera over the given
+    /// pixel box, with nodes every this many pixels. Cells with an
+    /// interpolation error larger than max_pixel_error are not used.
+    LensLookupTable(vw::camera::PinholeModel const& model,
+                    vw::BBox2i const& image_box,
+                    double spacing, double max_pixel_error);
+
+    /// From a pixel in the image to the pixel of the same ray for the
+    /// camera without distortion. Return false if not in the table.
+    bool undistort(vw::Vector2 const& pix, vw::Vector2 & undist_pix) const {
+      return m_undistort.interpolate(pix, undist_pix);
+    }
+
+    /// The inverse of undistort().
+    bool distort(vw::Vector2 const& undist_pix, vw::Vector2 & pix) const {
+      return m_distort.interpolate(undist_pix, pix);
+    }
+
+  private:
+    PixelLookupGrid m_undistort, m_distort;
+  };
+
+  class LensLookupModel : public vw::camera::CameraModel {
+  public:
+
+    /// The table must have been made for the intrinsics of this camera.
+    LensLookupModel(boost::shared_ptr<vw::camera::PinholeModel> exact_model,
+                    boost::shared_ptr<LensLookupTable const> table);
+
+    virtual ~LensLookupModel() {}
+    virtual std::string type() const { return "LensLookup"; }
+
+    virtual vw::Vector2 point_to_pixel (vw::Vector3 const& point) const;
+    virtual vw::Vector3 pixel_to_vector(vw::Vector2 const& pix) const;
+
+    virtual vw::Vector3 camera_center(vw::Vector2 const& pix = vw::Vector2()) const {
+      return m_exact_model->camera_center(pix);
+    }
+    virtual vw::Quat camera_pose(vw::Vector2 const& pix = vw::Vector2()) const {
+      return m_exact_model->camera_pose(pix);
+    }
+
+    boost::shared_ptr<vw::camera::PinholeModel> exact_model() const { return m_exact_model; }
+
+  private:
+    boost::shared_ptr<vw::camera::PinholeModel> m_exact_model;
+    vw::camera::PinholeModel                     m_ideal_model; ///< Same, without distortion
+    boost::shared_ptr<LensLookupTable const>     m_table;
+  };
+
+  /// If the camera is a pinhole model with lens distortion, return it
+  /// wrapped in a LensLookupModel, with a table which is made once for
+  /// each set of intrinsics and image box and then shared. Otherwise
+  /// return the camera itself.
+  boost::shared_ptr<vw::camera::CameraModel>
+  lens_lookup_model(boost::shared_ptr<vw::camera::CameraModel> cam,
+                    vw::BBox2i const& image_box,
+                    double spacing, double max_pixel_error);
+
+} // namespace asp
+
+#endif//__STEREO_CAMERA_LENS_LOOKUP_MODEL_H__
@@ -19,6 +19,7 @@
 #include <asp/Camera/ASTER_XML.h>
 #include <vw/Camera/CameraSolve.h>
 #include <asp/Camera/LinescanASTERModel.h>
+#include <asp/Camera/LinescanSolve.h>
 namespace asp {
 
 using namespace vw;
@@ -105,13 +106,44 @@ ASTERCameraModel::ASTERCameraModel(std::vector< std::vector<vw::Vector2> > const
 #endif
 }
 
-// Project the point onto the camera. Sometimes, but not always, seeding with the RPC
-// model is beneficial.  
+// Project the point onto the camera. First solve once from a guess
+// found with a 1D search for the line, started at the provided line or
+// at the last pixel found by this thread. If that fails, search for a
+// guess in the lattice, and also try seeding with the RPC model, which
+// is sometimes, but not always, beneficial.
 vw::Vector2 ASTERCameraModel::point_to_pixel(Vector3 const& point, Vector2 const& start_in) const {
 
   // - This method will be slower but works for more complicated geometries
   vw::camera::CameraGenericLMA model( this, point );
   int status;
+
+  // Solver constants
+  const double ABS_TOL = 1e-16;
+  const double REL_TOL = 1e-16;
+  const int    MAX_ITERATIONS = 1e+5;
+  const double MAX_ERROR = 1e-2;
+  Vector3 objective(0, 0, 0);
+
+  vw::Vector2 fast_start = m_image_size / 2.0;
+  if (start_in[0] >= 0)
+    fast_start[0] = start_in[0];
+  if (start_in[1] >= 0) {
+    fast_start[1] = start_in[1];
+  } else {
+    vw::Vector2 last = m_seed_cache.last_pixel();
+    if (last[1] == last[1]) // not NaN
+      fast_start[1] = last[1];
+  }
+  vw::Vector2 seed;
+  if (linescan_point_to_pixel_seed(this, point, m_image_size, fast_start[1], seed))
+    fast_start = seed;
+  vw::Vector2 fast_solution = vw::math::levenberg_marquardt(model, fast_start, objective, status,
+                                                            ABS_TOL, REL_TOL, MAX_ITERATIONS);
+  if ( (status > 0) && (norm_2(model(fast_solution)) < MAX_ERROR) ) {
+    m_seed_cache.set_last_pixel(fast_solution);
+    return fast_solution;
+  }
+
   vw::Vector2 start = m_image_size / 2.0; // Use the center as the initial guess
 
   bool has_guess = false;
@@ -180,16 +212,9 @@ vw::Vector2 ASTERCameraModel::point_to_pixel(Vector3 const& point, Vector2 const
   }
 #endif
 
-  // Solver constants
-  const double ABS_TOL = 1e-16;
-  const double REL_TOL = 1e-16;
-  const int    MAX_ITERATIONS = 1e+5;
-  const double MAX_ERROR = 1e-2;
-
   // Try two initial guesses. TODO: Study this in more detail.
   
   // Solution with user-provided initial guess
-  Vector3 objective(0, 0, 0);
   vw::Vector2 solution1 = vw::math::levenberg_marquardt(model, start, objective, status,
 							ABS_TOL, REL_TOL, MAX_ITERATIONS);
   
@@ -204,18 +229,16 @@ vw::Vector2 ASTERCameraModel::point_to_pixel(Vector3 const& point, Vector2 const
   double error2 = norm_2(model(solution2));
   double error  = std::min(error1, error2);
   
-  vw::Vector2 solution;
-  if (error1 < error2) {
+  vw::Vector2 solution = solution2;
+  if (error1 <= error2)
     solution = solution1;
-  } else if (error1 > error2) {
-    solution = solution2;
-  }
   
   // Check the error - If it is too high then the solver probably got
   // stuck at the edge of the image.
   VW_ASSERT( (status > 0) && (error < MAX_ERROR),
              vw::camera::PointToPixelErr() << "Unable to project point into LinescanASTER model" );
   
+  m_seed_cache.set_last_pixel(solution);
   return solution;
 }
 
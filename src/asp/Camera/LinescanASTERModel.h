@@ -29,6 +29,7 @@
 #include <vw/Camera/LinescanModel.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/Extrinsics.h>
+#include <asp/Camera/LinescanPoseCache.h>
 
 
 namespace asp {
@@ -89,6 +90,7 @@ namespace asp {
     vw::camera::LinearPiecewisePositionInterpolation m_interp_sat_pos;
     vw::camera::SlerpGridPointingInterpolation m_interp_sight_mat;
     boost::shared_ptr<vw::camera::CameraModel> m_rpc_model; // rpc approx, for initial guess
+    LinescanPoseCache                          m_seed_cache; // last pixel found, per thread
   }; // End class ASTERCameraModel
 
 
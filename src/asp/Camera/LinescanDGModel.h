@@ -27,6 +27,7 @@
 #include <vw/Camera/LinescanModel.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/Extrinsics.h>
+#include <asp/Camera/LinescanPoseCache.h>
 
 namespace asp {
 
@@ -68,10 +69,17 @@ namespace asp {
 
     // -- This set of functions implements virtual functions from LinescanModel.h --
 
-    // Implement the functions from the LinescanModel class using functors
-    virtual vw::Vector3 get_camera_center_at_time  (double time) const { return m_position_func(time); }
-    virtual vw::Vector3 get_camera_velocity_at_time(double time) const { return m_velocity_func(time); }
-    virtual vw::Quat    get_camera_pose_at_time    (double time) const { return m_pose_func    (time); }
+    // Implement the functions from the LinescanModel class using functors.
+    // The values are cached, as all pixels on a line need them at the same time.
+    virtual vw::Vector3 get_camera_center_at_time  (double time) const {
+      return m_pose_cache.position(m_position_func, time);
+    }
+    virtual vw::Vector3 get_camera_velocity_at_time(double time) const {
+      return m_pose_cache.velocity(m_velocity_func, time);
+    }
+    virtual vw::Quat    get_camera_pose_at_time    (double time) const {
+      return m_pose_cache.pose(m_pose_func, time);
+    }
     virtual double      get_time_at_line           (double line) const { return m_time_func    (line); }
     
     /// As pixel_to_vector, but in the local camera frame.
@@ -121,6 +129,7 @@ namespace asp {
     vw::camera::LinearPiecewisePositionInterpolation m_velocity_func; ///< Yields velocity at time T
     PoseFuncT                                        m_pose_func;     ///< Yields pose     at time T
     vw::camera::TLCTimeInterpolation                 m_time_func;     ///< Yields time at a given line.
+    LinescanPoseCache                                m_pose_cache;    ///< The values at the last times asked for
 
     // Intrinsics
     
@@ -160,6 +169,27 @@ namespace asp {
   typedef LinescanDGModel<vw::camera::PiecewiseAPositionInterpolation,
                   			  vw::camera::SLERPPoseInterpolation> DGCameraModel;
 
+  /// The values a DG camera model is built from, as found from its XML
+  /// file. These can be saved and loaded without parsing the XML again.
+  struct DGCameraParams {
+    std::vector<vw::Vector3> positions, velocities; // the ephemeris
+    std::vector<vw::Quat>    poses;                 // the attitude
+    double position_t0, position_dt, pose_t0, pose_dt;
+    std::vector<std::pair<double,double> > tlc;     // line -> time offset pairings
+    double       tlc_t0;
+    vw::Vector2i image_size;
+    vw::Vector2  detector_origin; // in pixels
+    double       focal_length;    // in pixels
+  };
+
+  /// Find the values a DG camera model is built from by parsing its XML file.
+  /// - This function does not take care of Xerces XML init/de-init, the caller must
+  ///   make sure this is done before/after this function is called!
+  inline void read_dg_camera_params_from_xml(std::string const& path, DGCameraParams & params);
+
+  /// Build a DG camera model from the values found from its XML file.
+  inline boost::shared_ptr<DGCameraModel> dg_camera_model_from_params(DGCameraParams const& params);
+
   /// Load a DG camera model from an XML file.
   /// - This function does not take care of Xerces XML init/de-init, the caller must
   ///   make sure this is done before/after this function is called!
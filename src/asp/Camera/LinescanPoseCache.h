@@ -0,0 +1,165 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file LinescanPoseCache.h
+///
+/// The position, velocity, and pose of a linescan camera at the time
+/// each was last asked for. Images are processed one line at a time,
+/// and all pixels on a line are seen at the same time, so with this
+/// the interpolation is done once per line rather than once per pixel.
+/// The pixel last found by point_to_pixel() is kept as well, to seed
+/// the next solve, as consecutive points in a tile are close.
+/// Each thread has its own values, so no locking is needed to use
+/// them. The values are owned by the cache, and freed with it. Each
+/// thread finds them by the id of the cache, in a table of its own.
+
+#ifndef __ASP_CAMERA_LINESCAN_POSE_CACHE_H__
+#define __ASP_CAMERA_LINESCAN_POSE_CACHE_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Math/Vector.h>
+#include <vw/Math/Quaternion.h>
+#include <boost/thread/tss.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/cstdint.hpp>
+#include <limits>
+#include <map>
+#include <vector>
+
+namespace asp {
+
+  class LinescanPoseCache {
+  public:
+
+    LinescanPoseCache(): m_id(next_id()) {}
+
+    // A copy of a camera may have different functions, so it gets its own cache
+    LinescanPoseCache(LinescanPoseCache const& /*other*/): m_id(next_id()) {}
+    LinescanPoseCache& operator=(LinescanPoseCache const& /*other*/) {
+      vw::Mutex::Lock lock(m_mutex);
+      m_id = next_id();
+      m_entries.clear();
+      return *this;
+    }
+
+    /// The camera position at the given time, computed with the given
+    /// function unless it was last asked for at the same time.
+    template <class FuncT>
+    vw::Vector3 position(FuncT const& func, double time) const {
+      Entry & e = entry();
+      if (e.position_time != time) {
+        e.position      = func(time);
+        e.position_time = time;
+      }
+      return e.position;
+    }
+
+    /// The camera velocity, as for position().
+    template <class FuncT>
+    vw::Vector3 velocity(FuncT const& func, double time) const {
+      Entry & e = entry();
+      if (e.velocity_time != time) {
+        e.velocity      = func(time);
+        e.velocity_time = time;
+      }
+      return e.velocity;
+    }
+
+    /// The camera pose, as for position().
+    template <class FuncT>
+    vw::Quat pose(FuncT const& func, double time) const {
+      Entry & e = entry();
+      if (e.pose_time != time) {
+        e.pose      = func(time);
+        e.pose_time = time;
+      }
+      return e.pose;
+    }
+
+    /// The pixel last found by point_to_pixel() in this thread, or NaN.
+    vw::Vector2 last_pixel() const { return entry().last_pixel; }
+    void set_last_pixel(vw::Vector2 const& pix) const { entry().last_pixel = pix; }
+
+  private:
+
+    // The times start as NaN, which is not equal to any time
+    struct Entry {
+      double      position_time, velocity_time, pose_time;
+      vw::Vector3 position, velocity;
+      vw::Quat    pose;
+      vw::Vector2 last_pixel;
+      Entry(): position_time(std::numeric_limits<double>::quiet_NaN()),
+               velocity_time(std::numeric_limits<double>::quiet_NaN()),
+               pose_time    (std::numeric_limits<double>::quiet_NaN()),
+               last_pixel(std::numeric_limits<double>::quiet_NaN(),
+                          std::numeric_limits<double>::quiet_NaN()) {}
+    };
+
+    // The entries of the caches used by a thread, by the cache id.
+    // The entries of a destroyed cache have expired.
+    typedef std::map<boost::uint64_t, boost::weak_ptr<Entry> > EntryTable;
+
+    static boost::uint64_t next_id() {
+      static vw::Mutex id_mutex;
+      static boost::uint64_t id = 0;
+      vw::Mutex::Lock lock(id_mutex);
+      return ++id;
+    }
+
+    static EntryTable & thread_table() {
+      static boost::thread_specific_ptr<EntryTable> tables;
+      if (tables.get() == NULL)
+        tables.reset(new EntryTable());
+      return *tables;
+    }
+
+    Entry & entry() const {
+      EntryTable & table = thread_table();
+      EntryTable::iterator it = table.find(m_id);
+      if (it != table.end()) {
+        boost::shared_ptr<Entry> e = it->second.lock();
+        if (e)
+          return *e; // Kept alive by this cache
+      }
+
+      // Before adding an entry, drop those of the destroyed caches,
+      // so the table does not grow as cameras come and go.
+      for (EntryTable::iterator jt = table.begin(); jt != table.end();) {
+        if (jt->second.expired())
+          table.erase(jt++);
+        else
+          ++jt;
+      }
+
+      boost::shared_ptr<Entry> e(new Entry());
+      {
+        vw::Mutex::Lock lock(m_mutex);
+        m_entries.push_back(e);
+      }
+      table[m_id] = e;
+      return *e;
+    }
+
+    boost::uint64_t m_id;
+    mutable vw::Mutex m_mutex; // Guards adding to m_entries
+    mutable std::vector< boost::shared_ptr<Entry> > m_entries; // One per thread
+  };
+
+} // namespace asp
+
+#endif//__ASP_CAMERA_LINESCAN_POSE_CACHE_H__
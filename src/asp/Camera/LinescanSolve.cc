@@ -0,0 +1,90 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Camera/LinescanSolve.h>
+
+using namespace vw;
+
+namespace asp {
+
+ScanlineLMA::result_type ScanlineLMA::operator()(domain_type const& y) const {
+
+  // Stay within the image, where the camera is defined
+  double line = std::min(std::max(y[0], 0.0), m_image_size[1] - 1.0);
+
+  Vector3 first = m_model->pixel_to_vector(Vector2(0, line));
+  Vector3 last  = m_model->pixel_to_vector(Vector2(m_image_size[0] - 1.0, line));
+  Vector3 ctr   = m_model->camera_center (Vector2(m_image_size[0] / 2.0, line));
+
+  result_type result(1);
+  result[0] = dot_prod(normalize(cross_prod(first, last)), normalize(m_point - ctr));
+  return result;
+}
+
+namespace {
+  // The signed angle between the ray of a pixel and the direction to
+  // the point, within the scanline with the given normal.
+  double angle_along_line(camera::CameraModel const* model, Vector2 const& pix,
+                          Vector3 const& dir, Vector3 const& normal) {
+    return dot_prod(cross_prod(normalize(model->pixel_to_vector(pix)), dir), normal);
+  }
+}
+
+bool linescan_point_to_pixel_seed(camera::CameraModel const* model,
+                                  Vector3 const& point,
+                                  Vector2 const& image_size,
+                                  double start_line, Vector2 & seed) {
+
+  try {
+    // Solve for the line
+    ScanlineLMA lma(model, point, image_size);
+    int status = 0;
+    Vector<double> objective(1), start(1);
+    start[0] = std::min(std::max(start_line, 0.0), image_size[1] - 1.0);
+    const double ABS_TOL = 1e-16;
+    const double REL_TOL = 1e-16;
+    const int    MAX_ITERATIONS = 100;
+    Vector<double> solution = math::levenberg_marquardt(lma, start, objective, status,
+                                                         ABS_TOL, REL_TOL, MAX_ITERATIONS);
+    double line = solution[0];
+    if (status <= 0 || !(line >= 0 && line <= image_size[1] - 1.0))
+      return false;
+
+    // Find the column. The angle to the point changes almost linearly
+    // along the line, so a few secant steps are enough.
+    Vector3 first  = model->pixel_to_vector(Vector2(0, line));
+    Vector3 last   = model->pixel_to_vector(Vector2(image_size[0] - 1.0, line));
+    Vector3 normal = normalize(cross_prod(first, last));
+    Vector3 dir    = normalize(point - model->camera_center(Vector2(image_size[0] / 2.0, line)));
+
+    double x0 = 0, x1 = image_size[0] - 1.0;
+    double a0 = angle_along_line(model, Vector2(x0, line), dir, normal);
+    double a1 = angle_along_line(model, Vector2(x1, line), dir, normal);
+    for (int it = 0; it < 3 && a1 != a0; it++) {
+      double x = x1 - a1*(x1 - x0)/(a1 - a0);
+      x0 = x1; a0 = a1;
+      x1 = x;  a1 = angle_along_line(model, Vector2(x1, line), dir, normal);
+    }
+
+    seed = Vector2(x1, line);
+    return (seed[0] == seed[0]); // false for NaN
+  } catch(...) {
+    return false;
+  }
+}
+
+} // namespace asp
@@ -0,0 +1,66 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+/// \file LinescanSolve.h
+///
+/// A cheap starting guess for projecting a point into a linescan
+/// camera. The full point_to_pixel() solver works in 2D and calls
+/// pixel_to_vector() many times, most of them while far from the
+/// solution. Instead, first find the image line whose scanline, the
+/// plane swept by the rays of the pixels on that line, contains the
+/// point. That is a 1D problem, as for DigitalGlobe's LinescanLMA. On
+/// that line the column is then found by interpolating the angle to
+/// the point across the line. The full solver started from there
+/// needs just a few iterations.
+
+#ifndef __STEREO_CAMERA_LINESCAN_SOLVE_H__
+#define __STEREO_CAMERA_LINESCAN_SOLVE_H__
+
+#include <vw/Math/Vector.h>
+#include <vw/Math/Matrix.h>
+#include <vw/Math/LevenbergMarquardt.h>
+#include <vw/Camera/CameraModel.h>
+
+namespace asp {
+
+  /// The signed angle between a point and the scanline of an image line.
+  class ScanlineLMA : public vw::math::LeastSquaresModelBase<ScanlineLMA> {
+    vw::camera::CameraModel const* m_model;
+    vw::Vector3 m_point;
+    vw::Vector2 m_image_size;
+  public:
+    typedef vw::Vector<double> result_type;   // 1D angle to the scanline
+    typedef result_type        domain_type;   // 1D line number
+    typedef vw::Matrix<double> jacobian_type;
+
+    ScanlineLMA(vw::camera::CameraModel const* model, vw::Vector3 const& point,
+                vw::Vector2 const& image_size):
+      m_model(model), m_point(point), m_image_size(image_size) {}
+
+    result_type operator()(domain_type const& y) const;
+  };
+
+  /// Find a starting pixel for point_to_pixel() with the above, with
+  /// the line search starting at the given line. Return false if it
+  /// failed, such as for points not seen by the image.
+  bool linescan_point_to_pixel_seed(vw::camera::CameraModel const* model,
+                                    vw::Vector3 const& point,
+                                    vw::Vector2 const& image_size,
+                                    double start_line, vw::Vector2 & seed);
+
+} // namespace asp
+
+#endif//__STEREO_CAMERA_LINESCAN_SOLVE_H__
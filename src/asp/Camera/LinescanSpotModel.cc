@@ -19,6 +19,7 @@
 #include <asp/Camera/SPOT_XML.h>
 #include <vw/Camera/CameraSolve.h>
 #include <asp/Camera/LinescanSpotModel.h>
+#include <asp/Camera/LinescanSolve.h>
 
 namespace asp {
 
@@ -33,9 +34,22 @@ vw::Vector2 SPOTCameraModel::point_to_pixel(Vector3 const& point, double starty)
   // - This method will be slower but works for more complicated geometries
   vw::camera::CameraGenericLMA model( this, point );
   int status;
-  vw::Vector2 start = m_image_size / 2.0; // Use the center as the initial guess
-  if (starty >= 0) // If the user provided a line number guess..
+  vw::Vector2 center = m_image_size / 2.0; // Use the center as the initial guess
+  vw::Vector2 start  = center;
+  if (starty >= 0) { // If the user provided a line number guess..
     start[1] = starty;
+  } else {
+    // Else continue from the last point projected by this thread,
+    // which is likely close.
+    vw::Vector2 last = m_pose_cache.last_pixel();
+    if (last[1] == last[1])
+      start[1] = last[1];
+  }
+
+  // Find the line with a 1D solver first, which is much cheaper
+  vw::Vector2 seed;
+  if (linescan_point_to_pixel_seed(this, point, m_image_size, start[1], seed))
+    start = seed;
 
   // Solver constants
   const double ABS_TOL = 1e-16;
@@ -46,16 +60,25 @@ vw::Vector2 SPOTCameraModel::point_to_pixel(Vector3 const& point, double starty)
   Vector3 objective(0, 0, 0);
   vw::Vector2 solution = vw::math::levenberg_marquardt(model, start, objective, status,
                                                ABS_TOL, REL_TOL, MAX_ITERATIONS);
-  // Check the error - If it is too high then the solver probably got stuck at the edge of the image.
   double  error = norm_2(model(solution));
+
+  // If that failed, try again from the image center, as before
+  if ( ((status <= 0) || !(error < MAX_ERROR)) && start != center ) {
+    solution = vw::math::levenberg_marquardt(model, center, objective, status,
+                                             ABS_TOL, REL_TOL, MAX_ITERATIONS);
+    error = norm_2(model(solution));
+  }
+  
+  // Check the error - If it is too high then the solver probably got stuck at the edge of the image.
   VW_ASSERT( (status > 0) && (error < MAX_ERROR),
 	           vw::camera::PointToPixelErr() << "Unable to project point into LinescanSPOT model" );
 
+  m_pose_cache.set_last_pixel(solution);
   return solution;
 }
 
 
-void SPOTCameraModel::check_time(double time, std::string const& location) const {
+void SPOTCameraModel::check_time(double time, const char* location) const {
   if ((time < m_min_time) || (time > m_max_time))
     vw::vw_throw(vw::ArgumentErr() << "SPOTCameraModel::"<<location
                  << ": Requested time "<<time<<" is out of bounds ("
@@ -64,15 +87,15 @@ void SPOTCameraModel::check_time(double time, std::string const& location) const
 
 vw::Vector3 SPOTCameraModel::get_camera_center_at_time(double time) const {
   check_time(time, "get_camera_center_at_time");
-  return m_position_func(time);
+  return m_pose_cache.position(m_position_func, time);
 }
 vw::Vector3 SPOTCameraModel::get_camera_velocity_at_time(double time) const { 
   check_time(time, "get_camera_velocity_at_time");
-  return m_velocity_func(time); 
+  return m_pose_cache.velocity(m_velocity_func, time);
 }
 vw::Quat SPOTCameraModel::get_camera_pose_at_time(double time) const {
   check_time(time, "get_camera_pose_at_time");
- return m_pose_func(time); 
+ return m_pose_cache.pose(m_pose_func, time);
 }
 double SPOTCameraModel::get_time_at_line(double line) const {
   if ((line < 0.0) || (static_cast<int>(line) >= m_image_size[1]))
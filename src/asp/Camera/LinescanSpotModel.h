@@ -28,6 +28,7 @@
 #include <vw/Camera/LinescanModel.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/Extrinsics.h>
+#include <asp/Camera/LinescanPoseCache.h>
 
 
 namespace asp {
@@ -157,6 +158,7 @@ namespace asp {
     vw::camera::LagrangianInterpolation m_velocity_func; ///< Yields velocity at time T
     vw::camera::SLERPPoseInterpolation  m_pose_func;     ///< Yields pose     at time T
     vw::camera::LinearTimeInterpolation m_time_func;     ///< Yields time at a given line.
+    LinescanPoseCache                   m_pose_cache;    ///< The values at the last times asked for
     
     // Intrinsics
     
@@ -171,7 +173,7 @@ namespace asp {
     
     /// Throw an exception if the input time is outside the given bounds.
     /// - Pass the caller location in to get a nice error message.
-    void check_time(double time, std::string const& location) const;
+    void check_time(double time, const char* location) const;
 
   }; // End class SPOTCameraModel
 
@@ -0,0 +1,91 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file RPCApproxModel.h
+///
+/// A camera model wrapper which speeds up point_to_pixel() by using an
+/// RPC model fit to the camera over the ground seen by the image.
+///
+/// Projecting into ISIS, DG, and other linescan cameras requires an
+/// iterative solver, while an RPC model is a ratio of polynomials.
+/// The RPC model is used within the lon-lat-height box it was fit in,
+/// and the exact camera outside of it. The functions from pixels to
+/// rays are passed through to the exact camera, as they are not
+/// iterative there, so triangulation is as accurate as before.
+
+#ifndef __STEREO_CAMERA_RPC_APPROX_MODEL_H__
+#define __STEREO_CAMERA_RPC_APPROX_MODEL_H__
+
+#include <asp/Camera/RPCModel.h>
+#include <vw/Camera/CameraModel.h>
+#include <boost/shared_ptr.hpp>
+#include <cmath>
+
+namespace asp {
+
+  class RPCApproxModel : public vw::camera::CameraModel {
+  public:
+
+    RPCApproxModel(boost::shared_ptr<vw::camera::CameraModel> exact_model,
+                   boost::shared_ptr<RPCModel> rpc_model):
+      m_exact_model(exact_model), m_rpc_model(rpc_model) {}
+
+    virtual ~RPCApproxModel() {}
+    virtual std::string type() const { return "RPCApprox"; }
+
+    virtual vw::Vector2 point_to_pixel(vw::Vector3 const& point) const {
+      vw::Vector3 llh = m_rpc_model->datum().cartesian_to_geodetic(point);
+      vw::Vector3 offset = m_rpc_model->lonlatheight_offset();
+      vw::Vector3 scale  = m_rpc_model->lonlatheight_scale();
+      for (int c = 0; c < 3; c++) {
+        if (std::abs(llh[c] - offset[c]) > scale[c])
+          return m_exact_model->point_to_pixel(point); // Outside of the fit box
+      }
+      return m_rpc_model->geodetic_to_pixel(llh);
+    }
+
+    // The remaining functions are not sped up, just passed through.
+    virtual vw::Vector3 pixel_to_vector(vw::Vector2 const& pix) const {
+      return m_exact_model->pixel_to_vector(pix);
+    }
+    virtual vw::Vector3 camera_center(vw::Vector2 const& pix = vw::Vector2()) const {
+      return m_exact_model->camera_center(pix);
+    }
+    virtual vw::Quat camera_pose(vw::Vector2 const& pix = vw::Vector2()) const {
+      return m_exact_model->camera_pose(pix);
+    }
+
+    boost::shared_ptr<vw::camera::CameraModel> exact_model() const { return m_exact_model; }
+    boost::shared_ptr<RPCModel>                rpc_model  () const { return m_rpc_model;   }
+
+  private:
+    boost::shared_ptr<vw::camera::CameraModel> m_exact_model;
+    boost::shared_ptr<RPCModel>                m_rpc_model;
+  };
+
+  /// The camera an RPC approximation was made of, or the camera itself
+  /// if it is not an approximation.
+  inline vw::camera::CameraModel const* exact_camera_model(vw::camera::CameraModel const* cam) {
+    RPCApproxModel const* approx_cam = dynamic_cast<RPCApproxModel const*>(cam);
+    if (approx_cam != NULL)
+      return approx_cam->exact_model().get();
+    return cam;
+  }
+
+} // namespace asp
+
+#endif//__STEREO_CAMERA_RPC_APPROX_MODEL_H__
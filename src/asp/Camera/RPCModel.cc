@@ -143,6 +143,89 @@ namespace asp {
                                                    );
   }
 
+  void RPCModel::normalized_geodetic_to_normalized_pixel
+  (size_t num_pts, double const* x, double const* y, double const* z,
+   RPCModel::CoeffVec const& line_num_coeff,
+   RPCModel::CoeffVec const& line_den_coeff,
+   RPCModel::CoeffVec const& sample_num_coeff,
+   RPCModel::CoeffVec const& sample_den_coeff,
+   double * col, double * row){
+
+    // Copy the coefficients to plain arrays so that the loop below
+    // has no dependencies other than on the current point.
+    double ln[20], ld[20], sn[20], sd[20];
+    for (int k = 0; k < 20; k++) {
+      ln[k] = line_num_coeff[k];   ld[k] = line_den_coeff[k];
+      sn[k] = sample_num_coeff[k]; sd[k] = sample_den_coeff[k];
+    }
+
+    for (size_t i = 0; i < num_pts; i++) {
+
+      // Same terms as in calculate_terms()
+      double xi = x[i], yi = y[i], zi = z[i];
+      double t[20];
+      t[ 0] = 1.0;      t[ 1] = xi;       t[ 2] = yi;       t[ 3] = zi;
+      t[ 4] = xi*yi;    t[ 5] = xi*zi;    t[ 6] = yi*zi;    t[ 7] = xi*xi;
+      t[ 8] = yi*yi;    t[ 9] = zi*zi;    t[10] = xi*yi*zi; t[11] = xi*xi*xi;
+      t[12] = xi*yi*yi; t[13] = xi*zi*zi; t[14] = xi*xi*yi; t[15] = yi*yi*yi;
+      t[16] = yi*zi*zi; t[17] = xi*xi*zi; t[18] = yi*yi*zi; t[19] = zi*zi*zi;
+
+      double lnv = 0, ldv = 0, snv = 0, sdv = 0;
+      for (int k = 0; k < 20; k++) {
+        lnv += ln[k]*t[k]; ldv += ld[k]*t[k];
+        snv += sn[k]*t[k]; sdv += sd[k]*t[k];
+      }
+
+      col[i] = snv/sdv;
+      row[i] = lnv/ldv;
+    }
+  }
+
+  void RPCModel::geodetic_to_pixel(size_t num_pts, double const* lon, double const* lat,
+                                   double const* height, double * col, double * row) const {
+
+    if (num_pts == 0)
+      return;
+
+    std::vector<double> x(num_pts), y(num_pts), z(num_pts);
+    for (size_t i = 0; i < num_pts; i++) {
+      x[i] = (lon[i]    - m_lonlatheight_offset[0]) / m_lonlatheight_scale[0];
+      y[i] = (lat[i]    - m_lonlatheight_offset[1]) / m_lonlatheight_scale[1];
+      z[i] = (height[i] - m_lonlatheight_offset[2]) / m_lonlatheight_scale[2];
+    }
+
+    normalized_geodetic_to_normalized_pixel(num_pts, &x[0], &y[0], &z[0],
+                                            m_line_num_coeff, m_line_den_coeff,
+                                            m_sample_num_coeff, m_sample_den_coeff,
+                                            col, row);
+
+    for (size_t i = 0; i < num_pts; i++) {
+      col[i] = col[i]*m_xy_scale[0] + m_xy_offset[0];
+      row[i] = row[i]*m_xy_scale[1] + m_xy_offset[1];
+    }
+  }
+
+  void RPCModel::point_to_pixel(std::vector<Vector3> const& points,
+                                std::vector<Vector2> & pixels) const {
+
+    size_t num_pts = points.size();
+    pixels.resize(num_pts);
+    if (num_pts == 0)
+      return;
+
+    std::vector<double> lon(num_pts), lat(num_pts), height(num_pts),
+      col(num_pts), row(num_pts);
+    for (size_t i = 0; i < num_pts; i++) {
+      Vector3 llh = m_datum.cartesian_to_geodetic(points[i]);
+      lon[i] = llh[0]; lat[i] = llh[1]; height[i] = llh[2];
+    }
+
+    geodetic_to_pixel(num_pts, &lon[0], &lat[0], &height[0], &col[0], &row[0]);
+
+    for (size_t i = 0; i < num_pts; i++)
+      pixels[i] = Vector2(col[i], row[i]);
+  }
+
   RPCModel::CoeffVec RPCModel::calculate_terms( vw::Vector3 const& normalized_geodetic ) {
 
     double x = normalized_geodetic.x(); // normalized lon
@@ -37,6 +37,7 @@
 
 #include <string>
 #include <ostream>
+#include <vector>
 
 namespace vw {
   class DiskImageResourceGDAL;
@@ -88,6 +89,26 @@ namespace asp {
 
     vw::Vector2 geodetic_to_pixel( vw::Vector3 const& geodetic ) const;
 
+    // Batch versions of the functions above, for projecting many points
+    // at once. The coordinates are stored as one array per component,
+    // so the polynomial evaluation loop can be vectorized.
+
+    /// Evaluate the RPC polynomial ratios at the normalized geodetics
+    /// (x[i], y[i], z[i]) and store the normalized pixels in (col[i], row[i]).
+    static void normalized_geodetic_to_normalized_pixel
+      (size_t num_pts, double const* x, double const* y, double const* z,
+       CoeffVec const& line_num_coeff,   CoeffVec const& line_den_coeff,
+       CoeffVec const& sample_num_coeff, CoeffVec const& sample_den_coeff,
+       double * col, double * row);
+
+    /// Project lon-lat-height points into the camera.
+    void geodetic_to_pixel(size_t num_pts, double const* lon, double const* lat,
+                           double const* height, double * col, double * row) const;
+
+    /// Project cartesian points into the camera.
+    void point_to_pixel(std::vector<vw::Vector3> const& points,
+                        std::vector<vw::Vector2> & pixels) const;
+
     // Access to constants
     vw::cartography::Datum const& datum   () const { return m_datum;               }
     CoeffVec    const& line_num_coeff     () const { return m_line_num_coeff;      }
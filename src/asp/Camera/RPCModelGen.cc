@@ -18,12 +18,314 @@
 
 #include <asp/Camera/RPCModelGen.h>
 #include <asp/Camera/RPCModel.h>
-#include <vw/Math/Geometry.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Cartography/CameraBBox.h>
+#include <boost/noncopyable.hpp>
+#include <algorithm>
+#include <limits>
+#include <cmath>
 
 using namespace vw;
 
 namespace asp {
 
+namespace {
+
+  // The line and the sample of an RPC model are fit separately, as
+  // each depends only on its own numerator and denominator. Each fit
+  // first solves the linearized problem, reweighted a few times by the
+  // denominator, which is close to the actual solution, then refines
+  // it with Levenberg-Marquardt on the normal equations. These are of
+  // size 39, and are accumulated over the points in parallel, so the
+  // cost is linear in the number of points, and dense sampling grids
+  // can be used.
+
+  // The 20 terms of the RPC polynomials, in the order of
+  // RPCModel::calculate_terms().
+  inline void rpc_terms(double x, double y, double z, double * t) {
+    t[ 0] = 1.0;     t[ 1] = x;       t[ 2] = y;       t[ 3] = z;
+    t[ 4] = x*y;     t[ 5] = x*z;     t[ 6] = y*z;     t[ 7] = x*x;
+    t[ 8] = y*y;     t[ 9] = z*z;     t[10] = x*y*z;   t[11] = x*x*x;
+    t[12] = x*y*y;   t[13] = x*z*z;   t[14] = x*x*y;   t[15] = y*y*y;
+    t[16] = y*z*z;   t[17] = x*x*z;   t[18] = y*y*z;   t[19] = z*z*z;
+  }
+
+  // The unknowns of one coordinate of an RPC model: the 20 coefficients
+  // of the numerator, then the last 19 of the denominator, whose first
+  // coefficient is 1.
+  const int NUM_COORD_COEFFS = 39;
+
+  // The normal equations, in the upper triangle of A, the right-hand
+  // side, and the cost, of the fit over some of the points.
+  struct RpcNormalEqs {
+    std::vector<double> A, b;
+    double cost;
+    RpcNormalEqs(): A(NUM_COORD_COEFFS*NUM_COORD_COEFFS, 0.0), b(NUM_COORD_COEFFS, 0.0),
+                    cost(0.0) {}
+    void add(RpcNormalEqs const& other) {
+      for (size_t k = 0; k < A.size(); k++) A[k] += other.A[k];
+      for (size_t k = 0; k < b.size(); k++) b[k] += other.b[k];
+      cost += other.cost;
+    }
+  };
+
+  // Accumulate the normal equations of one coordinate over a range of
+  // points, at the current coefficients p. If linear, these are the
+  // equations of the linearized fit n.t - obs*(d.t - 1) = obs, weighted
+  // by the inverse square of the current denominator, whose solution is
+  // the new coefficients. Otherwise these are the Gauss-Newton equations
+  // of the actual fit, whose solution is the step to the coefficients.
+  void accumulate_normal_eqs(double const* x, double const* y, double const* z,
+                             double const* obs, size_t begin, size_t end,
+                             std::vector<double> const& p, bool linear,
+                             RpcNormalEqs & eqs) {
+    const int n = NUM_COORD_COEFFS;
+    double t[20], a[NUM_COORD_COEFFS];
+    for (size_t i = begin; i < end; i++) {
+      rpc_terms(x[i], y[i], z[i], t);
+      double num = 0, den = 1.0;
+      for (int k = 0; k < 20; k++) num += p[k]*t[k];
+      for (int k = 1; k < 20; k++) den += p[19 + k]*t[k];
+
+      double rhs, wt;
+      if (linear) {
+        for (int k = 0; k < 20; k++) a[k]      =  t[k];
+        for (int k = 1; k < 20; k++) a[19 + k] = -obs[i]*t[k];
+        rhs = obs[i];
+        wt  = 1.0/(den*den);
+        double r = num - obs[i]*den;
+        eqs.cost += wt*r*r;
+      } else {
+        double f = num/den;
+        for (int k = 0; k < 20; k++) a[k]      =  t[k]/den;
+        for (int k = 1; k < 20; k++) a[19 + k] = -f*t[k]/den;
+        rhs = obs[i] - f;
+        wt  = 1.0;
+        eqs.cost += rhs*rhs;
+      }
+
+      for (int r = 0; r < n; r++) {
+        double war = wt*a[r];
+        eqs.b[r] += war*rhs;
+        double * row = &eqs.A[r*n];
+        for (int c = r; c < n; c++)
+          row[c] += war*a[c];
+      }
+    }
+  }
+
+  // Add the penalties on the coefficients, so that the equations
+  // minimize the squared penalty times coefficient as well.
+  void add_penalties(std::vector<double> const& pen, std::vector<double> const& p,
+                     bool linear, RpcNormalEqs & eqs) {
+    const int n = NUM_COORD_COEFFS;
+    for (int k = 0; k < n; k++) {
+      double w = pen[k]*pen[k];
+      eqs.A[k*n + k] += w;
+      eqs.cost       += w*p[k]*p[k];
+      if (!linear)
+        eqs.b[k]     -= w*p[k];
+    }
+  }
+
+  // Solve (A + lambda*diag(A)) x = b, with A symmetric positive
+  // definite and stored in the upper triangle, by Cholesky. Returns
+  // false if the matrix is not positive definite.
+  bool solve_normal_eqs(RpcNormalEqs const& eqs, double lambda, std::vector<double> & x) {
+    const int n = NUM_COORD_COEFFS;
+    std::vector<double> L(n*n, 0.0);
+    for (int j = 0; j < n; j++) {
+      for (int i = j; i < n; i++) {
+        double s = eqs.A[j*n + i]; // A(j, i) == A(i, j)
+        if (i == j)
+          s *= (1.0 + lambda);
+        for (int k = 0; k < j; k++)
+          s -= L[i*n + k]*L[j*n + k];
+        if (i == j) {
+          if (!(s > 0))
+            return false;
+          L[j*n + j] = std::sqrt(s);
+        } else {
+          L[i*n + j] = s/L[j*n + j];
+        }
+      }
+    }
+    x = eqs.b;
+    for (int i = 0; i < n; i++) {
+      for (int k = 0; k < i; k++) x[i] -= L[i*n + k]*x[k];
+      x[i] /= L[i*n + i];
+    }
+    for (int i = n - 1; i >= 0; i--) {
+      for (int k = i + 1; k < n; k++) x[i] -= L[k*n + i]*x[k];
+      x[i] /= L[i*n + i];
+    }
+    return true;
+  }
+
+  class RpcNormalEqsTask: public vw::Task, private boost::noncopyable {
+    double const *x, *y, *z, *obs;
+    size_t m_begin, m_end;
+    std::vector<double> const& m_p;
+    bool m_linear;
+    RpcNormalEqs & m_eqs;
+  public:
+    RpcNormalEqsTask(double const* x_in, double const* y_in, double const* z_in,
+                     double const* obs_in, size_t begin, size_t end,
+                     std::vector<double> const& p, bool linear, RpcNormalEqs & eqs):
+      x(x_in), y(y_in), z(z_in), obs(obs_in), m_begin(begin), m_end(end),
+      m_p(p), m_linear(linear), m_eqs(eqs) {}
+    void operator()() {
+      accumulate_normal_eqs(x, y, z, obs, m_begin, m_end, m_p, m_linear, m_eqs);
+    }
+  };
+
+  // The normal equations over all points. The points are split into
+  // chunks processed in parallel, and summed in order, so the result
+  // does not depend on the number of threads.
+  RpcNormalEqs normal_eqs(double const* x, double const* y, double const* z,
+                          double const* obs, size_t num_pts,
+                          std::vector<double> const& p, std::vector<double> const& pen,
+                          bool linear, int num_threads) {
+    const size_t chunk_size = 10000;
+    size_t num_chunks = std::max(size_t(1), (num_pts + chunk_size - 1) / chunk_size);
+    std::vector<RpcNormalEqs> chunk_eqs(num_chunks);
+    if (num_chunks == 1 || num_threads <= 1) {
+      for (size_t c = 0; c < num_chunks; c++)
+        accumulate_normal_eqs(x, y, z, obs, c*chunk_size, std::min(num_pts, (c + 1)*chunk_size),
+                              p, linear, chunk_eqs[c]);
+    } else {
+      FifoWorkQueue queue(num_threads);
+      for (size_t c = 0; c < num_chunks; c++)
+        queue.add_task(boost::shared_ptr<RpcNormalEqsTask>
+                       (new RpcNormalEqsTask(x, y, z, obs, c*chunk_size,
+                                             std::min(num_pts, (c + 1)*chunk_size),
+                                             p, linear, chunk_eqs[c])));
+      queue.join_all();
+    }
+
+    RpcNormalEqs eqs;
+    for (size_t c = 0; c < num_chunks; c++)
+      eqs.add(chunk_eqs[c]);
+    add_penalties(pen, p, linear, eqs);
+    return eqs;
+  }
+
+  // Fit one coordinate of the RPC model to the observations, with the
+  // given penalties on the coefficients. Returns false if the solver
+  // did not converge, in which case the coefficients are the best
+  // ones found.
+  bool fit_rpc_coordinate(double const* x, double const* y, double const* z,
+                          double const* obs, size_t num_pts,
+                          std::vector<double> const& pen, int num_threads,
+                          std::vector<double> & p) {
+
+    // The linearized problem, starting with a denominator of 1
+    const int num_linear_iters = 3;
+    p.assign(NUM_COORD_COEFFS, 0.0);
+    for (int iter = 0; iter < num_linear_iters; iter++) {
+      RpcNormalEqs eqs = normal_eqs(x, y, z, obs, num_pts, p, pen, true, num_threads);
+      std::vector<double> sol;
+      if (!solve_normal_eqs(eqs, 1e-12, sol))
+        vw_throw( ArgumentErr() << "Could not fit an RPC model. The points may be degenerate.\n" );
+      p = sol;
+    }
+
+    // Levenberg-Marquardt
+    const int    max_iters     = 100;
+    const double rel_tolerance = 1e-12;
+    RpcNormalEqs eqs = normal_eqs(x, y, z, obs, num_pts, p, pen, false, num_threads);
+    double lambda = 1e-4;
+    for (int iter = 0; iter < max_iters; iter++) {
+      std::vector<double> step;
+      if (solve_normal_eqs(eqs, lambda, step)) {
+        std::vector<double> new_p = p;
+        for (int k = 0; k < NUM_COORD_COEFFS; k++)
+          new_p[k] += step[k];
+        RpcNormalEqs new_eqs = normal_eqs(x, y, z, obs, num_pts, new_p, pen, false, num_threads);
+        if (new_eqs.cost < eqs.cost) {
+          double rel_decrease = (eqs.cost - new_eqs.cost) / std::max(eqs.cost, 1e-300);
+          p   = new_p;
+          eqs = new_eqs;
+          lambda = std::max(lambda/10.0, 1e-12);
+          if (rel_decrease < rel_tolerance)
+            return true;
+          continue;
+        }
+      }
+      lambda *= 10.0;
+      if (lambda > 1e10)
+        return true; // No step decreases the cost, so we are at the minimum
+    }
+    return false;
+  }
+
+  // Samples the camera on a lon-lat-height grid, one slice of constant
+  // longitude at a time, keeping the points which project near the
+  // image box. With an offset of 0.5 the centers of the grid cells
+  // are sampled instead of its nodes.
+  struct CameraSampler {
+    vw::camera::CameraModel const* cam;
+    cartography::Datum datum;
+    BBox2   image_box;
+    Vector3 llh_min, llh_delta;
+    Vector3i num_steps;
+    double  offset;
+
+    void sample_slice(int i, std::vector<Vector3> & llh_vec,
+                      std::vector<Vector2> & pix_vec) const {
+      for (int j = 0; j < num_steps[1]; j++) {
+        for (int k = 0; k < num_steps[2]; k++) {
+          Vector3 llh = llh_min + elem_prod(Vector3(i, j, k) + offset*Vector3(1, 1, 1),
+                                            llh_delta);
+          Vector2 pix;
+          try {
+            pix = cam->point_to_pixel(datum.geodetic_to_cartesian(llh));
+          } catch (...) {
+            continue; // The point does not project into the camera
+          }
+          if (!image_box.contains(pix))
+            continue;
+          llh_vec.push_back(llh);
+          pix_vec.push_back(pix);
+        }
+      }
+    }
+  };
+
+  class CameraSampleTask: public vw::Task, private boost::noncopyable {
+    CameraSampler const& m_sampler;
+    int m_slice;
+    std::vector<Vector3> & m_llh;
+    std::vector<Vector2> & m_pix;
+  public:
+    CameraSampleTask(CameraSampler const& sampler, int slice,
+                     std::vector<Vector3> & llh, std::vector<Vector2> & pix):
+      m_sampler(sampler), m_slice(slice), m_llh(llh), m_pix(pix) {}
+    void operator()() { m_sampler.sample_slice(m_slice, m_llh, m_pix); }
+  };
+
+  // Sample all slices in parallel, and append the samples in the
+  // order of a serial loop.
+  void sample_camera(CameraSampler const& sampler, int num_threads,
+                     std::vector<Vector3> & all_llh, std::vector<Vector2> & all_pixels) {
+    int num_slices = sampler.num_steps[0];
+    std::vector< std::vector<Vector3> > llh(num_slices);
+    std::vector< std::vector<Vector2> > pix(num_slices);
+    vw::FifoWorkQueue queue(num_threads);
+    for (int i = 0; i < num_slices; i++) {
+      boost::shared_ptr<CameraSampleTask> task(new CameraSampleTask(sampler, i, llh[i], pix[i]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+    for (int i = 0; i < num_slices; i++) {
+      all_llh.insert(all_llh.end(), llh[i].begin(), llh[i].end());
+      all_pixels.insert(all_pixels.end(), pix[i].begin(), pix[i].end());
+    }
+  }
+
+} // end anonymous namespace
+
   void unpackCoeffs(Vector<double> const& C,
                     RPCModel::CoeffVec& lineNum, RPCModel::CoeffVec& lineDen,
                     RPCModel::CoeffVec& sampNum, RPCModel::CoeffVec& sampDen
@@ -169,7 +471,8 @@ namespace asp {
                RPCModel::CoeffVec & line_num,
                RPCModel::CoeffVec & line_den,
                RPCModel::CoeffVec & samp_num,
-               RPCModel::CoeffVec & samp_den){
+               RPCModel::CoeffVec & samp_den,
+               int num_threads){
   
     VW_ASSERT( penalty_weight >= 0, ArgumentErr()
                << "The RPC penalty weight must be non-negative.\n" );
@@ -187,10 +490,6 @@ namespace asp {
     // Initialize a specialized least squares solver object and load the input data
     RpcSolveLMA lma_model (normalized_geodetics, normalized_pixels, penalty_adjustment);
 
-    Vector<double> solution;
-    double norm_error;
-
-    // As initial guess we use the linear part of the RPC transform.
     int numPts = normalized_geodetics.size()/RPCModel::GEODETIC_COORD_SIZE;
     int numPts2 = (normalized_pixels.size() - asp::RpcSolveLMA::NUM_PENALTY_TERMS)
       / RPCModel::IMAGE_COORD_SIZE;
@@ -198,65 +497,186 @@ namespace asp {
     if (numPts != numPts2) 
       vw_throw( ArgumentErr() << "Error in " << __FILE__
                 << ". Number of inputs and outputs do not agree.\n");
-    std::vector< Vector<double, RPCModel::GEODETIC_COORD_SIZE+1> > in(numPts), out(numPts);
-    for (int p = 0; p < numPts; p++) {
 
-      Vector<double, RPCModel::GEODETIC_COORD_SIZE+1> P;
-      for (int q = 0; q < RPCModel::GEODETIC_COORD_SIZE; q++) 
-        P[q] = normalized_geodetics[p*RPCModel::GEODETIC_COORD_SIZE + q]; // P[0], P[1], P[2]
-      P[RPCModel::GEODETIC_COORD_SIZE] = 1; // P[3]
-      in[p] = P;
-      
-      for (int q = 0; q < RPCModel::IMAGE_COORD_SIZE; q++) 
-        P[q] = normalized_pixels[p*RPCModel::IMAGE_COORD_SIZE + q]; // P[0], P[1]
-      P[RPCModel::IMAGE_COORD_SIZE]   = 0; // P[2]
-      P[RPCModel::IMAGE_COORD_SIZE+1] = 1; // P[3]
-      out[p] = P;
+    if (num_threads <= 0)
+      num_threads = vw_settings().default_num_threads();
+
+    std::vector<double> x(numPts), y(numPts), z(numPts), samp(numPts), line(numPts);
+    for (int p = 0; p < numPts; p++) {
+      x[p]    = normalized_geodetics[RPCModel::GEODETIC_COORD_SIZE*p + 0];
+      y[p]    = normalized_geodetics[RPCModel::GEODETIC_COORD_SIZE*p + 1];
+      z[p]    = normalized_geodetics[RPCModel::GEODETIC_COORD_SIZE*p + 2];
+      samp[p] = normalized_pixels[RPCModel::IMAGE_COORD_SIZE*p + 0]; // first coordinate is sample
+      line[p] = normalized_pixels[RPCModel::IMAGE_COORD_SIZE*p + 1]; // second coordinate is line
     }
-    Matrix4x4 T = math::AffineFittingFunctorN<RPCModel::GEODETIC_COORD_SIZE>()(in, out);
 
-    // Put this matrix in the format acceptable for the RPC solver
-    for (int p = 0; p < int(line_num.size()); p++) {
-      samp_num[p] = 0; samp_den[p] = 0; // first coordinate of output is sample
-      line_num[p] = 0; line_den[p] = 0; // second coordinate of output is line
+    // The same penalties as in RpcSolveLMA, on the coefficients of the
+    // terms of degree 2 and 3, of both the numerator and denominator.
+    vw::Vector<int,20> coeff_order = RPCModel::get_coeff_order();
+    std::vector<double> pen(NUM_COORD_COEFFS, 0.0);
+    for (int k = 4; k < 20; k++) {
+      pen[k]      = penalty_adjustment * (coeff_order[k] - 1);
+      pen[19 + k] = penalty_adjustment * (coeff_order[k] - 1);
     }
 
-    // The first coordinate of the output
-    samp_num[0] = T(0, 3); // the d value, the translation, in a*x + b*y + c*z + d
-    samp_num[1] = T(0, 0); samp_num[2] = T(0, 1); samp_num[3] = T(0, 2); // linear part, a, b, c
-    
-    // The second coordinate of the output
-    line_num[0] = T(1, 3); // the d value, the translation, in a*x + b*y + c*z + d
-    line_num[1] = T(1, 0); line_num[2] = T(1, 1); line_num[3] = T(1, 2); // linear part, a, b, c
+    // Fit the sample and the line
+    std::vector<double> samp_coeffs, line_coeffs;
+    bool converged = true;
+    if (numPts > 0) {
+      converged = fit_rpc_coordinate(&x[0], &y[0], &z[0], &samp[0], numPts, pen,
+                                     num_threads, samp_coeffs) && converged;
+      converged = fit_rpc_coordinate(&x[0], &y[0], &z[0], &line[0], numPts, pen,
+                                     num_threads, line_coeffs) && converged;
+    } else {
+      samp_coeffs.assign(NUM_COORD_COEFFS, 0.0);
+      line_coeffs.assign(NUM_COORD_COEFFS, 0.0);
+    }
+    if (!converged)
+      VW_OUT(DebugMessage, "asp") << "rpc_gen: WARNING --> The RPC solver did not converge.\n";
 
-    // The denominator is just 1 to start
-    samp_den[0] = 1;
-    line_den[0] = 1;
-    
-    // Initialize the model
-    Vector<double> startGuess;
-    startGuess.set_size(RPCModel::NUM_RPC_COEFFS);
-    // for (size_t i = 0; i < startGuess.size(); i++) startGuess[i] = 0.0; // start with zero
-    packCoeffs(line_num, line_den, samp_num, samp_den, startGuess);
+    samp_den[0] = line_den[0] = 1;
+    for (int k = 0; k < 20; k++) {
+      samp_num[k] = samp_coeffs[k];
+      line_num[k] = line_coeffs[k];
+    }
+    for (int k = 1; k < 20; k++) {
+      samp_den[k] = samp_coeffs[19 + k];
+      line_den[k] = line_coeffs[19 + k];
+    }
+    Vector<double> solution;
+    packCoeffs(line_num, line_den, samp_num, samp_den, solution);
+    int status = converged ? 1 : 0;
 
-    VW_OUT(DebugMessage, "asp") << "Initial guess for RPC coeffs: " << startGuess << std::endl;
-    
-    // Use the L-M solver to optimize the RPC model coefficient values.
-    int status = find_solution_from_seed(lma_model, startGuess, normalized_pixels,
-                                         solution, norm_error);
+    // The error norm, as in the original dense solver
+    double norm_error = norm_2(lma_model.difference(lma_model(solution), normalized_pixels));
     VW_OUT(DebugMessage, "asp") << "Solved RPC coeffs: " << solution << std::endl;
     VW_OUT(DebugMessage, "asp") << "rpc_gen: norm_error = " << norm_error << std::endl;
 
     // Dump all the results to disk if the user passed in an output prefix.
     if (output_prefix != "")
-      write_levmar_solver_results(output_prefix, status, startGuess,
+      write_levmar_solver_results(output_prefix, status, solution,
                                   solution, normalized_pixels, lma_model);
   
-    // If we ever want to improve our results further we should
-    // experiment with multiple starting seeds!
-
     unpackCoeffs(solution, line_num, line_den, samp_num, samp_den);
   }
-  
+
+  boost::shared_ptr<RPCModel>
+  approximate_camera_with_rpc(vw::camera::CameraModel const* cam,
+                              cartography::Datum const& datum,
+                              BBox2 const& image_box, Vector2 const& height_range,
+                              int num_samples, double penalty_weight,
+                              double & max_error, int num_threads) {
+
+    max_error = std::numeric_limits<double>::max();
+    if (num_threads <= 0)
+      num_threads = vw_settings().default_num_threads();
+    num_samples = std::max(num_samples, 2);
+
+    // The ground seen by the image box, from rays through a grid of
+    // its pixels intersected with the datum at the lowest and highest
+    // heights.
+    BBox3 llh_box;
+    int num_rays = 20;
+    for (int h = 0; h < 2; h++) {
+      double ht = height_range[h];
+      for (int i = 0; i <= num_rays; i++) {
+        for (int j = 0; j <= num_rays; j++) {
+          Vector2 pix = image_box.min() + elem_prod(Vector2(i, j)/double(num_rays),
+                                                    image_box.size());
+          try {
+            Vector3 xyz = cartography::datum_intersection(datum.semi_major_axis() + ht,
+                                                          datum.semi_minor_axis() + ht,
+                                                          cam->camera_center(pix),
+                                                          cam->pixel_to_vector(pix));
+            if (xyz == Vector3())
+              continue; // The ray misses the planet
+            Vector3 llh = datum.cartesian_to_geodetic(xyz);
+            llh[2] = ht;
+            llh_box.grow(llh);
+          } catch (...) {}
+        }
+      }
+    }
+    if (llh_box.empty() || llh_box.max()[0] <= llh_box.min()[0] ||
+        llh_box.max()[1] <= llh_box.min()[1])
+      return boost::shared_ptr<RPCModel>();
+
+    // Fit also to points a little beyond the image edges, so the
+    // model is as good at the edges as inside.
+    CameraSampler sampler;
+    sampler.cam       = cam;
+    sampler.datum     = datum;
+    sampler.image_box = image_box;
+    sampler.image_box.expand(0.05*std::max(image_box.width(), image_box.height()));
+    Vector3 margin(0.05*(llh_box.max()[0] - llh_box.min()[0]),
+                   0.05*(llh_box.max()[1] - llh_box.min()[1]), 0.0);
+    sampler.llh_min   = llh_box.min() - margin;
+    int num_ht = std::max(num_samples/4, 1); // the heights need fewer samples
+    sampler.num_steps = Vector3i(num_samples + 1, num_samples + 1, num_ht + 1);
+    sampler.llh_delta = elem_quot(llh_box.max() - llh_box.min() + 2*margin,
+                                  Vector3(num_samples, num_samples, num_ht));
+    sampler.offset    = 0.0;
+
+    std::vector<Vector3> all_llh;
+    std::vector<Vector2> all_pixels;
+    sample_camera(sampler, num_threads, all_llh, all_pixels);
+    if (all_llh.size() < size_t(RPCModel::NUM_RPC_COEFFS))
+      return boost::shared_ptr<RPCModel>();
+
+    BBox3 fit_llh_box;
+    BBox2 pixel_box;
+    for (size_t i = 0; i < all_llh.size(); i++) {
+      fit_llh_box.grow(all_llh[i]);
+      pixel_box.grow(all_pixels[i]);
+    }
+
+    // A box of no extent, such as along a single height, is given a
+    // unit scale so the normalization is defined.
+    Vector3 llh_scale  = (fit_llh_box.max() - fit_llh_box.min())/2.0; // half range
+    Vector3 llh_offset = (fit_llh_box.max() + fit_llh_box.min())/2.0; // center point
+    Vector2 pixel_scale  = (pixel_box.max() - pixel_box.min())/2.0;   // half range
+    Vector2 pixel_offset = (pixel_box.max() + pixel_box.min())/2.0;   // center point
+    for (int c = 0; c < 3; c++)
+      if (llh_scale[c] <= 0) llh_scale[c] = 1.0;
+    for (int c = 0; c < 2; c++)
+      if (pixel_scale[c] <= 0) pixel_scale[c] = 1.0;
+
+    int num_pts = all_llh.size();
+    Vector<double> normalized_llh(RPCModel::GEODETIC_COORD_SIZE*num_pts);
+    Vector<double> normalized_pixels(RPCModel::IMAGE_COORD_SIZE*num_pts
+                                     + RpcSolveLMA::NUM_PENALTY_TERMS);
+    for (size_t i = 0; i < normalized_pixels.size(); i++)
+      normalized_pixels[i] = 0.0; // The penalty terms must be zero
+    for (int pt = 0; pt < num_pts; pt++) {
+      subvector(normalized_llh, RPCModel::GEODETIC_COORD_SIZE*pt,
+                RPCModel::GEODETIC_COORD_SIZE)
+        = elem_quot(all_llh[pt] - llh_offset, llh_scale);
+      subvector(normalized_pixels, RPCModel::IMAGE_COORD_SIZE*pt,
+                RPCModel::IMAGE_COORD_SIZE)
+        = elem_quot(all_pixels[pt] - pixel_offset, pixel_scale);
+    }
+
+    RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
+    gen_rpc(penalty_weight, "", normalized_llh, normalized_pixels,
+            llh_scale, llh_offset, pixel_scale, pixel_offset,
+            line_num, line_den, samp_num, samp_den, num_threads);
+    boost::shared_ptr<RPCModel> rpc(new RPCModel(datum, line_num, line_den, samp_num, samp_den,
+                                                 pixel_offset, pixel_scale,
+                                                 llh_offset, llh_scale));
+
+    // Check the model at the centers of the cells of the sampling
+    // grid, within the image box itself.
+    std::vector<Vector3> check_llh;
+    std::vector<Vector2> check_pixels;
+    sampler.offset    = 0.5;
+    sampler.image_box = image_box;
+    sampler.num_steps -= Vector3i(1, 1, 1);
+    sample_camera(sampler, num_threads, check_llh, check_pixels);
+    max_error = 0.0;
+    for (size_t i = 0; i < check_llh.size(); i++)
+      max_error = std::max(max_error, norm_2(rpc->geodetic_to_pixel(check_llh[i]) -
+                                             check_pixels[i]));
+    return rpc;
+  }
   
 }
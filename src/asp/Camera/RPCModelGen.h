@@ -22,6 +22,8 @@
 
 #include <asp/Camera/RPCModel.h>
 #include <vw/Math/LevenbergMarquardt.h>
+#include <vw/Math/BBox.h>
+#include <boost/shared_ptr.hpp>
 
 namespace asp {
 
@@ -45,6 +47,9 @@ namespace asp {
     vw::Vector<double> m_normalizedGeodetics, 
                        m_normalizedPixels; ///< Also contains the extra penalty terms
     double             m_wt; ///< The penalty weight, k in the reference paper.
+
+    /// The normalized geodetics, one array per coordinate, for batch evaluation.
+    std::vector<double> m_x, m_y, m_z;
     
   public:
    
@@ -62,7 +67,16 @@ namespace asp {
                  ) :
       m_normalizedGeodetics(normalizedGeodetics),
       m_normalizedPixels(normalizedPixels),
-      m_wt(penaltyWeight){}
+      m_wt(penaltyWeight){
+
+      int numPts = m_normalizedGeodetics.size()/RPCModel::GEODETIC_COORD_SIZE;
+      m_x.resize(numPts); m_y.resize(numPts); m_z.resize(numPts);
+      for (int i = 0; i < numPts; i++) {
+        m_x[i] = m_normalizedGeodetics[RPCModel::GEODETIC_COORD_SIZE*i + 0];
+        m_y[i] = m_normalizedGeodetics[RPCModel::GEODETIC_COORD_SIZE*i + 1];
+        m_z[i] = m_normalizedGeodetics[RPCModel::GEODETIC_COORD_SIZE*i + 2];
+      }
+    }
 
     /// Given a set of RPC coefficients, compute the projected pixels.
     inline result_type operator()( domain_type const& C ) const {
@@ -83,17 +97,18 @@ namespace asp {
       result_type result;
       result.set_size(m_normalizedPixels.size());
       
-      // Loop through each test point
+      // Project all the normalized geodetic coordinates into the RPC
+      // camera at once to get the normalized pixels.
+      std::vector<double> col(numPts), row(numPts);
+      if (numPts > 0)
+        RPCModel::normalized_geodetic_to_normalized_pixel(numPts, &m_x[0], &m_y[0], &m_z[0],
+                                                          lineNum, lineDen, sampNum, sampDen,
+                                                          &col[0], &row[0]);
+
+      // Pack the normalized pixels into the output result vector
       for (int i = 0; i < numPts; i++){
-        // Unpack the normalized Geodetic coordinate
-        vw::Vector3 G = subvector(m_normalizedGeodetics, RPCModel::GEODETIC_COORD_SIZE*i, RPCModel::GEODETIC_COORD_SIZE);
-        
-        // Project the normalized geodetic coordinate into the RPC camera to get a normalized pixel
-        vw::Vector2 pxn = RPCModel::normalized_geodetic_to_normalized_pixel(G, lineNum, lineDen, sampNum, sampDen);
-             
-        // Pack the normalized pixel into the output result vector
-        subvector(result, RPCModel::IMAGE_COORD_SIZE*i, RPCModel::IMAGE_COORD_SIZE) = pxn;
-
+        result[RPCModel::IMAGE_COORD_SIZE*i + 0] = col[i];
+        result[RPCModel::IMAGE_COORD_SIZE*i + 1] = row[i];
       }
 
       // There are 4*20 - 2 = 78 coefficients we optimize. Of those, 2
@@ -135,6 +150,10 @@ namespace asp {
                               vw::Vector<double>      & final_params,
                               double              & norm_error);
   
+  /// Fit the RPC coefficients to the normalized point pairs. The sample
+  /// and the line are each fit by a linear solve followed by
+  /// Levenberg-Marquardt on the normal equations, accumulated with the
+  /// given number of threads, or with the default number if not positive.
   void gen_rpc(// Inputs
                double penalty_weight,
                std::string    const& output_prefix,
@@ -148,7 +167,25 @@ namespace asp {
                RPCModel::CoeffVec & line_num,
                RPCModel::CoeffVec & line_den,
                RPCModel::CoeffVec & samp_num,
-               RPCModel::CoeffVec & samp_den);
+               RPCModel::CoeffVec & samp_den,
+               int num_threads = 0);
+
+  /// Fit an RPC model to a camera over the ground seen by the pixels in
+  /// image_box, between the given heights above the datum, sampled on a
+  /// grid with this many samples along longitude and latitude. The
+  /// model is checked against the camera between the fitted samples,
+  /// and the largest error, in pixels, is returned in max_error. The
+  /// camera is projected into with the given number of threads, or the
+  /// default number if not positive, so it must be thread-safe unless
+  /// a single thread is used. Returns a null pointer if the image box
+  /// does not see enough of the planet to fit a model.
+  boost::shared_ptr<RPCModel>
+  approximate_camera_with_rpc(vw::camera::CameraModel const* cam,
+                              vw::cartography::Datum const& datum,
+                              vw::BBox2 const& image_box,
+                              vw::Vector2 const& height_range,
+                              int num_samples, double penalty_weight,
+                              double & max_error, int num_threads = 0);
 }
 
 #endif //__STEREO_CAMERA_RPC_MODEL_GEN_H__
@@ -0,0 +1,175 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file WVCorrect.h
+///
+/// Correct CCD artifacts in WorldView 1 and 2 images with given TDI.
+///
+/// The problem: A WV image is obtained by mosaicking from left to
+/// right image blocks which are as tall is the entire image (each
+/// block comes from an individual CCD image sensor). Blocks are
+/// slightly misplaced in respect to each other by some unknown
+/// subpixel offsets. We use tabulated values for the offsets and their
+/// locations to undo them.
+///
+/// The correction is a view, so it can be applied while the image is
+/// read, either by wv_correct, which writes the corrected image, or by
+/// stereo_pprc with --wv-correct, which corrects the images as it
+/// normalizes them without writing a corrected copy first.
+
+#ifndef __ASP_CAMERA_WV_CORRECT_H__
+#define __ASP_CAMERA_WV_CORRECT_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/Interpolation.h>
+#include <vw/Image/EdgeExtension.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Core/Exception.h>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  /// The tabulated column positions of the CCD boundaries and the
+  /// offsets across each of them, along and across the columns. These
+  /// are empty, with a warning, if there are no corrections for this
+  /// satellite and TDI.
+  void get_offsets(int tdi, bool is_wv01, bool is_forward,
+                   std::vector<double> & posx, std::vector<double> & ccdx,
+                   std::vector<double> & posy, std::vector<double> & ccdy);
+
+  /// Read from a DigitalGlobe camera XML file the parameters which
+  /// determine the correction. Throws if the camera is not WV01 or WV02.
+  void read_wv_correct_params(std::string const& camera_model_file,
+                              int & tdi, bool & is_wv01, bool & is_forward,
+                              double & pitch_ratio);
+
+  /// The image with the CCD offsets undone. If the image was cropped
+  /// from the full camera image, col_offset is the column of the full
+  /// image at which it starts.
+  template <class ImageT>
+  class WVCorrectView: public vw::ImageViewBase< WVCorrectView<ImageT> >{
+    ImageT m_img;
+    int m_tdi;
+    bool m_is_wv01, m_is_forward;
+    double m_pitch_ratio;
+    int m_col_offset;
+    std::vector<double> m_posx, m_ccdx, m_posy, m_ccdy;
+
+    typedef typename ImageT::pixel_type PixelT;
+
+  public:
+    WVCorrectView( ImageT const& img, int tdi, bool is_wv01, bool is_forward,
+                   double pitch_ratio, int col_offset = 0):
+      m_img(img), m_tdi(tdi), m_is_wv01(is_wv01), m_is_forward(is_forward),
+      m_pitch_ratio(pitch_ratio), m_col_offset(col_offset){
+
+      get_offsets(m_tdi, m_is_wv01, m_is_forward,
+                  m_posx, m_ccdx, m_posy, m_ccdy);
+
+      // Compensate for the variable pitch ratio
+      for (int i = 0; i < (int)m_posx.size(); i++) m_posx[i] *= m_pitch_ratio;
+      for (int i = 0; i < (int)m_posy.size(); i++) m_posy[i] *= m_pitch_ratio;
+
+      VW_ASSERT(m_posx.size() == m_ccdx.size() &&
+                m_posy.size() == m_ccdy.size(),
+                vw::ArgumentErr() << "wv_correct: Expecting the arrays of positions "
+                << "and offsets to have the same sizes.");
+    }
+
+    typedef PixelT pixel_type;
+    typedef PixelT result_type;
+    typedef vw::ProceduralPixelAccessor<WVCorrectView> pixel_accessor;
+
+    inline vw::int32 cols() const { return m_img.cols(); }
+    inline vw::int32 rows() const { return m_img.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+    inline pixel_type operator()( double/*i*/, double/*j*/, vw::int32/*p*/ = 0 ) const {
+      vw_throw(vw::NoImplErr() << "WVCorrectView::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+
+      // Need to see a bit more of the input image for the purpose
+      // of interpolation.
+      int max_offset = 5; // CCD offsets are always under 1 pix
+      int bias = vw::BilinearInterpolation::pixel_buffer + max_offset;
+      vw::BBox2i biased_box = bbox;
+      biased_box.expand(bias);
+      biased_box.crop(bounding_box(m_img));
+
+      vw::ImageView<result_type> cropped_img = crop(m_img, biased_box);
+      vw::InterpolationView<vw::EdgeExtensionView< vw::ImageView<result_type>,
+        vw::ConstantEdgeExtension >, vw::BilinearInterpolation> interp_img
+        = interpolate(cropped_img, vw::BilinearInterpolation(),
+                      vw::ConstantEdgeExtension());
+
+      vw::ImageView<result_type> tile(bbox.width(), bbox.height());
+      for (int col = bbox.min().x(); col < bbox.max().x(); col++){
+
+        // Accumulate the corrections up to the current column
+        // of the full image
+        int full_col = col + m_col_offset;
+        double valx = 0, valy = 0;
+        if (m_ccdx.size() > 0){
+          valx = 0.0;
+          for (size_t t = 0; t < m_ccdx.size(); t++){
+            if (m_posx[t] < full_col){
+              valx -= m_ccdx[t];
+            }
+          }
+          valy = 0.0;
+          for (size_t t = 0; t < m_ccdy.size(); t++){
+            if (m_posy[t] < full_col){
+              valy -= m_ccdy[t];
+            }
+          }
+        }
+
+        for (int row = bbox.min().y(); row < bbox.max().y(); row++){
+          tile(col - bbox.min().x(), row - bbox.min().y() )
+            = interp_img(col - biased_box.min().x() + valx,
+                         row - biased_box.min().y() + valy);
+        }
+      }
+
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
+                               cols(), rows() );
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  template <class ImageT>
+  WVCorrectView<ImageT> wv_correct(ImageT const& img,
+                                   int tdi, bool is_wv01, bool is_forward,
+                                   double pitch_ratio, int col_offset = 0){
+    return WVCorrectView<ImageT>(img, tdi, is_wv01, is_forward, pitch_ratio, col_offset);
+  }
+
+} // end namespace asp
+
+#endif//__ASP_CAMERA_WV_CORRECT_H__
@@ -0,0 +1,155 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+// Timing of the projections and triangulation of the DG and RPC
+// cameras, on the sample cameras of this directory. Run with 'make bench'.
+
+#include <asp/Camera/LinescanDGModel.h>
+#include <asp/Camera/RPC_XML.h>
+#include <asp/Camera/RPCModel.h>
+#include <asp/Camera/RPCStereoModel.h>
+#include <test/Helpers.h>
+#include <test/Benchmark.h>
+
+#include <vw/Stereo/StereoModel.h>
+
+using namespace vw;
+using namespace asp;
+using namespace vw::test;
+
+namespace {
+
+  typedef boost::shared_ptr<vw::camera::CameraModel> CameraModelPtr;
+
+  // A fixed grid of pixels over the image
+  std::vector<Vector2> pixel_grid(Vector2 const& size, int num) {
+    std::vector<Vector2> pixels;
+    for (int i = 0; i < num; i++)
+      for (int j = 0; j < num; j++)
+        pixels.push_back(Vector2((i + 0.5)*size[0]/num, (j + 0.5)*size[1]/num));
+    return pixels;
+  }
+
+  // Points on the ground seen by the pixels
+  std::vector<Vector3> ground_points(vw::camera::CameraModel const* cam,
+                                     std::vector<Vector2> const& pixels, double dist) {
+    std::vector<Vector3> points;
+    for (size_t i = 0; i < pixels.size(); i++)
+      points.push_back(cam->camera_center(pixels[i]) + dist*cam->pixel_to_vector(pixels[i]));
+    return points;
+  }
+
+  struct PointToPixel {
+    vw::camera::CameraModel const* cam;
+    std::vector<Vector3> const& points;
+    PointToPixel(vw::camera::CameraModel const* c, std::vector<Vector3> const& p):
+      cam(c), points(p) {}
+    void operator()() {
+      double sum = 0;
+      for (size_t i = 0; i < points.size(); i++)
+        sum += cam->point_to_pixel(points[i])[0];
+      benchmark_sink() += sum;
+    }
+  };
+
+  struct PixelToVector {
+    vw::camera::CameraModel const* cam;
+    std::vector<Vector2> const& pixels;
+    PixelToVector(vw::camera::CameraModel const* c, std::vector<Vector2> const& p):
+      cam(c), pixels(p) {}
+    void operator()() {
+      double sum = 0;
+      for (size_t i = 0; i < pixels.size(); i++)
+        sum += cam->pixel_to_vector(pixels[i])[0];
+      benchmark_sink() += sum;
+    }
+  };
+
+  template <class StereoModelT>
+  struct Triangulate {
+    StereoModelT const& model;
+    std::vector<Vector2> const& pix1, &pix2;
+    Triangulate(StereoModelT const& m, std::vector<Vector2> const& p1,
+                std::vector<Vector2> const& p2): model(m), pix1(p1), pix2(p2) {}
+    void operator()() {
+      double sum = 0, error;
+      for (size_t i = 0; i < pix1.size(); i++)
+        sum += model(pix1[i], pix2[i], error)[0];
+      benchmark_sink() += sum;
+    }
+  };
+
+  CameraModelPtr load_rpc(std::string const& path) {
+    RPCXML xml;
+    xml.read_from_file(path);
+    return CameraModelPtr(new RPCModel(*xml.rpc_ptr()));
+  }
+}
+
+// Each benchmark does 1024 calls on a 32 x 32 grid of pixels
+TEST(Benchmark, DGCameraModel) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  CameraModelPtr cam1(load_dg_camera_model_from_xml("dg_example1.xml"));
+  CameraModelPtr cam2(load_dg_camera_model_from_xml("dg_example2.xml"));
+  ASSERT_TRUE(cam1.get() != 0 && cam2.get() != 0);
+
+  // The pixels of the second camera seeing the same points
+  std::vector<Vector2> pix1 = pixel_grid(Vector2(35000, 21000), 32);
+  std::vector<Vector3> points = ground_points(cam1.get(), pix1, 6e5);
+  std::vector<Vector2> pix2;
+  for (size_t i = 0; i < points.size(); i++)
+    pix2.push_back(cam2->point_to_pixel(points[i]));
+
+  PointToPixel p2p(cam1.get(), points);
+  benchmark("dg_point_to_pixel_1024", p2p);
+
+  PixelToVector p2v(cam1.get(), pix1);
+  benchmark("dg_pixel_to_vector_1024", p2v);
+
+  vw::stereo::StereoModel sm(cam1.get(), cam2.get());
+  Triangulate<vw::stereo::StereoModel> tri(sm, pix1, pix2);
+  benchmark("dg_triangulate_1024", tri);
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
+
+TEST(Benchmark, RPCModel) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  CameraModelPtr cam1 = load_rpc("dg_example1.xml");
+  CameraModelPtr cam2 = load_rpc("dg_example4.xml");
+
+  std::vector<Vector2> pix1 = pixel_grid(Vector2(35000, 21000), 32);
+  std::vector<Vector3> points = ground_points(cam1.get(), pix1, 4e5);
+  std::vector<Vector2> pix2;
+  for (size_t i = 0; i < points.size(); i++)
+    pix2.push_back(cam2->point_to_pixel(points[i]));
+
+  PointToPixel p2p(cam1.get(), points);
+  benchmark("rpc_point_to_pixel_1024", p2p);
+
+  PixelToVector p2v(cam1.get(), pix1);
+  benchmark("rpc_pixel_to_vector_1024", p2v);
+
+  RPCStereoModel sm(cam1.get(), cam2.get());
+  Triangulate<RPCStereoModel> tri(sm, pix1, pix2);
+  benchmark("rpc_triangulate_1024", tri);
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
@@ -20,12 +20,15 @@
 #include <asp/Camera/RPC_XML.h>
 #include <asp/Camera/XMLBase.h>
 #include <asp/Camera/RPCModel.h>
+#include <asp/Camera/RPCModelGen.h>
+#include <asp/Camera/RPCApproxModel.h>
 #include <boost/scoped_ptr.hpp>
 #include <test/Helpers.h>
 
 #include <vw/Stereo/StereoModel.h>
 
 #include <vw/Cartography/GeoTransform.h>
+#include <vw/Cartography/CameraBBox.h>
 
 using namespace vw;
 using namespace asp;
@@ -158,3 +161,41 @@ TEST(DGCameraModel, CreateCamera) {
   XMLPlatformUtils::Terminate();
 }
 
+TEST(DGCameraModel, RPCApproximation) {
+
+  xercesc::XMLPlatformUtils::Initialize();
+
+  typedef boost::shared_ptr<vw::camera::CameraModel> CameraModelPtr;
+  CameraModelPtr cam(load_dg_camera_model_from_xml("dg_example1.xml"));
+  ASSERT_TRUE( cam.get() != 0 );
+
+  cartography::Datum datum("WGS84");
+  BBox2 image_box(25000, 8000, 5000, 5000);
+  Vector2 height_range(-200, 1000);
+  double max_error = 0;
+  boost::shared_ptr<RPCModel> rpc
+    = approximate_camera_with_rpc(cam.get(), datum, image_box, height_range,
+                                  20, 0.03, max_error);
+  ASSERT_TRUE( rpc.get() != 0 );
+  EXPECT_LT( max_error, 1.0 );
+
+  // Within the fit box the model is used, and agrees with the camera
+  RPCApproxModel approx_cam(cam, rpc);
+  for (int i = 0; i <= 4; i++) {
+    for (int j = 0; j <= 4; j++) {
+      Vector2 pix = image_box.min() + elem_prod(Vector2(i, j)/4.0, image_box.size());
+      Vector3 xyz = cartography::datum_intersection(datum.semi_major_axis() + 500,
+                                                    datum.semi_minor_axis() + 500,
+                                                    cam->camera_center(pix),
+                                                    cam->pixel_to_vector(pix));
+      EXPECT_VECTOR_NEAR( pix, approx_cam.point_to_pixel(xyz), 2*max_error + 0.01 );
+    }
+  }
+
+  // Far above the fit heights the camera itself is used
+  Vector2 pix = image_box.min() + image_box.size()/2.0;
+  Vector3 xyz = cam->camera_center(pix) + 1e5 * cam->pixel_to_vector(pix);
+  EXPECT_VECTOR_NEAR( cam->point_to_pixel(xyz), approx_cam.point_to_pixel(xyz), 1e-8 );
+
+  XMLPlatformUtils::Terminate();
+}
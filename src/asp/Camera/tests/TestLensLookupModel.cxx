@@ -0,0 +1,79 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <vw/Camera/PinholeModel.h>
+#include <vw/Camera/LensDistortion.h>
+#include <asp/Camera/LensLookupModel.h>
+
+using namespace vw;
+using namespace vw::camera;
+using namespace asp;
+
+namespace {
+  boost::shared_ptr<PinholeModel> make_camera(Vector3 const& center) {
+    return boost::shared_ptr<PinholeModel>
+      (new PinholeModel(center, math::identity_matrix<3>(),
+                        1000, 1000, 320, 240,
+                        Vector3(1,0,0), Vector3(0,1,0), Vector3(0,0,1),
+                        TsaiLensDistortion(Vector4(-0.1, 0.02, 1e-4, -1e-4))));
+  }
+}
+
+TEST( LensLookupModel, MatchesExact ) {
+
+  boost::shared_ptr<PinholeModel> exact = make_camera(Vector3(0, 0, 0));
+  boost::shared_ptr<CameraModel> cam
+    = lens_lookup_model(exact, BBox2i(0, 0, 640, 480), 4, 1e-3);
+  ASSERT_TRUE(dynamic_cast<LensLookupModel*>(cam.get()) != NULL);
+
+  for (double row = 0; row <= 480; row += 37.5) {
+    for (double col = 0; col <= 640; col += 41.3) {
+      Vector2 pix(col, row);
+      Vector3 dir = cam->pixel_to_vector(pix);
+      EXPECT_VECTOR_NEAR(exact->pixel_to_vector(pix), dir, 1e-5);
+
+      Vector3 point = cam->camera_center(pix) + 10.0*dir;
+      EXPECT_VECTOR_NEAR(pix, cam->point_to_pixel(point), 2e-3);
+      EXPECT_VECTOR_NEAR(exact->point_to_pixel(point), cam->point_to_pixel(point), 2e-3);
+    }
+  }
+}
+
+TEST( LensLookupModel, SharedTable ) {
+
+  // Cameras with the same intrinsics but different poses
+  boost::shared_ptr<CameraModel> cam1
+    = lens_lookup_model(make_camera(Vector3(0, 0, 0)), BBox2i(0, 0, 640, 480), 8, 1e-3);
+  boost::shared_ptr<PinholeModel> exact2 = make_camera(Vector3(5, -3, 2));
+  boost::shared_ptr<CameraModel> cam2
+    = lens_lookup_model(exact2, BBox2i(0, 0, 640, 480), 8, 1e-3);
+
+  Vector2 pix(100.5, 400.25);
+  EXPECT_VECTOR_NEAR(exact2->pixel_to_vector(pix), cam2->pixel_to_vector(pix), 1e-5);
+  EXPECT_VECTOR_NEAR(exact2->camera_center(pix), cam2->camera_center(pix), 1e-10);
+
+  // Far outside the table the exact model is used
+  Vector2 far_pix(2000, -1500);
+  EXPECT_VECTOR_NEAR(exact2->pixel_to_vector(far_pix), cam2->pixel_to_vector(far_pix), 1e-10);
+
+  // Cameras without distortion are left alone
+  boost::shared_ptr<PinholeModel> ideal
+    (new PinholeModel(Vector3(0, 0, 0), math::identity_matrix<3>(), 1000, 1000, 320, 240,
+                      Vector3(1,0,0), Vector3(0,1,0), Vector3(0,0,1), NullLensDistortion()));
+  EXPECT_EQ(ideal.get(), lens_lookup_model(ideal, BBox2i(0, 0, 640, 480), 8, 1e-3).get());
+}
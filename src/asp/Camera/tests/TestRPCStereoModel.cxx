@@ -182,6 +182,39 @@ TEST( StereoSessionRPC, InstantiateTest ) {
   xercesc::XMLPlatformUtils::Terminate();
 }
 
+TEST( StereoSessionRPC, BatchProjection ) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  RPCXML xml;
+  xml.read_from_file( "dg_example1.xml" );
+  RPCModel model( *xml.rpc_ptr() );
+
+  // The batch projection must agree with projecting one point at a time
+  const int NUM_POINTS = 25;
+  std::vector<double> lon(NUM_POINTS), lat(NUM_POINTS), height(NUM_POINTS),
+    col(NUM_POINTS), row(NUM_POINTS);
+  std::vector<Vector3> points(NUM_POINTS);
+  for (int i = 0; i < NUM_POINTS; i++) {
+    lon[i]    = -105.35 + 0.005*i;
+    lat[i]    =   39.70 + 0.004*i;
+    height[i] = 2000.0  + 20.0*i;
+    points[i] = model.datum().geodetic_to_cartesian(Vector3(lon[i], lat[i], height[i]));
+  }
+
+  model.geodetic_to_pixel(NUM_POINTS, &lon[0], &lat[0], &height[0], &col[0], &row[0]);
+  std::vector<Vector2> pixels;
+  model.point_to_pixel(points, pixels);
+  ASSERT_EQ( NUM_POINTS, (int)pixels.size() );
+
+  for (int i = 0; i < NUM_POINTS; i++) {
+    Vector2 pix = model.geodetic_to_pixel(Vector3(lon[i], lat[i], height[i]));
+    EXPECT_VECTOR_NEAR( pix, Vector2(col[i], row[i]), 1e-8 );
+    EXPECT_VECTOR_NEAR( model.point_to_pixel(points[i]), pixels[i], 1e-8 );
+  }
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
+
 TEST( StereoSessionRPC, CheckStereo ) {
 
   xercesc::XMLPlatformUtils::Initialize();
@@ -0,0 +1,126 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Core/BBoxTree.h>
+#include <algorithm>
+
+using namespace vw;
+
+namespace asp {
+
+namespace {
+
+  // At most this many boxes are kept in a leaf
+  const size_t LEAF_SIZE = 8;
+
+  // Compare boxes by their centers along a given axis
+  struct CenterLess {
+    std::vector<BBox2> const& m_boxes;
+    int m_axis;
+    CenterLess(std::vector<BBox2> const& boxes, int axis): m_boxes(boxes), m_axis(axis) {}
+    bool operator()(size_t a, size_t b) const {
+      return m_boxes[a].min()[m_axis] + m_boxes[a].max()[m_axis] <
+             m_boxes[b].min()[m_axis] + m_boxes[b].max()[m_axis];
+    }
+  };
+
+  // Same as BBox::intersects(), boundary included
+  inline bool overlap(BBox2 const& a, BBox2 const& b) {
+    return a.min().x() <= b.max().x() && b.min().x() <= a.max().x() &&
+           a.min().y() <= b.max().y() && b.min().y() <= a.max().y();
+  }
+}
+
+void BBoxTree::build(std::vector<BBox2> const& boxes) {
+
+  m_boxes = boxes;
+  m_indices.clear();
+  m_nodes.clear();
+
+  for (size_t i = 0; i < m_boxes.size(); i++) {
+    if (!m_boxes[i].empty())
+      m_indices.push_back(i);
+  }
+  if (m_indices.empty())
+    return;
+
+  m_nodes.reserve(4*(m_indices.size()/LEAF_SIZE + 1));
+  build_node(0, m_indices.size());
+}
+
+int BBoxTree::build_node(size_t begin, size_t end) {
+
+  BBox2 box;
+  for (size_t k = begin; k < end; k++)
+    box.grow(m_boxes[m_indices[k]]);
+
+  // Note that pushing to m_nodes invalidates references to its elements
+  int id = m_nodes.size();
+  Node node;
+  node.box   = box;
+  node.begin = begin;
+  node.end   = end;
+  node.left  = -1;
+  node.right = -1;
+  m_nodes.push_back(node);
+
+  if (end - begin <= LEAF_SIZE)
+    return id;
+
+  // Split at the median along the longer side
+  int axis = (box.width() >= box.height()) ? 0 : 1;
+  size_t mid = begin + (end - begin)/2;
+  std::nth_element(m_indices.begin() + begin, m_indices.begin() + mid,
+                   m_indices.begin() + end, CenterLess(m_boxes, axis));
+
+  int left  = build_node(begin, mid);
+  int right = build_node(mid, end);
+  m_nodes[id].left  = left;
+  m_nodes[id].right = right;
+
+  return id;
+}
+
+void BBoxTree::intersecting(BBox2 const& box, std::vector<size_t> & indices) const {
+
+  if (m_nodes.empty() || box.empty())
+    return;
+
+  size_t start = indices.size();
+  std::vector<int> stack;
+  stack.push_back(0);
+  while (!stack.empty()) {
+    Node const& node = m_nodes[stack.back()];
+    stack.pop_back();
+    if (!overlap(node.box, box))
+      continue;
+
+    if (node.left < 0) {
+      for (size_t k = node.begin; k < node.end; k++) {
+        if (overlap(m_boxes[m_indices[k]], box))
+          indices.push_back(m_indices[k]);
+      }
+    } else {
+      stack.push_back(node.left);
+      stack.push_back(node.right);
+    }
+  }
+
+  std::sort(indices.begin() + start, indices.end());
+}
+
+} // namespace asp
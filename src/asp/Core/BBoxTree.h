@@ -0,0 +1,67 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file BBoxTree.h
+///
+/// A static bounding box hierarchy to quickly find which of many 2D
+/// boxes intersect a given box. The tree is built once, by recursively
+/// splitting the boxes at the median of their centers along the longer
+/// side, and then it is only queried.
+
+#ifndef __ASP_CORE_BBOX_TREE_H__
+#define __ASP_CORE_BBOX_TREE_H__
+
+#include <vw/Math/BBox.h>
+#include <vector>
+
+namespace asp {
+
+  class BBoxTree {
+  public:
+
+    BBoxTree() {}
+
+    /// Build the tree. Empty boxes are never returned by queries.
+    /// Any previous contents are discarded.
+    void build(std::vector<vw::BBox2> const& boxes);
+
+    /// Append to the output the indices, in the vector passed to
+    /// build(), of the boxes which intersect the given box, with
+    /// the boundary included. The indices are in increasing order.
+    void intersecting(vw::BBox2 const& box, std::vector<size_t> & indices) const;
+
+    /// The number of non-empty boxes in the tree.
+    size_t size() const { return m_indices.size(); }
+
+  private:
+
+    struct Node {
+      vw::BBox2 box;       ///< The union of the boxes in this subtree
+      size_t begin, end;   ///< The range in m_indices of the boxes in this subtree
+      int    left, right;  ///< Children, or -1 for a leaf
+    };
+
+    int build_node(size_t begin, size_t end);
+
+    std::vector<vw::BBox2> m_boxes;
+    std::vector<size_t>    m_indices;
+    std::vector<Node>      m_nodes;
+  };
+
+} // namespace asp
+
+#endif//__ASP_CORE_BBOX_TREE_H__
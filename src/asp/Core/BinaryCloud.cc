@@ -0,0 +1,330 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file BinaryCloud.cc
+///
+
+#include <asp/Core/BinaryCloud.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <boost/algorithm/string.hpp>
+#include <cstring>
+
+using namespace vw;
+
+namespace asp {
+
+namespace {
+
+  const char       BINARY_CLOUD_MAGIC[8] = {'A', 'S', 'P', 'P', 'C', 'B', '1', '\0'};
+  const vw::uint32 BINARY_CLOUD_BYTE_ORDER = 0x01020304;
+
+  // The size of the header before the WKT
+  const size_t HEADER_SIZE = 8 + 2*sizeof(vw::uint32) + 4*sizeof(vw::uint64);
+
+  template <class T>
+  void write_value(std::ofstream & ofs, T const& value) {
+    ofs.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  template <class T>
+  void read_value(std::ifstream & ifs, T & value) {
+    ifs.read(reinterpret_cast<char*>(&value), sizeof(T));
+  }
+
+  int count_attributes(int attributes) {
+    int count = 0;
+    for (int k = 0; k < BINARY_CLOUD_NUM_ATTRIBUTES; k++)
+      if (attributes & (1 << k))
+        count++;
+    return count;
+  }
+
+  // Whether two boxes overlap, counting a shared boundary, as the box of
+  // a chunk may be flat or a single point. A box which was never grown
+  // has its min above its max, so it overlaps nothing.
+  template <class BBoxT>
+  bool boxes_overlap(BBoxT const& a, BBoxT const& b) {
+    for (size_t c = 0; c < a.min().size(); c++)
+      if (a.min()[c] > b.max()[c] || b.min()[c] > a.max()[c])
+        return false;
+    return true;
+  }
+
+  // Write the fields of the header which are known only at the end
+  void write_counts(std::ofstream & ofs, vw::uint64 num_points, vw::uint64 num_chunks,
+                    vw::uint64 index_offset) {
+    ofs.seekp(8 + 2*sizeof(vw::uint32));
+    write_value(ofs, num_points);
+    write_value(ofs, num_chunks);
+    write_value(ofs, index_offset);
+  }
+
+} // end anonymous namespace
+
+bool is_binary_cloud(std::string const& file) {
+  return boost::iends_with(file, ".pcb");
+}
+
+void BinaryCloudPoints::clear() {
+  xyz.clear();
+  for (size_t k = 0; k < attributes.size(); k++)
+    attributes[k].clear();
+}
+
+BinaryCloudWriter::BinaryCloudWriter(std::string const& file, int attributes,
+                                     vw::cartography::GeoReference const* georef,
+                                     int chunk_size):
+  m_file(file), m_attributes(attributes), m_has_georef(georef != NULL),
+  m_chunk_size(std::max(chunk_size, 1)), m_closed(false), m_num_points(0) {
+
+  VW_ASSERT(attributes >= 0 && attributes < (1 << BINARY_CLOUD_NUM_ATTRIBUTES),
+            ArgumentErr() << "BinaryCloudWriter: Invalid attributes: " << attributes << "\n");
+
+  m_ofs.open(file.c_str(), std::ios::out | std::ios::binary);
+  if (!m_ofs)
+    vw_throw( IOErr() << "Unable to open file \"" << file << "\"" );
+
+  std::string wkt;
+  if (m_has_georef) {
+    m_datum = georef->datum();
+    wkt     = georef->get_wkt();
+  }
+
+  m_ofs.write(BINARY_CLOUD_MAGIC, sizeof(BINARY_CLOUD_MAGIC));
+  write_value(m_ofs, BINARY_CLOUD_BYTE_ORDER);
+  write_value(m_ofs, vw::uint32(m_attributes));
+  write_counts(m_ofs, 0, 0, 0); // filled in by close()
+  write_value(m_ofs, vw::uint64(wkt.size()));
+  m_ofs.write(wkt.c_str(), wkt.size());
+
+  m_points.attributes.resize(count_attributes(m_attributes));
+}
+
+BinaryCloudWriter::~BinaryCloudWriter() {
+  try {
+    close();
+  } catch (std::exception const& e) {
+    vw_out(WarningMessage) << e.what() << std::endl;
+  }
+}
+
+void BinaryCloudWriter::add_point(Vector3 const& xyz, double intensity,
+                                  double error, double time) {
+  VW_ASSERT(!m_closed, LogicErr() << "BinaryCloudWriter: The file was closed.\n");
+
+  double values[BINARY_CLOUD_NUM_ATTRIBUTES] = {intensity, error, time};
+  m_points.xyz.push_back(xyz);
+  int col = 0;
+  for (int k = 0; k < BINARY_CLOUD_NUM_ATTRIBUTES; k++) {
+    if (m_attributes & (1 << k)) {
+      m_points.attributes[col].push_back(values[k]);
+      col++;
+    }
+  }
+  m_num_points++;
+
+  if (int(m_points.size()) >= m_chunk_size)
+    end_chunk();
+}
+
+void BinaryCloudWriter::add_points(BinaryCloudPoints const& points) {
+  VW_ASSERT(!m_closed, LogicErr() << "BinaryCloudWriter: The file was closed.\n");
+  VW_ASSERT(points.attributes.size() == m_points.attributes.size(),
+            ArgumentErr() << "BinaryCloudWriter: Expecting " << m_points.attributes.size()
+            << " attribute columns.\n");
+
+  for (size_t i = 0; i < points.size(); i++) {
+    m_points.xyz.push_back(points.xyz[i]);
+    for (size_t k = 0; k < points.attributes.size(); k++)
+      m_points.attributes[k].push_back(points.attributes[k][i]);
+    m_num_points++;
+
+    if (int(m_points.size()) >= m_chunk_size)
+      end_chunk();
+  }
+}
+
+void BinaryCloudWriter::end_chunk() {
+  if (m_points.size() == 0)
+    return;
+
+  BinaryCloudChunk chunk;
+  chunk.offset     = m_ofs.tellp();
+  chunk.num_points = m_points.size();
+
+  // The columns of coordinates, then of attributes
+  size_t num = m_points.size();
+  std::vector<double> column(num);
+  for (int c = 0; c < 3; c++) {
+    for (size_t i = 0; i < num; i++)
+      column[i] = m_points.xyz[i][c];
+    m_ofs.write(reinterpret_cast<const char*>(&column[0]), num*sizeof(double));
+  }
+  for (size_t k = 0; k < m_points.attributes.size(); k++)
+    m_ofs.write(reinterpret_cast<const char*>(&m_points.attributes[k][0]), num*sizeof(double));
+
+  for (size_t i = 0; i < num; i++) {
+    chunk.xyz_box.grow(m_points.xyz[i]);
+    if (m_has_georef) {
+      Vector3 llh = m_datum.cartesian_to_geodetic(m_points.xyz[i]);
+      chunk.lonlat_box.grow(subvector(llh, 0, 2));
+    }
+  }
+
+  if (!m_ofs)
+    vw_throw( IOErr() << "Failed writing file \"" << m_file << "\"" );
+
+  m_chunks.push_back(chunk);
+  m_points.clear();
+}
+
+void BinaryCloudWriter::close() {
+  if (m_closed)
+    return;
+  m_closed = true;
+  end_chunk();
+
+  vw::uint64 index_offset = m_ofs.tellp();
+  for (size_t i = 0; i < m_chunks.size(); i++) {
+    BinaryCloudChunk const& chunk = m_chunks[i];
+    write_value(m_ofs, chunk.offset);
+    write_value(m_ofs, chunk.num_points);
+    for (int c = 0; c < 3; c++) write_value(m_ofs, chunk.xyz_box.min()[c]);
+    for (int c = 0; c < 3; c++) write_value(m_ofs, chunk.xyz_box.max()[c]);
+    for (int c = 0; c < 2; c++) write_value(m_ofs, chunk.lonlat_box.min()[c]);
+    for (int c = 0; c < 2; c++) write_value(m_ofs, chunk.lonlat_box.max()[c]);
+  }
+  write_counts(m_ofs, m_num_points, m_chunks.size(), index_offset);
+  m_ofs.close();
+
+  if (!m_ofs)
+    vw_throw( IOErr() << "Failed writing file \"" << m_file << "\"" );
+}
+
+BinaryCloudReader::BinaryCloudReader(std::string const& file):
+  m_file(file), m_attributes(0), m_has_georef(false), m_num_points(0) {
+
+  m_ifs.open(file.c_str(), std::ios::in | std::ios::binary);
+  if (!m_ifs)
+    vw_throw( IOErr() << "Unable to open file \"" << file << "\"" );
+
+  char magic[sizeof(BINARY_CLOUD_MAGIC)];
+  vw::uint32 byte_order = 0, attributes = 0;
+  vw::uint64 num_chunks = 0, index_offset = 0, wkt_len = 0;
+  m_ifs.read(magic, sizeof(magic));
+  read_value(m_ifs, byte_order);
+  read_value(m_ifs, attributes);
+  read_value(m_ifs, m_num_points);
+  read_value(m_ifs, num_chunks);
+  read_value(m_ifs, index_offset);
+  read_value(m_ifs, wkt_len);
+  if (!m_ifs || memcmp(magic, BINARY_CLOUD_MAGIC, sizeof(magic)) != 0)
+    vw_throw( IOErr() << "Not a binary point cloud: " << file << "\n" );
+  if (byte_order != BINARY_CLOUD_BYTE_ORDER)
+    vw_throw( IOErr() << "The binary point cloud " << file
+                      << " was written on a machine with a different byte order.\n" );
+  if (index_offset < HEADER_SIZE)
+    vw_throw( IOErr() << "The binary point cloud " << file
+                      << " is incomplete, as it was not closed.\n" );
+  m_attributes = attributes;
+
+  std::string wkt(wkt_len, ' ');
+  if (wkt_len > 0)
+    m_ifs.read(&wkt[0], wkt_len);
+  if (wkt != "") {
+    m_georef.set_wkt(wkt);
+    m_has_georef = true;
+  }
+
+  m_ifs.seekg(index_offset);
+  m_chunks.resize(num_chunks);
+  for (size_t i = 0; i < m_chunks.size(); i++) {
+    BinaryCloudChunk & chunk = m_chunks[i];
+    read_value(m_ifs, chunk.offset);
+    read_value(m_ifs, chunk.num_points);
+    Vector3 xyz_min, xyz_max;
+    Vector2 ll_min, ll_max;
+    for (int c = 0; c < 3; c++) read_value(m_ifs, xyz_min[c]);
+    for (int c = 0; c < 3; c++) read_value(m_ifs, xyz_max[c]);
+    for (int c = 0; c < 2; c++) read_value(m_ifs, ll_min[c]);
+    for (int c = 0; c < 2; c++) read_value(m_ifs, ll_max[c]);
+    chunk.xyz_box    = BBox3(xyz_min, xyz_max);
+    chunk.lonlat_box = BBox2(ll_min, ll_max);
+  }
+  if (!m_ifs)
+    vw_throw( IOErr() << "Failed reading the index of " << file << "\n" );
+}
+
+int BinaryCloudReader::num_attribute_columns() const {
+  return count_attributes(m_attributes);
+}
+
+void BinaryCloudReader::read_chunk(int i, BinaryCloudPoints & points) {
+  VW_ASSERT(i >= 0 && i < num_chunks(),
+            ArgumentErr() << "BinaryCloudReader: Invalid chunk: " << i << "\n");
+
+  size_t num = m_chunks[i].num_points;
+  points.xyz.resize(num);
+  points.attributes.resize(num_attribute_columns());
+
+  m_ifs.seekg(m_chunks[i].offset);
+  std::vector<double> column(num);
+  for (int c = 0; c < 3; c++) {
+    if (num > 0)
+      m_ifs.read(reinterpret_cast<char*>(&column[0]), num*sizeof(double));
+    for (size_t p = 0; p < num; p++)
+      points.xyz[p][c] = column[p];
+  }
+  for (size_t k = 0; k < points.attributes.size(); k++) {
+    points.attributes[k].resize(num);
+    if (num > 0)
+      m_ifs.read(reinterpret_cast<char*>(&points.attributes[k][0]), num*sizeof(double));
+  }
+
+  if (!m_ifs)
+    vw_throw( IOErr() << "Failed reading chunk " << i << " of " << m_file << "\n" );
+}
+
+std::vector<int> BinaryCloudReader::chunks_in_box(BBox3 const& xyz_box) const {
+  std::vector<int> chunks;
+  for (int i = 0; i < num_chunks(); i++)
+    if (boxes_overlap(xyz_box, m_chunks[i].xyz_box))
+      chunks.push_back(i);
+  return chunks;
+}
+
+std::vector<int> BinaryCloudReader::chunks_in_lonlat_box(BBox2 const& lonlat_box) const {
+  std::vector<int> chunks;
+  for (int i = 0; i < num_chunks(); i++) {
+    BBox2 const& box = m_chunks[i].lonlat_box;
+    bool use = (lonlat_box.empty() || !m_has_georef);
+    for (int k = -1; k <= 1 && !use; k++)
+      use = boxes_overlap(lonlat_box, BBox2(box.min() + Vector2(360.0*k, 0),
+                                              box.max() + Vector2(360.0*k, 0)));
+    if (use)
+      chunks.push_back(i);
+  }
+  return chunks;
+}
+
+vw::uint64 binary_cloud_size(std::string const& file) {
+  BinaryCloudReader reader(file);
+  return reader.num_points();
+}
+
+} // namespace asp
@@ -0,0 +1,170 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file BinaryCloud.h
+///
+/// A compact binary format for point clouds, with the .pcb extension,
+/// which the point tools can exchange without converting to and
+/// parsing CSV text, or rasterizing to tif images.
+///
+/// The points are Cartesian (ECEF) and are stored in chunks. Within a
+/// chunk, the x, y, and z values are stored as columns of doubles, each
+/// followed by the column of each optional attribute (intensity, error,
+/// time). An index at the end of the file has the offset, number of
+/// points and bounding box of each chunk, so only the chunks which
+/// intersect a region need be read. The header has the georeference, if
+/// any, whose datum is used for the lon-lat boxes of the chunks.
+///
+/// Layout, in the byte order of the machine which wrote it:
+///   magic "ASPPCB1\0", uint32 byte order mark, uint32 attributes,
+///   uint64 num_points, uint64 num_chunks, uint64 index offset,
+///   uint64 WKT length, WKT of the georeference (empty if none),
+///   the chunks, then for each chunk: uint64 offset, uint64 num_points,
+///   6 doubles of its Cartesian box and 4 doubles of its lon-lat box.
+
+#ifndef __ASP_CORE_BINARY_CLOUD_H__
+#define __ASP_CORE_BINARY_CLOUD_H__
+
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Math/Vector.h>
+#include <vw/Math/BBox.h>
+#include <vw/Cartography/GeoReference.h>
+#include <boost/noncopyable.hpp>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  /// The optional attributes of the points, which can be or-ed together.
+  enum BinaryCloudAttribute {
+    BINARY_CLOUD_INTENSITY = 1,
+    BINARY_CLOUD_ERROR     = 2,
+    BINARY_CLOUD_TIME      = 4
+  };
+
+  /// The number of attributes.
+  const int BINARY_CLOUD_NUM_ATTRIBUTES = 3;
+
+  /// Return true if this file has the extension of a binary cloud.
+  bool is_binary_cloud(std::string const& file);
+
+  /// What the index of a binary cloud has for each chunk.
+  struct BinaryCloudChunk {
+    vw::uint64 offset, num_points;
+    vw::BBox3  xyz_box;
+    vw::BBox2  lonlat_box; ///< Empty if the cloud has no georeference
+  };
+
+  /// The points of a chunk, with a column for each attribute the cloud
+  /// has, in the order of BinaryCloudAttribute.
+  struct BinaryCloudPoints {
+    std::vector<vw::Vector3> xyz;
+    std::vector< std::vector<double> > attributes;
+
+    void clear();
+    size_t size() const { return xyz.size(); }
+  };
+
+  /// Write a binary cloud, one point at a time. A chunk is written when
+  /// it is full, or earlier with end_chunk(), for example at the end of
+  /// a tile, so that the chunks hold points which are close together.
+  class BinaryCloudWriter: private boost::noncopyable {
+  public:
+    /// The georeference, if given, is saved, and its datum is used for
+    /// the lon-lat boxes of the chunks.
+    BinaryCloudWriter(std::string const& file, int attributes,
+                      vw::cartography::GeoReference const* georef = NULL,
+                      int chunk_size = 65536);
+
+    /// Closes the file, if close() was not called. Errors are only logged.
+    ~BinaryCloudWriter();
+
+    /// Add a point. Only the attributes the cloud has are used, the
+    /// others are ignored.
+    void add_point(vw::Vector3 const& xyz, double intensity = 0.0,
+                   double error = 0.0, double time = 0.0);
+
+    /// Add points whose attribute columns are those of this cloud, such
+    /// as the points of a chunk of a cloud with the same attributes.
+    void add_points(BinaryCloudPoints const& points);
+
+    /// Write the points added so far as a chunk, if there are any.
+    void end_chunk();
+
+    /// Write the last chunk and the index.
+    void close();
+
+    vw::uint64 num_points() const { return m_num_points; }
+
+  private:
+    std::string   m_file;
+    std::ofstream m_ofs;
+    int           m_attributes;
+    bool          m_has_georef;
+    vw::cartography::Datum m_datum;
+    int           m_chunk_size;
+    bool          m_closed;
+    vw::uint64    m_num_points;
+    BinaryCloudPoints             m_points;
+    std::vector<BinaryCloudChunk> m_chunks;
+  };
+
+  /// Read the header and index of a binary cloud, then any of its chunks.
+  class BinaryCloudReader: private boost::noncopyable {
+  public:
+    BinaryCloudReader(std::string const& file);
+
+    vw::uint64 num_points() const { return m_num_points; }
+    int        num_chunks() const { return m_chunks.size(); }
+    int        attributes() const { return m_attributes; }
+
+    /// The number of attribute columns of each chunk.
+    int num_attribute_columns() const;
+
+    bool has_georef() const { return m_has_georef; }
+    vw::cartography::GeoReference const& georef() const { return m_georef; }
+
+    BinaryCloudChunk const& chunk(int i) const { return m_chunks[i]; }
+
+    /// Read the points of a chunk.
+    void read_chunk(int i, BinaryCloudPoints & points);
+
+    /// The chunks whose boxes intersect the given Cartesian box.
+    std::vector<int> chunks_in_box(vw::BBox3 const& xyz_box) const;
+
+    /// The chunks whose boxes intersect the given lon-lat box, allowing
+    /// for the box to be shifted by 360 degrees. All chunks if the box
+    /// is empty or the cloud has no georeference.
+    std::vector<int> chunks_in_lonlat_box(vw::BBox2 const& lonlat_box) const;
+
+  private:
+    std::string   m_file;
+    std::ifstream m_ifs;
+    int           m_attributes;
+    bool          m_has_georef;
+    vw::cartography::GeoReference m_georef;
+    vw::uint64    m_num_points;
+    std::vector<BinaryCloudChunk> m_chunks;
+  };
+
+  /// Returns the number of points stored in a binary cloud.
+  vw::uint64 binary_cloud_size(std::string const& file);
+
+} // namespace asp
+
+#endif//__ASP_CORE_BINARY_CLOUD_H__
@@ -0,0 +1,207 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <vw/FileIO/DiskImageResourceGDAL.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/FileIO/DiskImageUtils.h>
+#include <vw/Image/Algorithms.h>
+#include <asp/Core/CameraGrid.h>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <sstream>
+
+using namespace vw;
+namespace fs = boost::filesystem;
+
+namespace {
+  const std::string CAMERA_GRID_SPACING_TAG    = "CAMERA_GRID_SPACING";
+  const std::string CAMERA_GRID_IMAGE_SIZE_TAG = "CAMERA_GRID_IMAGE_SIZE";
+  const std::string CAMERA_GRID_DEM_TAG        = "CAMERA_GRID_DEM";
+  const std::string CAMERA_GRID_CAMERA_TAG     = "CAMERA_GRID_CAMERA";
+  const std::string CAMERA_GRID_ADJUSTMENT_TAG = "CAMERA_GRID_ADJUSTMENT";
+
+  // To save the field, it must be non-empty
+  std::string grid_input_path(std::string const& file) {
+    if (file == "")
+      return "NONE";
+    return fs::absolute(file).string();
+  }
+
+  // If the grid was made after this input to it
+  bool grid_newer_than(std::string const& grid_file, std::string const& input) {
+    if (input == "NONE")
+      return true;
+    if (!fs::exists(input)) {
+      vw_out(WarningMessage) << "Ignoring " << grid_file << " as " << input
+                             << ", which it was made with, does not exist.\n";
+      return false;
+    }
+    if (fs::last_write_time(grid_file) < fs::last_write_time(input)) {
+      vw_out(WarningMessage) << "Ignoring " << grid_file << " as it is older than "
+                             << input << ".\n";
+      return false;
+    }
+    return true;
+  }
+}
+
+std::string asp::camera_grid_file(std::string const& map_image) {
+  return fs::path(map_image).replace_extension("").string() + "_CamGrid.tif";
+}
+
+void asp::camera_grid_keywords(int spacing, Vector2i const& image_size,
+                               std::string const& dem_file, std::string const& camera_file,
+                               std::string const& adjust_file,
+                               std::map<std::string, std::string> & keywords) {
+  std::ostringstream size;
+  size << image_size.x() << ' ' << image_size.y();
+  keywords[CAMERA_GRID_SPACING_TAG]    = boost::lexical_cast<std::string>(spacing);
+  keywords[CAMERA_GRID_IMAGE_SIZE_TAG] = size.str();
+  keywords[CAMERA_GRID_DEM_TAG]        = grid_input_path(dem_file);
+  keywords[CAMERA_GRID_CAMERA_TAG]     = grid_input_path(camera_file);
+  keywords[CAMERA_GRID_ADJUSTMENT_TAG] = grid_input_path(adjust_file);
+}
+
+bool asp::read_camera_grid(std::string const& map_image, std::string const& dem_file,
+                           int & spacing, ImageView<CameraGridPixelT> & grid) {
+
+  std::string grid_file = camera_grid_file(map_image);
+  if (!fs::exists(grid_file) || !fs::exists(map_image))
+    return false;
+
+  // A grid older than the image was made for an earlier projection
+  if (fs::last_write_time(grid_file) < fs::last_write_time(map_image)) {
+    vw_out(WarningMessage) << "Ignoring " << grid_file << " as it is older than "
+                           << map_image << ".\n";
+    return false;
+  }
+
+  std::string spacing_str, size_str, grid_dem, grid_camera, grid_adjust;
+  try {
+    DiskImageResourceGDAL rsrc(grid_file);
+    vw::cartography::read_header_string(rsrc, CAMERA_GRID_SPACING_TAG,    spacing_str);
+    vw::cartography::read_header_string(rsrc, CAMERA_GRID_IMAGE_SIZE_TAG, size_str);
+    vw::cartography::read_header_string(rsrc, CAMERA_GRID_DEM_TAG,        grid_dem);
+    vw::cartography::read_header_string(rsrc, CAMERA_GRID_CAMERA_TAG,     grid_camera);
+    vw::cartography::read_header_string(rsrc, CAMERA_GRID_ADJUSTMENT_TAG, grid_adjust);
+  } catch (...) {
+    return false;
+  }
+  if (grid_dem == "" || grid_camera == "" || grid_adjust == "")
+    return false; // Written before the inputs were saved
+
+  // The grid is of the intersections with the DEM it was made with
+  if (!fs::exists(dem_file) || !fs::exists(grid_dem) || !fs::equivalent(dem_file, grid_dem)) {
+    vw_out(WarningMessage) << "Ignoring " << grid_file << " as it was made with the DEM "
+                           << grid_dem << " rather than " << dem_file << ".\n";
+    return false;
+  }
+  if (!grid_newer_than(grid_file, grid_dem)    ||
+      !grid_newer_than(grid_file, grid_camera) ||
+      !grid_newer_than(grid_file, grid_adjust))
+    return false;
+
+  Vector2i image_size;
+  std::istringstream is(size_str);
+  try {
+    spacing = boost::lexical_cast<int>(spacing_str);
+  } catch (boost::bad_lexical_cast const&) {
+    return false;
+  }
+  if (!(is >> image_size[0] >> image_size[1]) || spacing <= 0)
+    return false;
+  if (image_size != vw::file_image_size(map_image)) {
+    vw_out(WarningMessage) << "Ignoring " << grid_file << " as it was made for an image of "
+                           << "another size than " << map_image << ".\n";
+    return false;
+  }
+
+  DiskImageView<CameraGridPixelT> disk_grid(grid_file);
+  if (disk_grid.cols() != (image_size.x() - 1)/spacing + 2 ||
+      disk_grid.rows() != (image_size.y() - 1)/spacing + 2)
+    return false;
+  grid = disk_grid;
+
+  vw_out() << "Using the camera grid: " << grid_file << "\n";
+  return true;
+}
+
+asp::CameraGridTrans::CameraGridTrans(cartography::Map2CamTrans const& exact,
+                                      std::string const& map_image,
+                                      std::string const& dem_file):
+  m_exact(exact), m_spacing(0) {
+
+  boost::shared_ptr< ImageView<CameraGridPixelT> > grid(new ImageView<CameraGridPixelT>);
+  if (read_camera_grid(map_image, dem_file, m_spacing, *grid))
+    m_grid = grid;
+}
+
+bool asp::CameraGridTrans::box_in_grid(BBox2i const& bbox, BBox2i & cells) const {
+  if (!m_grid || bbox.empty())
+    return false;
+
+  ImageView<CameraGridPixelT> const& grid = *m_grid;
+  int c0 = (int)floor(double(bbox.min().x())/m_spacing);
+  int r0 = (int)floor(double(bbox.min().y())/m_spacing);
+  int c1 = (int)floor(double(bbox.max().x() - 1)/m_spacing);
+  int r1 = (int)floor(double(bbox.max().y() - 1)/m_spacing);
+  if (c0 < 0 || r0 < 0 || c1 + 1 >= grid.cols() || r1 + 1 >= grid.rows())
+    return false;
+  for (int r = r0; r <= r1; r++) {
+    for (int c = c0; c <= c1; c++) {
+      if (grid(c, r)[2] == 0)
+        return false;
+    }
+  }
+  cells = BBox2i(c0, r0, c1 - c0 + 1, r1 - r0 + 1);
+  return true;
+}
+
+Vector2 asp::CameraGridTrans::reverse(Vector2 const& p) const {
+  if (!m_grid)
+    return m_exact.reverse(p);
+
+  ImageView<CameraGridPixelT> const& grid = *m_grid;
+  double x = p.x()/m_spacing, y = p.y()/m_spacing;
+  int c = (int)floor(x), r = (int)floor(y);
+  if (c < 0 || r < 0 || c + 1 >= grid.cols() || r + 1 >= grid.rows() || grid(c, r)[2] == 0)
+    return m_exact.reverse(p);
+
+  double dx = x - c, dy = y - r;
+  Vector2 out;
+  for (int k = 0; k < 2; k++)
+    out[k] = (1-dx)*(1-dy)*grid(c, r)[k]   + dx*(1-dy)*grid(c+1, r)[k]
+      +      (1-dx)*dy    *grid(c, r+1)[k] + dx*dy    *grid(c+1, r+1)[k];
+  return out;
+}
+
+BBox2i asp::CameraGridTrans::reverse_bbox(BBox2i const& bbox) const {
+
+  // The interpolated pixels are within the box of the cell corners
+  BBox2i cells;
+  if (!box_in_grid(bbox, cells))
+    return m_exact.reverse_bbox(bbox);
+
+  ImageView<CameraGridPixelT> const& grid = *m_grid;
+  BBox2 out;
+  for (int r = cells.min().y(); r <= cells.max().y(); r++) {
+    for (int c = cells.min().x(); c <= cells.max().x(); c++)
+      out.grow(Vector2(grid(c, r)[0], grid(c, r)[1]));
+  }
+  return grow_bbox_to_int(out);
+}
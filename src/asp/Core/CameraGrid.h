@@ -0,0 +1,208 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file CameraGrid.h
+///
+/// The camera pixels seen by a map-projected image, found by mapproject
+/// at the nodes of a grid of its pixels and saved next to it. Stereo
+/// with map-projected images then finds the camera pixel of an image
+/// pixel by bilinear interpolation into the grid, rather than by
+/// intersecting with the DEM and projecting into the camera each time.
+/// The grid cells where the interpolation is not accurate enough, or
+/// where some corner does not project, use the exact transform.
+
+#ifndef __ASP_CORE_CAMERA_GRID_H__
+#define __ASP_CORE_CAMERA_GRID_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/ProgressCallback.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/Transform.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+#include <vw/Cartography/Map2CamTrans.h>
+#include <asp/Core/CorrectionGrid.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <string>
+
+namespace asp {
+
+  /// A grid node has the camera pixel seen by the image pixel at
+  /// spacing times its index, and a flag which is 1 if the grid cell
+  /// having this node as its upper-left corner can be interpolated.
+  typedef vw::Vector3f CameraGridPixelT;
+
+  /// The file with the grid of a map-projected image
+  std::string camera_grid_file(std::string const& map_image);
+
+  /// The header keys of a grid, having its spacing, the size of its
+  /// image, and the DEM, camera, and camera adjustment it was made
+  /// with. The adjustment file can be empty.
+  void camera_grid_keywords(int spacing, vw::Vector2i const& image_size,
+                            std::string const& dem_file, std::string const& camera_file,
+                            std::string const& adjust_file,
+                            std::map<std::string, std::string> & keywords);
+
+  /// Read the grid of a map-projected image. Return false if there is
+  /// none, or if it is older than the image or than the DEM, camera,
+  /// or adjustment it was made with, or if it was made for an image of
+  /// another size or with another DEM than this one.
+  bool read_camera_grid(std::string const& map_image, std::string const& dem_file,
+                        int & spacing, vw::ImageView<CameraGridPixelT> & grid);
+
+  /// The grid nodes in a box of them, found with the transform from
+  /// image pixels to camera pixels, with the exact projection at the
+  /// cell centers compared to the interpolated ones.
+  template <class TransT>
+  class CameraGridView: public vw::ImageViewBase< CameraGridView<TransT> > {
+    TransT m_trans;
+    int    m_spacing, m_cols, m_rows;
+    double m_max_error;
+
+  public:
+
+    typedef CameraGridPixelT pixel_type;
+    typedef pixel_type       result_type;
+    typedef vw::ProceduralPixelAccessor<CameraGridView> pixel_accessor;
+
+    CameraGridView(TransT const& trans, int spacing, double max_error, int cols, int rows):
+      m_trans(trans), m_spacing(spacing), m_cols(cols), m_rows(rows),
+      m_max_error(max_error) {}
+
+    inline vw::int32 cols  () const { return m_cols; }
+    inline vw::int32 rows  () const { return m_rows; }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline pixel_type operator()( double /*i*/, double /*j*/, vw::int32 /*p*/ = 0 ) const {
+      vw::vw_throw(vw::NoImplErr() << "CameraGridView::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+
+      // A copy per tile, as the transform caches the DEM region it needs.
+      // The image pixels span the nodes of the tile and also the next
+      // ones, for the last cells.
+      TransT trans = m_trans;
+      vw::BBox2i pix_box(m_spacing*bbox.min(),
+                         m_spacing*bbox.max() + vw::Vector2i(1, 1));
+      try {
+        trans.reverse_bbox(pix_box);
+      }catch(...){}
+
+      // A grid of this spacing, with the cells beyond the error left for
+      // the exact transform.
+      bool refine = false;
+      CorrectionGrid<ReverseTransformFunc<TransT>, 2>
+        grid(ReverseTransformFunc<TransT>(&trans), pix_box, m_max_error, m_spacing, refine);
+
+      vw::ImageView<pixel_type> out(bbox.width(), bbox.height());
+      for (int row = 0; row < out.rows(); row++) {
+        for (int col = 0; col < out.cols(); col++) {
+          // A node is also a corner of the cells before it, maybe in
+          // another tile, so it is kept wherever it projects.
+          double nan = std::numeric_limits<double>::quiet_NaN();
+          vw::Vector2 node(nan, nan);
+          if (grid.node_valid(col, row))
+            node = grid.node_value(col, row);
+          out(col, row) = pixel_type(node[0], node[1], grid.cell_valid(col, row) ? 1 : 0);
+        }
+      }
+
+      return prerasterize_type(out, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  /// Find and write the grid of a map-projected image of the given
+  /// size, with nodes this many image pixels apart. ISIS cameras must
+  /// be projected into with one thread.
+  template <class TransT>
+  void write_camera_grid(std::string const& grid_file, vw::Vector2i const& image_size,
+                         TransT const& trans, int spacing, double max_error,
+                         std::string const& dem_file, std::string const& camera_file,
+                         std::string const& adjust_file, bool single_threaded,
+                         vw::cartography::GdalWriteOptions const& opt,
+                         vw::ProgressCallback const& progress) {
+
+    VW_ASSERT(spacing > 0, vw::ArgumentErr() << "The camera grid spacing must be positive.\n");
+
+    // A pixel in the last column or row is in a cell which needs the
+    // nodes on both sides of it.
+    int cols = (image_size.x() - 1)/spacing + 2;
+    int rows = (image_size.y() - 1)/spacing + 2;
+    CameraGridView<TransT> grid(trans, spacing, max_error, cols, rows);
+
+    std::map<std::string, std::string> keywords;
+    camera_grid_keywords(spacing, image_size, dem_file, camera_file, adjust_file, keywords);
+
+    bool has_georef = false, has_nodata = false;
+    vw::cartography::GeoReference georef;
+    double nodata = 0;
+    vw::vw_out() << "Writing: " << grid_file << "\n";
+    if (single_threaded)
+      vw::cartography::write_gdal_image(grid_file, grid, has_georef, georef,
+                                        has_nodata, nodata, opt, progress, keywords);
+    else
+      vw::cartography::block_write_gdal_image(grid_file, grid, has_georef, georef,
+                                              has_nodata, nodata, opt, progress, keywords);
+  }
+
+  /// The transform from the pixels of a map-projected image to the
+  /// camera pixels, using the grid saved by mapproject where it can be
+  /// interpolated, and the exact transform elsewhere, or everywhere if
+  /// there is no grid. The grid is shared by the copies.
+  class CameraGridTrans: public vw::TransformBase<CameraGridTrans> {
+    vw::cartography::Map2CamTrans m_exact;
+    boost::shared_ptr< vw::ImageView<CameraGridPixelT> > m_grid;
+    int m_spacing;
+
+    /// If all the grid cells having pixels in the box can be interpolated
+    bool box_in_grid(vw::BBox2i const& bbox, vw::BBox2i & cells) const;
+
+  public:
+    CameraGridTrans(vw::cartography::Map2CamTrans const& exact, std::string const& map_image,
+                    std::string const& dem_file);
+
+    bool has_grid() const { return bool(m_grid); }
+
+    vw::Vector2 reverse(vw::Vector2 const& p) const;
+    vw::BBox2i  reverse_bbox(vw::BBox2i const& bbox) const;
+
+    vw::Vector2 forward(vw::Vector2 const& p) const { return m_exact.forward(p); }
+    vw::BBox2i  forward_bbox(vw::BBox2i const& bbox) const { return m_exact.forward_bbox(bbox); }
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_CAMERA_GRID_H__
@@ -0,0 +1,168 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file Checkpoint.cc
+///
+
+#include <vw/Core/Exception.h>
+#include <asp/Core/Checkpoint.h>
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+namespace fs = boost::filesystem;
+
+namespace asp {
+
+namespace {
+
+  // The first line of a checkpoint file
+  const std::string CHECKPOINT_MAGIC = "ASP_CHECKPOINT 1";
+
+  void write_string(std::ofstream & ofs, std::string const& str) {
+    long long len = str.size();
+    ofs.write(reinterpret_cast<const char*>(&len), sizeof(len));
+    ofs.write(str.data(), len);
+  }
+
+  std::string read_string(std::ifstream & ifs) {
+    long long len = 0;
+    ifs.read(reinterpret_cast<char*>(&len), sizeof(len));
+    if (!ifs || len < 0)
+      vw::vw_throw(vw::IOErr() << "Corrupted checkpoint file.\n");
+    std::string str(len, ' ');
+    if (len > 0)
+      ifs.read(&str[0], len);
+    return str;
+  }
+
+} // end anonymous namespace
+
+int SolverCheckpoint::counter(std::string const& name) const {
+  std::map<std::string, int>::const_iterator it = m_counters.find(name);
+  if (it == m_counters.end())
+    vw::vw_throw(vw::ArgumentErr() << "Missing from the checkpoint: " << name << ".\n");
+  return it->second;
+}
+
+void SolverCheckpoint::set_block(std::string const& name, double const* data, size_t len) {
+  m_blocks[name].assign(data, data + len);
+}
+
+bool SolverCheckpoint::has_block(std::string const& name) const {
+  return m_blocks.find(name) != m_blocks.end();
+}
+
+size_t SolverCheckpoint::block_size(std::string const& name) const {
+  std::map<std::string, std::vector<double> >::const_iterator it = m_blocks.find(name);
+  if (it == m_blocks.end())
+    vw::vw_throw(vw::ArgumentErr() << "Missing from the checkpoint: " << name << ".\n");
+  return it->second.size();
+}
+
+void SolverCheckpoint::get_block(std::string const& name, double * data, size_t len) const {
+  if (block_size(name) != len)
+    vw::vw_throw(vw::ArgumentErr() << "The checkpoint has " << block_size(name)
+                 << " values for " << name << ", but " << len << " are expected. "
+                 << "It was created with different inputs.\n");
+  std::vector<double> const& block = m_blocks.find(name)->second;
+  std::copy(block.begin(), block.end(), data);
+}
+
+void SolverCheckpoint::write(std::string const& file) const {
+
+  std::string tmp_file = file + ".tmp";
+  {
+    std::ofstream ofs(tmp_file.c_str(), std::ios::out | std::ios::binary);
+    if (!ofs.good())
+      vw::vw_throw(vw::IOErr() << "Cannot write: " << tmp_file << "\n");
+
+    ofs << CHECKPOINT_MAGIC << "\n";
+
+    long long num = m_counters.size();
+    ofs.write(reinterpret_cast<const char*>(&num), sizeof(num));
+    for (std::map<std::string, int>::const_iterator it = m_counters.begin();
+         it != m_counters.end(); it++) {
+      write_string(ofs, it->first);
+      long long value = it->second;
+      ofs.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    num = m_blocks.size();
+    ofs.write(reinterpret_cast<const char*>(&num), sizeof(num));
+    for (std::map<std::string, std::vector<double> >::const_iterator it = m_blocks.begin();
+         it != m_blocks.end(); it++) {
+      write_string(ofs, it->first);
+      long long len = it->second.size();
+      ofs.write(reinterpret_cast<const char*>(&len), sizeof(len));
+      if (len > 0)
+        ofs.write(reinterpret_cast<const char*>(&it->second[0]), len*sizeof(double));
+    }
+
+    if (!ofs.good())
+      vw::vw_throw(vw::IOErr() << "Failed writing: " << tmp_file << "\n");
+  }
+
+  fs::rename(tmp_file, file);
+}
+
+void SolverCheckpoint::read(std::string const& file) {
+
+  m_counters.clear();
+  m_blocks.clear();
+
+  std::ifstream ifs(file.c_str(), std::ios::in | std::ios::binary);
+  if (!ifs.good())
+    vw::vw_throw(vw::IOErr() << "Cannot read: " << file << "\n");
+
+  std::string line;
+  std::getline(ifs, line);
+  if (line != CHECKPOINT_MAGIC)
+    vw::vw_throw(vw::IOErr() << "Not a checkpoint file: " << file << "\n");
+
+  long long num = 0;
+  ifs.read(reinterpret_cast<char*>(&num), sizeof(num));
+  for (long long k = 0; k < num && ifs; k++) {
+    std::string name = read_string(ifs);
+    long long value = 0;
+    ifs.read(reinterpret_cast<char*>(&value), sizeof(value));
+    m_counters[name] = value;
+  }
+
+  num = 0;
+  ifs.read(reinterpret_cast<char*>(&num), sizeof(num));
+  for (long long k = 0; k < num && ifs; k++) {
+    std::string name = read_string(ifs);
+    long long len = 0;
+    ifs.read(reinterpret_cast<char*>(&len), sizeof(len));
+    if (!ifs || len < 0)
+      break;
+    std::vector<double> & block = m_blocks[name];
+    block.resize(len);
+    if (len > 0)
+      ifs.read(reinterpret_cast<char*>(&block[0]), len*sizeof(double));
+  }
+
+  if (!ifs)
+    vw::vw_throw(vw::IOErr() << "Corrupted checkpoint file: " << file << "\n");
+}
+
+std::string checkpoint_file_name(std::string const& out_prefix) {
+  return out_prefix + "-checkpoint.bin";
+}
+
+} // end namespace asp
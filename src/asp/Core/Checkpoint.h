@@ -0,0 +1,72 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file Checkpoint.h
+///
+/// The state of a long optimization, such as the one in bundle_adjust,
+/// saved every few iterations so that the optimization can be resumed
+/// if the process is killed. The tools decide what goes in it: named
+/// counters, such as the pass and the iteration, and named arrays of
+/// parameters. The problem itself is rebuilt from the inputs on resume.
+
+#ifndef __ASP_CORE_CHECKPOINT_H__
+#define __ASP_CORE_CHECKPOINT_H__
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  class SolverCheckpoint {
+  public:
+
+    /// Set the counter with the given name.
+    void set_counter(std::string const& name, int value) { m_counters[name] = value; }
+
+    /// The counter with the given name, which must exist.
+    int counter(std::string const& name) const;
+
+    /// Save a copy of the given array under the given name.
+    void set_block(std::string const& name, double const* data, size_t len);
+
+    bool has_block(std::string const& name) const;
+
+    /// The length of the saved array with the given name, which must exist.
+    size_t block_size(std::string const& name) const;
+
+    /// Copy the saved array with the given name to the given one, which
+    /// must have the same length, as the problem was rebuilt the same way.
+    void get_block(std::string const& name, double * data, size_t len) const;
+
+    /// Write to a temporary file which is then renamed, so that a kill
+    /// while writing leaves the previous checkpoint intact.
+    void write(std::string const& file) const;
+
+    void read(std::string const& file);
+
+  private:
+    std::map<std::string, int> m_counters;
+    std::map<std::string, std::vector<double> > m_blocks;
+  };
+
+  /// The checkpoint file for the given output prefix.
+  std::string checkpoint_file_name(std::string const& out_prefix);
+
+} // end namespace asp
+
+#endif // __ASP_CORE_CHECKPOINT_H__
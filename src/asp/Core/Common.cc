@@ -21,6 +21,7 @@
 #include <vw/FileIO/DiskImageResource.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/Trace.h>
 
 #include <map>
 #include <sstream>
@@ -41,12 +42,60 @@
 
 #if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
 #include "ogr_spatialref.h"
+#include <gdal_priv.h>
+#include <cpl_string.h>
 #endif
 
 using namespace vw;
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
+bool asp::is_vsi_path( std::string const& input ) {
+  return boost::starts_with(input, "/vsi");
+}
+
+bool asp::file_exists( std::string const& input ) {
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+  if (is_vsi_path(input)) {
+    VSIStatBufL buf;
+    return VSIStatL(input.c_str(), &buf) == 0;
+  }
+#endif
+  return fs::exists(input);
+}
+
+void asp::configure_vsi_io(int argc, char *argv[]) {
+
+  bool has_vsi = false;
+  for (int i = 1; i < argc; i++) {
+    if (is_vsi_path(argv[i]))
+      has_vsi = true;
+  }
+  if (!has_vsi)
+    return;
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+  // Values set by the user, such as via environment variables, take precedence
+  const char* settings[][2] = {
+    {"VSI_CACHE",                          "TRUE"},
+    {"VSI_CACHE_SIZE",                     "67108864"},   // 64 MB per open file
+    {"CPL_VSIL_CURL_CHUNK_SIZE",           "1048576"},    // read ahead 1 MB
+    {"CPL_VSIL_CURL_CACHE_SIZE",           "1073741824"}, // 1 GB shared by all files
+    {"GDAL_HTTP_MERGE_CONSECUTIVE_RANGES", "YES"},
+    {"GDAL_HTTP_MULTIPLEX",                "YES"},
+    {"GDAL_DISABLE_READDIR_ON_OPEN",       "EMPTY_DIR"},
+    {"GDAL_HTTP_MAX_RETRY",                "5"},
+    {"GDAL_HTTP_RETRY_DELAY",              "1"}
+  };
+  for (size_t i = 0; i < sizeof(settings)/sizeof(settings[0]); i++) {
+    if (CPLGetConfigOption(settings[i][0], NULL) == NULL)
+      CPLSetConfigOption(settings[i][0], settings[i][1]);
+  }
+#else
+  vw_throw( NoImplErr() << "Reading from remote storage is not available without GDAL support. Please rebuild VW and ASP with GDAL." );
+#endif
+}
+
 bool asp::has_cam_extension( std::string const& input ) {
   std::string ext = get_extension(input);
   if ( has_pinhole_extension(input) ||
@@ -262,14 +311,14 @@ bool asp::parse_multiview_cmd_files(std::vector<std::string> const &filesIn,
 
   // Verify that the images and cameras exist, otherwise GDAL prints funny messages later.
   for (int i = 0; i < (int)image_paths.size(); i++){
-    if (!fs::exists(image_paths[i])) {
+    if (!asp::file_exists(image_paths[i])) {
       vw_throw( ArgumentErr() << "Cannot find the image file: " << image_paths[i] << ".\n");
       return false;
     }
   }
   
   for (int i = 0; i < (int)camera_paths.size(); i++){
-    if (!fs::exists(camera_paths[i])) {
+    if (!asp::file_exists(camera_paths[i])) {
       vw_throw( ArgumentErr() << "Cannot find the camera file: " << camera_paths[i] << ".\n");
       return false;
     }
@@ -317,6 +366,15 @@ std::string asp::current_posix_time_string() {
 // planet (a point on whose surface is given by 'shift'). Return an
 // inverse power of 2, 1/2^10 for Earth and proportionally less for
 // smaller bodies.
+vw::cartography::GdalWriteOptions
+asp::float_write_options(vw::cartography::GdalWriteOptions const& opt){
+  vw::cartography::GdalWriteOptions float_opt = opt;
+  std::map<std::string, std::string>::const_iterator it = opt.gdal_options.find("COMPRESS");
+  if (it != opt.gdal_options.end() && (it->second == "LZW" || it->second == "DEFLATE"))
+    float_opt.gdal_options["PREDICTOR"] = "3";
+  return float_opt;
+}
+
 double asp::get_rounding_error(vw::Vector3 const& shift, double rounding_error){
 
   // Do nothing if the user specified it.
@@ -426,6 +484,12 @@ asp::check_command_line( int argc, char *argv[], vw::cartography::GdalWriteOptio
 
   unregistered.clear();
 
+  // Inputs in remote storage are read through GDAL with these settings
+  configure_vsi_io(argc, argv);
+
+  // Record the time spent in each tile if ASP_TRACE_PREFIX is set
+  configure_tracing(fs::path(argv[0]).filename().string());
+
   // Ensure that opt gets all needed fields from vw::cartography::GdalWriteOptionsDescription().
   // This is needed not only for stereo, but for all tools using vw::cartography::GdalWriteOptions.
   stereo_settings().initialize(opt);
@@ -514,6 +578,15 @@ asp::check_command_line( int argc, char *argv[], vw::cartography::GdalWriteOptio
              << "\" is not a valid options for TIF_COMPRESS." );
   opt.gdal_options["COMPRESS"] = opt.tif_compress;
 
+  // With compression, have GDAL compress the blocks in its own
+  // threads, and write them in order as they are done. Then the tile
+  // writes, which are serialized, only hand over the pixels, and the
+  // compression overlaps with computing the next tiles.
+#if GDAL_VERSION_NUM >= 2010000
+  if (opt.tif_compress != "NONE")
+    opt.gdal_options["NUM_THREADS"] = boost::lexical_cast<std::string>(opt.num_threads);
+#endif
+
   return vm;
 }
 
@@ -567,6 +640,103 @@ void asp::set_srs_string(std::string srs_string, bool have_user_datum,
 
 }
 
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+namespace {
+  // Forward the GDAL progress to a VW progress callback
+  int cog_progress(double complete, const char* /*message*/, void* data) {
+    vw::ProgressCallback const* tpc = static_cast<vw::ProgressCallback const*>(data);
+    tpc->report_fractional_progress(complete, 1.0);
+    return TRUE;
+  }
+}
+#endif
+
+void asp::write_cog(std::string const& filename,
+                    vw::cartography::GdalWriteOptions const& opt,
+                    std::string const& resampling,
+                    vw::ProgressCallback const& tpc){
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+
+  const int cog_block_size = 256;
+
+  // The overviews are written to the input only without the COG driver
+  GDALAllRegister();
+  GDALDriver * driver = GetGDALDriverManager()->GetDriverByName("COG");
+  GDALDataset * src = (GDALDataset*)GDALOpen(filename.c_str(),
+                                             (driver != NULL) ? GA_ReadOnly : GA_Update);
+  if (src == NULL)
+    vw_throw( IOErr() << "Cannot open for conversion to COG: " << filename );
+
+  // Overviews halving the resolution until the image fits in one block
+  std::vector<int> levels;
+  int factor = 2;
+  while (std::max(src->GetRasterXSize(), src->GetRasterYSize()) > cog_block_size*(factor/2)) {
+    levels.push_back(factor);
+    factor *= 2;
+  }
+
+  std::string compress = "LZW";
+  std::map<std::string, std::string>::const_iterator it = opt.gdal_options.find("COMPRESS");
+  if (it != opt.gdal_options.end())
+    compress = it->second;
+  std::string bigtiff = "IF_SAFER";
+  it = opt.gdal_options.find("BIGTIFF");
+  if (it != opt.gdal_options.end())
+    bigtiff = it->second;
+  std::string threads = boost::lexical_cast<std::string>(std::max(opt.num_threads, 1));
+
+  // With GDAL 3.1 or later the COG driver builds the overviews and
+  // orders the file contents. Otherwise the overviews are built in
+  // the input file and copied after the full-resolution tiles, which
+  // is the same layout, without the COG driver's ghost header.
+  char ** create_opts = NULL;
+  create_opts = CSLSetNameValue(create_opts, "COMPRESS",   compress.c_str());
+  create_opts = CSLSetNameValue(create_opts, "BIGTIFF",    bigtiff.c_str());
+  create_opts = CSLSetNameValue(create_opts, "NUM_THREADS", threads.c_str());
+  if (driver != NULL) {
+    std::string block_size = boost::lexical_cast<std::string>(cog_block_size);
+    create_opts = CSLSetNameValue(create_opts, "BLOCKSIZE", block_size.c_str());
+    create_opts = CSLSetNameValue(create_opts, "RESAMPLING", resampling.c_str());
+  } else {
+    vw_out() << "The COG driver needs GDAL 3.1 or later. Writing a tiled GeoTIFF "
+             << "with overviews instead.\n";
+    driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    std::string block_size = boost::lexical_cast<std::string>(cog_block_size);
+    create_opts = CSLSetNameValue(create_opts, "TILED",       "YES");
+    create_opts = CSLSetNameValue(create_opts, "BLOCKXSIZE",  block_size.c_str());
+    create_opts = CSLSetNameValue(create_opts, "BLOCKYSIZE",  block_size.c_str());
+    create_opts = CSLSetNameValue(create_opts, "COPY_SRC_OVERVIEWS", "YES");
+    CPLSetConfigOption("GDAL_NUM_THREADS", threads.c_str());
+    if (!levels.empty() &&
+        src->BuildOverviews(resampling.c_str(), levels.size(), &levels[0], 0, NULL,
+                            GDALDummyProgress, NULL) != CE_None) {
+      GDALClose(src);
+      CSLDestroy(create_opts);
+      vw_throw( IOErr() << "Failed to build the overviews of: " << filename );
+    }
+  }
+
+  // Write to a temporary file next to the output, then replace it
+  std::string tmp_file = fs::path(filename).replace_extension(".cog.tmp.tif").string();
+  GDALDataset * dst = driver->CreateCopy(tmp_file.c_str(), src, FALSE, create_opts,
+                                         cog_progress, (void*)&tpc);
+  CSLDestroy(create_opts);
+  GDALClose(src);
+  if (dst == NULL) {
+    fs::remove(tmp_file);
+    vw_throw( IOErr() << "Failed to write the COG: " << tmp_file );
+  }
+  GDALClose(dst);
+  tpc.report_finished();
+
+  fs::rename(tmp_file, filename);
+  
+#else
+  vw_throw( NoImplErr() << "COG output is not available without GDAL support. Please rebuild VW and ASP with GDAL." );
+#endif
+}
+
 
 void asp::BitChecker::check_argument( vw::uint8 arg ) {
   // Turn on the arg'th bit in m_checksum
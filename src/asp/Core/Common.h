@@ -36,6 +36,7 @@
 #include <vw/Math/Vector.h>
 #include <vw/FileIO/FileUtils.h>
 #include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelMask.h>
 #include <vw/Cartography/GeoReference.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <map>
@@ -58,6 +59,21 @@ namespace asp {
   /// Returns true for a shapefile
   bool has_shp_extension( std::string const& input );
 
+  /// Returns true for a path read through a GDAL virtual file system,
+  /// such as /vsis3/bucket/file.tif or /vsicurl/https://host/file.tif.
+  bool is_vsi_path( std::string const& input );
+
+  /// Returns true if the file exists, either on disk or, for a GDAL
+  /// virtual file system path, in remote storage.
+  bool file_exists( std::string const& input );
+
+  /// If any of the given arguments is a GDAL virtual file system path,
+  /// set the GDAL options for remote reads which the user did not
+  /// set in the environment: range requests merged and fetched in big
+  /// chunks, a per-file block cache, a shared cache of downloaded
+  /// chunks, and retries.
+  void configure_vsi_io(int argc, char *argv[]);
+
   /// Returns true if all of the input files have the given extension.
   bool all_files_have_extension(std::vector<std::string> const& files, std::string const& ext);
   
@@ -179,6 +195,34 @@ namespace asp {
   }
 
 
+  /// Round the valid disparities in an image to a multiple of the given
+  /// value. No rounding is done if the value is not positive.
+  struct RoundDisparity: public vw::ReturnFixedType< vw::PixelMask<vw::Vector2f> > {
+    double m_rounding_error;
+    RoundDisparity(double rounding_error):m_rounding_error(rounding_error){}
+    vw::PixelMask<vw::Vector2f> operator() (vw::PixelMask<vw::Vector2f> const& pix) const {
+      if (!(m_rounding_error > 0.0) || !is_valid(pix))
+        return pix;
+      vw::PixelMask<vw::Vector2f> ans = pix;
+      for (int i = 0; i < 2; i++)
+        ans.child()[i] = m_rounding_error*round(pix.child()[i]/m_rounding_error);
+      return ans;
+    }
+  };
+  template <class ImageT>
+  vw::UnaryPerPixelView<ImageT, RoundDisparity>
+  inline round_disparity( vw::ImageViewBase<ImageT> const& image,
+                          double rounding_error ) {
+    return vw::UnaryPerPixelView<ImageT, RoundDisparity>
+      ( image.impl(), RoundDisparity(rounding_error) );
+  }
+
+  /// The options for writing a floating-point image, such as a
+  /// disparity or a point cloud. With LZW or DEFLATE compression,
+  /// use the floating-point predictor, which makes it more effective.
+  vw::cartography::GdalWriteOptions
+  float_write_options(vw::cartography::GdalWriteOptions const& opt);
+
   /// To help with compression, round to about 1mm, but
   /// use for rounding a number with few digits in binary.
   const double APPROX_ONE_MM = 1.0/1024.0;
@@ -237,6 +281,14 @@ namespace asp {
                                  vw::cartography::GdalWriteOptions & opt,
                                  vw::ProgressCallback const& tpc);
 
+  /// Convert in place a GeoTIFF written by the block writer to a
+  /// Cloud Optimized GeoTIFF, with internal 256 x 256 tiles and
+  /// overviews made with the given GDAL resampling method.
+  void write_cog(std::string const& filename,
+                 vw::cartography::GdalWriteOptions const& opt,
+                 std::string const& resampling = "AVERAGE",
+                 vw::ProgressCallback const& tpc = vw::ProgressCallback::dummy_instance());
+
 
   // TODO: Replace with something else!
   /// Convenience class for setting flags and later on
@@ -0,0 +1,257 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Core/ConnectedComponents.h>
+#include <vw/Core/Exception.h>
+#include <algorithm>
+
+using namespace vw;
+
+namespace asp {
+
+namespace {
+
+  // Union-find with path halving. The root of each set is its smallest
+  // element, so that the result does not depend on the order of unions.
+  template <class IndexT>
+  IndexT find_root(std::vector<IndexT> & parent, IndexT i) {
+    while (parent[i] != i) {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+    }
+    return i;
+  }
+
+  template <class IndexT>
+  void join(std::vector<IndexT> & parent, IndexT a, IndexT b) {
+    a = find_root(parent, a);
+    b = find_root(parent, b);
+    if (a < b)
+      parent[b] = a;
+    else if (b < a)
+      parent[a] = b;
+  }
+}
+
+void label_components(std::vector<unsigned char> const& mask, int cols, int rows,
+                      std::vector<int> & labels, std::vector<int64> & sizes) {
+
+  VW_ASSERT(int64(mask.size()) == int64(cols)*rows,
+            ArgumentErr() << "label_components: Mask size does not match the dimensions.\n");
+
+  // First pass: provisional labels, with the equivalences between
+  // them recorded as they meet.
+  labels.assign(mask.size(), -1);
+  std::vector<int> parent;
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      int k = row*cols + col;
+      if (!mask[k])
+        continue;
+      // The neighbors already visited: left, up-left, up, and up-right
+      int nbrs[4] = {-1, -1, -1, -1};
+      if (col > 0)                       nbrs[0] = labels[k - 1];
+      if (row > 0 && col > 0)            nbrs[1] = labels[k - cols - 1];
+      if (row > 0)                       nbrs[2] = labels[k - cols];
+      if (row > 0 && col + 1 < cols)     nbrs[3] = labels[k - cols + 1];
+      for (int n = 0; n < 4; n++) {
+        if (nbrs[n] < 0)
+          continue;
+        if (labels[k] < 0)
+          labels[k] = nbrs[n];
+        else if (nbrs[n] != labels[k])
+          join(parent, labels[k], nbrs[n]);
+      }
+      if (labels[k] < 0) {
+        labels[k] = parent.size();
+        parent.push_back(labels[k]);
+      }
+    }
+  }
+
+  // Second pass: number the roots in order of first appearance
+  std::vector<int> final_label(parent.size(), -1);
+  sizes.clear();
+  for (size_t k = 0; k < labels.size(); k++) {
+    if (labels[k] < 0)
+      continue;
+    int root = find_root(parent, labels[k]);
+    if (final_label[root] < 0) {
+      final_label[root] = sizes.size();
+      sizes.push_back(0);
+    }
+    labels[k] = final_label[root];
+    sizes[labels[k]]++;
+  }
+}
+
+TiledComponents::TiledComponents(int cols, int rows, int tile_size):
+  m_cols(cols), m_rows(rows), m_tile_size(std::max(tile_size, 1)) {
+
+  m_tiles_x = (m_cols + m_tile_size - 1)/m_tile_size;
+  m_tiles_y = (m_rows + m_tile_size - 1)/m_tile_size;
+  for (int ty = 0; ty < m_tiles_y; ty++) {
+    for (int tx = 0; tx < m_tiles_x; tx++) {
+      BBox2i box(tx*m_tile_size, ty*m_tile_size, m_tile_size, m_tile_size);
+      box.crop(BBox2i(0, 0, m_cols, m_rows));
+      m_tiles.push_back(box);
+    }
+  }
+  m_edges.resize(m_tiles.size());
+}
+
+void TiledComponents::intersecting_tiles(BBox2i const& box,
+                                         std::vector<int> & tile_ids) const {
+  tile_ids.clear();
+  BBox2i crop_box = box;
+  crop_box.crop(BBox2i(0, 0, m_cols, m_rows));
+  if (crop_box.empty())
+    return;
+  for (int ty = crop_box.min().y()/m_tile_size; ty <= (crop_box.max().y() - 1)/m_tile_size; ty++)
+    for (int tx = crop_box.min().x()/m_tile_size; tx <= (crop_box.max().x() - 1)/m_tile_size; tx++)
+      tile_ids.push_back(ty*m_tiles_x + tx);
+}
+
+void TiledComponents::boundary_ids(int tile_id, std::vector<int> const& labels,
+                                   int num_labels, std::vector<int> & ids) const {
+
+  // Visit the boundary in a fixed order, so that the indices are the
+  // same each time the tile is labeled.
+  int w = m_tiles[tile_id].width(), h = m_tiles[tile_id].height();
+  ids.assign(num_labels, -1);
+  int count = 0;
+  for (int side = 0; side < 4; side++) {
+    int len = (side < 2) ? w : h;
+    for (int i = 0; i < len; i++) {
+      int k = 0;
+      if      (side == 0) k = i;             // top
+      else if (side == 1) k = (h - 1)*w + i; // bottom
+      else if (side == 2) k = i*w;           // left
+      else                k = i*w + w - 1;   // right
+      int label = labels[k];
+      if (label >= 0 && ids[label] < 0)
+        ids[label] = count++;
+    }
+  }
+}
+
+void TiledComponents::add_tile(int tile_id, std::vector<int> const& labels,
+                               std::vector<int64> const& sizes) {
+
+  int w = m_tiles[tile_id].width(), h = m_tiles[tile_id].height();
+  std::vector<int> ids;
+  boundary_ids(tile_id, labels, sizes.size(), ids);
+
+  TileEdges & edges = m_edges[tile_id];
+  edges.top.resize(w);
+  edges.bottom.resize(w);
+  edges.left.resize(h);
+  edges.right.resize(h);
+  for (int i = 0; i < w; i++) {
+    edges.top[i]    = (labels[i]           >= 0) ? ids[labels[i]]           : -1;
+    edges.bottom[i] = (labels[(h-1)*w + i] >= 0) ? ids[labels[(h-1)*w + i]] : -1;
+  }
+  for (int i = 0; i < h; i++) {
+    edges.left[i]  = (labels[i*w]         >= 0) ? ids[labels[i*w]]         : -1;
+    edges.right[i] = (labels[i*w + w - 1] >= 0) ? ids[labels[i*w + w - 1]] : -1;
+  }
+
+  edges.sizes.clear();
+  for (size_t label = 0; label < ids.size(); label++) {
+    if (ids[label] < 0)
+      continue;
+    if (int(edges.sizes.size()) <= ids[label])
+      edges.sizes.resize(ids[label] + 1);
+    edges.sizes[ids[label]] = sizes[label];
+  }
+}
+
+void TiledComponents::merge() {
+
+  m_offsets.resize(m_tiles.size() + 1);
+  m_offsets[0] = 0;
+  for (size_t t = 0; t < m_tiles.size(); t++)
+    m_offsets[t + 1] = m_offsets[t] + m_edges[t].sizes.size();
+
+  std::vector<int64> parent(m_offsets.back());
+  for (size_t i = 0; i < parent.size(); i++)
+    parent[i] = i;
+
+  // The seams with the right and bottom neighbors, where each pixel
+  // touches three across the seam, and the corners with the diagonal
+  // neighbors below.
+  for (int ty = 0; ty < m_tiles_y; ty++) {
+    for (int tx = 0; tx < m_tiles_x; tx++) {
+      int t = ty*m_tiles_x + tx;
+      if (tx + 1 < m_tiles_x)
+        join_seam(parent, t, m_edges[t].right, t + 1, m_edges[t + 1].left);
+      if (ty + 1 < m_tiles_y)
+        join_seam(parent, t, m_edges[t].bottom, t + m_tiles_x, m_edges[t + m_tiles_x].top);
+      if (tx + 1 < m_tiles_x && ty + 1 < m_tiles_y) {
+        int n = t + m_tiles_x + 1;
+        join_pixels(parent, t, m_edges[t].right.back(), n, m_edges[n].left.front());
+      }
+      if (tx > 0 && ty + 1 < m_tiles_y) {
+        int n = t + m_tiles_x - 1;
+        join_pixels(parent, t, m_edges[t].left.back(), n, m_edges[n].right.front());
+      }
+    }
+  }
+
+  std::vector<int64> root_totals(parent.size(), 0);
+  for (size_t t = 0; t < m_tiles.size(); t++)
+    for (size_t i = 0; i < m_edges[t].sizes.size(); i++)
+      root_totals[find_root(parent, int64(m_offsets[t] + i))] += m_edges[t].sizes[i];
+
+  m_totals.resize(parent.size());
+  for (size_t i = 0; i < parent.size(); i++)
+    m_totals[i] = root_totals[find_root(parent, int64(i))];
+
+  std::vector<TileEdges>().swap(m_edges);
+}
+
+void TiledComponents::join_pixels(std::vector<int64> & parent, int tile1, int id1,
+                                  int tile2, int id2) const {
+  if (id1 >= 0 && id2 >= 0)
+    join(parent, m_offsets[tile1] + id1, m_offsets[tile2] + id2);
+}
+
+void TiledComponents::join_seam(std::vector<int64> & parent, int tile1,
+                                std::vector<int> const& edge1, int tile2,
+                                std::vector<int> const& edge2) const {
+  int len = edge1.size();
+  for (int i = 0; i < len; i++) {
+    for (int j = std::max(i - 1, 0); j <= std::min(i + 1, len - 1); j++)
+      join_pixels(parent, tile1, edge1[i], tile2, edge2[j]);
+  }
+}
+
+void TiledComponents::component_sizes(int tile_id, std::vector<int> const& labels,
+                                      std::vector<int64> & sizes) const {
+
+  VW_ASSERT(m_offsets.size() == m_tiles.size() + 1,
+            LogicErr() << "TiledComponents: merge() must be called first.\n");
+
+  std::vector<int> ids;
+  boundary_ids(tile_id, labels, sizes.size(), ids);
+  for (size_t label = 0; label < ids.size(); label++) {
+    if (ids[label] >= 0)
+      sizes[label] = m_totals[m_offsets[tile_id] + ids[label]];
+  }
+}
+
+} // namespace asp
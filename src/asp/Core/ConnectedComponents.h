@@ -0,0 +1,230 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file ConnectedComponents.h
+///
+/// Connected components of the valid pixels of images too large to
+/// label at once. The image is split into a grid of tiles, which are
+/// labeled in parallel, and the components touching the tile
+/// boundaries are merged across the seams with a union-find. Only
+/// those boundary components are kept for the whole image, so memory
+/// use does not depend on how large the components are.
+
+#ifndef __ASP_CORE_CONNECTED_COMPONENTS_H__
+#define __ASP_CORE_CONNECTED_COMPONENTS_H__
+
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/BlockRasterize.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/PixelAccessors.h>
+#include <vw/Math/BBox.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <vector>
+
+namespace asp {
+
+  /// Label the 8-connected components of the nonzero pixels of a mask
+  /// stored row by row. Each label is set to its component index, or
+  /// to -1 for zero pixels, with the indices in order of first
+  /// appearance, so the same mask always gets the same labels. The
+  /// number of pixels in each component is returned in sizes.
+  void label_components(std::vector<unsigned char> const& mask, int cols, int rows,
+                        std::vector<int> & labels, std::vector<vw::int64> & sizes);
+
+  /// The sizes of the 8-connected components of an image, found tile
+  /// by tile. Each tile is labeled with label_components() and passed to
+  /// add_tile(), then merge() joins the components across the seams.
+  /// Afterwards, a tile labeled again the same way gets from
+  /// component_sizes() the sizes over the whole image.
+  class TiledComponents {
+  public:
+
+    TiledComponents(int cols, int rows, int tile_size);
+
+    /// The tiles, in row-major order of the grid.
+    std::vector<vw::BBox2i> const& tiles() const { return m_tiles; }
+
+    /// The tiles which intersect a box.
+    void intersecting_tiles(vw::BBox2i const& box, std::vector<int> & tile_ids) const;
+
+    /// Record the components of a tile touching its boundary. Can be
+    /// called from several threads, for different tiles.
+    void add_tile(int tile_id, std::vector<int> const& labels,
+                  std::vector<vw::int64> const& sizes);
+
+    /// Merge the components across the seams, once all tiles were added.
+    void merge();
+
+    /// Replace the sizes of the components of a tile, labeled the same
+    /// way as for add_tile(), with their sizes over the whole image.
+    void component_sizes(int tile_id, std::vector<int> const& labels,
+                         std::vector<vw::int64> & sizes) const;
+
+  private:
+
+    struct TileEdges {
+      // The boundary component index of each pixel on each side, or -1
+      std::vector<int> top, bottom, left, right;
+      std::vector<vw::int64> sizes; // the size within the tile of each boundary component
+    };
+
+    // For each label of a tile, its index among the components
+    // touching the boundary, or -1.
+    void boundary_ids(int tile_id, std::vector<int> const& labels, int num_labels,
+                      std::vector<int> & ids) const;
+
+    // Join two boundary components of two tiles, unless either is -1
+    void join_pixels(std::vector<vw::int64> & parent, int tile1, int id1,
+                     int tile2, int id2) const;
+
+    // Join the boundary components along a seam between two tiles
+    void join_seam(std::vector<vw::int64> & parent, int tile1, std::vector<int> const& edge1,
+                   int tile2, std::vector<int> const& edge2) const;
+
+    int m_cols, m_rows, m_tile_size, m_tiles_x, m_tiles_y;
+    std::vector<vw::BBox2i>  m_tiles;
+    std::vector<TileEdges>   m_edges;   // freed by merge()
+    std::vector<vw::int64>   m_offsets; // the first global boundary component of each tile
+    std::vector<vw::int64>   m_totals;  // the size over the image of each boundary component
+  };
+
+  /// Rasterize one tile of an image and label its valid pixels with
+  /// label_components().
+  template <class ImageT>
+  void label_tile(ImageT const& img, vw::BBox2i const& box,
+                  vw::ImageView<typename ImageT::pixel_type> & tile,
+                  std::vector<int> & labels, std::vector<vw::int64> & sizes) {
+    tile = vw::crop(img, box);
+    std::vector<unsigned char> mask(tile.cols()*tile.rows());
+    for (int row = 0; row < tile.rows(); row++)
+      for (int col = 0; col < tile.cols(); col++)
+        mask[row*tile.cols() + col] = is_valid(tile(col, row));
+    label_components(mask, tile.cols(), tile.rows(), labels, sizes);
+  }
+
+  /// Label one tile of an image and add it to a TiledComponents object.
+  template <class ImageT>
+  class ComponentTileTask: public vw::Task, private boost::noncopyable {
+    ImageT           m_img;
+    int              m_tile_id;
+    TiledComponents& m_components;
+  public:
+    ComponentTileTask(ImageT const& img, int tile_id, TiledComponents & components):
+      m_img(img), m_tile_id(tile_id), m_components(components) {}
+    virtual void operator()() {
+      vw::ImageView<typename ImageT::pixel_type> tile;
+      std::vector<int> labels;
+      std::vector<vw::int64> sizes;
+      label_tile(m_img, m_components.tiles()[m_tile_id], tile, labels, sizes);
+      m_components.add_tile(m_tile_id, labels, sizes);
+    }
+  };
+
+  /// Invalidate the 8-connected components of valid pixels which have
+  /// fewer than the given number of pixels, as vw::BlobIndexThreaded
+  /// does. The components are found over the whole image when the view
+  /// is created. The input tiles are kept in the block cache, so that
+  /// a tile is computed again when rasterized only if it was evicted.
+  template <class ImageT>
+  class SmallBlobEraseView: public vw::ImageViewBase<SmallBlobEraseView<ImageT> > {
+    typedef vw::BlockRasterizeView<ImageT> CachedT;
+    CachedT   m_img;
+    vw::int64 m_max_size;
+    boost::shared_ptr<TiledComponents> m_components;
+  public:
+
+    typedef typename ImageT::pixel_type pixel_type;
+    typedef pixel_type                  result_type;
+    typedef vw::ProceduralPixelAccessor<SmallBlobEraseView> pixel_accessor;
+
+    SmallBlobEraseView(vw::ImageViewBase<ImageT> const& img, vw::int64 max_size,
+                       int tile_size = vw::vw_settings().default_tile_size()):
+      m_img(vw::block_cache(img.impl(), vw::Vector2i(tile_size, tile_size), 0)),
+      m_max_size(max_size),
+      m_components(new TiledComponents(img.impl().cols(), img.impl().rows(), tile_size)) {
+
+      vw::FifoWorkQueue queue(vw::vw_settings().default_num_threads());
+      for (size_t i = 0; i < m_components->tiles().size(); i++) {
+        boost::shared_ptr<vw::Task>
+          task(new ComponentTileTask<CachedT>(m_img, i, *m_components));
+        queue.add_task(task);
+      }
+      queue.join_all();
+      m_components->merge();
+    }
+
+    inline vw::int32 cols  () const { return m_img.cols(); }
+    inline vw::int32 rows  () const { return m_img.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline pixel_type operator()( double /*i*/, double /*j*/, vw::int32 /*p*/ = 0 ) const {
+      vw::vw_throw(vw::NoImplErr() << "SmallBlobEraseView::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+
+      vw::ImageView<pixel_type> out(bbox.width(), bbox.height());
+      std::vector<int> tile_ids;
+      m_components->intersecting_tiles(bbox, tile_ids);
+      for (size_t t = 0; t < tile_ids.size(); t++) {
+        vw::BBox2i box = m_components->tiles()[tile_ids[t]];
+        vw::ImageView<pixel_type> tile;
+        std::vector<int> labels;
+        std::vector<vw::int64> sizes;
+        label_tile(m_img, box, tile, labels, sizes);
+        m_components->component_sizes(tile_ids[t], labels, sizes);
+
+        vw::BBox2i shared = box;
+        shared.crop(bbox);
+        for (int row = shared.min().y(); row < shared.max().y(); row++) {
+          for (int col = shared.min().x(); col < shared.max().x(); col++) {
+            int k = (row - box.min().y())*tile.cols() + col - box.min().x();
+            pixel_type pix = tile(col - box.min().x(), row - box.min().y());
+            if (labels[k] >= 0 && sizes[labels[k]] < m_max_size)
+              invalidate(pix);
+            out(col - bbox.min().x(), row - bbox.min().y()) = pix;
+          }
+        }
+      }
+
+      return prerasterize_type(out, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  template <class ImageT>
+  SmallBlobEraseView<ImageT>
+  erase_small_blobs(vw::ImageViewBase<ImageT> const& img, vw::int64 max_size) {
+    return SmallBlobEraseView<ImageT>(img.impl(), max_size);
+  }
+
+} // namespace asp
+
+#endif//__ASP_CORE_CONNECTED_COMPONENTS_H__
@@ -0,0 +1,199 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file CorrectionGrid.h
+///
+/// Evaluation of a smooth function of the pixels of a tile, such as a
+/// geoid height or a change of datum, exactly at the nodes of a coarse
+/// grid and by bilinear interpolation in between. The grid is refined
+/// until the interpolation agrees with the function at the cell
+/// centers to within a given error, and the cells with a node or a
+/// center where the function is not defined are evaluated exactly at
+/// each pixel.
+
+#ifndef __ASP_CORE_CORRECTION_GRID_H__
+#define __ASP_CORE_CORRECTION_GRID_H__
+
+#include <vw/Math/Vector.h>
+#include <vw/Math/BBox.h>
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+
+namespace asp {
+
+  /// The function is called as func(Vector2 const& pix, Vector<double, N>& value),
+  /// with pix in the pixels of the full image, and returns false where it
+  /// is not defined. A max_error of zero evaluates it at every pixel.
+  /// Without refinement the grid keeps the spacing max_step, and the
+  /// cells which are not within the error are evaluated exactly.
+  template <class FuncT, int N>
+  class CorrectionGrid {
+  public:
+    typedef vw::Vector<double, N> value_type;
+
+    CorrectionGrid(FuncT const& func, vw::BBox2i const& bbox, double max_error,
+                   int max_step = 32, bool refine = true):
+      m_func(func), m_bbox(bbox) {
+
+      int step = std::max(max_step, 1);
+      if (max_error <= 0 && refine)
+        step = 1;
+      while (!build(step, max_error, refine))
+        step = std::max(step / 2, 1);
+    }
+
+    /// The grid spacing which was used, in pixels.
+    int step() const { return m_step; }
+
+    /// The number of grid cells along each axis. There is one more node.
+    int num_cells(int axis) const { return m_num_cells[axis]; }
+
+    /// If the function is defined at a node, and its value there
+    bool node_valid(int i, int j) const { return m_node_valid[j*(m_num_cells[0] + 1) + i]; }
+    value_type const& node_value(int i, int j) const {
+      return m_values[j*(m_num_cells[0] + 1) + i];
+    }
+
+    /// If the pixels of a cell are interpolated
+    bool cell_valid(int i, int j) const { return m_cell_valid[j*m_num_cells[0] + i]; }
+
+    /// The value at a pixel of the tile. Returns false where the
+    /// function is not defined.
+    bool operator()(int col, int row, value_type & value) const {
+      int i = std::min((col - m_bbox.min().x()) / m_step, m_num_cells[0] - 1);
+      int j = std::min((row - m_bbox.min().y()) / m_step, m_num_cells[1] - 1);
+      if (!m_cell_valid[j*m_num_cells[0] + i])
+        return m_func(vw::Vector2(col, row), value);
+
+      double wx = (col - m_nodes[0][i]) / double(m_nodes[0][i+1] - m_nodes[0][i]);
+      double wy = (row - m_nodes[1][j]) / double(m_nodes[1][j+1] - m_nodes[1][j]);
+      value = interp(i, j, wx, wy);
+      return true;
+    }
+
+    /// The same at a point between the pixels of the tile
+    bool operator()(vw::Vector2 const& pix, value_type & value) const {
+      int i = (int)floor((pix.x() - m_bbox.min().x()) / m_step);
+      int j = (int)floor((pix.y() - m_bbox.min().y()) / m_step);
+      i = std::min(std::max(i, 0), m_num_cells[0] - 1);
+      j = std::min(std::max(j, 0), m_num_cells[1] - 1);
+      if (!m_cell_valid[j*m_num_cells[0] + i])
+        return m_func(pix, value);
+
+      double wx = (pix.x() - m_nodes[0][i]) / double(m_nodes[0][i+1] - m_nodes[0][i]);
+      double wy = (pix.y() - m_nodes[1][j]) / double(m_nodes[1][j+1] - m_nodes[1][j]);
+      value = interp(i, j, wx, wy);
+      return true;
+    }
+
+  private:
+
+    value_type interp(int i, int j, double wx, double wy) const {
+      int n = m_num_cells[0] + 1;
+      return (1-wy)*((1-wx)*m_values[j*n + i]     + wx*m_values[j*n + i + 1]) +
+                wy *((1-wx)*m_values[(j+1)*n + i] + wx*m_values[(j+1)*n + i + 1]);
+    }
+
+    // Evaluate the function at the nodes with this spacing. Return
+    // false if the interpolation is not within the error and a finer
+    // grid is to be tried.
+    bool build(int step, double max_error, bool refine) {
+      m_step = step;
+      for (int d = 0; d < 2; d++) {
+        int lo = m_bbox.min()[d], hi = std::max(m_bbox.max()[d] - 1, lo + 1);
+        m_nodes[d].clear();
+        for (int v = lo; v < hi; v += step)
+          m_nodes[d].push_back(v);
+        m_nodes[d].push_back(hi);
+        m_num_cells[d] = m_nodes[d].size() - 1;
+      }
+
+      int n = m_num_cells[0] + 1;
+      m_values.resize(n * (m_num_cells[1] + 1));
+      std::vector<bool> & node_valid = m_node_valid;
+      node_valid.resize(m_values.size());
+      for (int j = 0; j <= m_num_cells[1]; j++)
+        for (int i = 0; i <= m_num_cells[0]; i++)
+          node_valid[j*n + i] = m_func(vw::Vector2(m_nodes[0][i], m_nodes[1][j]),
+                                       m_values[j*n + i]);
+
+      m_cell_valid.assign(m_num_cells[0] * m_num_cells[1], false);
+      for (int j = 0; j < m_num_cells[1]; j++) {
+        for (int i = 0; i < m_num_cells[0]; i++) {
+          if (!node_valid[j*n + i]     || !node_valid[j*n + i + 1] ||
+              !node_valid[(j+1)*n + i] || !node_valid[(j+1)*n + i + 1])
+            continue;
+
+          // With a spacing of one pixel, all pixels are nodes. A cell
+          // whose center is not defined, such as one with a hole which
+          // misses its nodes, is left to be evaluated exactly.
+          if (step > 1) {
+            value_type exact;
+            vw::Vector2 center((m_nodes[0][i] + m_nodes[0][i+1]) / 2.0,
+                               (m_nodes[1][j] + m_nodes[1][j+1]) / 2.0);
+            if (!m_func(center, exact))
+              continue;
+            if (vw::math::norm_inf(exact - interp(i, j, 0.5, 0.5)) > max_error) {
+              if (refine)
+                return false;
+              continue;
+            }
+          }
+          m_cell_valid[j*m_num_cells[0] + i] = true;
+        }
+      }
+      return true;
+    }
+
+    FuncT                   m_func;
+    vw::BBox2i              m_bbox;
+    int                     m_step;
+    int                     m_num_cells[2];
+    std::vector<int>        m_nodes[2];
+    std::vector<value_type> m_values;
+    std::vector<bool>       m_node_valid, m_cell_valid;
+  };
+
+  /// The reverse of a transform, such as from the pixels of an output
+  /// to those of an input, as a function for the grid. It is not
+  /// defined where the transform throws or gives NaN.
+  template <class TransT>
+  struct ReverseTransformFunc {
+    TransT const* m_trans;
+    ReverseTransformFunc(TransT const* trans): m_trans(trans) {}
+    bool operator()(vw::Vector2 const& pix, vw::Vector2 & value) const {
+      try {
+        value = m_trans->reverse(pix);
+      }catch(...){
+        return false;
+      }
+      return !boost::math::isnan(value[0]) && !boost::math::isnan(value[1]);
+    }
+  };
+
+  template <int N, class FuncT>
+  CorrectionGrid<FuncT, N> correction_grid(FuncT const& func, vw::BBox2i const& bbox,
+                                           double max_error, int max_step = 32,
+                                           bool refine = true) {
+    return CorrectionGrid<FuncT, N>(func, bbox, max_error, max_step, refine);
+  }
+
+} // namespace asp
+
+#endif//__ASP_CORE_CORRECTION_GRID_H__
@@ -19,8 +19,10 @@
 /// \file DEMDisparity.cc
 ///
 
+#include <vw/Core/ThreadPool.h>
 #include <vw/Image/ImageView.h>
 #include <vw/Image/Transform.h>
+#include <vw/Image/Manipulation.h>
 #include <vw/Image/MaskViews.h>
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Camera/CameraModel.h>
@@ -30,6 +32,7 @@
 #include <vw/InterestPoint/MatrixIO.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/DemDisparity.h>
+#include <asp/Core/PointUtils.h>
 
 #include <boost/filesystem/operations.hpp>
 namespace fs = boost::filesystem;
@@ -52,6 +55,7 @@ namespace asp {
     Matrix<double>  m_align_left_matrix, m_align_right_matrix;
     int             m_pixel_sample;
     ImageView<PixelMask<Vector2i> > & m_disparity_spread;
+    ImageView<PixelMask<float> > m_dem_in_memory; // empty if not read in memory
 
   public:
     DemDisparity( ImageViewBase<ImageT> const& left_image,
@@ -62,7 +66,8 @@ namespace asp {
                   boost::shared_ptr<camera::CameraModel> right_camera_model,
                   bool do_align,
                   Matrix<double> const& align_left_matrix, Matrix<double> const& align_right_matrix,
-                  int pixel_sample, ImageView<PixelMask<Vector2i> > & disparity_spread)
+                  int pixel_sample, ImageView<PixelMask<Vector2i> > & disparity_spread,
+                  ImageView<PixelMask<float> > const& dem_in_memory)
       :m_left_image(left_image.impl()),
        m_dem_error(dem_error),
        m_dem_georef(dem_georef),
@@ -74,7 +79,8 @@ namespace asp {
        m_align_left_matrix(align_left_matrix),
        m_align_right_matrix(align_right_matrix),
        m_pixel_sample(pixel_sample),
-       m_disparity_spread(disparity_spread){}
+       m_disparity_spread(disparity_spread),
+       m_dem_in_memory(dem_in_memory){}
 
     // Image View interface
     typedef PixelMask<Vector2i> pixel_type;
@@ -107,11 +113,11 @@ namespace asp {
         }
       }
 
-      double height_error_tol = std::max(m_dem_error/4.0, 1.0); // height error in meters
-      double max_abs_tol      = height_error_tol/4.0; // abs cost function change b/w iterations
-      double max_rel_tol      = 1e-14;                // rel cost function change b/w iterations
-      int    num_max_iter     = 50;
-      bool   treat_nodata_as_zero = false;
+      // If the DEM was read in memory, all threads use it as it is
+      if (m_dem_in_memory.cols() > 0) {
+        compute_disparity(bbox, m_dem_in_memory, m_dem_georef, lowres_disparity);
+        return lowres_disparity;
+      }
 
       Vector3 prev_xyz;
 
@@ -131,31 +137,10 @@ namespace asp {
       BBox2i dem_box;
       for (unsigned k = 0; k < diagonals.size(); k++){
 
-        Vector2 left_lowres_pix = diagonals[k];
-
-        Vector2 left_fullres_pix = elem_quot(left_lowres_pix, m_downsample_scale);
-        if (m_do_align){
-          // Need to go to the image pixel in the untransformed image
-          left_fullres_pix = HomographyTransform(m_align_left_matrix).reverse(left_fullres_pix);
-        }
-
-        bool has_intersection;
-        Vector3 left_camera_ctr, left_camera_vec;
-        try {
-          left_camera_ctr = m_left_camera_model->camera_center(left_fullres_pix);
-          left_camera_vec = m_left_camera_model->pixel_to_vector(left_fullres_pix);
-        } catch (...) {
-          continue;
-        }
-        Vector3 xyz = camera_pixel_to_dem_xyz(left_camera_ctr, left_camera_vec,
-                                              m_dem, m_dem_georef,
-                                              treat_nodata_as_zero,
-                                              has_intersection,
-                                              height_error_tol, max_abs_tol,
-                                              max_rel_tol, num_max_iter,
-                                              prev_xyz
-                                              );
-        if ( !has_intersection || xyz == Vector3() ) continue;
+        Vector3 left_camera_vec;
+        Vector3 xyz = left_pixel_to_dem_xyz(diagonals[k], m_dem, m_dem_georef,
+                                            prev_xyz, left_camera_vec);
+        if ( xyz == Vector3() ) continue;
         prev_xyz = xyz;
 
         Vector3 llh = m_dem_georef.datum().cartesian_to_geodetic( xyz );
@@ -173,42 +158,77 @@ namespace asp {
       GeoReference georef_crop = crop(m_dem_georef, dem_box);
       ImageView <PixelMask<float> > dem_crop = crop(m_dem, dem_box);
 
-      // Compute the DEM disparity. Use one in every 'm_pixel_sample' pixels.
+      compute_disparity(bbox, dem_crop, georef_crop, lowres_disparity);
+      return lowres_disparity;
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+
+  private:
+
+    // Intersect with the DEM the ray from the left camera through the
+    // given low-res pixel. Return the zero vector on failure.
+    template <class DEMT>
+    Vector3 left_pixel_to_dem_xyz(Vector2 const& left_lowres_pix,
+                                  DEMT const& dem, GeoReference const& georef,
+                                  Vector3 const& prev_xyz, Vector3 & left_camera_vec) const {
+
+      double height_error_tol = std::max(m_dem_error/4.0, 1.0); // height error in meters
+      double max_abs_tol      = height_error_tol/4.0; // abs cost function change b/w iterations
+      double max_rel_tol      = 1e-14;                // rel cost function change b/w iterations
+      int    num_max_iter     = 50;
+      bool   treat_nodata_as_zero = false;
+
+      Vector2 left_fullres_pix = elem_quot(left_lowres_pix, m_downsample_scale);
+      if (m_do_align){
+        // Need to go to the image pixel in the untransformed image
+        left_fullres_pix = HomographyTransform(m_align_left_matrix).reverse(left_fullres_pix);
+      }
+
+      bool has_intersection;
+      Vector3 left_camera_ctr;
+      try {
+        left_camera_ctr = m_left_camera_model->camera_center(left_fullres_pix);
+        left_camera_vec = m_left_camera_model->pixel_to_vector(left_fullres_pix);
+      } catch (...) {
+        return Vector3();
+      }
+      Vector3 xyz = camera_pixel_to_dem_xyz(left_camera_ctr, left_camera_vec,
+                                            dem, georef,
+                                            treat_nodata_as_zero,
+                                            has_intersection,
+                                            height_error_tol, max_abs_tol,
+                                            max_rel_tol, num_max_iter,
+                                            prev_xyz
+                                            );
+      if (!has_intersection)
+        return Vector3();
+      return xyz;
+    }
+
+    // Compute the DEM disparity over the given tile, using the given
+    // DEM region. Use one in every 'm_pixel_sample' pixels.
+    template <class DEMT>
+    void compute_disparity(BBox2i const& bbox, DEMT const& dem, GeoReference const& georef,
+                           prerasterize_type & lowres_disparity) const {
 
       for (int row = bbox.min().y(); row < bbox.max().y(); row++){
         if (row%m_pixel_sample != 0) continue;
 
         // Must wipe the previous guess since we are now too far from it
-        prev_xyz = Vector3();
+        Vector3 prev_xyz = Vector3();
 
         for (int col = bbox.min().x(); col < bbox.max().x(); col++){
           if (col%m_pixel_sample != 0) continue;
 
           Vector2 left_lowres_pix = Vector2(col, row);
-
-          Vector2 left_fullres_pix = elem_quot(left_lowres_pix, m_downsample_scale);
-          if (m_do_align){
-            // Need to go to the image pixel in the untransformed image
-            left_fullres_pix = HomographyTransform(m_align_left_matrix).reverse(left_fullres_pix);
-          }
-
-          bool has_intersection;
-          Vector3 left_camera_ctr, left_camera_vec;
-          try {
-            left_camera_ctr = m_left_camera_model->camera_center(left_fullres_pix);
-            left_camera_vec = m_left_camera_model->pixel_to_vector(left_fullres_pix);
-          } catch (...) {
-            continue;
-          }
-          Vector3 xyz = camera_pixel_to_dem_xyz(left_camera_ctr, left_camera_vec,
-                                                dem_crop, georef_crop,
-                                                treat_nodata_as_zero,
-                                                has_intersection,
-                                                height_error_tol, max_abs_tol,
-                                                max_rel_tol, num_max_iter,
-                                                prev_xyz
-                                                );
-          if ( !has_intersection || xyz == Vector3() ) continue;
+          Vector3 left_camera_vec;
+          Vector3 xyz = left_pixel_to_dem_xyz(left_lowres_pix, dem, georef,
+                                              prev_xyz, left_camera_vec);
+          if ( xyz == Vector3() ) continue;
           prev_xyz = xyz;
 
           // Since our DEM is only known approximately, the true
@@ -251,13 +271,6 @@ namespace asp {
 
         }
       }
-
-      return lowres_disparity;
-    }
-
-    template <class DestT>
-    inline void rasterize(DestT const& dest, BBox2i bbox) const {
-      vw::rasterize(prerasterize(bbox), dest, bbox);
     }
   };
 
@@ -273,7 +286,8 @@ namespace asp {
                  Matrix<double> const& align_left_matrix,
                  Matrix<double> const& align_right_matrix,
                  int pixel_sample,
-                 ImageView<PixelMask<Vector2i> > & disparity_spread
+                 ImageView<PixelMask<Vector2i> > & disparity_spread,
+                 ImageView<PixelMask<float> > const& dem_in_memory
                  ) {
     typedef DemDisparity<ImageT, DEMImageT> return_type;
     return return_type( left.impl(),
@@ -281,10 +295,94 @@ namespace asp {
                         dem, downsample_scale,
                         left_camera_model, right_camera_model,
                         do_align, align_left_matrix, align_right_matrix,
-                        pixel_sample, disparity_spread
+                        pixel_sample, disparity_spread, dem_in_memory
                         );
   }
 
+  // The ground distance, in meters, between a DEM pixel and its
+  // neighbors, averaged over the two directions.
+  double dem_pixel_size(GeoReference const& georef, Vector2 const& pix) {
+    Vector3 pts[3];
+    Vector2 offsets[] = {Vector2(0, 0), Vector2(1, 0), Vector2(0, 1)};
+    for (int k = 0; k < 3; k++) {
+      Vector2 lonlat = georef.pixel_to_lonlat(pix + offsets[k]);
+      pts[k] = georef.datum().geodetic_to_cartesian(Vector3(lonlat[0], lonlat[1], 0.0));
+    }
+    return (norm_2(pts[1] - pts[0]) + norm_2(pts[2] - pts[0]))/2.0;
+  }
+
+  // The ground distance, in meters, between a low-res left image pixel
+  // and its neighbor, measured on the datum. Return 0 if not known.
+  double lowres_pixel_size(camera::CameraModel const& left_camera_model,
+                           Datum const& datum, Vector2 const& left_lowres_pix,
+                           Vector2f const& downsample_scale,
+                           bool do_align, Matrix<double> const& align_left_matrix) {
+    Vector3 pts[2];
+    for (int k = 0; k < 2; k++) {
+      Vector2 pix = elem_quot(left_lowres_pix + Vector2(k, 0), downsample_scale);
+      if (do_align)
+        pix = HomographyTransform(align_left_matrix).reverse(pix);
+      try {
+        pts[k] = datum_intersection(datum, left_camera_model.camera_center(pix),
+                                    left_camera_model.pixel_to_vector(pix));
+      } catch (...) {
+        return 0.0;
+      }
+      if (pts[k] == Vector3())
+        return 0.0;
+    }
+    return norm_2(pts[1] - pts[0]);
+  }
+
+  // Make a DEM at 1/factor of the resolution, with each pixel the
+  // average of the valid DEM pixels in a block of factor x factor pixels.
+  // The input is read a strip of rows at a time.
+  void reduce_dem(ImageViewRef<PixelMask<float> > const& dem, int factor,
+                  ImageView<PixelMask<float> > & reduced) {
+    reduced.set_size((dem.cols() + factor - 1)/factor, (dem.rows() + factor - 1)/factor);
+    for (int row = 0; row < reduced.rows(); row++) {
+      BBox2i strip_box(0, row*factor, dem.cols(), factor);
+      strip_box.crop(bounding_box(dem));
+      ImageView<PixelMask<float> > strip = crop(dem, strip_box);
+      for (int col = 0; col < reduced.cols(); col++) {
+        double sum = 0;
+        int    count = 0;
+        for (int r = 0; r < strip.rows(); r++) {
+          for (int c = col*factor; c < std::min((col + 1)*factor, strip.cols()); c++) {
+            if (!is_valid(strip(c, r)))
+              continue;
+            sum += strip(c, r).child();
+            count++;
+          }
+        }
+        if (count > 0)
+          reduced(col, row) = PixelMask<float>(sum/count);
+        else
+          reduced(col, row).invalidate();
+      }
+    }
+  }
+
+  // Read the matrices used to align the images, if any, as the
+  // disparity must be computed between the aligned images.
+  bool read_align_matrices(ASPGlobalOptions const& opt,
+                           Matrix<double> & align_left_matrix,
+                           Matrix<double> & align_right_matrix) {
+    align_left_matrix  = math::identity_matrix<3>();
+    align_right_matrix = math::identity_matrix<3>();
+    bool do_align = (stereo_settings().alignment_method == "homography" ||
+                     stereo_settings().alignment_method == "affineepipolar");
+    if ( do_align ){
+      if ( fs::exists(opt.out_prefix+"-align-L.exr") )
+        read_matrix(align_left_matrix, opt.out_prefix + "-align-L.exr");
+      if ( fs::exists(opt.out_prefix+"-align-R.exr") )
+        read_matrix(align_right_matrix, opt.out_prefix + "-align-R.exr");
+      vw_out(DebugMessage,"asp") << "Left alignment matrix: "  << align_left_matrix  << "\n";
+      vw_out(DebugMessage,"asp") << "Right alignment matrix: " << align_right_matrix << "\n";
+    }
+    return do_align;
+  }
+
   void produce_dem_disparity( ASPGlobalOptions & opt,
                               boost::shared_ptr<camera::CameraModel> left_camera_model,
                               boost::shared_ptr<camera::CameraModel> right_camera_model,
@@ -328,20 +426,40 @@ namespace asp {
     Vector2f downsample_scale( float(left_image_sub.cols()) / float(left_image.cols()),
                                float(left_image_sub.rows()) / float(left_image.rows()) );
 
-    Matrix<double> align_left_matrix  = math::identity_matrix<3>();
-    Matrix<double> align_right_matrix = math::identity_matrix<3>();
-    bool do_align = (stereo_settings().alignment_method == "homography" ||
-                     stereo_settings().alignment_method == "affineepipolar");
-    if ( do_align ){
-      // We used a transform to align the images, so we have to make
-      // sure to apply that transform to the disparity we are about to
-      // compute as well.
-      if ( fs::exists(opt.out_prefix+"-align-L.exr") )
-        read_matrix(align_left_matrix, opt.out_prefix + "-align-L.exr");
-      if ( fs::exists(opt.out_prefix+"-align-R.exr") )
-        read_matrix(align_right_matrix, opt.out_prefix + "-align-R.exr");
-      vw_out(DebugMessage,"asp") << "Left alignment matrix: "  << align_left_matrix  << "\n";
-      vw_out(DebugMessage,"asp") << "Right alignment matrix: " << align_right_matrix << "\n";
+    Matrix<double> align_left_matrix, align_right_matrix;
+    bool do_align = read_align_matrices(opt, align_left_matrix, align_right_matrix);
+
+    // There is no use for DEM pixels much smaller than the ground
+    // footprint of a low-res pixel, so use the DEM at the coarsest
+    // power of two reduction which is still finer than that. If the
+    // result is small enough, read it in memory once, and all threads
+    // will use it. Otherwise each tile reads the DEM region it needs.
+    int factor = 1;
+    double dem_px = dem_pixel_size(dem_georef, Vector2(dem.cols(), dem.rows())/2.0);
+    double img_px = lowres_pixel_size(*left_camera_model.get(), dem_georef.datum(),
+                                      Vector2(left_image_sub.cols(), left_image_sub.rows())/2.0,
+                                      downsample_scale, do_align, align_left_matrix);
+    if (dem_px > 0 && img_px > 0) {
+      while (2*factor*dem_px <= img_px && 2*factor < std::min(dem.cols(), dem.rows()))
+        factor *= 2;
+    }
+
+    const double max_dem_in_memory_pixels = 2.5e7; // 200 MB
+    double num_pixels = (double(dem.cols())/factor)*(double(dem.rows())/factor);
+    ImageView<PixelMask<float> > dem_in_memory;
+    if (num_pixels <= max_dem_in_memory_pixels) {
+      vw_out() << "Reading the DEM in memory, reduced by a factor of " << factor << ".\n";
+      if (factor == 1) {
+        dem_in_memory = dem;
+      } else {
+        reduce_dem(dem, factor, dem_in_memory);
+        // The center of each block of pixels becomes a pixel
+        dem_georef = resample(crop(dem_georef, (factor - 1)/2.0, (factor - 1)/2.0), 1.0/factor);
+      }
+      dem = dem_in_memory;
+    } else if (factor > 1) {
+      dem = subsample(dem, factor);
+      dem_georef = resample(dem_georef, 1.0/factor);
     }
 
     // Smaller tiles is better
@@ -358,7 +476,8 @@ namespace asp {
                                                        left_camera_model, right_camera_model,
                                                        do_align,
                                                        align_left_matrix, align_right_matrix,
-                                                       pixel_sample, disparity_spread
+                                                       pixel_sample, disparity_spread,
+                                                       dem_in_memory
                                                        ));
     std::string disparity_file = opt.out_prefix + "-D_sub.tif";
     vw_out() << "Writing low-resolution disparity: " << disparity_file << "\n";
@@ -402,4 +521,184 @@ namespace asp {
 
   }
 
+  // The range of the disparities, in the low-res images, of the prior
+  // points landing in each low-res left pixel
+  struct PriorDispRange {
+    ImageView<BBox2f> ranges;
+    Mutex             mutex;
+  };
+
+  // Project the points of a block of the prior cloud into the left and
+  // right images. Each point is also moved by the height error along
+  // the left ray, which keeps its left pixel, to see how far the
+  // disparity can change.
+  class PriorCloudDispTask : public Task, private boost::noncopyable {
+    ImageViewRef<Vector4> const& m_cloud;
+    BBox2i   m_bbox;
+    double   m_height_error;
+    Vector2f m_downsample_scale;
+    boost::shared_ptr<camera::CameraModel> m_left_camera_model, m_right_camera_model;
+    bool     m_do_align;
+    Matrix<double> m_align_left_matrix, m_align_right_matrix;
+    PriorDispRange & m_out;
+  public:
+    PriorCloudDispTask(ImageViewRef<Vector4> const& cloud, BBox2i const& bbox,
+                       double height_error, Vector2f const& downsample_scale,
+                       boost::shared_ptr<camera::CameraModel> left_camera_model,
+                       boost::shared_ptr<camera::CameraModel> right_camera_model,
+                       bool do_align, Matrix<double> const& align_left_matrix,
+                       Matrix<double> const& align_right_matrix, PriorDispRange & out):
+      m_cloud(cloud), m_bbox(bbox), m_height_error(height_error),
+      m_downsample_scale(downsample_scale),
+      m_left_camera_model(left_camera_model), m_right_camera_model(right_camera_model),
+      m_do_align(do_align), m_align_left_matrix(align_left_matrix),
+      m_align_right_matrix(align_right_matrix), m_out(out) {}
+
+    virtual void operator()() {
+      ImageView<Vector4> block = crop(m_cloud, m_bbox);
+      std::vector<Vector2i> pixels;
+      std::vector<BBox2f>   ranges;
+      for (int row = 0; row < block.rows(); row++) {
+        for (int col = 0; col < block.cols(); col++) {
+          Vector3 xyz = subvector(block(col, row), 0, 3);
+          if (xyz == Vector3())
+            continue;
+          double height_error = m_height_error + block(col, row)[3];
+
+          Vector2 left_pix, left_lowres_pix;
+          Vector3 left_ray;
+          try {
+            left_pix = m_left_camera_model->point_to_pixel(xyz);
+            left_ray = normalize(xyz - m_left_camera_model->camera_center(left_pix));
+          } catch (...) {
+            continue;
+          }
+          if (m_do_align)
+            left_pix = HomographyTransform(m_align_left_matrix).forward(left_pix);
+          left_lowres_pix = elem_prod(left_pix, m_downsample_scale);
+
+          BBox2f range;
+          double bias[] = {0.0, -1.0, 1.0};
+          int num = (height_error > 0) ? 3 : 1;
+          for (int k = 0; k < num; k++) {
+            Vector2 right_pix;
+            try {
+              right_pix = m_right_camera_model->point_to_pixel(xyz + bias[k]*height_error*left_ray);
+            } catch (...) {
+              continue;
+            }
+            if (m_do_align)
+              right_pix = HomographyTransform(m_align_right_matrix).forward(right_pix);
+            range.grow(elem_prod(right_pix, m_downsample_scale) - left_lowres_pix);
+          }
+          if (range.min().x() > range.max().x())
+            continue; // no projection succeeded
+
+          pixels.push_back(round(left_lowres_pix));
+          ranges.push_back(range);
+        }
+      }
+
+      Mutex::Lock lock(m_out.mutex);
+      BBox2i image_box = bounding_box(m_out.ranges);
+      for (size_t i = 0; i < pixels.size(); i++) {
+        if (image_box.contains(pixels[i]))
+          m_out.ranges(pixels[i].x(), pixels[i].y()).grow(ranges[i]);
+      }
+    }
+  };
+
+  void produce_prior_cloud_disparity(ASPGlobalOptions & opt,
+                                     boost::shared_ptr<camera::CameraModel> left_camera_model,
+                                     boost::shared_ptr<camera::CameraModel> right_camera_model,
+                                     std::string session_name) {
+
+    std::string cloud_file = stereo_settings().prior_point_cloud;
+    if (cloud_file == "")
+      vw_throw( ArgumentErr() << "No value was provided for: prior-point-cloud.\n" );
+    double height_error = stereo_settings().disparity_estimation_dem_error;
+    if (height_error < 0.0)
+      vw_throw( ArgumentErr() << "Invalid value for disparity-estimation-dem-error: "
+                << height_error << ".\n" );
+    if (stereo_settings().is_search_defined())
+      vw_out(WarningMessage) << "Computing low-resolution disparity from a prior point cloud. "
+                             << "Will ignore corr-search value: "
+                             << stereo_settings().search_range << ".\n";
+
+    DiskImageView<PixelGray<float> > left_image(opt.out_prefix+"-L.tif");
+    DiskImageView<PixelGray<float> > left_image_sub(opt.out_prefix+"-L_sub.tif");
+    Vector2f downsample_scale( float(left_image_sub.cols()) / float(left_image.cols()),
+                               float(left_image_sub.rows()) / float(left_image.rows()) );
+
+    Matrix<double> align_left_matrix, align_right_matrix;
+    bool do_align = read_align_matrices(opt, align_left_matrix, align_right_matrix);
+
+    // The fourth channel has the triangulation error, or with error
+    // vectors, it is the norm of the last three.
+    ImageViewRef<Vector4> cloud;
+    if (vw::get_num_channels(cloud_file) >= 6)
+      cloud = asp::point_and_error_norm(asp::read_asp_point_cloud<6>(cloud_file));
+    else
+      cloud = asp::read_asp_point_cloud<4>(cloud_file);
+
+    // Use about as many prior points as there are low-res pixels
+    double ratio = (double(cloud.cols())*cloud.rows())
+      / (double(left_image_sub.cols())*left_image_sub.rows());
+    int step = std::max(1, (int)floor(sqrt(ratio)));
+    if (step > 1)
+      cloud = subsample(cloud, step);
+    vw_out() << "Projecting the prior point cloud " << cloud_file
+             << ", using one in " << step << " points along each axis.\n";
+
+    PriorDispRange prior;
+    prior.ranges.set_size(left_image_sub.cols(), left_image_sub.rows());
+
+    // ISIS does not support multi-threading
+    int num_threads = vw_settings().default_num_threads();
+    if (session_name == "isis" || session_name == "isismapisis")
+      num_threads = 1;
+    std::vector<BBox2i> blocks = subdivide_bbox(cloud, 256, 256);
+    FifoWorkQueue queue(num_threads);
+    for (size_t b = 0; b < blocks.size(); b++)
+      queue.add_task(boost::shared_ptr<Task>
+                     (new PriorCloudDispTask(cloud, blocks[b], height_error, downsample_scale,
+                                             left_camera_model, right_camera_model,
+                                             do_align, align_left_matrix, align_right_matrix,
+                                             prior)));
+    queue.join_all();
+
+    // Each pixel gets the middle of its range, and the spread is the
+    // half-width of the range
+    ImageView<PixelMask<Vector2f> > lowres_disparity(prior.ranges.cols(), prior.ranges.rows());
+    ImageView<PixelMask<Vector2i> > disparity_spread(prior.ranges.cols(), prior.ranges.rows());
+    int num_valid = 0;
+    for (int row = 0; row < prior.ranges.rows(); row++) {
+      for (int col = 0; col < prior.ranges.cols(); col++) {
+        BBox2f const& range = prior.ranges(col, row);
+        if (range.min().x() > range.max().x()) { // no points
+          lowres_disparity(col, row).invalidate();
+          disparity_spread(col, row).invalidate();
+          continue;
+        }
+        lowres_disparity(col, row) = round( (range.min() + range.max())/2.0 );
+        disparity_spread(col, row) = ceil( (range.max() - range.min())/2.0 );
+        num_valid++;
+      }
+    }
+    if (num_valid == 0)
+      vw_throw( ArgumentErr() << "No points of the prior point cloud project into the images.\n" );
+    vw_out() << "The prior point cloud covers "
+             << 100.0*num_valid/(double(prior.ranges.cols())*prior.ranges.rows())
+             << "% of the low-resolution image.\n";
+
+    std::string disparity_file = opt.out_prefix + "-D_sub.tif";
+    vw_out() << "Writing low-resolution disparity: " << disparity_file << "\n";
+    vw::cartography::block_write_gdal_image( disparity_file, lowres_disparity, opt,
+                                 TerminalProgressCallback("asp", "\t--> Low-resolution disparity:") );
+    std::string disp_spread_file = opt.out_prefix + "-D_sub_spread.tif";
+    vw_out() << "Writing low-resolution disparity spread: " << disp_spread_file << "\n";
+    vw::cartography::block_write_gdal_image( disp_spread_file, disparity_spread, opt,
+                                 TerminalProgressCallback("asp", "\t--> Low-resolution disparity spread:") );
+  }
+
 }
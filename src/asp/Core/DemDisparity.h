@@ -43,6 +43,13 @@ namespace asp {
                              std::string session_name
                              );
 
+  /// Use the point cloud of a prior run over the same area, projected
+  /// into the cameras, to get the low-res disparity and its spread
+  void produce_prior_cloud_disparity(ASPGlobalOptions & opt,
+                                     boost::shared_ptr<vw::camera::CameraModel> left_camera_model,
+                                     boost::shared_ptr<vw::camera::CameraModel> right_camera_model,
+                                     std::string session_name);
+
 }
 
 #endif
@@ -0,0 +1,202 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <asp/Core/DemSplatter.h>
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <algorithm>
+#include <cmath>
+
+using namespace vw;
+
+namespace {
+  // The tile having a given node index, also for negative indices
+  inline int tile_of(int node, int tile_size) {
+    return node >= 0 ? node/tile_size : -((-node - 1)/tile_size) - 1;
+  }
+}
+
+asp::DemSplatter::DemSplatter(double spacing, double search_radius_factor,
+                              bool with_errors, int tile_size):
+  m_spacing(spacing), m_radius(spacing*search_radius_factor),
+  m_with_errors(with_errors), m_tile_size(tile_size) {
+
+  if (m_spacing <= 0)
+    vw_throw(ArgumentErr() << "DemSplatter: The DEM spacing must be positive.\n");
+  if (search_radius_factor <= 0)
+    vw_throw(ArgumentErr() << "DemSplatter: The search radius factor must be positive.\n");
+  if (m_tile_size <= 0)
+    vw_throw(ArgumentErr() << "DemSplatter: The tile size must be positive.\n");
+}
+
+boost::shared_ptr<asp::DemSplatter::Tile>
+asp::DemSplatter::get_tile(TileKey const& key) {
+  Mutex::Lock lock(m_mutex);
+  boost::shared_ptr<Tile> & tile = m_tiles[key];
+  if (!tile) {
+    tile.reset(new Tile);
+    tile->heights.set_size(m_tile_size, m_tile_size);
+    tile->height_weights.set_size(m_tile_size, m_tile_size);
+    vw::fill(tile->heights, 0.0);
+    vw::fill(tile->height_weights, 0.0);
+    if (m_with_errors) {
+      tile->errors.set_size(m_tile_size, m_tile_size);
+      tile->error_weights.set_size(m_tile_size, m_tile_size);
+      vw::fill(tile->errors, 0.0);
+      vw::fill(tile->error_weights, 0.0);
+    }
+  }
+  return tile;
+}
+
+void asp::DemSplatter::add_points(std::vector<Vector3> const& points,
+                                  std::vector<double>  const& errors) {
+
+  VW_ASSERT(!m_with_errors || errors.size() == points.size(),
+            ArgumentErr() << "DemSplatter: Expecting an error for each point.\n");
+
+  // The same Gaussian as in Point2Grid, decaying to 1/4 at the
+  // distance of one grid spacing.
+  double sigma   = -log(0.25)/m_spacing/m_spacing;
+  double radius2 = m_radius*m_radius;
+
+  for (size_t p = 0; p < points.size(); p++) {
+    Vector3 const& P = points[p];
+    if (boost::math::isnan(P[0]) || boost::math::isnan(P[1]) || boost::math::isnan(P[2]))
+      continue;
+    bool has_error = m_with_errors && !boost::math::isnan(errors[p]);
+
+    // The nodes within the search radius
+    int minx = (int)ceil ((P[0] - m_radius)/m_spacing);
+    int maxx = (int)floor((P[0] + m_radius)/m_spacing);
+    int miny = (int)ceil ((P[1] - m_radius)/m_spacing);
+    int maxy = (int)floor((P[1] + m_radius)/m_spacing);
+    if (minx > maxx || miny > maxy)
+      continue;
+
+    // Add the point to each tile having some of these nodes
+    for (int ty = tile_of(miny, m_tile_size); ty <= tile_of(maxy, m_tile_size); ty++) {
+      for (int tx = tile_of(minx, m_tile_size); tx <= tile_of(maxx, m_tile_size); tx++) {
+
+        int x0 = tx*m_tile_size, y0 = ty*m_tile_size;
+        int bx = std::max(minx, x0), ex = std::min(maxx, x0 + m_tile_size - 1);
+        int by = std::max(miny, y0), ey = std::min(maxy, y0 + m_tile_size - 1);
+
+        boost::shared_ptr<Tile> tile = get_tile(std::make_pair(tx, ty));
+        Mutex::Lock lock(tile->mutex);
+        for (int iy = by; iy <= ey; iy++) {
+          double dy  = iy*m_spacing - P[1];
+          for (int ix = bx; ix <= ex; ix++) {
+            double dx = ix*m_spacing - P[0];
+            double d2 = dx*dx + dy*dy;
+            if (d2 > radius2)
+              continue;
+            double wt = exp(-sigma*d2);
+            tile->heights       (ix - x0, iy - y0) += wt*P[2];
+            tile->height_weights(ix - x0, iy - y0) += wt;
+            if (has_error) {
+              tile->errors       (ix - x0, iy - y0) += wt*errors[p];
+              tile->error_weights(ix - x0, iy - y0) += wt;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+BBox2i asp::DemSplatter::node_box() const {
+  Mutex::Lock lock(m_mutex);
+  BBox2i box;
+  for (std::map<TileKey, boost::shared_ptr<Tile> >::const_iterator it = m_tiles.begin();
+       it != m_tiles.end(); it++) {
+    int x0 = it->first.first*m_tile_size, y0 = it->first.second*m_tile_size;
+    ImageView<double> const& weights = it->second->height_weights;
+    for (int row = 0; row < weights.rows(); row++) {
+      for (int col = 0; col < weights.cols(); col++) {
+        if (weights(col, row) > 0)
+          box.grow(BBox2i(x0 + col, y0 + row, 1, 1));
+      }
+    }
+  }
+  return box;
+}
+
+ImageView<float> asp::DemSplatter::assemble(BBox2i const& box, bool errors,
+                                            double nodata) const {
+  Mutex::Lock lock(m_mutex);
+  ImageView<float> out(box.width(), box.height());
+  vw::fill(out, nodata);
+  for (std::map<TileKey, boost::shared_ptr<Tile> >::const_iterator it = m_tiles.begin();
+       it != m_tiles.end(); it++) {
+    int x0 = it->first.first*m_tile_size, y0 = it->first.second*m_tile_size;
+    Tile const& tile = *it->second;
+    ImageView<double> const& sums    = errors ? tile.errors        : tile.heights;
+    ImageView<double> const& weights = errors ? tile.error_weights : tile.height_weights;
+    for (int row = 0; row < weights.rows(); row++) {
+      for (int col = 0; col < weights.cols(); col++) {
+        if (weights(col, row) <= 0)
+          continue;
+        Vector2i node(x0 + col, y0 + row);
+        if (!box.contains(node))
+          continue;
+        // The top row of the image has the largest y
+        out(node.x() - box.min().x(), box.max().y() - 1 - node.y())
+          = sums(col, row)/weights(col, row);
+      }
+    }
+  }
+  return out;
+}
+
+void asp::DemSplatter::write(std::string const& dem_file, std::string const& error_file,
+                             cartography::GeoReference georef, double nodata,
+                             cartography::GdalWriteOptions const& opt,
+                             ProgressCallback const& progress) const {
+
+  BBox2i box = node_box();
+  if (box.empty())
+    vw_throw(ArgumentErr() << "No valid points were found to make the DEM.\n");
+
+  // The top-left pixel is at the top-left node, and if pixels are
+  // areas then it extends half a spacing beyond it.
+  Matrix3x3 transform = math::identity_matrix<3>();
+  transform(0,0) =  m_spacing;
+  transform(1,1) = -m_spacing;
+  transform(0,2) =  box.min().x()*m_spacing;
+  transform(1,2) =  (box.max().y() - 1)*m_spacing;
+  if (georef.pixel_interpretation() == cartography::GeoReference::PixelAsArea) {
+    transform(0,2) -= 0.5 * transform(0,0);
+    transform(1,2) -= 0.5 * transform(1,1);
+  }
+  georef.set_transform(transform);
+
+  bool has_georef = true, has_nodata = true;
+  vw_out() << "Writing: " << dem_file << "\n";
+  cartography::block_write_gdal_image(dem_file, assemble(box, false, nodata),
+                                      has_georef, georef, has_nodata, nodata,
+                                      opt, progress);
+
+  if (m_with_errors && error_file != "") {
+    vw_out() << "Writing: " << error_file << "\n";
+    cartography::block_write_gdal_image(error_file, assemble(box, true, nodata),
+                                        has_georef, georef, has_nodata, nodata,
+                                        opt, progress);
+  }
+}
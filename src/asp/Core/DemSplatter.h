@@ -0,0 +1,99 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file DemSplatter.h
+///
+/// Make a DEM from projected points as they arrive, with no pass over
+/// a point cloud on disk. Each point is added to the grid nodes within
+/// the search radius with Gaussian weights, as point2dem does with
+/// Point2Grid. The grid is in tiles, made as points reach them, and a
+/// point near a tile boundary is added to each tile its radius
+/// overlaps, so the result does not depend on how the points are split.
+///
+/// The grid nodes are at integer multiples of the spacing, so that the
+/// DEMs made from separate runs with the same spacing line up.
+
+#ifndef __ASP_CORE_DEM_SPLATTER_H__
+#define __ASP_CORE_DEM_SPLATTER_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Core/ProgressCallback.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  class DemSplatter: private boost::noncopyable {
+  public:
+
+    /// The grid has the given spacing, in the units of the projection.
+    /// Each point reaches the nodes within search_radius_factor times
+    /// the spacing. If with_errors is true, the errors of the points
+    /// are gridded as well.
+    DemSplatter(double spacing, double search_radius_factor, bool with_errors,
+                int tile_size = 256);
+
+    /// Add points, with their projected x, y and height. Invalid points
+    /// have a NaN height. The errors are used only if gridded. Can be
+    /// called from many threads.
+    void add_points(std::vector<vw::Vector3> const& points,
+                    std::vector<double>      const& errors);
+
+    /// The box of the grid nodes which have values, as node indices,
+    /// with y increasing up. Empty if no points were added.
+    vw::BBox2i node_box() const;
+
+    /// Write the DEM, and the error image if gridded, with the given
+    /// projection. The georeference transform is set here.
+    void write(std::string const& dem_file, std::string const& error_file,
+               vw::cartography::GeoReference georef, double nodata,
+               vw::cartography::GdalWriteOptions const& opt,
+               vw::ProgressCallback const& progress) const;
+
+  private:
+    typedef std::pair<int, int> TileKey;
+
+    struct Tile {
+      vw::Mutex mutex;
+      vw::ImageView<double> heights, height_weights, errors, error_weights;
+    };
+
+    boost::shared_ptr<Tile> get_tile(TileKey const& key);
+
+    /// The gridded heights or errors, with nodata where there are none,
+    /// in a box of nodes, with the top row first.
+    vw::ImageView<float> assemble(vw::BBox2i const& box, bool errors, double nodata) const;
+
+    double m_spacing, m_radius;
+    bool   m_with_errors;
+    int    m_tile_size;
+
+    mutable vw::Mutex m_mutex; // protects m_tiles
+    std::map<TileKey, boost::shared_ptr<Tile> > m_tiles;
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_DEM_SPLATTER_H__
@@ -20,6 +20,12 @@
 ///
 
 #include <asp/Core/EigenUtils.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
+#include <boost/noncopyable.hpp>
+#include <algorithm>
+#include <set>
 
 // Allows FileIO to correctly read/write these pixel types
 namespace vw {
@@ -59,21 +65,17 @@ void pick_at_most_m_unique_elems_from_n_elems(int m, int n, std::vector<int>& el
   if (m < 1 || n < 1) return;
   if (m > n) m = n;
 
-  std::vector<int> all(n);
-  for (int i = 0; i < n; i++) all[i] = i;
-
-  // Swap a randomly selected element from index 0 to j with the one
-  // at index j. Then decrement j. Done after m elements are
-  // processed.
-  for (int j = n-1; j >= n-m; j--){
+  // Floyd's algorithm. For each j from n-m to n-1, pick a random
+  // element from 0 to j, and if it was picked before, pick j
+  // instead. This needs memory only for the m picked elements.
+  std::set<int> picked;
+  for (int j = n-m; j < n; j++){
     int r = rand()%(j+1); // 0 <= r <= j
-    std::swap(all[r], all[j]);
+    if (!picked.insert(r).second)
+      picked.insert(j);
   }
 
-  elems.resize(m);
-  for (int i = 0; i < m; i++) elems[i] = all[n-m+i];
-  std::sort(elems.begin(), elems.end());
-
+  elems.assign(picked.begin(), picked.end());
 }
 
 // Return at most m random points out of the input point cloud.
@@ -84,6 +86,8 @@ void random_pc_subsample(int m, DoubleMatrix& points){
   pick_at_most_m_unique_elems_from_n_elems(m, n, elems);
   m = elems.size();
 
+  // The elements are sorted, so elems[col] >= col, and the columns
+  // can be moved in place.
   for (int col = 0; col < m; col++){
     for (int row = 0; row < DIM; row++)
       points(row, col) = points(row, elems[col]);
@@ -91,6 +95,258 @@ void random_pc_subsample(int m, DoubleMatrix& points){
   points.conservativeResize(Eigen::NoChange, m);
 }
 
+namespace {
+
+  // A point which may be part of a random sample. The longitude is kept
+  // only for CSV files, for which the mean longitude is needed.
+  struct SampledPoint {
+    double      key;
+    vw::int64   index;
+    vw::Vector3 xyz;
+    double      lon;
+  };
+
+  bool sampled_key_less(SampledPoint const& a, SampledPoint const& b){
+    return a.key < b.key;
+  }
+  bool sampled_index_less(SampledPoint const& a, SampledPoint const& b){
+    return a.index < b.index;
+  }
+
+  // Pick at most a given number of points, uniformly at random and
+  // without replacement, out of points which are visited in any order,
+  // by any number of threads. Each point gets a pseudo-random key
+  // computed from its index, and the points with the smallest keys are
+  // kept. Hence the sample depends neither on the order the points are
+  // visited in, nor on the number of threads, and at most about twice
+  // the sample size is kept in memory, however many points there are.
+  class PointSampler: private boost::noncopyable {
+  public:
+    PointSampler(vw::int64 num_samples):
+      m_num_samples(std::max(num_samples, vw::int64(0))), m_threshold(1.0) {}
+
+    // A pseudo-random number in [0, 1) from the index of a point
+    static double key(vw::int64 index){
+      // The splitmix64 hash
+      vw::uint64 z = vw::uint64(index) + 0x9E3779B97F4A7C15ULL;
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+      z =  z ^ (z >> 31);
+      return (z >> 11) * (1.0 / 9007199254740992.0); // 2^53
+    }
+
+    // Points with keys no less than this will not be in the sample,
+    // so they need not be decoded.
+    double threshold() const {
+      vw::Mutex::Lock lock(m_mutex);
+      return m_threshold;
+    }
+
+    // Add candidate points, and clear them.
+    void add(std::vector<SampledPoint> & points){
+      vw::Mutex::Lock lock(m_mutex);
+      for (size_t it = 0; it < points.size(); it++) {
+        if (points[it].key < m_threshold)
+          m_points.push_back(points[it]);
+      }
+      points.clear();
+      if (vw::int64(m_points.size()) > 2*m_num_samples)
+        prune();
+    }
+
+    // The sample, in the order of the indices of the points
+    void get_points(std::vector<SampledPoint> & points){
+      vw::Mutex::Lock lock(m_mutex);
+      prune();
+      points = m_points;
+      std::sort(points.begin(), points.end(), sampled_index_less);
+    }
+
+  private:
+
+    // Keep only the points with the smallest keys, and lower the threshold
+    void prune(){
+      if (vw::int64(m_points.size()) <= m_num_samples)
+        return;
+      std::nth_element(m_points.begin(), m_points.begin() + m_num_samples,
+                       m_points.end(), sampled_key_less);
+      m_threshold = m_points[m_num_samples].key;
+      m_points.resize(m_num_samples);
+    }
+
+    vw::int64                 m_num_samples;
+    double                    m_threshold;
+    std::vector<SampledPoint> m_points;
+    mutable vw::Mutex         m_mutex;
+  };
+
+  // Put the sampled points in the matrix, as homogeneous coordinates.
+  // If desired, the shift is the first point, and it is subtracted.
+  void sampled_points_to_matrix(std::vector<SampledPoint> const& points,
+                                bool calc_shift, vw::Vector3 & shift,
+                                DoubleMatrix & data){
+
+    if (calc_shift && !points.empty())
+      shift = points[0].xyz;
+
+    data.resize(DIM+1, points.size());
+    for (size_t col = 0; col < points.size(); col++) {
+      for (int row = 0; row < DIM; row++)
+        data(row, col) = points[col].xyz[row] - shift[row];
+      data(DIM, col) = 1; // Extend to be a homogenous coordinate
+    }
+  }
+
+  // Progress reporting shared by the tasks sampling the tiles of an image
+  class SampleProgress: private boost::noncopyable {
+  public:
+    SampleProgress(int num_tiles, bool verbose):
+      m_tpc("asp", "\t--> "), m_inc_amount(1.0/std::max(num_tiles, 1)),
+      m_verbose(verbose) {
+      if (m_verbose)
+        m_tpc.report_progress(0);
+    }
+    void tile_done(){
+      if (!m_verbose)
+        return;
+      vw::Mutex::Lock lock(m_mutex);
+      m_tpc.report_incremental_progress(m_inc_amount);
+    }
+    void finished(){
+      if (m_verbose)
+        m_tpc.report_finished();
+    }
+  private:
+    vw::TerminalProgressCallback m_tpc;
+    double    m_inc_amount;
+    bool      m_verbose;
+    vw::Mutex m_mutex;
+  };
+
+  // The tiles of a box, to be sampled in parallel
+  std::vector<vw::BBox2i> sample_tiles(vw::BBox2i const& box){
+    const int tile_size = 256;
+    std::vector<vw::BBox2i> tiles;
+    for (int row = box.min().y(); row < box.max().y(); row += tile_size) {
+      for (int col = box.min().x(); col < box.max().x(); col += tile_size) {
+        tiles.push_back(vw::BBox2i(col, row,
+                                   std::min(tile_size, box.max().x() - col),
+                                   std::min(tile_size, box.max().y() - row)));
+      }
+    }
+    return tiles;
+  }
+
+  // Decode one tile of a DEM and add its valid points within the
+  // lon-lat box to the sample.
+  template <typename DemPixelType>
+  class DemSampleTask: public vw::Task, private boost::noncopyable {
+    vw::DiskImageView<DemPixelType> m_dem;
+    DemPixelType                    m_nodata;
+    vw::cartography::GeoReference   m_geo; // A copy, as it is not thread-safe
+    vw::BBox2                       m_lonlat_box;
+    vw::BBox2i                      m_tile;
+    PointSampler                  & m_sampler;
+    SampleProgress                & m_progress;
+  public:
+    DemSampleTask(vw::DiskImageView<DemPixelType> const& dem, DemPixelType nodata,
+                  vw::cartography::GeoReference const& geo,
+                  vw::BBox2 const& lonlat_box, vw::BBox2i const& tile,
+                  PointSampler & sampler, SampleProgress & progress):
+      m_dem(dem), m_nodata(nodata), m_geo(geo), m_lonlat_box(lonlat_box),
+      m_tile(tile), m_sampler(sampler), m_progress(progress){}
+
+    void operator()(){
+      double threshold = m_sampler.threshold();
+      vw::ImageView<DemPixelType> tile = crop(m_dem, m_tile);
+
+      std::vector<SampledPoint> points;
+      for (int j = 0; j < tile.rows(); j++) {
+        for (int i = 0; i < tile.cols(); i++) {
+          int col = m_tile.min().x() + i, row = m_tile.min().y() + j;
+          SampledPoint p;
+          p.index = vw::int64(row)*m_dem.cols() + col;
+          p.key   = PointSampler::key(p.index);
+          if (p.key >= threshold)
+            continue;
+
+          DemPixelType h = tile(i, j);
+          if ( h == m_nodata || std::isnan(h) || std::isinf(h) )
+            continue;
+
+          vw::Vector2 lonlat = m_geo.pixel_to_lonlat( vw::Vector2(col, row) );
+
+          // Skip points outside the given box
+          if (!m_lonlat_box.empty() && !m_lonlat_box.contains(lonlat))
+            continue;
+
+          vw::Vector3 llh( lonlat.x(), lonlat.y(), h );
+          p.xyz = m_geo.datum().geodetic_to_cartesian( llh );
+          if ( p.xyz == vw::Vector3() || !(p.xyz == p.xyz) )
+            continue; // invalid and NaN check
+
+          p.lon = lonlat.x();
+          points.push_back(p);
+        }
+      }
+      m_sampler.add(points);
+      m_progress.tile_done();
+    }
+  };
+
+  // Decode one tile of an ASP point cloud and add its valid points
+  // within the lon-lat box to the sample.
+  class PcSampleTask: public vw::Task, private boost::noncopyable {
+    vw::ImageViewRef<vw::Vector3> m_point_cloud;
+    vw::cartography::Datum        m_datum;
+    vw::BBox2                     m_lonlat_box;
+    vw::BBox2i                    m_tile;
+    PointSampler                & m_sampler;
+    SampleProgress              & m_progress;
+  public:
+    PcSampleTask(vw::ImageViewRef<vw::Vector3> const& point_cloud,
+                 vw::cartography::Datum const& datum,
+                 vw::BBox2 const& lonlat_box, vw::BBox2i const& tile,
+                 PointSampler & sampler, SampleProgress & progress):
+      m_point_cloud(point_cloud), m_datum(datum), m_lonlat_box(lonlat_box),
+      m_tile(tile), m_sampler(sampler), m_progress(progress){}
+
+    void operator()(){
+      double threshold = m_sampler.threshold();
+      vw::ImageView<vw::Vector3> tile = crop(m_point_cloud, m_tile);
+
+      std::vector<SampledPoint> points;
+      for (int j = 0; j < tile.rows(); j++) {
+        for (int i = 0; i < tile.cols(); i++) {
+          SampledPoint p;
+          p.index = vw::int64(m_tile.min().y() + j)*m_point_cloud.cols()
+            + m_tile.min().x() + i;
+          p.key   = PointSampler::key(p.index);
+          if (p.key >= threshold)
+            continue;
+
+          p.xyz = tile(i, j);
+          if ( p.xyz == vw::Vector3() || !(p.xyz == p.xyz) )
+            continue; // invalid and NaN check
+
+          // Skip points outside the given box
+          p.lon = 0.0;
+          if (!m_lonlat_box.empty()){
+            vw::Vector3 llh = m_datum.cartesian_to_geodetic(p.xyz);
+            if ( !m_lonlat_box.contains(subvector(llh, 0, 2)))
+              continue;
+            p.lon = llh[0];
+          }
+          points.push_back(p);
+        }
+      }
+      m_sampler.add(points);
+      m_progress.tile_done();
+    }
+  };
+
+} // end anonymous namespace
+
 int load_csv_aux(std::string const& file_name, int num_points_to_load,
                  vw::BBox2 const& lonlat_box,
                  bool calc_shift, vw::Vector3 & shift,
@@ -115,10 +371,11 @@ int load_csv_aux(std::string const& file_name, int num_points_to_load,
     vw_throw( vw::IOErr() << "Unable to open file \"" << file_name << "\"" );
   }
 
-  // We will randomly pick or not a point with probability load_ratio
-  double load_ratio = (double)num_points_to_load/std::max(1.0, (double)num_total_points);
-
-  data.conservativeResize(DIM+1, std::min(num_points_to_load, num_total_points));
+  // Only the sampled points, and the candidates for the sample, are kept
+  PointSampler sampler(num_points_to_load);
+  std::vector<SampledPoint> candidates;
+  double threshold = 1.0;
+  const size_t max_num_candidates = 65536;
 
   // Peek at the first valid line and see how many elements it has
   std::string line;
@@ -162,10 +419,8 @@ int load_csv_aux(std::string const& file_name, int num_points_to_load,
               << "as expected for the Moon.\n" );
   }
 
-  bool shift_was_calc = false;
   bool is_first_line  = true;
-  int points_count = 0;
-  mean_longitude = 0.0;
+  vw::int64 line_index = 0;
   line = "";
   while ( getline(file, line, '\n') ){
 
@@ -174,15 +429,12 @@ int load_csv_aux(std::string const& file_name, int num_points_to_load,
       continue;
     }
     
-    if (points_count >= num_points_to_load)
-      break;
-
     if (!is_valid_csv_line(line))
       continue;
 
-    // Randomly skip a percentage of points
-    double r = (double)std::rand()/(double)RAND_MAX;
-    if (r > load_ratio)
+    // Skip the points which will not be in the random sample
+    double key = PointSampler::key(line_index++);
+    if (key >= threshold)
       continue;
 
     // We went with C-style file reading instead of C++ in this instance
@@ -310,18 +562,17 @@ int load_csv_aux(std::string const& file_name, int num_points_to_load,
       xyz = rad*(xyz/norm_2(xyz));
     }
 
-    if (calc_shift && !shift_was_calc){
-      shift = xyz;
-      shift_was_calc = true;
+    SampledPoint p;
+    p.key   = key;
+    p.index = line_index;
+    p.xyz   = xyz;
+    p.lon   = lon;
+    candidates.push_back(p);
+    if (candidates.size() >= max_num_candidates){
+      sampler.add(candidates);
+      threshold = sampler.threshold();
     }
 
-    for (int row = 0; row < DIM; row++)
-      data(row, points_count) = xyz[row] - shift[row];
-    data(DIM, points_count) = 1;
-
-    points_count++;
-    mean_longitude += lon;
-
     // Throw an error if the lon and lat are not within bounds.
     // Note that we allow some slack for lon, perhaps the point
     // cloud is say from 350 to 370 degrees.
@@ -332,9 +583,16 @@ int load_csv_aux(std::string const& file_name, int num_points_to_load,
       vw_throw(vw::ArgumentErr() << "Invalid longitude value: "
                << lon << " in " << file_name << "\n");
   }
-  data.conservativeResize(Eigen::NoChange, points_count);
+  sampler.add(candidates);
+
+  std::vector<SampledPoint> points;
+  sampler.get_points(points);
+  sampled_points_to_matrix(points, calc_shift, shift, data);
 
-  mean_longitude /= points_count;
+  mean_longitude = 0.0;
+  for (size_t it = 0; it < points.size(); it++)
+    mean_longitude += points[it].lon;
+  mean_longitude /= points.size();
 
   return num_total_points;
 }
@@ -352,27 +610,13 @@ void load_csv(std::string const& file_name,
                  bool verbose,
                  DoubleMatrix & data){
 
-  int num_total_points = load_csv_aux(file_name, num_points_to_load,
-				      lonlat_box,
-				      calc_shift, shift,
-				      geo, csv_conv, is_lola_rdr_format,
-				      mean_longitude, verbose, data);
-  
-  int num_loaded_points = data.cols();
-  if (!lonlat_box.empty()                    &&
-      num_loaded_points < num_points_to_load &&
-      num_loaded_points < num_total_points){
-    // We loaded too few points. Just load them all, as CSV files are
-    // not too large, we will drop extraneous points later.
-    load_csv_aux(file_name, num_total_points, lonlat_box,
-		 calc_shift, shift,
-		 geo, csv_conv, is_lola_rdr_format,
-		 mean_longitude,
-		 false, // Skip repeating same messages
-                 data);
-  }
-  
-  return;
+  // The sample is taken among the points within the box, so unlike
+  // with picking points with a fixed probability, there is no need to
+  // try again if too few of them are in the box.
+  load_csv_aux(file_name, num_points_to_load, lonlat_box,
+               calc_shift, shift,
+               geo, csv_conv, is_lola_rdr_format,
+               mean_longitude, verbose, data);
 }
 
 // Load a DEM
@@ -381,8 +625,6 @@ void load_dem_pixel_type(std::string const& file_name,
                          int num_points_to_load, vw::BBox2 const& lonlat_box,
                          bool calc_shift, vw::Vector3 & shift,
                          bool verbose, DoubleMatrix & data){
-  
-  data.conservativeResize(DIM+1, num_points_to_load);
 
   vw::cartography::GeoReference dem_geo;
   bool has_georef = vw::cartography::read_georeference( dem_geo, file_name );
@@ -418,62 +660,26 @@ void load_dem_pixel_type(std::string const& file_name,
   if (pix_box.empty())
     pix_box = bounding_box(dem);
 
-  // We will randomly pick or not a point with probability load_ratio
-  int    num_points = pix_box.width()*pix_box.height();
-  double load_ratio = (double)num_points_to_load/std::max(1.0, (double)num_points);
-
-  bool shift_was_calc = false;
-  int  points_count   = 0;
-
-  vw::TerminalProgressCallback tpc("asp", "\t--> ");
-  double inc_amount = 1.0 / double(pix_box.width() );
-  if (verbose)
-    tpc.report_progress(0);
-
-  for (int i = pix_box.min().x(); i < pix_box.max().x(); i++ ) {
-
-    for (int j = pix_box.min().y(); j < pix_box.max().y(); j++ ) {
-      if (points_count >= num_points_to_load)
-        break;
-
-      double r = (double)std::rand()/(double)RAND_MAX;
-      if (r > load_ratio)
-        continue;
-
-      if ( dem(i, j) == nodata || std::isnan(dem(i, j)) || std::isinf(dem(i, j)) )
-        continue;
-      
-      vw::Vector2 lonlat = dem_geo.pixel_to_lonlat( vw::Vector2(i,j) );
-
-      // Skip points outside the given box
-      if (!lonlat_box.empty() && !lonlat_box.contains(lonlat))
-        continue;
-
-      vw::Vector3 llh( lonlat.x(), lonlat.y(), dem(i,j) );
-      vw::Vector3 xyz = dem_geo.datum().geodetic_to_cartesian( llh );
-      if ( xyz == vw::Vector3() || !(xyz == xyz) )
-        continue; // invalid and NaN check
-
-      if (calc_shift && !shift_was_calc){
-        shift = xyz;
-        shift_was_calc = true;
-      }
-
-      for (int row = 0; row < DIM; row++)
-        data(row, points_count) = xyz[row] - shift[row];
-      data(DIM, points_count) = 1; // Extend to be a homogenous coordinate
-
-      points_count++;
-    } // end y loop
-
-    if (verbose)
-      tpc.report_incremental_progress( inc_amount );
-  } // end x loop
-  if (verbose)
-    tpc.report_finished();
-
-  data.conservativeResize(Eigen::NoChange, points_count);
+  // Decode the tiles in parallel, keeping only a uniform random
+  // sample of the valid points within the box.
+  PointSampler sampler(num_points_to_load);
+  std::vector<vw::BBox2i> tiles = sample_tiles(pix_box);
+  SampleProgress progress(tiles.size(), verbose);
+  {
+    vw::FifoWorkQueue queue(vw::vw_settings().default_num_threads());
+    for (size_t it = 0; it < tiles.size(); it++) {
+      boost::shared_ptr<vw::Task>
+        task(new DemSampleTask<DemPixelType>(dem, nodata, dem_geo, lonlat_box,
+                                             tiles[it], sampler, progress));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+  progress.finished();
 
+  std::vector<SampledPoint> points;
+  sampler.get_points(points);
+  sampled_points_to_matrix(points, calc_shift, shift, data);
 }
 
 // Load a DEM
@@ -500,72 +706,6 @@ void load_dem(std::string const& file_name,
   }
 }
 
-vw::int64 load_pc_aux(std::string const& file_name,
-		      int num_points_to_load,
-		      vw::BBox2 const& lonlat_box,
-		      bool calc_shift,
-		      vw::Vector3 & shift,
-		      vw::cartography::GeoReference const& geo,
-		      bool verbose, DoubleMatrix & data){
-
-  data.conservativeResize(DIM+1, num_points_to_load);
-
-  // To do: Is it faster to to do for_each?
-  vw::ImageViewRef<vw::Vector3> point_cloud = read_asp_point_cloud<DIM>(file_name);
-
-  // We will randomly pick or not a point with probability load_ratio
-  vw::int64 num_total_points = point_cloud.cols()*point_cloud.rows();
-  double load_ratio = (double)num_points_to_load/std::max(1.0, (double)num_total_points);
-
-  bool shift_was_calc = false;
-  vw::int64 points_count = 0;
-
-  vw::TerminalProgressCallback tpc("asp", "\t--> ");
-  double inc_amount = 1.0 / double(point_cloud.rows() );
-  if (verbose) tpc.report_progress(0);
-
-  for (int j = 0; j < point_cloud.rows(); j++ ) {
-
-    for ( int i = 0; i < point_cloud.cols(); i++ ) {
-
-      if (points_count >= num_points_to_load)
-        break;
-
-      double r = (double)std::rand()/(double)RAND_MAX;
-      if (r > load_ratio)
-        continue;
-
-      vw::Vector3 xyz = point_cloud(i, j);
-      if ( xyz == vw::Vector3() || !(xyz == xyz) )
-        continue; // invalid and NaN check
-
-      if (calc_shift && !shift_was_calc){
-        shift = xyz;
-        shift_was_calc = true;
-      }
-
-      // Skip points outside the given box
-      if (!lonlat_box.empty()){
-        vw::Vector3 llh = geo.datum().cartesian_to_geodetic(xyz);
-        if ( !lonlat_box.contains(subvector(llh, 0, 2)))
-          continue;
-      }
-
-      for (int row = 0; row < DIM; row++)
-        data(row, points_count) = xyz[row] - shift[row];
-      data(DIM, points_count) = 1;
-
-      points_count++;
-    }
-    if (verbose) tpc.report_incremental_progress( inc_amount );
-  }
-  if (verbose) tpc.report_finished();
-
-  data.conservativeResize(Eigen::NoChange, points_count);
-
-  return num_total_points;
-}
-
 void load_pc(std::string const& file_name,
              int num_points_to_load,
              vw::BBox2 const& lonlat_box,
@@ -574,24 +714,30 @@ void load_pc(std::string const& file_name,
              vw::cartography::GeoReference const& geo,
              bool verbose, DoubleMatrix & data){
 
-  vw::int64 num_total_points = load_pc_aux(file_name, num_points_to_load,
-                                          lonlat_box, calc_shift, shift,
-                                          geo, verbose, data);
-
-  int num_loaded_points = data.cols();
-  if (!lonlat_box.empty()                    &&
-      num_loaded_points < num_points_to_load &&
-      num_loaded_points < num_total_points){
-
-    // We loaded too few points. Try harder. Need some care here as to not run
-    // out of memory.
-    num_points_to_load = std::max(4*num_points_to_load, 10000000);
-    if (verbose)
-      vw::vw_out() << "Too few points were loaded. Trying again." << std::endl;
-    load_pc_aux(file_name, num_points_to_load, lonlat_box,
-                calc_shift, shift, geo, verbose, data);
+  vw::ImageViewRef<vw::Vector3> point_cloud = read_asp_point_cloud<DIM>(file_name);
+
+  // Decode the tiles in parallel, keeping only a uniform random
+  // sample of the valid points within the box. As the sample is taken
+  // among those points, there is no need to try again if too few of
+  // them are in the box.
+  PointSampler sampler(num_points_to_load);
+  std::vector<vw::BBox2i> tiles = sample_tiles(bounding_box(point_cloud));
+  SampleProgress progress(tiles.size(), verbose);
+  {
+    vw::FifoWorkQueue queue(vw::vw_settings().default_num_threads());
+    for (size_t it = 0; it < tiles.size(); it++) {
+      boost::shared_ptr<vw::Task>
+        task(new PcSampleTask(point_cloud, geo.datum(), lonlat_box,
+                              tiles[it], sampler, progress));
+      queue.add_task(task);
+    }
+    queue.join_all();
   }
+  progress.finished();
 
+  std::vector<SampledPoint> points;
+  sampler.get_points(points);
+  sampled_points_to_matrix(points, calc_shift, shift, data);
 }
 
 }
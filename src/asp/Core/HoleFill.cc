@@ -0,0 +1,322 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file HoleFill.cc
+///
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/StringUtils.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PerPixelViews.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/FileIO/DiskImageUtils.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+#include <asp/Core/HoleFill.h>
+#include <boost/filesystem.hpp>
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <vector>
+
+using namespace vw;
+
+namespace {
+
+  /// A pixel of a level of the pyramid: the weighted average of the
+  /// valid values it covers, and its weight, from 0 (no data) to 1.
+  typedef Vector2f LevelPixelT;
+
+  /// Average each 2x2 block of the fine level, weighted, to get the
+  /// pixels of coarse_box in the next level. The fine image has the
+  /// pixels of fine_box.
+  void downsample_pixels(ImageView<LevelPixelT> const& fine, BBox2i const& fine_box,
+                         BBox2i const& coarse_box, ImageView<LevelPixelT> & coarse) {
+    coarse.set_size(coarse_box.width(), coarse_box.height());
+    for (int row = 0; row < coarse.rows(); row++) {
+      for (int col = 0; col < coarse.cols(); col++) {
+        double sum = 0.0, wt = 0.0;
+        for (int dr = 0; dr < 2; dr++) {
+          for (int dc = 0; dc < 2; dc++) {
+            int c = 2*(col + coarse_box.min().x()) + dc - fine_box.min().x();
+            int r = 2*(row + coarse_box.min().y()) + dr - fine_box.min().y();
+            if (c < 0 || r < 0 || c >= fine.cols() || r >= fine.rows())
+              continue;
+            LevelPixelT const& p = fine(c, r);
+            sum += p[1]*p[0];
+            wt  += p[1];
+          }
+        }
+        if (wt > 0)
+          coarse(col, row) = LevelPixelT(sum/wt, std::min(wt, 1.0));
+        else
+          coarse(col, row) = LevelPixelT(0, 0);
+      }
+    }
+  }
+
+  /// The box of the coarse level needed to interpolate the given box of
+  /// the fine level. A fine pixel i is at 0.5*i - 0.25 in the coarse level.
+  BBox2i coarse_box_for(BBox2i const& fine_box, int coarse_cols, int coarse_rows) {
+    BBox2i box(Vector2i((int)floor(0.5*fine_box.min().x() - 0.25),
+                        (int)floor(0.5*fine_box.min().y() - 0.25)),
+               Vector2i((int)floor(0.5*(fine_box.max().x() - 1) - 0.25) + 2,
+                        (int)floor(0.5*(fine_box.max().y() - 1) - 0.25) + 2));
+    box.crop(BBox2i(0, 0, coarse_cols, coarse_rows));
+    return box;
+  }
+
+  /// Fill the pixels of fine_box in a level from the filled level above
+  /// it. The pixels with less than full weight are blended with the
+  /// bilinear interpolation of the level above, whose pixels are those of
+  /// coarse_box, found with coarse_box_for().
+  void pull_pixels(ImageView<LevelPixelT> const& fine, BBox2i const& fine_box,
+                   ImageView<LevelPixelT> const& coarse, BBox2i const& coarse_box,
+                   ImageView<LevelPixelT> & filled) {
+    filled.set_size(fine.cols(), fine.rows());
+    for (int row = 0; row < fine.rows(); row++) {
+      for (int col = 0; col < fine.cols(); col++) {
+        LevelPixelT const& p = fine(col, row);
+        if (p[1] >= 1.0 || coarse_box.empty()) {
+          filled(col, row) = p;
+          continue;
+        }
+
+        double x = 0.5*(col + fine_box.min().x()) - 0.25;
+        double y = 0.5*(row + fine_box.min().y()) - 0.25;
+        int    x0 = (int)floor(x), y0 = (int)floor(y);
+        double tx = x - x0, ty = y - y0;
+        double sum = 0.0, wt = 0.0;
+        for (int dy = 0; dy < 2; dy++) {
+          for (int dx = 0; dx < 2; dx++) {
+            int c = std::max(coarse_box.min().x(), std::min(coarse_box.max().x() - 1, x0 + dx));
+            int r = std::max(coarse_box.min().y(), std::min(coarse_box.max().y() - 1, y0 + dy));
+            LevelPixelT const& q = coarse(c - coarse_box.min().x(), r - coarse_box.min().y());
+            double b = (dx ? tx : 1.0 - tx)*(dy ? ty : 1.0 - ty);
+            sum += b*q[1]*q[0];
+            wt  += b*q[1];
+          }
+        }
+
+        double w = p[1] + (1.0 - p[1])*wt;
+        if (w > 0)
+          filled(col, row) = LevelPixelT((p[1]*p[0] + (1.0 - p[1])*sum)/w, w);
+        else
+          filled(col, row) = LevelPixelT(0, 0);
+      }
+    }
+  }
+
+  /// The next level of the pyramid, made tile by tile.
+  class PyramidDownView: public ImageViewBase<PyramidDownView> {
+    ImageViewRef<LevelPixelT> m_fine;
+  public:
+    typedef LevelPixelT pixel_type;
+    typedef LevelPixelT result_type;
+    typedef ProceduralPixelAccessor<PyramidDownView> pixel_accessor;
+
+    PyramidDownView(ImageViewRef<LevelPixelT> const& fine): m_fine(fine) {}
+
+    inline int32 cols  () const { return (m_fine.cols() + 1)/2; }
+    inline int32 rows  () const { return (m_fine.rows() + 1)/2; }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline result_type operator()( int /*i*/, int /*j*/, int /*p*/=0 ) const {
+      vw_throw(NoImplErr() << "PyramidDownView::operator()(...) is not implemented");
+      return result_type();
+    }
+
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+      BBox2i fine_box(2*bbox.min(), 2*bbox.max());
+      fine_box.crop(bounding_box(m_fine));
+      ImageView<LevelPixelT> fine = crop(m_fine, fine_box), coarse;
+      downsample_pixels(fine, fine_box, bbox, coarse);
+      return prerasterize_type(coarse, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  /// A level of the pyramid with its holes filled from the filled level
+  /// above it, made tile by tile.
+  class PyramidPullView: public ImageViewBase<PyramidPullView> {
+    ImageViewRef<LevelPixelT> m_fine, m_coarse;
+  public:
+    typedef LevelPixelT pixel_type;
+    typedef LevelPixelT result_type;
+    typedef ProceduralPixelAccessor<PyramidPullView> pixel_accessor;
+
+    PyramidPullView(ImageViewRef<LevelPixelT> const& fine,
+                    ImageViewRef<LevelPixelT> const& coarse):
+      m_fine(fine), m_coarse(coarse) {}
+
+    inline int32 cols  () const { return m_fine.cols(); }
+    inline int32 rows  () const { return m_fine.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline result_type operator()( int /*i*/, int /*j*/, int /*p*/=0 ) const {
+      vw_throw(NoImplErr() << "PyramidPullView::operator()(...) is not implemented");
+      return result_type();
+    }
+
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+      BBox2i coarse_box = coarse_box_for(bbox, m_coarse.cols(), m_coarse.rows());
+      ImageView<LevelPixelT> fine = crop(m_fine, bbox), coarse, filled;
+      if (!coarse_box.empty())
+        coarse = crop(m_coarse, coarse_box);
+      pull_pixels(fine, bbox, coarse, coarse_box, filled);
+      return prerasterize_type(filled, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  /// From a DEM value to a pixel of the first level
+  struct ToLevelPixel: public ReturnFixedType<LevelPixelT> {
+    float m_nodata;
+    ToLevelPixel(float nodata): m_nodata(nodata) {}
+    LevelPixelT operator()(float val) const {
+      if (val == m_nodata || boost::math::isnan(val))
+        return LevelPixelT(0, 0);
+      return LevelPixelT(val, 1);
+    }
+  };
+
+  /// Back from a filled pixel of the first level to a DEM value
+  struct FromLevelPixel: public ReturnFixedType<float> {
+    float m_nodata;
+    FromLevelPixel(float nodata): m_nodata(nodata) {}
+    float operator()(LevelPixelT const& pix) const {
+      if (pix[1] > 0)
+        return pix[0];
+      return m_nodata;
+    }
+  };
+
+} // end anonymous namespace
+
+namespace asp {
+
+int pyramid_hole_fill_levels(int hole_fill_len, int cols, int rows) {
+  // A hole of up to this size cannot cover any pixel of the top level,
+  // whose pixels are bigger than it.
+  int num_levels = 0;
+  while ((1 << num_levels) <= hole_fill_len && (cols > 1 || rows > 1)) {
+    num_levels++;
+    cols = (cols + 1)/2;
+    rows = (rows + 1)/2;
+  }
+  return num_levels;
+}
+
+void pyramid_fill_holes(ImageView< PixelMask<float> > & image, int hole_fill_len) {
+
+  int num_levels = pyramid_hole_fill_levels(hole_fill_len, image.cols(), image.rows());
+
+  std::vector< ImageView<LevelPixelT> > levels(num_levels + 1);
+  levels[0].set_size(image.cols(), image.rows());
+  for (int row = 0; row < image.rows(); row++) {
+    for (int col = 0; col < image.cols(); col++) {
+      if (is_valid(image(col, row)))
+        levels[0](col, row) = LevelPixelT(image(col, row).child(), 1);
+      else
+        levels[0](col, row) = LevelPixelT(0, 0);
+    }
+  }
+
+  for (int k = 1; k <= num_levels; k++) {
+    BBox2i coarse_box(0, 0, (levels[k-1].cols() + 1)/2, (levels[k-1].rows() + 1)/2);
+    downsample_pixels(levels[k-1], bounding_box(levels[k-1]), coarse_box, levels[k]);
+  }
+
+  for (int k = num_levels - 1; k >= 0; k--) {
+    ImageView<LevelPixelT> filled;
+    pull_pixels(levels[k], bounding_box(levels[k]), levels[k+1], bounding_box(levels[k+1]),
+                filled);
+    levels[k] = filled;
+  }
+
+  for (int row = 0; row < image.rows(); row++) {
+    for (int col = 0; col < image.cols(); col++) {
+      if (!is_valid(image(col, row)) && levels[0](col, row)[1] > 0)
+        image(col, row) = PixelMask<float>(levels[0](col, row)[0]);
+    }
+  }
+}
+
+void pyramid_fill_holes(std::string const& in_file, std::string const& out_file,
+                        int hole_fill_len, vw::cartography::GdalWriteOptions const& opt,
+                        vw::ProgressCallback const& tpc) {
+
+  double nodata = 0.0;
+  if (!vw::read_nodata_val(in_file, nodata))
+    vw_throw(ArgumentErr() << "Cannot fill holes in " << in_file
+             << " as it has no no-data value.\n");
+  vw::cartography::GeoReference georef;
+  bool has_georef = vw::cartography::read_georeference(georef, in_file);
+
+  DiskImageView<float> in_img(in_file);
+  int num_levels = pyramid_hole_fill_levels(hole_fill_len, in_img.cols(), in_img.rows());
+
+  // Write the levels above the input, each from the one below it
+  std::vector< ImageViewRef<LevelPixelT> > levels;
+  levels.push_back(per_pixel_filter(in_img, ToLevelPixel(nodata)));
+  std::vector<std::string> level_files;
+  std::string level_prefix = boost::filesystem::path(out_file).replace_extension("").string();
+  for (int k = 1; k <= num_levels; k++) {
+    std::string level_file = level_prefix + "-pyramid-level-" + vw::num_to_str(k) + ".tif";
+    vw_out() << "Writing: " << level_file << "\n";
+    bool level_has_georef = false, level_has_nodata = false;
+    vw::cartography::block_write_gdal_image(level_file, PyramidDownView(levels[k-1]),
+                                            level_has_georef, georef,
+                                            level_has_nodata, nodata, opt,
+                                            TerminalProgressCallback("asp", "\t--> "));
+    level_files.push_back(level_file);
+    levels.push_back(DiskImageView<LevelPixelT>(level_file));
+  }
+
+  // Fill each level from the one above it, from the top down. Each
+  // tile of the output needs only a small box from each level.
+  ImageViewRef<LevelPixelT> filled = levels[num_levels];
+  for (int k = num_levels - 1; k >= 0; k--)
+    filled = PyramidPullView(levels[k], filled);
+
+  vw_out() << "Writing: " << out_file << "\n";
+  bool has_nodata = true;
+  vw::cartography::block_write_gdal_image(out_file,
+                                          per_pixel_filter(filled, FromLevelPixel(nodata)),
+                                          has_georef, georef, has_nodata, nodata, opt, tpc);
+
+  // Close the levels before removing them
+  filled = ImageView<LevelPixelT>();
+  levels.clear();
+  for (size_t k = 0; k < level_files.size(); k++)
+    boost::filesystem::remove(level_files[k]);
+}
+
+} // end namespace asp
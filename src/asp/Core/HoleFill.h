@@ -0,0 +1,65 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file HoleFill.h
+///
+/// Fill the no-data pixels of a DEM with the push-pull method. A
+/// pyramid of coarser and coarser images is made by averaging the
+/// valid pixels of each 2x2 block, then the holes of each level are
+/// filled by interpolating the level above it. Each level is only
+/// read with a margin of a pixel or two, so the cost does not grow with
+/// the size of the holes, unlike for grassfire-based hole-filling.
+///
+/// The number of levels is given by the hole-fill length. Holes up to
+/// about this size are filled, as are the no-data pixels within about
+/// this distance of valid ones elsewhere, including at the DEM boundary.
+
+#ifndef __ASP_CORE_HOLE_FILL_H__
+#define __ASP_CORE_HOLE_FILL_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Core/ProgressCallback.h>
+#include <string>
+
+// Forward declaration
+namespace vw{
+  namespace cartography{
+    class GdalWriteOptions;
+  }
+}
+
+namespace asp {
+
+  /// The number of pyramid levels above the image used to fill holes of
+  /// up to this size, for an image of the given dimensions.
+  int pyramid_hole_fill_levels(int hole_fill_len, int cols, int rows);
+
+  /// Fill in place the holes of an image in memory.
+  void pyramid_fill_holes(vw::ImageView< vw::PixelMask<float> > & image, int hole_fill_len);
+
+  /// Fill the holes of a single-band image on disk, such as a DEM, and
+  /// write the result, with the georeference and no-data value of the
+  /// input, which must have one. The levels of the pyramid are written
+  /// next to the output and removed at the end. Each level is written
+  /// in parallel, tile by tile.
+  void pyramid_fill_holes(std::string const& in_file, std::string const& out_file,
+                          int hole_fill_len, vw::cartography::GdalWriteOptions const& opt,
+                          vw::ProgressCallback const& tpc = vw::ProgressCallback::dummy_instance());
+}
+
+#endif //__ASP_CORE_HOLE_FILL_H__
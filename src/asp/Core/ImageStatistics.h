@@ -0,0 +1,135 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file ImageStatistics.h
+///
+/// Sampling of the valid pixel values of an image, to estimate its
+/// statistics and quantiles without reading every pixel. The image is
+/// sampled on a regular grid, so each cell of the grid contributes one
+/// sample, and the grid is read in tiles processed in parallel.
+
+#ifndef __ASP_CORE_IMAGE_STATISTICS_H__
+#define __ASP_CORE_IMAGE_STATISTICS_H__
+
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/EdgeExtension.h>
+#include <vw/Image/Statistics.h>
+#include <vw/Image/PixelMask.h>
+#include <boost/noncopyable.hpp>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+
+namespace asp {
+
+  /// The number of samples for which, with 95% confidence, a quantile
+  /// estimated from them is within this error of the true one, in
+  /// fraction of the number of pixels. Returns 0, meaning use all
+  /// pixels, if the error is not positive.
+  inline double stats_sample_count(double quantile_error) {
+    if (!(quantile_error > 0.0))
+      return 0.0;
+    double ans = 1.96/(2.0*quantile_error);
+    return ans*ans;
+  }
+
+  /// The sampling step along each axis so that an image of the given
+  /// size is sampled about num_samples times. All pixels are used if
+  /// num_samples is not positive.
+  inline int stats_sample_step(vw::int64 cols, vw::int64 rows, double num_samples) {
+    if (!(num_samples > 0.0))
+      return 1;
+    return std::max(1, int(ceil(sqrt(double(cols)*double(rows)/num_samples))));
+  }
+
+  /// Collects the values of the pixels it is given. Used with
+  /// ChannelAccumulator, which passes it only the valid pixels.
+  struct StatsSampleCollector {
+    std::vector<float> values;
+    void operator()(float val) { values.push_back(val); }
+  };
+
+  /// Collect the values of the valid pixels in one tile of a
+  /// subsampled image, for sample_valid_values().
+  template <class ViewT>
+  class StatsTileTask: public vw::Task, private boost::noncopyable {
+    ViewT               m_view;
+    vw::BBox2i          m_box;
+    std::vector<float>& m_values;
+  public:
+    StatsTileTask(ViewT const& view, vw::BBox2i const& box, std::vector<float> & values):
+      m_view(view), m_box(box), m_values(values) {}
+    virtual void operator()() {
+      // Rasterize first, so that the input is read in blocks
+      vw::ImageView<typename ViewT::pixel_type> tile = vw::crop(m_view, m_box);
+      vw::ChannelAccumulator<StatsSampleCollector> accumulator;
+      vw::for_each_pixel(tile, accumulator);
+      m_values.swap(accumulator.values);
+    }
+  };
+
+  /// The values of the valid pixels of an image, over all channels,
+  /// sampled every given number of pixels along each axis. The tiles
+  /// are processed with the given number of threads, or with the
+  /// default number if 0.
+  template <class ViewT>
+  void sample_valid_values(vw::ImageViewBase<ViewT> const& view_base, int sample_step,
+                           int num_threads, std::vector<float> & values) {
+    using namespace vw;
+    typedef SubsampleView< EdgeExtendView<ViewT, ConstantEdgeExtension> > SubT;
+    SubT sub = subsample(edge_extend(view_base.impl(), ConstantEdgeExtension()),
+                         std::max(sample_step, 1));
+
+    // Each tile of the subsampled image is read from a region of the
+    // input of about 2048 x 2048 pixels.
+    int tile_size = std::max(16, 2048/std::max(sample_step, 1));
+    std::vector<BBox2i> boxes = subdivide_bbox(sub, tile_size, tile_size);
+    std::vector< std::vector<float> > tile_values(boxes.size());
+    if (num_threads <= 0)
+      num_threads = vw_settings().default_num_threads();
+    FifoWorkQueue queue(num_threads);
+    for (size_t i = 0; i < boxes.size(); i++) {
+      boost::shared_ptr<Task> task(new StatsTileTask<SubT>(sub, boxes[i], tile_values[i]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+
+    size_t num_values = 0;
+    for (size_t i = 0; i < tile_values.size(); i++)
+      num_values += tile_values[i].size();
+    values.clear();
+    values.reserve(num_values);
+    for (size_t i = 0; i < tile_values.size(); i++) {
+      values.insert(values.end(), tile_values[i].begin(), tile_values[i].end());
+      std::vector<float>().swap(tile_values[i]);
+    }
+  }
+
+  /// The given quantile, between 0 and 1, of a set of values, which
+  /// get reordered. The values must not be empty.
+  inline float sample_quantile(std::vector<float> & values, double quantile) {
+    size_t pos = size_t(round(std::max(0.0, std::min(1.0, quantile))*(values.size() - 1)));
+    std::nth_element(values.begin(), values.begin() + pos, values.end());
+    return values[pos];
+  }
+
+} // namespace asp
+
+#endif//__ASP_CORE_IMAGE_STATISTICS_H__
@@ -21,6 +21,9 @@
 #include <vw/Math/RANSAC.h>
 #include <vw/Cartography/CameraBBox.h>
 #include <vw/Stereo/StereoModel.h>
+#include <boost/filesystem.hpp>
+#include <ctime>
+#include <iomanip>
 
 using namespace vw;
 
@@ -29,6 +32,68 @@ namespace asp {
   int g_ip_num_errors = 0;
   Mutex g_ip_mutex;
 
+  namespace {
+    // A point near the edge of a tile, and the tile it was found in
+    typedef std::pair<ip::InterestPointList::iterator, size_t> SeamPoint;
+
+    struct SeamPointLessX {
+      bool operator()(SeamPoint const& a, SeamPoint const& b) const {
+        return a.first->x < b.first->x;
+      }
+    };
+  }
+
+  void remove_ip_duplicates_at_seams(std::vector<BBox2i> const& boxes,
+                                     std::vector< boost::shared_ptr<ip::InterestPointList> >
+                                     & tile_ip, double radius) {
+
+    // Only the points within radius of the edge of their tile can have
+    // a duplicate in another tile.
+    std::vector<SeamPoint> seam_points;
+    for (size_t t = 0; t < tile_ip.size(); t++) {
+      BBox2 inner(boxes[t].min(), boxes[t].max());
+      inner.contract(radius);
+      for (ip::InterestPointList::iterator it = tile_ip[t]->begin();
+           it != tile_ip[t]->end(); ++it) {
+        if (!inner.contains(Vector2(it->x, it->y)))
+          seam_points.push_back(SeamPoint(it, t));
+      }
+    }
+
+    // Sorted by x, a point needs to be compared only with the next few
+    std::sort(seam_points.begin(), seam_points.end(), SeamPointLessX());
+    std::vector<bool> removed(seam_points.size(), false);
+    for (size_t i = 0; i < seam_points.size(); i++) {
+      if (removed[i])
+        continue;
+      ip::InterestPoint const& a = *seam_points[i].first;
+      for (size_t j = i + 1; j < seam_points.size(); j++) {
+        ip::InterestPoint const& b = *seam_points[j].first;
+        if (b.x - a.x > radius)
+          break;
+        if (removed[j] || seam_points[j].second == seam_points[i].second)
+          continue;
+        if (norm_2(Vector2(a.x - b.x, a.y - b.y)) > radius)
+          continue;
+        if (a.interest < b.interest) {
+          removed[i] = true;
+          break;
+        }
+        removed[j] = true;
+      }
+    }
+
+    size_t num_removed = 0;
+    for (size_t i = 0; i < seam_points.size(); i++) {
+      if (!removed[i])
+        continue;
+      tile_ip[seam_points[i].second]->erase(seam_points[i].first);
+      num_removed++;
+    }
+    vw_out(DebugMessage, "asp") << "Removed " << num_removed
+                                << " duplicate interest points at tile seams.\n";
+  }
+
 
 //-------------------------------------------------------------------------------------------------
 // Class EpipolarLinePointMatcher
@@ -121,7 +186,7 @@ namespace asp {
     math::FLANNTree<float        >& m_tree_float;
     math::FLANNTree<unsigned char>& m_tree_uchar;
     IPListIter                      m_start, m_end;
-    ip::InterestPointList const&    m_ip_other;
+    std::vector<Vector2> const&     m_other_org_coords; // ip2 in the original image
     camera::CameraModel            *m_cam1, *m_cam2;
     TransformRef                    m_tx1, m_tx2;
     EpipolarLinePointMatcher const& m_matcher;
@@ -134,7 +199,7 @@ namespace asp {
 			   math::FLANNTree<unsigned char>& tree_uchar,
 			   ip::InterestPointList::const_iterator start,
 			   ip::InterestPointList::const_iterator end,
-			   ip::InterestPointList const& ip2,
+			   std::vector<Vector2> const& ip2_org_coords,
 			   camera::CameraModel* cam1,
 			   camera::CameraModel* cam2,
 			   TransformRef const& tx1,
@@ -144,7 +209,7 @@ namespace asp {
 			   std::vector<size_t>::iterator output ) :
       m_single_threaded_camera(single_threaded_camera),
       m_use_uchar_tree(use_uchar_tree), m_tree_float(tree_float), m_tree_uchar(tree_uchar),
-      m_start(start), m_end(end), m_ip_other(ip2),
+      m_start(start), m_end(end), m_other_org_coords(ip2_org_coords),
       m_cam1(cam1), m_cam2(cam2), m_tx1(tx1), m_tx2(tx2),
       m_matcher( matcher ), m_camera_mutex(camera_mutex), m_output(output) {}
 
@@ -203,11 +268,8 @@ namespace asp {
         double small_epipolar_threshold = m_matcher.m_epipolar_threshold;
         double large_epipolar_threshold = small_epipolar_threshold + EPIPOLAR_BAND_EXPANSION;
         for ( size_t i = 0; i < num_matches_valid; i++ ) {
-          IPListIter ip2_it = m_ip_other.begin();
-          std::advance( ip2_it, indices[i] );
-
           if (found_epipolar){
-            Vector2 ip2_org_coord = m_tx2.reverse( Vector2( ip2_it->x, ip2_it->y ) );
+            Vector2 const& ip2_org_coord = m_other_org_coords[indices[i]];
             double  line_distance = m_matcher.distance_point_line( line_eq, ip2_org_coord );
             if ( line_distance < large_epipolar_threshold ) {
               if ( line_distance < small_epipolar_threshold )
@@ -281,6 +343,14 @@ namespace asp {
 
     vw_out(InfoMessage,"interest_point") << "FLANN-Tree created. Searching...\n";
 
+    // The candidate matches are found by their index in ip2, and the
+    // list does not have random access, so find their coordinates in
+    // the original image once here.
+    std::vector<Vector2> ip2_org_coords;
+    ip2_org_coords.reserve(ip2_size);
+    for (IPListIter it = ip2.begin(); it != ip2.end(); it++)
+      ip2_org_coords.push_back(tx2.reverse(Vector2(it->x, it->y)));
+
     FifoWorkQueue matching_queue; // Create a thread pool object
     Mutex camera_mutex;
 
@@ -304,7 +374,7 @@ namespace asp {
 	match_task( new EpipolarLineMatchTask( m_single_threaded_camera,
 					       use_uchar_FLANN, kd_float, kd_uchar,
 					       start_it, end_it,
-					       ip2, cam1, cam2, tx1, tx2, *this,
+					       ip2_org_coords, cam1, cam2, tx1, tx2, *this,
 					       camera_mutex, output_it ) );
       matching_queue.add_task( match_task );
       start_it = end_it;
@@ -314,7 +384,7 @@ namespace asp {
       match_task( new EpipolarLineMatchTask( m_single_threaded_camera,
 					     use_uchar_FLANN, kd_float, kd_uchar,
 					     start_it, ip1.end(),
-					     ip2, cam1, cam2, tx1, tx2, *this,
+					     ip2_org_coords, cam1, cam2, tx1, tx2, *this,
 					     camera_mutex, output_it ) );
     matching_queue.add_task( match_task );
     matching_queue.join_all(); // Wait for all the jobs to finish.
@@ -346,6 +416,80 @@ namespace asp {
 
   }
 
+  // Bounce the pixels in one column of the sampling grid of each image
+  // off the datum and into the other camera. Each column is a task, so
+  // that the rays through expensive camera models are found in parallel.
+  class RoughHomographyTask : public Task, private boost::noncopyable {
+    camera::CameraModel     *m_cam1, *m_cam2;
+    BBox2i                   m_box1, m_box2;
+    cartography::Datum       m_datum;
+    int                      m_i, m_num;
+    bool                     m_single_threaded_camera;
+    Mutex                  & m_camera_mutex;
+    TerminalProgressCallback & m_tpc;
+    std::vector<Vector3>   & m_left_points, & m_right_points;
+
+    // Intersect the ray from one camera with the datum, and project
+    // into the other camera. Return false if it does not see the point
+    // in its box.
+    bool bounce(camera::CameraModel* cam_from, camera::CameraModel* cam_to,
+                BBox2i const& box_to, Vector2 const& pix_from, Vector2 & pix_to) {
+      try {
+        Vector3 intersection;
+        if (m_single_threaded_camera) {
+          Mutex::Lock lock(m_camera_mutex);
+          intersection = cartography::datum_intersection( m_datum, cam_from, pix_from );
+          if ( intersection == Vector3() )
+            return false;
+          pix_to = cam_to->point_to_pixel( intersection );
+        }else{
+          intersection = cartography::datum_intersection( m_datum, cam_from, pix_from );
+          if ( intersection == Vector3() )
+            return false;
+          pix_to = cam_to->point_to_pixel( intersection );
+        }
+        return box_to.contains( pix_to );
+      }
+      catch (...) {}
+      return false;
+    }
+
+  public:
+    RoughHomographyTask(camera::CameraModel* cam1, camera::CameraModel* cam2,
+                        BBox2i const& box1, BBox2i const& box2,
+                        cartography::Datum const& datum, int i, int num,
+                        bool single_threaded_camera, Mutex & camera_mutex,
+                        TerminalProgressCallback & tpc,
+                        std::vector<Vector3> & left_points,
+                        std::vector<Vector3> & right_points):
+      m_cam1(cam1), m_cam2(cam2), m_box1(box1), m_box2(box2), m_datum(datum),
+      m_i(i), m_num(num), m_single_threaded_camera(single_threaded_camera),
+      m_camera_mutex(camera_mutex), m_tpc(tpc),
+      m_left_points(left_points), m_right_points(right_points) {}
+
+    virtual void operator()() {
+      int i = m_i, num = m_num;
+      for ( int j = 0; j < num; j++ ) {
+        Vector2 l( double(m_box1.width()  - 1) * i / (num-1.0),
+                   double(m_box1.height() - 1) * j / (num-1.0) );
+        Vector2 r;
+        if (bounce(m_cam1, m_cam2, m_box2, l, r)) {
+          m_left_points.push_back(  Vector3(l[0],l[1],1) );
+          m_right_points.push_back( Vector3(r[0],r[1],1) );
+        }
+
+        r = Vector2( double(m_box2.width()  - 1) * i / (num-1.0),
+                     double(m_box2.height() - 1) * j / (num-1.0) );
+        if (bounce(m_cam2, m_cam1, m_box1, r, l)) {
+          m_left_points.push_back( Vector3(l[0],l[1],1) );
+          m_right_points.push_back( Vector3(r[0],r[1],1) );
+        }
+      }
+      Mutex::Lock lock(m_camera_mutex);
+      m_tpc.report_incremental_progress( 1.0/double(num) );
+    }
+  };
+
   // Find a rough homography that maps right to left using the camera
   // and datum information.  More precisely, take a set of pixels in
   // the left camera image, project them onto the ground and back
@@ -356,58 +500,40 @@ namespace asp {
   rough_homography_fit( camera::CameraModel* cam1,
 			camera::CameraModel* cam2,
 			BBox2i const& box1, BBox2i const& box2,
-			cartography::Datum const& datum ) {
+			cartography::Datum const& datum,
+			bool single_threaded_camera ) {
 
     // Bounce several points off the datum and fit an affine.
-    std::vector<Vector3> left_points, right_points;
     int num = 100;
-    left_points.reserve(2*num*num);
-    right_points.reserve(2*num*num);
 
     // Report progress, as this may be slow
     TerminalProgressCallback tpc("", "\tRough homography--> ");
     tpc.report_progress(0);
-    double inc_amount = 1.0 / double(num) / double(num);
-    
-    for (int i = 0; i < num; i++ ) {
-      for ( int j = 0; j < num; j++ ) {
-        try {
-          Vector2 l( double(box1.width()  - 1) * i / (num-1.0),
-	             double(box1.height() - 1) * j / (num-1.0) );
-
-          Vector3 intersection = cartography::datum_intersection( datum, cam1, l );
-          if ( intersection == Vector3() )
-            continue;
-
-          Vector2 r = cam2->point_to_pixel( intersection );
 
-          if ( box2.contains( r ) ){
-            left_points.push_back(  Vector3(l[0],l[1],1) );
-            right_points.push_back( Vector3(r[0],r[1],1) );
-          }
-        }
-        catch (...) {}
-
-        try {
-          Vector2 r( double(box2.width()  - 1) * i / (num-1.0),
-	             double(box2.height() - 1) * j / (num-1.0) );
-
-          Vector3 intersection = cartography::datum_intersection( datum, cam2, r );
-          if ( intersection == Vector3() )
-            continue;
-
-          Vector2 l = cam1->point_to_pixel( intersection );
-
-          if ( box1.contains( l ) ) {
-            left_points.push_back( Vector3(l[0],l[1],1) );
-            right_points.push_back( Vector3(r[0],r[1],1) );
-          }
-        }
-        catch (...) {}
-        tpc.report_incremental_progress( inc_amount );
-      }
+    // The points of each column are kept apart, and put together in
+    // order at the end, so that the fit is the same with any number
+    // of threads.
+    std::vector< std::vector<Vector3> > left_cols(num), right_cols(num);
+    Mutex camera_mutex;
+    {
+      int num_threads = single_threaded_camera ? 1 : vw_settings().default_num_threads();
+      FifoWorkQueue queue(std::max(num_threads, 1));
+      for (int i = 0; i < num; i++)
+        queue.add_task(boost::shared_ptr<Task>
+                       (new RoughHomographyTask(cam1, cam2, box1, box2, datum, i, num,
+                                                single_threaded_camera, camera_mutex, tpc,
+                                                left_cols[i], right_cols[i])));
+      queue.join_all();
     }
     tpc.report_finished();
+
+    std::vector<Vector3> left_points, right_points;
+    left_points.reserve(2*num*num);
+    right_points.reserve(2*num*num);
+    for (int i = 0; i < num; i++) {
+      left_points.insert (left_points.end(),  left_cols[i].begin(),  left_cols[i].end());
+      right_points.insert(right_points.end(), right_cols[i].begin(), right_cols[i].end());
+    }
     
     if (left_points.empty() || right_points.empty())
       vw_throw( ArgumentErr() << "InterestPointMatching: rough_homography_fit failed to generate points! Examine your images, or consider using the option --skip-rough-homography.\n" );
@@ -415,7 +541,7 @@ namespace asp {
     double thresh_factor = stereo_settings().ip_inlier_factor; // 1/15 by default
 
     typedef math::HomographyFittingFunctor hfit_func;
-    math::RandomSampleConsensus<hfit_func, math::InterestPointErrorMetric>
+    ParallelRandomSampleConsensus<hfit_func, math::InterestPointErrorMetric>
       ransac( hfit_func(), math::InterestPointErrorMetric(),
 	      100, // num iterations
 	      norm_2(Vector2(box1.width(),box1.height())) * (1.5*thresh_factor), // inlier threshold
@@ -447,7 +573,7 @@ namespace asp {
     double thresh_factor = stereo_settings().ip_inlier_factor; // 1/15 by default
     
     // Use RANSAC to determine a good homography transform between the images
-    math::RandomSampleConsensus<math::HomographyFittingFunctor, math::InterestPointErrorMetric>
+    ParallelRandomSampleConsensus<math::HomographyFittingFunctor, math::InterestPointErrorMetric>
       ransac( math::HomographyFittingFunctor(),
 	      math::InterestPointErrorMetric(),
 	      100, // num iter
@@ -831,7 +957,7 @@ namespace asp {
     std::vector<size_t> indices;
     try {
 
-      vw::math::RandomSampleConsensus<vw::math::TranslationScaleFittingFunctor, vw::math::InterestPointErrorMetric> ransac( vw::math::TranslationScaleFittingFunctor(), vw::math::InterestPointErrorMetric(), 100, 10, ransac_ip1.size()/2, true);
+      ParallelRandomSampleConsensus<vw::math::TranslationScaleFittingFunctor, vw::math::InterestPointErrorMetric> ransac( vw::math::TranslationScaleFittingFunctor(), vw::math::InterestPointErrorMetric(), 100, 10, ransac_ip1.size()/2, true);
       T = ransac( ransac_ip2, ransac_ip1 );
       indices = ransac.inlier_indices(T, ransac_ip2, ransac_ip1 );
     } catch (...) {
@@ -866,4 +992,140 @@ namespace asp {
     return disp_file + "-unaligned-D.tif";
   }
 
+  vw::uint64 ip_cache_hash(vw::uint64 hash, const void* data, size_t num_bytes) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < num_bytes; i++) {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  namespace {
+    // The hash of the given text, as a key
+    std::string ip_cache_hash_key(std::string const& text){
+      std::ostringstream key;
+      key << std::hex << std::setw(16) << std::setfill('0')
+          << ip_cache_hash(IP_CACHE_HASH_SEED, text.c_str(), text.size());
+      return key.str();
+    }
+  }
+
+  std::string ip_cache_key(std::string const& image_file, std::string const& preprocessing,
+                           int ip_per_tile, double nodata){
+    namespace fs = boost::filesystem;
+    if (stereo_settings().ip_cache_dir.empty() || image_file.empty())
+      return "";
+
+    boost::system::error_code ec;
+    fs::path path = fs::absolute(image_file);
+    boost::uintmax_t size = fs::file_size(path, ec);
+    if (ec)
+      return "";
+    std::time_t mtime = fs::last_write_time(path, ec);
+    if (ec)
+      return "";
+
+    std::ostringstream os;
+    os.precision(17);
+    os << path.string() << "\n" << size << " " << mtime << "\n" << preprocessing << "\n"
+       << ip_per_tile << " " << nodata << " "
+       << stereo_settings().ip_matching_method << " " << stereo_settings().num_scales << " "
+       << stereo_settings().skip_image_normalization << " "
+       << stereo_settings().ip_normalize_tiles;
+    return ip_cache_hash_key(os.str());
+  }
+
+  std::string ip_cache_key(std::string const& key, std::string const& preprocessing){
+    if (key.empty())
+      return "";
+    return ip_cache_hash_key(key + "\n" + preprocessing);
+  }
+
+  namespace {
+
+    // The name of the cache file for the given key
+    std::string ip_cache_file(std::string const& key, std::string const& ext){
+      return (boost::filesystem::path(stereo_settings().ip_cache_dir) / (key + ext)).string();
+    }
+
+    // The key of the matches between two images also depends on the
+    // settings with which they are matched.
+    std::string match_cache_key(std::string const& key1, std::string const& key2){
+      std::ostringstream os;
+      os.precision(17);
+      os << stereo_settings().ip_uniqueness_thresh << " " << stereo_settings().ip_edge_buffer_percent;
+      std::string settings = os.str();
+      std::ostringstream key;
+      key << key1 << "__" << key2 << "-" << std::hex << std::setw(16) << std::setfill('0')
+          << ip_cache_hash(IP_CACHE_HASH_SEED, settings.c_str(), settings.size());
+      return key.str();
+    }
+
+    // Write to a temporary file first and then rename it, so that other
+    // processes sharing the cache never see a partially written file.
+    std::string ip_cache_tmp_file(std::string const& file){
+      boost::filesystem::create_directories(stereo_settings().ip_cache_dir);
+      return boost::filesystem::unique_path(file + "-%%%%%%%%.tmp").string();
+    }
+  }
+
+  bool read_cached_ip(std::string const& key, vw::ip::InterestPointList & ip){
+    if (key.empty())
+      return false;
+    std::string file = ip_cache_file(key, ".vwip");
+    if (!boost::filesystem::exists(file))
+      return false;
+    try {
+      std::vector<ip::InterestPoint> ip_vec = ip::read_binary_ip_file(file);
+      ip.assign(ip_vec.begin(), ip_vec.end());
+    } catch (std::exception const& e) {
+      vw_out(WarningMessage) << "Could not read cached interest points: " << file << "\n";
+      return false;
+    }
+    vw_out() << "\t    Using cached interest points: " << file << "\n";
+    return true;
+  }
+
+  void write_cached_ip(std::string const& key, vw::ip::InterestPointList const& ip){
+    if (key.empty())
+      return;
+    std::string file = ip_cache_file(key, ".vwip");
+    std::string tmp_file = ip_cache_tmp_file(file);
+    std::vector<ip::InterestPoint> ip_vec(ip.begin(), ip.end());
+    ip::write_binary_ip_file(tmp_file, ip_vec);
+    boost::filesystem::rename(tmp_file, file);
+  }
+
+  bool read_cached_matches(std::string const& key1, std::string const& key2,
+                           std::vector<vw::ip::InterestPoint> & matched_ip1,
+                           std::vector<vw::ip::InterestPoint> & matched_ip2){
+    if (key1.empty() || key2.empty())
+      return false;
+    std::string file = ip_cache_file(match_cache_key(key1, key2), ".match");
+    if (!boost::filesystem::exists(file))
+      return false;
+    try {
+      ip::read_binary_match_file(file, matched_ip1, matched_ip2);
+    } catch (std::exception const& e) {
+      vw_out(WarningMessage) << "Could not read cached matches: " << file << "\n";
+      matched_ip1.clear();
+      matched_ip2.clear();
+      return false;
+    }
+    vw_out() << "\t    Using cached matches: " << file << "\n";
+    return true;
+  }
+
+  void write_cached_matches(std::string const& key1, std::string const& key2,
+                            std::vector<vw::ip::InterestPoint> const& matched_ip1,
+                            std::vector<vw::ip::InterestPoint> const& matched_ip2){
+    if (key1.empty() || key2.empty())
+      return;
+    std::string file = ip_cache_file(match_cache_key(key1, key2), ".match");
+    std::string tmp_file = ip_cache_tmp_file(file);
+    ip::write_binary_match_file(tmp_file, matched_ip1, matched_ip2);
+    boost::filesystem::rename(tmp_file, file);
+  }
+
 }
@@ -32,8 +32,10 @@
 #include <vw/Cartography/Datum.h>
 
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/Ransac.h>
 #include <boost/foreach.hpp>
 #include <boost/math/special_functions/fpclassify.hpp>
+#include <sstream>
 
 // TODO: This function should live somewhere else!  It was pulled from vw->tools->ipmatch.cc
 template <typename Image1T, typename Image2T>
@@ -207,11 +209,13 @@ namespace asp {
   /// Find a rough homography that maps right to left using the camera
   /// and datum information.
   /// - This intersects rays with the datum, then projects them into the other camera.
+  /// - The rays are found in parallel, unless the cameras are single-threaded.
   vw::Matrix<double>
   rough_homography_fit( vw::camera::CameraModel* cam1,
                         vw::camera::CameraModel* cam2,
                         vw::BBox2i const& box1, vw::BBox2i const& box2,
-                        vw::cartography::Datum const& datum );
+                        vw::cartography::Datum const& datum,
+                        bool single_threaded_camera );
 
   /// Homography rectification that aligns the right image to the left
   /// image via a homography transform. It returns a vector2i of the
@@ -227,10 +231,59 @@ namespace asp {
                             vw::Matrix<double>& left_matrix,
                             vw::Matrix<double>& right_matrix );
 
+  /// The seed for ip_cache_hash().
+  const vw::uint64 IP_CACHE_HASH_SEED = 14695981039346656037ULL;
+
+  /// Continue a 64-bit FNV-1a hash with the given bytes.
+  vw::uint64 ip_cache_hash(vw::uint64 hash, const void* data, size_t num_bytes);
+
+  /// A key identifying the interest points detected in an image file,
+  /// made of its path, size and modification time, of a description of
+  /// how its pixels were changed before detection, and of the detection
+  /// settings. Later runs, with any output prefix, can then reuse these
+  /// points from --ip-cache-dir. Return an empty string if that is not
+  /// set, or if the file cannot be found.
+  std::string ip_cache_key(std::string const& image_file, std::string const& preprocessing,
+                           int ip_per_tile, double nodata);
+
+  /// The key of the points detected in the image of the given key,
+  /// after it was changed further as described. Empty if the key is.
+  std::string ip_cache_key(std::string const& key, std::string const& preprocessing);
+
+  /// Read from --ip-cache-dir the interest points with the given key.
+  /// Return false if the key is empty or the points are not cached.
+  bool read_cached_ip(std::string const& key, vw::ip::InterestPointList & ip);
+
+  /// Save the interest points to --ip-cache-dir, if the key is not empty.
+  void write_cached_ip(std::string const& key, vw::ip::InterestPointList const& ip);
+
+  /// Read from --ip-cache-dir the matches between the interest points of
+  /// two images with the given keys, found with the current settings.
+  bool read_cached_matches(std::string const& key1, std::string const& key2,
+                           std::vector<vw::ip::InterestPoint> & matched_ip1,
+                           std::vector<vw::ip::InterestPoint> & matched_ip2);
+
+  /// Save to --ip-cache-dir the matches between two images, if the keys are not empty.
+  void write_cached_matches(std::string const& key1, std::string const& key2,
+                            std::vector<vw::ip::InterestPoint> const& matched_ip1,
+                            std::vector<vw::ip::InterestPoint> const& matched_ip2);
+
+  /// The number of interest points to detect per 1024^2 tile, if not set by the user.
+  inline size_t auto_ip_per_tile(vw::BBox2i const& box, int ip_per_tile) {
+    if (ip_per_tile != 0)
+      return ip_per_tile;
+    float  number_boxes    = (box.width() / 1024.f) * (box.height() / 1024.f);
+    size_t points_per_tile = 5000.f / number_boxes;
+    if ( points_per_tile > 5000 ) points_per_tile = 5000;
+    if ( points_per_tile < 50   ) points_per_tile = 50;
+    return points_per_tile;
+  }
+
   /// Detect InterestPoints
   ///
   /// This is not meant to be used directly. Please use ip_matching() or
-  /// the dumb homography_ip_matching().
+  /// the dumb homography_ip_matching(). The points of an image with a
+  /// nonempty key from ip_cache_key() are read from and saved to the cache.
   template <class Image1T, class Image2T>
   void detect_ip( vw::ip::InterestPointList& ip1, 
                   vw::ip::InterestPointList& ip2,  
@@ -238,7 +291,9 @@ namespace asp {
 		  vw::ImageViewBase<Image2T> const& image2,
 		  int ip_per_tile,
 		  double nodata1 = std::numeric_limits<double>::quiet_NaN(),
-		  double nodata2 = std::numeric_limits<double>::quiet_NaN() );
+		  double nodata2 = std::numeric_limits<double>::quiet_NaN(),
+		  std::string const& cache_key1 = "",
+		  std::string const& cache_key2 = "" );
 
   /// Detect and Match Interest Points
   ///
@@ -250,7 +305,9 @@ namespace asp {
 			vw::ImageViewBase<Image2T> const& image2,
 			int ip_per_tile,
 			double nodata1 = std::numeric_limits<double>::quiet_NaN(),
-			double nodata2 = std::numeric_limits<double>::quiet_NaN() );
+			double nodata2 = std::numeric_limits<double>::quiet_NaN(),
+			std::string const& cache_key1 = "",
+			std::string const& cache_key2 = "" );
 
   /// Homography IP matching
   ///
@@ -262,7 +319,9 @@ namespace asp {
 			       std::string const& output_name,
 			       int inlier_threshold=10,
 			       double nodata1 = std::numeric_limits<double>::quiet_NaN(),
-			       double nodata2 = std::numeric_limits<double>::quiet_NaN() );
+			       double nodata2 = std::numeric_limits<double>::quiet_NaN(),
+			       std::string const& cache_key1 = "",
+			       std::string const& cache_key2 = "" );
 
   /// IP matching that uses clustering on triangulation error to
   /// determine inliers.  Check output this filter can fail.
@@ -328,7 +387,9 @@ namespace asp {
 		    double nodata2 = std::numeric_limits<double>::quiet_NaN(),
 		    vw::TransformRef const& left_tx  = vw::TransformRef(vw::TranslateTransform(0,0)),
 		    vw::TransformRef const& right_tx = vw::TransformRef(vw::TranslateTransform(0,0)),
-		    bool transform_to_original_coord = true );
+		    bool transform_to_original_coord = true,
+		    std::string const& cache_key1 = "",
+		    std::string const& cache_key2 = "" );
 
   /// Calls ip matching above but with an additional step where we
   /// apply a homography to make right image like left image. This is
@@ -347,7 +408,9 @@ namespace asp {
 				double nodata1 = std::numeric_limits<double>::quiet_NaN(),
 				double nodata2 = std::numeric_limits<double>::quiet_NaN(),
 				vw::TransformRef const& left_tx  = vw::TransformRef(vw::TranslateTransform(0,0)),
-				vw::TransformRef const& right_tx = vw::TransformRef(vw::TranslateTransform(0,0)) );
+				vw::TransformRef const& right_tx = vw::TransformRef(vw::TranslateTransform(0,0)),
+				std::string const& cache_key1 = "",
+				std::string const& cache_key2 = "" );
 
 // ==============================================================================================
 // Function definitions
@@ -419,6 +482,153 @@ namespace asp {
   } // End function remove_ip_near_nodata
   
 
+  /// Build the descriptors for a subset of the interest points of an image.
+  template <class ImageT>
+  class DescribeIpTask: public vw::Task, private boost::noncopyable {
+    ImageT m_image;
+    boost::shared_ptr<vw::ip::InterestPointList> m_ip;
+  public:
+    DescribeIpTask(ImageT const& image, boost::shared_ptr<vw::ip::InterestPointList> ip):
+      m_image(image), m_ip(ip) {}
+    void operator()() {
+      vw::ip::SGradDescriptorGenerator descriptor;
+      describe_interest_points(m_image, descriptor, *m_ip);
+    }
+  };
+
+  /// Move the interest points to the given number of lists of about
+  /// the same size.
+  inline void split_ip_list(vw::ip::InterestPointList & ip, int num_chunks,
+                            std::vector< boost::shared_ptr<vw::ip::InterestPointList> > & chunks) {
+    size_t chunk_size = ip.size()/std::max(num_chunks, 1) + 1;
+    while (!ip.empty()) {
+      boost::shared_ptr<vw::ip::InterestPointList> chunk(new vw::ip::InterestPointList);
+      vw::ip::InterestPointList::iterator end = ip.begin();
+      std::advance(end, std::min(chunk_size, ip.size()));
+      chunk->splice(chunk->end(), ip, ip.begin(), end);
+      chunks.push_back(chunk);
+    }
+  }
+
+  /// Build the descriptors of the interest points of both images at
+  /// the same time, with the points split among the threads.
+  template <class Image1T, class Image2T>
+  void describe_ip_in_parallel(vw::ImageViewBase<Image1T> const& image1,
+                               vw::ImageViewBase<Image2T> const& image2,
+                               vw::ip::InterestPointList & ip1,
+                               vw::ip::InterestPointList & ip2) {
+
+    // Use more chunks than threads, as the points are not spread evenly
+    int num_threads = vw::vw_settings().default_num_threads();
+    std::vector< boost::shared_ptr<vw::ip::InterestPointList> > chunks1, chunks2;
+    split_ip_list(ip1, 4*num_threads, chunks1);
+    split_ip_list(ip2, 4*num_threads, chunks2);
+
+    vw::FifoWorkQueue queue(num_threads);
+    for (size_t i = 0; i < chunks1.size(); i++)
+      queue.add_task(boost::shared_ptr< DescribeIpTask<Image1T> >
+                     (new DescribeIpTask<Image1T>(image1.impl(), chunks1[i])));
+    for (size_t i = 0; i < chunks2.size(); i++)
+      queue.add_task(boost::shared_ptr< DescribeIpTask<Image2T> >
+                     (new DescribeIpTask<Image2T>(image2.impl(), chunks2[i])));
+    queue.join_all();
+
+    // Put the points back in their original order
+    for (size_t i = 0; i < chunks1.size(); i++)
+      ip1.splice(ip1.end(), *chunks1[i]);
+    for (size_t i = 0; i < chunks2.size(); i++)
+      ip2.splice(ip2.end(), *chunks2[i]);
+  }
+
+  /// Drop the interest points found twice at the seams between tiles.
+  /// A point is owned by the tile whose box contains it, but the same
+  /// feature can be located a fraction of a pixel differently by the two
+  /// tiles around a seam, and land in both. Of two points within
+  /// radius of each other from different tiles, the weaker is removed.
+  void remove_ip_duplicates_at_seams(std::vector<vw::BBox2i> const& boxes,
+                                     std::vector< boost::shared_ptr<vw::ip::InterestPointList> >
+                                     & tile_ip, double radius);
+
+  /// Detect the interest points in one tile of an image. The tile is
+  /// expanded by a margin before detection, so that the features near
+  /// its edges see all of their neighborhood, and only the points
+  /// within the tile itself are kept.
+  template <class ImageT, class DetectorT>
+  class DetectIpTileTask: public vw::Task, private boost::noncopyable {
+    ImageT    m_image;
+    DetectorT m_detector; // own copy, as some detectors adapt their thresholds
+    vw::BBox2i m_box;
+    int        m_margin;
+    size_t     m_points_per_tile;
+    boost::shared_ptr<vw::ip::InterestPointList> m_ip;
+  public:
+    DetectIpTileTask(ImageT const& image, DetectorT const& detector,
+                     vw::BBox2i const& box, int margin, size_t points_per_tile,
+                     boost::shared_ptr<vw::ip::InterestPointList> ip):
+      m_image(image), m_detector(detector), m_box(box), m_margin(margin),
+      m_points_per_tile(points_per_tile), m_ip(ip) {}
+    void operator()() {
+      vw::BBox2i expanded = m_box;
+      expanded.expand(m_margin);
+      expanded.crop(bounding_box(m_image));
+
+      // Only this much of the image is in memory at a time, per thread
+      vw::ImageView<typename ImageT::pixel_type> tile = vw::crop(m_image, expanded);
+      vw::ip::InterestPointList ip = m_detector(tile, m_points_per_tile);
+
+      for (vw::ip::InterestPointList::iterator it = ip.begin(); it != ip.end(); ++it) {
+        it->x  += expanded.min().x();
+        it->y  += expanded.min().y();
+        it->ix += expanded.min().x();
+        it->iy += expanded.min().y();
+        if (m_box.contains(vw::Vector2(it->x, it->y)))
+          m_ip->push_back(*it);
+      }
+    }
+  };
+
+  /// Detect the interest points of an image in 1024^2 tiles, in
+  /// parallel, with at most points_per_tile per tile. The scale space is
+  /// built per tile, over the tile and a margin around it, so memory use
+  /// does not grow with the image size.
+  template <class ImageT, class DetectorT>
+  vw::ip::InterestPointList detect_ip_in_tiles(vw::ImageViewBase<ImageT> const& image,
+                                               DetectorT const& detector,
+                                               size_t points_per_tile) {
+    const int    TILE_SIZE   = 1024; // the ip per tile are per 1024^2 pixels
+    const int    TILE_MARGIN = 64;
+    const double SEAM_RADIUS = 1.0;
+
+    std::vector<vw::BBox2i> boxes;
+    for (int row = 0; row < image.impl().rows(); row += TILE_SIZE) {
+      for (int col = 0; col < image.impl().cols(); col += TILE_SIZE) {
+        boxes.push_back(vw::BBox2i(col, row,
+                                   std::min(TILE_SIZE, image.impl().cols() - col),
+                                   std::min(TILE_SIZE, image.impl().rows() - row)));
+      }
+    }
+
+    std::vector< boost::shared_ptr<vw::ip::InterestPointList> > tile_ip(boxes.size());
+    vw::FifoWorkQueue queue(vw::vw_settings().default_num_threads());
+    for (size_t i = 0; i < boxes.size(); i++) {
+      tile_ip[i] = boost::shared_ptr<vw::ip::InterestPointList>(new vw::ip::InterestPointList);
+      queue.add_task(boost::shared_ptr< DetectIpTileTask<ImageT, DetectorT> >
+                     (new DetectIpTileTask<ImageT, DetectorT>
+                      (image.impl(), detector, boxes[i], TILE_MARGIN,
+                       points_per_tile, tile_ip[i])));
+    }
+    queue.join_all();
+
+    remove_ip_duplicates_at_seams(boxes, tile_ip, SEAM_RADIUS);
+
+    // Put the points together in tile order, so the result does not
+    // depend on the order the threads finished in
+    vw::ip::InterestPointList ip;
+    for (size_t i = 0; i < tile_ip.size(); i++)
+      ip.splice(ip.end(), *tile_ip[i]);
+    return ip;
+  }
+
   // Detect InterestPoints
   //
   /// This is not meant to be used directly. Please use ip_matching() or
@@ -430,7 +640,9 @@ namespace asp {
                   vw::ImageViewBase<Image2T> const& image2,
                   int    ip_per_tile,
                   double nodata1,
-                  double nodata2 ) {
+                  double nodata2,
+                  std::string const& cache_key1,
+                  std::string const& cache_key2 ) {
     using namespace vw;
     BBox2i box1 = bounding_box(image1.impl());
     ip1.clear();
@@ -439,25 +651,24 @@ namespace asp {
     Stopwatch sw;
     sw.start();
 
-    // Automatically determine how many ip we need
-    float  number_boxes    = (box1.width() / 1024.f) * (box1.height() / 1024.f);
-    size_t points_per_tile = 5000.f / number_boxes;
-    if ( points_per_tile > 5000 ) points_per_tile = 5000;
-    if ( points_per_tile < 50   ) points_per_tile = 50;
-
-    // See if to override with manual value
-    if (ip_per_tile != 0)
-      points_per_tile = ip_per_tile;
+    // Automatically determine how many ip we need, unless set manually
+    size_t points_per_tile = auto_ip_per_tile(box1, ip_per_tile);
 
     vw_out() << "Using " << points_per_tile << " interest points per tile (1024^2 px).\n";
 
+    // Reuse the points detected in an earlier run, if any
+    bool cached1 = read_cached_ip(cache_key1, ip1);
+    bool cached2 = read_cached_ip(cache_key2, ip2);
+
     // Load the detection method from stereo_settings.
     // - This relies on a direct match in the enum integer value.
     DetectIpMethod detect_method = static_cast<DetectIpMethod>(stereo_settings().ip_matching_method);
 
     // Detect Interest Points
     // - Due to templated types we need to duplicate a bunch of code here
-    if (detect_method == DETECT_IP_METHOD_INTEGRAL) {
+    if (cached1 && cached2) {
+      // Nothing to detect
+    } else if (detect_method == DETECT_IP_METHOD_INTEGRAL) {
       // Zack's custom detector
       int num_scales = stereo_settings().num_scales;
       if (num_scales <= 0) 
@@ -471,16 +682,20 @@ namespace asp {
       // This detector can't handle a mask so if there is nodata just
       //  set those pixels to zero.
       
-      vw_out() << "\t    Processing left image" << std::endl;
-      if ( boost::math::isnan(nodata1) )
-        ip1 = detect_interest_points( image1.impl(), detector, points_per_tile );
-      else
-        ip1 = detect_interest_points( apply_mask(create_mask_less_or_equal(image1.impl(),nodata1)), detector, points_per_tile );
-      vw_out() << "\t    Processing right image" << std::endl;
-      if ( boost::math::isnan(nodata2) )
-        ip2 = detect_interest_points( image2.impl(), detector, points_per_tile );
-      else
-        ip2 = detect_interest_points( apply_mask(create_mask_less_or_equal(image2.impl(),nodata2)), detector, points_per_tile );
+      if (!cached1) {
+        vw_out() << "\t    Processing left image" << std::endl;
+        if ( boost::math::isnan(nodata1) )
+          ip1 = detect_ip_in_tiles( image1.impl(), detector, points_per_tile );
+        else
+          ip1 = detect_ip_in_tiles( apply_mask(create_mask_less_or_equal(image1.impl(),nodata1)), detector, points_per_tile );
+      }
+      if (!cached2) {
+        vw_out() << "\t    Processing right image" << std::endl;
+        if ( boost::math::isnan(nodata2) )
+          ip2 = detect_ip_in_tiles( image2.impl(), detector, points_per_tile );
+        else
+          ip2 = detect_ip_in_tiles( apply_mask(create_mask_less_or_equal(image2.impl(),nodata2)), detector, points_per_tile );
+      }
     } else {
 
       // Initialize the OpenCV detector.  Conveniently we can just pass in the type argument.
@@ -504,16 +719,20 @@ namespace asp {
 
       // These detectors do accept a mask so use one if applicable.
 
-      vw_out() << "\t    Processing left image" << std::endl;
-      if ( boost::math::isnan(nodata1) )
-        ip1 = detect_interest_points( image1.impl(), detector, points_per_tile );
-      else
-        ip1 = detect_interest_points( create_mask_less_or_equal(image1.impl(),nodata1), detector, points_per_tile );
-      vw_out() << "\t    Processing right image" << std::endl;
-      if ( boost::math::isnan(nodata2) )
-        ip2 = detect_interest_points( image2.impl(), detector, points_per_tile );
-      else
-        ip2 = detect_interest_points( create_mask_less_or_equal(image2.impl(),nodata2), detector, points_per_tile );
+      if (!cached1) {
+        vw_out() << "\t    Processing left image" << std::endl;
+        if ( boost::math::isnan(nodata1) )
+          ip1 = detect_ip_in_tiles( image1.impl(), detector, points_per_tile );
+        else
+          ip1 = detect_ip_in_tiles( create_mask_less_or_equal(image1.impl(),nodata1), detector, points_per_tile );
+      }
+      if (!cached2) {
+        vw_out() << "\t    Processing right image" << std::endl;
+        if ( boost::math::isnan(nodata2) )
+          ip2 = detect_ip_in_tiles( image2.impl(), detector, points_per_tile );
+        else
+          ip2 = detect_ip_in_tiles( create_mask_less_or_equal(image2.impl(),nodata2), detector, points_per_tile );
+      }
     } // End OpenCV case
 
     sw.stop();
@@ -528,18 +747,38 @@ namespace asp {
 
     sw.start();
 
+    // The points read from the cache are already processed up to the
+    // edge filtering below, which depends on the pairing of the images.
     vw_out() << "\t    Removing IP near nodata" << std::endl;
     const int NODATA_RADIUS = 4;
-    if ( !boost::math::isnan(nodata1) )
+    if ( !boost::math::isnan(nodata1) && !cached1 )
       remove_ip_near_nodata( image1.impl(), nodata1, ip1, NODATA_RADIUS );
 
-    if ( !boost::math::isnan(nodata2) )
+    if ( !boost::math::isnan(nodata2) && !cached2 )
       remove_ip_near_nodata( image2.impl(), nodata2, ip2, NODATA_RADIUS );
 
     sw.stop();
     vw_out(DebugMessage,"asp") << "Remove IP elapsed time: "
 			       << sw.elapsed_seconds() << " s." << std::endl;
 
+    sw.start();
+
+    // For the two OpenCV options we already built the descriptors, so only do this for the integral method.
+    if (detect_method == DETECT_IP_METHOD_INTEGRAL && !(cached1 && cached2)) {
+      vw_out() << "\t    Building descriptors" << std::endl;
+      // Replacing the nodata values with zero has no effect when there are none
+      ip::InterestPointList empty_list;
+      describe_ip_in_parallel(apply_mask(create_mask_less_or_equal(image1.impl(),nodata1)),
+                              apply_mask(create_mask_less_or_equal(image2.impl(),nodata2)),
+                              cached1 ? empty_list : ip1, cached2 ? empty_list : ip2);
+
+      vw_out(DebugMessage,"asp") << "Building descriptors elapsed time: "
+                                 << sw.elapsed_seconds() << " s." << std::endl;
+    }
+
+    if (!cached1) write_cached_ip(cache_key1, ip1);
+    if (!cached2) write_cached_ip(cache_key2, ip2);
+
     // Filter out IP from the opposite sides of the two images.
     // - Would be better to just pass an ROI into the IP detector!
     if (stereo_settings().ip_edge_buffer_percent > 0) {
@@ -557,25 +796,6 @@ namespace asp {
                << num_removed_right << " points from the right side of the right image.\n";
     } // End side IP filtering
 
-    sw.start();
-
-    // For the two OpenCV options we already built the descriptors, so only do this for the integral method.
-    if (detect_method == DETECT_IP_METHOD_INTEGRAL) {
-      vw_out() << "\t    Building descriptors" << std::endl;
-      ip::SGradDescriptorGenerator descriptor;
-      if ( boost::math::isnan(nodata1) )
-        describe_interest_points( image1.impl(), descriptor, ip1 );
-      else
-        describe_interest_points( apply_mask(create_mask_less_or_equal(image1.impl(),nodata1)), descriptor, ip1 );
-      if ( boost::math::isnan(nodata2) )
-        describe_interest_points( image2.impl(), descriptor, ip2 );
-      else
-        describe_interest_points( apply_mask(create_mask_less_or_equal(image2.impl(),nodata2)), descriptor, ip2 );
-
-      vw_out(DebugMessage,"asp") << "Building descriptors elapsed time: "
-                                 << sw.elapsed_seconds() << " s." << std::endl;
-    }
-
     vw_out() << "\t    Found interest points:\n" << "\t      left: " << ip1.size() << std::endl;
     vw_out() << "\t     right: " << ip2.size() << std::endl;
   }
@@ -590,13 +810,21 @@ namespace asp {
                         vw::ImageViewBase<Image2T> const& image2,
                         int    ip_per_tile,
                         double nodata1,
-                        double nodata2) {
+                        double nodata2,
+                        std::string const& cache_key1,
+                        std::string const& cache_key2 ) {
     using namespace vw;
 
+    // Reuse the matches found in an earlier run, if any
+    if (read_cached_matches(cache_key1, cache_key2, matched_ip1, matched_ip2)) {
+      vw_out() << "\n\t    Matched points: " << matched_ip1.size() << std::endl;
+      return;
+    }
+
     // Detect Interest Points
     ip::InterestPointList ip1, ip2;
     detect_ip( ip1, ip2, image1.impl(), image2.impl(),
-               ip_per_tile, nodata1, nodata2 );
+               ip_per_tile, nodata1, nodata2, cache_key1, cache_key2 );
 
     // Match the interset points using the default matcher
     vw_out() << "\t--> Matching interest points\n";
@@ -628,6 +856,7 @@ namespace asp {
     }
 
     ip::remove_duplicates( matched_ip1, matched_ip2 );
+    write_cached_matches(cache_key1, cache_key2, matched_ip1, matched_ip2);
 
     if (stereo_settings().ip_debug_images) {
       vw_out() << "\t    Writing IP initial match debug image.\n";
@@ -648,7 +877,9 @@ namespace asp {
                                std::string const& output_name,
                                int    inlier_threshold,
                                double nodata1,
-                               double nodata2 ) {
+                               double nodata2,
+                               std::string const& cache_key1,
+                               std::string const& cache_key2 ) {
 
     using namespace vw;
 
@@ -656,14 +887,14 @@ namespace asp {
     detect_match_ip( matched_ip1, matched_ip2,
                      image1.impl(), image2.impl(),
                      ip_per_tile,
-                     nodata1, nodata2 );
+                     nodata1, nodata2, cache_key1, cache_key2 );
     if ( matched_ip1.size() == 0 || matched_ip2.size() == 0 )
       return false;
     std::vector<Vector3> ransac_ip1 = iplist_to_vectorlist(matched_ip1),
                          ransac_ip2 = iplist_to_vectorlist(matched_ip2);
     std::vector<size_t> indices;
     try {
-      typedef math::RandomSampleConsensus<math::HomographyFittingFunctor, math::InterestPointErrorMetric> RansacT;
+      typedef ParallelRandomSampleConsensus<math::HomographyFittingFunctor, math::InterestPointErrorMetric> RansacT;
       const int    MIN_NUM_OUTPUT_INLIERS = ransac_ip1.size()/2;
       const int    NUM_ITERATIONS         = 100;
       RansacT ransac( math::HomographyFittingFunctor(),
@@ -717,14 +948,16 @@ namespace asp {
                     double nodata2,
                     vw::TransformRef const& left_tx,
                     vw::TransformRef const& right_tx,
-                    bool transform_to_original_coord) {
+                    bool transform_to_original_coord,
+                    std::string const& cache_key1,
+                    std::string const& cache_key2 ) {
     using namespace vw;
 
     // Detect interest points
     ip::InterestPointList ip1, ip2;
     detect_ip( ip1, ip2, image1.impl(), image2.impl(),
                ip_per_tile,
-               nodata1, nodata2 );
+               nodata1, nodata2, cache_key1, cache_key2 );
     if ( ip1.size() == 0 || ip2.size() == 0 ){
       vw_out() << "Unable to detect interest points." << std::endl;
       return false;
@@ -769,13 +1002,13 @@ namespace asp {
     matched_ip1.reserve( valid_count ); // Get our allocations out of the way.
     matched_ip2.reserve( valid_count );
     {
-      ip::InterestPointList::const_iterator ip1_it = ip1.begin(), ip2_it = ip2.begin();
+      // Random access to ip2, as walking the list for each match is quadratic
+      std::vector<ip::InterestPoint> ip2_vec( ip2.begin(), ip2.end() );
+      ip::InterestPointList::const_iterator ip1_it = ip1.begin();
       for ( size_t i = 0; i < forward_match.size(); i++ ) {
         if ( forward_match[i] != NULL_INDEX ) {
           matched_ip1.push_back( *ip1_it );
-          ip2_it = ip2.begin();
-          std::advance( ip2_it, forward_match[i] );
-          matched_ip2.push_back( *ip2_it );
+          matched_ip2.push_back( ip2_vec[forward_match[i]] );
         }
         ip1_it++;
       }
@@ -886,7 +1119,9 @@ namespace asp {
 				double nodata1,
 				double nodata2,
 				vw::TransformRef const& left_tx,
-				vw::TransformRef const& right_tx ) {
+				vw::TransformRef const& right_tx,
+				std::string const& cache_key1,
+				std::string const& cache_key2 ) {
 
     using namespace vw;
 
@@ -898,7 +1133,8 @@ namespace asp {
     try {
       // Homography is defined in the original camera coordinates
       rough_homography =  rough_homography_fit( cam1, cam2, left_tx.reverse_bbox(box1),
-                                                right_tx.reverse_bbox(box2), datum );
+                                                right_tx.reverse_bbox(box2), datum,
+                                                single_threaded_camera );
     } catch(...) {
       VW_OUT( DebugMessage, "asp" ) << "Rough homography fit failed, trying with identity transform. " << std::endl;
       rough_homography.set_identity(3);
@@ -923,6 +1159,13 @@ namespace asp {
 			                right_tx, HomographyTransform(rough_homography)));
     raster_box -= Vector2i(raster_box.min());
 
+    // The right image is warped before detection, so its cached points
+    // are also keyed on the warp.
+    std::ostringstream warp;
+    warp.precision(17);
+    warp << "align " << rough_homography << " " << right_tx.reverse_bbox(box2) << " "
+         << tx.forward_bbox(right_tx.reverse_bbox(box2));
+    std::string aligned_key2 = ip_cache_key(cache_key2, warp.str());
 
     // With a transform applied to the input images, try to match interest points between them.
     // - It is important that we use NearestPixelInterpolation in the
@@ -936,7 +1179,7 @@ namespace asp {
 				  NearestPixelInterpolation()), raster_box),
 		   ip_per_tile,
 		   datum, output_name, epipolar_threshold, uniqueness_threshold,
-		   nodata1, nodata2, left_tx, tx );
+		   nodata1, nodata2, left_tx, tx, true, cache_key1, aligned_key2 );
     if (!inlier)
       return inlier;
 
@@ -28,6 +28,11 @@
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/InterestPointMatching.h>
 
+#include <boost/filesystem/operations.hpp>
+#include <cstdlib>
+
+namespace fs = boost::filesystem;
+
 using namespace vw;
 
 namespace asp {
@@ -107,6 +112,8 @@ namespace asp {
       Matrix<double> left_matrix, right_matrix;
       BBox2i image_size = bounding_box(disparity);
       bool adjust_left_image_size = true;
+      // The RANSAC in homography_rectification() has its own seeded
+      // generator, so the fits can run in parallel and are reproducible.
       homography_rectification( adjust_left_image_size,
                                 image_size.size(), image_size.size(),
                                 left_ip, right_ip, left_matrix, right_matrix );
@@ -121,41 +128,65 @@ namespace asp {
     return vw::math::identity_matrix<3>();
   }
 
-  // Task that computes local homography in a given tile
+  // Task that computes the local homography of a correlation tile
   class LocalHomTask: public vw::Task, private boost::noncopyable {
 
     int m_col, m_row;
-    BBox2i m_sub_bbox;
-    // We on purpose store a local deep copy of sub_disparity_crop to
-    // avoid segfault.
-    ImageView < PixelMask<Vector2i> > m_sub_disparity_crop;
+    BBox2i m_bbox; // the tile in the full-res image
+    Vector2 m_upscale_factor;
+    ImageView<PixelMask<Vector2f> > const& m_sub_disp;
     ImageView<Matrix3x3> & m_local_hom;
   public:
-    LocalHomTask(int col, int row,
-                 BBox2i sub_bbox,
-                 ImageViewRef < PixelMask<Vector2i> > const& sub_disparity_crop,
+    LocalHomTask(int col, int row, BBox2i const& bbox, Vector2 const& upscale_factor,
+                 ImageView<PixelMask<Vector2f> > const& sub_disp,
                  ImageView<Matrix3x3> & local_hom):
-      m_col(col), m_row(row), m_sub_bbox(sub_bbox),
-      m_sub_disparity_crop(sub_disparity_crop),
-      m_local_hom(local_hom){}
+      m_col(col), m_row(row), m_bbox(bbox), m_upscale_factor(upscale_factor),
+      m_sub_disp(sub_disp), m_local_hom(local_hom){}
 
     void operator()() {
-      bool success;
-      // To do: If this function is ever used, the variable 'success'
-      // needs to be treated properly.
-      exit(1); // broken, for now
-      m_local_hom(m_col, m_row)
-        = homography_for_disparity(m_sub_bbox, m_sub_disparity_crop, success);
+
+      // The low-res version of bbox
+      BBox2i sub_bbox( elem_quot(m_bbox.min(), m_upscale_factor),
+                       elem_quot(m_bbox.max(), m_upscale_factor) );
+
+      // Expand the box until square to make sure the local
+      // homography calculation does not fail. If that does not
+      // help, keep on expanding the box.
+      bool success = false;
+      int len = std::max(sub_bbox.width(), sub_bbox.height());
+      sub_bbox = BBox2i(sub_bbox.max() - Vector2(len, len), sub_bbox.max());
+      sub_bbox.expand(1);
+      Matrix3x3 hom;
+      while(1){
+        sub_bbox.crop( bounding_box(m_sub_disp) );
+        hom = homography_for_disparity(sub_bbox, crop(m_sub_disp, sub_bbox), success);
+        if (success) break;
+        vw_out() << "\t--> Failed to find local disparity in box: " << m_bbox  << std::endl;
+        vw_out() << "\t--> Trying again by increasing the local region."  << std::endl;
+        if (sub_bbox == bounding_box(m_sub_disp)) break; // can't expand more
+        len = std::max(sub_bbox.width(), sub_bbox.height());
+        sub_bbox.expand(len);
+      }
+
+      // Each task writes its own entry, so no locking is needed
+      m_local_hom(m_col, m_row) = hom;
     }
   };
 
-  
+  // A tile whose homography was not computed is marked with a zero
+  // matrix, which is never a valid homography.
+  namespace {
+    bool is_computed(Matrix3x3 const& hom) {
+      return hom != Matrix3x3();
+    }
+  }
+
   void create_local_homographies(ASPGlobalOptions const& opt){
 
+    std::string sub_disp_file  = opt.out_prefix + "-D_sub.tif";
+    std::string local_hom_file = opt.out_prefix + "-local_hom.txt";
     DiskImageView< PixelGray<float> > left_sub (opt.out_prefix + "-L_sub.tif");
     DiskImageView< PixelGray<float> > left_img (opt.out_prefix + "-L.tif");
-    DiskImageView< PixelMask<Vector2f> >
-      sub_disparity(opt.out_prefix + "-D_sub.tif");
 
     Vector2 upscale_factor( double(left_img.cols()) / double(left_sub.cols()),
                             double(left_img.rows()) / double(left_sub.rows()) );
@@ -163,64 +194,62 @@ namespace asp {
     int ts   = ASPGlobalOptions::corr_tile_size();
     int cols = (int)ceil(left_img.cols()/double(ts));
     int rows = (int)ceil(left_img.rows()/double(ts));
-    ImageView<Matrix3x3> local_hom(cols, rows);
 
-    // Calculate the local homographies using multiple threads.
-    // To do: Each thread calls RANSAC, which calls rand(), which
-    // is not thread safe. So for now use just one thread.
+    // Start from the homographies computed before, unless D_sub
+    // changed since then.
+    ImageView<Matrix3x3> local_hom;
+    bool have_previous = false;
+    if ( fs::exists(local_hom_file) &&
+         fs::last_write_time(local_hom_file) >= fs::last_write_time(sub_disp_file) ) {
+      try {
+        read_local_homographies(local_hom_file, local_hom);
+        have_previous = (local_hom.cols() == cols && local_hom.rows() == rows);
+      } catch (...) {}
+    }
+    if (!have_previous) {
+      local_hom.set_size(cols, rows);
+      for (int col = 0; col < cols; col++)
+        for (int row = 0; row < rows; row++)
+          local_hom(col, row) = Matrix3x3();
+    }
+
+    // Only the tiles this run will correlate are computed. D_sub is
+    // low-res, so it is read in memory once and shared by all threads.
+    BBox2i crop_win = stereo_settings().trans_crop_win;
+    crop_win.crop(bounding_box(left_img));
+    ImageView< PixelMask<Vector2f> > sub_disp
+      = DiskImageView< PixelMask<Vector2f> >(sub_disp_file);
 
     Stopwatch sw;
     sw.start();
 
-    //FifoWorkQueue queue( vw_settings().default_num_threads() );
+    int num_computed = 0;
+    FifoWorkQueue queue( vw_settings().default_num_threads() );
     for (int col = 0; col < cols; col++){
       for (int row = 0; row < rows; row++){
 
         BBox2i bbox(col*ts, row*ts, ts, ts);
         bbox.crop(bounding_box(left_img));
+        if ( is_computed(local_hom(col, row)) || !bbox.intersects(crop_win) )
+          continue;
 
-        // The low-res version of bbox
-        BBox2i sub_bbox( elem_quot(bbox.min(), upscale_factor),
-                          elem_quot(bbox.max(), upscale_factor) );
-
-        // Expand the box until square to make sure the local
-        // homography calculation does not fail. If that does not
-        // help, keep on expanding the box.
-        bool success = false;
-        int len = std::max(sub_bbox.width(), sub_bbox.height());
-        sub_bbox = BBox2i(sub_bbox.max() - Vector2(len, len), sub_bbox.max());
-        sub_bbox.expand(1);
-        while(1){
-
-          // This code enables multi-threading. It gives different answers each time,
-          // as multiple threads pull random numbers from the same stream.
-          // This code must be kept disabled until Boost's random function is used
-          // with one random stream for each thread.
-          //boost::shared_ptr<LocalHomTask>
-          //task(new LocalHomTask(col, row, sub_bbox, crop(sub_disparity, sub_bbox),
-          //                        local_hom));
-          //queue.add_task(task);
-
-          sub_bbox.crop( bounding_box(sub_disparity) );
-          local_hom(col, row)
-            = homography_for_disparity(sub_bbox, crop(sub_disparity, sub_bbox), success);
-          if (success) break;
-          vw_out() << "\t--> Failed to find local disparity in box: " << bbox  << std::endl;
-          vw_out() << "\t--> Trying again by increasing the local region."  << std::endl;
-          if (sub_bbox == bounding_box(sub_disparity)) break; // can't expand more
-          len = std::max(sub_bbox.width(), sub_bbox.height());
-          sub_bbox.expand(len);
-        }
-
+        boost::shared_ptr<LocalHomTask>
+          task(new LocalHomTask(col, row, bbox, upscale_factor, sub_disp, local_hom));
+        queue.add_task(task);
+        num_computed++;
       }
     }
-    //queue.join_all();
+    queue.join_all();
 
     sw.stop();
     vw_out(DebugMessage,"asp") << "Local homographies elapsed time: "
                                << sw.elapsed_seconds() << " s." << std::endl;
 
-    std::string local_hom_file = opt.out_prefix + "-local_hom.txt";
+    if (num_computed == 0) {
+      vw_out() << "\t--> Using cached local homographies: " << local_hom_file << "\n";
+      return;
+    }
+
     vw_out() << "Writing: " << local_hom_file << "\n";
     write_local_homographies(local_hom_file, local_hom);
 
@@ -280,4 +309,58 @@ namespace asp {
     return;
   }
 
+  void warp_by_homography(ImageViewRef< PixelGray<float> > const& right,
+                          ImageViewRef<uint8> const& right_mask,
+                          Matrix3x3 const& H, BBox2i const& out_box,
+                          ImageView< PixelGray<float> > & out){
+
+    out.set_size(out_box.width(), out_box.height());
+    fill(out, PixelGray<float>(0));
+    if (out_box.empty())
+      return;
+
+    // The part of the right image seen by the output box. The
+    // corners bound it as long as the box does not straddle the line
+    // which the homography sends to infinity, which is not the case
+    // for the small distortions seen in stereo.
+    HomographyTransform T(H);
+    BBox2 src_box;
+    src_box.grow(T.reverse(Vector2(out_box.min().x(), out_box.min().y())));
+    src_box.grow(T.reverse(Vector2(out_box.max().x(), out_box.min().y())));
+    src_box.grow(T.reverse(Vector2(out_box.min().x(), out_box.max().y())));
+    src_box.grow(T.reverse(Vector2(out_box.max().x(), out_box.max().y())));
+    BBox2i in_box(floor(src_box.min().x()) - 2, floor(src_box.min().y()) - 2,
+                  0, 0);
+    in_box.max() = Vector2i(ceil(src_box.max().x()) + 2, ceil(src_box.max().y()) + 2);
+    in_box.crop(bounding_box(right));
+    if (in_box.empty())
+      return;
+
+    ImageView< PixelGray<float> > src  = crop(right,      in_box);
+    ImageView<uint8>              mask = crop(right_mask, in_box);
+
+    // Same arithmetic as HomographyTransform::reverse(), done in place
+    Matrix3x3 Hinv = inverse(H);
+    int ncols = src.cols(), nrows = src.rows();
+    for (int row = 0; row < out.rows(); row++){
+      double y = row + out_box.min().y();
+      for (int col = 0; col < out.cols(); col++){
+        double x = col + out_box.min().x();
+        double w  = Hinv(2,0)*x + Hinv(2,1)*y + Hinv(2,2);
+        double sx = (Hinv(0,0)*x + Hinv(0,1)*y + Hinv(0,2))/w - in_box.min().x();
+        double sy = (Hinv(1,0)*x + Hinv(1,1)*y + Hinv(1,2))/w - in_box.min().y();
+        int x0 = int(floor(sx)), y0 = int(floor(sy));
+        if (x0 < 0 || y0 < 0 || x0 + 1 >= ncols || y0 + 1 >= nrows)
+          continue;
+        if (mask(x0, y0) == 0 || mask(x0 + 1, y0) == 0 ||
+            mask(x0, y0 + 1) == 0 || mask(x0 + 1, y0 + 1) == 0)
+          continue;
+        double ax = sx - x0, ay = sy - y0;
+        out(col, row) = PixelGray<float>
+          ((src(x0, y0    )[0]*(1 - ax) + src(x0 + 1, y0    )[0]*ax)*(1 - ay) +
+           (src(x0, y0 + 1)[0]*(1 - ax) + src(x0 + 1, y0 + 1)[0]*ax)*ay);
+      }
+    }
+  }
+
 } // namespace asp
@@ -23,6 +23,10 @@
 #define __LOCAL_DISPARITY_H__
 
 #include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelTypes.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Matrix.h>
 #include <vector>
 
 // Forward declaration
@@ -37,7 +41,10 @@ namespace asp {
   /// we will have the split {0, 1, 2}, {3, 4, 5}, {6, 7}.
   void split_n_into_k(int n, int k, std::vector<int> & partition);
 
-  /// Create a local homography for each correlation tile
+  /// Create a local homography for each correlation tile which
+  /// intersects trans_crop_win. Tiles already in the local homography
+  /// file are kept, unless D_sub is newer than that file. The tiles are
+  /// computed in parallel, and the other tiles are left as zero matrices.
   void create_local_homographies(ASPGlobalOptions const& opt);
 
   void write_local_homographies(std::string const& local_hom_file,
@@ -45,6 +52,19 @@ namespace asp {
   void read_local_homographies(std::string const& local_hom_file,
                                vw::ImageView<vw::Matrix3x3> & local_hom);
 
+  /// Warp the right image by the homography H, with bilinear
+  /// interpolation, over the box out_box of the output only. The result
+  /// equals the same box of
+  ///   apply_mask(transform(copy_mask(right, create_mask(right_mask)),
+  ///                      HomographyTransform(H)))
+  /// but the part of the right image which is needed is read once,
+  /// rather than through a chain of views for each pixel. Pixels whose
+  /// interpolation touches an invalid or outside pixel are zero.
+  void warp_by_homography(vw::ImageViewRef< vw::PixelGray<float> > const& right,
+                          vw::ImageViewRef<vw::uint8> const& right_mask,
+                          vw::Matrix3x3 const& H, vw::BBox2i const& out_box,
+                          vw::ImageView< vw::PixelGray<float> > & out);
+
 
 } // namespace asp
 
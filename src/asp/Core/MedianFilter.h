@@ -32,6 +32,10 @@
 #include <vw/Image/EdgeExtension.h>
 #include <vw/Image/PerPixelAccessorViews.h>
 
+#include <algorithm>
+#include <limits>
+#include <vector>
+
 namespace vw {
 
   uint8 find_median_in_histogram(Vector<int, CALC_PIXEL_NUM_VALS> histogram,
@@ -102,6 +106,140 @@ namespace vw {
     return pixel_cast_rescale<PixelT>(result);
   }
 
+  namespace detail {
+
+    // Add or remove the valid values of a column of the window to the
+    // histograms of their keys.
+    inline void update_key_histogram(ImageView<int> const& keys, int col, int row0, int row1,
+                                     int delta, int num_fine, std::vector<int> & fine,
+                                     std::vector<int> & coarse, int & count) {
+      for (int row = row0; row <= row1; row++) {
+        int key = keys(col, row);
+        if (key < 0)
+          continue;
+        fine[key]            += delta;
+        coarse[key/num_fine] += delta;
+        count                += delta;
+      }
+    }
+
+    // The value of given rank among the valid values of the window.
+    // The histograms give the key of that value, then it is found
+    // exactly among the values in the window with that key.
+    template <class T>
+    T select_in_window(ImageView<T> const& img, ImageView<int> const& keys,
+                       BBox2i const& window, int rank, int num_fine,
+                       std::vector<int> const& fine, std::vector<int> const& coarse,
+                       std::vector<T> & in_bin) {
+      int below = 0, block = 0;
+      while (below + coarse[block] <= rank)
+        below += coarse[block++];
+      int key = block*num_fine;
+      while (below + fine[key] <= rank)
+        below += fine[key++];
+
+      in_bin.clear();
+      for (int row = window.min().y(); row < window.max().y(); row++)
+        for (int col = window.min().x(); col < window.max().x(); col++)
+          if (keys(col, row) == key)
+            in_bin.push_back(img(col, row));
+
+      typename std::vector<T>::iterator it = in_bin.begin() + (rank - below);
+      std::nth_element(in_bin.begin(), it, in_bin.end());
+      return *it;
+    }
+  }
+
+  /// The median of the valid values in the (2*half+1) x (2*half+1)
+  /// window around each pixel of a float image, with the window
+  /// cropped at the image boundary. NaN values are invalid, and the
+  /// output is NaN at those pixels. As with math::destructive_median,
+  /// for an even number of values this is the mean of the middle two.
+  ///
+  /// The values are quantized to ordered keys, whose histogram over
+  /// the window is updated one column at a time and gives the key of
+  /// the median. Only the values with that key are then compared to
+  /// find the median exactly, so no values are copied or sorted per
+  /// pixel. Larger images can be processed in tiles, in parallel.
+  template <class T>
+  void float_median_filter(ImageView<T> const& img, int half, ImageView<T> & out) {
+
+    const int NUM_FINE = 64, NUM_KEYS = NUM_FINE*NUM_FINE;
+    int nc = img.cols(), nr = img.rows();
+    out.set_size(nc, nr);
+
+    // The range of the valid values
+    bool has_valid = false;
+    T lo = 0, hi = 0;
+    for (int row = 0; row < nr; row++) {
+      for (int col = 0; col < nc; col++) {
+        T val = img(col, row);
+        if (val != val) // NaN
+          continue;
+        if (!has_valid) {
+          lo = hi = val;
+          has_valid = true;
+        }
+        lo = std::min(lo, val);
+        hi = std::max(hi, val);
+      }
+    }
+
+    // The keys are increasing with the values, and -1 for invalid values
+    double scale = (hi > lo) ? (NUM_KEYS - 1) / (double(hi) - double(lo)) : 0.0;
+    ImageView<int> keys(nc, nr);
+    for (int row = 0; row < nr; row++) {
+      for (int col = 0; col < nc; col++) {
+        T val = img(col, row);
+        out(col, row) = std::numeric_limits<T>::quiet_NaN();
+        if (val != val)
+          keys(col, row) = -1;
+        else
+          keys(col, row) = std::min(int((double(val) - double(lo)) * scale), NUM_KEYS - 1);
+      }
+    }
+    if (!has_valid || half < 0)
+      return;
+
+    std::vector<int> fine(NUM_KEYS), coarse(NUM_FINE);
+    std::vector<T> in_bin;
+    for (int row = 0; row < nr; row++) {
+
+      int row0 = std::max(row - half, 0), row1 = std::min(row + half, nr - 1);
+      std::fill(fine.begin(),   fine.end(),   0);
+      std::fill(coarse.begin(), coarse.end(), 0);
+      int count = 0;
+      for (int col = 0; col < std::min(half, nc); col++)
+        detail::update_key_histogram(keys, col, row0, row1, 1, NUM_FINE, fine, coarse, count);
+
+      for (int col = 0; col < nc; col++) {
+
+        // Slide the window to be centered at this column
+        if (col + half < nc)
+          detail::update_key_histogram(keys, col + half, row0, row1, 1,
+                                       NUM_FINE, fine, coarse, count);
+        if (col - half - 1 >= 0)
+          detail::update_key_histogram(keys, col - half - 1, row0, row1, -1,
+                                       NUM_FINE, fine, coarse, count);
+
+        if (keys(col, row) < 0)
+          continue; // the window has at least this value when we go on
+
+        BBox2i window(Vector2i(std::max(col - half, 0), row0),
+                      Vector2i(std::min(col + half, nc - 1) + 1, row1 + 1));
+        T val1 = detail::select_in_window(img, keys, window, (count - 1)/2, NUM_FINE,
+                                          fine, coarse, in_bin);
+        if (count % 2 == 1) {
+          out(col, row) = val1;
+        } else {
+          T val2 = detail::select_in_window(img, keys, window, count/2, NUM_FINE,
+                                            fine, coarse, in_bin);
+          out(col, row) = (val1 + val2) / 2.0;
+        }
+      }
+    }
+  }
+
   template<class PixelT>
   class MedianFilterFunctor:public ReturnFixedType<PixelT>
   {
@@ -35,9 +35,13 @@
 #include <vw/Image/InpaintView.h>
 
 #include <asp/Core/SoftwareRenderer.h>
+#include <asp/Core/MedianFilter.h>
 #include <boost/foreach.hpp>
 #include <boost/math/special_functions/next.hpp>
+#include <boost/shared_ptr.hpp>
 #include <asp/Core/OrthoRasterizer.h>
+#include <asp/Core/Trace.h>
+#include <asp/Core/PointCloudStats.h>
 #include <valarray>
 
 namespace asp{
@@ -85,8 +89,7 @@ namespace asp{
     BBox3& m_global_bbox;
     std::vector<BBoxPair>& m_point_image_boundaries;
     ImageViewRef<double> const& m_error_image;
-    double m_estim_max_error; // used for outlier removal based on percentage
-    std::vector<double> & m_errors_hist;
+    std::vector<double> & m_errors_hist; // used for outlier removal based on percentage
     double m_max_valid_triangulation_error; // used for outlier removal based on thresh
     Mutex& m_mutex;
     const ProgressCallback& m_progress;
@@ -104,14 +107,10 @@ namespace asp{
 
     struct ErrorHistAccumulator{
       std::vector<double> & m_hist;
-      double m_max_val;
-      ErrorHistAccumulator(std::vector<double>& hist, double max_val):
-        m_hist(hist), m_max_val(max_val){}
+      ErrorHistAccumulator(std::vector<double>& hist): m_hist(hist){}
       void operator()(double err){
-        if (err == 0) return; // null errors come from invalid pixels
-        int len = m_hist.size();
-        int k = round((len-1)*std::min(err, m_max_val)/m_max_val);
-        m_hist[k]++;
+        if (!(err > 0)) return; // null errors come from invalid pixels
+        m_hist[error_hist_bin(err)]++;
       }
     };
 
@@ -121,14 +120,14 @@ namespace asp{
 			  BBox2i const& image_bbox,
 			  BBox3       & global_bbox, 
 			  std::vector<BBoxPair>& boundaries,
-			  ImageViewRef<double> const& error_image, double estim_max_error,
+			  ImageViewRef<double> const& error_image,
 			  std::vector<double> & errors_hist,
 			  double max_valid_triangulation_error,
 			  Mutex& mutex, const ProgressCallback& progress, float inc_amt ) :
       m_view(view.impl()), m_sub_block_size(sub_block_size),
       m_image_bbox(image_bbox),
       m_global_bbox(global_bbox), m_point_image_boundaries( boundaries ),
-      m_error_image(error_image), m_estim_max_error(estim_max_error),
+      m_error_image(error_image),
       m_errors_hist(errors_hist), m_max_valid_triangulation_error(max_valid_triangulation_error),
       m_mutex( mutex ), m_progress( progress ), m_inc_amt( inc_amt ) {}
       
@@ -182,7 +181,7 @@ namespace asp{
         }
 
         if (remove_outliers_with_pct){
-          ErrorHistAccumulator error_accum(local_hist, m_estim_max_error);
+          ErrorHistAccumulator error_accum(local_hist);
           for_each_pixel( crop( local_error, blocks[i] - m_image_bbox.min() ),
 		          error_accum );
 
@@ -248,29 +247,23 @@ namespace asp{
     int nc = image.cols(), nr = image.rows(); // shorten
     double nan = std::numeric_limits<double>::quiet_NaN();
 
-    ImageView<Vector3> image_out = copy(image);
+    ImageView<double> heights(nc, nr), medians;
+    for (int col = 0; col < nc; col++)
+      for (int row = 0; row < nr; row++)
+        heights(col, row) = image(col, row).z();
+    vw::float_median_filter(heights, half, medians);
 
-    for (int col = 0; col < image.cols(); col++){
-      for (int row = 0; row < image.rows(); row++){
+    for (int col = 0; col < nc; col++){
+      for (int row = 0; row < nr; row++){
 
-        if (boost::math::isnan(image(col, row).z()))
+        if (boost::math::isnan(heights(col, row)))
           continue;
 
-        std::vector<double> vals;
-        for (int c = std::max(col-half, 0); c <= std::min(col+half, nc-1); c++){
-          for (int r = std::max(row-half, 0); r <= std::min(row+half, nr-1); r++){
-            if (boost::math::isnan(image(c, r).z())) continue;
-            vals.push_back(image(c, r).z());
-          }
-        }
-        double median = vw::math::destructive_median(vals);
-        if (fabs(median - image(col, row).z()) > thresh){
-          image_out(col, row).z() = nan;
+        if (fabs(medians(col, row) - heights(col, row)) > thresh){
+          image(col, row).z() = nan;
         }
       }
     }
-
-    image = copy(image_out);
   }
 
   // TODO: This function should live somewhere else!
@@ -339,13 +332,14 @@ namespace asp{
    double search_radius_factor, double sigma_factor, bool use_surface_sampling, int pc_tile_size,
    vw::BBox2 const& projwin,
    bool remove_outliers_with_pct, Vector2 const& remove_outliers_params,
-   ImageViewRef<double> const& error_image, double estim_max_error,
+   ImageViewRef<double> const& error_image,
    double max_valid_triangulation_error,
    Vector2 median_filter_params, int erode_len, bool has_las_or_csv,
    std::string const& filter,
    double default_grid_size_multiplier,
    size_t *num_invalid_pixels, vw::Mutex *count_mutex,
-   const ProgressCallback& progress):
+   const ProgressCallback& progress,
+   std::vector<double> const& known_errors_hist):
     // Ensure all members are initiated, even if to temporary values
     m_point_image(point_image), m_texture(ImageView<float>(1,1)),
     m_bbox(BBox3()), m_snapped_bbox(BBox3()), m_spacing(0.0), m_default_spacing(0.0),
@@ -388,11 +382,11 @@ namespace asp{
     // They're used for querying what part of the image we need
     VW_OUT(DebugMessage,"asp") << "Computing raster bounding box...\n";
 
-    int num_bins = 1024;
     std::vector<double> errors_hist;
-    if (remove_outliers_with_pct){
+    bool have_errors_hist = (remove_outliers_with_pct && !known_errors_hist.empty());
+    if (remove_outliers_with_pct && !have_errors_hist){
       // Need to compute the histogram of all errors in the error image
-      errors_hist = std::vector<double>(num_bins, 0.0);
+      errors_hist = std::vector<double>(ERROR_HIST_NUM_BINS, 0.0);
     }
 
     // Subdivide each block into smaller chunks. Note: small chunks
@@ -420,7 +414,7 @@ namespace asp{
       boost::shared_ptr<task_type>
         task( new task_type( m_point_image, sub_block_size, blocks[i],
                              m_bbox, m_point_image_boundaries,
-                             error_image, estim_max_error, errors_hist,
+                             error_image, errors_hist,
                              max_valid_triangulation_error,
                              mutex, progress, inc_amt ) );
       queue.add_task( task );
@@ -428,6 +422,15 @@ namespace asp{
     queue.join_all();
     progress.report_finished();
 
+    // Index the boundaries, to quickly find the ones overlapping a tile
+    std::vector<BBox2> xy_boxes(m_point_image_boundaries.size());
+    for (size_t i = 0; i < m_point_image_boundaries.size(); i++) {
+      BBox3 const& box = m_point_image_boundaries[i].first;
+      if (!box.empty())
+        xy_boxes[i] = BBox2(subvector(box.min(), 0, 2), subvector(box.max(), 0, 2));
+    }
+    m_boundaries_tree.build(xy_boxes);
+
     if ( m_bbox.empty() )
       vw_throw( ArgumentErr() << "OrthoRasterize: Input point cloud is empty!\n" );
 
@@ -439,6 +442,11 @@ namespace asp{
 
     VW_OUT(DebugMessage,"asp") << "Point cloud boundary is " << m_bbox << "\n";
 
+    if (have_errors_hist){
+      vw_out() << "Using the triangulation error histogram from the point cloud header.\n";
+      errors_hist = known_errors_hist;
+    }
+
     if (remove_outliers_with_pct){
       // Find the outlier cutoff from the histogram of all errors.
       // The cutoff is the outlier factor times the percentile of the errors.
@@ -448,18 +456,17 @@ namespace asp{
       vw::int64 num_errors = 0;
       for (int s = 0; s < hist_size; s++)
         num_errors += errors_hist[s];
-      int cutoff_index = 0;
+      // The below is equivalent to sorting all errors in increasing order,
+      // and looking at the error at index pct*num_errors.
+      double error_percentile = 0.0;
       vw::int64 sum = 0;
-      for (int s = 0; s < hist_size; s++){
+      for (int s = 0; s < hist_size && num_errors > 0; s++){
         sum += errors_hist[s];
         if (sum >= pct*num_errors){
-          cutoff_index = s;
+          error_percentile = error_hist_value(s);
           break;
         }
       }
-      // The below is equivalent to sorting all errors in increasing order,
-      // and looking at the error at index pct*num_errors.
-      double error_percentile = estim_max_error*cutoff_index/double(hist_size);
       // Multiply by the outlier factor
       m_error_cutoff = factor*error_percentile;
       vw_out() << "Automatic triangulation error cutoff is " << m_error_cutoff
@@ -572,6 +579,22 @@ namespace asp{
   /// \cond INTERNAL
   OrthoRasterizerView::prerasterize_type OrthoRasterizerView::prerasterize( BBox2i const& bbox )
     const {
+    std::vector< ImageView<pixel_type> > results;
+    BBox2i bbox_1 = rasterize_textures(bbox, false, results);
+    return prerasterize_type(results[0], BBox2i(-bbox_1.min().x(),
+                                                -bbox_1.min().y(), cols(), rows()));
+  }
+
+  // Rasterize the texture, and the extra textures if asked for, in one
+  // pass over the point cloud. All textures share the points and their
+  // filtering, and each has its own render buffer or grid. The number
+  // of unset pixels is counted for the first texture only.
+  BBox2i OrthoRasterizerView::rasterize_textures( BBox2i const& bbox, bool use_extra_textures,
+                                                  std::vector< ImageView<pixel_type> > & results )
+    const {
+
+    asp::ScopedTrace trace("point2dem_tile", bbox);
+    trace.count("pixels", double(bbox.width())*bbox.height());
     
     BBox2i bbox_1 = bbox;
 
@@ -581,17 +604,17 @@ namespace asp{
     // Used to find which polygons are actually in the draw space.
     BBox3 local_3d_bbox = pixel_to_point_bbox(bbox_1);
 
-    ImageView<float > render_buffer;
-    ImageView<double> d_buffer, weights;
-    if (m_use_surface_sampling){
-      render_buffer.set_size(bbox_1.width(), bbox_1.height());
-    }
+    std::vector< ImageViewRef<float> > textures(1, m_texture);
+    if (use_extra_textures)
+      textures.insert(textures.end(), m_extra_textures.begin(), m_extra_textures.end());
+    int num_textures = textures.size();
 
-    // Setup a software renderer and the orthographic view matrix
-    vw::stereo::SoftwareRenderer renderer(bbox_1.width(), bbox_1.height(),
-                                          &render_buffer(0,0) );
-    renderer.Ortho2D(local_3d_bbox.min().x(), local_3d_bbox.max().x(),
-                     local_3d_bbox.min().y(), local_3d_bbox.max().y());
+    // One render buffer or grid per texture. These are not resized
+    // after the renderers and grids point to them.
+    std::vector< ImageView<float > > render_buffers(num_textures);
+    std::vector< ImageView<double> > d_buffers(num_textures), weights(num_textures);
+    std::vector< boost::shared_ptr<vw::stereo::SoftwareRenderer> > renderers(num_textures);
+    std::vector< boost::shared_ptr<asp::Point2Grid> > point2grids(num_textures);
 
     // Given a DEM grid point, search for cloud points within the
     // circular region of radius equal to grid size. As such, a
@@ -604,14 +627,30 @@ namespace asp{
       search_radius = std::max(m_spacing, m_default_spacing);
     else
       search_radius = m_spacing*m_search_radius_factor;
-    asp::Point2Grid point2grid(bbox_1.width(),
+
+    std::valarray<float> vertices(10);
+    std::vector< std::valarray<float> > intensities(num_textures, std::valarray<float>(5));
+    for (int t = 0; t < num_textures; t++) {
+      if (m_use_surface_sampling){
+        // Setup a software renderer and the orthographic view matrix
+        render_buffers[t].set_size(bbox_1.width(), bbox_1.height());
+        renderers[t] = boost::shared_ptr<vw::stereo::SoftwareRenderer>
+          (new vw::stereo::SoftwareRenderer(bbox_1.width(), bbox_1.height(),
+                                            &render_buffers[t](0,0) ));
+        renderers[t]->Ortho2D(local_3d_bbox.min().x(), local_3d_bbox.max().x(),
+                              local_3d_bbox.min().y(), local_3d_bbox.max().y());
+      }else{
+        point2grids[t] = boost::shared_ptr<asp::Point2Grid>
+          (new asp::Point2Grid(bbox_1.width(),
                                bbox_1.height(),
-                               d_buffer, weights,
+                               d_buffers[t], weights[t],
                                local_3d_bbox.min().x(),
                                local_3d_bbox.min().y(),
                                m_spacing, m_default_spacing,
                                search_radius, m_sigma_factor,
-                               m_filter, m_percentile);
+                               m_filter, m_percentile));
+      }
+    }
     
     // Set up the default color value
     double min_val = 0.0;
@@ -624,16 +663,16 @@ namespace asp{
       min_val = m_default_value;
     }
 
-    std::valarray<float> vertices(10), intensities(5);
-
-    if (m_use_surface_sampling){
-      static const int NUM_COLOR_COMPONENTS = 1;  // We only need gray scale
-      static const int NUM_VERTEX_COMPONENTS = 2; // DEMs are 2D
-      renderer.Clear(min_val);
-      renderer.SetVertexPointer(NUM_VERTEX_COMPONENTS, &vertices[0]);
-      renderer.SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[0]);
-    }else{
-      point2grid.Clear(min_val);
+    for (int t = 0; t < num_textures; t++) {
+      if (m_use_surface_sampling){
+        static const int NUM_COLOR_COMPONENTS = 1;  // We only need gray scale
+        static const int NUM_VERTEX_COMPONENTS = 2; // DEMs are 2D
+        renderers[t]->Clear(min_val);
+        renderers[t]->SetVertexPointer(NUM_VERTEX_COMPONENTS, &vertices[0]);
+        renderers[t]->SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[t][0]);
+      }else{
+        point2grids[t]->Clear(min_val);
+      }
     }
 
     // For each block in the DEM space intersecting local_3d_bbox,
@@ -644,7 +683,12 @@ namespace asp{
     typedef std::map<BBox2i, BBox2i, compare_bboxes> BlockMapType;
     typedef BlockMapType::iterator MapIterType;
     BlockMapType blocks_map;
-    BOOST_FOREACH( BBoxPair const& boundary, m_point_image_boundaries ) {
+    std::vector<size_t> candidates;
+    m_boundaries_tree.intersecting(BBox2(subvector(local_3d_bbox.min(), 0, 2),
+                                         subvector(local_3d_bbox.max(), 0, 2)),
+                                   candidates);
+    BOOST_FOREACH( size_t index, candidates ) {
+      BBoxPair const& boundary = m_point_image_boundaries[index];
       if (! local_3d_bbox.intersects(boundary.first) )
         continue;
 
@@ -669,11 +713,14 @@ namespace asp{
         (*m_num_invalid_pixels) += bbox.width()*bbox.height();
       }
       
-      if (m_use_surface_sampling){
-        return prerasterize_type( render_buffer, BBox2i(-bbox_1.min().x(), -bbox_1.min().y(), cols(), rows()) );
-      }else{
-        return prerasterize_type( d_buffer,      BBox2i(-bbox_1.min().x(), -bbox_1.min().y(), cols(), rows()) );
+      results.resize(num_textures);
+      for (int t = 0; t < num_textures; t++) {
+        if (m_use_surface_sampling)
+          results[t] = render_buffers[t];
+        else
+          results[t] = d_buffers[t];
       }
+      return bbox_1;
     }
 
     // This is very important. When doing surface sampling, for each
@@ -683,6 +730,7 @@ namespace asp{
     for (MapIterType it = blocks_map.begin(); it != blocks_map.end(); it++){
 
       BBox2i block = it->second;
+      trace.count("point_blocks", 1);
 
       block.max() += Vector2i(d, d);
       block.crop(vw::bounding_box(m_point_image));
@@ -702,7 +750,9 @@ namespace asp{
       // Crop back to the area of interest
       point_copy = crop(point_copy, block - biased_block.min());
 
-      ImageView<float> texture_copy = crop(m_texture, block );
+      std::vector< ImageView<float> > texture_copies(num_textures);
+      for (int t = 0; t < num_textures; t++)
+        texture_copies[t] = crop(textures[t], block);
 
       typedef ImageView<Vector3>::pixel_accessor PointAcc;
       PointAcc row_acc = point_copy.origin();
@@ -732,28 +782,32 @@ namespace asp{
               vertices[8] = (*point_ul).x(); // UL
               vertices[9] = (*point_ul).y();
 
-              intensities[0] = texture_copy(col,  row);
-              intensities[1] = texture_copy(col,row+1);
-              intensities[2] = texture_copy(col+1,  row+1);
-              intensities[3] = texture_copy(col+1,row);
-              intensities[4] = texture_copy(col,row);
-
-              if ( !boost::math::isnan((*point_ll).z()) ) {
-                // triangle 1 is: UL LL LR
-                renderer.DrawPolygon(0, 3);
-              }
-              if ( !boost::math::isnan((*point_ur).z()) ) {
-                // triangle 2 is: LR, UR, UL
-                renderer.DrawPolygon(2, 3);
+              for (int t = 0; t < num_textures; t++) {
+                ImageView<float> const& texture_copy = texture_copies[t];
+                intensities[t][0] = texture_copy(col,  row);
+                intensities[t][1] = texture_copy(col,row+1);
+                intensities[t][2] = texture_copy(col+1,  row+1);
+                intensities[t][3] = texture_copy(col+1,row);
+                intensities[t][4] = texture_copy(col,row);
+
+                if ( !boost::math::isnan((*point_ll).z()) ) {
+                  // triangle 1 is: UL LL LR
+                  renderers[t]->DrawPolygon(0, 3);
+                }
+                if ( !boost::math::isnan((*point_ur).z()) ) {
+                  // triangle 2 is: LR, UR, UL
+                  renderers[t]->DrawPolygon(2, 3);
+                }
               }
             }
 
           }else{
             // The new engine
             if ( !boost::math::isnan(point_copy(col, row).z()) ){
-              point2grid.AddPoint(point_copy(col, row).x(),
-                                  point_copy(col, row).y(),
-                                  texture_copy(col,  row));
+              for (int t = 0; t < num_textures; t++)
+                point2grids[t]->AddPoint(point_copy(col, row).x(),
+                                         point_copy(col, row).y(),
+                                         texture_copies[t](col,  row));
             }
           }
           point_ul.next_col();
@@ -763,18 +817,20 @@ namespace asp{
 
     }
 
-    if (!m_use_surface_sampling)
-      point2grid.normalize();
-
     // The software renderer returns an image which will render
     // upside down in most image formats, so we correct that here.
     // We also introduce transparent pixels into the result where necessary.
     // TODO: Here can do flipping in place.
-    ImageView< PixelGray<float> > result;
-    if (m_use_surface_sampling)
-      result = flip_vertical(render_buffer);
-    else
-      result = flip_vertical(d_buffer);
+    results.resize(num_textures);
+    for (int t = 0; t < num_textures; t++) {
+      if (m_use_surface_sampling) {
+        results[t] = flip_vertical(render_buffers[t]);
+      }else{
+        point2grids[t]->normalize();
+        results[t] = flip_vertical(d_buffers[t]);
+      }
+    }
+    ImageView<pixel_type> const& result = results[0];
 
     // Loop through result here and count up how many pixels have been
     // changed from the default value.
@@ -794,9 +850,25 @@ namespace asp{
       vw::Mutex::Lock lock(*m_count_mutex);
       (*m_num_invalid_pixels) += num_unset;
     }
+    trace.count("unset_pixels", num_unset);
+
+    return bbox_1;
+  }
 
-    return prerasterize_type (result, BBox2i(-bbox_1.min().x(),
-                                             -bbox_1.min().y(), cols(), rows()));
+  OrthoRasterizerMultiView::prerasterize_type
+  OrthoRasterizerMultiView::prerasterize( BBox2i const& bbox ) const {
+    std::vector< ImageView<OrthoRasterizerView::pixel_type> > results;
+    BBox2i bbox_1 = m_rasterizer.rasterize_textures(bbox, true, results);
+
+    // The channels with no texture of their own repeat the first one
+    ImageView<pixel_type> tile(bbox_1.width(), bbox_1.height());
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        for (int t = 0; t < pixel_type::static_size; t++)
+          tile(col, row)[t] = results[std::min(t, int(results.size()) - 1)](col, row).v();
+      }
+    }
+    return prerasterize_type(tile, BBox2i(-bbox_1.min().x(), -bbox_1.min().y(), cols(), rows()));
   }
 
 
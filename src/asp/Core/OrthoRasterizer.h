@@ -31,6 +31,8 @@
 #include <vw/Math/Vector.h>
 #include <vw/Math/BBox.h>
 #include <asp/Core/Point2Grid.h>
+#include <asp/Core/BBoxTree.h>
+#include <vector>
 
 namespace asp{
 
@@ -46,6 +48,7 @@ namespace asp{
     public ImageViewBase<OrthoRasterizerView> {
     ImageViewRef<Vector3> m_point_image;
     ImageViewRef<float>   m_texture;
+    std::vector< ImageViewRef<float> > m_extra_textures; // see OrthoRasterizerMultiView
     BBox3   m_bbox, m_snapped_bbox; // bounding box of point cloud
     double  m_spacing;         // point cloud units (usually m or deg) per pixel
     double  m_default_spacing; // if user did not specify spacing
@@ -69,14 +72,16 @@ namespace asp{
     size_t     *m_num_invalid_pixels; ///< Keep a count of nodata output pixels, needs to be pointer due to VW weirdness.
     vw::Mutex  *m_count_mutex;        ///< A lock for m_num_invalid_pixels, needs to be pointer due to C++ weirdness.
 
-    // We could actually use a quadtree here .. but this should be a
-    // good enough improvement.
     std::vector<BBoxPair> m_point_image_boundaries;
     // These boundaries describe a point cloud 3D boundaries and then
     // their location in the the point cloud image. These boxes are
     // overlapping in the pc image X/Y domain to insure that
     // everything is triangulated.
 
+    // A spatial index of the x-y extent of the 3D boundaries above,
+    // as there can be very many of them.
+    BBoxTree m_boundaries_tree;
+
     // Function to convert pixel coordinates to the point domain
     BBox3 pixel_to_point_bbox( BBox2 const& px ) const;
 
@@ -87,6 +92,9 @@ namespace asp{
     static int max_subblock_size(){ return 128;} // is used in point2dem and below
 
     /// Constructor.  You must call initialize_spacing before using the object!!
+    /// If known_errors_hist is not empty, it is the histogram of the
+    /// triangulation errors, as saved in the cloud header by stereo_tri,
+    /// and the errors are not read to find it.
     OrthoRasterizerView(ImageViewRef<Vector3> point_image,
                         ImageViewRef<double> texture,
                         double  search_radius_factor,
@@ -97,7 +105,6 @@ namespace asp{
                         bool    remove_outliers_with_pct,
                         Vector2 const& remove_outliers_params,
                         ImageViewRef<double> const& error_image,
-                        double  estim_max_error,
                         double  max_valid_triangulation_error,
                         Vector2 median_filter_params,
                         int     erode_len,
@@ -106,7 +113,8 @@ namespace asp{
 			double default_grid_size_multiplier,
                         size_t  *num_invalid_pixels,
                         vw::Mutex *count_mutex,
-                        const ProgressCallback& progress);
+                        const ProgressCallback& progress,
+                        std::vector<double> const& known_errors_hist = std::vector<double>());
 
     /// This must be called before the object can be used!
     void initialize_spacing(double spacing=0.0);
@@ -124,6 +132,20 @@ namespace asp{
       m_texture = channel_cast<float>(channels_to_planes(texture.impl()));
     }
 
+    /// Add a texture to be rasterized in the same pass as the main one,
+    /// with the same points, by OrthoRasterizerMultiView. It must have
+    /// the same dimensions as the point image.
+    template <class TextureViewT>
+    void add_extra_texture(TextureViewT texture) {
+      VW_ASSERT(texture.impl().cols() == m_point_image.cols() &&
+                texture.impl().rows() == m_point_image.rows(),
+      ArgumentErr() << "Orthorasterizer: add_extra_texture() failed."
+                    << " Texture dimensions must match point image dimensions.");
+      m_extra_textures.push_back(channel_cast<float>(channels_to_planes(texture.impl())));
+    }
+    void clear_extra_textures() { m_extra_textures.clear(); }
+    int  num_extra_textures() const { return m_extra_textures.size(); }
+
     inline int32 cols() const {return (int)round((fabs(m_snapped_bbox.max().x() - m_snapped_bbox.min().x()) / m_spacing)) + 1;}
     inline int32 rows() const {return (int)round((fabs(m_snapped_bbox.max().y() - m_snapped_bbox.min().y()) / m_spacing)) + 1;}
 
@@ -145,6 +167,12 @@ namespace asp{
     }
     /// \endcond
 
+    /// Rasterize the given box of the main texture, followed, if asked
+    /// for, by the extra textures. All results are on the returned box,
+    /// which is the input box grown by the search margin.
+    BBox2i rasterize_textures(BBox2i const& bbox, bool use_extra_textures,
+                              std::vector< ImageView<pixel_type> > & results) const;
+
     void set_use_alpha          (bool   val) { m_use_alpha       = val; }
     void set_use_minz_as_default(bool   val) { m_minz_as_default = val; }
     void set_default_value      (double val) { m_default_value   = val; }
@@ -197,6 +225,47 @@ namespace asp{
     
   };
 
+  /// Rasterize the texture of an OrthoRasterizerView, usually the
+  /// heights, together with up to two extra textures, such as the
+  /// triangulation error and the ortho image, from a single pass over
+  /// the point cloud. Each channel is one texture. The channels with no
+  /// texture repeat the first one.
+  class OrthoRasterizerMultiView:
+    public ImageViewBase<OrthoRasterizerMultiView> {
+    OrthoRasterizerView m_rasterizer;
+
+  public:
+    typedef Vector3f pixel_type;
+    typedef const Vector3f result_type;
+    typedef ProceduralPixelAccessor<OrthoRasterizerMultiView> pixel_accessor;
+
+    OrthoRasterizerMultiView(OrthoRasterizerView const& rasterizer):
+      m_rasterizer(rasterizer) {
+      VW_ASSERT(rasterizer.num_extra_textures() < pixel_type::static_size,
+                ArgumentErr() << "OrthoRasterizerMultiView: Too many extra textures.");
+    }
+
+    inline int32 cols  () const { return m_rasterizer.cols(); }
+    inline int32 rows  () const { return m_rasterizer.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( int /*i*/, int /*j*/, int /*p*/=0 ) const {
+      vw_throw(NoImplErr() << "OrthoRasterizerMultiView::operator() has not been implemented.");
+      return pixel_type();
+    }
+
+    /// \cond INTERNAL
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    prerasterize_type prerasterize( BBox2i const& bbox ) const;
+
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+    /// \endcond
+  };
+
   // TODO: Make this a BBox class function!!!
   /// Snaps the coordinates of a BBox to a grid spacing
   template <size_t N>
@@ -34,56 +34,145 @@
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/PhotometricOutlier.h>
-namespace fs = boost::filesystem;
-
+#include <asp/Core/ImageStatistics.h>
 using namespace vw;
 using namespace asp;
 
+namespace {
+
+  /// The difference of the left image and the right image projected
+  /// into the left one by the disparity, with the pixels where the
+  /// projected right image is zero being invalid.
+  typedef PixelMask<PixelGray<float> > DiffPixelT;
+
+  ImageViewRef<DiffPixelT>
+  masked_photometric_diff(DiskImageView<PixelGray<float> > const& left_image,
+                          DiskImageView<PixelGray<float> > const& right_image,
+                          DiskImageView<PixelMask<Vector2f> > const& disparity) {
+    stereo::DisparityTransform trans(disparity);
+    ImageViewRef<PixelGray<float> > right_proj
+      = transform(right_image, trans, ZeroEdgeExtension());
+    ImageViewRef<DiffPixelT> right_mask = create_mask(right_proj);
+    return copy_mask(abs(apply_mask(copy_mask(left_image, right_mask)) - right_proj),
+                     right_mask);
+  }
+
+  /// Invalidate the disparity where the image difference is above the
+  /// threshold, dilated by the distance to such pixels and smoothed
+  /// with a Gaussian, one tile at a time.
+  ///
+  /// The distance from an outlier only matters up to where the
+  /// smoothed distance can no longer fall below the kernel size.
+  /// Since the distance changes by at most one from a pixel to the
+  /// next, and the Gaussian is truncated, capping it at the kernel
+  /// size plus twice the Gaussian diameter does not change which
+  /// pixels are kept. So each tile is done exactly on a region which
+  /// is larger by this cap and the Gaussian radius.
+  class PhotometricOutlierView: public ImageViewBase<PhotometricOutlierView> {
+    DiskImageView<PixelGray<float> >    m_left_image, m_right_image;
+    DiskImageView<PixelMask<Vector2f> > m_disparity;
+    ImageViewRef<DiffPixelT>            m_diff;
+    float m_thresh;
+    int   m_kernel_size, m_sigma, m_dist_cap, m_margin;
+
+  public:
+    PhotometricOutlierView(std::string const& prefix, std::string const& input_disparity,
+                           int kernel_size):
+      m_left_image(prefix+"-L.tif"), m_right_image(prefix+"-R.tif"),
+      m_disparity(input_disparity), m_kernel_size(kernel_size) {
+
+      m_diff = masked_photometric_diff(m_left_image, m_right_image, m_disparity);
+
+      // Only a sample of the differences is needed for the threshold
+      ImageViewRef<PixelGray<float> > diff = apply_mask(m_diff);
+      std::vector<float> values;
+      sample_valid_values(diff, stats_sample_step(diff.cols(), diff.rows(),
+                                                  stats_sample_count(stereo_settings().stats_quantile_error)),
+                          0, values);
+      if (values.empty())
+        vw_throw( ArgumentErr() << "No valid pixels in the image difference.\n" );
+      m_thresh = sample_quantile(values, 0.99985); // Pulling out last bin of CDF
+      vw_out() << "\t  Using threshold: " << m_thresh << "\n";
+
+      m_sigma = kernel_size/3;
+      std::vector<float> kernel;
+      generate_gaussian_kernel(kernel, m_sigma, 0);
+      int radius = kernel.size()/2;
+      m_dist_cap = m_kernel_size + 4*radius + 1;
+      m_margin   = m_dist_cap + radius;
+    }
+
+    typedef PixelMask<Vector2f> pixel_type;
+    typedef pixel_type          result_type;
+    typedef ProceduralPixelAccessor<PhotometricOutlierView> pixel_accessor;
+
+    inline int32 cols  () const { return m_disparity.cols(); }
+    inline int32 rows  () const { return m_disparity.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+    inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+      vw_throw(NoImplErr() << "PhotometricOutlierView::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+      BBox2i big_box = bbox;
+      big_box.expand(m_margin);
+      big_box.crop(bounding_box(*this));
+
+      // Thresholding image and dilating
+      ImageView<DiffPixelT> diff = crop(m_diff, big_box);
+      ImageView<PixelGray<float> > dust = threshold(apply_mask(diff), m_thresh, 1.0, 0.0);
+      ImageView<PixelGray<float> > grass;
+      grassfire(dust, grass);
+      for (int row = 0; row < grass.rows(); row++) {
+        for (int col = 0; col < grass.cols(); col++) {
+          if (grass(col, row).v() > m_dist_cap)
+            grass(col, row).v() = m_dist_cap;
+        }
+      }
+      dust = gaussian_filter(grass, m_sigma);
+
+      ImageView<pixel_type> tile = crop(m_disparity, bbox);
+      for (int row = 0; row < tile.rows(); row++) {
+        for (int col = 0; col < tile.cols(); col++) {
+          int c = col + bbox.min().x() - big_box.min().x();
+          int r = row + bbox.min().y() - big_box.min().y();
+          if (!(dust(c, r).v() > m_kernel_size) || !is_valid(diff(c, r)))
+            tile(col, row).invalidate();
+        }
+      }
+
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+} // end anonymous namespace
+
+ImageViewRef<PixelMask<Vector2f> >
+asp::photometric_outlier_view( std::string const& prefix,
+                               std::string const& input_disparity,
+                               int kernel_size ) {
+  return PhotometricOutlierView(prefix, input_disparity, kernel_size);
+}
+
 void asp::photometric_outlier_rejection( vw::cartography::GdalWriteOptions const& opt,
                                          std::string const& prefix,
                                          std::string const& input_disparity,
                                          std::string & output_disparity,
                                          int kernel_size ) {
-  // Projecting right into perspective of left
-  DiskImageView<PixelGray<float> > right_disk_image(prefix+"-R.tif");
-  DiskImageView<PixelMask<Vector2f> > disparity_disk_image( input_disparity );
-  stereo::DisparityTransform trans( disparity_disk_image );
-
-  std::string cache_dir = "/tmp"; // modify here to use a different cache dir if needed
-  if (!fs::is_directory(cache_dir)) {
-    vw_out() << "\nCreating cache directory: " << cache_dir << std::endl;
-    fs::create_directories(cache_dir);
-  }
 
-  DiskCacheImageView<PixelGray<float> >
-    right_proj( transform( right_disk_image, trans, ZeroEdgeExtension() ), "tif", TerminalProgressCallback("asp","Projecting R:"), cache_dir);
-
-  // Differencing Left and Projected Right
-  ImageViewRef<PixelMask<PixelGray<float32> > > right_mask =
-    create_mask(right_proj);
-  DiskImageView<PixelGray<float32> > left_image(prefix+"-L.tif");
-  DiskCacheImageView<PixelGray<float> >
-    diff( abs(apply_mask(copy_mask(left_image,right_mask))-right_proj),
-          "tif", TerminalProgressCallback("asp","\tDifference:"),
-          cache_dir);
-  ChannelAccumulator<math::CDFAccumulator<float32> > cdf;
-  cdf.resize(8000,2001);
-  for_each_pixel(diff, cdf);
-  float thresh = cdf.quantile(0.99985); // Pulling out last bin of CDF
-  vw_out() << "\t  Using threshold: " << thresh << "\n";
-
-  // Thresholding image and dilating
-  ImageView<PixelGray<float> > dust =
-    threshold(apply_mask(copy_mask(diff,right_mask)),thresh,1.0,0.0);
-  ImageView<PixelGray<float> > grass;
-  grassfire(dust,grass);
-  dust = gaussian_filter(grass,kernel_size/3);
-
-  ImageViewRef<PixelMask<Vector2f > > cleaned_disparity =
-    intersect_mask(disparity_disk_image,
-                   intersect_mask(create_mask(threshold(dust,kernel_size,0.0,1.0)),right_mask));
-
-  vw::cartography::block_write_gdal_image( prefix+"-FDust.tif",
-                          cleaned_disparity, opt,
-                          TerminalProgressCallback("asp","Dust Removal:") );
+  output_disparity = prefix+"-FDust.tif";
+  vw::cartography::block_write_gdal_image( output_disparity,
+                          photometric_outlier_view(prefix, input_disparity, kernel_size),
+                          opt, TerminalProgressCallback("asp","Dust Removal:") );
 }
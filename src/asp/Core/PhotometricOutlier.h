@@ -23,6 +23,9 @@
 #ifndef __STEREO_CORE_PHOTOMETRIC_OUTLIER_H__
 #define __STEREO_CORE_PHOTOMETRIC_OUTLIER_H__
 
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/Vector.h>
 #include <string>
 
 // Forward declaration
@@ -33,6 +36,18 @@ namespace vw{
 }
 
 namespace asp {
+
+  /// The input disparity, with the pixels invalidated where the left
+  /// image and the right image projected by the disparity differ the
+  /// most, such as dust, and close to them. Computed tile by tile when
+  /// rasterized. Only a sample of the differences is computed here, to
+  /// find the threshold.
+  vw::ImageViewRef<vw::PixelMask<vw::Vector2f> >
+  photometric_outlier_view( std::string const& prefix,
+                            std::string const& input_disparity,
+                            int kernel_size );
+
+  /// The same, written to <prefix>-FDust.tif, whose name is returned.
   void photometric_outlier_rejection( vw::cartography::GdalWriteOptions const& opt,
                                       std::string const& prefix,
                                       std::string const& input_disparity,
@@ -43,7 +43,7 @@ Point2Grid::Point2Grid(int width, int height,
   m_width(width), m_height(height),
   m_buffer(buffer), m_weights(weights),
   m_x0(x0), m_y0(y0), m_grid_size(grid_size),
-  m_radius(radius), m_filter(filter), m_percentile(percentile){
+  m_radius(radius), m_sigma(0), m_filter(filter), m_percentile(percentile){
   
   if (m_grid_size <= 0)
     vw_throw( ArgumentErr() << "Point2Grid: Grid size must be > 0.\n" );
@@ -69,16 +69,8 @@ Point2Grid::Point2Grid(int width, int height,
   // Override this if passed from outside
   if (sigma_factor > 0)
     sigma = sigma_factor/spacing/spacing;
-  
-  // Sample the gaussian for speed
-  int num_samples = 1000;
-  m_dx = m_radius/(num_samples - 1.0);
-  m_sampled_gauss.resize(num_samples);
-  for (int k = 0; k < num_samples; k++){
-    double dist = k*m_dx;
-    m_sampled_gauss[k] = exp(-sigma*dist*dist);
-  }
-  
+
+  m_sigma = sigma;
 }
 
 void Point2Grid::Clear(const float value) {
@@ -93,10 +85,8 @@ void Point2Grid::Clear(const float value) {
 
   // For these we need to keep all values (in fact, for stddev we could get away with less,
   // but it is not worth trying so hard).
-  if (m_filter == f_median || m_filter == f_stddev ||
-      m_filter == f_nmad || m_filter == f_percentile) {
-    m_vals.set_size(m_width, m_height);
-  }
+  m_val_cells.clear();
+  m_vals.clear();
   
 }
 
@@ -108,96 +98,154 @@ void Point2Grid::AddPoint(double x, double y, double z){
   int maxx = std::min( (int)floor( (x + m_radius - m_x0)/m_grid_size ), m_buffer.cols() - 1 );
   int maxy = std::min( (int)floor( (y + m_radius - m_y0)/m_grid_size ), m_buffer.rows() - 1 );
 
-  // Add the contribution of current point to all grid points within radius
-  for (int ix = minx; ix <= maxx; ix++){
-    for (int iy = miny; iy <= maxy; iy++){
-      
-      double gx = m_x0 + ix*m_grid_size;
-      double gy = m_y0 + iy*m_grid_size;
-      double dist = sqrt( (x-gx)*(x-gx) + (y-gy)*(y-gy) );
-      if ( dist > m_radius ) continue;
+  if (minx > maxx || miny > maxy)
+    return;
+
+  // The Gaussian weight is separable, exp(-sigma*(dx^2 + dy^2)) =
+  // exp(-sigma*dx^2)*exp(-sigma*dy^2), so find the factors for the
+  // columns once, and for each row once.
+  int nx = maxx - minx + 1;
+  m_dx2.resize(nx);
+  for (int i = 0; i < nx; i++){
+    double dx = x - (m_x0 + (minx + i)*m_grid_size);
+    m_dx2[i] = dx*dx;
+  }
+  if (m_filter == f_weighted_average) {
+    m_wx.resize(nx);
+    for (int i = 0; i < nx; i++)
+      m_wx[i] = exp(-m_sigma*m_dx2[i]);
+  }
+
+  double radius2 = m_radius*m_radius;
+
+  // Add the contribution of current point to all grid points within
+  // radius. Go along rows, as that is how the buffers are stored.
+  for (int iy = miny; iy <= maxy; iy++){
+
+    double dy  = y - (m_y0 + iy*m_grid_size);
+    double dy2 = dy*dy;
+    if (dy2 > radius2) continue;
+
+    double * buffer  = &m_buffer (minx, iy);
+    double * weights = &m_weights(minx, iy);
 
-      if (m_filter == f_weighted_average) {
-        double wt = m_sampled_gauss[(int)round(dist/m_dx)];
+    if (m_filter == f_weighted_average) {
+      double wy = exp(-m_sigma*dy2);
+      for (int i = 0; i < nx; i++){
+        if (m_dx2[i] + dy2 > radius2) continue;
+        double wt = m_wx[i]*wy;
         if (wt <= 0) continue;
-        if (m_weights(ix, iy) == 0) m_buffer(ix, iy) = 0.0; // set to 0 before incrementing below
-        m_buffer(ix, iy)  += z*wt;
-        m_weights(ix, iy) += wt;
-
-      }else if (m_filter == f_mean){
-        if (m_weights(ix, iy) == 0) m_buffer(ix, iy) = 0.0; // set to 0 before incrementing below
-        m_buffer(ix, iy)  += z;
-        m_weights(ix, iy) += 1;
+        if (weights[i] == 0) buffer[i] = 0.0; // set to 0 before incrementing below
+        buffer[i]  += z*wt;
+        weights[i] += wt;
+      }
+      continue;
+    }
+
+    for (int i = 0; i < nx; i++){
+      if (m_dx2[i] + dy2 > radius2) continue;
+
+      if (m_filter == f_mean){
+        if (weights[i] == 0) buffer[i] = 0.0; // set to 0 before incrementing below
+        buffer[i]  += z;
+        weights[i] += 1;
         
       }else if (m_filter == f_min){
-        if (m_weights(ix, iy) == 0) {
-          m_buffer(ix, iy)  = z; // first time we set the value
-          m_weights(ix, iy) = 1; // mark the fact that the buffer was initialized
+        if (weights[i] == 0) {
+          buffer[i]  = z; // first time we set the value
+          weights[i] = 1; // mark the fact that the buffer was initialized
         }else
-          m_buffer(ix, iy) = std::min(m_buffer(ix, iy), z);
+          buffer[i] = std::min(buffer[i], z);
       
       }else if (m_filter == f_max){
-        if (m_weights(ix, iy) == 0) {
-          m_buffer(ix, iy)  = z; // first time we set the value
-          m_weights(ix, iy) = 1; // mark the fact that the buffer was initialized
+        if (weights[i] == 0) {
+          buffer[i]  = z; // first time we set the value
+          weights[i] = 1; // mark the fact that the buffer was initialized
         }else
-          m_buffer(ix, iy) = std::max(m_buffer(ix, iy), z);
+          buffer[i] = std::max(buffer[i], z);
         
       }else if (m_filter == f_count){
-        if (m_weights(ix, iy) == 0) {
-          m_weights(ix, iy) = 1; // mark the fact that the buffer was initialized
+        if (weights[i] == 0) {
+          weights[i] = 1; // mark the fact that the buffer was initialized
         }else
-          m_weights(ix, iy) += 1;
+          weights[i] += 1;
         
       }else if (m_filter == f_stddev || m_filter == f_median ||
                 m_filter == f_nmad   || m_filter == f_percentile){
-        m_vals(ix, iy).push_back(z); // not strictly needed for stddev
+        m_val_cells.push_back(minx + i + iy*m_width); // not strictly needed for stddev
+        m_vals.push_back(z);
       }
-      
     }
-    
   }
 }
 
 void Point2Grid::normalize(){
+
+  bool keep_vals = (m_filter == f_stddev || m_filter == f_median ||
+                    m_filter == f_nmad   || m_filter == f_percentile);
+
+  // Group the values by cell, with a counting sort. The values of
+  // cell i end up in sorted_vals[offsets[i]], ..., sorted_vals[offsets[i+1]-1].
+  std::vector<size_t> offsets;
+  std::vector<double> sorted_vals, cell_vals;
+  if (keep_vals) {
+    offsets.assign(size_t(m_width)*m_height + 1, 0);
+    for (size_t it = 0; it < m_val_cells.size(); it++)
+      offsets[m_val_cells[it] + 1]++;
+    for (size_t i = 1; i < offsets.size(); i++)
+      offsets[i] += offsets[i-1];
+    sorted_vals.resize(m_vals.size());
+    std::vector<size_t> pos(offsets.begin(), offsets.end() - 1);
+    for (size_t it = 0; it < m_vals.size(); it++)
+      sorted_vals[pos[m_val_cells[it]]++] = m_vals[it];
+    std::vector<int>().swap(m_val_cells); // free these before computing
+    std::vector<double>().swap(m_vals);
+  }
+
   for (int c = 0; c < m_buffer.cols(); c++){
     for (int r = 0; r < m_buffer.rows(); r++){
 
       if (m_filter == f_weighted_average || m_filter == f_mean) {
         if (m_weights(c, r) > 0)
           m_buffer (c, r) /= m_weights(c, r);
+        continue;
 
-      }else if (m_filter == f_count)
+      }else if (m_filter == f_count) {
         m_buffer(c, r) = m_weights(c, r); // hence instead of no-data we will have always 0
+        continue;
+      }
+
+      if (!keep_vals)
+        continue;
+
+      size_t cell = c + size_t(r)*m_width;
+      if (offsets[cell] == offsets[cell+1])
+        continue; // nothing to compute
+
+      // Reuse the same buffer for the values of each cell
+      cell_vals.assign(sorted_vals.begin() + offsets[cell],
+                       sorted_vals.begin() + offsets[cell+1]);
 
-      else if (m_filter == f_stddev){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
+      if (m_filter == f_stddev){
         vw::math::StdDevAccumulator<double> V;
-        for (size_t it = 0; it < m_vals(c, r).size(); it++) 
-          V(m_vals(c, r)[it]);
+        for (size_t it = 0; it < cell_vals.size(); it++) 
+          V(cell_vals[it]);
         m_buffer(c, r) = V.value();
       }
       
       else if (m_filter == f_median){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
         vw::math::MedianAccumulator<double> V;
-        for (size_t it = 0; it < m_vals(c, r).size(); it++) 
-          V(m_vals(c, r)[it]);
+        for (size_t it = 0; it < cell_vals.size(); it++) 
+          V(cell_vals[it]);
         m_buffer(c, r) = V.value();
       }
 
       else if (m_filter == f_nmad){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
-        m_buffer(c, r) = vw::math::destructive_nmad(m_vals(c, r));
+        m_buffer(c, r) = vw::math::destructive_nmad(cell_vals);
       }
       
       else if (m_filter == f_percentile){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
-        m_buffer(c, r) = vw::math::destructive_percentile(m_vals(c, r), m_percentile);
+        m_buffer(c, r) = vw::math::destructive_percentile(cell_vals, m_percentile);
       }
       
     }
@@ -23,6 +23,7 @@
 #define __VW_POINT2GRID_H__
 
 #include <vw/Image/ImageView.h>
+#include <vector>
 
 namespace asp {
 
@@ -48,12 +49,16 @@ namespace asp {
     int m_width, m_height; // DEM dimensions
     vw::ImageView<double> & m_buffer;
     vw::ImageView<double> & m_weights;
-    vw::ImageView< std::vector<double> > m_vals; // when need to keep all individual values
+    // When need to keep all individual values, they are stored in one
+    // flat buffer, with the cell (c + r*m_width) of each. They are
+    // grouped by cell in normalize().
+    std::vector<int>    m_val_cells;
+    std::vector<double> m_vals;
     double m_x0, m_y0; // lower-left corner
     double m_grid_size;  // spacing between output DEM pixels
     double m_radius;   // how far to search for cloud points
-    double m_dx;       // spacing between samples
-    std::vector<double> m_sampled_gauss;
+    double m_sigma;    // the weight of a point at distance d is exp(-m_sigma*d^2)
+    std::vector<double> m_dx2, m_wx; // per point, for each column in the radius
     FilterType m_filter;
     double m_percentile; // The actual value of the percentile to use if in that mode
     
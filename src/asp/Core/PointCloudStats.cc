@@ -0,0 +1,218 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <vw/Core/Log.h>
+#include <asp/Core/Common.h>
+#include <asp/Core/PointCloudStats.h>
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+#include <gdal_priv.h>
+#endif
+
+using namespace vw;
+
+namespace {
+
+  const double ERROR_HIST_MIN_LOG = log(1e-10);
+  const double ERROR_HIST_MAX_LOG = log(1e+10);
+
+  // The header keys. The values are written with full precision.
+  const std::string POINT_COUNT_TAG    = "POINT_COUNT";
+  const std::string POINT_BBOX_MIN_TAG = "POINT_BBOX_MIN";
+  const std::string POINT_BBOX_MAX_TAG = "POINT_BBOX_MAX";
+  const std::string POINT_MEAN_TAG     = "POINT_MEAN";
+  const std::string POINT_MEAN_LON_TAG = "POINT_MEAN_LON";
+  const std::string ERROR_HIST_TAG     = "ERROR_HIST"; // bin:count pairs
+  const std::string POINT_CLOUD_SIZE_TAG      = "POINT_CLOUD_SIZE"; // cols rows
+  const std::string POINT_ROUNDING_ERROR_TAG  = "POINT_ROUNDING_ERROR";
+
+  std::string vec3_str(Vector3 const& v) {
+    std::ostringstream os;
+    os << std::setprecision(17) << v[0] << ' ' << v[1] << ' ' << v[2];
+    return os.str();
+  }
+
+  bool parse_vec3(std::string const& str, Vector3 & v) {
+    std::istringstream is(str);
+    return bool(is >> v[0] >> v[1] >> v[2]);
+  }
+}
+
+int asp::error_hist_bin(double err){
+  double step = (ERROR_HIST_MAX_LOG - ERROR_HIST_MIN_LOG)/ERROR_HIST_NUM_BINS;
+  int k = (int)floor((log(err) - ERROR_HIST_MIN_LOG)/step);
+  return std::max(0, std::min(ERROR_HIST_NUM_BINS - 1, k));
+}
+
+double asp::error_hist_value(int bin){
+  double step = (ERROR_HIST_MAX_LOG - ERROR_HIST_MIN_LOG)/ERROR_HIST_NUM_BINS;
+  return exp(ERROR_HIST_MIN_LOG + (bin + 0.5)*step);
+}
+
+void asp::PointCloudStats::add(PointCloudStats const& other) {
+  num_valid += other.num_valid;
+  bbox.grow(other.bbox);
+  sum     += other.sum;
+  lon_sum += other.lon_sum;
+  rounding_error = std::max(rounding_error, other.rounding_error);
+  for (std::map<int, int64>::const_iterator it = other.errors_hist.begin();
+       it != other.errors_hist.end(); it++)
+    errors_hist[it->first] += it->second;
+}
+
+std::vector<double> asp::PointCloudStats::dense_errors_hist() const {
+  std::vector<double> hist(ERROR_HIST_NUM_BINS, 0.0);
+  for (std::map<int, int64>::const_iterator it = errors_hist.begin();
+       it != errors_hist.end(); it++)
+    hist[it->first] = it->second;
+  return hist;
+}
+
+asp::PointCloudStats asp::PointCloudStatsCollector::stats() const {
+  Mutex::Lock lock(m_mutex);
+  PointCloudStats out;
+  for (std::map<std::pair<int, int>, PointCloudStats>::const_iterator it = m_tiles.begin();
+       it != m_tiles.end(); it++)
+    out.add(it->second);
+  return out;
+}
+
+void asp::write_point_cloud_stats(std::string const& file, PointCloudStats const& stats) {
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+  std::ostringstream hist;
+  for (std::map<int, int64>::const_iterator it = stats.errors_hist.begin();
+       it != stats.errors_hist.end(); it++) {
+    if (it != stats.errors_hist.begin())
+      hist << ' ';
+    hist << it->first << ':' << it->second;
+  }
+  std::ostringstream mean_lon, rounding_error;
+  mean_lon       << std::setprecision(17) << stats.mean_lon();
+  rounding_error << std::setprecision(17) << stats.rounding_error;
+
+  // The file was written and closed by now, so open it again to add
+  // the statistics to its header.
+  Mutex::Lock lock(DiskImageResourceGDAL::global_lock());
+  GDALAllRegister();
+  GDALDataset * dataset = (GDALDataset*)GDALOpen(file.c_str(), GA_Update);
+  if (dataset == NULL) {
+    vw_out(WarningMessage) << "Could not save the point cloud statistics in: " << file << "\n";
+    return;
+  }
+  // The size the statistics are for, so they are not used for a crop
+  std::ostringstream size;
+  size << dataset->GetRasterXSize() << ' ' << dataset->GetRasterYSize();
+  dataset->SetMetadataItem(POINT_CLOUD_SIZE_TAG.c_str(), size.str().c_str());
+  dataset->SetMetadataItem(POINT_COUNT_TAG.c_str(),
+                           boost::lexical_cast<std::string>(stats.num_valid).c_str());
+  dataset->SetMetadataItem(POINT_ROUNDING_ERROR_TAG.c_str(), rounding_error.str().c_str());
+  if (stats.num_valid > 0) {
+    dataset->SetMetadataItem(POINT_BBOX_MIN_TAG.c_str(), vec3_str(stats.bbox.min()).c_str());
+    dataset->SetMetadataItem(POINT_BBOX_MAX_TAG.c_str(), vec3_str(stats.bbox.max()).c_str());
+    dataset->SetMetadataItem(POINT_MEAN_TAG.c_str(),     vec3_str(stats.mean()).c_str());
+    dataset->SetMetadataItem(POINT_MEAN_LON_TAG.c_str(), mean_lon.str().c_str());
+  }
+  dataset->SetMetadataItem(ERROR_HIST_TAG.c_str(), hist.str().c_str());
+  GDALClose(dataset);
+#endif
+}
+
+bool asp::read_point_cloud_stats(std::string const& file, PointCloudStats & stats) {
+
+  stats = PointCloudStats();
+
+  std::map<std::string, std::string> keys;
+  keys[POINT_COUNT_TAG]    = "";
+  keys[POINT_BBOX_MIN_TAG] = "";
+  keys[POINT_BBOX_MAX_TAG] = "";
+  keys[POINT_MEAN_TAG]     = "";
+  keys[POINT_MEAN_LON_TAG] = "";
+  keys[ERROR_HIST_TAG]     = "";
+  keys[POINT_CLOUD_SIZE_TAG]     = "";
+  keys[POINT_ROUNDING_ERROR_TAG] = "";
+  int cols = 0, rows = 0;
+  try {
+    DiskImageResourceGDAL rsrc(file);
+    for (std::map<std::string, std::string>::iterator it = keys.begin(); it != keys.end(); it++)
+      vw::cartography::read_header_string(rsrc, it->first, it->second);
+    cols = rsrc.cols();
+    rows = rsrc.rows();
+  } catch (...) {
+    return false;
+  }
+
+  if (keys[POINT_COUNT_TAG] == "")
+    return false;
+
+  int saved_cols = -1, saved_rows = -1;
+  std::istringstream size(keys[POINT_CLOUD_SIZE_TAG]);
+  if (!(size >> saved_cols >> saved_rows) || saved_cols != cols || saved_rows != rows) {
+    vw_out(WarningMessage) << "Ignoring the point cloud statistics in: " << file
+                           << ", as they are not for a cloud of its size.\n";
+    return false;
+  }
+
+  try {
+    stats.num_valid = boost::lexical_cast<int64>(keys[POINT_COUNT_TAG]);
+    if (keys[POINT_ROUNDING_ERROR_TAG] != "")
+      stats.rounding_error = boost::lexical_cast<double>(keys[POINT_ROUNDING_ERROR_TAG]);
+    if (stats.num_valid > 0) {
+      Vector3 bmin, bmax, mean;
+      if (!parse_vec3(keys[POINT_BBOX_MIN_TAG], bmin) ||
+          !parse_vec3(keys[POINT_BBOX_MAX_TAG], bmax) ||
+          !parse_vec3(keys[POINT_MEAN_TAG],     mean))
+        return false;
+      stats.bbox    = BBox3(bmin, bmax);
+      stats.sum     = mean*double(stats.num_valid);
+      stats.lon_sum = boost::lexical_cast<double>(keys[POINT_MEAN_LON_TAG])*stats.num_valid;
+    }
+  } catch (boost::bad_lexical_cast const&) {
+    return false;
+  }
+
+  std::istringstream hist(keys[ERROR_HIST_TAG]);
+  int bin;
+  char sep;
+  int64 count;
+  while (hist >> bin >> sep >> count) {
+    if (bin < 0 || bin >= ERROR_HIST_NUM_BINS || sep != ':')
+      return false;
+    stats.errors_hist[bin] += count;
+  }
+
+  return true;
+}
+
+bool asp::read_point_cloud_stats(std::vector<std::string> const& files,
+                                 PointCloudStats & stats) {
+  stats = PointCloudStats();
+  for (size_t i = 0; i < files.size(); i++) {
+    PointCloudStats file_stats;
+    if (!read_point_cloud_stats(files[i], file_stats)) {
+      stats = PointCloudStats();
+      return false;
+    }
+    stats.add(file_stats);
+  }
+  return !files.empty();
+}
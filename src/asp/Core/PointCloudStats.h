@@ -0,0 +1,162 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file PointCloudStats.h
+///
+/// Statistics of a point cloud, found by stereo_tri as it writes the
+/// cloud and saved in its header, so that the tools reading the cloud
+/// can skip the passes over all of it which would find them again.
+
+#ifndef __ASP_CORE_POINT_CLOUD_STATS_H__
+#define __ASP_CORE_POINT_CLOUD_STATS_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/Manipulation.h>
+#include <boost/shared_ptr.hpp>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  // The histogram of triangulation errors, used for outlier removal,
+  // has bins of equal size in the logarithm of the error, over a range
+  // wide enough for any error, so that it can be found in the same pass
+  // as the bounding boxes, with no estimate of the largest error. The
+  // values of neighboring bins differ by about half a percent.
+  const int ERROR_HIST_NUM_BINS = 8192;
+
+  /// The bin of the error histogram having the given error
+  int error_hist_bin(double err);
+
+  /// The error at the center of a bin
+  double error_hist_value(int bin);
+
+  struct PointCloudStats {
+    vw::int64   num_valid;
+    vw::BBox3   bbox;            ///< of the valid points
+    vw::Vector3 sum;             ///< of the valid points, for their mean
+    double      lon_sum;         ///< of their longitude, in degrees in [-180, 180]
+    std::map<int, vw::int64> errors_hist; ///< of the positive errors, the nonempty bins
+    double      rounding_error;  ///< of the saved points, or 0 if not known
+
+    PointCloudStats(): num_valid(0), lon_sum(0), rounding_error(0) {}
+
+    /// Add a point. A point equal to (0, 0, 0) is no-data.
+    void add_point(vw::Vector3 const& xyz, double error) {
+      if (error > 0)
+        errors_hist[error_hist_bin(error)]++;
+      if (xyz == vw::Vector3())
+        return;
+      num_valid++;
+      bbox.grow(xyz);
+      sum     += xyz;
+      lon_sum += atan2(xyz[1], xyz[0])*180.0/M_PI;
+    }
+
+    /// Add the statistics of another cloud, such as another tile
+    void add(PointCloudStats const& other);
+
+    /// The error histogram, with all ERROR_HIST_NUM_BINS bins
+    std::vector<double> dense_errors_hist() const;
+
+    vw::Vector3 mean    () const { return num_valid > 0 ? sum/double(num_valid) : vw::Vector3(); }
+    double      mean_lon() const { return num_valid > 0 ? lon_sum/double(num_valid) : 0.0; }
+  };
+
+  /// Save the statistics in the header of the cloud, once it is written
+  void write_point_cloud_stats(std::string const& file, PointCloudStats const& stats);
+
+  /// Read the statistics from the header of a cloud. Return false if
+  /// it does not have them, or if they were saved for a cloud of a
+  /// different size, as when the header was copied to a crop of it.
+  bool read_point_cloud_stats(std::string const& file, PointCloudStats & stats);
+
+  /// Read the statistics of several clouds, and add them up. Return
+  /// false if any of them does not have them.
+  bool read_point_cloud_stats(std::vector<std::string> const& files, PointCloudStats & stats);
+
+  /// The statistics of the tiles of a cloud, as they are rasterized.
+  /// A tile rasterized more than once is counted once.
+  class PointCloudStatsCollector {
+    mutable vw::Mutex m_mutex;
+    std::map<std::pair<int, int>, PointCloudStats> m_tiles;
+  public:
+    void add_tile(vw::BBox2i const& bbox, PointCloudStats const& stats) {
+      vw::Mutex::Lock lock(m_mutex);
+      m_tiles[std::make_pair(bbox.min().x(), bbox.min().y())] = stats;
+    }
+    PointCloudStats stats() const;
+  };
+
+  /// Pass a cloud through unchanged, collecting the statistics of
+  /// each tile rasterized. The pixels are the xyz point followed by
+  /// the triangulation error, as a number or as a vector.
+  template <class ImageT>
+  class PointCloudStatsView: public vw::ImageViewBase< PointCloudStatsView<ImageT> > {
+    ImageT m_img;
+    boost::shared_ptr<PointCloudStatsCollector> m_collector;
+  public:
+
+    typedef typename ImageT::pixel_type pixel_type;
+    typedef pixel_type                  result_type;
+    typedef vw::ProceduralPixelAccessor<PointCloudStatsView> pixel_accessor;
+
+    PointCloudStatsView(vw::ImageViewBase<ImageT> const& img,
+                        boost::shared_ptr<PointCloudStatsCollector> collector):
+      m_img(img.impl()), m_collector(collector) {}
+
+    inline vw::int32 cols  () const { return m_img.cols(); }
+    inline vw::int32 rows  () const { return m_img.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline pixel_type operator()( double /*i*/, double /*j*/, vw::int32 /*p*/ = 0 ) const {
+      vw::vw_throw(vw::NoImplErr() << "PointCloudStatsView::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+      vw::ImageView<pixel_type> out = vw::crop(m_img, bbox);
+      const int n = vw::math::VectorSize<pixel_type>::value;
+      PointCloudStats stats;
+      for (int row = 0; row < out.rows(); row++) {
+        for (int col = 0; col < out.cols(); col++) {
+          pixel_type const& p = out(col, row);
+          stats.add_point(subvector(p, 0, 3), norm_2(subvector(p, 3, n - 3)));
+        }
+      }
+      m_collector->add_tile(bbox, stats);
+      return prerasterize_type(out, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_POINT_CLOUD_STATS_H__
@@ -23,9 +23,20 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/BinaryCloud.h>
 #include <vw/Cartography/Chipper.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Core/Settings.h>
 #include <boost/math/special_functions/fpclassify.hpp>
+#include <boost/noncopyable.hpp>
+#include <proj_api.h>
+#include <limits>
+#include <queue>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
 
 using namespace vw;
 using namespace vw::cartography;
@@ -160,20 +171,218 @@ namespace asp{
 
   };
 
+  // Reading of CSV files in large chunks which end at line
+  // boundaries, so that the lines of several chunks can be parsed in
+  // parallel, without the cost of reading one line at a time.
+  namespace {
+
+    // Must agree with csv_separator()
+    inline bool is_csv_separator(char c) {
+      return c == ',' || c == ' ' || c == '\t';
+    }
+
+    class CsvChunkReader {
+      std::ifstream m_ifs;
+      std::string   m_carry; // The start of a line not finished in the last chunk
+    public:
+      static const size_t CHUNK_SIZE = 16*1024*1024;
+
+      CsvChunkReader(std::string const& file): m_ifs(file.c_str(), std::ios::binary) {
+        if (!m_ifs)
+          vw_throw( vw::IOErr() << "Unable to open file \"" << file << "\"" );
+      }
+
+      // The next chunk, which has only whole lines. Returns false at the
+      // end of the file.
+      bool next(std::string & chunk) {
+        chunk.swap(m_carry);
+        m_carry.clear();
+        while (m_ifs) {
+          size_t start = chunk.size();
+          chunk.resize(start + CHUNK_SIZE);
+          m_ifs.read(&chunk[start], CHUNK_SIZE);
+          chunk.resize(start + m_ifs.gcount());
+          if (!m_ifs)
+            break; // The last chunk, which may not end with a newline
+
+          // Keep the partial line at the end for the next chunk. A chunk
+          // without a newline is a part of a very long line, so read more.
+          size_t pos = chunk.rfind('\n');
+          if (pos != std::string::npos) {
+            m_carry.assign(chunk, pos + 1, std::string::npos);
+            chunk.resize(pos + 1);
+            break;
+          }
+        }
+        return !chunk.empty();
+      }
+    };
+
+    // How the records of a chunk are converted to points, if at all
+    enum CsvPointType { CSV_NO_POINTS, CSV_CARTESIAN, CSV_POINT_HEIGHT };
+
+    // Parse the lines of one chunk, with the same rules as
+    // parse_csv_line(). The messages about lines which cannot be parsed
+    // are kept, to be printed in the order of the file.
+    class CsvChunkTask: public vw::Task, private boost::noncopyable {
+      asp::CsvConv const&                  m_conv;
+      GeoReference                         m_geo; // A copy, the projection is not shareable
+      CsvPointType                         m_point_type;
+      std::string                   const& m_chunk;
+      bool                                 m_is_first_chunk;
+      std::vector<asp::CsvConv::CsvRecord> & m_records;
+      std::vector<Vector3>                 & m_points;
+      std::string                          & m_messages;
+    public:
+      CsvChunkTask(asp::CsvConv const& conv, GeoReference const& geo,
+                   CsvPointType point_type, std::string const& chunk, bool is_first_chunk,
+                   std::vector<asp::CsvConv::CsvRecord> & records,
+                   std::vector<Vector3> & points, std::string & messages):
+        m_conv(conv), m_geo(geo), m_point_type(point_type), m_chunk(chunk),
+        m_is_first_chunk(is_first_chunk), m_records(records), m_points(points),
+        m_messages(messages) {}
+
+      void operator()() {
+        std::ostringstream os;
+        bool is_first_line = m_is_first_chunk;
+        const char* ptr       = m_chunk.c_str();
+        const char* chunk_end = ptr + m_chunk.size();
+        while (ptr < chunk_end) {
+          const char* line_end = (const char*)memchr(ptr, '\n', chunk_end - ptr);
+          if (line_end == NULL)
+            line_end = chunk_end;
+
+          // The first line may be the header, so don't complain about it
+          asp::CsvConv::CsvRecord values;
+          if (*ptr == '#') {
+            if (!is_first_line)
+              os << "Ignoring line starting with comment: "
+                 << std::string(ptr, line_end) << "\n";
+          } else if (m_conv.parse_csv_fields(ptr, line_end, values)) {
+            if (m_point_type == CSV_NO_POINTS)
+              m_records.push_back(values);
+            else if (m_point_type == CSV_CARTESIAN)
+              m_points.push_back(m_conv.csv_to_cartesian(values, m_geo));
+            else
+              m_points.push_back(m_conv.csv_to_cartesian_or_point_height(values, m_geo, true));
+          } else if (!is_first_line) {
+            os << "Failed to read line: " << std::string(ptr, line_end) << "\n";
+          }
+
+          is_first_line = false;
+          ptr = line_end + 1;
+        }
+        m_messages = os.str();
+      }
+    };
+
+    // Read a CSV file in batches of one chunk per thread, with the
+    // chunks of a batch parsed in parallel. The records or points are
+    // returned in the order of the file.
+    class CsvParallelReader: private boost::noncopyable {
+      CsvChunkReader      m_reader;
+      asp::CsvConv const& m_conv;
+      GeoReference        m_geo;
+      CsvPointType        m_point_type;
+      bool                m_is_first_chunk;
+      int                 m_num_threads;
+    public:
+      CsvParallelReader(std::string const& file, asp::CsvConv const& conv,
+                        GeoReference const& geo, CsvPointType point_type):
+        m_reader(file), m_conv(conv), m_geo(geo), m_point_type(point_type),
+        m_is_first_chunk(true),
+        m_num_threads(std::max(int(vw_settings().default_num_threads()), 1)) {}
+
+      // Append the next batch. Returns false at the end of the file.
+      bool read_batch(std::vector<asp::CsvConv::CsvRecord> & records,
+                      std::vector<Vector3> & points) {
+        std::vector<std::string> chunks;
+        std::string chunk;
+        while (int(chunks.size()) < m_num_threads && m_reader.next(chunk)) {
+          chunks.push_back(std::string());
+          chunks.back().swap(chunk);
+        }
+        if (chunks.empty())
+          return false;
+
+        int num_chunks = chunks.size();
+        std::vector< std::vector<asp::CsvConv::CsvRecord> > chunk_records(num_chunks);
+        std::vector< std::vector<Vector3> > chunk_points(num_chunks);
+        std::vector<std::string> messages(num_chunks);
+        vw::FifoWorkQueue queue(std::min(m_num_threads, num_chunks));
+        for (int i = 0; i < num_chunks; i++) {
+          boost::shared_ptr<vw::Task>
+            task(new CsvChunkTask(m_conv, m_geo, m_point_type, chunks[i],
+                                  m_is_first_chunk && i == 0,
+                                  chunk_records[i], chunk_points[i], messages[i]));
+          queue.add_task(task);
+        }
+        queue.join_all();
+        m_is_first_chunk = false;
+
+        for (int i = 0; i < num_chunks; i++) {
+          if (messages[i] != "")
+            vw_out() << messages[i];
+          records.insert(records.end(), chunk_records[i].begin(), chunk_records[i].end());
+          points.insert(points.end(), chunk_points[i].begin(), chunk_points[i].end());
+        }
+        return true;
+      }
+    };
+
+  } // end anonymous namespace
+
+  class BinaryReader: public BaseReader{
+    asp::BinaryCloudReader m_reader;
+    asp::BinaryCloudPoints m_points;
+    int                    m_chunk;
+    size_t                 m_point_index;
+    Vector3                m_curr_point;
+  public:
+
+    // The points are Cartesian, so they are returned as they are
+    BinaryReader(std::string const& file):
+      m_reader(file), m_chunk(0), m_point_index(0){
+      m_num_points = m_reader.num_points();
+      m_has_georef = false;
+    }
+
+    virtual bool ReadNextPoint(){
+      while (m_point_index >= m_points.size()){
+        if (m_chunk >= m_reader.num_chunks())
+          return false; // reached end of file
+        m_reader.read_chunk(m_chunk, m_points);
+        m_chunk++;
+        m_point_index = 0;
+      }
+      m_curr_point = m_points.xyz[m_point_index];
+      m_point_index++;
+      return true;
+    }
+
+    virtual Vector3 GetPoint(){
+      return m_curr_point;
+    }
+
+  }; // End class BinaryReader
+
   class CsvReader: public BaseReader{
     std::string  m_csv_file;
     asp::CsvConv m_csv_conv;
-    bool         m_is_first_line;
-    bool         m_has_valid_point;
     Vector3      m_curr_point;
-    std::ifstream * m_ifs;
+    CsvParallelReader * m_reader;
+    std::vector<asp::CsvConv::CsvRecord> m_records; // Not used, points are returned
+    std::vector<Vector3> m_points; // The points parsed in the current batch
+    size_t       m_point_index;
   public:
 
     CsvReader(std::string const & csv_file,
               asp::CsvConv const& csv_conv,
               GeoReference const& georef)
-      : m_csv_file(csv_file), m_csv_conv(csv_conv),
-        m_is_first_line(true), m_has_valid_point(false){
+      : m_csv_file(csv_file), m_csv_conv(csv_conv), m_reader(NULL), m_point_index(0){
+
+      VW_ASSERT(m_csv_conv.csv_format_str != "",
+                ArgumentErr() << "CsvReader: The CSV format was not specified.\n");
 
       // We will convert from projected space to xyz, unless points
       // are already in this format.
@@ -182,67 +391,269 @@ namespace asp{
       m_georef      = georef;
       m_num_points  = asp::csv_file_size(m_csv_file);
 
-      m_ifs = new std::ifstream ( m_csv_file.c_str() );
-      if ( !*m_ifs ) {
-        vw_throw( vw::IOErr() << "Unable to open file \"" << m_csv_file << "\"" );
+      // Will return projected point and height or xyz. We really
+      // prefer projected points, as then the chipper will have an
+      // easier time grouping spatially points close together, as it
+      // operates the first two coordinates.
+      m_reader = new CsvParallelReader(m_csv_file, m_csv_conv, m_georef, CSV_POINT_HEIGHT);
+    }
+
+    virtual bool ReadNextPoint(){
+
+      // Parse the next batch of lines, in parallel, once the points
+      // of the current batch are used up.
+      while (m_point_index >= m_points.size()){
+        m_points.clear();
+        m_point_index = 0;
+        if (!m_reader->read_batch(m_records, m_points))
+          return false; // reached end of file
       }
 
-      VW_ASSERT(m_csv_conv.csv_format_str != "",
-                ArgumentErr() << "CsvReader: The CSV format was not specified.\n");
+      m_curr_point = m_points[m_point_index];
+      m_point_index++;
+      return true;
+    }
+
+    virtual Vector3 GetPoint(){
+      return m_curr_point;
+    }
 
+    virtual ~CsvReader(){
+      delete m_reader;
+      m_reader = NULL;
     }
 
-    virtual bool ReadNextPoint(){
+  }; // End class CsvReader
+
+
+  // Sorting of the points of a cloud along a Morton (Z-order) curve
+  // over their first two coordinates, so that points which are
+  // consecutive in the sorted order are close together.
+  namespace {
+
+  // A point with its key, as stored in the sorted runs on disk
+  struct SortRecord {
+    vw::uint64 key;
+    double     xyz[3];
+    bool operator<(SortRecord const& other) const { return key < other.key; }
+  };
+
+  // Map a double to an integer with the same order. The keys only need
+  // to be ordered like the coordinates, so no bounding box of the points
+  // needs to be known before they are read.
+  inline vw::uint64 sortable_bits(double val){
+    vw::uint64 bits;
+    memcpy(&bits, &val, sizeof(bits));
+    return (bits >> 63) ? ~bits : (bits | (vw::uint64(1) << 63));
+  }
+
+  // Spread the low 32 bits of a number to the even bits
+  inline vw::uint64 spread_bits(vw::uint64 v){
+    v &= 0xFFFFFFFFULL;
+    v = (v | (v << 16)) & 0x0000FFFF0000FFFFULL;
+    v = (v | (v <<  8)) & 0x00FF00FF00FF00FFULL;
+    v = (v | (v <<  4)) & 0x0F0F0F0F0F0F0F0FULL;
+    v = (v | (v <<  2)) & 0x3333333333333333ULL;
+    v = (v | (v <<  1)) & 0x5555555555555555ULL;
+    return v;
+  }
 
-      std::string line;
-      asp::CsvConv::CsvRecord vals;
+  // Interleave the top 32 bits of the two coordinates. Those keep
+  // about 6 significant digits, which is much finer than a block.
+  inline vw::uint64 morton_key(double x, double y){
+    return (spread_bits(sortable_bits(x) >> 32) << 1) | spread_bits(sortable_bits(y) >> 32);
+  }
+
+  typedef std::vector<SortRecord>::iterator SortIter;
+
+  class SortSegmentTask: public vw::Task, private boost::noncopyable {
+    SortIter m_begin, m_end;
+  public:
+    SortSegmentTask(SortIter begin, SortIter end): m_begin(begin), m_end(end) {}
+    void operator()() { std::sort(m_begin, m_end); }
+  };
+
+  class MergeSegmentsTask: public vw::Task, private boost::noncopyable {
+    SortIter m_begin, m_middle, m_end;
+  public:
+    MergeSegmentsTask(SortIter begin, SortIter middle, SortIter end):
+      m_begin(begin), m_middle(middle), m_end(end) {}
+    void operator()() { std::inplace_merge(m_begin, m_middle, m_end); }
+  };
 
-      // Keep on reading, until a valid point is hit or the end of the file
-      // is reached.
-      while (1){
-	
-        m_has_valid_point = getline(*m_ifs, line, '\n');
-        if (!m_has_valid_point) return m_has_valid_point; // reached end of file
+  // Sort a segment per thread, then merge pairs of segments, in
+  // parallel, until one is left.
+  void parallel_sort(std::vector<SortRecord> & records){
+    size_t num_threads = std::max(int(vw_settings().default_num_threads()), 1);
+    size_t num_segments = std::max(std::min(num_threads, records.size()/1024), size_t(1));
+    std::vector<size_t> bounds;
+    for (size_t i = 0; i <= num_segments; i++)
+      bounds.push_back(records.size()*i/num_segments);
+
+    {
+      vw::FifoWorkQueue queue(num_threads);
+      for (size_t i = 0; i + 1 < bounds.size(); i++)
+        queue.add_task(boost::shared_ptr<vw::Task>
+                       (new SortSegmentTask(records.begin() + bounds[i],
+                                            records.begin() + bounds[i+1])));
+      queue.join_all();
+    }
 
-        vals = m_csv_conv.parse_csv_line(m_is_first_line, m_has_valid_point, line);
-        if (m_has_valid_point) break;
+    while (bounds.size() > 2){
+      std::vector<size_t> merged_bounds;
+      vw::FifoWorkQueue queue(num_threads);
+      size_t i = 0;
+      for (; i + 2 < bounds.size(); i += 2){
+        queue.add_task(boost::shared_ptr<vw::Task>
+                       (new MergeSegmentsTask(records.begin() + bounds[i],
+                                              records.begin() + bounds[i+1],
+                                              records.begin() + bounds[i+2])));
+        merged_bounds.push_back(bounds[i]);
       }
+      for (; i < bounds.size(); i++)
+        merged_bounds.push_back(bounds[i]);
+      queue.join_all();
+      bounds.swap(merged_bounds);
+    }
+  }
 
-      // Will return projected point and height or xyz. We really
-      // prefer projected points, as then the chipper will have an
-      // easier time grouping spatially points close together, as it
-      // operates the first two coordinates.
-      bool return_point_height = true;
-      m_curr_point
-	= m_csv_conv.csv_to_cartesian_or_point_height(vals, m_georef, return_point_height);
+  void write_sort_records(std::string const& file, std::vector<SortRecord> const& records,
+                          bool keys_too){
+    std::ofstream ofs(file.c_str(), std::ios::out | std::ios::binary);
+    for (size_t i = 0; i < records.size(); i++){
+      if (keys_too)
+        ofs.write(reinterpret_cast<const char*>(&records[i]), sizeof(SortRecord));
+      else
+        ofs.write(reinterpret_cast<const char*>(records[i].xyz), sizeof(records[i].xyz));
+    }
+    ofs.close();
+    if (!ofs)
+      vw_throw( IOErr() << "Failed writing file \"" << file << "\"" );
+  }
 
-      return m_has_valid_point;
+  // Read the records of a sorted run with a buffer
+  class SortRunReader: private boost::noncopyable {
+    std::ifstream           m_ifs;
+    std::vector<SortRecord> m_buffer;
+    size_t                  m_pos;
+  public:
+    SortRunReader(std::string const& file):
+      m_ifs(file.c_str(), std::ios::in | std::ios::binary), m_pos(0){
+      if (!m_ifs)
+        vw_throw( IOErr() << "Unable to open file \"" << file << "\"" );
+    }
+    bool next(SortRecord & record){
+      if (m_pos >= m_buffer.size()){
+        m_buffer.resize(65536);
+        m_ifs.read(reinterpret_cast<char*>(&m_buffer[0]), m_buffer.size()*sizeof(SortRecord));
+        m_buffer.resize(m_ifs.gcount()/sizeof(SortRecord));
+        m_pos = 0;
+        if (m_buffer.empty())
+          return false;
+      }
+      record = m_buffer[m_pos];
+      m_pos++;
+      return true;
     }
+  };
 
-    virtual Vector3 GetPoint(){
-      return m_curr_point;
+  // The next record of each run, with the smallest key on top of the heap
+  struct RunHead {
+    SortRecord record;
+    size_t     run;
+    bool operator<(RunHead const& other) const { return other.record < record; }
+  };
+
+  /// Read all the points of a reader, sort them along a Morton curve,
+  /// and write them to a file of raw doubles, three per point. The
+  /// points are sorted in memory in runs of a fixed size, in parallel,
+  /// and the runs are merged on disk, so the memory use does not depend
+  /// on the number of points. Returns the number of points.
+  boost::uint64_t sort_points_to_file(asp::BaseReader * reader, std::string const& sorted_file){
+
+    const size_t RUN_SIZE = 1 << 22; // 128 MB of records
+
+    boost::uint64_t num_points = 0;
+    std::vector<std::string> run_files;
+    std::vector<SortRecord> records;
+    records.reserve(std::min(RUN_SIZE, size_t(reader->m_num_points)));
+    bool has_points = true;
+    while (has_points){
+      has_points = reader->ReadNextPoint();
+      if (has_points){
+        Vector3 p = reader->GetPoint();
+        SortRecord record;
+        record.key = morton_key(p[0], p[1]);
+        for (int c = 0; c < 3; c++)
+          record.xyz[c] = p[c];
+        records.push_back(record);
+        num_points++;
+      }
+      if (records.size() < RUN_SIZE && has_points)
+        continue;
+      if (records.empty())
+        break;
+
+      parallel_sort(records);
+      if (!has_points && run_files.empty()){ // all points fit in memory
+        write_sort_records(sorted_file, records, false);
+        return num_points;
+      }
+      std::ostringstream os;
+      os << sorted_file << ".run" << run_files.size();
+      write_sort_records(os.str(), records, true);
+      run_files.push_back(os.str());
+      records.clear();
     }
 
-    virtual ~CsvReader(){
-      delete m_ifs;
-      m_ifs = NULL;
+    // Merge the runs
+    std::ofstream ofs(sorted_file.c_str(), std::ios::out | std::ios::binary);
+    std::vector< boost::shared_ptr<SortRunReader> > runs;
+    std::priority_queue<RunHead> heads;
+    for (size_t i = 0; i < run_files.size(); i++){
+      runs.push_back(boost::shared_ptr<SortRunReader>(new SortRunReader(run_files[i])));
+      RunHead head;
+      head.run = i;
+      if (runs[i]->next(head.record))
+        heads.push(head);
+    }
+    while (!heads.empty()){
+      RunHead head = heads.top();
+      heads.pop();
+      ofs.write(reinterpret_cast<const char*>(head.record.xyz), sizeof(head.record.xyz));
+      if (runs[head.run]->next(head.record))
+        heads.push(head);
     }
+    ofs.close();
+    if (!ofs)
+      vw_throw( IOErr() << "Failed writing file \"" << sorted_file << "\"" );
 
-  }; // End class CsvReader
+    runs.clear();
+    for (size_t i = 0; i < run_files.size(); i++)
+      boost::filesystem::remove(run_files[i]);
+
+    return num_points;
+  }
 
+  } // end anonymous namespace
 
-  /// Create a point cloud image from a las file. The image will be
-  /// created block by block, when it needs to be written to disk. It is
-  /// important that the writer invoking this image be single-threaded,
-  /// as we read from the las file sequentially.
+  /// Create a point cloud image from a file of points sorted along a
+  /// Morton curve. Each tile holds the next TILE_LEN x TILE_LEN points
+  /// in the sorted order, which are close together, and which are
+  /// split into blocks of spatially close points. A tile reads its
+  /// points from its own offset in the file, so tiles can be written
+  /// in parallel.
   template <class ImageT>
   class LasOrCsvToTif_Class : public ImageViewBase< LasOrCsvToTif_Class<ImageT> > {
 
     typedef typename ImageT::pixel_type PixelT;
 
-    asp::BaseReader * m_reader;
+    std::string     m_sorted_file;
+    boost::uint64_t m_num_points;
+    bool            m_has_georef;
+    GeoReference    m_georef;
     int m_rows, m_cols; // These are pixel sizes, not tile counts.
-    int m_block_size;
+    int m_tile_len, m_block_size;
 
   public:
 
@@ -250,10 +661,13 @@ namespace asp{
     typedef PixelT result_type;
     typedef ProceduralPixelAccessor<LasOrCsvToTif_Class> pixel_accessor;
 
-    LasOrCsvToTif_Class(asp::BaseReader * reader, int num_rows, int tile_len, int block_size):
-      m_reader(reader), m_block_size(block_size){
+    LasOrCsvToTif_Class(std::string const& sorted_file, boost::uint64_t num_points,
+                        bool has_georef, GeoReference const& georef,
+                        int num_rows, int tile_len, int block_size):
+      m_sorted_file(sorted_file), m_num_points(num_points),
+      m_has_georef(has_georef), m_georef(georef),
+      m_tile_len(tile_len), m_block_size(block_size){
 
-      boost::uint64_t num_points = m_reader->m_num_points;
       int num_row_tiles = std::max(1, (int)ceil(double(num_rows)/tile_len));
       m_rows = tile_len*num_row_tiles;
 
@@ -276,33 +690,38 @@ namespace asp{
     typedef CropView<ImageView<PixelT> > prerasterize_type;
     inline prerasterize_type prerasterize( BBox2i const& bbox ) const{
 
-      // Read a chunk of the las file, and store it in the current tile.
-
       int num_cols = bbox.width();
       int num_rows = bbox.height();
 
-      VW_ASSERT((num_rows % m_block_size == 0) && (num_cols % m_block_size == 0),
-                ArgumentErr() << "LasOrCsvToTif_Class: Expecting the number of rows "
-                              << "to be a multiple of the block size.\n");
+      VW_ASSERT(num_cols == m_tile_len && num_rows == m_tile_len &&
+                bbox.min().x() % m_tile_len == 0 && bbox.min().y() % m_tile_len == 0,
+                ArgumentErr() << "LasOrCsvToTif_Class: Expecting to write whole tiles.\n");
+
+      // The points of this tile, with the tiles numbered row by row
+      boost::uint64_t tile_index = boost::uint64_t(bbox.min().y()/m_tile_len)*(m_cols/m_tile_len)
+        + bbox.min().x()/m_tile_len;
+      boost::uint64_t begin = std::min(tile_index*num_cols*num_rows, m_num_points);
+      boost::uint64_t end   = std::min(begin + num_cols*num_rows, m_num_points);
 
-      // Read the specified number of points from the file
-      int max_num_pts_to_read = num_cols*num_rows;
-      int count = 0;
       PointBuffer in;
-      std::vector<PointBuffer> outVec;
-      while (m_reader->ReadNextPoint()){
-        in.push_back(m_reader->GetPoint());
-        count++;
-        if (count >= max_num_pts_to_read)
-          break;
+      if (end > begin){
+        std::vector<double> vals(3*(end - begin));
+        std::ifstream ifs(m_sorted_file.c_str(), std::ios::in | std::ios::binary);
+        ifs.seekg(begin*3*sizeof(double));
+        ifs.read(reinterpret_cast<char*>(&vals[0]), vals.size()*sizeof(double));
+        if (!ifs)
+          vw_throw( IOErr() << "Failed reading file \"" << m_sorted_file << "\"" );
+        for (boost::uint64_t i = 0; i < end - begin; i++)
+          in.push_back(Vector3(vals[3*i], vals[3*i+1], vals[3*i+2]));
       }
 
-      // Take the points just read, and put them in groups by spatial
-      // location, so that later point2dem does not need to read every
-      // input point when writing a given tile, but only certain
-      // groups.
+      // Put the points in groups by spatial location, so that later
+      // point2dem does not need to read every input point when writing
+      // a given tile, but only certain groups. The georef is copied, as
+      // its projection cannot be shared among threads.
+      GeoReference georef = m_georef;
       ImageView<Vector3> Img;
-      Chipper(in, m_block_size, m_reader->m_has_georef, m_reader->m_georef, num_cols, num_rows, Img);
+      Chipper(in, m_block_size, m_has_georef, georef, num_cols, num_rows, Img);
 
       VW_ASSERT(num_cols == Img.cols() && num_rows == Img.rows(),
                 ArgumentErr() << "LasOrCsvToTif_Class: Size mis-match.\n");
@@ -318,6 +737,143 @@ namespace asp{
 
   }; // End class LasOrCsvToTif_Class
 
+  /// Bin points into square spatial buckets and write each bucket
+  /// to a raw file as one or more blocks of block_size x block_size
+  /// points in Cartesian coordinates. A block is written as soon as
+  /// its bucket fills up, so only partially filled buckets are kept
+  /// in memory. If too many points are buffered, all buckets are
+  /// written out, each only up to its last filled row of block_size
+  /// points, padded with invalid (zero) points.
+  class RawBlockBinner {
+
+    std::ofstream       m_ofs;
+    size_t              m_block_len;
+    double              m_bucket_len;
+    size_t              m_max_buffered;
+    size_t              m_num_buffered;
+    size_t              m_row_len;
+    boost::uint64_t     m_num_rows;
+    std::vector<double> m_buf;
+
+    typedef std::pair<boost::int64_t, boost::int64_t> BucketKey;
+    typedef std::map<BucketKey, std::vector<Vector3> > BucketMap;
+    BucketMap m_buckets;
+
+    // Write the points of a bucket, as whole rows
+    void write_block(std::vector<Vector3> & pts){
+      size_t num_rows = std::max((pts.size() + m_row_len - 1)/m_row_len, size_t(1));
+      size_t len      = 3*num_rows*m_row_len;
+      std::fill(m_buf.begin(), m_buf.begin() + len, 0.0);
+      for (size_t k = 0; k < pts.size(); k++){
+        for (int c = 0; c < 3; c++)
+          m_buf[3*k + c] = pts[k][c];
+      }
+      m_ofs.write(reinterpret_cast<const char*>(&m_buf[0]), len*sizeof(double));
+      pts.clear();
+      m_num_rows += num_rows;
+    }
+
+    void write_all(){
+      for (BucketMap::iterator it = m_buckets.begin(); it != m_buckets.end(); it++){
+        if (!it->second.empty())
+          write_block(it->second);
+      }
+      m_buckets.clear();
+      m_num_buffered = 0;
+    }
+
+  public:
+
+    RawBlockBinner(std::string const& raw_file, int block_size,
+                   double bucket_len, size_t max_buffered):
+      m_ofs(raw_file.c_str(), std::ios::out | std::ios::binary),
+      m_block_len(size_t(block_size)*block_size), m_bucket_len(bucket_len),
+      m_max_buffered(max_buffered), m_num_buffered(0), m_row_len(block_size),
+      m_num_rows(0), m_buf(3*m_block_len){
+      if (!m_ofs)
+        vw_throw( IOErr() << "Unable to open file \"" << raw_file << "\"" );
+    }
+
+    /// Bin a point by its first two coordinates, and store the given
+    /// Cartesian point.
+    void add(Vector3 const& binned_pt, Vector3 const& xyz){
+      BucketKey key(boost::int64_t(floor(binned_pt[0]/m_bucket_len)),
+                    boost::int64_t(floor(binned_pt[1]/m_bucket_len)));
+      std::vector<Vector3> & bucket = m_buckets[key];
+      bucket.push_back(xyz);
+      m_num_buffered++;
+      if (bucket.size() == m_block_len){
+        write_block(bucket);
+        m_num_buffered -= m_block_len;
+      }
+      if (m_num_buffered > m_max_buffered)
+        write_all();
+    }
+
+    /// Write the remaining points and return the number of rows written.
+    boost::uint64_t finish(){
+      write_all();
+      if (m_num_rows == 0){
+        // An image cannot be empty
+        std::vector<Vector3> empty;
+        write_block(empty);
+      }
+      m_ofs.close();
+      if (!m_ofs)
+        vw_throw( IOErr() << "Failed to write the binned points." );
+      return m_num_rows;
+    }
+
+  }; // End class RawBlockBinner
+
+  /// Read all points with the given reader and bin them with
+  /// RawBlockBinner. The bucket size is estimated from the density of
+  /// an initial sample of points, so that a bucket would hold about
+  /// one block. Returns the number of rows written.
+  boost::uint64_t bin_points_to_raw_file(asp::BaseReader * reader,
+                                         std::string const& raw_file,
+                                         int block_size){
+
+    const size_t block_len           = size_t(block_size)*block_size;
+    const size_t NUM_SAMPLE_POINTS   = 16*block_len;
+    const size_t MAX_BUFFERED_POINTS = 1024*block_len; // 400 MB for 128 x 128 blocks
+
+    std::vector<Vector3> sample;
+    BBox2 sample_box;
+    while (sample.size() < NUM_SAMPLE_POINTS && reader->ReadNextPoint()){
+      sample.push_back(reader->GetPoint());
+      sample_box.grow(subvector(sample.back(), 0, 2));
+    }
+    bool has_more = (sample.size() == NUM_SAMPLE_POINTS);
+
+    double bucket_len = 1.0;
+    if (!sample.empty()){
+      double area = sample_box.width()*sample_box.height();
+      if (area > 0)
+        bucket_len = sqrt(area*block_len/sample.size());
+      else
+        bucket_len = std::max(1.0, std::max(sample_box.width(), sample_box.height()));
+    }
+
+    // Points in projected coordinates are binned in the plane, and
+    // converted to Cartesian only once binned.
+    bool has_georef = reader->m_has_georef;
+    GeoReference const& georef = reader->m_georef;
+    RawBlockBinner binner(raw_file, block_size, bucket_len, MAX_BUFFERED_POINTS);
+    Vector3 p, xyz;
+    for (size_t k = 0; k < sample.size() || (has_more && reader->ReadNextPoint()); k++){
+      p = (k < sample.size()) ? sample[k] : reader->GetPoint();
+      xyz = p;
+      if (has_georef){
+        Vector2 ll = georef.point_to_lonlat(subvector(p, 0, 2));
+        xyz = georef.datum().geodetic_to_cartesian(Vector3(ll[0], ll[1], p[2]));
+      }
+      binner.add(p, xyz);
+    }
+
+    return binner.finish();
+  }
+
 } // namespace asp
 
 //------------------------------------------------------------------------------------------
@@ -514,65 +1070,69 @@ bool asp::CsvConv::parse_georef(vw::cartography::GeoReference & georef) const {
 
 #include <iomanip>
 
-asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool & success,
-                                                     std::string const& line) const {
-  // Parse a CSV file line in given format
-  success = true;
-
-  // Copy the input line into a temporary buffer
-  const int bufSize = 2048;
-  char temp[bufSize];
-  strncpy(temp, line.c_str(), bufSize);
-
-  std::string sep = asp::csv_separator();
+bool asp::CsvConv::parse_csv_fields(const char* begin, const char* end,
+                                    CsvRecord & values) const {
 
+  // Split the line on separators, with runs of separators counting as
+  // one, as strtok() does, but without copying the line.
   int col_index = -1; // The current column we are reading
   int num_floats_read = 0;
   int num_values_read = 0;
-
-  CsvRecord values;
-  // Be prepared for the fact that the first line may be the header,
-  // so almost certainly we won't read it correctly, but don't
-  // complain about it.
-  if (!line.empty() && line[0] == '#') {
-    if (!is_first_line) vw_out() << "Ignoring line starting with comment: " << line << std::endl;
-    success = false;
-    is_first_line = false;
-    return values;
-  }
-
-  char * ptr = temp;
-  while(1){
-
+  const char* ptr = begin;
+  while (num_values_read < this->num_targets){
+
+    while (ptr < end && is_csv_separator(*ptr))
+      ptr++;
+    if (ptr >= end) break; // no more tokens
+    const char* token = ptr;
+    while (ptr < end && !is_csv_separator(*ptr))
+      ptr++;
     col_index++; // Increment the column counter
-    const char* token = strtok(ptr, sep.c_str());  // Split line on seperator char
-    ptr = NULL; // After the first call, strtok expects a null pointer as input.
-    if ( token == NULL ) break; // no more tokens
-    if ( num_values_read >= this->num_targets ) break; // read enough values
 
     // Check if this is one of the columns we need to read
-    if (this->col2name.find(col_index) == this->col2name.end())
+    std::map<int, std::string>::const_iterator it = this->col2name.find(col_index);
+    if (it == this->col2name.end())
       continue;
 
-    if (this->col2name.at(col_index) == "file") // This is a string input
-      values.file = token;
+    if (it->second == "file") // This is a string input
+      values.file.assign(token, ptr);
     else {
-      // Parse the floating point value from the token
-      double val;
-      int flag = sscanf(token, "%lg", &val);
-      if (flag == 0){ // Handle parsing failure
-        success = false;
-        break;
-      }
+      // Parse the floating point value from the token. Leading white
+      // space, such as a carriage return, would let strtod() read on
+      // into the next line.
+      if (isspace(*token))
+        return false;
+      char * num_end;
+      double val = strtod(token, &num_end);
+      if (num_end == token) // Handle parsing failure
+        return false;
       values.point_data[num_floats_read] = val;
       num_floats_read++;
     }
     num_values_read++;
 
   } // End loop through columns
-  
-  if (num_values_read != this->num_targets)
+
+  return (num_values_read == this->num_targets);
+}
+
+asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool & success,
+                                                     std::string const& line) const {
+  // Parse a CSV file line in given format
+  success = true;
+
+  CsvRecord values;
+  // Be prepared for the fact that the first line may be the header,
+  // so almost certainly we won't read it correctly, but don't
+  // complain about it.
+  if (!line.empty() && line[0] == '#') {
+    if (!is_first_line) vw_out() << "Ignoring line starting with comment: " << line << std::endl;
     success = false;
+    is_first_line = false;
+    return values;
+  }
+
+  success = parse_csv_fields(line.c_str(), line.c_str() + line.size(), values);
 
   if (!success){
     if (!is_first_line){
@@ -591,27 +1151,31 @@ size_t asp::CsvConv::read_csv_file(std::string    const & file_path,
   // Clear output object
   output_list.clear();
 
-  // Open input file
-  std::ifstream file( file_path.c_str() );
-  if( !file )
-    vw_throw( vw::IOErr() << "Unable to open file \"" << file_path << "\"" );
-
-  // Read through all the lines of the input file, parse each line, and build the output list.
-  bool success;
-  bool first_line = true;
-  std::string line = "";
-  while ( std::getline(file, line, '\n') ){
-    CsvRecord new_record = asp::CsvConv::parse_csv_line(first_line, success, line);
-    if (success)
-      output_list.push_back(new_record);
-    first_line = false;
+  // Parse the file in chunks of lines, in parallel, and build the output list.
+  CsvParallelReader reader(file_path, *this, GeoReference(), CSV_NO_POINTS);
+  std::vector<CsvRecord> records;
+  std::vector<Vector3> points; // not used
+  while (reader.read_batch(records, points)){
+    output_list.insert(output_list.end(), records.begin(), records.end());
+    records.clear();
   }
 
-  file.close();
-
   return output_list.size();
 }
 
+size_t asp::CsvConv::read_csv_file(std::string const& file_path,
+                                   vw::cartography::GeoReference const& geo,
+                                   std::vector<vw::Vector3> & points) const {
+  points.clear();
+
+  // The records are converted as they are parsed, so they are not kept
+  CsvParallelReader reader(file_path, *this, geo, CSV_CARTESIAN);
+  std::vector<CsvRecord> records; // not used
+  while (reader.read_batch(records, points)) {}
+
+  return points.size();
+}
+
 
 vw::Vector3 asp::CsvConv::sort_parsed_vector3(CsvRecord const& csv) const {
   Vector3 ordered_csv;
@@ -842,36 +1406,107 @@ void asp::las_or_csv_to_tif(std::string const& in_file,
   Vector2 original_tile_size = opt->raster_tile_size;
   opt->raster_tile_size = tile_size;
 
+  // Sort the points along a Morton curve, so that each tile, and each
+  // block within it, has points which are close together.
+  std::string sorted_file = boost::filesystem::path(out_file).replace_extension(".sorted").string();
+  boost::uint64_t num_points = 0;
+  bool has_georef = false;
+  GeoReference georef;
   if (asp::is_csv(in_file)){ // CSV
-
-    boost::shared_ptr<asp::CsvReader> csvReaderPtr( new asp::CsvReader(in_file, csv_conv, csv_georef) );
-    ImageViewRef<Vector3> Img
-      = asp::LasOrCsvToTif_Class< ImageView<Vector3> > (csvReaderPtr.get(), num_rows, TILE_LEN, block_size);
-
-    // Must use a thread only, as we read the las file serially.
-    vw::cartography::write_gdal_image(out_file, Img, *opt, TerminalProgressCallback("asp", "\t--> ") );
-
+    asp::CsvReader reader(in_file, csv_conv, csv_georef);
+    num_points = sort_points_to_file(&reader, sorted_file);
+    has_georef = reader.m_has_georef;
+    georef     = reader.m_georef;
   }else if (asp::is_las(in_file)){ // LAS
-
     std::ifstream ifs;
     ifs.open(in_file.c_str(), std::ios::in | std::ios::binary);
     liblas::ReaderFactory f;
-    liblas::Reader reader = f.CreateWithStream(ifs);
-    boost::shared_ptr<asp::LasReader> lasReaderPtr( new asp::LasReader(reader) );
-    ImageViewRef<Vector3> Img
-      = asp::LasOrCsvToTif_Class< ImageView<Vector3> > (lasReaderPtr.get(), num_rows, TILE_LEN, block_size);
-
-    // Must use a thread only, as we read the las file serially.
-    vw::cartography::write_gdal_image(out_file, Img, *opt, TerminalProgressCallback("asp", "\t--> ") );
+    liblas::Reader las_reader = f.CreateWithStream(ifs);
+    asp::LasReader reader(las_reader);
+    num_points = sort_points_to_file(&reader, sorted_file);
+    has_georef = reader.m_has_georef;
+    georef     = reader.m_georef;
+  }else if (asp::is_binary_cloud(in_file)){ // Binary cloud
+    asp::BinaryReader reader(in_file);
+    num_points = sort_points_to_file(&reader, sorted_file);
+    has_georef = reader.m_has_georef;
+    georef     = reader.m_georef;
   }else
     vw_throw( ArgumentErr() << "Unknown file type: " << in_file << "\n");
 
+  // The tiles read their own parts of the sorted file, so they are
+  // written in parallel.
+  ImageViewRef<Vector3> Img
+    = asp::LasOrCsvToTif_Class< ImageView<Vector3> > (sorted_file, num_points, has_georef, georef,
+                                                      num_rows, TILE_LEN, block_size);
+  vw::cartography::block_write_gdal_image(out_file, Img, *opt,
+                                          TerminalProgressCallback("asp", "\t--> ") );
+  boost::filesystem::remove(sorted_file);
+
   // Restore the original tile size
   opt->raster_tile_size = original_tile_size;
 
 }
 
 
+void asp::las_or_csv_to_raw_buckets(std::string const& in_file,
+                                    std::string const& raw_file,
+                                    std::string const& header_file,
+                                    int block_size,
+                                    vw::cartography::GeoReference const& csv_georef,
+                                    asp::CsvConv const& csv_conv) {
+
+  vw_out() << "Binning points into temporary file: " << raw_file << std::endl;
+
+  boost::uint64_t num_rows = 0;
+  if (asp::is_csv(in_file)){ // CSV
+    asp::CsvReader reader(in_file, csv_conv, csv_georef);
+    num_rows = bin_points_to_raw_file(&reader, raw_file, block_size);
+  }else if (asp::is_las(in_file)){ // LAS
+    std::ifstream ifs;
+    ifs.open(in_file.c_str(), std::ios::in | std::ios::binary);
+    liblas::ReaderFactory f;
+    liblas::Reader las_reader = f.CreateWithStream(ifs);
+    asp::LasReader reader(las_reader);
+    num_rows = bin_points_to_raw_file(&reader, raw_file, block_size);
+  }else if (asp::is_binary_cloud(in_file)){ // Binary cloud
+    asp::BinaryReader reader(in_file);
+    num_rows = bin_points_to_raw_file(&reader, raw_file, block_size);
+  }else
+    vw_throw( ArgumentErr() << "Unknown file type: " << in_file << "\n");
+
+  if (num_rows > boost::uint64_t(std::numeric_limits<int32>::max()))
+    vw_throw( ArgumentErr() << "Too many points in: " << in_file << "\n");
+
+  // The blocks are stacked vertically in an image block_size pixels
+  // wide, so that each block is contiguous on disk. GDAL reads the
+  // raw file via this VRT header.
+  int one = 1;
+  bool little_endian = (*reinterpret_cast<char*>(&one) == 1);
+  int pixel_len = 3*sizeof(double);
+
+  std::ofstream ofs(header_file.c_str());
+  if (!ofs)
+    vw_throw( IOErr() << "Unable to open file \"" << header_file << "\"" );
+  ofs << "<VRTDataset rasterXSize=\"" << block_size << "\" rasterYSize=\""
+      << num_rows << "\">\n";
+  for (int band = 0; band < 3; band++){
+    ofs << "  <VRTRasterBand dataType=\"Float64\" band=\"" << band + 1
+        << "\" subClass=\"VRTRawRasterBand\">\n"
+        << "    <SourceFilename relativeToVRT=\"1\">"
+        << boost::filesystem::path(raw_file).filename().string() << "</SourceFilename>\n"
+        << "    <ImageOffset>" << band*sizeof(double) << "</ImageOffset>\n"
+        << "    <PixelOffset>" << pixel_len << "</PixelOffset>\n"
+        << "    <LineOffset>"  << pixel_len*block_size << "</LineOffset>\n"
+        << "    <ByteOrder>"   << (little_endian ? "LSB" : "MSB") << "</ByteOrder>\n"
+        << "  </VRTRasterBand>\n";
+  }
+  ofs << "</VRTDataset>\n";
+  ofs.close();
+  if (!ofs)
+    vw_throw( IOErr() << "Failed writing file \"" << header_file << "\"" );
+}
+
 bool asp::is_las(std::string const& file){
   std::string lfile = boost::to_lower_copy(file);
   return (boost::iends_with(lfile, ".las")  || boost::iends_with(lfile, ".laz"));
@@ -886,6 +1521,10 @@ bool asp::is_las_or_csv(std::string const& file){
   return asp::is_las(file) || is_csv(file);
 }
 
+bool asp::is_las_csv_or_binary(std::string const& file){
+  return asp::is_las_or_csv(file) || asp::is_binary_cloud(file);
+}
+
 bool asp::georef_from_las(std::string const& las_file,
                           vw::cartography::GeoReference & georef){
 
@@ -919,6 +1558,15 @@ bool asp::georef_from_pc_files(std::vector<std::string> const& files,
   for (int i = 0; i < (int)files.size(); i++){
     GeoReference local_georef;
 
+    // Binary clouds keep the georef in their header
+    if (is_binary_cloud(files[i])){
+      asp::BinaryCloudReader reader(files[i]);
+      if (!reader.has_georef())
+        continue;
+      georef = reader.georef();
+      return true;
+    }
+
     // Sometimes ASP PC files can have georef, written there by stereo
     try {
       if (!is_las(files[i]) && read_georeference(local_georef, files[i])){
@@ -1015,15 +1663,28 @@ bool asp::is_valid_csv_line(std::string const& line){
 
 boost::uint64_t asp::csv_file_size(std::string const& file){
 
-  std::ifstream fh( file.c_str() );
-  if( !fh )
-    vw_throw( vw::IOErr() << "Unable to open file \"" << file << "\"" );
-
-  int num_total_points = 0;
-  std::string line;
-  while ( getline(fh, line, '\n') ){
-    if (!asp::is_valid_csv_line(line)) continue;
-    num_total_points++;
+  // Count the lines which is_valid_csv_line() accepts, reading the
+  // file in large chunks rather than line by line.
+  CsvChunkReader reader(file);
+  boost::uint64_t num_total_points = 0;
+  std::string chunk;
+  while (reader.next(chunk)){
+    const char* ptr       = chunk.c_str();
+    const char* chunk_end = ptr + chunk.size();
+    while (ptr < chunk_end){
+      const char* line_end = (const char*)memchr(ptr, '\n', chunk_end - ptr);
+      if (line_end == NULL)
+        line_end = chunk_end;
+      if (*ptr != '#'){
+        for (const char* c = ptr; c < line_end; c++){
+          if (*c != ' ' && *c != '\t'){
+            num_total_points++;
+            break;
+          }
+        }
+      }
+      ptr = line_end + 1;
+    }
   }
 
   return num_total_points;
@@ -1051,10 +1712,51 @@ std::string asp::prefix_from_pointcloud_filename(std::string const& filename) {
   return result;
 }
 
+namespace {
+
+  // Grow a shared bounding box with the valid points of one block of a cloud
+  class PointCloudBBoxTask: public vw::Task, private boost::noncopyable {
+    vw::ImageViewRef<vw::Vector3> m_image;
+    vw::BBox2i m_block;
+    bool m_is_geodetic;
+    vw::BBox3 & m_bbox;
+    vw::Mutex & m_mutex;
+    vw::ProgressCallback const& m_progress;
+    double m_inc_amt;
+
+  public:
+    PointCloudBBoxTask(vw::ImageViewRef<vw::Vector3> const& image, vw::BBox2i const& block,
+                       bool is_geodetic, vw::BBox3 & bbox, vw::Mutex & mutex,
+                       vw::ProgressCallback const& progress, double inc_amt):
+      m_image(image), m_block(block), m_is_geodetic(is_geodetic), m_bbox(bbox),
+      m_mutex(mutex), m_progress(progress), m_inc_amt(inc_amt) {}
+
+    void operator()() {
+      vw::ImageView<vw::Vector3> tile = crop(m_image, m_block);
+      vw::BBox3 local_bbox;
+      for (int row = 0; row < tile.rows(); row++) {
+        for (int col = 0; col < tile.cols(); col++) {
+          vw::Vector3 const& pt = tile(col, row);
+          if ( (!m_is_geodetic && pt != vw::Vector3()) ||
+               (m_is_geodetic  &&  !boost::math::isnan(pt.z())) )
+            local_bbox.grow(pt);
+        }
+      }
+
+      vw::Mutex::Lock lock(m_mutex);
+      if (local_bbox != vw::BBox3()) // growing by a box with no points would break it
+        m_bbox.grow(local_bbox);
+      m_progress.report_incremental_progress(m_inc_amt);
+    }
+  };
+
+}
+
 // Compute bounding box of the given cloud. If is_geodetic is false,
 // that means a cloud of raw xyz cartesian values, then Vector3()
 // signifies no-data. If is_geodetic is true, no-data is suggested
 // by having the z component of the point be NaN.
+// The cloud is read in blocks, in parallel.
 vw::BBox3 asp::pointcloud_bbox(vw::ImageViewRef<vw::Vector3> const& point_image,
                                bool is_geodetic) {
 
@@ -1062,20 +1764,111 @@ vw::BBox3 asp::pointcloud_bbox(vw::ImageViewRef<vw::Vector3> const& point_image,
   vw::vw_out() << "Computing the point cloud bounding box.\n";
   vw::TerminalProgressCallback progress_bar("asp", "\t--> ");
 
-  for (int row=0; row < point_image.rows(); ++row ) {
-    progress_bar.report_fractional_progress(row, point_image.rows());
-    for (int col=0; col < point_image.cols(); ++col ) {
-      vw::Vector3 pt = point_image(col, row);
-      if ( (!is_geodetic && pt != vw::Vector3()) ||
-           (is_geodetic  &&  !boost::math::isnan(pt.z())) )
-        result.grow(pt);
-    }
+  int block_size = vw::vw_settings().default_tile_size();
+  std::vector<vw::BBox2i> blocks = subdivide_bbox(point_image, block_size, block_size);
+  if (blocks.empty())
+    return result;
+
+  vw::FifoWorkQueue queue(vw::vw_settings().default_num_threads());
+  vw::Mutex mutex;
+  double inc_amt = 1.0 / double(blocks.size());
+  for (size_t i = 0; i < blocks.size(); i++) {
+    boost::shared_ptr<PointCloudBBoxTask>
+      task(new PointCloudBBoxTask(point_image, blocks[i], is_geodetic, result,
+                                  mutex, progress_bar, inc_amt));
+    queue.add_task(task);
   }
+  queue.join_all();
   progress_bar.report_finished();
 
   return result;
 }
 
+void asp::cartesian_to_projected(ImageView<Vector3> & points,
+                                 GeoReference const& georef,
+                                 double lon_center, Vector3 const& offset){
+
+  double nan = std::numeric_limits<double>::quiet_NaN();
+
+  // Gather the valid points
+  std::vector<Vector2i> pos;
+  std::vector<double> x, y, z;
+  for (int row = 0; row < points.rows(); row++) {
+    for (int col = 0; col < points.cols(); col++) {
+      Vector3 const& xyz = points(col, row);
+      if (xyz == Vector3()) {
+        points(col, row) = Vector3(0, 0, nan);
+        continue;
+      }
+      pos.push_back(Vector2i(col, row));
+      x.push_back(xyz[0]);
+      y.push_back(xyz[1]);
+      z.push_back(xyz[2]);
+    }
+  }
+  size_t num = pos.size();
+  if (num == 0)
+    return;
+
+  // Cartesian to geodetic, the way Datum::cartesian_to_geodetic() does
+  // it for one point. A datum with a meridian offset is left to it.
+  Datum const& datum = georef.datum();
+  bool batched = (datum.meridian_offset() == 0);
+  if (batched) {
+    double a  = datum.semi_major_axis(), b = datum.semi_minor_axis();
+    double es = 1.0 - (b*b)/(a*a);
+    batched = (pj_geocentric_to_geodetic(a, es, num, 1, &x[0], &y[0], &z[0]) == 0);
+  }
+
+  CenterLongitudeFunc recenter(lon_center);
+  PointOffsetFunc     add_offset(offset);
+  std::vector<Vector3> llh(num);
+  for (size_t i = 0; i < num; i++) {
+    Vector3 p;
+    if (batched)
+      p = Vector3(x[i]*180.0/M_PI, y[i]*180.0/M_PI, z[i]);
+    else
+      p = datum.cartesian_to_geodetic(points(pos[i][0], pos[i][1]));
+    llh[i] = add_offset(recenter(p));
+  }
+
+  // Lon-lat to projected coordinates, all points at once, with a proj4
+  // context of our own, so that threads can do this concurrently.
+  bool projected = false;
+  if (georef.is_projected()) {
+    projCtx ctx = pj_ctx_alloc();
+    projPJ  dst = pj_init_plus_ctx(ctx, georef.overall_proj4_str().c_str());
+    projPJ  src = (dst == NULL) ? NULL : pj_latlong_from_proj(dst);
+    if (src != NULL) {
+      for (size_t i = 0; i < num; i++) {
+        x[i] = llh[i][0]*M_PI/180.0;
+        y[i] = llh[i][1]*M_PI/180.0;
+      }
+      projected = (pj_transform(src, dst, num, 1, &x[0], &y[0], NULL) == 0);
+    }
+    if (src != NULL) pj_free(src);
+    if (dst != NULL) pj_free(dst);
+    pj_ctx_free(ctx);
+  }
+
+  for (size_t i = 0; i < num; i++) {
+    Vector3 & out = points(pos[i][0], pos[i][1]);
+    if (projected) {
+      if (x[i] == HUGE_VAL || y[i] == HUGE_VAL)
+        out = Vector3(0, 0, nan);
+      else
+        out = Vector3(x[i], y[i], llh[i][2]);
+      continue;
+    }
+    // Not projected, or proj4 failed, so go one point at a time
+    try {
+      out = georef.geodetic_to_point(llh[i]);
+    } catch(...) {
+      out = Vector3(0, 0, nan);
+    }
+  }
+}
+
 // Find the average longitude for a given point image with lon, lat, height values
 double asp::find_avg_lon(ImageViewRef<Vector3> const& point_image){
 
@@ -1105,6 +1898,8 @@ std::string asp::get_cloud_type(std::string const& file_name){
     return "CSV";
   if (asp::is_las(file_name))
     return "LAS";
+  if (asp::is_binary_cloud(file_name))
+    return "BINARY";
 
   // Note that any tif, ntf, and cub file with one channel with georeference be
   // interpreted as a DEM.
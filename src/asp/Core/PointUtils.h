@@ -23,24 +23,22 @@
 #ifndef __ASP_CORE_POINT_UTILS_H__
 #define __ASP_CORE_POINT_UTILS_H__
 
+#include <algorithm>
 #include <string>
+#include <vector>
 #include <vw/Core/Functors.h>
+#include <vw/Image/BlockRasterize.h>
 #include <vw/Image/PerPixelViews.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/Matrix.h>
 #include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Manipulation.h>
 #include <vw/Mosaic/ImageComposite.h>
 #include <vw/FileIO/DiskImageUtils.h>
+#include <vw/Cartography/GeoReference.h>
 
 #include <asp/Core/Common.h>
 
-namespace vw{
-  namespace cartography{
-    class Datum;
-    class GeoReference;
-  }
-}
-
 namespace asp {
 
 
@@ -106,11 +104,25 @@ namespace asp {
     CsvRecord parse_csv_line(bool & is_first_line, bool & success,
                               std::string const& line) const;
 
+    /// Extract the values we care about from the characters of one line
+    /// in [begin, end). The line must be followed in memory by a character
+    /// which cannot continue a number, such as a newline or a null
+    /// terminator. Unlike parse_csv_line(), comments are not skipped and
+    /// nothing is printed. Returns false if the line could not be parsed.
+    bool parse_csv_fields(const char* begin, const char* end, CsvRecord & values) const;
+
     /// Reads an entire CSV file and stores a record for each line.
-    /// - Intended for use with smaller files.
+    /// - The file is read in large chunks ending at line boundaries,
+    ///   which are parsed in parallel.
     size_t read_csv_file(std::string const    & file_path,
                              std::list<CsvRecord> & output_list) const;
 
+    /// Reads an entire CSV file and converts each line to a Cartesian
+    /// point, as csv_to_cartesian() does, in parallel as above.
+    size_t read_csv_file(std::string const& file_path,
+                         vw::cartography::GeoReference const& geo,
+                         std::vector<vw::Vector3> & points) const;
+
     /// Convert values read from a csv file using parse_csv_line (in the same order they appear in the file)
     /// to a Cartesian point. If return_point_height is true, and the csv point is not
     /// in xyz format, return instead the projected point and height above datum.
@@ -172,9 +184,12 @@ namespace asp {
   }; // End class CsvConv
 
 
-  /// Fetch a chunk of the las file of area TILE_LEN x TILE_LEN,
-  /// split it into bins of spatially close points, and write
-  /// it to disk as a tile in a vector tif image.
+  /// Sort the points of a LAS, CSV, or binary cloud file along a Morton
+  /// curve, with an external sort whose runs are sorted in parallel.
+  /// Then write them as a vector tif image, whose tiles of area
+  /// TILE_LEN x TILE_LEN each hold consecutive sorted points, split
+  /// into bins of spatially close points. The tiles are written in
+  /// parallel.
   void las_or_csv_to_tif(std::string const& in_file,
                          std::string const& out_file,
                          int num_rows, int block_size,
@@ -183,9 +198,25 @@ namespace asp {
                          asp::CsvConv const& csv_conv);
 
 
+  /// Read a LAS, CSV, or binary cloud file in a single pass, bin its points into
+  /// spatial buckets, and write them to a raw file as blocks of
+  /// block_size x block_size Cartesian points, each block holding
+  /// points from one bucket. Partially filled buckets are written only
+  /// up to their last filled row. Also write a GDAL VRT header for the
+  /// raw file, which can then be read as any point cloud. This needs no
+  /// temporary tif, and the memory use does not depend on the number
+  /// of points.
+  void las_or_csv_to_raw_buckets(std::string const& in_file,
+                                 std::string const& raw_file,
+                                 std::string const& header_file,
+                                 int block_size,
+                                 vw::cartography::GeoReference const& csv_georef,
+                                 asp::CsvConv const& csv_conv);
+
   bool is_las       (std::string const& file); ///< Return true if this is a LAS file
   bool is_csv       (std::string const& file); ///< Return true if this is a CSV file
   bool is_las_or_csv(std::string const& file); ///< Return true if this file is LAS or CSV format
+  bool is_las_csv_or_binary(std::string const& file); ///< Return true if this file is LAS, CSV, or a binary cloud
 
   /// Builds a GeoReference from a LAS file
   bool georef_from_las(std::string const& las_file,
@@ -228,13 +259,113 @@ namespace asp {
   std::string prefix_from_pointcloud_filename(std::string const& filename);
 
 
+  /// The first m channels of a point cloud file written by ASP, read
+  /// a tile at a time. Each tile is decoded as doubles straight into
+  /// one buffer, and the shift the cloud was written with is added back
+  /// in the same pass, except to the points which are (0, 0, 0).
+  template<int m>
+  class PointCloudTileView: public vw::ImageViewBase< PointCloudTileView<m> > {
+    boost::shared_ptr<vw::DiskImageResource> m_rsrc;
+    vw::Vector3 m_shift;
+
+  public:
+    typedef vw::Vector<double, m> pixel_type;
+    typedef pixel_type            result_type;
+    typedef vw::ProceduralPixelAccessor<PointCloudTileView> pixel_accessor;
+
+    PointCloudTileView(boost::shared_ptr<vw::DiskImageResource> rsrc, vw::Vector3 const& shift):
+      m_rsrc(rsrc), m_shift(shift) {
+      vw::ImageFormat fmt = m_rsrc->format();
+      int num_channels = fmt.planes*vw::num_channels(fmt.pixel_format);
+      VW_ASSERT(m >= 1 && m <= num_channels,
+                vw::ArgumentErr() << "Cannot read " << m << " channels from a point cloud with "
+                << num_channels << " channels.\n");
+    }
+
+    inline vw::int32 cols  () const { return m_rsrc->cols(); }
+    inline vw::int32 rows  () const { return m_rsrc->rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    /// Slow, as a pixel is read by itself. Rasterize instead.
+    inline pixel_type operator()( double i, double j, vw::int32 /*p*/ = 0 ) const {
+      return prerasterize(vw::BBox2i(int(i), int(j), 1, 1))(int(i), int(j));
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+
+      // The file channels of a pixel are together, and the planes are
+      // one after another.
+      vw::ImageFormat fmt = m_rsrc->format();
+      fmt.cols = bbox.width();
+      fmt.rows = bbox.height();
+      fmt.channel_type = vw::VW_CHANNEL_FLOAT64;
+      int nc = vw::num_channels(fmt.pixel_format);
+      std::vector<double> buf(size_t(fmt.cols)*fmt.rows*fmt.planes*nc);
+      vw::ImageBuffer dest;
+      dest.data    = &buf[0];
+      dest.format  = fmt;
+      dest.cstride = nc*sizeof(double);
+      dest.rstride = dest.cstride*fmt.cols;
+      dest.pstride = dest.rstride*fmt.rows;
+      m_rsrc->read(dest, bbox);
+
+      size_t plane_size = size_t(fmt.cols)*fmt.rows*nc;
+      int len = std::min(3, m);
+      vw::ImageView<pixel_type> tile(bbox.width(), bbox.height());
+      for (int row = 0; row < tile.rows(); row++) {
+        for (int col = 0; col < tile.cols(); col++) {
+          double const* src = &buf[(size_t(row)*fmt.cols + col)*nc];
+          pixel_type & pix = tile(col, row);
+          bool valid = false;
+          for (int k = 0; k < m; k++) {
+            pix[k] = src[(k/nc)*plane_size + k%nc];
+            if (k < len && pix[k] != 0)
+              valid = true;
+          }
+          if (valid) {
+            for (int k = 0; k < len; k++)
+              pix[k] += m_shift[k];
+          }
+        }
+      }
+
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
   /// Read a point cloud file in the format written by ASP.
   /// Given a point cloud with n channels, return the first m channels.
   /// We must have 1 <= m <= n <= 6.
   /// If the image was written by subtracting a shift, put that shift back.
+  /// The tiles are cached, as for a DiskImageView.
   template<int m>
   vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud(std::string const& filename);
 
+  /// ImageView operator that takes the last three elements of a vector
+  /// (the error part) and replaces them with the norm of that 3-vector.
+  struct PointAndErrorNorm : public vw::ReturnFixedType<vw::Vector4> {
+    vw::Vector4 operator() (vw::Vector6 const& pt) const {
+      vw::Vector4 result;
+      subvector(result,0,3) = subvector(pt,0,3);
+      result[3] = norm_2(subvector(pt,3,3));
+      return result;
+    }
+  };
+  template <class ImageT>
+  vw::UnaryPerPixelView<ImageT, PointAndErrorNorm>
+  inline point_and_error_norm( vw::ImageViewBase<ImageT> const& image ) {
+    return vw::UnaryPerPixelView<ImageT, PointAndErrorNorm>( image.impl(),
+                                                             PointAndErrorNorm() );
+  }
+
 
   /// Hide these functions from external users
   namespace point_utils_private {
@@ -256,8 +387,53 @@ namespace asp {
 
   } // end namespace point_utils_private
 
+  /// The input clouds placed side by side, with the ones wider than
+  /// tall transposed, and the given spacing between them. Each tile is
+  /// read directly from the inputs which overlap it, found by a search
+  /// over where they start, rather than through an image composite.
+  /// Pixels not covered by any input are zero, which is invalid.
+  template <class PixelT>
+  class PointCloudStackView: public vw::ImageViewBase< PointCloudStackView<PixelT> >{
+    std::vector< vw::ImageViewRef<PixelT> > m_images;
+    std::vector<int> m_starts; // the output column where each image starts
+    int m_cols, m_rows;
+
+  public:
+    PointCloudStackView(std::vector<std::string> const& files, int spacing);
+
+    typedef PixelT pixel_type;
+    typedef PixelT result_type;
+    typedef vw::ProceduralPixelAccessor<PointCloudStackView> pixel_accessor;
+
+    inline vw::int32 cols  () const { return m_cols; }
+    inline vw::int32 rows  () const { return m_rows; }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+    /// Reads from the input having this pixel
+    inline pixel_type operator()( double i, double j, vw::int32 /*p*/ = 0 ) const {
+      size_t k = std::upper_bound(m_starts.begin(), m_starts.end(), int(i)) - m_starts.begin();
+      if (k == 0)
+        return pixel_type();
+      k--;
+      int col = int(i) - m_starts[k], row = int(j);
+      if (col >= m_images[k].cols() || row >= m_images[k].rows())
+        return pixel_type();
+      return m_images[k](col, row);
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const;
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
   /// Read multiple image files pack them into a single patchwork tiled image.
-  /// - Relies on the vw::mosaic::ImageComposite class.
+  /// - Uses PointCloudStackView.
   template<class PixelT>
   inline vw::ImageViewRef<PixelT> form_point_cloud_composite(std::vector<std::string> const & files, int spacing=0);
 
@@ -323,6 +499,71 @@ namespace asp {
                                                          PointTransFunc(t));
   }
 
+  /// Convert, in place, a block of cartesian points to the projection
+  /// of the georeference, with their longitude centered on lon_center
+  /// and the offset added to their lon-lat-height. The points going
+  /// through proj4 are converted together, rather than one at a time.
+  /// The no-data points, equal to Vector3(), and the points which
+  /// fail to project, get a NaN height.
+  void cartesian_to_projected(vw::ImageView<vw::Vector3> & points,
+                              vw::cartography::GeoReference const& georef,
+                              double lon_center, vw::Vector3 const& offset);
+
+  /// The same as geodetic_to_point(point_image_offset(recenter_longitude
+  /// (cartesian_to_geodetic(image, georef), lon_center), offset), georef),
+  /// with each tile converted by cartesian_to_projected().
+  template <class ImageT>
+  class CartesianToProjectedView:
+    public vw::ImageViewBase< CartesianToProjectedView<ImageT> > {
+    ImageT m_img;
+    vw::cartography::GeoReference m_georef;
+    double m_lon_center;
+    vw::Vector3 m_offset;
+  public:
+
+    typedef vw::Vector3 pixel_type;
+    typedef vw::Vector3 result_type;
+    typedef vw::ProceduralPixelAccessor<CartesianToProjectedView> pixel_accessor;
+
+    CartesianToProjectedView(vw::ImageViewBase<ImageT> const& img,
+                             vw::cartography::GeoReference const& georef,
+                             double lon_center, vw::Vector3 const& offset):
+      m_img(img.impl()), m_georef(georef), m_lon_center(lon_center), m_offset(offset) {}
+
+    inline vw::int32 cols  () const { return m_img.cols(); }
+    inline vw::int32 rows  () const { return m_img.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline pixel_type operator()( double i, double j, vw::int32 /*p*/ = 0 ) const {
+      vw::ImageView<vw::Vector3> point(1, 1);
+      point(0, 0) = m_img(i, j);
+      cartesian_to_projected(point, m_georef, m_lon_center, m_offset);
+      return point(0, 0);
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+      vw::ImageView<pixel_type> out = vw::crop(m_img, bbox);
+      cartesian_to_projected(out, m_georef, m_lon_center, m_offset);
+      return prerasterize_type(out, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  template <class ImageT>
+  CartesianToProjectedView<ImageT>
+  cartesian_to_projected(vw::ImageViewBase<ImageT> const& image,
+                         vw::cartography::GeoReference const& georef,
+                         double lon_center, vw::Vector3 const& offset = vw::Vector3()) {
+    return CartesianToProjectedView<ImageT>(image.impl(), georef, lon_center, offset);
+  }
+
 
   /// Compute bounding box of the given cloud. If is_geodetic is false,
   /// that means a cloud of raw xyz cartesian values, then Vector3()
@@ -345,50 +586,73 @@ vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud(std::string const
     shift = vw::str_to_vec<vw::Vector3>(shift_str);
   }
 
-  // Read the first m channels
-  vw::ImageViewRef< vw::Vector<double, m> > out_image
-    = vw::read_channels<m, double>(filename, 0);
+  // Read the first m channels, adding the shift back to the points
+  PointCloudTileView<m> cloud(rsrc, shift);
+  return vw::block_cache(cloud, rsrc->block_read_size(), 0);
+}
 
-  // Add the shift back to the first several channels.
-  if (shift != vw::Vector3())
-    out_image = subtract_shift(out_image, -shift);
+template <class PixelT>
+PointCloudStackView<PixelT>::PointCloudStackView(std::vector<std::string> const& files,
+                                                 int spacing):
+  m_cols(0), m_rows(0){
 
-  return out_image;
-}
+  for (size_t i = 0; i < files.size(); i++){
 
+    vw::ImageViewRef<PixelT> I
+      = point_utils_private::read_point_cloud_compatible_file<PixelT>(files[i]);
 
-/// Read given files and form an image composite.
-template<class PixelT>
-vw::ImageViewRef<PixelT> form_point_cloud_composite(std::vector<std::string> const & files,
-                                                    int spacing){
+    // We will stack the images side by side. Images which are wider
+    // than tall will be transposed.
+    if (I.rows() < I.cols())
+      I = transpose(I);
 
-  VW_ASSERT(files.size() >= 1, vw::ArgumentErr() << "Expecting at least one file.\n");
+    int start = m_cols;
+    if (i > 0 && spacing > 0) // Insert the spacing
+      start = spacing*(int)ceil(double(start)/spacing) + spacing;
 
-  vw::mosaic::ImageComposite<PixelT> composite_image;
-  composite_image.set_draft_mode(true); // images will be disjoint, no need for fancy stuff
+    m_images.push_back(I);
+    m_starts.push_back(start);
+    m_cols = start + I.cols();
+    m_rows = std::max(m_rows, I.rows());
+  }
+}
 
-  for (int i = 0; i < (int)files.size(); i++){
+template <class PixelT>
+typename PointCloudStackView<PixelT>::prerasterize_type
+PointCloudStackView<PixelT>::prerasterize(vw::BBox2i const& bbox) const {
+
+  vw::ImageView<pixel_type> tile(bbox.width(), bbox.height());
+  if (m_images.empty())
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+
+  // The last image starting at or before the tile, then all following
+  // images starting before the tile ends.
+  size_t i = std::upper_bound(m_starts.begin(), m_starts.end(), bbox.min().x())
+    - m_starts.begin();
+  if (i > 0)
+    i--;
+  for (; i < m_images.size() && m_starts[i] < bbox.max().x(); i++){
+    vw::Vector2i offset(m_starts[i], 0);
+    vw::BBox2i image_box = bounding_box(m_images[i]) + offset;
+    image_box.crop(bbox);
+    if (image_box.empty())
+      continue;
+    crop(tile, image_box - bbox.min()) = crop(m_images[i], image_box - offset);
+  }
 
-    vw::ImageViewRef<PixelT> I = point_utils_private::read_point_cloud_compatible_file<PixelT>(files[i]);
+  return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+}
 
-    // We will stack the images in the composite side by side. Images which
-    // are wider than tall will be transposed.
-    // To do: A more efficient approach would be to also stack one
-    // image on top of each other, if some images are not too tall.
-    // --> Does this code ever get images where rows != cols??
-    if (I.rows() < I.cols())
-      I = transpose(I);
 
-    int start = composite_image.cols();
-    if (i > 0){
-      // Insert the spacing
-      start = spacing*(int)ceil(double(start)/spacing) + spacing;
-    }
-    composite_image.insert(I, start, 0);
+/// Read given files and form an image composite.
+template<class PixelT>
+vw::ImageViewRef<PixelT> form_point_cloud_composite(std::vector<std::string> const & files,
+                                                    int spacing){
 
-  } // End loop through files
+  VW_ASSERT(files.size() >= 1, vw::ArgumentErr() << "Expecting at least one file.\n");
 
-  return composite_image;
+  // An index of where each input starts, rather than a composite
+  return PointCloudStackView<PixelT>(files, spacing);
 }
 
 // Find the average longitude for a given point image with lon, lat, height values
@@ -0,0 +1,307 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file Ransac.h
+///
+/// A drop-in replacement for vw::math::RandomSampleConsensus, taking
+/// the same fitting and error functors, for fitting homographies and
+/// similar transforms to many interest point matches.
+///
+/// The VW version refits each hypothesis to all of its inliers, even
+/// when it is no better than the best so far, and runs a fixed number of
+/// iterations. Here, the hypotheses are evaluated in batches, in
+/// parallel, and only the best of each batch is refit, if it beats the
+/// best model so far. Counting the inliers of a hypothesis stops as soon
+/// as it can no longer beat the best model. The search stops once enough
+/// hypotheses were tried to have drawn, with high confidence, an
+/// all-inlier sample, given the inlier ratio of the best model.
+///
+/// The random samples are drawn from a generator seeded with a fixed
+/// value, and the batches do not depend on the number of threads, so
+/// the result is reproducible.
+
+#ifndef __ASP_CORE_RANSAC_H__
+#define __ASP_CORE_RANSAC_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Math/RANSAC.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <cmath>
+
+namespace asp {
+
+  /// The number of hypotheses to try so that, with the given
+  /// confidence, at least one random sample of sample_size points has
+  /// only inliers, if inlier_ratio of the points are inliers.
+  inline int ransac_num_iterations_needed(double inlier_ratio, int sample_size,
+                                          double confidence) {
+    const int MAX_ITER = std::numeric_limits<int>::max();
+    if (inlier_ratio >= 1.0)
+      return 1;
+    double p = std::pow(inlier_ratio, sample_size); // chance a sample is all inliers
+    if (!(p > 0.0))
+      return MAX_ITER;
+    double n = std::log(1.0 - confidence)/std::log(1.0 - p);
+    if (!(n < MAX_ITER))
+      return MAX_ITER;
+    return std::max(1, (int)std::ceil(n));
+  }
+
+  template <class FittingFuncT, class ErrorFuncT>
+  class ParallelRandomSampleConsensus {
+  public:
+    typedef typename FittingFuncT::result_type ModelT;
+
+    /// The arguments are as for vw::math::RandomSampleConsensus, where
+    /// num_iterations is now the largest number of hypotheses to
+    /// try. Use num_threads = 0 for the VW default.
+    ParallelRandomSampleConsensus(FittingFuncT const& fitting_func,
+                                  ErrorFuncT const& error_func,
+                                  int num_iterations,
+                                  double inlier_threshold,
+                                  int min_num_output_inliers,
+                                  bool reduce_min_num_output_inliers_if_no_fit = false,
+                                  int num_threads = 0):
+      m_fitting_func(fitting_func), m_error_func(error_func),
+      m_num_iterations(num_iterations), m_inlier_threshold(inlier_threshold),
+      m_min_num_output_inliers(min_num_output_inliers),
+      m_reduce_min_num_output_inliers_if_no_fit(reduce_min_num_output_inliers_if_no_fit),
+      m_num_threads(num_threads) {}
+
+    /// The indices of the points on which H has an error under the threshold.
+    template <class ContainerT1, class ContainerT2>
+    std::vector<size_t> inlier_indices(ModelT const& H,
+                                       std::vector<ContainerT1> const& p1,
+                                       std::vector<ContainerT2> const& p2) const {
+      std::vector<size_t> indices;
+      for (size_t i = 0; i < p1.size(); i++) {
+        if (m_error_func(H, p1[i], p2[i]) < m_inlier_threshold)
+          indices.push_back(i);
+      }
+      return indices;
+    }
+
+    /// Count the inliers of H. Give up, and return a count under
+    /// min_count, once H can no longer have min_count inliers.
+    template <class ContainerT1, class ContainerT2>
+    int num_inliers(ModelT const& H,
+                    std::vector<ContainerT1> const& p1,
+                    std::vector<ContainerT2> const& p2, int min_count) const {
+      int count = 0;
+      int num = p1.size();
+      for (int i = 0; i < num; i++) {
+        if (m_error_func(H, p1[i], p2[i]) < m_inlier_threshold)
+          count++;
+        else if (count + (num - i - 1) < min_count)
+          break;
+      }
+      return count;
+    }
+
+    /// Fit a model mapping p1 to p2, ignoring outliers.
+    template <class ContainerT1, class ContainerT2>
+    ModelT operator()(std::vector<ContainerT1> const& p1,
+                      std::vector<ContainerT2> const& p2) {
+
+      // The number of hypotheses per batch. It does not depend on the
+      // number of threads, to get the same result with any of them.
+      const int    BATCH_SIZE            = 32;
+      const int    MIN_POINTS_PER_THREAD = 1000;
+      const double CONFIDENCE            = 0.99;
+      const int    SEED                  = 314159;
+
+      VW_ASSERT(p1.size() == p2.size(),
+                vw::math::RANSACErr() << "RANSAC: The inputs have different sizes.");
+      if (p1.empty())
+        vw_throw(vw::math::RANSACErr() << "RANSAC: No points to fit.");
+
+      int num_points  = p1.size();
+      int sample_size = m_fitting_func.min_elements_needed_for_fit(p1[0]);
+      if (num_points < sample_size)
+        vw_throw(vw::math::RANSACErr() << "RANSAC: Need at least " << sample_size
+                 << " points to fit a model, got " << num_points << ".");
+
+      // For few points the threads cost more than they save
+      int num_threads = m_num_threads;
+      if (num_threads <= 0)
+        num_threads = vw::vw_settings().default_num_threads();
+      num_threads = std::max(1, std::min(num_threads, num_points/MIN_POINTS_PER_THREAD));
+
+      boost::random::mt19937 generator(SEED);
+      boost::random::uniform_int_distribution<int> distribution(0, num_points - 1);
+
+      ModelT best_model;
+      int    best_count = -1;
+      int    num_needed = m_num_iterations;
+      int    num_done   = 0;
+
+      while (num_done < std::min(m_num_iterations, num_needed)) {
+
+        int batch_size = std::min(BATCH_SIZE, m_num_iterations - num_done);
+
+        // Draw the samples serially, so that they do not depend on the threads
+        std::vector< std::vector<size_t> > samples(batch_size);
+        for (int b = 0; b < batch_size; b++) {
+          std::vector<size_t> & sample = samples[b];
+          while ((int)sample.size() < sample_size) {
+            size_t index = distribution(generator);
+            if (std::find(sample.begin(), sample.end(), index) == sample.end())
+              sample.push_back(index);
+          }
+        }
+
+        // Fit and score the hypotheses. Those with fewer inliers than the
+        // best model so far are not counted in full.
+        std::vector<ModelT> models(batch_size);
+        std::vector<int>    counts(batch_size, -1);
+        int min_count = std::max(best_count, 0);
+        if (num_threads == 1) {
+          HypothesesTask<ContainerT1, ContainerT2>
+            (*this, p1, p2, samples, 0, batch_size, min_count, models, counts)();
+        } else {
+          vw::FifoWorkQueue queue(num_threads);
+          int chunk = (batch_size + num_threads - 1)/num_threads;
+          for (int beg = 0; beg < batch_size; beg += chunk) {
+            int end = std::min(beg + chunk, batch_size);
+            queue.add_task(boost::shared_ptr< HypothesesTask<ContainerT1, ContainerT2> >
+                           (new HypothesesTask<ContainerT1, ContainerT2>
+                            (*this, p1, p2, samples, beg, end, min_count, models, counts)));
+          }
+          queue.join_all();
+        }
+        num_done += batch_size;
+
+        // Refit the best hypothesis of the batch to its inliers, if it
+        // is better than the best model so far.
+        int best_in_batch = -1;
+        for (int b = 0; b < batch_size; b++) {
+          if (counts[b] > best_count && (best_in_batch < 0 || counts[b] > counts[best_in_batch]))
+            best_in_batch = b;
+        }
+        if (best_in_batch < 0)
+          continue;
+
+        ModelT H     = models[best_in_batch];
+        int    count = counts[best_in_batch];
+        try {
+          std::vector<size_t> indices = inlier_indices(H, p1, p2);
+          std::vector<ContainerT1> inliers1;
+          std::vector<ContainerT2> inliers2;
+          for (size_t i = 0; i < indices.size(); i++) {
+            inliers1.push_back(p1[indices[i]]);
+            inliers2.push_back(p2[indices[i]]);
+          }
+          ModelT refit_H     = m_fitting_func(inliers1, inliers2, H);
+          int    refit_count = num_inliers(refit_H, p1, p2, count);
+          if (refit_count >= count) {
+            H     = refit_H;
+            count = refit_count;
+          }
+        } catch (...) {
+          // Keep the hypothesis as it is
+        }
+
+        best_model = H;
+        best_count = count;
+        num_needed = ransac_num_iterations_needed(double(best_count)/num_points,
+                                                  sample_size, CONFIDENCE);
+      }
+
+      vw_out(vw::DebugMessage, "asp") << "RANSAC: Tried " << num_done << " hypotheses, "
+                                      << "found " << best_count << " inliers out of "
+                                      << num_points << ".\n";
+
+      // As in VW, if allowed, lower the required number of inliers
+      // until the best model has enough.
+      int min_inliers = m_min_num_output_inliers;
+      if (m_reduce_min_num_output_inliers_if_no_fit) {
+        while (best_count < min_inliers && min_inliers > sample_size) {
+          min_inliers = std::max(sample_size, (int)(min_inliers/1.5));
+          vw_out(vw::DebugMessage, "asp") << "RANSAC: Reducing the minimum number "
+                                          << "of output inliers to " << min_inliers << ".\n";
+        }
+      }
+
+      if (best_count < std::max(min_inliers, sample_size))
+        vw_throw(vw::math::RANSACErr() << "RANSAC was unable to find a fit "
+                 << "that matched the supplied data.");
+
+      return best_model;
+    }
+
+  private:
+
+    // Fit and score a range of hypotheses.
+    template <class ContainerT1, class ContainerT2>
+    class HypothesesTask: public vw::Task, private boost::noncopyable {
+      ParallelRandomSampleConsensus const& m_ransac;
+      std::vector<ContainerT1>   const& m_p1;
+      std::vector<ContainerT2>   const& m_p2;
+      std::vector< std::vector<size_t> > const& m_samples;
+      int m_beg, m_end, m_min_count;
+      std::vector<ModelT> & m_models;
+      std::vector<int>    & m_counts;
+    public:
+      HypothesesTask(ParallelRandomSampleConsensus const& ransac,
+                     std::vector<ContainerT1> const& p1,
+                     std::vector<ContainerT2> const& p2,
+                     std::vector< std::vector<size_t> > const& samples,
+                     int beg, int end, int min_count,
+                     std::vector<ModelT> & models, std::vector<int> & counts):
+        m_ransac(ransac), m_p1(p1), m_p2(p2), m_samples(samples),
+        m_beg(beg), m_end(end), m_min_count(min_count),
+        m_models(models), m_counts(counts) {}
+
+      virtual void operator()() {
+        for (int b = m_beg; b < m_end; b++) {
+          std::vector<ContainerT1> sample1;
+          std::vector<ContainerT2> sample2;
+          for (size_t i = 0; i < m_samples[b].size(); i++) {
+            sample1.push_back(m_p1[m_samples[b][i]]);
+            sample2.push_back(m_p2[m_samples[b][i]]);
+          }
+          try {
+            m_models[b] = m_ransac.m_fitting_func(sample1, sample2);
+            m_counts[b] = m_ransac.num_inliers(m_models[b], m_p1, m_p2, m_min_count);
+          } catch (...) {
+            m_counts[b] = -1; // a degenerate sample
+          }
+        }
+      }
+    };
+
+    FittingFuncT m_fitting_func;
+    ErrorFuncT   m_error_func;
+    int    m_num_iterations;
+    double m_inlier_threshold;
+    int    m_min_num_output_inliers;
+    bool   m_reduce_min_num_output_inliers_if_no_fit;
+    int    m_num_threads;
+  };
+
+} // namespace asp
+
+#endif // __ASP_CORE_RANSAC_H__
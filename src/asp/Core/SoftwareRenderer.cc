@@ -47,6 +47,7 @@
 #include <asp/Core/SoftwareRenderer.h>
 
 #include <iostream>
+#include <algorithm>
 
 using namespace std;
 using namespace vw;
@@ -358,10 +359,10 @@ DrawGraySpan(GraphicsState *gc)
   float *span =
     &(gc->buffer[gc->rasterInfo.frag.y * gc->width + x ] );
 
-  for (int i = length; i; --i) {
-    *span++ = float(gray);
-    gray += drdx;
-  }
+  // Each value depends only on the index, not on the previous value,
+  // so the compiler can vectorize this loop.
+  for (int i = 0; i < length; i++)
+    span[i] = float(gray + RealT(i) * drdx);
 }
 
 // In the SnapX* and FillSubTriangle routines, 1s31.1s31 fixed point
@@ -632,6 +633,21 @@ FillTriangle(GraphicsState *gc, Vertex *a, Vertex *b, Vertex *c)
   }
 }
 
+// Return true if a triangle, in window coordinates, cannot touch any
+// pixel of the buffer, so its setup can be skipped. This is most
+// triangles of the point cloud blocks a DEM tile needs. Coordinates
+// are truncated to pixels, so a margin is kept on each side.
+inline bool
+TriangleOutsideBuffer(Coords const& a, Coords const& b, Coords const& c,
+                      int width, int height)
+{
+  const RealT margin = 2.0;
+  RealT minX = std::min(a.x, std::min(b.x, c.x)), maxX = std::max(a.x, std::max(b.x, c.x));
+  RealT minY = std::min(a.y, std::min(b.y, c.y)), maxY = std::max(a.y, std::max(b.y, c.y));
+  return (maxX < -margin || minX > width + margin ||
+          maxY < -margin || minY > height + margin);
+}
+
 inline void
 MapToWindow(Coords &coords,
             const double ndcMap[3][2],
@@ -805,7 +821,9 @@ SoftwareRenderer::DrawPolygon(const int startIndex, const int numVertices)
                 0.0, 0.0, double(m_bufferWidth), double(m_bufferHeight),
                 vertex2.window);
 
-    FillTriangle((GraphicsState *) m_graphicsState, &vertex0, &vertex1, &vertex2);
+    if (!TriangleOutsideBuffer(vertex0.window, vertex1.window, vertex2.window,
+                               m_bufferWidth, m_bufferHeight))
+      FillTriangle((GraphicsState *) m_graphicsState, &vertex0, &vertex1, &vertex2);
 
     vertexIndex1 += m_triangleVertexStep;
     vertexIndex2 += m_triangleVertexStep;
@@ -0,0 +1,385 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/Filter.h>
+#include <vw/Image/BlockRasterize.h>
+#include <vw/Image/EdgeExtension.h>
+#include <vw/Image/Manipulation.h>
+#include <asp/Core/SparseCorrelation.h>
+#include <boost/noncopyable.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <cmath>
+
+using namespace vw;
+
+namespace asp {
+
+bool normalized_cross_correlation(ImageView<float> const& tmpl,
+                                  ImageView<float> const& search,
+                                  ImageView<float> & ncc) {
+
+  int tw = tmpl.cols(), th = tmpl.rows();
+  int sw = search.cols(), sh = search.rows();
+  VW_ASSERT(tw > 0 && th > 0 && tw <= sw && th <= sh,
+            ArgumentErr() << "normalized_cross_correlation: The template must "
+            << "fit in the search image.\n");
+  ncc.set_size(sw - tw + 1, sh - th + 1);
+
+  // The template minus its mean. Since that sums to zero, its dot
+  // product with the search image needs no correction for the local mean.
+  double n = double(tw)*th, mean = 0.0;
+  for (int y = 0; y < th; y++)
+    for (int x = 0; x < tw; x++)
+      mean += tmpl(x, y);
+  mean /= n;
+  std::vector<double> t(tw*th);
+  double t_sumsq = 0.0;
+  for (int y = 0; y < th; y++) {
+    for (int x = 0; x < tw; x++) {
+      t[y*tw + x] = tmpl(x, y) - mean;
+      t_sumsq += t[y*tw + x]*t[y*tw + x];
+    }
+  }
+  if (t_sumsq <= 1e-12*n)
+    return false;
+
+  // Integral images of the search image and its square
+  std::vector<double> s1((sw + 1)*(sh + 1), 0.0), s2((sw + 1)*(sh + 1), 0.0);
+  for (int y = 0; y < sh; y++) {
+    for (int x = 0; x < sw; x++) {
+      double v = search(x, y);
+      int k = (y + 1)*(sw + 1) + x + 1;
+      s1[k] = v   + s1[k - 1] + s1[k - sw - 1] - s1[k - sw - 2];
+      s2[k] = v*v + s2[k - 1] + s2[k - sw - 1] - s2[k - sw - 2];
+    }
+  }
+
+  for (int j = 0; j < ncc.rows(); j++) {
+    for (int i = 0; i < ncc.cols(); i++) {
+
+      int k00 = j*(sw + 1) + i, k01 = k00 + tw, k10 = k00 + th*(sw + 1), k11 = k10 + tw;
+      double sum   = s1[k11] - s1[k01] - s1[k10] + s1[k00];
+      double sumsq = s2[k11] - s2[k01] - s2[k10] + s2[k00];
+      double var   = sumsq - sum*sum/n;
+      if (var <= 1e-12*n) {
+        ncc(i, j) = 0.0;
+        continue;
+      }
+
+      double dot = 0.0;
+      for (int y = 0; y < th; y++) {
+        const double * tr = &t[y*tw];
+        for (int x = 0; x < tw; x++)
+          dot += tr[x]*search(i + x, j + y);
+      }
+      ncc(i, j) = dot/sqrt(t_sumsq*var);
+    }
+  }
+
+  return true;
+}
+
+namespace {
+
+  // The image reduced by the given factor after a Gaussian blur, and
+  // filtered with a Laplacian of Gaussian. Pixels outside the image
+  // are zero. The filtered tiles are cached, so each is found once,
+  // however many templates overlap it.
+  ImageViewRef<float> log_filtered(ImageViewRef<float> const& img, int factor) {
+    ImageViewRef<float> a = img;
+    if (factor > 1)
+      a = subsample(gaussian_filter(img, factor/2.0, ZeroEdgeExtension()), factor);
+    ImageViewRef<float> log_img
+      = gaussian_filter(laplacian_filter(a, ZeroEdgeExtension()), 1.4, ZeroEdgeExtension());
+    return block_cache(log_img, Vector2i(256, 256), 0);
+  }
+
+  // Read a box of the full-resolution image from its filtered version
+  // at the given factor. The box size must be a multiple of the factor.
+  void filtered_crop(ImageViewRef<float> const& filtered, BBox2i const& box, int factor,
+                     ImageView<float> & out) {
+    int col = int(floor(double(box.min().x())/factor));
+    int row = int(floor(double(box.min().y())/factor));
+    out = crop(edge_extend(filtered, ZeroEdgeExtension()),
+               col, row, box.width()/factor, box.height()/factor);
+  }
+
+  // The position of the largest value
+  Vector2i peak_position(ImageView<float> const& img, float & peak) {
+    Vector2i pos;
+    peak = -std::numeric_limits<float>::max();
+    for (int j = 0; j < img.rows(); j++) {
+      for (int i = 0; i < img.cols(); i++) {
+        if (img(i, j) > peak) {
+          peak = img(i, j);
+          pos = Vector2i(i, j);
+        }
+      }
+    }
+    return pos;
+  }
+
+  // The filtered images, at full and at the reduced resolution
+  struct FilteredImages {
+    ImageViewRef<float> left, right, left_low, right_low;
+  };
+
+  // Find the disparity at a left image point, first over the whole
+  // search range at the reduced resolution, then at full resolution
+  // around that. Returns false if there is no good match.
+  bool match_point(FilteredImages const& images, SparseDispOptions const& opt,
+                   int factor, Vector2i const& pix, Vector2f & disp) {
+
+    // Search at the reduced resolution. All sizes are multiples of the factor.
+    int     tsize = (opt.template_size/factor)*factor;
+    Vector2i range(factor*int(ceil(double(opt.search_range[0])/factor)),
+                   factor*int(ceil(double(opt.search_range[1])/factor)));
+    BBox2i tbox(pix - Vector2i(tsize, tsize)/2, pix - Vector2i(tsize, tsize)/2 + Vector2i(tsize, tsize));
+    BBox2i sbox(tbox.min() - range, tbox.max() + range);
+
+    ImageView<float> tmpl, search, ncc;
+    filtered_crop(images.left_low,  tbox, factor, tmpl);
+    filtered_crop(images.right_low, sbox, factor, search);
+    if (!normalized_cross_correlation(tmpl, search, ncc))
+      return false;
+    float score;
+    Vector2i d = factor*peak_position(ncc, score) - range;
+
+    // Refine at full resolution, within a couple of reduced pixels
+    if (factor > 1) {
+      int r = 2*factor;
+      tsize = opt.template_size;
+      tbox = BBox2i(pix - Vector2i(tsize, tsize)/2, pix - Vector2i(tsize, tsize)/2 + Vector2i(tsize, tsize));
+      sbox = BBox2i(tbox.min() + d - Vector2i(r, r), tbox.max() + d + Vector2i(r, r));
+      filtered_crop(images.left,  tbox, 1, tmpl);
+      filtered_crop(images.right, sbox, 1, search);
+      if (!normalized_cross_correlation(tmpl, search, ncc))
+        return false;
+      d += peak_position(ncc, score) - Vector2i(r, r);
+    }
+
+    if (score < opt.min_score)
+      return false;
+    disp = Vector2f(d[0], d[1]);
+    return true;
+  }
+
+  // Task matching the points on one row of the grid
+  class SparseRowTask: public vw::Task, private boost::noncopyable {
+    FilteredImages const& m_images;
+    SparseDispOptions const& m_opt;
+    int m_factor, m_row;
+    std::vector<int> const& m_x, & m_y;
+    ImageView<PixelMask<Vector2f> > & m_grid;
+  public:
+    SparseRowTask(FilteredImages const& images, SparseDispOptions const& opt,
+                  int factor, int row,
+                  std::vector<int> const& x, std::vector<int> const& y,
+                  ImageView<PixelMask<Vector2f> > & grid):
+      m_images(images), m_opt(opt), m_factor(factor), m_row(row),
+      m_x(x), m_y(y), m_grid(grid) {}
+
+    void operator()() {
+      for (size_t col = 0; col < m_x.size(); col++) {
+        Vector2f disp;
+        if (match_point(m_images, m_opt, m_factor, Vector2i(m_x[col], m_y[m_row]), disp))
+          m_grid(col, m_row) = PixelMask<Vector2f>(disp);
+        else
+          m_grid(col, m_row).invalidate();
+      }
+    }
+  };
+
+  // The grid coordinates, spaced evenly with the templates inside the image
+  void grid_coords(int len, SparseDispOptions const& opt, std::vector<int> & coords) {
+    coords.clear();
+    int half = opt.template_size/2;
+    for (int c = half; c <= len - 1 - half; c += opt.spacing)
+      coords.push_back(c);
+  }
+
+  // Remove the matches far from the median of their valid neighbors
+  void remove_outliers(ImageView<PixelMask<Vector2f> > & grid) {
+    const double tol = 16.0; // pixels
+    ImageView<PixelMask<Vector2f> > orig = copy(grid);
+    for (int row = 0; row < grid.rows(); row++) {
+      for (int col = 0; col < grid.cols(); col++) {
+        if (!is_valid(orig(col, row)))
+          continue;
+        std::vector<double> dx, dy;
+        for (int r = std::max(row - 1, 0); r <= std::min(row + 1, grid.rows() - 1); r++) {
+          for (int c = std::max(col - 1, 0); c <= std::min(col + 1, grid.cols() - 1); c++) {
+            if ((c == col && r == row) || !is_valid(orig(c, r)))
+              continue;
+            dx.push_back(orig(c, r).child()[0]);
+            dy.push_back(orig(c, r).child()[1]);
+          }
+        }
+        if (dx.size() < 3)
+          continue;
+        std::nth_element(dx.begin(), dx.begin() + dx.size()/2, dx.end());
+        std::nth_element(dy.begin(), dy.begin() + dy.size()/2, dy.end());
+        Vector2f d = orig(col, row).child();
+        if (std::abs(d[0] - dx[dx.size()/2]) > tol || std::abs(d[1] - dy[dy.size()/2]) > tol)
+          grid(col, row).invalidate();
+      }
+    }
+  }
+
+  // Fill the invalid grid points with the mean of their valid
+  // neighbors, repeatedly, until all are filled.
+  void fill_holes(ImageView<PixelMask<Vector2f> > & grid) {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      ImageView<PixelMask<Vector2f> > orig = copy(grid);
+      for (int row = 0; row < grid.rows(); row++) {
+        for (int col = 0; col < grid.cols(); col++) {
+          if (is_valid(orig(col, row)))
+            continue;
+          Vector2f sum;
+          int count = 0;
+          int nbrs[4][2] = {{col-1, row}, {col+1, row}, {col, row-1}, {col, row+1}};
+          for (int k = 0; k < 4; k++) {
+            int c = nbrs[k][0], r = nbrs[k][1];
+            if (c < 0 || r < 0 || c >= grid.cols() || r >= grid.rows() || !is_valid(orig(c, r)))
+              continue;
+            sum += orig(c, r).child();
+            count++;
+          }
+          if (count > 0) {
+            grid(col, row) = PixelMask<Vector2f>(sum/count);
+            changed = true;
+          }
+        }
+      }
+    }
+  }
+
+  // The index of the grid interval containing a value, and the
+  // fraction of the way through it.
+  void grid_interval(std::vector<int> const& coords, double val, int & index, double & frac) {
+    if (coords.size() < 2) {
+      index = 0;
+      frac  = 0.0;
+      return;
+    }
+    int    spacing = coords[1] - coords[0];
+    double pos     = (val - coords[0])/spacing;
+    index = std::max(0, std::min(int(floor(pos)), int(coords.size()) - 2));
+    frac  = std::max(0.0, std::min(pos - index, 1.0));
+  }
+
+} // end anonymous namespace
+
+void sparse_disparity(ImageViewRef<float> const& left,
+                      ImageViewRef<float> const& right,
+                      SparseDispOptions const& opt,
+                      Vector2i const& sub_size,
+                      ImageView<PixelMask<Vector2f> > & sub_disp,
+                      ImageView<PixelMask<Vector2i> > & sub_spread) {
+
+  VW_ASSERT(opt.template_size >= 8 && opt.spacing > 0 &&
+            opt.search_range[0] >= 0 && opt.search_range[1] >= 0,
+            ArgumentErr() << "sparse_disparity: Invalid options.\n");
+
+  std::vector<int> x, y;
+  grid_coords(left.cols(), opt, x);
+  grid_coords(left.rows(), opt, y);
+  if (x.empty() || y.empty())
+    vw_throw(ArgumentErr() << "sparse_disparity: The image is smaller than the template.\n");
+
+  // Reduce the resolution of the first search until the search range
+  // is small, while keeping enough pixels in the template.
+  int factor = 1;
+  while (std::max(opt.search_range[0], opt.search_range[1])/(2*factor) >= 32 &&
+         opt.template_size/(2*factor) >= 8)
+    factor *= 2;
+
+  vw_out() << "Matching " << x.size()*y.size() << " points at full resolution, "
+           << "first searching at 1/" << factor << " resolution.\n";
+
+  FilteredImages images;
+  images.left  = log_filtered(left,  1);
+  images.right = log_filtered(right, 1);
+  images.left_low  = factor > 1 ? log_filtered(left,  factor) : images.left;
+  images.right_low = factor > 1 ? log_filtered(right, factor) : images.right;
+
+  ImageView<PixelMask<Vector2f> > grid(x.size(), y.size());
+  int num_threads = opt.num_threads > 0 ? opt.num_threads : vw_settings().default_num_threads();
+  FifoWorkQueue queue(num_threads);
+  for (size_t row = 0; row < y.size(); row++) {
+    boost::shared_ptr<SparseRowTask>
+      task(new SparseRowTask(images, opt, factor, row, x, y, grid));
+    queue.add_task(task);
+  }
+  queue.join_all();
+
+  remove_outliers(grid);
+  int num_valid = 0;
+  for (int row = 0; row < grid.rows(); row++)
+    for (int col = 0; col < grid.cols(); col++)
+      num_valid += is_valid(grid(col, row));
+  vw_out() << "Matched " << num_valid << " points.\n";
+  if (num_valid == 0)
+    vw_throw(ArgumentErr() << "sparse_disparity: Could not match any points.\n");
+  fill_holes(grid);
+
+  // Interpolate the grid to the low-res image, and scale the disparities
+  Vector2 scale(double(sub_size[0])/left.cols(), double(sub_size[1])/left.rows());
+  sub_disp.set_size(sub_size[0], sub_size[1]);
+  sub_spread.set_size(sub_size[0], sub_size[1]);
+  for (int row = 0; row < sub_size[1]; row++) {
+    int iy;
+    double fy;
+    grid_interval(y, row/scale[1], iy, fy);
+    int iy1 = std::min(iy + 1, int(y.size()) - 1);
+    for (int col = 0; col < sub_size[0]; col++) {
+      int ix;
+      double fx;
+      grid_interval(x, col/scale[0], ix, fx);
+      int ix1 = std::min(ix + 1, int(x.size()) - 1);
+
+      Vector2 nodes[4] = {grid(ix, iy).child(), grid(ix1, iy).child(),
+                          grid(ix, iy1).child(), grid(ix1, iy1).child()};
+      double w[4] = {(1 - fx)*(1 - fy), fx*(1 - fy), (1 - fx)*fy, fx*fy};
+      Vector2 d;
+      for (int k = 0; k < 4; k++)
+        d += w[k]*elem_prod(nodes[k], scale);
+
+      Vector2 spread;
+      for (int k = 0; k < 4; k++) {
+        Vector2 diff = elem_prod(nodes[k], scale) - d;
+        for (int a = 0; a < 2; a++)
+          spread[a] = std::max(spread[a], std::abs(diff[a]));
+      }
+
+      sub_disp(col, row)   = PixelMask<Vector2f>(d);
+      sub_spread(col, row) = PixelMask<Vector2i>(Vector2i(int(ceil(spread[0])) + 2,
+                                                          int(ceil(spread[1])) + 2));
+    }
+  }
+}
+
+} // namespace asp
@@ -0,0 +1,73 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file SparseCorrelation.h
+///
+/// The low-resolution disparity found by matching templates from the
+/// full-resolution left image at a sparse grid of points, for terrain
+/// such as snow whose only features disappear at low resolution. The
+/// images are filtered with a Laplacian of Gaussian, and the templates
+/// read from them are matched with normalized cross-correlation, first over the whole search range at a
+/// reduced resolution, then at full resolution around the best match.
+/// The grid points are matched in parallel, and the result is
+/// interpolated to the size of D_sub.
+
+#ifndef __ASP_CORE_SPARSE_CORRELATION_H__
+#define __ASP_CORE_SPARSE_CORRELATION_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/Vector.h>
+
+namespace asp {
+
+  /// The normalized cross-correlation of a template with the search
+  /// image at each position where the template fits inside it, with
+  /// the template's top-left corner at that position. The local sums of
+  /// the search image come from integral images. Positions where the
+  /// search image is constant under the template get zero. Returns
+  /// false if the template itself is constant.
+  bool normalized_cross_correlation(vw::ImageView<float> const& tmpl,
+                                    vw::ImageView<float> const& search,
+                                    vw::ImageView<float> & ncc);
+
+  struct SparseDispOptions {
+    int          template_size; ///< Side of the square templates, in pixels
+    int          spacing;       ///< Distance between the grid points, in pixels
+    vw::Vector2i search_range;  ///< Half-width of the search along each axis
+    double       min_score;     ///< Matches with a lower correlation are rejected
+    int          num_threads;
+    SparseDispOptions(): template_size(56), spacing(64), search_range(484, 484),
+                         min_score(0.4), num_threads(0) {}
+  };
+
+  /// Match the left image against the right image at a grid of points,
+  /// and interpolate the disparities to an image of the given size, as
+  /// for D_sub. The spread at a pixel is the largest difference between
+  /// its disparity and those of the grid points around it, plus two
+  /// pixels. Throws if no point could be matched.
+  void sparse_disparity(vw::ImageViewRef<float> const& left,
+                        vw::ImageViewRef<float> const& right,
+                        SparseDispOptions const& opt,
+                        vw::Vector2i const& sub_size,
+                        vw::ImageView<vw::PixelMask<vw::Vector2f> > & sub_disp,
+                        vw::ImageView<vw::PixelMask<vw::Vector2i> > & sub_spread);
+
+} // namespace asp
+
+#endif//__ASP_CORE_SPARSE_CORRELATION_H__
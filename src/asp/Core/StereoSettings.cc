@@ -92,6 +92,10 @@ namespace asp {
     // to get a camera pointer, and there we don't parse stereo.default
     disable_correct_velocity_aberration = false;
 
+    // Used when loading pinhole cameras, also by tools which don't parse stereo.default
+    lens_lookup_table_spacing = 0;
+    lens_lookup_table_error   = 0.01;
+
     double nan = std::numeric_limits<double>::quiet_NaN();
     nodata_value = nan;
   }
@@ -137,20 +141,38 @@ namespace asp {
                       "Write debug images to disk when detecting and matching interest points.")
       ("num-obalog-scales",              po::value(&global.num_scales)->default_value(-1),
        "How many scales to use if detecting interest points with OBALoG. If not specified, 8 will be used. More can help for images with high frequency artifacts.")
+      ("ip-cache-dir",             po::value(&global.ip_cache_dir)->default_value(""),
+       "Save the detected interest points and their matches in this directory, under a hash of the image path, size, and modification time and the detection settings, and reuse them in later runs, with any output prefix.")
       ("nodata-value",             po::value(&global.nodata_value)->default_value(nan),
        "Pixels with values less than or equal to this number are treated as no-data. This overrides the no-data values from input images.")
       ("nodata-pixel-percentage",  po::value(&global.nodata_pixel_percentage)->default_value(nan),
        "The percentage of (low-value) pixels treated as no-data (use a number between 0 and 100).")
       ("nodata-optimal-threshold-factor", po::value(&global.nodata_optimal_threshold_factor)->default_value(nan),
                      "Pixels with values less than this factor times the optimal Otsu threshold are treated as no-data. Suggested value: 0.1 to 0.2.")
+      ("stats-quantile-error", po::value(&global.stats_quantile_error)->default_value(0.001),
+       "Compute the image statistics used for normalization and no-data thresholds from pixels sampled on a grid, so that with 95% confidence each quantile is within this fraction of the number of pixels of the exact one. Set to 0 to use all pixels.")
       ("skip-rough-homography", po::bool_switch(&global.skip_rough_homography)->default_value(false)->implicit_value(true),
        "Skip the step of performing datum-based rough homography if it fails.")
       ("skip-image-normalization", po::bool_switch(&global.skip_image_normalization)->default_value(false)->implicit_value(true),
        "Skip the step of normalizing the values of input images and removing nodata-pixels. Create instead symbolic links to original images.")
+      ("wv-correct", po::bool_switch(&global.wv_correct)->default_value(false)->implicit_value(true),
+       "Correct the CCD artifacts of raw WorldView-1 and WorldView-2 images, as wv_correct does, while normalizing them, so no corrected copy of the images needs to be written first. Only for the dg session.")
       ("part-of-multiview-run", po::bool_switch(&global.part_of_multiview_run)->default_value(false)->implicit_value(true),
        "If the current run is part of a larger multiview run.")
       ("datum",                    po::value(&global.datum)->default_value("WGS_1984"),
-       "Set the datum to use with RPC camera models. Options: WGS_1984, D_MOON (1,737,400 meters), D_MARS (3,396,190 meters), MOLA (3,396,000 meters), NAD83, WGS72, and NAD27. Also accepted: Earth (=WGS_1984), Mars (=D_MARS), Moon (=D_MOON).");
+       "Set the datum to use with RPC camera models. Options: WGS_1984, D_MOON (1,737,400 meters), D_MARS (3,396,190 meters), MOLA (3,396,000 meters), NAD83, WGS72, and NAD27. Also accepted: Earth (=WGS_1984), Mars (=D_MARS), Moon (=D_MOON).")
+      ("isis-linescan-approx-error", po::value(&global.isis_linescan_approx_error)->default_value(0.0),
+       "Replace each ISIS linescan camera with an approximation sampled from it once, which is much faster and can be used by all threads at the same time, if it projects points within this many pixels of the ISIS camera. Set to 0 to always use the ISIS cameras.")
+      ("rpc-approximation-error", po::value(&global.rpc_approximation_error)->default_value(0.0),
+       "Project into each camera with an RPC model fit to it over the ground seen by the image, if the model is within this many pixels of the camera. This is much faster for ISIS, DG, and other linescan cameras. Set to 0 to always use the cameras themselves.")
+      ("rpc-approximation-height-range", po::value(&global.rpc_approximation_height_range)->default_value(Vector2(-10000, 10000), "-10000 10000"),
+       "The range of heights above the datum, in meters, over which to fit the RPC approximation of the cameras.")
+      ("camera-cache-dir", po::value(&global.camera_cache_dir)->default_value(""),
+       "Save in this directory, in a compact binary form, the DigitalGlobe and RPC camera models read from XML files, as well as the RPC approximations of the cameras, and load them from there later, to avoid parsing the XML or fitting the approximations again.")
+      ("lens-lookup-table-spacing", po::value(&global.lens_lookup_table_spacing)->default_value(0.0),
+       "For pinhole cameras with lens distortion, undistort and distort pixels by interpolating into tables with nodes this many pixels apart, such as 4, rather than inverting the lens model iteratively for each pixel. The tables are made once for each set of intrinsics and shared by all images with those intrinsics. Set to 0 to use the lens model itself.")
+      ("lens-lookup-table-error", po::value(&global.lens_lookup_table_error)->default_value(0.01),
+       "With --lens-lookup-table-spacing, use the lens model itself in the table cells where interpolation is off by more than this many pixels.");
   }
 
   CorrelationDescription::CorrelationDescription() : po::options_description("Correlation Options") {
@@ -161,7 +183,7 @@ namespace asp {
       ("prefilter-mode",         po::value(&global.pre_filter_mode)->default_value(2),
                      "Preprocessing filter mode. [0 None, 1 Gaussian, 2 LoG, 3 Sign of LoG]")
       ("corr-seed-mode",         po::value(&global.seed_mode)->default_value(1),
-                     "Correlation seed strategy. [0 None, 1 Use low-res disparity from stereo, 2 Use low-res disparity from provided DEM (see disparity-estimation-dem), 3 Use low-res disparity produced by sparse_disp (in development)]")
+                     "Correlation seed strategy. [0 None, 1 Use low-res disparity from stereo, 2 Use low-res disparity from provided DEM (see disparity-estimation-dem), 3 Use low-res disparity produced by sparse_disp (in development), 4 Use low-res disparity from the point cloud of a prior run (see prior-point-cloud)]")
       ("min-num-ip",             po::value(&global.min_num_ip)->default_value(30),
                      "The minimum number of interest points which must be found to estimate the search range.")
       ("corr-sub-seed-percent",  po::value(&global.seed_percent_pad)->default_value(0.25),
@@ -202,10 +224,28 @@ namespace asp {
                      "DEM to use in estimating the low-resolution disparity (when corr-seed-mode is 2).")
       ("disparity-estimation-dem-error", po::value(&global.disparity_estimation_dem_error)->default_value(0.0),
                      "Error (in meters) of the disparity estimation DEM.")
+      ("prior-point-cloud", po::value(&global.prior_point_cloud)->default_value(""),
+                     "The point cloud (PC.tif) of a prior run over the same area, to use in estimating the low-resolution disparity (when corr-seed-mode is 4). The value of disparity-estimation-dem-error is how much the surface may have changed since.")
+      ("sparse-disp-template-size", po::value(&global.sparse_disp_template_size)->default_value(56),
+                     "The size of the templates matched at full resolution when corr-seed-mode is 3.")
+      ("sparse-disp-spacing",    po::value(&global.sparse_disp_spacing)->default_value(64),
+                     "The distance, in pixels, between the points matched when corr-seed-mode is 3.")
+      ("sparse-disp-search-range", po::value(&global.sparse_disp_search_range)->default_value(Vector2i(484,484),"484 484"),
+                     "How far to search, in pixels, along each axis, when corr-seed-mode is 3. It is limited to a quarter of the image size.")
+      ("sparse-disp-min-score",  po::value(&global.sparse_disp_min_score)->default_value(0.4),
+                     "Matches with a normalized cross-correlation below this are rejected, when corr-seed-mode is 3.")
       ("use-local-homography",   po::bool_switch(&global.use_local_homography)->default_value(false)->implicit_value(true),
                      "Apply a local homography in each tile.")
       ("corr-timeout",           po::value(&global.corr_timeout)->default_value(900),
                      "Correlation timeout for a tile, in seconds.")
+      ("corr-timeout-fallback", po::bool_switch(&global.corr_timeout_fallback)->default_value(false)->implicit_value(true),
+                     "Give a tile half of --corr-timeout, and if no disparity is found in that time, correlate it again with the images subsampled by 2, then by 4, and a narrower search range, with a quarter of the time each. Tiles then finish within the timeout with lower quality instead of with no disparity.")
+      ("corr-resume",            po::bool_switch(&global.corr_resume)->default_value(false)->implicit_value(true),
+                     "Save each finished full-resolution correlation tile and record it in a manifest file. If correlation is interrupted, rerunning it with this option will reuse the saved tiles.")
+      ("corr-search-quantile",   po::value(&global.corr_search_quantile)->default_value(0.0),
+                     "When finding the search range of each tile from D_sub, ignore this fraction of the disparities at each end of the range. This keeps a few outliers from inflating the search range.")
+      ("corr-save-search-ranges", po::bool_switch(&global.corr_save_search_ranges)->default_value(false)->implicit_value(true),
+                     "Save the search range used for each tile to output-prefix-corr-search-ranges.txt.")
       ("stereo-algorithm",       po::value(&global.stereo_algorithm)->default_value(0),
                      "Stereo algorithm to use [0=local window, 1=SGM, 2=MGM, 3=MGM Final].")
       ("corr-blob-filter",       po::value(&global.corr_blob_filter_area)->default_value(0),
@@ -246,7 +286,9 @@ namespace asp {
       ("disable-v-subpixel",  po::bool_switch(&global.disable_v_subpixel)->default_value(false)->implicit_value(true),
                               "Disable calculation of subpixel in vertical direction.")
       ("subpixel-max-levels", po::value(&global.subpixel_max_levels)->default_value(2),
-                              "Max pyramid levels to process when using the BayesEM refinement. (0 is just a single level).");
+                              "Max pyramid levels to process when using the BayesEM refinement. (0 is just a single level).")
+      ("subpixel-in-corr",    po::bool_switch(&global.subpixel_in_corr)->default_value(false)->implicit_value(true),
+                              "With subpixel-mode 1, do the parabola fit during correlation, write the refined disparity to D.tif, and skip the refinement step.");
 
     po::options_description experimental_subpixel_options("Experimental Subpixel Options");
     experimental_subpixel_options.add_options()
@@ -290,6 +332,8 @@ namespace asp {
                               "Size of region filtered off the image border.  If unset, equal to the subpixel kernel size.")
       ("erode-max-size",      po::value(&global.erode_max_size)->default_value(0),
                               "Isolated blobs with no more pixels than this number should be removed.")
+      ("disparity-rounding-error", po::value(&global.disparity_rounding_error)->default_value(0.0),
+                              "Round the refined disparities, and hence the filtered ones, to a multiple of this value, in pixels, so that they compress better on disk. The inverse of a power of 2, such as 1/256 = 0.00390625, is suggested. Default: no rounding.")
       ("median-filter-size",  po::value(&global.median_filter_size)->default_value(0),
                               "Filter subpixel results with a median filter of this size. Can only be used with texture smoothing.")
       ("texture-smooth-size",  po::value(&global.disp_smooth_size)->default_value(0),
@@ -346,6 +390,20 @@ namespace asp {
        "Compute the piecewise adjustments as part of jitter correction, and then stop.")
       ("skip-computing-piecewise-adjustments", po::bool_switch(&global.skip_computing_piecewise_adjustments)->default_value(false)->implicit_value(true),
        "Skip computing the piecewise adjustments for jitter, they should have been done by now.")
+      ("piecewise-adjustment-checkpoint-interval", po::value(&global.piecewise_adjustment_checkpoint_interval)->default_value(0),
+       "Every this many iterations of solving for jitter, save the piecewise adjustments to <output prefix>-jitter-checkpoint.bin, so that solving can be continued with --resume-piecewise-adjustment if interrupted. Set to 0 to not save checkpoints.")
+      ("resume-piecewise-adjustment", po::bool_switch(&global.resume_piecewise_adjustment)->default_value(false)->implicit_value(true),
+       "Continue solving for jitter from the checkpoint saved by an interrupted run with the same inputs and options.")
+      ("fuse-rfne-fltr-tri", po::bool_switch(&global.fuse_rfne_fltr_tri)->default_value(false)->implicit_value(true),
+       "Skip writing RD.tif and F.tif. Instead, during triangulation do refinement and filtering in memory, one tile at a time, starting from D.tif.")
+      ("direct-dem-spacing", po::value(&global.direct_dem_spacing)->default_value(0.0),
+       "If positive, skip writing PC.tif and instead grid the triangulated points into a DEM with this spacing, saved as <output prefix>-DEM.tif. The spacing is in the units of the projection. Set to 0 to write the point cloud.")
+      ("direct-dem-t_srs", po::value(&global.direct_dem_t_srs)->default_value(""),
+       "The projection of the DEM written with --direct-dem-spacing, as a PROJ.4 string. Default: longitude-latitude on the datum of the images.")
+      ("direct-dem-errorimage", po::bool_switch(&global.direct_dem_errorimage)->default_value(false)->implicit_value(true),
+       "With --direct-dem-spacing, also write the gridded triangulation error, as <output prefix>-IntersectionErr.tif.")
+      ("quick-look", po::bool_switch(&global.quick_look)->default_value(false)->implicit_value(true),
+       "Make a coarse DEM, <output prefix>-QuickLook-DEM.tif, from the low-resolution disparity D_sub only, skipping full-resolution correlation, refinement, filtering, and the point cloud. The options --direct-dem-spacing (default: found from the points), --direct-dem-t_srs, and --direct-dem-errorimage apply to it.")
       ;
   }
 
@@ -377,6 +435,10 @@ namespace asp {
        "Delete any subsampled and other files created by the GUI when exiting.")
       ("create-image-pyramids-only",   po::bool_switch(&global.create_image_pyramids_only)->default_value(false)->implicit_value(true),
        "Without starting the GUI, build multi-resolution pyramids for the inputs, to be able to load them fast later.")
+      ("pyramid-cache-dir", po::value(&global.pyramid_cache_dir)->default_value(""),
+       "Keep the multi-resolution pyramids of the inputs in this directory, to reuse them in later sessions, including for images in read-only locations. Default: next to each image, or in the current directory.")
+      ("pyramid-cache-size-mb", po::value(&global.pyramid_cache_size_mb)->default_value(10240),
+       "With --pyramid-cache-dir, keep the cache within this size, by removing the pyramids used least recently.")
       ;
   }
 
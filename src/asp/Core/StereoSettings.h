@@ -107,15 +107,24 @@ namespace asp {
                                             ///  of the left/right edges of the images being matched.
     bool   ip_normalize_tiles;              ///< Individually normalize tiles for IP detection.
     bool   ip_debug_images;                 ///< Write debug interest point images.
+    std::string ip_cache_dir;               ///< Reuse interest points and matches saved here.
     
     double nodata_value;                    ///< Pixels with values less than or equal to this number are treated as no-data.
                                             //  This overrides the nodata values from input images.
     double nodata_pixel_percentage;         ///< Percentage of low-value pixels treated as no-data
     double nodata_optimal_threshold_factor; ///< Pixels with values less than this factor times the optimal Otsu threshold are treated as no-data
+    double stats_quantile_error;            ///< Sample images for statistics so that quantiles are within this error, or use all pixels if 0
     bool   skip_rough_homography;           /// Use this if datum-based rough homography fails. 
     bool   skip_image_normalization;        ///< Skip the step of normalizing the values of input images and removing nodata-pixels. Create instead symbolic links to original images.
+    bool   wv_correct;                      ///< Correct the CCD artifacts of WV01 and WV02 images while preprocessing them, as wv_correct does
     bool   part_of_multiview_run;           ///< If this run is part of a larger multiview run
     std::string datum;                      ///< The datum to use with RPC camera models
+    double isis_linescan_approx_error;      ///< Use a sampled approximation of ISIS linescan cameras if within this many pixels
+    double rpc_approximation_error;         ///< Project into RPC fits of the cameras if within this many pixels
+    vw::Vector2 rpc_approximation_height_range; ///< The heights over which the RPC approximations are fit
+    std::string camera_cache_dir;           ///< Cache here the DG and RPC cameras read from XML files, and the RPC approximations
+    double lens_lookup_table_spacing;       ///< Tabulate the lens distortion of pinhole cameras with nodes this many pixels apart
+    double lens_lookup_table_error;         ///< Use the exact lens distortion where the table is off by more than this
 
     // Correlation Options
     float slogW;                      ///< Preprocessing filter width
@@ -151,8 +160,17 @@ namespace asp {
     bool skip_low_res_disparity_comp;
     std::string disparity_estimation_dem;     // DEM to use in estimating the low-resolution disparity
     double disparity_estimation_dem_error; // Error (in meters) of the disparity estimation DEM
+    std::string prior_point_cloud;            // Point cloud of a prior run, for corr-seed-mode 4
+    int    sparse_disp_template_size; // Template size for corr-seed-mode 3
+    int    sparse_disp_spacing;       // Distance between the matched points for corr-seed-mode 3
+    vw::Vector2i sparse_disp_search_range; // Half-width of the search for corr-seed-mode 3
+    double sparse_disp_min_score;     // Smallest correlation accepted for corr-seed-mode 3
     bool   use_local_homography;      // Apply a local homography in each tile
     int    corr_timeout;              // Correlation timeout for a tile, in seconds
+    bool   corr_timeout_fallback;     // On timeout, correlate the tile again at lower resolution
+    bool   corr_resume;               // Save finished tiles and reuse them when rerun
+    double corr_search_quantile;      // Fraction of D_sub outliers to ignore in the tile search range
+    bool   corr_save_search_ranges;   // Save the search range of each tile
     int    stereo_algorithm;          // 0 = Default local window search method.
                                       // 1 = Slower SGM method.
                                       // 2 = Even slower smooth SGM method.
@@ -173,6 +191,7 @@ namespace asp {
     vw::Vector2i subpixel_kernel;     // Subpixel correlation kernel
     bool disable_h_subpixel, disable_v_subpixel;
     vw::uint16 subpixel_max_levels;   // Max pyramid levels to process. 0 hits only once.
+    bool subpixel_in_corr;            // Do parabola subpixel in stereo_corr and skip stereo_rfne
 
     // Experimental Subpixel Options (mode 3 only)
     int subpixel_em_iter;
@@ -190,6 +209,7 @@ namespace asp {
     int    rm_cleanup_passes;         // Number of times to perform cleanup
                                       // in the post-processing phase
     int  erode_max_size;              // Max island size in pixels that it'll remove
+    double disparity_rounding_error;  // Round the subpixel disparities to a multiple of this
     bool enable_fill_holes;           // If to enable hole-filling
     bool disable_fill_holes;          // This obsolete parameter is ignored
     int  fill_hole_max_size;          // Maximum hole size in pixels that we'll attempt to fill
@@ -217,6 +237,8 @@ namespace asp {
     double piecewise_adjustment_camera_weight;
     bool   skip_computing_piecewise_adjustments;
     bool   compute_piecewise_adjustments_only;
+    int    piecewise_adjustment_checkpoint_interval;
+    bool   resume_piecewise_adjustment;
 
     bool   compute_error_vector;              // Compute the triangulation error vector, not just its length
 
@@ -227,6 +249,11 @@ namespace asp {
     bool   compute_point_cloud_center_only;   // Only compute the center of triangulated point cloud and exit.
     bool   skip_point_cloud_center_comp;
     bool   unalign_disparity;                 // Compute disparity between unaligned images
+    bool   fuse_rfne_fltr_tri;                // Do refinement and filtering in memory as part of triangulation
+    double direct_dem_spacing;                // If positive, write a DEM with this spacing instead of the point cloud
+    std::string direct_dem_t_srs;             // The projection of that DEM
+    bool   direct_dem_errorimage;             // Also write the gridded triangulation error
+    bool   quick_look;                        // Make a coarse DEM from D_sub only
     
     // stereo_gui options
     int grid_cols;
@@ -239,6 +266,8 @@ namespace asp {
     std::string match_file, gcp_file;
     bool delete_temporary_files_on_exit;
     bool create_image_pyramids_only;
+    std::string pyramid_cache_dir;
+    double pyramid_cache_size_mb;
 
     // DG Options
     bool disable_correct_velocity_aberration;
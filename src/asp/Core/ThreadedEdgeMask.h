@@ -18,8 +18,10 @@
 
 #include <vw/Core/System.h>
 #include <vw/Core/ThreadPool.h>
+#include <vw/Core/Thread.h>
 #include <vw/Image/MaskViews.h>
 #include <boost/foreach.hpp>
+#include <limits>
 
 #ifndef __ASP_CORE_THREADEDEDGEMASK_H__
 #define __ASP_CORE_THREADEDEDGEMASK_H__
@@ -51,6 +53,7 @@ namespace asp {
       typedef std::vector<vw::int32> Array;
       typedef boost::shared_array<vw::int32> SharedArray;
       SharedArray g_left, g_right, g_top, g_bottom;
+      vw::Mutex & m_merge_mutex;
       Array       m_left, m_right, m_top, m_bottom;
       // This how much we increment after we test a pixel. Set to 1 if
       // you wish to test every pixel.
@@ -60,9 +63,10 @@ namespace asp {
                    typename ViewT::pixel_type mask_value,
                    vw::int32 search_step,
                    vw::BBox2i bbox, SharedArray left, SharedArray right,
-                   SharedArray top, SharedArray bottom ) :
+                   SharedArray top, SharedArray bottom, vw::Mutex & merge_mutex ) :
         m_view(view), m_mask_value(mask_value), m_bbox(bbox), 
-        g_left(left), g_right(right), g_top(top), g_bottom(bottom), 
+        g_left(left), g_right(right), g_top(top), g_bottom(bottom),
+        m_merge_mutex(merge_mutex), 
         m_left( m_bbox.height() ), m_right( m_bbox.height() ), 
         m_top( m_bbox.width() ), m_bottom( m_bbox.width() ), STEP_SIZE(search_step) {
 
@@ -72,6 +76,35 @@ namespace asp {
         std::fill( m_bottom.begin(), m_bottom.end(), -1 );
       }
 
+      // For each column, the first row in the sequence start, start +
+      // step, start + 2*step, ... with a valid pixel, or the first row
+      // of that sequence out of the tile. The tile is read along its
+      // rows, which is how it is stored, rather than down each column.
+      template <class ImageT>
+      void sweep_columns( ImageT const& copy, vw::int32 start, vw::int32 step,
+                          Array & hit ) const {
+        using namespace vw;
+        const int32 NOT_HIT = std::numeric_limits<int32>::min();
+        int32 cols = copy.cols(), rows = copy.rows();
+        hit.assign( cols, NOT_HIT );
+        int32 remaining = cols, j = start;
+        for ( ; j >= 0 && j < rows && remaining > 0; j += step ) {
+          typename ImageT::pixel_type const* row = &copy(0,j);
+          for ( int32 i = 0; i < cols; ++i ) {
+            if ( hit[i] == NOT_HIT && !(row[i] == m_mask_value) ) {
+              hit[i] = j;
+              --remaining;
+            }
+          }
+        }
+        // Find where the sequence leaves the tile, if we stopped early
+        while ( j >= 0 && j < rows )
+          j += step;
+        for ( int32 i = 0; i < cols; ++i )
+          if ( hit[i] == NOT_HIT )
+            hit[i] = j;
+      }
+
       void operator()() {
         using namespace vw;
 
@@ -81,11 +114,12 @@ namespace asp {
         { // Detecting Edges
           // Search left and right side
           for ( int32 j = 0; j < copy.rows(); ++j ) { // Loop up through the rows in the local tile
+            typename ViewT::pixel_type const* row = &copy(0,j);
             int32 i = 0;
-            while ( i < copy.cols() && copy(i,j) == m_mask_value ) // Move from left to right in row by STEP_SIZE
+            while ( i < copy.cols() && row[i] == m_mask_value )    // Move from left to right in row by STEP_SIZE
               i += STEP_SIZE;                                      //    until we hit an invalid pixel
             if ( i > 0 ) i -= STEP_SIZE;                           // Walk back one step if we are not at col 0
-            while ( i < copy.cols() && copy(i,j) == m_mask_value ) // Now do the same thing but in steps of 1
+            while ( i < copy.cols() && row[i] == m_mask_value )    // Now do the same thing but in steps of 1
               ++i;
             if ( i > 0 ) --i;
             // Early exit condition if entire row was nodata
@@ -94,21 +128,25 @@ namespace asp {
             m_left[j] = i;                                         // Now we have the left-most valid column in the row
 
             i = copy.cols() - 1;                                   // Do the same thing going right to left
-            while ( i >= 0 && copy(i,j) == m_mask_value )
+            while ( i >= 0 && row[i] == m_mask_value )
               i -= STEP_SIZE;
             if ( i < copy.cols() - 1 )
               i += STEP_SIZE;
-            while ( i >= 0 && copy(i,j) == m_mask_value )
+            while ( i >= 0 && row[i] == m_mask_value )
               --i;
             if ( i < copy.cols() - 1 )
               ++i;
             m_right[j] = i;
           }
-                                                                   // Now find the first valid rows from the bottom
+
+          // Now find the first valid rows from the bottom and from the
+          // top. The coarse search in steps of STEP_SIZE is done for all
+          // columns at once, then each column is refined in steps of 1.
+          Array top_hits, bottom_hits;
+          sweep_columns( copy, 0, STEP_SIZE, top_hits );
+          sweep_columns( copy, copy.rows()-1, -STEP_SIZE, bottom_hits );
           for ( int32 i = 0; i < copy.cols(); ++i ) {
-            int32 j = 0;
-            while ( j < copy.rows() && copy(i,j) == m_mask_value )
-              j += STEP_SIZE;
+            int32 j = top_hits[i];
             if ( j > 0 )
               j -= STEP_SIZE;
             while ( j < copy.rows() && copy(i,j) == m_mask_value )
@@ -120,9 +158,7 @@ namespace asp {
               continue; // We're keeping top and bottom as -1
             m_top[i] = j;
 
-            j = copy.rows()-1;                                     // And the first valid rows from the top
-            while ( j >= 0 && copy(i,j) == m_mask_value )
-              j -= STEP_SIZE;
+            j = bottom_hits[i];                                    // And the first valid rows from the top
             if ( j < copy.rows()-1 )
               j += STEP_SIZE;
             while ( j >= 0 && copy(i,j) == m_mask_value )
@@ -133,7 +169,9 @@ namespace asp {
           }
         }
 
-        { // Merging result back into global perspective
+        { // Merging result back into global perspective. Tiles in the
+          // same rows or columns update the same entries.
+          Mutex::Lock lock( m_merge_mutex );
           int32 l = 0;
           for ( int32 j = m_bbox.min()[1];                      // Loop through rows
                 j < m_bbox.max()[1]; j++ ) {
@@ -215,6 +253,7 @@ namespace asp {
       std::fill( m_bottom.get(), m_bottom.get()+view.cols(), 0           );
 
       // Calculating edges in parallel
+      Mutex merge_mutex;
       FifoWorkQueue queue( vw_settings().default_num_threads() );
 
       std::vector<BBox2i> bboxes = subdivide_bbox( m_view, block_size, block_size );
@@ -233,7 +272,8 @@ namespace asp {
       BOOST_FOREACH( BBox2i const& box, bboxes ) {
         VW_OUT(DebugMessage, "threadededgemask") << "Created EdgeMaskTask for " << box << std::endl;
         boost::shared_ptr<EdgeMaskTask> task(new EdgeMaskTask(m_view, mask_value, search_step, box, 
-                                                              m_left, m_right, m_top, m_bottom ) );
+                                                              m_left, m_right, m_top, m_bottom,
+                                                              merge_mutex ) );
         queue.add_task(task);
       }
       queue.join_all(); // Wait for all tasks to complete
@@ -0,0 +1,123 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file TilePool.h
+///
+/// Reuse of the scratch images of a tile. The views which work on a
+/// tile at a time allocate several images the size of the tile, and
+/// free them when the tile is done. As all tiles of a run have nearly
+/// the same size, the buffers of one tile can be handed to the next
+/// tile processed by the same thread, rather than going to the heap
+/// each time.
+///
+/// Each thread keeps a few freed images of each pixel type, and an
+/// image is reused only if its size is the same as the one asked
+/// for. No locking is needed, as no image moves between threads.
+
+#ifndef __ASP_CORE_TILE_POOL_H__
+#define __ASP_CORE_TILE_POOL_H__
+
+#include <vw/Image/ImageView.h>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/tss.hpp>
+#include <vector>
+
+namespace asp {
+
+  namespace detail {
+
+    /// The freed images of one pixel type for the current thread.
+    template <class PixelT>
+    class TilePool: private boost::noncopyable {
+    public:
+      /// How many freed images a thread keeps, per pixel type.
+      static const size_t max_images = 4;
+
+      static TilePool& instance() {
+        static boost::thread_specific_ptr<TilePool> pools;
+        if (pools.get() == NULL)
+          pools.reset(new TilePool);
+        return *pools;
+      }
+
+      /// An image of the given size. Its pixels are not initialized.
+      vw::ImageView<PixelT> acquire(int cols, int rows) {
+        for (size_t i = 0; i < m_free.size(); i++) {
+          if (m_free[i].cols() == cols && m_free[i].rows() == rows) {
+            vw::ImageView<PixelT> img = m_free[i];
+            m_free.erase(m_free.begin() + i);
+            return img;
+          }
+        }
+        return vw::ImageView<PixelT>(cols, rows);
+      }
+
+      /// Keep an image for later. The oldest one is dropped if there are
+      /// too many.
+      void release(vw::ImageView<PixelT> const& img) {
+        if (img.cols() <= 0 || img.rows() <= 0)
+          return;
+        if (m_free.size() >= max_images)
+          m_free.erase(m_free.begin());
+        m_free.push_back(img);
+      }
+
+      size_t size() const { return m_free.size(); }
+
+    private:
+      TilePool() {}
+      std::vector< vw::ImageView<PixelT> > m_free;
+    };
+
+    template <class PixelT>
+    const size_t TilePool<PixelT>::max_images;
+
+  } // end namespace detail
+
+  /// A scratch image of a tile, taken from the pool of the current
+  /// thread and given back to it when this object goes out of scope.
+  /// The pixels are not initialized.
+  ///
+  /// The image must not be returned or otherwise kept past the life of
+  /// this object, as an ImageView assignment shares rather than copies
+  /// the pixels; copy() it instead. If the image is assigned a different
+  /// buffer, that buffer is not pooled, so assigning to it is safe.
+  template <class PixelT>
+  class ScratchImage: private boost::noncopyable {
+  public:
+    ScratchImage(int cols, int rows):
+      m_image(detail::TilePool<PixelT>::instance().acquire(cols, rows)),
+      m_data(m_image.data()) {}
+
+    ~ScratchImage() {
+      if (m_image.data() == m_data)
+        detail::TilePool<PixelT>::instance().release(m_image);
+    }
+
+    vw::ImageView<PixelT>      & operator*()        { return m_image; }
+    vw::ImageView<PixelT> const& operator*()  const { return m_image; }
+    vw::ImageView<PixelT>      * operator->()       { return &m_image; }
+    vw::ImageView<PixelT> const* operator->() const { return &m_image; }
+
+  private:
+    vw::ImageView<PixelT> m_image;
+    PixelT*               m_data; // to tell if the image was given another buffer
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_TILE_POOL_H__
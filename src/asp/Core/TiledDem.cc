@@ -0,0 +1,212 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/FileIO/DiskImageUtils.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+#include <asp/Core/TiledDem.h>
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace vw;
+
+namespace {
+
+  // Order the points by the tile they are in
+  struct TileLess {
+    std::vector< std::pair<int, int> > const& keys;
+    TileLess(std::vector< std::pair<int, int> > const& k): keys(k) {}
+    bool operator()(size_t a, size_t b) const { return keys[a] < keys[b]; }
+  };
+
+  // The cubic convolution kernel with a = -0.5, as in Catmull-Rom splines
+  inline double cubic_weight(double x) {
+    x = std::abs(x);
+    if (x <= 1.0)
+      return (1.5*x - 2.5)*x*x + 1.0;
+    if (x < 2.0)
+      return ((-0.5*x + 2.5)*x - 4.0)*x + 2.0;
+    return 0.0;
+  }
+}
+
+asp::TiledDem::TiledDem(std::string const& dem_file, double cache_mb, int tile_size):
+  m_file(dem_file), m_dem(dem_file), m_nodata(-std::numeric_limits<float>::max()),
+  m_tile_size(tile_size), m_num_reads(0) {
+
+  VW_ASSERT(tile_size > 0, ArgumentErr() << "TiledDem: The tile size must be positive.\n");
+  if (!vw::cartography::read_georeference(m_georef, dem_file))
+    vw_throw(ArgumentErr() << "Cannot read georeference from DEM: " << dem_file << ".\n");
+  vw::read_nodata_val(dem_file, m_nodata);
+
+  double tile_mb = double(tile_size)*tile_size*sizeof(float)/(1024.0*1024.0);
+  m_max_tiles = std::max(4, int(cache_mb/tile_mb));
+}
+
+size_t asp::TiledDem::num_tile_reads() const {
+  Mutex::Lock lock(m_mutex);
+  return m_num_reads;
+}
+
+asp::TiledDem::TilePtr asp::TiledDem::get_tile(TileKey const& key) const {
+
+  {
+    Mutex::Lock lock(m_mutex);
+    std::map<TileKey, CacheEntry>::iterator it = m_cache.find(key);
+    if (it != m_cache.end()) {
+      m_lru.splice(m_lru.begin(), m_lru, it->second.lru_pos);
+      return it->second.tile;
+    }
+  }
+
+  // Read without holding the lock, so other threads can use the
+  // cached tiles meanwhile. Two threads may read the same tile, and
+  // then the first one read is kept.
+  BBox2i box(key.first*m_tile_size, key.second*m_tile_size, m_tile_size, m_tile_size);
+  box.crop(bounding_box(m_dem));
+  boost::shared_ptr<Tile> tile(new Tile(crop(m_dem, box)));
+
+  Mutex::Lock lock(m_mutex);
+  m_num_reads++;
+  std::map<TileKey, CacheEntry>::iterator it = m_cache.find(key);
+  if (it != m_cache.end())
+    return it->second.tile;
+
+  m_lru.push_front(key);
+  CacheEntry entry;
+  entry.tile    = tile;
+  entry.lru_pos = m_lru.begin();
+  m_cache[key]  = entry;
+
+  // Tiles still used by a lookup stay alive through their pointers
+  while (m_lru.size() > m_max_tiles) {
+    m_cache.erase(m_lru.back());
+    m_lru.pop_back();
+  }
+
+  return tile;
+}
+
+float asp::TiledDem::pixel(int col, int row, TileKey & key, TilePtr & tile) const {
+  TileKey here(col/m_tile_size, row/m_tile_size);
+  if (here != key || !tile) {
+    tile = get_tile(here);
+    key  = here;
+  }
+  return (*tile)(col - here.first*m_tile_size, row - here.second*m_tile_size);
+}
+
+vw::PixelMask<double>
+asp::TiledDem::lookup(Vector2 const& pix, InterpType interp,
+                      TileKey & key, TilePtr & tile) const {
+
+  PixelMask<double> out;
+  out.invalidate();
+
+  double c = pix[0], r = pix[1];
+  int ncols = cols(), nrows = rows();
+  if (!(c >= 0 && r >= 0 && c <= ncols - 1 && r <= nrows - 1)) // also false for NaN
+    return out;
+
+  if (interp == NEAREST_INTERP) {
+    float v = pixel(int(round(c)), int(round(r)), key, tile);
+    if (v == m_nodata || boost::math::isnan(v))
+      return out;
+    return PixelMask<double>(v);
+  }
+
+  int x0 = int(floor(c)), y0 = int(floor(r));
+  double dx = c - x0, dy = r - y0;
+
+  if (interp == BICUBIC_INTERP && x0 >= 1 && y0 >= 1 && x0 + 2 < ncols && y0 + 2 < nrows) {
+    double sum = 0;
+    bool good = true;
+    for (int j = -1; j <= 2 && good; j++) {
+      double wy = cubic_weight(j - dy), row_sum = 0;
+      for (int i = -1; i <= 2; i++) {
+        float v = pixel(x0 + i, y0 + j, key, tile);
+        if (v == m_nodata || boost::math::isnan(v)) {
+          good = false;
+          break;
+        }
+        row_sum += cubic_weight(i - dx)*v;
+      }
+      sum += wy*row_sum;
+    }
+    if (good)
+      return PixelMask<double>(sum);
+  }
+
+  // Bilinear, with the last row and column extended
+  int x1 = std::min(x0 + 1, ncols - 1), y1 = std::min(y0 + 1, nrows - 1);
+  float v00 = pixel(x0, y0, key, tile), v10 = pixel(x1, y0, key, tile);
+  float v01 = pixel(x0, y1, key, tile), v11 = pixel(x1, y1, key, tile);
+  if (v00 == m_nodata || v10 == m_nodata || v01 == m_nodata || v11 == m_nodata ||
+      boost::math::isnan(v00) || boost::math::isnan(v10) ||
+      boost::math::isnan(v01) || boost::math::isnan(v11))
+    return out;
+
+  return PixelMask<double>((v00*(1 - dx) + v10*dx)*(1 - dy) + (v01*(1 - dx) + v11*dx)*dy);
+}
+
+vw::PixelMask<double>
+asp::TiledDem::height_at_pixel(Vector2 const& pix, InterpType interp) const {
+  TileKey key(-1, -1);
+  TilePtr tile;
+  return lookup(pix, interp, key, tile);
+}
+
+vw::PixelMask<double>
+asp::TiledDem::height_at_lonlat(Vector2 const& lonlat, InterpType interp) const {
+  Vector2 pix;
+  try {
+    pix = m_georef.lonlat_to_pixel(lonlat);
+  } catch(...) {
+    PixelMask<double> out;
+    out.invalidate();
+    return out;
+  }
+  return height_at_pixel(pix, interp);
+}
+
+void asp::TiledDem::heights_at_pixels(std::vector<Vector2> const& pixels,
+                                      std::vector< PixelMask<double> > & heights,
+                                      InterpType interp) const {
+
+  heights.resize(pixels.size());
+
+  std::vector<TileKey> keys(pixels.size());
+  std::vector<size_t>  order(pixels.size());
+  for (size_t i = 0; i < pixels.size(); i++) {
+    order[i] = i;
+    if (pixels[i][0] >= 0 && pixels[i][1] >= 0)
+      keys[i] = TileKey(int(pixels[i][0])/m_tile_size, int(pixels[i][1])/m_tile_size);
+    else
+      keys[i] = TileKey(-1, -1);
+  }
+  std::sort(order.begin(), order.end(), TileLess(keys));
+
+  TileKey key(-1, -1);
+  TilePtr tile;
+  for (size_t k = 0; k < order.size(); k++)
+    heights[order[k]] = lookup(pixels[order[k]], interp, key, tile);
+}
@@ -0,0 +1,118 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file TiledDem.h
+///
+/// Height lookups in a DEM on disk. The DEM is read a tile at a time,
+/// only where it is queried, and the tiles most recently used are kept
+/// in memory, up to a given budget. A lookup takes the cache lock once
+/// per tile it needs, and the tiles are read with that lock released, so
+/// many threads can query the same DEM.
+///
+/// A batch of lookups is sorted by tile first, so each tile is fetched
+/// once per batch, however the points are ordered.
+
+#ifndef __ASP_CORE_TILED_DEM_H__
+#define __ASP_CORE_TILED_DEM_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/Cartography/GeoReference.h>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  class TiledDem: private boost::noncopyable {
+  public:
+
+    enum InterpType { NEAREST_INTERP, BILINEAR_INTERP, BICUBIC_INTERP };
+
+    /// Open the DEM, which must be georeferenced. At most cache_mb
+    /// megabytes of its tiles are kept in memory.
+    TiledDem(std::string const& dem_file, double cache_mb = 256, int tile_size = 256);
+
+    std::string                   const& file_name() const { return m_file;   }
+    vw::cartography::GeoReference const& georef   () const { return m_georef; }
+    int    cols()   const { return m_dem.cols(); }
+    int    rows()   const { return m_dem.rows(); }
+    double nodata() const { return m_nodata; }
+
+    /// The height at a pixel of the DEM. It is invalid outside the DEM,
+    /// or if any of the pixels it is interpolated from is no-data.
+    /// Bicubic interpolation falls back to bilinear near no-data and
+    /// at the DEM boundary.
+    vw::PixelMask<double> height_at_pixel(vw::Vector2 const& pix,
+                                          InterpType interp = BILINEAR_INTERP) const;
+
+    /// The height at a location given as lon-lat, or as the projected
+    /// point if the DEM is projected.
+    vw::PixelMask<double> height_at_lonlat(vw::Vector2 const& lonlat,
+                                           InterpType interp = BILINEAR_INTERP) const;
+
+    /// Heights at many pixels, looked up tile by tile.
+    void heights_at_pixels(std::vector<vw::Vector2> const& pixels,
+                           std::vector< vw::PixelMask<double> > & heights,
+                           InterpType interp = BILINEAR_INTERP) const;
+
+    /// The number of tiles read from disk so far.
+    size_t num_tile_reads() const;
+
+  private:
+    typedef vw::ImageView<float>               Tile;
+    typedef boost::shared_ptr<Tile const>      TilePtr;
+    typedef std::pair<int, int>                TileKey;
+    typedef std::list<TileKey>                 LruList;
+
+    struct CacheEntry {
+      TilePtr tile;
+      LruList::iterator lru_pos;
+    };
+
+    /// A tile, read from disk if not cached.
+    TilePtr get_tile(TileKey const& key) const;
+
+    /// A pixel value, with the tile it is in kept in 'tile' between
+    /// calls, so neighboring pixels take the lock only when the tile changes.
+    float pixel(int col, int row, TileKey & key, TilePtr & tile) const;
+
+    /// The interpolated height, with the current tile kept as above.
+    vw::PixelMask<double> lookup(vw::Vector2 const& pix, InterpType interp,
+                                 TileKey & key, TilePtr & tile) const;
+
+    std::string                   m_file;
+    vw::DiskImageView<float>      m_dem;
+    vw::cartography::GeoReference m_georef;
+    double                        m_nodata;
+    int                           m_tile_size;
+    size_t                        m_max_tiles;
+
+    mutable vw::Mutex                       m_mutex;  // protects all below
+    mutable std::map<TileKey, CacheEntry>   m_cache;
+    mutable LruList                         m_lru;    // most recently used first
+    mutable size_t                          m_num_reads;
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_TILED_DEM_H__
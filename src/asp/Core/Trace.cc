@@ -0,0 +1,182 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <vw/Core/Log.h>
+#include <vw/Core/Thread.h>
+#include <asp/Core/Trace.h>
+#include <boost/thread/thread.hpp>
+
+#include <sys/time.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <map>
+
+using namespace vw;
+
+namespace asp {
+
+namespace detail {
+  bool g_tracing_enabled = false;
+}
+
+namespace {
+
+  struct TraceEvent {
+    const char* name;
+    int64       start_us, dur_us;
+    int         thread;
+    BBox2i      tile;
+    std::vector<std::pair<const char*, double> > args;
+  };
+
+  // Everything recorded, guarded by one lock. Events are recorded per
+  // tile or per function call, not per pixel, so the lock is cheap.
+  struct TraceState {
+    vw::Mutex                           mutex;
+    std::string                         trace_file;
+    std::vector<TraceEvent>             events;
+    std::map<std::string, double>       counters;
+    std::map<boost::thread::id, int>    threads;
+    bool                                written;
+    TraceState(): written(false) {}
+  };
+
+  TraceState & trace_state() {
+    static TraceState * state = new TraceState(); // never destroyed, used at exit
+    return *state;
+  }
+
+  // Quote a string for JSON. The names are ours, so only quotes and
+  // backslashes need escaping.
+  std::string json_string(std::string const& str) {
+    std::string ans = "\"";
+    for (size_t i = 0; i < str.size(); i++) {
+      if (str[i] == '"' || str[i] == '\\')
+        ans += '\\';
+      ans += str[i];
+    }
+    return ans + "\"";
+  }
+
+  void write_trace() {
+    TraceState & s = trace_state();
+    vw::Mutex::Lock lock(s.mutex);
+    s.written = true; // The flag stays set, as other threads may read it
+
+    std::ofstream os(s.trace_file.c_str());
+    if (!os) {
+      vw_out(WarningMessage) << "Could not write the trace file: " << s.trace_file << std::endl;
+      return;
+    }
+    int pid = getpid();
+    os << "{\"traceEvents\": [\n";
+    for (size_t i = 0; i < s.events.size(); i++) {
+      TraceEvent const& e = s.events[i];
+      os << "{\"name\": " << json_string(e.name) << ", \"ph\": \"X\", \"ts\": " << e.start_us
+         << ", \"dur\": " << e.dur_us << ", \"pid\": " << pid << ", \"tid\": " << e.thread
+         << ", \"args\": {";
+      bool first = true;
+      if (!e.tile.empty()) {
+        os << "\"tile\": \"" << e.tile.min().x() << " " << e.tile.min().y() << " "
+           << e.tile.width() << " " << e.tile.height() << "\"";
+        first = false;
+      }
+      for (size_t k = 0; k < e.args.size(); k++) {
+        os << (first ? "" : ", ") << json_string(e.args[k].first) << ": " << e.args[k].second;
+        first = false;
+      }
+      os << "}},\n";
+    }
+    // The run totals, as metadata of the process
+    os << "{\"name\": \"counters\", \"ph\": \"M\", \"pid\": " << pid << ", \"args\": {";
+    for (std::map<std::string, double>::const_iterator it = s.counters.begin();
+         it != s.counters.end(); it++)
+      os << (it == s.counters.begin() ? "" : ", ") << json_string(it->first) << ": " << it->second;
+    os << "}}\n]}\n";
+
+    vw_out() << "Wrote trace: " << s.trace_file << std::endl;
+  }
+
+} // end anonymous namespace
+
+void configure_tracing(std::string const& prog_name) {
+  const char* prefix = getenv("ASP_TRACE_PREFIX");
+  if (prefix == NULL || std::string(prefix) == "" || tracing_enabled())
+    return;
+  std::ostringstream os;
+  os << prefix << "-" << prog_name << "-" << getpid() << ".json";
+  start_tracing(os.str());
+}
+
+void start_tracing(std::string const& trace_file) {
+  TraceState & s = trace_state();
+  {
+    vw::Mutex::Lock lock(s.mutex);
+    bool registered = (s.trace_file != "");
+    s.trace_file = trace_file;
+    detail::g_tracing_enabled = true;
+    if (registered)
+      return;
+  }
+  atexit(write_trace);
+}
+
+int64 trace_time_us() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return int64(tv.tv_sec)*1000000 + tv.tv_usec;
+}
+
+void record_trace_event(const char* name, int64 start_us, int64 end_us, BBox2i const& tile,
+                        std::vector<std::pair<const char*, double> > const& args) {
+  TraceState & s = trace_state();
+  vw::Mutex::Lock lock(s.mutex);
+  if (!tracing_enabled() || s.written)
+    return;
+
+  // The run totals of the counts
+  for (size_t i = 0; i < args.size(); i++)
+    s.counters[std::string(name) + "." + args[i].first] += args[i].second;
+
+  // Number the threads in the order they are first seen
+  boost::thread::id id = boost::this_thread::get_id();
+  std::map<boost::thread::id, int>::iterator it = s.threads.find(id);
+  if (it == s.threads.end())
+    it = s.threads.insert(std::make_pair(id, int(s.threads.size()))).first;
+
+  TraceEvent e;
+  e.name     = name;
+  e.start_us = start_us;
+  e.dur_us   = end_us - start_us;
+  e.thread   = it->second;
+  e.tile     = tile;
+  e.args     = args;
+  s.events.push_back(e);
+}
+
+void add_to_counter(const char* name, double value) {
+  if (!tracing_enabled())
+    return;
+  TraceState & s = trace_state();
+  vw::Mutex::Lock lock(s.mutex);
+  if (!s.written)
+    s.counters[name] += value;
+}
+
+} // namespace asp
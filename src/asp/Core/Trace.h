@@ -0,0 +1,118 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file Trace.h
+///
+/// Timing of the tiles and functions of a run, written when the run
+/// ends to a file in the Chrome trace event format, which can be
+/// opened in chrome://tracing or Perfetto. Tracing is on if the
+/// environment variable ASP_TRACE_PREFIX is set, and each process then
+/// writes <prefix>-<program>-<pid>.json, so the many processes of a
+/// parallel run do not overwrite each other's traces. When it is off, a
+/// scoped timer costs one check of a flag.
+///
+/// Counters, such as of the pixels or solver iterations of a tile, are
+/// attached to scoped timers, so they cost nothing per pixel, and are
+/// also summed over the run as <event>.<counter>. Other totals, such as
+/// of cache hits, can be added with add_to_counter(), which locks, so it
+/// should be called once per tile rather than once per pixel.
+///
+/// Tracing is switched on only before any threads start, by
+/// check_command_line(), and is never switched off, so the flag is
+/// read without a lock. Events recorded after the trace is written at
+/// exit are dropped.
+
+#ifndef __ASP_CORE_TRACE_H__
+#define __ASP_CORE_TRACE_H__
+
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Math/BBox.h>
+#include <boost/noncopyable.hpp>
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace asp {
+
+  namespace detail {
+    extern bool g_tracing_enabled;
+  }
+
+  /// Whether the events are being recorded.
+  inline bool tracing_enabled() { return detail::g_tracing_enabled; }
+
+  /// Start recording if ASP_TRACE_PREFIX is set. The trace is written
+  /// when the program exits. Called by check_command_line(), so tools
+  /// need not call it.
+  void configure_tracing(std::string const& prog_name);
+
+  /// Start recording, with the trace written to the given file when
+  /// the program exits. Must be called before any threads start.
+  void start_tracing(std::string const& trace_file);
+
+  /// The time, in microseconds.
+  vw::int64 trace_time_us();
+
+  /// Record an event which started at the given time. Its arguments,
+  /// such as the tile or counts, are shown with it.
+  void record_trace_event(const char* name, vw::int64 start_us, vw::int64 end_us,
+                          vw::BBox2i const& tile,
+                          std::vector<std::pair<const char*, double> > const& args);
+
+  /// Add to a counter whose total over the run is saved with the trace.
+  /// Does nothing if tracing is off.
+  void add_to_counter(const char* name, double value);
+
+  /// Record the time from construction to destruction as an event,
+  /// with the tile being processed, if any, and any counts added.
+  /// The name must be a string literal, or outlive the program.
+  class ScopedTrace: private boost::noncopyable {
+  public:
+    ScopedTrace(const char* name, vw::BBox2i const& tile = vw::BBox2i()):
+      m_name(name), m_tile(tile), m_start(0) {
+      if (tracing_enabled())
+        m_start = trace_time_us();
+    }
+
+    /// Attach a count, such as of pixels, to the event.
+    void count(const char* name, double value) {
+      if (!tracing_enabled())
+        return;
+      for (size_t i = 0; i < m_args.size(); i++) {
+        if (m_args[i].first == name) {
+          m_args[i].second += value;
+          return;
+        }
+      }
+      m_args.push_back(std::make_pair(name, value));
+    }
+
+    ~ScopedTrace() {
+      if (tracing_enabled())
+        record_trace_event(m_name, m_start, trace_time_us(), m_tile, m_args);
+    }
+
+  private:
+    const char* m_name;
+    vw::BBox2i  m_tile;
+    vw::int64   m_start;
+    std::vector<std::pair<const char*, double> > m_args;
+  };
+
+} // namespace asp
+
+#endif//__ASP_CORE_TRACE_H__
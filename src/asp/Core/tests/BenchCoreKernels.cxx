@@ -0,0 +1,123 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+// Timing of the software renderer and of the interest point matcher,
+// on synthetic data of fixed size. Run with 'make bench'.
+
+#include <test/Helpers.h>
+#include <test/Benchmark.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Camera/PinholeModel.h>
+#include <vw/Camera/LensDistortion.h>
+#include <vw/Cartography/CameraBBox.h>
+#include <asp/Core/SoftwareRenderer.h>
+#include <asp/Core/InterestPointMatching.h>
+
+using namespace vw;
+using namespace asp;
+using namespace vw::test;
+
+namespace {
+
+  // Fill a 512 x 512 buffer with a mesh of 2 x 64 x 64 triangles
+  struct RenderMesh {
+    ImageView<float> buffer;
+    stereo::SoftwareRenderer renderer;
+    std::vector<float> vertices, colors;
+    RenderMesh(): buffer(512, 512), renderer(512, 512, &buffer(0,0)) {
+      int num = 64;
+      double step = 512.0/num;
+      for (int i = 0; i < num; i++) {
+        for (int j = 0; j < num; j++) {
+          float x0 = i*step, y0 = j*step, x1 = x0 + step, y1 = y0 + step;
+          float tri[12] = {x0, y0, x1, y0, x1, y1,   x0, y0, x1, y1, x0, y1};
+          vertices.insert(vertices.end(), tri, tri + 12);
+          for (int k = 0; k < 6; k++)
+            colors.push_back(float(i + j));
+        }
+      }
+      renderer.Ortho2D(0, 512, 0, 512);
+      renderer.SetVertexPointer(2, &vertices[0]);
+      renderer.SetColorPointer(1, &colors[0]);
+    }
+    void operator()() {
+      renderer.Clear(0.0);
+      for (size_t k = 0; k < vertices.size()/6; k++)
+        renderer.DrawPolygon(3*k, 3);
+      benchmark_sink() += buffer(256, 256);
+    }
+  };
+
+  camera::PinholeModel dg_like_camera(Vector3 const& center) {
+    return camera::PinholeModel(center,
+                                Quat(-0.0794638597818,-0.0396316037899,
+                                     -0.40945443655,-0.907998840691).rotation_matrix(),
+                                1.65e6, 1.65e6, 17500, 17500,
+                                Vector3(1,0,0), Vector3(0,1,0), Vector3(0,0,1),
+                                camera::NullLensDistortion());
+  }
+
+  // Match 1600 interest points, with 64-float descriptors, seen by
+  // two cameras.
+  struct MatchIp {
+    cartography::Datum datum;
+    camera::PinholeModel cam1, cam2;
+    ip::InterestPointList ip1, ip2;
+    std::vector<size_t> indices;
+    MatchIp(): datum("WGS84"),
+               cam1(dg_like_camera(Vector3(-414653.934175,-2305310.05912,-6759174.5439))),
+               cam2(dg_like_camera(Vector3(-374653.934175,-2305310.05912,-6759174.5439))) {
+      srand(7);
+      int num = 40;
+      for (int i = 0; i < num; i++) {
+        for (int j = 0; j < num; j++) {
+          Vector2 pix1((i + 0.5)*35000/num, (j + 0.5)*35000/num);
+          Vector3 xyz = cartography::datum_intersection(datum, &cam1, pix1);
+          Vector2 pix2 = cam2.point_to_pixel(xyz);
+          ip::InterestPoint p1(pix1.x(), pix1.y()), p2(pix2.x(), pix2.y());
+          p1.descriptor.set_size(64);
+          p2.descriptor.set_size(64);
+          for (int k = 0; k < 64; k++) {
+            p1.descriptor[k] = float(rand())/RAND_MAX;
+            p2.descriptor[k] = p1.descriptor[k] + 0.01*float(rand())/RAND_MAX;
+          }
+          ip1.push_back(p1);
+          ip2.push_back(p2);
+        }
+      }
+    }
+    void operator()() {
+      bool single_threaded_camera = false;
+      EpipolarLinePointMatcher matcher(single_threaded_camera, 0.8, 1e3, datum);
+      matcher(ip1, ip2, DETECT_IP_METHOD_INTEGRAL, &cam1, &cam2,
+              TransformRef(TranslateTransform(0,0)), TransformRef(TranslateTransform(0,0)),
+              indices);
+      benchmark_sink() += indices.size();
+    }
+  };
+}
+
+TEST(Benchmark, SoftwareRenderer) {
+  RenderMesh render;
+  benchmark("render_mesh_512x512", render);
+}
+
+TEST(Benchmark, InterestPointMatching) {
+  MatchIp match;
+  benchmark("epipolar_ip_matching_1600", match);
+}
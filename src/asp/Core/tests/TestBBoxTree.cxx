@@ -0,0 +1,62 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/BBoxTree.h>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace vw;
+using namespace asp;
+
+TEST( BBoxTree, MatchesLinearSearch ) {
+
+  srand(42);
+  std::vector<BBox2> boxes;
+  for (int i = 0; i < 1000; i++) {
+    Vector2 corner(rand() % 1000, rand() % 1000);
+    Vector2 size  (rand() % 30,   rand() % 30  );
+    boxes.push_back(BBox2(corner, corner + size));
+  }
+  boxes.push_back(BBox2()); // empty, never found
+
+  BBoxTree tree;
+  tree.build(boxes);
+  EXPECT_EQ(boxes.size() - 1, tree.size());
+
+  for (int q = 0; q < 100; q++) {
+    Vector2 corner(rand() % 1000, rand() % 1000);
+    Vector2 size  (rand() % 100,  rand() % 100 );
+    BBox2 query(corner, corner + size);
+
+    std::vector<size_t> expected, found;
+    for (size_t i = 0; i < boxes.size(); i++) {
+      if (!boxes[i].empty() && boxes[i].intersects(query))
+        expected.push_back(i);
+    }
+    tree.intersecting(query, found);
+    ASSERT_EQ(expected.size(), found.size());
+    for (size_t i = 0; i < expected.size(); i++)
+      EXPECT_EQ(expected[i], found[i]);
+  }
+
+  // Boxes which only touch the query are found
+  std::vector<size_t> found;
+  tree.intersecting(BBox2(boxes[0].max(), boxes[0].max() + Vector2(1, 1)), found);
+  EXPECT_TRUE(std::find(found.begin(), found.end(), size_t(0)) != found.end());
+}
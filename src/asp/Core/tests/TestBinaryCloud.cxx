@@ -0,0 +1,71 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/BinaryCloud.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST( BinaryCloud, WriteRead ) {
+
+  UnlinkName cloud_name("binary_cloud.pcb");
+  EXPECT_TRUE(is_binary_cloud(cloud_name));
+
+  cartography::GeoReference georef;
+  georef.set_well_known_geogcs("WGS84");
+
+  // Two chunks, one ended early and one split by the chunk size
+  {
+    BinaryCloudWriter writer(cloud_name, BINARY_CLOUD_ERROR | BINARY_CLOUD_TIME,
+                             &georef, 3);
+    Vector3 a = georef.datum().geodetic_to_cartesian(Vector3(10, 20, 0));
+    Vector3 b = georef.datum().geodetic_to_cartesian(Vector3(-100, -30, 0));
+    writer.add_point(a, 1.0, 0.5, 100.0);
+    writer.end_chunk();
+    for (int i = 0; i < 4; i++)
+      writer.add_point(b + Vector3(i, 0, 0), 1.0, 0.25*i, 200.0 + i);
+    writer.close();
+  }
+
+  BinaryCloudReader reader(cloud_name);
+  EXPECT_EQ(uint64(5), reader.num_points());
+  EXPECT_EQ(3, reader.num_chunks());
+  EXPECT_EQ(2, reader.num_attribute_columns());
+  EXPECT_TRUE(reader.has_georef());
+  EXPECT_EQ(binary_cloud_size(cloud_name), reader.num_points());
+
+  BinaryCloudPoints points;
+  reader.read_chunk(2, points);
+  ASSERT_EQ(size_t(1), points.size());
+  EXPECT_EQ(0.75,  points.attributes[0][0]); // error
+  EXPECT_EQ(203.0, points.attributes[1][0]); // time
+
+  // Only the first chunk is near this lon-lat box, also when shifted by 360
+  std::vector<int> chunks = reader.chunks_in_lonlat_box(BBox2(5, 15, 10, 10));
+  ASSERT_EQ(size_t(1), chunks.size());
+  EXPECT_EQ(0, chunks[0]);
+  chunks = reader.chunks_in_lonlat_box(BBox2(365, 15, 10, 10));
+  ASSERT_EQ(size_t(1), chunks.size());
+  EXPECT_EQ(3, int(reader.chunks_in_lonlat_box(BBox2()).size()));
+
+  reader.read_chunk(0, points);
+  ASSERT_EQ(size_t(1), points.size());
+  EXPECT_EQ(0, int(reader.chunks_in_box(BBox3(points.xyz[0] + Vector3(1, 1, 1),
+                                              points.xyz[0] + Vector3(2, 2, 2))).size()));
+  EXPECT_EQ(1, int(reader.chunks_in_box(BBox3(points.xyz[0], points.xyz[0])).size()));
+}
@@ -0,0 +1,97 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/CameraGrid.h>
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  // A smooth transform, failing to project in a small region
+  struct HoleTrans {
+    Vector2 reverse(Vector2 const& p) const {
+      if (p.x() > 40 && p.x() < 50 && p.y() > 40 && p.y() < 50)
+        vw_throw(ArgumentErr() << "No projection.\n");
+      return Vector2(2*p.x() + 0.001*p.x()*p.x(), 3*p.y() + 5);
+    }
+    BBox2i reverse_bbox(BBox2i const& bbox) const { return bbox; }
+  };
+
+  ImageView<CameraGridPixelT> make_grid(int spacing, double max_error) {
+    int cols = (100 - 1)/spacing + 2, rows = (80 - 1)/spacing + 2;
+    return CameraGridView<HoleTrans>(HoleTrans(), spacing, max_error, cols, rows);
+  }
+
+  bool projects(Vector2 const& p) {
+    return !(p.x() > 40 && p.x() < 50 && p.y() > 40 && p.y() < 50);
+  }
+}
+
+TEST( CameraGrid, NodesAndFlags ) {
+  int spacing = 8;
+  HoleTrans trans;
+  ImageView<CameraGridPixelT> grid = make_grid(spacing, 0.1);
+
+  int num_flagged = 0;
+  for (int row = 0; row < grid.rows(); row++) {
+    for (int col = 0; col < grid.cols(); col++) {
+      Vector2 pix = spacing*Vector2(col, row);
+      if (projects(pix)) {
+        Vector2 exact = trans.reverse(pix);
+        EXPECT_NEAR(exact[0], grid(col, row)[0], 1e-3);
+        EXPECT_NEAR(exact[1], grid(col, row)[1], 1e-3);
+      } else {
+        EXPECT_TRUE(boost::math::isnan(grid(col, row)[0]));
+      }
+
+      // The last column and row of nodes are only corners
+      if (grid(col, row)[2] == 0 || col + 1 >= grid.cols() || row + 1 >= grid.rows())
+        continue;
+      num_flagged++;
+
+      // A flagged cell has projecting corners and a center within the error
+      Vector2 center = spacing*Vector2(col + 0.5, row + 0.5);
+      EXPECT_TRUE(projects(center));
+      for (int di = 0; di <= 1; di++) {
+        for (int dj = 0; dj <= 1; dj++)
+          EXPECT_TRUE(projects(spacing*Vector2(col + di, row + dj)));
+      }
+      Vector2 interp;
+      for (int k = 0; k < 2; k++)
+        interp[k] = 0.25*(grid(col, row)[k] + grid(col+1, row)[k] +
+                          grid(col, row+1)[k] + grid(col+1, row+1)[k]);
+      EXPECT_LT(norm_inf(interp - trans.reverse(center)), 0.1 + 1e-4);
+    }
+  }
+
+  // Only the four cells around the node in the hole can't be interpolated
+  EXPECT_EQ((grid.cols() - 1)*(grid.rows() - 1) - 4, num_flagged);
+
+  // The cell with the hole at its center is not flagged
+  EXPECT_EQ(0, grid(5, 5)[2]);
+}
+
+TEST( CameraGrid, TightError ) {
+  // The quadratic term is off by 0.016 pixels at the cell centers
+  ImageView<CameraGridPixelT> grid = make_grid(8, 0.01);
+  for (int row = 0; row < grid.rows(); row++) {
+    for (int col = 0; col < grid.cols(); col++)
+      EXPECT_EQ(0, grid(col, row)[2]);
+  }
+}
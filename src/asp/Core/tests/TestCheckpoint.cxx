@@ -0,0 +1,74 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/Checkpoint.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST( Checkpoint, WriteRead ) {
+
+  UnlinkName file_name("checkpoint.bin");
+
+  std::vector<double> cameras(12), empty;
+  for (size_t i = 0; i < cameras.size(); i++)
+    cameras[i] = 0.1*i - 0.5;
+
+  {
+    SolverCheckpoint checkpoint;
+    checkpoint.set_counter("pass", 2);
+    checkpoint.set_counter("iteration", 40);
+    checkpoint.set_block("cameras", &cameras[0], cameras.size());
+    checkpoint.set_block("outliers", NULL, 0);
+    checkpoint.write(file_name);
+  }
+
+  SolverCheckpoint checkpoint;
+  checkpoint.read(file_name);
+  EXPECT_EQ(2,  checkpoint.counter("pass"));
+  EXPECT_EQ(40, checkpoint.counter("iteration"));
+  EXPECT_TRUE(checkpoint.has_block("outliers"));
+  EXPECT_EQ(0u, checkpoint.block_size("outliers"));
+  EXPECT_FALSE(checkpoint.has_block("points"));
+
+  std::vector<double> out(cameras.size());
+  checkpoint.get_block("cameras", &out[0], out.size());
+  for (size_t i = 0; i < cameras.size(); i++)
+    EXPECT_EQ(cameras[i], out[i]);
+
+  // The problem must be rebuilt with the same sizes
+  std::vector<double> wrong(5);
+  EXPECT_THROW(checkpoint.get_block("cameras", &wrong[0], wrong.size()), ArgumentErr);
+  EXPECT_THROW(checkpoint.counter("level"), ArgumentErr);
+}
+
+TEST( Checkpoint, Overwrite ) {
+
+  UnlinkName file_name("checkpoint2.bin");
+
+  // A later checkpoint replaces the earlier one
+  for (int iter = 1; iter <= 3; iter++) {
+    SolverCheckpoint checkpoint;
+    checkpoint.set_counter("iteration", iter);
+    checkpoint.write(file_name);
+  }
+
+  SolverCheckpoint checkpoint;
+  checkpoint.read(file_name);
+  EXPECT_EQ(3, checkpoint.counter("iteration"));
+}
@@ -0,0 +1,148 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/ConnectedComponents.h>
+#include <cstdlib>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  // The size of the 8-connected component of each pixel, by flood fill
+  std::vector<int64> flood_fill_sizes(std::vector<unsigned char> const& mask, int cols, int rows) {
+    std::vector<int64> ans(mask.size(), 0);
+    std::vector<bool>  seen(mask.size(), false);
+    for (size_t start = 0; start < mask.size(); start++) {
+      if (!mask[start] || seen[start])
+        continue;
+      std::vector<int> stack(1, start), comp;
+      seen[start] = true;
+      while (!stack.empty()) {
+        int k = stack.back();
+        stack.pop_back();
+        comp.push_back(k);
+        int col = k % cols, row = k / cols;
+        for (int r = row - 1; r <= row + 1; r++) {
+          for (int c = col - 1; c <= col + 1; c++) {
+            if (c < 0 || r < 0 || c >= cols || r >= rows)
+              continue;
+            int nk = r*cols + c;
+            if (mask[nk] && !seen[nk]) {
+              seen[nk] = true;
+              stack.push_back(nk);
+            }
+          }
+        }
+      }
+      for (size_t i = 0; i < comp.size(); i++)
+        ans[comp[i]] = comp.size();
+    }
+    return ans;
+  }
+}
+
+TEST( ConnectedComponents, LabelMatchesFloodFill ) {
+
+  // A U shape, whose arms are joined only at the bottom, with a pixel
+  // touching one arm only diagonally, and two isolated pixels
+  int cols = 6, rows = 3;
+  unsigned char data[] = {1, 0, 0, 1, 0, 1,
+                          1, 0, 1, 0, 0, 0,
+                          1, 1, 1, 0, 1, 0};
+  std::vector<unsigned char> mask(data, data + cols*rows);
+  std::vector<int> labels;
+  std::vector<int64> sizes;
+  label_components(mask, cols, rows, labels, sizes);
+  ASSERT_EQ(3u, sizes.size());
+  EXPECT_EQ(0, labels[0]);
+  EXPECT_EQ(0, labels[3]);
+  EXPECT_EQ(0, labels[cols + 2]);
+  EXPECT_EQ(1, labels[5]);
+  EXPECT_EQ(2, labels[2*cols + 4]);
+  EXPECT_EQ(-1, labels[1]);
+  EXPECT_EQ(7, sizes[0]);
+  EXPECT_EQ(1, sizes[1]);
+  EXPECT_EQ(1, sizes[2]);
+}
+
+TEST( ConnectedComponents, TilesMatchWholeImage ) {
+
+  srand(7);
+  for (int trial = 0; trial < 50; trial++) {
+    int cols = 1 + rand() % 60, rows = 1 + rand() % 60, tile_size = 1 + rand() % 17;
+    int density = rand() % 100;
+    std::vector<unsigned char> mask(cols*rows);
+    for (size_t k = 0; k < mask.size(); k++)
+      mask[k] = (rand() % 100) < density;
+    std::vector<int64> expected = flood_fill_sizes(mask, cols, rows);
+
+    TiledComponents components(cols, rows, tile_size);
+    std::vector< std::vector<unsigned char> > tile_masks(components.tiles().size());
+    for (size_t t = 0; t < components.tiles().size(); t++) {
+      BBox2i box = components.tiles()[t];
+      for (int row = box.min().y(); row < box.max().y(); row++)
+        for (int col = box.min().x(); col < box.max().x(); col++)
+          tile_masks[t].push_back(mask[row*cols + col]);
+      std::vector<int> labels;
+      std::vector<int64> sizes;
+      label_components(tile_masks[t], box.width(), box.height(), labels, sizes);
+      components.add_tile(t, labels, sizes);
+    }
+    components.merge();
+
+    for (size_t t = 0; t < components.tiles().size(); t++) {
+      BBox2i box = components.tiles()[t];
+      std::vector<int> labels;
+      std::vector<int64> sizes;
+      label_components(tile_masks[t], box.width(), box.height(), labels, sizes);
+      components.component_sizes(t, labels, sizes);
+      for (int row = box.min().y(); row < box.max().y(); row++) {
+        for (int col = box.min().x(); col < box.max().x(); col++) {
+          int k = (row - box.min().y())*box.width() + col - box.min().x();
+          if (mask[row*cols + col])
+            ASSERT_EQ(expected[row*cols + col], sizes[labels[k]]);
+          else
+            EXPECT_EQ(-1, labels[k]);
+        }
+      }
+    }
+  }
+}
+
+TEST( ConnectedComponents, EraseSmallBlobs ) {
+
+  ImageView< PixelMask<float> > img(6, 6);
+  // A blob of 2 pixels spanning two tiles, one of 3 pixels joined
+  // diagonally across a tile corner, and one of 6 pixels
+  img(2, 0) = 1; img(3, 0) = 1;
+  img(1, 2) = 3; img(2, 2) = 3; img(3, 3) = 3;
+  for (int col = 0; col < 6; col++)
+    img(col, 5) = 2;
+
+  // Blobs with fewer than 3 pixels are erased
+  int max_size = 3, tile_size = 3;
+  ImageView< PixelMask<float> > out
+    = SmallBlobEraseView< ImageView< PixelMask<float> > >(img, max_size, tile_size);
+  EXPECT_FALSE(is_valid(out(2, 0)));
+  EXPECT_FALSE(is_valid(out(3, 0)));
+  EXPECT_TRUE(is_valid(out(1, 2)));
+  EXPECT_TRUE(is_valid(out(3, 3)));
+  for (int col = 0; col < 6; col++)
+    EXPECT_TRUE(is_valid(out(col, 5)));
+}
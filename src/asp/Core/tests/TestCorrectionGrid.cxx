@@ -0,0 +1,134 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/CorrectionGrid.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Cartography/GeoTransform.h>
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  // A smooth function, not defined in a small hole
+  struct WavyFunc {
+    bool operator()(Vector2 const& pix, Vector<double, 1> & value) const {
+      value[0] = 30.0 * std::sin(pix.x() / 300.0) * std::cos(pix.y() / 200.0);
+      return !(pix.x() > 100 && pix.x() < 120 && pix.y() > 50 && pix.y() < 60);
+    }
+  };
+
+  // The largest difference from the function over the tile, and the
+  // number of pixels where the grid and the function disagree on
+  // whether there is a value.
+  void compare(CorrectionGrid<WavyFunc, 1> const& grid, BBox2i const& bbox,
+               double & max_diff, int & num_mismatched) {
+    max_diff = 0;
+    num_mismatched = 0;
+    WavyFunc func;
+    for (int row = bbox.min().y(); row < bbox.max().y(); row++) {
+      for (int col = bbox.min().x(); col < bbox.max().x(); col++) {
+        Vector<double, 1> approx, exact;
+        bool has_approx = grid(col, row, approx);
+        bool has_exact  = func(Vector2(col, row), exact);
+        if (has_approx != has_exact) {
+          num_mismatched++;
+          continue;
+        }
+        if (has_exact)
+          max_diff = std::max(max_diff, std::abs(approx[0] - exact[0]));
+      }
+    }
+  }
+}
+
+TEST( CorrectionGrid, WithinError ) {
+  BBox2i bbox(37, 11, 250, 173);
+  double max_diff;
+  int num_mismatched;
+
+  CorrectionGrid<WavyFunc, 1> coarse(WavyFunc(), bbox, 0.1);
+  compare(coarse, bbox, max_diff, num_mismatched);
+  EXPECT_GT(coarse.step(), 1);
+  EXPECT_LT(max_diff, 0.1);
+  EXPECT_EQ(0, num_mismatched);
+
+  CorrectionGrid<WavyFunc, 1> fine(WavyFunc(), bbox, 1e-3);
+  compare(fine, bbox, max_diff, num_mismatched);
+  EXPECT_LE(fine.step(), coarse.step());
+  EXPECT_LT(max_diff, 1e-3);
+  EXPECT_EQ(0, num_mismatched);
+}
+
+TEST( CorrectionGrid, ExactWithZeroError ) {
+  BBox2i bbox(0, 0, 40, 30);
+  CorrectionGrid<WavyFunc, 1> grid(WavyFunc(), bbox, 0.0);
+  EXPECT_EQ(1, grid.step());
+
+  double max_diff;
+  int num_mismatched;
+  compare(grid, bbox, max_diff, num_mismatched);
+  EXPECT_NEAR(0.0, max_diff, 1e-12);
+  EXPECT_EQ(0, num_mismatched);
+}
+
+TEST( CorrectionGrid, AcrossUtmZones ) {
+
+  // A 30 m input grid in UTM zone 10 and the output in zone 11, next
+  // to it, as dem_mosaic sees them.
+  cartography::GeoReference in_georef, out_georef;
+  in_georef.set_well_known_geogcs("WGS84");
+  out_georef.set_well_known_geogcs("WGS84");
+  in_georef.set_UTM(10, 1);
+  out_georef.set_UTM(11, 1);
+  Matrix3x3 in_trans, out_trans;
+  in_trans.set_identity();
+  out_trans.set_identity();
+  in_trans(0, 0)  = 30;  in_trans(1, 1)  = -30;
+  out_trans(0, 0) = 30;  out_trans(1, 1) = -30;
+  in_trans(0, 2)  = 730000;  in_trans(1, 2)  = 5010000;
+  out_trans(0, 2) = 260000;  out_trans(1, 2) = 5005000;
+  in_georef.set_transform(in_trans);
+  out_georef.set_transform(out_trans);
+  cartography::GeoTransform geotrans(in_georef, out_georef);
+
+  BBox2i bbox(512, 256, 256, 200);
+  double max_error = 0.01;
+  bool refine = false;
+  CorrectionGrid<ReverseTransformFunc<cartography::GeoTransform>, 2>
+    grid(ReverseTransformFunc<cartography::GeoTransform>(&geotrans), bbox,
+         max_error, 16, refine);
+  EXPECT_EQ(16, grid.step());
+
+  double max_diff = 0;
+  for (int row = bbox.min().y(); row < bbox.max().y(); row++) {
+    for (int col = bbox.min().x(); col < bbox.max().x(); col++) {
+      Vector2 approx;
+      ASSERT_TRUE(grid(col, row, approx));
+      Vector2 exact = geotrans.reverse(Vector2(col, row));
+      max_diff = std::max(max_diff, norm_inf(approx - exact));
+    }
+  }
+  EXPECT_LT(max_diff, max_error);
+
+  // The projections at this scale are smooth enough to interpolate everywhere
+  for (int j = 0; j < grid.num_cells(1); j++) {
+    for (int i = 0; i < grid.num_cells(0); i++)
+      EXPECT_TRUE(grid.cell_valid(i, j));
+  }
+}
@@ -0,0 +1,114 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/DemSplatter.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <limits>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  // Points every half spacing over a box, with heights on a plane
+  void lattice_points(std::vector<Vector3> & points, std::vector<double> & errors) {
+    points.clear();
+    errors.clear();
+    for (int row = 0; row <= 10; row++) {
+      for (int col = 0; col <= 20; col++) {
+        points.push_back(Vector3(0.5*col, 0.5*row, 7 + 0.1*col));
+        errors.push_back(0.25);
+      }
+    }
+  }
+
+  void write_dem(DemSplatter const& splatter, std::string const& dem_file,
+                 std::string const& error_file) {
+    cartography::GeoReference georef(cartography::Datum("WGS84"));
+    cartography::GdalWriteOptions opt;
+    splatter.write(dem_file, error_file, georef, -std::numeric_limits<float>::max(), opt,
+                   ProgressCallback::dummy_instance());
+  }
+}
+
+TEST( DemSplatter, WeightedAverage ) {
+  std::vector<Vector3> points;
+  std::vector<double>  errors;
+  lattice_points(points, errors);
+
+  DemSplatter splatter(1.0, 1.0, true);
+  splatter.add_points(points, errors);
+
+  // The nodes reached by the points, within one spacing of them
+  EXPECT_EQ(BBox2i(-1, -1, 13, 8), splatter.node_box());
+
+  UnlinkName dem_name("dem_splatter-DEM.tif"), err_name("dem_splatter-IntersectionErr.tif");
+  write_dem(splatter, dem_name, err_name);
+  DiskImageView<float> dem(dem_name), err(err_name);
+  ASSERT_EQ(13, dem.cols());
+  ASSERT_EQ(8,  dem.rows());
+
+  // The points around a node inside the box are symmetric about it,
+  // so their weighted average is on the plane. The top row has the
+  // largest y.
+  for (int y = 0; y <= 5; y++) {
+    for (int x = 0; x <= 10; x++) {
+      if (x == 0 || x == 10) // The points are all on one side
+        continue;
+      EXPECT_NEAR(7 + 0.2*x, dem(x + 1, 6 - y), 1e-5);
+    }
+  }
+  for (int row = 0; row < err.rows(); row++) {
+    for (int col = 0; col < err.cols(); col++) {
+      if (err(col, row) > -1e30)
+        EXPECT_NEAR(0.25, err(col, row), 1e-6);
+    }
+  }
+}
+
+TEST( DemSplatter, SplitPointsAndTiles ) {
+  std::vector<Vector3> points;
+  std::vector<double>  errors;
+  lattice_points(points, errors);
+
+  // All points at once, and in two halves with small tiles, so that
+  // points are added to several tiles.
+  DemSplatter whole(1.0, 1.5, false);
+  whole.add_points(points, errors);
+
+  DemSplatter split(1.0, 1.5, false, 4);
+  size_t half = points.size()/2;
+  std::vector<Vector3> points1(points.begin(), points.begin() + half);
+  std::vector<Vector3> points2(points.begin() + half, points.end());
+  std::vector<double>  errors1(errors.begin(), errors.begin() + half);
+  std::vector<double>  errors2(errors.begin() + half, errors.end());
+  split.add_points(points2, errors2);
+  split.add_points(points1, errors1);
+
+  EXPECT_EQ(whole.node_box(), split.node_box());
+
+  UnlinkName whole_name("dem_splatter_whole-DEM.tif"), split_name("dem_splatter_split-DEM.tif");
+  write_dem(whole, whole_name, "");
+  write_dem(split, split_name, "");
+  DiskImageView<float> whole_dem(whole_name), split_dem(split_name);
+  ASSERT_EQ(whole_dem.cols(), split_dem.cols());
+  ASSERT_EQ(whole_dem.rows(), split_dem.rows());
+  for (int row = 0; row < whole_dem.rows(); row++) {
+    for (int col = 0; col < whole_dem.cols(); col++)
+      EXPECT_NEAR(whole_dem(col, row), split_dem(col, row), 1e-4);
+  }
+}
@@ -0,0 +1,84 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/HoleFill.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST( HoleFill, NumLevels ) {
+  EXPECT_EQ(0, pyramid_hole_fill_levels(0,   100, 100));
+  EXPECT_EQ(1, pyramid_hole_fill_levels(1,   100, 100));
+  EXPECT_EQ(2, pyramid_hole_fill_levels(2,   100, 100));
+  EXPECT_EQ(4, pyramid_hole_fill_levels(10,  100, 100));
+  // No more levels once the image is a single pixel
+  EXPECT_EQ(3, pyramid_hole_fill_levels(1000,  8,   5));
+}
+
+TEST( HoleFill, FillsPlane ) {
+  // A plane with a hole in the middle
+  int cols = 40, rows = 30;
+  ImageView< PixelMask<float> > image(cols, rows);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      image(col, row) = PixelMask<float>(2.0*col + 3.0*row);
+      if (col >= 15 && col < 22 && row >= 10 && row < 16)
+        image(col, row).invalidate();
+    }
+  }
+  ImageView< PixelMask<float> > orig = copy(image);
+
+  pyramid_fill_holes(image, 8);
+
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      ASSERT_TRUE(is_valid(image(col, row)));
+      if (is_valid(orig(col, row))) {
+        // Valid values are kept exactly
+        EXPECT_EQ(orig(col, row).child(), image(col, row).child());
+      } else {
+        // The filled values are between the ones around the hole, and
+        // close to the plane
+        EXPECT_NEAR(2.0*col + 3.0*row, image(col, row).child(), 2.5);
+        EXPECT_GE(image(col, row).child(), 2.0*15 + 3.0*10 - 5.0);
+        EXPECT_LE(image(col, row).child(), 2.0*21 + 3.0*15 + 5.0);
+      }
+    }
+  }
+}
+
+TEST( HoleFill, KeepsFarPixels ) {
+  // With a short length, pixels far from valid data are not filled
+  int cols = 64, rows = 64;
+  ImageView< PixelMask<float> > image(cols, rows);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      image(col, row) = PixelMask<float>(5.0);
+      if (col >= 8)
+        image(col, row).invalidate();
+    }
+  }
+
+  pyramid_fill_holes(image, 2);
+
+  EXPECT_TRUE(is_valid(image(8, 10)));
+  EXPECT_NEAR(5.0, image(8, 10).child(), 1e-5);
+  EXPECT_FALSE(is_valid(image(40, 10)));
+  EXPECT_FALSE(is_valid(image(63, 63)));
+}
@@ -21,6 +21,7 @@
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/LensDistortion.h>
 #include <vw/Cartography/CameraBBox.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
 
 using namespace vw;
 using namespace asp;
@@ -69,3 +70,39 @@ TEST( InterestPointMatching, DatumIntersection ) {
   }
 
 }
+
+TEST( InterestPointMatching, IpCacheKey ) {
+
+  cartography::GeoReference georef;
+  cartography::GdalWriteOptions opt;
+  bool has_georef = false, has_nodata = false;
+  UnlinkName small("ip_cache_small.tif"), large("ip_cache_large.tif");
+  vw::cartography::write_gdal_image(small, ImageView<float>(30, 60), has_georef, georef,
+                                    has_nodata, 0, opt);
+  vw::cartography::write_gdal_image(large, ImageView<float>(40, 60), has_georef, georef,
+                                    has_nodata, 0, opt);
+
+  // No key without a cache directory, or for a missing file
+  stereo_settings().ip_cache_dir = "";
+  EXPECT_EQ( "", ip_cache_key(small, "", 500, 0) );
+  stereo_settings().ip_cache_dir = "ip_cache";
+  EXPECT_EQ( "", ip_cache_key("ip_cache_missing.tif", "", 500, 0) );
+
+  std::string key = ip_cache_key(small, "", 500, 0);
+  EXPECT_EQ( 16u, key.size() );
+  EXPECT_EQ( key, ip_cache_key(small, "", 500, 0) );
+
+  // The key changes with the file, the preprocessing and the settings
+  EXPECT_NE( key, ip_cache_key(large, "", 500, 0) );
+  EXPECT_NE( key, ip_cache_key(small, "normalize", 500, 0) );
+  EXPECT_NE( key, ip_cache_key(small, "", 600, 0) );
+  EXPECT_NE( key, ip_cache_key(small, "", 500, 1) );
+
+  // A changed image has its own key
+  std::string aligned = ip_cache_key(key, "align");
+  EXPECT_EQ( 16u, aligned.size() );
+  EXPECT_NE( key, aligned );
+  EXPECT_EQ( "", ip_cache_key("", "align") );
+
+  stereo_settings().ip_cache_dir = "";
+}
@@ -0,0 +1,64 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/LocalHomography.h>
+#include <vw/Image/Transform.h>
+#include <vw/Image/MaskViews.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST( LocalHomography, WarpMatchesTransform ) {
+  int cols = 60, rows = 50;
+  ImageView< PixelGray<float> > right(cols, rows);
+  ImageView<uint8> mask(cols, rows);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      right(col, row) = PixelGray<float>(std::sin(0.3*col) + 0.05*row*row);
+      mask(col, row)  = (col == 20 && row > 10) ? 0 : 255;
+    }
+  }
+
+  Matrix3x3 H;
+  H(0,0) = 1.02;  H(0,1) = 0.03; H(0,2) = -3.5;
+  H(1,0) = -0.01; H(1,1) = 0.98; H(1,2) = 2.25;
+  H(2,0) = 1e-4;  H(2,1) = -2e-4; H(2,2) = 1;
+
+  ImageView< PixelGray<float> > expected
+    = apply_mask(transform(copy_mask(right, create_mask(mask)),
+                           HomographyTransform(H), cols, rows));
+
+  // A box inside the image and one hanging over its edge
+  BBox2i boxes[2] = {BBox2i(10, 5, 30, 25), BBox2i(40, 30, 30, 30)};
+  for (int k = 0; k < 2; k++) {
+    ImageView< PixelGray<float> > out;
+    warp_by_homography(right, mask, H, boxes[k], out);
+    ASSERT_EQ(boxes[k].width(),  out.cols());
+    ASSERT_EQ(boxes[k].height(), out.rows());
+    for (int row = 0; row < out.rows(); row++) {
+      for (int col = 0; col < out.cols(); col++) {
+        int c = col + boxes[k].min().x(), r = row + boxes[k].min().y();
+        if (c >= cols || r >= rows)
+          EXPECT_EQ(0.0, out(col, row)[0]);
+        else
+          EXPECT_NEAR(expected(c, r)[0], out(col, row)[0], 1e-4);
+      }
+    }
+  }
+}
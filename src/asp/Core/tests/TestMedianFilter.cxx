@@ -0,0 +1,65 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/MedianFilter.h>
+#include <vw/Math/Statistics.h>
+#include <cmath>
+#include <limits>
+
+using namespace vw;
+
+TEST(MedianFilter, FloatMedianMatchesBruteForce) {
+
+  // Heights with repeated values, holes, and a spread of magnitudes,
+  // so that several values share a quantized key.
+  int nc = 23, nr = 17;
+  double nan = std::numeric_limits<double>::quiet_NaN();
+  ImageView<double> img(nc, nr);
+  for (int col = 0; col < nc; col++) {
+    for (int row = 0; row < nr; row++) {
+      img(col, row) = std::floor(std::fmod(col * 7.3 + row * row * 3.1, 50.0));
+      if (col == 5 && row > 3)
+        img(col, row) += 1e+4;
+      if ((col * 11 + row * 5) % 9 == 0)
+        img(col, row) = nan;
+    }
+  }
+
+  for (int half = 0; half <= 3; half++) {
+    ImageView<double> out;
+    float_median_filter(img, half, out);
+    ASSERT_EQ(nc, out.cols());
+    ASSERT_EQ(nr, out.rows());
+
+    for (int col = 0; col < nc; col++) {
+      for (int row = 0; row < nr; row++) {
+        if (std::isnan(img(col, row))) {
+          EXPECT_TRUE(std::isnan(out(col, row)));
+          continue;
+        }
+        std::vector<double> vals;
+        for (int c = std::max(col-half, 0); c <= std::min(col+half, nc-1); c++)
+          for (int r = std::max(row-half, 0); r <= std::min(row+half, nr-1); r++)
+            if (!std::isnan(img(c, r)))
+              vals.push_back(img(c, r));
+        EXPECT_EQ(math::destructive_median(vals), out(col, row))
+          << half << ": " << col << ", " << row;
+      }
+    }
+  }
+}
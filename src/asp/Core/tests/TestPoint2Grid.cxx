@@ -0,0 +1,130 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/Point2Grid.h>
+#include <vw/Math/Functors.h>
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  const int    WIDTH = 5, HEIGHT = 4;
+  const double RADIUS = 0.8, NODATA = -1e+6;
+
+  struct TestPoint {
+    double x, y, z;
+  };
+
+  // Points in the grid, in no particular order, so that the values of
+  // the cells are interleaved.
+  std::vector<TestPoint> make_points() {
+    std::vector<TestPoint> points;
+    for (int k = 0; k < 400; k++) {
+      TestPoint p;
+      p.x = std::fmod(k * 0.618034 * 7, WIDTH - 1.0);
+      p.y = std::fmod(k * 0.414214 * 5, HEIGHT - 1.0);
+      p.z = std::fmod(k * 37.0, 101.0);
+      points.push_back(p);
+    }
+    return points;
+  }
+
+  // The values which go into each cell, the way Point2Grid chooses them.
+  std::vector<double> cell_values(std::vector<TestPoint> const& points, int c, int r) {
+    std::vector<double> vals;
+    for (size_t k = 0; k < points.size(); k++) {
+      double dx = points[k].x - c, dy = points[k].y - r;
+      if (std::sqrt(dx*dx + dy*dy) <= RADIUS)
+        vals.push_back(points[k].z);
+    }
+    return vals;
+  }
+
+  ImageView<double> grid_points(std::vector<TestPoint> const& points, FilterType filter,
+                                double percentile) {
+    ImageView<double> buffer, weights;
+    Point2Grid grid(WIDTH, HEIGHT, buffer, weights, 0, 0, 1.0, 1.0, RADIUS, 0,
+                    filter, percentile);
+    grid.Clear(NODATA);
+    for (size_t k = 0; k < points.size(); k++)
+      grid.AddPoint(points[k].x, points[k].y, points[k].z);
+    grid.normalize();
+    return buffer;
+  }
+}
+
+TEST(Point2Grid, MedianAndPercentile) {
+
+  std::vector<TestPoint> points = make_points();
+  ImageView<double> median     = grid_points(points, f_median,     0);
+  ImageView<double> percentile = grid_points(points, f_percentile, 25);
+  ImageView<double> stddev     = grid_points(points, f_stddev,     0);
+
+  int num_filled = 0;
+  for (int c = 0; c < WIDTH; c++) {
+    for (int r = 0; r < HEIGHT; r++) {
+      std::vector<double> vals = cell_values(points, c, r);
+      if (vals.empty()) {
+        EXPECT_EQ(NODATA, median(c, r));
+        EXPECT_EQ(NODATA, percentile(c, r));
+        continue;
+      }
+      num_filled++;
+
+      vw::math::MedianAccumulator<double> M;
+      vw::math::StdDevAccumulator<double> S;
+      for (size_t k = 0; k < vals.size(); k++) {
+        M(vals[k]);
+        S(vals[k]);
+      }
+      EXPECT_NEAR(M.value(), median(c, r), 1e-12);
+      EXPECT_NEAR(S.value(), stddev(c, r), 1e-10);
+      EXPECT_NEAR(vw::math::destructive_percentile(vals, 25), percentile(c, r), 1e-12);
+    }
+  }
+  EXPECT_GT(num_filled, WIDTH*HEIGHT/2);
+}
+
+TEST(Point2Grid, WeightedAverage) {
+
+  std::vector<TestPoint> points = make_points();
+  ImageView<double> average = grid_points(points, f_weighted_average, 0);
+
+  // With no sigma factor, the weight decays to 0.25 at the grid size
+  double sigma = -std::log(0.25);
+  for (int c = 0; c < WIDTH; c++) {
+    for (int r = 0; r < HEIGHT; r++) {
+      double sum = 0, sum_wt = 0;
+      for (size_t k = 0; k < points.size(); k++) {
+        double dx = points[k].x - c, dy = points[k].y - r;
+        double dist2 = dx*dx + dy*dy;
+        if (dist2 > RADIUS*RADIUS)
+          continue;
+        double wt = std::exp(-sigma*dist2);
+        sum    += wt*points[k].z;
+        sum_wt += wt;
+      }
+      if (sum_wt == 0)
+        EXPECT_EQ(NODATA, average(c, r));
+      else
+        EXPECT_NEAR(sum/sum_wt, average(c, r), 1e-10);
+    }
+  }
+}
@@ -0,0 +1,94 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/PointCloudStats.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST( PointCloudStats, ErrorHistBins ) {
+  double errs[] = {1e-3, 0.25, 1.0, 37.5};
+  for (int i = 0; i < 4; i++) {
+    int bin = error_hist_bin(errs[i]);
+    EXPECT_NEAR(errs[i], error_hist_value(bin), 0.005*errs[i]);
+  }
+  EXPECT_EQ(0, error_hist_bin(1e-20));
+  EXPECT_EQ(ERROR_HIST_NUM_BINS - 1, error_hist_bin(1e+20));
+}
+
+TEST( PointCloudStats, AddPoints ) {
+  PointCloudStats a, b;
+  a.add_point(Vector3(1, 1, 0), 0.5);
+  a.add_point(Vector3(), 0.0);     // no-data
+  b.add_point(Vector3(-1, 3, 4), 0.5);
+  b.add_point(Vector3(2, 0, 2), 2.0);
+
+  a.add(b);
+  EXPECT_EQ(3, a.num_valid);
+  EXPECT_VECTOR_NEAR(Vector3(-1, 0, 0), a.bbox.min(), 1e-12);
+  EXPECT_VECTOR_NEAR(Vector3( 2, 3, 4), a.bbox.max(), 1e-12);
+  EXPECT_VECTOR_NEAR(Vector3(2.0/3, 4.0/3, 2), a.mean(), 1e-12);
+
+  ASSERT_EQ(2u, a.errors_hist.size());
+  std::vector<double> hist = a.dense_errors_hist();
+  ASSERT_EQ(size_t(ERROR_HIST_NUM_BINS), hist.size());
+  EXPECT_EQ(2, hist[error_hist_bin(0.5)]);
+  EXPECT_EQ(1, hist[error_hist_bin(2.0)]);
+}
+
+TEST( PointCloudStats, CollectorCountsTilesOnce ) {
+  PointCloudStats tile;
+  tile.add_point(Vector3(1, 2, 3), 1.0);
+
+  PointCloudStatsCollector collector;
+  collector.add_tile(BBox2i(0, 0, 10, 10), tile);
+  collector.add_tile(BBox2i(0, 0, 10, 10), tile);  // rasterized again
+  collector.add_tile(BBox2i(10, 0, 10, 10), tile);
+  EXPECT_EQ(2, collector.stats().num_valid);
+}
+
+TEST( PointCloudStats, HeaderRoundTrip ) {
+  PointCloudStats stats;
+  stats.add_point(Vector3(1, 2, 3), 0.5);
+  stats.rounding_error = 1.0/1024;
+
+  cartography::GeoReference georef;
+  cartography::GdalWriteOptions opt;
+  bool has_georef = false, has_nodata = false;
+  UnlinkName small("pc_stats_small.tif"), large("pc_stats_large.tif");
+  vw::cartography::write_gdal_image(small, ImageView<Vector3f>(4, 3), has_georef, georef,
+                                    has_nodata, 0, opt);
+  vw::cartography::write_gdal_image(large, ImageView<Vector3f>(5, 3), has_georef, georef,
+                                    has_nodata, 0, opt);
+  write_point_cloud_stats(small, stats);
+
+  PointCloudStats read;
+  ASSERT_TRUE(read_point_cloud_stats(small, read));
+  EXPECT_EQ(1, read.num_valid);
+  EXPECT_VECTOR_NEAR(Vector3(1, 2, 3), read.mean(), 1e-12);
+  EXPECT_EQ(stats.rounding_error, read.rounding_error);
+
+  // The other file has no statistics, so neither do both together
+  EXPECT_FALSE(read_point_cloud_stats(large, read));
+  std::vector<std::string> files;
+  files.push_back(small);
+  files.push_back(large);
+  EXPECT_FALSE(read_point_cloud_stats(files, read));
+}
@@ -18,6 +18,7 @@
 
 #include <test/Helpers.h>
 #include <asp/Core/PointUtils.h>
+#include <fstream>
 
 using namespace vw;
 using namespace asp;
@@ -128,3 +129,76 @@ TEST( PointUtils, CsvConv ) {
   
   
 }
+
+TEST( PointUtils, ReadCsvFile ) {
+
+  CsvConv conv;
+  conv.parse_csv_format("1:x 2:y 3:z 4:file", "");
+  EXPECT_TRUE(conv.is_configured());
+
+  // A header, a comment, a bad line, CRLF endings, and no newline at the end
+  UnlinkName csv_name("read_csv_file.csv");
+  {
+    std::ofstream ofs(csv_name.c_str());
+    ofs << "x,y,z,file\n"
+        << "1, 2, 3, a.tif\n"
+        << "# comment\n"
+        << "4,,5  6\tb.tif\r\n"
+        << "bad, 7, 8, c.tif\n"
+        << "9, 10, 11, d.tif";
+  }
+  EXPECT_EQ(boost::uint64_t(5), csv_file_size(csv_name));
+
+  std::list<CsvConv::CsvRecord> records;
+  EXPECT_EQ(size_t(3), conv.read_csv_file(csv_name, records));
+  std::list<CsvConv::CsvRecord>::const_iterator it = records.begin();
+  EXPECT_VECTOR_EQ(Vector3(1, 2, 3), it->point_data);
+  EXPECT_EQ("a.tif", it->file);
+  it++;
+  EXPECT_VECTOR_EQ(Vector3(4, 5, 6), it->point_data);
+  EXPECT_EQ("b.tif\r", it->file);
+  it++;
+  EXPECT_VECTOR_EQ(Vector3(9, 10, 11), it->point_data);
+  EXPECT_EQ("d.tif", it->file);
+
+  // The same points, converted as they are read
+  vw::cartography::GeoReference geo;
+  std::vector<Vector3> points;
+  EXPECT_EQ(size_t(3), conv.read_csv_file(csv_name, geo, points));
+  EXPECT_VECTOR_EQ(Vector3(4, 5, 6), points[1]);
+}
+
+TEST( PointUtils, ReadAspPointCloud ) {
+
+  // A cloud with a shift, and a point with no data, which stays zero
+  ImageView<Vector4> cloud(3, 2);
+  for (int row = 0; row < cloud.rows(); row++) {
+    for (int col = 0; col < cloud.cols(); col++)
+      cloud(col, row) = Vector4(1e6 + col, 2e6 + row, 3e6, 0.5);
+  }
+  cloud(1, 1) = Vector4();
+  Vector3 shift(1e6, 2e6, 3e6);
+
+  UnlinkName cloud_name("read_asp_point_cloud.tif");
+  vw::cartography::GdalWriteOptions opt;
+  block_write_approx_gdal_image(cloud_name, shift, 0.0, cloud, false,
+                                vw::cartography::GeoReference(), false, 0, opt);
+
+  ImageView<Vector3> points = read_asp_point_cloud<3>(cloud_name);
+  ASSERT_EQ(cloud.cols(), points.cols());
+  ASSERT_EQ(cloud.rows(), points.rows());
+  EXPECT_VECTOR_NEAR(Vector3(1e6 + 2, 2e6, 3e6), points(2, 0), 1e-6);
+  EXPECT_VECTOR_NEAR(Vector3(1e6, 2e6 + 1, 3e6), points(0, 1), 1e-6);
+  EXPECT_VECTOR_EQ(Vector3(), points(1, 1));
+
+  // Two copies side by side, transposed as they are wider than tall,
+  // with a gap of zeros between them.
+  std::vector<std::string> files(2, cloud_name);
+  ImageView<Vector3> stack = form_point_cloud_composite<Vector3>(files, 4);
+  ASSERT_EQ(10, stack.cols());
+  ASSERT_EQ(3,  stack.rows());
+  EXPECT_VECTOR_NEAR(Vector3(1e6 + 2, 2e6, 3e6), stack(0, 2), 1e-6);
+  EXPECT_VECTOR_EQ(Vector3(), stack(3, 0));
+  EXPECT_VECTOR_NEAR(Vector3(1e6 + 2, 2e6, 3e6), stack(8, 2), 1e-6);
+  EXPECT_VECTOR_EQ(Vector3(), stack(9, 1));
+}
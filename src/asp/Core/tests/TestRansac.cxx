@@ -0,0 +1,104 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/Ransac.h>
+#include <vw/Math/Geometry.h>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  // Points related by a homography, with every fourth one an outlier
+  void make_matches(int num, Matrix3x3 const& H,
+                    std::vector<Vector3> & p1, std::vector<Vector3> & p2) {
+    srand(3);
+    p1.clear();
+    p2.clear();
+    for (int i = 0; i < num; i++) {
+      Vector3 a(rand() % 1000, rand() % 1000, 1);
+      Vector3 b = H*a;
+      b /= b[2];
+      if (i % 4 == 0)
+        b += Vector3(50 + rand() % 100, 50 + rand() % 100, 0);
+      p1.push_back(a);
+      p2.push_back(b);
+    }
+  }
+}
+
+TEST( Ransac, NumIterationsNeeded ) {
+  EXPECT_EQ(1, ransac_num_iterations_needed(1.0, 4, 0.99));
+  // log(0.01)/log(1 - 0.5^4) = 71.3
+  EXPECT_EQ(72, ransac_num_iterations_needed(0.5, 4, 0.99));
+  EXPECT_EQ(std::numeric_limits<int>::max(), ransac_num_iterations_needed(0.0, 4, 0.99));
+}
+
+TEST( Ransac, FindsHomography ) {
+  Matrix3x3 H;
+  H(0,0) = 1.1;  H(0,1) = 0.05; H(0,2) = 20;
+  H(1,0) = -0.02; H(1,1) = 0.95; H(1,2) = -10;
+  H(2,0) = 1e-5; H(2,1) = 2e-5; H(2,2) = 1;
+
+  std::vector<Vector3> p1, p2;
+  make_matches(4000, H, p1, p2);
+
+  // The same result with one thread and with several
+  Matrix<double> fit[2];
+  std::vector<size_t> indices[2];
+  for (int k = 0; k < 2; k++) {
+    ParallelRandomSampleConsensus<math::HomographyFittingFunctor,
+                                  math::InterestPointErrorMetric>
+      ransac(math::HomographyFittingFunctor(), math::InterestPointErrorMetric(),
+             100, 1.0, p1.size()/2, false, k == 0 ? 1 : 4);
+    fit[k]     = ransac(p1, p2);
+    indices[k] = ransac.inlier_indices(fit[k], p1, p2);
+  }
+
+  ASSERT_EQ(indices[0].size(), indices[1].size());
+  EXPECT_EQ(3000u, indices[0].size());
+  for (size_t i = 0; i < indices[0].size(); i++) {
+    EXPECT_EQ(indices[0][i], indices[1][i]);
+    EXPECT_NE(0u, indices[0][i] % 4);
+  }
+
+  Matrix<double> G = fit[0]/fit[0](2,2);
+  for (int r = 0; r < 3; r++)
+    for (int c = 0; c < 3; c++)
+      EXPECT_NEAR(H(r,c), G(r,c), 1e-3*std::max(1.0, std::abs(H(r,c))));
+}
+
+TEST( Ransac, TooFewInliers ) {
+  Matrix3x3 H = math::identity_matrix<3>();
+  std::vector<Vector3> p1, p2;
+  make_matches(100, H, p1, p2);
+
+  // Ask for more inliers than there are
+  ParallelRandomSampleConsensus<math::HomographyFittingFunctor,
+                                math::InterestPointErrorMetric>
+    ransac(math::HomographyFittingFunctor(), math::InterestPointErrorMetric(),
+           100, 1.0, 90, false);
+  EXPECT_THROW(ransac(p1, p2), math::RANSACErr);
+
+  // Unless allowed to settle for fewer
+  ParallelRandomSampleConsensus<math::HomographyFittingFunctor,
+                                math::InterestPointErrorMetric>
+    ransac2(math::HomographyFittingFunctor(), math::InterestPointErrorMetric(),
+            100, 1.0, 90, true);
+  EXPECT_NO_THROW(ransac2(p1, p2));
+}
@@ -185,3 +185,23 @@ TEST_F( SoftwareRenderTest, ExtremelyLargeTriangle ) {
     }
   }
 }
+
+TEST_F( SoftwareRenderTest, OutsideTriangle ) {
+  color.clear();
+  color += 1.0,1.0,1.0;
+
+  // Triangles wholly off frame on each side draw nothing
+  double shifts[4][2] = {{-2.0, 0.0}, {2.0, 0.0}, {0.0, -2.0}, {0.0, 2.0}};
+  for (int s = 0; s < 4; s++) {
+    vertices.clear();
+    vertices += 0.2+shifts[s][0],0.2+shifts[s][1],0.8+shifts[s][0],0.2+shifts[s][1],
+      0.5+shifts[s][0],0.8+shifts[s][1];
+    renderer.Clear(0.0);
+    renderer.DrawPolygon(0,3);
+    for ( size_t i = 0; i < 128; i++ ) {
+      for ( size_t j = 0; j < 128; j++ ) {
+        EXPECT_EQ( 0.0, render_buffer(i,j) ) << s << ": " << i << "," << j;
+      }
+    }
+  }
+}
@@ -0,0 +1,99 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <vw/Image/Algorithms.h>
+#include <vw/Image/Filter.h>
+#include <vw/Image/Manipulation.h>
+#include <asp/Core/SparseCorrelation.h>
+#include <cstdlib>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  // Smoothed noise, so that it has texture at several scales
+  ImageView<float> random_texture(int cols, int rows) {
+    srand(1);
+    ImageView<float> noise(cols, rows);
+    for (int row = 0; row < rows; row++)
+      for (int col = 0; col < cols; col++)
+        noise(col, row) = float(rand())/RAND_MAX;
+    return gaussian_filter(noise, 1.5);
+  }
+}
+
+TEST( SparseCorrelation, NCCPeakAtTemplatePosition ) {
+  ImageView<float> search = random_texture(40, 40);
+  ImageView<float> tmpl   = crop(search, 7, 5, 12, 12);
+
+  ImageView<float> ncc;
+  ASSERT_TRUE(normalized_cross_correlation(tmpl, search, ncc));
+  EXPECT_EQ(29, ncc.cols());
+  EXPECT_EQ(29, ncc.rows());
+
+  Vector2i best;
+  for (int row = 0; row < ncc.rows(); row++) {
+    for (int col = 0; col < ncc.cols(); col++) {
+      EXPECT_LE(ncc(col, row), 1.0 + 1e-6);
+      if (ncc(col, row) > ncc(best[0], best[1]))
+        best = Vector2i(col, row);
+    }
+  }
+  EXPECT_EQ(Vector2i(7, 5), best);
+  EXPECT_NEAR(1.0, ncc(7, 5), 1e-6);
+
+  // A constant template has no correlation
+  ImageView<float> flat(12, 12);
+  fill(flat, 3.0);
+  EXPECT_FALSE(normalized_cross_correlation(flat, search, ncc));
+}
+
+TEST( SparseCorrelation, RecoversShift ) {
+  int cols = 240, rows = 200;
+  ImageView<float> big = random_texture(cols + 20, rows + 20);
+
+  // The right image is the left one shifted by the disparity
+  Vector2i shift(6, -3);
+  ImageView<float> right(cols, rows);
+  for (int row = 0; row < rows; row++)
+    for (int col = 0; col < cols; col++)
+      right(col, row) = big(col - shift[0] + 10, row - shift[1] + 10);
+  ImageView<float> left = crop(big, 10, 10, cols, rows);
+
+  SparseDispOptions opt;
+  opt.template_size = 24;
+  opt.spacing       = 32;
+  opt.search_range  = Vector2i(16, 16);
+  opt.num_threads   = 2;
+
+  ImageView<PixelMask<Vector2f> > sub_disp;
+  ImageView<PixelMask<Vector2i> > sub_spread;
+  sparse_disparity(left, right, opt, Vector2i(cols/4, rows/4), sub_disp, sub_spread);
+
+  ASSERT_EQ(cols/4, sub_disp.cols());
+  ASSERT_EQ(rows/4, sub_disp.rows());
+  for (int row = 0; row < sub_disp.rows(); row++) {
+    for (int col = 0; col < sub_disp.cols(); col++) {
+      ASSERT_TRUE(is_valid(sub_disp(col, row)));
+      EXPECT_NEAR(shift[0]/4.0, sub_disp(col, row).child()[0], 1e-4);
+      EXPECT_NEAR(shift[1]/4.0, sub_disp(col, row).child()[1], 1e-4);
+      EXPECT_EQ(Vector2i(2, 2), sub_spread(col, row).child());
+    }
+  }
+}
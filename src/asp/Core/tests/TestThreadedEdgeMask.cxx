@@ -54,3 +54,26 @@ TEST( ThreadedEdgeMask, active_area ) {
   output = threaded_edge_mask(input,0);
   EXPECT_EQ( input, output );
 }
+
+TEST( ThreadedEdgeMask, tiled ) {
+  // A disk, whose rows and columns are each one valid run
+  ImageView<uint8> input(101,83);
+  fill(input,0);
+  for ( int32 i = 0; i < input.cols(); i++ )
+    for ( int32 j = 0; j < input.rows(); j++ )
+      if ( (i-47)*(i-47) + (j-40)*(j-40) < 35*35 )
+        input(i,j) = 200;
+
+  // Many small tiles, which share rows and columns, must give the
+  // same result as a single tile.
+  ImageView<PixelMask<uint8> > whole = threaded_edge_mask(input,0,0,1024);
+  ImageView<PixelMask<uint8> > tiled = threaded_edge_mask(input,0,0,16);
+  EXPECT_EQ( threaded_edge_mask(input,0,0,1024).active_area(),
+             threaded_edge_mask(input,0,0,16).active_area() );
+  for ( int32 i = 0; i < input.cols(); i++ ) {
+    for ( int32 j = 0; j < input.rows(); j++ ) {
+      EXPECT_EQ( is_valid(whole(i,j)), is_valid(tiled(i,j)) ) << i << "," << j;
+      EXPECT_EQ( input(i,j) != 0, is_valid(tiled(i,j)) ) << i << "," << j;
+    }
+  }
+}
@@ -0,0 +1,60 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/TilePool.h>
+#include <vw/Image/PixelTypes.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST( TilePool, ReusesSameSize ) {
+  float* data = NULL;
+  {
+    ScratchImage<float> a(30, 20);
+    EXPECT_EQ(30, a->cols());
+    EXPECT_EQ(20, a->rows());
+    data = a->data();
+  }
+  {
+    // Another size gets its own buffer
+    ScratchImage<float> b(20, 30);
+    EXPECT_NE(data, b->data());
+    ScratchImage<float> c(30, 20);
+    EXPECT_EQ(data, c->data());
+  }
+}
+
+TEST( TilePool, ReassignedIsNotPooled ) {
+  ImageView<double> other(8, 8);
+  {
+    ScratchImage<double> a(8, 8);
+    *a = other; // now shares the pixels of other
+  }
+  ScratchImage<double> b(8, 8);
+  EXPECT_NE(other.data(), b->data());
+}
+
+TEST( TilePool, KeepsFewImages ) {
+  typedef PixelGray<uint8> PixelT;
+  {
+    ScratchImage<PixelT> a(1, 1), b(2, 2), c(3, 3), d(4, 4), e(5, 5), f(6, 6);
+  }
+  EXPECT_EQ(detail::TilePool<PixelT>::max_images,
+            detail::TilePool<PixelT>::instance().size());
+}
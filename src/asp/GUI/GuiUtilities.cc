@@ -32,9 +32,13 @@
 #include <vw/Math/EulerAngles.h>
 #include <vw/Image/Algorithms.h>
 #include <vw/Cartography/GeoTransform.h>
-#include <vw/tools/hillshade.h>
 #include <vw/Core/RunOnce.h>
 #include <asp/GUI/GuiUtilities.h>
+#include <asp/Core/StereoSettings.h>
+#include <boost/functional/hash.hpp>
+#include <algorithm>
+#include <iomanip>
+#include <map>
 
 using namespace vw;
 using namespace vw::gui;
@@ -53,6 +57,74 @@ TemporaryFiles& temporary_files() {
   return *temporary_files_ptr;
 }
 
+// Remove the least recently used subdirectories of the pyramid cache,
+// other than the given one, until the cache is within the size limit.
+void prune_pyramid_cache(fs::path const& cache_dir, fs::path const& keep_dir,
+                         double max_size_mb) {
+
+  std::vector< std::pair<std::time_t, fs::path> > dirs;
+  std::map<fs::path, double> dir_sizes;
+  double total_size = 0.0;
+  for (fs::directory_iterator it(cache_dir); it != fs::directory_iterator(); it++) {
+    if (!fs::is_directory(it->path()))
+      continue;
+    double size = 0.0;
+    for (fs::directory_iterator f(it->path()); f != fs::directory_iterator(); f++) {
+      if (fs::is_regular_file(fs::symlink_status(f->path())))
+        size += fs::file_size(f->path());
+    }
+    dirs.push_back(std::make_pair(fs::last_write_time(it->path()), it->path()));
+    dir_sizes[it->path()] = size;
+    total_size += size;
+  }
+
+  std::sort(dirs.begin(), dirs.end());
+  double max_size = max_size_mb*1024.0*1024.0;
+  for (size_t i = 0; i < dirs.size() && total_size > max_size; i++) {
+    if (dirs[i].second == keep_dir)
+      continue;
+    vw_out() << "Removing from the pyramid cache: " << dirs[i].second.string() << std::endl;
+    total_size -= dir_sizes[dirs[i].second];
+    fs::remove_all(dirs[i].second);
+  }
+}
+
+std::string pyramid_base_file(std::string const& image_file) {
+
+  std::string cache_dir = asp::stereo_settings().pyramid_cache_dir;
+  if (cache_dir == "" || !fs::exists(image_file))
+    return image_file;
+
+  try {
+    fs::path image_path = fs::absolute(image_file);
+
+    // Key the cache by the image path, size, and modification time, so
+    // that a changed image gets a new pyramid.
+    std::size_t key = 0;
+    boost::hash_combine(key, image_path.string());
+    boost::hash_combine(key, fs::file_size(image_path));
+    boost::hash_combine(key, fs::last_write_time(image_path));
+    std::ostringstream key_str;
+    key_str << std::hex << std::setw(16) << std::setfill('0') << key;
+
+    fs::path dir = fs::path(cache_dir) / key_str.str();
+    fs::path link = dir / image_path.filename();
+    fs::create_directories(dir);
+    if (!fs::exists(fs::symlink_status(link)))
+      fs::create_symlink(image_path, link);
+
+    // Mark this entry as the most recently used
+    fs::last_write_time(dir, std::time(NULL));
+    prune_pyramid_cache(cache_dir, dir, asp::stereo_settings().pyramid_cache_size_mb);
+
+    return link.string();
+  } catch (const std::exception& e) {
+    vw_out(WarningMessage) << "Cannot use the pyramid cache for " << image_file << ": "
+                           << e.what() << std::endl;
+  }
+  return image_file;
+}
+
 bool isPolyZeroDim(const QPolygon & pa){
   
   int numPts = pa.size();
@@ -120,60 +192,60 @@ QRect bbox2qrect(BBox2 const& B){
                round(B.width()), round(B.height()));
 }
 
-bool write_hillshade(vw::cartography::GdalWriteOptions const& opt,
-                     double azimuth, double elevation,
-                     std::string const& input_file,
-                     std::string      & output_file) {
-
-  // Sanity check: Must have a georeference
-  cartography::GeoReference georef;
-  bool has_georef = vw::cartography::read_georeference(georef, input_file);
-  if (!has_georef) {
-    popUp("No georeference present in: " + input_file + ".");
-    return false;
-  }
-
-  double scale       = 0.0;
-  double blur_sigma  = std::numeric_limits<double>::quiet_NaN();
-  double nodata_val  = std::numeric_limits<double>::quiet_NaN();
-  vw::read_nodata_val(input_file, nodata_val);
-  std::ostringstream oss;
-  oss << "_hillshade_a" << azimuth << "_e" << elevation << ".tif"; 
-  std::string suffix = oss.str();
+vw::Vector2 georef_pixel_size(vw::cartography::GeoReference const& georef,
+                              vw::Vector2 const& pix) {
+
+  // Go through ECEF, which works for both projected and geographic georeferences
+  vw::cartography::Datum const& datum = georef.datum();
+  Vector2 ll_0 = georef.pixel_to_lonlat(pix);
+  Vector2 ll_x = georef.pixel_to_lonlat(pix + Vector2(1, 0));
+  Vector2 ll_y = georef.pixel_to_lonlat(pix + Vector2(0, 1));
+  Vector3 p0   = datum.geodetic_to_cartesian(Vector3(ll_0[0], ll_0[1], 0));
+  Vector3 px   = datum.geodetic_to_cartesian(Vector3(ll_x[0], ll_x[1], 0));
+  Vector3 py   = datum.geodetic_to_cartesian(Vector3(ll_y[0], ll_y[1], 0));
+  return Vector2(norm_2(px - p0), norm_2(py - p0));
+}
 
-  output_file = vw::mosaic::filename_from_suffix1(input_file, suffix);
-  try {
-    DiskImageView<float> input(input_file);
-    try{
-      bool will_write = vw::mosaic::overwrite_if_no_good(input_file, output_file,
-                                             input.cols(), input.rows());
-      if (will_write){
-        vw_out() << "Writing: " << output_file << std::endl;
-        vw::do_multitype_hillshade(input_file, output_file, azimuth, elevation, scale,
-                                   nodata_val, blur_sigma);
-      }
-    }catch(...){
-      // Failed to write, presumably because we have no write access.
-      // Write the file in the current dir.
-      vw_out() << "Failed to write: " << output_file << "\n";
-      output_file = vw::mosaic::filename_from_suffix2(input_file, suffix);
-      bool will_write = vw::mosaic::overwrite_if_no_good(input_file, output_file,
-                                             input.cols(), input.rows());
-      if (will_write){
-        vw_out() << "Writing: " << output_file << std::endl;
-        vw::do_multitype_hillshade(input_file,  output_file, azimuth, elevation, scale,
-                                   nodata_val, blur_sigma);
+void formHillshadeQimage(bool highlight_nodata, double nodata_val,
+                         vw::Vector2 const& pixel_size,
+                         double azimuth, double elevation,
+                         ImageView<double> const& clip, QImage & qimg) {
+
+  // The direction to the light, with x to the east, y to the north, and z up
+  double a = azimuth*M_PI/180.0, e = elevation*M_PI/180.0;
+  Vector3 light(sin(a)*cos(e), cos(a)*cos(e), sin(e));
+
+  double dx = std::max(pixel_size[0], 1e-10), dy = std::max(pixel_size[1], 1e-10);
+  int cols = clip.cols(), rows = clip.rows();
+  qimg = QImage(cols, rows, QImage::Format_ARGB32_Premultiplied);
+  for (int row = 0; row < rows; row++) {
+    QRgb * line = reinterpret_cast<QRgb*>(qimg.scanLine(row));
+    for (int col = 0; col < cols; col++) {
+      double z = clip(col, row);
+      if (z <= nodata_val || std::isnan(z)) {
+        line[col] = highlight_nodata ? qRgb(255, 0, 0) : QRgb(Qt::transparent);
+        continue;
       }
+
+      // Use one-sided differences at the edges of the clip and of the nodata areas
+      int c0 = std::max(col - 1, 0), c1 = std::min(col + 1, cols - 1);
+      int r0 = std::max(row - 1, 0), r1 = std::min(row + 1, rows - 1);
+      double zl = clip(c0, row), zr = clip(c1, row), zu = clip(col, r0), zd = clip(col, r1);
+      if (zl <= nodata_val || std::isnan(zl)) { zl = z; c0 = col; }
+      if (zr <= nodata_val || std::isnan(zr)) { zr = z; c1 = col; }
+      if (zu <= nodata_val || std::isnan(zu)) { zu = z; r0 = row; }
+      if (zd <= nodata_val || std::isnan(zd)) { zd = z; r1 = row; }
+      double dzdx = (c1 > c0) ? (zr - zl)/((c1 - c0)*dx) : 0.0;
+      double dzdy = (r1 > r0) ? (zu - zd)/((r1 - r0)*dy) : 0.0; // rows go south
+
+      Vector3 normal(-dzdx, -dzdy, 1.0);
+      double v = 255.0*std::max(0.0, dot_prod(normal, light))/norm_2(normal);
+      int g = int(round(std::min(v, 255.0)));
+      line[col] = qRgba(g, g, g, 255);
     }
-  } catch (const Exception& e) {
-    popUp(e.what());
-    return false;
   }
-
-  return true;
 }
 
-
 // Convert a single polygon in a set of polygons to an ORG ring.  
 void toOGR(const double * xv, const double * yv, int startPos, int numVerts,
 	     OGRLinearRing & R){
@@ -847,48 +919,54 @@ void chooseFilesDlg::chooseFiles(const std::vector<imageData> & images){
 DiskImagePyramidMultiChannel::DiskImagePyramidMultiChannel(std::string const& base_file,
                              vw::cartography::GdalWriteOptions const& opt,
                              int top_image_max_pix,
-                             int subsample):m_opt(opt),
+                             int subsample):m_opt(opt), m_base_file(base_file),
                                                 m_num_channels(0),
                                                 m_rows(0), m_cols(0),
                                                 m_type(UNINIT){
   if (base_file == "") return;
 
+  // Just read the header here. The pyramid is built in load().
+  try {
+    boost::shared_ptr<DiskImageResource> rsrc(DiskImageResourcePtr(base_file));
+    m_num_channels = get_num_channels(base_file);
+    m_cols = rsrc->cols();
+    m_rows = rsrc->rows();
+    if (m_num_channels < 1 || m_num_channels > 4)
+      vw_throw(ArgumentErr() << "Unsupported image with " << m_num_channels << " bands.\n");
+  } catch (const Exception& e) {
+      popUp(e.what());
+      return;
+  }
+}
+
+void DiskImagePyramidMultiChannel::load() const {
+  if (m_type != UNINIT || m_base_file == "") return;
+
   // Instantiate the correct DiskImagePyramid then record information including
   //  the list of temporary files it created.
   try {
-    m_num_channels = get_num_channels(base_file);
+    std::string pyramid_file = pyramid_base_file(m_base_file);
     if (m_num_channels == 1) {
       // Single channel image with float pixels.
-      m_img_ch1_double = vw::mosaic::DiskImagePyramid<double>(base_file, m_opt);
-      m_rows = m_img_ch1_double.rows();
-      m_cols = m_img_ch1_double.cols();
+      m_img_ch1_double = vw::mosaic::DiskImagePyramid<double>(pyramid_file, m_opt);
       m_type = CH1_DOUBLE;
       temporary_files().files.insert(m_img_ch1_double.get_temporary_files().begin(), 
                                      m_img_ch1_double.get_temporary_files().end());
     }else if (m_num_channels == 2){
       // uint8 image with an alpha channel.
-      m_img_ch2_uint8 = vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 2> >(base_file, m_opt);
-      m_num_channels = 2; // we read only 1 channel
-      m_rows = m_img_ch2_uint8.rows();
-      m_cols = m_img_ch2_uint8.cols();
+      m_img_ch2_uint8 = vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 2> >(pyramid_file, m_opt);
       m_type = CH2_UINT8;
       temporary_files().files.insert(m_img_ch2_uint8.get_temporary_files().begin(), 
                                      m_img_ch2_uint8.get_temporary_files().end());
     } else if (m_num_channels == 3){
       // RGB image with three uint8 channels.
-      m_img_ch3_uint8 = vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 3> >(base_file, m_opt);
-      m_num_channels = 3;
-      m_rows = m_img_ch3_uint8.rows();
-      m_cols = m_img_ch3_uint8.cols();
+      m_img_ch3_uint8 = vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 3> >(pyramid_file, m_opt);
       m_type = CH3_UINT8;
       temporary_files().files.insert(m_img_ch3_uint8.get_temporary_files().begin(), 
                                      m_img_ch3_uint8.get_temporary_files().end());
     } else if (m_num_channels == 4){
       // RGB image with three uint8 channels and an alpha channel
-      m_img_ch4_uint8 = vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 4> >(base_file, m_opt);
-      m_num_channels = 4;
-      m_rows = m_img_ch4_uint8.rows();
-      m_cols = m_img_ch4_uint8.cols();
+      m_img_ch4_uint8 = vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 4> >(pyramid_file, m_opt);
       m_type = CH4_UINT8;
       temporary_files().files.insert(m_img_ch4_uint8.get_temporary_files().begin(), 
                                      m_img_ch4_uint8.get_temporary_files().end());
@@ -902,6 +980,7 @@ DiskImagePyramidMultiChannel::DiskImagePyramidMultiChannel(std::string const& ba
 }
 
 double DiskImagePyramidMultiChannel::get_nodata_val() const {
+  load();
   
   // Extract the clip, then convert it from VW format to QImage format.
   if (m_type == CH1_DOUBLE) {
@@ -920,6 +999,7 @@ double DiskImagePyramidMultiChannel::get_nodata_val() const {
 void DiskImagePyramidMultiChannel::get_image_clip(double scale_in, vw::BBox2i region_in,
                   bool highlight_nodata,
                   QImage & qimg, double & scale_out, vw::BBox2i & region_out) const{
+  load();
 
   bool scale_pixels = (m_type == CH1_DOUBLE);
   vw::Vector2 bounds;
@@ -957,7 +1037,63 @@ void DiskImagePyramidMultiChannel::get_image_clip(double scale_in, vw::BBox2i re
   }
 }
 
+void DiskImagePyramidMultiChannel::get_hillshade_clip(double scale_in, vw::BBox2i region_in,
+                                                      bool highlight_nodata,
+                                                      vw::cartography::GeoReference const& georef,
+                                                      double azimuth, double elevation,
+                                                      QImage & qimg, double & scale_out,
+                                                      vw::BBox2i & region_out) const {
+  load();
+
+  if (m_type != CH1_DOUBLE)
+    vw_throw(ArgumentErr() << "Hill-shading makes sense only for single-channel images.\n");
+
+  ImageView<double> clip;
+  m_img_ch1_double.get_image_clip(scale_in, region_in, clip, scale_out, region_out);
+
+  // The pixels of the clip are larger than the image pixels by the
+  // scale of the pyramid level they came from. The region is in the
+  // pixels of that level, so its center is scaled back to find the
+  // pixel size where the clip is. If the georeference fails there,
+  // show the clip without hillshading.
+  Vector2 pixel_size;
+  try {
+    Vector2 center = scale_out*Vector2(region_out.min() + region_out.max())/2.0;
+    pixel_size = georef_pixel_size(georef, center);
+  } catch (const std::exception& e) {
+    vw_out(WarningMessage) << "Could not find the pixel size for hillshading: "
+                           << e.what() << "\n";
+    bool scale_pixels = true;
+    formQimage(highlight_nodata, scale_pixels, m_img_ch1_double.get_nodata_val(),
+               m_img_ch1_double.get_approx_bounds(), clip, qimg);
+    return;
+  }
+  formHillshadeQimage(highlight_nodata, m_img_ch1_double.get_nodata_val(),
+                      scale_out*pixel_size, azimuth, elevation, clip, qimg);
+}
+
+void DiskImagePyramidMultiChannel::get_thresh_clip(double scale_in, vw::BBox2i region_in,
+                                                   double thresh,
+                                                   QImage & qimg, double & scale_out,
+                                                   vw::BBox2i & region_out) const {
+  load();
+
+  if (m_type != CH1_DOUBLE)
+    vw_throw(ArgumentErr() << "Thresholding makes sense only for single-channel images.\n");
+
+  ImageView<double> clip;
+  m_img_ch1_double.get_image_clip(scale_in, region_in, clip, scale_out, region_out);
+
+  // Pixels at or below the no-data value are shown as no-data, so
+  // raising it to the threshold does the thresholding.
+  bool highlight_nodata = true, scale_pixels = true;
+  double nodata_val = std::max(m_img_ch1_double.get_nodata_val(), thresh);
+  formQimage(highlight_nodata, scale_pixels, nodata_val,
+             m_img_ch1_double.get_approx_bounds(), clip, qimg);
+}
+
 std::string DiskImagePyramidMultiChannel::get_value_as_str(int32 x, int32 y) const {
+  load();
 
   // Below we cast from Vector<uint8> to Vector<double>, as the former
   // refuses to print well.
@@ -978,6 +1114,7 @@ std::string DiskImagePyramidMultiChannel::get_value_as_str(int32 x, int32 y) con
 }
   
 double DiskImagePyramidMultiChannel::get_value_as_double(int32 x, int32 y) const {
+  load();
   if (m_type == CH1_DOUBLE) {
     return m_img_ch1_double.bottom()(x, y, 0);
   }else if (m_type == CH2_UINT8){
@@ -996,4 +1133,78 @@ void PointList::push_back(std::list<vw::Vector2> pts) {
   }
 }
 
+void MatchGridIndex::build(std::vector<vw::ip::InterestPoint> const& ip) {
+
+  m_num_points = ip.size();
+  m_box        = BBox2();
+  m_cell_start.clear();
+  m_indices.clear();
+  m_cols = 0;
+  m_rows = 0;
+  if (ip.empty())
+    return;
+
+  for (size_t it = 0; it < ip.size(); it++)
+    m_box.grow(Vector2(ip[it].x, ip[it].y));
+
+  // Aim for 16 points per cell. The second term is for points that
+  // are all on a horizontal or vertical line.
+  double w = m_box.width(), h = m_box.height();
+  double num = ip.size();
+  m_cell_size = std::max(sqrt(w*h*16.0/num), std::max(w, h)*16.0/num);
+  if (m_cell_size <= 0)
+    m_cell_size = 1.0;
+  m_cols = int(w/m_cell_size) + 1;
+  m_rows = int(h/m_cell_size) + 1;
+
+  // Sort the point indices by cell
+  std::vector<size_t> cell_of(ip.size());
+  m_cell_start.resize(m_cols*m_rows + 1, 0);
+  for (size_t it = 0; it < ip.size(); it++) {
+    int col = int((ip[it].x - m_box.min().x())/m_cell_size);
+    int row = int((ip[it].y - m_box.min().y())/m_cell_size);
+    cell_of[it] = std::min(col, m_cols - 1) + std::min(row, m_rows - 1)*m_cols;
+    m_cell_start[cell_of[it] + 1]++;
+  }
+  for (size_t k = 1; k < m_cell_start.size(); k++)
+    m_cell_start[k] += m_cell_start[k-1];
+
+  std::vector<size_t> pos(m_cell_start.begin(), m_cell_start.end() - 1);
+  m_indices.resize(ip.size());
+  for (size_t it = 0; it < ip.size(); it++)
+    m_indices[pos[cell_of[it]]++] = it;
+}
+
+void MatchGridIndex::query(std::vector<vw::ip::InterestPoint> const& ip,
+                           vw::BBox2 const& box, double min_spacing,
+                           std::vector<size_t> & indices) const {
+  indices.clear();
+  if (m_indices.empty() || box.empty())
+    return;
+  if (box.max().x() < m_box.min().x() || box.min().x() > m_box.max().x() ||
+      box.max().y() < m_box.min().y() || box.min().y() > m_box.max().y())
+    return;
+
+  int col0 = std::max(int(floor((box.min().x() - m_box.min().x())/m_cell_size)), 0);
+  int row0 = std::max(int(floor((box.min().y() - m_box.min().y())/m_cell_size)), 0);
+  int col1 = std::min(int(floor((box.max().x() - m_box.min().x())/m_cell_size)), m_cols - 1);
+  int row1 = std::min(int(floor((box.max().y() - m_box.min().y())/m_cell_size)), m_rows - 1);
+
+  bool thin_out = (m_cell_size <= min_spacing);
+  for (int row = row0; row <= row1; row++) {
+    for (int col = col0; col <= col1; col++) {
+      int cell = col + row*m_cols;
+      for (size_t k = m_cell_start[cell]; k < m_cell_start[cell+1]; k++) {
+        size_t it = m_indices[k];
+        if (ip[it].x < box.min().x() || ip[it].x > box.max().x() ||
+            ip[it].y < box.min().y() || ip[it].y > box.max().y())
+          continue;
+        indices.push_back(it);
+        if (thin_out)
+          break;
+      }
+    }
+  }
+}
+
 }} // namespace vw::gui
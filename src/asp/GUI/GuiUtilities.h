@@ -89,6 +89,15 @@ namespace vw { namespace gui {
   /// Access the global list of temporary files
   TemporaryFiles& temporary_files();
 
+  /// The file from which to build the pyramid of subsampled images for
+  /// an image. With --pyramid-cache-dir, this is a link to the image in
+  /// a subdirectory of the cache specific to the image path, size, and
+  /// modification time. Then the pyramid is kept there and reused in
+  /// later sessions, even if the directory of the image is read-only.
+  /// The least recently used subdirectories are removed to keep the
+  /// cache within --pyramid-cache-size-mb.
+  std::string pyramid_base_file(std::string const& image_file);
+
   // Pop-up a window with given message
   void popUp(std::string msg);
 
@@ -148,11 +157,19 @@ namespace vw { namespace gui {
   /// Convert a BBox2 object to a QRect object.
   QRect bbox2qrect(BBox2 const& B);
 
-  /// Save a hillshaded file
-  bool write_hillshade(vw::cartography::GdalWriteOptions const& opt,
-                       double azimuth, double elevation,
-                       std::string const& input_file,
-                       std::string      & output_file);
+  /// The ground size, in meters, of a pixel of an image with the given
+  /// georeference, along the columns and rows, near the given pixel.
+  vw::Vector2 georef_pixel_size(vw::cartography::GeoReference const& georef,
+                                vw::Vector2 const& pix);
+
+  /// Hillshade a DEM clip with the given pixel size in meters, and
+  /// form the QImage to display. The azimuth of the light is measured
+  /// in degrees clockwise from north, and its elevation in degrees
+  /// above the horizon.
+  void formHillshadeQimage(bool highlight_nodata, double nodata_val,
+                           vw::Vector2 const& pixel_size,
+                           double azimuth, double elevation,
+                           ImageView<double> const& clip, QImage & qimg);
 
   // Given an image, and an input file name, modify the filename using
   // a prefix. Write the image to that filename. If that fails, create
@@ -226,15 +243,19 @@ namespace vw { namespace gui {
   // is not a perfect solution, but there seem to be no easy way
   // in ASP to handle images with variable numbers of channels.
   // TODO: Add the case when multi-channel images also have float or double pixels
+  // The pyramid is built only on first use, as for an image which
+  // was never in view it may not be needed at all. Until then only the
+  // image size and number of channels, read from the file header, are known.
   struct DiskImagePyramidMultiChannel{
     vw::cartography::GdalWriteOptions m_opt;
-    vw::mosaic::DiskImagePyramid< double               > m_img_ch1_double;
-    vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 2> > m_img_ch2_uint8;
-    vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 3> > m_img_ch3_uint8;
-    vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 4> > m_img_ch4_uint8;
+    std::string m_base_file;
+    mutable vw::mosaic::DiskImagePyramid< double               > m_img_ch1_double;
+    mutable vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 2> > m_img_ch2_uint8;
+    mutable vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 3> > m_img_ch3_uint8;
+    mutable vw::mosaic::DiskImagePyramid< Vector<vw::uint8, 4> > m_img_ch4_uint8;
     int m_num_channels;
     int m_rows, m_cols;
-    ImgType m_type; // keeps track of which of the above images we use
+    mutable ImgType m_type; // keeps track of which of the above images we use
 
     // Constructor
     DiskImagePyramidMultiChannel(std::string const& base_file = "",
@@ -247,7 +268,25 @@ namespace vw { namespace gui {
     void get_image_clip(double scale_in, vw::BBox2i region_in,
                       bool highlight_nodata,
                       QImage & qimg, double & scale_out, vw::BBox2i & region_out) const;
+
+    // As get_image_clip(), but hillshade the clip of a single-channel
+    // image, so that only the pixels being shown are hillshaded.
+    void get_hillshade_clip(double scale_in, vw::BBox2i region_in,
+                            bool highlight_nodata,
+                            vw::cartography::GeoReference const& georef,
+                            double azimuth, double elevation,
+                            QImage & qimg, double & scale_out, vw::BBox2i & region_out) const;
+    // As get_image_clip(), but show as no-data, highlighted, the pixels
+    // of a single-channel image at or below the given threshold. Only
+    // the pixels being shown are thresholded.
+    void get_thresh_clip(double scale_in, vw::BBox2i region_in,
+                         double thresh,
+                         QImage & qimg, double & scale_out, vw::BBox2i & region_out) const;
     double get_nodata_val() const;
+
+    /// Build the pyramid if not done already.
+    void load() const;
+    bool is_loaded() const { return m_type != UNINIT; }
     
     int32 cols  () const { return m_cols;  }
     int32 rows  () const { return m_rows;  }
@@ -303,6 +342,33 @@ namespace vw { namespace gui {
     void push_back(std::list<vw::Vector2> pts);
   };
 
+  /// A grid over the interest points of one image, so that drawing
+  /// visits only the points in view. Each cell lists the indices of
+  /// its points, stored contiguously.
+  class MatchGridIndex {
+    vw::BBox2 m_box;
+    double m_cell_size;
+    int m_cols, m_rows;
+    size_t m_num_points;
+    std::vector<size_t> m_cell_start; // cell k owns m_indices[m_cell_start[k]...m_cell_start[k+1]]
+    std::vector<size_t> m_indices;
+  public:
+    MatchGridIndex(): m_cell_size(0), m_cols(0), m_rows(0), m_num_points(0) {}
+
+    /// Index these points. About 16 points land in a cell on average.
+    void build(std::vector<vw::ip::InterestPoint> const& ip);
+
+    /// The number of points the index was built with.
+    size_t num_points() const { return m_num_points; }
+
+    /// Find the points within the given box. Where a grid cell is no
+    /// bigger than min_spacing, return just one point in that cell,
+    /// so a dense set of points seen from afar is thinned out.
+    void query(std::vector<vw::ip::InterestPoint> const& ip,
+               vw::BBox2 const& box, double min_spacing,
+               std::vector<size_t> & indices) const;
+  };
+
   /// Class to create a file list on the left side of the window
   class chooseFilesDlg: public QWidget{
     Q_OBJECT
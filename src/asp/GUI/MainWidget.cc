@@ -180,6 +180,7 @@ namespace vw { namespace gui {
     installEventFilter(this);
 
     m_firstPaintEvent = true;
+    m_ip_index_dirty  = true;
     m_emptyRubberBand = QRect(0, 0, 0, 0);
     m_rubberBand      = m_emptyRubberBand;
     m_cropWinMode     = false;
@@ -570,56 +571,24 @@ namespace vw { namespace gui {
       return;
     }
 
-    int num_images = m_images.size();
-    m_shadow_thresh_images.clear(); // wipe the old copy
-    m_shadow_thresh_images.resize(num_images);
-
-    // Create the thresholded images and save them to disk. We have to do it each
-    // time as perhaps the shadow threshold changed.
-    for (int image_iter = 0; image_iter < num_images; image_iter++) {
-      std::string input_file = m_image_files[image_iter];
-
-      double nodata_val = -std::numeric_limits<double>::max();
-      vw::read_nodata_val(input_file, nodata_val);
-      nodata_val = std::max(nodata_val, m_shadow_thresh);
-
-      int num_channels = m_images[image_iter].img.planes();
-      if (num_channels != 1) {
-        popUp("Thresholding makes sense only for single-channel images.");
-        m_shadow_thresh_view_mode = false;
-        return;
-      }
-
-      ImageViewRef<double> thresh_image
-        = apply_mask(create_mask_less_or_equal(DiskImageView<double>(input_file),
-                                               nodata_val), nodata_val);
-
-      std::string suffix = "_thresh.tif";
-      bool has_georef = false;
-      bool has_nodata = true;
-      vw::cartography::GeoReference georef;
-      std::string output_file
-        = write_in_orig_or_curr_dir(m_opt,
-                                    thresh_image, input_file, suffix,
-                                    has_georef,  georef,
-                                    has_nodata, nodata_val);
-
-      // Read it back right away
-      m_shadow_thresh_images[image_iter].read(output_file, m_opt, m_use_georef);
-      temporary_files().files.insert(output_file);
+    int num_channels = m_images[0].img.planes();
+    if (num_channels != 1) {
+      popUp("Thresholding makes sense only for single-channel images.");
+      m_shadow_thresh_view_mode = false;
+      return;
     }
 
+    // The thresholding itself is done in drawImage() for the visible
+    // pixels only, so changing the threshold needs just a redraw.
     refreshPixmap();
   }
 
   void MainWidget::maybeGenHillshade(){
 
+    // Check that the images can be hillshaded. The hillshading itself
+    // is done in drawImage() for the visible pixels only, so changing
+    // the hillshade parameters needs just a redraw.
     int num_images = m_images.size();
-    m_hillshaded_images.clear(); // wipe the old copy
-    m_hillshaded_images.resize(num_images);
-
-    // Create the hillshaded images and save them to disk. We have to do
-    // it each time as perhaps the hillshade parameters changed.
     for (int image_iter = 0; image_iter < num_images; image_iter++) {
 
       if (!m_hillshade_mode[image_iter]) continue;
@@ -630,28 +599,12 @@ namespace vw { namespace gui {
         return;
       }
 
-      std::string input_file = m_image_files[image_iter];
       int num_channels = m_images[image_iter].img.planes();
       if (num_channels != 1) {
         popUp("Hill-shading makes sense only for single-channel images.");
         m_hillshade_mode[image_iter] = false;
         return;
       }
-
-      // Save the hillshaded images to disk
-      std::string hillshaded_file;
-      bool success = write_hillshade(m_opt,
-                                     m_hillshade_azimuth,
-                                     m_hillshade_elevation,
-                                     input_file, hillshaded_file);
-      if (!success) {
-        m_hillshade_mode[image_iter] = false;
-        return;
-      }
-
-      vw_out() << "Reading: " << hillshaded_file << std::endl;
-      m_hillshaded_images[image_iter].read(hillshaded_file, m_opt, m_use_georef);
-      temporary_files().files.insert(hillshaded_file);
     }
   }
 
@@ -908,6 +861,21 @@ namespace vw { namespace gui {
 
       if (m_images[i].isPoly())
 	continue;
+
+      // Do not build the pyramid of an image which would be shown
+      // only as a few screen pixels, as when very many images are
+      // loaded and seen from afar. Draw its footprint instead. The
+      // pyramid gets built once zoomed in enough.
+      if (!m_images[i].img.is_loaded()) {
+        const int min_pyramid_screen_size = 128;
+        BBox2 footprint = world2screen(B);
+        if (std::max(footprint.width(), footprint.height()) < min_pyramid_screen_size) {
+          paint->setPen(QColor("yellow"));
+          paint->setBrush(Qt::NoBrush);
+          paint->drawRect(bbox2qrect(footprint).normalized());
+          continue;
+        }
+      }
       
       QImage qimg;
       // Since the image portion contained in image_box could be huge,
@@ -921,13 +889,13 @@ namespace vw { namespace gui {
       BBox2i region_out;
       bool   highlight_nodata = m_shadow_thresh_view_mode;
       if (m_shadow_thresh_view_mode){
-        m_shadow_thresh_images[i].img.get_image_clip(scale, image_box,
-                                                     highlight_nodata,
-                                                     qimg, scale_out, region_out);
+        m_images[i].img.get_thresh_clip(scale, image_box, m_shadow_thresh,
+                                        qimg, scale_out, region_out);
       }else if (m_hillshade_mode[i]){
-        m_hillshaded_images[i].img.get_image_clip(scale, image_box,
-                                                  highlight_nodata,
-                                                  qimg, scale_out, region_out);
+        m_images[i].img.get_hillshade_clip(scale, image_box, highlight_nodata,
+                                           m_images[i].georef,
+                                           m_hillshade_azimuth, m_hillshade_elevation,
+                                           qimg, scale_out, region_out);
       }else{
         // Original images
         m_images[i].img.get_image_clip(scale, image_box,
@@ -949,9 +917,26 @@ namespace vw { namespace gui {
                               QImage::Format_ARGB32_Premultiplied);
 
         // Initialize all pixels to transparent
-        for (int col = 0; col < qimg2.width(); col++) {
-          for (int row = 0; row < qimg2.height(); row++) {
-            qimg2.setPixel(col, row,  QColor(0, 0, 0, 0).rgba());
+        qimg2.fill(QColor(0, 0, 0, 0).rgba());
+
+        // Finding the pixel in m_images[i] for a screen pixel goes
+        // through the georeference transforms, which is slow. Do it
+        // exactly only on a grid of screen pixels, and interpolate
+        // bilinearly in between. Where a transform fails at a grid
+        // corner, as beyond the edge of a projection, do every pixel
+        // of that grid cell exactly.
+        const int grid = 8;
+        int nx = (screen_box.width()  + grid - 1)/grid + 1;
+        int ny = (screen_box.height() + grid - 1)/grid + 1;
+        std::vector<Vector2>       grid_pix(nx*ny);
+        std::vector<unsigned char> grid_ok (nx*ny, 0);
+        for (int gx = 0; gx < nx; gx++){
+          for (int gy = 0; gy < ny; gy++){
+            Vector2 screen_pt(screen_box.min().x() + gx*grid, screen_box.min().y() + gy*grid);
+            try {
+              grid_pix[gy*nx + gx] = MainWidget::world2image(screen2world(screen_pt), i);
+              grid_ok [gy*nx + gx] = 1;
+            }catch ( const std::exception & e ) {}
           }
         }
 
@@ -959,19 +944,27 @@ namespace vw { namespace gui {
         for (int x = screen_box.min().x(); x < screen_box.max().x(); x++){
           for (int y = screen_box.min().y(); y < screen_box.max().y(); y++){
 
-            // Convert from a pixel as seen on screen to the world coordinate system.
-            Vector2 world_pt = screen2world(Vector2(x, y));
-
             // p is in pixel coordinates of m_images[i]
             Vector2 p;
-            try {
-              p = MainWidget::world2image(world_pt, i);
-              bool is_in = (p[0] >= 0 && p[0] <= m_images[i].img.cols()-1 &&
-                            p[1] >= 0 && p[1] <= m_images[i].img.rows()-1 );
-              if (!is_in) continue; // out of range
-            }catch ( const std::exception & e ) {
-              continue;
+            int    gx = (x - screen_box.min().x())/grid, gy = (y - screen_box.min().y())/grid;
+            double fx = double(x - screen_box.min().x() - gx*grid)/grid;
+            double fy = double(y - screen_box.min().y() - gy*grid)/grid;
+            int    k  = gy*nx + gx;
+            if (grid_ok[k] && grid_ok[k+1] && grid_ok[k+nx] && grid_ok[k+nx+1]){
+              p = (1-fy)*((1-fx)*grid_pix[k]    + fx*grid_pix[k+1])
+                +    fy *((1-fx)*grid_pix[k+nx] + fx*grid_pix[k+nx+1]);
+            }else{
+              try {
+                // Convert from a pixel as seen on screen to the world coordinate system.
+                Vector2 world_pt = screen2world(Vector2(x, y));
+                p = MainWidget::world2image(world_pt, i);
+              }catch ( const std::exception & e ) {
+                continue;
+              }
             }
+            bool is_in = (p[0] >= 0 && p[0] <= m_images[i].img.cols()-1 &&
+                          p[1] >= 0 && p[1] <= m_images[i].img.rows()-1 );
+            if (!is_in) continue; // out of range
                         
             // Convert to scaled image pixels and snap to integer value
             p = round(p/scale_out);
@@ -1039,8 +1032,25 @@ namespace vw { namespace gui {
         highlight_last = true;
     }
 
-    // For each IP...
-    for (size_t ip_iter = 0; ip_iter < ip.size(); ip_iter++) {
+    if (m_ip_index_dirty || m_ip_index.num_points() != ip.size()) {
+      m_ip_index.build(ip);
+      m_ip_index_dirty = false;
+    }
+
+    // Look up only the points in view. When zoomed out so far that
+    // many points would be drawn on top of each other, draw just one
+    // per few screen pixels.
+    std::vector<size_t> in_view;
+    BBox2 view_box = screen2world(BBox2(0, 0, m_window_width, m_window_height));
+    m_ip_index.query(ip, view_box, pixelToWorldDist(3.0), in_view);
+
+    // Always draw the point being edited, if any
+    if (highlight_last && (in_view.empty() || in_view.back() != ip.size() - 1))
+      in_view.push_back(ip.size() - 1);
+
+    for (size_t view_iter = 0; view_iter < in_view.size(); view_iter++) {
+      size_t ip_iter = in_view[view_iter];
+
       // Generate the pixel coord of the point
       double x = ip[ip_iter].x;
       double y = ip[ip_iter].y;
@@ -2265,6 +2275,8 @@ namespace vw { namespace gui {
 	vw_out() << "Shadow threshold for "
 		 << m_image_files[0]
 		 << ": " << m_shadow_thresh << std::endl;
+	if (m_shadow_thresh_view_mode)
+	  refreshPixmap();
 	return;
       }
 
@@ -2581,6 +2593,10 @@ namespace vw { namespace gui {
       return;
     }
 
+    // All the places which add, delete, or load matches come here
+    // afterwards, so this is where the index goes stale.
+    m_ip_index_dirty = true;
+
     m_view_matches = view_matches;
     refreshPixmap();
   }
@@ -2773,6 +2789,8 @@ namespace vw { namespace gui {
     m_shadow_thresh = thresh;
     vw_out() << "Shadow threshold for " << m_image_files[0]
 	     << ": " << m_shadow_thresh << std::endl;
+    if (m_shadow_thresh_view_mode)
+      refreshPixmap();
   }
 
   double MainWidget::getThreshold(){
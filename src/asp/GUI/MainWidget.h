@@ -337,13 +337,15 @@ public slots:
     double m_shadow_thresh;
     bool   m_shadow_thresh_calc_mode;
     bool   m_shadow_thresh_view_mode;
-    std::vector<imageData> m_shadow_thresh_images;
 
-    std::vector<imageData> m_hillshaded_images;
     std::set<int> m_indicesWithAction;
     
     bool m_view_matches; ///< Control if IP's are drawn
 
+    /// Index over the IP's of this image, rebuilt when the matches change
+    MatchGridIndex m_ip_index;
+    bool m_ip_index_dirty;
+
     bool m_zoom_all_to_same_region; // if all widgets are forced to zoom to same region
     bool & m_allowMultipleSelections; // alias, this is controlled from MainWindow for all widgets
     bool m_can_emit_zoom_all_signal; 
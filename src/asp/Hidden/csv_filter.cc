@@ -15,7 +15,7 @@
 //  limitations under the License.
 // __END_LICENSE__
 
-// This tool does one of two things:
+// This tool does one of three things:
 // 1. Read a DEM and a CSV file, with the csv format for example, being:
 // --csv-format '1:file 2:lon 3:lat 4:radius_km'
 // and throw away all CSV points further than a given distance from
@@ -43,12 +43,23 @@
 // disp(sprintf('saving file %s', file));
 // save(file, 'G', '-ascii', '-double');
 
+// 3. Keep only the lines of a CSV file with points in a time window
+// and/or a lon-lat box, and write them unchanged to --output-csv.
+// The time is in the column named 'file' in --csv-format, such as
+// 2009-09-21T23:32:28.76. The file is read and filtered in blocks of
+// lines, in parallel. With --index, a summary of each block, with its
+// time range and lon-lat box, is saved on the first run, and later runs
+// read only the blocks which can have points in the window.
+// A reference DEM is not needed, but if given its georeference is used.
+
 // Optionally, grouping the points by track can be done, by parsing
 // the LOLA RDR file, but this was not helpful.
 
 // This is work in progess.
 
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Math.h>
 #include <vw/Image.h>
@@ -60,12 +71,17 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/PointUtils.h>
 
+#include <algorithm>
 #include <limits>
 #include <cstring>
 #include <ctime>
+#include <fstream>
+#include <sstream>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 namespace fs = boost::filesystem;
 namespace po = boost::program_options;
 
@@ -78,6 +94,8 @@ struct Options : public vw::cartography::GdalWriteOptions {
   std::string csv_file, reference_dem;
   double max_height_diff;
   std::string projected_point_file, projected_grid, interpolated_csv, interpolated_dem;
+  std::string output_csv, index_file, start_time_str, end_time_str;
+  BBox2 lon_lat_window;
   
   Options():max_height_diff(-1){}
 
@@ -95,7 +113,12 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("projected-point-file",  po::value(&opt.projected_point_file)->default_value(""), "After reading the CSV file entries and filtering them, write them in projected coordinates (projected x, projected y, height above datum).")
     ("projected-grid",  po::value(&opt.projected_grid)->default_value(""), "After reading the CSV file entries and filtering them, write the x, y grid at which we want these values interpolated using natural neighbor.")
     ("interpolated-csv",  po::value(&opt.interpolated_csv)->default_value(""), "Read from disk the CSV values interpolated on the grid.")
-    ("interpolated-dem",  po::value(&opt.interpolated_dem)->default_value(""), "Write the interpolated values as a DEM.");
+    ("interpolated-dem",  po::value(&opt.interpolated_dem)->default_value(""), "Write the interpolated values as a DEM.")
+    ("output-csv",  po::value(&opt.output_csv)->default_value(""), "Write the lines of the CSV file with points in the time window and lon-lat box to this file. The reference DEM is then optional.")
+    ("start-time",  po::value(&opt.start_time_str)->default_value(""), "Keep the points at or after this time, such as 2009-09-21T23:32:28. The time is in the column named 'file' in --csv-format.")
+    ("end-time",  po::value(&opt.end_time_str)->default_value(""), "Keep the points at or before this time.")
+    ("lon-lat-window",  po::value(&opt.lon_lat_window)->default_value(BBox2(0,0,0,0), "auto"), "Keep the points in this lon-lat box. The format is: lon_min lat_min lon_max lat_max.")
+    ("index",  po::value(&opt.index_file)->default_value(""), "With --output-csv, save the time range and lon-lat box of each block of lines of the CSV file to this file, or if it was saved for this CSV file before, read from it which blocks to filter.");
     
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -122,6 +145,13 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if (opt.csv_file == "" )
     vw_throw(ArgumentErr() << "The CSV file was not specified.\n" << usage << general_options << "\n");
 
+  // Filtering by time and location needs no more checks
+  if (opt.output_csv != "")
+    return;
+  if (opt.index_file != "")
+    vw_throw(ArgumentErr() << "The option --index needs --output-csv.\n"
+             << usage << general_options << "\n");
+
   if (opt.reference_dem == "" )
     vw_throw(ArgumentErr() << "The reference DEM file was not specified.\n" << usage << general_options << "\n");
 
@@ -136,20 +166,21 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
  
 }
 
-// Convert 2009-09-21T23:32:28.76345700 to seconds
-double parse_time(std::string& time_str){
+// Convert 2009-09-21T23:32:28.76345700 to seconds. Return false if
+// the time cannot be parsed.
+bool parse_time(std::string const& time_str, double & seconds){
   int year, month, day, hour, min;
   double sec;
 
   // Replace all '-' and 'T' and ':' with spaces to scan things easier
-  char * str = const_cast<char*>(time_str.c_str());
-  for (size_t i = 0; i < time_str.size(); i++){
+  std::string str = time_str;
+  for (size_t i = 0; i < str.size(); i++){
     if (str[i] == 'T' || str[i] == ':' || str[i] == '-')
       str[i] = ' ';
   }
   
-  if (sscanf(time_str.c_str(), "%d %d %d %d %d %lf", &year, &month, &day, &hour, &min, &sec) != 6 )
-    vw_throw(ArgumentErr() << "Could not parse time: " << time_str << ".\n");
+  if (sscanf(str.c_str(), "%d %d %d %d %d %lf", &year, &month, &day, &hour, &min, &sec) != 6 )
+    return false;
 
   struct tm t = {0};  // Initalize to all 0's
   t.tm_year = year - 1900;  // This is year-1900, so 112 = 2012
@@ -160,7 +191,350 @@ double parse_time(std::string& time_str){
   t.tm_sec = sec;
   time_t timeSinceEpoch = mktime(&t); // for some reason, the answer I get is off by an hour. Dunno.
 
-  return double(timeSinceEpoch) + (sec - int(sec)); // add back the fractional part
+  seconds = double(timeSinceEpoch) + (sec - int(sec)); // add back the fractional part
+  return true;
+}
+
+double parse_time(std::string const& time_str){
+  double seconds;
+  if (!parse_time(time_str, seconds))
+    vw_throw(ArgumentErr() << "Could not parse time: " << time_str << ".\n");
+  return seconds;
+}
+
+// The time range and lon-lat box of the points in a block of lines of
+// the CSV file. Empty ranges have the min above the max.
+struct BlockSummary {
+  vw::int64 offset, length, num_points;
+  double min_time, max_time;
+  BBox2 lonlat;
+  BlockSummary(): offset(0), length(0), num_points(0), min_time(1), max_time(0) {}
+};
+
+// The points to keep
+struct CsvWindow {
+  bool   has_time, has_lonlat;
+  double start_time, end_time;
+  BBox2  lonlat;
+
+  // A longitude may be in [0, 360) while the box is in [-180, 180)
+  bool contains_lonlat(Vector2 ll) const {
+    for (int k = -1; k <= 1; k++) {
+      if (lonlat.contains(ll + Vector2(360.0*k, 0)))
+        return true;
+    }
+    return false;
+  }
+  bool contains(double time, Vector2 const& ll) const {
+    return (!has_time   || (time >= start_time && time <= end_time)) &&
+           (!has_lonlat || contains_lonlat(ll));
+  }
+  bool intersects(BlockSummary const& b) const {
+    if (b.num_points == 0)
+      return false;
+    if (has_time && (b.min_time > b.max_time ||
+                     b.max_time < start_time || b.min_time > end_time))
+      return false;
+    if (has_lonlat) {
+      if (b.lonlat.empty())
+        return false;
+      bool found = false;
+      for (int k = -1; k <= 1; k++) {
+        BBox2 box = b.lonlat;
+        box.min() += Vector2(360.0*k, 0);
+        box.max() += Vector2(360.0*k, 0);
+        if (lonlat.intersects(box))
+          found = true;
+      }
+      if (!found)
+        return false;
+    }
+    return true;
+  }
+};
+
+// Reads the CSV file in blocks of whole lines, and also the byte
+// ranges of blocks found before.
+class CsvBlockReader {
+  std::ifstream m_ifs;
+  vw::int64     m_offset; // Where the carry starts in the file
+  std::string   m_carry;  // The start of a line not finished in the last block
+public:
+  static const size_t BLOCK_SIZE = 1024*1024;
+
+  CsvBlockReader(std::string const& file): m_ifs(file.c_str(), std::ios::binary), m_offset(0) {
+    if (!m_ifs)
+      vw_throw(IOErr() << "Unable to open file \"" << file << "\"");
+  }
+
+  // The next block. Returns false at the end of the file.
+  bool next(BlockSummary & summary, std::string & block) {
+    block.swap(m_carry);
+    m_carry.clear();
+    while (m_ifs) {
+      size_t start = block.size();
+      block.resize(start + BLOCK_SIZE);
+      m_ifs.read(&block[start], BLOCK_SIZE);
+      block.resize(start + m_ifs.gcount());
+      if (!m_ifs)
+        break; // The last block, which may not end with a newline
+
+      // A block without a newline is a part of a very long line
+      size_t pos = block.rfind('\n');
+      if (pos != std::string::npos) {
+        m_carry.assign(block, pos + 1, std::string::npos);
+        block.resize(pos + 1);
+        break;
+      }
+    }
+    summary = BlockSummary();
+    summary.offset = m_offset;
+    summary.length = block.size();
+    m_offset += block.size();
+    return !block.empty();
+  }
+
+  void read(BlockSummary const& summary, std::string & block) {
+    block.resize(summary.length);
+    m_ifs.clear();
+    m_ifs.seekg(summary.offset);
+    m_ifs.read(&block[0], summary.length);
+    if (vw::int64(m_ifs.gcount()) != summary.length)
+      vw_throw(IOErr() << "Could not read the CSV file at offset " << summary.offset << ".\n");
+  }
+};
+
+// Keep the lines of a block with points in the window, and summarize
+// all the points of the block.
+class BlockFilterTask: public vw::Task, private boost::noncopyable {
+  asp::CsvConv const& m_conv;
+  GeoReference        m_geo; // A copy, the projection is not shareable
+  CsvWindow    const& m_window;
+  bool                m_has_time_col;
+  std::string  const& m_block;
+  std::string       & m_kept;
+  BlockSummary      & m_summary;
+public:
+  BlockFilterTask(asp::CsvConv const& conv, GeoReference const& geo, CsvWindow const& window,
+                  bool has_time_col, std::string const& block, std::string & kept,
+                  BlockSummary & summary):
+    m_conv(conv), m_geo(geo), m_window(window), m_has_time_col(has_time_col),
+    m_block(block), m_kept(kept), m_summary(summary) {}
+
+  void operator()() {
+    const char* ptr       = m_block.c_str();
+    const char* block_end = ptr + m_block.size();
+    while (ptr < block_end) {
+      const char* line_end = (const char*)memchr(ptr, '\n', block_end - ptr);
+      if (line_end == NULL)
+        line_end = block_end;
+      const char* next = line_end + 1;
+
+      // Comments, the header, and lines which cannot be parsed are skipped
+      asp::CsvConv::CsvRecord values;
+      if (*ptr == '#' || !m_conv.parse_csv_fields(ptr, line_end, values)) {
+        ptr = next;
+        continue;
+      }
+      Vector3 llh = m_conv.csv_to_geodetic(values, m_geo);
+      if (llh != llh) { // invalid point
+        ptr = next;
+        continue;
+      }
+      Vector2 ll = subvector(llh, 0, 2);
+
+      double time = 0;
+      bool has_time = m_has_time_col && parse_time(values.file, time);
+      if (has_time) {
+        if (m_summary.min_time > m_summary.max_time) {
+          m_summary.min_time = m_summary.max_time = time;
+        } else {
+          m_summary.min_time = std::min(m_summary.min_time, time);
+          m_summary.max_time = std::max(m_summary.max_time, time);
+        }
+      }
+      m_summary.lonlat.grow(ll);
+      m_summary.num_points++;
+
+      if ((has_time || !m_window.has_time) && m_window.contains(time, ll)) {
+        m_kept.append(ptr, line_end);
+        m_kept += '\n';
+      }
+      ptr = next;
+    }
+  }
+};
+
+// The index is valid only for the same CSV file read the same way
+std::string csv_index_key(Options const& opt, std::string const& proj4) {
+  std::ostringstream os;
+  os << fs::file_size(opt.csv_file) << ' ' << fs::last_write_time(opt.csv_file) << ' '
+     << opt.csv_format_str << ' ' << proj4 << ' ' << opt.datum;
+  std::string key = os.str();
+  std::replace(key.begin(), key.end(), '\n', ' ');
+  return key;
+}
+
+bool read_csv_index(std::string const& index_file, std::string const& key,
+                    std::vector<BlockSummary> & blocks) {
+  blocks.clear();
+  std::ifstream ifs(index_file.c_str());
+  std::string line;
+  if (!std::getline(ifs, line) || line != "# csv_filter index: " + key)
+    return false;
+  BlockSummary b;
+  double min_lon, min_lat, max_lon, max_lat;
+  while (ifs >> b.offset >> b.length >> b.num_points >> b.min_time >> b.max_time
+         >> min_lon >> min_lat >> max_lon >> max_lat) {
+    b.lonlat = BBox2();
+    if (min_lon <= max_lon && min_lat <= max_lat)
+      b.lonlat.grow(BBox2(Vector2(min_lon, min_lat), Vector2(max_lon, max_lat)));
+    blocks.push_back(b);
+  }
+  return !blocks.empty();
+}
+
+void write_csv_index(std::string const& index_file, std::string const& key,
+                     std::vector<BlockSummary> const& blocks) {
+  vw_out() << "Writing: " << index_file << std::endl;
+  std::ofstream ofs(index_file.c_str());
+  ofs.precision(17);
+  ofs << "# csv_filter index: " << key << "\n";
+  for (size_t i = 0; i < blocks.size(); i++) {
+    BlockSummary const& b = blocks[i];
+    ofs << b.offset << ' ' << b.length << ' ' << b.num_points << ' '
+        << b.min_time << ' ' << b.max_time << ' ';
+    if (b.lonlat.empty())
+      ofs << "1 1 0 0\n";
+    else
+      ofs << b.lonlat.min().x() << ' ' << b.lonlat.min().y() << ' '
+          << b.lonlat.max().x() << ' ' << b.lonlat.max().y() << "\n";
+  }
+  if (!ofs)
+    vw_throw(IOErr() << "Could not write: " << index_file << ".\n");
+}
+
+// Filter many blocks at a time in parallel, and write the lines kept in
+// the order of the file.
+void filter_blocks(asp::CsvConv const& conv, GeoReference const& geo, CsvWindow const& window,
+                   bool has_time_col, std::vector<std::string> & blocks,
+                   std::vector<BlockSummary> & summaries, std::ofstream & ofs) {
+  int num_blocks = blocks.size();
+  std::vector<std::string> kept(num_blocks);
+  vw::FifoWorkQueue queue(vw_settings().default_num_threads());
+  for (int i = 0; i < num_blocks; i++)
+    queue.add_task(boost::shared_ptr<vw::Task>
+                   (new BlockFilterTask(conv, geo, window, has_time_col, blocks[i],
+                                        kept[i], summaries[i])));
+  queue.join_all();
+  for (int i = 0; i < num_blocks; i++)
+    ofs << kept[i];
+}
+
+void filter_csv(Options const& opt) {
+
+  // The georeference is only needed to find the lon and lat of the points
+  GeoReference geo;
+  std::string proj4 = opt.csv_proj4_str;
+  if (opt.reference_dem != "") {
+    if (!read_georeference(geo, opt.reference_dem))
+      vw_throw(ArgumentErr() << "Canot load a georeference from: " << opt.reference_dem << ".\n");
+    if (proj4 == "")
+      proj4 = geo.overall_proj4_str();
+  }
+  asp::CsvConv csv_conv;
+  csv_conv.parse_csv_format(opt.csv_format_str, proj4);
+  if (!csv_conv.is_configured()) 
+    vw_throw(ArgumentErr() << "Could not configure the csv parser.\n");
+  csv_conv.parse_georef(geo);
+  if (opt.datum != "")
+    geo.set_datum(opt.datum);
+
+  CsvWindow window;
+  window.has_time   = (opt.start_time_str != "" || opt.end_time_str != "");
+  window.start_time = -std::numeric_limits<double>::max();
+  window.end_time   =  std::numeric_limits<double>::max();
+  if (opt.start_time_str != "")
+    window.start_time = parse_time(opt.start_time_str);
+  if (opt.end_time_str != "")
+    window.end_time = parse_time(opt.end_time_str);
+  window.has_lonlat = (opt.lon_lat_window != BBox2(0,0,0,0));
+  window.lonlat     = opt.lon_lat_window;
+
+  bool has_time_col = (opt.csv_format_str.find("file") != std::string::npos);
+  if (window.has_time && !has_time_col)
+    vw_throw(ArgumentErr() << "Filtering by time needs a column named 'file' "
+             << "in --csv-format, with the time.\n");
+
+  std::ofstream ofs(opt.output_csv.c_str(), std::ios::binary);
+  if (!ofs)
+    vw_throw(IOErr() << "Could not open for writing: " << opt.output_csv << ".\n");
+
+  // Keep the header, if any
+  {
+    std::ifstream ifs(opt.csv_file.c_str());
+    std::string line;
+    asp::CsvConv::CsvRecord values;
+    if (std::getline(ifs, line) &&
+        (line.empty() || line[0] == '#' ||
+         !csv_conv.parse_csv_fields(line.c_str(), line.c_str() + line.size(), values)))
+      ofs << line << "\n";
+  }
+
+  CsvBlockReader reader(opt.csv_file);
+  int batch_size = 4*std::max(int(vw_settings().default_num_threads()), 1);
+  std::string key;
+  if (opt.index_file != "")
+    key = csv_index_key(opt, proj4);
+
+  std::vector<BlockSummary> index;
+  if (opt.index_file != "" && read_csv_index(opt.index_file, key, index)) {
+
+    // Read only the blocks which can have points in the window
+    std::vector<BlockSummary> selected;
+    for (size_t i = 0; i < index.size(); i++) {
+      if (window.intersects(index[i]))
+        selected.push_back(index[i]);
+    }
+    vw_out() << "Reading " << selected.size() << " of " << index.size()
+             << " blocks, using the index: " << opt.index_file << std::endl;
+    for (size_t start = 0; start < selected.size(); start += batch_size) {
+      size_t end = std::min(selected.size(), start + batch_size);
+      std::vector<std::string>  blocks(end - start);
+      std::vector<BlockSummary> summaries(end - start);
+      for (size_t i = start; i < end; i++)
+        reader.read(selected[i], blocks[i - start]);
+      filter_blocks(csv_conv, geo, window, has_time_col, blocks, summaries, ofs);
+    }
+
+  } else {
+
+    // Read the whole file, and summarize it if asked to
+    bool done = false;
+    while (!done) {
+      std::vector<std::string>  blocks;
+      std::vector<BlockSummary> summaries;
+      BlockSummary summary;
+      std::string block;
+      while (int(blocks.size()) < batch_size) {
+        if (!reader.next(summary, block)) {
+          done = true;
+          break;
+        }
+        blocks.push_back(std::string());
+        blocks.back().swap(block);
+        summaries.push_back(summary);
+      }
+      filter_blocks(csv_conv, geo, window, has_time_col, blocks, summaries, ofs);
+      index.insert(index.end(), summaries.begin(), summaries.end());
+    }
+    if (opt.index_file != "")
+      write_csv_index(opt.index_file, key, index);
+  }
+
+  if (!ofs)
+    vw_throw(IOErr() << "Could not write: " << opt.output_csv << ".\n");
+  vw_out() << "Wrote: " << opt.output_csv << std::endl;
 }
 
   
@@ -170,6 +544,11 @@ int main(int argc, char *argv[]) {
   try {
     handle_arguments( argc, argv, opt );
 
+    if (opt.output_csv != "") {
+      filter_csv(opt);
+      return 0;
+    }
+
     // Read the DEM georef
     GeoReference csv_georef, dem_georef;
     bool has_georef = read_georeference(dem_georef, opt.reference_dem);
@@ -193,16 +572,15 @@ int main(int argc, char *argv[]) {
     if (opt.datum != "")
       csv_georef.set_datum(opt.datum);
 
-    // Read the CSV file
-    std::list<asp::CsvConv::CsvRecord> csv_records;
-    typedef std::list<asp::CsvConv::CsvRecord>::const_iterator RecordIter;
-    csv_conv.read_csv_file(opt.csv_file, csv_records);
+    // Read the CSV file, converting the points to Cartesian as they are parsed
+    std::vector<Vector3> csv_xyz;
+    csv_conv.read_csv_file(opt.csv_file, csv_georef, csv_xyz);
     
     std::vector<Vector3> csv_llh;
     std::vector<double> timestamp;
     std::vector<std::string> timestamp_str;
-    for (RecordIter iter = csv_records.begin(); iter != csv_records.end(); iter++) {
-      Vector3 xyz = csv_conv.csv_to_cartesian(*iter, csv_georef);
+    for (size_t it = 0; it < csv_xyz.size(); it++) {
+      Vector3 xyz = csv_xyz[it];
       if (xyz == Vector3() || xyz != xyz)
 	continue; // invalid point
       Vector3 llh = dem_georef.datum().cartesian_to_geodetic(xyz);
@@ -0,0 +1,194 @@
+#!/usr/bin/env python
+# __BEGIN_LICENSE__
+#  Copyright (c) 2009-2013, United States Government as represented by the
+#  Administrator of the National Aeronautics and Space Administration. All
+#  rights reserved.
+#
+#  The NGT platform is licensed under the Apache License, Version 2.0 (the
+#  "License"); you may not use this file except in compliance with the
+#  License. You may obtain a copy of the License at
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+# __END_LICENSE__
+
+'''Run tasks which depend on each other, as soon as the tasks they need
+   are done, with a limit on how many tasks of each stage run at the same
+   time. This way the I/O-bound stages of some batches, such as point2dem,
+   overlap with the CPU-bound stages of others, such as stereo.
+
+   As a tool, the tasks are read from a file, one per line, as:
+     <name> <stage> <comma-separated tasks it needs, or -> <command>
+   Lines which are empty or start with # are ignored. A task whose
+   command fails is reported, and the tasks which need it are skipped.'''
+
+import os, sys, argparse, subprocess, threading
+
+class DagRunner(object):
+    '''Run python functions as the tasks of a graph. The functions run in
+       threads, so they should spend their time in external programs.'''
+
+    def __init__(self, stageLimits=None, defaultLimit=1, logger=None):
+        self.stageLimits  = dict(stageLimits or {})
+        self.defaultLimit = max(defaultLimit, 1)
+        self.logger       = logger
+        self.tasks        = [] # In the order they were added
+        self.byName       = {}
+
+    def add(self, name, stage, function, args=(), deps=()):
+        '''Add a task, which calls function(*args) after the tasks named
+           in deps are done. The task fails if the function raises.'''
+        if name in self.byName:
+            raise Exception('Duplicate task: ' + name)
+        task = {'name': name, 'stage': stage, 'function': function, 'args': args,
+                'deps': list(deps), 'status': None, 'error': None}
+        self.tasks.append(task)
+        self.byName[name] = task
+
+    def limit(self, stage):
+        return max(self.stageLimits.get(stage, self.defaultLimit), 1)
+
+    def log(self, text):
+        if self.logger:
+            self.logger.info(text)
+        else:
+            print(text)
+
+    def run(self):
+        '''Run all tasks. Returns the failed tasks, by name, with their
+           errors. Tasks with failed dependencies fail with them.'''
+
+        for task in self.tasks:
+            for dep in task['deps']:
+                if dep not in self.byName:
+                    raise Exception('Task ' + task['name'] + ' needs unknown task ' + dep)
+
+        cond    = threading.Condition()
+        running = {} # Number of running tasks per stage
+        state   = {'active': 0}
+
+        def work(task):
+            try:
+                task['function'](*task['args'])
+                status, error = True, None
+            except Exception as e:
+                status, error = False, e
+            with cond:
+                task['status'] = status
+                task['error']  = error
+                running[task['stage']] -= 1
+                state['active'] -= 1
+                cond.notify()
+
+        pending = list(self.tasks)
+        with cond:
+            while pending or state['active'] > 0:
+                progress = False
+                for task in list(pending):
+                    deps = [self.byName[d] for d in task['deps']]
+                    if any(d['status'] is False for d in deps):
+                        task['status'] = False
+                        task['error']  = Exception('A task it needs failed.')
+                        pending.remove(task)
+                        progress = True
+                        self.log('Skipping task ' + task['name'] + ' as a task it needs failed.')
+                        continue
+                    if not all(d['status'] is True for d in deps):
+                        continue
+                    stage = task['stage']
+                    if running.get(stage, 0) >= self.limit(stage):
+                        continue
+                    running[stage] = running.get(stage, 0) + 1
+                    state['active'] += 1
+                    pending.remove(task)
+                    progress = True
+                    thread = threading.Thread(target=work, args=(task,))
+                    thread.daemon = True
+                    thread.start()
+
+                if not progress:
+                    if state['active'] == 0:
+                        # Only possible with a cycle in the graph
+                        raise Exception('Tasks depend on each other in a cycle: ' +
+                                        ' '.join([t['name'] for t in pending]))
+                    cond.wait()
+
+        failed = {}
+        for task in self.tasks:
+            if not task['status']:
+                failed[task['name']] = task['error']
+        return failed
+
+def runCommand(command):
+    '''Run one of the commands from the file'''
+    print(command)
+    status = subprocess.call(command, shell=True)
+    if status != 0:
+        raise Exception('Command failed with status ' + str(status) + ': ' + command)
+
+def parseStageLimits(values):
+    '''Parse the stage=limit values.'''
+    limits = {}
+    for value in values:
+        parts = value.split('=')
+        if len(parts) != 2:
+            raise Exception('Expecting a stage limit as stage=number, got: ' + value)
+        limits[parts[0]] = int(parts[1])
+    return limits
+
+def main(argsIn):
+
+    try:
+        usage = '''usage: dag_command_runner.py --task-file <file> [options]'''
+        parser = argparse.ArgumentParser(usage=usage)
+
+        parser.add_argument("--task-file",  dest="taskFile", default=None,
+                            help="The file from where to read the tasks.")
+
+        parser.add_argument('--stage-limit', dest='stageLimits', action='append', default=[],
+                            help='How many tasks of a stage to run at the same time, as ' +
+                            'stage=number. Can be repeated.')
+
+        parser.add_argument('--num-processes', dest='numProcesses', type=int, default=1,
+                            help='How many tasks to run at the same time for the stages ' +
+                            'without a limit.')
+
+        options = parser.parse_args(argsIn)
+        stageLimits = parseStageLimits(options.stageLimits)
+
+    except Exception as e:
+        print(str(e))
+        return -1
+
+    if options.taskFile is None or not os.path.exists(options.taskFile):
+        print('Error: Missing task file.')
+        return -1
+
+    runner = DagRunner(stageLimits, options.numProcesses)
+    with open(options.taskFile, 'r') as f:
+        for line in f:
+            line = line.strip()
+            if line == "" or line.startswith('#'):
+                continue
+            parts = line.split(None, 3)
+            if len(parts) != 4:
+                print('Error: Expecting a name, stage, dependencies and command on line: ' + line)
+                return -1
+            (name, stage, deps, command) = parts
+            deps = [] if deps == '-' else deps.split(',')
+            runner.add(name, stage, runCommand, (command,), deps)
+
+    print('Running ' + str(len(runner.tasks)) + ' tasks.')
+    failed = runner.run()
+    for name in sorted(failed.keys()):
+        print('Task ' + name + ' failed: ' + str(failed[name]))
+    print('Finished, ' + str(len(failed)) + ' tasks failed.')
+    return 0 if len(failed) == 0 else 1
+
+# Run main function if called from shell
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
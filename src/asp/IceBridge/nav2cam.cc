@@ -42,6 +42,10 @@
 // interpolate the camera position/orientation in the sbet nav
 // file. Combine with the camera intrinsics tsai file passed on input,
 // and write down the camera intrinsics + extrinsics tsai file.
+//
+// The nav text file is converted, once per flight, to a binary index
+// sorted by time, in which the nav data around each frame is found by
+// binary search.
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/StereoSettings.h>
@@ -50,7 +54,10 @@
 #include <vw/Math/Matrix.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/Extrinsics.h>
+#include <algorithm>
+#include <cstring>
 #include <ctime>
+#include <limits>
 #include <stdlib.h>
 
 // Turn off warnings from eigen
@@ -235,7 +242,7 @@ void parse_camera_pose(std::string const& line, Vector3 & xyz, Quat & look, Quat
 
             
 struct Options : public vw::cartography::GdalWriteOptions {
-  std::string nav_file, input_cam, output_folder;
+  std::string nav_file, nav_index, input_cam, output_folder;
   std::vector<std::string> image_files, camera_files;
   bool detect_offset;
   int  camera_mounting;
@@ -249,6 +256,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("input-cam",      po::value(&opt.input_cam)->default_value(""), 
                        "The input camera file from where to read the intrinsics.")
     ("nav-file",       po::value(&opt.nav_file)->default_value(""), "The nav file, in text format.")
+    ("nav-index",      po::value(&opt.nav_index)->default_value(""),
+                       "The binary index of the nav file, created if missing or older than the nav file. Default: the name of the nav file with the .navindex extension, in the output folder.")
     ("time-offset",    po::value(&opt.time_offset)->default_value(0.0),
                        "Time offset to be added to the navigation file timestamps.")
     ("output-folder",  po::value(&opt.output_folder)->default_value(""), 
@@ -310,6 +319,160 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 
 
 
+
+// TODO: Is the rotation interpolation method ok?  It is the only
+//       method implemented in VW with sparse time values!
+typedef vw::camera::LagrangianInterpolationVarTime NavPosInterpType;
+typedef vw::camera::LagrangianInterpolationVarTime NavRotInterpType;
+
+/// The number of nav records used on each side of a time when interpolating
+const int NAV_INTERP_RADIUS = 4;
+
+/**
+  The records of a nav file, converted to binary and sorted by time, so
+  that the data around the time of a frame is found by binary search,
+  without parsing the text file again for each flight or scanning it.
+
+  Layout, in the byte order of the machine which wrote it: the magic
+  "ASPNAV1\0", uint64 number of records, then for each record the time,
+  the GCC position, and the roll, pitch and heading, as doubles.
+*/
+class NavIndex {
+public:
+
+  /// Convert a nav text file to an index. The times must be non-decreasing.
+  static void build(std::string const& nav_file, std::string const& index_file,
+                    Datum const& datum) {
+
+    std::ifstream ifs(nav_file.c_str());
+    if (!ifs)
+      vw_throw( ArgumentErr() << "Cannot open nav file: " << nav_file << "\n" );
+    vw::create_out_dir(index_file);
+    std::string tmp_file = index_file + ".tmp"; // Not seen until complete
+    std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+    if (!ofs)
+      vw_throw( ArgumentErr() << "Cannot write: " << tmp_file << "\n" );
+
+    uint64 num_records = 0;
+    ofs.write(MAGIC, sizeof(MAGIC));
+    ofs.write(reinterpret_cast<const char*>(&num_records), sizeof(num_records));
+
+    std::string line;
+    double prev_time = -std::numeric_limits<double>::max();
+    while (getline(ifs, line)) {
+      double rec[RECORD_SIZE];
+      double lat, lon, alt;
+      scan_line(line, rec[0], lat, lon, alt, rec[4], rec[5], rec[6]);
+      if (rec[0] < prev_time)
+        vw_throw( ArgumentErr() << "The times in the nav file " << nav_file
+                  << " are not sorted, at line: " << line << "\n" );
+      prev_time = rec[0];
+
+      Vector3 loc = datum.geodetic_to_cartesian(Vector3(lon, lat, alt));
+      for (int i = 0; i < 3; i++)
+        rec[i+1] = loc[i];
+      ofs.write(reinterpret_cast<const char*>(rec), sizeof(rec));
+      num_records++;
+    }
+
+    // Now that the number of records is known, write it in the header
+    ofs.seekp(sizeof(MAGIC));
+    ofs.write(reinterpret_cast<const char*>(&num_records), sizeof(num_records));
+    ofs.close();
+    if (!ofs)
+      vw_throw( IOErr() << "Failed writing: " << tmp_file << "\n" );
+    fs::rename(tmp_file, index_file);
+  }
+
+  /// True if the index exists and is not older than the nav file.
+  static bool is_up_to_date(std::string const& index_file, std::string const& nav_file) {
+    return fs::exists(index_file) &&
+      fs::last_write_time(index_file) >= fs::last_write_time(nav_file);
+  }
+
+  NavIndex(std::string const& index_file): m_index_file(index_file) {
+    m_ifs.open(index_file.c_str(), std::ios::binary);
+    char magic[sizeof(MAGIC)];
+    m_ifs.read(magic, sizeof(magic));
+    m_ifs.read(reinterpret_cast<char*>(&m_num_records), sizeof(m_num_records));
+    if (!m_ifs || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+      vw_throw( IOErr() << "Not a nav index: " << index_file << "\n" );
+  }
+
+  uint64 size() const { return m_num_records; }
+
+  /// Set up interpolators which are valid for times from start to end.
+  /// Returns false if the nav data does not cover these times.
+  bool get_interpolators(double start, double end,
+                         boost::shared_ptr<NavPosInterpType> &pos_interpolator_ptr,
+                         boost::shared_ptr<NavRotInterpType> &rot_interpolator_ptr) {
+
+    if (m_num_records == 0)
+      return false;
+
+    // Find the records bracketing the times, then add a few more on
+    // each side for the interpolation.
+    int64 first = lower_bound(start) - 1 - NAV_INTERP_RADIUS;
+    int64 last  = lower_bound(end)       + NAV_INTERP_RADIUS;
+    first = std::max(first, int64(0));
+    last  = std::min(last,  int64(m_num_records) - 1);
+
+    std::vector<double> recs;
+    read_records(first, last - first + 1, recs);
+    std::vector<double > times;
+    std::vector<Vector3> locs, rots;
+    for (size_t i = 0; i < recs.size(); i += RECORD_SIZE) {
+      times.push_back(recs[i]);
+      locs.push_back(Vector3(recs[i+1], recs[i+2], recs[i+3]));
+      rots.push_back(Vector3(recs[i+4], recs[i+5], recs[i+6]));
+    }
+
+    if (times.front() > start || times.back() < end)
+      return false;
+
+    pos_interpolator_ptr = boost::shared_ptr<NavPosInterpType>(
+          new NavPosInterpType(locs, times, NAV_INTERP_RADIUS));
+    rot_interpolator_ptr = boost::shared_ptr<NavRotInterpType>(
+          new NavRotInterpType(rots, times, NAV_INTERP_RADIUS));
+    return true;
+  }
+
+private:
+
+  static const int  RECORD_SIZE = 7; // Doubles per record
+  static const char MAGIC[8];
+
+  std::string   m_index_file;
+  std::ifstream m_ifs;
+  uint64        m_num_records;
+  std::vector<double> m_buf;
+
+  /// Read consecutive records, starting with the given one.
+  void read_records(int64 first, int64 count, std::vector<double> & recs) {
+    recs.resize(count*RECORD_SIZE);
+    m_ifs.seekg(sizeof(MAGIC) + sizeof(m_num_records) + first*RECORD_SIZE*sizeof(double));
+    m_ifs.read(reinterpret_cast<char*>(&recs[0]), recs.size()*sizeof(double));
+    if (!m_ifs)
+      vw_throw( IOErr() << "Failed reading: " << m_index_file << "\n" );
+  }
+
+  /// The first record with time no less than the given time, by binary search.
+  int64 lower_bound(double time) {
+    int64 lo = 0, hi = m_num_records;
+    while (lo < hi) {
+      int64 mid = lo + (hi - lo)/2;
+      read_records(mid, 1, m_buf);
+      if (m_buf[0] < time)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return lo;
+  }
+};
+
+const char NavIndex::MAGIC[8] = {'A', 'S', 'P', 'N', 'A', 'V', '1', '\0'};
+
 /**
   Class which loads an Icebridge nav file in chunks and provides an interpolator
    for each chunk.
@@ -317,10 +480,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 class ScrollingNavInterpolator {
 public:
 
-  // TODO: Is the rotation interpolation method ok?  It is the only
-  //       method implemented in VW with sparse time values!
-  typedef vw::camera::LagrangianInterpolationVarTime PosInterpType;
-  typedef vw::camera::LagrangianInterpolationVarTime RotInterpType;
+  typedef NavPosInterpType PosInterpType;
+  typedef NavRotInterpType RotInterpType;
 
   // Open the file
   ScrollingNavInterpolator(std::string const& path, Datum const& datum_in)
@@ -385,11 +546,10 @@ public:
       return false;
   
     // Set up the interpolator
-    const int INTERP_RADIUS = 4;  
     pos_interpolator_ptr = boost::shared_ptr<PosInterpType>(
-          new PosInterpType(m_loc_vector, m_time_vector, INTERP_RADIUS));
+          new PosInterpType(m_loc_vector, m_time_vector, NAV_INTERP_RADIUS));
     rot_interpolator_ptr = boost::shared_ptr<RotInterpType>(
-          new RotInterpType(m_rot_vector, m_time_vector, INTERP_RADIUS));
+          new RotInterpType(m_rot_vector, m_time_vector, NAV_INTERP_RADIUS));
               
     return true;
   }
@@ -485,11 +645,12 @@ void print_matrix(Matrix3x3 const& m) {
 
 /// Helper function to write out the camera model once we have the position and pose.
 /// - This also adds the important row-direction flip from the camera to the image.
+/// - The input camera is parsed once, and copied for each frame.
 void write_output_camera(Vector3 const& center, Matrix3x3 const& pose,
-                         std::string const& input_cam, 
+                         PinholeModel const& input_cam, 
                          std::string const& output_camera) {
                          
-  // Load the reference pinhole model, update it, and write it out to disk.
+  // Copy the reference pinhole model, update it, and write it out to disk.
   PinholeModel camera_model(input_cam);
   camera_model.set_camera_center(center);
   camera_model.set_camera_pose(pose);
@@ -513,6 +674,238 @@ void write_output_camera(Vector3 const& center, Matrix3x3 const& pose,
   camera_model.write(output_camera);
 }
 
+/// Find the position and pose of the camera for a frame from the
+/// interpolated nav data, and write the camera.
+/// - Returns false if the pose could not be estimated.
+bool write_frame_camera(Options const& opt, Datum const& datum_wgs84,
+                        PinholeModel const& input_cam,
+                        NavPosInterpType const& pos_interpolator,
+                        NavRotInterpType const& rot_interpolator,
+                        double ortho_time, std::string const& orthoimage_path,
+                        std::string const& output_camera_path) {
+
+  const double POSE_TIME_DELTA = 0.1; // Look this far ahead/behind to determine direction
+
+  // Try to interpolate this ortho position
+  Vector3 gcc_interp, rot_interp;
+  try{
+    gcc_interp = pos_interpolator(ortho_time);
+    rot_interp = rot_interpolator(ortho_time);
+  } catch(...){
+    vw_out() << "Failed to interpolate position for file " << orthoimage_path << std::endl;
+    return false;
+  }
+  Vector3 llh_interp = datum_wgs84.cartesian_to_geodetic(gcc_interp);
+  
+  double roll    = rot_interp[0];
+  double pitch   = rot_interp[1];
+  //double heading = rot_interp[2];
+  //vw_out() << "For file " << orthoimage_path << " computed LLH " << llh_interp << std::endl;
+  //vw_out() << "Roll    = " << roll    <<" = "<< roll*180/3.14159<< std::endl;
+  //vw_out() << "Pitch   = " << pitch   <<" = "<< pitch*180/3.14159<< std::endl;
+  //vw_out() << "Heading = " << heading << std::endl;
+
+  //std::cout << "Ortho time  = " << ortho_time << std::endl;
+  //vw_out() << "llh = " << llh_interp << std::endl;
+  
+  // Now estimate the rotation information
+
+  /*
+    For some reason the heading interpolated from the navigation data is about 30 degrees
+    off from what is expected by looking at the flight path.  The roll and pitch values are
+    consistent with what is stored in the Icebridge-provided ortho files (the heading is not 
+    provided).  What has proven to work the best so far is to estimate the camera pose 
+    including the heading just by using the flight path, and then to apply the pitch and roll
+    to that matrix.  The best order to apply the pitch and roll has been determined by seeing 
+    which one map-projects closest to the lidar data.
+  */
+  
+  // Get a point ahead of and behind the frame location
+  Vector3 gcc_interp_forward  = pos_interpolator(ortho_time+POSE_TIME_DELTA);
+  Vector3 gcc_interp_backward = pos_interpolator(ortho_time-POSE_TIME_DELTA);
+  
+  if (gcc_interp_forward == gcc_interp_backward) {
+    vw_out() << "Failed to estimate pose for file " << orthoimage_path << std::endl;
+    return false;
+  }
+  
+  // From these points get two flight direction vectors and take the mean.
+  Vector3 dir1 = gcc_interp_forward - gcc_interp;
+  Vector3 dir2 = gcc_interp - gcc_interp_backward;
+  Vector3 xDir = (dir1 + dir2) / 2.0;
+ 
+  // The Z vector is straight down from the camera to the ground.
+  Vector3 llh_ground = llh_interp;
+  llh_ground[2] = 0;
+  Vector3 gcc_ground = datum_wgs84.geodetic_to_cartesian(llh_ground);
+  Vector3 zDir = gcc_ground - gcc_interp;
+  
+  // Normalize the vectors
+  xDir = xDir / norm_2(xDir);
+  zDir = zDir / norm_2(zDir);
+  
+  // The Y vector is the cross product of the two established vectors
+  Vector3 yDir = cross_prod(zDir, xDir);
+
+  // Hack to allow testing of whether rotation is applied before axis change.
+  // - The rotations appear to take affect BEFORE the camera mounting (ie they are aircraft rotations)
+  // - Once we are satisfied this is always true, remove the option not to do this.
+  if (opt.camera_mounting > 0) {
+    Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
+                                  xDir[1], yDir[1], zDir[1],
+                                  xDir[2], yDir[2], zDir[2]);
+    Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
+    Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
+    Matrix3x3 M       = rotation_matrix_gcc*M_pitch*M_roll; // Pre-apply rotation.
+    xDir  = Vector3(M(0,0), M(1,0), M(2,0)); // Restore axes
+    yDir  = Vector3(M(0,1), M(1,1), M(2,1));
+    zDir  = Vector3(M(0,2), M(1,2), M(2,2));
+    roll  = 0; // Set to zero so that these rotations are not applied twice
+    pitch = 0;
+  }
+
+  // Account for the camera mounting direction relative to aircraft motion.
+  Vector3 vTemp;
+  switch(abs(opt.camera_mounting)) {
+    case 1: // Left forwards
+      xDir = xDir * -1.0;
+      yDir = yDir * -1.0;
+      break;
+    case 2: // Top forwards
+      vTemp = xDir;
+      xDir = -1.0*yDir;
+      yDir = vTemp;
+      break;
+    case 3: // Bottom forwards
+      vTemp = xDir;
+      xDir = yDir;
+      yDir = -1.0*vTemp;
+      break;
+    default: break; // Right forwards, the default.
+  }
+  
+  // Pack into a rotation matrix
+  Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
+                                xDir[1], yDir[1], zDir[1],
+                                xDir[2], yDir[2], zDir[2]);
+  
+  // TODO: ENU or NED?
+  //Matrix3x3 ned_matrix = datum_wgs84.lonlat_to_ned_matrix(Vector2(llh_interp[0], llh_interp[1]));
+  //Matrix3x3 enu_matrix(ned_matrix(0,1), ned_matrix(0,0), -ned_matrix(0,2),
+  //                     ned_matrix(1,1), ned_matrix(1,0), -ned_matrix(1,2),
+  //                     ned_matrix(2,1), ned_matrix(2,0), -ned_matrix(2,2));
+
+  //Vector3 north(ned_matrix(0,0), ned_matrix(1,0), ned_matrix(2,0));
+  //double angle = acos(dot_prod(xDir, north) / (norm_2(north)*norm_2(xDir)));
+  
+  //std::cout << "Nav, est, diff, cam: " << heading <<", "<< angle << ", "<< fabs(heading)-angle << ", " << camera_file <<  std::endl;
+
+
+  //std::cout << "gcc = " << gcc_interp << std::endl;
+  //std::cout << "xDir = " << xDir << std::endl;
+  //std::cout << "yDir = " << yDir << std::endl;
+  //std::cout << "zDir = " << zDir << std::endl;
+  
+  //std::cout << std::endl << "Estimate based matrix " << std::endl;
+  //print_matrix(rotation_matrix_gcc);
+  
+  // TODO: Clean all this up once we are satisfied with it!
+  
+  Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
+  Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
+
+  //std::cout << "M_roll, M_pitch:\n";
+  //print_matrix(M_roll ); std::cout << std::endl;
+  //print_matrix(M_pitch); std::cout << std::endl;
+  
+  // Without documentation it is very difficult to determine
+  // which of these rotation orders is correct!
+  // - Could be neither since the yaw rotation is already baked in.
+  //Matrix3x3 M1 = M_pitch*M_roll*rotation_matrix_gcc; // <-- off
+  //Matrix3x3 M2 = M_roll*M_pitch*rotation_matrix_gcc; // <-- off
+  Matrix3x3 M3 = rotation_matrix_gcc*M_pitch*M_roll; // <-- Best
+  //Matrix3x3 M4 = rotation_matrix_gcc*M_roll*M_pitch; // <-- Ok
+  
+  //std::cout << "Modified matrices:\n";
+  //print_matrix(M1); std::cout << std::endl;
+  //print_matrix(M2); std::cout << std::endl;
+  //print_matrix(M3); std::cout << std::endl;
+  //print_matrix(M4); std::cout << std::endl;
+
+  //std::string var_path = output_camera_path.string() + "_";
+  //write_output_camera(gcc_interp, rotation_matrix_gcc, opt.input_cam, var_path + "M0.tsai");
+  //write_output_camera(gcc_interp, M1, opt.input_cam, var_path + "M1.tsai");
+  //write_output_camera(gcc_interp, M2, opt.input_cam, var_path + "M2.tsai");
+  //write_output_camera(gcc_interp, M3, opt.input_cam, var_path + "M3.tsai");
+  //write_output_camera(gcc_interp, M4, opt.input_cam, var_path + "batch_06420_06421_2M4.tsai");
+
+  write_output_camera(gcc_interp, M3,
+                      input_cam, output_camera_path);
+
+  //std::cout << std::endl << "NED matrix " << std::endl;
+  //print_matrix(ned_matrix);
+
+  //std::cout << std::endl << "ENU matrix " << std::endl;
+  //std::cout << enu_matrix << std::endl << std::endl;
+  /*
+  double yaw = -3.14159 / 2;
+  Matrix3x3 My90 = get_rotation_matrix_yaw(yaw);
+  
+  for (int p=0; p<0; ++p) {
+    Matrix3x3 rotation_matrix_gcc_2 = get_look_rotation_matrix(heading, pitch, roll, p);
+
+
+    std::cout << std::endl << "Angle based matrix " << p << std::endl;
+    std::cout << ned_matrix * rotation_matrix_gcc_2 << std::endl;
+
+    //std::cout << std::endl << "Angle based matrix 90 1" << p << std::endl;
+    //std::cout << My90*(ned_matrix * rotation_matrix_gcc_2) << std::endl;
+    
+    std::cout << std::endl << "Angle based matrix 90 2 " << p << std::endl;
+    std::cout << (ned_matrix * rotation_matrix_gcc_2)*My90 << std::endl;  
+    
+    
+    std::cout << std::endl << "Angle based matrix ALT" << p << std::endl;
+    std::cout << rotation_matrix_gcc_2*ned_matrix << std::endl;
+    
+    //std::cout << std::endl << "Angle based matrix ALT 90 1" << p << std::endl;
+    //std::cout << My90*(rotation_matrix_gcc_2*ned_matrix) << std::endl;
+    
+    std::cout << std::endl << "Angle based matrix ALT 90 2 " << p << std::endl;
+    std::cout << (rotation_matrix_gcc_2*ned_matrix)*My90 << std::endl;        
+
+    std::cout << "------------\n";
+
+
+    std::cout << std::endl << "Angle based matrix " << p << std::endl;
+    std::cout << enu_matrix * rotation_matrix_gcc_2 << std::endl;
+
+    //std::cout << std::endl << "Angle based matrix 90 1" << p << std::endl;
+    //std::cout << My90*(enu_matrix * rotation_matrix_gcc_2) << std::endl;
+    
+    std::cout << std::endl << "Angle based matrix 90 2" << p << std::endl;
+    std::cout << (enu_matrix * rotation_matrix_gcc_2)*My90 << std::endl;  
+    
+    
+    std::cout << std::endl << "Angle based matrix ALT" << p << std::endl;
+    std::cout << rotation_matrix_gcc_2*enu_matrix << std::endl;
+    
+    //std::cout << std::endl << "Angle based matrix ALT 90 1" << p << std::endl;
+    //std::cout << My90*(rotation_matrix_gcc_2*enu_matrix) << std::endl;
+    
+    std::cout << std::endl << "Angle based matrix ALT 90 2" << p << std::endl;
+    std::cout << (rotation_matrix_gcc_2*enu_matrix)*My90 << std::endl;        
+
+    
+  }
+  std::cout << std::endl << std::endl;
+  */
+  //write_output_camera(gcc_interp, rotation_matrix_gcc,
+  //                    opt.input_cam, output_camera_path.string());
+
+  return true;
+}
+
 // ================================================================================
 
 int main(int argc, char* argv[]) {
@@ -537,15 +930,66 @@ int main(int argc, char* argv[]) {
   
   const boost::filesystem::path output_dir(opt.output_folder);
   
-  // Initialize the nav interpolator
-  std::cout << "Opening input stream: " << opt.nav_file << std::endl;
-  ScrollingNavInterpolator interpLoader(opt.nav_file, datum_wgs84);
+  // The camera intrinsics, shared by all frames
+  PinholeModel input_cam(opt.input_cam);
+
+  // Require this much interpolation time on each side of a frame
+  const double CHUNK_TIME_BOUNDARY = 1.0;
+
+  if (!opt.detect_offset) {
+
+    // Look up the nav data around each frame in the binary index,
+    // which is built only once per nav file.
+    std::string index_path = opt.nav_index;
+    if (index_path.empty())
+      index_path = (output_dir / fs::path(opt.nav_file).filename()).string() + ".navindex";
+    if (!NavIndex::is_up_to_date(index_path, opt.nav_file)) {
+      vw_out() << "Writing nav index: " << index_path << std::endl;
+      NavIndex::build(opt.nav_file, index_path, datum_wgs84);
+    }
+    NavIndex nav_index(index_path);
+    vw_out() << "Loaded nav index with " << nav_index.size() << " records.\n";
+
+    const size_t num_files = opt.image_files.size();
+    for (size_t file_index = 0; file_index < num_files; file_index++) {
 
-  // Load target camera positions if desired
-  std::vector<Vector3> target_locations;
-  std::vector<double > target_times;
-  if (opt.detect_offset) {
+      // Get the next input and output paths
+      std::string             orthoimage_path = opt.image_files [file_index];
+      boost::filesystem::path camera_file(opt.camera_files[file_index]);
+      boost::filesystem::path output_camera_path = output_dir / camera_file;
+
+      // Get time for this frame
+      double ortho_time = gps_seconds(orthoimage_path) - opt.time_offset;
+
+      boost::shared_ptr<NavPosInterpType> pos_interpolator_ptr;
+      boost::shared_ptr<NavRotInterpType> rot_interpolator_ptr;
+      if (!nav_index.get_interpolators(ortho_time - CHUNK_TIME_BOUNDARY,
+                                       ortho_time + CHUNK_TIME_BOUNDARY,
+                                       pos_interpolator_ptr, rot_interpolator_ptr)) {
+        vw_out() << "The nav data does not cover the time of file " << orthoimage_path << std::endl;
+        continue;
+      }
+
+      write_frame_camera(opt, datum_wgs84, input_cam,
+                         *pos_interpolator_ptr, *rot_interpolator_ptr,
+                         ortho_time, orthoimage_path, output_camera_path.string());
+
+      // Update progress
+      if (file_index % PRINT_INTERVAL == 0)
+        vw_out() << file_index << " files processed.\n";
+    } // End loop through ortho files
+
+    vw_out() << "Finished processing the frames.\n";
+  } else {
+
+    // Search the entire nav file for the locations of the given cameras
+    std::cout << "Opening input stream: " << opt.nav_file << std::endl;
+    ScrollingNavInterpolator interpLoader(opt.nav_file, datum_wgs84);
+    
+    // Load target camera positions
     std::cout << "Reading target locations...\n";
+    std::vector<Vector3> target_locations;
+    std::vector<double > target_times;
     const size_t num_targets = opt.camera_files.size();
     target_locations.reserve(num_targets);
     target_times.reserve    (num_targets);
@@ -561,290 +1005,33 @@ int main(int argc, char* argv[]) {
     }
     interpLoader.set_target_locs(target_locations);
     std::cout << "Done loading " << target_locations.size() << " target locations.\n";
-  } // End target loading condition
-
-  boost::shared_ptr<ScrollingNavInterpolator::PosInterpType> pos_interpolator_ptr;
-  boost::shared_ptr<ScrollingNavInterpolator::RotInterpType> rot_interpolator_ptr;
-  double start, end;
-  
-  const double POSE_TIME_DELTA     = 0.1; // Look this far ahead/behind to determine direction
-  const double CHUNK_TIME_BOUNDARY = 1.0; // Require this much interpolation time
-  size_t file_index = 0;
-  const size_t num_files = opt.image_files.size();
-
-  // Keep loading chunks until the nav data catches up with the images
-  double ortho_time=0;
-  while (interpLoader.load_next_chunk(pos_interpolator_ptr, rot_interpolator_ptr)) {
-
-    // Get the time boundaries of the current chunk
-    interpLoader.get_time_boundaries(start, end);  
-
-    //std::cout << "Time range: " << start << " ---- " << end << std::endl;
-
-    // When detecting offsets all we want to do is loop through the nav file.
-    if (opt.detect_offset)
-      continue;
-
-    // Loop through ortho files until we need to advance the nav chunk
-    while (file_index < num_files) {
-
-      // Get the next input and output paths
-      std::string             orthoimage_path = opt.image_files [file_index];
-      boost::filesystem::path camera_file(opt.camera_files[file_index]);
-      boost::filesystem::path output_camera_path = output_dir / camera_file;
-      
-      // Get time for this frame
-      if (ortho_time == 0) {
-        ortho_time = gps_seconds(orthoimage_path) - opt.time_offset;
-        //vw_out() << orthoimage_path << " -> gps_time = " << ortho_time << std::endl;
-      }
-
-      // If this ortho is too far ahead in time, move on to the next nav chunk.
-      if (ortho_time > end - CHUNK_TIME_BOUNDARY)
-        break; // Don't advance file_index
-
-      // If this ortho is too early in time, move on to the next ortho file.
-      if (ortho_time < start + CHUNK_TIME_BOUNDARY) {
-        vw_out() << "Too early to interpolate position for file " << orthoimage_path << std::endl;
-        ++file_index;
-        ortho_time = 0;
-        continue;
-      }
-
-      // Try to interpolate this ortho position
-      Vector3 gcc_interp, rot_interp;
-      try{
-        gcc_interp = pos_interpolator_ptr->operator()(ortho_time);
-        rot_interp = rot_interpolator_ptr->operator()(ortho_time);
-      } catch(...){
-        vw_out() << "Failed to interpolate position for file " << orthoimage_path << std::endl;
-        ++file_index;
-        ortho_time = 0;
-        continue;
-      }
-      Vector3 llh_interp = datum_wgs84.cartesian_to_geodetic(gcc_interp);
-      
-      double roll    = rot_interp[0];
-      double pitch   = rot_interp[1];
-      //double heading = rot_interp[2];
-      //vw_out() << "For file " << orthoimage_path << " computed LLH " << llh_interp << std::endl;
-      //vw_out() << "Roll    = " << roll    <<" = "<< roll*180/3.14159<< std::endl;
-      //vw_out() << "Pitch   = " << pitch   <<" = "<< pitch*180/3.14159<< std::endl;
-      //vw_out() << "Heading = " << heading << std::endl;
-
-      //std::cout << "Ortho time  = " << ortho_time << std::endl;
-      //vw_out() << "llh = " << llh_interp << std::endl;
-      
-      // Now estimate the rotation information
-
-      /*
-        For some reason the heading interpolated from the navigation data is about 30 degrees
-        off from what is expected by looking at the flight path.  The roll and pitch values are
-        consistent with what is stored in the Icebridge-provided ortho files (the heading is not 
-        provided).  What has proven to work the best so far is to estimate the camera pose 
-        including the heading just by using the flight path, and then to apply the pitch and roll
-        to that matrix.  The best order to apply the pitch and roll has been determined by seeing 
-        which one map-projects closest to the lidar data.
-      */
-      
-      // Get a point ahead of and behind the frame location
-      Vector3 gcc_interp_forward  = pos_interpolator_ptr->operator()(ortho_time+POSE_TIME_DELTA);
-      Vector3 gcc_interp_backward = pos_interpolator_ptr->operator()(ortho_time-POSE_TIME_DELTA);
-      
-      if (gcc_interp_forward == gcc_interp_backward) {
-        vw_out() << "Failed to estimate pose for file " << orthoimage_path << std::endl;
-        ++file_index;
-        ortho_time = 0;
-        continue;
-      }
-      
-      // From these points get two flight direction vectors and take the mean.
-      Vector3 dir1 = gcc_interp_forward - gcc_interp;
-      Vector3 dir2 = gcc_interp - gcc_interp_backward;
-      Vector3 xDir = (dir1 + dir2) / 2.0;
-     
-      // The Z vector is straight down from the camera to the ground.
-      Vector3 llh_ground = llh_interp;
-      llh_ground[2] = 0;
-      Vector3 gcc_ground = datum_wgs84.geodetic_to_cartesian(llh_ground);
-      Vector3 zDir = gcc_ground - gcc_interp;
-      
-      // Normalize the vectors
-      xDir = xDir / norm_2(xDir);
-      zDir = zDir / norm_2(zDir);
-      
-      // The Y vector is the cross product of the two established vectors
-      Vector3 yDir = cross_prod(zDir, xDir);
-
-      // Hack to allow testing of whether rotation is applied before axis change.
-      // - The rotations appear to take affect BEFORE the camera mounting (ie they are aircraft rotations)
-      // - Once we are satisfied this is always true, remove the option not to do this.
-      if (opt.camera_mounting > 0) {
-        Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
-                                      xDir[1], yDir[1], zDir[1],
-                                      xDir[2], yDir[2], zDir[2]);
-        Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
-        Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
-        Matrix3x3 M       = rotation_matrix_gcc*M_pitch*M_roll; // Pre-apply rotation.
-        xDir  = Vector3(M(0,0), M(1,0), M(2,0)); // Restore axes
-        yDir  = Vector3(M(0,1), M(1,1), M(2,1));
-        zDir  = Vector3(M(0,2), M(1,2), M(2,2));
-        roll  = 0; // Set to zero so that these rotations are not applied twice
-        pitch = 0;
-      }
-
-      // Account for the camera mounting direction relative to aircraft motion.
-      Vector3 vTemp;
-      switch(abs(opt.camera_mounting)) {
-        case 1: // Left forwards
-          xDir = xDir * -1.0;
-          yDir = yDir * -1.0;
-          break;
-        case 2: // Top forwards
-          vTemp = xDir;
-          xDir = -1.0*yDir;
-          yDir = vTemp;
-          break;
-        case 3: // Bottom forwards
-          vTemp = xDir;
-          xDir = yDir;
-          yDir = -1.0*vTemp;
-          break;
-        default: break; // Right forwards, the default.
-      }
-      
-      // Pack into a rotation matrix
-      Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
-                                    xDir[1], yDir[1], zDir[1],
-                                    xDir[2], yDir[2], zDir[2]);
-      
-      // TODO: ENU or NED?
-      //Matrix3x3 ned_matrix = datum_wgs84.lonlat_to_ned_matrix(Vector2(llh_interp[0], llh_interp[1]));
-      //Matrix3x3 enu_matrix(ned_matrix(0,1), ned_matrix(0,0), -ned_matrix(0,2),
-      //                     ned_matrix(1,1), ned_matrix(1,0), -ned_matrix(1,2),
-      //                     ned_matrix(2,1), ned_matrix(2,0), -ned_matrix(2,2));
-
-      //Vector3 north(ned_matrix(0,0), ned_matrix(1,0), ned_matrix(2,0));
-      //double angle = acos(dot_prod(xDir, north) / (norm_2(north)*norm_2(xDir)));
-      
-      //std::cout << "Nav, est, diff, cam: " << heading <<", "<< angle << ", "<< fabs(heading)-angle << ", " << camera_file <<  std::endl;
 
+    boost::shared_ptr<NavPosInterpType> pos_interpolator_ptr;
+    boost::shared_ptr<NavRotInterpType> rot_interpolator_ptr;
+    while (interpLoader.load_next_chunk(pos_interpolator_ptr, rot_interpolator_ptr)) {}
 
-      //std::cout << "gcc = " << gcc_interp << std::endl;
-      //std::cout << "xDir = " << xDir << std::endl;
-      //std::cout << "yDir = " << yDir << std::endl;
-      //std::cout << "zDir = " << zDir << std::endl;
-      
-      //std::cout << std::endl << "Estimate based matrix " << std::endl;
-      //print_matrix(rotation_matrix_gcc);
-      
-      // TODO: Clean all this up once we are satisfied with it!
-      
-      Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
-      Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
+    vw_out() << "Finished looping through the nav file.\n";
 
-      //std::cout << "M_roll, M_pitch:\n";
-      //print_matrix(M_roll ); std::cout << std::endl;
-      //print_matrix(M_pitch); std::cout << std::endl;
-      
-      // Without documentation it is very difficult to determine
-      // which of these rotation orders is correct!
-      // - Could be neither since the yaw rotation is already baked in.
-      //Matrix3x3 M1 = M_pitch*M_roll*rotation_matrix_gcc; // <-- off
-      //Matrix3x3 M2 = M_roll*M_pitch*rotation_matrix_gcc; // <-- off
-      Matrix3x3 M3 = rotation_matrix_gcc*M_pitch*M_roll; // <-- Best
-      //Matrix3x3 M4 = rotation_matrix_gcc*M_roll*M_pitch; // <-- Ok
-      
-      //std::cout << "Modified matrices:\n";
-      //print_matrix(M1); std::cout << std::endl;
-      //print_matrix(M2); std::cout << std::endl;
-      //print_matrix(M3); std::cout << std::endl;
-      //print_matrix(M4); std::cout << std::endl;
-
-      //std::string var_path = output_camera_path.string() + "_";
-      //write_output_camera(gcc_interp, rotation_matrix_gcc, opt.input_cam, var_path + "M0.tsai");
-      //write_output_camera(gcc_interp, M1, opt.input_cam, var_path + "M1.tsai");
-      //write_output_camera(gcc_interp, M2, opt.input_cam, var_path + "M2.tsai");
-      //write_output_camera(gcc_interp, M3, opt.input_cam, var_path + "M3.tsai");
-      //write_output_camera(gcc_interp, M4, opt.input_cam, var_path + "batch_06420_06421_2M4.tsai");
-
-      write_output_camera(gcc_interp, M3,
-                          opt.input_cam, output_camera_path.string());
-
-      //std::cout << std::endl << "NED matrix " << std::endl;
-      //print_matrix(ned_matrix);
-
-      //std::cout << std::endl << "ENU matrix " << std::endl;
-      //std::cout << enu_matrix << std::endl << std::endl;
-      /*
-      double yaw = -3.14159 / 2;
-      Matrix3x3 My90 = get_rotation_matrix_yaw(yaw);
-      
-      for (int p=0; p<0; ++p) {
-        Matrix3x3 rotation_matrix_gcc_2 = get_look_rotation_matrix(heading, pitch, roll, p);
-
-
-        std::cout << std::endl << "Angle based matrix " << p << std::endl;
-        std::cout << ned_matrix * rotation_matrix_gcc_2 << std::endl;
-
-        //std::cout << std::endl << "Angle based matrix 90 1" << p << std::endl;
-        //std::cout << My90*(ned_matrix * rotation_matrix_gcc_2) << std::endl;
-        
-        std::cout << std::endl << "Angle based matrix 90 2 " << p << std::endl;
-        std::cout << (ned_matrix * rotation_matrix_gcc_2)*My90 << std::endl;  
-        
-        
-        std::cout << std::endl << "Angle based matrix ALT" << p << std::endl;
-        std::cout << rotation_matrix_gcc_2*ned_matrix << std::endl;
-        
-        //std::cout << std::endl << "Angle based matrix ALT 90 1" << p << std::endl;
-        //std::cout << My90*(rotation_matrix_gcc_2*ned_matrix) << std::endl;
-        
-        std::cout << std::endl << "Angle based matrix ALT 90 2 " << p << std::endl;
-        std::cout << (rotation_matrix_gcc_2*ned_matrix)*My90 << std::endl;        
-
-        std::cout << "------------\n";
-
-
-        std::cout << std::endl << "Angle based matrix " << p << std::endl;
-        std::cout << enu_matrix * rotation_matrix_gcc_2 << std::endl;
-
-        //std::cout << std::endl << "Angle based matrix 90 1" << p << std::endl;
-        //std::cout << My90*(enu_matrix * rotation_matrix_gcc_2) << std::endl;
-        
-        std::cout << std::endl << "Angle based matrix 90 2" << p << std::endl;
-        std::cout << (enu_matrix * rotation_matrix_gcc_2)*My90 << std::endl;  
-        
-        
-        std::cout << std::endl << "Angle based matrix ALT" << p << std::endl;
-        std::cout << rotation_matrix_gcc_2*enu_matrix << std::endl;
-        
-        //std::cout << std::endl << "Angle based matrix ALT 90 1" << p << std::endl;
-        //std::cout << My90*(rotation_matrix_gcc_2*enu_matrix) << std::endl;
-        
-        std::cout << std::endl << "Angle based matrix ALT 90 2" << p << std::endl;
-        std::cout << (rotation_matrix_gcc_2*enu_matrix)*My90 << std::endl;        
-
-        
-      }
-      std::cout << std::endl << std::endl;
-      */
-      //write_output_camera(gcc_interp, rotation_matrix_gcc,
-      //                    opt.input_cam, output_camera_path.string());
-
-
-      // Update progress
-      if (file_index % PRINT_INTERVAL == 0)
-        vw_out() << file_index << " files processed.\n";
-
-      ++file_index;
-      ortho_time = 0;
+    std::cout << "Getting target results...\n";
+    // Compute the mean difference between the target camera time and the matched time
+    //  and print the results.
+    std::vector<double> matched_times, best_distances;
+    interpLoader.get_target_times(matched_times, best_distances);
+    const size_t num_found = target_times.size();
+    double mean_offset = 0, mean_dist = 0;
+    for (size_t i=0; i<num_found; ++i) {
+      double diff = matched_times[i] - target_times[i];
+      mean_offset += diff;
+      mean_dist   += best_distances[i];
+      std::cout << "Offset: " << diff << ", dist = " << best_distances[i]
+                << ", time = " << matched_times[i] << std::endl;
+    }
+    mean_offset /= static_cast<double>(num_found);
+    mean_dist   /= static_cast<double>(num_found);
+    std::cout << "Computed mean nav time offset: " << mean_offset << std::endl;
+    std::cout << "Computed mean nav distance   : " << mean_dist   << std::endl;
+  }
 
-    } // End loop through ortho files
-    
-  } // End loop through nav batches
-  
-  vw_out() << "Finished looping through the nav file.\n";
 /*
     
         // TODO: The camera position needs to be interpolated from the several nearest lines!
@@ -893,27 +1080,6 @@ int main(int argc, char* argv[]) {
   
   */
   
-  if (opt.detect_offset) {
-    std::cout << "Getting target results...\n";
-    // Compute the mean difference between the target camera time and the matched time
-    //  and print the results.
-    std::vector<double> matched_times, best_distances;
-    interpLoader.get_target_times(matched_times, best_distances);
-    const size_t num_targets = target_times.size();
-    double mean_offset = 0, mean_dist = 0;
-    for (size_t i=0; i<num_targets; ++i) {
-      double diff = matched_times[i] - target_times[i];
-      mean_offset += diff;
-      mean_dist   += best_distances[i];
-      std::cout << "Offset: " << diff << ", dist = " << best_distances[i]
-                << ", time = " << matched_times[i] << std::endl;
-    }
-    mean_offset /= static_cast<double>(num_targets);
-    mean_dist   /= static_cast<double>(num_targets);
-    std::cout << "Computed mean nav time offset: " << mean_offset << std::endl;
-    std::cout << "Computed mean nav distance   : " << mean_dist   << std::endl;
-  }
-  
   return 0;
     
   //} ASP_STANDARD_CATCHES;
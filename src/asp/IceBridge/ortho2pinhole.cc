@@ -25,6 +25,10 @@
 // opt.reference_dem, we assume for now that the image is mapprojected
 // onto the datum. Save on output a gcp file, that may be used to further
 // refine the camera using bundle_adjust.
+//
+// With --frame-list, many frames are processed in one process, in
+// parallel, sharing the reference DEM and the input camera models,
+// rather than loading them anew for each frame.
 #include <asp/Core/Macros.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Sessions/StereoSessionFactory.h>
@@ -33,7 +37,14 @@
 #include <asp/Core/InterestPointMatching.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Cartography/GeoTransform.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
 #include <boost/core/null_deleter.hpp>
+#include <boost/noncopyable.hpp>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <sstream>
 
 
 // Turn off warnings from eigen
@@ -70,16 +81,90 @@ typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
 
 
 struct Options : public vw::cartography::GdalWriteOptions {
-  std::string raw_image, ortho_image, input_cam, output_cam, reference_dem, camera_estimate;
+  std::string raw_image, ortho_image, input_cam, output_cam, reference_dem, camera_estimate,
+    frame_list;
   double camera_height, orthoimage_height, ip_inlier_factor, max_translation;
-  int    ip_per_tile, ip_detect_method, min_ip;
+  int    ip_per_tile, ip_detect_method, min_ip, num_parallel_frames;
   bool   individually_normalize, keep_match_file, write_gcp_file, skip_image_normalization, 
     show_error, short_circuit, crop_reference_dem;
 
   // Make sure all values are initialized, even though they will be
   // over-written later.
   Options(): camera_height(-1), orthoimage_height(0), ip_per_tile(0),
-             ip_detect_method(0), individually_normalize(false), keep_match_file(false){}
+             ip_detect_method(0), num_parallel_frames(1),
+             individually_normalize(false), keep_match_file(false){}
+};
+
+/// The inputs which are the same for all frames, loaded only once, and
+/// then shared by the threads processing the frames.
+class SharedInputs: private boost::noncopyable {
+public:
+  bool                          has_ref_dem;
+  float                         dem_nodata;
+  vw::cartography::GeoReference dem_georef;
+  ImageViewRef<float>           dem; // The full reference DEM, read from disk as needed
+
+  SharedInputs(): has_ref_dem(false), dem_nodata(-std::numeric_limits<float>::max()){}
+
+  /// Open the reference DEM and read its georeference and nodata value.
+  void load_reference_dem(std::string const& dem_file) {
+    bool is_good = vw::cartography::read_georeference(dem_georef, dem_file);
+    if (!is_good) {
+      vw_throw(ArgumentErr() << "Error: Cannot read georeference from: "
+                             << dem_file << ".\n");
+    }
+    {
+      // Read the no-data
+      DiskImageResourceGDAL rsrc(dem_file);
+      if (rsrc.has_nodata_read()) dem_nodata = rsrc.nodata_read();
+    }
+    dem = DiskImageView<float>(dem_file);
+    has_ref_dem = true;
+  }
+
+  /// The pinhole model in the given file, parsed only the first time
+  /// it is asked for. Returns an empty pointer if the file cannot be
+  /// read as a pinhole model.
+  boost::shared_ptr<PinholeModel> camera_template(std::string const& camera_file) {
+    vw::Mutex::Lock lock(m_camera_mutex);
+    std::map<std::string, boost::shared_ptr<PinholeModel> >::iterator it
+      = m_cameras.find(camera_file);
+    if (it != m_cameras.end())
+      return it->second;
+
+    boost::shared_ptr<PinholeModel> cam;
+    try {
+      cam.reset(new PinholeModel(camera_file));
+    } catch(...) {} // Let the stereo session figure out the format
+    m_cameras[camera_file] = cam;
+    return cam;
+  }
+
+private:
+  std::map<std::string, boost::shared_ptr<PinholeModel> > m_cameras;
+  vw::Mutex m_camera_mutex;
+};
+
+// Guards the changes to the global stereo settings when frames are
+// processed in parallel.
+vw::Mutex g_settings_mutex;
+
+/// Set the epipolar threshold in the global stereo settings, if
+/// positive, for the lifetime of this object, and restore the old
+/// value after. The settings are locked meanwhile, so that a frame
+/// processed in parallel neither sees nor keeps the value of another.
+class ScopedEpipolarThreshold: private boost::noncopyable {
+  vw::Mutex::Lock m_lock;
+  double          m_old_threshold;
+public:
+  ScopedEpipolarThreshold(double threshold): m_lock(g_settings_mutex),
+    m_old_threshold(asp::stereo_settings().epipolar_threshold) {
+    if (threshold > 0)
+      asp::stereo_settings().epipolar_threshold = threshold;
+  }
+  ~ScopedEpipolarThreshold() {
+    asp::stereo_settings().epipolar_threshold = m_old_threshold;
+  }
 };
 
 /// Record a set of IP results as ground control points
@@ -279,27 +364,17 @@ int solve_for_cam_adjust(boost::shared_ptr<PinholeModel> camera_model,
 
 
    
-/// Load the DEM and adjust some options depending on DEM statistics.
-void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const& rsrc_ortho,
+/// Set up the shared reference DEM for this frame and adjust some
+/// options depending on DEM statistics.
+void load_reference_dem(Options &opt, SharedInputs const& shared,
+                        boost::shared_ptr<DiskImageResource> const& rsrc_ortho,
                         vw::cartography::GeoReference const& ortho_georef,
                         ImageViewRef< PixelMask<float> > &dem,
                         vw::cartography::GeoReference &dem_georef,
                         bool &elevation_change_present) {
 
-  // Set up the DEM if it was provided.
-  float dem_nodata = -std::numeric_limits<float>::max();
-
-  bool is_good = vw::cartography::read_georeference(dem_georef, opt.reference_dem);
-  if (!is_good) {
-    vw_throw(ArgumentErr() << "Error: Cannot read georeference from: "
-                           << opt.reference_dem << ".\n");
-  }
-
-  {
-    // Read the no-data
-    DiskImageResourceGDAL rsrc(opt.reference_dem);
-    if (rsrc.has_nodata_read()) dem_nodata = rsrc.nodata_read();
-  }
+  float dem_nodata = shared.dem_nodata;
+  dem_georef = shared.dem_georef;
 
 
   bool crop_is_success = false;
@@ -310,8 +385,7 @@ void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const
     DiskImageView<float> tmp_ortho(rsrc_ortho);
     BBox2 ortho_bbox = bounding_box(tmp_ortho);
 
-    DiskImageView<float> tmp_dem(opt.reference_dem);
-    BBox2 dem_bbox = bounding_box(tmp_dem);
+    BBox2 dem_bbox = bounding_box(shared.dem);
     
     // The GeoTransform will hide the messy details of conversions
     vw::cartography::GeoTransform geotrans(dem_georef, ortho_georef, dem_bbox, ortho_bbox);
@@ -331,7 +405,7 @@ void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const
       crop_box.crop(dem_bbox);
       
       if (!crop_box.empty()) {
-        ImageView<float> cropped_dem = crop(DiskImageView<float>(opt.reference_dem), crop_box);
+        ImageView<float> cropped_dem = crop(shared.dem, crop_box);
         dem = create_mask(cropped_dem, dem_nodata);
         dem_georef = crop(dem_georef, crop_box);
         crop_is_success = true;
@@ -343,7 +417,7 @@ void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const
   
   // Default behavior  
   if (!crop_is_success)
-    dem = create_mask(DiskImageView<float>(opt.reference_dem), dem_nodata);
+    dem = create_mask(shared.dem, dem_nodata);
 
   
   // Get an estimate of the elevation range in the input image
@@ -398,7 +472,7 @@ void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const
   
 } // End load_reference_dem
 
-void load_camera_and_find_ip(Options const& opt, 
+void load_camera_and_find_ip(Options const& opt, SharedInputs & shared,
                              boost::shared_ptr<DiskImageResource> const& rsrc_raw,
                              boost::shared_ptr<DiskImageResource> const& rsrc_ortho,
                              std::string const& match_filename,
@@ -413,7 +487,12 @@ void load_camera_and_find_ip(Options const& opt,
                                                        out_prefix));
   session->get_nodata_values(rsrc_raw, rsrc_ortho, nodata1, nodata2);
   
-  cam = session->camera_model(opt.raw_image, opt.input_cam);
+  // Copy the input camera rather than parsing it again for each frame
+  boost::shared_ptr<PinholeModel> cam_template = shared.camera_template(opt.input_cam);
+  if (cam_template)
+    cam.reset(new PinholeModel(*cam_template));
+  else
+    cam = session->camera_model(opt.raw_image, opt.input_cam);
   
   // Skip IP finding if the match file exists since the code will re-use it anyways.
   if (boost::filesystem::exists(match_filename)) {
@@ -636,7 +715,7 @@ double refine_camera_with_dem_pts(Options const& opt,
 
 
 // Primary task-solving function.
-void ortho2pinhole(Options & opt){
+void ortho2pinhole(Options & opt, SharedInputs & shared){
 
   // Input image handles
   boost::shared_ptr<DiskImageResource>
@@ -656,29 +735,32 @@ void ortho2pinhole(Options & opt){
   // Set up the DEM if it was provided.
   ImageViewRef< PixelMask<float> > dem;
   vw::cartography::GeoReference dem_georef;
-  bool has_ref_dem = (opt.reference_dem != "");
+  bool has_ref_dem = shared.has_ref_dem;
   bool elevation_change_present = false;
   if (has_ref_dem) {
-    load_reference_dem(opt, rsrc_ortho, ortho_georef, dem, dem_georef, elevation_change_present);
+    load_reference_dem(opt, shared, rsrc_ortho, ortho_georef, dem, dem_georef,
+                       elevation_change_present);
   }
   
 
   // When significant elevation change is present, the homography IP filter is not
   //  accurate and we need to compensate by relaxing our inlier threshold.
   const double ELEVATION_INLIER_SCALE = 10;
+  double epipolar_threshold = -1; // Use the global setting
   if (elevation_change_present) {
     // TODO: Decouple threshold from other params!
-    asp::stereo_settings().epipolar_threshold = 150*asp::stereo_settings().ip_inlier_factor * ELEVATION_INLIER_SCALE;
-    //asp::stereo_settings().ip_inlier_factor *= ELEVATION_INLIER_SCALE;
-    
-    vw_out() << "Due to elevation change, increasing ip_inlier_factor to " 
-             << asp::stereo_settings().ip_inlier_factor << std::endl;
+    epipolar_threshold = 150*opt.ip_inlier_factor * ELEVATION_INLIER_SCALE;
+    vw_out() << "Due to elevation change, increasing the epipolar threshold to "
+             << epipolar_threshold << std::endl;
   }
 
   // Load camera and find IP
   std::string match_filename = opt.output_cam + ".match";
   boost::shared_ptr<CameraModel> cam;
-  load_camera_and_find_ip(opt, rsrc_raw, rsrc_ortho, match_filename, cam);
+  {
+    ScopedEpipolarThreshold threshold_guard(epipolar_threshold);
+    load_camera_and_find_ip(opt, shared, rsrc_raw, rsrc_ortho, match_filename, cam);
+  }
 
   // The ortho image file must have the height of the camera above the ground.
   // This can be over-written from the command line.
@@ -907,6 +989,24 @@ std::string handle_rgb_input(std::string const& input_path, Options const& opt)
 
 }
 
+/// Check the inputs of a frame and create its output directory.
+void check_frame(Options const& opt) {
+
+  if (opt.camera_estimate != "") {
+    if (!boost::filesystem::exists(opt.camera_estimate)) {
+      vw_throw( ArgumentErr() << "Estimated camera file " << opt.camera_estimate << " does not exist!\n");
+    }    
+  }
+
+  if (opt.short_circuit && opt.camera_estimate == "")
+    vw_throw( ArgumentErr() << "Estimated camera file is required with the short-circuit option.\n");
+
+  // Create the output directory
+  vw::create_out_dir(opt.output_cam);
+}
+
+void process_frame(Options opt, SharedInputs & shared);
+
 void handle_arguments( int argc, char *argv[], Options& opt ) {
   po::options_description general_options("");
   general_options.add_options()
@@ -941,7 +1041,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("reference-dem",             po::value(&opt.reference_dem)->default_value(""),
      "If provided, extract from this DEM the heights above the ground rather than assuming the value in --orthoimage-height.")
     ("crop-reference-dem", po::bool_switch(&opt.crop_reference_dem)->default_value(false)->implicit_value(true),
-     "Crop the reference DEM to a generous area to make it faster to load.");
+     "Crop the reference DEM to a generous area to make it faster to load.")
+    ("frame-list",             po::value(&opt.frame_list)->default_value(""),
+     "Process all frames in this file, having on each line a raw image, ortho image, input camera, output camera, and optionally an estimated camera, rather than the frame on the command line.")
+    ("num-parallel-frames",    po::value(&opt.num_parallel_frames)->default_value(1),
+     "With --frame-list, how many frames to process at the same time.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
   
@@ -958,7 +1062,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   positional_desc.add("input-cam",  1);
   positional_desc.add("output-cam", 1);
 
-  std::string usage("<raw image> <ortho image> <input pinhole cam> <output pinhole cam> [options]");
+  std::string usage("<raw image> <ortho image> <input pinhole cam> <output pinhole cam> [options]\n"
+                    "  or: --frame-list <frame list> [options]");
   bool allow_unregistered = false;
   std::vector<std::string> unregistered;
   po::variables_map vm =
@@ -971,7 +1076,15 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   asp::stereo_settings().individually_normalize   = opt.individually_normalize;
   asp::stereo_settings().skip_image_normalization = opt.skip_image_normalization;
   asp::stereo_settings().ip_inlier_factor         = opt.ip_inlier_factor;
-  
+
+  if ( !opt.frame_list.empty() ) {
+    // The frames are checked as the list is read
+    if (opt.num_parallel_frames < 1)
+      vw_throw( ArgumentErr() << "The number of parallel frames must be positive.\n");
+    asp::log_to_file(argc, argv, "", opt.frame_list);
+    return;
+  }
+
   if ( opt.raw_image.empty() )
     vw_throw( ArgumentErr() << "Missing input raw image.\n" << usage << general_options );
 
@@ -984,37 +1097,75 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if ( opt.output_cam.empty() )
     vw_throw( ArgumentErr() << "Missing output pinhole camera.\n" << usage << general_options );
 
-  if (opt.camera_estimate != "") {
-    if (!boost::filesystem::exists(opt.camera_estimate)) {
-      vw_throw( ArgumentErr() << "Estimated camera file " << opt.camera_estimate << " does not exist!\n");
-    }    
-  }
-
-  if (opt.short_circuit && opt.camera_estimate == "")
-    vw_throw( ArgumentErr() << "Estimated camera file is required with the short-circuit option.\n");
-
-  // Create the output directory
-  vw::create_out_dir(opt.output_cam);
+  check_frame(opt);
 
   // Turn on logging to file
   asp::log_to_file(argc, argv, "", opt.output_cam);
   
 }
 
-// ================================================================================
+/// Read the frames to process. Each gets a copy of the options, with
+/// its own images and cameras.
+void read_frame_list(Options const& opt, std::vector<Options> & frames) {
+
+  frames.clear();
+  std::ifstream ifs(opt.frame_list.c_str());
+  if (!ifs)
+    vw_throw( ArgumentErr() << "Cannot open frame list: " << opt.frame_list << ".\n");
+
+  std::string line;
+  while (getline(ifs, line)) {
+    boost::trim(line);
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    Options frame = opt;
+    frame.camera_estimate = "";
+    std::istringstream is(line);
+    if (!(is >> frame.raw_image >> frame.ortho_image >> frame.input_cam >> frame.output_cam))
+      vw_throw( ArgumentErr() << "Expecting a raw image, ortho image, input camera, and "
+                              << "output camera on line: " << line << "\n");
+    is >> frame.camera_estimate; // Optional
+
+    check_frame(frame);
+    frames.push_back(frame);
+  }
+}
 
-int main(int argc, char* argv[]) {
+/// Process the frames of the list, a few at a time. A frame which
+/// fails does not stop the others.
+class FrameTask: public vw::Task, private boost::noncopyable {
+  Options        m_opt;
+  SharedInputs & m_shared;
+  bool         & m_success;
+public:
+  FrameTask(Options const& opt, SharedInputs & shared, bool & success):
+    m_opt(opt), m_shared(shared), m_success(success) {}
+
+  void operator()() {
+    try {
+      process_frame(m_opt, m_shared);
+      m_success = true;
+    } catch (std::exception const& e) {
+      vw_out() << "Failed to process frame " << m_opt.raw_image << ": " << e.what() << "\n";
+      m_success = false;
+    }
+  }
+};
+
+/// Process one frame, either copying the camera estimate, or solving
+/// for the camera using the ortho image.
+void process_frame(Options opt, SharedInputs & shared) {
 
-  Options opt;
-  //try {
-  handle_arguments( argc, argv, opt );
-   
   if (opt.short_circuit) {
     vw_out() << "Creating camera without using ortho image.\n";
   
     // Load input camera files
     vw_out() << "Loading: " << opt.input_cam << std::endl;
-    PinholeModel input_cam(opt.input_cam);
+    boost::shared_ptr<PinholeModel> cam_template = shared.camera_template(opt.input_cam);
+    if (!cam_template)
+      vw_throw( ArgumentErr() << "Cannot read pinhole camera: " << opt.input_cam << ".\n");
+    PinholeModel input_cam(*cam_template);
     vw_out() << "Loading: " << opt.camera_estimate << std::endl;
     PinholeModel est_cam(opt.camera_estimate);
     
@@ -1025,13 +1176,51 @@ int main(int argc, char* argv[]) {
     // Write to output camera
     vw_out() << "Writing: " << opt.output_cam << std::endl;
     input_cam.write(opt.output_cam);
-    return 0;
+    return;
   }
   
   opt.raw_image   = handle_rgb_input(opt.raw_image,   opt);
   opt.ortho_image = handle_rgb_input(opt.ortho_image, opt);
   
-  ortho2pinhole(opt);
-  return 0;
+  ortho2pinhole(opt, shared);
+}
+
+// ================================================================================
+
+int main(int argc, char* argv[]) {
+
+  Options opt;
+  //try {
+  handle_arguments( argc, argv, opt );
+
+  SharedInputs shared;
+  if (opt.reference_dem != "")
+    shared.load_reference_dem(opt.reference_dem);
+
+  if (opt.frame_list.empty()) {
+    process_frame(opt, shared);
+    return 0;
+  }
+
+  std::vector<Options> frames;
+  read_frame_list(opt, frames);
+  vw_out() << "Processing " << frames.size() << " frames from " << opt.frame_list
+           << ", " << opt.num_parallel_frames << " at a time.\n";
+
+  // Not a vector<bool>, as each task needs a reference to its flag
+  std::deque<bool> success(frames.size(), false);
+  {
+    vw::FifoWorkQueue queue(opt.num_parallel_frames);
+    for (size_t it = 0; it < frames.size(); it++) {
+      boost::shared_ptr<vw::Task> task(new FrameTask(frames[it], shared, success[it]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
+  int num_failed = std::count(success.begin(), success.end(), false);
+  vw_out() << "Processed " << frames.size() - num_failed << " out of "
+           << frames.size() << " frames.\n";
+  return (num_failed == 0) ? 0 : 1;
   //} ASP_STANDARD_CATCHES;
 }
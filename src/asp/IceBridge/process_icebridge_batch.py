@@ -35,7 +35,7 @@ sys.path.insert(0, icebridgepath)
 sys.path.insert(0, libexecpath)
 sys.path.insert(0, toolspath)
 
-import icebridge_common
+import icebridge_common, dag_command_runner
 import asp_system_utils, asp_alg_utils, asp_geo_utils, asp_image_utils, asp_file_utils
 asp_system_utils.verify_python_version_is_supported()
 
@@ -864,6 +864,15 @@ def createDem(i, options, inputPairs, prefixes, demFiles, projString,
               suppressOutput, redo, logger=None):
     '''Create a DEM from a pair of images'''
 
+    runStereo(i, options, inputPairs, prefixes, heightLimitString, threadText,
+              matchFilePair, suppressOutput, redo, logger)
+    cloudToDem(i, options, prefixes, demFiles, projString, threadText,
+               suppressOutput, redo, logger)
+
+def runStereo(i, options, inputPairs, prefixes, heightLimitString, threadText,
+              matchFilePair, suppressOutput, redo, logger=None):
+    '''Create the point cloud of a pair of images, the first step of createDem.'''
+
     # Since we use epipolar alignment our images should be aligned at least this well.
     VERTICAL_SEARCH_LIMIT = 10
     TIMEOUT = 40*60 # Do not let any process take more than this time in seconds
@@ -965,7 +974,15 @@ def createDem(i, options, inputPairs, prefixes, demFiles, projString,
         icebridge_common.logger_print(logger, "Writing: " + filePath)
         with open(filePath, 'w') as f:
             f.write( ("%d, %f, %s\n") % (corrSearchWidth, memUsage, elapsed) )
-        
+
+def cloudToDem(i, options, prefixes, demFiles, projString, threadText,
+               suppressOutput, redo, logger=None):
+    '''Create and check the DEMs from the point cloud of a pair of images,
+       the second step of createDem.'''
+
+    thisPairPrefix = prefixes[i]
+    triOutput      = thisPairPrefix + '-PC.tif'
+
     # point2dem on the result of ASP
     # - The size limit is to prevent bad point clouds from creating giant DEM files which
     #   cause the processing node to crash.
@@ -985,7 +1002,10 @@ def createDem(i, options, inputPairs, prefixes, demFiles, projString,
     # - This calculation currently does not work well but anything under this is probably bad.
     # TODO: This validity fraction is NOT ACCURATE and needs to be improved!
     MIN_FRACTION_VALID_PIXELS = 0.10 
+    # The pairs after the first one keep their own file, as they can run at the same time.
     percentageFlagFile = os.path.join(options.outputFolder, 'valid_pixel_fraction.txt')
+    if i > 0:
+        percentageFlagFile = thisPairPrefix + '-valid_pixel_fraction.txt'
     fractionValid = 1.0;
 
     # Try to parse the output text for the percentage or read it from disk if we already logged it.
@@ -1158,6 +1178,13 @@ def main(argsIn):
         parser.add_option('--num-threads', dest='numThreads', default=None,
                           type='int', help='The number of threads to use for processing.')
 
+        parser.add_option('--num-parallel-stereo', dest='numParallelStereo', default=1,
+                          type='int', help='How many stereo pairs of the batch to run at the same time.')
+
+        parser.add_option('--num-parallel-point2dem', dest='numParallelPoint2dem', default=1,
+                          type='int', help='How many point2dem steps of the batch to run at the ' +
+                          'same time. They can overlap with stereo on other pairs.')
+
         (options, args) = parser.parse_args(argsIn)
 
         # Check argument count
@@ -1415,11 +1442,23 @@ def doWork(options, args, logger):
             asp_system_utils.executeCommand(cmd, csvPath, suppressOutput, redo)
             fireLidarDiffCsvPaths.append(csvPath)
         
-    # Process the batch serially (but we will start multiple such batches in parallel).
+    # Process the pairs of the batch (but we will start multiple such batches in parallel).
+    # The point2dem stage of a pair can overlap with the stereo stage of the next one.
+    runner = dag_command_runner.DagRunner({'stereo':    options.numParallelStereo,
+                                           'point2dem': options.numParallelPoint2dem},
+                                          1, logger)
     for i in range(0, numStereoRuns):
-        createDem(i, options, origInputPairs, prefixes, demFiles,
-                  projString, heightLimitString, threadText,
-                  baMatchFiles[i], suppressOutput, redo, logger)
+        runner.add('stereo_' + str(i), 'stereo', runStereo,
+                   (i, options, origInputPairs, prefixes, heightLimitString, threadText,
+                    baMatchFiles[i], suppressOutput, redo, logger))
+        runner.add('point2dem_' + str(i), 'point2dem', cloudToDem,
+                   (i, options, prefixes, demFiles, projString, threadText,
+                    suppressOutput, redo, logger), ['stereo_' + str(i)])
+    failed = runner.run()
+    for i in range(0, numStereoRuns): # Fail on the first pair which failed, as before
+        for name in ['stereo_' + str(i), 'point2dem_' + str(i)]:
+            if name in failed:
+                raise failed[name]
         
     # If we had to create at least one DEM, need to redo all the post-DEM creation steps
     if atLeastOneDemMissing:
@@ -1548,7 +1587,10 @@ def doWork(options, args, logger):
                                 threadText, heightLimitString, logger)
                                 
     # Consolidate statistics into a one line summary file
+    # The pairs after the first one keep their own file, as they can run at the same time.
     percentageFlagFile = os.path.join(options.outputFolder, 'valid_pixel_fraction.txt')
+    if i > 0:
+        percentageFlagFile = thisPairPrefix + '-valid_pixel_fraction.txt'
     consolidateStats(lidarDiffPath, interDiffSummaryPath, 
                      fireballDiffSummaryPath, fireLidarDiffSummaryPath,  
                      allDemPath, consolidatedStatsPath, percentageFlagFile, logger)
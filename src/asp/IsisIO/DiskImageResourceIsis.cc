@@ -32,9 +32,11 @@
 #include <asp/IsisIO/DiskImageResourceIsis.h>
 
 #include <string>
+#include <algorithm>
 
 #include <Cube.h>
 #include <Portal.h>
+#include <Pvl.h>
 #include <SpecialPixel.h>
 
 using namespace std;
@@ -43,13 +45,20 @@ using namespace boost;
 namespace vw {
 
 
-  // We use a fixed tile size of 2048x2048 pixels here.  Although this
-  // may not be the native tile size of the ISIS cube, it seems to be
-  // much faster to let the ISIS driver aggregate smaller blocks by
-  // making a larger request rather than caching those blocks ourselves.
+  // We read blocks of about 2048x2048 pixels, as it is much faster to
+  // let the ISIS driver aggregate smaller blocks by making a larger
+  // request. For tiled cubes the block is rounded up to a whole number
+  // of native tiles, so that no tile is decoded for two blocks.
   Vector2i DiskImageResourceIsis::block_read_size() const
   {
-    return Vector2i(2048,2048);
+    const int block_size = 2048;
+    Vector2i size(block_size, block_size);
+    for (int i = 0; i < 2; i++) {
+      if (m_native_block_size[i] > 0)
+        size[i] = m_native_block_size[i] *
+          std::max(1, (block_size + m_native_block_size[i]/2)/m_native_block_size[i]);
+    }
+    return size;
   }
 
   /// Bind the resource to a file for writing.
@@ -88,6 +97,39 @@ namespace vw {
       default:
         vw_throw(IOErr() << "DiskImageResourceIsis: Unknown pixel type.");
     }
+
+    // The native tile size, if the cube is stored in tiles rather than
+    // band-sequentially.
+    m_native_block_size = Vector2i(0, 0);
+    Isis::PvlObject & core = m_cube->label()->findObject("IsisCube").findObject("Core");
+    if (core.hasKeyword("TileSamples") && core.hasKeyword("TileLines"))
+      m_native_block_size = Vector2i(int(core["TileSamples"]), int(core["TileLines"]));
+
+    m_cube_pool.clear();
+    m_cube_pool.push_back(m_cube);
+  }
+
+  boost::shared_ptr<Isis::Cube> DiskImageResourceIsis::acquire_cube() const {
+    {
+      Mutex::Lock lock(m_cube_pool_mutex);
+      if (!m_cube_pool.empty()) {
+        boost::shared_ptr<Isis::Cube> cube = m_cube_pool.back();
+        m_cube_pool.pop_back();
+        return cube;
+      }
+    }
+
+    // All handles are in use by other threads, so open one more
+    boost::shared_ptr<Isis::Cube> cube(new Isis::Cube());
+    cube->open(QString::fromStdString(m_filename));
+    VW_ASSERT(cube->isOpen(), IOErr() << "DiskImageResourceIsis: Could not open cube file: \""
+              << m_filename << "\".");
+    return cube;
+  }
+
+  void DiskImageResourceIsis::release_cube(boost::shared_ptr<Isis::Cube> cube) const {
+    Mutex::Lock lock(m_cube_pool_mutex);
+    m_cube_pool.push_back(cube);
   }
 
   /// Read the disk image into the given buffer.
@@ -104,7 +146,14 @@ namespace vw {
     Isis::Portal buffer( bbox.width(), bbox.height(),
                          m_cube->pixelType() );
     buffer.SetPosition(bbox.min().x()+1, bbox.min().y()+1, 1);
-    m_cube->read(buffer);
+    boost::shared_ptr<Isis::Cube> cube = acquire_cube();
+    try {
+      cube->read(buffer);
+    } catch (...) {
+      release_cube(cube);
+      throw;
+    }
+    release_cube(cube);
 
     // Create generic image buffer from the Isis data.
     ImageBuffer src;
@@ -23,9 +23,11 @@
 #ifndef __VW_FILEIO_DISK_IMAGE_RESOUCE_ISIS_H__
 #define __VW_FILEIO_DISK_IMAGE_RESOUCE_ISIS_H__
 
+#include <vw/Core/Thread.h>
 #include <vw/Image/PixelTypes.h>
 #include <vw/FileIO/DiskImageResource.h>
 #include <vw/FileIO/DiskImageResourceGDAL.h>
+#include <vector>
 
 namespace Isis {
   class Cube;
@@ -81,10 +83,19 @@ namespace vw {
     bool is_map_projected() const;
 
   private:
+
+    // ISIS reads a cube one request at a time, so each thread reading
+    // gets its own handle to the file, from a pool of handles opened
+    // as needed and kept until the resource is destroyed.
+    boost::shared_ptr<Isis::Cube> acquire_cube() const;
+    void release_cube(boost::shared_ptr<Isis::Cube> cube) const;
+
     boost::shared_ptr<Isis::Cube> m_cube;
     std::string m_filename;
     int         m_bytes_per_pixel;
-    Vector2i    m_native_block_size;
+    Vector2i    m_native_block_size; // the tile size, or (0, 0) if not tiled
+    mutable Mutex m_cube_pool_mutex;
+    mutable std::vector< boost::shared_ptr<Isis::Cube> > m_cube_pool;
   };
 
 } // namespace vw
@@ -27,15 +27,30 @@
 #include <vw/Math/Vector.h>
 #include <vw/Math/Matrix.h>
 #include <vw/Camera/CameraModel.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/Log.h>
+
+// Boost
+#include <boost/shared_ptr.hpp>
+
+// STL
+#include <map>
 
 // ASP
 #include <asp/IsisIO/IsisInterface.h>
+#include <asp/IsisIO/IsisLinescanApprox.h>
 
 namespace vw {
 namespace camera {
 
   // This is largely just a shortened reimplementation of ISIS's
   // Camera.cpp.
+  //
+  // An ISIS camera is not thread-safe, as each query changes its
+  // internal state. To allow multiple threads to use the same camera
+  // model, each thread gets its own IsisInterface instance, opened
+  // from the same cube on first use. The pool of instances is shared
+  // among copies of this model.
   class IsisCameraModel : public CameraModel {
 
   public:
@@ -43,7 +58,8 @@ namespace camera {
     // Constructors / Destructors
     //------------------------------------------------------------------
     IsisCameraModel(std::string cube_filename) :
-      m_interface(asp::isis::IsisInterface::open( cube_filename )) {}
+      m_interface(open_interface( cube_filename )),
+      m_pool(new InterfacePool(cube_filename)) {}
     virtual std::string type() const { return "Isis"; }
 
     //------------------------------------------------------------------
@@ -54,22 +70,46 @@ namespace camera {
     //  image plane.  Returns a pixel location (col, row) where the
     //  point appears in the image.
     virtual Vector2 point_to_pixel(Vector3 const& point) const {
-      return m_interface->point_to_pixel( point ); }
+      if (m_approx) return m_approx->point_to_pixel( point );
+      return interface()->point_to_pixel( point ); }
 
     // Returns a (normalized) pointing vector from the camera center
     //  through the position of the pixel 'pix' on the image plane.
     virtual Vector3 pixel_to_vector (Vector2 const& pix) const {
-      return m_interface->pixel_to_vector( pix ); }
+      if (m_approx) return m_approx->pixel_to_vector( pix );
+      return interface()->pixel_to_vector( pix ); }
 
 
     // Returns the position of the focal point of the camera
     virtual Vector3 camera_center(Vector2 const& pix = Vector2() ) const {
-      return m_interface->camera_center( pix ); }
+      if (m_approx) return m_approx->camera_center( pix );
+      return interface()->camera_center( pix ); }
 
     // Pose is a rotation which moves a vector in camera coordinates
     // into world coordinates.
     virtual Quat camera_pose(Vector2 const& pix = Vector2() ) const {
-      return m_interface->camera_pose( pix ); }
+      if (m_approx) return m_approx->camera_pose( pix );
+      return interface()->camera_pose( pix ); }
+
+    // For a linescan camera, sample it once into an approximation, and
+    // use that for the queries above if its error is within the given
+    // number of pixels. The approximation needs no ISIS calls, so it is
+    // fast, and copies of this model share it. Returns whether it is used.
+    bool use_linescan_approx(double max_error) {
+      m_approx.reset();
+      if (m_interface->type() != "LineScan" || max_error <= 0)
+        return false;
+      boost::shared_ptr<asp::isis::IsisLinescanApprox>
+        approx(new asp::isis::IsisLinescanApprox(*m_interface));
+      if (approx->max_error() > max_error) {
+        vw_out(WarningMessage) << "The approximation of the ISIS linescan camera has an "
+                               << "error of " << approx->max_error()
+                               << " pixels. Using the ISIS camera.\n";
+        return false;
+      }
+      m_approx = approx;
+      return true;
+    }
 
     // Returns the number of lines is the ISIS cube
     int lines() const { return m_interface->lines(); }
@@ -83,12 +123,12 @@ namespace camera {
 
     // Returns the ephemeris time for a pixel
     double ephemeris_time( Vector2 const& pix = Vector2() ) const {
-      return m_interface->ephemeris_time( pix );
+      return interface()->ephemeris_time( pix );
     }
 
     // Sun position in the target frame's inertial frame
     Vector3 sun_position( Vector2 const& pix = Vector2() ) const {
-      return m_interface->sun_position( pix );
+      return interface()->sun_position( pix );
     }
 
     // The three main radii that make up the spheroid. Z is out the polar region.
@@ -102,7 +142,47 @@ namespace camera {
     }
 
   protected:
-    boost::shared_ptr<asp::isis::IsisInterface> m_interface;
+
+    typedef boost::shared_ptr<asp::isis::IsisInterface> InterfacePtr;
+
+    // The per-thread IsisInterface instances for one cube
+    struct InterfacePool {
+      InterfacePool(std::string const& cube_filename):
+        m_cube_filename(cube_filename), m_owner(vw::Thread::id()) {}
+
+      std::string  m_cube_filename;
+      vw::uint64   m_owner; // the thread which created m_interface
+      std::map<vw::uint64, InterfacePtr> m_interfaces;
+      vw::Mutex    m_mutex;
+    };
+
+    // Opening a cube loads SPICE data, which is not thread-safe, so it is
+    // serialized across all ISIS camera models.
+    static InterfacePtr open_interface(std::string const& cube_filename) {
+      static vw::Mutex open_mutex;
+      vw::Mutex::Lock lock(open_mutex);
+      return InterfacePtr(asp::isis::IsisInterface::open( cube_filename ));
+    }
+
+    // Return the IsisInterface instance to be used by the current thread
+    asp::isis::IsisInterface* interface() const {
+      vw::uint64 id = vw::Thread::id();
+      if (id == m_pool->m_owner)
+        return m_interface.get();
+
+      vw::Mutex::Lock lock(m_pool->m_mutex);
+      InterfacePtr & ptr = m_pool->m_interfaces[id];
+      if (!ptr)
+        ptr = open_interface(m_pool->m_cube_filename);
+      return ptr.get();
+    }
+
+    // The instance for the thread which created this model. The general
+    // information queries do not change the camera state and use it
+    // from any thread.
+    InterfacePtr m_interface;
+    boost::shared_ptr<InterfacePool> m_pool;
+    boost::shared_ptr<asp::isis::IsisLinescanApprox> m_approx; // if set, used instead of ISIS
 
     friend std::ostream& operator<<( std::ostream&, IsisCameraModel const& );
   };
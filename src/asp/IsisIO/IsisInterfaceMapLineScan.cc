@@ -24,6 +24,7 @@
 #include <asp/IsisIO/IsisInterfaceMapLineScan.h>
 
 #include <algorithm>
+#include <cmath>
 #include <limits>
 #include <string>
 #include <vector>
@@ -46,6 +47,14 @@ using namespace vw;
 using namespace asp;
 using namespace asp::isis;
 
+// The spacing, in map pixels, of the grid of camera pixels, how far,
+// in camera pixels, its interpolation may be from the exact value for
+// a grid cell to be used, and the size of the blocks of map pixels
+// which have a grid each.
+static const int    MAP_GRID_SPACING   = 32;
+static const double MAX_MAP_GRID_ERROR = 0.05;
+static const int    MAP_GRID_BLOCK     = 8 * MAP_GRID_SPACING;
+
 // Constructor
 IsisInterfaceMapLineScan::IsisInterfaceMapLineScan( std::string const& filename ) :
   IsisInterface( filename ){//, m_projection( Isis::ProjectionFactory::CreateFromCube(*m_label) ) {
@@ -58,6 +67,44 @@ IsisInterfaceMapLineScan::IsisInterfaceMapLineScan( std::string const& filename
   m_groundmap = m_camera->GroundMap();
   m_focalmap = m_camera->FocalPlaneMap();
   m_cache_px[0] = m_cache_px[1] = std::numeric_limits<double>::quiet_NaN();
+
+  m_block_cols = (samples() + MAP_GRID_BLOCK - 1) / MAP_GRID_BLOCK;
+  m_block_rows = (lines()   + MAP_GRID_BLOCK - 1) / MAP_GRID_BLOCK;
+  m_grids.resize( m_block_cols * m_block_rows );
+}
+
+bool IsisInterfaceMapLineScan::exact_camera_pixel( Vector2 const& map_px,
+                                                   Vector2 & cam_px ) const {
+  if (!m_projection->SetWorld( map_px[0]+1, map_px[1]+1 ))
+    return false;
+
+  // The camera of a map projected cube works in map pixels unless
+  // told to ignore the projection
+  m_camera->IgnoreProjection( true );
+  bool success =
+    m_camera->SetGround( Isis::Latitude(m_projection->UniversalLatitude(),Isis::Angle::Degrees),
+                         Isis::Longitude(m_projection->UniversalLongitude(),Isis::Angle::Degrees) );
+  cam_px = Vector2( m_camera->Sample(), m_camera->Line() );
+  m_camera->IgnoreProjection( false );
+  return success;
+}
+
+bool IsisInterfaceMapLineScan::grid_camera_pixel( Vector2 const& map_px,
+                                                  Vector2 & cam_px ) const {
+  if ( map_px[0] < 0 || map_px[1] < 0 || map_px[0] > samples() - 1 || map_px[1] > lines() - 1 )
+    return false;
+
+  int col = std::min( int(map_px[0]) / MAP_GRID_BLOCK, m_block_cols - 1 );
+  int row = std::min( int(map_px[1]) / MAP_GRID_BLOCK, m_block_rows - 1 );
+  boost::shared_ptr<MapGrid> & grid = m_grids[row * m_block_cols + col];
+  if ( !grid ) {
+    BBox2i block( col * MAP_GRID_BLOCK, row * MAP_GRID_BLOCK, MAP_GRID_BLOCK, MAP_GRID_BLOCK );
+    block.crop( BBox2i( 0, 0, samples(), lines() ) );
+    bool refine = false;
+    grid.reset( new MapGrid( ExactCameraPixelFunc(this), block, MAX_MAP_GRID_ERROR,
+                             MAP_GRID_SPACING, refine ) );
+  }
+  return (*grid)( map_px, cam_px );
 }
 
 // Custom Functions
@@ -163,13 +210,26 @@ IsisInterfaceMapLineScan::point_to_pixel( Vector3 const& point ) const {
 Vector3
 IsisInterfaceMapLineScan::camera_center( Vector2 const& px ) const {
   if ( px != m_cache_px ) {
+    // Invalidate first, as a failure below leaves the camera elsewhere
+    m_cache_px[0] = m_cache_px[1] = std::numeric_limits<double>::quiet_NaN();
+    Vector2 cam_px;
+    if ( grid_camera_pixel( px, cam_px ) ) {
+      // The raw camera pixel is known, so there is no ground to image
+      // solve. Going from it to the ground is direct.
+      m_camera->IgnoreProjection( true );
+      bool success = m_camera->SetImage( cam_px[0], cam_px[1] );
+      m_camera->IgnoreProjection( false );
+      if (!success)
+        vw_throw( camera::PixelToRayErr() << "Failed to SetImage." );
+    } else {
+      if (!m_projection->SetWorld( px[0]+1,
+                                   px[1]+1 ))
+        vw_throw( camera::PixelToRayErr() << "Failed to SetWorld." );
+      if (!m_groundmap->SetGround( Isis::Latitude(m_projection->UniversalLatitude(),Isis::Angle::Degrees),
+                                   Isis::Longitude(m_projection->UniversalLongitude(),Isis::Angle::Degrees) ) )
+        vw_throw( camera::PixelToRayErr() << "Failed to SetGround." );
+    }
     m_cache_px = px;
-    if (!m_projection->SetWorld( px[0]+1,
-                                 px[1]+1 ))
-      vw_throw( camera::PixelToRayErr() << "Failed to SetWorld." );
-    if (!m_groundmap->SetGround( Isis::Latitude(m_projection->UniversalLatitude(),Isis::Angle::Degrees),
-                                 Isis::Longitude(m_projection->UniversalLongitude(),Isis::Angle::Degrees) ) )
-      vw_throw( camera::PixelToRayErr() << "Failed to SetGround." );
   }
   Vector3 position;
   m_camera->instrumentPosition( &position[0] );
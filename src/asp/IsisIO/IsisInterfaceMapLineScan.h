@@ -25,6 +25,9 @@
 
 // ASP & VW
 #include <asp/IsisIO/IsisInterface.h>
+#include <asp/Core/CorrectionGrid.h>
+#include <boost/shared_ptr.hpp>
+#include <vector>
 
 // Isis
 #include <TProjection.h>
@@ -59,6 +62,33 @@ namespace isis {
     Isis::CameraGroundMap     *m_groundmap;
     Isis::CameraFocalPlaneMap *m_focalmap;
 
+    // Going from a map pixel to the camera takes a map projection
+    // and a ground to image solve in ISIS. The camera pixel seen at
+    // each map pixel is instead interpolated on a coarse grid, made
+    // for a block of map pixels when the block is first needed. A
+    // grid cell whose interpolation misses the camera pixel at its
+    // center by more than a small bound, or with a corner off the
+    // camera, is found exactly.
+    struct ExactCameraPixelFunc {
+      IsisInterfaceMapLineScan const* m_interface;
+      ExactCameraPixelFunc(IsisInterfaceMapLineScan const* interface):
+        m_interface(interface) {}
+      bool operator()(vw::Vector2 const& map_px, vw::Vector2 & cam_px) const {
+        return m_interface->exact_camera_pixel(map_px, cam_px);
+      }
+    };
+    friend struct ExactCameraPixelFunc;
+    typedef CorrectionGrid<ExactCameraPixelFunc, 2> MapGrid;
+    int m_block_cols, m_block_rows;
+    mutable std::vector< boost::shared_ptr<MapGrid> > m_grids;
+
+    /// The camera pixel, in ISIS conventions, seen at a map pixel,
+    /// computed through the map projection and the camera.
+    bool exact_camera_pixel( vw::Vector2 const& map_px, vw::Vector2 & cam_px ) const;
+    /// The same, from the grid. Returns false if the map pixel is
+    /// outside of the cube or does not see the camera.
+    bool grid_camera_pixel ( vw::Vector2 const& map_px, vw::Vector2 & cam_px ) const;
+
   };
 
 }}
@@ -0,0 +1,183 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <vw/Core/Exception.h>
+#include <vw/Camera/CameraModel.h>
+#include <asp/IsisIO/IsisLinescanApprox.h>
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+using namespace asp::isis;
+
+IsisLinescanApprox::IsisLinescanApprox(IsisInterface const& isis, int line_step):
+  m_samples(isis.samples()), m_lines(isis.lines()), m_line_step(std::max(line_step, 1)),
+  m_max_error(std::numeric_limits<double>::max()) {
+
+  VW_ASSERT(m_samples >= 2 && m_lines >= 2,
+            ArgumentErr() << "IsisLinescanApprox: The image is too small.\n");
+
+  // The position and pose. The last entry is at the last line, so the
+  // last interval may be shorter than the others.
+  for (int line = 0; ; line += m_line_step) {
+    double l = std::min(line, m_lines - 1);
+    m_centers.push_back(isis.camera_center(Vector2(0, l)));
+    m_poses.push_back  (isis.camera_pose  (Vector2(0, l)));
+    if (l >= m_lines - 1)
+      break;
+  }
+
+  // The look direction of each sample in the camera frame, which does
+  // not depend on the line for a linescan sensor.
+  double mid = (m_lines - 1)/2.0;
+  Quat inv_pose = inverse(isis.camera_pose(Vector2(0, mid)));
+  for (int sample = 0; sample < m_samples; sample++) {
+    Vector3 dir = inv_pose.rotate(isis.pixel_to_vector(Vector2(sample, mid)));
+    VW_ASSERT(dir[2] != 0, ArgumentErr() << "IsisLinescanApprox: A look direction "
+              << "is perpendicular to the optical axis.\n");
+    m_local_dirs.push_back(dir);
+    m_tan_x.push_back(dir[0]/dir[2]);
+    m_tan_y.push_back(dir[1]/dir[2]);
+  }
+  m_tan_x_increasing = (m_tan_x.back() > m_tan_x.front());
+
+  // Measure the accuracy by projecting into this model points which
+  // the ISIS camera sees at the pixels of a grid, somewhat below the
+  // camera so the parallax over a line is small.
+  const int num = 10;
+  m_max_error = 0.0;
+  for (int i = 0; i <= num; i++) {
+    for (int j = 0; j <= num; j++) {
+      Vector2 pix((m_samples - 1)*double(i)/num, (m_lines - 1)*double(j)/num);
+      Vector3 ctr = isis.camera_center(pix);
+      double  alt = std::max(norm_2(ctr) - isis.target_radii()[0], 1000.0);
+      Vector3 pt  = ctr + alt*isis.pixel_to_vector(pix);
+      double err = std::numeric_limits<double>::max();
+      try {
+        err = norm_2(point_to_pixel(pt) - pix);
+      } catch (const vw::camera::PointToPixelErr&) {}
+      if (!(err <= m_max_error))
+        m_max_error = err;
+    }
+  }
+}
+
+void IsisLinescanApprox::line_interval(double line, int & index, double & frac) const {
+  index = std::max(0, std::min(int(floor(line/m_line_step)), int(m_centers.size()) - 2));
+  double l0 = double(index)*m_line_step;
+  double l1 = std::min(double(index + 1)*m_line_step, double(m_lines - 1));
+  frac = (line - l0)/(l1 - l0);
+}
+
+Vector3 IsisLinescanApprox::camera_center(Vector2 const& pix) const {
+  int index;
+  double frac;
+  line_interval(pix[1], index, frac);
+  return (1.0 - frac)*m_centers[index] + frac*m_centers[index + 1];
+}
+
+Quat IsisLinescanApprox::camera_pose(Vector2 const& pix) const {
+  int index;
+  double frac;
+  line_interval(pix[1], index, frac);
+
+  // Normalized linear interpolation, which over a few lines is the
+  // same as spherical interpolation.
+  Quat a = m_poses[index], b = m_poses[index + 1];
+  double dot = a[0]*b[0] + a[1]*b[1] + a[2]*b[2] + a[3]*b[3];
+  double sign = (dot < 0) ? -1.0 : 1.0;
+  Vector4 q;
+  for (int k = 0; k < 4; k++)
+    q[k] = (1.0 - frac)*a[k] + sign*frac*b[k];
+  q = normalize(q);
+  return Quat(q[0], q[1], q[2], q[3]);
+}
+
+Vector3 IsisLinescanApprox::local_vector(double sample) const {
+  int    index = std::max(0, std::min(int(floor(sample)), m_samples - 2));
+  double frac  = sample - index;
+  return normalize((1.0 - frac)*m_local_dirs[index] + frac*m_local_dirs[index + 1]);
+}
+
+double IsisLinescanApprox::tan_y_at_sample(double sample) const {
+  int    index = std::max(0, std::min(int(floor(sample)), m_samples - 2));
+  double frac  = sample - index;
+  return (1.0 - frac)*m_tan_y[index] + frac*m_tan_y[index + 1];
+}
+
+double IsisLinescanApprox::sample_from_tan_x(double tan_x) const {
+  // The tangents are monotonic along the detector. Beyond its ends,
+  // extrapolate from the first or last interval.
+  int lo = 0, hi = m_samples - 1;
+  while (hi - lo > 1) {
+    int mid = (lo + hi)/2;
+    if ((m_tan_x[mid] < tan_x) == m_tan_x_increasing)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo + (tan_x - m_tan_x[lo])/(m_tan_x[hi] - m_tan_x[lo]);
+}
+
+Vector3 IsisLinescanApprox::pixel_to_vector(Vector2 const& pix) const {
+  return camera_pose(pix).rotate(local_vector(pix[0]));
+}
+
+double IsisLinescanApprox::line_error(Vector3 const& point, double line,
+                                      double & sample) const {
+  Vector2 pix(0, line);
+  Vector3 pt = inverse(camera_pose(pix)).rotate(point - camera_center(pix));
+  sample = sample_from_tan_x(pt[0]/pt[2]);
+  return pt[1]/pt[2] - tan_y_at_sample(sample);
+}
+
+Vector2 IsisLinescanApprox::point_to_pixel(Vector3 const& point) const {
+
+  // Find the line at which the point is seen on the detector with the
+  // secant method. Given the line, the sample follows from where the
+  // point is across the detector.
+  double sample = 0.0;
+  double line0 = (m_lines - 1)/2.0, line1 = line0 + 1.0;
+  double err0  = line_error(point, line0, sample);
+  double err1  = line_error(point, line1, sample);
+
+  const int max_iter = 50;
+  bool converged = false;
+  for (int iter = 0; iter < max_iter; iter++) {
+    if (err1 == err0)
+      break;
+    double line2 = line1 - err1*(line1 - line0)/(err1 - err0);
+    line0 = line1;
+    err0  = err1;
+    line1 = line2;
+    err1  = line_error(point, line1, sample);
+
+    if (std::abs(line1 - line0) < 1e-8) {
+      converged = true;
+      break;
+    }
+  }
+
+  VW_ASSERT(converged && line1 == line1 && sample == sample,
+            vw::camera::PointToPixelErr() << " Unable to project point into the "
+            << "approximate ISIS linescan camera ");
+
+  return Vector2(sample, line1);
+}
@@ -0,0 +1,86 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file IsisLinescanApprox.h
+///
+/// An approximation of an ISIS linescan camera built by sampling it
+/// once. The camera position and pose are tabulated every few lines
+/// and interpolated in between, and the look direction of each
+/// detector sample in the camera frame, which includes the ISIS
+/// distortion model, is tabulated too. After that no ISIS calls are
+/// made, so the approximation is fast and can be used from any number of
+/// threads. Its accuracy is measured against the ISIS camera when it is
+/// built.
+///
+#ifndef __ASP_ISIS_LINESCAN_APPROX_H__
+#define __ASP_ISIS_LINESCAN_APPROX_H__
+
+#include <vw/Math/Vector.h>
+#include <vw/Math/Quaternion.h>
+#include <asp/IsisIO/IsisInterface.h>
+
+#include <vector>
+
+namespace asp {
+namespace isis {
+
+  class IsisLinescanApprox {
+  public:
+
+    /// Sample the given ISIS linescan camera, with the position and
+    /// pose tabulated every line_step lines.
+    IsisLinescanApprox(IsisInterface const& isis, int line_step = 8);
+
+    vw::Vector2 point_to_pixel ( vw::Vector3 const& point ) const;
+    vw::Vector3 pixel_to_vector( vw::Vector2 const& pix   ) const;
+    vw::Vector3 camera_center  ( vw::Vector2 const& pix   ) const;
+    vw::Quat    camera_pose    ( vw::Vector2 const& pix   ) const;
+
+    /// The largest difference, in pixels, between a pixel and the
+    /// projection by this model of a ground point which the ISIS camera
+    /// sees at that pixel, over a grid of pixels spanning the image.
+    double max_error() const { return m_max_error; }
+
+  private:
+
+    // The interpolated camera frame look direction at a sample, and
+    // its tangents of the angles from the optical axis.
+    vw::Vector3 local_vector(double sample) const;
+    double      sample_from_tan_x(double tan_x) const;
+    double      tan_y_at_sample  (double sample) const;
+
+    // How far, along the track, a point seen at the given line is from
+    // the detector, and the sample where it is seen.
+    double line_error(vw::Vector3 const& point, double line, double & sample) const;
+
+    // The index of the interval of a table containing a value, and the
+    // fraction of the way through it.
+    void line_interval(double line, int & index, double & frac) const;
+
+    int    m_samples, m_lines, m_line_step;
+    std::vector<vw::Vector3> m_centers;     // at lines 0, m_line_step, ...
+    std::vector<vw::Quat   > m_poses;
+    std::vector<vw::Vector3> m_local_dirs;  // at each sample
+    std::vector<double     > m_tan_x, m_tan_y;
+    bool   m_tan_x_increasing;
+    double m_max_error;
+  };
+
+}}
+
+#endif//__ASP_ISIS_LINESCAN_APPROX_H__
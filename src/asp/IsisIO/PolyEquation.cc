@@ -69,19 +69,22 @@ PolyEquation::PolyEquation( int order_x,
 
 // Update
 //-----------------------------------------------
+namespace {
+  // Evaluate a polynomial with Horner's rule
+  inline double horner( Vector<double> const& coeff, double t ) {
+    double result = 0;
+    for ( int i = int(coeff.size()) - 1; i >= 0; i-- )
+      result = result*t + coeff[i];
+    return result;
+  }
+}
+
 void PolyEquation::update( double const& t ) {
   m_cached_time = t;
   double delta_t = t-m_time_offset;
-  Vector<double> powers( m_max_length );
-  powers[0] = 1;
-  for ( uint8 i = 1; i < m_max_length; i++ )
-    powers[i] = powers[i-1]*delta_t;
-  m_cached_output[0] = sum( elem_prod(m_x_coeff,
-                                      subvector(powers,0,m_x_coeff.size())) );
-  m_cached_output[1] = sum( elem_prod(m_y_coeff,
-                                      subvector(powers,0,m_y_coeff.size())) );
-  m_cached_output[2] = sum( elem_prod(m_z_coeff,
-                                      subvector(powers,0,m_z_coeff.size())) );
+  m_cached_output[0] = horner( m_x_coeff, delta_t );
+  m_cached_output[1] = horner( m_y_coeff, delta_t );
+  m_cached_output[2] = horner( m_z_coeff, delta_t );
 }
 
 // FileIO
@@ -20,7 +20,7 @@
 #include <asp/IsisIO/RPNEquation.h>
 
 #include <iomanip>
-#include <stack>
+#include <cmath>
 #include <vector>
 
 #include <boost/algorithm/string/classification.hpp>
@@ -38,15 +38,18 @@ RPNEquation::RPNEquation() {
   m_y_consts.clear();
   m_z_eq.clear();
   m_z_consts.clear();
+  m_x_code.clear();
+  m_y_code.clear();
+  m_z_code.clear();
   m_cached_time = -1;
   m_time_offset = 0;
 }
 RPNEquation::RPNEquation( std::string x_eq,
                           std::string y_eq,
                           std::string z_eq ) {
-  string_to_eqn( x_eq, m_x_eq, m_x_consts );
-  string_to_eqn( y_eq, m_y_eq, m_y_consts );
-  string_to_eqn( z_eq, m_z_eq, m_z_consts );
+  string_to_eqn( x_eq, m_x_eq, m_x_consts, m_x_code );
+  string_to_eqn( y_eq, m_y_eq, m_y_consts, m_y_code );
+  string_to_eqn( z_eq, m_z_eq, m_z_consts, m_z_code );
   m_cached_time = -1;
   m_time_offset = 0;
 }
@@ -56,22 +59,24 @@ RPNEquation::RPNEquation( std::string x_eq,
 void RPNEquation::update( double const& t ) {
   m_cached_time = t;
   double delta_t = t - m_time_offset;
-  m_cached_output[0] = evaluate( m_x_eq,
+  m_cached_output[0] = evaluate( m_x_code,
                                  m_x_consts,
                                  delta_t );
-  m_cached_output[1] = evaluate( m_y_eq,
+  m_cached_output[1] = evaluate( m_y_code,
                                  m_y_consts,
                                  delta_t );
-  m_cached_output[2] = evaluate( m_z_eq,
+  m_cached_output[2] = evaluate( m_z_code,
                                  m_z_consts,
                                  delta_t );
 }
 void RPNEquation::string_to_eqn( std::string& str,
                                  std::vector<std::string>& commands,
-                                 std::vector<double>& consts ) {
+                                 std::vector<double>& consts,
+                                 std::vector<OpCode>& code ) {
   // Breaks a string into the equation format used internally
   commands.clear();
   consts.clear();
+  code.clear();
   boost::split( commands, str, boost::is_any_of(" ="));
 
   // Cleaning out any tokens that are just ""
@@ -91,84 +96,71 @@ void RPNEquation::string_to_eqn( std::string& str,
       *iter = "c";
     }
   }
-}
-double RPNEquation::evaluate( std::vector<std::string>& commands,
-                              std::vector<double>& consts,
-                              double const& t ) {
-  // Evaluates an equation in the internal format
+
+  // Compile the commands, checking that each operator has its
+  // arguments, as this is cheaper to do once than on each evaluation.
   if ( commands.empty() )
-    return 0;
-  int consts_index = 0;
-  std::stack<double> rpn_stack;
-  double buffer;
+    return;
+  size_t depth = 0;
   for ( std::vector<std::string>::iterator iter = commands.begin();
         iter != commands.end(); ++iter ) {
-    if ( *iter == "c" ) {
-      rpn_stack.push( consts[consts_index] );
-      consts_index++;
-    } else if ( *iter == "t" ) {
-      rpn_stack.push( t );
-    } else if ( rpn_stack.size() < 1 ) {
+    OpCode op;
+    size_t num_args = 0;
+    if      ( *iter == "c"   ) op = OP_CONST;
+    else if ( *iter == "t"   ) op = OP_T;
+    else if ( *iter == "sin" ) { op = OP_SIN; num_args = 1; }
+    else if ( *iter == "cos" ) { op = OP_COS; num_args = 1; }
+    else if ( *iter == "tan" ) { op = OP_TAN; num_args = 1; }
+    else if ( *iter == "abs" ) { op = OP_ABS; num_args = 1; }
+    else if ( *iter == "*"   ) { op = OP_MUL; num_args = 2; }
+    else if ( *iter == "/"   ) { op = OP_DIV; num_args = 2; }
+    else if ( *iter == "-"   ) { op = OP_SUB; num_args = 2; }
+    else if ( *iter == "+"   ) { op = OP_ADD; num_args = 2; }
+    else if ( *iter == "^"   ) { op = OP_POW; num_args = 2; }
+    else
+      vw_throw( IOErr() << "Unknown RPN operator: " << *iter << "\n" );
+
+    if ( depth < num_args )
       vw_throw( IOErr() << "Insufficient arguments for RPN command: "
                 << *iter << "\n" );
-    } else if ( *iter == "sin" ) {
-      buffer = sin( rpn_stack.top() );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "cos" ) {
-      buffer = cos( rpn_stack.top() );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "tan" ) {
-      buffer = tan( rpn_stack.top() );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "abs" ) {
-      buffer = fabs( rpn_stack.top() );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( rpn_stack.size() < 2 ) {
-      vw_throw( IOErr() << "Insufficient arguments for command: "
-                << *iter << "\n" );
-    } else if ( *iter == "*" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer *= rpn_stack.top();
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "/" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer = rpn_stack.top() / buffer;
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "-" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer = rpn_stack.top() - buffer;
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "+" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer += rpn_stack.top();
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( *iter == "^" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer = pow( rpn_stack.top(), buffer );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else {
-      vw_throw( IOErr() << "Unknown RPN operator: " << *iter << "\n" );
-    }
-  } // End of calculator
+    if ( num_args == 0 )
+      depth++;
+    else
+      depth -= num_args - 1;
+    if ( depth > m_stack.size() )
+      m_stack.resize( depth );
+    code.push_back( op );
+  }
 
-  if ( rpn_stack.size() != 1 )
+  if ( depth != 1 )
     vw_throw( IOErr() << "Unbalanced RPN equation! More constants than need by operators.\n" );
+}
+double RPNEquation::evaluate( std::vector<OpCode> const& code,
+                              std::vector<double> const& consts,
+                              double const& t ) {
+  // Evaluates a compiled equation. It was checked to be well formed
+  // when compiled, so there are no checks here.
+  if ( code.empty() )
+    return 0;
+  int consts_index = 0;
+  double* top = &m_stack[0] - 1;
+  for ( size_t i = 0; i < code.size(); i++ ) {
+    switch ( code[i] ) {
+    case OP_CONST: *(++top) = consts[consts_index++];   break;
+    case OP_T:     *(++top) = t;                        break;
+    case OP_SIN:   *top = sin( *top );                  break;
+    case OP_COS:   *top = cos( *top );                  break;
+    case OP_TAN:   *top = tan( *top );                  break;
+    case OP_ABS:   *top = fabs( *top );                 break;
+    case OP_MUL:   top--; *top *= top[1];               break;
+    case OP_DIV:   top--; *top /= top[1];               break;
+    case OP_SUB:   top--; *top -= top[1];               break;
+    case OP_ADD:   top--; *top += top[1];               break;
+    case OP_POW:   top--; *top = pow( *top, top[1] );   break;
+    }
+  }
 
-  return rpn_stack.top();
+  return *top;
 }
 
 // FileIO
@@ -211,13 +203,13 @@ void RPNEquation::read( std::ifstream &f ) {
 
   buffer = "";
   std::getline( f, buffer );
-  string_to_eqn( buffer, m_x_eq, m_x_consts );
+  string_to_eqn( buffer, m_x_eq, m_x_consts, m_x_code );
   buffer = "";
   std::getline( f, buffer );
-  string_to_eqn( buffer, m_y_eq, m_y_consts );
+  string_to_eqn( buffer, m_y_eq, m_y_consts, m_y_code );
   buffer = "";
   std::getline( f, buffer );
-  string_to_eqn( buffer, m_z_eq, m_z_consts );
+  string_to_eqn( buffer, m_z_eq, m_z_consts, m_z_code );
 }
 
 // Constant Access
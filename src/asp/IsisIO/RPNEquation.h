@@ -39,19 +39,29 @@ namespace asp {
   // Remember: Have your equation space delimited
   // Also: 'c' is an internal place holder for RPNEquation
   class RPNEquation : public BaseEquation {
+    // The commands are compiled into these op codes when the
+    // equation is read, so evaluating it does not compare strings.
+    enum OpCode { OP_CONST, OP_T, OP_SIN, OP_COS, OP_TAN, OP_ABS,
+                  OP_MUL, OP_DIV, OP_SUB, OP_ADD, OP_POW };
+
     std::vector<std::string> m_x_eq;
     std::vector<double> m_x_consts;
+    std::vector<OpCode> m_x_code;
     std::vector<std::string> m_y_eq;
     std::vector<double> m_y_consts;
+    std::vector<OpCode> m_y_code;
     std::vector<std::string> m_z_eq;
     std::vector<double> m_z_consts;
+    std::vector<OpCode> m_z_code;
+    std::vector<double> m_stack; // Sized for the deepest equation
 
     void update( double const& t );
     void string_to_eqn( std::string& str,
                         std::vector<std::string>& commands,
-                        std::vector<double>& consts );
-    double evaluate( std::vector<std::string>& commands,
-                     std::vector<double>& consts,
+                        std::vector<double>& consts,
+                        std::vector<OpCode>& code );
+    double evaluate( std::vector<OpCode> const& code,
+                     std::vector<double> const& consts,
                      double const& t );
   public:
     RPNEquation();
@@ -0,0 +1,91 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+// Timing of the projections of the ISIS cameras, on the sample cubes
+// of this directory. Run with 'make bench'.
+
+#include <test/Helpers.h>
+#include <test/Benchmark.h>
+
+#include <vw/Math/Vector.h>
+#include <asp/IsisIO/IsisCameraModel.h>
+
+using namespace vw;
+using namespace vw::camera;
+using namespace vw::test;
+
+namespace {
+
+  struct PointToPixel {
+    IsisCameraModel & cam;
+    std::vector<Vector3> const& points;
+    PointToPixel(IsisCameraModel & c, std::vector<Vector3> const& p): cam(c), points(p) {}
+    void operator()() {
+      double sum = 0;
+      for (size_t i = 0; i < points.size(); i++)
+        sum += cam.point_to_pixel(points[i])[0];
+      benchmark_sink() += sum;
+    }
+  };
+
+  struct PixelToVector {
+    IsisCameraModel & cam;
+    std::vector<Vector2> const& pixels;
+    PixelToVector(IsisCameraModel & c, std::vector<Vector2> const& p): cam(c), pixels(p) {}
+    void operator()() {
+      double sum = 0;
+      for (size_t i = 0; i < pixels.size(); i++)
+        sum += cam.pixel_to_vector(pixels[i])[0];
+      benchmark_sink() += sum;
+    }
+  };
+
+  // 256 calls each, on a 16 x 16 grid of pixels, and on the points
+  // 70 km along their rays.
+  void bench_cube(std::string const& cube, std::string const& name) {
+    IsisCameraModel cam(cube);
+
+    std::vector<Vector2> pixels;
+    std::vector<Vector3> points;
+    int num = 16;
+    for (int i = 0; i < num; i++) {
+      for (int j = 0; j < num; j++) {
+        Vector2 pix((i + 0.5)*cam.samples()/num, (j + 0.5)*cam.lines()/num);
+        pixels.push_back(pix);
+        points.push_back(cam.camera_center(pix) + 70000*cam.pixel_to_vector(pix));
+      }
+    }
+
+    PointToPixel p2p(cam, points);
+    benchmark(name + "_point_to_pixel_256", p2p);
+
+    PixelToVector p2v(cam, pixels);
+    benchmark(name + "_pixel_to_vector_256", p2v);
+  }
+}
+
+TEST(Benchmark, IsisCameraModel) {
+  if (!asp::isis::IsisEnv()) {
+    vw_out() << "ISISROOT or ISIS3DATA was not set. ISIS benchmarks won't be run."
+	     << std::endl;
+    return;
+  }
+
+  bench_cube("5165r.cub",           "isis_frame");
+  bench_cube("E1701676.reduce.cub", "isis_linescan");
+}
@@ -126,3 +126,17 @@ TEST(EphemerisEquations, reversepolish) {
   EXPECT_NEAR( 15.4176744337735, test[1], DELTA );
   EXPECT_NEAR( 2737.72972972973, test[2], DELTA );
 }
+
+TEST(EphemerisEquations, reversepolish_malformed) {
+  // Malformed equations are caught when they are compiled
+  EXPECT_THROW( RPNEquation( "t +", "t", "t" ), IOErr );
+  EXPECT_THROW( RPNEquation( "t", "2 t", "t" ), IOErr );
+  EXPECT_THROW( RPNEquation( "t", "t", "t foo" ), IOErr );
+
+  // An empty equation evaluates to zero
+  RPNEquation rpn( "", "t 2 ^", "2 t -" );
+  Vector3 test = rpn(3);
+  EXPECT_EQ( 0,  test[0] );
+  EXPECT_NEAR( 9,  test[1], DELTA );
+  EXPECT_EQ( -1, test[2] );
+}
@@ -271,3 +271,29 @@ TEST(IsisCameraModel, camera_model) {
     EXPECT_LT( angle_from_z, 0.5 );
   }
 }
+
+TEST(IsisCameraModel, linescan_approx) {
+  if (!asp::isis::IsisEnv()) {
+    vw_out() << "ISISROOT or ISIS3DATA was not set. ISIS unit tests won't be run."
+	     << std::endl;
+    return;
+  }
+
+  std::string cube("E1701676.reduce.cub"); // Linescan
+  IsisCameraModel isis_cam(cube);
+  IsisCameraModel approx_cam(cube);
+  ASSERT_TRUE( approx_cam.use_linescan_approx(0.05) );
+
+  srand( 42 );
+  for ( size_t i = 0; i < 10; i++ ) {
+    Vector2 pixel = generate_random( isis_cam.samples(),
+				     isis_cam.lines() );
+    EXPECT_VECTOR_NEAR( isis_cam.camera_center(pixel),
+			approx_cam.camera_center(pixel), 1e-2 );
+    EXPECT_LT( acos(std::min(1.0, dot_prod(isis_cam.pixel_to_vector(pixel),
+					   approx_cam.pixel_to_vector(pixel)))), 1e-6 );
+
+    Vector3 point = isis_cam.camera_center(pixel) + 70000*isis_cam.pixel_to_vector(pixel);
+    EXPECT_VECTOR_NEAR( pixel, approx_cam.point_to_pixel(point), 0.05 );
+  }
+}
@@ -21,7 +21,7 @@
 General system related utilities
 """
 
-import sys, os, re, shutil, subprocess, string, time, errno, multiprocessing, signal
+import sys, os, re, shutil, subprocess, string, time, errno, multiprocessing, signal, glob
 import os.path as P
 import asp_string_utils, asp_cmd_utils
 
@@ -158,8 +158,14 @@ def check_parallel_version():
     if ver < '20170722':
         die("Expecting a version of GNU parallel >= 20170722.")
 
-def runInGnuParallel(numParallelProcesses, commandString, argumentFilePath, parallelArgs=[], nodeListPath=None, verbose=False):
-    """Use GNU Parallel to spread task across multiple computers and processes"""
+def runInGnuParallel(numParallelProcesses, commandString, argumentFilePath, parallelArgs=[], nodeListPath=None, verbose=False,
+                     memFree=None, retries=None, jobLogPath=None):
+    """Use GNU Parallel to spread task across multiple computers and processes.
+    With memFree, such as '4G', a job starts on a node only when that much
+    memory is free there. With retries, a failed job is run again up to that
+    many times in total, on another node if there is one. With jobLogPath,
+    the run-time and exit status of each job are saved there, and summarized
+    at the end."""
 
     # Make sure GNU parallel is installed
     if not checkIfToolExists('parallel'):
@@ -184,6 +190,13 @@ def runInGnuParallel(numParallelProcesses, commandString, argumentFilePath, para
     if nodeListPath is not None:
         cmd += ['--sshloginfile', nodeListPath]
 
+    if memFree is not None:
+        cmd += ['--memfree', str(memFree)]
+    if retries is not None and retries > 1:
+        cmd += ['--retries', str(retries)]
+    if jobLogPath is not None:
+        cmd += ['--joblog', jobLogPath]
+
     # Append any additional arguments to parallel
     cmd += parallelArgs
 
@@ -194,8 +207,69 @@ def runInGnuParallel(numParallelProcesses, commandString, argumentFilePath, para
         print(" ".join(cmd))
 
     returnCode = subprocess.call(cmd)
+
+    if jobLogPath is not None:
+        report_joblog(jobLogPath)
+
     return returnCode
 
+def read_joblog(jobLogPath):
+    """Parse a GNU parallel job log. Return a list with a dictionary
+    per job, having the host, the run-time in seconds, the exit value
+    and the command. With retries, a job appears once per attempt."""
+    jobs = []
+    if not os.path.exists(jobLogPath):
+        return jobs
+    with open(jobLogPath, 'r') as f:
+        for line in f:
+            if not line.endswith('\n'):
+                continue # still being written
+            # Seq Host Starttime JobRuntime Send Receive Exitval Signal Command
+            vals = line.rstrip('\n').split('\t')
+            if len(vals) < 9 or vals[0] == 'Seq':
+                continue
+            try:
+                jobs.append({'seq': int(vals[0]), 'host': vals[1],
+                             'runtime': float(vals[3]), 'exitval': int(vals[6]),
+                             'signal': int(vals[7]), 'command': vals[8]})
+            except ValueError:
+                continue
+    return jobs
+
+def report_joblog(jobLogPath):
+    """Print, per host, how many jobs ran and failed and how long they
+    took, from a GNU parallel job log."""
+    jobs = read_joblog(jobLogPath)
+    if len(jobs) == 0:
+        return
+    hosts = {}
+    for job in jobs:
+        hosts.setdefault(job['host'], []).append(job)
+    for host in sorted(hosts.keys()):
+        times  = sorted([job['runtime'] for job in hosts[host]])
+        failed = len([job for job in hosts[host]
+                      if job['exitval'] != 0 or job['signal'] != 0])
+        print("Jobs on %s: count = %d, failed = %d, median = %gs, max = %gs"
+              % (host, len(times), failed, times[len(times)//2], times[-1]))
+    print("Per-job run-times are saved in: " + jobLogPath)
+
+def num_numa_nodes():
+    '''The number of NUMA nodes, usually one per CPU socket, on this machine.'''
+    nodes = [d for d in glob.glob('/sys/devices/system/node/node*')
+             if re.match('^node\d+$', os.path.basename(d))]
+    return max(len(nodes), 1)
+
+def numa_bind_prefix(slot):
+    '''A command prefix to run a process on one NUMA node, with its
+    memory allocated on that node too. Processes with consecutive GNU
+    parallel slot numbers ({%}) go to consecutive nodes. Empty if
+    there is only one node or numactl is missing.'''
+    num_nodes = num_numa_nodes()
+    if num_nodes <= 1 or which('numactl') is None:
+        return []
+    node = (int(slot) - 1) % num_nodes
+    return ['numactl', '--cpunodebind=' + str(node), '--localalloc']
+
 # When user-exposed ASP executables are installed, they are in
 # 'bin'. Otherwise, in dev mode, they are in the same dir as __file__.
 # We prefer absolute paths below, in case some intermediate directories
@@ -309,6 +383,68 @@ def run_with_return_code(cmd, verbose=False):
 
     return p.returncode
 
+class JobGraph:
+    '''Run shell commands in parallel, each one once the commands it
+    depends on have finished. A command whose dependency failed is not
+    run, and counts as failed. Use as:
+      jobs = JobGraph(num_procs)
+      a = jobs.add('hi2isis ...')
+      b = jobs.add('hical ...', [a])
+      failed = jobs.run()
+    '''
+
+    def __init__(self, num_procs, verbose=True):
+        self.num_procs = max(1, num_procs)
+        self.verbose   = verbose
+        self.cmds      = []
+        self.deps      = []
+
+    def add(self, cmd, deps=[]):
+        '''Add a command and return its id. Ids of None in the
+        dependencies, for steps which were skipped, are ignored.'''
+        self.cmds.append(cmd)
+        self.deps.append([d for d in deps if d is not None])
+        return len(self.cmds) - 1
+
+    def run(self):
+        '''Run all commands, and return the list of those which failed.'''
+        PENDING, RUNNING, DONE, FAILED = range(4)
+        state   = [PENDING] * len(self.cmds)
+        running = {} # id to process
+        while True:
+            # Start what is ready, in the order the commands were added
+            for i in range(len(self.cmds)):
+                if state[i] != PENDING:
+                    continue
+                if any(state[d] == FAILED for d in self.deps[i]):
+                    state[i] = FAILED
+                    print('Not running, as a command it needs failed: ' + self.cmds[i])
+                    continue
+                if len(running) >= self.num_procs:
+                    continue
+                if all(state[d] == DONE for d in self.deps[i]):
+                    if self.verbose:
+                        print(self.cmds[i])
+                    running[i] = subprocess.Popen(self.cmds[i], shell=True, env=os.environ)
+                    state[i] = RUNNING
+
+            if len(running) == 0:
+                break
+
+            # Wait for any command to finish
+            finished = []
+            while len(finished) == 0:
+                for i in running:
+                    if running[i].poll() is not None:
+                        finished.append(i)
+                if len(finished) == 0:
+                    time.sleep(0.1)
+            for i in finished:
+                state[i] = DONE if running[i].returncode == 0 else FAILED
+                del running[i]
+
+        return [self.cmds[i] for i in range(len(self.cmds)) if state[i] == FAILED]
+
 # For timeout
 def timeout_alarm_handler(signum, frame):
     raise Exception("Timeout reached!")
@@ -38,6 +38,7 @@
 #include <asp/Sessions/CameraModelLoader.h>
 #include <asp/Camera/RPCModel.h>
 #include <asp/Camera/RPC_XML.h>
+#include <asp/Camera/CameraCache.h>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <map>
@@ -67,12 +68,22 @@ boost::shared_ptr<vw::camera::CameraModel> CameraModelLoader::load_pinhole_camer
 // - TODO: Move to another file
 boost::shared_ptr<vw::camera::CameraModel> CameraModelLoader::load_rpc_camera_model(std::string const& path) const
 {
+  // Try the cache of models read before from XML files. Images with
+  // RPC models are read quickly by GDAL, and are not worth hashing.
+  std::string cache_file;
+  if (!has_image_extension(path))
+    cache_file = camera_cache_file(stereo_settings().camera_cache_dir, path, "rpc");
+  boost::shared_ptr<RPCModel> cached_model;
+  if (read_cached_rpc_model(cache_file, cached_model))
+    return cached_model;
+
   // Try the default loading method
   RPCModel* rpc_model = NULL;
   try {
     RPCXML rpc_xml; // This is for reading XML files
     rpc_xml.read_from_file(path);
     rpc_model = new RPCModel(*rpc_xml.rpc_ptr()); // Copy the value
+    write_cached_rpc_model(cache_file, *rpc_model);
   } catch (...) {}
   if (!rpc_model) // The default loading method failed, try the backup method.
   {
@@ -88,8 +99,15 @@ boost::shared_ptr<vw::camera::CameraModel> CameraModelLoader::load_rpc_camera_mo
 // Load a DG camera file
 boost::shared_ptr<vw::camera::CameraModel> CameraModelLoader::load_dg_camera_model(std::string const& path) const
 {
-  // Redirect to the call from LinescanDGModel.h file
-  return CameraModelPtr(load_dg_camera_model_from_xml(path));
+  // Parse the XML file, unless it was parsed before and the
+  // resulting values were cached.
+  std::string cache_file = camera_cache_file(stereo_settings().camera_cache_dir, path, "dg");
+  DGCameraParams params;
+  if (!read_cached_dg_params(cache_file, params)) {
+    read_dg_camera_params_from_xml(path, params);
+    write_cached_dg_params(cache_file, params);
+  }
+  return CameraModelPtr(dg_camera_model_from_params(params));
 }
 
 // Load a spot5 camera file
@@ -113,7 +131,9 @@ boost::shared_ptr<vw::camera::CameraModel> CameraModelLoader::load_ASTER_camera_
 boost::shared_ptr<vw::camera::CameraModel> CameraModelLoader::load_isis_camera_model(std::string const& path) const
 {
 #if defined(ASP_HAVE_PKG_ISISIO) && ASP_HAVE_PKG_ISISIO == 1
-  return CameraModelPtr(new vw::camera::IsisCameraModel(path));
+  boost::shared_ptr<vw::camera::IsisCameraModel> cam(new vw::camera::IsisCameraModel(path));
+  cam->use_linescan_approx(stereo_settings().isis_linescan_approx_error);
+  return cam;
 #endif
   // If ISIS was not enabled in the build, just throw an exception.
   vw::vw_throw( vw::NoImplErr() << "\nCannot load ISIS files because ISIS was not enabled in the build!.\n");
@@ -26,6 +26,7 @@
 #include <vw/Image/PixelTypeInfo.h>
 #include <vw/FileIO/DiskImageResource.h>
 #include <vw/FileIO/DiskImageView.h>
+#include <vw/FileIO/DiskImageResourceGDAL.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 
 #include <asp/Core/StereoSettings.h>
@@ -34,12 +35,20 @@
 #include <asp/Core/InterestPointMatching.h>
 #include <asp/Core/BundleAdjustUtils.h>
 #include <asp/Camera/AdjustedLinescanDGModel.h>
+#include <asp/Camera/RPCModelGen.h>
+#include <asp/Camera/RPCApproxModel.h>
+#include <asp/Camera/CameraCache.h>
+#include <boost/functional/hash.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
 
 #include <map>
 #include <utility>
 #include <string>
 #include <ostream>
 #include <limits>
+#include <sstream>
+#include <iomanip>
 
 using namespace vw;
 
@@ -106,6 +115,7 @@ namespace asp {
 
     DiskImageView<float> image1(rsrc1), image2(rsrc2);
     ImageViewRef<float> image1_norm=image1, image2_norm=image2;
+    std::string preprocessing;
     // Get normalized versions of the images for OpenCV based methods
     if ( (stereo_settings().ip_matching_method != DETECT_IP_METHOD_INTEGRAL) &&
        (stats1[0] != stats1[1]) ) { // Don't normalize if no stats were provided!
@@ -115,14 +125,25 @@ namespace asp {
                        true, // Use percentile based stretch for ip matching
                        stats1,      stats2,
                        image1_norm, image2_norm);
+      std::ostringstream os;
+      os.precision(17);
+      os << "normalize " << stereo_settings().force_use_entire_range << " "
+         << stereo_settings().individually_normalize << " " << stats1 << " " << stats2;
+      preprocessing = os.str();
     }
 
+    // The keys of the interest points of these images in --ip-cache-dir
+    std::string cache_key1 = ip_cache_key(input_file1, preprocessing, ip_per_tile, nodata1);
+    std::string cache_key2 = ip_cache_key(input_file2, preprocessing, ip_per_tile, nodata2);
+
     bool nadir_facing = this->is_nadir_facing();
     
     bool inlier = false;
     if (nadir_facing) {
       // Run an IP matching function that takes the camera and datum info into account
-      bool single_threaded_camera = true; // TODO: This is probably needed only for ISIS.
+      // ISIS cameras are not thread safe. The other ones are used from
+      // many threads in triangulation as well.
+      bool single_threaded_camera = (this->name() == "isis" || this->name() == "isismapisis");
 
       bool use_sphere_for_isis = false; // Assume Mars is not a sphere
       cartography::Datum datum = this->get_datum(cam1, use_sphere_for_isis);
@@ -176,7 +197,10 @@ namespace asp {
                              ip_per_tile,
                              datum, match_filename,
                              epipolar_threshold, ip_uniqueness_thresh,
-                             nodata1, nodata2);              
+                             nodata1, nodata2,
+                             TransformRef(TranslateTransform(0,0)),
+                             TransformRef(TranslateTransform(0,0)),
+                             true, cache_key1, cache_key2);
       }
       else {
         inlier = ip_matching_w_alignment(single_threaded_camera, cam1, cam2,
@@ -184,7 +208,10 @@ namespace asp {
                                          ip_per_tile,
                                          datum, match_filename,
                                          epipolar_threshold, ip_uniqueness_thresh,
-                                         nodata1, nodata2);
+                                         nodata1, nodata2,
+                                         TransformRef(TranslateTransform(0,0)),
+                                         TransformRef(TranslateTransform(0,0)),
+                                         cache_key1, cache_key2);
       }
     } else { // Not nadir facing
       // Run a simpler purely image based matching function
@@ -200,7 +227,7 @@ namespace asp {
                                        ip_per_tile,
                                        match_filename,
                                        inlier_threshold,
-                                       nodata1, nodata2);
+                                       nodata1, nodata2, cache_key1, cache_key2);
     }
     if (!inlier) {
       boost::filesystem::remove(match_filename);
@@ -465,6 +492,78 @@ shared_preprocessing_hook(vw::cartography::GdalWriteOptions              & optio
   return false; // don't exit early
 }
 
+std::string StereoSession::left_image_recipe(std::string const& left_input_file,
+                                             float left_nodata_value,
+                                             Matrix<double> const& align_left_matrix,
+                                             Vector2i const& left_size,
+                                             double left_lo, double left_hi) const {
+  namespace fs = boost::filesystem;
+  std::ostringstream os;
+  os << std::setprecision(17);
+  os << fs::absolute(left_input_file).string() << ' ' << fs::file_size(left_input_file)
+     << ' ' << fs::last_write_time(left_input_file)
+     << " crop " << stereo_settings().left_image_crop_win
+     << " nodata " << left_nodata_value
+     << " wv_correct " << stereo_settings().wv_correct
+     << " align";
+  for (size_t r = 0; r < align_left_matrix.rows(); r++)
+    for (size_t c = 0; c < align_left_matrix.cols(); c++)
+      os << ' ' << align_left_matrix(r, c);
+  os << " size " << left_size.x() << ' ' << left_size.y()
+     << " range " << left_lo << ' ' << left_hi;
+  return os.str();
+}
+
+bool StereoSession::link_shared_left_image(std::string const& recipe,
+                                           std::string const& left_output_file) const {
+  namespace fs = boost::filesystem;
+  if (!stereo_settings().part_of_multiview_run)
+    return false;
+
+  // The pairs have the prefixes <prefix>-pair<p>/<p>
+  fs::path pair_dir = fs::path(m_out_prefix).parent_path();
+  std::string pair_name = pair_dir.filename().string();
+  size_t pos = pair_name.rfind("-pair");
+  if (pos == std::string::npos)
+    return false;
+  std::string stem = pair_name.substr(0, pos + 5);
+  fs::path run_dir = pair_dir.parent_path();
+  if (run_dir.empty())
+    run_dir = ".";
+  if (!fs::is_directory(run_dir))
+    return false;
+
+  for (fs::directory_iterator it(run_dir); it != fs::directory_iterator(); it++) {
+    std::string name = it->path().filename().string();
+    if (name == pair_name || name.find(stem) != 0 || !fs::is_directory(it->path()))
+      continue;
+
+    // Link only to a file written by its own pair, never to a link
+    std::string other_file = (it->path() / (name.substr(stem.size()) + "-L.tif")).string();
+    if (!fs::exists(other_file) || fs::is_symlink(other_file))
+      continue;
+    std::string other_recipe;
+    try {
+      DiskImageResourceGDAL rsrc(other_file);
+      vw::cartography::read_header_string(rsrc, left_image_recipe_key(), other_recipe);
+    } catch (...) {
+      continue;
+    }
+    if (other_recipe != recipe)
+      continue;
+
+    if (fs::exists(left_output_file) || fs::is_symlink(left_output_file))
+      fs::remove(left_output_file);
+    fs::create_symlink(fs::path("..") / name / fs::path(other_file).filename(),
+                       left_output_file);
+    vw_out() << "\t--> Linking " << left_output_file << " to the same left image of another "
+             << "pair: " << other_file << "\n";
+    return true;
+  }
+  return false;
+}
+
+
 // TODO: Find a better place for these functions!
 
 // If both left-image-crop-win and right-image-crop win are specified,
@@ -552,7 +651,8 @@ load_adjusted_model(boost::shared_ptr<vw::camera::CameraModel> cam,
           (new AdjustedLinescanDGModel(cam,
 		                 stereo_settings().piecewise_adjustment_interp_type,
 		                 adjustment_bounds, position_correction,
-		                 pose_correction, image_size));
+		                 pose_correction, image_size,
+                                 true)); // use dense adjustment tables
 
         // Apply the pixel offset and pose corrections. So this a second adjustment
         // on top of the first.
@@ -567,7 +667,8 @@ load_adjusted_model(boost::shared_ptr<vw::camera::CameraModel> cam,
            (new PiecewiseAdjustedLinescanModel(cam,
                                                stereo_settings().piecewise_adjustment_interp_type,
                                                adjustment_bounds, position_correction,
-                                               pose_correction, image_size));
+                                               pose_correction, image_size,
+                                               true)); // use dense adjustment tables
          
          // Apply the pixel offset and pose corrections. So this a second adjustment
          // on top of the first.
@@ -588,4 +689,107 @@ load_adjusted_model(boost::shared_ptr<vw::camera::CameraModel> cam,
 						 pose_correction[0], pixel_offset));
 }
 
+// The cache file for the RPC approximation of a camera. ISIS cubes
+// are too big to hash, so the key is made of the names, sizes, and
+// times of the files the camera is made from, and of the settings of
+// the approximation.
+std::string rpc_approx_cache_file(std::string const& image_file,
+                                  std::string const& camera_file,
+                                  BBox2 const& image_box) {
+  namespace fs = boost::filesystem;
+  std::string cache_dir = stereo_settings().camera_cache_dir;
+  if (cache_dir == "")
+    return "";
+
+  std::vector<std::string> files;
+  files.push_back(image_file);
+  files.push_back(camera_file);
+  std::string ba_pref = stereo_settings().bundle_adjust_prefix;
+  if (ba_pref != "")
+    files.push_back(asp::bundle_adjust_file_name(ba_pref, image_file, camera_file));
+
+  std::size_t key = 0;
+  try {
+    for (size_t i = 0; i < files.size(); i++) {
+      boost::hash_combine(key, fs::absolute(files[i]).string());
+      if (fs::exists(files[i])) {
+        boost::hash_combine(key, fs::file_size(files[i]));
+        boost::hash_combine(key, fs::last_write_time(files[i]));
+      }
+    }
+    fs::create_directories(cache_dir);
+  } catch (const std::exception& e) {
+    vw_out(WarningMessage) << "Could not use the camera model cache directory "
+                           << cache_dir << ": " << e.what() << std::endl;
+    return "";
+  }
+  for (int c = 0; c < 2; c++) {
+    boost::hash_combine(key, image_box.min()[c]);
+    boost::hash_combine(key, image_box.max()[c]);
+    boost::hash_combine(key, stereo_settings().rpc_approximation_height_range[c]);
+  }
+  boost::hash_combine(key, stereo_settings().rpc_approximation_error);
+
+  std::ostringstream name;
+  name << fs::path(camera_file).stem().string() << "-" << std::hex << std::setw(16)
+       << std::setfill('0') << key << ".rpc-approx.cache";
+  return (fs::path(cache_dir) / name.str()).string();
+}
+
+boost::shared_ptr<vw::camera::CameraModel>
+StereoSession::rpc_approximation(boost::shared_ptr<vw::camera::CameraModel> cam,
+                                 std::string const& image_file,
+                                 std::string const& camera_file) {
+  double max_allowed_error = stereo_settings().rpc_approximation_error;
+  if (max_allowed_error <= 0)
+    return cam;
+
+  // Fit over the part of the image stereo is done in
+  boost::shared_ptr<DiskImageResource> rsrc(DiskImageResourcePtr(image_file));
+  BBox2 image_box(0, 0, rsrc->cols(), rsrc->rows());
+  BBox2i crop_win;
+  if (image_file == m_left_image_file)
+    crop_win = stereo_settings().left_image_crop_win;
+  else if (image_file == m_right_image_file)
+    crop_win = stereo_settings().right_image_crop_win;
+  if (crop_win != BBox2i(0, 0, 0, 0))
+    image_box.crop(crop_win);
+
+  std::string cache_file = rpc_approx_cache_file(image_file, camera_file, image_box);
+  boost::shared_ptr<RPCModel> rpc;
+  if (read_cached_rpc_model(cache_file, rpc)) {
+    vw_out() << "Using the RPC approximation of the camera from: " << cache_file << "\n";
+    return boost::shared_ptr<vw::camera::CameraModel>(new RPCApproxModel(cam, rpc));
+  }
+
+  // ISIS cameras are not thread-safe
+  int num_threads = 0;
+  if (boost::contains(this->name(), "isis"))
+    num_threads = 1;
+
+  vw_out() << "Fitting an RPC approximation to the camera: " << camera_file << "\n";
+  bool use_sphere_for_isis = false;
+  double max_error = 0;
+  int num_samples = 40;
+  double penalty_weight = 0.03;
+  rpc = approximate_camera_with_rpc(cam.get(), this->get_datum(cam.get(), use_sphere_for_isis),
+                                    image_box, stereo_settings().rpc_approximation_height_range,
+                                    num_samples, penalty_weight, max_error, num_threads);
+  if (!rpc) {
+    vw_out(WarningMessage) << "Could not fit an RPC approximation to the camera. "
+                           << "Using the camera itself.\n";
+    return cam;
+  }
+  if (max_error > max_allowed_error) {
+    vw_out(WarningMessage) << "The RPC approximation of the camera is off by up to "
+                           << max_error << " pixels, which is more than "
+                           << max_allowed_error << ". Using the camera itself.\n";
+    return cam;
+  }
+  vw_out() << "The RPC approximation is within " << max_error << " pixels of the camera.\n";
+  write_cached_rpc_model(cache_file, *rpc);
+
+  return boost::shared_ptr<vw::camera::CameraModel>(new RPCApproxModel(cam, rpc));
+}
+
 } // End namespace asp
@@ -32,6 +32,7 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <asp/Core/Common.h>
+#include <asp/Core/ImageStatistics.h>
 #include <asp/Core/StereoSettings.h>
 
 namespace asp {
@@ -41,41 +42,58 @@ namespace asp {
   //TODO: Move this function!
   /// Compute the min, max, mean, and standard deviation of an image object and write them to a log.
   /// - "tag" is only used to make the log messages more descriptive.
+  /// The image is sampled on a grid fine enough for the quantile error in
+  /// stereo_settings(), in tiles processed in parallel with the given
+  /// number of threads, or with the default number if 0.
   template <class ViewT>
-  Vector6f gather_stats( vw::ImageViewBase<ViewT> const& view_base, std::string const& tag) {
+  Vector6f gather_stats( vw::ImageViewBase<ViewT> const& view_base, std::string const& tag,
+                         int num_threads = 0) {
     using namespace vw;
     vw_out(InfoMessage) << "\t--> Computing statistics for " + tag + "\n";
     ViewT image = view_base.impl();
 
     // Compute statistics at a reduced resolution
-    int stat_scale = int(ceil(sqrt(float(image.cols())*float(image.rows()) / 1000000)));
+    int stat_scale
+      = stats_sample_step(image.cols(), image.rows(),
+                          stats_sample_count(stereo_settings().stats_quantile_error));
+    std::vector<float> values;
+    sample_valid_values(image, stat_scale, num_threads, values);
 
-    ChannelAccumulator<vw::math::CDFAccumulator<float> > accumulator;
-    for_each_pixel( subsample( edge_extend(image, ConstantEdgeExtension()),
-			       stat_scale ),
-		    accumulator );
     Vector6f result;
-    result[0] = accumulator.quantile(0); // Min
-    result[1] = accumulator.quantile(1); // Max
-    result[2] = accumulator.approximate_mean();
-    result[3] = accumulator.approximate_stddev();
-    result[4] = accumulator.quantile(0.02); // Percentile values
-    result[5] = accumulator.quantile(0.98);
+    if (values.empty()) {
+      vw_out(WarningMessage) << "No valid pixels found in the " << tag << " image.\n";
+      return result;
+    }
+
+    double sum = 0.0, sum2 = 0.0;
+    for (size_t i = 0; i < values.size(); i++) {
+      sum  += values[i];
+      sum2 += double(values[i])*values[i];
+    }
+    double mean = sum/values.size();
+    double var  = std::max(sum2/values.size() - mean*mean, 0.0);
+
+    result[0] = sample_quantile(values, 0.0); // Min
+    result[1] = sample_quantile(values, 1.0); // Max
+    result[2] = mean;
+    result[3] = sqrt(var);
+    result[4] = sample_quantile(values, 0.02); // Percentile values
+    result[5] = sample_quantile(values, 0.98);
 
     vw_out(InfoMessage) << "\t  " << tag << ": [ lo: " << result[0] << " hi: " << result[1]
 					     << " mean: " << result[2] << " std_dev: "  << result[3] << " ]\n";
     return result;
   }
 
-  //TODO: Move this function!
-  /// Normalize the intensity of two grayscale images based on input statistics
-  template<class ImageT>
-  void normalize_images(bool force_use_entire_range,
-                        bool individually_normalize,
-                        bool use_percentile_stretch,
-                        Vector6f const& left_stats,
-                        Vector6f const& right_stats,
-                        ImageT & Limg, ImageT & Rimg){
+  /// The intensity ranges which normalize_images() stretches to [0, 1]
+  /// for the left and right images.
+  inline void normalization_bounds(bool force_use_entire_range,
+                                   bool individually_normalize,
+                                   bool use_percentile_stretch,
+                                   Vector6f const& left_stats,
+                                   Vector6f const& right_stats,
+                                   double & left_lo,  double & left_hi,
+                                   double & right_lo, double & right_hi){
 
     // These arguments must contain: (min, max, mean, std)
     VW_ASSERT(left_stats.size() == 6 && right_stats.size() == 6,
@@ -87,47 +105,56 @@ namespace asp {
       force_use_entire_range = true;
 
     if ( force_use_entire_range ) { // Stretch between the min and max values
-      if ( individually_normalize ) {
-        vw::vw_out() << "\t--> Individually normalize images to their respective min max\n";
-        Limg = normalize( Limg, left_stats [0], left_stats [1], 0.0, 1.0 );
-        Rimg = normalize( Rimg, right_stats[0], right_stats[1], 0.0, 1.0 );
-      } else { // Normalize using the same stats
-        float low = std::min(left_stats[0], right_stats[0]);
-        float hi  = std::max(left_stats[1], right_stats[1]);
-        vw::vw_out() << "\t--> Normalizing globally to: [" << low << " " << hi << "]\n";
-        Limg = normalize( Limg, low, hi, 0.0, 1.0 );
-        Rimg = normalize( Rimg, low, hi, 0.0, 1.0 );
-      }
-    } else { // Don't force the entire range
-      double left_min, left_max, right_min, right_max;
-      if (use_percentile_stretch) {
-        // Percentile stretch
-        left_min  = left_stats [4];
-        left_max  = left_stats [5];
-        right_min = right_stats[4];
-        right_max = right_stats[5];
-      } else {
-        // Two standard deviation stretch
-        left_min  = left_stats [2] - 2*left_stats [3];
-        left_max  = left_stats [2] + 2*left_stats [3];
-        right_min = right_stats[2] - 2*right_stats[3];
-        right_max = right_stats[2] + 2*right_stats[3];
-      }
-
-      // The images are normalized so most pixels fall into this range,
-      // but the data is not clamped so some pixels can fall outside this range.
-      if ( individually_normalize > 0 ) {
-        vw::vw_out() << "\t--> Individually normalize images\n";
-        Limg = normalize( Limg, left_min,  left_max,  0.0, 1.0 );
-        Rimg = normalize( Rimg, right_min, right_max, 0.0, 1.0 );
-      } else { // Normalize using the same stats
-        float low = std::min(left_min, right_min);
-        float hi  = std::max(left_max, right_max);
-        vw::vw_out() << "\t--> Normalizing globally to: [" << low << " " << hi << "]\n";
-        Limg = normalize( Limg, low, hi, 0.0, 1.0 );
-        Rimg = normalize( Rimg, low, hi, 0.0, 1.0 );
-      }
+      left_lo  = left_stats [0];
+      left_hi  = left_stats [1];
+      right_lo = right_stats[0];
+      right_hi = right_stats[1];
+    } else if (use_percentile_stretch) {
+      // Percentile stretch
+      left_lo  = left_stats [4];
+      left_hi  = left_stats [5];
+      right_lo = right_stats[4];
+      right_hi = right_stats[5];
+    } else {
+      // Two standard deviation stretch
+      left_lo  = left_stats [2] - 2*left_stats [3];
+      left_hi  = left_stats [2] + 2*left_stats [3];
+      right_lo = right_stats[2] - 2*right_stats[3];
+      right_hi = right_stats[2] + 2*right_stats[3];
+    }
+
+    if ( !individually_normalize ) { // Normalize using the same stats
+      float low = std::min(left_lo, right_lo);
+      float hi  = std::max(left_hi, right_hi);
+      left_lo = right_lo = low;
+      left_hi = right_hi = hi;
     }
+  }
+
+  //TODO: Move this function!
+  /// Normalize the intensity of two grayscale images based on input statistics
+  template<class ImageT>
+  void normalize_images(bool force_use_entire_range,
+                        bool individually_normalize,
+                        bool use_percentile_stretch,
+                        Vector6f const& left_stats,
+                        Vector6f const& right_stats,
+                        ImageT & Limg, ImageT & Rimg){
+
+    double left_lo, left_hi, right_lo, right_hi;
+    normalization_bounds(force_use_entire_range, individually_normalize,
+                         use_percentile_stretch, left_stats, right_stats,
+                         left_lo, left_hi, right_lo, right_hi);
+
+    // Unless the entire range is used, the images are normalized so
+    // most pixels fall into this range, but the data is not clamped so
+    // some pixels can fall outside this range.
+    if ( individually_normalize )
+      vw::vw_out() << "\t--> Individually normalize images\n";
+    else
+      vw::vw_out() << "\t--> Normalizing globally to: [" << left_lo << " " << left_hi << "]\n";
+    Limg = normalize( Limg, left_lo,  left_hi,  0.0, 1.0 );
+    Rimg = normalize( Rimg, right_lo, right_hi, 0.0, 1.0 );
     return;
   }
 
@@ -184,6 +211,14 @@ namespace asp {
     camera_model(std::string const& image_file,
 		 std::string const& camera_file = "") = 0;
 
+    /// Replace a camera with an RPC model fit to it, wrapped so that
+    /// only the projection of points into the camera uses the model, if
+    /// --rpc-approximation-error is set and the model is that accurate.
+    /// Otherwise return the camera itself.
+    boost::shared_ptr<vw::camera::CameraModel>
+    rpc_approximation(boost::shared_ptr<vw::camera::CameraModel> cam,
+                      std::string const& image_file, std::string const& camera_file);
+
     /// Method to help determine what session we actually have
     virtual std::string name() const = 0;
 
@@ -283,6 +318,24 @@ namespace asp {
                                    bool                              & has_right_georef,
                                    vw::cartography::GeoReference     & left_georef,
                                    vw::cartography::GeoReference     & right_georef);
+
+    /// All pairs of a multiview run have the same left image. A string
+    /// with everything that goes into its preprocessed version, saved
+    /// in the header of the left output, so that pairs which would
+    /// write the same one can share it.
+    std::string left_image_recipe(std::string const& left_input_file, float left_nodata_value,
+                                  vw::Matrix<double> const& align_left_matrix,
+                                  vw::Vector2i const& left_size,
+                                  double left_lo, double left_hi) const;
+
+    /// In a multiview run, make the left output a link to the left
+    /// output of another pair with the same recipe, if there is one
+    /// done by now. Return true if it was linked.
+    bool link_shared_left_image(std::string const& recipe,
+                                std::string const& left_output_file) const;
+
+    /// The header key with the recipe of the left output
+    static std::string left_image_recipe_key() { return "LEFT_IMAGE_RECIPE"; }
   };
 
 // TODO: Move this function!
@@ -180,8 +180,9 @@ void StereoSessionConcrete<DISKTRANSFORM_TYPE,STEREOMODEL_TYPE>::
 // Code for reading different camera models
 
 // TODO: Move this function somewhere else!
-/// Computes a Map2CamTrans given a DEM, image, and a sensor model.
-inline cartography::Map2CamTrans
+/// Computes a Map2CamTrans given a DEM, image, and a sensor model. It
+/// interpolates into the camera grid saved by mapproject if there is one.
+inline asp::CameraGridTrans
 getTransformFromMapProject(const std::string &input_dem_path,
                            const std::string &img_file_path,
                            boost::shared_ptr<vw::camera::CameraModel> map_proj_model_ptr) {
@@ -195,10 +196,12 @@ getTransformFromMapProject(const std::string &input_dem_path,
 
   bool call_from_mapproject = false;
   DiskImageView<float> img(img_file_path);
-  return cartography::Map2CamTrans(map_proj_model_ptr.get(),
-                                   image_georef, dem_georef, input_dem_path,
-                                   Vector2(img.cols(), img.rows()),
-                                   call_from_mapproject);
+  return asp::CameraGridTrans(cartography::Map2CamTrans(map_proj_model_ptr.get(),
+                                                        image_georef, dem_georef,
+                                                        input_dem_path,
+                                                        Vector2(img.cols(), img.rows()),
+                                                        call_from_mapproject),
+                              img_file_path, input_dem_path);
 }
 
 // Redirect to the correct function depending on the template parameters
@@ -209,10 +212,18 @@ StereoSessionConcrete<DISKTRANSFORM_TYPE,STEREOMODEL_TYPE>::camera_model(std::st
                                                                          std::string const& camera_file) {
   vw_out() << "Loading camera model: " << image_file << ' ' << camera_file << "\n";
 
-  if (camera_file == "") // No camera file provided, use the image file.
-    return load_camera_model(STEREOMODEL_TYPE, image_file, image_file);
-  else // Camera file provided
-    return load_camera_model(STEREOMODEL_TYPE, image_file, camera_file);
+  // If no camera file is provided, use the image file.
+  std::string cam_file = (camera_file == "") ? image_file : camera_file;
+  boost::shared_ptr<vw::camera::CameraModel> cam
+    = load_camera_model(STEREOMODEL_TYPE, image_file, cam_file);
+
+  // Projecting into RPC and pinhole cameras is fast already, and the
+  // ASTER session needs its own camera type.
+  if (STEREOMODEL_TYPE == STEREOMODEL_TYPE_ISIS || STEREOMODEL_TYPE == STEREOMODEL_TYPE_DG ||
+      STEREOMODEL_TYPE == STEREOMODEL_TYPE_SPOT5)
+    cam = this->rpc_approximation(cam, image_file, cam_file);
+
+  return cam;
 }
 
 template <STEREOSESSION_DISKTRANSFORM_TYPE  DISKTRANSFORM_TYPE,
@@ -31,6 +31,7 @@
 #include <asp/Core/AffineEpipolar.h>
 #include <asp/Camera/RPCModel.h>
 #include <asp/Camera/RPC_XML.h>
+#include <asp/Camera/WVCorrect.h>
 
 namespace asp {
 
@@ -102,12 +103,33 @@ namespace asp {
     ImageViewRef< PixelMask<float> > right_masked_image
       = create_mask_less_or_equal(right_disk_image, right_nodata_value);
 
+    // Undo the CCD offsets as the images are read, rather than reading
+    // copies corrected by wv_correct. The offsets depend on the column
+    // in the full image, so account for any crop.
+    if (stereo_settings().wv_correct) {
+      if (this->name() != "dg")
+        vw_throw(ArgumentErr() << "The option --wv-correct can be used only "
+                 << "with the dg session and images which are not map-projected.\n");
+      int tdi;
+      bool is_wv01, is_forward;
+      double pitch_ratio;
+      vw_out() << "\t--> Correcting CCD artifacts.\n";
+      read_wv_correct_params(this->m_left_camera_file, tdi, is_wv01, is_forward, pitch_ratio);
+      left_masked_image = wv_correct(left_masked_image, tdi, is_wv01, is_forward, pitch_ratio,
+                                     stereo_settings().left_image_crop_win.min().x());
+      read_wv_correct_params(this->m_right_camera_file, tdi, is_wv01, is_forward, pitch_ratio);
+      right_masked_image = wv_correct(right_masked_image, tdi, is_wv01, is_forward, pitch_ratio,
+                                      stereo_settings().right_image_crop_win.min().x());
+    }
+
     // Compute input image statistics
     Vector6f left_stats  = gather_stats(left_masked_image,  "left" );
     Vector6f right_stats = gather_stats(right_masked_image, "right");
 
     ImageViewRef< PixelMask<float> > Limg, Rimg;
     std::string lcase_file = boost::to_lower_copy(this->m_left_camera_file);
+    Matrix<double> align_left_matrix = math::identity_matrix<3>();
+    Vector2i left_size = file_image_size(left_cropped_file);
 
     // Image alignment block - Generate aligned versions of the input
     // images according to the options.
@@ -136,10 +158,8 @@ namespace asp {
       ip::read_binary_match_file(match_filename, left_ip, right_ip);
 
       // Initialize alignment matrices and get the input image sizes.
-      Matrix<double> align_left_matrix  = math::identity_matrix<3>(),
-                     align_right_matrix = math::identity_matrix<3>();
-      Vector2i left_size  = file_image_size(left_cropped_file ),
-	             right_size = file_image_size(right_cropped_file);
+      Matrix<double> align_right_matrix = math::identity_matrix<3>();
+      Vector2i right_size = file_image_size(right_cropped_file);
 
       // Compute the appropriate alignment matrix based on the input points
       if ( stereo_settings().alignment_method == "homography" ) {
@@ -187,13 +207,39 @@ namespace asp {
     bool has_nodata = true;
     float output_nodata = -32768.0;
 
+    // The pairs of a multiview run share the left image when it is
+    // preprocessed the same way for each. It is written under another
+    // name first, so that it is never seen half done.
+    double left_lo, left_hi, right_lo, right_hi;
+    normalization_bounds(stereo_settings().force_use_entire_range,
+                         stereo_settings().individually_normalize,
+                         false, left_stats, right_stats,
+                         left_lo, left_hi, right_lo, right_hi);
+    std::map<std::string, std::string> keywords;
+    std::string recipe;
+    if (stereo_settings().part_of_multiview_run) {
+      recipe = this->left_image_recipe(left_input_file, left_nodata_value, align_left_matrix,
+                                       left_size, left_lo, left_hi);
+      keywords[StereoSession::left_image_recipe_key()] = recipe;
+    }
+
     // The left image is written out with no alignment warping.
     vw_out() << "\t--> Writing pre-aligned images.\n";
-    vw_out() << "\t--> Writing: " << left_output_file << ".\n";
-    block_write_gdal_image( left_output_file, apply_mask(Limg, output_nodata),
-			    has_left_georef, left_georef,
-			    has_nodata, output_nodata, options,
-			    TerminalProgressCallback("asp","\t  L:  ") );
+    if (recipe == "" || !this->link_shared_left_image(recipe, left_output_file)) {
+      std::string left_tmp_file = left_output_file;
+      if (recipe != "")
+        left_tmp_file = this->m_out_prefix + "-L-tmp.tif";
+      vw_out() << "\t--> Writing: " << left_output_file << ".\n";
+      block_write_gdal_image( left_tmp_file, apply_mask(Limg, output_nodata),
+			      has_left_georef, left_georef,
+			      has_nodata, output_nodata, options,
+			      TerminalProgressCallback("asp","\t  L:  "), keywords );
+      if (left_tmp_file != left_output_file) {
+        if (boost::filesystem::is_symlink(left_output_file))
+          boost::filesystem::remove(left_output_file);
+        boost::filesystem::rename(left_tmp_file, left_output_file);
+      }
+    }
 
     vw_out() << "\t--> Writing: " << right_output_file << ".\n";
     if ( stereo_settings().alignment_method == "none" )
@@ -49,6 +49,7 @@
 #include <asp/IsisIO/IsisCameraModel.h>
 #include <asp/IsisIO/DiskImageResourceIsis.h>
 #include <asp/IsisIO/Equation.h>
+#include <asp/Camera/RPCApproxModel.h>
 
 
 // Boost
@@ -210,7 +211,8 @@ template <STEREOSESSION_DISKTRANSFORM_TYPE  DISKTRANSFORM_TYPE>
 vw::cartography::Datum StereoSessionIsisBase<DISKTRANSFORM_TYPE>::get_datum(const vw::camera::CameraModel* cam, bool use_sphere_for_isis) const
 {
   const IsisCameraModel * isis_cam
-    = dynamic_cast<const IsisCameraModel*>(vw::camera::unadjusted_model(cam));
+    = dynamic_cast<const IsisCameraModel*>
+    (vw::camera::unadjusted_model(asp::exact_camera_model(cam)));
   VW_ASSERT(isis_cam != NULL, ArgumentErr() << "StereoSessionISIS: Invalid left camera.\n");
   Vector3 radii = isis_cam->target_radii();
   double radius1 = (radii[0] + radii[1]) / 2;
@@ -436,17 +438,18 @@ template <STEREOSESSION_DISKTRANSFORM_TYPE  DISKTRANSFORM_TYPE>
 ImageViewRef<PixelMask<Vector2f> > StereoSessionIsisBase<DISKTRANSFORM_TYPE>
 ::pre_pointcloud_hook(std::string const& input_file) {
 
-  std::string dust_result = input_file;
   if ( stereo_settings().mask_flatfield ) {
     // ****************************************************
     // The following code is for Apollo Metric Camera ONLY!
     // (use at your own risk)
     // ****************************************************
+    // The dust is masked as each tile is triangulated, rather than
+    // written to a file first.
     vw_out() << "\t--> Masking pixels that appear to be dust.  (NOTE: Use this option with Apollo Metric Camera frames only!)\n";
-    photometric_outlier_rejection(this->m_options, this->m_out_prefix, input_file,
-				  dust_result, stereo_settings().corr_kernel[0]);
+    return photometric_outlier_view(this->m_out_prefix, input_file,
+                                    stereo_settings().corr_kernel[0]);
   }
-  return DiskImageView<PixelMask<Vector2f> >(dust_result);
+  return DiskImageView<PixelMask<Vector2f> >(input_file);
 } // End function pre_pointcloud_hook(
 
 
@@ -21,6 +21,7 @@
 
 #include <asp/Sessions/StereoSessionPinhole.h>
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Camera/LensLookupModel.h>
 
 #include <vw/Math/BBox.h>
 #include <vw/Math/Geometry.h>
@@ -86,7 +87,7 @@ asp::StereoSessionPinhole::determine_image_align(std::string const& out_prefix,
   try {
 
     double ip_inlier_factor = stereo_settings().ip_inlier_factor; // default is 1/15
-    vw::math::RandomSampleConsensus<vw::math::HomographyFittingFunctor,       
+    asp::ParallelRandomSampleConsensus<vw::math::HomographyFittingFunctor,       
       vw::math::InterestPointErrorMetric> ransac( vw::math::HomographyFittingFunctor(), 
                                                   vw::math::InterestPointErrorMetric(),
                                                   100, // number of iterations
@@ -234,6 +235,22 @@ void asp::StereoSessionPinhole::pre_preprocessing_hook(bool adjust_left_image_si
 
 namespace asp {
 
+// Load a pinhole camera, with its lens distortion tabulated if
+// --lens-lookup-table-spacing is set. The camera sees the pixels of a
+// cropped image shifted by the offset, so the table covers those.
+boost::shared_ptr<vw::camera::CameraModel>
+load_pinhole_lens_lookup(std::string const& image_file, std::string const& camera_file,
+                         vw::Vector2 const& pixel_offset) {
+  boost::shared_ptr<vw::camera::CameraModel> cam
+    = vw::camera::load_pinhole_camera_model(camera_file);
+  if (stereo_settings().lens_lookup_table_spacing <= 0)
+    return cam;
+
+  vw::Vector2i offset(floor(pixel_offset[0]), floor(pixel_offset[1]));
+  vw::BBox2i image_box(offset, offset + file_image_size(image_file) + vw::Vector2i(1, 1));
+  return lens_lookup_model(cam, image_box, stereo_settings().lens_lookup_table_spacing,
+                           stereo_settings().lens_lookup_table_error);
+}
 
 void asp::StereoSessionPinhole::get_unaligned_camera_models(
                                  boost::shared_ptr<vw::camera::CameraModel> &left_cam,
@@ -246,9 +263,11 @@ void asp::StereoSessionPinhole::get_unaligned_camera_models(
                                                        m_right_image_file, m_right_image_file);
 
   // Load the camera models adjusted for cropping
-  left_cam  = load_adjusted_model(vw::camera::load_pinhole_camera_model(m_left_camera_file),
+  left_cam  = load_adjusted_model(load_pinhole_lens_lookup(m_left_image_file, m_left_camera_file,
+                                                           left_pixel_offset),
                                   m_left_image_file, m_left_camera_file, left_pixel_offset);
-  right_cam = load_adjusted_model(vw::camera::load_pinhole_camera_model(m_right_camera_file),
+  right_cam = load_adjusted_model(load_pinhole_lens_lookup(m_right_image_file, m_right_camera_file,
+                                                           right_pixel_offset),
                                   m_right_image_file, m_right_camera_file, right_pixel_offset);                                 
 }
 
@@ -269,7 +288,7 @@ load_adj_pinhole_model(std::string const& image_file,       std::string const& c
 
   if ( stereo_settings().alignment_method != "epipolar" ) {
     // Not epipolar, just load the camera model.
-    return load_adjusted_model(vw::camera::load_pinhole_camera_model(camera_file),
+    return load_adjusted_model(load_pinhole_lens_lookup(image_file, camera_file, pixel_offset),
                                image_file, camera_file, pixel_offset);
   }
   // Otherwise handle the epipolar case
@@ -24,13 +24,17 @@
 #include "SpiceUsr.h"
 #include "SpiceZfc.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <fstream>
 #include <list>
+#include <set>
 #include <string>
 
 #include <vw/Core/Exception.h>
 #include <vw/Core/Debugging.h>
+#include <vw/Core/Thread.h>
 
 #include <string.h>
 
@@ -186,10 +190,13 @@ namespace spice {
     velocity.resize(number_of_samples);
     pose.resize(number_of_samples);
 
-    unsigned int interval_count = 0;
-    for( SpiceDouble time = begin_time;
-         time < end_time;
-         time += interval ) {
+    // Count the samples rather than accumulate the time, as the sum
+    // of the intervals can fall short of end_time by rounding and
+    // give one sample more than was allocated.
+    for (unsigned int interval_count = 0; interval_count < number_of_samples;
+         interval_count++) {
+      SpiceDouble time = begin_time + interval_count * interval;
+
       // Obtain the state vector of the spacecraft at the given
       // ephemeris time.
       //
@@ -225,7 +232,6 @@ namespace spice {
       SpiceDouble quaternion[4];
       m2q_c( rotation_matrix, quaternion );
       pose[interval_count] = Quat(quaternion[0],quaternion[1],quaternion[2],quaternion[3]);
-      interval_count++;
     }
 
     CHECK_SPICE_ERROR();
@@ -244,12 +250,22 @@ namespace spice {
     char set[] = "SET", ret[] = "RETURN";
     erract_c (  set, lenout, ret  );
 
-    // Load the kernels
+    // Load the kernels. SPICE keeps them loaded for the life of the
+    // process, so a kernel which was loaded already, for example for
+    // another image from the same mission, is not loaded again. That
+    // would only read it once more and add it to the list SPICE
+    // searches.
+    static std::set<std::string> loaded_kernels;
+    static vw::Mutex loaded_kernels_mutex;
+    vw::Mutex::Lock lock(loaded_kernels_mutex);
     list<string>::iterator iter;
-    for (iter = kernels.begin(); iter != kernels.end(); iter++)
+    for (iter = kernels.begin(); iter != kernels.end(); iter++) {
+      if (loaded_kernels.count(*iter) > 0)
+        continue;
       furnsh_c( (*iter).c_str() );
-
-    CHECK_SPICE_ERROR();
+      CHECK_SPICE_ERROR();
+      loaded_kernels.insert(*iter);
+    }
   }
 
   // This variant reads a file containing a list of kernel files,
@@ -274,4 +290,61 @@ namespace spice {
     load_kernels(kernel_list);
   }
 
+  EphemerisTable::EphemerisTable(double begin_time, double end_time, double interval,
+                                 std::string const& spacecraft,
+                                 std::string const& reference_frame,
+                                 std::string const& planet,
+                                 std::string const& instrument):
+    m_begin_time(begin_time), m_interval(interval) {
+
+    if (interval <= 0 || end_time <= begin_time)
+      vw_throw(ArgumentErr() << "EphemerisTable: Invalid time range or interval.");
+
+    // Sample one interval past the end, so that end_time is covered
+    body_state(begin_time, end_time + interval, interval,
+               m_position, m_velocity, m_pose,
+               spacecraft, reference_frame, planet, instrument);
+    if (m_position.size() < 2)
+      vw_throw(ArgumentErr() << "EphemerisTable: Need at least two samples.");
+  }
+
+  double EphemerisTable::end_time() const {
+    return m_begin_time + (m_position.size() - 1) * m_interval;
+  }
+
+  bool EphemerisTable::contains(double time) const {
+    return time >= m_begin_time && time <= end_time();
+  }
+
+  void EphemerisTable::locate(double time, int & index, double & alpha) const {
+    if (!contains(time))
+      vw_throw(ArgumentErr() << "EphemerisTable: Time " << time
+               << " is out of the range " << m_begin_time << " to " << end_time() << ".");
+    double offset = (time - m_begin_time) / m_interval;
+    index = std::min(int(floor(offset)), int(m_position.size()) - 2);
+    alpha = offset - index;
+  }
+
+  Vector3 EphemerisTable::position(double time) const {
+    int i; double s;
+    locate(time, i, s);
+    double s2 = s*s, s3 = s2*s;
+    return ( 2*s3 - 3*s2 + 1) * m_position[i]
+         + (   s3 - 2*s2 + s) * m_interval * m_velocity[i]
+         + (-2*s3 + 3*s2    ) * m_position[i+1]
+         + (   s3 -   s2    ) * m_interval * m_velocity[i+1];
+  }
+
+  Vector3 EphemerisTable::velocity(double time) const {
+    int i; double s;
+    locate(time, i, s);
+    return (1 - s) * m_velocity[i] + s * m_velocity[i+1];
+  }
+
+  Quat EphemerisTable::pose(double time) const {
+    int i; double s;
+    locate(time, i, s);
+    return vw::math::slerp(s, m_pose[i], m_pose[i+1], 0);
+  }
+
 }} // namespace asp::spice
@@ -69,6 +69,41 @@ namespace spice {
                   std::string const& planet,
                   std::string const& instrument);
 
+  /// The position, velocity and pose of a body sampled once over a
+  /// time range, such as the time an image was acquired, so that they
+  /// can be looked up at many times without querying SPICE each time.
+  /// Between the samples the position is interpolated with a cubic
+  /// Hermite polynomial using the velocity, which for a smooth orbit
+  /// is much more accurate than linear interpolation, the velocity
+  /// linearly, and the pose with slerp.
+  class EphemerisTable {
+  public:
+    EphemerisTable(double begin_time, double end_time, double interval,
+                   std::string const& spacecraft,
+                   std::string const& reference_frame,
+                   std::string const& planet,
+                   std::string const& instrument);
+
+    double begin_time() const { return m_begin_time; }
+    double end_time  () const;
+
+    /// If the time is in the range covered by the samples.
+    bool contains(double time) const;
+
+    vw::Vector3            position(double time) const;
+    vw::Vector3            velocity(double time) const;
+    vw::Quaternion<double> pose    (double time) const;
+
+  private:
+    /// The index of the sample at or before the time, and the fraction
+    /// of the way to the next one.
+    void locate(double time, int & index, double & alpha) const;
+
+    double m_begin_time, m_interval;
+    std::vector<vw::Vector3>            m_position, m_velocity;
+    std::vector<vw::Quaternion<double> > m_pose;
+  };
+
 }} // namespace asp::spice
 
 #endif // __SPICE_H__
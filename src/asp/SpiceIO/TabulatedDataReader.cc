@@ -25,8 +25,6 @@
 
 using namespace std;
 
-#define LINE_MAXSIZE 4096
-
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 /*               TabulatedDataReader Class Methods               */
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
@@ -43,41 +41,34 @@ namespace spice {
     if ( !m_file.is_open() ) {
       throw vw::IOErr() << "Failed to open tabulated data record: " << filename << ".";
     }
+
+    std::string line;
+    while (std::getline(m_file, line))
+      m_lines.push_back(line);
+    close();
   }
 
 
   // Returns 1 on success, 0 on failure
   int TabulatedDataReader::find_line_with_text(std::string query,
                                                std::vector<std::string> &result) {
-    // Reset file pointer to the top of the file
-    m_file.seekg(0);
 
-    int found = 0;
-    char line[LINE_MAXSIZE];
-
-    // Read through the lines until the search returns a match
-    while ( !found && !m_file.eof() ) {
-      m_file.getline(line, LINE_MAXSIZE);
+    // Search through the lines until one matches
+    for (size_t i = 0; i < m_lines.size(); i++) {
 
       // If the text is found, cut up this line using the delimeters
       // and return true.
-      if(boost::find_first(line, query)) {
-        string str_line(line);
+      if (boost::find_first(m_lines[i], query)) {
+        string const& str_line = m_lines[i];
         cout << str_line << endl;
         boost::split( result, str_line, boost::is_any_of(m_delimeters) );
-        vector<string>::iterator iter = result.begin();
-
-        //      unsigned int c = 0;
-        for (iter = result.begin(); iter != result.end(); iter++) {
+        for (vector<string>::iterator iter = result.begin(); iter != result.end(); iter++)
           boost::trim(*iter);
-          //      cout << c << ":   " << *iter << "\n";
-          //      c++;
-        }
-        found = 1;
+        return 1;
       }
     }
 
-    return found;
+    return 0;
   }
 
 }} //end namespace asp::spice
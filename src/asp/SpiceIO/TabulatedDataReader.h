@@ -27,6 +27,8 @@
 namespace asp {
 namespace spice {
 
+  /// The whole file is read when the reader is created, so each
+  /// query searches the lines in memory rather than the file.
   class TabulatedDataReader {
   public:
     /* Constructor / Destructor */
@@ -47,6 +49,7 @@ namespace spice {
     std::string m_delimeters;
 
     std::ifstream m_file;
+    std::vector<std::string> m_lines;
   };
 
 }} // end namespace asp::spice
@@ -35,6 +35,8 @@
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Math.h>
 #include <vw/Core/StringUtils.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Image.h>
 #include <vw/Cartography/Datum.h>
 #include <vw/Cartography/GeoReference.h>
@@ -49,6 +51,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/program_options.hpp>
+#include <boost/noncopyable.hpp>
 
 namespace fs = boost::filesystem;
 namespace po = boost::program_options;
@@ -263,14 +266,22 @@ public:
 
     ImageView<input_type> input_tile = crop(m_img, bbox); // to speed things up
     ImageView<result_type> tile(bbox.width(), bbox.height());
-    for (int col = bbox.min().x(); col < bbox.max().x(); col++){
-      Vector3 C = m_corr[col];
-      for (int row = bbox.min().y(); row < bbox.max().y(); row++){
-	input_type val = input_tile(col - bbox.min().x(), row - bbox.min().y());
+
+    // The correction depends only on the column. Find it once per
+    // column, then go through the tile in memory order.
+    std::vector<double> gain(bbox.width()), offset(bbox.width());
+    for (int col = 0; col < bbox.width(); col++){
+      Vector3 const& C = m_corr[col + bbox.min().x()];
+      gain[col]   = C[1] / C[2];
+      offset[col] = C[0];
+    }
+    for (int row = 0; row < bbox.height(); row++){
+      for (int col = 0; col < bbox.width(); col++){
+	input_type val = input_tile(col, row);
 	if (m_has_nodata && val == m_nodata)
-	  tile(col - bbox.min().x(), row - bbox.min().y() ) = val;
+	  tile(col, row) = val;
 	else
-	  tile(col - bbox.min().x(), row - bbox.min().y() ) = C[1] * val / C[2] + C[0];
+	  tile(col, row) = gain[col] * val + offset[col];
       }
     }
     
@@ -335,6 +346,55 @@ void apply_radiometric_corrections(Options const& opt,
 			      TerminalProgressCallback("asp", "\t-->: "));
 }
 
+// Find the points at one height above the datum along the rays from
+// the satellite to the lattice ground points. Each such layer writes
+// its own part of the output arrays, so the layers can be done in parallel.
+class HeightLayerTask: public vw::Task, private boost::noncopyable {
+  int m_sample;
+  double m_height;
+  cartography::Datum const& m_datum;
+  std::vector<Vector3> const& m_ground_xyz;
+  std::vector<Vector3> const& m_sat_pos;
+  std::vector<Vector2> const& m_pixels;
+  std::vector<Vector3> & m_all_llh;
+  std::vector<Vector2> & m_all_pixels;
+public:
+  HeightLayerTask(int sample, double height, cartography::Datum const& datum,
+                  std::vector<Vector3> const& ground_xyz,
+                  std::vector<Vector3> const& sat_pos,
+                  std::vector<Vector2> const& pixels,
+                  std::vector<Vector3> & all_llh,
+                  std::vector<Vector2> & all_pixels):
+    m_sample(sample), m_height(height), m_datum(datum), m_ground_xyz(ground_xyz),
+    m_sat_pos(sat_pos), m_pixels(pixels), m_all_llh(all_llh), m_all_pixels(all_pixels) {}
+
+  void operator()() {
+    int num_pts = m_ground_xyz.size();
+    int count   = m_sample*num_pts;
+
+    // Find an xyz position at roughly that height on the line
+    // connecting the original ground point and the satellite
+    // center. We need to solve a quadratic equation for that. We
+    // assume the Earth is a sphere.
+    for (int pt = 0; pt < num_pts; pt++) {
+
+      Vector3 A = m_ground_xyz[pt];
+      Vector3 B = m_sat_pos[pt];
+      Vector3 D = B - A;
+
+      // Find t such that norm(A + t*D) = norm(A) + height
+      double  d = dot_prod(A, D) * dot_prod(A, D)
+        + dot_prod(D, D) * (m_height*m_height + 2*norm_2(A)*m_height);
+      double  t = ( -dot_prod(A, D) + sqrt(d) ) / dot_prod(D, D);
+      Vector3 P = A + t*D;
+
+      m_all_llh[count]    = m_datum.cartesian_to_geodetic(P);
+      m_all_pixels[count] = m_pixels[pt];
+      count++;
+    }
+  }
+};
+
 // Generate lon-lat-height to image pixel correspondences that we will
 // use to create the RPC model.
 void generate_point_pairs(// Inputs
@@ -441,32 +501,16 @@ void generate_point_pairs(// Inputs
   int num_total_pts = num_pts*num_samples;
   std::vector<Vector3> all_llh (num_total_pts);
   std::vector<Vector2> all_pixels(num_total_pts);
-  count = 0;
+  vw::FifoWorkQueue queue(vw_settings().default_num_threads());
   for (int sample = 0; sample < num_samples; sample++) {
     double height = min_height
       + double(sample)*(max_height - min_height)/(num_samples - 1.0);
-
-    // Find an xyz position at roughly that height on the line
-    // connecting the original ground point and the satellite
-    // center. We need to solve a quadratic equation for that. We
-    // assume the Earth is a sphere.
-    for (int pt = 0; pt < num_pts; pt++) {
-
-      Vector3 A = ground_xyz[pt]; 
-      Vector3 B = full_sat_pos[pt];
-      Vector3 D = B - A;
-
-      // Find t such that norm(A + t*D) = norm(A) + height
-      double  d = dot_prod(A, D) * dot_prod(A, D)
-        + dot_prod(D, D) * (height*height + 2*norm_2(A)*height);
-      double  t = ( -dot_prod(A, D) + sqrt(d) ) / dot_prod(D, D);
-      Vector3 P = A + t*D;
-
-      all_llh[count]  = datum.cartesian_to_geodetic(P);
-      all_pixels[count] = pixels[pt];
-      count++;
-    }
+    boost::shared_ptr<HeightLayerTask>
+      task(new HeightLayerTask(sample, height, datum, ground_xyz, full_sat_pos,
+                               pixels, all_llh, all_pixels));
+    queue.add_task(task);
   }
+  queue.join_all();
   
   // Find the range of lon-lat-heights
   BBox3 llh_box;
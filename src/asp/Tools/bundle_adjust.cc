@@ -21,6 +21,8 @@
 
 #include <vw/FileIO/KML.h>
 #include <vw/Camera/CameraUtilities.h>
+#include <vw/Cartography/CameraBBox.h>
+#include <vw/Core/ThreadPool.h>
 #include <asp/Core/Macros.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Sessions/StereoSessionFactory.h>
@@ -30,6 +32,8 @@
 #include <asp/Core/InterestPointMatching.h>
 #include <xercesc/util/PlatformUtils.hpp>
 #include <asp/Core/EigenUtils.h>
+#include <asp/Core/Checkpoint.h>
+#include <asp/Core/TiledDem.h>
 
 // Turn off warnings from eigen
 #if defined(__GNUC__) || defined(__GNUG__)
@@ -95,7 +99,7 @@ size_t filter_ip_homog(std::vector<ip::InterestPoint> const& ip1_in,
     std::vector<Vector3> ransac_ip1 = iplist_to_vectorlist(ip1_in),
                          ransac_ip2 = iplist_to_vectorlist(ip2_in);
   
-    typedef math::RandomSampleConsensus<math::HomographyFittingFunctor, math::InterestPointErrorMetric> RansacT;
+    typedef asp::ParallelRandomSampleConsensus<math::HomographyFittingFunctor, math::InterestPointErrorMetric> RansacT;
     const int    MIN_NUM_OUTPUT_INLIERS = ransac_ip1.size()/2;
     const int    NUM_ITERATIONS         = 100;
     RansacT ransac( math::HomographyFittingFunctor(),
@@ -256,7 +260,7 @@ double calc_ip_coverage_fraction(std::vector<ip::InterestPoint> const& ip,
 struct Options : public vw::cartography::GdalWriteOptions {
   std::vector<std::string> image_files, camera_files, gcp_files;
   std::string cnet_file, out_prefix, input_prefix, stereo_session_string,
-    cost_function, ba_type, mapprojected_data, gcp_data;
+    cost_function, ba_type, mapprojected_data, gcp_data, linear_solver;
   int    ip_per_tile, ip_edge_buffer_percent;
   double min_triangulation_angle, lambda, camera_weight, rotation_weight, 
     translation_weight, overlap_exponent, robust_threshold, parameter_tolerance;
@@ -266,7 +270,11 @@ struct Options : public vw::cartography::GdalWriteOptions {
          disable_tri_filtering, ip_normalize_tiles, ip_debug_images;
   std::string datum_str, camera_position_file, initial_transform_file,
     csv_format_str, csv_proj4_str, reference_terrain, disparity_list, intrinsics_to_float_str,
-    heights_from_dem;
+    heights_from_dem, ip_cache_dir;
+  double lens_lookup_table_spacing, lens_lookup_table_error;
+  int    num_parallel_matches, num_new_images, checkpoint_interval;
+  bool   resume;
+  bool   skip_disjoint_footprints, warm_start_passes;
   double semi_major, semi_minor, position_filter_dist;
   int num_ba_passes, max_num_reference_points;
   std::string remove_outliers_params_str;
@@ -295,6 +303,9 @@ struct Options : public vw::cartography::GdalWriteOptions {
              robust_threshold(0), report_level(0), min_matches(0),
              max_iterations(0), overlap_limit(0), save_iteration(false),
              create_pinhole(false), fix_gcp_xyz(false), solve_intrinsics(false),
+             lens_lookup_table_spacing(0), lens_lookup_table_error(0),
+             num_parallel_matches(0), num_new_images(0), checkpoint_interval(0), resume(false),
+             skip_disjoint_footprints(false), warm_start_passes(false),
              semi_major(0), semi_minor(0), position_filter_dist(-1),
              num_ba_passes(1), max_num_reference_points(-1),
              datum(cartography::Datum(UNSPECIFIED_DATUM, "User Specified Spheroid",
@@ -323,12 +334,16 @@ update_cnet_and_init_cams(ModelT & ba_model, Options & opt,
   if (opt.initial_transform_file != "")
     ba_model.import_transform(opt.initial_transform, cameras_vec);
 
-  // Read the adjustments from a previous run
+  // Read the adjustments from a previous run. In incremental mode the
+  // new images may not have any yet.
   if (opt.input_prefix != "") {
+    size_t num_old_cameras = ba_model.num_cameras() - opt.num_new_images;
     for (size_t icam = 0; icam < ba_model.num_cameras(); icam++){
       std::string adjust_file = asp::bundle_adjust_file_name(opt.input_prefix,
                                                              opt.image_files[icam],
                                                              opt.camera_files[icam]);
+      if (icam >= num_old_cameras && !fs::exists(adjust_file))
+        continue;
 
       ba_model.read_adjustment(icam, adjust_file, cameras_vec);
     }
@@ -466,6 +481,138 @@ struct BaReprojectionError {
   size_t m_icam, m_ipt;
 };
 
+/// The same residual as BaReprojectionError, but with the Jacobian
+/// computed here rather than by ceres::NumericDiffCostFunction. For
+/// both BA models the projected pixel depends on the camera position
+/// parameters and on the point only through their difference, so the
+/// position part of the Jacobian is the negative of the point part and
+/// needs no projections. The point and rotation parts use central
+/// differences with the same step sizes as Ceres would. That is 13
+/// projections per evaluation instead of 19.
+template<class ModelT>
+class BaReprojectionJacobianError:
+  public ceres::SizedCostFunction<2, ModelT::camera_params_n, ModelT::point_params_n> {
+public:
+  BaReprojectionJacobianError(Vector2 const& observation, Vector2 const& pixel_sigma,
+                              ModelT * const ba_model, size_t icam, size_t ipt):
+    m_observation(observation),
+    m_pixel_sigma(pixel_sigma),
+    m_ba_model(ba_model),
+    m_icam(icam), m_ipt(ipt){}
+
+  virtual bool Evaluate(double const* const* parameters,
+                        double* residuals,
+                        double** jacobians) const {
+
+    const int ncp = ModelT::camera_params_n;
+    const int npp = ModelT::point_params_n;
+    const int num_pos = ncp/2; // the position comes first, then the rotation
+
+    try{
+
+      VW_ASSERT(m_icam < m_ba_model->num_cameras(),
+                ArgumentErr() << "Out of bounds in the number of cameras.");
+      VW_ASSERT(m_ipt  < m_ba_model->num_points(),
+                ArgumentErr() << "Out of bounds in the number of points." );
+
+      typename ModelT::camera_vector_t cam_vec;
+      for (int c = 0; c < ncp; c++)
+        cam_vec[c] = parameters[0][c];
+      typename ModelT::point_vector_t  point_vec;
+      for (int p = 0; p < npp; p++)
+        point_vec[p] = parameters[1][p];
+
+      Vector2 prediction = m_ba_model->cam_pixel(m_ipt, m_icam, cam_vec, point_vec);
+      residuals[0] = (prediction[0] - m_observation[0])/m_pixel_sigma[0];
+      residuals[1] = (prediction[1] - m_observation[1])/m_pixel_sigma[1];
+
+      if (jacobians == NULL || (jacobians[0] == NULL && jacobians[1] == NULL))
+        return true;
+
+      // The Jacobians are row-major, with one row per residual
+      double point_jac[2][ModelT::point_params_n];
+      for (int p = 0; p < npp; p++) {
+        double h = step_size(point_vec[p]);
+        typename ModelT::point_vector_t plus = point_vec, minus = point_vec;
+        plus[p] += h;
+        minus[p] -= h;
+        Vector2 diff = m_ba_model->cam_pixel(m_ipt, m_icam, cam_vec, plus)
+          - m_ba_model->cam_pixel(m_ipt, m_icam, cam_vec, minus);
+        point_jac[0][p] = diff[0]/(2*h*m_pixel_sigma[0]);
+        point_jac[1][p] = diff[1]/(2*h*m_pixel_sigma[1]);
+      }
+
+      if (jacobians[1] != NULL) {
+        for (int r = 0; r < 2; r++)
+          for (int p = 0; p < npp; p++)
+            jacobians[1][r*npp + p] = point_jac[r][p];
+      }
+
+      if (jacobians[0] != NULL) {
+        for (int r = 0; r < 2; r++)
+          for (int c = 0; c < num_pos; c++)
+            jacobians[0][r*ncp + c] = -point_jac[r][c];
+
+        for (int c = num_pos; c < ncp; c++) {
+          double h = step_size(cam_vec[c]);
+          typename ModelT::camera_vector_t plus = cam_vec, minus = cam_vec;
+          plus[c] += h;
+          minus[c] -= h;
+          Vector2 diff = m_ba_model->cam_pixel(m_ipt, m_icam, plus,  point_vec)
+            - m_ba_model->cam_pixel(m_ipt, m_icam, minus, point_vec);
+          jacobians[0][c]       = diff[0]/(2*h*m_pixel_sigma[0]);
+          jacobians[0][ncp + c] = diff[1]/(2*h*m_pixel_sigma[1]);
+        }
+      }
+
+    } catch (std::exception const& e) {
+      // Failed to compute residuals
+
+      Mutex::Lock lock( g_ba_mutex );
+      g_ba_num_errors++;
+      if (g_ba_num_errors < 100) {
+        vw_out(ErrorMessage) << e.what() << std::endl;
+      }else if (g_ba_num_errors == 100) {
+        vw_out() << "Will print no more error messages about "
+                 << "failing to compute residuals.\n";
+      }
+
+      residuals[0] = 1e+20;
+      residuals[1] = 1e+20;
+      return false;
+    }
+
+    return true;
+  }
+
+  // Factory to hide the construction of the CostFunction object from
+  // the client code.
+  static ceres::CostFunction* Create(Vector2 const& observation,
+                                     Vector2 const& pixel_sigma,
+                                     ModelT * const ba_model,
+                                     size_t icam, // camera index
+                                     size_t ipt // point index
+                                     ){
+    VW_ASSERT(ModelT::camera_params_n == 6 && ModelT::point_params_n == 3,
+              LogicErr() << "Expecting a position and a rotation for each camera.");
+    return new BaReprojectionJacobianError(observation, pixel_sigma, ba_model, icam, ipt);
+  }
+
+private:
+
+  // The step ceres::NumericDiffCostFunction uses by default
+  static double step_size(double x) {
+    const double relative_step_size = 1e-6;
+    double h = std::abs(x) * relative_step_size;
+    return (h == 0.0) ? relative_step_size : h;
+  }
+
+  Vector2 m_observation;
+  Vector2 m_pixel_sigma;
+  ModelT * const m_ba_model;
+  size_t m_icam, m_ipt;
+};
+
 /// A ceres cost function. Here we float a pinhole camera's intrinsic
 /// and extrinsic parameters. The result is the residual, the
 /// difference in the observation and the projection of the point into
@@ -1123,8 +1270,8 @@ void add_residual_block(ModelT & ba_model,
                         ceres::Problem & problem){
 
   ceres::CostFunction* cost_function =
-    BaReprojectionError<ModelT>::Create(observation, pixel_sigma,
-                                        &ba_model, icam, ipt);
+    BaReprojectionJacobianError<ModelT>::Create(observation, pixel_sigma,
+                                                &ba_model, icam, ipt);
   problem.AddResidualBlock(cost_function, loss_function, camera, point);
 }
 
@@ -1141,8 +1288,8 @@ void add_residual_block<BAPinholeModel>
   // If the intrinsics are constant use the default method above
   if (ba_model.are_intrinsics_constant()) {
     ceres::CostFunction* cost_function =
-      BaReprojectionError<BAPinholeModel>::Create(observation, pixel_sigma,
-                                                  &ba_model, icam, ipt);
+      BaReprojectionJacobianError<BAPinholeModel>::Create(observation, pixel_sigma,
+                                                          &ba_model, icam, ipt);
     problem.AddResidualBlock(cost_function, loss_function, camera, point);
   }
   else {
@@ -1314,10 +1461,7 @@ void compute_residuals(bool apply_loss_function,
   double cost = 0;
   ceres::Problem::EvaluateOptions eval_options;
   eval_options.apply_loss_function = apply_loss_function;
-  if (opt.stereo_session_string == "isis")
-    eval_options.num_threads = 1;
-  else
-    eval_options.num_threads = opt.num_threads;
+  eval_options.num_threads = opt.num_threads;
   problem.Evaluate(eval_options, &cost, &residuals, 0, 0);
   const size_t num_residuals = residuals.size();
   
@@ -1672,31 +1816,246 @@ void record_points_to_kml(const std::string &kml_path, const cartography::Datum&
 }
 
 
-void create_interp_dem(std::string & dem_file,
-                       vw::cartography::GeoReference & dem_georef,
-                       ImageViewRef< PixelMask<double> > & interp_dem){
-  
+/// Open a DEM for height lookups. It is read a tile at a time, only
+/// where it is queried.
+boost::shared_ptr<asp::TiledDem> load_dem(std::string const& dem_file){
+
   vw_out() << "Loading DEM: " << dem_file << std::endl;
-  double nodata_val = -std::numeric_limits<float>::max(); // note we use a float nodata
+  boost::shared_ptr<asp::TiledDem> dem(new asp::TiledDem(dem_file));
+  double nodata_val = -std::numeric_limits<float>::max();
   if (vw::read_nodata_val(dem_file, nodata_val)){
     vw_out() << "Found DEM nodata value: " << nodata_val << std::endl;
   }
-  
-  ImageView< PixelMask<double> > dem = create_mask(DiskImageView<double>(dem_file), nodata_val);
-  
-  interp_dem = interpolate(dem, BilinearInterpolation(), ConstantEdgeExtension());
-  bool is_good = vw::cartography::read_georeference(dem_georef, dem_file);
-  if (!is_good) {
-    vw_throw(ArgumentErr() << "Error: Cannot read georeference from DEM: "
-             << dem_file << ".\n");
+  return dem;
+}
+
+/// Choose the Ceres linear solver. The points are always eliminated
+/// first, so that only the reduced camera system has to be solved.
+void set_linear_solver(Options const& opt,
+                       CameraRelationNetwork<JFeature> & crn,
+                       std::set<int> const& outlier_xyz,
+                       int num_camera_params, int num_point_params,
+                       int num_points, double * points,
+                       ceres::Problem & problem,
+                       ceres::Solver::Options & options) {
+
+  int num_cameras = crn.size();
+  std::string solver = opt.linear_solver;
+  if (solver == "auto") {
+
+    // Set solver options according to the recommendations in the Ceres solving FAQs
+    solver = "sparse_schur";
+    if (num_cameras < 100)
+      solver = "dense_schur";
+    if (num_cameras > 3500)
+      solver = "iterative_schur";
+
+    // The reduced camera matrix has a block for each camera and for each
+    // pair of cameras which see the same point. The sparse factorization
+    // of that matrix needs several times its size. If that would be too
+    // much, avoid forming it.
+    if (solver == "sparse_schur") {
+      const double MAX_SCHUR_BYTES = 1024.0*1024.0*1024.0;
+      const double FILL_IN_FACTOR  = 4.0;
+      typedef CameraNode<JFeature>::iterator crn_iter;
+      std::vector< std::vector<int> > point_cams(num_points);
+      for (int icam = 0; icam < num_cameras; icam++) {
+        for (crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++) {
+          int ipt = (**fiter).m_point_id;
+          if (outlier_xyz.find(ipt) == outlier_xyz.end())
+            point_cams[ipt].push_back(icam);
+        }
+      }
+      std::set< std::pair<int, int> > cam_pairs;
+      for (int ipt = 0; ipt < num_points; ipt++) {
+        for (size_t a = 0; a < point_cams[ipt].size(); a++)
+          for (size_t b = a+1; b < point_cams[ipt].size(); b++)
+            cam_pairs.insert(std::make_pair(std::min(point_cams[ipt][a], point_cams[ipt][b]),
+                                            std::max(point_cams[ipt][a], point_cams[ipt][b])));
+      }
+      double schur_bytes = FILL_IN_FACTOR * (num_cameras + 2.0*cam_pairs.size())
+        * num_camera_params * num_camera_params * sizeof(double);
+      vw_out() << "Camera pairs with shared points: " << cam_pairs.size() << "\n";
+      if (schur_bytes > MAX_SCHUR_BYTES)
+        solver = "iterative_schur";
+    }
   }
+
+  if (solver == "dense_schur") {
+    options.linear_solver_type = ceres::DENSE_SCHUR;
+  } else if (solver == "sparse_schur") {
+    options.linear_solver_type = ceres::SPARSE_SCHUR;
+  } else if (solver == "iterative_schur") {
+    options.linear_solver_type  = ceres::ITERATIVE_SCHUR;
+    options.preconditioner_type = ceres::SCHUR_JACOBI;
+    // This is supposed to help with speed in a certain size range, but
+    // the explicit Schur complement needs as much memory as sparse_schur.
+    options.use_explicit_schur_complement = (num_cameras > 3500 && num_cameras <= 7000);
+  } else {
+    vw_throw(ArgumentErr() << "Unknown linear solver: " << solver << ".\n");
+  }
+  vw_out() << "Using the " << solver << " linear solver.\n";
+
+  // Eliminate the points first, then solve for the cameras and intrinsics
+  ceres::ParameterBlockOrdering * ordering = new ceres::ParameterBlockOrdering;
+  std::set<double*> point_blocks;
+  for (int ipt = 0; ipt < num_points; ipt++) {
+    double * point = points + ipt * num_point_params;
+    if (problem.HasParameterBlock(point)) {
+      ordering->AddElementToGroup(point, 0);
+      point_blocks.insert(point);
+    }
+  }
+  std::vector<double*> blocks;
+  problem.GetParameterBlocks(&blocks);
+  for (size_t b = 0; b < blocks.size(); b++) {
+    if (point_blocks.find(blocks[b]) == point_blocks.end())
+      ordering->AddElementToGroup(blocks[b], 1);
+  }
+  options.linear_solver_ordering.reset(ordering);
 }
 
+
+/// The reference terrain points binned in a lon-lat grid, with the 3D
+/// box of the points in each cell, to quickly find the points which
+/// may project into a given image.
+struct ReferencePointGrid {
+
+  std::vector<Vector3>            points;
+  std::vector< std::vector<int> > cells; // the indices of the points in each cell
+  std::vector<BBox3>              boxes; // the box of the points in each cell
+
+  // Bin the given points, with about this many points per cell
+  void build(std::vector<Vector3> const& xyz, std::vector<Vector2> const& lonlat,
+             int points_per_cell) {
+
+    points = xyz;
+    cells.clear();
+    boxes.clear();
+    if (points.empty())
+      return;
+
+    BBox2 box;
+    for (size_t i = 0; i < lonlat.size(); i++)
+      box.grow(lonlat[i]);
+
+    int num_side = std::max(1, int(round(sqrt(double(points.size())/points_per_cell))));
+    double dx = std::max(box.width(),  1e-12)/num_side;
+    double dy = std::max(box.height(), 1e-12)/num_side;
+    cells.resize(num_side*num_side);
+    boxes.resize(num_side*num_side);
+    for (size_t i = 0; i < points.size(); i++) {
+      int cx = std::min(num_side - 1, int((lonlat[i].x() - box.min().x())/dx));
+      int cy = std::min(num_side - 1, int((lonlat[i].y() - box.min().y())/dy));
+      int cell = cy*num_side + cx;
+      cells[cell].push_back(i);
+      boxes[cell].grow(points[i]);
+    }
+  }
+};
+
+/// Find the grid cells which may have points projecting into the
+/// given camera. The corners of the box of the points of a cell are
+/// projected, and the cell is skipped only if the box of their
+/// projections, grown by its size, is away from the image.
+template <class ModelT>
+void cells_seen_by_camera(ModelT & ba_model, int icam, double * camera,
+                          double * intrinsics, BBox2i const& image_box,
+                          ReferencePointGrid const& grid, std::vector<bool> & seen) {
+
+  typename ModelT::camera_intr_vector_t cam_intr_vec;
+  typename ModelT::point_vector_t       point_vec;
+  ba_model.concat_extrinsics_intrinsics(camera, intrinsics, cam_intr_vec);
+
+  seen.assign(grid.cells.size(), false);
+  for (size_t c = 0; c < grid.cells.size(); c++) {
+    if (grid.cells[c].empty())
+      continue;
+
+    BBox3 const& box = grid.boxes[c];
+    BBox2 pix_box;
+    bool success = true;
+    for (int corner = 0; corner < 8 && success; corner++) {
+      Vector3 xyz((corner & 1) ? box.max().x() : box.min().x(),
+                  (corner & 2) ? box.max().y() : box.min().y(),
+                  (corner & 4) ? box.max().z() : box.min().z());
+      for (size_t p = 0; p < point_vec.size(); p++) point_vec[p] = xyz[p];
+      try {
+        Vector2 pix = ba_model.cam_pixel(0, icam, cam_intr_vec, point_vec);
+        if (pix != pix || pix == Vector2(-999999,-999999))
+          success = false; // nan or failed projection
+        else
+          pix_box.grow(pix);
+      }catch(std::exception const& e){
+        success = false;
+      }
+    }
+
+    if (success) {
+      // Allow for the projection being curved, and for lens distortion
+      pix_box.expand(std::max(pix_box.width(), pix_box.height()));
+      if (!pix_box.intersects(BBox2(image_box)))
+        continue;
+    }
+    seen[c] = true; // Cannot rule it out
+  }
+}
+
+/// Save a checkpoint of the optimization every few iterations, so
+/// that it can be resumed with --resume.
+class BaCheckpointCallback: public ceres::IterationCallback {
+public:
+  BaCheckpointCallback(Options const& opt, int pass, int prev_iterations,
+                       double const* cameras,    int cameras_len,
+                       double const* points,     int points_len,
+                       double const* intrinsics, double const* scaled_intrinsics,
+                       int intrinsics_len,       std::set<int> const& outlier_xyz):
+    m_opt(opt), m_pass(pass), m_prev_iterations(prev_iterations),
+    m_cameras(cameras), m_cameras_len(cameras_len),
+    m_points(points), m_points_len(points_len),
+    m_intrinsics(intrinsics), m_scaled_intrinsics(scaled_intrinsics),
+    m_intrinsics_len(intrinsics_len), m_outlier_xyz(outlier_xyz) {}
+
+  virtual ceres::CallbackReturnType operator()
+    (const ceres::IterationSummary& summary) {
+
+    if (m_opt.checkpoint_interval <= 0 || summary.iteration <= 0 ||
+        summary.iteration % m_opt.checkpoint_interval != 0)
+      return ceres::SOLVER_CONTINUE;
+
+    asp::SolverCheckpoint checkpoint;
+    checkpoint.set_counter("pass", m_pass);
+    checkpoint.set_counter("iteration", m_prev_iterations + summary.iteration);
+    checkpoint.set_block("cameras", m_cameras, m_cameras_len);
+    checkpoint.set_block("points",  m_points,  m_points_len);
+    checkpoint.set_block("intrinsics", m_intrinsics, m_intrinsics_len);
+    checkpoint.set_block("scaled_intrinsics", m_scaled_intrinsics, m_intrinsics_len);
+    std::vector<double> outliers(m_outlier_xyz.begin(), m_outlier_xyz.end());
+    checkpoint.set_block("outliers", outliers.empty() ? NULL : &outliers[0], outliers.size());
+
+    std::string checkpoint_file = asp::checkpoint_file_name(m_opt.out_prefix);
+    vw_out() << "Writing: " << checkpoint_file << std::endl;
+    checkpoint.write(checkpoint_file);
+
+    return ceres::SOLVER_CONTINUE;
+  }
+
+private:
+  Options const& m_opt;
+  int m_pass, m_prev_iterations;
+  double const* m_cameras;    int m_cameras_len;
+  double const* m_points;     int m_points_len;
+  double const* m_intrinsics; double const* m_scaled_intrinsics;
+  int m_intrinsics_len;
+  std::set<int> const& m_outlier_xyz;
+};
+
 template <class ModelT>
 int do_ba_ceres_one_pass(ModelT                          & ba_model,
                           Options                         & opt,
                           ControlNetwork                  & cnet,
                           CameraRelationNetwork<JFeature> & crn,
+                          int                               pass,
                           bool                              first_pass,
                           bool                              last_pass,
                           int                               num_camera_params,
@@ -1708,7 +2067,8 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
                           double                          * cameras,
                           double                          * intrinsics,
                           double                          * points,
-                          std::set<int>                   & outlier_xyz){
+                          std::set<int>                   & outlier_xyz,
+                          asp::SolverCheckpoint const     * resume_checkpoint){
 
   ceres::Problem problem;
 
@@ -1742,17 +2102,26 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
   if (num_intrinsic_params > 0)
     scaled_intrinsics_ptr = &scaled_intrinsics[0];
 
+  // When resuming, continue from the checkpointed iteration of this pass
+  int prev_iterations = 0;
+  if (resume_checkpoint != NULL) {
+    prev_iterations = resume_checkpoint->counter("iteration");
+    if (num_intrinsic_params > 0)
+      resume_checkpoint->get_block("scaled_intrinsics", scaled_intrinsics_ptr,
+                                   num_intrinsic_params);
+  }
+
   
-  vw::cartography::GeoReference dem_georef;
-  ImageViewRef< PixelMask<double> >  interp_dem;
+  boost::shared_ptr<asp::TiledDem> dem;
   if (opt.heights_from_dem != "") {
     if (!opt.create_pinhole) 
       vw_throw( ArgumentErr() << "When using a high quality DEM, must use the --create-pinhole-cameras option.\n");
-    create_interp_dem(opt.heights_from_dem, dem_georef, interp_dem);
+    dem = load_dem(opt.heights_from_dem);
   }
   
   // Add the various cost functions the solver will optimize over.
   std::vector<size_t> cam_residual_counts(num_cameras);
+  std::vector<bool> height_from_dem_done(num_points, false); // look up each point once
   for ( int icam = 0; icam < num_cameras; icam++ ) {
     cam_residual_counts[icam] = 0;
     for ( crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++ ){
@@ -1805,22 +2174,18 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
         // Fix the obtained xyz points as they are considered reliable
         // and we should have the cameras and intrinsics params to conform
         // to these.
-        if (cnet[ipt].type() != ControlPoint::GroundControlPoint){
+        if (cnet[ipt].type() != ControlPoint::GroundControlPoint &&
+            !height_from_dem_done[ipt]){
+          height_from_dem_done[ipt] = true;
           Vector3 xyz(point[0], point[1], point[2]);
-          vw::Vector3 llh = dem_georef.datum().cartesian_to_geodetic(xyz);
+          vw::Vector3 llh = dem->georef().datum().cartesian_to_geodetic(xyz);
           vw::Vector2 ll = subvector(llh, 0, 2);
-          Vector2 pix = dem_georef.lonlat_to_pixel(ll);
-          if (pix[0] >= 0 &&
-              pix[1] >= 0 &&
-              pix[0] <= interp_dem.cols()-1 &&
-              pix[1] <= interp_dem.rows()-1) {
-            PixelMask<double> ht = interp_dem(pix[0], pix[1]);
-            if (is_valid(ht)) {
-              llh[2] = ht.child();
-              xyz = dem_georef.datum().geodetic_to_cartesian(llh);
-              for (size_t it = 0; it < xyz.size(); it++) 
-                point[it] = xyz[it];
-            }
+          PixelMask<double> ht = dem->height_at_lonlat(ll);
+          if (is_valid(ht)) {
+            llh[2] = ht.child();
+            xyz = dem->georef().datum().geodetic_to_cartesian(llh);
+            for (size_t it = 0; it < xyz.size(); it++) 
+              point[it] = xyz[it];
           }
           problem.SetParameterBlockConstant(point);
         }
@@ -1992,115 +2357,116 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
       image_boxes.push_back(bbox);
     }
 
-    vw_out() << "Setting up the error to the reference terrain.\n";
-    TerminalProgressCallback tpc("", "\t--> ");
-    tpc.report_progress(0);
+    // Filter by lonlat box if provided, this is very much recommended
+    // to quickly discard most points in the huge reference terrain.
+    // Let's hope there is no 360 degree offset when computing
+    // the longitude.
+    std::vector<Vector3> ref_xyz;
+    std::vector<Vector2> ref_lonlat;
     int num_cols = data.cols();
-    //double inc_amount = 1.0/double(pos_records.size());
-    double inc_amount = 1.0/double(num_cols);
-				   
-    reference_vec.clear();
     for (int data_col = 0; data_col < num_cols; data_col++) {
-
-      //vw::Vector3 reference_xyz = csv_conv.csv_to_cartesian(*iter, geo);
       vw::Vector3 reference_xyz;
       for (int row = 0; row < asp::DIM; row++)
         reference_xyz[row] = data(row, data_col);
+      vw::Vector3 llh = geo.datum().cartesian_to_geodetic(reference_xyz);
+      vw::Vector2 ll = subvector(llh, 0, 2);
+      if ( asp::stereo_settings().lon_lat_limit != BBox2(0,0,0,0) &&
+           !asp::stereo_settings().lon_lat_limit.contains(ll))
+        continue;
+      ref_xyz.push_back(reference_xyz);
+      ref_lonlat.push_back(ll);
+    }
 
-      // Filter by lonlat box if provided, this is very much recommended
-      // to quickly discard most points in the huge reference terrain.
-      // Let's hope there is no 360 degree offset when computing
-      // the longitude. 
-      if ( asp::stereo_settings().lon_lat_limit != BBox2(0,0,0,0) ) {
-	vw::Vector3 llh = geo.datum().cartesian_to_geodetic(reference_xyz);
-	vw::Vector2 ll = subvector(llh, 0, 2);
-	if (!asp::stereo_settings().lon_lat_limit.contains(ll)) {
-	  continue;
-	}
-      }
+    // Index the points, so that for each pair of images only the
+    // points which may project into both are checked.
+    const int REF_POINTS_PER_CELL = 1000;
+    ReferencePointGrid grid;
+    grid.build(ref_xyz, ref_lonlat, REF_POINTS_PER_CELL);
 
-      bool good_point = true;
-      Vector2 left_pred;
+    vw_out() << "Setting up the error to the reference terrain.\n";
+    TerminalProgressCallback tpc("", "\t--> ");
+    tpc.report_progress(0);
+    int num_pairs = num_cameras/2;
+    double inc_amount = 1.0/double(std::max(num_pairs, 1));
 
-      // Iterate over the cameras, add a residual for each point and each camera pair.
-      // Camera 0 is paired with camera 1, camera 2 with camera 3, etc. 
-      for ( int icam = 0; icam < num_cameras; icam++ ) {
+    reference_vec.clear();
 
-        if (icam%2 == 0) {
-          // Reset this for every pair of images
-          good_point = true; 
-        }
+    // Camera 0 is paired with camera 1, camera 2 with camera 3, etc.
+    // Add a residual for each point and each camera pair.
+    for (int ipair = 0; ipair < num_pairs; ipair++) {
 
-        if (!good_point) continue; 
-          
-        // Get pointers to the camera and point coordinates
-        double * camera = cameras + icam * num_camera_params;
-        double * point  = &reference_xyz[0];
-
-        // Project the current point into the current camera
-        typename ModelT::camera_intr_vector_t cam_intr_vec;
-        typename ModelT::point_vector_t       point_vec;
-        ba_model.concat_extrinsics_intrinsics(camera, intrinsics, cam_intr_vec);
-        for (size_t p = 0; p < point_vec.size(); p++) point_vec[p] = point[p];
-        Vector2 prediction, right_pred;
-        try {
-          prediction = ba_model.cam_pixel(0, icam, cam_intr_vec, point_vec);
-        }catch(std::exception const& e){
-          good_point = false;
-          continue;
-        }
+      int left_cam = 2*ipair, right_cam = 2*ipair + 1;
+      double * left_camera  = cameras + left_cam  * num_camera_params;
+      double * right_camera = cameras + right_cam * num_camera_params;
 
-	// Check if the current point projects in the camera
-        if (!image_boxes[icam].contains(prediction)) {
-          good_point = false;
-          continue;
-	}
+      std::vector<bool> left_cells, right_cells;
+      cells_seen_by_camera(ba_model, left_cam, left_camera, intrinsics,
+                           image_boxes[left_cam], grid, left_cells);
+      cells_seen_by_camera(ba_model, right_cam, right_camera, intrinsics,
+                           image_boxes[right_cam], grid, right_cells);
 
-        if (icam%2 == 0) {
-          left_pred = prediction;
-	  // Record where we projected in the left camera, and then switch to the right camera
-          continue;
-        }
+      typename ModelT::camera_intr_vector_t left_intr_vec, right_intr_vec;
+      ba_model.concat_extrinsics_intrinsics(left_camera,  intrinsics, left_intr_vec);
+      ba_model.concat_extrinsics_intrinsics(right_camera, intrinsics, right_intr_vec);
 
-	if (icam%2 != 1)
-	  vw_throw(ArgumentErr() << "Expecting an odd camera here.\n");
+      for (size_t c = 0; c < grid.cells.size(); c++) {
 
-        right_pred = prediction;
-        
-        // Check for out of range, etc
-	if (!good_point) continue;
-        if (left_pred != left_pred) continue; // nan check
-        if (left_pred[0] < 0 || left_pred[0] > interp_disp[icam/2].cols() - 1 ) continue;
-        if (left_pred[1] < 0 || left_pred[1] > interp_disp[icam/2].rows() - 1 ) continue;
-
-        DispPixelT dispPix = interp_disp[icam/2](left_pred[0], left_pred[1]);
-        if (!is_valid(dispPix)) continue;
-          
-        Vector2 right_pix = left_pred + dispPix.child();
-        if (!image_boxes[icam].contains(right_pix)) 
+        if (!left_cells[c] || !right_cells[c])
           continue;
 
-        if (right_pred != right_pred || norm_2(right_pix - right_pred) > opt.max_disp_error) {
-          // Ignore pixels which are too far from where they should be before optimization
-          continue;
-        }
-        
-	reference_vec.push_back(reference_xyz);
+        for (size_t k = 0; k < grid.cells[c].size(); k++) {
 
-        ceres::LossFunction* loss_function = get_loss_function(opt);
-        
-        // Call function to select the appropriate Ceres residual block to add.
-        add_residual_block(reference_xyz, interp_disp[icam/2], ba_model,
-                           icam-1, icam, // left icam and right icam
-                           cameras + (icam-1) * num_camera_params, // left cam
-                           cameras + icam * num_camera_params, // right cam
-                           scaled_intrinsics_ptr,
-                           opt.intrinsics_to_float,
-                           loss_function, problem);
+          vw::Vector3 reference_xyz = grid.points[grid.cells[c][k]];
+
+          // Project the current point into the cameras
+          typename ModelT::point_vector_t point_vec;
+          for (size_t p = 0; p < point_vec.size(); p++) point_vec[p] = reference_xyz[p];
+          Vector2 left_pred, right_pred;
+          try {
+            left_pred  = ba_model.cam_pixel(0, left_cam,  left_intr_vec,  point_vec);
+            right_pred = ba_model.cam_pixel(0, right_cam, right_intr_vec, point_vec);
+          }catch(std::exception const& e){
+            continue;
+          }
+
+          // Check if the current point projects in the cameras
+          if (!image_boxes[left_cam].contains(left_pred) ||
+              !image_boxes[right_cam].contains(right_pred))
+            continue;
+
+          // Check for out of range, etc
+          if (left_pred != left_pred) continue; // nan check
+          if (left_pred[0] < 0 || left_pred[0] > interp_disp[ipair].cols() - 1 ) continue;
+          if (left_pred[1] < 0 || left_pred[1] > interp_disp[ipair].rows() - 1 ) continue;
+
+          DispPixelT dispPix = interp_disp[ipair](left_pred[0], left_pred[1]);
+          if (!is_valid(dispPix)) continue;
+
+          Vector2 right_pix = left_pred + dispPix.child();
+          if (!image_boxes[right_cam].contains(right_pix))
+            continue;
+
+          if (right_pred != right_pred || norm_2(right_pix - right_pred) > opt.max_disp_error) {
+            // Ignore pixels which are too far from where they should be before optimization
+            continue;
+          }
+
+          reference_vec.push_back(reference_xyz);
+
+          ceres::LossFunction* loss_function = get_loss_function(opt);
+
+          // Call function to select the appropriate Ceres residual block to add.
+          add_residual_block(reference_xyz, interp_disp[ipair], ba_model,
+                             left_cam, right_cam,
+                             left_camera, right_camera,
+                             scaled_intrinsics_ptr,
+                             opt.intrinsics_to_float,
+                             loss_function, problem);
+        }
       }
       tpc.report_incremental_progress( inc_amount );
     }
-    
+
     tpc.report_finished();
     vw_out() << "Found " << reference_vec.size() << " reference points in range.\n";
   }
@@ -2140,26 +2506,14 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
   options.function_tolerance = 1e-16;
   options.parameter_tolerance = opt.parameter_tolerance; // default is 1e-8
 
-  options.max_num_iterations = opt.max_iterations;
+  options.max_num_iterations = std::max(0, opt.max_iterations - prev_iterations);
   options.max_num_consecutive_invalid_steps = std::max(5, opt.max_iterations/5); // try hard
   options.minimizer_progress_to_stdout = true;//(opt.report_level >= vw::ba::ReportFile);
 
-  if (opt.stereo_session_string == "isis")
-    options.num_threads = 1;
-  else
-    options.num_threads = opt.num_threads;
+  options.num_threads = opt.num_threads;
 
-  // Set solver options according to the recommendations in the Ceres solving FAQs
-  options.linear_solver_type = ceres::SPARSE_SCHUR;
-  if (num_cameras < 100)
-    options.linear_solver_type = ceres::DENSE_SCHUR;
-  if (num_cameras > 3500) {
-    options.use_explicit_schur_complement = true; // This is supposed to help with speed in a certain size range
-    options.linear_solver_type  = ceres::ITERATIVE_SCHUR;
-    options.preconditioner_type = ceres::SCHUR_JACOBI;
-  }
-  if (num_cameras > 7000)
-    options.use_explicit_schur_complement = false; // Only matters with ITERATIVE_SCHUR
+  set_linear_solver(opt, crn, outlier_xyz, num_camera_params, num_point_params,
+                    num_points, points, problem, options);
 
   //options.ordering_type = ceres::SCHUR;
   //options.eta = 1e-3; // FLAGS_eta;
@@ -2169,6 +2523,17 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
   //  options->minimizer_type = ceres::LINE_SEARCH;
   //}
 
+  // Save checkpoints as the optimization goes on
+  BaCheckpointCallback checkpoint_callback(opt, pass, prev_iterations,
+                                           cameras, num_cameras*num_camera_params,
+                                           points,  num_points*num_point_params,
+                                           intrinsics, scaled_intrinsics_ptr,
+                                           num_intrinsic_params, outlier_xyz);
+  if (opt.checkpoint_interval > 0) {
+    options.callbacks.push_back(&checkpoint_callback);
+    options.update_state_every_iteration = true; // ensure we save the latest values
+  }
+
   vw_out() << "Starting the Ceres optimizer..." << std::endl;
   ceres::Solver::Summary summary;
   ceres::Solve(options, &problem, &summary);
@@ -2189,22 +2554,36 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
     vw_out() << std::endl;
   }
   
-  vw_out() << "Writing final condition log files..." << std::endl;
-  residual_prefix = opt.out_prefix + "-final_residuals_loss_function";
-  write_residual_logs(residual_prefix, true,  opt, num_cameras, num_camera_params,
-                      num_point_params, cam_residual_counts,
-                      num_gcp_residuals, reference_vec, crn,
-                      points, num_points, outlier_xyz, problem);
-  residual_prefix = opt.out_prefix + "-final_residuals_no_loss_function";
-  write_residual_logs(residual_prefix, false, opt, num_cameras, num_camera_params,
-                      num_point_params, cam_residual_counts,
-                      num_gcp_residuals, reference_vec, crn,
-                      points, num_points, outlier_xyz, problem);
+  // Find the outliers before writing the final logs. If there are new
+  // outliers another pass will follow and overwrite the logs, so they
+  // need not be written now.
+  int num_new_outliers = 0;
+  if (!last_pass) 
+    num_new_outliers =
+      update_outliers(cnet, crn, points, num_points,
+                      outlier_xyz,   // in-out
+                      opt, num_cameras, num_camera_params, num_point_params,
+                      cam_residual_counts,  
+                      num_gcp_residuals, reference_vec, problem);
 
-  point_kml_path = opt.out_prefix + "-final_points.kml";
-  record_points_to_kml(point_kml_path, opt.datum, points, num_points, outlier_xyz,
-		       kmlPointSkip, "final_points",
-                       "http://maps.google.com/mapfiles/kml/shapes/placemark_circle_highlight.png");
+  if (last_pass || num_new_outliers == 0) {
+    vw_out() << "Writing final condition log files..." << std::endl;
+    residual_prefix = opt.out_prefix + "-final_residuals_loss_function";
+    write_residual_logs(residual_prefix, true,  opt, num_cameras, num_camera_params,
+                        num_point_params, cam_residual_counts,
+                        num_gcp_residuals, reference_vec, crn,
+                        points, num_points, outlier_xyz, problem);
+    residual_prefix = opt.out_prefix + "-final_residuals_no_loss_function";
+    write_residual_logs(residual_prefix, false, opt, num_cameras, num_camera_params,
+                        num_point_params, cam_residual_counts,
+                        num_gcp_residuals, reference_vec, crn,
+                        points, num_points, outlier_xyz, problem);
+
+    point_kml_path = opt.out_prefix + "-final_points.kml";
+    record_points_to_kml(point_kml_path, opt.datum, points, num_points, outlier_xyz,
+                         kmlPointSkip, "final_points",
+                         "http://maps.google.com/mapfiles/kml/shapes/placemark_circle_highlight.png");
+  }
 
   // Print stats for optimized gcp
   if (num_gcp > 0) {
@@ -2229,15 +2608,6 @@ int do_ba_ceres_one_pass(ModelT                          & ba_model,
     }
   }
 
-  int num_new_outliers = 0;
-  if (!last_pass) 
-    num_new_outliers =
-      update_outliers(cnet, crn, points, num_points,
-                      outlier_xyz,   // in-out
-                      opt, num_cameras, num_camera_params, num_point_params,
-                      cam_residual_counts,  
-                      num_gcp_residuals, reference_vec, problem);
-
   // Create a match file with clean points.
   // TODO: Make this a function.
   // TODO: Create this for every pair of images.
@@ -2371,15 +2741,56 @@ void do_ba_ceres(ModelT & ba_model, Options & opt ){
 
   if (opt.num_ba_passes <= 0)
     vw_throw(ArgumentErr() << "Error: Expecting at least one bundle adjust pass.\n");
-  
-  for (int pass = 0; pass < opt.num_ba_passes; pass++) {
 
-    if (opt.num_ba_passes > 1) {
+  // Continue from where an interrupted run saved its checkpoint
+  int start_pass = 0;
+  asp::SolverCheckpoint checkpoint;
+  bool resuming = false;
+  std::string checkpoint_file = asp::checkpoint_file_name(opt.out_prefix);
+  if (opt.resume) {
+    if (!fs::exists(checkpoint_file)) {
+      vw_out(WarningMessage) << "Cannot find checkpoint: " << checkpoint_file
+                             << ". Starting from the beginning.\n";
+    } else {
+      vw_out() << "Reading: " << checkpoint_file << std::endl;
+      checkpoint.read(checkpoint_file);
+      start_pass = checkpoint.counter("pass");
+      if (start_pass < 0 || start_pass >= opt.num_ba_passes)
+        vw_throw(ArgumentErr() << "The checkpoint " << checkpoint_file
+                 << " is for pass " << start_pass << " but there are only "
+                 << opt.num_ba_passes << " passes.\n");
+      checkpoint.get_block("cameras", &cameras_vec[0], cameras_vec.size());
+      checkpoint.get_block("points",  &points_vec[0],  points_vec.size());
+      if (num_intrinsic_params > 0)
+        checkpoint.get_block("intrinsics", &intrinsics_vec[0], intrinsics_vec.size());
+      std::vector<double> outliers(checkpoint.block_size("outliers"));
+      if (!outliers.empty())
+        checkpoint.get_block("outliers", &outliers[0], outliers.size());
+      for (size_t i = 0; i < outliers.size(); i++)
+        outlier_xyz.insert(int(outliers[i]));
+      resuming = true;
+      vw_out() << "Resuming at pass " << start_pass << ", iteration "
+               << checkpoint.counter("iteration") << ".\n";
+    }
+  }
+
+  for (int pass = start_pass; pass < opt.num_ba_passes; pass++) {
+
+    if (opt.num_ba_passes > 1)
       vw_out() << "Bundle adjust pass: " << pass << std::endl;
+
+    // The resumed pass starts from the checkpointed values rather than the original ones
+    bool resume_pass = (resuming && pass == start_pass);
+    
+    if (opt.num_ba_passes > 1 && !resume_pass) {
       // Go back to the original inputs to optimize, sans the outliers. Note that we
-      // copy values, to not disturb the pointer of each vector.
-      for (size_t i = 0; i < cameras_vec.size(); i++)    cameras_vec[i]    = orig_cameras_vec[i];
-      for (size_t i = 0; i < points_vec.size(); i++)     points_vec[i]     = orig_points_vec[i];
+      // copy values, to not disturb the pointer of each vector. When warm-starting
+      // only the intrinsics are reset, as the pinhole cost functions optimize them
+      // relative to the original values.
+      if (!opt.warm_start_passes) {
+        for (size_t i = 0; i < cameras_vec.size(); i++) cameras_vec[i] = orig_cameras_vec[i];
+        for (size_t i = 0; i < points_vec.size(); i++)  points_vec[i]  = orig_points_vec[i];
+      }
       for (size_t i = 0; i < intrinsics_vec.size(); i++) intrinsics_vec[i] = orig_intrinsics_vec[i];
     }
     
@@ -2390,11 +2801,13 @@ void do_ba_ceres(ModelT & ba_model, Options & opt ){
     if (num_intrinsic_params > 0) intrinsics = &intrinsics_vec[0];
     
     bool last_pass = (pass == opt.num_ba_passes - 1);
-    int num_new_outliers = do_ba_ceres_one_pass(ba_model, opt,  cnet,  crn, (pass==0), last_pass,
+    int num_new_outliers = do_ba_ceres_one_pass(ba_model, opt,  cnet,  crn, pass,
+                                                (pass==0), last_pass,
                                                 num_camera_params,  num_point_params,  
                                                 num_intrinsic_params, num_cameras, num_points,  
                                                 orig_cameras_vec,  cameras,  intrinsics,  points,  
-                                                outlier_xyz);
+                                                outlier_xyz,
+                                                resume_pass ? &checkpoint : NULL);
 
     if (!last_pass && num_new_outliers == 0) {
       vw_out() << "No new outliers removed. No more passes are needed.\n";
@@ -2975,9 +3388,8 @@ void create_matches_from_mapprojected_images(Options const& opt){
   std::string dem_file = map_files.back();
   map_files.erase(map_files.end() - 1);
 
-  vw::cartography::GeoReference dem_georef;
-  ImageViewRef< PixelMask<double> > interp_dem;
-  create_interp_dem(dem_file, dem_georef, interp_dem);
+  boost::shared_ptr<asp::TiledDem> dem = load_dem(dem_file);
+  vw::cartography::GeoReference const& dem_georef = dem->georef();
   
   for (size_t i = 0; i < map_files.size(); i++) {
     for (size_t j = i+1; j < map_files.size(); j++) {
@@ -3007,10 +3419,7 @@ void create_matches_from_mapprojected_images(Options const& opt){
         vw::ip::InterestPoint P1 = ip1[ip_iter];
         Vector2 pix1(P1.x, P1.y);
         Vector2 ll1 = georef1.pixel_to_lonlat(pix1);
-        Vector2 dem_pix1 = dem_georef.lonlat_to_pixel(ll1);
-        if (dem_pix1[0] < 0 || dem_pix1[0] >= interp_dem.cols() - 1) continue;
-        if (dem_pix1[1] < 0 || dem_pix1[1] >= interp_dem.rows() - 1) continue;
-        PixelMask<double> dem_val1 = interp_dem(dem_pix1[0], dem_pix1[1]);
+        PixelMask<double> dem_val1 = dem->height_at_lonlat(ll1);
         if (!is_valid(dem_val1)) continue;
         Vector3 llh1(ll1[0], ll1[1], dem_val1.child());
         Vector3 xyz1 = dem_georef.datum().geodetic_to_cartesian(llh1);
@@ -3022,10 +3431,7 @@ void create_matches_from_mapprojected_images(Options const& opt){
         vw::ip::InterestPoint P2 = ip2[ip_iter];
         Vector2 pix2(P2.x, P2.y);
         Vector2 ll2 = georef2.pixel_to_lonlat(pix2);
-        Vector2 dem_pix2 = dem_georef.lonlat_to_pixel(ll2);
-        if (dem_pix2[0] < 0 || dem_pix2[0] >= interp_dem.cols() - 1) continue;
-        if (dem_pix2[1] < 0 || dem_pix2[1] >= interp_dem.rows() - 1) continue;
-        PixelMask<double> dem_val2 = interp_dem(dem_pix2[0], dem_pix2[1]);
+        PixelMask<double> dem_val2 = dem->height_at_lonlat(ll2);
         if (!is_valid(dem_val2)) continue;
         Vector3 llh2(ll2[0], ll2[1], dem_val2.child());
         Vector3 xyz2 = dem_georef.datum().geodetic_to_cartesian(llh2);
@@ -3067,9 +3473,8 @@ void create_gcp_from_mapprojected_images(Options const& opt){
   std::string dem_file = image_files.back();
   image_files.erase(image_files.end() - 1); // wipe the dem from the list
 
-  vw::cartography::GeoReference dem_georef;
-  ImageViewRef< PixelMask<double> > interp_dem;
-  create_interp_dem(dem_file, dem_georef, interp_dem);
+  boost::shared_ptr<asp::TiledDem> dem = load_dem(dem_file);
+  vw::cartography::GeoReference const& dem_georef = dem->georef();
   
   int num_images = image_files.size();
   std::vector<std::vector<vw::ip::InterestPoint> > matches;
@@ -3124,13 +3529,13 @@ void create_gcp_from_mapprojected_images(Options const& opt){
     Vector2 dem_pixel(dem_ip.x, dem_ip.y);
     Vector2 lonlat = dem_georef.pixel_to_lonlat(dem_pixel);
     
-    if (dem_pixel[0] < 0 || dem_pixel[0] >= interp_dem.cols() - 1 ||
-        dem_pixel[1] < 0 || dem_pixel[1] >= interp_dem.rows() - 1) {
+    if (dem_pixel[0] < 0 || dem_pixel[0] > dem->cols() - 1 ||
+        dem_pixel[1] < 0 || dem_pixel[1] > dem->rows() - 1) {
       vw_out() << "Skipping pixel outside of DEM: " << dem_pixel << std::endl;
       continue;
     }
     
-    PixelMask<float> mask_height = interp_dem(dem_pixel[0], dem_pixel[1])[0];
+    PixelMask<double> mask_height = dem->height_at_pixel(dem_pixel);
     if (!is_valid(mask_height)) continue;
     
     Vector3 llh(lonlat[0], lonlat[1], mask_height.child());
@@ -3154,10 +3559,7 @@ void create_gcp_from_mapprojected_images(Options const& opt){
       Vector2 ip_pix(ip.x, ip.y);
       Vector2 ll = img_georefs[i].pixel_to_lonlat(ip_pix);
       
-      Vector2 dem_pix = dem_georef.lonlat_to_pixel(ll);
-      if (dem_pix[0] < 0 || dem_pix[0] >= interp_dem.cols() - 1) continue;
-      if (dem_pix[1] < 0 || dem_pix[1] >= interp_dem.rows() - 1) continue;
-      PixelMask<double> dem_val = interp_dem(dem_pix[0], dem_pix[1]);
+      PixelMask<double> dem_val = dem->height_at_lonlat(ll);
       if (!is_valid(dem_val)) continue;
       Vector3 llh(ll[0], ll[1], dem_val.child());
       Vector3 xyz = dem_georef.datum().geodetic_to_cartesian(llh);
@@ -3195,6 +3597,163 @@ void create_gcp_from_mapprojected_images(Options const& opt){
 
 }
 
+/// Find the footprint of each camera on the datum, as a lon-lat box
+/// enlarged by a fraction of its size, to allow for terrain and camera
+/// errors. The box is left empty if it cannot be found.
+void find_camera_footprints(Options const& opt, std::vector<BBox2> & footprints) {
+
+  const double FOOTPRINT_PAD = 0.1;
+  cartography::GeoReference georef(opt.datum);
+  footprints.assign(opt.image_files.size(), BBox2());
+  for (size_t i = 0; i < opt.image_files.size(); i++) {
+    try {
+      Vector2i size = file_image_size(opt.image_files[i]);
+      BBox2 box = cartography::camera_bbox(georef, opt.camera_models[i], size[0], size[1]);
+      if (!box.empty())
+        box.expand(FOOTPRINT_PAD*std::max(box.width(), box.height()));
+      footprints[i] = box;
+    } catch (std::exception const& e) {
+      vw_out(WarningMessage) << "Could not find the footprint of " << opt.image_files[i]
+                             << ": " << e.what() << "\n";
+    }
+  }
+}
+
+/// Compute the statistics of an image, used to normalize it for matching.
+class ImageStatsTask: public vw::Task, private boost::noncopyable {
+  std::string m_image_file;
+  float m_nodata;
+  vw::Vector<vw::float32,6> & m_stats;
+public:
+  ImageStatsTask(std::string const& image_file, float nodata, vw::Vector<vw::float32,6> & stats):
+    m_image_file(image_file), m_nodata(nodata), m_stats(stats) {}
+  void operator()() {
+    DiskImageView<float> image(m_image_file);
+    // The images are already processed in parallel
+    int num_threads = 1;
+    m_stats = asp::gather_stats(create_mask_less_or_equal(image, m_nodata), m_image_file,
+                                num_threads);
+  }
+};
+
+/// Find the interest point matches between a pair of images and write
+/// them to the match file. Failures are reported but are not fatal.
+class MatchPairTask: public vw::Task, private boost::noncopyable {
+  Options const& m_opt;
+  int m_i, m_j;
+  std::string m_match_file;
+  std::vector<float> const& m_nodata;
+  std::vector< vw::Vector<vw::float32,6> > const& m_stats;
+  int & m_num_pairs_matched;
+  vw::Mutex & m_mutex;
+public:
+  MatchPairTask(Options const& opt, int i, int j, std::string const& match_file,
+                std::vector<float> const& nodata,
+                std::vector< vw::Vector<vw::float32,6> > const& stats,
+                int & num_pairs_matched, vw::Mutex & mutex):
+    m_opt(opt), m_i(i), m_j(j), m_match_file(match_file), m_nodata(nodata), m_stats(stats),
+    m_num_pairs_matched(num_pairs_matched), m_mutex(mutex) {}
+
+  void operator()() {
+    std::string image1_path  = m_opt.image_files[m_i];
+    std::string image2_path  = m_opt.image_files[m_j];
+    try{
+      // IP matching may not succeed for all pairs
+
+      // Load both images into a new StereoSession object and use it to find interest points.
+      // - The points are written to a file on disk.
+      std::string session_type = m_opt.stereo_session_string; // the factory may modify it
+      SessionPtr session(asp::StereoSessionFactory::create(session_type, m_opt,
+                                                           image1_path,  image2_path,
+                                                           m_opt.camera_files[m_i],
+                                                           m_opt.camera_files[m_j],
+                                                           m_opt.out_prefix
+                                                           ));
+      Vector2i image1_size = file_image_size(image1_path);
+      session->ip_matching(image1_path, image2_path,
+                           Vector2(image1_size),
+                           m_stats[m_i],
+                           m_stats[m_j],
+                           m_opt.ip_per_tile,
+                           m_nodata[m_i], m_nodata[m_j], m_match_file,
+                           m_opt.camera_models[m_i].get(),
+                           m_opt.camera_models[m_j].get());
+
+      // TODO: Move this into the IP finding code!
+      // Compute the coverage fraction
+      std::vector<ip::InterestPoint> ip1, ip2;
+      ip::read_binary_match_file(m_match_file, ip1, ip2);
+      int right_ip_width = image1_size[0]*
+                            static_cast<double>(100-m_opt.ip_edge_buffer_percent)/100.0;
+      Vector2i ip_size(right_ip_width, image1_size[1]);
+      double ip_coverage = calc_ip_coverage_fraction(ip2, ip_size);
+
+      vw::Mutex::Lock lock(m_mutex);
+      vw_out() << "IP coverage fraction for " << m_match_file << " = " << ip_coverage << std::endl;
+      ++m_num_pairs_matched;
+    } catch ( const std::exception& e ){
+      vw::Mutex::Lock lock(m_mutex);
+      vw_out() << "Could not find interest points between images "
+               << image1_path << " and " << image2_path << std::endl;
+      vw_out(WarningMessage) << e.what() << std::endl;
+    } //End try/catch
+  }
+};
+
+/// In incremental mode, after the new images were matched, keep only
+/// the matches of the old images which overlap with the new ones,
+/// which are the ones that will float, and fix the other old images.
+/// The matches among old images are not found again, but taken from
+/// the output prefix or the previous run.
+void select_incremental_matches(Options & opt,
+                                std::vector< std::pair<int, int> > const& old_pairs,
+                                std::map< std::pair<int, int>, std::string> & match_files) {
+
+  int num_images     = opt.image_files.size();
+  int num_old_images = num_images - opt.num_new_images;
+
+  // The old images with matches to the new ones
+  std::vector<bool> is_neighbor(num_old_images, false);
+  typedef std::map< std::pair<int, int>, std::string>::const_iterator MatchIter;
+  for (MatchIter it = match_files.begin(); it != match_files.end(); it++) {
+    int i = it->first.first, j = it->first.second;
+    if (!fs::exists(it->second))
+      continue; // the pair failed to match
+    if (i < num_old_images && j >= num_old_images)
+      is_neighbor[i] = true;
+    if (j < num_old_images && i >= num_old_images)
+      is_neighbor[j] = true;
+  }
+
+  int num_old_pairs = 0;
+  for (size_t k = 0; k < old_pairs.size(); k++) {
+    int i = old_pairs[k].first, j = old_pairs[k].second;
+    if (!is_neighbor[i] && !is_neighbor[j])
+      continue; // fixed on both sides, so it does not help
+    std::string image1_path = opt.image_files[i], image2_path = opt.image_files[j];
+    std::string match_filename = ip::match_filename(opt.out_prefix, image1_path, image2_path);
+    if (!fs::exists(match_filename))
+      match_filename = ip::match_filename(opt.input_prefix, image1_path, image2_path);
+    if (!fs::exists(match_filename))
+      continue;
+    match_files[old_pairs[k]] = match_filename;
+    num_old_pairs++;
+  }
+
+  int num_neighbors = 0;
+  for (int i = 0; i < num_old_images; i++) {
+    if (is_neighbor[i])
+      num_neighbors++;
+    else
+      opt.fixed_cameras_indices.insert(i);
+  }
+
+  vw_out() << "Incremental mode: optimizing " << opt.num_new_images << " new image(s) and "
+           << num_neighbors << " old image(s) overlapping with them, using "
+           << num_old_pairs << " existing match file(s) among old images. The other "
+           << num_old_images - num_neighbors << " old image(s) are kept fixed.\n";
+}
+
 // TODO: Change something so we don't have to repeat all the stereo IP options here!
 
 void handle_arguments( int argc, char *argv[], Options& opt ) {
@@ -3226,6 +3785,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      "Before optimizing the cameras, apply to them the 4x4 rotation + translation transform from this file. The transform is in respect to the planet center, such as written by pc_align's source-to-reference or reference-to-source alignment transform. Set the number of iterations to 0 to stop at this step.")
     ("fixed-camera-indices",    po::value(&opt.fixed_cameras_indices_str)->default_value(""),
      "A list of indices, in quotes and starting from 0, with space as separator, corresponding to cameras to keep fixed during the optimization process.")
+    ("num-new-images",    po::value(&opt.num_new_images)->default_value(0),
+     "Incremental mode. The last this many input images are new, and the others were adjusted before, with the adjustments and match files at --input-adjustments-prefix. Only the pairs with a new image are matched, and only the new images and the old ones overlapping with them are optimized. The other old images are kept fixed.")
     ("fix-gcp-xyz",  po::bool_switch(&opt.fix_gcp_xyz)->default_value(false)->implicit_value(true),
      "If the GCP are highly accurate, use this option to not float them during the optimization.")
 
@@ -3266,6 +3827,12 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      "Skip tri_ip filtering.")
     ("ip-debug-images",     po::value(&opt.ip_debug_images)->default_value(false)->implicit_value(true),
                     "Write debug images to disk when detecting and matching interest points.")
+    ("ip-cache-dir",        po::value(&opt.ip_cache_dir)->default_value(""),
+     "Save the detected interest points and their matches in this directory, under a hash of the image pixels and the detection settings, and reuse them in later runs, with any output prefix. The default is output-prefix-ip-cache when there are more than two images.")
+    ("lens-lookup-table-spacing", po::value(&opt.lens_lookup_table_spacing)->default_value(0.0),
+     "For pinhole cameras with lens distortion, undistort and distort pixels by interpolating into tables with nodes this many pixels apart, such as 4, shared by all images with the same intrinsics. Cannot be used with --create-pinhole-cameras. Set to 0 to use the lens model itself.")
+    ("lens-lookup-table-error", po::value(&opt.lens_lookup_table_error)->default_value(0.01),
+     "With --lens-lookup-table-spacing, use the lens model itself where the table is off by more than this many pixels.")
     ("elevation-limit",        po::value(&opt.elevation_limit)->default_value(Vector2(0,0), "auto"),
      "Limit on expected elevation range: Specify as two values: min max.")
     // Note that we count later on the default for lon_lat_limit being BBox2(0,0,0,0).
@@ -3283,10 +3850,16 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
                          "Set the maximum number of iterations.")
     ("parameter-tolerance",   po::value(&opt.parameter_tolerance)->default_value(1e-8),
      "Making this smaller will result in more iterations.")
+    ("linear-solver",   po::value(&opt.linear_solver)->default_value("auto"),
+     "The Ceres linear solver: auto, dense_schur, sparse_schur, or iterative_schur. With auto, it is chosen based on the number of cameras and how many camera pairs see the same points.")
     ("overlap-limit",    po::value(&opt.overlap_limit)->default_value(0),
                          "Limit the number of subsequent images to search for matches to the current image to this value.  By default match all images.")
     ("overlap-list",    po::value(&opt.overlap_list_file)->default_value(""),
      "A file containing a list of image pairs, one pair per line, separated by a space, which are expected to overlap. Matches are then computed only among the images in each pair.")
+    ("skip-disjoint-footprints", po::bool_switch(&opt.skip_disjoint_footprints)->default_value(false)->implicit_value(true),
+     "Before matching, find the footprint of each image on the datum, and do not match the image pairs whose footprints, enlarged by 10 percent, do not intersect. A datum must be set.")
+    ("num-parallel-matches", po::value(&opt.num_parallel_matches)->default_value(0),
+     "How many image pairs to match at the same time. Each match also uses multiple threads. The default is a quarter of the number of threads, and 1 for ISIS cameras, which are not thread-safe.")
     ("position-filter-dist", po::value(&opt.position_filter_dist)->default_value(-1),
                          "Set a distance in meters and don't perform IP matching on images with an estimated camera center farther apart than this distance.  Requires --camera-positions.")
     ("rotation-weight",  po::value(&opt.rotation_weight)->default_value(0.0), "A higher weight will penalize more rotation deviations from the original configuration.")
@@ -3299,6 +3872,12 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      "How many interest points to detect in each 1024^2 image tile (default: automatic determination).")
     ("num-passes",             po::value(&opt.num_ba_passes)->default_value(1),
      "How many passes of bundle adjustment to do. If more than one, outliers will be removed between passes using --remove-outliers-params, and re-optimization will take place. Match files and residual files with the outliers removed will be written to disk.")
+    ("warm-start-passes",   po::bool_switch(&opt.warm_start_passes)->default_value(false)->implicit_value(true),
+     "With more than one pass, start each pass from the cameras and points found in the previous one rather than from the inputs. The intrinsics are always started from the inputs. The later passes then converge in fewer iterations, but the outliers removed in earlier passes still influence the starting point.")
+    ("checkpoint-interval",  po::value(&opt.checkpoint_interval)->default_value(0),
+     "Every this many iterations, save the cameras, points, intrinsics, outliers and the pass and iteration reached, so that the optimization can be continued with --resume if interrupted. The checkpoint is <output prefix>-checkpoint.bin. Set to 0 to not save checkpoints.")
+    ("resume",   po::bool_switch(&opt.resume)->default_value(false)->implicit_value(true),
+     "Continue the optimization from the checkpoint saved with --checkpoint-interval by an interrupted run with the same inputs and options. The matching and the control network are redone or read from disk as before.")
     ("remove-outliers-params",        po::value(&opt.remove_outliers_params_str)->default_value("75.0 3.0 2.0 3.0", "'pct factor err1 err2'"),
      "Outlier removal based on percentage, when more than one bundle adjustment pass is used. Triangulated points with reprojection error in pixels larger than min(max('pct'-th percentile * 'factor', err1), err2) will be removed as outliers. Hence, never remove errors smaller than err1 but always remove those bigger than err2. Specify as a list in quotes. Default: '75.0 3.0 2.0 3.0'.")
     ("remove-outliers-by-disparity-params",  po::value(&opt.remove_outliers_by_disp_params)->default_value(Vector2(90.0,3.0), "pct factor"),
@@ -3411,9 +3990,23 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if (opt.approximate_pinhole_intrinsics && opt.solve_intrinsics)
     vw_throw( ArgumentErr() << "Cannot approximate intrinsics while solving for them.\n");
 
+  if (opt.create_pinhole && opt.lens_lookup_table_spacing > 0)
+    vw_throw( ArgumentErr() << "Cannot use lens lookup tables when optimizing pinhole cameras "
+              << "directly, as their intrinsics are needed.\n");
+
   if (opt.create_pinhole && opt.input_prefix != "")
     vw_throw( ArgumentErr() << "Cannot use initial adjustments with pinhole cameras. Read the cameras directly.\n");
 
+  if (opt.num_new_images < 0 || opt.num_new_images > (int)opt.image_files.size())
+    vw_throw( ArgumentErr() << "The number of new images must be between 0 and "
+              << "the number of images.\n");
+  if (opt.num_new_images > 0 && opt.input_prefix == "")
+    vw_throw( ArgumentErr() << "The incremental mode needs the adjustments of "
+              << "the old images, with --input-adjustments-prefix.\n");
+  if (opt.num_new_images > 0 && opt.cnet_file != "")
+    vw_throw( ArgumentErr() << "The incremental mode builds the control network "
+              << "from the match files, so a network cannot be read.\n");
+
   vw::string_replace(opt.remove_outliers_params_str, ",", " "); // replace any commas
   opt.remove_outliers_params = vw::str_to_vec<vw::Vector<double, 4> >(opt.remove_outliers_params_str);
   
@@ -3433,6 +4026,14 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   asp::stereo_settings().ip_edge_buffer_percent  = opt.ip_edge_buffer_percent;
   asp::stereo_settings().ip_debug_images         = opt.ip_debug_images;
   asp::stereo_settings().ip_normalize_tiles      = opt.ip_normalize_tiles;
+  asp::stereo_settings().ip_cache_dir            = opt.ip_cache_dir;
+  asp::stereo_settings().lens_lookup_table_spacing = opt.lens_lookup_table_spacing;
+  asp::stereo_settings().lens_lookup_table_error   = opt.lens_lookup_table_error;
+
+  // With more than two images, each image is in several pairs. Cache
+  // its interest points, so that they are detected only once.
+  if (opt.ip_cache_dir.empty() && opt.image_files.size() > 2)
+    asp::stereo_settings().ip_cache_dir = opt.out_prefix + "-ip-cache";
 
   // Ensure good order
   if ( asp::stereo_settings().lon_lat_limit != BBox2(0,0,0,0) ) {
@@ -3468,6 +4069,16 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if (opt.stereo_session_string == "rpc" && opt.datum_str == "")
     vw_throw( ArgumentErr() << "When the session type is RPC, the datum must be specified.\n"
               << usage << general_options );       
+
+  if (opt.skip_disjoint_footprints && opt.datum_str == "")
+    vw_throw( ArgumentErr() << "The option --skip-disjoint-footprints needs the datum.\n"
+              << usage << general_options );
+
+  boost::to_lower(opt.linear_solver);
+  if (opt.linear_solver != "auto"         && opt.linear_solver != "dense_schur" &&
+      opt.linear_solver != "sparse_schur" && opt.linear_solver != "iterative_schur")
+    vw_throw( ArgumentErr() << "Unknown linear solver: " << opt.linear_solver << ".\n"
+              << usage << general_options );
        
   if (opt.datum_str != ""){
     // If the user set the datum, use it.
@@ -3643,13 +4254,22 @@ int main(int argc, char* argv[]) {
     const bool got_est_cam_positions =
       (estimated_camera_gcc.size() == static_cast<size_t>(num_images));
     
+    // Find the camera footprints, to skip the pairs which cannot overlap
+    std::vector<BBox2> footprints;
+    if (opt.skip_disjoint_footprints)
+      find_camera_footprints(opt, footprints);
+
+    // First find the pairs to match, then match them in parallel.
+    // In incremental mode the pairs of old images are not matched.
     int num_pairs_matched = 0;
+    int num_old_images = num_images - opt.num_new_images;
+    std::vector< std::pair<int, int> > pairs_to_match, old_pairs;
     for (int i = 0; i < num_images; i++){
       for (int j = i+1; j <= std::min(num_images-1, i+opt.overlap_limit); j++){
 
         std::string image1_path  = opt.image_files[i];
         std::string image2_path  = opt.image_files[j];
-        
+
         // Look only at these pairs, if specified in a list
         if (!opt.overlap_list.empty()) {
           std::pair<std::string, std::string> pair(image1_path, image2_path);
@@ -3669,11 +4289,20 @@ int main(int argc, char* argv[]) {
             continue; // Skip this image pair
           }
         } // End estimated camera position filtering
-      
-        // Load both images into a new StereoSession object and use it to find interest points.
-        // - The points are written to a file on disk.
-        std::string camera1_path = opt.camera_files[i];
-        std::string camera2_path = opt.camera_files[j];        
+
+        // Skip the pairs whose footprints are known and do not intersect
+        if (opt.skip_disjoint_footprints && !footprints[i].empty() &&
+            !footprints[j].empty() && !footprints[i].intersects(footprints[j])) {
+          vw_out() << "Skipping pair with disjoint footprints: " << image1_path << " and "
+                   << image2_path << std::endl;
+          continue;
+        }
+
+        if (opt.num_new_images > 0 && j < num_old_images) {
+          old_pairs.push_back(std::pair<int, int>(i, j));
+          continue;
+        }
+
         std::string match_filename = ip::match_filename(opt.out_prefix, image1_path, image2_path);
         match_files[ std::pair<int, int>(i, j) ] = match_filename;
         if (fs::exists(match_filename)) {
@@ -3681,58 +4310,61 @@ int main(int argc, char* argv[]) {
           ++num_pairs_matched;
           continue;
         }
-        boost::shared_ptr<DiskImageResource>
-          rsrc1(vw::DiskImageResourcePtr(image1_path)),
-          rsrc2(vw::DiskImageResourcePtr(image2_path));
-        if ( (rsrc1->channels() > 1) || (rsrc2->channels() > 1) )
+        pairs_to_match.push_back(std::pair<int, int>(i, j));
+      }
+    } // End loop through all input image pairs
+
+    if (!pairs_to_match.empty()) {
+
+      // The nodata value and statistics of each image are found only once
+      std::vector<bool> used(num_images, false);
+      for (size_t k = 0; k < pairs_to_match.size(); k++)
+        used[pairs_to_match[k].first] = used[pairs_to_match[k].second] = true;
+      std::vector<float> nodata(num_images, std::numeric_limits<float>::quiet_NaN());
+      std::vector< vw::Vector<vw::float32,6> > stats(num_images);
+      int num_threads = vw_settings().default_num_threads();
+      FifoWorkQueue stats_queue(num_threads);
+      for (int i = 0; i < num_images; i++) {
+        if (!used[i])
+          continue;
+        boost::shared_ptr<DiskImageResource> rsrc(vw::DiskImageResourcePtr(opt.image_files[i]));
+        if (rsrc->channels() > 1)
           vw_throw(ArgumentErr() << "Error: Input images can only have a single channel!\n\n");
         float nodata1, nodata2;
         SessionPtr session(asp::StereoSessionFactory::create(opt.stereo_session_string, opt,
-                                                             image1_path,  image2_path,
-                                                             camera1_path, camera2_path,
+                                                             opt.image_files [i], opt.image_files [i],
+                                                             opt.camera_files[i], opt.camera_files[i],
                                                              opt.out_prefix
                                                              ));
-        session->get_nodata_values(rsrc1, rsrc2, nodata1, nodata2);
-        try{
-          // IP matching may not succeed for all pairs
-
-          // Get masked views of the images to get statistics from
-          DiskImageView<float> image1_view(rsrc1), image2_view(rsrc2);
-          ImageViewRef< PixelMask<float> > masked_image1
-            = create_mask_less_or_equal(image1_view,  nodata1);
-          ImageViewRef< PixelMask<float> > masked_image2
-            = create_mask_less_or_equal(image2_view, nodata2);
-          vw::Vector<vw::float32,6> image1_stats = asp::gather_stats(masked_image1, image1_path);
-          vw::Vector<vw::float32,6> image2_stats = asp::gather_stats(masked_image2, image2_path);
-
-          session->ip_matching(image1_path, image2_path,
-                               Vector2(masked_image1.cols(), masked_image1.rows()),
-                               image1_stats,
-                               image2_stats,
-                               opt.ip_per_tile,
-                               nodata1, nodata2, match_filename,
-                               opt.camera_models[i].get(),
-                               opt.camera_models[j].get());
-        
-        // TODO: Move this into the IP finding code!
-        // Compute the coverage fraction
-        std::vector<ip::InterestPoint> ip1, ip2;
-        ip::read_binary_match_file(match_filename, ip1, ip2);       
-        int right_ip_width = rsrc1->cols()*
-                              static_cast<double>(100-opt.ip_edge_buffer_percent)/100.0;
-        Vector2i ip_size(right_ip_width, rsrc1->rows());
-        double ip_coverage = calc_ip_coverage_fraction(ip2, ip_size);
-        vw_out() << "IP coverage fraction = " << ip_coverage << std::endl;
-          
-                               
-          ++num_pairs_matched;
-        } catch ( const std::exception& e ){
-          vw_out() << "Could not find interest points between images "
-                   << opt.image_files[i] << " and " << opt.image_files[j] << std::endl;
-          vw_out(WarningMessage) << e.what() << std::endl;
-        } //End try/catch
+        session->get_nodata_values(rsrc, rsrc, nodata1, nodata2);
+        nodata[i] = nodata1;
+        stats_queue.add_task(boost::shared_ptr<ImageStatsTask>
+                             (new ImageStatsTask(opt.image_files[i], nodata[i], stats[i])));
       }
-    } // End loop through all input image pairs
+      stats_queue.join_all();
+
+      // Each match also uses multiple threads, and ISIS is not thread-safe
+      int num_parallel_matches = opt.num_parallel_matches;
+      if (num_parallel_matches <= 0)
+        num_parallel_matches = std::max(1, num_threads/4);
+      if (opt.stereo_session_string == "isis")
+        num_parallel_matches = 1;
+      vw_out() << "Matching " << pairs_to_match.size() << " image pairs, "
+               << num_parallel_matches << " at a time.\n";
+
+      vw::Mutex match_mutex;
+      FifoWorkQueue match_queue(num_parallel_matches);
+      for (size_t k = 0; k < pairs_to_match.size(); k++) {
+        int i = pairs_to_match[k].first, j = pairs_to_match[k].second;
+        match_queue.add_task(boost::shared_ptr<MatchPairTask>
+                             (new MatchPairTask(opt, i, j, match_files[pairs_to_match[k]],
+                                                nodata, stats, num_pairs_matched, match_mutex)));
+      }
+      match_queue.join_all();
+    }
+
+    if (opt.num_new_images > 0)
+      select_incremental_matches(opt, old_pairs, match_files);
 
     //if (num_pairs_matched == 0) {
     //  vw_throw( ArgumentErr() << "Unable to find an IP based match between any input image pair!\n");
@@ -335,7 +335,8 @@ osg::Node* createScene( std::vector<PointIter*>& points,
                         std::vector<CameraIter*>& cameras,
                         std::vector<ConnLineIter*>& connLines,
                         std::vector< std::vector<PointIter*> >& addPoints,
-                        BBox3f const* point_cloud, double cam_distance ) {
+                        BBox3f const* point_cloud, double cam_distance,
+                        size_t max_pick_targets ) {
 
   osg::Group* scene = new osg::Group();
 
@@ -520,35 +521,30 @@ osg::Node* createScene( std::vector<PointIter*>& points,
     scene->addChild( camerasGroup );
   }
 
-  // 4.) Draw Connecting Lines
+  // 4.) Draw Connecting Lines, all in one geometry
   if ( connLines.size() ){
-    osg::Group* linesGroup = new osg::Group;
-
-    for ( unsigned i = 0; i < connLines.size(); i+= 1 ){
-      osg::Geometry* geometry = new osg::Geometry;
-
-      osg::Vec3Array* vertices = new osg::Vec3Array( 2 );
-      (*vertices)[0] = connLines[i]->point()->position( 0 );
-      (*vertices)[1] = connLines[i]->camera()->position( 0 );
-      geometry->setVertexArray( vertices );
-
-      osg::Vec4Array* colours = new osg::Vec4Array( 1 );
-      geometry->setColorArray( colours );
-      geometry->setColorBinding( osg::Geometry::BIND_OVERALL );
-      (*colours)[0].set(0.8f, 0.8f, 0.8f, 1.0f);
+    osg::Geometry* geometry = new osg::Geometry;
 
-      geometry->addPrimitiveSet( new osg::DrawArrays(GL_LINES, 0, 2) );
+    osg::Vec3Array* vertices = new osg::Vec3Array( connLines.size()*2 );
+    for ( unsigned i = 0; i < connLines.size(); ++i ) {
+      (*vertices)[2*i]   = connLines[i]->point()->position( 0 );
+      (*vertices)[2*i+1] = connLines[i]->camera()->position( 0 );
+    }
+    geometry->setVertexArray( vertices );
 
-      geometry->setUseDisplayList( false );
-      geometry->setDrawCallback( new linesDrawCallback( connLines[i] ));
+    osg::Vec4Array* colours = new osg::Vec4Array( 1 );
+    geometry->setColorArray( colours );
+    geometry->setColorBinding( osg::Geometry::BIND_OVERALL );
+    (*colours)[0].set(0.8f, 0.8f, 0.8f, 1.0f);
 
-      osg::Geode* geode = new osg::Geode;
-      geode->addDrawable( geometry );
-      linesGroup->addChild( geode );
-    }
+    geometry->addPrimitiveSet( new osg::DrawArrays(GL_LINES, 0, vertices->size()) );
 
-    scene->addChild( linesGroup );
+    geometry->setUseDisplayList( false );
+    geometry->setDrawCallback( new connLinesDrawCallback( &connLines ));
 
+    osg::Geode* geode = new osg::Geode;
+    geode->addDrawable( geometry );
+    scene->addChild( geode );
   }
 
   // 5.) Build hit points, surfaces that the mouse intersector can use
@@ -556,8 +552,17 @@ osg::Node* createScene( std::vector<PointIter*>& points,
     double scale = cam_distance * 0.5;
     osg::Group* hitTargetGroup = new osg::Group;
 
+    // Each target is a node of its own, too many to draw for a large
+    // bundle adjustment. Then picking is not possible.
+    if ( cameras.size() > max_pick_targets )
+      vw_out() << "Not making pick targets for the " << cameras.size() << " cameras, "
+               << "more than " << max_pick_targets << ".\n";
+    if ( points.size() > max_pick_targets )
+      vw_out() << "Not making pick targets for the " << points.size() << " points, "
+               << "more than " << max_pick_targets << ".\n";
+
     // Targets for cameras
-    if ( cameras.size() ) {
+    if ( cameras.size() && cameras.size() <= max_pick_targets ) {
       // Building the target that all will use
       osg::Vec3Array* vertices = new osg::Vec3Array(4);
       (*vertices)[0].set( 1.0f, -1.0f, -0.1f );
@@ -606,7 +611,7 @@ osg::Node* createScene( std::vector<PointIter*>& points,
     }
 
     // Targets for points
-    if ( points.size() ) {
+    if ( points.size() && points.size() <= max_pick_targets ) {
       // Building the target that all will use
       osg::Vec3Array* vertices = new osg::Vec3Array(4);
       (*vertices)[0].set( 10.0f, -10.0f, -0.5f );
@@ -789,6 +794,7 @@ int main(int argc, char* argv[]){
   PlaybackControl* playControl = new PlaybackControl(controlStep);
   boost::scoped_ptr<BBox3f> point_cloud;        // World size of the objects
   double q25_camera_distance; // Average distance between cameras
+  size_t max_pick_targets;
 
   //OpenSceneGraph Variable which are important overall
   osgViewer::Viewer viewer;
@@ -808,6 +814,7 @@ int main(int argc, char* argv[]){
     ("show-moon","Add a transparent Moon to the display.")
     ("show-mars","Add a transparent Mars to the display.")
     ("show-earth","Add a transparent Earth to the display.")
+    ("max-pick-targets",po::value<size_t>(&max_pick_targets)->default_value(10000),"Points and cameras can be picked with the mouse only if there are no more than this many of them, as each needs its own node in the scene.")
     ("help,h","Display this help message.");
 
   std::ostringstream usage;
@@ -1008,7 +1015,8 @@ int main(int argc, char* argv[]){
   {
     root->addChild( createScene( pointData,    cameraData,
                                  connLineData, addPointData,
-                                 point_cloud.get(),  q25_camera_distance ) );
+                                 point_cloud.get(),  q25_camera_distance,
+                                 max_pick_targets ) );
 
     // Optimizing the Scene (seems like good practice in OSG)
     osgUtil::Optimizer optimizer;
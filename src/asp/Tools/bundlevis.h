@@ -192,10 +192,14 @@ std::vector<ConnLineIter*> loadControlNet( std::string cnetFile ,
                                            vw::ba::ControlNetwork* cnet,
                                            int* step );
 
-// This builds the entire scene
+// This builds the entire scene. Points and cameras get targets for
+// picking only if there are no more than max_pick_targets of them.
 osg::Node* createScene( std::vector<PointIter*>& points,
                         std::vector<CameraIter*>& cameras,
-                        std::vector<ConnLineIter*>& connLines );
+                        std::vector<ConnLineIter*>& connLines,
+                        std::vector< std::vector<PointIter*> >& addPoints,
+                        vw::BBox3f const* point_cloud, double cam_distance,
+                        size_t max_pick_targets );
 
 // Playback control
 class PlaybackControl {
@@ -328,37 +332,38 @@ struct pushbroomDrawCallback : public osg::Drawable::DrawCallback {
   mutable int m_previousStep;
 };
 
-// This is a draw back for the lines connecting cameras and points
-struct linesDrawCallback : public osg::Drawable::DrawCallback {
-  linesDrawCallback( ConnLineIter* connLine ) {
-    m_connLine = connLine;
+// This is a draw back for all the lines connecting cameras and points,
+// in a single geometry. A line which is not to be drawn has both ends
+// at the point, so it is not seen.
+struct connLinesDrawCallback : public osg::Drawable::DrawCallback {
+  connLinesDrawCallback( std::vector<ConnLineIter*>* connLines ) {
+    m_connLines = connLines;
   }
 
   virtual void drawImplementation( osg::RenderInfo& renderInfo,
                                    const osg::Drawable* drawable ) const {
-    int buffer = m_connLine->step();
-
-    if ( buffer == 0 )
-      buffer = m_connLine->point()->size();
-
-    if ( m_previousStep != buffer ) {
-      osg::Geometry* geometry =
-        dynamic_cast<osg::Geometry*>(const_cast<osg::Drawable*>(drawable));
-      osg::Vec3Array* vertices =
-        dynamic_cast<osg::Vec3Array*>(geometry->getVertexArray());
-
-      (*vertices)[0] = m_connLine->point()->position( buffer - 1 );
-      (*vertices)[1] = m_connLine->camera()->position( buffer - 1 );
+    // Which lines are drawn can change with picking at any step
+    osg::Geometry* geometry =
+      dynamic_cast<osg::Geometry*>(const_cast<osg::Drawable*>(drawable));
+    osg::Vec3Array* vertices =
+      dynamic_cast<osg::Vec3Array*>(geometry->getVertexArray());
+
+    for ( unsigned i = 0; i < m_connLines->size(); ++i ) {
+      ConnLineIter* line = (*m_connLines)[i];
+      int buffer = line->step();
+      if ( buffer == 0 )
+        buffer = line->point()->size();
+      (*vertices)[2*i] = line->point()->position( buffer - 1 );
+      if ( line->is_drawable() )
+        (*vertices)[2*i+1] = line->camera()->position( buffer - 1 );
+      else
+        (*vertices)[2*i+1] = (*vertices)[2*i];
     }
 
-    m_previousStep = buffer;
-
-    if ( m_connLine->is_drawable() )
-      drawable->drawImplementation( renderInfo );
+    drawable->drawImplementation( renderInfo );
   }
 
-  mutable ConnLineIter* m_connLine;
-  mutable int m_previousStep;
+  mutable std::vector<ConnLineIter*>* m_connLines;
 };
 
 // This is a update callback, it's meant just to work with playback control
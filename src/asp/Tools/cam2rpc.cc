@@ -29,6 +29,8 @@
 #include <vw/Image.h>
 #include <vw/Cartography/Datum.h>
 #include <vw/Cartography/GeoReference.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/FileUtils.h>
@@ -40,6 +42,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/program_options.hpp>
+#include <boost/noncopyable.hpp>
 
 namespace fs = boost::filesystem;
 namespace po = boost::program_options;
@@ -58,12 +61,12 @@ struct Options : public vw::cartography::GdalWriteOptions {
   BBox2i image_crop_box;
   Vector2 height_range;
   float output_nodata_value;
-  double gsd;
+  double gsd, refine_error;
   int num_samples;
   Options(): penalty_weight(-1.0), no_crop(false),
              skip_computing_rpc(false), save_tif(false), has_output_nodata(false),
              output_nodata_value(-std::numeric_limits<float>::max()),
-             gsd(-1.0), num_samples(-1) {}
+             gsd(-1.0), refine_error(0.0), num_samples(-1) {}
 };
 
 void handle_arguments(int argc, char *argv[], Options& opt) {
@@ -96,7 +99,9 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("dem-file",   po::value(&opt.dem_file)->default_value(""),
      "Instead of using a longitude-latitude-height box, sample the surface of this DEM.")
     ("gsd",     po::value(&opt.gsd)->default_value(-1),
-     "Expected resolution on the ground, in meters. This is needed for SETSM.");
+     "Expected resolution on the ground, in meters. This is needed for SETSM.")
+    ("refine-error",     po::value(&opt.refine_error)->default_value(0.0),
+     "If positive, sample the camera also at the centers of the cells of the sampling grid, add the samples where the RPC model is off by more than this many pixels, and fit the model again.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -169,6 +174,189 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   }
 }
 
+// The camera is sampled on a grid of lon-lat-height or of DEM pixels.
+// The samples of one value of the first grid coordinate form a slice,
+// and the slices are projected into the camera in parallel. With an
+// offset of 0.5 the centers of the grid cells are sampled instead of
+// its nodes.
+struct SampleGrid {
+  CameraModel const* cam;
+  BBox2 image_box;
+  double offset;
+
+  // Sampling a lon-lat-height box
+  Datum datum;
+  Vector3 llh_min, llh_delta;
+  int num_samples;
+
+  // Sampling a DEM
+  ImageView< PixelMask<double> > const* dem;
+  GeoReference dem_geo;
+  double delta_col, delta_row;
+
+  SampleGrid(): cam(NULL), offset(0), num_samples(0), dem(NULL),
+                delta_col(1), delta_row(1) {}
+
+  // The number of samples along a box axis. With no extent there is
+  // a single sample.
+  int num_box_steps(double delta) const {
+    if (delta == 0)
+      return 1;
+    return offset == 0 ? num_samples + 1 : num_samples;
+  }
+
+  int num_dem_steps(double delta, int size) const {
+    int n = 0;
+    while ((n + offset)*delta < size)
+      n++;
+    return n;
+  }
+
+  int num_slices() const {
+    if (dem != NULL)
+      return num_dem_steps(delta_col, dem->cols());
+    return num_box_steps(llh_delta[0]);
+  }
+
+  void add_sample(Datum const& d, Vector3 llh,
+                  std::vector<Vector3> & llh_vec, std::vector<Vector2> & pix_vec) const {
+    Vector3 xyz = d.geodetic_to_cartesian(llh);
+
+    // Go back to llh. This is a bugfix for the 360 deg offset problem.
+    llh = d.cartesian_to_geodetic(xyz);
+
+    Vector2 cam_pix = cam->point_to_pixel(xyz);
+    if (image_box.contains(cam_pix)) {
+      llh_vec.push_back(llh);
+      pix_vec.push_back(cam_pix);
+    }
+  }
+
+  void sample_slice(int i, std::vector<Vector3> & llh_vec,
+                    std::vector<Vector2> & pix_vec) const {
+    if (dem == NULL) {
+      int num_lat = num_box_steps(llh_delta[1]), num_ht = num_box_steps(llh_delta[2]);
+      double lon = llh_min[0] + (i + offset)*llh_delta[0];
+      for (int j = 0; j < num_lat; j++) {
+        double lat = llh_min[1] + (j + offset)*llh_delta[1];
+        for (int k = 0; k < num_ht; k++) {
+          double ht = llh_min[2] + (k + offset)*llh_delta[2];
+          add_sample(datum, Vector3(lon, lat, ht), llh_vec, pix_vec);
+        }
+      }
+      return;
+    }
+
+    // A copy of the georeference per slice, as its projection is not
+    // safe to share among threads
+    GeoReference geo = dem_geo;
+    int col = (i + offset)*delta_col; // cast to int
+    int num_rows = num_dem_steps(delta_row, dem->rows());
+    for (int j = 0; j < num_rows; j++) {
+      int row = (j + offset)*delta_row; // cast to int
+      if (!is_valid((*dem)(col, row))) continue;
+
+      // Lon lat height
+      Vector2 lonlat = geo.pixel_to_lonlat(Vector2(col, row));
+      Vector3 llh(lonlat[0], lonlat[1], (*dem)(col, row).child());
+      add_sample(geo.datum(), llh, llh_vec, pix_vec);
+    }
+  }
+};
+
+class SampleSliceTask: public vw::Task, private boost::noncopyable {
+  SampleGrid const& m_grid;
+  int m_slice;
+  std::vector<Vector3> & m_llh;
+  std::vector<Vector2> & m_pix;
+  vw::Mutex & m_mutex;
+  vw::TerminalProgressCallback & m_tpc;
+  double m_inc_amount;
+public:
+  SampleSliceTask(SampleGrid const& grid, int slice,
+                  std::vector<Vector3> & llh, std::vector<Vector2> & pix,
+                  vw::Mutex & mutex, vw::TerminalProgressCallback & tpc, double inc_amount):
+    m_grid(grid), m_slice(slice), m_llh(llh), m_pix(pix), m_mutex(mutex),
+    m_tpc(tpc), m_inc_amount(inc_amount) {}
+
+  void operator()() {
+    m_grid.sample_slice(m_slice, m_llh, m_pix);
+    vw::Mutex::Lock lock(m_mutex);
+    m_tpc.report_incremental_progress(m_inc_amount);
+  }
+};
+
+// Sample the grid, in parallel unless the camera is not thread-safe,
+// and append the samples which project into the image. They are
+// appended in the order of a serial loop, so results do not depend
+// on the number of threads.
+void sample_camera(SampleGrid const& grid, int num_threads,
+                   std::vector<Vector3> & all_llh, std::vector<Vector2> & all_pixels) {
+
+  int num_slices = grid.num_slices();
+  std::vector< std::vector<Vector3> > llh(num_slices);
+  std::vector< std::vector<Vector2> > pix(num_slices);
+
+  vw::TerminalProgressCallback tpc("asp", "\t--> ");
+  tpc.report_progress(0);
+  vw::Mutex mutex;
+  double inc_amount = 1.0 / std::max(num_slices, 1);
+  vw::FifoWorkQueue queue(num_threads);
+  for (int i = 0; i < num_slices; i++) {
+    boost::shared_ptr<SampleSliceTask>
+      task(new SampleSliceTask(grid, i, llh[i], pix[i], mutex, tpc, inc_amount));
+    queue.add_task(task);
+  }
+  queue.join_all();
+  tpc.report_finished();
+
+  for (int i = 0; i < num_slices; i++) {
+    all_llh.insert(all_llh.end(), llh[i].begin(), llh[i].end());
+    all_pixels.insert(all_pixels.end(), pix[i].begin(), pix[i].end());
+  }
+}
+
+// Fit the RPC model to the point pairs, normalized to the given boxes.
+void fit_rpc(Options const& opt,
+             std::vector<Vector3> const& all_llh, std::vector<Vector2> const& all_pixels,
+             Vector3 const& llh_scale, Vector3 const& llh_offset,
+             Vector2 const& pixel_scale, Vector2 const& pixel_offset,
+             asp::RPCModel::CoeffVec & line_num, asp::RPCModel::CoeffVec & line_den,
+             asp::RPCModel::CoeffVec & samp_num, asp::RPCModel::CoeffVec & samp_den) {
+
+  Vector<double> normalized_llh;
+  Vector<double> normalized_pixels;
+  int num_total_pts = all_llh.size();
+  normalized_llh.set_size(asp::RPCModel::GEODETIC_COORD_SIZE*num_total_pts);
+  normalized_pixels.set_size(asp::RPCModel::IMAGE_COORD_SIZE*num_total_pts
+                             + asp::RpcSolveLMA::NUM_PENALTY_TERMS);
+  for (size_t i = 0; i < normalized_pixels.size(); i++) {
+    // Important: The extra penalty terms are all set to zero here.
+    normalized_pixels[i] = 0.0; 
+  }
+    
+  // Form the arrays of normalized pixels and normalized llh
+  for (int pt = 0; pt < num_total_pts; pt++) {
+    // Normalize the pixel to -1 <> 1 range
+    Vector3 llh_n   = elem_quot(all_llh[pt]    - llh_offset,   llh_scale);
+    Vector2 pixel_n = elem_quot(all_pixels[pt] - pixel_offset, pixel_scale);
+    subvector(normalized_llh, asp::RPCModel::GEODETIC_COORD_SIZE*pt,
+              asp::RPCModel::GEODETIC_COORD_SIZE) = llh_n;
+    subvector(normalized_pixels, asp::RPCModel::IMAGE_COORD_SIZE*pt,
+              asp::RPCModel::IMAGE_COORD_SIZE   ) = pixel_n;
+  }
+
+  // Find the RPC coefficients
+  std::string output_prefix = "";
+  vw_out() << "Generating the RPC approximation using " << num_total_pts << " point pairs.\n";
+  asp::gen_rpc(// Inputs
+               opt.penalty_weight, output_prefix,
+               normalized_llh, normalized_pixels,  
+               llh_scale, llh_offset, pixel_scale, pixel_offset,
+               // Outputs
+               line_num, line_den, samp_num, samp_den);
+}
+
 int main( int argc, char *argv[] ) {
 
   Options opt;
@@ -232,89 +420,48 @@ int main( int argc, char *argv[] ) {
     std::vector<Vector3> all_llh;
     std::vector<Vector2> all_pixels;
 
-    vw_out() << "Projecting pixels into the camera to generate the RPC model.\n";
-    vw::TerminalProgressCallback tpc("asp", "\t--> ");
-    double inc_amount = 1.0 / double(opt.num_samples);
-    
+    // ISIS cameras are not thread-safe
+    int num_threads = vw_settings().default_num_threads();
+    if (session->name() == "isis" || session->name() == "isismapisis")
+      num_threads = 1;
+
+    SampleGrid grid;
+    grid.cam       = cam.get();
+    grid.image_box = image_box;
+
+    ImageView< PixelMask<double> > dem;
     if (opt.dem_file.empty()) {
 
-      cartography::Datum datum(opt.datum_str);
-      vw_out() << "Using datum: " << datum << std::endl;
+      grid.datum = cartography::Datum(opt.datum_str);
+      vw_out() << "Using datum: " << grid.datum << std::endl;
       
       BBox2   & ll = opt.lon_lat_range; // shortcut
       Vector2 & H  = opt.height_range;
-      double delta_lon = (ll.max()[0] - ll.min()[0])/double(opt.num_samples);
-      double delta_lat = (ll.max()[1] - ll.min()[1])/double(opt.num_samples);
-      double delta_ht  = (H[1] - H[0])/double(opt.num_samples);
-      tpc.report_progress(0);
-      for (double lon = ll.min()[0]; lon <= ll.max()[0]; lon += delta_lon) {
-        for (double lat = ll.min()[1]; lat <= ll.max()[1]; lat += delta_lat) {
-          for (double ht = H[0]; ht <= H[1]; ht += delta_ht) {
-
-            Vector3 llh(lon, lat, ht);
-            Vector3 xyz = datum.geodetic_to_cartesian(llh);
-            
-            // Go back to llh. This is a bugfix for the 360 deg offset problem.
-            llh = datum.cartesian_to_geodetic(xyz);
-            
-            Vector2 cam_pix = cam->point_to_pixel(xyz);
-            if (image_box.contains(cam_pix)) {
-              all_llh.push_back(llh);
-              all_pixels.push_back(cam_pix);
-            }
-            
-          }
-        }
-        tpc.report_incremental_progress(inc_amount);
-      }
-      
+      grid.num_samples = opt.num_samples;
+      grid.llh_min     = Vector3(ll.min()[0], ll.min()[1], H[0]);
+      grid.llh_delta   = Vector3(ll.max()[0] - ll.min()[0], ll.max()[1] - ll.min()[1],
+                                 H[1] - H[0]) / double(opt.num_samples);
     }else{
       vw_out() << "Sampling the surface of the DEM: " << opt.dem_file  << std::endl;
 
       float dem_nodata_val = -std::numeric_limits<float>::max(); 
       vw::read_nodata_val(opt.dem_file, dem_nodata_val);
-      ImageView< PixelMask<double> > dem = create_mask
+      dem = create_mask
         (channel_cast<double>(DiskImageView<float>(opt.dem_file)), dem_nodata_val);
       
-      GeoReference dem_geo;
-      if (!read_georeference(dem_geo, opt.dem_file))
+      if (!read_georeference(grid.dem_geo, opt.dem_file))
         vw_throw( ArgumentErr() << "Missing georef.\n");
       
-      
       // If the DEM is too big, we need to skip points. About
       // 40,000 points should be good enough to determine 78 RPC
       // coefficients.
-      double delta_col = std::max(1.0, dem.cols()/double(opt.num_samples));
-      double delta_row = std::max(1.0, dem.rows()/double(opt.num_samples));
-      tpc.report_progress(0);
-      for (double dcol = 0; dcol < dem.cols(); dcol += delta_col) {
-        for (double drow = 0; drow < dem.rows(); drow += delta_row) {
-          int col = dcol, row = drow; // cast to int
-          
-          if (!is_valid(dem(col, row))) continue;
-          
-          Vector2 pix(col, row);
-          Vector2 lonlat = dem_geo.pixel_to_lonlat(pix);
-          
-          // Lon lat height
-          Vector3 llh;
-          llh[0] = lonlat[0]; llh[1] = lonlat[1]; llh[2] = dem(col, row).child();
-          Vector3 xyz = dem_geo.datum().geodetic_to_cartesian(llh);
-          
-          // Go back to llh. This is a bugfix for the 360 deg offset problem.
-          llh = dem_geo.datum().cartesian_to_geodetic(xyz);
-          
-          Vector2 cam_pix = cam->point_to_pixel(xyz);
-          if (image_box.contains(cam_pix)) {
-            all_llh.push_back(llh);
-            all_pixels.push_back(cam_pix);
-          }
-          
-        }
-        tpc.report_incremental_progress(inc_amount);
-      }
+      grid.dem       = &dem;
+      grid.delta_col = std::max(1.0, dem.cols()/double(opt.num_samples));
+      grid.delta_row = std::max(1.0, dem.rows()/double(opt.num_samples));
     }
-    tpc.report_finished();
+
+    vw_out() << "Projecting pixels into the camera to generate the RPC model.\n";
+    sample_camera(grid, num_threads, all_llh, all_pixels);
 
     // The pixel box
     BBox2 pixel_box;
@@ -382,38 +529,48 @@ int main( int argc, char *argv[] ) {
     vw_out() << "Lon-lat-height box for the RPC approx: " << llh_box   << std::endl;
     vw_out() << "Camera pixel box for the RPC approx:   " << pixel_box << std::endl;
 
-    Vector<double> normalized_llh;
-    Vector<double> normalized_pixels;
-    int num_total_pts = all_llh.size();
-    normalized_llh.set_size(asp::RPCModel::GEODETIC_COORD_SIZE*num_total_pts);
-    normalized_pixels.set_size(asp::RPCModel::IMAGE_COORD_SIZE*num_total_pts
-			       + asp::RpcSolveLMA::NUM_PENALTY_TERMS);
-    for (size_t i = 0; i < normalized_pixels.size(); i++) {
-      // Important: The extra penalty terms are all set to zero here.
-      normalized_pixels[i] = 0.0; 
-    }
-      
-    // Form the arrays of normalized pixels and normalized llh
-    for (int pt = 0; pt < num_total_pts; pt++) {
-      // Normalize the pixel to -1 <> 1 range
-      Vector3 llh_n   = elem_quot(all_llh[pt]    - llh_offset,   llh_scale);
-      Vector2 pixel_n = elem_quot(all_pixels[pt] - pixel_offset, pixel_scale);
-      subvector(normalized_llh, asp::RPCModel::GEODETIC_COORD_SIZE*pt,
-		asp::RPCModel::GEODETIC_COORD_SIZE) = llh_n;
-      subvector(normalized_pixels, asp::RPCModel::IMAGE_COORD_SIZE*pt,
-		asp::RPCModel::IMAGE_COORD_SIZE   ) = pixel_n;
-    }
-
-    // Find the RPC coefficients
     asp::RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
-    std::string output_prefix = "";
-    vw_out() << "Generating the RPC approximation using " << num_total_pts << " point pairs.\n";
-    asp::gen_rpc(// Inputs
-		 opt.penalty_weight, output_prefix,
-		 normalized_llh, normalized_pixels,  
-		 llh_scale, llh_offset, pixel_scale, pixel_offset,
-		 // Outputs
-		 line_num, line_den, samp_num, samp_den);
+    fit_rpc(opt, all_llh, all_pixels, llh_scale, llh_offset, pixel_scale, pixel_offset,
+            line_num, line_den, samp_num, samp_den);
+
+    // Where the model is worse than allowed between the samples, add
+    // samples at the cell centers and fit again. They are kept only
+    // within the boxes the model was normalized to.
+    if (opt.refine_error > 0) {
+      std::vector<Vector3> mid_llh;
+      std::vector<Vector2> mid_pixels;
+      grid.offset = 0.5;
+      vw_out() << "Sampling the centers of the grid cells.\n";
+      sample_camera(grid, num_threads, mid_llh, mid_pixels);
+
+      int num_added = 0;
+      double max_error = 0;
+      for (size_t i = 0; i < mid_llh.size(); i++) {
+        Vector2 pix = mid_pixels[i];
+        if (!opt.no_crop)
+          pix -= crop_box.min();
+        if (!pixel_box.contains(pix) || !llh_box.contains(mid_llh[i]))
+          continue;
+        Vector2 rpc_pix = elem_prod(asp::RPCModel::normalized_geodetic_to_normalized_pixel
+                                    (elem_quot(mid_llh[i] - llh_offset, llh_scale),
+                                     line_num, line_den, samp_num, samp_den),
+                                    pixel_scale) + pixel_offset;
+        double err = norm_2(rpc_pix - pix);
+        max_error = std::max(max_error, err);
+        if (err > opt.refine_error) {
+          all_llh.push_back(mid_llh[i]);
+          all_pixels.push_back(pix);
+          num_added++;
+        }
+      }
+      vw_out() << "Max RPC error at the cell centers: " << max_error << " pixels.\n";
+      if (num_added > 0) {
+        vw_out() << "Adding " << num_added << " samples where the error exceeds "
+                 << opt.refine_error << " pixels.\n";
+        fit_rpc(opt, all_llh, all_pixels, llh_scale, llh_offset, pixel_scale, pixel_offset,
+                line_num, line_den, samp_num, samp_den);
+      }
+    }
 
     // TODO: Integrate this with aster2asp existing functionality!
     // Have a generic function for saving WV RPC files. 
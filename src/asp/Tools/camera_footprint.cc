@@ -30,9 +30,14 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/FileUtils.h>
+#include <vw/Core/ThreadPool.h>
 
 #include <limits>
 #include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
@@ -49,7 +54,8 @@ using namespace vw::cartography;
 
 struct Options : public vw::cartography::GdalWriteOptions {
   string image_file, camera_file, stereo_session, bundle_adjust_prefix,
-         datum_str, dem_file, target_srs_string, output_kml;
+         datum_str, dem_file, target_srs_string, output_kml,
+         image_camera_list, output_geojson;
   bool quick;
   //BBox2i image_crop_box;
 };
@@ -64,6 +70,10 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
 	     "Use a faster but less accurate computation.")
     ("output-kml", po::value(&opt.output_kml),
      "Create an output KML file at this path.")
+    ("image-camera-list", po::value(&opt.image_camera_list)->default_value(""),
+     "Compute the footprints of all the images in this file, in parallel. Each line has an image and its camera model, or only the image if it contains the camera, as for ISIS cubes.")
+    ("output-geojson", po::value(&opt.output_geojson)->default_value(""),
+     "Save the footprints, as polygons in longitude and latitude with the image, camera, bounding box and mean GSD of each, to this GeoJSON file.")
     ("session-type,t",   po::value(&opt.stereo_session)->default_value(""),
      "Select the input camera model type. Normally this is auto-detected, but may need to be specified if the input camera model is in XML format. Options: pinhole isis rpc dg spot5 aster.")
     ("bundle-adjust-prefix", po::value(&opt.bundle_adjust_prefix),
@@ -94,9 +104,17 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
 			    allow_unregistered, unregistered);
 
   
-  if ( opt.image_file.empty() )
+  if ( opt.image_file.empty() && opt.image_camera_list.empty() )
     vw_throw( ArgumentErr() << "Missing input image.\n" << usage << general_options );
 
+  if ( !opt.image_file.empty() && !opt.image_camera_list.empty() )
+    vw_throw( ArgumentErr() << "Cannot specify both an image and --image-camera-list.\n"
+              << usage << general_options );
+
+  if ( !opt.image_camera_list.empty() && !opt.output_kml.empty() )
+    vw_throw( ArgumentErr() << "With --image-camera-list, use --output-geojson "
+              << "rather than --output-kml.\n" );
+
   if (boost::iends_with(opt.image_file, ".cub") && opt.stereo_session == "" )
     opt.stereo_session = "isis";
 
@@ -117,6 +135,241 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   //}
 }
 
+/// The footprint of one camera.
+struct Footprint {
+  std::string          image_file, camera_file, error;
+  BBox2                bbox;   ///< In the target projection
+  float                mean_gsd;
+  std::vector<Vector3> coords; ///< Longitude, latitude, and height of the boundary
+  Footprint(): mean_gsd(0) {}
+};
+
+/// The georeference to compute the footprints in, and the DEM, if any.
+/// These are read once and shared by all cameras.
+struct FootprintTarget {
+  GeoReference                      georef;
+  ImageViewRef< PixelMask<double> > dem;
+  bool                              has_dem;
+  FootprintTarget(): has_dem(false) {}
+};
+
+void load_target(Options const& opt, FootprintTarget & target) {
+
+  if (opt.dem_file.empty()) { // No DEM available, intersect with the datum.
+
+    // Initialize the georef/datum
+    bool have_user_datum = (opt.datum_str != "");
+    cartography::Datum datum(opt.datum_str);
+    target.georef = GeoReference(datum);
+      
+    asp::set_srs_string(opt.target_srs_string, have_user_datum, datum, target.georef);
+      
+  } else { // DEM provided, intersect with it.
+
+    // Load the DEM
+    float dem_nodata_val = -std::numeric_limits<float>::max(); 
+    vw::read_nodata_val(opt.dem_file, dem_nodata_val);
+    target.dem = create_mask
+      (channel_cast<double>(DiskImageView<float>(opt.dem_file)), dem_nodata_val);
+    target.has_dem = true;
+      
+    if (!read_georeference(target.georef, opt.dem_file))
+      vw_throw( ArgumentErr() << "Missing georef.\n");
+  }
+  vw_out() << "Using georef: " << target.georef << std::endl;
+}
+
+/// Load the camera of an image. If the session is ISIS, the camera
+/// is in the image, and the camera file is set to it.
+boost::shared_ptr<CameraModel> load_camera(Options const& opt, std::string const& image_file,
+                                           std::string & camera_file, std::string & session_name) {
+
+  std::string stereo_session = opt.stereo_session;
+  if (boost::iends_with(image_file, ".cub") && stereo_session == "" )
+    stereo_session = "isis";
+
+  typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
+  Options session_opt = opt; // may change inside
+  SessionPtr session(asp::StereoSessionFactory::create
+                     (stereo_session, // may change inside
+                      session_opt,
+                      image_file,  image_file,
+                      camera_file, camera_file,
+                      "",
+                      "",
+                      false) ); // Do not allow promotion from normal to map projected session
+  session_name = session->name();
+
+  // If the session was above auto-guessed as isis, adjust for the fact
+  // that the isis .cub file also has camera info.
+  if ((session->name() == "isis" || session->name() == "isismapisis") ){
+    // The user did not provide an output file. Then the camera
+    // information is contained within the image file and what is in
+    // the camera file is actually the output file.
+    camera_file = image_file;
+  }
+
+  if ( camera_file.empty() )
+    vw_throw( ArgumentErr() << "Missing input camera.\n" );
+
+  return session->camera_model(image_file, camera_file);
+}
+
+void compute_footprint(Options const& opt, FootprintTarget const& target,
+                       boost::shared_ptr<CameraModel> cam, Footprint & fp) {
+
+  // Just get the image size
+  vw::Vector2i image_size = vw::file_image_size(fp.image_file);
+
+  // The georef is copied, as its projection should not be shared
+  // between threads
+  GeoReference georef = target.georef;
+  fp.coords.clear();
+  if (!target.has_dem) {
+    std::vector<Vector2> coords2;
+    fp.bbox = camera_bbox(georef, cam, image_size[0], image_size[1], fp.mean_gsd,
+                          &coords2);
+    for (size_t i=0; i<coords2.size(); ++i) {
+      Vector3 proj_coord(coords2[i][0], coords2[i][1], 0.0);
+      fp.coords.push_back(georef.point_to_geodetic(proj_coord));
+    }
+  } else {
+    fp.bbox = camera_bbox(target.dem, georef, georef, cam,
+                          image_size[0], image_size[1], fp.mean_gsd, opt.quick, &fp.coords);
+    for (size_t i=0; i<fp.coords.size(); ++i)
+      fp.coords[i] = georef.datum().cartesian_to_geodetic(fp.coords[i]);
+  }
+}
+
+/// Compute the footprint of one of the cameras of a list. Failures
+/// are reported with the footprint rather than thrown, so one bad
+/// camera does not stop the others.
+class FootprintTask: public vw::Task, private boost::noncopyable {
+  Options         const& m_opt;
+  FootprintTarget const& m_target;
+  Footprint            & m_fp;
+  vw::Mutex            & m_camera_mutex;
+  bool                   m_lock_cameras;
+public:
+  FootprintTask(Options const& opt, FootprintTarget const& target, Footprint & fp,
+                vw::Mutex & camera_mutex, bool lock_cameras):
+    m_opt(opt), m_target(target), m_fp(fp), m_camera_mutex(camera_mutex),
+    m_lock_cameras(lock_cameras) {}
+  void operator()() {
+    try {
+      boost::shared_ptr<CameraModel> cam;
+      std::string session_name;
+      {
+        // The session factory is not known to be thread-safe
+        vw::Mutex::Lock lock(m_camera_mutex);
+        cam = load_camera(m_opt, m_fp.image_file, m_fp.camera_file, session_name);
+      }
+      if (m_lock_cameras) {
+        vw::Mutex::Lock lock(m_camera_mutex);
+        compute_footprint(m_opt, m_target, cam, m_fp);
+      } else {
+        compute_footprint(m_opt, m_target, cam, m_fp);
+      }
+    } catch (const std::exception& e) {
+      m_fp.error = e.what();
+    }
+  }
+};
+
+/// Read the lines of image and camera files. The camera can be
+/// omitted if it is in the image.
+std::vector<Footprint> read_image_camera_list(std::string const& list_file) {
+  std::ifstream ifs(list_file.c_str());
+  if (!ifs)
+    vw_throw( ArgumentErr() << "Could not read: " << list_file << "\n" );
+  std::vector<Footprint> footprints;
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream is(line);
+    Footprint fp;
+    if (!(is >> fp.image_file) || fp.image_file[0] == '#')
+      continue;
+    is >> fp.camera_file;
+    footprints.push_back(fp);
+  }
+  return footprints;
+}
+
+bool lonlat_less(Vector2 const& a, Vector2 const& b) {
+  return a[0] < b[0] || (a[0] == b[0] && a[1] < b[1]);
+}
+
+/// The convex hull of the longitude-latitude points, counterclockwise,
+/// closed, as GeoJSON wants for the outer ring of a polygon.
+std::vector<Vector2> lonlat_hull(std::vector<Vector3> const& coords) {
+  std::vector<Vector2> pts;
+  for (size_t i = 0; i < coords.size(); i++)
+    pts.push_back(subvector(coords[i], 0, 2));
+  std::sort(pts.begin(), pts.end(), lonlat_less);
+  if (pts.size() < 3)
+    return pts;
+
+  // Andrew's monotone chain
+  std::vector<Vector2> hull(2*pts.size());
+  size_t k = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    size_t start = k;
+    for (size_t n = 0; n < pts.size(); n++) {
+      Vector2 const& p = (pass == 0) ? pts[n] : pts[pts.size() - 1 - n];
+      while (k >= start + 2) {
+        Vector2 a = hull[k-1] - hull[k-2], b = p - hull[k-2];
+        if (a[0]*b[1] - a[1]*b[0] > 0)
+          break;
+        k--;
+      }
+      hull[k++] = p;
+    }
+    k--; // The last point is the first of the next pass
+  }
+  hull.resize(k);
+  hull.push_back(hull[0]);
+  return hull;
+}
+
+std::string json_string(std::string const& str) {
+  std::string ans = "\"";
+  for (size_t i = 0; i < str.size(); i++) {
+    if (str[i] == '"' || str[i] == '\\')
+      ans += '\\';
+    ans += str[i];
+  }
+  return ans + "\"";
+}
+
+/// Save the footprints which were found as a GeoJSON feature collection.
+void write_geojson(std::string const& file, std::vector<Footprint> const& footprints) {
+  vw_out() << "Writing: " << file << std::endl;
+  std::ofstream os(file.c_str());
+  if (!os)
+    vw_throw( ArgumentErr() << "Could not write: " << file << "\n" );
+  os << std::setprecision(12);
+  os << "{\"type\": \"FeatureCollection\", \"features\": [";
+  bool first = true;
+  for (size_t i = 0; i < footprints.size(); i++) {
+    Footprint const& fp = footprints[i];
+    std::vector<Vector2> hull = lonlat_hull(fp.coords);
+    if (!fp.error.empty() || hull.size() < 4)
+      continue;
+    os << (first ? "\n" : ",\n");
+    first = false;
+    os << "{\"type\": \"Feature\", \"properties\": {\"image\": " << json_string(fp.image_file)
+       << ", \"camera\": " << json_string(fp.camera_file)
+       << ", \"bbox\": [" << fp.bbox.min().x() << ", " << fp.bbox.min().y() << ", "
+       << fp.bbox.max().x() << ", " << fp.bbox.max().y() << "]"
+       << ", \"mean_gsd\": " << fp.mean_gsd << "}, "
+       << "\"geometry\": {\"type\": \"Polygon\", \"coordinates\": [[";
+    for (size_t k = 0; k < hull.size(); k++)
+      os << (k == 0 ? "" : ", ") << "[" << hull[k][0] << ", " << hull[k][1] << "]";
+    os << "]]}}";
+  }
+  os << "\n]}\n";
+}
+
 int main( int argc, char *argv[] ) {
 
   Options opt;
@@ -124,91 +377,77 @@ int main( int argc, char *argv[] ) {
 
     handle_arguments(argc, argv, opt);
 
-    typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
-    SessionPtr session(asp::StereoSessionFactory::create
-		       (opt.stereo_session, // may change inside
-                        opt,
-                        opt.image_file,  opt.image_file,
-                        opt.camera_file, opt.camera_file,
-                        "",
-                        "",
-                        false) ); // Do not allow promotion from normal to map projected session
+    FootprintTarget target;
     
-    // If the session was above auto-guessed as isis, adjust for the fact
-    // that the isis .cub file also has camera info.
-    if ((session->name() == "isis" || session->name() == "isismapisis") ){
-      // The user did not provide an output file. Then the camera
-      // information is contained within the image file and what is in
-      // the camera file is actually the output file.
-      opt.camera_file = opt.image_file;
-    }
+    if (!opt.image_camera_list.empty()) {
+
+      // Batch mode. The footprints of the cameras are computed in
+      // parallel, sharing the DEM.
+      std::vector<Footprint> footprints = read_image_camera_list(opt.image_camera_list);
+      load_target(opt, target);
+
+      // ISIS is not thread-safe
+      bool lock_cameras = (opt.stereo_session == "isis");
+      for (size_t i = 0; i < footprints.size(); i++)
+        if (boost::iends_with(footprints[i].image_file, ".cub"))
+          lock_cameras = true;
+
+      vw::Mutex camera_mutex;
+      FifoWorkQueue queue(vw_settings().default_num_threads());
+      for (size_t i = 0; i < footprints.size(); i++)
+        queue.add_task(boost::shared_ptr<FootprintTask>
+                       (new FootprintTask(opt, target, footprints[i], camera_mutex,
+                                          lock_cameras)));
+      queue.join_all();
+
+      int num_failed = 0;
+      for (size_t i = 0; i < footprints.size(); i++) {
+        Footprint const& fp = footprints[i];
+        if (!fp.error.empty()) {
+          vw_out(WarningMessage) << "Could not compute the footprint of " << fp.image_file
+                                 << ": " << fp.error << std::endl;
+          num_failed++;
+          continue;
+        }
+        vw_out() << fp.image_file << ": " << fp.bbox << ", mean gsd: " << fp.mean_gsd << "\n";
+      }
+      vw_out() << "Computed " << footprints.size() - num_failed << " of "
+               << footprints.size() << " footprints.\n";
 
-    if ( opt.camera_file.empty() )
-      vw_throw( ArgumentErr() << "Missing input camera.\n" );
+      if (!opt.output_geojson.empty())
+        write_geojson(opt.output_geojson, footprints);
+      return 0;
+    }
 
-   
-    boost::shared_ptr<CameraModel> cam = session->camera_model(opt.image_file, opt.camera_file);
+    std::string session_name;
+    boost::shared_ptr<CameraModel> cam = load_camera(opt, opt.image_file, opt.camera_file,
+                                                     session_name);
 
     // The input nodata value
     float input_nodata_value = -std::numeric_limits<float>::max(); 
     vw::read_nodata_val(opt.image_file, input_nodata_value);
 
-    // Just get the image size
-    vw::Vector2i image_size = vw::file_image_size(opt.image_file);
-
 //    // The bounding box -> Add this feature in the future!
 //    BBox2 image_box = bounding_box(input_img);
 //    if (!opt.image_crop_box.empty()) 
 //      image_box.crop(opt.image_crop_box);
     
     // Perform the computation
+    load_target(opt, target);
     
-    GeoReference target_georef;
-    
-    BBox2 footprint_bbox;
-    float mean_gsd=0;
-    std::vector<Vector3> coords;
-    if (opt.dem_file.empty()) { // No DEM available, intersect with the datum.
-
-      // Initialize the georef/datum
-      bool have_user_datum = (opt.datum_str != "");
-      cartography::Datum datum(opt.datum_str);
-      target_georef = GeoReference(datum);
-      
-      asp::set_srs_string(opt.target_srs_string, have_user_datum, datum, target_georef);
-      vw_out() << "Using georef: " << target_georef << std::endl;
-
-      std::vector<Vector2> coords2;
-      footprint_bbox = camera_bbox(target_georef, cam, image_size[0], image_size[1], mean_gsd, &coords2);
-      for (size_t i=0; i<coords2.size(); ++i) {
-        Vector3 proj_coord(coords2[i][0], coords2[i][1], 0.0);
-        coords.push_back(target_georef.point_to_geodetic(proj_coord));
-      }
-      
-    } else { // DEM provided, intersect with it.
-
-      // Load the DEM
-      float dem_nodata_val = -std::numeric_limits<float>::max(); 
-      vw::read_nodata_val(opt.dem_file, dem_nodata_val);
-      ImageViewRef< PixelMask<double> > dem = create_mask
-        (channel_cast<double>(DiskImageView<float>(opt.dem_file)), dem_nodata_val);
-      
-      GeoReference dem_georef;
-      if (!read_georeference(dem_georef, opt.dem_file))
-        vw_throw( ArgumentErr() << "Missing georef.\n");
-
-      target_georef = dem_georef; // return box in this projection
-      vw_out() << "Using georef: " << target_georef << std::endl;
-      
-      footprint_bbox = camera_bbox(dem, dem_georef, target_georef, cam,
-                                   image_size[0], image_size[1], mean_gsd, opt.quick, &coords);
-      for (size_t i=0; i<coords.size(); ++i)
-        coords[i] = target_georef.datum().cartesian_to_geodetic(coords[i]);
-    }
+    Footprint fp;
+    fp.image_file  = opt.image_file;
+    fp.camera_file = opt.camera_file;
+    compute_footprint(opt, target, cam, fp);
+    BBox2 footprint_bbox = fp.bbox;
+    std::vector<Vector3> const& coords = fp.coords;
     
     // Print out the results    
     vw_out() << "Computed footprint bounding box:\n" << footprint_bbox << std::endl;
-    vw_out() << "Computed mean gsd: " << mean_gsd << std::endl;
+    vw_out() << "Computed mean gsd: " << fp.mean_gsd << std::endl;
+
+    if (!opt.output_geojson.empty())
+      write_geojson(opt.output_geojson, std::vector<Footprint>(1, fp));
  
     if (opt.output_kml == "")
       return 0;
@@ -286,7 +286,20 @@ void ccd_adjust(std::vector<std::string> const& image_files,
   options.num_threads = num_threads;
 
   options.linear_solver_type = ceres::SPARSE_SCHUR;
-  //options.ordering_type = ceres::SCHUR;
+
+  // Eliminate the points first, then solve for the few offsets
+  ceres::ParameterBlockOrdering * ordering = new ceres::ParameterBlockOrdering;
+  for (int ipt = 0; ipt < num_points; ipt++) {
+    double * point = points + ipt * NUM_POINT_PARAMS;
+    if (problem.HasParameterBlock(point))
+      ordering->AddElementToGroup(point, 0);
+  }
+  for (int ioff = 0; ioff < num_offsets; ioff++) {
+    double * offset = ccd_offsets + ioff * NUM_PIXEL_PARAMS;
+    if (problem.HasParameterBlock(offset))
+      ordering->AddElementToGroup(offset, 1);
+  }
+  options.linear_solver_ordering.reset(ordering);
   //options.eta = 1e-3; // FLAGS_eta;
   //options->max_solver_time_in_seconds = FLAGS_max_solver_time;
   //options->use_nonmonotonic_steps = FLAGS_nonmonotonic_steps;
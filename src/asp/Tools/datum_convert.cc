@@ -27,8 +27,10 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/CorrectionGrid.h>
 
 #include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
@@ -36,13 +38,55 @@ using namespace vw;
 using namespace vw::cartography;
 using namespace std;
 
+/// Image view which converts a DEM to another datum. The heights are
+/// converted on the pixels of the input DEM, then resampled with
+/// bilinear interpolation to the pixels of the output DEM, as by
+/// geo_transform() with constant edge extension.
+/// - Both the change of height and the map from the output to the
+///   input pixels are smooth, so for each tile they are evaluated
+///   exactly only on a coarse grid, and interpolated in between.
 template <class ImageT>
 class DatumConvertView : public ImageViewBase<DatumConvertView<ImageT> >
 {
   ImageT        m_input_dem;
   GeoReference const& m_input_georef;
   GeoReference const& m_output_georef;
+  GeoTransform        m_trans;
+  int32               m_cols, m_rows;
   double              m_nodata_val;
+  double              m_max_grid_error; ///< Interpolate the heights to within this error
+
+  /// The change in height at an input pixel, for heights of zero and
+  /// of m_ref_height. Other heights are interpolated linearly.
+  struct HeightChangeFunc {
+    DatumConvertView const* m_view;
+    HeightChangeFunc(DatumConvertView const* view): m_view(view) {}
+    bool operator()(Vector2 const& pix, Vector2 & change) const {
+      change[0] = m_view->output_height(pix, 0.0);
+      change[1] = m_view->output_height(pix, m_ref_height) - m_ref_height;
+      return true;
+    }
+  };
+
+  /// The input pixel seen by an output pixel. Returns false if it
+  /// is not known, such as outside of the domain of the projection.
+  struct InputPixelFunc {
+    DatumConvertView const* m_view;
+    InputPixelFunc(DatumConvertView const* view): m_view(view) {}
+    bool operator()(Vector2 const& pix, Vector2 & input_pix) const {
+      try {
+        input_pix = m_view->m_trans.reverse(pix);
+      } catch (const vw::Exception&) {
+        return false;
+      }
+      return true;
+    }
+  };
+
+  static const double m_ref_height;
+
+  /// Interpolate the input pixels to within this many pixels
+  static const double m_max_pixel_error;
 
 public:
 
@@ -50,53 +94,115 @@ public:
   typedef double result_type;
   typedef ProceduralPixelAccessor<DatumConvertView> pixel_accessor;
 
-  /// Image view which adds or subtracts the ellipsoid/geoid difference
-  ///  from elevations in a DEM image.
   DatumConvertView(ImageT       const& input_dem,
                    GeoReference const& input_georef,
                    GeoReference const& output_georef,
-                   double nodata_val):
+                   int32 output_cols, int32 output_rows,
+                   double nodata_val, double max_grid_error):
     m_input_dem(input_dem), m_input_georef(input_georef), m_output_georef(output_georef),
-    m_nodata_val(nodata_val){}
+    m_trans(input_georef, output_georef), m_cols(output_cols), m_rows(output_rows),
+    m_nodata_val(nodata_val), m_max_grid_error(max_grid_error){}
 
-  inline int32 cols  () const { return m_input_dem.cols(); }
-  inline int32 rows  () const { return m_input_dem.rows(); }
+  inline int32 cols  () const { return m_cols; }
+  inline int32 rows  () const { return m_rows; }
   inline int32 planes() const { return 1; }
 
   inline pixel_accessor origin() const { return pixel_accessor(*this); }
 
   inline result_type operator()( size_t col, size_t row, size_t p=0 ) const {
+    vw_throw(NoImplErr() << "DatumConvertView::operator()(...) is not implemented");
+    return result_type();
+  }
 
-    // Handle nodata
-    if ( m_input_dem(col, row) == m_nodata_val )
-      return m_nodata_val;
-
-    // Compute the elevation in the output datum
-    double  current_height  = m_input_dem(col, row);
-    Vector2 input_lonlat    = m_input_georef.pixel_to_lonlat(Vector2(col, row));
+  /// The elevation in the output datum of a height at an input pixel
+  double output_height(Vector2 const& input_pixel, double current_height) const {
+    Vector2 input_lonlat    = m_input_georef.pixel_to_lonlat(input_pixel);
     Vector3 input_llh(input_lonlat[0], input_lonlat[1], current_height);
     Vector3 gcc_coord       = m_input_georef.datum().geodetic_to_cartesian(input_llh);
     Vector3 output_lonlat   = m_output_georef.datum().cartesian_to_geodetic(gcc_coord);
-    double output_height = output_lonlat[2];
-/*
-    if ( (current_height < -50) || (current_height > 700))
-    {
-      std::cout << "pixel      = " << Vector2(col, row) << std::endl;
-      std::cout << "height      = " << current_height << std::endl;
-      //std::cout << m_input_dem(col, row)  << std::endl;
-      //std::cout << "dem lonlat = " << input_llh     << std::endl;
-      //std::cout << "gcc_coord  = " << gcc_coord     << std::endl;
-      //std::cout << "out lonlat = " << output_lonlat << std::endl;
-    }
-*/
-    return output_height;
+    return output_lonlat[2];
   }
 
   /// \cond INTERNAL
-  typedef DatumConvertView<typename ImageT::prerasterize_type> prerasterize_type;
+  typedef CropView<ImageView<result_type> > prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return prerasterize_type( m_input_dem.prerasterize(bbox), m_input_georef,
-                              m_output_georef, m_nodata_val );
+
+    ImageView<result_type> tile(bbox.width(), bbox.height());
+    fill(tile, m_nodata_val);
+
+    // The input pixels seen by the tile
+    // With a maximum error of zero everything is evaluated exactly.
+    double max_pixel_error = (m_max_grid_error > 0) ? m_max_pixel_error : 0.0;
+    asp::CorrectionGrid<InputPixelFunc, 2> pixel_grid(InputPixelFunc(this), bbox,
+                                                      max_pixel_error);
+    std::vector<Vector2> input_pix(bbox.width()*bbox.height());
+    std::vector<bool>    has_input(input_pix.size());
+    BBox2 input_box;
+    for (int row = 0; row < bbox.height(); row++) {
+      for (int col = 0; col < bbox.width(); col++) {
+        int k = row*bbox.width() + col;
+        has_input[k] = pixel_grid(col + bbox.min().x(), row + bbox.min().y(), input_pix[k]);
+        if (has_input[k])
+          input_box.grow(input_pix[k]);
+      }
+    }
+    if (input_box.empty())
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+
+    // The input region needed for interpolation. With constant edge
+    // extension, pixels outside of the DEM see its closest pixels.
+    int in_cols = m_input_dem.cols(), in_rows = m_input_dem.rows();
+    Vector2i lo(std::min(std::max(int(floor(input_box.min().x())) - 1, 0), in_cols - 1),
+                std::min(std::max(int(floor(input_box.min().y())) - 1, 0), in_rows - 1));
+    Vector2i hi(std::min(std::max(int(ceil (input_box.max().x())) + 2, lo.x() + 1), in_cols),
+                std::min(std::max(int(ceil (input_box.max().y())) + 2, lo.y() + 1), in_rows));
+    BBox2i region(lo, hi);
+
+    // Compute the elevations in the output datum on the input region
+    ImageView<double> heights = crop(m_input_dem, region);
+    typedef asp::CorrectionGrid<HeightChangeFunc, 2> HeightGrid;
+    boost::shared_ptr<HeightGrid> height_grid;
+    if (m_max_grid_error > 0)
+      height_grid.reset(new HeightGrid(HeightChangeFunc(this), region, m_max_grid_error));
+    std::vector<bool> valid(heights.cols()*heights.rows());
+    Vector2 change;
+    for (int row = 0; row < heights.rows(); row++) {
+      for (int col = 0; col < heights.cols(); col++) {
+        double & height = heights(col, row);
+        valid[row*heights.cols() + col] = (height != m_nodata_val);
+        if (height == m_nodata_val)
+          continue;
+        if (height_grid) {
+          (*height_grid)(col + region.min().x(), row + region.min().y(), change);
+          height += change[0] + (change[1] - change[0]) * height / m_ref_height;
+        } else {
+          height = output_height(Vector2(col + region.min().x(), row + region.min().y()), height);
+        }
+      }
+    }
+
+    // Bilinear interpolation. The result is invalid unless all four of
+    // the neighbors are valid.
+    int rc = region.width(), rr = region.height();
+    for (int row = 0; row < bbox.height(); row++) {
+      for (int col = 0; col < bbox.width(); col++) {
+        int k = row*bbox.width() + col;
+        if (!has_input[k])
+          continue;
+        double x = input_pix[k].x() - region.min().x();
+        double y = input_pix[k].y() - region.min().y();
+        int x0 = int(floor(x)), y0 = int(floor(y));
+        double wx = x - x0, wy = y - y0;
+        int xa = std::min(std::max(x0, 0), rc - 1), xb = std::min(std::max(x0 + 1, 0), rc - 1);
+        int ya = std::min(std::max(y0, 0), rr - 1), yb = std::min(std::max(y0 + 1, 0), rr - 1);
+        if (!valid[ya*rc + xa] || !valid[ya*rc + xb] || !valid[yb*rc + xa] || !valid[yb*rc + xb])
+          continue;
+        tile(col, row) = (1-wy)*((1-wx)*heights(xa, ya) + wx*heights(xb, ya)) +
+                            wy *((1-wx)*heights(xa, yb) + wx*heights(xb, yb));
+      }
+    }
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
   }
   template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
     vw::rasterize( prerasterize(bbox), dest, bbox );
@@ -104,14 +210,22 @@ public:
   /// \endcond
 };
 
+template <class ImageT>
+const double DatumConvertView<ImageT>::m_ref_height = 1000.0;
+
+template <class ImageT>
+const double DatumConvertView<ImageT>::m_max_pixel_error = 0.01;
+
 // Helper function which uses the class above.
 template <class ImageT>
 DatumConvertView<ImageT>
 datum_convert( ImageViewBase<ImageT> const& input_dem,
                GeoReference          const& input_georef,
                GeoReference          const& output_georef,
-               double                       nodata_val) {
-  return DatumConvertView<ImageT>( input_dem.impl(), input_georef, output_georef, nodata_val );
+               int32 output_cols, int32 output_rows,
+               double nodata_val, double max_grid_error) {
+  return DatumConvertView<ImageT>( input_dem.impl(), input_georef, output_georef,
+                                   output_cols, output_rows, nodata_val, max_grid_error );
 }
 
 /// Convert input pixel location to output projection location
@@ -166,7 +280,7 @@ BBox2 get_output_projected_bbox(GeoReference     const& input_georef,
 
 struct Options : vw::cartography::GdalWriteOptions {
   string input_dem, output_dem, output_datum, target_srs_string;
-  double nodata_value;
+  double nodata_value, max_grid_error;
   bool   use_double;
 };
 
@@ -179,7 +293,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ){
     ("nodata_value", po::value(&opt.nodata_value)->default_value(-32768),
      "The value of no-data pixels, unless specified in the DEM.")
     ("double", po::bool_switch(&opt.use_double)->default_value(false)->implicit_value(true),
-     "Output using double precision (64 bit) instead of float (32 bit).");
+     "Output using double precision (64 bit) instead of float (32 bit).")
+    ("max-grid-error", po::value(&opt.max_grid_error)->default_value(0.001),
+     "Evaluate the change of height exactly on a coarse grid of each tile, refined until interpolating it is within this many meters of the exact change at the centers of the grid cells, and interpolate in between. The positions in the input DEM of the output pixels are found the same way, to within 0.01 pixels. If 0, evaluate both at each pixel.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -212,6 +328,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ){
 
   boost::to_lower(opt.output_datum);
 
+  if (opt.max_grid_error < 0)
+    vw_throw( ArgumentErr() << "The maximum grid error must be non-negative.\n" );
+
   vw::create_out_dir(opt.output_dem);
 
   //// Turn on logging to file
@@ -279,23 +398,13 @@ void do_work(Options const& opt) {
   BBox2i output_pixel_box = output_georef.point_to_pixel_bbox(output_proj_box);
   vw_out() << "Computed output pixel box:\n" << output_pixel_box << std::endl;
 
-  // Update the elevation values in the image to account for the new datum.
-  ImageViewRef<double> dem_new_heights = datum_convert(pixel_cast<double>(dem_img),
-                                                       dem_georef,
-                                                       output_georef,
-                                                       dem_nodata_val
-                                                      );
-
-  // Apply the horizontal warping to the image on account of the new datum.
-  ImageViewRef<double> output_dem = apply_mask(geo_transform(create_mask(dem_new_heights,
-                                                                         dem_nodata_val),
-                                                             dem_georef, output_georef,
-                                                             output_pixel_box.width(),
-                                                             output_pixel_box.height(),
-                                                             ConstantEdgeExtension()
-                                                            ),
-                                               dem_nodata_val
-                                              );
+  // Update the elevation values in the image to account for the new
+  // datum, and apply the horizontal warping on account of the new datum.
+  ImageViewRef<double> output_dem = datum_convert(pixel_cast<double>(dem_img),
+                                                  dem_georef, output_georef,
+                                                  output_pixel_box.width(),
+                                                  output_pixel_box.height(),
+                                                  dem_nodata_val, opt.max_grid_error);
 
   vw_out() << "Writing adjusted DEM: " << opt.output_dem << endl;
 
@@ -34,6 +34,7 @@ extern "C" {
 #include <vw/Math.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/CorrectionGrid.h>
 
 #include <boost/filesystem.hpp>
 namespace po = boost::program_options;
@@ -55,6 +56,16 @@ class DemGeoidView : public ImageViewBase<DemGeoidView<ImageT> >
   bool     m_reverse_adjustment; ///< If true, convert from orthometric height to geoid height
   double   m_correction;
   double   m_nodata_val;
+  double   m_max_grid_error; ///< Interpolate the geoid heights of a tile to within this error
+
+  /// The geoid height at a DEM pixel, for evaluation on a grid.
+  struct GeoidHeightFunc {
+    DemGeoidView const* m_view;
+    GeoidHeightFunc(DemGeoidView const* view): m_view(view) {}
+    bool operator()(Vector2 const& pix, Vector<double, 1> & height) const {
+      return m_view->geoid_height(pix, height[0]);
+    }
+  };
 
 public:
 
@@ -68,13 +79,14 @@ public:
                bool is_egm2008, vector<double> const& egm2008_grid,
                ImageViewRef<PixelMask<double> > const& geoid,
                GeoReference const& geoid_georef, bool reverse_adjustment,
-               double correction, double nodata_val):
+               double correction, double nodata_val, double max_grid_error):
     m_img(img), m_georef(georef),
     m_is_egm2008(is_egm2008), m_egm2008_grid(egm2008_grid),
     m_geoid(geoid), m_geoid_georef(geoid_georef),
     m_reverse_adjustment(reverse_adjustment),
     m_correction(correction),
-    m_nodata_val(nodata_val){}
+    m_nodata_val(nodata_val),
+    m_max_grid_error(max_grid_error){}
 
   inline int32 cols  () const { return m_img.cols(); }
   inline int32 rows  () const { return m_img.rows(); }
@@ -82,12 +94,12 @@ public:
 
   inline pixel_accessor origin() const { return pixel_accessor(*this); }
 
-  inline result_type operator()( size_t col, size_t row, size_t p=0 ) const {
-
-    if ( m_img(col, row, p) == m_nodata_val )
-      return m_nodata_val; // Skip invalid pixels
+  /// The height of the geoid above the ellipsoid at a DEM pixel,
+  /// including the correction. Returns false if the geoid is not
+  /// known there.
+  bool geoid_height(Vector2 const& pix, double & geoid_height) const {
 
-    Vector2 lonlat = m_georef.pixel_to_lonlat(Vector2(col, row));
+    Vector2 lonlat = m_georef.pixel_to_lonlat(pix);
 
     // For testing (see the link to the reference web form belows).
     //lonlat[0] = -121;   lonlat[1] = 37;   // mainland US
@@ -112,9 +124,7 @@ public:
     while( lonlat[0] <   0.0  ) lonlat[0] += 360.0;
     while( lonlat[0] >= 360.0 ) lonlat[0] -= 360.0;
 
-
-
-    result_type geoid_height = 0.0;
+    geoid_height = 0.0;
     if (m_is_egm2008){
       int nr = m_geoid.rows(), 
           nc = m_geoid.cols();
@@ -126,29 +136,64 @@ public:
       Vector2  pix = m_geoid_georef.lonlat_to_pixel(lonlat);
       PixelMask<double> interp_val = m_geoid(pix[0], pix[1]);
       if (!is_valid(interp_val))
-        return m_nodata_val;
+        return false;
       geoid_height = interp_val.child();
     }
 
     geoid_height += m_correction;
+    return true;
+  }
 
-    result_type height_above_ellipsoid = m_img(col, row, p);
-    
-    // Compute height above the geoid
-    // - See the note in the main program about the formula below
+  /// Compute height above the geoid
+  /// - See the note in the main program about the formula below
+  inline result_type adjust(double height_above_ellipsoid, double geoid_height) const {
     if (m_reverse_adjustment)
       return height_above_ellipsoid + geoid_height;
     else
       return height_above_ellipsoid - geoid_height;
   }
 
+  inline result_type operator()( size_t col, size_t row, size_t p=0 ) const {
+
+    if ( m_img(col, row, p) == m_nodata_val )
+      return m_nodata_val; // Skip invalid pixels
+
+    double geoid_ht = 0.0;
+    if (!geoid_height(Vector2(col, row), geoid_ht))
+      return m_nodata_val;
+
+    return adjust(m_img(col, row, p), geoid_ht);
+  }
+
   /// \cond INTERNAL
-  typedef DemGeoidView<typename ImageT::prerasterize_type> prerasterize_type;
+  /// The geoid is smooth, so for each tile it is evaluated exactly only
+  /// on a coarse grid, and interpolated in between.
+  typedef CropView<ImageView<result_type> > prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return prerasterize_type( m_img.prerasterize(bbox), m_georef,
-                              m_is_egm2008, m_egm2008_grid,
-                              m_geoid, m_geoid_georef, m_reverse_adjustment,
-                              m_correction, m_nodata_val );
+
+    ImageView<result_type> tile = crop(m_img, bbox);
+
+    bool has_valid = false;
+    for (int row = 0; row < tile.rows() && !has_valid; row++)
+      for (int col = 0; col < tile.cols() && !has_valid; col++)
+        has_valid = (tile(col, row) != m_nodata_val);
+
+    if (has_valid) {
+      asp::CorrectionGrid<GeoidHeightFunc, 1> grid(GeoidHeightFunc(this), bbox, m_max_grid_error);
+      Vector<double, 1> geoid_ht;
+      for (int row = 0; row < tile.rows(); row++) {
+        for (int col = 0; col < tile.cols(); col++) {
+          if (tile(col, row) == m_nodata_val)
+            continue; // Skip invalid pixels
+          if (grid(col + bbox.min().x(), row + bbox.min().y(), geoid_ht))
+            tile(col, row) = adjust(tile(col, row), geoid_ht[0]);
+          else
+            tile(col, row) = m_nodata_val;
+        }
+      }
+    }
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
   }
   template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
     vw::rasterize( prerasterize(bbox), dest, bbox );
@@ -163,16 +208,17 @@ dem_geoid( ImageViewBase<ImageT> const& img, GeoReference const& georef,
            bool is_egm2008, vector<double> & egm2008_grid,
            ImageViewRef<PixelMask<double> > const& geoid,
            GeoReference const& geoid_georef, bool reverse_adjustment,
-           double correction, double nodata_val) {
+           double correction, double nodata_val, double max_grid_error) {
   return DemGeoidView<ImageT>( img.impl(), georef,
                                is_egm2008, egm2008_grid,
                                geoid, geoid_georef,
-                               reverse_adjustment, correction, nodata_val );
+                               reverse_adjustment, correction, nodata_val,
+                               max_grid_error );
 }
 
 struct Options : vw::cartography::GdalWriteOptions {
   string dem_name, geoid, out_prefix;
-  double nodata_value;
+  double nodata_value, max_grid_error;
   bool   use_double;
   bool   reverse_adjustment;
 };
@@ -216,7 +262,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ){
          "Output using double precision (64 bit) instead of float (32 bit).")
     ("reverse-adjustment",
                         po::bool_switch(&opt.reverse_adjustment)->default_value(false)->implicit_value(true),
-        "Go from DEM relative to the geoid to DEM relative to the ellipsoid.");
+        "Go from DEM relative to the geoid to DEM relative to the ellipsoid.")
+    ("max-grid-error",  po::value(&opt.max_grid_error)->default_value(0.001),
+        "Evaluate the geoid exactly on a coarse grid of each tile, refined until interpolating it is within this many meters of the geoid at the centers of the grid cells, and interpolate in between. If 0, evaluate the geoid at each pixel.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -241,6 +289,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ){
 
   boost::to_lower(opt.geoid);
 
+  if (opt.max_grid_error < 0)
+    vw_throw( ArgumentErr() << "The maximum grid error must be non-negative.\n" );
+
   if ( opt.out_prefix.empty() )
     opt.out_prefix = fs::path(opt.dem_name).stem().string();
 
@@ -450,7 +501,8 @@ int main( int argc, char *argv[] ) {
     ImageViewRef<double> adj_dem = dem_geoid(dem_img, dem_georef,
                                              is_egm2008, egm2008_grid,
                                              geoid, geoid_georef,
-                                             reverse_adjustment, major_correction, dem_nodata_val);
+                                             reverse_adjustment, major_correction, dem_nodata_val,
+                                             opt.max_grid_error);
 
     string adj_dem_file = opt.out_prefix + "-adj.tif";
     vw_out() << "Writing adjusted DEM: " << adj_dem_file << endl;
@@ -34,6 +34,8 @@
 #include <iomanip>
 #include <string>
 #include <vector>
+#include <list>
+#include <map>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -50,6 +52,11 @@
 #include <vw/Image/Algorithms2.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/BBoxTree.h>
+#include <asp/Core/Trace.h>
+#include <asp/Core/TilePool.h>
+#include <asp/Core/HoleFill.h>
+#include <asp/Core/CorrectionGrid.h>
 
 
 #include <boost/math/special_functions/fpclassify.hpp>
@@ -57,6 +64,9 @@
 #include <boost/program_options.hpp>
 
 #include <boost/filesystem/convenience.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <cpl_conv.h>
 
 using namespace std;
 using namespace vw;
@@ -101,12 +111,20 @@ void centerline_weights2(ImageT const& img, ImageView<double> & weights,
     maxValInCol[col] = 0;
   }
 
+  // Evaluate the validity of each pixel only once, as the input is
+  // usually a lazy view, and it is needed again further down.
+  std::vector<unsigned char> valid(size_t(numCols)*size_t(numRows), 0);
+
   // Note that we do just a single pass through the image to compute
   // both the horizontal and vertical min/max values.
+  bool has_valid = false;
   for (int row = 0 ; row < numRows; row++) {
+    unsigned char * valid_row = &valid[0] + size_t(row)*numCols;
     for (int col = 0; col < numCols; col++) {
 
       if ( !is_valid(img(col,row)) ) continue;
+      valid_row[col] = 1;
+      has_valid = true;
       
       // Record the first and last valid column in each row
       if (col < minValInRow[row]) minValInRow[row] = col;
@@ -142,22 +160,28 @@ void centerline_weights2(ImageT const& img, ImageView<double> & weights,
 
   // Compute the weighting for each pixel in the image
   weights.set_size(output_bbox.width(), output_bbox.height());
-  fill(weights, 0);
+
+  // Without valid pixels every pixel is a border pixel
+  if (!has_valid) {
+    fill(weights, border_fill_value);
+    return;
+  }
   
   for (int row = output_bbox.min().y(); row < output_bbox.max().y(); row++){
+    unsigned char const* valid_row = &valid[0] + size_t(row)*numCols;
+    int min_col = minValInRow[row], max_col = maxValInRow[row];
     for (int col = output_bbox.min().x(); col < output_bbox.max().x(); col++){
-      bool inner_row = ((row >= minValInCol[col]) && (row <= maxValInCol[col]));
-      bool inner_col = ((col >= minValInRow[row]) && (col <= maxValInRow[row]));
-      bool inner_pixel = inner_row && inner_col;
-      Vector2 pix(col, row);
       double new_weight = 0; // Invalid pixels usually get zero weight
-      if (is_valid(img(col,row))) {
+      if (valid_row[col]) {
+        Vector2 pix(col, row);
         double weight_h = compute_line_weights(pix, true,  hCenterLine, hMaxDistArray);
         double weight_v = compute_line_weights(pix, false, vCenterLine, vMaxDistArray);
         new_weight = weight_h*weight_v;
       }
       else { // Invalid pixel
-        if (inner_pixel)
+        bool inner_row = ((row >= minValInCol[col]) && (row <= maxValInCol[col]));
+        bool inner_col = ((col >= min_col) && (col <= max_col));
+        if (inner_row && inner_col)
           new_weight = hole_fill_value;
         else // Border pixel
           new_weight = border_fill_value;
@@ -240,28 +264,51 @@ void blur_weights(ImageView<double> & weights, double sigma){
 
   int cols = weights.cols(), rows = weights.rows();
 
-  ImageView<double> extra_wts(cols + 2*extra, rows + 2*extra);
-  fill(extra_wts, 0);
-  for (int col = 0; col < cols; col++) {
-    for (int row = 0; row < rows; row++) {
-      if (weights(col,row) > 0)
-        extra_wts(col + extra, row + extra) = weights(col, row);
-      else
-        extra_wts(col + extra, row + extra) = 0;
+  // Only the region with positive weights, plus the kernel extent,
+  // needs to be blurred, as the weights elsewhere are not changed.
+  // A DEM often covers only a small part of the tile.
+  BBox2i pos_box;
+  for (int row = 0; row < rows; row++) {
+    double const* wt_row = &weights(0, row);
+    int first = -1, last = -1;
+    for (int col = 0; col < cols; col++) {
+      if (wt_row[col] > 0) {
+        if (first < 0) first = col;
+        last = col;
+      }
+    }
+    if (first >= 0) {
+      pos_box.grow(Vector2i(first, row));
+      pos_box.grow(Vector2i(last + 1, row + 1));
     }
   }
+  if (pos_box.empty())
+    return;
+
+  // The blur is done in single precision, which is enough for weights
+  // and halves the memory traffic. The Gaussian filter is separable.
+  int box_cols = pos_box.width(), box_rows = pos_box.height();
+  int beg_col  = pos_box.min().x(), beg_row = pos_box.min().y();
+  ImageView<float> extra_wts(box_cols + 2*extra, box_rows + 2*extra);
+  fill(extra_wts, 0);
+  for (int row = 0; row < box_rows; row++) {
+    double const* wt_row  = &weights(beg_col, beg_row + row);
+    float       * out_row = &extra_wts(extra, row + extra);
+    for (int col = 0; col < box_cols; col++)
+      out_row[col] = (wt_row[col] > 0) ? float(wt_row[col]) : 0.0f;
+  }
 
-  ImageView<double> blurred_wts = gaussian_filter(extra_wts, sigma);
+  ImageView<float> blurred_wts = gaussian_filter(extra_wts, sigma);
 
   // Copy back.  The weights must not grow. In particular, where the
   // original weights were zero, the new weights must also be zero, as
   // at those points there is no DEM data.
-  for (int col = 0; col < cols; col++) {
-    for (int row = 0; row < rows; row++) {
-      if (weights(col, row) > 0) {
-        weights(col, row) = blurred_wts(col + extra, row + extra);
-      }
-      //weights(col, row) = std::min(weights(col, row), blurred_wts(col + extra, row + extra));
+  for (int row = 0; row < box_rows; row++) {
+    double     * wt_row = &weights(beg_col, beg_row + row);
+    float const* in_row = &blurred_wts(extra, row + extra);
+    for (int col = 0; col < box_cols; col++) {
+      if (wt_row[col] > 0)
+        wt_row[col] = in_row[col];
     }
   }
 
@@ -321,25 +368,28 @@ std::string processed_proj4(std::string const& srs){
 }
 
 struct Options : vw::cartography::GdalWriteOptions {
-  string dem_list_file, out_prefix, target_srs_string, output_type, tile_list_str, this_dem_as_reference;
+  string dem_list_file, out_prefix, target_srs_string, output_type, tile_list_str, this_dem_as_reference, footprint_index;
   vector<string> dem_files;
   double tr, geo_tile_size;
   bool   has_out_nodata;
   double out_nodata_value;
-  int    tile_size, tile_index, erode_len, priority_blending_len, extra_crop_len, hole_fill_len, block_size, save_dem_weight;
-  double  weights_exp, weights_blur_sigma, dem_blur_sigma;
+  int    tile_size, tile_index, erode_len, priority_blending_len, extra_crop_len, hole_fill_len, pyramid_hole_fill_len, block_size, save_dem_weight, tile_cache_size_mb, transform_grid_spacing;
+  double  weights_exp, weights_blur_sigma, dem_blur_sigma, transform_grid_error;
   double nodata_threshold;
-  bool   first, last, min, max, block_max, mean, stddev, median, count, save_index_map, use_centerline_weights, first_dem_as_reference, propagate_nodata;
+  bool   first, last, min, max, block_max, mean, stddev, median, count, save_index_map, use_centerline_weights, first_dem_as_reference, propagate_nodata, mmap_inputs, query, approx_median, cog;
   std::set<int> tile_list;
   BBox2 projwin;
   Options(): tr(0), geo_tile_size(0), has_out_nodata(false), tile_index(-1),
 	     erode_len(0), priority_blending_len(0), extra_crop_len(0),
-	     hole_fill_len(0), block_size(0), save_dem_weight(-1), 
-	     weights_exp(0), weights_blur_sigma(0.0), dem_blur_sigma(0.0),
+	     hole_fill_len(0), pyramid_hole_fill_len(0), block_size(0), save_dem_weight(-1), tile_cache_size_mb(0),
+	     transform_grid_spacing(0), weights_exp(0), weights_blur_sigma(0.0), dem_blur_sigma(0.0),
+	     transform_grid_error(0),
 	     nodata_threshold(std::numeric_limits<double>::quiet_NaN()),
 	     first(false), last(false), min(false), max(false), block_max(false),
 	     mean(false), stddev(false), median(false), count(false), save_index_map(false),
-	     use_centerline_weights(false), first_dem_as_reference(false), projwin(BBox2()) {}
+	     use_centerline_weights(false), first_dem_as_reference(false), mmap_inputs(false), query(false),
+	     approx_median(false), cog(false),
+	     projwin(BBox2()) {}
 };
 
 /// Return the number of no-blending options selected.
@@ -365,6 +415,203 @@ std::string tile_suffix(Options const& opt){
   return ans;
 }
 
+/// A streaming estimate of the median at each pixel of a tile, with
+/// the P-square algorithm of Jain and Chlamtac (1985). Each pixel
+/// keeps five marker heights and the positions of the three inner
+/// ones, so memory does not grow with the number of input DEMs. While
+/// a pixel has at most five values, its median is exact.
+class StreamingMedianTile {
+
+  int m_cols, m_rows;
+  std::vector<double> m_heights;   // 5 per pixel
+  std::vector<int>    m_positions; // 3 per pixel, 1-based ranks of the inner markers
+  std::vector<int>    m_counts;    // 1 per pixel
+
+public:
+  StreamingMedianTile(int cols, int rows): m_cols(cols), m_rows(rows),
+    m_heights(5*size_t(cols)*rows, 0.0), m_positions(3*size_t(cols)*rows, 0),
+    m_counts(size_t(cols)*rows, 0) {}
+
+  void add(int col, int row, double val) {
+
+    size_t pix = size_t(row)*m_cols + col;
+    double * q = &m_heights[5*pix];
+    int    & N = m_counts[pix];
+
+    // Keep the first five values sorted
+    if (N < 5) {
+      int k = N;
+      while (k > 0 && q[k-1] > val) {
+        q[k] = q[k-1];
+        k--;
+      }
+      q[k] = val;
+      N++;
+      if (N == 5) {
+        int * n = &m_positions[3*pix];
+        n[0] = 2; n[1] = 3; n[2] = 4;
+      }
+      return;
+    }
+
+    // Marker ranks, with the outer ones implied
+    int * inner = &m_positions[3*pix];
+    int n[5] = {1, inner[0], inner[1], inner[2], N};
+
+    // Find the cell holding the value, extending the extremes if needed
+    int k;
+    if      (val <  q[0]) { q[0] = val; k = 0; }
+    else if (val <  q[1]) k = 0;
+    else if (val <  q[2]) k = 1;
+    else if (val <  q[3]) k = 2;
+    else if (val <= q[4]) k = 3;
+    else                  { q[4] = val; k = 3; }
+
+    for (int i = k + 1; i < 5; i++)
+      n[i]++;
+    N++;
+
+    // Desired ranks of the markers for the median
+    const double frac[5] = {0.0, 0.25, 0.5, 0.75, 1.0};
+
+    // Move the inner markers towards their desired ranks with a
+    // parabolic prediction, or a linear one if that is not monotone.
+    for (int i = 1; i <= 3; i++) {
+      double d = 1.0 + (N - 1)*frac[i] - n[i];
+      if ((d >= 1.0 && n[i+1] - n[i] > 1) || (d <= -1.0 && n[i-1] - n[i] < -1)) {
+        int dir = (d > 0) ? 1 : -1;
+        double qp = q[i] + double(dir)/(n[i+1] - n[i-1]) *
+          ((n[i] - n[i-1] + dir)*(q[i+1] - q[i])/(n[i+1] - n[i]) +
+           (n[i+1] - n[i] - dir)*(q[i] - q[i-1])/(n[i] - n[i-1]));
+        if (q[i-1] < qp && qp < q[i+1])
+          q[i] = qp;
+        else
+          q[i] = q[i] + dir*(q[i+dir] - q[i])/(n[i+dir] - n[i]);
+        n[i] += dir;
+      }
+    }
+
+    inner[0] = n[1]; inner[1] = n[2]; inner[2] = n[3];
+  }
+
+  /// Return false if no values were added at this pixel.
+  bool median(int col, int row, double & val) const {
+    size_t pix = size_t(row)*m_cols + col;
+    double const* q = &m_heights[5*pix];
+    int N = m_counts[pix];
+    if (N == 0)
+      return false;
+    if (N >= 5)
+      val = q[2];
+    else if (N % 2 == 1)
+      val = q[N/2];
+    else
+      val = 0.5*(q[N/2 - 1] + q[N/2]);
+    return true;
+  }
+};
+
+/// A cache of square tiles of the input DEMs, shared by all threads
+/// writing the mosaic, and limited in total size. When it is full,
+/// the least recently used tiles are dropped. This way, input pixels
+/// needed by several output tiles, such as due to the extra crop
+/// length, are usually read and decoded only once. It also persists
+/// when the DiskImageManager closes file handles.
+class DemTileCache {
+
+  typedef std::pair<int, std::pair<int, int> > KeyType; // DEM index, tile col, tile row
+  typedef boost::shared_ptr< ImageView<RealT> > TilePtr;
+  typedef std::list<KeyType> LruType;
+  struct Entry {
+    TilePtr            tile;
+    LruType::iterator  lru_pos;
+  };
+
+  size_t                   m_max_bytes, m_num_bytes;
+  int                      m_tile_len;
+  std::map<KeyType, Entry> m_entries;
+  LruType                  m_lru; // most recently used first
+  vw::Mutex                m_mutex;
+
+  TilePtr find(KeyType const& key) {
+    vw::Mutex::Lock lock(m_mutex);
+    std::map<KeyType, Entry>::iterator it = m_entries.find(key);
+    if (it == m_entries.end())
+      return TilePtr();
+    m_lru.splice(m_lru.begin(), m_lru, it->second.lru_pos);
+    return it->second.tile;
+  }
+
+  void insert(KeyType const& key, TilePtr tile) {
+    vw::Mutex::Lock lock(m_mutex);
+    if (m_entries.find(key) != m_entries.end())
+      return; // Another thread read this tile meanwhile
+    m_lru.push_front(key);
+    Entry entry;
+    entry.tile    = tile;
+    entry.lru_pos = m_lru.begin();
+    m_entries[key] = entry;
+    m_num_bytes += tile_bytes(*tile);
+    while (m_num_bytes > m_max_bytes && m_lru.size() > 1) {
+      std::map<KeyType, Entry>::iterator it = m_entries.find(m_lru.back());
+      m_num_bytes -= tile_bytes(*it->second.tile);
+      m_entries.erase(it);
+      m_lru.pop_back();
+    }
+  }
+
+  static size_t tile_bytes(ImageView<RealT> const& tile) {
+    return size_t(tile.cols())*tile.rows()*sizeof(RealT);
+  }
+
+public:
+
+  /// A size of zero disables the cache.
+  DemTileCache(int max_size_mb, int tile_len = 256):
+    m_max_bytes(size_t(std::max(max_size_mb, 0))*1024*1024),
+    m_num_bytes(0), m_tile_len(tile_len) {}
+
+  /// Crop the DEM with given index to the given box, which must be
+  /// within its bounds.
+  template <class ImageT>
+  ImageView<RealT> crop(int dem_index, ImageViewBase<ImageT> const& dem, BBox2i const& box) {
+
+    if (m_max_bytes == 0)
+      return vw::crop(dem.impl(), box);
+
+    ImageView<RealT> out(box.width(), box.height());
+    BBox2i dem_box = bounding_box(dem.impl());
+    int num_hits = 0, num_misses = 0;
+    int beg_col = box.min().x()/m_tile_len, end_col = (box.max().x() - 1)/m_tile_len;
+    int beg_row = box.min().y()/m_tile_len, end_row = (box.max().y() - 1)/m_tile_len;
+    for (int row = beg_row; row <= end_row; row++) {
+      for (int col = beg_col; col <= end_col; col++) {
+
+        BBox2i tile_box(col*m_tile_len, row*m_tile_len, m_tile_len, m_tile_len);
+        tile_box.crop(dem_box);
+
+        KeyType key(dem_index, std::make_pair(col, row));
+        TilePtr tile = find(key);
+        if (!tile) {
+          tile = TilePtr(new ImageView<RealT>(vw::crop(dem.impl(), tile_box)));
+          insert(key, tile);
+          num_misses++;
+        } else {
+          num_hits++;
+        }
+
+        BBox2i overlap = tile_box;
+        overlap.crop(box);
+        vw::crop(out, overlap - box.min())
+          = vw::crop(*tile, overlap - tile_box.min());
+      }
+    }
+    asp::add_to_counter("dem_tile_cache_hits",   num_hits);
+    asp::add_to_counter("dem_tile_cache_misses", num_misses);
+    return out;
+  }
+};
+
 /// Class that does the actual image processing work
 class DemMosaicView: public ImageViewBase<DemMosaicView>{
   int m_cols, m_rows, m_bias;
@@ -376,6 +623,9 @@ class DemMosaicView: public ImageViewBase<DemMosaicView>{
   vector<BBox2i>          const& m_dem_pixel_bboxes; // alias
   long long int                & m_num_valid_pixels; // alias, to populate on output
   vw::Mutex                    & m_count_mutex;      // alias, a lock for m_num_valid_pixels
+  DemTileCache                 & m_tile_cache;       // alias, shared by all tiles
+  asp::BBoxTree           const& m_dem_tree;         // alias, DEM boxes in output pixels
+  vector<bool>                   m_same_proj;        // if a DEM has the output projection
 
 public:
   DemMosaicView(int cols, int rows, int bias,
@@ -386,12 +636,14 @@ public:
                 vector<double>         const& nodata_values,
                 vector<BBox2i>         const& dem_pixel_bboxes,
                 long long int               & num_valid_pixels,
-                vw::Mutex                   & count_mutex):
+                vw::Mutex                   & count_mutex,
+                DemTileCache                & tile_cache,
+                asp::BBoxTree          const& dem_tree):
     m_cols(cols), m_rows(rows), m_bias(bias), m_opt(opt),
     m_imgMgr(imgMgr), m_georefs(georefs),
     m_out_georef(out_georef), m_nodata_values(nodata_values),
     m_dem_pixel_bboxes(dem_pixel_bboxes), m_num_valid_pixels(num_valid_pixels),
-    m_count_mutex(count_mutex) {
+    m_count_mutex(count_mutex), m_tile_cache(tile_cache), m_dem_tree(dem_tree) {
 
     // How many valid pixels we will have
     m_num_valid_pixels = 0;
@@ -401,6 +653,12 @@ public:
         imgMgr.size() != dem_pixel_bboxes.size())
       vw_throw(ArgumentErr() << "Inputs expected to have the same size do not.\n");
 
+    // Only the DEMs in another projection than the output need a
+    // transform grid, for the others the transform is cheap.
+    std::string out_proj4 = m_out_georef.overall_proj4_str();
+    for (int i = 0; i < (int)m_georefs.size(); i++)
+      m_same_proj.push_back(m_georefs[i].overall_proj4_str() == out_proj4);
+
     // Sanity check, see if datums differ, then the tool won't work
     const double out_major_axis = m_out_georef.datum().semi_major_axis();
     const double out_minor_axis = m_out_georef.datum().semi_minor_axis();
@@ -446,6 +704,9 @@ public:
   inline prerasterize_type prerasterize(BBox2i bbox) const {
 
     BBox2i orig_box = bbox;
+
+    asp::ScopedTrace trace("dem_mosaic_tile", orig_box);
+    trace.count("pixels", double(orig_box.width())*orig_box.height());
     
     // When doing priority blending, we will do all the work in the
     // output pixels domain. Hence we need to take into account the
@@ -457,8 +718,11 @@ public:
     // of the precision of the inputs, for increased accuracy.
     // - The image data buffers are initialized here
     typedef PixelGrayA<double> DoubleGrayA;
-    ImageView<double> tile   (bbox.width(), bbox.height()); // the output tile (in most cases)
-    ImageView<double> weights(bbox.width(), bbox.height()); // accumulated weights (in most cases)
+    // - These two are reused from tile to tile by this thread
+    asp::ScratchImage<double> tile_buf   (bbox.width(), bbox.height());
+    asp::ScratchImage<double> weights_buf(bbox.width(), bbox.height());
+    ImageView<double> & tile    = *tile_buf;    // the output tile (in most cases)
+    ImageView<double> & weights = *weights_buf; // accumulated weights (in most cases)
     fill( tile, m_opt.out_nodata_value );
     fill( weights, 0.0 );
 
@@ -469,8 +733,13 @@ public:
     // - Used for median and stddev calculation.
     std::vector< ImageView<double> > tile_vec, weight_vec;
     std::vector< std::string > dem_vec;
-    if (m_opt.median) // Store each input separately
+    if (m_opt.median && !m_opt.approx_median) // Store each input separately
       tile_vec.reserve(m_imgMgr.size());
+
+    // With the approximate median the values are not stored
+    boost::shared_ptr<StreamingMedianTile> median_sketch;
+    if (m_opt.median && m_opt.approx_median)
+      median_sketch.reset(new StreamingMedianTile(bbox.width(), bbox.height()));
     if (m_opt.stddev) { // Need one working image
       tile_vec.push_back(ImageView<double>(bbox.width(), bbox.height()));
       // Each pixel starts at zero, nodata is handled later
@@ -508,8 +777,18 @@ public:
     ImageView<double> first_dem;
     ImageView<double> local_wts_orig;
     
-    // Loop through all input DEMs
-    for (int dem_iter = 0; dem_iter < (int)m_imgMgr.size(); dem_iter++){
+    // Find the DEMs which may overlap with this tile, in increasing
+    // order of their index. The exact check is done further down.
+    std::vector<size_t> candidates;
+    BBox2i search_box = bbox;
+    search_box.expand(m_bias + BilinearInterpolation::pixel_buffer + 2);
+    m_dem_tree.intersecting(search_box, candidates);
+    trace.count("candidate_dems", candidates.size());
+
+    // Loop through the candidate input DEMs
+    for (size_t cand_iter = 0; cand_iter < candidates.size(); cand_iter++){
+
+      int dem_iter = candidates[cand_iter];
 
       // Load the information for this DEM
       GeoReference georef        = m_georefs         [dem_iter];
@@ -544,8 +823,10 @@ public:
 
       // Crop the disk dem to a 2-channel in-memory image. First
       // channel is the image pixels, second will be the weights.
-      ImageViewRef<double     > disk_dem = pixel_cast<double>(m_imgMgr.get_handle(dem_iter, bbox));
-      ImageView   <DoubleGrayA> dem      = crop(disk_dem, in_box);
+      ImageViewRef<RealT      > handle   = m_imgMgr.get_handle(dem_iter, bbox);
+      ImageViewRef<double     > disk_dem = pixel_cast<double>(handle);
+      ImageView   <DoubleGrayA> dem      = pixel_cast<double>(m_tile_cache.crop(dem_iter, handle,
+                                                                                in_box));
 
       if (m_opt.first_dem_as_reference && dem_iter == 0) {
         // We need to keep the first DEM, to use it as ref
@@ -673,6 +954,18 @@ public:
       ImageViewRef<DoubleGrayA> interp_dem
         = interpolate(dem, BilinearInterpolation(), ConstantEdgeExtension());
 
+      // Going through the projections for every pixel is slow, so for
+      // an input in another projection they are interpolated on a
+      // grid, except in the cells where that is off by more than the
+      // error. A spacing of one pixel finds each of them exactly.
+      int grid_spacing = m_opt.transform_grid_spacing;
+      if (m_same_proj[dem_iter] || grid_spacing <= 0)
+        grid_spacing = 1;
+      bool refine = false;
+      asp::CorrectionGrid<asp::ReverseTransformFunc<GeoTransform>, 2>
+        trans_grid(asp::ReverseTransformFunc<GeoTransform>(&geotrans), bbox,
+                   m_opt.transform_grid_error, grid_spacing, refine);
+
       // Loop through each output pixel
       for (int c = 0; c < bbox.width(); c++){
         for (int r = 0; r < bbox.height(); r++){
@@ -680,7 +973,9 @@ public:
           // Coordinates in the output mosaic
           Vector2 out_pix(c +  bbox.min().x(), r +  bbox.min().y());
           // Coordinate in this input DEM
-          Vector2 in_pix = geotrans.reverse(out_pix);
+          Vector2 in_pix;
+          if (!trans_grid(out_pix.x(), out_pix.y(), in_pix))
+            continue; // Does not project into this DEM
 
           // Input DEM pixel relative to loaded bbox
           double x = in_pix[0] - in_box.min().x();
@@ -823,10 +1118,20 @@ public:
       // For the median option, keep a copy of the output tile for each input DEM!
       // Also do it for max per block.
       // - This will be memory intensive. 
-      if (m_opt.median || m_opt.block_max) {
+      if ((m_opt.median && !m_opt.approx_median) || m_opt.block_max) {
         tile_vec.push_back(copy(tile));
         dem_vec.push_back(dem_name);
       }
+
+      // For the approximate median, update the estimate with this DEM instead
+      if (median_sketch) {
+        for (int c = 0; c < bbox.width(); c++){
+          for (int r = 0; r < bbox.height(); r++){
+            if (tile(c, r) != m_opt.out_nodata_value)
+              median_sketch->add(c, r, tile(c, r));
+          }
+        }
+      }
       
       // For priority blending, need also to keep all tiles, but also the weights
       if (m_opt.priority_blending_len > 0){
@@ -867,7 +1172,16 @@ public:
     } // End stddev case
 
     // For the median operation
-    if (m_opt.median){
+    if (median_sketch){
+      fill( tile, m_opt.out_nodata_value );
+      for (int c = 0; c < bbox.width(); c++){
+        for (int r = 0; r < bbox.height(); r++){
+          double val;
+          if (median_sketch->median(c, r, val))
+            tile(c, r) = val;
+        }
+      }
+    } else if (m_opt.median){
       // Init output pixels to nodata
       fill( tile, m_opt.out_nodata_value );
       vector<double> vals(tile_vec.size());
@@ -1066,6 +1380,7 @@ public:
       vw::Mutex::Lock lock(m_count_mutex);
       m_num_valid_pixels += num_valid_in_tile;
     }
+    trace.count("valid_pixels", num_valid_in_tile);
 
     if (m_opt.first_dem_as_reference) {
       
@@ -1107,11 +1422,13 @@ public:
 /// - mosaic_bbox is the output bounding box in projected space
 /// - dem_proj_bboxes and dem_pixel_bboxes are the locations of
 ///   each input DEM in the output DEM in projected and pixel coordinates.
+/// - dem_nodata_values are the no-data values of the DEMs, or NaN if not set.
 void load_dem_bounding_boxes(Options       const& opt,
 			     GeoReference  const& mosaic_georef,
 			     BBox2              & mosaic_bbox, // Projected coordinates
 			     std::vector<BBox2> & dem_proj_bboxes,
-			     std::vector<BBox2i> & dem_pixel_bboxes) {
+			     std::vector<BBox2i> & dem_pixel_bboxes,
+			     std::vector<double> & dem_nodata_values) {
 
   vw_out() << "Determining the bounding boxes of the input DEMs.\n";
 
@@ -1119,6 +1436,7 @@ void load_dem_bounding_boxes(Options       const& opt,
   mosaic_bbox = BBox2();
   dem_proj_bboxes.clear();
   dem_pixel_bboxes.clear();
+  dem_nodata_values.clear();
   
   TerminalProgressCallback tpc("", "\t--> ");
   tpc.report_progress(0);
@@ -1137,6 +1455,12 @@ void load_dem_bounding_boxes(Options       const& opt,
 
     dem_pixel_bboxes.push_back(pixel_box);
 
+    // Since the DEMs have float pixels, read the no-data as float
+    if (in_rsrc.has_nodata_read())
+      dem_nodata_values.push_back(RealT(in_rsrc.nodata_read()));
+    else
+      dem_nodata_values.push_back(std::numeric_limits<double>::quiet_NaN());
+
     if (dem_iter == 0) 
       first_dem_proj_box = georef.bounding_box(img);
     
@@ -1196,6 +1520,144 @@ void load_dem_bounding_boxes(Options       const& opt,
   
 } // End function load_dem_bounding_boxes
 
+/// Everything the footprints in the index depend on besides the DEMs
+/// themselves. An index with a different key is not reused.
+std::string footprint_index_key(Options const& opt, GeoReference const& mosaic_georef) {
+  std::ostringstream os;
+  os.precision(17);
+  os << mosaic_georef.overall_proj4_str() << "\n" << mosaic_georef.transform() << "\n"
+     << opt.first_dem_as_reference << "\n";
+  return os.str();
+}
+
+// Helpers for reading and writing the binary index
+namespace {
+  template <class T>
+  void write_value(std::ofstream & ofs, T const& val) {
+    ofs.write(reinterpret_cast<const char*>(&val), sizeof(T));
+  }
+  template <class T>
+  bool read_value(std::ifstream & ifs, T & val) {
+    return bool(ifs.read(reinterpret_cast<char*>(&val), sizeof(T)));
+  }
+  void write_string(std::ofstream & ofs, std::string const& str) {
+    write_value(ofs, boost::uint64_t(str.size()));
+    ofs.write(str.data(), str.size());
+  }
+  bool read_string(std::ifstream & ifs, std::string & str) {
+    boost::uint64_t len = 0;
+    if (!read_value(ifs, len) || len > (1ULL << 30))
+      return false;
+    str.resize(len);
+    return len == 0 || bool(ifs.read(&str[0], len));
+  }
+  const std::string FOOTPRINT_INDEX_MAGIC = "ASP_DEM_FOOTPRINT_INDEX_1";
+}
+
+/// Save the outputs of load_dem_bounding_boxes(), so that later
+/// invocations on the same DEMs, such as for separate tiles, need not
+/// open every DEM. The file is written under a temporary name and
+/// then renamed, so that concurrent jobs never see a partial index.
+void write_footprint_index(std::string const& index_file, std::string const& key,
+                           Options const& opt, BBox2 const& mosaic_bbox,
+                           std::vector<BBox2>  const& dem_proj_bboxes,
+                           std::vector<BBox2i> const& dem_pixel_bboxes,
+                           std::vector<double> const& dem_nodata_values) {
+
+  std::ostringstream os;
+  os << index_file << ".tmp." << getpid();
+  std::string tmp_file = os.str();
+  std::ofstream ofs(tmp_file.c_str(), std::ios::out | std::ios::binary);
+  if (!ofs)
+    vw_throw(ArgumentErr() << "Cannot write: " << tmp_file << "\n");
+
+  write_string(ofs, FOOTPRINT_INDEX_MAGIC);
+  write_string(ofs, key);
+  for (int c = 0; c < 2; c++) {
+    write_value(ofs, double(mosaic_bbox.min()[c]));
+    write_value(ofs, double(mosaic_bbox.max()[c]));
+  }
+  write_value(ofs, boost::uint64_t(opt.dem_files.size()));
+  for (size_t i = 0; i < opt.dem_files.size(); i++) {
+    write_string(ofs, opt.dem_files[i]);
+    for (int c = 0; c < 2; c++) {
+      write_value(ofs, double(dem_proj_bboxes[i].min()[c]));
+      write_value(ofs, double(dem_proj_bboxes[i].max()[c]));
+    }
+    for (int c = 0; c < 2; c++) {
+      write_value(ofs, boost::int32_t(dem_pixel_bboxes[i].min()[c]));
+      write_value(ofs, boost::int32_t(dem_pixel_bboxes[i].max()[c]));
+    }
+    write_value(ofs, dem_nodata_values[i]);
+  }
+  ofs.close();
+  if (!ofs)
+    vw_throw(ArgumentErr() << "Failed to write: " << tmp_file << "\n");
+
+  fs::rename(tmp_file, index_file);
+  vw_out() << "Wrote the footprint index: " << index_file << std::endl;
+}
+
+/// Read an index written by write_footprint_index(). Return false if
+/// it is missing, or was made for other DEMs or another output grid.
+bool read_footprint_index(std::string const& index_file, std::string const& key,
+                          Options const& opt, BBox2 & mosaic_bbox,
+                          std::vector<BBox2>  & dem_proj_bboxes,
+                          std::vector<BBox2i> & dem_pixel_bboxes,
+                          std::vector<double> & dem_nodata_values) {
+
+  std::ifstream ifs(index_file.c_str(), std::ios::in | std::ios::binary);
+  if (!ifs)
+    return false;
+
+  std::string magic, file_key;
+  if (!read_string(ifs, magic) || magic != FOOTPRINT_INDEX_MAGIC ||
+      !read_string(ifs, file_key) || file_key != key) {
+    vw_out() << "The footprint index " << index_file << " was made for different "
+             << "settings, it will be recreated.\n";
+    return false;
+  }
+
+  double vals[4];
+  for (int c = 0; c < 4; c++)
+    read_value(ifs, vals[c]);
+  mosaic_bbox = BBox2(Vector2(vals[0], vals[2]), Vector2(vals[1], vals[3]));
+
+  boost::uint64_t num_dems = 0;
+  read_value(ifs, num_dems);
+  if (num_dems != opt.dem_files.size()) {
+    vw_out() << "The footprint index " << index_file << " was made for different "
+             << "DEMs, it will be recreated.\n";
+    return false;
+  }
+
+  dem_proj_bboxes.resize(num_dems);
+  dem_pixel_bboxes.resize(num_dems);
+  dem_nodata_values.resize(num_dems);
+  for (size_t i = 0; i < num_dems; i++) {
+    std::string file;
+    boost::int32_t pix[4];
+    if (!read_string(ifs, file))
+      return false;
+    if (file != opt.dem_files[i]) {
+      vw_out() << "The footprint index " << index_file << " was made for different "
+               << "DEMs, it will be recreated.\n";
+      return false;
+    }
+    for (int c = 0; c < 4; c++)
+      read_value(ifs, vals[c]);
+    for (int c = 0; c < 4; c++)
+      read_value(ifs, pix[c]);
+    if (!read_value(ifs, dem_nodata_values[i]))
+      return false;
+    dem_proj_bboxes[i]  = BBox2 (Vector2 (vals[0], vals[2]), Vector2 (vals[1], vals[3]));
+    dem_pixel_bboxes[i] = BBox2i(Vector2i(pix[0],  pix[2]),  Vector2i(pix[1],  pix[3]));
+  }
+
+  vw_out() << "Read the footprint index: " << index_file << std::endl;
+  return true;
+}
+
 
 void handle_arguments( int argc, char *argv[], Options& opt ) {
 
@@ -1216,6 +1678,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 	   "If positive, keep unmodified values from the earliest available DEM at the current location except a band this wide measured in pixels around its boundary where blending will happen.")
     ("hole-fill-length",   po::value(&opt.hole_fill_len)->default_value(0),
 	   "Maximum dimensions of a hole in the output DEM to fill in, in pixels.")
+    ("pyramid-hole-fill-length", po::value(&opt.pyramid_hole_fill_len)->default_value(0),
+	   "Fill the holes in each output DEM tile up to about this size, in pixels, and the no-data pixels within about this distance of valid ones elsewhere, including at the boundary, by interpolation from a pyramid of coarser DEMs. This is done after the tile is written, and its cost does not grow with the length, unlike for --hole-fill-length. Only with Float32 output.")
     ("tr",              po::value(&opt.tr),
 	   "Output DEM resolution in target georeferenced units per pixel. Default: use the same resolution as the first DEM to be mosaicked.")
     ("t_srs",           po::value(&opt.target_srs_string)->default_value(""),
@@ -1236,6 +1700,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 	   "Find the standard deviation of the DEM values.")
     ("median",  po::bool_switch(&opt.median)->default_value(false),
 	   "Find the median DEM value (this can be memory-intensive, fewer threads are suggested).")
+    ("approx-median", po::bool_switch(&opt.approx_median)->default_value(false),
+     "With --median, estimate the median at each pixel while reading the DEMs, rather than keeping all their values, so that memory usage does not grow with the number of overlapping DEMs. The result is exact where at most five DEMs overlap.")
     ("count",   po::bool_switch(&opt.count)->default_value(false),
      "Each pixel is set to the number of valid DEM heights at that pixel.")
     ("block-max", po::bool_switch(&opt.block_max)->default_value(false),
@@ -1269,6 +1735,20 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      "The output DEM will have the same size, grid, and georeference as this one, but it will not be used in the mosaic.")
     ("save-index-map",   po::bool_switch(&opt.save_index_map)->default_value(false),
      "For each output pixel, save the index of the input DEM it came from (applicable only for --first, --last, --min, and --max). A text file with the index assigned to each input DEM is saved as well.")
+    ("tile-cache-size-mb", po::value<int>(&opt.tile_cache_size_mb)->default_value(0),
+     "Keep in memory up to this many MB of tiles of the input DEMs, shared by all threads, so that the regions which overlap between output tiles are read only once. Default: no such cache.")
+    ("transform-grid-spacing", po::value<int>(&opt.transform_grid_spacing)->default_value(16),
+     "For input DEMs in another projection than the output, find their pixels exactly only at the nodes of a grid this many output pixels apart, and interpolate bilinearly in between. Set to 0 to find each pixel exactly.")
+    ("transform-grid-error", po::value<double>(&opt.transform_grid_error)->default_value(0.01),
+     "With --transform-grid-spacing, find exactly the pixels in the grid cells where the interpolation is off by more than this many input pixels.")
+    ("mmap-inputs",   po::bool_switch(&opt.mmap_inputs)->default_value(false),
+     "Read uncompressed input GeoTIFF files by mapping them into memory, if there is enough RAM.")
+    ("cog",   po::bool_switch(&opt.cog)->default_value(false),
+     "Write each output tile as a Cloud Optimized GeoTIFF, with internal overviews.")
+    ("footprint-index", po::value(&opt.footprint_index)->default_value(""),
+     "Save to this file the bounding boxes and no-data values of the input DEMs, or read them from it if it was created before for the same DEMs and output grid. This way, separate invocations with --tile-index need not open every DEM at startup.")
+    ("query",   po::bool_switch(&opt.query)->default_value(false),
+     "Print the number of tiles, the indices of the tiles which intersect at least one input DEM, and the names of those tiles, then exit. Invoked from parallel_dem_mosaic.")
     ("threads",             po::value<int>(&opt.num_threads)->default_value(4),
 	   "Number of threads to use.")
     ("help,h", "Display this help message.");
@@ -1300,9 +1780,30 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if (opt.hole_fill_len < 0)
     vw_throw(ArgumentErr() << "The hole fill length must not be negative.\n"
 			   << usage << general_options );
+  if (opt.pyramid_hole_fill_len < 0)
+    vw_throw(ArgumentErr() << "The pyramid hole fill length must not be negative.\n"
+			   << usage << general_options );
+  if (opt.pyramid_hole_fill_len > 0 && opt.output_type != "Float32")
+    vw_throw(ArgumentErr() << "The pyramid hole fill length can be used only with Float32 output.\n"
+			   << usage << general_options );
   if (opt.tile_size <= 0)
     vw_throw(ArgumentErr() << "The size of a tile in pixels must be positive.\n"
 			   << usage << general_options );
+  if (opt.tile_cache_size_mb < 0)
+    vw_throw(ArgumentErr() << "The tile cache size must not be negative.\n"
+			   << usage << general_options );
+  if (opt.transform_grid_spacing < 0)
+    vw_throw(ArgumentErr() << "The transform grid spacing must not be negative.\n"
+			   << usage << general_options );
+  if (opt.transform_grid_error <= 0)
+    vw_throw(ArgumentErr() << "The transform grid error must be positive.\n"
+			   << usage << general_options );
+
+  // With GDAL 1.11 or later, this makes GDAL read uncompressed
+  // GeoTIFF files via mmap, which avoids copying the data through its
+  // own block cache, if the file fits in RAM.
+  if (opt.mmap_inputs)
+    CPLSetConfigOption("GTIFF_VIRTUAL_MEM_IO", "IF_ENOUGH_RAM");
 
   if (opt.priority_blending_len < 0)
     vw_throw(ArgumentErr() << "The priority blending length must not be negative.\n"
@@ -1318,6 +1819,10 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 	     << "--min, --max, -mean, --stddev, --median, --count can be specified.\n"
 	     << usage << general_options );
 
+  if (opt.approx_median && !opt.median)
+    vw_throw(ArgumentErr() << "The option --approx-median must be used with --median.\n"
+			   << usage << general_options );
+
   if (opt.geo_tile_size < 0)
     vw_throw(ArgumentErr() << "The size of a tile in georeferenced units must not be negative.\n"
 			   << usage << general_options );
@@ -1552,8 +2057,17 @@ int main( int argc, char *argv[] ) {
     BBox2 mosaic_bbox;
     vector<BBox2> dem_proj_bboxes;
     vector<BBox2i> dem_pixel_bboxes, loaded_dem_pixel_bboxes;
-    load_dem_bounding_boxes(opt, mosaic_georef, mosaic_bbox,
-                            dem_proj_bboxes, dem_pixel_bboxes);
+    vector<double> dem_nodata_values;
+    std::string index_key = footprint_index_key(opt, mosaic_georef);
+    if (opt.footprint_index == "" ||
+        !read_footprint_index(opt.footprint_index, index_key, opt, mosaic_bbox,
+                              dem_proj_bboxes, dem_pixel_bboxes, dem_nodata_values)) {
+      load_dem_bounding_boxes(opt, mosaic_georef, mosaic_bbox,
+                              dem_proj_bboxes, dem_pixel_bboxes, dem_nodata_values);
+      if (opt.footprint_index != "")
+        write_footprint_index(opt.footprint_index, index_key, opt, mosaic_bbox,
+                              dem_proj_bboxes, dem_pixel_bboxes, dem_nodata_values);
+    }
 
     if (opt.projwin != BBox2()) {
       // If to create the mosaic only in a given region
@@ -1645,11 +2159,50 @@ int main( int argc, char *argv[] ) {
       tile_pixel_bboxes.push_back(tile_box);
     }
 
+    // If there are 17 tiles, let them be tile-00, ..., tile-16.
+    int num_digits = 1;
+    int tens = 10;
+    while (num_tiles - 1 >= tens){
+      num_digits++;
+      tens *= 10;
+    }
+
+    // Print the tiles which have data and exit. This is invoked from
+    // parallel_dem_mosaic, which will then create only those tiles.
+    if (opt.query) {
+      asp::BBoxTree proj_tree;
+      proj_tree.build(dem_proj_bboxes);
+      std::ostringstream tile_ids, tile_files;
+      for (int tile_id = start_tile; tile_id < end_tile; tile_id++){
+        if (!opt.tile_list.empty() && opt.tile_list.find(tile_id) == opt.tile_list.end()) 
+          continue;
+        BBox2i tile_pixel_box = tile_pixel_bboxes[tile_id - start_tile];
+        if (tile_pixel_box.empty())
+          continue;
+        std::vector<size_t> dems_in_tile;
+        proj_tree.intersecting(mosaic_georef.pixel_to_point_bbox(tile_pixel_box), dems_in_tile);
+        if (dems_in_tile.empty())
+          continue;
+        tile_ids << ", " << tile_id;
+        if (write_to_precise_file)
+          tile_files << ", " << opt.out_prefix;
+        else
+          tile_files << ", " << opt.out_prefix << "-tile-"
+                     << std::setfill('0') << std::setw(num_digits) << tile_id
+                     << tile_suffix(opt) << ".tif";
+      }
+      vw_out() << "num_tiles, "      << num_tiles << std::endl;
+      vw_out() << "nonempty_tiles"   << tile_ids.str()   << std::endl;
+      vw_out() << "nonempty_files"   << tile_files.str() << std::endl;
+      return 0;
+    }
+
     // Store the no-data values, pointers to images, and georeferences (for speed).
     vw_out() << "Reading the input DEMs.\n";
     vector<double>          nodata_values;
     vector<GeoReference>    georefs;
     std::vector<string>     loaded_dems;
+    std::vector<BBox2>      loaded_dem_out_bboxes;
     DiskImageManager<RealT> imgMgr;
 
     BBox2i output_dem_box = BBox2i(0, 0, cols, rows); // output DEM box
@@ -1694,20 +2247,10 @@ int main( int argc, char *argv[] ) {
       // handles furthest from the current location.
       imgMgr.add_file_handle_not_thread_safe(opt.dem_files[dem_iter], curr_box);
       
+      // The nodata-value was read together with the bounding boxes
       double curr_nodata_value = opt.out_nodata_value;
-      try {
-        // Get the nodata-value. Need a try block, in case we can't
-        // open more handles.
-        DiskImageResourceGDAL in_rsrc(opt.dem_files[dem_iter]);
-        if ( in_rsrc.has_nodata_read() )
-          curr_nodata_value = RealT(in_rsrc.nodata_read());
-      }catch(std::exception const& e){
-        // Try again
-        imgMgr.freeup_handles_not_thread_safe();
-        DiskImageResourceGDAL in_rsrc(opt.dem_files[dem_iter]);
-        if ( in_rsrc.has_nodata_read() )
-          curr_nodata_value = RealT(in_rsrc.nodata_read());
-      }
+      if (!boost::math::isnan(dem_nodata_values[dem_iter]))
+        curr_nodata_value = dem_nodata_values[dem_iter];
       
       loaded_dems.push_back(opt.dem_files[dem_iter]);
 
@@ -1718,16 +2261,18 @@ int main( int argc, char *argv[] ) {
       nodata_values.push_back(curr_nodata_value);
       georefs.push_back(georef);
       loaded_dem_pixel_bboxes.push_back(dem_pixel_box);
+      loaded_dem_out_bboxes.push_back(curr_box);
     } // End loop through DEM files
 
-    // If there are 17 tiles, let them be tile-00, ..., tile-16.
-    int num_digits = 1;
-    int tens = 10;
-    while (num_tiles - 1 >= tens){
-      num_digits++;
-      tens *= 10;
-    }
-    
+    // Index the loaded DEMs by their extent in the output image, so
+    // that each output tile visits only the DEMs near it.
+    asp::BBoxTree dem_tree;
+    dem_tree.build(loaded_dem_out_bboxes);
+
+    // Shared by all output tiles, so that DEM pixels read for a tile
+    // can be reused by its neighbors.
+    DemTileCache tile_cache(opt.tile_cache_size_mb);
+
     // Time to generate each of the output tiles
     for (int tile_id = start_tile; tile_id < end_tile; tile_id++){
 
@@ -1756,7 +2301,7 @@ int main( int argc, char *argv[] ) {
                              imgMgr, georefs,
                              mosaic_georef, nodata_values,
                              loaded_dem_pixel_bboxes,
-                             num_valid_pixels, count_mutex),
+                             num_valid_pixels, count_mutex, tile_cache, dem_tree),
                tile_box);
       GeoReference crop_georef = crop(mosaic_georef, tile_box.min().x(),
 				      tile_box.min().y());
@@ -1806,6 +2351,23 @@ int main( int argc, char *argv[] ) {
       if (num_valid_pixels == 0) {
         vw_out() << "Removing tile with no valid pixels: " << dem_tile << std::endl;
         boost::filesystem::remove(dem_tile);
+        continue;
+      }
+
+      if (opt.pyramid_hole_fill_len > 0) {
+        // Fill the holes of the written tile, as a separate pass
+        std::string unfilled_tile
+          = boost::filesystem::path(dem_tile).replace_extension(".unfilled.tif").string();
+        boost::filesystem::rename(dem_tile, unfilled_tile);
+        TerminalProgressCallback fill_tpc("asp", "\t--> Hole-filling: ");
+        asp::pyramid_fill_holes(unfilled_tile, dem_tile, opt.pyramid_hole_fill_len,
+                                opt, fill_tpc);
+        boost::filesystem::remove(unfilled_tile);
+      }
+
+      if (opt.cog) {
+        TerminalProgressCallback cog_tpc("asp", "\t--> Overviews: ");
+        asp::write_cog(dem_tile, opt, "AVERAGE", cog_tpc);
       }
       
     } // End loop through tiles
@@ -31,6 +31,7 @@
 
 #include <stdlib.h>
 
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO.h>
 #include <vw/Image.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
@@ -48,6 +49,7 @@ struct Options : vw::cartography::GdalWriteOptions {
   std::string input_file_name;
   BBox2       normalization_range;
   BBox2       roi;    ///< Only generate output images in this region
+  bool        cog;
 
   // Output
   std::string output_prefix, output_file_type;
@@ -61,7 +63,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("roi", po::value(&opt.roi)->default_value(BBox2(0,0,0,0), "auto"),
      "Region of interest. Specify in format: xmin,ymin,xmax,ymax.")
     ("output-prefix,o", po::value(&opt.output_prefix), "Specify the output prefix.")
-    ("output-filetype,t", po::value(&opt.output_file_type)->default_value("tif"), "Specify the output file type.");
+    ("output-filetype,t", po::value(&opt.output_file_type)->default_value("tif"), "Specify the output file type.")
+    ("cog", po::bool_switch(&opt.cog)->default_value(false),
+     "Write the outputs as Cloud Optimized GeoTIFFs, with internal overviews.");
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
   po::options_description positional("");
@@ -86,6 +90,94 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     opt.output_prefix = vw::prefix_from_filename(opt.input_file_name);
 }
 
+/// Find the range of the disparities in one block of the image, and
+/// add it to the total.
+template <class PixelT>
+class DisparityRangeTask : public Task, private boost::noncopyable {
+  DiskImageView<PixelT> m_disparity;
+  BBox2i                m_block;
+  BBox2               & m_range;
+  Mutex               & m_mutex;
+public:
+  DisparityRangeTask(DiskImageView<PixelT> const& disparity, BBox2i const& block,
+                     BBox2 & range, Mutex & mutex):
+    m_disparity(disparity), m_block(block), m_range(range), m_mutex(mutex) {}
+
+  virtual void operator()() {
+    typedef typename PixelChannelType<PixelT>::type ChannelT;
+    ImageView<PixelT> disp = crop(m_disparity, m_block);
+    BBox2 range;
+    for (int row = 0; row < disp.rows(); row++) {
+      for (int col = 0; col < disp.cols(); col++) {
+        PixelT const& p = disp(col, row);
+        if (is_valid(p))
+          range.grow(Vector2(compound_select_channel<ChannelT const&>(p, 0),
+                             compound_select_channel<ChannelT const&>(p, 1)));
+      }
+    }
+    Mutex::Lock lock(m_mutex);
+    m_range.grow(range);
+  }
+};
+
+/// The disparity range, from about a million pixels in whole blocks of
+/// the image spread over the region, so that only these blocks are read
+/// from disk. The blocks are read in parallel.
+template <class PixelT>
+BBox2 sampled_disparity_range(DiskImageView<PixelT> const& disparity,
+                              std::string const& disparity_file, BBox2i const& roi) {
+
+  Vector2i block_size = vw::DiskImageResourcePtr(disparity_file)->block_read_size();
+  block_size = Vector2i(std::max(block_size.x(), 1), std::max(block_size.y(), 1));
+  int num_bx = (roi.max().x() - 1)/block_size.x() - roi.min().x()/block_size.x() + 1;
+  int num_by = (roi.max().y() - 1)/block_size.y() - roi.min().y()/block_size.y() + 1;
+
+  // Every step-th block in each direction
+  double num_blocks = 1000.0*1000.0/(double(block_size.x())*block_size.y());
+  int step = std::max(1, (int)floor(sqrt(double(num_bx)*num_by/std::max(num_blocks, 1.0))));
+
+  BBox2 range;
+  Mutex mutex;
+  FifoWorkQueue queue(vw_settings().default_num_threads());
+  for (int by = roi.min().y()/block_size.y(); by*block_size.y() < roi.max().y(); by += step) {
+    for (int bx = roi.min().x()/block_size.x(); bx*block_size.x() < roi.max().x(); bx += step) {
+      BBox2i block(bx*block_size.x(), by*block_size.y(), block_size.x(), block_size.y());
+      block.crop(roi);
+      if (block.empty())
+        continue;
+      queue.add_task(boost::shared_ptr<Task>
+                     (new DisparityRangeTask<PixelT>(disparity, block, range, mutex)));
+    }
+  }
+  queue.join_all();
+
+  if (range.empty())
+    range = BBox2(0, 0, 0, 0);
+  return range;
+}
+
+/// Scale the horizontal and vertical disparities of a pixel in their
+/// ranges to 8 bit, with invalid pixels set to 0.
+template <class PixelT>
+struct DisparityToByteFunctor: ReturnFixedType< Vector<uint8, 2> > {
+  BBox2 m_range;
+  DisparityToByteFunctor(BBox2 const& range): m_range(range) {}
+
+  Vector<uint8, 2> operator()(PixelT const& p) const {
+    typedef typename PixelChannelType<PixelT>::type ChannelT;
+    Vector<uint8, 2> out;
+    if (!is_valid(p))
+      return out;
+    for (int k = 0; k < 2; k++) {
+      double lo = m_range.min()[k], hi = m_range.max()[k];
+      double v  = compound_select_channel<ChannelT const&>(p, k);
+      v = (hi > lo) ? (v - lo)/(hi - lo) : 0.0;
+      out[k] = (uint8)round(255.0*std::max(0.0, std::min(1.0, v)));
+    }
+    return out;
+  }
+};
+
 template <class PixelT>
 void do_disparity_visualization(Options& opt) {
   DiskImageView<PixelT > disk_disparity_map(opt.input_file_name);
@@ -105,62 +197,56 @@ void do_disparity_visualization(Options& opt) {
   if (has_georef)
     georef = crop(georef, roiToUse);
 
-  // We don't want to sample every pixel as the image might be very
-  // large. Let's subsample the image so that it is rough 1000x1000 samples.
-  float subsample_amt =
-    float(roiToUse.height())*float(roiToUse.width()) / ( 1000.f * 1000.f );
-
-  // Compute intensity display range if not passed in
+  // We don't want to read every pixel as the image might be very
+  // large, so sample whole blocks of it.
   if ( opt.normalization_range == BBox2(0,0,0,0) )
-    opt.normalization_range =
-      get_disparity_range(subsample(crop(disk_disparity_map, roiToUse),
-                                    subsample_amt > 1 ? subsample_amt : 1));
+    opt.normalization_range = sampled_disparity_range(disk_disparity_map,
+                                                      opt.input_file_name,
+                                                      BBox2i(roiToUse));
 
   vw_out() << "\t    Horizontal: [" << opt.normalization_range.min().x()
            << " " << opt.normalization_range.max().x() << "]    Vertical: ["
            << opt.normalization_range.min().y() << " "
            << opt.normalization_range.max().y() << "]\n";
 
-  // Generate value-normalized copies of the H and V channels
-  typedef typename PixelChannelType<PixelT>::type ChannelT;
-  ImageViewRef<ChannelT> horizontal =
-    apply_mask(copy_mask(clamp(normalize(crop(select_channel(disk_disparity_map,0),
-                                              roiToUse),
-                                         opt.normalization_range.min().x(),
-                                         opt.normalization_range.max().x(),
-                                         ChannelRange<ChannelT>::min(),ChannelRange<ChannelT>::max()
-                                        )
-                              ),
-                         crop(disk_disparity_map, roiToUse)
-                        )
-              );
-  ImageViewRef<ChannelT> vertical =
-    apply_mask(copy_mask(clamp(normalize(crop(select_channel(disk_disparity_map,1),
-                                              roiToUse),
-                                         opt.normalization_range.min().y(),
-                                         opt.normalization_range.max().y(),
-                                         ChannelRange<ChannelT>::min(),ChannelRange<ChannelT>::max()
-                                        )
-                              ),
-                         crop(disk_disparity_map, roiToUse)
-                        )
-              );
-
-  // Write both images to disk, casting as UINT8
-  std::string h_file = opt.output_prefix+"-H."+opt.output_file_type;
-  vw_out() << "\t--> Writing horizontal disparity debug image: " << h_file << "\n";
-  block_write_gdal_image( h_file,
-                          channel_cast_rescale<uint8>(horizontal),
+  // Read the disparity once, writing both normalized channels to a
+  // temporary two-band image, which then is split into the H and V
+  // images. That image is much smaller than the disparity.
+  std::string hv_file = opt.output_prefix + "-HV-tmp.tif";
+  vw_out() << "\t--> Normalizing the disparity: " << hv_file << "\n";
+  block_write_gdal_image( hv_file,
+                          per_pixel_filter(crop(disk_disparity_map, roiToUse),
+                                           DisparityToByteFunctor<PixelT>(opt.normalization_range)),
                           has_georef, georef,
                           has_nodata, output_nodata,
-                          opt, TerminalProgressCallback("asp","\t    H : "));
+                          opt, TerminalProgressCallback("asp","\t    HV: "));
+
+  std::string h_file = opt.output_prefix+"-H."+opt.output_file_type;
   std::string v_file = opt.output_prefix+"-V."+opt.output_file_type;
-  vw_out() << "\t--> Writing vertical disparity debug image: " << v_file << "\n";
-  block_write_gdal_image( v_file,
-                          channel_cast_rescale<uint8>(vertical),
-                          has_georef, georef,
-                          has_nodata, output_nodata,
-                          opt, TerminalProgressCallback("asp","\t    V : "));
+  {
+    DiskImageView< Vector<uint8, 2> > hv(hv_file);
+
+    // Write both images to disk, as UINT8
+    vw_out() << "\t--> Writing horizontal disparity debug image: " << h_file << "\n";
+    block_write_gdal_image( h_file,
+                            select_channel(hv, 0),
+                            has_georef, georef,
+                            has_nodata, output_nodata,
+                            opt, TerminalProgressCallback("asp","\t    H : "));
+    vw_out() << "\t--> Writing vertical disparity debug image: " << v_file << "\n";
+    block_write_gdal_image( v_file,
+                            select_channel(hv, 1),
+                            has_georef, georef,
+                            has_nodata, output_nodata,
+                            opt, TerminalProgressCallback("asp","\t    V : "));
+  }
+  boost::filesystem::remove(hv_file);
+
+  if (opt.cog) {
+    TerminalProgressCallback cog_tpc("asp", "Overviews: ");
+    asp::write_cog(h_file, opt, "AVERAGE", cog_tpc);
+    asp::write_cog(v_file, opt, "AVERAGE", cog_tpc);
+  }
 }
 
 int main( int argc, char *argv[] ) {
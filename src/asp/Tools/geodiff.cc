@@ -17,6 +17,8 @@
 
 
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/ImageStatistics.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO.h>
 #include <vw/Image.h>
 #include <vw/Cartography.h>
@@ -30,6 +32,9 @@ using namespace vw::cartography;
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <boost/noncopyable.hpp>
+#include <fstream>
+#include <iterator>
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
@@ -44,6 +49,126 @@ public:
   }
 };
 
+/// Statistics of the differences, accumulated as the differences are
+/// computed, so that no second pass over them is needed. The
+/// percentiles are estimated from a sample of the differences.
+struct DiffStats {
+  long long int      count;
+  double             sum, sum2, min_val, max_val;
+  std::vector<float> samples;
+
+  DiffStats(): count(0), sum(0.0), sum2(0.0),
+               min_val(std::numeric_limits<double>::max()),
+               max_val(-std::numeric_limits<double>::max()) {}
+
+  void add(double diff) {
+    count++;
+    sum  += diff;
+    sum2 += diff*diff;
+    if (diff < min_val) min_val = diff;
+    if (diff > max_val) max_val = diff;
+  }
+
+  void merge(DiffStats const& other) {
+    count += other.count;
+    sum   += other.sum;
+    sum2  += other.sum2;
+    min_val = std::min(min_val, other.min_val);
+    max_val = std::max(max_val, other.max_val);
+    samples.insert(samples.end(), other.samples.begin(), other.samples.end());
+  }
+
+  double mean() const {
+    return count > 0 ? sum/count : 0.0;
+  }
+
+  double stddev() const {
+    if (count == 0)
+      return 0.0;
+    double m = mean();
+    return std::sqrt(std::max(0.0, sum2/count - m*m)); // clip numerical noise
+  }
+
+  /// Print the statistics, each line starting with the given prefix.
+  void print(std::ostream & os, std::string const& prefix) const {
+    os << prefix << "Max difference:       " << max_val  << std::endl;
+    os << prefix << "Min difference:       " << min_val  << std::endl;
+    os << prefix << "Mean difference:      " << mean()   << std::endl;
+    os << prefix << "StdDev of difference: " << stddev() << std::endl;
+    if (samples.empty())
+      return;
+    std::vector<float> values = samples;
+    os << prefix << "Median difference:    " << asp::sample_quantile(values, 0.5) << std::endl;
+    os << prefix << "Percentiles 5, 25, 75, 95: "
+       << asp::sample_quantile(values, 0.05) << ", " << asp::sample_quantile(values, 0.25) << ", "
+       << asp::sample_quantile(values, 0.75) << ", " << asp::sample_quantile(values, 0.95)
+       << std::endl;
+  }
+};
+
+/// Pass through the difference image, while adding its valid pixels to
+/// the statistics, so they are found while the image is written. The
+/// pixels on a grid with the given step are also sampled for the
+/// percentiles, which makes the sample independent of the order in
+/// which the tiles are processed.
+class DiffStatsView: public ImageViewBase<DiffStatsView> {
+  ImageViewRef<double> m_diff;
+  double               m_nodata;
+  int                  m_sample_step;
+  DiffStats          & m_stats; // alias
+  vw::Mutex          & m_mutex; // alias, to lock when updating m_stats
+
+public:
+  DiffStatsView(ImageViewRef<double> const& diff, double nodata, int sample_step,
+                DiffStats & stats, vw::Mutex & mutex):
+    m_diff(diff), m_nodata(nodata), m_sample_step(sample_step),
+    m_stats(stats), m_mutex(mutex) {}
+
+  typedef double pixel_type;
+  typedef double result_type;
+  typedef ProceduralPixelAccessor<DiffStatsView> pixel_accessor;
+
+  inline int32 cols  () const { return m_diff.cols(); }
+  inline int32 rows  () const { return m_diff.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+  inline pixel_type operator()(double/*i*/, double/*j*/, int32/*p*/ = 0) const {
+    vw_throw(NoImplErr() << "DiffStatsView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+    ImageView<pixel_type> tile = crop(m_diff, bbox);
+
+    DiffStats tile_stats;
+    for (int row = 0; row < tile.rows(); row++) {
+      bool sample_row = ((row + bbox.min().y()) % m_sample_step == 0);
+      for (int col = 0; col < tile.cols(); col++) {
+        double val = tile(col, row);
+        if (val == m_nodata || val != val)
+          continue;
+        tile_stats.add(val);
+        if (sample_row && (col + bbox.min().x()) % m_sample_step == 0)
+          tile_stats.samples.push_back(val);
+      }
+    }
+    {
+      vw::Mutex::Lock lock(m_mutex);
+      m_stats.merge(tile_stats);
+    }
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i const& bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
 struct Options : vw::cartography::GdalWriteOptions {
   string dem1_file, dem2_file, output_prefix, csv_format_str, csv_proj4_str;
   double nodata_value;
@@ -174,6 +299,13 @@ void dem2dem_diff(Options& opt){
   }
     
   GeoReference crop_georef = crop(dem1_georef, crop_box);
+
+  // Gather the statistics while writing
+  DiffStats stats;
+  vw::Mutex stats_mutex;
+  int sample_step = asp::stats_sample_step(difference.cols(), difference.rows(),
+                                           asp::stats_sample_count(0.001));
+  difference = DiffStatsView(difference, opt.nodata_value, sample_step, stats, stats_mutex);
     
   std::string output_file = opt.output_prefix + "-diff.tif";
   vw_out() << "Writing difference file: " << output_file << "\n";
@@ -196,8 +328,72 @@ void dem2dem_diff(Options& opt){
     block_write_image(*rsrc, difference,
                       TerminalProgressCallback("asp", "\t--> Differencing: "));
   }
+
+  stats.print(vw_out(), "");
 }
 
+/// Parse a range of lines of a CSV file and find the difference of
+/// the DEM height and the height of each point, as longitude,
+/// latitude, and difference. Each task has its own copies of the
+/// georeferences, as their projections may not be used from several
+/// threads at once.
+class CsvDiffTask: public vw::Task, private boost::noncopyable {
+  std::vector<std::string> const& m_lines;
+  size_t                   m_beg, m_end;
+  bool                     m_is_first_line, m_reverse, m_use_absolute;
+  asp::CsvConv const&      m_csv_conv;
+  GeoReference             m_csv_georef, m_dem_georef;
+  ImageViewRef< PixelMask<double> > m_interp_dem;
+  int                      m_cols, m_rows;
+  std::vector<Vector3>   & m_diffs;
+
+public:
+  CsvDiffTask(std::vector<std::string> const& lines, size_t beg, size_t end,
+              bool is_first_line, bool reverse, bool use_absolute,
+              asp::CsvConv const& csv_conv,
+              GeoReference const& csv_georef, GeoReference const& dem_georef,
+              ImageViewRef< PixelMask<double> > const& interp_dem, int cols, int rows,
+              std::vector<Vector3> & diffs):
+    m_lines(lines), m_beg(beg), m_end(end), m_is_first_line(is_first_line),
+    m_reverse(reverse), m_use_absolute(use_absolute), m_csv_conv(csv_conv),
+    m_csv_georef(csv_georef), m_dem_georef(dem_georef), m_interp_dem(interp_dem),
+    m_cols(cols), m_rows(rows), m_diffs(diffs) {}
+
+  virtual void operator()() {
+    bool first_line = m_is_first_line;
+    for (size_t it = m_beg; it < m_end; it++) {
+      bool success = false;
+      asp::CsvConv::CsvRecord record
+        = m_csv_conv.parse_csv_line(first_line, success, m_lines[it]);
+      first_line = false;
+      if (!success)
+        continue;
+
+      Vector3 xyz = m_csv_conv.csv_to_cartesian(record, m_csv_georef);
+      if (xyz == Vector3() || xyz != xyz)
+        continue; // invalid point
+      Vector3 llh = m_dem_georef.datum().cartesian_to_geodetic(xyz); // use the dem's datum
+      Vector2 ll  = subvector(llh, 0, 2);
+      Vector2 pix = m_dem_georef.lonlat_to_pixel(ll);
+
+      // Check for out of range
+      if (pix[0] < 0 || pix[0] > m_cols - 1) continue;
+      if (pix[1] < 0 || pix[1] > m_rows - 1) continue;
+      PixelMask<double> dem_ht = m_interp_dem(pix[0], pix[1]);
+      if (!is_valid(dem_ht))
+        continue;
+
+      double diff = dem_ht.child() - llh[2];
+      if (m_reverse)
+        diff *= -1;
+      if (m_use_absolute)
+        diff = std::abs(diff);
+
+      m_diffs.push_back(Vector3(ll[0], ll[1], diff));
+    }
+  }
+};
+
 // From a DEM, subtract a csv file. Reverse the sign is 'reverse' is true.
 void dem2csv_diff(Options & opt, std::string const& dem_file,
                   std::string const & csv_file, bool reverse){
@@ -242,88 +438,96 @@ void dem2csv_diff(Options & opt, std::string const& dem_file,
   GeoReference csv_georef = dem_georef;
   csv_conv.parse_georef(csv_georef);
 
-  std::list<asp::CsvConv::CsvRecord> csv_records;
-  typedef std::list<asp::CsvConv::CsvRecord>::const_iterator RecordIter;
-  csv_conv.read_csv_file(csv_file, csv_records);
-  
-  std::vector<Vector3> csv_llh;
-  for (RecordIter iter = csv_records.begin(); iter != csv_records.end(); iter++) {
-    Vector3 xyz = csv_conv.csv_to_cartesian(*iter, csv_georef);
-    if (xyz == Vector3() || xyz != xyz)
-      continue; // invalid point
-    Vector3 llh = dem_georef.datum().cartesian_to_geodetic(xyz); // use the dem's datum
-    csv_llh.push_back(llh);
-  }
-
   // We will interpolate into the DEM to find the difference
   ImageViewRef< PixelMask<double> > interp_dem
     = interpolate(create_mask(dem, dem_nodata),
 		  BilinearInterpolation(), ConstantEdgeExtension());
 
-
-  // Save the diffs
-  int    count     = 0;
-  double diff_min  = std::numeric_limits<double>::max();
-  double diff_max  = -diff_min;
-  double diff_mean = 0.0;
-  double diff_std  = 0.0;
-  
-  std::vector<Vector3> csv_diff;
-  for (size_t it = 0; it < csv_llh.size(); it++) {
-
-    Vector3 llh = csv_llh[it];
-    Vector2 ll  = subvector(llh, 0, 2);
-    Vector2 pix = dem_georef.lonlat_to_pixel(ll);
-    
-    // Check for out of range
-    if (pix[0] < 0 || pix[0] > dem.cols() - 1) continue;
-    if (pix[1] < 0 || pix[1] > dem.rows() - 1) continue;
-    PixelMask<double> dem_ht = interp_dem(pix[0], pix[1]);
-    if (!is_valid(dem_ht))
-      continue;
-
-    double diff = dem_ht.child() - llh[2];
-    if (reverse) 
-      diff *= -1;
-    if (opt.use_absolute)
-      diff = std::abs(diff);
-
-    if (diff > diff_max) diff_max = diff;
-    if (diff < diff_min) diff_min = diff;
-
-    diff_mean += diff;
-    diff_std  += diff*diff;
-    count     += 1;
-    csv_diff.push_back(Vector3(ll[0], ll[1], diff));
-  }
-
-  if (count > 0) {
-    diff_mean /= count;
-    diff_std = diff_std/count - diff_mean*diff_mean;
-    if (diff_std < 0)
-      diff_std = 0; // just in case, for numerical noise
-    diff_std = std::sqrt(diff_std);
+  // The differences are written as they are found, and the file with
+  // the statistics at the top is put together at the end.
+  std::string output_file = opt.output_prefix + "-diff.csv";
+  std::string body_file   = output_file + ".tmp";
+  std::ofstream body( body_file.c_str() );
+  if (!body)
+    vw_throw(IOErr() << "Unable to open file: " << body_file << "\n");
+  body.precision(16);
+
+  std::ifstream csv( csv_file.c_str() );
+  if (!csv)
+    vw_throw(IOErr() << "Unable to open file \"" << csv_file << "\"");
+
+  // Read the file in chunks. The lines of a chunk are parsed and
+  // interpolated in parallel, and their differences gathered in order.
+  // The percentiles are found from every sample_stride-th difference,
+  // with the stride doubled each time the sample gets too large.
+  const size_t chunk_size  = 1000000;
+  const size_t max_samples = 2*size_t(asp::stats_sample_count(0.001));
+  int num_threads = opt.num_threads > 0 ? opt.num_threads : vw_settings().default_num_threads();
+  num_threads = std::max(num_threads, 1);
+  size_t sample_stride = 1;
+  long long int diff_index = 0;
+  DiffStats stats;
+  bool first_line = true;
+  std::vector<std::string> lines;
+  while (csv) {
+    lines.clear();
+    std::string line;
+    while (lines.size() < chunk_size && std::getline(csv, line, '\n'))
+      lines.push_back(line);
+    if (lines.empty())
+      break;
+
+    size_t num_tasks = std::min(lines.size(), size_t(num_threads));
+    size_t task_size = (lines.size() + num_tasks - 1)/num_tasks;
+    std::vector< std::vector<Vector3> > task_diffs(num_tasks);
+    {
+      FifoWorkQueue queue(num_threads);
+      for (size_t t = 0; t < num_tasks; t++) {
+        size_t beg = t*task_size, end = std::min(lines.size(), beg + task_size);
+        boost::shared_ptr<Task> task
+          (new CsvDiffTask(lines, beg, end, first_line && t == 0, reverse, opt.use_absolute,
+                           csv_conv, csv_georef, dem_georef, interp_dem,
+                           dem.cols(), dem.rows(), task_diffs[t]));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
+    first_line = false;
+
+    for (size_t t = 0; t < num_tasks; t++) {
+      for (size_t it = 0; it < task_diffs[t].size(); it++) {
+        Vector3 const& diff = task_diffs[t][it];
+        stats.add(diff[2]);
+        if (diff_index % sample_stride == 0)
+          stats.samples.push_back(diff[2]);
+        diff_index++;
+        if (stats.samples.size() >= max_samples) {
+          // Keep every other sample
+          for (size_t k = 0; 2*k < stats.samples.size(); k++)
+            stats.samples[k] = stats.samples[2*k];
+          stats.samples.resize((stats.samples.size() + 1)/2);
+          sample_stride *= 2;
+        }
+        body << diff[0] << "," << diff[1] << "," << diff[2] << "\n";
+      }
+    }
   }
+  csv.close();
+  body.close();
 
-  vw_out() << "Max difference:       " << diff_max  << std::endl;
-  vw_out() << "Min difference:       " << diff_min  << std::endl;
-  vw_out() << "Mean difference:      " << diff_mean << std::endl;
-  vw_out() << "StdDev of difference: " << diff_std  << std::endl;
+  stats.print(vw_out(), "");
 
-  std::string output_file = opt.output_prefix + "-diff.csv";
   vw_out() << "Writing difference file: " << output_file << "\n";
-  std::ofstream outfile( output_file.c_str() );
-  outfile.precision(16);
-  outfile << "# longitude,latitude, height diff (m)" << std::endl;
-  outfile << "# " << dem_georef.datum() << std::endl; // dem's datum
-  outfile << "# Max difference:       " << diff_max  << std::endl;
-  outfile << "# Min difference:       " << diff_min  << std::endl;
-  outfile << "# Mean difference:      " << diff_mean << std::endl;
-  outfile << "# StdDev of difference: " << diff_std  << std::endl;
-  for (size_t it = 0; it < csv_diff.size(); it++) {
-    Vector3 diff = csv_diff[it];
-    outfile << diff[0] << "," << diff[1] << "," << diff[2] << std::endl;
+  {
+    std::ofstream outfile( output_file.c_str() );
+    outfile.precision(16);
+    outfile << "# longitude,latitude, height diff (m)" << std::endl;
+    outfile << "# " << dem_georef.datum() << std::endl; // dem's datum
+    stats.print(outfile, "# ");
+    std::ifstream body_in( body_file.c_str() );
+    outfile << body_in.rdbuf();
   }
+  fs::remove(body_file);
 }
 
 // Subtract from the first dem the second. One of them can be a CSV file.
@@ -18,11 +18,13 @@
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/ImageStatistics.h>
 
 #include <boost/program_options.hpp>
 namespace po = boost::program_options;
 #include <boost/filesystem/path.hpp>
 namespace fs = boost::filesystem;
+#include <boost/math/special_functions/fpclassify.hpp>
 
 #include <vw/Image.h>
 #include <vw/FileIO.h>
@@ -30,35 +32,41 @@ namespace fs = boost::filesystem;
 
 using namespace vw;
 
-// Functors
-template <class Arg1T, class Arg2T>
-struct ReplaceChannelFunc: public ReturnFixedType<Arg1T> {
-private:
-  int m_channel;
-public:
-  ReplaceChannelFunc( int const& channel ) : m_channel(channel) {}
+// Replacing the value of a pixel in HSV keeps its hue and saturation,
+// which amounts to scaling its RGB channels by the ratio of the new
+// value to the old one, the largest channel. That is done here with
+// no conversion to HSV and back.
+template <class ChannelT>
+inline PixelRGB<ChannelT> replace_value(PixelRGB<ChannelT> const& rgb, double val) {
+  double old_val = std::max(double(rgb[0]), std::max(double(rgb[1]), double(rgb[2])));
+  if (old_val <= 0)
+    return PixelRGB<ChannelT>(val, val, val);
+  double ratio = val/old_val;
+  PixelRGB<ChannelT> out;
+  for (int k = 0; k < 3; k++) {
+    double c = rgb[k]*ratio;
+    if (std::numeric_limits<ChannelT>::is_integer)
+      c = std::max(double(std::numeric_limits<ChannelT>::min()),
+                   std::min(double(std::numeric_limits<ChannelT>::max()), round(c)));
+    out[k] = ChannelT(c);
+  }
+  return out;
+}
 
-  inline Arg1T operator()( Arg1T const& arg1,
-                           Arg2T const& arg2 ) const {
-    Arg1T t( arg1 );
-    t[m_channel] = arg2;
-    return t;
+// Functors
+template <class ChannelT>
+struct ReplaceValueFunc: public ReturnFixedType<PixelRGB<ChannelT> > {
+  inline PixelRGB<ChannelT> operator()(PixelRGB<ChannelT> const& rgb,
+                                       PixelGray<ChannelT> const& gray) const {
+    return replace_value(rgb, double(gray.v()));
   }
 };
 
-template <class Image1T, class Image2T>
-inline BinaryPerPixelView<Image1T, Image2T, ReplaceChannelFunc<typename Image1T::pixel_type, typename Image2T::pixel_type> >
-replace_channel( ImageViewBase<Image1T> const& image1,
-                 int const& channel,
-                 ImageViewBase<Image2T> const& image2 ) {
-  typedef ReplaceChannelFunc<typename Image1T::pixel_type, typename Image2T::pixel_type> func_type;
-  return BinaryPerPixelView<Image1T, Image2T, func_type >( image1.impl(), image2.impl(), func_type(channel));
-}
-
 // Standard Arguments
 struct Options : public vw::cartography::GdalWriteOptions {
-  std::string input_rgb, input_gray;
-  std::string output_file;
+  std::string input_rgb, input_gray, input_dem;
+  std::string output_file, colormap_style;
+  double azimuth, elevation, min_height, max_height;
 };
 
 // Image Operations
@@ -70,7 +78,7 @@ void do_merge(Options const& opt) {
   cartography::read_georeference(georef, opt.input_rgb);
 
   ImageViewRef<PixelRGB<ChannelT> > result =
-    pixel_cast<PixelRGB<ChannelT> >(replace_channel(pixel_cast<PixelHSV<ChannelT> >(rgb_image),2,shaded_image));
+    per_pixel_filter(rgb_image, shaded_image, ReplaceValueFunc<ChannelT>());
 
   bool has_georef = true;
   bool has_nodata = false;
@@ -80,6 +88,157 @@ void do_merge(Options const& opt) {
                           TerminalProgressCallback("tools.hsv_merge","Writing:") );
 }
 
+// The color of a height, scaled to [0, 1] between the colormap bounds
+PixelRGB<uint8> height_color(std::string const& style, double t) {
+  t = std::max(0.0, std::min(1.0, t));
+  double r, g, b;
+  if (style == "jet") {
+    r = 1.5 - std::abs(4*t - 3);
+    g = 1.5 - std::abs(4*t - 2);
+    b = 1.5 - std::abs(4*t - 1);
+  } else { // binary-red-blue, from blue through white to red
+    r = std::min(1.0, 2*t);
+    b = std::min(1.0, 2 - 2*t);
+    g = std::min(r, b);
+  }
+  r = std::max(0.0, std::min(1.0, r));
+  g = std::max(0.0, std::min(1.0, g));
+  b = std::max(0.0, std::min(1.0, b));
+  return PixelRGB<uint8>(round(255*r), round(255*g), round(255*b));
+}
+
+// The ground size of a DEM pixel, in meters, along the columns and rows
+Vector2 dem_pixel_size(cartography::GeoReference const& georef, Vector2 const& pix) {
+  cartography::Datum const& datum = georef.datum();
+  Vector2 ll_0 = georef.pixel_to_lonlat(pix);
+  Vector2 ll_x = georef.pixel_to_lonlat(pix + Vector2(1, 0));
+  Vector2 ll_y = georef.pixel_to_lonlat(pix + Vector2(0, 1));
+  Vector3 p0   = datum.geodetic_to_cartesian(Vector3(ll_0[0], ll_0[1], 0));
+  Vector3 px   = datum.geodetic_to_cartesian(Vector3(ll_x[0], ll_x[1], 0));
+  Vector3 py   = datum.geodetic_to_cartesian(Vector3(ll_y[0], ll_y[1], 0));
+  return Vector2(std::max(norm_2(px - p0), 1e-10), std::max(norm_2(py - p0), 1e-10));
+}
+
+// The colorized hillshade of a DEM, with the hillshade, the colormap,
+// and their merge done per tile, so the DEM is read once. No-data
+// pixels are black.
+class ColorizedHillshadeView: public ImageViewBase<ColorizedHillshadeView> {
+  DiskImageView<float>      m_dem;
+  cartography::GeoReference m_georef;
+  double      m_nodata, m_min_height, m_max_height;
+  Vector3     m_light;
+  std::string m_style;
+
+  bool is_valid_height(double z) const {
+    return !boost::math::isnan(z) && z > m_nodata;
+  }
+
+public:
+  typedef PixelRGB<uint8> pixel_type;
+  typedef pixel_type      result_type;
+  typedef ProceduralPixelAccessor<ColorizedHillshadeView> pixel_accessor;
+
+  ColorizedHillshadeView(DiskImageView<float> const& dem,
+                         cartography::GeoReference const& georef, double nodata,
+                         double min_height, double max_height,
+                         double azimuth, double elevation, std::string const& style):
+    m_dem(dem), m_georef(georef), m_nodata(nodata),
+    m_min_height(min_height), m_max_height(max_height), m_style(style) {
+    // The direction to the light, with x to the east, y to the north, and z up
+    double a = azimuth*M_PI/180.0, e = elevation*M_PI/180.0;
+    m_light = Vector3(sin(a)*cos(e), cos(a)*cos(e), sin(e));
+  }
+
+  inline int32 cols  () const { return m_dem.cols(); }
+  inline int32 rows  () const { return m_dem.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "ColorizedHillshadeView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    // The tile with a one-pixel border, for the slopes
+    BBox2i big = bbox;
+    big.expand(1);
+    ImageView<float> dem = crop(edge_extend(m_dem, ConstantEdgeExtension()), big);
+
+    Vector2 pixel_size = dem_pixel_size(m_georef, Vector2(bbox.min() + bbox.max())/2.0);
+    double dx = pixel_size[0], dy = pixel_size[1];
+    double scale = 1.0/std::max(m_max_height - m_min_height, 1e-10);
+
+    ImageView<pixel_type> tile(bbox.width(), bbox.height());
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        int c = col + 1, r = row + 1;
+        double z = dem(c, r);
+        if (!is_valid_height(z)) {
+          tile(col, row) = pixel_type(0, 0, 0);
+          continue;
+        }
+
+        // One-sided differences at the edges of the no-data areas
+        int c0 = c - 1, c1 = c + 1, r0 = r - 1, r1 = r + 1;
+        double zl = dem(c0, r), zr = dem(c1, r), zu = dem(c, r0), zd = dem(c, r1);
+        if (!is_valid_height(zl)) { zl = z; c0 = c; }
+        if (!is_valid_height(zr)) { zr = z; c1 = c; }
+        if (!is_valid_height(zu)) { zu = z; r0 = r; }
+        if (!is_valid_height(zd)) { zd = z; r1 = r; }
+        double dzdx = (c1 > c0) ? (zr - zl)/((c1 - c0)*dx) : 0.0;
+        double dzdy = (r1 > r0) ? (zu - zd)/((r1 - r0)*dy) : 0.0; // rows go south
+
+        Vector3 normal(-dzdx, -dzdy, 1.0);
+        double shade = 255.0*std::max(0.0, dot_prod(normal, m_light))/norm_2(normal);
+        tile(col, row) = replace_value(height_color(m_style, (z - m_min_height)*scale),
+                                       std::min(shade, 255.0));
+      }
+    }
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+void do_dem_merge(Options opt) {
+  DiskImageView<float> dem(opt.input_dem);
+  cartography::GeoReference georef;
+  if (!cartography::read_georeference(georef, opt.input_dem))
+    vw_throw(ArgumentErr() << "The DEM has no georeference: " << opt.input_dem << "\n");
+
+  double nodata = -std::numeric_limits<float>::max();
+  boost::shared_ptr<DiskImageResource> rsrc = DiskImageResourcePtr(opt.input_dem);
+  if (rsrc->has_nodata_read())
+    nodata = rsrc->nodata_read();
+
+  // The colormap bounds, if not set, from a sample of the heights
+  if (opt.min_height >= opt.max_height) {
+    std::vector<float> values;
+    int step = asp::stats_sample_step(dem.cols(), dem.rows(), 1.0e+6);
+    asp::sample_valid_values(create_mask_less_or_equal(dem, nodata), step, 0, values);
+    if (values.empty())
+      vw_throw(ArgumentErr() << "No valid heights found in: " << opt.input_dem << "\n");
+    opt.min_height = asp::sample_quantile(values, 0.0);
+    opt.max_height = asp::sample_quantile(values, 1.0);
+    vw_out() << "Colormap height range: " << opt.min_height << ' ' << opt.max_height << "\n";
+  }
+
+  ColorizedHillshadeView result(dem, georef, nodata, opt.min_height, opt.max_height,
+                                opt.azimuth, opt.elevation, opt.colormap_style);
+
+  bool has_georef = true, has_nodata = false;
+  block_write_gdal_image( opt.output_file, result, has_georef, georef, has_nodata, nodata, opt,
+                          TerminalProgressCallback("tools.hsv_merge","Writing:") );
+}
+
 // Handle input
 int main( int argc, char *argv[] ) {
 
@@ -88,7 +247,21 @@ int main( int argc, char *argv[] ) {
   try {
     po::options_description general_options("Description: Mimicks hsv_merge.py by Frank Warmerdam and Trent Hare. Use it to combine results from gdaldem.");
     general_options.add_options()
-      ("output-file,o", po::value(&opt.output_file), "Specify the output file.");
+      ("output-file,o", po::value(&opt.output_file), "Specify the output file.")
+      ("dem", po::value(&opt.input_dem),
+       "Make the colorized hillshade of this DEM, reading it once, instead of merging "
+       "an RGB and a gray image.")
+      ("colormap-style", po::value(&opt.colormap_style)->default_value("binary-red-blue"),
+       "With --dem, the colormap style: binary-red-blue or jet.")
+      ("min", po::value(&opt.min_height)->default_value(0),
+       "With --dem, the height at the start of the colormap.")
+      ("max", po::value(&opt.max_height)->default_value(0),
+       "With --dem, the height at the end of the colormap. If not more than --min, "
+       "the range of the heights is used.")
+      ("azimuth", po::value(&opt.azimuth)->default_value(300),
+       "With --dem, the azimuth of the light, in degrees clockwise from north.")
+      ("elevation", po::value(&opt.elevation)->default_value(20),
+       "With --dem, the elevation of the light above the horizon, in degrees.");
     general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
     po::options_description positional_options("");
@@ -100,7 +273,7 @@ int main( int argc, char *argv[] ) {
     positional_desc.add("input-rgb", 1 );
     positional_desc.add("input-gray", 1 );
 
-    std::string usage("[options] <input rgb> <input gray>");
+    std::string usage("[options] <input rgb> <input gray>\n  hsv_merge [options] --dem <input DEM> -o <output>");
     bool allow_unregistered = false;
     std::vector<std::string> unregistered;
     po::variables_map vm =
@@ -108,6 +281,15 @@ int main( int argc, char *argv[] ) {
                                positional_options, positional_desc, usage,
                                allow_unregistered, unregistered );
 
+    if ( !opt.input_dem.empty() ) {
+      if ( opt.output_file.empty() )
+        vw_throw( ArgumentErr() << "Missing the output file.\n" << usage << general_options );
+      if ( opt.colormap_style != "binary-red-blue" && opt.colormap_style != "jet" )
+        vw_throw( ArgumentErr() << "Unknown colormap style: " << opt.colormap_style << ".\n" );
+      do_dem_merge( opt );
+      return 0;
+    }
+
     if ( opt.input_rgb.empty() || opt.input_gray.empty() )
       vw_throw( ArgumentErr() << "Missing required input files.\n"
                 << usage << general_options );
@@ -235,6 +235,209 @@ struct calc_operation {
 };
 
 
+/// The operation tree compiled into a flat list of instructions, each
+/// of which is applied to a whole row of pixels before the next one,
+/// rather than walking the tree for every pixel. The operands of an
+/// instruction are constants, input variables, or the results of
+/// earlier instructions, which are kept on a stack of row buffers.
+/// Subtrees which depend on no variable are evaluated once, when
+/// compiling.
+class calc_program {
+public:
+
+  calc_program(): m_max_depth(0) {}
+
+  /// Compile the tree, checking that it uses only the given number of variables.
+  calc_program(calc_operation const& tree, int num_vars): m_max_depth(0) {
+    int depth = 0;
+    m_result = compile(tree, num_vars, depth);
+  }
+
+  /// The number of row buffers needed by evaluate().
+  int num_buffers() const { return m_max_depth + 1; }
+
+  /// Apply the program to n pixels, with the values of variable k at
+  /// vars[k]. The buffers must be num_buffers() vectors of n values.
+  void evaluate(std::vector<const double*> const& vars, int n,
+                std::vector< std::vector<double> > & buffers, double * out) const {
+
+    int sp = 0; // the number of results on the stack
+    for (size_t k = 0; k < m_program.size(); k++) {
+      instruction const& ins = m_program[k];
+      int num_args = ins.args.size();
+
+      // Results of earlier instructions are the top entries of the stack,
+      // in order. This result replaces them.
+      int num_on_stack = 0;
+      for (int a = 0; a < num_args; a++)
+        if (ins.args[a].kind == operand::STACK)
+          num_on_stack++;
+      int first = sp - num_on_stack;
+
+      std::vector<const double*> ptr(num_args);
+      std::vector<bool>          is_const(num_args);
+      int next = first;
+      for (int a = 0; a < num_args; a++) {
+        operand const& arg = ins.args[a];
+        is_const[a] = (arg.kind == operand::CONSTANT);
+        if      (arg.kind == operand::CONSTANT) ptr[a] = &arg.value;
+        else if (arg.kind == operand::VARIABLE) ptr[a] = vars[arg.var];
+        else                                    ptr[a] = &buffers[next++][0];
+      }
+
+      double * res = &buffers[first][0];
+      apply(ins.op, ptr, is_const, n, res);
+      sp = first + 1;
+    }
+
+    // Copy the result, which could also be a constant or a variable
+    if (m_result.kind == operand::CONSTANT)
+      std::fill(out, out + n, m_result.value);
+    else if (m_result.kind == operand::VARIABLE)
+      std::copy(vars[m_result.var], vars[m_result.var] + n, out);
+    else
+      std::copy(buffers[0].begin(), buffers[0].begin() + n, out);
+  }
+
+private:
+
+  struct operand {
+    enum Kind {CONSTANT, VARIABLE, STACK};
+    Kind   kind;
+    int    var;
+    double value;
+    operand(): kind(CONSTANT), var(0), value(0) {}
+  };
+
+  struct instruction {
+    OperationType        op;
+    std::vector<operand> args;
+  };
+
+  std::vector<instruction> m_program;
+  operand                  m_result;
+  int                      m_max_depth;
+
+  /// Emit the instructions for this node after those of its inputs,
+  /// and return where its result will be. Depth is the number of
+  /// results on the stack before this node is evaluated.
+  operand compile(calc_operation const& node, int num_vars, int depth) {
+
+    operand ans;
+    if (node.opType == OP_number) {
+      ans.value = node.value;
+      return ans;
+    }
+    if (node.opType == OP_variable) {
+      if (node.varName < 0 || node.varName >= num_vars)
+        vw_throw(ArgumentErr() << "Unrecognized variable input!\n");
+      ans.kind = operand::VARIABLE;
+      ans.var  = node.varName;
+      return ans;
+    }
+    if (node.opType == OP_pass && node.inputs.size() == 1)
+      return compile(node.inputs[0], num_vars, depth);
+
+    const size_t numInputs = node.inputs.size();
+    size_t minInputs = 2;
+    if (node.opType == OP_negate || node.opType == OP_abs ||
+        node.opType == OP_min    || node.opType == OP_max)
+      minInputs = 1;
+    if (numInputs < minInputs)
+      vw_throw(LogicErr() << "Insufficient inputs for this operation!\n");
+
+    instruction ins;
+    ins.op = node.opType;
+    bool all_const = true;
+    for (size_t i = 0; i < numInputs; i++) {
+      operand arg = compile(node.inputs[i], num_vars, depth);
+      if (arg.kind == operand::STACK)
+        depth++;
+      m_max_depth = std::max(m_max_depth, depth);
+      all_const = all_const && (arg.kind == operand::CONSTANT);
+      ins.args.push_back(arg);
+    }
+
+    if (all_const) {
+      // Evaluate now, as the tree would for a pixel
+      std::vector<const double*> ptr(numInputs);
+      std::vector<bool> is_const(numInputs, true);
+      for (size_t i = 0; i < numInputs; i++)
+        ptr[i] = &ins.args[i].value;
+      apply(ins.op, ptr, is_const, 1, &ans.value);
+      return ans;
+    }
+
+    m_program.push_back(ins);
+    ans.kind = operand::STACK;
+    return ans;
+  }
+
+  // The value at index i of an operand, which is the same for all i if constant
+  static inline double at(const double* p, bool is_const, int i) {
+    return is_const ? p[0] : p[i];
+  }
+
+  /// Apply one operation to n values. The result may be written over
+  /// an operand, as each value is read before its result is written.
+  static void apply(OperationType op, std::vector<const double*> const& ptr,
+                    std::vector<bool> const& is_const, int n, double * res) {
+
+    const double *a = ptr[0];
+    bool ca = is_const[0];
+    switch(op) {
+      case OP_negate:
+        for (int i = 0; i < n; i++) res[i] = -1 * at(a, ca, i);
+        return;
+      case OP_abs:
+        for (int i = 0; i < n; i++) res[i] = std::abs(at(a, ca, i));
+        return;
+      case OP_min:
+      case OP_max:
+        // The result may be over a later operand, so read all first
+        for (int i = 0; i < n; i++) {
+          double ans = at(a, ca, i);
+          for (size_t k = 1; k < ptr.size(); k++) {
+            double v = at(ptr[k], is_const[k], i);
+            if ((op == OP_min && v < ans) || (op == OP_max && v > ans))
+              ans = v;
+          }
+          res[i] = ans;
+        }
+        return;
+      default:
+        break;
+    }
+
+    // Binary operations. Loops without a constant operand are the common case.
+    const double *b = ptr[1];
+    bool cb = is_const[1];
+    switch(op) {
+      case OP_add:
+        if (!ca && !cb) { for (int i = 0; i < n; i++) res[i] = a[i] + b[i]; }
+        else            { for (int i = 0; i < n; i++) res[i] = at(a, ca, i) + at(b, cb, i); }
+        return;
+      case OP_subtract:
+        if (!ca && !cb) { for (int i = 0; i < n; i++) res[i] = a[i] - b[i]; }
+        else            { for (int i = 0; i < n; i++) res[i] = at(a, ca, i) - at(b, cb, i); }
+        return;
+      case OP_multiply:
+        if (!ca && !cb) { for (int i = 0; i < n; i++) res[i] = a[i] * b[i]; }
+        else            { for (int i = 0; i < n; i++) res[i] = at(a, ca, i) * at(b, cb, i); }
+        return;
+      case OP_divide:
+        if (!ca && !cb) { for (int i = 0; i < n; i++) res[i] = a[i] / b[i]; }
+        else            { for (int i = 0; i < n; i++) res[i] = at(a, ca, i) / at(b, cb, i); }
+        return;
+      case OP_power:
+        for (int i = 0; i < n; i++) res[i] = pow(at(a, ca, i), at(b, cb, i));
+        return;
+      default:
+        vw_throw(LogicErr() << "Unexpected operation type!\n");
+    }
+  }
+};
+
 // We need to tell fusion about our calc_operation struct
 // to make it a first-class fusion citizen
 BOOST_FUSION_ADAPT_STRUCT(
@@ -396,7 +599,7 @@ vw::float64 clamp_and_cast<vw::float64>(const double val) {
   return clamp_and_cast_float<vw::float64>(val);
 }
 
-/// Image view class which applies the calc_operation tree to each pixel location.
+/// Image view class which applies the compiled calc_operation tree to each pixel location.
 template <class ImageT, typename OutputPixelT>
 class ImageCalcView : public ImageViewBase<ImageCalcView<ImageT, OutputPixelT> > {
 
@@ -410,7 +613,7 @@ private: // Variables
   std::vector<bool      > m_has_nodata_vec;
   std::vector<input_pixel_type> m_nodata_vec;
   result_type    m_output_nodata;
-  calc_operation m_operation_tree;
+  calc_program   m_program;
   int m_num_rows;
   int m_num_cols;
   int m_num_channels;
@@ -425,7 +628,7 @@ public: // Functions
                  calc_operation const& operation_tree)
                   : m_image_vec(imageVec),   m_has_nodata_vec(has_nodata_vec),
                     m_nodata_vec(nodata_vec), m_output_nodata(outputNodata),
-                    m_operation_tree(operation_tree) {
+                    m_program(operation_tree, imageVec.size()) {
     const size_t numImages = imageVec.size();
     VW_ASSERT( (numImages > 0), ArgumentErr() << "ImageCalcView: One or more images required!." );
     VW_ASSERT( (has_nodata_vec.size() == numImages), LogicErr() << "ImageCalcView: Incorrect hasNodata count passed in!." );
@@ -463,54 +666,56 @@ public: // Functions
     // Set up the output image tile
     ImageView<result_type> tile(bbox.width(), bbox.height());
 
-    // TODO: Left to right processing!
-
-    // Set up for pixel calculations
+    // Set up for the calculations, which are done one row and channel at a time
     const size_t num_images = m_image_vec.size();
-    std::vector<input_pixel_type> input_pixels(num_images);
-    std::vector<double>           input_doubles(num_images);
+    const int    width      = bbox.width();
+    std::vector< std::vector<double> > input_rows(num_images, std::vector<double>(width));
+    std::vector<const double*>         vars(num_images);
+    for (size_t i=0; i<num_images; ++i)
+      vars[i] = &input_rows[i][0];
+    std::vector< std::vector<double> > buffers(m_program.num_buffers(),
+                                               std::vector<double>(width));
+    std::vector<double> output_row(width);
+    std::vector<bool>   is_nodata(width);
 
     // Rasterize all the input images at this particular tile
     std::vector<ImageView<input_pixel_type> > input_tiles(num_images);
     for (size_t i=0; i<num_images; ++i)
       input_tiles[i] = crop(m_image_vec[i], bbox);
 
-    // Loop through each output pixel and compute each output value
-    for (int c = 0; c < bbox.width(); c++) {
-      for (int r = 0; r < bbox.height(); r++) {
-        // Fetch all the input pixels for this location
-        bool isNodata = false;
-        for (size_t i=0; i<num_images; ++i) {
-          input_pixels[i] = (input_tiles[i])(c,r);
+    for (int r = 0; r < bbox.height(); r++) {
 
-          // If any of the input pixels are nodata, the output is nodata.
-          if (m_has_nodata_vec[i] && (m_nodata_vec[i] == input_pixels[i])) {
-            isNodata = true;
+      // If any of the input pixels are nodata, the output is nodata.
+      for (int c = 0; c < width; c++) {
+        is_nodata[c] = false;
+        for (size_t i=0; i<num_images; ++i) {
+          if (m_has_nodata_vec[i] && (m_nodata_vec[i] == input_tiles[i](c,r))) {
+            is_nodata[c] = true;
             break;
           }
-        } // End image loop
-
-        if (isNodata) { // Output is nodata, move on to the next pixel
-          tile(c, r) = m_output_nodata;
-          continue;
         }
+      }
 
+      for (int chan=0; chan<m_num_channels; ++chan) {
+        for (size_t i=0; i<num_images; ++i) {
+          for (int c = 0; c < width; c++)
+            input_rows[i][c] = input_tiles[i](c,r)[chan];
+        }
 
-        for (int chan=0; chan<m_num_channels; ++chan) {
-          for (size_t i=0; i<num_images; ++i) {
-            input_doubles[i] = input_pixels[i][chan];
-          } // End image loop
-
-          // Apply the operation tree to this pixel and store in the output pixel
-          double newVal = m_operation_tree.applyOperation<double>(input_doubles);
-          //if (newVal > 255)
-          //  std::cout << "Value: " << newVal << " --> " << static_cast<double>(clamp_and_cast<output_channel_type>(newVal)) << "\n";
-          tile(c, r, chan) = clamp_and_cast<output_channel_type>(newVal);
+        // Apply the program to the row and store it in the output pixels
+        m_program.evaluate(vars, width, buffers, &output_row[0]);
+        for (int c = 0; c < width; c++) {
+          if (!is_nodata[c])
+            tile(c, r, chan) = clamp_and_cast<output_channel_type>(output_row[c]);
+        }
+      } // End channel loop
 
-        } // End channel loop
+      for (int c = 0; c < width; c++) {
+        if (is_nodata[c])
+          tile(c, r) = m_output_nodata;
+      }
 
-      } // End row loop
-    } // End column loop
+    } // End row loop
 
   // Return the tile we created with fake borders to make it look the size of the entire output image
   return prerasterize_type(tile,
@@ -28,6 +28,7 @@
 #include <vw/BundleAdjustment/ControlNetworkLoader.h>
 #include <asp/Core/InterestPointMatching.h>
 #include <asp/Core/BundleAdjustUtils.h>
+#include <asp/Core/Checkpoint.h>
 #include <asp/Tools/jitter_adjust.h>
 #include <vw/Core/Stopwatch.h>
 
@@ -156,10 +157,23 @@ void populate_adjustements(std::vector<double> const& cameras_vec,
   }
 }
 
+// If the linearized projection below is off by more than this many
+// pixels, project the point into the adjusted camera instead.
+const double MAX_LINEARIZED_PIXEL_ERROR = 2.0;
+
 // A ceres cost function. We pass in the observation, the model, and
 // the current camera and point indices. The result is the residual,
 // the difference in the observation and the projection of the point
 // into the camera, normalized by pixel_sigma.
+
+// Projecting into the adjusted camera is an iterative solve, done
+// for every evaluation by the numerical differentiation. Instead, the
+// ray of the original camera through the observed pixel is found once,
+// together with how it moves with the pixel. Then the adjustments at
+// the observation line are undone on the point, and its offset from
+// this ray is converted to a pixel offset. This is exact when the
+// residual is zero, and the point is projected into the adjusted
+// camera as before when the residual is large.
 struct PiecewiseReprojectionError {
   PiecewiseReprojectionError(Vector2 const& observation, Vector2 const& pixel_sigma,
 			     Vector2 const& adjustment_bounds,
@@ -185,7 +199,106 @@ struct PiecewiseReprojectionError {
     m_camera_index3(camera_index3),
     m_camera_index4(camera_index4),
     m_end_index(end_index),
-    m_ipt(ipt){}
+    m_ipt(ipt), m_has_ray(false), m_adj_time(0.0){
+
+    try {
+      m_ray_ctr = m_cam->camera_center(m_observation);
+      m_ray_dir = m_cam->pixel_to_vector(m_observation);
+      for (int c = 0; c < 2; c++) {
+        Vector2 step;
+        step[c] = 1.0;
+        m_ctr_deriv[c] = (m_cam->camera_center(m_observation + step) -
+                          m_cam->camera_center(m_observation - step))/2.0;
+        m_dir_deriv[c] = (m_cam->pixel_to_vector(m_observation + step) -
+                          m_cam->pixel_to_vector(m_observation - step))/2.0;
+      }
+
+      // The DG adjustments are placed in time, the others in lines
+      m_adj_time = m_observation.y();
+      if (is_dg_session())
+        m_adj_time = get_dg_ptr(m_cam)->get_time_at_line(m_observation.y());
+
+      m_has_ray = true;
+    } catch (...) {
+      // Will project into the adjusted camera on every evaluation
+      m_has_ray = false;
+    }
+  }
+
+  bool is_dg_session() const {
+    return (m_session == "dg" || m_session == "dgmaprpc");
+  }
+
+  // Project the point into the camera with the given adjustments.
+  Vector2 adjusted_point_to_pixel(std::vector<vw::Vector3> const& position_adjustments,
+                                  std::vector<vw::Quat>    const& pose_adjustments,
+                                  Vector3 const& point_vec) const {
+
+    // The adjusted camera has just the adjustments, it does not create a full
+    // copy of the camera.
+    int interp_type = stereo_settings().piecewise_adjustment_interp_type;
+
+    asp::AdjustedModelWrapper cam_wrapper(m_session, m_cam,
+                                          interp_type,
+                                          m_adjustment_bounds,
+                                          position_adjustments, pose_adjustments,
+                                          m_image_size);
+
+    // Note that we pass the observation as an initial guess, as the
+    // prediction is hopefully not too far from it.
+    return cam_wrapper.point_to_pixel(point_vec, m_observation.y());
+  }
+
+  // Approximate the projection of the point into the adjusted camera
+  // with the cached ray. Return false if this is not accurate enough.
+  bool linearized_point_to_pixel(std::vector<vw::Vector3> const& position_adjustments,
+                                 std::vector<vw::Quat>    const& pose_adjustments,
+                                 Vector3 const& point_vec, Vector2 & prediction) const {
+
+    if (!m_has_ray)
+      return false;
+
+    // The adjustments at the observation line only
+    int interp_type = stereo_settings().piecewise_adjustment_interp_type;
+    Vector3 adj_position;
+    Quat    adj_pose;
+    if (is_dg_session()) {
+      DGCameraModel const* dg_cam = get_dg_ptr(m_cam);
+      adj_position = AdjustableDGPosition(dg_cam, interp_type, m_adjustment_bounds,
+                                          position_adjustments, g_num_wts, g_sigma)
+        .adjustment(m_adj_time);
+      adj_pose = AdjustableDGPose(dg_cam, interp_type, m_adjustment_bounds,
+                                  pose_adjustments, g_num_wts, g_sigma)
+        .adjustment(m_adj_time);
+    } else {
+      adj_position = AdjustablePosition(interp_type, m_adjustment_bounds,
+                                        position_adjustments, g_num_wts, g_sigma)(m_adj_time);
+      adj_pose = AdjustablePose(interp_type, m_adjustment_bounds,
+                                pose_adjustments, g_num_wts, g_sigma)(m_adj_time);
+    }
+
+    // Undo the adjustments on the point, and find its offset from the
+    // original ray, at the depth of the point.
+    Vector3 Y      = inverse(adj_pose).rotate(point_vec - m_ray_ctr - adj_position);
+    double  depth  = dot_prod(Y, m_ray_dir);
+    Vector3 offset = Y - depth*m_ray_dir;
+
+    // Least squares for the pixel offset producing this offset
+    Vector3 J0 = m_ctr_deriv[0] + depth*m_dir_deriv[0];
+    Vector3 J1 = m_ctr_deriv[1] + depth*m_dir_deriv[1];
+    double a = dot_prod(J0, J0), b = dot_prod(J0, J1), c = dot_prod(J1, J1);
+    double det = a*c - b*b;
+    if (!(det > 1e-12*a*c))
+      return false;
+    Vector2 rhs(dot_prod(J0, offset), dot_prod(J1, offset));
+    Vector2 pix_offset((c*rhs[0] - b*rhs[1])/det, (a*rhs[1] - b*rhs[0])/det);
+
+    if (norm_2(pix_offset) > MAX_LINEARIZED_PIXEL_ERROR)
+      return false;
+
+    prediction = m_observation + pix_offset;
+    return true;
+  }
 
   template <typename T>
   bool do_calc(const T* const camera1, const T* const camera2,
@@ -194,11 +307,15 @@ struct PiecewiseReprojectionError {
 
     try{
 
-      int num_cameras = m_cameras_vec.size();
-      std::vector<double> local_cameras_vec = m_cameras_vec;
+      int num_cameras = m_cameras_vec.size()/NUM_CAMERA_PARAMS;
 
-	// Copy the camera adjustments to local storage.  Update them
-	// with the latest value for the current camera being floated.
+	// Copy the camera adjustments of the current camera to local
+	// storage. Update them with the latest value for the adjustments
+	// being floated. The adjustments of the other camera are not needed.
+      VW_ASSERT(0 <= m_start_index && m_start_index < m_end_index && m_end_index <= num_cameras,
+                ArgumentErr() << "Book-keeping failure in camera indicies");
+      std::vector<double> local_cameras_vec(m_cameras_vec.begin() + NUM_CAMERA_PARAMS*m_start_index,
+                                            m_cameras_vec.begin() + NUM_CAMERA_PARAMS*m_end_index);
 
       for (int i = 1; i <= 4; i++) {
 
@@ -228,7 +345,7 @@ struct PiecewiseReprojectionError {
 		  ArgumentErr() << "Book-keeping failure in camera indicies");
 
 	for (int p = 0; p < NUM_CAMERA_PARAMS; p++) {
-	  local_cameras_vec[NUM_CAMERA_PARAMS*camera_index + p] = camera[p];
+	  local_cameras_vec[NUM_CAMERA_PARAMS*(camera_index - m_start_index) + p] = camera[p];
 	}
       }
 
@@ -236,28 +353,20 @@ struct PiecewiseReprojectionError {
       std::vector<vw::Vector3> position_adjustments;
       std::vector<vw::Quat>   pose_adjustments;
       populate_adjustements(local_cameras_vec,
-			    m_start_index, m_end_index,
+			    0, m_end_index - m_start_index,
 			    position_adjustments, pose_adjustments);
 
-      // The adjusted camera has just the adjustments, it does not create a full
-      // copy of the camera.
-      int interp_type = stereo_settings().piecewise_adjustment_interp_type;
-
-      asp::AdjustedModelWrapper cam_wrapper(m_session, m_cam,
-                                            interp_type,
-                                            m_adjustment_bounds,
-                                            position_adjustments, pose_adjustments,
-                                            m_image_size);
-      
       // Copy the input data to structures expected by the BA model
       Vector3 point_vec;
       for (size_t p = 0; p < point_vec.size(); p++)
 	point_vec[p]  = (double)point[p];
 
-      // Project the current point into the current camera.  Note that
-      // we pass the observation as an initial guess, as the
-      // prediction is hopefully not too far from it.
-      Vector2 prediction = cam_wrapper.point_to_pixel(point_vec, m_observation.y());
+      // Project the current point into the current camera
+      Vector2 prediction;
+      if (!linearized_point_to_pixel(position_adjustments, pose_adjustments,
+                                     point_vec, prediction))
+        prediction = adjusted_point_to_pixel(position_adjustments, pose_adjustments,
+                                             point_vec);
 
       // The error is the difference between the predicted and observed position,
       // normalized by sigma.
@@ -399,6 +508,13 @@ struct PiecewiseReprojectionError {
 
   int m_end_index;    // all adjustment indices for current camera will be < this
   int m_ipt;          // index of the current 3D point in the vector of points
+
+  // The ray of the original camera through the observation, and its
+  // derivatives with respect to the pixel column and row
+  bool    m_has_ray;
+  double  m_adj_time;  // where the adjustments are evaluated
+  Vector3 m_ray_ctr, m_ray_dir;
+  Vector3 m_ctr_deriv[2], m_dir_deriv[2];
 };
 
 // A ceres cost function. The residual is the difference between the
@@ -445,11 +561,37 @@ std::vector<double> * g_cameras_vec;
 // Will be called at each iteration. Here we can put any desired logging info.
 class PiecewiseBaCallback: public ceres::IterationCallback {
 public:
+  /// Every checkpoint_interval iterations, if positive, save the
+  /// adjustments and points, for --resume-piecewise-adjustment.
+  PiecewiseBaCallback(std::string const& checkpoint_file, int checkpoint_interval,
+                      int prev_iterations,
+                      std::vector<double> const& cameras_vec,
+                      std::vector<double> const& points_vec):
+    m_checkpoint_file(checkpoint_file), m_checkpoint_interval(checkpoint_interval),
+    m_prev_iterations(prev_iterations),
+    m_cameras_vec(cameras_vec), m_points_vec(points_vec) {}
+
   virtual ceres::CallbackReturnType operator()
     (const ceres::IterationSummary& summary) {
 
+    if (m_checkpoint_interval <= 0 || summary.iteration <= 0 ||
+        summary.iteration % m_checkpoint_interval != 0)
+      return ceres::SOLVER_CONTINUE;
+
+    asp::SolverCheckpoint checkpoint;
+    checkpoint.set_counter("iteration", m_prev_iterations + summary.iteration);
+    checkpoint.set_block("cameras", &m_cameras_vec[0], m_cameras_vec.size());
+    checkpoint.set_block("points",  &m_points_vec[0],  m_points_vec.size());
+    vw_out() << "Writing: " << m_checkpoint_file << std::endl;
+    checkpoint.write(m_checkpoint_file);
+
     return ceres::SOLVER_CONTINUE;
   }
+private:
+  std::string m_checkpoint_file;
+  int m_checkpoint_interval, m_prev_iterations;
+  std::vector<double> const& m_cameras_vec;
+  std::vector<double> const& m_points_vec;
 };
 
 // Given a set of interest points, find their y values, and return the bounds
@@ -468,11 +610,15 @@ vw::Vector2 find_bounds_from_percentiles(std::vector<ip::InterestPoint> const& i
 
   std::vector<double> Y(len);
   for (int ip_iter = 0; ip_iter < len; ip_iter++) Y[ip_iter] = ip[ip_iter].y;
-  std::sort(Y.begin(), Y.end());
 
   int beg = round(percentiles[0]*len/100.0); beg = std::min(beg, len - 1);
   int end = round(percentiles[1]*len/100.0); end = std::min(end, len - 1);
 
+  // Only these two order statistics are needed, not a full sort.
+  // Since beg <= end, the second selection is in the upper part.
+  std::nth_element(Y.begin(), Y.begin() + beg, Y.end());
+  std::nth_element(Y.begin() + beg, Y.begin() + end, Y.end());
+
   return Vector2(Y[beg], Y[end]);
 }
 
@@ -617,6 +763,25 @@ void jitter_adjust(std::vector<std::string> const& image_files,
   // The camera positions and orientations before we float them
   std::vector<double> orig_cameras_vec = cameras_vec;
 
+  // Continue from the checkpoint of an interrupted run. The problem is
+  // built the same way, so only the variables need to be restored.
+  int max_num_iterations = 1000, prev_iterations = 0;
+  std::string checkpoint_file = asp::checkpoint_file_name(out_prefix + "-jitter");
+  if (stereo_settings().resume_piecewise_adjustment) {
+    if (!fs::exists(checkpoint_file)) {
+      vw_out(WarningMessage) << "Cannot find checkpoint: " << checkpoint_file
+                             << ". Starting from the beginning.\n";
+    } else {
+      vw_out() << "Reading: " << checkpoint_file << std::endl;
+      asp::SolverCheckpoint checkpoint;
+      checkpoint.read(checkpoint_file);
+      checkpoint.get_block("cameras", &cameras_vec[0], cameras_vec.size());
+      checkpoint.get_block("points",  &points_vec[0],  points_vec.size());
+      prev_iterations = std::min(checkpoint.counter("iteration"), max_num_iterations);
+      vw_out() << "Resuming at iteration " << prev_iterations << ".\n";
+    }
+  }
+
   // The ceres problem
   ceres::Problem problem;
 
@@ -765,14 +930,13 @@ void jitter_adjust(std::vector<std::string> const& image_files,
   ceres::Solver::Options options;
   options.gradient_tolerance = 1e-16;
   options.function_tolerance = 1e-16;
-  options.max_num_iterations = 1000;
+  options.max_num_iterations = max_num_iterations - prev_iterations;
   options.max_num_consecutive_invalid_steps = 100; // try hard
   options.minimizer_progress_to_stdout = true;
 
   options.num_threads = num_threads;
 
   options.linear_solver_type = ceres::SPARSE_SCHUR;
-  //options.ordering_type = ceres::SCHUR;
   //options.eta = 1e-3; // FLAGS_eta;
   //options->max_solver_time_in_seconds = FLAGS_max_solver_time;
   //options->use_nonmonotonic_steps = FLAGS_nonmonotonic_steps;
@@ -780,8 +944,27 @@ void jitter_adjust(std::vector<std::string> const& image_files,
   //  options->minimizer_type = ceres::LINE_SEARCH;
   //}
 
+  // Eliminate the points first, rather than let Ceres search for an
+  // independent set. Each observation touches at most four consecutive
+  // adjustments of one camera, so the reduced camera matrix which is
+  // left is banded, and its sparse factorization has little fill.
+  ceres::ParameterBlockOrdering * ordering = new ceres::ParameterBlockOrdering;
+  for (int ipt = 0; ipt < num_points; ipt++) {
+    double * point = points + ipt * NUM_POINT_PARAMS;
+    if (problem.HasParameterBlock(point))
+      ordering->AddElementToGroup(point, 0);
+  }
+  for (int cam_index = 0; cam_index < num_total_adj; cam_index++) {
+    double * camera = cameras + NUM_CAMERA_PARAMS * cam_index;
+    if (problem.HasParameterBlock(camera))
+      ordering->AddElementToGroup(camera, 1);
+  }
+  options.linear_solver_ordering.reset(ordering);
+
   // Use a callback function at every iteration.
-  PiecewiseBaCallback callback;
+  PiecewiseBaCallback callback(checkpoint_file,
+                               stereo_settings().piecewise_adjustment_checkpoint_interval,
+                               prev_iterations, cameras_vec, points_vec);
   options.callbacks.push_back(&callback);
   options.update_state_every_iteration = true; // ensure we have the latest adjustments
 
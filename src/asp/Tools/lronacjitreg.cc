@@ -31,6 +31,8 @@
 #include <vw/Stereo/CostFunctions.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <vw/Stereo/Correlate.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 
 #include <asp/Core/DemDisparity.h>
 #include <asp/Core/LocalHomography.h>
@@ -41,6 +43,7 @@
 
 #include <boost/accumulators/accumulators.hpp>
 #include <boost/accumulators/statistics.hpp>
+#include <boost/noncopyable.hpp>
 
 using namespace vw;
 using namespace vw::stereo;
@@ -122,6 +125,70 @@ bool handle_arguments(int argc, char* argv[],
   return true;
 }
 
+/// The sums of the valid shifts of a row of the disparity, from which
+/// their mean and standard deviation are found. Rows can be combined.
+struct RowShiftStats
+{
+  double sum_x, sum_y, sum_x2, sum_y2;
+  int    count;
+
+  RowShiftStats(): sum_x(0), sum_y(0), sum_x2(0), sum_y2(0), count(0) {}
+
+  void add(Vector2f const& shift)
+  {
+    sum_x  += shift[0];          sum_y  += shift[1];
+    sum_x2 += shift[0]*shift[0]; sum_y2 += shift[1]*shift[1];
+    ++count;
+  }
+
+  void add(RowShiftStats const& other)
+  {
+    sum_x  += other.sum_x;  sum_y  += other.sum_y;
+    sum_x2 += other.sum_x2; sum_y2 += other.sum_y2;
+    count  += other.count;
+  }
+
+  double mean_x() const { return sum_x / count; }
+  double mean_y() const { return sum_y / count; }
+
+  double std_dev_x() const { return std_dev(sum_x, sum_x2); }
+  double std_dev_y() const { return std_dev(sum_y, sum_y2); }
+
+  double std_dev(double sum, double sum2) const
+  {
+    double mean = sum / count;
+    return sqrt(std::max(sum2 / count - mean*mean, 0.0));
+  }
+};
+
+/// Compute the disparity of a block of lines and accumulate the valid
+/// shifts of each of its rows.
+class RowShiftTask: public vw::Task, private boost::noncopyable
+{
+  ImageViewRef<PixelMask<Vector2f> > const& m_disparity;
+  BBox2i                                    m_block;
+  std::vector<RowShiftStats>              & m_row_stats;
+public:
+  RowShiftTask(ImageViewRef<PixelMask<Vector2f> > const& disparity, BBox2i const& block,
+               std::vector<RowShiftStats> & row_stats):
+    m_disparity(disparity), m_block(block), m_row_stats(row_stats) {}
+
+  virtual void operator()()
+  {
+    ImageView<PixelMask<Vector2f> > disp = crop(m_disparity, m_block);
+    for (int row = 0; row < disp.rows(); ++row)
+    {
+      // Each task writes only the rows of its block
+      RowShiftStats & stats = m_row_stats[m_block.min().y() + row];
+      for (int col = 0; col < disp.cols(); ++col)
+      {
+        if (is_valid(disp(col, row)))
+          stats.add(disp(col, row).child());
+      }
+    }
+  }
+};
+
 bool determineShifts(Parameters & params, 
                      double &dX, double &dY)
 {
@@ -192,7 +259,7 @@ bool determineShifts(Parameters & params,
       printf("Found %lu, %lu matched interest points.\n", matched_ip1.size(), matched_ip2.size());
 
       // Filter interest point matches
-      math::RandomSampleConsensus<math::SimilarityFittingFunctor, math::InterestPointErrorMetric>
+      asp::ParallelRandomSampleConsensus<math::SimilarityFittingFunctor, math::InterestPointErrorMetric>
         ransac( math::SimilarityFittingFunctor(), math::InterestPointErrorMetric(),
                 100, 5, 100, true );
       std::vector<Vector3> ransac_ip1 = ip::iplist_to_vectorlist(matched_ip1);
@@ -260,9 +327,9 @@ bool determineShifts(Parameters & params,
   int    corr_timeout       = 0;
   int    min_lr_level = 0;
   double seconds_per_op     = 0.0;
-  DiskCacheImageView<PixelMask<Vector2f> >
+  ImageViewRef<PixelMask<Vector2f> >
     disparity_map
-    ( stereo::pyramid_correlate( apply_mask(create_mask_less_or_equal(crop(left_disk_image,  crop_roi),0)),
+    = ( stereo::pyramid_correlate( apply_mask(create_mask_less_or_equal(crop(left_disk_image,  crop_roi),0)),
 				 apply_mask(create_mask_less_or_equal(crop(right_disk_image, crop_roi),0)),
 				 constant_view( uint8(255), left_disk_image ),
 				 constant_view( uint8(255), right_disk_image ),
@@ -274,8 +341,25 @@ bool determineShifts(Parameters & params,
 
   // Compute the mean horizontal and vertical shifts
   // - Currently disparity_map contains the per-pixel shifts
-  
-  printf("Accumulating offsets...\n");  
+  // - The disparity is computed and accumulated in blocks of lines
+  //   in parallel, and the per-row results are merged in order below.
+
+  printf("Accumulating offsets...\n");
+
+  std::vector<RowShiftStats> rowStats(disparity_map.rows());
+  {
+    const int blockLines = vw_settings().default_tile_size();
+    vw::FifoWorkQueue queue(vw_settings().default_num_threads());
+    for (int row = 0; row < disparity_map.rows(); row += blockLines)
+    {
+      int numLines = std::min(blockLines, disparity_map.rows() - row);
+      queue.add_task(boost::shared_ptr<vw::Task>
+                     (new RowShiftTask(disparity_map,
+                                       BBox2i(0, row, disparity_map.cols(), numLines),
+                                       rowStats)));
+    }
+    queue.join_all();
+  }
 
   std::ofstream out;
   const bool writeLogFile = !params.rowLogFilePath.empty();
@@ -326,39 +410,19 @@ bool determineShifts(Parameters & params,
   double meanHorizOffset     = 0.0;
   int    numValidRows        = 0;
   int    totalNumValidPixels = 0;
-  
-  vw::StdDevAccumulator<float> stdCalcX, stdCalcY;
-  
+
+  RowShiftStats totalStats;
+
   std::vector<double> rowOffsets(disparity_map.rows());
   std::vector<double> colOffsets(disparity_map.rows());  
   for (int row=0; row<disparity_map.rows(); ++row)
   {
-  
-    // Accumulate the shifts for this row
-    vw::StdDevAccumulator<float> stdDevCalcRow;
-    double rowSum        = 0.0;
-    double colSum        = 0.0;
-    double stdDevRow     = 0.0;
-    int    numValidInRow = 0;
-    for (int col=0; col<disparity_map.cols(); ++col)
-    {
-    
-      if (is_valid(disparity_map(col,row)))
-      {
-        float dY = disparity_map(col,row)[1]; // Y
-        float dX = disparity_map(col,row)[0]; // X
-        rowSum += dY;
-        colSum += dX;
-        ++numValidInRow;
-      
-        stdCalcX(dX);
-        stdCalcY(dY);
-
-        stdDevCalcRow(dY);
-      }
-    } // End loop through cols
+    RowShiftStats const& stats = rowStats[row];
+    totalStats.add(stats);
 
     // Compute mean shift for this row
+    double stdDevRow     = 0.0;
+    int    numValidInRow = stats.count;
     if (numValidInRow == 0)
     {
       rowOffsets[row] = 0;
@@ -367,9 +431,9 @@ bool determineShifts(Parameters & params,
     }
     else  // At least one valid pixel
     {
-      rowOffsets[row] = rowSum / static_cast<double>(numValidInRow);
-      colOffsets[row] = colSum / static_cast<double>(numValidInRow);
-      stdDevRow = stdDevCalcRow.value();
+      rowOffsets[row] = stats.mean_y();
+      colOffsets[row] = stats.mean_x();
+      stdDevRow = stats.std_dev_y();
       totalNumValidPixels += numValidInRow;
       ++numValidRows;      
     }
@@ -405,10 +469,10 @@ bool determineShifts(Parameters & params,
     if(numValidRows > 0) 
     {
       out << "#   Using IpFind result only:   0" << endl;
-      out << "#   Average Sample Offset: " << setprecision(4) << stdCalcX.mean()
-          << "  StdDev: " << setprecision(4) << stdCalcX.value() << endl;
-      out << "#   Average Line Offset:   " << setprecision(4) << stdCalcY.mean()
-          << " StdDev: " << setprecision(4) << stdCalcY.value() << endl;
+      out << "#   Average Sample Offset: " << setprecision(4) << totalStats.mean_x()
+          << "  StdDev: " << setprecision(4) << totalStats.std_dev_x() << endl;
+      out << "#   Average Line Offset:   " << setprecision(4) << totalStats.mean_y()
+          << " StdDev: " << setprecision(4) << totalStats.std_dev_y() << endl;
      }
      else  // No valid rows
      {
@@ -439,8 +503,8 @@ bool determineShifts(Parameters & params,
   }
   
   // Compute overall mean shift
-  meanVertOffset  = stdCalcY.mean();
-  meanHorizOffset = stdCalcX.mean();
+  meanVertOffset  = totalStats.mean_y();
+  meanHorizOffset = totalStats.mean_x();
   
   dX = meanHorizOffset;
   dY = meanVertOffset;
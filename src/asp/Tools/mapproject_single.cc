@@ -33,8 +33,17 @@
 #include <asp/Core/Common.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/Core/StereoSettings.h>
+#include <asp/Camera/CachedProjectionModel.h>
+#include <asp/Camera/RPCModel.h>
+#include <asp/Core/CameraGrid.h>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <sstream>
 
 using namespace vw;
 using namespace vw::cartography;
@@ -50,6 +59,33 @@ class Datum2CamTrans : public vw::TransformBase<Map2CamTrans> {
   vw::Vector2i m_image_size;
   bool         m_call_from_mapproject;
   Vector2      m_invalid_pix;
+  asp::RPCModel const* m_rpc_cam; // If the camera is RPC, else NULL
+  boost::uint64_t      m_id;      // Shared by the copies of this transform
+
+  // The camera pixels of the last tile projected at once by this
+  // thread, so that reverse() at those pixels needs no projection.
+  // Larger boxes, such as that of the whole image, are not kept.
+  struct TileCache {
+    boost::uint64_t      owner;
+    vw::BBox2i           bbox;
+    std::vector<Vector2> pix;
+    TileCache(): owner(0) {}
+  };
+  static const int MAX_CACHED_TILE_AREA = 1024*1024;
+
+  static TileCache & tile_cache() {
+    static boost::thread_specific_ptr<TileCache> cache;
+    if (cache.get() == NULL)
+      cache.reset(new TileCache());
+    return *cache;
+  }
+
+  static boost::uint64_t next_id() {
+    static vw::Mutex id_mutex;
+    static boost::uint64_t id = 0;
+    vw::Mutex::Lock lock(id_mutex);
+    return ++id;
+  }
 
 public:
   Datum2CamTrans( vw::camera::CameraModel const* cam,
@@ -61,7 +97,8 @@ public:
                 ):
     m_cam(cam), m_image_georef(image_georef), m_dem_georef(dem_georef),
     m_dem_height(dem_height), m_image_size(image_size),
-    m_call_from_mapproject(call_from_mapproject){
+    m_call_from_mapproject(call_from_mapproject),
+    m_rpc_cam(dynamic_cast<asp::RPCModel const*>(cam)), m_id(next_id()){
 
     m_invalid_pix = vw::camera::CameraModel::invalid_pixel();
   }
@@ -69,18 +106,27 @@ public:
   /// Convert Map Projected pixel to camera pixel
   vw::Vector2 reverse(const vw::Vector2 &p) const{
 
+    // Use the pixels of the tile projected by reverse_bbox(), if there
+    if (m_rpc_cam != NULL) {
+      TileCache const& cache = tile_cache();
+      int x = int(p[0]), y = int(p[1]);
+      if (cache.owner == m_id && x == p[0] && y == p[1] && cache.bbox.contains(Vector2i(x, y))) {
+        Vector2 const& pt = cache.pix[(y - cache.bbox.min().y())*cache.bbox.width()
+                                      + x - cache.bbox.min().x()];
+        if (pt != pt || !can_interpolate(pt)) // NaN or out of bounds
+          return m_invalid_pix;
+        return pt;
+      }
+    }
+
     Vector2 lonlat = m_image_georef.pixel_to_lonlat(p);
     Vector3 lonlatAlt(lonlat[0], lonlat[1], m_dem_height);
     Vector3 xyz = m_dem_georef.datum().geodetic_to_cartesian(lonlatAlt);
     
-    int b = BicubicInterpolation::pixel_buffer;  
     Vector2 pt;
     try{
       pt = m_cam->point_to_pixel(xyz);
-      if ( m_call_from_mapproject &&
-           (pt[0] < b - 1 || pt[0] >= m_image_size[0] - b ||
-            pt[1] < b - 1 || pt[1] >= m_image_size[1] - b)
-           ){
+      if (!can_interpolate(pt)){
         // Won't be able to interpolate into image in transform(...)
         return m_invalid_pix;
       }
@@ -91,9 +137,51 @@ public:
     return pt;
   }
 
+  /// If the camera pixel is far enough from the image boundary
+  bool can_interpolate(Vector2 const& pt) const {
+    int b = BicubicInterpolation::pixel_buffer;  
+    return !( m_call_from_mapproject &&
+              (pt[0] < b - 1 || pt[0] >= m_image_size[0] - b ||
+               pt[1] < b - 1 || pt[1] >= m_image_size[1] - b) );
+  }
+
   vw::BBox2i reverse_bbox( vw::BBox2i const& bbox ) const {
 
-    vw::BBox2 out_box;      
+    vw::BBox2 out_box;
+
+    // RPC models can project all the points in the box at once. The
+    // pixels are kept for reverse(), which is called next for the same
+    // tile, in the same thread.
+    asp::RPCModel const* rpc_cam = m_rpc_cam;
+    if (rpc_cam != NULL) {
+      std::vector<Vector3> xyz;
+      std::vector<Vector2> pix;
+      xyz.reserve(bbox.width()*bbox.height());
+      for( int32 y=bbox.min().y(); y<bbox.max().y(); ++y ){
+        for( int32 x=bbox.min().x(); x<bbox.max().x(); ++x ){
+          Vector2 lonlat = m_image_georef.pixel_to_lonlat(Vector2(x,y));
+          xyz.push_back(m_dem_georef.datum().geodetic_to_cartesian
+                        (Vector3(lonlat[0], lonlat[1], m_dem_height)));
+        }
+      }
+      rpc_cam->point_to_pixel(xyz, pix);
+      if (bbox.width()*bbox.height() <= MAX_CACHED_TILE_AREA) {
+        TileCache & cache = tile_cache();
+        cache.owner = m_id;
+        cache.bbox  = bbox;
+        cache.pix   = pix;
+      }
+      for (size_t i = 0; i < pix.size(); i++) {
+        if (pix[i] != pix[i] || !can_interpolate(pix[i])) // NaN or out of bounds
+          continue;
+        out_box.grow( pix[i] );
+      }
+      out_box = grow_bbox_to_int( out_box );
+      if (out_box.empty())
+        out_box = vw::BBox2i(0, 0, 0, 0);
+      return out_box;
+    }
+
     for( int32 y=bbox.min().y(); y<bbox.max().y(); ++y ){
       for( int32 x=bbox.min().x(); x<bbox.max().x(); ++x ){
       
@@ -120,16 +208,271 @@ public:
 typedef PixelMask<float> DemPixelT;
 
 
+/// Find the camera pixels seen by the pixels of a tile of the output
+/// image. The exact projections, going through the DEM or the datum,
+/// are found on a grid, with the needed DEM region read in memory
+/// once per tile, and bilinear interpolation is used in between. Grid
+/// cells where some corner fails to project, or where the
+/// interpolation error at the cell center is too large, use exact
+/// projections for all their pixels.
+class TileCameraProjector {
+  vw::camera::CameraModel const* m_cam;
+  GeoReference            m_image_georef, m_dem_georef;
+  ImageViewRef<DemPixelT> m_dem;
+  bool                    m_has_dem;
+  float                   m_dem_height;
+  Vector2i                m_image_size;
+  int                     m_spacing;
+  double                  m_max_error;
+
+  static Vector2 invalid() {
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    return Vector2(nan, nan);
+  }
+
+  /// Bilinear interpolation into the DEM tile. All four neighbors must be valid.
+  static bool interp_height(ImageView<DemPixelT> const& dem, BBox2i const& dem_box,
+                            Vector2 const& dem_pix, double & height) {
+    double x = dem_pix.x() - dem_box.min().x(), y = dem_pix.y() - dem_box.min().y();
+    int c = (int)floor(x), r = (int)floor(y);
+    if (c < 0 || r < 0 || c + 1 >= dem.cols() || r + 1 >= dem.rows())
+      return false;
+    if (!is_valid(dem(c, r))   || !is_valid(dem(c+1, r)) ||
+        !is_valid(dem(c, r+1)) || !is_valid(dem(c+1, r+1)))
+      return false;
+    double dx = x - c, dy = y - r;
+    height = (1-dx)*(1-dy)*dem(c, r).child()   + dx*(1-dy)*dem(c+1, r).child()
+      +      (1-dx)*dy    *dem(c, r+1).child() + dx*dy    *dem(c+1, r+1).child();
+    return true;
+  }
+
+  /// The camera pixel seen by an output pixel, or NaN if not found.
+  Vector2 exact(Vector2 const& pix, ImageView<DemPixelT> const& dem,
+                BBox2i const& dem_box) const {
+    Vector2 lonlat = m_image_georef.pixel_to_lonlat(pix);
+    double height = m_dem_height;
+    if (m_has_dem &&
+        !interp_height(dem, dem_box, m_dem_georef.lonlat_to_pixel(lonlat), height))
+      return invalid();
+    Vector3 xyz = m_dem_georef.datum().geodetic_to_cartesian
+      (Vector3(lonlat[0], lonlat[1], height));
+    try {
+      return m_cam->point_to_pixel(xyz);
+    }catch(...){
+      return invalid();
+    }
+  }
+
+  /// If the camera pixel is far enough from the image boundary, same
+  /// as in Map2CamTrans.
+  bool can_interpolate(Vector2 const& pt) const {
+    int b = BicubicInterpolation::pixel_buffer;
+    return !(pt[0] != pt[0] || pt[1] != pt[1] ||
+             pt[0] < b - 1 || pt[0] >= m_image_size[0] - b ||
+             pt[1] < b - 1 || pt[1] >= m_image_size[1] - b);
+  }
+
+public:
+  TileCameraProjector(vw::camera::CameraModel const* cam,
+                      GeoReference const& image_georef,
+                      GeoReference const& dem_georef,
+                      ImageViewRef<DemPixelT> const& dem, bool has_dem,
+                      float dem_height, Vector2i const& image_size,
+                      int spacing, double max_error):
+    m_cam(cam), m_image_georef(image_georef), m_dem_georef(dem_georef),
+    m_dem(dem), m_has_dem(has_dem), m_dem_height(dem_height), m_image_size(image_size),
+    m_spacing(std::max(spacing, 1)), m_max_error(max_error) {}
+
+  /// The camera pixel for each pixel in the given output tile. It is
+  /// NaN where there is none, or it is too close to the image boundary.
+  void project(BBox2i const& tile, ImageView<Vector2> & cam_pix) const {
+
+    int wid = tile.width(), hgt = tile.height();
+    cam_pix.set_size(wid, hgt);
+    if (wid <= 0 || hgt <= 0)
+      return;
+
+    // The grid nodes, including the last row and column of the tile
+    std::vector<int> node_x, node_y;
+    for (int x = 0; x < wid - 1; x += m_spacing) node_x.push_back(x);
+    node_x.push_back(wid - 1);
+    for (int y = 0; y < hgt - 1; y += m_spacing) node_y.push_back(y);
+    node_y.push_back(hgt - 1);
+    int nx = node_x.size(), ny = node_y.size();
+
+    // Read in memory the DEM region seen by the tile. Grow the box of the
+    // DEM pixels at the nodes by as much as a grid cell spans in the DEM.
+    ImageView<DemPixelT> dem;
+    BBox2i dem_box;
+    if (m_has_dem) {
+      ImageView<Vector2> node_dem_pix(nx, ny);
+      BBox2 box;
+      for (int i = 0; i < nx; i++) {
+        for (int j = 0; j < ny; j++) {
+          Vector2 lonlat = m_image_georef.pixel_to_lonlat(tile.min() + Vector2(node_x[i],
+                                                                               node_y[j]));
+          node_dem_pix(i, j) = m_dem_georef.lonlat_to_pixel(lonlat);
+          box.grow(node_dem_pix(i, j));
+        }
+      }
+      double span = 0;
+      for (int i = 0; i < nx; i++) {
+        for (int j = 0; j < ny; j++) {
+          if (i + 1 < nx)
+            span = std::max(span, norm_inf(node_dem_pix(i+1, j) - node_dem_pix(i, j)));
+          if (j + 1 < ny)
+            span = std::max(span, norm_inf(node_dem_pix(i, j+1) - node_dem_pix(i, j)));
+        }
+      }
+      dem_box = grow_bbox_to_int(box);
+      dem_box.expand((int)ceil(span) + 2);
+      dem = crop(edge_extend(m_dem, ValueEdgeExtension<DemPixelT>(DemPixelT())), dem_box);
+    }
+
+    ImageView<Vector2> nodes(nx, ny);
+    for (int i = 0; i < nx; i++) {
+      for (int j = 0; j < ny; j++)
+        nodes(i, j) = exact(tile.min() + Vector2(node_x[i], node_y[j]), dem, dem_box);
+    }
+
+    for (int i = 0; i + 1 < std::max(nx, 2); i++) {
+      for (int j = 0; j + 1 < std::max(ny, 2); j++) {
+
+        // A tile with a single row or column has degenerate cells
+        int i1 = std::min(i + 1, nx - 1), j1 = std::min(j + 1, ny - 1);
+        int x0 = node_x[i], x1 = node_x[i1], y0 = node_y[j], y1 = node_y[j1];
+        Vector2 p00 = nodes(i, j), p10 = nodes(i1, j), p01 = nodes(i, j1), p11 = nodes(i1, j1);
+
+        bool use_exact = (p00 != p00 || p10 != p10 || p01 != p01 || p11 != p11);
+        if (!use_exact && (x1 - x0 > 1 || y1 - y0 > 1)) {
+          Vector2 center_exact = exact(tile.min() + Vector2((x0 + x1)/2.0, (y0 + y1)/2.0),
+                                       dem, dem_box);
+          Vector2 center_interp = (p00 + p10 + p01 + p11)/4.0;
+          use_exact = (center_exact != center_exact ||
+                       norm_2(center_exact - center_interp) > m_max_error);
+        }
+
+        // The last cell in each direction includes its far edge
+        int end_x = (i1 == nx - 1) ? x1 + 1 : x1;
+        int end_y = (j1 == ny - 1) ? y1 + 1 : y1;
+        for (int x = x0; x < end_x; x++) {
+          for (int y = y0; y < end_y; y++) {
+            Vector2 pt;
+            if (use_exact) {
+              pt = exact(tile.min() + Vector2(x, y), dem, dem_box);
+            }else{
+              double dx = (x1 > x0) ? double(x - x0)/(x1 - x0) : 0.0;
+              double dy = (y1 > y0) ? double(y - y0)/(y1 - y0) : 0.0;
+              pt = (1-dx)*(1-dy)*p00 + dx*(1-dy)*p10 + (1-dx)*dy*p01 + dx*dy*p11;
+            }
+            cam_pix(x, y) = can_interpolate(pt) ? pt : invalid();
+          }
+        }
+      }
+    }
+  }
+};
+
+/// Map project an image tile by tile. For each output tile, find the
+/// camera pixels with TileCameraProjector, then read in memory the
+/// input image region they fall in, and interpolate into it.
+template <class ImageT, class EdgeT>
+class TiledProjectionView: public ImageViewBase< TiledProjectionView<ImageT, EdgeT> > {
+  ImageT m_image;
+  boost::shared_ptr<TileCameraProjector> m_projector;
+  EdgeT  m_edge;
+  typename ImageT::pixel_type m_nodata;
+  int    m_cols, m_rows;
+
+public:
+  typedef typename ImageT::pixel_type pixel_type;
+  typedef pixel_type result_type;
+  typedef ProceduralPixelAccessor<TiledProjectionView> pixel_accessor;
+
+  TiledProjectionView(ImageT const& image,
+                      boost::shared_ptr<TileCameraProjector> projector,
+                      EdgeT const& edge, pixel_type const& nodata, int cols, int rows):
+    m_image(image), m_projector(projector), m_edge(edge), m_nodata(nodata),
+    m_cols(cols), m_rows(rows) {}
+
+  inline int32 cols() const { return m_cols; }
+  inline int32 rows() const { return m_rows; }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double/*i*/, double/*j*/, int32/*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "TiledProjectionView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    ImageView<Vector2> cam_pix;
+    m_projector->project(bbox, cam_pix);
+
+    ImageView<pixel_type> tile(bbox.width(), bbox.height());
+    BBox2 src_box;
+    for (int col = 0; col < tile.cols(); col++) {
+      for (int row = 0; row < tile.rows(); row++) {
+        tile(col, row) = m_nodata;
+        if (cam_pix(col, row) == cam_pix(col, row)) // not NaN
+          src_box.grow(cam_pix(col, row));
+      }
+    }
+
+    if (!src_box.empty()) {
+      BBox2i src_ibox = grow_bbox_to_int(src_box);
+      src_ibox.expand(BicubicInterpolation::pixel_buffer + 1);
+      src_ibox.crop(bounding_box(m_image));
+      ImageView<pixel_type> src = crop(m_image, src_ibox);
+      InterpolationView<EdgeExtensionView<ImageView<pixel_type>, EdgeT>, BicubicInterpolation>
+        interp_src = interpolate(src, BicubicInterpolation(), m_edge);
+      for (int col = 0; col < tile.cols(); col++) {
+        for (int row = 0; row < tile.rows(); row++) {
+          Vector2 pt = cam_pix(col, row);
+          if (pt != pt)
+            continue;
+          tile(col, row) = interp_src(pt.x() - src_ibox.min().x(), pt.y() - src_ibox.min().y());
+        }
+      }
+    }
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i const& bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+template <class ImageT, class EdgeT>
+TiledProjectionView<ImageT, EdgeT>
+tiled_projection(ImageT const& image, boost::shared_ptr<TileCameraProjector> projector,
+                 EdgeT const& edge, typename ImageT::pixel_type const& nodata,
+                 int cols, int rows) {
+  return TiledProjectionView<ImageT, EdgeT>(image, projector, edge, nodata, cols, rows);
+}
+
 struct Options : vw::cartography::GdalWriteOptions {
   // Input
   std::string dem_file, image_file, camera_file, output_file, stereo_session,
     bundle_adjust_prefix;
-  bool isQuery, noGeoHeaderInfo;
+  bool isQuery, noGeoHeaderInfo, cache_projection, cog;
 
   // Settings
   std::string target_srs_string, output_type, metadata;
-  double nodata_value, tr, mpp, ppd, datum_offset;
+  double nodata_value, tr, mpp, ppd, datum_offset, cache_projection_error,
+    projection_grid_error, rpc_approximation_error, lens_lookup_table_spacing,
+    lens_lookup_table_error;
+  int projection_grid_spacing;
   BBox2 target_projwin, target_pixelwin;
+  std::string batch_list;
+  int camera_grid_spacing;
+  double camera_grid_error;
+  bool camera_grid_only;
 };
 
 void handle_arguments( int argc, char *argv[], Options& opt ) {
@@ -161,7 +504,31 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("ot",  po::value(&opt.output_type)->default_value("Float32"), "Output data type, when the input is single channel. Supported types: Byte, UInt16, Int16, UInt32, Int32, Float32. If the output type is a kind of integer, values are rounded and then clamped to the limits of that type. This option will be ignored for multi-channel images, when the output type is set to be the same as the input type.")
     ("mo",  po::value(&opt.metadata)->default_value(""), "Write metadata to the output file. Provide as a string in quotes if more than one item, separated by a space, such as 'VAR1=VALUE1 VAR2=VALUE2'. Neither the variable names nor the values should contain spaces.")
     ("no-geoheader-info", po::bool_switch(&opt.noGeoHeaderInfo)->default_value(false),
-     "Suppress writing some auxiliary information in geoheaders.");
+     "Suppress writing some auxiliary information in geoheaders.")
+    ("cog", po::bool_switch(&opt.cog)->default_value(false),
+     "Write the output as a Cloud Optimized GeoTIFF, with internal overviews.")
+    ("cache-projection", po::bool_switch(&opt.cache_projection)->default_value(false),
+     "Speed up projecting into the camera by interpolating into a lattice of exact projections computed over the output footprint. Most useful for linescan cameras.")
+    ("cache-projection-error", po::value(&opt.cache_projection_error)->default_value(0.01),
+     "When using --cache-projection, use the exact camera model in regions where the interpolation error is larger than this, in pixels.")
+    ("projection-grid-spacing", po::value(&opt.projection_grid_spacing)->default_value(0),
+     "Map project tile by tile. In each output tile, find the camera pixels exactly only on a grid with this spacing, in output pixels, and interpolate in between. Read in memory once per tile the DEM and input image regions it needs. Set to 1 to not interpolate, and to 0 to not use this.")
+    ("projection-grid-error", po::value(&opt.projection_grid_error)->default_value(0.05),
+     "When using --projection-grid-spacing, use exact projections in the grid cells where the interpolation error is larger than this, in pixels.")
+    ("rpc-approximation-error", po::value(&opt.rpc_approximation_error)->default_value(0.0),
+     "Project into the camera with an RPC model fit to it over the ground seen by the image, if the model is within this many pixels of the camera. Not used with the rpc and pinhole sessions. Set to 0 to not use this.")
+    ("lens-lookup-table-spacing", po::value(&opt.lens_lookup_table_spacing)->default_value(0.0),
+     "For pinhole cameras with lens distortion, distort pixels by interpolating into a table with nodes this many pixels apart, such as 4, rather than with the lens model itself. Set to 0 to not use this.")
+    ("lens-lookup-table-error", po::value(&opt.lens_lookup_table_error)->default_value(0.01),
+     "With --lens-lookup-table-spacing, use the lens model itself where the table is off by more than this many pixels.")
+    ("camera-grid-spacing", po::value(&opt.camera_grid_spacing)->default_value(0),
+     "Save next to the output the camera pixels seen by the output pixels on a grid with this spacing, in output pixels, such as 16. Stereo with map-projected images then interpolates into this grid rather than projecting into the camera for each pixel. Set to 0 to not use this.")
+    ("camera-grid-error", po::value(&opt.camera_grid_error)->default_value(0.01),
+     "With --camera-grid-spacing, mark for exact projection the grid cells where the interpolation error is larger than this, in pixels.")
+    ("camera-grid-only", po::bool_switch(&opt.camera_grid_only)->default_value(false),
+     "Write only the camera grid, for an output already written.")
+    ("batch-list", po::value(&opt.batch_list)->default_value(""),
+     "Map project many images onto the DEM in one run, reading the DEM once. Each line of this file has an image, its camera, and the output image. The outputs have the same resolution and grid. Then only the DEM is given on the command line.");
   
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -178,7 +545,7 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   positional_desc.add("camera-model", 1);
   positional_desc.add("output-image", 1);
 
-  std::string usage("[options] <dem> <camera-image> <camera-model> <output-image>\nInstead of the DEM file, a datum can be provided, such as\nWGS84, NAD83, NAD27, D_MOON, D_MARS, and MOLA.");
+  std::string usage("[options] <dem> <camera-image> <camera-model> <output-image>\nInstead of the DEM file, a datum can be provided, such as\nWGS84, NAD83, NAD27, D_MOON, D_MARS, and MOLA.\nWith --batch-list, only the DEM is given:\n[options] --batch-list <list> <dem>");
   bool allow_unregistered = false;
   std::vector<std::string> unregistered;
   po::variables_map vm =
@@ -186,8 +553,21 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
                              positional, positional_desc, usage,
                              allow_unregistered, unregistered );
 
-  if ( !vm.count("dem") || !vm.count("camera-image") || !vm.count("camera-model") )
+  if ( !vm.count("dem") )
     vw_throw( ArgumentErr() << usage << general_options );
+  if ( opt.batch_list == "" && (!vm.count("camera-image") || !vm.count("camera-model")) )
+    vw_throw( ArgumentErr() << usage << general_options );
+  if ( opt.batch_list != "" && vm.count("camera-image") )
+    vw_throw( ArgumentErr() << "With --batch-list, the images and cameras must be in the list.\n" );
+
+  if (opt.projection_grid_spacing < 0)
+    vw_throw( ArgumentErr() << "The projection grid spacing must be non-negative.\n" );
+  if (opt.camera_grid_spacing < 0)
+    vw_throw( ArgumentErr() << "The camera grid spacing must be non-negative.\n" );
+  if (opt.camera_grid_only && opt.camera_grid_spacing <= 0)
+    vw_throw( ArgumentErr() << "The option --camera-grid-only needs --camera-grid-spacing.\n" );
+  if (opt.camera_grid_only && opt.batch_list != "")
+    vw_throw( ArgumentErr() << "The option --camera-grid-only cannot be used with --batch-list.\n" );
 
   // We support map-projecting using the DG camera model, however, these images
   // cannot be used later to do stereo, as that process expects the images
@@ -204,6 +584,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   // Need this to be able to load adjusted camera models. That will happen
   // in the stereo session.
   asp::stereo_settings().bundle_adjust_prefix = opt.bundle_adjust_prefix;
+  asp::stereo_settings().rpc_approximation_error = opt.rpc_approximation_error;
+  asp::stereo_settings().lens_lookup_table_spacing = opt.lens_lookup_table_spacing;
+  asp::stereo_settings().lens_lookup_table_error   = opt.lens_lookup_table_error;
 
   if (fs::path(opt.dem_file).extension() != "") {
     // A path to a real DEM file was provided, load it!
@@ -296,6 +679,11 @@ void write_parallel_cond( std::string              const& filename,
                                 has_nodata, nodata_val, opt, tpc, keywords);
   }
 
+  if (opt.cog) {
+    TerminalProgressCallback cog_tpc("asp", "Overviews: ");
+    asp::write_cog(filename, opt, "AVERAGE", cog_tpc);
+  }
+
 }
 
 /// Compute which camera pixel observes a DEM pixel.
@@ -316,6 +704,35 @@ Vector2 demPixToCamPix(Vector2i const& dem_pixel,
   return camera_pixel;
 }
 
+/// Estimate the range of DEM heights in the given lon-lat box, by
+/// sampling the DEM at most at a few hundred locations in each
+/// direction. Heights outside this range are still handled correctly
+/// by the cached projection model, just not sped up.
+Vector2 dem_height_range(ImageViewRef<DemPixelT> const& dem,
+                         GeoReference const& dem_georef,
+                         BBox2 const& lonlat_box) {
+  BBox2i dem_box = grow_bbox_to_int(dem_georef.lonlat_to_pixel_bbox(lonlat_box));
+  dem_box.crop(bounding_box(dem));
+
+  const int max_samples = 500;
+  int step_x = std::max(1, dem_box.width() /max_samples);
+  int step_y = std::max(1, dem_box.height()/max_samples);
+  double min_h = std::numeric_limits<double>::max(), max_h = -min_h;
+  for (int row = dem_box.min().y(); row < dem_box.max().y(); row += step_y) {
+    for (int col = dem_box.min().x(); col < dem_box.max().x(); col += step_x) {
+      DemPixelT h = dem(col, row);
+      if (!is_valid(h))
+        continue;
+      min_h = std::min(min_h, double(h.child()));
+      max_h = std::max(max_h, double(h.child()));
+    }
+  }
+  if (min_h > max_h)
+    return Vector2(0, 0);
+
+  return Vector2(min_h, max_h);
+}
+
 /// Expand the ground BBox to contain all the corners of the DEM if they intersect the camera.
 /// - TODO: This method still does not guarantee all points will be included in the bbox.
 /// - TODO: This should probably take pixel validity into account!
@@ -359,45 +776,11 @@ void expandBboxToContainCornerIntersections(boost::shared_ptr<camera::CameraMode
 
 }
 
-/// Compute output georeference to use
-void calc_target_geom(// Inputs
-                      bool calc_target_res,
-                      Vector2i const& image_size,
-                      boost::shared_ptr<camera::CameraModel> const& camera_model,
-                      ImageViewRef<DemPixelT> const& dem,
-                      GeoReference const& dem_georef, 
-                      Options const & opt,
-                      // Outputs
-                      BBox2 & cam_box, GeoReference & target_georef){
-
-  // Find the camera bbox and the target resolution unless user-supplied.
-  // - This call returns the bounding box of the camera view on the ground.
-  // - The bounding box is in units defined by dem_georef and might not be meters.
-  // - auto_res is an estimate of the ground resolution visible by the camera.
-  //   This is in a unit defined by dem_georef and also might not be meters.
-  // - This call WILL intersect pixels outside the dem valid area!
-  // - TODO: Modify this function to optionally disable intersection outside the DEM
-  float auto_res;
-  cam_box = camera_bbox(dem, dem_georef,
-                        target_georef, 
-                        camera_model,
-                        image_size.x(), image_size.y(), auto_res, false);
-
-  // Use auto-calculated ground resolution if that option was selected
-  double current_resolution;
-  if (calc_target_res) {
-    current_resolution = auto_res;
-  } else {
-    // Set the resolution from input options
-    if (target_georef.is_projected()) {
-      current_resolution = opt.mpp; // Use units of meters
-    } else { // Not projected, GDC coordinates only.
-      current_resolution = 1/opt.ppd; // Use units of degrees
-                                      // Lat/lon degrees are different so we never want to do this!
-    }
-    
-  }
-  vw_out() << "Output pixel size: " << current_resolution << std::endl;
+/// Put the output georeference on the grid of the given resolution,
+/// with its corner at the corner of the ground box, which is snapped
+/// to the grid too.
+void set_target_grid(double current_resolution, Options const& opt,
+                     BBox2 & cam_box, GeoReference & target_georef) {
 
   // If an image bounding box (projected coordinates) was passed in,
   // override the camera's view on the ground with the custom box.
@@ -451,10 +834,53 @@ void calc_target_geom(// Inputs
 
   // Last adjustment, to ensure 0 0 is always in the box corner
   target_georef = crop(target_georef, target_image_size.min().x(), target_image_size.min().y());
-  
-  return;
 }
 
+/// The output resolution set with --tr, --mpp, or --ppd, in the units
+/// of the output projection.
+double user_resolution(Options const& opt, GeoReference const& target_georef) {
+  if (target_georef.is_projected())
+    return opt.mpp; // Use units of meters
+  // Not projected, GDC coordinates only.
+  return 1/opt.ppd; // Use units of degrees
+}
+
+/// Compute output georeference to use
+void calc_target_geom(// Inputs
+                      bool calc_target_res,
+                      Vector2i const& image_size,
+                      boost::shared_ptr<camera::CameraModel> const& camera_model,
+                      ImageViewRef<DemPixelT> const& dem,
+                      GeoReference const& dem_georef, 
+                      Options const & opt,
+                      // Outputs
+                      BBox2 & cam_box, GeoReference & target_georef){
+
+  // Find the camera bbox and the target resolution unless user-supplied.
+  // - This call returns the bounding box of the camera view on the ground.
+  // - The bounding box is in units defined by dem_georef and might not be meters.
+  // - auto_res is an estimate of the ground resolution visible by the camera.
+  //   This is in a unit defined by dem_georef and also might not be meters.
+  // - This call WILL intersect pixels outside the dem valid area!
+  // - TODO: Modify this function to optionally disable intersection outside the DEM
+  float auto_res;
+  cam_box = camera_bbox(dem, dem_georef,
+                        target_georef, 
+                        camera_model,
+                        image_size.x(), image_size.y(), auto_res, false);
+
+  // Use auto-calculated ground resolution if that option was selected
+  double current_resolution;
+  if (calc_target_res) {
+    current_resolution = auto_res;
+  } else {
+    // Set the resolution from input options
+    current_resolution = user_resolution(opt, target_georef);
+  }
+  vw_out() << "Output pixel size: " << current_resolution << std::endl;
+
+  set_target_grid(current_resolution, opt, cam_box, target_georef);
+}
 
 /// Map project the image with a nodata value.  Used for single channel images.
 template <class ImagePixelT, class Map2CamTransT>
@@ -540,6 +966,82 @@ void project_image_alpha(Options & opt,
 
 }
 
+/// Map project the image with a nodata value, tile by tile. Used for
+/// single channel images.
+template <class ImagePixelT>
+void project_image_nodata_tiled(Options & opt,
+                                GeoReference const& croppedGeoRef,
+                                Vector2i     const& virtual_image_size,
+                                BBox2i       const& croppedImageBB,
+                                boost::shared_ptr<TileCameraProjector> projector) {
+
+    typedef PixelMask<ImagePixelT> ImageMaskPixelT;
+
+    boost::shared_ptr<DiskImageResource> img_rsrc = 
+          vw::DiskImageResourcePtr(opt.image_file);   
+
+    if (img_rsrc->has_nodata_read()) 
+      opt.nodata_value = img_rsrc->nodata_read();
+    
+    bool            has_img_nodata = true;
+    ImageMaskPixelT nodata_mask    = ImageMaskPixelT(); // invalid value for a PixelMask
+
+    write_parallel_type
+      (opt.output_file,
+       crop(apply_mask(tiled_projection(create_mask(DiskImageView<ImagePixelT>(img_rsrc),
+                                                    opt.nodata_value),
+                                        projector,
+                                        ValueEdgeExtension<ImageMaskPixelT>(nodata_mask),
+                                        nodata_mask,
+                                        virtual_image_size[0], virtual_image_size[1]),
+                       opt.nodata_value),
+            croppedImageBB),
+       croppedGeoRef, has_img_nodata, opt.nodata_value, opt,
+       TerminalProgressCallback("","")
+       );
+}
+
+/// Map project the image with an alpha channel, tile by tile. Used for
+/// multi-channel images.
+template <class ImagePixelT>
+void project_image_alpha_tiled(Options & opt,
+                               GeoReference const& croppedGeoRef,
+                               Vector2i     const& virtual_image_size,
+                               BBox2i       const& croppedImageBB,
+                               boost::shared_ptr<TileCameraProjector> projector) {
+
+    boost::shared_ptr<DiskImageResource> img_rsrc = 
+          vw::DiskImageResourcePtr(opt.image_file);   
+
+    const bool        has_img_nodata    = false;
+    const ImagePixelT transparent_pixel = ImagePixelT();
+
+    write_parallel_type
+      (opt.output_file,
+       crop(tiled_projection(DiskImageView<ImagePixelT>(img_rsrc), projector,
+                             ConstantEdgeExtension(), transparent_pixel,
+                             virtual_image_size[0], virtual_image_size[1]),
+            croppedImageBB),
+       croppedGeoRef, has_img_nodata, opt.nodata_value, opt,
+       TerminalProgressCallback("","")
+       );
+}
+
+/// The projector for tiled map projection, onto the DEM or the datum.
+boost::shared_ptr<TileCameraProjector>
+tile_projector(Options const& opt,
+               GeoReference const& dem_georef,
+               GeoReference const& target_georef,
+               ImageViewRef<DemPixelT> const& dem,
+               Vector2i const& image_size,
+               boost::shared_ptr<camera::CameraModel> const& camera_model) {
+  bool has_dem = (fs::path(opt.dem_file).extension() != "");
+  return boost::shared_ptr<TileCameraProjector>
+    (new TileCameraProjector(camera_model.get(), target_georef, dem_georef, dem, has_dem,
+                             opt.datum_offset, image_size, opt.projection_grid_spacing,
+                             opt.projection_grid_error));
+}
+
 // The two "pick" functions below select between the Map2CamTrans and Datum2CamTrans
 // transform classes which will be passed to the image projection function.
 // - TODO: Is there a good reason for the transform classes to be CRTP instead of virtual?
@@ -549,10 +1051,17 @@ void project_image_nodata_pick_transform(Options & opt,
                           GeoReference const& dem_georef,
                           GeoReference const& target_georef,
                           GeoReference const& croppedGeoRef,
+                          ImageViewRef<DemPixelT> const& dem,
                           Vector2i     const& image_size,
                           Vector2i     const& virtual_image_size,
                           BBox2i       const& croppedImageBB,
                           boost::shared_ptr<camera::CameraModel> const& camera_model) {
+  if (opt.projection_grid_spacing > 0)
+    return project_image_nodata_tiled<ImagePixelT>(opt, croppedGeoRef, virtual_image_size,
+                                                 croppedImageBB,
+                                                 tile_projector(opt, dem_georef, target_georef,
+                                                                dem, image_size, camera_model));
+
   const bool        call_from_mapproject = true;
   if (fs::path(opt.dem_file).extension() != "") {
     // A DEM file was provided
@@ -584,10 +1093,17 @@ void project_image_alpha_pick_transform(Options & opt,
                           GeoReference const& dem_georef,
                           GeoReference const& target_georef,
                           GeoReference const& croppedGeoRef,
+                          ImageViewRef<DemPixelT> const& dem,
                           Vector2i     const& image_size,
                           Vector2i     const& virtual_image_size,
                           BBox2i       const& croppedImageBB,
                           boost::shared_ptr<camera::CameraModel> const& camera_model) {
+  if (opt.projection_grid_spacing > 0)
+    return project_image_alpha_tiled<ImagePixelT>(opt, croppedGeoRef, virtual_image_size,
+                                                 croppedImageBB,
+                                                 tile_projector(opt, dem_georef, target_georef,
+                                                                dem, image_size, camera_model));
+
   const bool        call_from_mapproject = true;
   if (fs::path(opt.dem_file).extension() != "") {
     // A DEM file was provided
@@ -614,130 +1130,434 @@ void project_image_alpha_pick_transform(Options & opt,
   }
 }
 
+/// Load the camera model of opt.image_file, with the session found
+/// from it. For ISIS, the camera may be in the image file, and then
+/// opt.camera_file is actually the output file.
+boost::shared_ptr<camera::CameraModel> load_camera(Options & opt) {
+
+  // TODO: Replace this using the new CameraModelLoader functions
+
+  // We create a stereo session where both of the cameras and images
+  // are the same, because we want to take advantage of the stereo
+  // pipeline's ability to generate camera models for various
+  // missions.  Hence, we create two identical camera models, but only one is used.
+  typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
+  SessionPtr session( asp::StereoSessionFactory::create
+                      (opt.stereo_session, // in-out
+                       opt,
+                       opt.image_file, opt.image_file, // The same file is passed in twice
+                       opt.camera_file, opt.camera_file,
+                       opt.output_file,
+                       opt.dem_file,
+                       false) ); // Do not allow promotion from normal to map projected session
+
+  // If the session was above auto-guessed as isis, adjust for the fact
+  // that the isis .cub file also has camera info.
+  if ((session->name() == "isis" || session->name() == "isismapisis")
+        && opt.output_file.empty() ){
+    // The user did not provide an output file. Then the camera
+    // information is contained within the image file and what is in
+    // the camera file is actually the output file.
+    opt.output_file = opt.camera_file;
+    opt.camera_file = opt.image_file;
+  }
+
+  if ( opt.output_file.empty() )
+    vw_throw( ArgumentErr() << "Missing output filename.\n" );
+
+  // Initialize a camera model
+  boost::shared_ptr<camera::CameraModel> camera_model =
+    session->camera_model(opt.image_file, opt.camera_file);
+
+  {
+    // Safety check that the users are not trying to map project map
+    // projected images. This should not be an error as sometimes
+    // even raw images have some half-baked georeference attached to them.
+    GeoReference dummy_georef;
+    bool has_georef = vw::cartography::read_georeference( dummy_georef, opt.image_file );
+    if (has_georef)
+      vw_out(WarningMessage) << "Your input camera image is already map-"
+                             << "projected. The expected input is required "
+                             << "to be unprojected or raw camera imagery.\n";
+  }
+
+  return camera_model;
+}
+
+/// Load the DEM, or make a constant one at the datum. Then the camera
+/// center decides if its longitudes are centered on 0 or 180.
+void load_dem(Options const& opt,
+              boost::shared_ptr<camera::CameraModel> const& camera_model,
+              GeoReference & dem_georef, ImageViewRef<DemPixelT> & dem) {
+
+  if (fs::path(opt.dem_file).extension() != "") {
+    // A path to a real DEM file was provided, load it!
+
+    bool has_georef = vw::cartography::read_georeference(dem_georef, opt.dem_file);
+    if (!has_georef)
+      vw_throw( ArgumentErr() << "There is no georeference information in: " << opt.dem_file << ".\n" );
+
+    boost::shared_ptr<DiskImageResource> dem_rsrc(DiskImageResourcePtr(opt.dem_file));
+
+    // If we have a nodata value, create a mask.
+    DiskImageView<float> dem_disk_image(opt.dem_file);
+    if (dem_rsrc->has_nodata_read()){
+      dem = create_mask(dem_disk_image, dem_rsrc->nodata_read());
+    }else{
+      dem = pixel_cast<DemPixelT>(dem_disk_image);
+    }      
+  } else {
+    // Projecting to a datum instead of a DEM
+    std::string datum_name = opt.dem_file;
+    
+    // Use the camera center to determine whether to center the fake DEM on 0 or 180.
+    Vector3 llr_camera_loc =
+      cartography::XYZtoLonLatRadEstimateFunctor::apply( camera_model->camera_center(Vector2()) );
+    if ( llr_camera_loc[0] < 0 ) 
+      llr_camera_loc[0] += 360;
+    dem_georef = GeoReference(Datum(datum_name),
+                              Matrix3x3(1, 0, (llr_camera_loc[0] < 90 ||
+                                               llr_camera_loc[0] > 270) ? -180 : 0,
+                                        0, -1, 90, 0, 0, 1) );
+    dem = constant_view(PixelMask<float>(opt.datum_offset), 360, 180 );
+    vw_out() << "\t--> Using flat datum \"" << datum_name << "\" as elevation model.\n";
+  }
+}
+
+/// The output projection, before its grid is set, and whether the
+/// output resolution is to be found from the camera. Fills in opt.mpp
+/// and opt.ppd from whichever of --tr, --mpp, and --ppd was set.
+bool prepare_target_georef(Options & opt, GeoReference const& dem_georef,
+                           GeoReference & target_georef) {
+
+  // Read projection. Work out output bounding box in points using original camera model.
+  target_georef = dem_georef;
+
+  // User specified the proj4 string for the output georeference
+  if (opt.target_srs_string != ""){
+    bool  have_user_datum = false;
+    Datum user_datum;
+    asp::set_srs_string(opt.target_srs_string, have_user_datum, user_datum, target_georef);
+  }
+
+  // Find the target resolution based --tr, --mpp, and --ppd if provided. Do
+  // the math to convert pixel-per-degree to meter-per-pixel and vice-versa.
+  int sum = (!std::isnan(opt.tr)) + (!std::isnan(opt.mpp)) + (!std::isnan(opt.ppd));
+  if (sum >= 2){
+    vw_throw( ArgumentErr() << "Must specify at most one of the options: --tr, --mpp, --ppd.\n" );
+  }
+
+  double radius = target_georef.datum().semi_major_axis();
+  if ( !std::isnan(opt.tr) ){ // --tr was set
+    if (target_georef.is_projected()) {
+      if (std::isnan(opt.mpp)) opt.mpp = opt.tr; // User must have provided be meters per pixel
+    }else {
+      if (std::isnan(opt.ppd)) opt.ppd = 1.0/opt.tr; // User must have provided degrees per pixel
+    }
+  }
+  
+  if (!std::isnan(opt.mpp)){ // Meters per pixel was set
+    if (std::isnan(opt.ppd)) opt.ppd = 2.0*M_PI*radius/(360.0*opt.mpp);
+  }
+  if (!std::isnan(opt.ppd)){ // Pixels per degree was set
+    if (std::isnan(opt.mpp)) opt.mpp = 2.0*M_PI*radius/(360.0*opt.ppd);
+  }
+  
+  bool user_provided_resolution = (!std::isnan(opt.ppd));
+  return !user_provided_resolution;
+}
+
+/// Save the camera pixels seen by the output pixels on a grid, for
+/// stereo to interpolate into. They are found as stereo does, with the
+/// DEM and the camera used for the output.
+void save_camera_grid(Options const& opt,
+                      GeoReference const& dem_georef,
+                      GeoReference const& output_georef,
+                      Vector2i const& output_size,
+                      Vector2i const& image_size,
+                      boost::shared_ptr<camera::CameraModel> const& camera_model) {
+
+  if (fs::path(opt.dem_file).extension() == "") {
+    vw_out(WarningMessage) << "Not writing the camera grid, as stereo with map-projected "
+                           << "images needs a DEM, not a datum.\n";
+    return;
+  }
+
+  const bool call_from_mapproject = false; // Same as in stereo
+  Map2CamTrans trans(camera_model.get(), output_georef, dem_georef, opt.dem_file,
+                     image_size, call_from_mapproject);
+
+  // The files the grid depends on, so stereo can tell if it is stale
+  std::string camera_file = (opt.camera_file == "") ? opt.image_file : opt.camera_file;
+  std::string adjust_file;
+  if (asp::stereo_settings().bundle_adjust_prefix != "")
+    adjust_file = asp::bundle_adjust_file_name(asp::stereo_settings().bundle_adjust_prefix,
+                                               opt.image_file, opt.camera_file);
+
+  // ISIS is not thread safe
+  bool single_threaded = (opt.stereo_session == "isis" || opt.stereo_session == "isismapisis");
+  TerminalProgressCallback tpc("asp", "\t--> Camera grid: ");
+  asp::write_camera_grid(asp::camera_grid_file(opt.output_file), output_size,
+                         trans, opt.camera_grid_spacing, opt.camera_grid_error,
+                         opt.dem_file, camera_file, adjust_file,
+                         single_threaded, opt, tpc);
+}
+
+/// Map project one image, with the output georeference already on
+/// its grid, and cam_box its footprint in projected coordinates.
+void project_image(Options & opt,
+                   GeoReference const& dem_georef,
+                   GeoReference const& target_georef,
+                   ImageViewRef<DemPixelT> const& dem,
+                   Vector2i const& image_size,
+                   BBox2 const& cam_box,
+                   boost::shared_ptr<camera::CameraModel> camera_model) {
+
+  vw_out() << "Projected space bounding box: " << cam_box << std::endl;
+
+  // Compute output image size in pixels using bounding box in output projected space
+  BBox2i target_image_size = target_georef.point_to_pixel_bbox( cam_box );
+
+  vw_out() << "Image box: " << target_image_size << std::endl;
+  
+  // Very important note: this box may be in the middle of the
+  // image.  However, the virtual image we create with
+  // transform_nodata() below is assumed to start at (0, 0), and in
+  // target_georef we assume the same thing. Hence, its width and
+  // height are going to be the max values of target_image_size.
+  // There is no performance hit here, since that potentially huge
+  // image is never actually realized, we crop it as seen below
+  // before finding its pixels. This could be made less confusing.
+  int virtual_image_width  = target_image_size.max().x();
+  int virtual_image_height = target_image_size.max().y();
+
+  // Shrink output image BB if an output image BB was passed in
+  GeoReference croppedGeoRef  = target_georef;
+  BBox2i       croppedImageBB = target_image_size;
+  if ( opt.target_pixelwin != BBox2() ) {
+    // Replace with passed in bounding box
+    croppedImageBB = opt.target_pixelwin;
+
+    // Update output georeference to match the reduced image size
+    croppedGeoRef = vw::cartography::crop(target_georef, croppedImageBB);
+  }
+  //vw_out() << "croppedImageBB = " << croppedImageBB << std::endl;
+  //vw_out() << "\nCROPPED georeference:\n"        << croppedGeoRef << std::endl;
+
+  // Important: Don't modify the line below, we count on it in mapproject.in.
+  vw_out() << "Output image size:\n";
+  vw_out() << "(width: " << virtual_image_width
+           << " height: " << virtual_image_height << ")" << std::endl;
+
+  if (opt.isQuery){ // Quit before we do any image work
+    vw_out() << "Query finished, exiting mapproject tool.\n";
+    return;
+  }
+
+  // The grid is made with the camera itself, not the cached projections
+  boost::shared_ptr<camera::CameraModel> exact_camera = camera_model;
+
+  if (opt.cache_projection) {
+    BBox2 lonlat_box = croppedGeoRef.pixel_to_lonlat_bbox
+      (BBox2(0, 0, croppedImageBB.width(), croppedImageBB.height()));
+    Vector2 height_range = dem_height_range(dem, dem_georef, lonlat_box);
+    camera_model = boost::shared_ptr<camera::CameraModel>
+      (new asp::CachedProjectionModel(camera_model, dem_georef.datum(), lonlat_box,
+                                      height_range, Vector3i(64, 64, 3),
+                                      opt.cache_projection_error));
+  }
+
+  // Determine the pixel type of the input image
+  boost::shared_ptr<DiskImageResource> image_rsrc = vw::DiskImageResourcePtr(opt.image_file);
+  ImageFormat image_fmt = image_rsrc->format();
+  const int num_input_channels = num_channels(image_fmt.pixel_format);
+
+  // Prepare output directory
+  vw::create_out_dir(opt.output_file);
+
+  // Redirect to the correctly typed function to perform the actual map projection.
+  // - Must correspond to the type of the input image.
+  if (image_fmt.pixel_format == VW_PIXEL_RGB) {
+
+    // We can't just use float for everything or the output will be cast
+    //  into the -1 to 1 range which is probably not desired.
+    // - Always use an alpha channel with RGB images.
+    switch(image_fmt.channel_type) {
+    case VW_CHANNEL_UINT8:
+      project_image_alpha_pick_transform<PixelRGBA<uint8> >(opt, dem_georef, target_georef,
+                                                            croppedGeoRef, dem, image_size, 
+                                                            Vector2i(virtual_image_width,
+                                                                     virtual_image_height),
+                                                            croppedImageBB, camera_model);
+      break;
+    case VW_CHANNEL_INT16:
+      project_image_alpha_pick_transform<PixelRGBA<int16> >(opt, dem_georef, target_georef,
+                                                            croppedGeoRef, dem, image_size, 
+                                                            Vector2i(virtual_image_width,
+                                                                     virtual_image_height),
+                                                            croppedImageBB, camera_model);
+      break;
+    case VW_CHANNEL_UINT16:
+      project_image_alpha_pick_transform<PixelRGBA<uint16> >(opt, dem_georef, target_georef,
+                                                             croppedGeoRef, dem, image_size, 
+                                                             Vector2i(virtual_image_width,
+                                                                      virtual_image_height),
+                                                             croppedImageBB, camera_model);
+      break;
+    default:
+      project_image_alpha_pick_transform<PixelRGBA<float32> >(opt, dem_georef, target_georef,
+                                                              croppedGeoRef, dem, image_size, 
+                                                              Vector2i(virtual_image_width,
+                                                                       virtual_image_height),
+                                                              croppedImageBB, camera_model);
+      break;
+    };
+    
+  } else {
+    // If the input image is not RGB, only single channel images are supported.
+    if (num_input_channels != 1 || image_fmt.planes != 1)
+      vw_throw( ArgumentErr() << "Input images must be single channel or RGB!\n" );
+    // This will cast to float but will not rescale the pixel values.
+    project_image_nodata_pick_transform<float>(opt, dem_georef, target_georef, croppedGeoRef,
+                                               dem, image_size, 
+                         Vector2i(virtual_image_width, virtual_image_height),
+                         croppedImageBB, camera_model);
+  }
+
+  // After the output, so that the grid is not older than it
+  if (opt.camera_grid_spacing > 0)
+    save_camera_grid(opt, dem_georef, croppedGeoRef,
+                     Vector2i(croppedImageBB.width(), croppedImageBB.height()),
+                     image_size, exact_camera);
+}
+
+/// Orders the images by where their footprints are, from the top of
+/// the output grid, so that images seen one after another need mostly
+/// the same DEM region, which then is still in the cache.
+struct FootprintOrder {
+  std::vector<BBox2> const& m_boxes;
+  FootprintOrder(std::vector<BBox2> const& boxes): m_boxes(boxes) {}
+  bool operator()(int a, int b) const {
+    Vector2 ca = m_boxes[a].center(), cb = m_boxes[b].center();
+    if (ca.y() != cb.y())
+      return ca.y() > cb.y();
+    return ca.x() < cb.x();
+  }
+};
+
+/// Map project all the images in opt.batch_list onto the DEM, which
+/// is loaded once and shared. The outputs have the same resolution,
+/// the finest among the images unless set by the user, and as their
+/// corners are snapped to multiples of it, they are on the same grid.
+void batch_mapproject(Options & opt) {
+
+  // Each line has an image, its camera, and the output image. For
+  // ISIS cubes, which contain the camera, the camera may be omitted.
+  std::vector<Options> jobs;
+  std::ifstream list(opt.batch_list.c_str());
+  if (!list)
+    vw_throw( IOErr() << "Cannot open: " << opt.batch_list << ".\n" );
+  std::string line;
+  while (std::getline(list, line)) {
+    std::istringstream is(line);
+    std::vector<std::string> tokens;
+    std::string token;
+    while (is >> token)
+      tokens.push_back(token);
+    if (tokens.empty() || tokens[0][0] == '#')
+      continue;
+    if (tokens.size() != 2 && tokens.size() != 3)
+      vw_throw( ArgumentErr() << "Expecting an image, a camera, and an output image "
+                << "on each line of " << opt.batch_list << ", got: " << line << "\n" );
+    Options job = opt;
+    job.image_file  = tokens[0];
+    job.camera_file = tokens[1];
+    job.output_file = (tokens.size() == 3) ? tokens[2] : "";
+    jobs.push_back(job);
+  }
+  if (jobs.empty())
+    vw_throw( ArgumentErr() << "No images to map project in: " << opt.batch_list << ".\n" );
+
+  std::vector<boost::shared_ptr<camera::CameraModel> > cameras(jobs.size());
+  for (size_t i = 0; i < jobs.size(); i++) {
+    // The session found for the first image is used for the rest
+    jobs[i].stereo_session = opt.stereo_session;
+    cameras[i] = load_camera(jobs[i]);
+    opt.stereo_session = jobs[i].stereo_session;
+  }
+
+  GeoReference dem_georef;
+  ImageViewRef<DemPixelT> dem;
+  load_dem(opt, cameras[0], dem_georef, dem);
+
+  GeoReference target_georef;
+  bool calc_target_res = prepare_target_georef(opt, dem_georef, target_georef);
+
+  // The footprints, found once per image
+  std::vector<BBox2>    cam_boxes  (jobs.size());
+  std::vector<Vector2i> image_sizes(jobs.size());
+  double current_resolution = std::numeric_limits<double>::max();
+  for (size_t i = 0; i < jobs.size(); i++) {
+    image_sizes[i] = vw::file_image_size(jobs[i].image_file);
+    float auto_res;
+    cam_boxes[i] = camera_bbox(dem, dem_georef, target_georef, cameras[i],
+                               image_sizes[i].x(), image_sizes[i].y(), auto_res, false);
+    current_resolution = std::min(current_resolution, double(auto_res));
+  }
+  if (!calc_target_res)
+    current_resolution = user_resolution(opt, target_georef);
+  vw_out() << "Output pixel size: " << current_resolution << std::endl;
+
+  std::vector<int> order(jobs.size());
+  for (size_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), FootprintOrder(cam_boxes));
+
+  for (size_t k = 0; k < order.size(); k++) {
+    int i = order[k];
+    Options & job = jobs[i];
+    vw_out() << "Map projecting " << job.image_file << " (" << k + 1 << " of "
+             << order.size() << ").\n";
+    GeoReference job_georef = target_georef;
+    set_target_grid(current_resolution, job, cam_boxes[i], job_georef);
+    project_image(job, dem_georef, job_georef, dem, image_sizes[i], cam_boxes[i],
+                  cameras[i]);
+  }
+}
+
 int main( int argc, char* argv[] ) {
 
   Options opt;
   try {
     handle_arguments( argc, argv, opt );
 
-    // TODO: Replace this using the new CameraModelLoader functions
-
-    // We create a stereo session where both of the cameras and images
-    // are the same, because we want to take advantage of the stereo
-    // pipeline's ability to generate camera models for various
-    // missions.  Hence, we create two identical camera models, but only one is used.
-    typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
-    SessionPtr session( asp::StereoSessionFactory::create
-                        (opt.stereo_session, // in-out
-                         opt,
-                         opt.image_file, opt.image_file, // The same file is passed in twice
-                         opt.camera_file, opt.camera_file,
-                         opt.output_file,
-                         opt.dem_file,
-                         false) ); // Do not allow promotion from normal to map projected session
-    
-    // If the session was above auto-guessed as isis, adjust for the fact
-    // that the isis .cub file also has camera info.
-    if ((session->name() == "isis" || session->name() == "isismapisis")
-          && opt.output_file.empty() ){
-      // The user did not provide an output file. Then the camera
-      // information is contained within the image file and what is in
-      // the camera file is actually the output file.
-      opt.output_file = opt.camera_file;
-      opt.camera_file = opt.image_file;
+    if (opt.batch_list != "") {
+      batch_mapproject(opt);
+      return 0;
     }
 
-    if ( opt.output_file.empty() )
-      vw_throw( ArgumentErr() << "Missing output filename.\n" );
-
-    // Initialize a camera model
-    boost::shared_ptr<camera::CameraModel> camera_model =
-      session->camera_model(opt.image_file, opt.camera_file);
-
-    {
-      // Safety check that the users are not trying to map project map
-      // projected images. This should not be an error as sometimes
-      // even raw images have some half-baked georeference attached to them.
-      GeoReference dummy_georef;
-      bool has_georef = vw::cartography::read_georeference( dummy_georef, opt.image_file );
-      if (has_georef)
-        vw_out(WarningMessage) << "Your input camera image is already map-"
-                               << "projected. The expected input is required "
-                               << "to be unprojected or raw camera imagery.\n";
-    }
+    boost::shared_ptr<camera::CameraModel> camera_model = load_camera(opt);
 
     // Load the DEM
     GeoReference dem_georef;
     ImageViewRef<DemPixelT> dem;
-    if (fs::path(opt.dem_file).extension() != "") {
-      // A path to a real DEM file was provided, load it!
-
-      bool has_georef = vw::cartography::read_georeference(dem_georef, opt.dem_file);
-      if (!has_georef)
-        vw_throw( ArgumentErr() << "There is no georeference information in: " << opt.dem_file << ".\n" );
-
-      boost::shared_ptr<DiskImageResource> dem_rsrc(DiskImageResourcePtr(opt.dem_file));
-
-      // If we have a nodata value, create a mask.
-      DiskImageView<float> dem_disk_image(opt.dem_file);
-      if (dem_rsrc->has_nodata_read()){
-        dem = create_mask(dem_disk_image, dem_rsrc->nodata_read());
-      }else{
-        dem = pixel_cast<DemPixelT>(dem_disk_image);
-      }      
-    } else {
-      // Projecting to a datum instead of a DEM
-      std::string datum_name = opt.dem_file;
-      
-      // Use the camera center to determine whether to center the fake DEM on 0 or 180.
-      Vector3 llr_camera_loc =
-        cartography::XYZtoLonLatRadEstimateFunctor::apply( camera_model->camera_center(Vector2()) );
-      if ( llr_camera_loc[0] < 0 ) 
-        llr_camera_loc[0] += 360;
-      dem_georef = GeoReference(Datum(datum_name),
-                                Matrix3x3(1, 0, (llr_camera_loc[0] < 90 ||
-                                                 llr_camera_loc[0] > 270) ? -180 : 0,
-                                          0, -1, 90, 0, 0, 1) );
-      dem = constant_view(PixelMask<float>(opt.datum_offset), 360, 180 );
-      vw_out() << "\t--> Using flat datum \"" << datum_name << "\" as elevation model.\n";
-    }
+    load_dem(opt, camera_model, dem_georef, dem);
     // Finished setting up the datum
 
-    // Read projection. Work out output bounding box in points using original camera model.
-    GeoReference target_georef = dem_georef;
-
-    // User specified the proj4 string for the output georeference
-    if (opt.target_srs_string != ""){
-      bool  have_user_datum = false;
-      Datum user_datum;
-      asp::set_srs_string(opt.target_srs_string, have_user_datum, user_datum, target_georef);
-    }
-
-    // Find the target resolution based --tr, --mpp, and --ppd if provided. Do
-    // the math to convert pixel-per-degree to meter-per-pixel and vice-versa.
-    int sum = (!std::isnan(opt.tr)) + (!std::isnan(opt.mpp)) + (!std::isnan(opt.ppd));
-    if (sum >= 2){
-      vw_throw( ArgumentErr() << "Must specify at most one of the options: --tr, --mpp, --ppd.\n" );
+    // The grid is for the output as it was written, which, when made
+    // in tiles, need not be on the grid found from the arguments.
+    if (opt.camera_grid_only) {
+      GeoReference output_georef;
+      if (!read_georeference(output_georef, opt.output_file))
+        vw_throw( ArgumentErr() << "The output image " << opt.output_file
+                  << " lacks georeferencing information.\n" );
+      save_camera_grid(opt, dem_georef, output_georef, vw::file_image_size(opt.output_file),
+                       vw::file_image_size(opt.image_file), camera_model);
+      return 0;
     }
 
-    double radius = target_georef.datum().semi_major_axis();
-    if ( !std::isnan(opt.tr) ){ // --tr was set
-      if (target_georef.is_projected()) {
-        if (std::isnan(opt.mpp)) opt.mpp = opt.tr; // User must have provided be meters per pixel
-      }else {
-        if (std::isnan(opt.ppd)) opt.ppd = 1.0/opt.tr; // User must have provided degrees per pixel
-      }
-    }
-    
-    if (!std::isnan(opt.mpp)){ // Meters per pixel was set
-      if (std::isnan(opt.ppd)) opt.ppd = 2.0*M_PI*radius/(360.0*opt.mpp);
-    }
-    if (!std::isnan(opt.ppd)){ // Pixels per degree was set
-      if (std::isnan(opt.mpp)) opt.mpp = 2.0*M_PI*radius/(360.0*opt.ppd);
-    }
-    
-    bool user_provided_resolution = (!std::isnan(opt.ppd));
-    bool     calc_target_res = !user_provided_resolution;
+    GeoReference target_georef;
+    bool     calc_target_res = prepare_target_georef(opt, dem_georef, target_georef);
     Vector2i image_size      = vw::file_image_size(opt.image_file);
     BBox2    cam_box;
     calc_target_geom(// Inputs
@@ -746,110 +1566,10 @@ int main( int argc, char* argv[] ) {
                      // Outputs
                      opt, cam_box, target_georef);
 
-    vw_out() << "Projected space bounding box: " << cam_box << std::endl;
-
-    // Compute output image size in pixels using bounding box in output projected space
-    BBox2i target_image_size = target_georef.point_to_pixel_bbox( cam_box );
-
-    vw_out() << "Image box: " << target_image_size << std::endl;
-    
-    // Very important note: this box may be in the middle of the
-    // image.  However, the virtual image we create with
-    // transform_nodata() below is assumed to start at (0, 0), and in
-    // target_georef we assume the same thing. Hence, its width and
-    // height are going to be the max values of target_image_size.
-    // There is no performance hit here, since that potentially huge
-    // image is never actually realized, we crop it as seen below
-    // before finding its pixels. This could be made less confusing.
-    int virtual_image_width  = target_image_size.max().x();
-    int virtual_image_height = target_image_size.max().y();
-
-    // Shrink output image BB if an output image BB was passed in
-    GeoReference croppedGeoRef  = target_georef;
-    BBox2i       croppedImageBB = target_image_size;
-    if ( opt.target_pixelwin != BBox2() ) {
-      // Replace with passed in bounding box
-      croppedImageBB = opt.target_pixelwin;
-
-      // Update output georeference to match the reduced image size
-      croppedGeoRef = vw::cartography::crop(target_georef, croppedImageBB);
-    }
-    //vw_out() << "croppedImageBB = " << croppedImageBB << std::endl;
-    //vw_out() << "\nCROPPED georeference:\n"        << croppedGeoRef << std::endl;
-
-    // Important: Don't modify the line below, we count on it in mapproject.in.
-    vw_out() << "Output image size:\n";
-    vw_out() << "(width: " << virtual_image_width
-             << " height: " << virtual_image_height << ")" << std::endl;
-
-    if (opt.isQuery){ // Quit before we do any image work
-      vw_out() << "Query finished, exiting mapproject tool.\n";
-      return 0;
-    }
-
-    // Determine the pixel type of the input image
-    boost::shared_ptr<DiskImageResource> image_rsrc = vw::DiskImageResourcePtr(opt.image_file);
-    ImageFormat image_fmt = image_rsrc->format();
-    const int num_input_channels = num_channels(image_fmt.pixel_format);
-
-    // Prepare output directory
-    vw::create_out_dir(opt.output_file);
-
-    // Redirect to the correctly typed function to perform the actual map projection.
-    // - Must correspond to the type of the input image.
-    if (image_fmt.pixel_format == VW_PIXEL_RGB) {
-
-      // We can't just use float for everything or the output will be cast
-      //  into the -1 to 1 range which is probably not desired.
-      // - Always use an alpha channel with RGB images.
-      switch(image_fmt.channel_type) {
-      case VW_CHANNEL_UINT8:
-        project_image_alpha_pick_transform<PixelRGBA<uint8> >(opt, dem_georef, target_georef,
-                                                              croppedGeoRef, image_size, 
-                                                              Vector2i(virtual_image_width,
-                                                                       virtual_image_height),
-                                                              croppedImageBB, camera_model);
-        break;
-      case VW_CHANNEL_INT16:
-        project_image_alpha_pick_transform<PixelRGBA<int16> >(opt, dem_georef, target_georef,
-                                                              croppedGeoRef, image_size, 
-                                                              Vector2i(virtual_image_width,
-                                                                       virtual_image_height),
-                                                              croppedImageBB, camera_model);
-        break;
-      case VW_CHANNEL_UINT16:
-        project_image_alpha_pick_transform<PixelRGBA<uint16> >(opt, dem_georef, target_georef,
-                                                               croppedGeoRef, image_size, 
-                                                               Vector2i(virtual_image_width,
-                                                                        virtual_image_height),
-                                                               croppedImageBB, camera_model);
-        break;
-      default:
-        project_image_alpha_pick_transform<PixelRGBA<float32> >(opt, dem_georef, target_georef,
-                                                                croppedGeoRef, image_size, 
-                                                                Vector2i(virtual_image_width,
-                                                                         virtual_image_height),
-                                                                croppedImageBB, camera_model);
-        break;
-      };
-      
-    } else {
-      // If the input image is not RGB, only single channel images are supported.
-      if (num_input_channels != 1 || image_fmt.planes != 1)
-        vw_throw( ArgumentErr() << "Input images must be single channel or RGB!\n" );
-      // This will cast to float but will not rescale the pixel values.
-      project_image_nodata_pick_transform<float>(opt, dem_georef, target_georef, croppedGeoRef,
-                                                 image_size, 
-                           Vector2i(virtual_image_width, virtual_image_height),
-                           croppedImageBB, camera_model);
-    } 
+    project_image(opt, dem_georef, target_georef, dem, image_size, cam_box, camera_model);
     // Done map projecting!
 
   } ASP_STANDARD_CATCHES;
 
   return 0;
 }
-
-
-
-
@@ -38,6 +38,9 @@
 #endif
 
 #include <iomanip>
+#include <fstream>
+#include <map>
+#include <sstream>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/program_options.hpp>
@@ -62,6 +65,7 @@ struct Options : public vw::cartography::GdalWriteOptions {
   std::string datum;
   double model_scale; ///< Size scaling applied to 3D models
   int    linescan_line; ///< Show the camera position at this line
+  int    max_cameras_per_file; ///< Split the cameras among region files beyond this
 
   // Output
   std::string out_file;
@@ -216,6 +220,139 @@ size_t get_files_from_solver_folder(std::string                 const& solver_fo
   return num_images;
 }
 
+/// Write a KML file with the given cameras, and the lines to the
+/// cameras matched to them.
+void write_cameras_kml(std::string const& kml_file, Options const& opt,
+                       std::vector<int>                const& indices,
+                       std::vector<Vector3>            const& positions,
+                       std::vector<Quat>               const& poses,
+                       std::vector<std::string>        const& names,
+                       std::vector<std::vector<int> >  const& matched_cameras) {
+
+  KMLFile kml( kml_file, "orbitviz" );
+
+  // Style listing
+  if ( opt.path_to_outside_model.empty() ) {
+    // Placemark Style
+    kml.append_style( "plane", "", 1.2,
+                      "http://maps.google.com/mapfiles/kml/shapes/airports.png",
+                      opt.hide_labels);
+    kml.append_style( "plane_highlight", "", 1.4,
+                      "http://maps.google.com/mapfiles/kml/shapes/airports.png");
+    kml.append_stylemap( "camera_placemark", "plane",
+                         "plane_highlight" );
+  }
+
+  // Adding Placemarks
+  for (size_t k = 0; k < indices.size(); k++) {
+    int i = indices[k];
+    Vector3 const& lon_lat_alt = positions[i];
+    if (!opt.path_to_outside_model.empty()) {
+      kml.append_model( opt.path_to_outside_model,
+                        lon_lat_alt.x(), lon_lat_alt.y(),
+                        poses[i], names[i], "",
+                        lon_lat_alt[2], opt.model_scale );
+    } else {
+      kml.append_placemark( lon_lat_alt.x(), lon_lat_alt.y(),
+                            names[i], "", "camera_placemark",
+                            lon_lat_alt[2], true );
+    }
+  }
+
+  // Draw lines between camera positions representing camera
+  //  pairs with match files.
+  const std::string style_id = "ip_match_style";
+  kml.append_line_style(style_id, "FF00FF00", 1.0); // Green line with default size
+  std::vector<Vector3> line_ends(2);
+  for (size_t k = 0; k < indices.size(); k++) {
+    int i = indices[k];
+    if (i >= (int)matched_cameras.size())
+      continue;
+    line_ends[0] = positions[i];
+    for (size_t j=0; j<matched_cameras[i].size(); ++j) {
+      line_ends[1] = positions[matched_cameras[i][j]];
+      kml.append_line(line_ends, "", style_id);
+    }
+  }
+
+  kml.close_kml();
+}
+
+/// Split the cameras by location among KML files, in a grid of cells
+/// of about max_cameras_per_file cameras each. The output file has a
+/// network link to each, with the region of its cell, so that a viewer
+/// loads the cameras of only the cells in view and large enough.
+void write_camera_regions_kml(Options const& opt,
+                              std::vector<Vector3>            const& positions,
+                              std::vector<Quat>               const& poses,
+                              std::vector<std::string>        const& names,
+                              std::vector<std::vector<int> >  const& matched_cameras) {
+
+  BBox3 box;
+  for (size_t i = 0; i < positions.size(); i++)
+    box.grow(positions[i]);
+  double min_size = 1e-3; // degrees, so that no cell is empty of area
+  for (int k = 0; k < 2; k++) {
+    if (box.max()[k] - box.min()[k] < min_size) {
+      box.min()[k] -= min_size/2;
+      box.max()[k] += min_size/2;
+    }
+  }
+
+  int num_cells = (int)ceil(sqrt(double(positions.size())/opt.max_cameras_per_file));
+  std::map<std::pair<int, int>, std::vector<int> > cells;
+  for (size_t i = 0; i < positions.size(); i++) {
+    int cx = (int)floor((positions[i][0] - box.min()[0])/(box.max()[0] - box.min()[0])*num_cells);
+    int cy = (int)floor((positions[i][1] - box.min()[1])/(box.max()[1] - box.min()[1])*num_cells);
+    cx = std::max(0, std::min(num_cells - 1, cx));
+    cy = std::max(0, std::min(num_cells - 1, cy));
+    cells[std::make_pair(cx, cy)].push_back(i);
+  }
+
+  fs::path out_path(opt.out_file);
+  std::string stem = out_path.stem().string();
+  std::ofstream kml(opt.out_file.c_str());
+  if (!kml.is_open())
+    vw_throw( IOErr() << "Unable to open output file: " << opt.out_file << "\n" );
+  kml << std::setprecision(12);
+  kml << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      << "<kml xmlns=\"http://www.opengis.net/kml/2.2\">\n"
+      << "<Document>\n  <name>orbitviz</name>\n";
+
+  double dx = (box.max()[0] - box.min()[0])/num_cells;
+  double dy = (box.max()[1] - box.min()[1])/num_cells;
+  for (std::map<std::pair<int, int>, std::vector<int> >::const_iterator it = cells.begin();
+       it != cells.end(); it++) {
+    std::ostringstream os;
+    os << stem << "_" << it->first.first << "_" << it->first.second << ".kml";
+    std::string cell_file = os.str();
+    write_cameras_kml((out_path.parent_path() / cell_file).string(), opt, it->second,
+                      positions, poses, names, matched_cameras);
+
+    double west  = box.min()[0] + dx*it->first.first,  east  = west  + dx;
+    double south = box.min()[1] + dy*it->first.second, north = south + dy;
+    kml << "  <NetworkLink>\n"
+        << "    <name>" << cell_file << "</name>\n"
+        << "    <Region>\n"
+        << "      <LatLonAltBox>\n"
+        << "        <north>" << north << "</north><south>" << south << "</south>\n"
+        << "        <east>"  << east  << "</east><west>"   << west  << "</west>\n"
+        << "        <minAltitude>" << box.min()[2] << "</minAltitude>"
+        << "<maxAltitude>" << box.max()[2] << "</maxAltitude>\n"
+        << "        <altitudeMode>absolute</altitudeMode>\n"
+        << "      </LatLonAltBox>\n"
+        << "      <Lod><minLodPixels>128</minLodPixels><maxLodPixels>-1</maxLodPixels></Lod>\n"
+        << "    </Region>\n"
+        << "    <Link><href>" << cell_file << "</href>"
+        << "<viewRefreshMode>onRegion</viewRefreshMode></Link>\n"
+        << "  </NetworkLink>\n";
+  }
+
+  kml << "</Document>\n</kml>\n";
+  kml.close();
+  vw_out() << "Split the cameras among " << cells.size() << " region files.\n";
+}
+
 void handle_arguments( int argc, char *argv[], Options& opt ) {
   po::options_description general_options("");
   general_options.add_options()
@@ -238,6 +375,10 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
           "Load the results from a run of the camera-solve tool. The only positional argument must be the path to the camera-solve output folder.")
     ("write-csv", po::bool_switch(&opt.write_csv)->default_value(false),
      "Write a csv file with the orbital data.")
+    ("max-cameras-per-file",    po::value(&opt.max_cameras_per_file)->default_value(0),
+     "If positive and there are more cameras than this, split them by location among "
+     "KML files with about this many each, loaded by the output file only when their "
+     "region is in view.")
     ("bundle-adjust-prefix",    po::value(&opt.bundle_adjust_prefix),
      "Use the camera adjustment obtained by previously running bundle_adjust with this output prefix.");
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
@@ -302,21 +443,6 @@ int main(int argc, char* argv[]) {
     // Prepare output directory
     vw::create_out_dir(opt.out_file);
     
-    // Create the KML file.
-    KMLFile kml( opt.out_file, "orbitviz" );
-
-    // Style listing
-    if ( opt.path_to_outside_model.empty() ) {
-      // Placemark Style
-      kml.append_style( "plane", "", 1.2,
-                        "http://maps.google.com/mapfiles/kml/shapes/airports.png", 
-                        opt.hide_labels);
-      kml.append_style( "plane_highlight", "", 1.4,
-                        "http://maps.google.com/mapfiles/kml/shapes/airports.png");
-      kml.append_stylemap( "camera_placemark", "plane",
-                           "plane_highlight" );
-    }
-
     // Load up the datum
     cartography::Datum datum(opt.datum);
     vw_out() << "Using datum: " << datum << std::endl;
@@ -334,6 +460,8 @@ int main(int argc, char* argv[]) {
 
     // Building Camera Models and then writing to KML
     std::vector<Vector3> camera_positions(num_cameras);
+    std::vector<Quat> camera_poses(num_cameras);
+    std::vector<std::string> display_names(num_cameras);
     for (size_t i=0; i < num_cameras; i++) {
       boost::shared_ptr<camera::CameraModel> current_camera;
 
@@ -370,40 +498,25 @@ int main(int argc, char* argv[]) {
                                 current_camera->camera_center(camera_pixel));
       camera_positions[i] = lon_lat_alt;
 
-      // Adding Placemarks
-      std::string display_name = strip_directory(image_files[i]);
-      if (!opt.path_to_outside_model.empty()) {
-        kml.append_model( opt.path_to_outside_model,
-                          lon_lat_alt.x(), lon_lat_alt.y(),
-                          inverse(current_camera->camera_pose(camera_pixel)),
-                          display_name, "",
-                          lon_lat_alt[2], opt.model_scale );
-      } else {
-        kml.append_placemark( lon_lat_alt.x(), lon_lat_alt.y(),
-                              display_name, "", "camera_placemark",
-                              lon_lat_alt[2], true );
-      }
-      
+      if (!opt.path_to_outside_model.empty())
+        camera_poses[i] = inverse(current_camera->camera_pose(camera_pixel));
+      display_names[i] = strip_directory(image_files[i]);
+
     } // End loop through cameras
 
-    // Draw lines between camera positions representing camera
-    //  pairs with match files.
-    const std::string style_id = "ip_match_style";
-    kml.append_line_style(style_id, "FF00FF00", 1.0); // Green line with default size
-    std::vector<Vector3> line_ends(2);
-    for (size_t i=0; i<matched_cameras.size(); ++i) {
-      line_ends[0] = camera_positions[i];
-      for (size_t j=0; j<matched_cameras[i].size(); ++j) {
-        int index = matched_cameras[i][j];
-        line_ends[1] = camera_positions[index];
-        kml.append_line(line_ends, "", style_id);
-      }
+    if (opt.max_cameras_per_file > 0 && (int)num_cameras > opt.max_cameras_per_file) {
+      write_camera_regions_kml(opt, camera_positions, camera_poses, display_names,
+                               matched_cameras);
+    } else {
+      std::vector<int> indices(num_cameras);
+      for (size_t i = 0; i < num_cameras; i++)
+        indices[i] = i;
+      write_cameras_kml(opt.out_file, opt, indices, camera_positions, camera_poses,
+                        display_names, matched_cameras);
     }
 
-
     // Put the Writing: messages here, so that they show up after all other info.
     vw_out() << "Writing: " << opt.out_file << std::endl; 
-    kml.close_kml();
 
     if (opt.write_csv){
       vw_out() << "Writing: " << csv_file << std::endl;
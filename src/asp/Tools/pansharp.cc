@@ -29,6 +29,7 @@ using namespace vw::cartography;
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/Trace.h>
 #include <asp/Camera/RPC_XML.h>
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
@@ -210,6 +211,170 @@ inline pansharp_view( ImageGrayT  const& gray_image,
 }
 
 
+/// Image view class which applies the same pan sharp algorithm as
+/// PanSharpView, but resamples the color image itself, with the gray
+/// pixels mapping to the color pixels by an affine transform, as is
+/// the case when the two georeferences have the same projection.
+/// - Each tile reads the region of the color image it needs once and
+///   then does the resampling, the color transforms, and the intensity
+///   swap in one pass along each row, on float buffers.
+/// - The results are the same as from geo_transform() with bilinear
+///   interpolation followed by PanSharpView.
+template <class ImageGrayT, class ImageColorT>
+class FusedPanSharpView : public ImageViewBase<FusedPanSharpView<ImageGrayT, ImageColorT> > {
+
+public: // Definitions
+
+  typedef PixelRGB<double> pixel_type;
+  typedef pixel_type       result_type;
+
+private: // Variables
+
+  ImageGrayT  m_gray_image;  // Masked gray image
+  ImageColorT m_color_image; // Unmasked color image, at its own resolution
+  double      m_color_nodata;
+  Matrix3x3   m_gray_to_color; // From gray to color pixels
+  double      m_output_nodata;
+  double      m_min_val;
+  double      m_max_val;
+
+public: // Functions
+
+  FusedPanSharpView( ImageGrayT  const& gray_image,
+                     ImageColorT const& color_image,
+                     double             color_nodata,
+                     Matrix3x3   const& gray_to_color,
+                     double             output_nodata,
+                     double             min_value,
+                     double             max_value)
+    : m_gray_image(gray_image), m_color_image(color_image),
+      m_color_nodata(color_nodata), m_gray_to_color(gray_to_color),
+      m_output_nodata(output_nodata), m_min_val(min_value), m_max_val(max_value) {}
+
+  inline int32 cols  () const { return m_gray_image.cols(); }
+  inline int32 rows  () const { return m_gray_image.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline result_type operator()( int32 i, int32 j, int32 p=0 ) const {
+    vw_throw(NoImplErr() << "FusedPanSharpView::operator()(...) is not implemented");
+    return result_type();
+  }
+
+  typedef ProceduralPixelAccessor<FusedPanSharpView<ImageGrayT, ImageColorT> > pixel_accessor;
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  typedef CropView<ImageView<result_type> > prerasterize_type;
+  inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+
+    asp::ScopedTrace trace("pansharp_tile", bbox);
+    trace.count("pixels", double(bbox.width())*bbox.height());
+
+    ImageView<result_type> tile(bbox.width(), bbox.height());
+    ImageView<typename ImageGrayT::pixel_type> gray_tile = crop(m_gray_image, bbox);
+
+    // The region of the color image seen by the tile, with a pixel
+    // more on each side for the interpolation
+    Matrix3x3 const& A = m_gray_to_color;
+    BBox2 color_box;
+    for (int k = 0; k < 4; k++) {
+      double c = (k % 2 == 0) ? bbox.min().x() : bbox.max().x();
+      double r = (k / 2 == 0) ? bbox.min().y() : bbox.max().y();
+      color_box.grow(Vector2(A(0,0)*c + A(0,1)*r + A(0,2),
+                             A(1,0)*c + A(1,1)*r + A(1,2)));
+    }
+    BBox2i color_crop(Vector2i(floor(color_box.min().x()) - 1, floor(color_box.min().y()) - 1),
+                      Vector2i(ceil (color_box.max().x()) + 2, ceil (color_box.max().y()) + 2));
+    color_crop.crop(bounding_box(m_color_image));
+
+    // Read the color region once, splitting the channels so the inner
+    // loops are over contiguous floats. A color pixel is invalid if all
+    // its channels are the nodata value, as with create_mask().
+    int ccols = color_crop.width(), crows = color_crop.height();
+    std::vector<float> red(ccols*crows), green(ccols*crows), blue(ccols*crows);
+    std::vector<uint8> color_valid(ccols*crows);
+    if (!color_crop.empty()) {
+      ImageView<typename ImageColorT::pixel_type> color_tile = crop(m_color_image, color_crop);
+      for (int r = 0; r < crows; r++) {
+        for (int c = 0; c < ccols; c++) {
+          typename ImageColorT::pixel_type const& pix = color_tile(c, r);
+          int k = r*ccols + c;
+          red  [k] = pix[0];
+          green[k] = pix[1];
+          blue [k] = pix[2];
+          color_valid[k] = !(double(pix[0]) == m_color_nodata &&
+                             double(pix[1]) == m_color_nodata &&
+                             double(pix[2]) == m_color_nodata);
+        }
+      }
+    }
+
+    const float min_val = m_min_val, max_val = m_max_val;
+    const float mean_val = (m_min_val + m_max_val + 1) / 2.0;
+
+    int wid = bbox.width();
+    std::vector<float> y_row(wid), r_row(wid), g_row(wid), b_row(wid);
+    std::vector<uint8> valid_row(wid);
+    for (int r = 0; r < bbox.height(); r++) {
+
+      // Bilinear interpolation of the color image. As with the masked
+      // interpolation in geo_transform(), the result is invalid unless
+      // all four of the neighbors are valid.
+      double row = r + bbox.min().y();
+      double x = A(0,0)*bbox.min().x() + A(0,1)*row + A(0,2) - color_crop.min().x();
+      double y = A(1,0)*bbox.min().x() + A(1,1)*row + A(1,2) - color_crop.min().y();
+      for (int c = 0; c < wid; c++, x += A(0,0), y += A(1,0)) {
+        valid_row[c] = 0;
+        if (!is_valid(gray_tile(c, r)))
+          continue;
+        int x0 = int(floor(x)), y0 = int(floor(y));
+        if (x0 < 0 || y0 < 0 || x0 + 1 >= ccols || y0 + 1 >= crows)
+          continue;
+        int k = y0*ccols + x0;
+        if (!color_valid[k] || !color_valid[k+1] ||
+            !color_valid[k+ccols] || !color_valid[k+ccols+1])
+          continue;
+        float wx = x - x0, wy = y - y0;
+        float w00 = (1-wx)*(1-wy), w10 = wx*(1-wy), w01 = (1-wx)*wy, w11 = wx*wy;
+        r_row[c] = w00*red  [k] + w10*red  [k+1] + w01*red  [k+ccols] + w11*red  [k+ccols+1];
+        g_row[c] = w00*green[k] + w10*green[k+1] + w01*green[k+ccols] + w11*green[k+ccols+1];
+        b_row[c] = w00*blue [k] + w10*blue [k+1] + w01*blue [k+ccols] + w11*blue [k+ccols+1];
+        y_row[c] = gray_tile(c, r)[0];
+        valid_row[c] = 1;
+      }
+
+      // Convert to YCbCr, replace Y with the gray value, and convert
+      // back, as in rgbToYCbCr() and ycbcrToRgb(). A branch-free loop,
+      // so the compiler can vectorize it.
+      for (int c = 0; c < wid; c++) {
+        float cb = mean_val - 0.168736f*r_row[c] - 0.331264f*g_row[c] + 0.5f     *b_row[c];
+        float cr = mean_val + 0.5f     *r_row[c] - 0.418688f*g_row[c] - 0.081312f*b_row[c];
+        cb = std::min(std::max(cb, min_val), max_val) - mean_val;
+        cr = std::min(std::max(cr, min_val), max_val) - mean_val;
+        float yv = y_row[c];
+        r_row[c] = std::min(std::max(yv + 1.402f  *cr,                  min_val), max_val);
+        g_row[c] = std::min(std::max(yv - 0.34414f*cb - 0.71414f*cr,    min_val), max_val);
+        b_row[c] = std::min(std::max(yv + 1.772f  *cb,                  min_val), max_val);
+      }
+
+      for (int c = 0; c < wid; c++) {
+        if (valid_row[c])
+          tile(c, r) = result_type(r_row[c], g_row[c], b_row[c]);
+        else
+          tile(c, r) = result_type(m_output_nodata, m_output_nodata, m_output_nodata);
+      }
+    }
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+    vw::rasterize( prerasterize(bbox), dest, bbox );
+  }
+
+}; // End class FusedPanSharpView
+
+
 
 //-------------------------------------------------------------------------------------
 
@@ -222,6 +387,7 @@ struct Options : vw::cartography::GdalWriteOptions {
   double nodata_value,
          min_value,
          max_value;
+  int    tile_size;
   bool has_nodata;
 };
 
@@ -240,7 +406,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("color-xml", po::value(&opt.color_xml_file)->default_value(""),
              "Path to a WV XML file for the color image.  Can be used to obtain the geo data.")
     ("nodata-value", po::value(&opt.nodata_value)->default_value(DEFAULT_NODATA),
-             "The no-data value to use, unless present in the color image header.");
+             "The no-data value to use, unless present in the color image header.")
+    ("tile-size", po::value(&opt.tile_size)->default_value(0),
+             "Process the images in square tiles of this size. If not set, use the largest tiles, up to 2048 pixels, for which the buffers of all threads fit within the cache size.");
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
   po::options_description positional("");
@@ -270,6 +438,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if (opt.min_value > opt.max_value)
     vw_throw( ArgumentErr() << "The minimum value cannot be greater than the maximum value!\n\n");
 
+  if (opt.tile_size < 0)
+    vw_throw( ArgumentErr() << "The tile size must be non-negative.\n\n");
+
   // Determine if the user entered a nodata value
   opt.has_nodata = vm.count("output-nodata-value");
 
@@ -277,6 +448,54 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 }
 
 
+/// Find the affine transform from the pixels of the cropped gray
+/// image to the pixels of the color image. Return false if the two
+/// images do not have the same projection, or the transform is not
+/// affine within a hundredth of a pixel.
+bool find_gray_to_color_transform(GeoReference const& gray_georef,
+                                  GeoReference const& color_georef,
+                                  Vector2      const& gray_offset,
+                                  Vector2i     const& gray_size,
+                                  Matrix3x3         & gray_to_color) {
+
+  if (gray_georef.proj4_str() != color_georef.proj4_str())
+    return false;
+
+  double wid = std::max(gray_size.x(), 1), hgt = std::max(gray_size.y(), 1);
+  Vector2 origin = color_georef.point_to_pixel(gray_georef.pixel_to_point(gray_offset));
+  Vector2 xdir   = (color_georef.point_to_pixel(gray_georef.pixel_to_point
+                                                (gray_offset + Vector2(wid, 0))) - origin)/wid;
+  Vector2 ydir   = (color_georef.point_to_pixel(gray_georef.pixel_to_point
+                                                (gray_offset + Vector2(0, hgt))) - origin)/hgt;
+  gray_to_color.set_identity();
+  gray_to_color(0,0) = xdir.x(); gray_to_color(0,1) = ydir.x(); gray_to_color(0,2) = origin.x();
+  gray_to_color(1,0) = xdir.y(); gray_to_color(1,1) = ydir.y(); gray_to_color(1,2) = origin.y();
+
+  // Check the transform at the center and the far corner
+  for (int k = 1; k <= 2; k++) {
+    Vector2 pix(k*wid/2.0, k*hgt/2.0);
+    Vector2 exact  = color_georef.point_to_pixel(gray_georef.pixel_to_point(gray_offset + pix));
+    Vector2 approx = origin + pix.x()*xdir + pix.y()*ydir;
+    if (norm_2(exact - approx) > 0.01)
+      return false;
+  }
+  return true;
+}
+
+/// The largest tile size, a multiple of 256 up to 2048, for which the
+/// tile buffers of all threads fit within the cache size. Each output
+/// pixel needs the double output, the masked gray input, and the float
+/// buffers of a row and of the color region.
+int pansharp_tile_size(double color_to_gray_area) {
+  const double bytes_per_pixel = sizeof(PixelRGB<double>) + sizeof(PixelMask<PixelGray<double> >)
+    + 4*sizeof(float) + color_to_gray_area*(3*sizeof(float) + 1 + sizeof(PixelRGB<double>));
+  double budget = double(vw_settings().system_cache_size()) / vw_settings().default_num_threads();
+  int tile_size = 256;
+  while (tile_size < 2048 && std::pow(tile_size + 256.0, 2) * bytes_per_pixel <= budget)
+    tile_size += 256;
+  return tile_size;
+}
+
 /// Load and process the images with the correct data type
 template <typename T>
 void load_inputs_and_process(Options           & opt,
@@ -323,7 +542,44 @@ void load_inputs_and_process(Options           & opt,
   // WorldView convention is to mask <= a value, but this may not be a universal standard!
   // - create_mask_less_or_equal seems to break on PixelRGB types.
 
+  // When the gray pixels map to the color pixels by an affine
+  // transform, resample the color image per tile in the pansharp
+  // view itself rather than per pixel through geo_transform().
+  Vector2   gray_offset(int32(crop_box.min().x()), int32(crop_box.min().y()));
+  Vector2i  gray_size(int32(crop_box.width()), int32(crop_box.height()));
+  Matrix3x3 gray_to_color;
+  bool fused = find_gray_to_color_transform(gray_georef, color_georef, gray_offset,
+                                            gray_size, gray_to_color);
+
+  int tile_size = opt.tile_size;
+  if (tile_size == 0) {
+    double color_to_gray_area = 1.0;
+    if (fused)
+      color_to_gray_area = std::abs(gray_to_color(0,0)*gray_to_color(1,1) -
+                                    gray_to_color(0,1)*gray_to_color(1,0));
+    tile_size = pansharp_tile_size(color_to_gray_area);
+  }
+  opt.raster_tile_size = Vector2i(tile_size, tile_size);
+  vw_out() << "Using tile size: " << tile_size << std::endl;
+
   vw_out() << "Writing: " << opt.output_file << std::endl;
+  if (fused) {
+    block_write_gdal_image(opt.output_file,
+                           pixel_cast<PixelRGBMask>
+                           (FusedPanSharpView<ImageViewRef<PixelMask<PixelGray<double> > >,
+                                              DiskImageView<PixelRGB<T> > >
+                            (crop(create_mask_less_or_equal(pixel_cast<double>(gray_img),
+                                                            gray_nodata),
+                                  crop_box),
+                             color_img, color_nodata, gray_to_color,
+                             opt.nodata_value, opt.min_value, opt.max_value)),
+                           true, gray_georef,
+                           opt.has_nodata, opt.nodata_value,
+                           opt,
+                           TerminalProgressCallback("pansharp","\t--> Writing:"));
+    return;
+  }
+
   vw::cartography::block_write_gdal_image( opt.output_file,
                                // The final output image is set up in these few lines:
                                pixel_cast<PixelRGBMask>
@@ -47,6 +47,7 @@
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Math.h>
 #include <vw/Image.h>
@@ -61,6 +62,7 @@
 #include <liblas/liblas.hpp>
 
 #include <limits>
+#include <set>
 #include <cstring>
 
 #include <pointmatcher/PointMatcher.h>
@@ -68,6 +70,7 @@
 #include <ceres/loss_function.h>
 
 #include <asp/Tools/pc_align_utils.h>
+#include <asp/Tools/pc_align_icp.h>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
@@ -99,11 +102,14 @@ namespace vw {
 struct Options : public vw::cartography::GdalWriteOptions {
   // Input
   string reference, source, init_transform_file, alignment_method, config_file,
-    datum, csv_format_str, csv_proj4_str, match_file;
+    datum, csv_format_str, csv_proj4_str, match_file, icp_engine, source_list;
+  std::vector<std::string> batch_sources; // read from source_list
   PointMatcher<RealT>::Matrix init_transform;
   int    num_iter,
          max_num_reference_points,
-         max_num_source_points;
+         max_num_source_points,
+         num_parallel_sources,
+         num_icp_levels;
   double diff_translation_err,
          diff_rotation_err,
          max_disp,
@@ -148,7 +154,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("max-num-source-points",    po::value(&opt.max_num_source_points)->default_value(100000),
                                  "Maximum number of (randomly picked) source points to use (after discarding gross outliers).")
     ("alignment-method",         po::value(&opt.alignment_method)->default_value("point-to-plane"),
-                                 "The type of iterative closest point method to use. [point-to-plane, point-to-point, similarity-point-to-point, least-squares, similarity-least-squares]")
+                                 "The type of iterative closest point method to use. [point-to-plane, point-to-point, similarity-point-to-point, least-squares, similarity-least-squares, point-to-dem]")
+    ("icp-engine",               po::value(&opt.icp_engine)->default_value("libpointmatcher"),
+                                 "The implementation of iterative closest point to use. [libpointmatcher, native] The native one keeps the reference points in single precision in a KD-tree built with multiple threads, and is faster and uses less memory for large reference clouds.")
+    ("num-icp-levels",           po::value(&opt.num_icp_levels)->default_value(1),
+                                 "With the native ICP engine, align first a decimated source, then one with 4 times more points, and so on, this many times, ending with all of the source points. The coarser levels use more of the matches. Helps with large initial offsets.")
     ("highest-accuracy",         po::bool_switch(&opt.highest_accuracy)->default_value(false)->implicit_value(true),
                                  "Compute with highest accuracy for point-to-plane (can be much slower).")
     ("csv-format",               po::value(&opt.csv_format_str)->default_value(""), asp::csv_opt_caption().c_str())
@@ -176,6 +186,10 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 
     ("match-file", po::value(&opt.match_file)->default_value(""),
      "Compute a translation + rotation + scale transform from the source to the reference point cloud using manually selected point correspondences (obtained for example using stereo_gui).")
+    ("source-list",              po::value(&opt.source_list)->default_value(""),
+     "Align to the reference each of the source clouds listed in this file, one per line, instead of a single source. The reference is loaded and indexed only once. The outputs for each source have the given output prefix followed by a dash and the name of the source without the extension. Needs --icp-engine native, unless the alignment method is point-to-dem.")
+    ("num-parallel-sources",     po::value(&opt.num_parallel_sources)->default_value(4),
+     "With --source-list, how many sources to align at the same time. The threads are shared among them.")
     ("config-file",              po::value(&opt.config_file)->default_value(""),
      "This is an advanced option. Read the alignment parameters from a configuration file, in the format expected by libpointmatcher, over-riding the command-line options.");
 
@@ -201,6 +215,27 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
                              positional, positional_desc, usage,
                              allow_unregistered, unregistered );
 
+  // Read the sources to align in batch, if any
+  if (opt.source_list != "") {
+    if (!opt.source.empty())
+      vw_throw( ArgumentErr() << "Cannot specify both a source cloud and a source list.\n"
+                              << usage << general_options );
+    std::ifstream ifs(opt.source_list.c_str());
+    if (!ifs.good())
+      vw_throw( ArgumentErr() << "Cannot open source list: " << opt.source_list << "\n" );
+    std::string line;
+    while (std::getline(ifs, line)) {
+      boost::algorithm::trim(line);
+      if (line.empty() || line[0] == '#')
+        continue;
+      opt.batch_sources.push_back(line);
+    }
+    if (opt.batch_sources.empty())
+      vw_throw( ArgumentErr() << "No sources were found in: " << opt.source_list << "\n" );
+    // The first source is used in finding the datum
+    opt.source = opt.batch_sources[0];
+  }
+
   if ( opt.reference.empty() || opt.source.empty() )
     vw_throw( ArgumentErr() << "Missing input files.\n" << usage << general_options );
 
@@ -271,19 +306,62 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
       opt.alignment_method != "point-to-point"            &&
       opt.alignment_method != "similarity-point-to-point" &&
       opt.alignment_method != "least-squares"             &&
-      opt.alignment_method != "similarity-least-squares"
+      opt.alignment_method != "similarity-least-squares"  &&
+      opt.alignment_method != "point-to-dem"
       )
     vw_throw( ArgumentErr() << "Only the following alignment methods are supported: "
 	      << "point-to-plane, point-to-point, similarity-point-to-point, "
-	      << "least-squares, and similarity-least-squares.\n"
+	      << "least-squares, similarity-least-squares, and point-to-dem.\n"
 	      << usage << general_options );
 
+  if (opt.icp_engine != "libpointmatcher" && opt.icp_engine != "native")
+    vw_throw( ArgumentErr() << "Only the following ICP engines are supported: "
+	      << "libpointmatcher and native.\n"
+	      << usage << general_options );
+
+  if (opt.icp_engine == "native" && opt.config_file != "")
+    vw_throw( ArgumentErr() << "A libpointmatcher configuration file cannot be "
+	      << "used with the native ICP engine.\n" );
+
+  if (opt.num_icp_levels <= 0)
+    vw_throw( ArgumentErr() << "The number of ICP levels must be positive.\n" );
+  if (opt.num_icp_levels > 1 && opt.icp_engine != "native")
+    vw_throw( ArgumentErr() << "More than one ICP level needs --icp-engine native.\n" );
+
   if ( (opt.alignment_method == "least-squares" ||
 	opt.alignment_method == "similarity-least-squares")
        && asp::get_cloud_type(opt.reference) != "DEM")
     vw_throw( ArgumentErr()
 	      << "Least squares alignment can be used only when the "
 	      << "reference cloud is a DEM.\n" );
+
+  if (opt.alignment_method == "point-to-dem" && !opt.use_dem_distances())
+    vw_throw( ArgumentErr()
+	      << "Point-to-DEM alignment can be used only when the "
+	      << "reference cloud is a DEM, and without --no-dem-distances.\n" );
+
+  if (!opt.batch_sources.empty()) {
+    // Only the native tree and the DEM can be searched by several
+    // alignments at the same time.
+    if (opt.icp_engine != "native" && opt.alignment_method != "point-to-dem")
+      vw_throw( ArgumentErr() << "A source list needs --icp-engine native, unless "
+                << "the alignment method is point-to-dem.\n" );
+    if (opt.match_file != "" || opt.save_trans_ref)
+      vw_throw( ArgumentErr() << "A source list cannot be used with --match-file or "
+                << "--save-inv-transformed-reference-points.\n" );
+    if (opt.num_parallel_sources <= 0)
+      vw_throw( ArgumentErr() << "The number of parallel sources must be positive.\n" );
+
+    // Each source writes its files with its own prefix
+    std::set<std::string> names;
+    for (size_t i = 0; i < opt.batch_sources.size(); i++) {
+      std::string name = fs::path(opt.batch_sources[i]).stem().string();
+      if (!names.insert(name).second)
+        vw_throw( ArgumentErr() << "The sources in the list must have distinct names, "
+                  << "without the extension, as these are used in the output names. "
+                  << "Repeated: " << name << "\n" );
+    }
+  }
 }
 
 /// Try to read the georef/datum info, need it to read CSV files.
@@ -359,6 +437,19 @@ void read_georef(Options& opt, asp::CsvConv& csv_conv, GeoReference& geo){
     }
   }
 
+  // Binary clouds keep the georef in their header
+  std::string files[] = {opt.reference, opt.source};
+  for (int i = 0; i < 2; i++){
+    if ( asp::get_cloud_type(files[i]) != "BINARY" )
+      continue;
+    asp::BinaryCloudReader reader(files[i]);
+    if (reader.has_georef()){
+      geo = reader.georef();
+      vw_out() << "Detected datum from " << files[i] << ":\n" << geo.datum() << std::endl;
+      is_good = true;
+    }
+  }
+
   // We should have read in the datum from an input file, but check to see if
   //  we should override it with input parameters.
 
@@ -754,6 +845,140 @@ least_squares_alignment(DP & source_point_cloud, // Should not be modified
   return T;
 }
 
+/// The point on the reference DEM at the location of the given point,
+/// and the DEM normal there, from the DEM heights at that pixel and at
+/// the next column and row. All are in planet-centered coordinates.
+/// Return false if outside the DEM or at no-data.
+bool dem_point_and_normal(Vector3 const& gcc_coord,
+                          vw::cartography::GeoReference        const& dem_georef,
+                          vw::ImageViewRef< PixelMask<float> > const& dem,
+                          Vector3 & dem_point, Vector3 & normal) {
+
+  Vector3 llh = dem_georef.datum().cartesian_to_geodetic(gcc_coord);
+  Vector2 pix;
+  try {
+    pix = dem_georef.lonlat_to_pixel(subvector(llh, 0, 2));
+  }catch(...){
+    return false;
+  }
+
+  Vector2 offsets[] = {Vector2(0, 0), Vector2(1, 0), Vector2(0, 1)};
+  Vector3 xyz[3];
+  for (int k = 0; k < 3; k++) {
+    Vector2 curr_pix = pix + offsets[k];
+    double c = curr_pix[0], r = curr_pix[1];
+    if (c < 0 || c >= dem.cols()-1 || r < 0 || r >= dem.rows()-1)
+      return false;
+    PixelMask<float> h = dem(c, r);
+    if (!is_valid(h))
+      return false;
+    Vector2 lonlat = dem_georef.pixel_to_lonlat(curr_pix);
+    xyz[k] = dem_georef.datum().geodetic_to_cartesian(Vector3(lonlat[0], lonlat[1], h.child()));
+  }
+
+  dem_point = xyz[0];
+  normal    = cross_prod(xyz[1] - xyz[0], xyz[2] - xyz[0]);
+  double len = norm_2(normal);
+  if (len == 0)
+    return false;
+  normal /= len;
+  return true;
+}
+
+/// Point-to-plane ICP where the reference point and normal matching
+/// each source point are found directly from the reference DEM grid,
+/// rather than from a tree of reference points. Only the DEM tiles
+/// under the source points are read.
+PointMatcher<RealT>::Matrix
+point_to_dem_alignment(DP const& source_point_cloud,
+                       vw::Vector3 const& point_cloud_shift,
+                       vw::cartography::GeoReference        const& dem_georef,
+                       vw::ImageViewRef< PixelMask<float> > const& dem_ref,
+                       Options const& opt) {
+
+  const int num_pts = source_point_cloud.features.cols();
+  PointMatcher<RealT>::Matrix T = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
+
+  std::string iteration_file = opt.out_prefix + "-iterationInfo.csv";
+  ofstream ofs(iteration_file.c_str());
+  ofs << "# iteration, number of inliers, mean inlier error, "
+      << "rotation change (radians), translation change\n";
+
+  double diff_rot_err = (2.0*M_PI/360.0)*opt.diff_rotation_err; // convert to radians
+  std::vector<Eigen::Vector3d> src(num_pts), ref(num_pts), normals(num_pts);
+  std::vector<double> dists(num_pts), sorted_dists;
+  std::vector<int> valid;
+  for (int iter = 0; iter < opt.num_iter; iter++) {
+
+    Eigen::Matrix3d R = T.block(0, 0, DIM, DIM);
+    Eigen::Vector3d t = T.block(0, DIM, DIM, 1);
+
+    // Match each point with the DEM point at the same location
+    valid.clear();
+    for (int col = 0; col < num_pts; col++) {
+      src[col] = R*source_point_cloud.features.block(0, col, DIM, 1) + t;
+      Vector3 gcc_coord(src[col][0] + point_cloud_shift[0],
+                        src[col][1] + point_cloud_shift[1],
+                        src[col][2] + point_cloud_shift[2]);
+      Vector3 dem_point, normal;
+      if (!dem_point_and_normal(gcc_coord, dem_georef, dem_ref, dem_point, normal))
+        continue;
+      dem_point -= point_cloud_shift;
+      ref    [col] = Eigen::Vector3d(dem_point[0], dem_point[1], dem_point[2]);
+      normals[col] = Eigen::Vector3d(normal[0], normal[1], normal[2]);
+      dists  [col] = std::abs((src[col] - ref[col]).dot(normals[col]));
+      valid.push_back(col);
+    }
+    if (valid.empty())
+      vw_throw( ArgumentErr() << "No source points are above the reference DEM.\n");
+
+    // Keep only the closest matches
+    sorted_dists.clear();
+    for (size_t k = 0; k < valid.size(); k++)
+      sorted_dists.push_back(dists[valid[k]]);
+    int num_inliers = std::max(1, (int)round(opt.outlier_ratio*sorted_dists.size()));
+    num_inliers = std::min(num_inliers, (int)sorted_dists.size());
+    std::nth_element(sorted_dists.begin(), sorted_dists.begin() + num_inliers - 1,
+                     sorted_dists.end());
+    double max_dist = sorted_dists[num_inliers - 1];
+
+    std::vector<Eigen::Vector3d> p, q, n;
+    double mean_err = 0.0;
+    for (size_t k = 0; k < valid.size(); k++) {
+      int col = valid[k];
+      if (dists[col] > max_dist)
+        continue;
+      p.push_back(src[col]);
+      q.push_back(ref[col]);
+      n.push_back(normals[col]);
+      mean_err += dists[col];
+    }
+    mean_err /= p.size();
+
+    Eigen::Matrix3d dR;
+    Eigen::Vector3d dT;
+    asp::point_to_plane_update(p, q, n, opt.compute_translation_only, dR, dT);
+
+    PointMatcher<RealT>::Matrix dM = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
+    dM.block(0, 0, DIM, DIM) = dR;
+    dM.block(0, DIM, DIM, 1) = dT;
+    T = dM*T;
+
+    double rot_change, trans_change;
+    asp::transform_change(dR, dT, rot_change, trans_change);
+    ofs << iter << ", " << p.size() << ", " << mean_err << ", "
+        << rot_change << ", " << trans_change << "\n";
+
+    if (iter == opt.num_iter - 1 || 
+        (rot_change < diff_rot_err && trans_change < opt.diff_translation_err)) {
+      vw_out() << "Match ratio: " << double(p.size())/num_pts << endl;
+      break;
+    }
+  }
+
+  return T;
+}
+
 /// Filters out all points from point_cloud with an error entry higher than cutoff
 void filterPointsByError(DP & point_cloud, PointMatcher<RealT>::Matrix &errors, double cutoff) {
 
@@ -814,6 +1039,7 @@ void update_best_error(std::vector<double>         const& dem_errors,
 double compute_registration_error(DP          const& ref_point_cloud,
                                   DP               & source_point_cloud, // Should not be modified
                                   PM::ICP          & pm_icp_object, // Must already be initialized
+                                  asp::PointKdTree const* native_tree, // used instead if not NULL
                                   vw::Vector3 const& shift,
                                   vw::cartography::GeoReference        const& dem_georef,
                                   vw::ImageViewRef< PixelMask<float> > const& dem_ref,
@@ -822,10 +1048,24 @@ double compute_registration_error(DP          const& ref_point_cloud,
   Stopwatch sw;
   sw.start();
 
+  if (opt.alignment_method == "point-to-dem") {
+    // There is no reference cloud, only the DEM
+    std::vector<double> dem_errors;
+    calcErrorsWithDem(source_point_cloud, shift, dem_georef, dem_ref, dem_errors);
+    error_matrix.resize(1, dem_errors.size());
+    for (size_t col = 0; col < dem_errors.size(); col++)
+      error_matrix(0, col) = dem_errors[col];
+    sw.stop();
+    return sw.elapsed_seconds();
+  }
+
   // Always start by computing the error using LPM
   // Use a big number to make sure no points are filtered!
-  pm_icp_object.filterGrossOutliersAndCalcErrors(ref_point_cloud, BIG_NUMBER,
-                                                 source_point_cloud, error_matrix);
+  if (native_tree != NULL)
+    asp::icp_errors(*native_tree, source_point_cloud.features, error_matrix);
+  else
+    pm_icp_object.filterGrossOutliersAndCalcErrors(ref_point_cloud, BIG_NUMBER,
+                                                   source_point_cloud, error_matrix);
 
   if (opt.use_dem_distances()) {
     // Compute the distance from each point to the DEM
@@ -848,6 +1088,7 @@ double compute_registration_error(DP          const& ref_point_cloud,
 void filter_source_cloud(DP          const& ref_point_cloud,
                          DP               & source_point_cloud,
                          PM::ICP          & pm_icp_object, // Must already be initialized
+                         asp::PointKdTree const* native_tree, // used instead if not NULL
                          vw::Vector3 const& shift,
                          vw::cartography::GeoReference        const& dem_georef,
                          vw::ImageViewRef< PixelMask<float> > const& dem_ref,
@@ -864,10 +1105,15 @@ void filter_source_cloud(DP          const& ref_point_cloud,
   try {
     if (opt.use_dem_distances()) {
       // Compute the registration error using the best available means
-      compute_registration_error(ref_point_cloud, source_point_cloud, pm_icp_object, shift,
-                                 dem_georef, dem_ref, opt, error_matrix);
+      compute_registration_error(ref_point_cloud, source_point_cloud, pm_icp_object,
+                                 native_tree, shift, dem_georef, dem_ref, opt, error_matrix);
 
       filterPointsByError(source_point_cloud, error_matrix, opt.max_disp);
+    } else if (native_tree != NULL) {
+      asp::icp_errors(*native_tree, source_point_cloud.features, error_matrix);
+      filterPointsByError(source_point_cloud, error_matrix, opt.max_disp);
+      if (source_point_cloud.features.cols() == 0)
+        vw_throw( ArgumentErr() << "Error: No points left in source cloud after filtering.\n");
     } else { // LPM only method
         // Points in source_point_cloud further than opt.max_disp from ref_point_cloud are deleted!
         pm_icp_object.filterGrossOutliersAndCalcErrors(ref_point_cloud, opt.max_disp,
@@ -904,7 +1150,8 @@ Eigen::Vector3d vw_vector3_to_eigen(vw::Vector3 const& vw_vector) {
 
 // Need this to placate libpointmatcher.
 std::string alignment_method_fallback(std::string const& alignment_method){
-  if (alignment_method == "least-squares" || alignment_method == "similarity-least-squares") 
+  if (alignment_method == "least-squares" || alignment_method == "similarity-least-squares" ||
+      alignment_method == "point-to-dem") 
     return "point-to-plane";
   return alignment_method;
 }
@@ -1034,6 +1281,426 @@ PointMatcher<RealT>::Matrix ned_to_caresian_transform(vw::cartography::Datum con
   return T;
 }
 
+/// The reference points, indexed, and the reference DEM, if any. These
+/// are loaded once and then only read when aligning the sources.
+struct ReferenceData {
+  DP      point_cloud;         // Emptied when the native tree is built
+  PM::ICP icp;                 // Has the libpointmatcher tree
+  asp::PointKdTree native_tree;
+  asp::PointKdTree const* native_tree_ptr; // Set if the native tree is used
+  Vector3 shift;               // Subtracted from all loaded points
+  bool    is_lola_rdr_format;
+  cartography::GeoReference dem_georef;
+  vw::ImageViewRef< PixelMask<float> > dem;
+  ReferenceData(): native_tree_ptr(NULL), is_lola_rdr_format(false) {}
+};
+
+/// Intersect the lon-lat box of the reference points with the one of
+/// the source points. Return the intersection adjusted to each of
+/// them, as we will use ref_box to bound the source points, and
+/// vice-versa.
+void intersect_lonlat_boxes(Options const& opt, GeoReference const& geo,
+                            asp::CsvConv const& csv_conv, int num_sample_pts,
+                            BBox2 const& full_ref_box, std::string const& source,
+                            BBox2 & ref_box, BBox2 & source_box) {
+  ref_box    = full_ref_box;
+  source_box = calc_extended_lonlat_bbox(geo, num_sample_pts, csv_conv,
+                                         source, opt.max_disp);
+
+  // When boxes are huge, it is hard to do the optimization of intersecting
+  // them, as they may differ not by 0 or 360, but by 180. Better do nothing
+  // in that case. The solution may degrade a bit, as we may load points
+  // not in the intersection of the boxes, but at least it won't be wrong.
+  // In this case, there is a chance the boxes were computed wrong anyway.
+  if (ref_box.width() > 180.0 || source_box.width() > 180.0) {
+    vw_out() << "Warning: Your input point clouds are spread over more than half the planet. "
+             << "It is suggested that they be cropped, to get more accurate results.\n";
+    ref_box = BBox2();
+    source_box = BBox2();
+  }
+
+  vw_out() << "Reference box: " << ref_box << std::endl;
+  vw_out() << "Source box:    " << source_box << std::endl;
+
+  // If ref points are offset by 360 degrees in longitude in respect
+  // to source points, adjust the ref box to be aligned with the
+  // source points, and vice versa.  Note that we will use the ref
+  // box to bound the source points, and vice-versa.
+  double lon_offset = 0.0;
+  if (!ref_box.empty() && !source_box.empty()){
+    // Compute the longitude offset
+    double source_mean_lon = (source_box.min().x() + source_box.max().x())/2.0;
+    double ref_mean_lon    = (ref_box.min().x()    + ref_box.max().x()   )/2.0;
+    lon_offset = source_mean_lon - ref_mean_lon;
+    lon_offset = 360.0*round(lon_offset/360.0);
+    // Apply to both bounding boxes
+    ref_box    += Vector2(lon_offset, 0);
+    // Intersect them, as pc_align will operate on their common area
+    ref_box.crop(source_box);
+    source_box.crop(ref_box); // common area
+    source_box -= Vector2(lon_offset, 0);
+
+    // Extra adjustments. These are needed since pixel_to_lonlat and
+    // cartesian_to_geodetic can disagree by 360 degress. Adjust ref
+    // to source and vice-versa.
+    adjust_lonlat_bbox(opt.reference, source_box);
+    adjust_lonlat_bbox(source, ref_box);
+  }
+  vw_out() << "Intersection:  " << ref_box << std::endl;
+}
+
+/// Load the reference points within the given box, shifted to have
+/// their centroid at the origin, and index them. Load the reference
+/// DEM if it is used for distances.
+void load_reference(Options const& opt, BBox2 const& source_box,
+                    GeoReference const& geo, asp::CsvConv const& csv_conv,
+                    ReferenceData & ref) {
+
+  // With point-to-dem alignment only the reference DEM is used,
+  // not its points, and the shift is found from the source points.
+  bool dem_only = (opt.alignment_method == "point-to-dem");
+
+  if (!dem_only) {
+    // Load the subsampled reference point cloud.
+    Stopwatch sw1;
+    sw1.start();
+    bool   calc_shift = true; // Shift points so the first point is (0,0,0)
+    double mean_ref_longitude = 0.0; // may get overwritten
+    load_cloud(opt.reference, opt.max_num_reference_points,
+               source_box, // source box is used to bound reference
+               calc_shift, ref.shift, geo, csv_conv, ref.is_lola_rdr_format,
+               mean_ref_longitude, opt.verbose, ref.point_cloud);
+    sw1.stop();
+    if (opt.verbose)
+      vw_out() << "Loading the reference point cloud took "
+               << sw1.elapsed_seconds() << " [s]" << endl;
+
+    // So far we shifted by the first point in the reference point cloud
+    // to reduce the magnitude of all loaded points. Shift one more time,
+    // to place the centroid of the reference at the origin. The source
+    // points will be loaded with the same shift.
+    // Note: If this code is ever converting to using floats,
+    // the operation below needs to be re-implemented to be accurate.
+    int numRefPts = ref.point_cloud.features.cols();
+    Eigen::VectorXd meanRef = ref.point_cloud.features.rowwise().sum() / numRefPts;
+    ref.point_cloud.features.topRows(DIM).colwise() -= meanRef.head(DIM);
+    for (int row = 0; row < DIM; row++)
+      ref.shift[row] += meanRef(row); // Update the shift variable as well as the points
+  }
+
+  // If the reference point cloud came from a DEM, also load the data in DEM format.
+  if (opt.use_dem_distances()) {
+    vw_out() << "Loading reference as DEM." << endl;
+    // Load the dem, then wrap it inside an ImageViewRef object.
+    // - This is done because the actual DEM type cannot be created without being initialized.
+    InterpolationReadyDem reference_dem(load_interpolation_ready_dem(opt.reference,
+                                                                     ref.dem_georef));
+    ref.dem.reset(reference_dem);
+  }
+
+  // Initialize the reference tree
+  Stopwatch sw3;
+  if (opt.verbose && !dem_only)
+    vw_out() << "Building the reference cloud tree." << endl;
+  sw3.start();
+  if (dem_only) {
+    // No tree is needed
+  } else if (opt.icp_engine == "native") {
+    ref.native_tree.build(ref.point_cloud.features);
+    ref.native_tree_ptr = &ref.native_tree;
+    // The tree has its own copy of the points
+    ref.point_cloud.features = PointMatcher<RealT>::Matrix();
+  } else {
+    ref.icp.initRefTree(ref.point_cloud, alignment_method_fallback(opt.alignment_method),
+                        opt.highest_accuracy, false /*opt.verbose*/);
+  }
+  sw3.stop();
+  if (opt.verbose && !dem_only)
+    vw_out() << "Reference point cloud processing took " << sw3.elapsed_seconds() << " [s]" << endl;
+}
+
+/// Align opt.source to the reference, and write the outputs with
+/// opt.out_prefix. The reference is not modified, unless the
+/// libpointmatcher engine is used, so with the native engine or the
+/// DEM this can be called for several sources at the same time.
+void align_source(Options const& opt, BBox2 const& ref_box,
+                  GeoReference const& geo, asp::CsvConv const& csv_conv,
+                  ReferenceData & ref) {
+
+  bool dem_only = (opt.alignment_method == "point-to-dem");
+  PM::ICP & icp = ref.icp; // LibpointMatcher object
+  double elapsed_time;
+
+  // Load the subsampled source point cloud. If the user wants
+  // to filter gross outliers in the source points based on
+  // max_disp, load a lot more points than asked, filter based on
+  // max_disp, then resample to the number desired by the user.
+  // With point-to-dem alignment the shift is found from the source
+  // points, else the one of the reference is used.
+  Vector3 shift = ref.shift;
+  bool   calc_shift = dem_only;
+  bool   is_lola_rdr_format = ref.is_lola_rdr_format; // may get overwritten
+  double mean_source_longitude = 0.0;                // may get overwritten
+  int num_source_pts = opt.max_num_source_points;
+  if (opt.max_disp > 0.0)
+    num_source_pts = max(num_source_pts, 50000000);
+  Stopwatch sw2;
+  sw2.start();
+  DP source_point_cloud;
+  load_cloud(opt.source, num_source_pts,
+             ref_box, // ref box is used to bound source
+             calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
+             mean_source_longitude, opt.verbose, source_point_cloud);
+  sw2.stop();
+  if (opt.verbose)
+    vw_out() << "Loading the source point cloud took "
+             << sw2.elapsed_seconds() << " [s]" << endl;
+
+  if (dem_only) {
+    // Place the centroid of the source at the origin
+    int numSrcPts = source_point_cloud.features.cols();
+    Eigen::VectorXd meanSrc = source_point_cloud.features.rowwise().sum() / numSrcPts;
+    source_point_cloud.features.topRows(DIM).colwise() -= meanSrc.head(DIM);
+    for (int row = 0; row < DIM; row++)
+      shift[row] += meanSrc(row); // Update the shift variable as well as the points
+  }
+  if (opt.verbose)
+    vw_out() << "Data shifted internally by subtracting: " << shift << std::endl;
+
+  // See if to apply an initial north-east-down translation
+  PointMatcher<RealT>::Matrix init_transform = opt.init_transform;
+  if (opt.initial_ned_translation != "") {
+    if (opt.init_transform_file != "")
+      vw_throw( ArgumentErr()
+                << "Cannot specify an initial transform both from file and as a NED vector.\n");
+
+    init_transform = ned_to_caresian_transform(geo.datum(),
+                                               opt.initial_ned_translation,
+                                               shift);
+  }
+
+  // The point clouds are shifted, so shift the initial transform as well.
+  PointMatcher<RealT>::Matrix initT = apply_shift(init_transform, shift);
+
+  // Apply the initial guess transform to the source point cloud.
+  apply_transform_to_cloud(initT, source_point_cloud);
+
+  PointMatcher<RealT>::Matrix beg_errors;
+  if (opt.max_disp > 0.0){
+    // Filter gross outliers
+    filter_source_cloud(ref.point_cloud, source_point_cloud, icp, ref.native_tree_ptr,
+                        shift, ref.dem_georef, ref.dem, opt);
+  }
+
+  random_pc_subsample(opt.max_num_source_points, source_point_cloud.features);
+  vw_out() << "Reducing number of source points to "
+           << source_point_cloud.features.cols() << endl;
+
+  //dump_llh("ref.csv", datum, ref_point_cloud,    shift);
+  //dump_llh("src.csv", datum, source, shift);
+
+  elapsed_time = compute_registration_error(ref.point_cloud, source_point_cloud, icp,
+                                            ref.native_tree_ptr, shift, ref.dem_georef, ref.dem,
+                                            opt, beg_errors);
+  calc_stats("Input", beg_errors);
+  if (opt.verbose)
+    vw_out() << "Initial error computation took " << elapsed_time << " [s]" << endl;
+
+  // Compute the transformation to align the source to reference.
+  Stopwatch sw4;
+  sw4.start();
+  PointMatcher<RealT>::Matrix Id = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
+  if (opt.icp_engine == "native" || dem_only){
+    // These get their parameters when invoked
+  }else if (opt.config_file == ""){
+    // Read the options from the command line
+    icp.setParams(opt.out_prefix, opt.num_iter, opt.outlier_ratio,
+                  (2.0*M_PI/360.0)*opt.diff_rotation_err, // convert to radians
+                  opt.diff_translation_err, alignment_method_fallback(opt.alignment_method),
+                  false/*opt.verbose*/);
+  }else{
+    vw_out() << "Will read the options from: " << opt.config_file << endl;
+    ifstream ifs(opt.config_file.c_str());
+    if (!ifs.good())
+      vw_throw( ArgumentErr() << "Cannot open configuration file: "
+                << opt.config_file << "\n" );
+    icp.loadFromYaml(ifs);
+  }
+
+  // We bypass calling ICP if the user explicitely asks for 0 iterations.
+  PointMatcher<RealT>::Matrix T = Id;
+  if (opt.num_iter > 0){
+    if (opt.alignment_method != "least-squares" &&
+	  opt.alignment_method != "similarity-least-squares" &&
+        opt.alignment_method != "point-to-dem") {
+      if (opt.icp_engine == "native") {
+        asp::IcpOptions icp_opt;
+        icp_opt.method               = opt.alignment_method;
+        icp_opt.num_iter             = opt.num_iter;
+        icp_opt.outlier_ratio        = opt.outlier_ratio;
+        icp_opt.diff_rotation_err    = (2.0*M_PI/360.0)*opt.diff_rotation_err; // radians
+        icp_opt.diff_translation_err = opt.diff_translation_err;
+        icp_opt.translation_only     = opt.compute_translation_only;
+        icp_opt.num_levels           = opt.num_icp_levels;
+        double ratio = asp::icp_align(ref.native_tree, source_point_cloud.features, icp_opt,
+                                      opt.out_prefix + "-iterationInfo.csv", T);
+        vw_out() << "Match ratio: " << ratio << endl;
+      } else {
+        T = icp(source_point_cloud, ref.point_cloud, Id,
+                opt.compute_translation_only);
+        vw_out() << "Match ratio: "
+                 << icp.errorMinimizer->getWeightedPointUsedRatio() << endl;
+      }
+    }else if (opt.alignment_method == "point-to-dem"){
+      T = point_to_dem_alignment(source_point_cloud, shift,
+                                 ref.dem_georef, ref.dem, opt);
+    }else{
+      T = least_squares_alignment(source_point_cloud, shift,
+                                  ref.dem_georef, ref.dem, opt);
+    }
+    
+  }
+  sw4.stop();
+  if (opt.verbose)
+    vw_out() << "Alignment took " << sw4.elapsed_seconds() << " [s]" << endl;
+
+  // Transform the source to make it close to reference.
+  DP trans_source_point_cloud(source_point_cloud);
+  apply_transform_to_cloud(T, trans_source_point_cloud);
+
+  // Calculate by how much points move as result of T
+  calc_max_displacment(source_point_cloud, trans_source_point_cloud);
+  Vector3 source_ctr_vec, source_ctr_llh;
+  Vector3 trans_xyz, trans_ned, trans_llh;
+  calc_translation_vec(source_point_cloud, trans_source_point_cloud, shift, geo.datum(),
+                       source_ctr_vec, source_ctr_llh,
+                       trans_xyz, trans_ned, trans_llh);
+
+  // For each point, compute the distance to the nearest reference point.
+  PointMatcher<RealT>::Matrix end_errors;
+  elapsed_time = compute_registration_error(ref.point_cloud, trans_source_point_cloud, icp,
+                                            ref.native_tree_ptr, shift, ref.dem_georef,
+                                            ref.dem, opt, end_errors);
+  calc_stats("Output", end_errors);
+  if (opt.verbose)
+    vw_out() << "Final error computation took " << elapsed_time << " [s]" << endl;
+
+  // We must apply to T the initial guess transform
+  PointMatcher<RealT>::Matrix combinedT = T*initT;
+
+  // Go back to the original coordinate system, undoing the shift
+  PointMatcher<RealT>::Matrix globalT = apply_shift(combinedT, -shift);
+
+  // Print statistics
+  vw_out() << "Alignment transform (rotation + translation, "
+           << "origin is planet center):" << endl << globalT << endl;
+  vw_out() << "Centroid of source points (Cartesian, meters): " << source_ctr_vec << std::endl;
+  // Swap lat and lon, as we want to print lat first
+  std::swap(source_ctr_llh[0], source_ctr_llh[1]);
+  vw_out() << "Centroid of source points (lat,lon,z): " << source_ctr_llh << std::endl;
+  vw_out() << std::endl;
+
+  vw_out() << "Translation vector (Cartesian, meters): " << trans_xyz << std::endl;
+  vw_out() << "Translation vector (North-East-Down, meters): "
+           << trans_ned << std::endl;
+  vw_out() << "Translation vector magnitude (meters): " << norm_2(trans_xyz)
+           << std::endl;
+  if (opt.max_disp > 0 && opt.max_disp < norm_2(trans_xyz)) {
+    vw_out() << "Warning: The input --max-displacement value is smaller than the "
+             << "final observed displacement. It may be advised to increase the former "
+             << "and rerun the tool.\n";
+  }
+
+  // Swap lat and lon, as we want to print lat first
+  std::swap(trans_llh[0], trans_llh[1]);
+  vw_out() << "Translation vector (lat,lon,z): " << trans_llh << std::endl;
+  vw_out() << std::endl;
+
+  Matrix3x3 rot;
+  for (int r = 0; r < DIM; r++)
+    for (int c = 0; c < DIM; c++)
+      rot(r, c) = globalT(r, c);
+
+  if (opt.alignment_method == "similarity-point-to-point" ||
+	opt.alignment_method == "similarity-least-squares"){
+    double scale = pow(det(rot), 1.0/3.0);
+    for (int r = 0; r < DIM; r++)
+      for (int c = 0; c < DIM; c++)
+        rot(r, c) /= scale;
+    vw_out() << "Scale - 1 = " << (scale-1.0) << std::endl;
+  }
+  
+  Vector3 euler_angles = math::rotation_matrix_to_euler_xyz(rot) * 180/M_PI;
+  Vector3 axis_angles = math::matrix_to_axis_angle(rot) * 180/M_PI;
+  vw_out() << "Euler angles (degrees): " << euler_angles  << endl;
+  vw_out() << "Axis of rotation and angle (degrees): "
+           << axis_angles/norm_2(axis_angles) << ' '
+           << norm_2(axis_angles) << endl;
+
+  Stopwatch sw5;
+  sw5.start();
+  save_transforms(opt, globalT);
+
+  if (opt.save_trans_ref){
+    string trans_ref_prefix = opt.out_prefix + "-trans_reference";
+    save_trans_point_cloud(opt, opt.reference, trans_ref_prefix,
+                           geo, csv_conv, globalT.inverse());
+  }
+
+  if (opt.save_trans_source){
+    string trans_source_prefix = opt.out_prefix + "-trans_source";
+    save_trans_point_cloud(opt, opt.source, trans_source_prefix,
+                           geo, csv_conv, globalT);
+  }
+
+  save_errors(source_point_cloud, beg_errors,  opt.out_prefix + "-beg_errors.csv",
+              shift, geo, csv_conv, is_lola_rdr_format, mean_source_longitude);
+  save_errors(trans_source_point_cloud, end_errors,  opt.out_prefix + "-end_errors.csv",
+              shift, geo, csv_conv, is_lola_rdr_format, mean_source_longitude);
+
+  if (opt.verbose) vw_out() << "Writing: " << opt.out_prefix
+    + "-iterationInfo.csv" << std::endl;
+
+  sw5.stop();
+  if (opt.verbose) vw_out() << "Saving to disk took "
+                            << sw5.elapsed_seconds() << " [s]" << endl;
+}
+
+/// Align one of the sources in a batch, with its own output prefix.
+class AlignSourceTask : public vw::Task, private boost::noncopyable {
+  Options       m_opt;
+  BBox2         m_ref_box;
+  GeoReference  const& m_geo;
+  asp::CsvConv  const& m_csv_conv;
+  ReferenceData      & m_ref;
+  int           m_num_omp_threads;
+  vw::Mutex        & m_mutex;
+  std::vector<std::string> & m_failed;
+public:
+  AlignSourceTask(Options const& opt, BBox2 const& ref_box, GeoReference const& geo,
+                  asp::CsvConv const& csv_conv, ReferenceData & ref, int num_omp_threads,
+                  vw::Mutex & mutex, std::vector<std::string> & failed):
+    m_opt(opt), m_ref_box(ref_box), m_geo(geo), m_csv_conv(csv_conv), m_ref(ref),
+    m_num_omp_threads(num_omp_threads), m_mutex(mutex), m_failed(failed) {}
+
+  virtual void operator()() {
+// TODO: Enable on OSX when clang supports OpenMP!
+#if (defined(ASP_OSX_BUILD) && ASP_OSX_BUILD==1)
+#else
+    // The OpenMP thread count is per thread
+    omp_set_num_threads(m_num_omp_threads);
+#endif
+    try {
+      vw_out() << "Aligning: " << m_opt.source << std::endl;
+      align_source(m_opt, m_ref_box, m_geo, m_csv_conv, m_ref);
+    } catch (const std::exception& e) {
+      vw_out(ErrorMessage) << "Failed to align " << m_opt.source << ": " << e.what() << std::endl;
+      vw::Mutex::Lock lock(m_mutex);
+      m_failed.push_back(m_opt.source);
+    }
+  }
+};
+
 int main( int argc, char *argv[] ) {
 
   // Mandatory line for Eigen
@@ -1064,6 +1731,10 @@ int main( int argc, char *argv[] ) {
       return 0;
     }
 
+    std::vector<std::string> sources = opt.batch_sources;
+    if (sources.empty())
+      sources.push_back(opt.source);
+
     // We will use ref_box to bound the source points, and vice-versa.
     // Decide how many samples to pick to estimate these boxes.
     Stopwatch sw0;
@@ -1072,322 +1743,69 @@ int main( int argc, char *argv[] ) {
                                   std::max(opt.max_num_source_points,
                                            opt.max_num_reference_points)/4);
     num_sample_pts = std::min(9000000, num_sample_pts); // avoid being slow
-    
-    // Compute GDC bounding box of the source and reference clouds
+
+    // Compute GDC bounding box of the source and reference clouds.
+    // The reference is loaded once, so it is bounded by the union of
+    // the boxes of the sources.
     vw_out() << "Computing the intersection of the bounding boxes "
              << "of the reference and source points." << endl;
-    BBox2 ref_box, source_box;
-    ref_box    = calc_extended_lonlat_bbox(geo, num_sample_pts, csv_conv,
-                                           opt.reference, opt.max_disp);
-    source_box = calc_extended_lonlat_bbox(geo, num_sample_pts, csv_conv,
-                                           opt.source,    opt.max_disp);
-
-    // When boxes are huge, it is hard to do the optimization of intersecting
-    // them, as they may differ not by 0 or 360, but by 180. Better do nothing
-    // in that case. The solution may degrade a bit, as we may load points
-    // not in the intersection of the boxes, but at least it won't be wrong.
-    // In this case, there is a chance the boxes were computed wrong anyway.
-    if (ref_box.width() > 180.0 || source_box.width() > 180.0) {
-      vw_out() << "Warning: Your input point clouds are spread over more than half the planet. "
-               << "It is suggested that they be cropped, to get more accurate results.\n";
-      ref_box = BBox2();
-      source_box = BBox2();
-    }
-    
-    vw_out() << "Reference box: " << ref_box << std::endl;
-    vw_out() << "Source box:    " << source_box << std::endl;
-
-    // If ref points are offset by 360 degrees in longitude in respect
-    // to source points, adjust the ref box to be aligned with the
-    // source points, and vice versa.  Note that we will use the ref
-    // box to bound the source points, and vice-versa.
-    double lon_offset = 0.0;
-    if (!ref_box.empty() && !source_box.empty()){
-      // Compute the longitude offset
-      double source_mean_lon = (source_box.min().x() + source_box.max().x())/2.0;
-      double ref_mean_lon    = (ref_box.min().x()    + ref_box.max().x()   )/2.0;
-      lon_offset = source_mean_lon - ref_mean_lon;
-      lon_offset = 360.0*round(lon_offset/360.0);
-      // Apply to both bounding boxes
-      ref_box    += Vector2(lon_offset, 0);
-      // Intersect them, as pc_align will operate on their common area
-      ref_box.crop(source_box);
-      source_box.crop(ref_box); // common area
-      source_box -= Vector2(lon_offset, 0);
-
-      // Extra adjustments. These are needed since pixel_to_lonlat and
-      // cartesian_to_geodetic can disagree by 360 degress. Adjust ref
-      // to source and vice-versa.
-      adjust_lonlat_bbox(opt.reference, source_box);
-      adjust_lonlat_bbox(opt.source, ref_box);
+    BBox2 full_ref_box = calc_extended_lonlat_bbox(geo, num_sample_pts, csv_conv,
+                                                   opt.reference, opt.max_disp);
+    std::vector<BBox2> ref_boxes(sources.size());
+    BBox2 source_box;
+    bool bound_reference = true;
+    for (size_t i = 0; i < sources.size(); i++) {
+      BBox2 curr_source_box;
+      intersect_lonlat_boxes(opt, geo, csv_conv, num_sample_pts, full_ref_box, sources[i],
+                             ref_boxes[i], curr_source_box);
+      if (curr_source_box.empty())
+        bound_reference = false; // Then the reference is not bounded
+      source_box.grow(curr_source_box);
     }
+    if (!bound_reference)
+      source_box = BBox2();
     sw0.stop();
-    vw_out() << "Intersection:  " << ref_box << std::endl;
     vw_out() << "Intersection of bounding boxes took " << sw0.elapsed_seconds() << " [s]" << endl;
 
     // Load the point clouds. We will shift both point clouds by the
-    // centroid of the first one to bring them closer to origin.
-
-    // Load the subsampled reference point cloud.
-    Vector3 shift;
-    bool   calc_shift = true; // Shift points so the first point is (0,0,0)
-    bool   is_lola_rdr_format = false;   // may get overwritten
-    double mean_ref_longitude    = 0.0;  // may get overwritten
-    double mean_source_longitude = 0.0;  // may get overwritten
-    Stopwatch sw1;
-    sw1.start();
-    DP ref_point_cloud;
-    load_cloud(opt.reference, opt.max_num_reference_points,
-               source_box, // source box is used to bound reference
-               calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
-               mean_ref_longitude, opt.verbose, ref_point_cloud);
-    sw1.stop();
-    if (opt.verbose)
-      vw_out() << "Loading the reference point cloud took "
-               << sw1.elapsed_seconds() << " [s]" << endl;
-    //ref_point_cloud.save(outputBaseFile + "_ref.vtk");
-
-    // Load the subsampled source point cloud. If the user wants
-    // to filter gross outliers in the source points based on
-    // max_disp, load a lot more points than asked, filter based on
-    // max_disp, then resample to the number desired by the user.
-    int num_source_pts = opt.max_num_source_points;
-    if (opt.max_disp > 0.0)
-      num_source_pts = max(num_source_pts, 50000000);
-    calc_shift = false; // Use the same shift used for the reference point cloud
-    Stopwatch sw2;
-    sw2.start();
-    DP source_point_cloud;
-    load_cloud(opt.source, num_source_pts,
-	      ref_box, // ref box is used to bound source
-	      calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
-	      mean_source_longitude, opt.verbose, source_point_cloud);
-    sw2.stop();
-    if (opt.verbose)
-      vw_out() << "Loading the source point cloud took "
-               << sw2.elapsed_seconds() << " [s]" << endl;
-
-    // So far we shifted by first point in reference point cloud to reduce
-    // the magnitude of all loaded points. Now that we have loaded all
-    // points, shift one more time, to place the centroid of the
-    // reference at the origin.
-    // Note: If this code is ever converting to using floats,
-    // the operation below needs to be re-implemented to be accurate.
-    int numRefPts = ref_point_cloud.features.cols();
-    Eigen::VectorXd meanRef = ref_point_cloud.features.rowwise().sum() / numRefPts;
-    ref_point_cloud.features.topRows(DIM).colwise()    -= meanRef.head(DIM);
-    source_point_cloud.features.topRows(DIM).colwise() -= meanRef.head(DIM);
-    for (int row = 0; row < DIM; row++)
-      shift[row] += meanRef(row); // Update the shift variable as well as the points
-    if (opt.verbose)
-      vw_out() << "Data shifted internally by subtracting: " << shift << std::endl;
-
-
-    // See if to apply an initial north-east-down translation
-    if (opt.initial_ned_translation != "") {
-      if (opt.init_transform_file != "")
-        vw_throw( ArgumentErr()
-                  << "Cannot specify an initial transform both from file and as a NED vector.\n");
-
-      opt.init_transform = ned_to_caresian_transform(geo.datum(),
-                                                     opt.initial_ned_translation, 
-                                                     shift);
-    }
-    
-    // The point clouds are shifted, so shift the initial transform as well.
-    PointMatcher<RealT>::Matrix initT = apply_shift(opt.init_transform, shift);
-
-    // If the reference point cloud came from a DEM, also load the data in DEM format.
-    cartography::GeoReference dem_georef;
-    vw::ImageViewRef< PixelMask<float> > reference_dem_ref;
-    if (opt.use_dem_distances()) {
-      vw_out() << "Loading reference as DEM." << endl;
-      // Load the dem, then wrap it inside an ImageViewRef object.
-      // - This is done because the actual DEM type cannot be created without being initialized.
-      InterpolationReadyDem reference_dem(load_interpolation_ready_dem(opt.reference, dem_georef));
-      reference_dem_ref.reset(reference_dem);
-    }
-
-    // Now all of the input data is loaded.
-
-    // Filter the reference and initialize the reference tree
-    double elapsed_time;
-    PM::ICP icp; // LibpointMatcher object
-
-    Stopwatch sw3;
-    if (opt.verbose)
-      vw_out() << "Building the reference cloud tree." << endl;
-    sw3.start();
-    icp.initRefTree(ref_point_cloud, alignment_method_fallback(opt.alignment_method),
-		    opt.highest_accuracy, false /*opt.verbose*/);
-    sw3.stop();
-    if (opt.verbose)
-      vw_out() << "Reference point cloud processing took " << sw3.elapsed_seconds() << " [s]" << endl;
-
-    // Apply the initial guess transform to the source point cloud.
-    apply_transform_to_cloud(initT, source_point_cloud);
-    
-    PointMatcher<RealT>::Matrix beg_errors;
-    if (opt.max_disp > 0.0){
-      // Filter gross outliers
-      filter_source_cloud(ref_point_cloud, source_point_cloud, icp,
-                          shift, dem_georef, reference_dem_ref, opt);
-    }
-
-    random_pc_subsample(opt.max_num_source_points, source_point_cloud.features);
-    vw_out() << "Reducing number of source points to "
-             << source_point_cloud.features.cols() << endl;
-
-    //dump_llh("ref.csv", datum, ref_point_cloud,    shift);
-    //dump_llh("src.csv", datum, source, shift);
+    // centroid of the reference to bring them closer to origin.
+    ReferenceData ref;
+    load_reference(opt, source_box, geo, csv_conv, ref);
 
-    elapsed_time = compute_registration_error(ref_point_cloud, source_point_cloud, icp,
-                                              shift, dem_georef, reference_dem_ref,
-					      opt, beg_errors);
-    calc_stats("Input", beg_errors);
-    if (opt.verbose)
-      vw_out() << "Initial error computation took " << elapsed_time << " [s]" << endl;
-
-
-    // Compute the transformation to align the source to reference.
-    Stopwatch sw4;
-    sw4.start();
-    PointMatcher<RealT>::Matrix Id = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
-    if (opt.config_file == ""){
-      // Read the options from the command line
-      icp.setParams(opt.out_prefix, opt.num_iter, opt.outlier_ratio,
-                    (2.0*M_PI/360.0)*opt.diff_rotation_err, // convert to radians
-                    opt.diff_translation_err, alignment_method_fallback(opt.alignment_method),
-                    false/*opt.verbose*/);
-    }else{
-      vw_out() << "Will read the options from: " << opt.config_file << endl;
-      ifstream ifs(opt.config_file.c_str());
-      if (!ifs.good())
-        vw_throw( ArgumentErr() << "Cannot open configuration file: "
-                  << opt.config_file << "\n" );
-      icp.loadFromYaml(ifs);
+    if (opt.batch_sources.empty()) {
+      align_source(opt, ref_boxes[0], geo, csv_conv, ref);
+      return 0;
     }
 
-    // We bypass calling ICP if the user explicitely asks for 0 iterations.
-    PointMatcher<RealT>::Matrix T = Id;
-    if (opt.num_iter > 0){
-      if (opt.alignment_method != "least-squares" &&
-	  opt.alignment_method != "similarity-least-squares") {
-	T = icp(source_point_cloud, ref_point_cloud, Id,
-		opt.compute_translation_only);
-	vw_out() << "Match ratio: "
-		 << icp.errorMinimizer->getWeightedPointUsedRatio() << endl;
-      }else{
-	T = least_squares_alignment(source_point_cloud, shift,
-				    dem_georef, reference_dem_ref, opt);
-      }
-      
+    // Align the sources in parallel, sharing the threads. The failed
+    // ones are reported at the end.
+    int num_parallel = std::min(opt.num_parallel_sources, int(sources.size()));
+    int num_omp_threads = std::max(1, opt.num_threads/num_parallel);
+    vw_out() << "Aligning " << sources.size() << " sources, " << num_parallel
+             << " at a time." << std::endl;
+    vw::Mutex mutex;
+    std::vector<std::string> failed;
+    vw::FifoWorkQueue queue(num_parallel);
+    for (size_t i = 0; i < sources.size(); i++) {
+      Options source_opt = opt;
+      source_opt.source     = sources[i];
+      source_opt.out_prefix = opt.out_prefix + "-" + fs::path(sources[i]).stem().string();
+      boost::shared_ptr<AlignSourceTask>
+        task(new AlignSourceTask(source_opt, ref_boxes[i], geo, csv_conv, ref,
+                                 num_omp_threads, mutex, failed));
+      queue.add_task(task);
     }
-    sw4.stop();
-    if (opt.verbose)
-      vw_out() << "Alignment took " << sw4.elapsed_seconds() << " [s]" << endl;
-
-    // Transform the source to make it close to reference.
-    DP trans_source_point_cloud(source_point_cloud);
-    apply_transform_to_cloud(T, trans_source_point_cloud);
-
-    // Calculate by how much points move as result of T
-    calc_max_displacment(source_point_cloud, trans_source_point_cloud);
-    Vector3 source_ctr_vec, source_ctr_llh;
-    Vector3 trans_xyz, trans_ned, trans_llh;
-    calc_translation_vec(source_point_cloud, trans_source_point_cloud, shift, geo.datum(),
-                         source_ctr_vec, source_ctr_llh,
-                         trans_xyz, trans_ned, trans_llh);
-
-    // For each point, compute the distance to the nearest reference point.
-    PointMatcher<RealT>::Matrix end_errors;
-    elapsed_time = compute_registration_error(ref_point_cloud, trans_source_point_cloud, icp,
-                                              shift, dem_georef, reference_dem_ref, opt,
-					      end_errors);
-    calc_stats("Output", end_errors);
-    if (opt.verbose)
-      vw_out() << "Final error computation took " << elapsed_time << " [s]" << endl;
-
-    // We must apply to T the initial guess transform
-    PointMatcher<RealT>::Matrix combinedT = T*initT;
-
-    // Go back to the original coordinate system, undoing the shift
-    PointMatcher<RealT>::Matrix globalT = apply_shift(combinedT, -shift);
-
-    // Print statistics
-    vw_out() << "Alignment transform (rotation + translation, "
-             << "origin is planet center):" << endl << globalT << endl;
-    vw_out() << "Centroid of source points (Cartesian, meters): " << source_ctr_vec << std::endl;
-    // Swap lat and lon, as we want to print lat first
-    std::swap(source_ctr_llh[0], source_ctr_llh[1]);
-    vw_out() << "Centroid of source points (lat,lon,z): " << source_ctr_llh << std::endl;
-    vw_out() << std::endl;
-
-    vw_out() << "Translation vector (Cartesian, meters): " << trans_xyz << std::endl;
-    vw_out() << "Translation vector (North-East-Down, meters): "
-             << trans_ned << std::endl;
-    vw_out() << "Translation vector magnitude (meters): " << norm_2(trans_xyz)
-             << std::endl;
-    if (opt.max_disp > 0 && opt.max_disp < norm_2(trans_xyz)) {
-      vw_out() << "Warning: The input --max-displacement value is smaller than the "
-               << "final observed displacement. It may be advised to increase the former "
-               << "and rerun the tool.\n";
+    queue.join_all();
+
+    if (!failed.empty()) {
+      std::sort(failed.begin(), failed.end());
+      vw_out() << "Failed to align " << failed.size() << " of " << sources.size()
+               << " sources:" << std::endl;
+      for (size_t i = 0; i < failed.size(); i++)
+        vw_out() << failed[i] << std::endl;
+      return 1;
     }
 
-    // Swap lat and lon, as we want to print lat first
-    std::swap(trans_llh[0], trans_llh[1]);
-    vw_out() << "Translation vector (lat,lon,z): " << trans_llh << std::endl;
-    vw_out() << std::endl;
-
-    Matrix3x3 rot;
-    for (int r = 0; r < DIM; r++)
-      for (int c = 0; c < DIM; c++)
-        rot(r, c) = globalT(r, c);
-
-    if (opt.alignment_method == "similarity-point-to-point" ||
-	opt.alignment_method == "similarity-least-squares"){
-      double scale = pow(det(rot), 1.0/3.0);
-      for (int r = 0; r < DIM; r++)
-        for (int c = 0; c < DIM; c++)
-          rot(r, c) /= scale;
-      vw_out() << "Scale - 1 = " << (scale-1.0) << std::endl;
-    }
-    
-    Vector3 euler_angles = math::rotation_matrix_to_euler_xyz(rot) * 180/M_PI;
-    Vector3 axis_angles = math::matrix_to_axis_angle(rot) * 180/M_PI;
-    vw_out() << "Euler angles (degrees): " << euler_angles  << endl;
-    vw_out() << "Axis of rotation and angle (degrees): "
-             << axis_angles/norm_2(axis_angles) << ' '
-             << norm_2(axis_angles) << endl;
-
-    Stopwatch sw5;
-    sw5.start();
-    save_transforms(opt, globalT);
-
-    if (opt.save_trans_ref){
-      string trans_ref_prefix = opt.out_prefix + "-trans_reference";
-      save_trans_point_cloud(opt, opt.reference, trans_ref_prefix,
-                             geo, csv_conv, globalT.inverse());
-    }
-
-    if (opt.save_trans_source){
-      string trans_source_prefix = opt.out_prefix + "-trans_source";
-      save_trans_point_cloud(opt, opt.source, trans_source_prefix,
-                             geo, csv_conv, globalT);
-    }
-
-    save_errors(source_point_cloud, beg_errors,  opt.out_prefix + "-beg_errors.csv",
-                shift, geo, csv_conv, is_lola_rdr_format, mean_source_longitude);
-    save_errors(trans_source_point_cloud, end_errors,  opt.out_prefix + "-end_errors.csv",
-                shift, geo, csv_conv, is_lola_rdr_format, mean_source_longitude);
-
-    if (opt.verbose) vw_out() << "Writing: " << opt.out_prefix
-      + "-iterationInfo.csv" << std::endl;
-
-    sw5.stop();
-    if (opt.verbose) vw_out() << "Saving to disk took "
-                              << sw5.elapsed_seconds() << " [s]" << endl;
-
   } ASP_STANDARD_CATCHES;
 
   return 0;
@@ -0,0 +1,492 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Tools/pc_align_icp.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <cmath>
+
+using namespace vw;
+
+namespace asp {
+
+namespace {
+
+  // Do not split the building of ranges smaller than this into parallel tasks
+  const size_t MIN_TASK_SIZE = 100000;
+
+  // Coarse ICP levels with fewer source points than this are skipped
+  const int MIN_ICP_LEVEL_POINTS = 1000;
+
+  // The source is decimated by 4^(MAX_ICP_LEVELS - 1) at most
+  const int MAX_ICP_LEVELS = 8;
+
+  // Compare points by a given coordinate
+  struct CoordLess {
+    float const* m_coords;
+    int m_axis;
+    CoordLess(float const* coords, int axis): m_coords(coords), m_axis(axis) {}
+    bool operator()(unsigned int a, unsigned int b) const {
+      return m_coords[3*size_t(a) + m_axis] < m_coords[3*size_t(b) + m_axis];
+    }
+  };
+
+  // Put the median of the range along the axis of largest extent in
+  // the middle, then do the same for each half. Pointers are used so
+  // that the parallel tasks share the data.
+  void build_range(unsigned int * order, float const* coords, unsigned char * axes,
+                   size_t begin, size_t end) {
+
+    if (end - begin <= 1) {
+      if (end > begin)
+        axes[begin] = 0;
+      return;
+    }
+
+    float lo[3], hi[3];
+    for (int d = 0; d < 3; d++) {
+      lo[d] =  std::numeric_limits<float>::max();
+      hi[d] = -std::numeric_limits<float>::max();
+    }
+    for (size_t k = begin; k < end; k++) {
+      float const* p = coords + 3*size_t(order[k]);
+      for (int d = 0; d < 3; d++) {
+        lo[d] = std::min(lo[d], p[d]);
+        hi[d] = std::max(hi[d], p[d]);
+      }
+    }
+    int axis = 0;
+    for (int d = 1; d < 3; d++) {
+      if (hi[d] - lo[d] > hi[axis] - lo[axis])
+        axis = d;
+    }
+
+    size_t mid = begin + (end - begin)/2;
+    std::nth_element(order + begin, order + mid, order + end, CoordLess(coords, axis));
+    axes[mid] = axis;
+
+    if (end - begin >= MIN_TASK_SIZE) {
+#pragma omp task
+      build_range(order, coords, axes, begin, mid);
+#pragma omp task
+      build_range(order, coords, axes, mid + 1, end);
+#pragma omp taskwait
+    } else {
+      build_range(order, coords, axes, begin, mid);
+      build_range(order, coords, axes, mid + 1, end);
+    }
+  }
+
+  inline float dist2(float const* p, Eigen::Vector3f const& q) {
+    float dx = p[0] - q[0], dy = p[1] - q[1], dz = p[2] - q[2];
+    return dx*dx + dy*dy + dz*dz;
+  }
+
+  void nearest_range(float const* points, unsigned char const* axes,
+                     size_t begin, size_t end, Eigen::Vector3f const& q,
+                     size_t & best_index, float & best_dist2) {
+    if (begin >= end)
+      return;
+
+    size_t mid = begin + (end - begin)/2;
+    float const* p = points + 3*mid;
+    float d2 = dist2(p, q);
+    if (d2 < best_dist2) {
+      best_dist2 = d2;
+      best_index = mid;
+    }
+
+    float diff = q[axes[mid]] - p[axes[mid]];
+    if (diff < 0) {
+      nearest_range(points, axes, begin, mid, q, best_index, best_dist2);
+      if (diff*diff < best_dist2)
+        nearest_range(points, axes, mid + 1, end, q, best_index, best_dist2);
+    } else {
+      nearest_range(points, axes, mid + 1, end, q, best_index, best_dist2);
+      if (diff*diff < best_dist2)
+        nearest_range(points, axes, begin, mid, q, best_index, best_dist2);
+    }
+  }
+
+  // The heap has the farthest of the current candidates at the front
+  typedef std::pair<float, size_t> Candidate;
+
+  void nearest_k_range(float const* points, unsigned char const* axes,
+                       size_t begin, size_t end, Eigen::Vector3f const& q,
+                       size_t k, std::vector<Candidate> & heap) {
+    if (begin >= end)
+      return;
+
+    size_t mid = begin + (end - begin)/2;
+    float const* p = points + 3*mid;
+    float d2 = dist2(p, q);
+    if (heap.size() < k) {
+      heap.push_back(Candidate(d2, mid));
+      std::push_heap(heap.begin(), heap.end());
+    } else if (d2 < heap.front().first) {
+      std::pop_heap(heap.begin(), heap.end());
+      heap.back() = Candidate(d2, mid);
+      std::push_heap(heap.begin(), heap.end());
+    }
+
+    float diff = q[axes[mid]] - p[axes[mid]];
+    size_t near_beg = mid + 1, near_end = end, far_beg = begin, far_end = mid;
+    if (diff < 0) {
+      std::swap(near_beg, far_beg);
+      std::swap(near_end, far_end);
+    }
+    nearest_k_range(points, axes, near_beg, near_end, q, k, heap);
+    if (heap.size() < k || diff*diff < heap.front().first)
+      nearest_k_range(points, axes, far_beg, far_end, q, k, heap);
+  }
+
+  // The normal of the surface at a reference point, from its neighbors.
+  // It is zero if there are not enough of them.
+  Eigen::Vector3d reference_normal(PointKdTree const& tree, size_t index, int num_neighbors) {
+
+    std::vector<size_t> neighbors;
+    tree.nearest_k(tree.point(index), num_neighbors, neighbors);
+    if (neighbors.size() < 3)
+      return Eigen::Vector3d::Zero();
+
+    Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+    for (size_t k = 0; k < neighbors.size(); k++)
+      mean += tree.point(neighbors[k]).cast<double>();
+    mean /= double(neighbors.size());
+
+    Eigen::Matrix3d cov = Eigen::Matrix3d::Zero();
+    for (size_t k = 0; k < neighbors.size(); k++) {
+      Eigen::Vector3d d = tree.point(neighbors[k]).cast<double>() - mean;
+      cov += d*d.transpose();
+    }
+
+    // The eigenvalues are in increasing order
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(cov);
+    return solver.eigenvectors().col(0);
+  }
+
+} // end anonymous namespace
+
+void PointKdTree::build(IcpMatrix const& points) {
+
+  size_t num_points = points.cols();
+  if (num_points >= size_t(std::numeric_limits<unsigned int>::max()))
+    vw_throw(ArgumentErr() << "Too many points for the KD-tree: " << num_points << ".\n");
+
+  std::vector<float> coords(3*num_points);
+  std::vector<unsigned int> order(num_points);
+  for (size_t col = 0; col < num_points; col++) {
+    for (int d = 0; d < 3; d++)
+      coords[3*col + d] = points(d, col);
+    order[col] = col;
+  }
+
+  m_axes.assign(num_points, 0);
+  if (num_points > 0) {
+#pragma omp parallel
+    {
+#pragma omp single
+      build_range(&order[0], &coords[0], &m_axes[0], 0, num_points);
+    }
+  }
+
+  m_points.resize(3*num_points);
+  for (size_t k = 0; k < num_points; k++) {
+    for (int d = 0; d < 3; d++)
+      m_points[3*k + d] = coords[3*size_t(order[k]) + d];
+  }
+}
+
+void PointKdTree::nearest(Eigen::Vector3f const& query, size_t & index, float & dist2) const {
+  index = 0;
+  dist2 = std::numeric_limits<float>::max();
+  if (m_axes.empty())
+    vw_throw(LogicErr() << "The KD-tree is empty.\n");
+  nearest_range(&m_points[0], &m_axes[0], 0, m_axes.size(), query, index, dist2);
+}
+
+void PointKdTree::nearest_k(Eigen::Vector3f const& query, int k,
+                            std::vector<size_t> & indices) const {
+  indices.clear();
+  if (m_axes.empty() || k <= 0)
+    return;
+
+  std::vector<Candidate> heap;
+  heap.reserve(k);
+  nearest_k_range(&m_points[0], &m_axes[0], 0, m_axes.size(), query, k, heap);
+  std::sort_heap(heap.begin(), heap.end());
+  for (size_t i = 0; i < heap.size(); i++)
+    indices.push_back(heap[i].second);
+}
+
+void point_to_plane_update(std::vector<Eigen::Vector3d> const& p,
+                           std::vector<Eigen::Vector3d> const& q,
+                           std::vector<Eigen::Vector3d> const& n,
+                           bool translation_only,
+                           Eigen::Matrix3d & dR, Eigen::Vector3d & dT) {
+
+  // With dR*p = p + w x p, the residual is linear in w and dT
+  Eigen::Matrix<double, 6, 6> A = Eigen::Matrix<double, 6, 6>::Zero();
+  Eigen::Matrix<double, 6, 1> b = Eigen::Matrix<double, 6, 1>::Zero();
+  for (size_t k = 0; k < p.size(); k++) {
+    Eigen::Matrix<double, 6, 1> J;
+    J.head(3) = p[k].cross(n[k]);
+    J.tail(3) = n[k];
+    A += J*J.transpose();
+    b += J*((p[k] - q[k]).dot(n[k]));
+  }
+
+  dR = Eigen::Matrix3d::Identity();
+  if (translation_only) {
+    Eigen::Matrix3d At = A.block(3, 3, 3, 3);
+    Eigen::Vector3d bt = b.tail(3);
+    dT = At.jacobiSvd(Eigen::ComputeFullU | Eigen::ComputeFullV).solve(-bt);
+    return;
+  }
+
+  Eigen::Matrix<double, 6, 1> x
+    = A.jacobiSvd(Eigen::ComputeFullU | Eigen::ComputeFullV).solve(-b);
+  Eigen::Vector3d w = x.head(3);
+  double angle = w.norm();
+  if (angle > 0)
+    dR = Eigen::AngleAxisd(angle, w/angle).toRotationMatrix();
+  dT = x.tail(3);
+}
+
+void transform_change(Eigen::Matrix3d const& dR, Eigen::Vector3d const& dT,
+                      double & rot_change, double & trans_change) {
+  double scale = std::pow(std::abs(dR.determinant()), 1.0/3.0);
+  double cos_angle = 0.5*((dR/scale).trace() - 1.0);
+  rot_change   = std::acos(std::max(-1.0, std::min(1.0, cos_angle)));
+  trans_change = dT.norm();
+}
+
+void icp_errors(PointKdTree const& ref_tree, IcpMatrix const& source, IcpMatrix & errors) {
+
+  int num_points = source.cols();
+  errors.resize(1, num_points);
+  if (ref_tree.size() == 0)
+    vw_throw(ArgumentErr() << "No reference points.\n");
+
+#pragma omp parallel for
+  for (int col = 0; col < num_points; col++) {
+    Eigen::Vector3f q(source(0, col), source(1, col), source(2, col));
+    size_t index;
+    float d2;
+    ref_tree.nearest(q, index, d2);
+    errors(0, col) = std::sqrt(double(d2));
+  }
+}
+
+namespace {
+
+  // The iterations of ICP with the given source points, starting from
+  // and updating the given transform. The iterations are numbered
+  // from iter_count in the iteration file.
+  double icp_iterations(PointKdTree const& ref_tree, IcpMatrix const& source,
+                        IcpOptions const& opt, double outlier_ratio,
+                        double rot_tol, double trans_tol,
+                        std::map<size_t, Eigen::Vector3d> & normals,
+                        std::ofstream & ofs, int & iter_count,
+                        IcpMatrix & transform) {
+
+    bool point_to_plane = (opt.method == "point-to-plane");
+    bool similarity     = (opt.method == "similarity-point-to-point");
+
+    int num_points = source.cols();
+    int num_inliers = std::max(1, std::min(num_points, int(std::floor(outlier_ratio*num_points + 0.5))));
+
+    std::vector<size_t> matches(num_points);
+    std::vector<float>  dists2(num_points), sorted_dists2;
+    double used_ratio = 0.0;
+
+    for (int iter = 0; iter < opt.num_iter; iter++) {
+
+      int iter_index = iter_count++;
+
+      Eigen::Matrix3d R = transform.block(0, 0, 3, 3);
+      Eigen::Vector3d T = transform.block(0, 3, 3, 1);
+
+      // Match the current source points with the reference
+#pragma omp parallel for
+      for (int col = 0; col < num_points; col++) {
+        Eigen::Vector3d p = R*source.block(0, col, 3, 1) + T;
+        ref_tree.nearest(p.cast<float>(), matches[col], dists2[col]);
+      }
+
+      // Keep only the closest matches
+      sorted_dists2 = dists2;
+      std::nth_element(sorted_dists2.begin(), sorted_dists2.begin() + num_inliers - 1,
+                       sorted_dists2.end());
+      float max_dist2 = sorted_dists2[num_inliers - 1];
+      std::vector<int> inliers;
+      double mean_err = 0.0;
+      for (int col = 0; col < num_points; col++) {
+        if (dists2[col] <= max_dist2) {
+          inliers.push_back(col);
+          mean_err += std::sqrt(double(dists2[col]));
+        }
+      }
+      int num_used = inliers.size();
+      mean_err /= num_used;
+      used_ratio = double(num_used)/num_points;
+
+      Eigen::Matrix3d dR = Eigen::Matrix3d::Identity();
+      Eigen::Vector3d dT = Eigen::Vector3d::Zero();
+
+      if (!point_to_plane) {
+
+        Eigen::Matrix3Xd src(3, num_used), dst(3, num_used);
+        for (int k = 0; k < num_used; k++) {
+          int col = inliers[k];
+          src.col(k) = R*source.block(0, col, 3, 1) + T;
+          dst.col(k) = ref_tree.point(matches[col]).cast<double>();
+        }
+
+        if (opt.translation_only) {
+          dT = (dst - src).rowwise().mean();
+        } else {
+          Eigen::Matrix4d M = Eigen::umeyama(src, dst, similarity);
+          dR = M.block(0, 0, 3, 3);
+          dT = M.block(0, 3, 3, 1);
+        }
+
+      } else {
+
+        // Find the normals not computed before
+        std::vector<size_t> missing;
+        for (int k = 0; k < num_used; k++) {
+          size_t index = matches[inliers[k]];
+          if (normals.find(index) == normals.end())
+            missing.push_back(index);
+        }
+        std::sort(missing.begin(), missing.end());
+        missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+        std::vector<Eigen::Vector3d> missing_normals(missing.size());
+        int num_missing = missing.size();
+#pragma omp parallel for
+        for (int k = 0; k < num_missing; k++)
+          missing_normals[k] = reference_normal(ref_tree, missing[k], opt.num_normal_neighbors);
+        for (int k = 0; k < num_missing; k++)
+          normals[missing[k]] = missing_normals[k];
+
+        std::vector<Eigen::Vector3d> p(num_used), q(num_used), n(num_used);
+        for (int k = 0; k < num_used; k++) {
+          int col = inliers[k];
+          p[k] = R*source.block(0, col, 3, 1) + T;
+          q[k] = ref_tree.point(matches[col]).cast<double>();
+          n[k] = normals[matches[col]];
+        }
+        point_to_plane_update(p, q, n, opt.translation_only, dR, dT);
+      }
+
+      // Apply the increment
+      IcpMatrix dM = IcpMatrix::Identity(4, 4);
+      dM.block(0, 0, 3, 3) = dR;
+      dM.block(0, 3, 3, 1) = dT;
+      transform = dM*transform;
+
+      double rot_change, trans_change;
+      transform_change(dR, dT, rot_change, trans_change);
+
+      if (ofs.is_open())
+        ofs << iter_index << ", " << num_used << ", " << mean_err << ", "
+            << rot_change << ", " << trans_change << "\n";
+
+      if (rot_change < rot_tol && trans_change < trans_tol) {
+        vw_out() << "ICP converged after " << iter + 1 << " iterations.\n";
+        break;
+      }
+    }
+
+    return used_ratio;
+  }
+
+} // end anonymous namespace
+
+double icp_align(PointKdTree const& ref_tree, IcpMatrix const& source,
+                 IcpOptions const& opt, std::string const& iteration_file,
+                 IcpMatrix & transform) {
+
+  transform = IcpMatrix::Identity(4, 4);
+
+  int num_points = source.cols();
+  if (num_points == 0 || ref_tree.size() == 0)
+    vw_throw(ArgumentErr() << "No points to align.\n");
+
+  if (opt.method != "point-to-plane" && opt.method != "similarity-point-to-point" &&
+      opt.method != "point-to-point")
+    vw_throw(ArgumentErr() << "Unsupported alignment method: " << opt.method << ".\n");
+
+  std::ofstream ofs;
+  if (iteration_file != "") {
+    ofs.open(iteration_file.c_str());
+    ofs << "# iteration, number of inliers, mean inlier error, "
+        << "rotation change (radians), translation change\n";
+  }
+
+  // Normals of reference points are only computed when matched, and
+  // kept for all levels
+  std::map<size_t, Eigen::Vector3d> normals;
+
+  // Go from the coarsest level to the full source. Level k uses every
+  // 4^k-th source point, more of the matches, and looser tolerances,
+  // as it only needs to bring the source close to the reference for
+  // the next level. All levels search the same reference tree.
+  int num_levels = std::max(1, std::min(opt.num_levels, MAX_ICP_LEVELS));
+  int iter_count = 0;
+  double used_ratio = 0.0;
+  for (int level = num_levels - 1; level >= 0; level--) {
+
+    int stride = 1 << (2*level);
+    int num_level_points = (num_points + stride - 1)/stride;
+    if (level > 0 && num_level_points < MIN_ICP_LEVEL_POINTS)
+      continue; // too few points for this level to be useful
+
+    double outlier_ratio = opt.outlier_ratio
+      + (1.0 - opt.outlier_ratio)*double(level)/double(num_levels);
+    double tol_factor = double(1 << level);
+
+    if (num_levels > 1)
+      vw_out() << "ICP level " << level << ", using " << num_level_points
+               << " source points.\n";
+
+    if (level == 0) {
+      used_ratio = icp_iterations(ref_tree, source, opt, outlier_ratio,
+                                  opt.diff_rotation_err, opt.diff_translation_err,
+                                  normals, ofs, iter_count, transform);
+    } else {
+      IcpMatrix level_source(source.rows(), num_level_points);
+      for (int k = 0; k < num_level_points; k++)
+        level_source.col(k) = source.col(k*stride);
+      used_ratio = icp_iterations(ref_tree, level_source, opt, outlier_ratio,
+                                  tol_factor*opt.diff_rotation_err,
+                                  tol_factor*opt.diff_translation_err,
+                                  normals, ofs, iter_count, transform);
+    }
+  }
+
+  return used_ratio;
+}
+
+} // end namespace asp
@@ -0,0 +1,116 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file pc_align_icp.h
+///
+/// An alternative to libpointmatcher for the point-to-point and
+/// point-to-plane ICP in pc_align. The reference points are stored in
+/// single precision in a KD-tree which is built in parallel, and the
+/// reference normals are computed only for the reference points which
+/// get matched. Each iteration queries the tree in parallel only with
+/// the current source points.
+
+#ifndef __ASP_TOOLS_PC_ALIGN_ICP_H__
+#define __ASP_TOOLS_PC_ALIGN_ICP_H__
+
+#include <Eigen/Dense>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic> IcpMatrix;
+
+  /// A static KD-tree of 3D points, with the points stored in single
+  /// precision. The points should be shifted to be close to the origin.
+  class PointKdTree {
+  public:
+
+    PointKdTree() {}
+
+    /// Build the tree from the first three rows of the input, with
+    /// one point per column. Any previous contents are discarded.
+    void build(IcpMatrix const& points);
+
+    /// The closest point to the query. Return its index in the tree
+    /// and the squared distance to it. The tree must not be empty.
+    void nearest(Eigen::Vector3f const& query, size_t & index, float & dist2) const;
+
+    /// The indices in the tree of up to k points closest to the query.
+    void nearest_k(Eigen::Vector3f const& query, int k, std::vector<size_t> & indices) const;
+
+    /// The point with the given index in the tree.
+    Eigen::Vector3f point(size_t index) const {
+      return Eigen::Vector3f(m_points[3*index], m_points[3*index+1], m_points[3*index+2]);
+    }
+
+    size_t size() const { return m_axes.size(); }
+
+  private:
+
+    // The points are in tree order. The median of each range is at its
+    // middle, with its split axis, and the two halves are on either side.
+    std::vector<float>         m_points;
+    std::vector<unsigned char> m_axes;
+  };
+
+  /// Parameters for icp_align().
+  struct IcpOptions {
+    std::string method; // point-to-point, similarity-point-to-point, or point-to-plane
+    int    num_iter;
+    double outlier_ratio;        // fraction of the closest matches used in each iteration
+    double diff_rotation_err;    // in radians
+    double diff_translation_err;
+    bool   translation_only;
+    int    num_normal_neighbors; // for point-to-plane
+    int    num_levels;           // coarse-to-fine levels, with the source decimated by 4 per level
+    IcpOptions(): method("point-to-plane"), num_iter(100), outlier_ratio(0.75),
+                  diff_rotation_err(1e-8), diff_translation_err(1e-3),
+                  translation_only(false), num_normal_neighbors(10), num_levels(1) {}
+  };
+
+  /// The rotation and translation increment which, applied to the
+  /// points p, minimizes the sum of squared distances to the planes
+  /// through the points q with normals n. The rotation is linearized.
+  void point_to_plane_update(std::vector<Eigen::Vector3d> const& p,
+                             std::vector<Eigen::Vector3d> const& q,
+                             std::vector<Eigen::Vector3d> const& n,
+                             bool translation_only,
+                             Eigen::Matrix3d & dR, Eigen::Vector3d & dT);
+
+  /// The rotation angle, in radians, with any scale factored out, and
+  /// the translation magnitude of an increment.
+  void transform_change(Eigen::Matrix3d const& dR, Eigen::Vector3d const& dT,
+                        double & rot_change, double & trans_change);
+
+  /// The distance from each source point, with one point per column,
+  /// to the closest reference point. The output has one row.
+  void icp_errors(PointKdTree const& ref_tree, IcpMatrix const& source, IcpMatrix & errors);
+
+  /// Find the 4x4 transform which, applied to the source points, with
+  /// one point per column, brings them closest to the reference points.
+  /// Each iteration is appended to the given CSV file, if not empty.
+  /// With several levels, the alignment starts with a decimated source
+  /// and more of the matches, and ends with all of the source.
+  /// Return the fraction of the source points used in the last iteration.
+  double icp_align(PointKdTree const& ref_tree, IcpMatrix const& source,
+                   IcpOptions const& opt, std::string const& iteration_file,
+                   IcpMatrix & transform);
+
+} // end namespace asp
+
+#endif//__ASP_TOOLS_PC_ALIGN_ICP_H__
@@ -59,11 +59,16 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/BinaryCloud.h>
 #include <asp/Core/EigenUtils.h>
 #include <liblas/liblas.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
 
 #include <limits>
 #include <cstring>
+#include <sstream>
 
 #include <pointmatcher/PointMatcher.h>
 
@@ -158,10 +163,22 @@ void calc_max_displacment(DP const& source, DP const& trans_source);
 /// Apply a transformation matrix to a Vector3 in homogenous coordinates
 vw::Vector3 apply_transform(PointMatcher<RealT>::Matrix const& T, vw::Vector3 const& P);
 
-/// Apply a transform to the first three coordinates of the cloud
+/// Apply a transform to the first three coordinates of the cloud.
+/// The transform is kept as a rotation (with scale) and a translation,
+/// as this is applied to each pixel of the cloud.
 struct TransformPC: public vw::UnaryReturnSameType {
-  PointMatcher<RealT>::Matrix m_T;
-  TransformPC(PointMatcher<RealT>::Matrix const& T):m_T(T){}
+  vw::Matrix3x3 m_rot;
+  vw::Vector3   m_trans;
+  TransformPC(PointMatcher<RealT>::Matrix const& T){
+    for (int r = 0; r < DIM; r++) {
+      for (int c = 0; c < DIM; c++)
+        m_rot(r, c) = T(r, c);
+      m_trans[r] = T(r, DIM);
+    }
+  }
+  inline vw::Vector3 apply(vw::Vector3 const& xyz) const {
+    return m_rot*xyz + m_trans;
+  }
   inline vw::Vector<double> operator()(vw::Vector<double> const& pt) const {
 
     vw::Vector<double> P = pt; // local copy
@@ -170,13 +187,19 @@ struct TransformPC: public vw::UnaryReturnSameType {
     if (xyz == vw::Vector3())
       return P; // invalid point
 
-    vw::Vector3 Q = apply_transform(m_T, xyz);
-    subvector(P, 0, 3) = Q;
+    subvector(P, 0, 3) = apply(xyz);
 
     return P;
   }
 };
 
+/// Apply a transform to a batch of points, in parallel. If there is a
+/// georeference, the points are in its projected space, with the
+/// height above datum, and are converted to Cartesian and back.
+void apply_transform_to_points(PointMatcher<RealT>::Matrix const& T,
+                               bool has_georef,
+                               vw::cartography::GeoReference const& georef,
+                               std::vector<vw::Vector3> & points);
 
 /// Apply a given transform to the point cloud in input file, and save it.
 /// - Note: We transform the entire point cloud, not just the resampled
@@ -65,6 +65,14 @@ typename PointMatcher<T>::DataPoints::Labels form_labels(int dim){
   return labels;
 }
 
+// The points of a LAS file are read in chunks of this size, in parallel,
+// each chunk with its own reader.
+const vw::int64 LAS_CHUNK_SIZE = 1000000;
+
+// When the next point to load is at most this many points ahead, read
+// through to it rather than seeking.
+const vw::int64 LAS_MAX_READ_AHEAD = 64;
+
 vw::int64 load_las_aux(std::string const& file_name,
                        int num_points_to_load,
                        vw::BBox2 const& lonlat_box,
@@ -73,71 +81,137 @@ vw::int64 load_las_aux(std::string const& file_name,
                        vw::cartography::GeoReference const& geo,
                        bool verbose, DoubleMatrix & data){
 
-  data.conservativeResize(DIM+1, num_points_to_load);
-
   vw::cartography::GeoReference las_georef;
   bool has_georef = georef_from_las(file_name, las_georef);
   if (!has_georef)
     vw_throw(vw::ArgumentErr() << "LAS: " << file_name
                                << " does not have a georeference.\n");
 
-  std::ifstream ifs;
-  ifs.open(file_name.c_str(), std::ios::in | std::ios::binary);
-  liblas::ReaderFactory f;
-  liblas::Reader reader = f.CreateWithStream(ifs);
-
-  // We will randomly pick or not a point with probability load_ratio
   vw::int64 num_total_points = las_file_size(file_name);
-  double load_ratio
-    = (double)num_points_to_load/std::max(1.0, (double)num_total_points);
+  if (num_points_to_load > num_total_points)
+    num_points_to_load = num_total_points;
+  if (num_points_to_load < 0)
+    num_points_to_load = 0;
 
-  bool shift_was_calc = false;
-  vw::int64 points_count = 0;
+  data.conservativeResize(DIM+1, num_points_to_load);
+
+  // Each chunk gets a number of the points to load proportional to its
+  // size, and the chunk k fills the columns starting at start[k]. The
+  // points picked in a chunk are only read, rather than all of them.
+  vw::int64 num_chunks = (num_total_points + LAS_CHUNK_SIZE - 1)/LAS_CHUNK_SIZE;
+  std::vector<vw::int64> start(num_chunks + 1, 0), count(num_chunks, 0);
+  for (vw::int64 k = 0; k < num_chunks; k++) {
+    vw::int64 end = std::min((k + 1)*LAS_CHUNK_SIZE, num_total_points);
+    start[k+1] = vw::int64(double(num_points_to_load)*double(end)/double(num_total_points));
+  }
+  if (num_chunks > 0)
+    start[num_chunks] = num_points_to_load;
 
   vw::TerminalProgressCallback tpc("asp", "\t--> ");
-  int hundred = 100;
-  int spacing = num_total_points/hundred;
-  double inc_amount = 1.0 / hundred;
+  double inc_amount = 1.0 / std::max(vw::int64(1), num_chunks);
   if (verbose) tpc.report_progress(0);
 
-  while (reader.ReadNextPoint()){
-
-    if (points_count >= num_points_to_load)
-      break;
+  // Exceptions cannot leave a parallel loop, so they are thrown after it
+  std::string error;
+
+#pragma omp parallel for schedule(dynamic)
+  for (vw::int64 k = 0; k < num_chunks; k++) {
+
+    vw::int64 begin = k*LAS_CHUNK_SIZE;
+    vw::int64 end   = std::min(begin + LAS_CHUNK_SIZE, num_total_points);
+    vw::int64 col   = start[k];
+    vw::int64 num_to_pick = start[k+1] - start[k];
+
+    try {
+      std::ifstream ifs;
+      ifs.open(file_name.c_str(), std::ios::in | std::ios::binary);
+      liblas::ReaderFactory f;
+      liblas::Reader reader = f.CreateWithStream(ifs);
+
+      // Each chunk has its own seed, so the result does not depend on
+      // the number of threads.
+      boost::random::mt19937 gen(static_cast<unsigned int>(k));
+      boost::random::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+      vw::int64 next = 0; // the index of the point the reader will return next
+      for (vw::int64 i = begin; i < end && num_to_pick > 0; i++) {
+
+        // Pick this point with probability num_to_pick/(end - i). This
+        // picks exactly the given number of points in the chunk, and any
+        // such set of points is equally likely.
+        if (double(end - i)*uniform(gen) >= double(num_to_pick))
+          continue;
+        num_to_pick--;
+
+        if (i < next || i > next + LAS_MAX_READ_AHEAD) {
+          reader.Seek(i);
+          next = i;
+        }
+        bool success = true;
+        while (next <= i && success) {
+          success = reader.ReadNextPoint();
+          next++;
+        }
+        if (!success)
+          break;
+
+        liblas::Point const& p = reader.GetPoint();
+        vw::Vector3 xyz(p.GetX(), p.GetY(), p.GetZ());
+        if (has_georef){
+          vw::Vector2 ll = las_georef.point_to_lonlat(subvector(xyz, 0, 2));
+          xyz = las_georef.datum().geodetic_to_cartesian(vw::Vector3(ll[0], ll[1], xyz[2]));
+        }
 
-    double r = (double)std::rand()/(double)RAND_MAX;
-    if (r > load_ratio)
-      continue;
+        // Skip points outside the given box
+        if (!lonlat_box.empty()){
+          vw::Vector3 llh = geo.datum().cartesian_to_geodetic(xyz);
+          if ( !lonlat_box.contains(subvector(llh, 0, 2)))
+            continue;
+        }
 
-    liblas::Point const& p = reader.GetPoint();
-    vw::Vector3 xyz(p.GetX(), p.GetY(), p.GetZ());
-    if (has_georef){
-      vw::Vector2 ll = las_georef.point_to_lonlat(subvector(xyz, 0, 2));
-      xyz = las_georef.datum().geodetic_to_cartesian(vw::Vector3(ll[0], ll[1], xyz[2]));
+        // The shift is applied below, once the first point is known
+        for (int row = 0; row < DIM; row++)
+          data(row, col) = xyz[row];
+        col++;
+      }
+    } catch (std::exception const& e) {
+#pragma omp critical
+      error = e.what();
     }
 
-    if (calc_shift && !shift_was_calc){
-      shift = xyz;
-      shift_was_calc = true;
-    }
+    count[k] = col - start[k];
 
-    // Skip points outside the given box
-    if (!lonlat_box.empty()){
-      vw::Vector3 llh = geo.datum().cartesian_to_geodetic(xyz);
-      if ( !lonlat_box.contains(subvector(llh, 0, 2)))
-        continue;
+    if (verbose) {
+#pragma omp critical
+      tpc.report_incremental_progress( inc_amount );
     }
+  }
 
-    for (int row = 0; row < DIM; row++)
-      data(row, points_count) = xyz[row] - shift[row];
-    data(DIM, points_count) = 1;
+  if (verbose) tpc.report_finished();
 
-    if (verbose && points_count%spacing == 0) tpc.report_incremental_progress( inc_amount );
+  if (!error.empty())
+    vw_throw(vw::IOErr() << "Failed to read: " << file_name << ". " << error << "\n");
 
-    points_count++;
-  }
+  // Move the points of each chunk right after those of the previous
+  // chunks, in place, and apply the shift.
+  bool shift_was_calc = false;
+  vw::int64 points_count = 0;
+  for (vw::int64 k = 0; k < num_chunks; k++) {
+    for (vw::int64 col = start[k]; col < start[k] + count[k]; col++) {
 
-  if (verbose) tpc.report_finished();
+      if (calc_shift && !shift_was_calc){
+        for (int row = 0; row < DIM; row++)
+          shift[row] = data(row, col);
+        shift_was_calc = true;
+      }
+
+      for (int row = 0; row < DIM; row++)
+        data(row, points_count) = data(row, col) - shift[row];
+      data(DIM, points_count) = 1;
+
+      points_count++;
+    }
+  }
 
   data.conservativeResize(Eigen::NoChange, points_count);
 
@@ -172,6 +246,179 @@ void load_las(std::string const& file_name,
 
 }
 
+// Load a sample of the points of a binary cloud. Only the chunks whose
+// boxes intersect the lon-lat box are read, in parallel, with a reader
+// per thread.
+vw::int64 load_binary_aux(std::string const& file_name,
+                          int num_points_to_load,
+                          vw::BBox2 const& lonlat_box,
+                          bool calc_shift,
+                          vw::Vector3 & shift,
+                          vw::cartography::GeoReference const& geo,
+                          bool verbose, DoubleMatrix & data){
+
+  std::vector<int> chunks;
+  std::vector<vw::int64> chunk_sizes;
+  vw::int64 num_total_points = 0;
+  {
+    BinaryCloudReader reader(file_name);
+    chunks = reader.chunks_in_lonlat_box(lonlat_box);
+    for (size_t k = 0; k < chunks.size(); k++) {
+      chunk_sizes.push_back(reader.chunk(chunks[k]).num_points);
+      num_total_points += chunk_sizes.back();
+    }
+  }
+
+  if (num_points_to_load > num_total_points)
+    num_points_to_load = num_total_points;
+  if (num_points_to_load < 0)
+    num_points_to_load = 0;
+
+  data.conservativeResize(DIM+1, num_points_to_load);
+
+  // Each chunk gets a number of the points to load proportional to its
+  // size, and the chunk k fills the columns starting at start[k].
+  vw::int64 num_chunks = chunks.size();
+  std::vector<vw::int64> start(num_chunks + 1, 0), count(num_chunks, 0);
+  vw::int64 end = 0;
+  for (vw::int64 k = 0; k < num_chunks; k++) {
+    end += chunk_sizes[k];
+    start[k+1] = vw::int64(double(num_points_to_load)*double(end)/double(num_total_points));
+  }
+  if (num_chunks > 0)
+    start[num_chunks] = num_points_to_load;
+
+  vw::TerminalProgressCallback tpc("asp", "\t--> ");
+  double inc_amount = 1.0 / std::max(vw::int64(1), num_chunks);
+  if (verbose) tpc.report_progress(0);
+
+  // Exceptions cannot leave a parallel loop, so they are thrown after it
+  std::string error;
+
+#pragma omp parallel
+  {
+    boost::shared_ptr<BinaryCloudReader> reader;
+    try {
+      reader.reset(new BinaryCloudReader(file_name));
+    } catch (std::exception const& e) {
+#pragma omp critical
+      error = e.what();
+    }
+    BinaryCloudPoints points;
+
+#pragma omp for schedule(dynamic)
+    for (vw::int64 k = 0; k < num_chunks; k++) {
+
+      vw::int64 col = start[k];
+      vw::int64 num_to_pick = start[k+1] - start[k];
+
+      try {
+        if (reader)
+          reader->read_chunk(chunks[k], points);
+        else
+          points.clear();
+
+        // Each chunk has its own seed, so the result does not depend on
+        // the number of threads.
+        boost::random::mt19937 gen(static_cast<unsigned int>(chunks[k]));
+        boost::random::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+        vw::int64 end = points.size();
+        for (vw::int64 i = 0; i < end && num_to_pick > 0; i++) {
+
+          // Pick this point with probability num_to_pick/(end - i), as
+          // for LAS files.
+          if (double(end - i)*uniform(gen) >= double(num_to_pick))
+            continue;
+          num_to_pick--;
+
+          vw::Vector3 const& xyz = points.xyz[i];
+
+          // Skip points outside the given box
+          if (!lonlat_box.empty()){
+            vw::Vector3 llh = geo.datum().cartesian_to_geodetic(xyz);
+            if ( !lonlat_box.contains(subvector(llh, 0, 2)))
+              continue;
+          }
+
+          // The shift is applied below, once the first point is known
+          for (int row = 0; row < DIM; row++)
+            data(row, col) = xyz[row];
+          col++;
+        }
+      } catch (std::exception const& e) {
+#pragma omp critical
+        error = e.what();
+      }
+
+      count[k] = col - start[k];
+
+      if (verbose) {
+#pragma omp critical
+        tpc.report_incremental_progress( inc_amount );
+      }
+    }
+  }
+
+  if (verbose) tpc.report_finished();
+
+  if (!error.empty())
+    vw_throw(vw::IOErr() << "Failed to read: " << file_name << ". " << error << "\n");
+
+  // Move the points of each chunk right after those of the previous
+  // chunks, in place, and apply the shift.
+  bool shift_was_calc = false;
+  vw::int64 points_count = 0;
+  for (vw::int64 k = 0; k < num_chunks; k++) {
+    for (vw::int64 col = start[k]; col < start[k] + count[k]; col++) {
+
+      if (calc_shift && !shift_was_calc){
+        for (int row = 0; row < DIM; row++)
+          shift[row] = data(row, col);
+        shift_was_calc = true;
+      }
+
+      for (int row = 0; row < DIM; row++)
+        data(row, points_count) = data(row, col) - shift[row];
+      data(DIM, points_count) = 1;
+
+      points_count++;
+    }
+  }
+
+  data.conservativeResize(Eigen::NoChange, points_count);
+
+  return num_total_points;
+}
+
+void load_binary(std::string const& file_name,
+                 int num_points_to_load,
+                 vw::BBox2 const& lonlat_box,
+                 bool calc_shift,
+                 vw::Vector3 & shift,
+                 vw::cartography::GeoReference const& geo,
+                 bool verbose, DoubleMatrix & data){
+
+  vw::int64 num_total_points = load_binary_aux(file_name, num_points_to_load,
+                                               lonlat_box, calc_shift, shift,
+                                               geo, verbose, data);
+
+  int num_loaded_points = data.cols();
+  if (!lonlat_box.empty()                    &&
+      num_loaded_points < num_points_to_load &&
+      num_loaded_points < num_total_points){
+
+    // Some points of the chunks which were read are outside the box.
+    // Try harder, as for LAS files.
+    num_points_to_load = std::max(4*num_points_to_load, 10000000);
+    if (verbose)
+      vw::vw_out() << "Too few points were loaded. Trying again." << std::endl;
+    load_binary_aux(file_name, num_points_to_load, lonlat_box,
+                    calc_shift, shift, geo, verbose, data);
+  }
+
+}
+
 // Load xyz points from disk into a matrix with 4 columns. Last column is just ones.
 void load_cloud(std::string const& file_name,
                int num_points_to_load,
@@ -202,6 +449,9 @@ void load_cloud(std::string const& file_name,
   else if (file_type == "LAS")
     load_las(file_name, num_points_to_load, lonlat_box, calc_shift, shift,
 	     geo, verbose, data);
+  else if (file_type == "BINARY")
+    load_binary(file_name, num_points_to_load, lonlat_box, calc_shift, shift,
+                geo, verbose, data);
   else if (file_type == "CSV"){
     bool verbose = true;
     load_csv(file_name, num_points_to_load, lonlat_box, 
@@ -436,6 +686,32 @@ vw::Vector3 apply_transform(PointMatcher<RealT>::Matrix const& T, vw::Vector3 co
     return Q;
 }
 
+void apply_transform_to_points(PointMatcher<RealT>::Matrix const& T,
+                               bool has_georef,
+                               vw::cartography::GeoReference const& georef,
+                               std::vector<vw::Vector3> & points){
+
+  TransformPC trans(T);
+  vw::int64 num_points = points.size();
+#pragma omp parallel for
+  for (vw::int64 i = 0; i < num_points; i++) {
+    vw::Vector3 P = points[i];
+    if (has_georef){
+      // Go from projected space to xyz
+      vw::Vector2 ll = georef.point_to_lonlat(subvector(P, 0, 2));
+      P = georef.datum().geodetic_to_cartesian(vw::Vector3(ll[0], ll[1], P[2]));
+    }
+    P = trans.apply(P);
+    if (has_georef){
+      // Go from xyz to projected space
+      vw::Vector3 llh = georef.datum().cartesian_to_geodetic(P);
+      subvector(P, 0, 2) = georef.lonlat_to_point(subvector(llh, 0, 2));
+      P[2] = llh[2];
+    }
+    points[i] = P;
+  }
+}
+
 /// Apply a given transform to the point cloud in input file,
 /// and save it.
 /// - Note: We transform the entire point cloud, not just the resampled
@@ -454,6 +730,8 @@ void save_trans_point_cloud(vw::cartography::GdalWriteOptions const& opt,
     output_file = out_prefix + ".csv";
   else if (file_type == "LAS")
     output_file = out_prefix + boost::filesystem::path(input_file).extension().string();
+  else if (file_type == "BINARY")
+    output_file = out_prefix + ".pcb";
   else
     output_file = out_prefix + ".tif";
   vw::vw_out() << "Writing: " << output_file << std::endl;
@@ -515,36 +793,58 @@ void save_trans_point_cloud(vw::cartography::GdalWriteOptions const& opt,
     ofs.open(output_file.c_str(), std::ios::out | std::ios::binary);
     liblas::Writer writer(ofs, header);
 
+    // Read a chunk of points, transform it in parallel, and write it.
+    // The reading and writing cannot be done in parallel, as the
+    // points are written in the order they are read, to one stream.
     vw::TerminalProgressCallback tpc("asp", "\t--> ");
-    int hundred = 100;
-    int spacing = num_total_points/hundred;
-    double inc_amount = 1.0 / hundred;
-    vw::int64 count = 0;
-    while (reader.ReadNextPoint()){
-
-      liblas::Point const& in_las_pt = reader.GetPoint();
-      vw::Vector3 P(in_las_pt.GetX(), in_las_pt.GetY(), in_las_pt.GetZ());
-      if (has_georef){
-        // Go from projected space to xyz
-        vw::Vector2 ll = las_georef.point_to_lonlat(subvector(P, 0, 2));
-        P = las_georef.datum().geodetic_to_cartesian(vw::Vector3(ll[0], ll[1], P[2]));
-      }
-      P = apply_transform(T, P);
-      if (has_georef){
-        // Go from xyz to projected space
-        vw::Vector3 llh = las_georef.datum().cartesian_to_geodetic(P);
-        subvector(P, 0, 2) = las_georef.lonlat_to_point(subvector(llh, 0, 2));
-        P[2] = llh[2];
+    vw::int64 num_chunks = (num_total_points + LAS_CHUNK_SIZE - 1)/LAS_CHUNK_SIZE;
+    double inc_amount = 1.0 / std::max(vw::int64(1), num_chunks);
+    std::vector<vw::Vector3> points;
+    bool done = false;
+    while (!done){
+
+      points.clear();
+      while ((vw::int64)points.size() < LAS_CHUNK_SIZE){
+        if (!reader.ReadNextPoint()){
+          done = true;
+          break;
+        }
+        liblas::Point const& in_las_pt = reader.GetPoint();
+        points.push_back(vw::Vector3(in_las_pt.GetX(), in_las_pt.GetY(), in_las_pt.GetZ()));
       }
 
+      apply_transform_to_points(T, has_georef, las_georef, points);
+
       liblas::Point out_las_pt(&header);
-      out_las_pt.SetCoordinates(P[0], P[1], P[2]);
-      writer.WritePoint(out_las_pt);
+      for (size_t i = 0; i < points.size(); i++){
+        out_las_pt.SetCoordinates(points[i][0], points[i][1], points[i][2]);
+        writer.WritePoint(out_las_pt);
+      }
+
+      tpc.report_incremental_progress( inc_amount );
+    }
+    tpc.report_finished();
+
+  }else if (file_type == "BINARY"){
 
-      if (count%spacing == 0) tpc.report_incremental_progress( inc_amount );
+    // The chunks and attributes of the input are kept, so the output
+    // can be read as selectively
+    BinaryCloudReader reader(input_file);
+    BinaryCloudWriter writer(output_file, reader.attributes(),
+                             reader.has_georef() ? &reader.georef() : NULL);
 
-      count++;
+    vw::TerminalProgressCallback tpc("asp", "\t--> ");
+    double inc_amount = 1.0 / std::max(1, reader.num_chunks());
+    BinaryCloudPoints points;
+    vw::cartography::GeoReference no_georef; // The points are Cartesian
+    for (int k = 0; k < reader.num_chunks(); k++){
+      reader.read_chunk(k, points);
+      apply_transform_to_points(T, false, no_georef, points.xyz);
+      writer.add_points(points);
+      writer.end_chunk();
+      tpc.report_incremental_progress( inc_amount );
     }
+    writer.close();
     tpc.report_finished();
 
   }else if (file_type == "CSV"){
@@ -583,40 +883,53 @@ void save_trans_point_cloud(vw::cartography::GdalWriteOptions const& opt,
       outfile << "# Projection: " << geo.overall_proj4_str() << std::endl;
     }
 
-    int numPts = point_cloud.features.cols();
+    // The points are transformed and formatted in parallel, a chunk
+    // at a time, then the chunk is written.
+    TransformPC trans(T);
+    vw::int64 numPts = point_cloud.features.cols();
+    vw::int64 num_chunks = (numPts + LAS_CHUNK_SIZE - 1)/LAS_CHUNK_SIZE;
     vw::TerminalProgressCallback tpc("asp", "\t--> ");
-    int hundred = 100;
-    int spacing = numPts/hundred;
-    double inc_amount = 1.0 / hundred;
-    for (int col = 0; col < numPts; col++){
+    double inc_amount = 1.0 / std::max(vw::int64(1), num_chunks);
+    std::vector<std::string> lines;
+    for (vw::int64 k = 0; k < num_chunks; k++){
 
-      Eigen::VectorXd V(DIM + 1);
-      for (int row = 0; row < DIM; row++)
-        V[row] = point_cloud.features(row, col) + shift[row];
-      V[DIM] = 1;
+      vw::int64 begin = k*LAS_CHUNK_SIZE;
+      vw::int64 end   = std::min(begin + LAS_CHUNK_SIZE, numPts);
+      lines.resize(end - begin);
 
-      // Apply the transform
-      V = T*V;
+#pragma omp parallel for
+      for (vw::int64 col = begin; col < end; col++){
 
-      vw::Vector3 P;
-      for (int row = 0; row < DIM; row++) P[row] = V[row];
+        vw::Vector3 P;
+        for (int row = 0; row < DIM; row++)
+          P[row] = point_cloud.features(row, col) + shift[row];
 
-      if (csv_conv.is_configured()){
+        // Apply the transform
+        P = trans.apply(P);
 
-        vw::Vector3 csv = csv_conv.cartesian_to_csv(P, geo, mean_longitude);
-        outfile << csv[0] << ',' << csv[1] << ',' << csv[2] << std::endl;
+        std::ostringstream os;
+        os.precision(16);
+        if (csv_conv.is_configured()){
 
-      }else{
-        vw::Vector3 llh = geo.datum().cartesian_to_geodetic(P); // lon-lat-height
-        llh[0] += 360.0*round((mean_longitude - llh[0])/360.0); // 360 deg adjustment
+          vw::Vector3 csv = csv_conv.cartesian_to_csv(P, geo, mean_longitude);
+          os << csv[0] << ',' << csv[1] << ',' << csv[2] << '\n';
 
-        if (is_lola_rdr_format)
-          outfile << llh[0] << ',' << llh[1] << ',' << norm_2(P)/1000.0 << std::endl;
-        else
-          outfile << llh[1] << ',' << llh[0] << ',' << llh[2] << std::endl;
+        }else{
+          vw::Vector3 llh = geo.datum().cartesian_to_geodetic(P); // lon-lat-height
+          llh[0] += 360.0*round((mean_longitude - llh[0])/360.0); // 360 deg adjustment
+
+          if (is_lola_rdr_format)
+            os << llh[0] << ',' << llh[1] << ',' << norm_2(P)/1000.0 << '\n';
+          else
+            os << llh[1] << ',' << llh[0] << ',' << llh[2] << '\n';
+        }
+        lines[col - begin] = os.str();
       }
 
-      if (col%spacing == 0) tpc.report_incremental_progress( inc_amount );
+      for (size_t i = 0; i < lines.size(); i++)
+        outfile << lines[i];
+
+      tpc.report_incremental_progress( inc_amount );
     }
     tpc.report_finished();
     outfile.close();
@@ -19,19 +19,22 @@
 /// \file pc_merge.cc
 ///
 /// A simple tool to merge multiple point cloud files into a single file. The clouds
-/// can have 1 channel (plain raster images) or 3 to 6 channels.
+/// can have 1 channel (plain raster images) or 3 to 6 channels. If the output
+/// is a binary cloud (.pcb), the inputs can be point cloud tifs or binary clouds.
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/BinaryCloud.h>
 #include <asp/Core/OrthoRasterizer.h>
 
 #include <vw/Core/Stopwatch.h>
-#include <vw/Mosaic/ImageComposite.h>
 #include <vw/FileIO/DiskImageUtils.h>
+#include <vw/Cartography.h>
 #include <vw/Cartography/PointImageManipulation.h>
 
 #include <limits>
+#include <algorithm>
 
 using namespace vw;
 using namespace vw::cartography;
@@ -100,94 +103,114 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 }
 
 
-/// Throws if the input point clouds do not have the same number of channels.
-/// - Returns the number of channels.
-int check_num_channels(std::vector<std::string> const& pc_files){
+/// What is needed from the header of each input cloud.
+struct CloudInfo {
+  int     num_channels;
+  double  num_pixels;
+  bool    has_shift;
+  Vector3 shift;
+};
+
+/// Read the header of each input cloud, opening each file only once.
+/// Also find a georeference, if any of the inputs has one. Of course
+/// it will be wrong when applied to the merged cloud, but it will at
+/// least have the correct datum and projection.
+void read_cloud_headers(std::vector<std::string> const& pc_files,
+                        std::vector<CloudInfo> & infos,
+                        bool & has_georef, GeoReference & georef){
   VW_ASSERT(pc_files.size() >= 1,
             ArgumentErr() << "Expecting at least one file.\n");
 
-  int target_num = get_num_channels(pc_files[0]);
-  for (int i = 1; i < (int)pc_files.size(); ++i){
-    int num_channels = get_num_channels(pc_files[i]);
-    if (num_channels != target_num)
+  infos.resize(pc_files.size());
+  has_georef = false;
+  for (size_t i = 0; i < pc_files.size(); i++) {
+    DiskImageResourceGDAL rsrc(pc_files[i]);
+    ImageFormat fmt = rsrc.format();
+    infos[i].num_channels = fmt.planes * num_channels(fmt.pixel_format);
+    infos[i].num_pixels   = double(fmt.cols) * double(fmt.rows);
+
+    std::string shift_str;
+    infos[i].has_shift = read_header_string(rsrc, asp::ASP_POINT_OFFSET_TAG_STR, shift_str);
+    infos[i].shift     = Vector3();
+    if (infos[i].has_shift)
+      infos[i].shift = asp::str_to_vec<vw::Vector3>(shift_str);
+
+    GeoReference local_georef;
+    if (read_georeference(local_georef, rsrc)){
+      georef = local_georef;
+      has_georef = true;
+    }
+  }
+}
+
+/// Throws if the input point clouds do not have the same number of channels.
+/// - Returns the number of channels.
+int check_num_channels(std::vector<CloudInfo> const& infos){
+
+  int target_num = infos[0].num_channels;
+  for (size_t i = 1; i < infos.size(); ++i){
+    if (infos[i].num_channels != target_num)
       vw_throw( ArgumentErr() << "Input point clouds must all have the same number of channels!.\n" );
   }
   return target_num;
 }
 
 /// Determine the common shift value to use for the output files
-Vector3 determine_output_shift(std::vector<std::string> const& pc_files, Options const& opt){
+Vector3 determine_output_shift(std::vector<CloudInfo> const& infos, Options const& opt){
 
   // If writing to double format, no shift is needed.
   if (opt.write_double)
     return Vector3(0,0,0);
 
-  // As an approximation, compute the mean shift vector of the input files.
+  // Use the mean of the shifts of the input files, weighted by the
+  // number of pixels in each, so that the largest clouds lose the least
+  // precision when cast to float.
   // - If none of the input files have a shift, the output file will be written as a double.
-  vw::Vector3 shift(0,0,0), shiftIn;
-  double shift_count = 0;
-  for (size_t i=0; i<pc_files.size(); ++i) {
-    // Read in the shift from each cloud and accumulate them
-    std::string shift_str;
-    boost::shared_ptr<vw::DiskImageResource> rsrc( new vw::DiskImageResourceGDAL(pc_files[i]) );
-    if (vw::cartography::read_header_string(*rsrc.get(), asp::ASP_POINT_OFFSET_TAG_STR, shift_str)){
-      //std::cout << "shift string = " << shift_str << std::endl;
-      shift += asp::str_to_vec<vw::Vector3>(shift_str);
-      shift_count += 1.0;
-    }
+  vw::Vector3 shift(0,0,0);
+  double weight = 0;
+  for (size_t i = 0; i < infos.size(); ++i) {
+    if (!infos[i].has_shift)
+      continue;
+    double w = std::max(infos[i].num_pixels, 1.0);
+    shift  += w*infos[i].shift;
+    weight += w;
   }
-  if (shift_count < 0.9) // If no shifts read, don't use a shift.
+  if (weight == 0) // If no shifts read, don't use a shift.
     return Vector3(0,0,0);
 
-  // Compute the mean shift
-  // - It would be more accurate to weight the shift according to the number of input points
-  shift /= shift_count;
+  shift /= weight;
   return shift;
 }
 
-
 // Do the actual work of loading, merging, and saving the point clouds
 
 // Case 1: Single-channel cloud.
 template <class PixelT>
 typename boost::enable_if<boost::is_same<PixelT, vw::PixelGray<float> >, void >::type
-do_work(Vector3 const& shift, Options const& opt) {
+do_work(Vector3 const& shift, bool has_georef, GeoReference const& georef,
+        Options const& opt) {
   // The spacing is selected to be compatible with the point2dem convention.
   const int spacing = asp::OrthoRasterizerView::max_subblock_size();
-  ImageViewRef<PixelT> merged_cloud = asp::form_point_cloud_composite<PixelT>(opt.pointcloud_files, spacing);
+  asp::PointCloudStackView<PixelT> merged_cloud(opt.pointcloud_files, spacing);
 
   vw_out() << "Writing image: " << opt.out_file << "\n";
 
-  bool has_georef = false;
-  bool has_nodata = false;
+  // The georeference of the inputs is not used for plain images
+  bool has_nodata  = false;
   double nodata = -std::numeric_limits<float>::max(); // smallest float
-  GeoReference georef;
-  vw::cartography::block_write_gdal_image(opt.out_file, merged_cloud, has_georef,
-                              georef,  has_nodata, nodata, opt,
+  vw::cartography::block_write_gdal_image(opt.out_file, merged_cloud, false,
+                              GeoReference(),  has_nodata, nodata, opt,
                               TerminalProgressCallback("asp", "\t--> Merging: "));
 }
 
 // Case 2: Multi-channel cloud.
 template <class PixelT>
 typename boost::disable_if<boost::is_same<PixelT, vw::PixelGray<float> >, void >::type
-do_work(Vector3 const& shift, Options const& opt) {
+do_work(Vector3 const& shift, bool has_georef, GeoReference const& georef,
+        Options const& opt) {
   // The spacing is selected to be compatible with the point2dem convention.
   const int spacing = asp::OrthoRasterizerView::max_subblock_size();
-  ImageViewRef<PixelT> merged_cloud = asp::form_point_cloud_composite<PixelT>(opt.pointcloud_files, spacing);
-
-  // See if we can pull a georeference from somewhere. Of course it will be wrong
-  // when applied to the merged cloud, but it will at least have the correct datum
-  // and projection.
-  bool has_georef = false;
-  cartography::GeoReference georef;
-  for (size_t i = 0; i < opt.pointcloud_files.size(); i++){
-    cartography::GeoReference local_georef;
-
-    if (read_georeference(local_georef, opt.pointcloud_files[i])){
-      georef = local_georef;
-      has_georef = true;
-    }
-  }
+  asp::PointCloudStackView<PixelT> merged_cloud(opt.pointcloud_files, spacing);
 
   bool has_nodata = false;
   double nodata = -std::numeric_limits<float>::max(); // smallest float
@@ -205,6 +228,103 @@ do_work(Vector3 const& shift, Options const& opt) {
       opt, TerminalProgressCallback("asp", "\t--> Merging: "));
 }
 
+/// Append the points of a tif cloud to a binary cloud, with a chunk per
+/// tile, so that each chunk has points which are close together. The
+/// fourth channel of a cloud written by stereo is the triangulation
+/// error, which is kept if the output has the error attribute.
+template <class PixelT>
+void append_tif_to_binary(std::string const& file, asp::BinaryCloudWriter & writer,
+                          bool keep_error){
+
+  ImageViewRef<PixelT> cloud
+    = asp::point_utils_private::read_point_cloud_compatible_file<PixelT>(file);
+
+  const int tile_len = 256;
+  std::vector<BBox2i> tiles = subdivide_bbox(cloud, tile_len, tile_len);
+  TerminalProgressCallback tpc("asp", "\t--> ");
+  double inc_amount = 1.0 / std::max(size_t(1), tiles.size());
+  for (size_t t = 0; t < tiles.size(); t++){
+    ImageView<PixelT> tile = crop(cloud, tiles[t]);
+    for (int row = 0; row < tile.rows(); row++){
+      for (int col = 0; col < tile.cols(); col++){
+        Vector3 xyz = subvector(tile(col, row), 0, 3);
+        if (xyz == Vector3()) // invalid point
+          continue;
+        double error = keep_error ? tile(col, row)[3] : 0.0;
+        writer.add_point(xyz, 0.0, error, 0.0);
+      }
+    }
+    writer.end_chunk();
+    tpc.report_incremental_progress( inc_amount );
+  }
+  tpc.report_finished();
+}
+
+/// Merge the inputs into a binary cloud. The output keeps only the
+/// attributes which all inputs have.
+void merge_to_binary(Options const& opt){
+
+  // Find the common attributes and a georeference
+  int attributes = (1 << asp::BINARY_CLOUD_NUM_ATTRIBUTES) - 1;
+  std::vector<int> num_channels(opt.pointcloud_files.size(), 0);
+  for (size_t i = 0; i < opt.pointcloud_files.size(); i++){
+    std::string const& file = opt.pointcloud_files[i];
+    if (asp::is_binary_cloud(file)){
+      asp::BinaryCloudReader reader(file);
+      attributes &= reader.attributes();
+    }else{
+      num_channels[i] = get_num_channels(file);
+      if (num_channels[i] < 3)
+        vw_throw( ArgumentErr() << "Not a point cloud: " << file << "\n" );
+      attributes &= (num_channels[i] >= 4 ? asp::BINARY_CLOUD_ERROR : 0);
+    }
+  }
+  GeoReference georef;
+  bool has_georef = asp::georef_from_pc_files(opt.pointcloud_files, georef);
+
+  vw_out() << "Writing point cloud: " << opt.out_file << "\n";
+  asp::BinaryCloudWriter writer(opt.out_file, attributes, has_georef ? &georef : NULL);
+  bool keep_error = ((attributes & asp::BINARY_CLOUD_ERROR) != 0);
+
+  for (size_t i = 0; i < opt.pointcloud_files.size(); i++){
+    std::string const& file = opt.pointcloud_files[i];
+    vw_out() << "Adding: " << file << "\n";
+
+    if (num_channels[i] == 3){
+      append_tif_to_binary<Vector3>(file, writer, keep_error);
+    }else if (num_channels[i] == 4){
+      append_tif_to_binary<Vector4>(file, writer, keep_error);
+    }else if (num_channels[i] == 6){
+      append_tif_to_binary<Vector6>(file, writer, keep_error);
+    }else if (num_channels[i] != 0){
+      vw_throw( ArgumentErr() << "Unsupported number of channels in: " << file << "\n" );
+    }else{
+      // Copy the chunks of a binary cloud, with the attributes the
+      // output has
+      asp::BinaryCloudReader reader(file);
+      asp::BinaryCloudPoints points;
+      for (int k = 0; k < reader.num_chunks(); k++){
+        reader.read_chunk(k, points);
+        for (size_t p = 0; p < points.size(); p++){
+          double values[asp::BINARY_CLOUD_NUM_ATTRIBUTES] = {0.0, 0.0, 0.0};
+          int col = 0;
+          for (int a = 0; a < asp::BINARY_CLOUD_NUM_ATTRIBUTES; a++){
+            if (reader.attributes() & (1 << a)){
+              values[a] = points.attributes[col][p];
+              col++;
+            }
+          }
+          writer.add_point(points.xyz[p], values[0], values[1], values[2]);
+        }
+        writer.end_chunk();
+      }
+    }
+  }
+
+  writer.close();
+  vw_out() << "Wrote " << writer.num_points() << " points.\n";
+}
+
 //-----------------------------------------------------------------------------------
 
 int main( int argc, char *argv[] ) {
@@ -213,21 +333,32 @@ int main( int argc, char *argv[] ) {
   try {
     handle_arguments( argc, argv, opt );
 
+    if (asp::is_binary_cloud(opt.out_file)){
+      merge_to_binary(opt);
+      return 0;
+    }
+
+    // Read the headers of the inputs once
+    std::vector<CloudInfo> infos;
+    bool has_georef = false;
+    GeoReference georef;
+    read_cloud_headers(opt.pointcloud_files, infos, has_georef, georef);
+
     // Determine the number of channels
-    int num_channels = check_num_channels(opt.pointcloud_files);
+    int num_channels = check_num_channels(infos);
 
     // Determine the output shift (if any)
-    Vector3 shift = determine_output_shift(opt.pointcloud_files, opt);
+    Vector3 shift = determine_output_shift(infos, opt);
 
     // The code has to branch here depending on the number of channels
     switch (num_channels)
     {
       // The input point clouds have their shift incorporated and are stored as doubles.
       // If the output file is stored as float, it needs to have a single shift value applied.
-      case 1:  do_work< vw::PixelGray<float> >(shift, opt); break;
-      case 3:  do_work<Vector3>(shift, opt); break;
-      case 4:  do_work<Vector4>(shift, opt); break;
-      case 6:  do_work<Vector6>(shift, opt); break;
+      case 1:  do_work< vw::PixelGray<float> >(shift, has_georef, georef, opt); break;
+      case 3:  do_work<Vector3>(shift, has_georef, georef, opt); break;
+      case 4:  do_work<Vector4>(shift, has_georef, georef, opt); break;
+      case 6:  do_work<Vector6>(shift, has_georef, georef, opt); break;
       default: vw_throw( ArgumentErr() << "Unsupported number of channels!.\n" );
     }
 
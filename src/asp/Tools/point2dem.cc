@@ -20,7 +20,10 @@
 ///
 
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/BinaryCloud.h>
 #include <asp/Core/OrthoRasterizer.h>
+#include <asp/Core/PointCloudStats.h>
+#include <asp/Core/HoleFill.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/StereoSettings.h>
@@ -86,7 +89,7 @@ struct Options : vw::cartography::GdalWriteOptions {
   double      rounding_error;
   std::string target_srs_string;
   BBox2       target_projwin;
-  int         fsaa, dem_hole_fill_len, ortho_hole_fill_len, ortho_hole_fill_extra_len;
+  int         fsaa, dem_hole_fill_len, dem_pyramid_hole_fill_len, ortho_hole_fill_len, ortho_hole_fill_extra_len;
   bool        remove_outliers_with_pct;
   Vector2     remove_outliers_params;
   double      max_valid_triangulation_error;
@@ -95,7 +98,7 @@ struct Options : vw::cartography::GdalWriteOptions {
   std::string csv_format_str, csv_proj4_str, filter;
   double      search_radius_factor, sigma_factor, default_grid_size_multiplier;
   bool        use_surface_sampling;
-  bool        has_las_or_csv;
+  bool        has_las_or_csv, stream_las_csv, dem_pyramid, cog;
   Vector2i    max_output_size;
 
   // Output
@@ -104,11 +107,12 @@ struct Options : vw::cartography::GdalWriteOptions {
   // Defaults that the user doesn't need to see.
   Options() : nodata_value(-std::numeric_limits<float>::max()),
 	      semi_major(0), semi_minor(0), fsaa(1),
-	      dem_hole_fill_len(0), ortho_hole_fill_len(0), ortho_hole_fill_extra_len(0),
+	      dem_hole_fill_len(0), dem_pyramid_hole_fill_len(0), ortho_hole_fill_len(0), ortho_hole_fill_extra_len(0),
 	      remove_outliers_with_pct(true), max_valid_triangulation_error(0),
 	      erode_len(0), search_radius_factor(0), sigma_factor(0),
 	      default_grid_size_multiplier(1.0), use_surface_sampling(false),
-	      has_las_or_csv(false), max_output_size(9999999, 9999999){}
+	      has_las_or_csv(false), stream_las_csv(false), dem_pyramid(false), cog(false),
+	      max_output_size(9999999, 9999999){}
 };
 
 void parse_input_clouds_textures(std::vector<std::string> const& files,
@@ -154,7 +158,7 @@ void parse_input_clouds_textures(std::vector<std::string> const& files,
   // Separate the input point clouds from the textures
   opt.pointcloud_files.clear(); opt.texture_files.clear();
   for (int i = 0; i < num; i++){
-    if (asp::is_las_or_csv(files[i]) || get_num_channels(files[i]) >= 3)
+    if (asp::is_las_csv_or_binary(files[i]) || get_num_channels(files[i]) >= 3)
       opt.pointcloud_files.push_back(files[i]);
     else
       opt.texture_files.push_back(files[i]);
@@ -170,10 +174,10 @@ void parse_input_clouds_textures(std::vector<std::string> const& files,
   // are tif.
   opt.has_las_or_csv = false;
   for (int i = 0; i < (int)files.size(); i++)
-    opt.has_las_or_csv = opt.has_las_or_csv || asp::is_las_or_csv(files[i]);
+    opt.has_las_or_csv = opt.has_las_or_csv || asp::is_las_csv_or_binary(files[i]);
   if (opt.has_las_or_csv && opt.do_ortho)
     vw_throw( ArgumentErr() << "Cannot create orthoimages if "
-	      << "point clouds are LAS or CSV.\n" );
+	      << "point clouds are LAS, CSV, or binary.\n" );
 
   if (opt.do_ortho){
 
@@ -198,9 +202,11 @@ void parse_input_clouds_textures(std::vector<std::string> const& files,
 
 }
 
-/// Convert any LAS or CSV files to ASP tif files. We do some binning
+/// Convert any LAS, CSV, or binary cloud files to ASP tif files. We do some binning
 /// to make the spatial data more localized, to improve performance.
-/// - We will later wipe these temporary tifs.
+/// - With --stream-las-csv, the points are instead binned into raw
+///   files, each with a VRT header which is read as a tif.
+/// - We will later wipe these temporary files.
 void las_or_csv_to_tifs(Options& opt,
 			cartography::Datum const& datum,
 			std::vector<std::string> & tmp_tifs){
@@ -247,19 +253,22 @@ void las_or_csv_to_tifs(Options& opt,
   // to right for the purpose of creating the DEM, we waste little space.
   int num_rows = 0;
   for (int i = 0; i < num_files; i++){
-    if (asp::is_las_or_csv(opt.pointcloud_files[i]))
+    if (asp::is_las_csv_or_binary(opt.pointcloud_files[i]))
       continue;
     DiskImageView<float> img(opt.pointcloud_files[i]);
     num_rows = std::max(num_rows, img.rows()); // Record the max number of rows across all input tifs
   }
 
   // No tif files exist. Find a reasonable value for the number of rows.
-  if (num_rows == 0){
+  // Not needed when streaming, as then the image width is fixed.
+  if (num_rows == 0 && !opt.stream_las_csv){
     boost::uint64_t max_num_pts = 0;
     for (int i = 0; i < num_files; i++){
       std::string file = opt.pointcloud_files[i];
       if (asp::is_las(file))  max_num_pts = std::max(max_num_pts, asp::las_file_size(file));
       if (asp::is_csv(file))  max_num_pts = std::max(max_num_pts, asp::csv_file_size(file));
+      if (asp::is_binary_cloud(file))
+        max_num_pts = std::max(max_num_pts, boost::uint64_t(asp::binary_cloud_size(file)));
       // No need to check for other cases; At least one file must be las or csv!
     }
     num_rows = std::max(1, (int)ceil(sqrt(double(max_num_pts))));
@@ -274,30 +283,44 @@ void las_or_csv_to_tifs(Options& opt,
   // indices.  This is key to fast rasterization later.
   for (int i = 0; i < num_files; i++){
 
-    if (!asp::is_las_or_csv(opt.pointcloud_files[i])) // Skip tif files
+    if (!asp::is_las_csv_or_binary(opt.pointcloud_files[i])) // Skip tif files
       continue;
     std::string in_file = opt.pointcloud_files[i];
     std::string stem    = fs::path( in_file ).stem().string();
+    // When streaming, the output is a VRT header for a raw file
+    std::string ext = opt.stream_las_csv ? ".vrt" : ".tif";
     std::string suffix;
     if (opt.out_prefix.find(stem) != std::string::npos)
-      suffix = ".tif";
+      suffix = ext;
     else
-      suffix = "-" + stem + ".tif";
+      suffix = "-" + stem + ext;
     std::string out_file = opt.out_prefix + "-tmp" + suffix;
+    std::string raw_file = fs::path(out_file).replace_extension(".raw").string();
 
     // Handle the case when the output file may exist
     const int NUM_TEMP_NAME_RETRIES = 1000;
     for (int count = 0; count < NUM_TEMP_NAME_RETRIES; count++){
-      if (!fs::exists(out_file))
+      if (!fs::exists(out_file) && !(opt.stream_las_csv && fs::exists(raw_file)))
 	break;
       // File exists, try a different name
       vw_out() << "File exists: " << out_file << std::endl;
       std::ostringstream os; os << count;
       out_file = opt.out_prefix + "-tmp-" + os.str() + suffix;
+      raw_file = fs::path(out_file).replace_extension(".raw").string();
     }
-    if (fs::exists(out_file))
+    if (fs::exists(out_file) || (opt.stream_las_csv && fs::exists(raw_file)))
       vw_throw( ArgumentErr() << "Too many attempts at creating a temporary file.\n");
 
+    if (opt.stream_las_csv) {
+      asp::las_or_csv_to_raw_buckets(in_file, raw_file, out_file, block_size,
+                                     asp::is_las(in_file) ? pc_georef : csv_georef,
+                                     csv_conv);
+      opt.pointcloud_files[i] = out_file;
+      tmp_tifs.push_back(out_file);
+      tmp_tifs.push_back(raw_file);
+      continue;
+    }
+
     // TODO: This if statement should not be needed, the function should handle it!
     // Perform the actual conversion to a tif file
     if (asp::is_las(in_file)) {
@@ -390,6 +413,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("output-filetype,t", po::value(&opt.output_file_type)->default_value("tif"), "Specify the output file.")
     ("errorimage",        po::bool_switch(&opt.do_error)->default_value(false),   "Write a triangulation intersection error image.")
     ("dem-hole-fill-len", po::value(&opt.dem_hole_fill_len)->default_value(0),    "Maximum dimensions of a hole in the output DEM to fill in, in pixels.")
+    ("dem-pyramid-hole-fill-len", po::value(&opt.dem_pyramid_hole_fill_len)->default_value(0),
+     "Fill the holes in the output DEM up to about this size, in pixels, and the no-data pixels within about this distance of valid ones elsewhere, including at the boundary, by interpolation from a pyramid of coarser DEMs. This is done after the DEM is written, and its cost does not grow with the length, unlike for --dem-hole-fill-len.")
     ("orthoimage-hole-fill-len",      po::value(&opt.ortho_hole_fill_len)->default_value(0),
 	    "Maximum dimensions of a hole in the output orthoimage to fill in, in pixels.")
     ("orthoimage-hole-fill-extra-len",      po::value(&opt.ortho_hole_fill_extra_len)->default_value(0),
@@ -408,6 +433,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 	    "Erode input point clouds by this many pixels at boundary (after outliers are removed, but before filling in holes).")
     ("csv-format",     po::value(&opt.csv_format_str)->default_value(""), asp::csv_opt_caption().c_str())
     ("csv-proj4",      po::value(&opt.csv_proj4_str)->default_value(""), "The PROJ.4 string to use to interpret the entries in input CSV files, if those files contain Easting and Northing fields. If not specified, --t_srs will be used.")
+    ("stream-las-csv", po::bool_switch(&opt.stream_las_csv)->default_value(false),
+     "Instead of converting LAS and CSV files to temporary point cloud tif files, bin their points spatially in a single pass and write them to temporary raw files. This uses bounded memory, and each DEM tile then reads only the points near it.")
     ("filter",      po::value(&opt.filter)->default_value("weighted_average"), "The filter to apply to the heights of the cloud points within a given circular neighborhood when gridding (its radius is controlled via --search-radius-factor). Options: weighted_average (default), min, max, mean, median, stddev, count (number of points), nmad (= 1.4826 * median(abs(X - median(X)))), n-pct (where n is a real value between 0 and 100, for example, 80-pct, meaning, 80th percentile). Except for the default, the name of the filter will be added to the obtained DEM file name, e.g., output-min-DEM.tif.")
     ("rounding-error", po::value(&opt.rounding_error)->default_value(asp::APPROX_ONE_MM),
 	    "How much to round the output DEM and errors, in meters (more rounding means less precision but potentially smaller size on disk). The inverse of a power of 2 is suggested. [Default: 1/2^10]")
@@ -420,7 +447,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("use-surface-sampling", po::bool_switch(&opt.use_surface_sampling)->default_value(false),
      "Use the older algorithm, interpret the point cloud as a surface made up of triangles and interpolate into it (prone to aliasing).")
     ("fsaa",   po::value<int>(&opt.fsaa)->default_value(1),            "Oversampling amount to perform antialiasing (obsolete).")
-    ("no-dem", po::bool_switch(&opt.no_dem)->default_value(false), "Skip writing a DEM.");
+    ("dem-pyramid", po::bool_switch(&opt.dem_pyramid)->default_value(false),
+     "When several values are passed to --dem-spacing, grid the cloud only at the first (finest) one, and derive the DEMs at the other spacings from that DEM, by averaging (or taking the min or max, per --filter). The cloud is then read only once. Only DEMs are produced at the other spacings.")
+    ("no-dem", po::bool_switch(&opt.no_dem)->default_value(false), "Skip writing a DEM.")
+    ("cog", po::bool_switch(&opt.cog)->default_value(false),
+     "Write the GeoTIFF outputs as Cloud Optimized GeoTIFFs, with internal overviews.");
   
   general_options.add( manipulation_options );
   general_options.add( projection_options );
@@ -514,9 +545,26 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     vw_throw( ArgumentErr() << "The --fsaa option is obsolete. It can be used only with the --use-surface-sampling option which invokes the old algorithm.\n" << usage << general_options );
   }
 
+  if (opt.dem_pyramid){
+    if (opt.no_dem)
+      vw_throw( ArgumentErr() << "Cannot use --dem-pyramid with --no-dem.\n" );
+    if (opt.filter != "weighted_average" && opt.filter != "mean" &&
+        opt.filter != "min" && opt.filter != "max")
+      vw_throw( ArgumentErr() << "The --dem-pyramid option works only "
+                << "with the weighted_average, mean, min, and max filters.\n" );
+    for (size_t i = 1; i < opt.dem_spacing.size(); i++){
+      if (opt.dem_spacing[i] <= opt.dem_spacing[0])
+        vw_throw( ArgumentErr() << "With --dem-pyramid, the first DEM spacing "
+                  << "must be finer than the other ones.\n" );
+    }
+  }
+
   if (opt.dem_hole_fill_len < 0)
     vw_throw( ArgumentErr() << "The value of "
 			    << "--dem-hole-fill-len must be non-negative.\n");
+  if (opt.dem_pyramid_hole_fill_len < 0)
+    vw_throw( ArgumentErr() << "The value of "
+			    << "--dem-pyramid-hole-fill-len must be non-negative.\n");
   if (opt.ortho_hole_fill_len < 0)
     vw_throw( ArgumentErr() << "The value of "
 			    << "--orthoimage-hole-fill-len must be non-negative.\n");
@@ -701,6 +749,26 @@ namespace asp{
 						  ErrorToNED(georef) );
   }
 
+  /// The name of an output file, given its type, such as "DEM".
+  std::string output_file_name(Options const& opt, std::string const& imgName){
+    // Append a tag if desired to compute the min, max, etc. Later on, in OrthoRasterizer
+    // we do a full validation of opt.filter.
+    std::string tag = "";
+    if (opt.filter != "weighted_average")
+      tag = "-" + opt.filter; 
+
+    return opt.out_prefix + tag + "-" + imgName + "." + opt.output_file_type;
+  }
+
+  /// Stop the program if it is going to create too large a DEM, as
+  /// this will cause a crash.
+  void check_dem_size(Options const& opt, Vector2i const& dem_size) {
+    if ((dem_size[0] > opt.max_output_size[0]) || (dem_size[1] > opt.max_output_size[1]))
+      vw_throw( ArgumentErr()
+                << "Requested DEM size is too large, max allowed output size is "
+                << opt.max_output_size << " pixels.\n" );
+  }
+
   /// Write an image to disk while handling some common options.
   template<class ImageT>
   void save_image(Options& opt, ImageT img, GeoReference const& georef,
@@ -719,24 +787,149 @@ namespace asp{
     int block_size = nextpow2(2.0*hole_fill_len);
     block_size = std::max(256, block_size);
 
-    // Append a tag if desired to compute the min, max, etc. Later on, in OrthoRasterizer
-    // we do a full validation of opt.filter.
-    std::string tag = "";
-    if (opt.filter != "weighted_average")
-      tag = "-" + opt.filter; 
-    
-    std::string output_file = opt.out_prefix + tag + "-" + imgName
-      + "." + opt.output_file_type;
+    std::string output_file = output_file_name(opt, imgName);
     vw_out() << "Writing: " << output_file << "\n";
     TerminalProgressCallback tpc("asp", imgName + ": ");
-    if ( opt.output_file_type == "tif" )
+    if ( opt.output_file_type == "tif" ) {
       asp::save_with_temp_big_blocks(block_size, output_file, img, georef,
                                      opt.nodata_value, opt, tpc);
-    else
+      if (opt.cog) {
+        TerminalProgressCallback cog_tpc("asp", imgName + " overviews: ");
+        asp::write_cog(output_file, opt, "AVERAGE", cog_tpc);
+      }
+    } else
       vw::cartography::write_gdal_image(output_file, img, georef, opt, tpc);
   } // End function save_image
 
 
+  /// Resample a DEM to a coarser grid. Each output grid point is
+  /// given the mean (or min or max) of the valid input pixels within
+  /// a square of the output spacing centered at it, with pixels on
+  /// the square boundary weighted by their overlap with it. The grids
+  /// are given by the positions of the upper-left grid points, in
+  /// projected coordinates, and by the spacings.
+  template <class ImageT>
+  class DemPyramidLevelView : public ImageViewBase<DemPyramidLevelView<ImageT> >
+  {
+    ImageT      m_dem;
+    double      m_nodata_value;
+    std::string m_filter;
+    Vector2     m_in_corner, m_out_corner;
+    double      m_in_spacing, m_out_spacing;
+    int         m_cols, m_rows;
+
+    // The input pixel range and weights along one axis for an output
+    // grid point at input pixel position u
+    void window(double u, int len, int & beg, std::vector<double> & wts) const {
+      double half = 0.5*m_out_spacing/m_in_spacing;
+      beg = std::max(0, (int)floor(u - half + 0.5));
+      int end = std::min(len - 1, (int)ceil(u + half - 0.5));
+      wts.clear();
+      for (int c = beg; c <= end; c++)
+        wts.push_back(std::max(0.0, std::min(c + 0.5, u + half) - std::max(c - 0.5, u - half)));
+    }
+
+    double in_col(int col) const {
+      return (m_out_corner.x() + col*m_out_spacing - m_in_corner.x())/m_in_spacing;
+    }
+    double in_row(int row) const {
+      return (m_in_corner.y() - (m_out_corner.y() - row*m_out_spacing))/m_in_spacing;
+    }
+
+  public:
+
+    typedef PixelGray<float> pixel_type;
+    typedef PixelGray<float> result_type;
+    typedef ProceduralPixelAccessor<DemPyramidLevelView> pixel_accessor;
+
+    DemPyramidLevelView(ImageViewBase<ImageT> const& dem, double nodata_value,
+                        std::string const& filter,
+                        Vector2 const& in_corner,  double in_spacing,
+                        Vector2 const& out_corner, double out_spacing,
+                        int cols, int rows):
+      m_dem(dem.impl()), m_nodata_value(nodata_value), m_filter(filter),
+      m_in_corner(in_corner), m_out_corner(out_corner),
+      m_in_spacing(in_spacing), m_out_spacing(out_spacing),
+      m_cols(cols), m_rows(rows){}
+
+    inline int32 cols  () const { return m_cols; }
+    inline int32 rows  () const { return m_rows; }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( size_t i, size_t j, size_t p=0 ) const {
+      vw_throw( NoImplErr() << "DemPyramidLevelView::operator(...) is not implemented.\n");
+      return result_type();
+    }
+
+    typedef CropView<ImageView<result_type> > prerasterize_type;
+    inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+
+      ImageView<result_type> tile(bbox.width(), bbox.height());
+      fill(tile, m_nodata_value);
+
+      // The input region needed for this tile
+      int beg_col, beg_row, end_col, end_row;
+      std::vector<double> wx, wy;
+      window(in_col(bbox.min().x()),     m_dem.cols(), beg_col, wx);
+      window(in_col(bbox.max().x() - 1), m_dem.cols(), end_col, wx);
+      end_col += wx.size();
+      window(in_row(bbox.min().y()),     m_dem.rows(), beg_row, wy);
+      window(in_row(bbox.max().y() - 1), m_dem.rows(), end_row, wy);
+      end_row += wy.size();
+      BBox2i in_box(beg_col, beg_row, end_col - beg_col, end_row - beg_row);
+      in_box.crop(bounding_box(m_dem));
+      if (in_box.empty())
+        return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+
+      ImageView<float> in = crop(m_dem, in_box);
+
+      for (int row = bbox.min().y(); row < bbox.max().y(); row++){
+        int r0;
+        window(in_row(row), m_dem.rows(), r0, wy);
+        for (int col = bbox.min().x(); col < bbox.max().x(); col++){
+          int c0;
+          window(in_col(col), m_dem.cols(), c0, wx);
+
+          double sum = 0, wsum = 0, val = 0;
+          bool found = false;
+          for (size_t r = 0; r < wy.size(); r++){
+            int ir = r0 + r - in_box.min().y();
+            if (wy[r] <= 0 || ir < 0 || ir >= in.rows()) continue;
+            for (size_t c = 0; c < wx.size(); c++){
+              int ic = c0 + c - in_box.min().x();
+              if (wx[c] <= 0 || ic < 0 || ic >= in.cols()) continue;
+              double h = in(ic, ir);
+              if (h == m_nodata_value) continue;
+              if (m_filter == "min")
+                val = found ? std::min(val, h) : h;
+              else if (m_filter == "max")
+                val = found ? std::max(val, h) : h;
+              else{
+                sum  += wx[c]*wy[r]*h;
+                wsum += wx[c]*wy[r];
+              }
+              found = true;
+            }
+          }
+          if (!found)
+            continue;
+          if (m_filter != "min" && m_filter != "max")
+            val = sum/wsum;
+          tile(col - bbox.min().x(), row - bbox.min().y()) = val;
+        }
+      }
+
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+  };
+
   /// A class for combining the three channels of errors and finding their absolute values.
   template <class ImageT>
   class CombinedView : public ImageViewBase<CombinedView<ImageT> >
@@ -853,47 +1046,6 @@ namespace asp{
     }
   };
 
-  class ErrorRangeEstimAccum : public ReturnFixedType<void> {
-    typedef double accum_type;
-    std::vector<accum_type> m_vals;
-  public:
-    typedef accum_type value_type;
-
-    ErrorRangeEstimAccum() { m_vals.clear(); }
-
-    void operator()( accum_type const& value ) {
-      // Don't add zero errors, those most likely came from invalid points
-      if (value > 0)
-	m_vals.push_back(value);
-    }
-
-    int size(){
-      return m_vals.size();
-    }
-
-    value_type value(Vector2 const& remove_outliers_params){
-      VW_ASSERT(!m_vals.empty(), ArgumentErr() << "ErrorRangeEstimAccum: no valid samples");
-
-      // How to pick a representative value for maximum error?  The
-      // maximum error itself may be no good, as it could be very
-      // huge, and then sampling the range of errors will be distorted
-      // by that.  The solution adopted here: Find a percentile of the
-      // range of errors, mulitply it by the outlier factor, and
-      // multiply by another factor to ensure we don't underestimate
-      // the maximum. This value may end up being larger than the
-      // largest error, but at least it is is not grossly huge
-      // if just a few of the errors are very large.
-      std::sort(m_vals.begin(), m_vals.end());
-      int    len    = m_vals.size();
-      double pct    = remove_outliers_params[0]/100.0; // e.g., 0.75
-      double factor = remove_outliers_params[1];
-      int    k      = std::min(len-1, (int)(pct*len));
-      double val    = m_vals[k]*factor*4.0;
-      return val;
-    }
-
-  };
-
   template<int num_ch>
   ImageViewRef<double> error_norm(std::vector<std::string> const& pc_files){
 
@@ -945,7 +1097,6 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
                                 Options& opt,
                                 cartography::GeoReference& georef,
                                 ImageViewRef<double> const& error_image,
-                                double estim_max_error,
                                 size_t *num_invalid_pixels) {
 
   vw_out() << "\t-- Starting DEM rasterization --\n";
@@ -991,12 +1142,53 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
     opt.rounding_error = 0.0;
   }
 
-  ImageViewRef< PixelGray<float> > rasterizer_fsaa
-    = generate_fsaa_raster( rasterizer, opt );
-
-  // Write out the DEM. We've set the texture to be the height.
+  // The error image with one channel, and the ortho image without
+  // hole-filling, use the same points as the DEM. Then rasterize all
+  // of them at once, in tiles with a channel for each which are kept
+  // in the cache, so that the outputs after the DEM mostly do not
+  // read and bin the cloud again. A tile dropped from the cache is
+  // rasterized anew, which is no more work than for a single output.
+  int num_channels = 0;
+  if (opt.do_error)
+    num_channels = asp::num_channels(opt.pointcloud_files);
+  bool multi_error = opt.do_error && num_channels == 4;
+  bool multi_ortho = opt.do_ortho && opt.ortho_hole_fill_len <= 0;
+  bool multi_pass  = !opt.no_dem && (multi_error || multi_ortho);
+  int  error_index = 0, ortho_index = 0; // channels of the multi-channel tiles
   Vector2 tile_size(vw_settings().default_tile_size(),
 		    vw_settings().default_tile_size());
+  ImageViewRef<Vector3f> multi_img;
+
+  if (multi_pass) {
+    rasterizer.clear_extra_textures();
+    if (multi_error) {
+      ImageViewRef<Vector4> point_disk_image
+        = asp::form_point_cloud_composite<Vector4>
+        (opt.pointcloud_files, asp::OrthoRasterizerView::max_subblock_size());
+      rasterizer.add_extra_texture(select_channel(point_disk_image, 3));
+      error_index = rasterizer.num_extra_textures();
+    }
+    if (multi_ortho) {
+      rasterizer.add_extra_texture(asp::form_point_cloud_composite< PixelGray<float> >
+                                   (opt.texture_files,
+                                    asp::OrthoRasterizerView::max_subblock_size()));
+      ortho_index = rasterizer.num_extra_textures();
+    }
+
+    // The view has its own copy of the textures
+    multi_img = block_cache(asp::OrthoRasterizerMultiView(rasterizer), tile_size,
+                            opt.num_threads);
+    rasterizer.clear_extra_textures();
+  }
+
+  ImageViewRef< PixelGray<float> > rasterizer_fsaa;
+  if (multi_pass)
+    rasterizer_fsaa = generate_fsaa_raster
+      (pixel_cast< PixelGray<float> >(select_channel(multi_img, 0)), opt);
+  else
+    rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
+
+  // Write out the DEM. We've set the texture to be the height.
   if ( !opt.no_dem ){
     Stopwatch sw2;
     sw2.start();
@@ -1019,12 +1211,28 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
     // Stop the program if it is going to create too large a DEM, this will cause a crash.
     Vector2i dem_size = bounding_box(dem).size();
     vw_out()<< "Creating output file that is " << dem_size << " px.\n";
-    if ((dem_size[0] > opt.max_output_size[0]) || (dem_size[1] > opt.max_output_size[1]))
-      vw_throw( ArgumentErr()
-                << "Requested DEM size is too large, max allowed output size is "
-                << opt.max_output_size << " pixels.\n" );
+    asp::check_dem_size(opt, dem_size);
     
-    asp::save_image(opt, dem, georef, hole_fill_len, "DEM");
+    if (opt.dem_pyramid_hole_fill_len <= 0) {
+      asp::save_image(opt, dem, georef, hole_fill_len, "DEM");
+    } else {
+      // Fill the holes of the written DEM, as a separate pass, and
+      // only then make the overviews.
+      bool cog = opt.cog;
+      opt.cog = false;
+      asp::save_image(opt, dem, georef, hole_fill_len, "DEM-unfilled");
+      opt.cog = cog;
+      std::string unfilled_file = asp::output_file_name(opt, "DEM-unfilled");
+      std::string dem_file      = asp::output_file_name(opt, "DEM");
+      TerminalProgressCallback fill_tpc("asp", "DEM hole-filling: ");
+      asp::pyramid_fill_holes(unfilled_file, dem_file, opt.dem_pyramid_hole_fill_len,
+                              opt, fill_tpc);
+      fs::remove(unfilled_file);
+      if (opt.cog && opt.output_file_type == "tif") {
+        TerminalProgressCallback cog_tpc("asp", "DEM overviews: ");
+        asp::write_cog(dem_file, opt, "AVERAGE", cog_tpc);
+      }
+    }
     sw2.stop();
     vw_out(DebugMessage,"asp") << "DEM render time: " << sw2.elapsed_seconds() << ".\n";
 
@@ -1037,10 +1245,18 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
 
   // Write triangulation error image if requested
   if ( opt.do_error ) {
-    int num_channels = asp::num_channels(opt.pointcloud_files);
 
     int hole_fill_len = 0;
-    if (num_channels == 4){
+    if (num_channels == 4 && multi_pass){
+      // The error is a scalar, rasterized together with the DEM
+      rasterizer_fsaa = generate_fsaa_raster
+        (pixel_cast< PixelGray<float> >(select_channel(multi_img, error_index)), opt);
+      save_image(opt,
+		 asp::round_image_pixels_skip_nodata(rasterizer_fsaa,
+						     opt.rounding_error,
+						     opt.nodata_value),
+		 georef, hole_fill_len, "IntersectionErr");
+    }else if (num_channels == 4){
       // The error is a scalar.
       ImageViewRef<Vector4> point_disk_image
         = asp::form_point_cloud_composite<Vector4>
@@ -1099,7 +1315,15 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
   // Write DRG if the user requested and provided a texture file.
   // This must be at the end, as we may be messing with the point
   // image in irreversible ways.
-  if (opt.do_ortho) {
+  if (opt.do_ortho && multi_pass && multi_ortho) {
+    Stopwatch sw3;
+    sw3.start();
+    rasterizer_fsaa = generate_fsaa_raster
+      (pixel_cast< PixelGray<float> >(select_channel(multi_img, ortho_index)), opt);
+    asp::save_image(opt, rasterizer_fsaa, georef, 0, "DRG");
+    sw3.stop();
+    vw_out(DebugMessage,"asp") << "DRG render time: " << sw3.elapsed_seconds() << "\n";
+  } else if (opt.do_ortho) {
     
     Stopwatch sw3;
     sw3.start();
@@ -1180,12 +1404,72 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
 } // End do_software_rasterization
 
 
+/// With --dem-pyramid, write the DEM at a coarser spacing, derived
+/// from the DEM at the finest spacing, which must already be written.
+void write_dem_pyramid_level(Options& opt, std::string const& fine_prefix,
+                             cartography::GeoReference const& fine_georef,
+                             double spacing) {
+
+  Options fine_opt = opt;
+  fine_opt.out_prefix = fine_prefix;
+  std::string fine_dem_file = asp::output_file_name(fine_opt, "DEM");
+  DiskImageView<float> fine_dem(fine_dem_file);
+
+  // The upper-left grid point of the fine DEM
+  Matrix3x3 transform = fine_georef.transform();
+  double fine_spacing = transform(0,0);
+  Vector2 fine_corner(transform(0,2), transform(1,2));
+  if ( fine_georef.pixel_interpretation() == cartography::GeoReference::PixelAsArea )
+    fine_corner += 0.5*Vector2(transform(0,0), transform(1,1));
+
+  if (spacing <= fine_spacing)
+    vw_throw( ArgumentErr() << "With --dem-pyramid, the DEM spacing " << spacing
+              << " must be coarser than the first one, " << fine_spacing << ".\n" );
+
+  // Snap the grid to multiples of the spacing, as when rasterizing
+  // directly, unless the user's projwin decides the grid.
+  Vector2 fine_last_corner = fine_corner + fine_spacing*Vector2(fine_dem.cols() - 1,
+                                                                -(fine_dem.rows() - 1));
+  Vector2 corner = fine_corner;
+  if (opt.target_projwin == BBox2()) {
+    corner.x() = spacing*floor(fine_corner.x()/spacing);
+    corner.y() = spacing*ceil (fine_corner.y()/spacing);
+  }
+  int cols = (int)ceil((fine_last_corner.x() - corner.x())/spacing - 1e-6) + 1;
+  int rows = (int)ceil((corner.y() - fine_last_corner.y())/spacing - 1e-6) + 1;
+  cols = std::max(cols, 1);
+  rows = std::max(rows, 1);
+
+  vw_out() << "\t-- Deriving DEM from " << fine_dem_file << " --\n";
+  vw_out() << "\t--> DEM spacing: " << spacing << " pt/px\n";
+
+  cartography::GeoReference georef = fine_georef;
+  transform(0,0) =  spacing;
+  transform(1,1) = -spacing;
+  transform(0,2) = corner.x();
+  transform(1,2) = corner.y();
+  if ( georef.pixel_interpretation() == cartography::GeoReference::PixelAsArea ) {
+    transform(0,2) -= 0.5 * transform(0,0);
+    transform(1,2) -= 0.5 * transform(1,1);
+  }
+  georef.set_transform(transform);
+
+  // The weighted_average and mean filters both give the mean here
+  ImageViewRef< PixelGray<float> > dem
+    = asp::DemPyramidLevelView< DiskImageView<float> >(fine_dem, opt.nodata_value, opt.filter,
+                                                        fine_corner, fine_spacing,
+                                                        corner, spacing, cols, rows);
+  dem = asp::round_image_pixels_skip_nodata(dem, opt.rounding_error, opt.nodata_value);
+  vw_out()<< "Creating output file that is " << Vector2i(cols, rows) << " px.\n";
+  asp::save_image(opt, dem, georef, 0, "DEM");
+}
+
 // Wrapper for do_software_rasterization that goes through all spacing values
 void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_point_input,
                                              Options& opt,
                                              cartography::GeoReference& georef,
                                              ImageViewRef<double> const& error_image,
-                                             double estim_max_error) {
+                                             std::vector<double> const& errors_hist) {
   // Perform the slow initialization that can be shared by all output resolutions
   Stopwatch sw1;
   sw1.start();
@@ -1198,11 +1482,11 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
                asp::ASPGlobalOptions::tri_tile_size(), // to efficiently process the cloud
                opt.target_projwin,
                opt.remove_outliers_with_pct, opt.remove_outliers_params,
-               error_image, estim_max_error, opt.max_valid_triangulation_error,
+               error_image, opt.max_valid_triangulation_error,
                opt.median_filter_params, opt.erode_len, opt.has_las_or_csv,
                opt.filter, opt.default_grid_size_multiplier,
                &num_invalid_pixels, &count_mutex,
-               TerminalProgressCallback("asp","QuadTree: "));
+               TerminalProgressCallback("asp","QuadTree: "), errors_hist);
 
   sw1.stop();
   vw_out(DebugMessage,"asp") << "Quad time: " << sw1.elapsed_seconds() << std::endl;
@@ -1217,6 +1501,12 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
   // Call the function for each dem spacing
   for (size_t i = 0; i < opt.dem_spacing.size(); i++) {
     double this_spacing = opt.dem_spacing[i];
+
+    if (opt.dem_pyramid && i > 0) {
+      opt.out_prefix = base_out_prefix + "_" + vw::num_to_str(i);
+      write_dem_pyramid_level(opt, base_out_prefix, georef, this_spacing);
+      continue;
+    }
     
     // Required second init step for each spacing
     rasterizer.initialize_spacing(this_spacing);
@@ -1227,7 +1517,7 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
     else // Write later iterations to a different path.
       opt.out_prefix = base_out_prefix + "_" + vw::num_to_str(i);
     do_software_rasterization(rasterizer, opt, georef, error_image,
-                              estim_max_error, &num_invalid_pixels);
+                              &num_invalid_pixels);
   } // End loop through spacings
 
   opt.out_prefix = base_out_prefix; // Restore the original value
@@ -1301,20 +1591,27 @@ int main( int argc, char *argv[] ) {
     ImageViewRef<Vector3> point_image = asp::form_point_cloud_composite<Vector3>(opt.pointcloud_files,
 						  asp::OrthoRasterizerView::max_subblock_size());
 
+    // The statistics saved by stereo_tri in the cloud headers, if all
+    // inputs have them, spare passes over the cloud below.
+    asp::PointCloudStats cloud_stats;
+    bool have_cloud_stats = asp::read_point_cloud_stats(opt.pointcloud_files, cloud_stats);
+    bool rotated = (opt.phi_rot != 0 || opt.omega_rot != 0 || opt.kappa_rot != 0);
+
     // Apply an (optional) rotation to the 3D points before building the mesh.
-    if (opt.phi_rot != 0 || opt.omega_rot != 0 || opt.kappa_rot != 0) {
+    if (rotated) {
       vw_out() << "\t--> Applying rotation sequence: " << opt.rot_order
                << "      Angles: " << opt.phi_rot << "   "
                << opt.omega_rot << "  " << opt.kappa_rot << "\n";
       point_image = asp::point_transform(point_image,
 					 math::euler_to_rotation_matrix(opt.phi_rot, opt.omega_rot,opt.kappa_rot, opt.rot_order));
     }
-    // Estimate the maximum value of the error channel in case we would
-    // like to remove outliers. This not the cuttoff triangulation error,
-    // just a large but reasonable number that will be used to estimate
-    // that error later.
+    // The triangulation error, in case we would like to remove
+    // outliers. The histogram of errors, from which the cutoff is
+    // found, is accumulated as the rasterizer reads the cloud for
+    // its bounding boxes, without a pass of its own, unless the cloud
+    // headers have it.
     ImageViewRef<double> error_image;
-    double estim_max_error = 0.0;
+    std::vector<double> errors_hist;
     if (opt.remove_outliers_with_pct || opt.max_valid_triangulation_error > 0.0){
       int num_channels = asp::num_channels(opt.pointcloud_files);
 
@@ -1326,46 +1623,19 @@ int main( int argc, char *argv[] ) {
         opt.remove_outliers_with_pct      = false;
         opt.max_valid_triangulation_error = 0.0;
       }
-
-      if (opt.remove_outliers_with_pct && opt.max_valid_triangulation_error == 0.0){
-        // Get a somewhat dense sampling of the error image to get an idea
-        // of what the distribution of errors is. This will be refined
-        // later using a histogram approach and using all points. Do
-        // several attempts if the sampling is too coarse.
-        bool success = false;
-        for (int count = 7; count <= 18; count++){
-
-          double sample = (1 << count);
-          int32 subsample_amt = int32(norm_2(Vector2(point_image.cols(),
-				               point_image.rows()))/sample);
-          if (subsample_amt < 1 ) subsample_amt = 1;
-
-          Stopwatch sw2;
-          sw2.start();
-          PixelAccumulator<asp::ErrorRangeEstimAccum> error_accum;
-          for_each_pixel( subsample(error_image, subsample_amt),
-	            error_accum,
-	            TerminalProgressCallback
-	            ("asp","Triangulation error range estimation: ") );
-          if (error_accum.size() > 0){
-            success = true;
-            estim_max_error = error_accum.value(opt.remove_outliers_params);
-          }
-          sw2.stop();
-          vw_out(DebugMessage,"asp") << "Triangulation error range estimation time: "
-		               << sw2.elapsed_seconds() << std::endl;
-          if (success || subsample_amt == 1) break;
-          vw_out() << "Failed to estimate the triangulation range. Check if your cloud is valid. "
-             << "Trying again with finer sampling.\n";
-        }
-      }
+      if (opt.remove_outliers_with_pct && have_cloud_stats)
+        errors_hist = cloud_stats.dense_errors_hist();
     }
     // Determine if we should be using a longitude range between
     // [-180, 180] or [0,360]. We determine this by looking at the
     // average location of the points. If the average location has a
     // negative x value (think in ECEF coordinates) then we should
     // be using [0,360].
-    double avg_lon = asp::find_avg_lon(point_image);
+    double avg_lon = 0;
+    if (have_cloud_stats && !rotated)
+      avg_lon = cloud_stats.mean().x() >= 0 ? 0 : 180;
+    else
+      avg_lon = asp::find_avg_lon(point_image);
     
     
     // TODO: Do we need the recenter code now that we have this?
@@ -1374,29 +1644,15 @@ int main( int argc, char *argv[] ) {
     if (output_georef.overall_proj4_str().find("+proj=aea") == std::string::npos)
       output_georef.set_lon_center(avg_lon < 100);
     
-    // We trade off readability here to avoid ImageViewRef dereferences
-    if (opt.lon_offset != 0 || opt.lat_offset != 0 || opt.height_offset != 0) {
+    // The points are converted to the output projection a tile at a
+    // time, with the proj4 calls of a tile batched together.
+    Vector3 offset(opt.lon_offset, opt.lat_offset, opt.height_offset);
+    if (offset != Vector3())
       vw_out() << "\t--> Applying offset: " << opt.lon_offset
                << " " << opt.lat_offset << " " << opt.height_offset << "\n";
-      do_software_rasterization_multi_spacing
-        (geodetic_to_point  // GDC to XYZ
-            (asp::point_image_offset  // Add user coordinate offset
-              (asp::recenter_longitude(cartesian_to_geodetic(point_image,output_georef), // XYZ to GDC, then normalize longitude
-			               avg_lon),
-           Vector3(opt.lon_offset,
-	           opt.lat_offset,
-	           opt.height_offset)),
-             output_georef),
-         opt, output_georef, error_image, estim_max_error);
-    } else {
-      do_software_rasterization_multi_spacing
-        (geodetic_to_point
-            (asp::recenter_longitude
-              (cartesian_to_geodetic(point_image, output_georef),
-               avg_lon),
-             output_georef),
-        opt, output_georef, error_image, estim_max_error);
-    }
+    do_software_rasterization_multi_spacing
+      (asp::cartesian_to_projected(point_image, output_georef, avg_lon, offset),
+       opt, output_georef, error_image, errors_hist);
 
     // Wipe the temporary files
     for (int i = 0; i < (int)tmp_tifs.size(); i++)
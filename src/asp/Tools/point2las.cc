@@ -22,13 +22,16 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <sstream>
 #include <boost/program_options.hpp>
 #include <liblas/liblas.hpp>
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/PointCloudStats.h>
 
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO.h>
 #include <vw/Image.h>
 #include <vw/Math.h>
@@ -51,9 +54,10 @@ struct Options : vw::cartography::GdalWriteOptions {
   std::string pointcloud_file;
   std::string target_srs_string;
   bool compressed;
+  int  tile_size;
   // Output
   std::string out_prefix;
-  Options() : compressed(false){}
+  Options() : compressed(false), tile_size(0){}
 };
 
 void handle_arguments( int argc, char *argv[], Options& opt ) {
@@ -63,6 +67,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("compressed,c",    po::bool_switch(&opt.compressed)->default_value(false)->implicit_value(true),
            "Compress using laszip.")
     ("output-prefix,o", po::value(&opt.out_prefix), "Specify the output prefix.")
+    ("tile-size",       po::value(&opt.tile_size)->default_value(0),
+     "If positive, write the cloud as square tiles of this size in pixels, each to its own file, <output prefix>-tile-<index>.las (or .laz). The tiles are written and compressed in parallel.")
     ("datum",           po::value(&opt.datum),
           "Create a geo-referenced LAS file in respect to this datum. Options: WGS_1984, D_MOON (1,737,400 meters), D_MARS (3,396,190 meters), MOLA (3,396,000 meters), NAD83, WGS72, and NAD27. Also accepted: Earth (=WGS_1984), Mars (=D_MARS), Moon (=D_MOON).")
     ("reference-spheroid,r", po::value(&opt.reference_spheroid),
@@ -92,6 +98,10 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     vw_throw( ArgumentErr() << "Missing point cloud.\n"
               << usage << general_options );
 
+  if ( opt.tile_size < 0 )
+    vw_throw( ArgumentErr() << "The tile size must be non-negative.\n"
+              << usage << general_options );
+
   if ( opt.out_prefix.empty() )
     opt.out_prefix =
       vw::prefix_from_filename( opt.pointcloud_file );
@@ -112,10 +122,125 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 
 }
 
-int main( int argc, char *argv[] ) {
+// The cloud is read and converted in blocks of about this many pixels
+const int POINT_BLOCK_SIZE = 1024*1024;
+
+// Rasterize a block of the cloud and collect its valid points, in row-major order
+void collect_points(ImageViewRef<Vector3> const& point_image, BBox2i const& block,
+                    bool is_geodetic, std::vector<Vector3> & points){
+
+  ImageView<Vector3> tile = crop(point_image, block);
+  points.clear();
+  for (int row = 0; row < tile.rows(); row++){
+    for (int col = 0; col < tile.cols(); col++){
+
+      Vector3 const& point = tile(col, row);
+
+      // Skip no-data points
+      bool is_good = ( (!is_geodetic && point != vw::Vector3()) ||
+                       (is_geodetic  && !boost::math::isnan(point.z())) );
+      if (!is_good) continue;
+
+      points.push_back(point);
+    }
+  }
+}
 
-  // To do: need to understand what is the optimal strategy for
-  // traversing the input point cloud file to minimize the reading time.
+// Set the offset, scale, and extent of the LAS header from the bounding
+// box of the points.
+void set_las_header_box(BBox3 const& cloud_bbox, liblas::Header & header){
+
+  // The las format stores the values as 32 bit integers. So, for a
+  // given point, we store round((point-offset)/scale), as well as
+  // the offset and scale values. Here we decide the values for
+  // offset and scale to lose minimum amount of precision. We make
+  // the scale almost as large as it can be without causing integer overflow.
+  Vector3 offset = (cloud_bbox.min() + cloud_bbox.max())/2.0;
+  double  maxInt = std::numeric_limits<int32>::max();
+          maxInt *= 0.95; // Just in case stay a bit away
+  Vector3 scale  = cloud_bbox.size()/(2.0*maxInt);
+  for (size_t i = 0; i < scale.size(); i++){
+    if (scale[i] <= 0.0) scale[i] = 1.0e-16; // avoid degeneracy
+  }
+
+  // The line below causes trouble with compression in libLAS-1.7.0.
+  //header.SetDataFormatId(liblas::ePointFormat1);
+  header.SetScale (scale [0], scale [1], scale [2]);
+  header.SetOffset(offset[0], offset[1], offset[2]);
+
+  // Populate the min and max fields of the LAS header
+  header.SetMax(cloud_bbox.max().x(),cloud_bbox.max().y(),cloud_bbox.max().z());
+  header.SetMin(cloud_bbox.min().x(),cloud_bbox.min().y(),cloud_bbox.min().z());
+}
+
+// Collect the points of one block of the cloud
+class CollectPointsTask: public Task, private boost::noncopyable {
+  ImageViewRef<Vector3> m_point_image;
+  BBox2i m_block;
+  bool m_is_geodetic;
+  std::vector<Vector3> & m_points;
+
+public:
+  CollectPointsTask(ImageViewRef<Vector3> const& point_image, BBox2i const& block,
+                    bool is_geodetic, std::vector<Vector3> & points):
+    m_point_image(point_image), m_block(block), m_is_geodetic(is_geodetic),
+    m_points(points){}
+
+  void operator()(){
+    collect_points(m_point_image, m_block, m_is_geodetic, m_points);
+  }
+};
+
+// Write one tile of the cloud to its own LAS file, with the header
+// fitted to the points of that tile. Tiles with no valid points are skipped.
+class WriteLasTileTask: public Task, private boost::noncopyable {
+  ImageViewRef<Vector3> m_point_image;
+  BBox2i m_block;
+  bool m_is_geodetic;
+  liblas::Header m_header; // a copy, with the SRS and compression already set
+  std::string m_las_file;
+  Mutex & m_mutex;
+  ProgressCallback const& m_progress;
+  double m_inc_amt;
+
+public:
+  WriteLasTileTask(ImageViewRef<Vector3> const& point_image, BBox2i const& block,
+                   bool is_geodetic, liblas::Header const& header,
+                   std::string const& las_file, Mutex & mutex,
+                   ProgressCallback const& progress, double inc_amt):
+    m_point_image(point_image), m_block(block), m_is_geodetic(is_geodetic),
+    m_header(header), m_las_file(las_file), m_mutex(mutex),
+    m_progress(progress), m_inc_amt(inc_amt){}
+
+  void operator()(){
+
+    std::vector<Vector3> points;
+    collect_points(m_point_image, m_block, m_is_geodetic, points);
+
+    if (!points.empty()){
+      BBox3 tile_bbox;
+      for (size_t i = 0; i < points.size(); i++)
+        tile_bbox.grow(points[i]);
+      set_las_header_box(tile_bbox, m_header);
+
+      std::ofstream ofs;
+      ofs.open(m_las_file.c_str(), std::ios::out | std::ios::binary);
+      liblas::Writer writer(ofs, m_header);
+      for (size_t i = 0; i < points.size(); i++){
+        liblas::Point las_point(&m_header);
+        las_point.SetCoordinates(points[i][0], points[i][1], points[i][2]);
+        writer.WritePoint(las_point);
+      }
+    }
+
+    Mutex::Lock lock(m_mutex);
+    if (!points.empty())
+      vw_out() << "Wrote: " << m_las_file << "\n";
+    m_progress.report_incremental_progress(m_inc_amt);
+  }
+};
+
+int main( int argc, char *argv[] ) {
 
   Options opt;
   try {
@@ -152,71 +277,109 @@ int main( int argc, char *argv[] ) {
 
     // Save the las file with given georeference, if present
     ImageViewRef<Vector3> point_image = asp::read_asp_point_cloud<3>(opt.pointcloud_file);
+
+    // The statistics saved by stereo_tri in the cloud header, if present
+    asp::PointCloudStats cloud_stats;
+    bool have_cloud_stats = asp::read_point_cloud_stats(opt.pointcloud_file, cloud_stats);
+
     if (is_geodetic) {
       point_image = cartesian_to_geodetic(point_image, datum);
-      double avg_lon = asp::find_avg_lon(point_image); // see if to use [-180, 180] or [0, 360]
+      double avg_lon = 0; // see if to use [-180, 180] or [0, 360]
+      if (have_cloud_stats)
+        avg_lon = cloud_stats.mean_lon() >= 0 ? 0 : 180;
+      else
+        avg_lon = asp::find_avg_lon(point_image);
       point_image = geodetic_to_point(asp::recenter_longitude(point_image, avg_lon), georef);
     }
 
-    BBox3 cloud_bbox = asp::pointcloud_bbox(point_image, is_geodetic);
-
-    // The las format stores the values as 32 bit integers. So, for a
-    // given point, we store round((point-offset)/scale), as well as
-    // the offset and scale values. Here we decide the values for
-    // offset and scale to lose minimum amount of precision. We make
-    // the scale almost as large as it can be without causing integer overflow.
-    Vector3 offset = (cloud_bbox.min() + cloud_bbox.max())/2.0;
-    double  maxInt = std::numeric_limits<int32>::max();
-            maxInt *= 0.95; // Just in case stay a bit away
-    Vector3 scale  = cloud_bbox.size()/(2.0*maxInt);
-    for (size_t i = 0; i < scale.size(); i++){
-      if (scale[i] <= 0.0) scale[i] = 1.0e-16; // avoid degeneracy
-    }
-
-    // The line below causes trouble with compression in libLAS-1.7.0.
-    //header.SetDataFormatId(liblas::ePointFormat1);
-    header.SetScale (scale [0], scale [1], scale [2]);
-    header.SetOffset(offset[0], offset[1], offset[2]);
-
-    // Populate the min and max fields of the LAS header
-    header.SetMax(cloud_bbox.max().x(),cloud_bbox.max().y(),cloud_bbox.max().z());
-    header.SetMin(cloud_bbox.min().x(),cloud_bbox.min().y(),cloud_bbox.min().z());
-
-    std::string lasFile;
+    std::string ext = ".las";
     header.SetCompressed(opt.compressed);
     if (opt.compressed)
-      lasFile = opt.out_prefix + ".laz";
-    else
-      lasFile = opt.out_prefix + ".las";
+      ext = ".laz";
+
+    int num_threads = vw_settings().default_num_threads();
+
+    if (opt.tile_size > 0){
+      // Each tile is read, converted, compressed, and written
+      // independently of the others.
+      std::vector<BBox2i> tiles = subdivide_bbox(point_image, opt.tile_size, opt.tile_size);
+      vw_out() << "Writing " << tiles.size() << " LAS tiles with prefix: "
+               << opt.out_prefix << "\n";
+
+      TerminalProgressCallback tpc("asp", "\t--> ");
+      FifoWorkQueue queue(num_threads);
+      Mutex mutex;
+      double inc_amt = 1.0 / std::max(size_t(1), tiles.size());
+      for (size_t i = 0; i < tiles.size(); i++){
+        std::ostringstream os;
+        os << opt.out_prefix << "-tile-" << i << ext;
+        boost::shared_ptr<WriteLasTileTask>
+          task(new WriteLasTileTask(point_image, tiles[i], is_geodetic, header,
+                                    os.str(), mutex, tpc, inc_amt));
+        queue.add_task(task);
+      }
+      queue.join_all();
+      tpc.report_finished();
 
+      return 0;
+    }
+
+    // The header box is of the cartesian points, so it is of use
+    // only if they are saved as such. It is of the points before
+    // they were rounded when saved, so pad it by at least that
+    // rounding error.
+    BBox3 cloud_bbox;
+    if (have_cloud_stats && !is_geodetic && cloud_stats.num_valid > 0) {
+      cloud_bbox = cloud_stats.bbox;
+      cloud_bbox.expand(std::max(0.01, cloud_stats.rounding_error));
+    } else
+      cloud_bbox = asp::pointcloud_bbox(point_image, is_geodetic);
+    set_las_header_box(cloud_bbox, header);
+
+    std::string lasFile = opt.out_prefix + ext;
     vw_out() << "Writing LAS file: " << lasFile + "\n";
     std::ofstream ofs;
     ofs.open(lasFile.c_str(), std::ios::out | std::ios::binary);
     liblas::Writer writer(ofs, header);
 
-    TerminalProgressCallback tpc("asp", "\t--> ");
-    for (int row = 0; row < point_image.rows(); row++){
-      tpc.report_fractional_progress(row, point_image.rows());
-      for (int col = 0; col < point_image.cols(); col++){
+    // Blocks of whole rows are read and converted in parallel, a batch
+    // at a time, and then written in order, so the points are in the
+    // same order as in the input cloud.
+    int block_rows = std::max(1, POINT_BLOCK_SIZE / std::max(1, point_image.cols()));
+    std::vector<BBox2i> blocks;
+    for (int row = 0; row < point_image.rows(); row += block_rows)
+      blocks.push_back(BBox2i(0, row, point_image.cols(),
+                              std::min(block_rows, point_image.rows() - row)));
 
-        Vector3 point = point_image(col, row);
-
-        // Skip no-data points
-        bool is_good = ( (!is_geodetic && point != vw::Vector3()) ||
-                         (is_geodetic  && !boost::math::isnan(point.z())) );
-        if (!is_good) continue;
+    size_t batch_size = 2*std::max(1, num_threads);
+    TerminalProgressCallback tpc("asp", "\t--> ");
+    for (size_t start = 0; start < blocks.size(); start += batch_size){
+      tpc.report_fractional_progress(start, blocks.size());
+
+      size_t end = std::min(start + batch_size, blocks.size());
+      std::vector< std::vector<Vector3> > points(end - start);
+      FifoWorkQueue queue(num_threads);
+      for (size_t k = start; k < end; k++){
+        boost::shared_ptr<CollectPointsTask>
+          task(new CollectPointsTask(point_image, blocks[k], is_geodetic, points[k - start]));
+        queue.add_task(task);
+      }
+      queue.join_all();
 
+      for (size_t k = 0; k < points.size(); k++){
+        for (size_t i = 0; i < points[k].size(); i++){
+          Vector3 const& point = points[k][i];
 #if 0
-        // For comparison later with las2txt.
-        std::cout.precision(16);
-        std::cout << "\npoint " << point[0] << ' ' << point[1] << ' '
-                  << point[2] << std::endl;
+          // For comparison later with las2txt.
+          std::cout.precision(16);
+          std::cout << "\npoint " << point[0] << ' ' << point[1] << ' '
+                    << point[2] << std::endl;
 #endif
-
-        liblas::Point las_point(&header);
-        las_point.SetCoordinates(point[0], point[1], point[2]);
-        writer.WritePoint(las_point);
-
+          liblas::Point las_point(&header);
+          las_point.SetCoordinates(point[0], point[1], point[2]);
+          writer.WritePoint(las_point);
+        }
+        points[k] = std::vector<Vector3>(); // free the memory
       }
     }
     tpc.report_finished();
@@ -26,21 +26,27 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <math.h>
+#include <float.h>
 
 //VisionWorkbench & ASP
 #include <vw/Image/Transform.h>
 #include <vw/Cartography/PointImageManipulation.h>
 #include <vw/Image/MaskViews.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/PointCloudStats.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <vw/Core/ThreadPool.h>
+#include <boost/filesystem.hpp>
 using namespace vw;
 using namespace vw::cartography;
 namespace po = boost::program_options;
+namespace fs = boost::filesystem;
 
 //OpenSceneGraph
 #include <osg/Geode>
 #include <osg/Group>
+#include <osg/PagedLOD>
 #include <osg/ShapeDrawable>
 #include <osgUtil/Optimizer>
 #include <osgUtil/SmoothingVisitor>
@@ -73,12 +79,13 @@ namespace vw {
 }
 
 struct Options : vw::cartography::GdalWriteOptions {
-  Options() : root( new osg::Group() ), simplify_percent(0) {};
+  Options() : root( new osg::Group() ), simplify_percent(0), tile_size(0), num_lod_levels(1) {};
   // Input
   std::string pointcloud_filename, texture_file_name;
 
   // Settings
   uint32 step_size;
+  int tile_size, num_lod_levels;
   osg::ref_ptr<osg::Group> root;
   float simplify_percent;
   osg::Vec3f dataNormal;
@@ -157,24 +164,10 @@ osg::StateSet* create1DTexture( osg::Node* loadedModel , const osg::Vec3f& Direc
 // ---------------------------------------------------------
 // BUILD MESH
 //
-// Takes in an image and builds geodes for every triangle strip.
+// Prepares the texture, if any, and returns the name of the texture
+// file which osg can load, or an empty string.
 // ---------------------------------------------------------
-template <class ViewT>
-osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
-                       Options& opt ) {
-
-  //const ViewT& point_image_impl = point_image.impl();
-  osg::Geode* mesh = new osg::Geode();
-  osg::Geometry* geometry = new osg::Geometry();
-  osg::Vec3Array* vertices = new osg::Vec3Array();
-  osg::Vec2Array* texcoords = new osg::Vec2Array();
-  osg::Vec3Array* normals = new osg::Vec3Array();
-
-  opt.dataNormal = osg::Vec3f( 0.0f , 0.0f , 0.0f );
-
-  vw_out() << "\t--> Orginal size: [" << point_image.impl().cols() << ", " << point_image.impl().rows() << "]\n";
-  vw_out() << "\t--> Subsampled:   [" << point_image.impl().cols()/opt.step_size << ", "
-            << point_image.impl().rows()/opt.step_size << "]\n";
+std::string prepare_texture( vw::Vector2i const& image_size, Options const& opt ) {
 
   //////////////////////////////////////////////////
   // Deciding how to reduce the texture size
@@ -183,8 +176,8 @@ osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
   if ( opt.texture_file_name.size() ) {
     DiskImageView<PixelGray<uint8> > previous_texture(opt.texture_file_name);
     tex_file = asp::prefix_from_pointcloud_filename(opt.output_prefix) + "-tex";
-    if (point_image.impl().cols() > 4096 ||
-        point_image.impl().rows() > 4096 ) {
+    if (image_size.x() > 4096 ||
+        image_size.y() > 4096 ) {
       vw_out() << "Resampling to reduce texture size:\n";
       float tex_sub_scale = 4096.0/float(std::max(previous_texture.cols(),previous_texture.rows()));
       ImageViewRef<PixelGray<uint8> > new_texture = resample(previous_texture,tex_sub_scale);
@@ -213,219 +206,447 @@ osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
     tex_file += ".jpg";
   }
 
-  //////////////////////////////////////////////////
-  /// Setting name of geode
-  {
-    std::ostringstream os;
-    os << "Simple Mesh" << std::endl;
-    mesh->setName( os.str() );
+  return tex_file;
+}
+
+// Attach the texture to the given state set
+void attach_texture( std::string const& tex_file, osg::StateSet* stateset ) {
+
+  vw_out() << "Attaching texture data\n";
+
+  osg::Image* textureImage = osgDB::readImageFile(tex_file.c_str());
+
+  if ( textureImage ) {
+    if ( textureImage->valid() ){
+      osg::Texture2D* texture = new osg::Texture2D;
+      texture->setImage(textureImage);
+      stateset->setTextureAttributeAndModes(0,texture,osg::StateAttribute::ON);
+    } else {
+      vw_out() << "Failed to open texture data in " << tex_file << std::endl;
+    }
+  } else {
+    vw_out() << "Failed to open texture data in " << tex_file << std::endl;
   }
+}
+
+// Add to the normal at a grid point the normal of the triangle formed
+// with two of its neighbors, if they are in the grid and valid.
+void add_quadrant_normal( ImageView<Vector3> const& grid, int c, int r,
+                          int c1, int r1, int c2, int r2, Vector3 & normal ) {
+  if ( c1 < 0 || c1 >= grid.cols() || r1 < 0 || r1 >= grid.rows() ||
+       c2 < 0 || c2 >= grid.cols() || r2 < 0 || r2 >= grid.rows() )
+    return;
+  if ( grid(c1,r1) == Vector3(0,0,0) || grid(c2,r2) == Vector3(0,0,0) )
+    return;
+  normal = normal + normalize(cross_prod( grid(c1,r1) - grid(c,r),
+                                          grid(c2,r2) - grid(c,r) ) );
+}
+
+// ---------------------------------------------------------
+// BUILD GEOMETRY
+//
+// Builds the vertices and the triangle strips for the grid points
+// within the given range. The grid holds points of the cloud subsampled
+// by the given step, and grid_origin is the subsampled index of its
+// first point. Grid points around the range are used only for the
+// normals, so that the normals agree where two tiles meet.
+// ---------------------------------------------------------
+osg::Geometry* build_geometry( ImageView<Vector3> const& grid, BBox2i const& range,
+                               Vector2i const& grid_origin, int step,
+                               Vector2i const& image_size, bool enable_lighting,
+                               bool has_texture, Vector3 & data_normal ) {
+
+  osg::Geometry* geometry = new osg::Geometry();
+  osg::Vec3Array* vertices = new osg::Vec3Array();
+  osg::Vec2Array* texcoords = new osg::Vec2Array();
+  osg::Vec3Array* normals = new osg::Vec3Array();
 
   //////////////////////////////////////////////////
   /// PUSHING ALL VERTICES & Also texture coordinates
-  {
+  for ( int r = range.min().y(); r < range.max().y(); ++r ){
+    for ( int c = range.min().x(); c < range.max().x(); ++c ){
+
+      Vector3 const& point = grid(c,r);
+      vertices->push_back( osg::Vec3f( point[0], point[1], point[2] ) );
+
+      // Calculating normals, if the user wants shading
+      if (enable_lighting) {
+        Vector3 temp_normal;
+
+        // These calculations seems backwards from what they should
+        // be. Its because for the indexing of the image is weird,
+        // its column then row.
+        add_quadrant_normal( grid, c, r, c+1, r, c, r-1, temp_normal );
+        add_quadrant_normal( grid, c, r, c, r+1, c+1, r, temp_normal );
+        add_quadrant_normal( grid, c, r, c-1, r, c, r+1, temp_normal );
+        add_quadrant_normal( grid, c, r, c, r-1, c-1, r, temp_normal );
+
+        temp_normal = normalize( temp_normal );
+        normals->push_back( osg::Vec3f( temp_normal[0],
+                                        temp_normal[1],
+                                        temp_normal[2] ) );
+      }
+
+      if ( has_texture ) {
+        int c_step = (grid_origin.x() + c) * step;
+        int r_step = (grid_origin.y() + r) * step;
+        texcoords->push_back( osg::Vec2f ( (float)c_step / (float)image_size.x() ,
+                                           1-(float)r_step / (float)image_size.y() ) );
+      } else if ( (point[0] != 0 ) &&
+                  (point[1] != 0 ) &&
+                  (point[2] != 0 ) ) {
+        //I'm calculating the main normal for the data.
+        data_normal += point;
+      }
+    }
+  }
+
+  geometry->setVertexArray( vertices );
+
+  if (enable_lighting)
+    geometry->setNormalArray( normals );
+
+  if ( has_texture )
+    geometry->setTexCoordArray( 0,texcoords );
+
+  osg::Vec4Array* colour = new osg::Vec4Array();
+  colour->push_back( osg::Vec4f( 1.0f, 1.0f, 1.0f, 1.0f ) );
+  geometry->setColorArray( colour );
+  geometry->setColorBinding( osg::Geometry::BIND_OVERALL );
 
-    // Some constants for the calculation in here
-    uint32 num_rows = point_image.impl().rows()/opt.step_size;
-    uint32 num_cols = point_image.impl().cols()/opt.step_size;
-
-    TerminalProgressCallback progress("asp", "\tVertices:   ");
-    double progress_mult = 1.0/double(num_rows*num_cols);
-
-    for ( uint32 r = 0; r < (num_rows); ++r ){
-      for (uint32 c = 0; c < (num_cols); ++c ){
-        progress.report_progress((r*num_cols+c)*progress_mult);
-
-        uint32 r_step = r * opt.step_size;
-        uint32 c_step = c * opt.step_size;
-
-        vertices->push_back( osg::Vec3f( point_image.impl()(c_step,r_step)[0] ,
-                                         point_image.impl()(c_step,r_step)[1] ,
-                                         point_image.impl()(c_step,r_step)[2] ) );
-
-        // Calculating normals, if the user wants shading
-        if (opt.enable_lighting) {
-          Vector3 temp_normal;
-
-          // These calculations seems backwards from what they should
-          // be. Its because for the indexing of the image is weird,
-          // its column then row.
-
-          // Is quadrant 1 normal calculation possible?
-          if ( (r > 0) && ( (c+1) < (num_cols)) ) {
-            if ( (point_image.impl()(c_step+opt.step_size,r_step) != Vector3(0,0,0)) &&
-                 (point_image.impl()(c_step,r_step-opt.step_size) != Vector3(0,0,0)) ) {
-              temp_normal = temp_normal + normalize(cross_prod( point_image.impl()(c_step+opt.step_size,r_step) -
-                                                                point_image.impl()(c_step,r_step),
-                                                                point_image.impl()(c_step,r_step-opt.step_size) -
-                                                                point_image.impl()(c_step,r_step) ) );
-            }
-          }
-          // Is quadrant 2 normal calculation possible?
-          if ( ( (c+1) < (num_cols) ) && ((r+1) < (num_rows))){
-            if ( (point_image.impl()(c_step,r_step+opt.step_size) != Vector3(0,0,0)) &&
-                 (point_image.impl()(c_step+opt.step_size,r_step) != Vector3(0,0,0)) ) {
-              temp_normal = temp_normal + normalize(cross_prod( point_image.impl()(c_step,r_step+opt.step_size) -
-                                                                point_image.impl()(c_step,r_step),
-                                                                point_image.impl()(c_step+opt.step_size,r_step) -
-                                                                point_image.impl()(c_step,r_step) ) );
-            }
-          }
-          // Is quadrant 3 normal calculation possible?
-          if ( ((r+1) < (num_rows)) && (c>0) ) {
-            if ( (point_image.impl()(c_step-opt.step_size,r_step) != Vector3(0,0,0)) &&
-                 (point_image.impl()(c_step,r_step+opt.step_size) != Vector3(0,0,0)) ) {
-              temp_normal = temp_normal + normalize(cross_prod( point_image.impl()(c_step-opt.step_size,r_step) -
-                                                                point_image.impl()(c_step,r_step),
-                                                                point_image.impl()(c_step,r_step+opt.step_size) -
-                                                                point_image.impl()(c_step,r_step) ) );
-            }
-          }
-          // Is quadrant 4 normal calculation possible?
-          if ( (c>0) && (r>0) ) {
-            if ( (point_image.impl()(c_step,r_step-opt.step_size) != Vector3(0,0,0)) &&
-                 (point_image.impl()(c_step-opt.step_size,r_step) != Vector3(0,0,0)) ) {
-              temp_normal = temp_normal + normalize(cross_prod( point_image.impl()(c_step,r_step-opt.step_size) -
-                                                                point_image.impl()(c_step,r_step),
-                                                                point_image.impl()(c_step-opt.step_size,r_step) -
-                                                                point_image.impl()(c_step,r_step) ) );
-            }
-          }
-
-          temp_normal = normalize( temp_normal );
-          normals->push_back( osg::Vec3f( temp_normal[0],
-                                          temp_normal[1],
-                                          temp_normal[2] ) );
+  //////////////////////////////////////////////////
+  // Deciding How to draw triangle strips
+  uint32 col_steps = range.width();
+  for (int r = 0; r < range.height() - 1; ++r){
+
+    bool add_direction_down = true;
+    osg::DrawElementsUInt* dui = new osg::DrawElementsUInt(GL_TRIANGLE_STRIP);
+
+    for (uint32 c = 0; c < ( col_steps ); ++c){
+
+      uint32 pointing_index = r*(col_steps) + c;
+
+      if (add_direction_down) {
+
+        // Adding top point ...
+        if ( (vertices->at(pointing_index)[0] != 0) &&
+             (vertices->at(pointing_index)[1] != 0) &&
+             (vertices->at(pointing_index)[2] != 0) ) {
+
+          dui->push_back( pointing_index );
         }
 
-        if ( tex_file.size() ) {
-          texcoords->push_back( osg::Vec2f ( (float)c_step / (float)point_image.impl().cols() ,
-                                             1-(float)r_step / (float)point_image.impl().rows() ) );
-        } else if ( (point_image.impl()(c_step,r_step)[0] != 0 ) &&
-                    (point_image.impl()(c_step,r_step)[1] != 0 ) &&
-                    (point_image.impl()(c_step,r_step)[2] != 0 ) ) {
-          //I'm calculating the main normal for the data.
-          opt.dataNormal[0] += point_image.impl()(c_step,r_step)[0];
-          opt.dataNormal[1] += point_image.impl()(c_step,r_step)[1];
-          opt.dataNormal[2] += point_image.impl()(c_step,r_step)[2];
+        // Adding bottom point ..
+        if ( (vertices->at(pointing_index+col_steps)[0] != 0) &&
+             (vertices->at(pointing_index+col_steps)[1] != 0) &&
+             (vertices->at(pointing_index+col_steps)[2] != 0) ) {
+
+          dui->push_back( pointing_index+col_steps );
+        } else {
+          // If there's a drop out here... we switch adding direction.
+          add_direction_down = false;
         }
-      }
-    }
-    progress.report_finished();
 
-    vw_out() << "\t > size: " << vertices->size() << " vertices\n";
+      } else {
 
-    geometry->setVertexArray( vertices );
+        // Adding bottom point ..
+        if ( (vertices->at(pointing_index+col_steps)[0] != 0) &&
+             (vertices->at(pointing_index+col_steps)[1] != 0) &&
+             (vertices->at(pointing_index+col_steps)[2] != 0) ) {
 
-    if (opt.enable_lighting)
-      geometry->setNormalArray( normals );
+          dui->push_back( pointing_index+col_steps );
+        }
 
-    if ( tex_file.size() ) {
-      geometry->setTexCoordArray( 0,texcoords );
-    } else {
-      opt.dataNormal.normalize();
+        // Adding top point ...
+        if ( (vertices->at(pointing_index)[0] != 0) &&
+             (vertices->at(pointing_index)[1] != 0) &&
+             (vertices->at(pointing_index)[2] != 0) ) {
+
+          dui->push_back( pointing_index );
+        } else {
+          // If there's a drop out here... we switch adding direction.
+          add_direction_down = true;
+        }
+      }
     }
 
-    osg::Vec4Array* colour = new osg::Vec4Array();
-    colour->push_back( osg::Vec4f( 1.0f, 1.0f, 1.0f, 1.0f ) );
-    geometry->setColorArray( colour );
-    geometry->setColorBinding( osg::Geometry::BIND_OVERALL );
+    geometry->addPrimitiveSet(dui);
+  }
+
+  return geometry;
+}
 
+// Read a box of the cloud subsampled by the given step into a grid
+// which starts at grid_origin in the subsampled cloud.
+class ReadGridTask : public Task, private boost::noncopyable {
+  ImageViewRef<Vector3> m_point_image;
+  int m_step;
+  BBox2i m_box;
+  Vector2i m_grid_origin;
+  ImageView<Vector3> & m_grid;
+public:
+  ReadGridTask( ImageViewRef<Vector3> const& point_image, int step, BBox2i const& box,
+                Vector2i const& grid_origin, ImageView<Vector3> & grid ):
+    m_point_image(point_image), m_step(step), m_box(box),
+    m_grid_origin(grid_origin), m_grid(grid) {}
+
+  void operator()() {
+    crop(m_grid, m_box - m_grid_origin) = crop(subsample(m_point_image, m_step), m_box);
   }
+};
+
+// ---------------------------------------------------------
+// BUILD MESH
+//
+// Takes in an image and builds geodes for every triangle strip.
+// ---------------------------------------------------------
+osg::Node* build_mesh( ImageViewRef<Vector3> const& point_image,
+                       Options& opt ) {
+
+  osg::Geode* mesh = new osg::Geode();
+
+  opt.dataNormal = osg::Vec3f( 0.0f , 0.0f , 0.0f );
+
+  vw_out() << "\t--> Orginal size: [" << point_image.cols() << ", " << point_image.rows() << "]\n";
+  vw_out() << "\t--> Subsampled:   [" << point_image.cols()/opt.step_size << ", "
+            << point_image.rows()/opt.step_size << "]\n";
+
+  Vector2i image_size(point_image.cols(), point_image.rows());
+  std::string tex_file = prepare_texture(image_size, opt);
 
   //////////////////////////////////////////////////
-  // Deciding How to draw triangle strips
-  vw_out() << "Drawing triangle strips\n";
+  /// Setting name of geode
   {
-    uint32 col_steps = point_image.impl().cols()/opt.step_size;
+    std::ostringstream os;
+    os << "Simple Mesh" << std::endl;
+    mesh->setName( os.str() );
+  }
 
-    for (uint32 r = 0;
-         r < ( point_image.impl().rows()/opt.step_size - 1); ++r){
+  // Read the subsampled points, in parallel blocks of rows
+  int num_rows = point_image.rows()/opt.step_size;
+  int num_cols = point_image.cols()/opt.step_size;
+  ImageView<Vector3> grid(num_cols, num_rows);
+  {
+    int block_rows = std::max(1, vw_settings().default_tile_size()/int(opt.step_size));
+    FifoWorkQueue queue( vw_settings().default_num_threads() );
+    for ( int r = 0; r < num_rows; r += block_rows ) {
+      BBox2i box(0, r, num_cols, std::min(block_rows, num_rows - r));
+      boost::shared_ptr<ReadGridTask>
+        task( new ReadGridTask( point_image, opt.step_size, box, Vector2i(0, 0), grid ) );
+      queue.add_task( task );
+    }
+    queue.join_all();
+  }
 
-      bool add_direction_down = true;
-      osg::DrawElementsUInt* dui = new osg::DrawElementsUInt(GL_TRIANGLE_STRIP);
+  vw_out() << "\t > size: " << num_rows*num_cols << " vertices\n";
 
-      for (uint32 c = 0; c < ( col_steps ); ++c){
+  vw_out() << "Drawing triangle strips\n";
+  Vector3 data_normal;
+  osg::Geometry* geometry
+    = build_geometry( grid, bounding_box(grid), Vector2i(0, 0), opt.step_size,
+                      image_size, opt.enable_lighting, !tex_file.empty(), data_normal );
+
+  if ( tex_file.empty() ) {
+    opt.dataNormal = osg::Vec3f( data_normal[0], data_normal[1], data_normal[2] );
+    opt.dataNormal.normalize();
+  }
 
-        uint32 pointing_index = r*(col_steps) + c;
+  ////////////////////////////////////////////////
+  /// Adding texture to the DTM
+  if (tex_file.size())
+    attach_texture( tex_file, geometry->getOrCreateStateSet() );
 
-        //vw_out() << "V: " << vertices->at(pointing_index)[0] << " " << vertices->at(pointing_index)[1] << " " << vertices->at(pointing_index)[2] << std::endl;
+  mesh->addDrawable( geometry );
 
-        if (add_direction_down) {
+  return mesh;
 
-          // Adding top point ...
-          if ( (vertices->at(pointing_index)[0] != 0) &&
-               (vertices->at(pointing_index)[1] != 0) &&
-               (vertices->at(pointing_index)[2] != 0) ) {
+}
 
-            dui->push_back( pointing_index );
-          }
+// Smooth, simplify, and optimize a mesh, as requested
+void postprocess_mesh( osg::Node* node, Options & opt, bool verbose ) {
 
-          // Adding bottom point ..
-          if ( (vertices->at(pointing_index+col_steps)[0] != 0) &&
-               (vertices->at(pointing_index+col_steps)[1] != 0) &&
-               (vertices->at(pointing_index+col_steps)[2] != 0) ) {
+  if ( opt.smooth_mesh ) {
+    if (verbose) vw_out() << "Smoothing data\n";
+    osgUtil::SmoothingVisitor sv;
+    node->accept(sv);
+  }
 
-            dui->push_back( pointing_index+col_steps );
-          } else {
-            // If there's a drop out here... we switch adding direction.
-            add_direction_down = false;
-          }
+  if ( opt.simplify_mesh ) {
+    if ( opt.simplify_percent == 0.0 )
+      opt.simplify_percent = 1.0;
 
-        } else {
+    if (verbose) vw_out() << "Simplifying data\n";
+    osgUtil::Simplifier simple;
+    simple.setSmoothing( opt.smooth_mesh );
+    simple.setSampleRatio( opt.simplify_percent );
+    node->accept(simple);
+  }
 
-          // Adding bottom point ..
-          if ( (vertices->at(pointing_index+col_steps)[0] != 0) &&
-               (vertices->at(pointing_index+col_steps)[1] != 0) &&
-               (vertices->at(pointing_index+col_steps)[2] != 0) ) {
+  {
+    if (verbose) vw_out() << "Optimizing data\n";
+    osgUtil::Optimizer optimizer;
+    optimizer.optimize( node );
+  }
+}
 
-            dui->push_back( pointing_index+col_steps );
-          }
+// Build the meshes of one tile at all levels of detail. A tile covers
+// tile_size x tile_size cells of the grid subsampled by the step size,
+// and shares its boundary vertices with the neighboring tiles. At level
+// k the step is multiplied by 2^k.
+class MeshTileTask : public Task, private boost::noncopyable {
+  ImageViewRef<Vector3> m_point_image;
+  Vector2i m_tile_origin; // in the grid at level 0
+  Options const& m_opt;
+  bool m_has_texture;
+  std::vector< osg::ref_ptr<osg::Geode> > & m_levels;
+  Vector3 & m_data_normal;
+  Mutex & m_mutex;
+  ProgressCallback const& m_progress;
+  double m_inc_amt;
+
+public:
+  MeshTileTask( ImageViewRef<Vector3> const& point_image, Vector2i const& tile_origin,
+                Options const& opt, bool has_texture,
+                std::vector< osg::ref_ptr<osg::Geode> > & levels,
+                Vector3 & data_normal, Mutex & mutex,
+                ProgressCallback const& progress, double inc_amt ):
+    m_point_image(point_image), m_tile_origin(tile_origin), m_opt(opt),
+    m_has_texture(has_texture), m_levels(levels), m_data_normal(data_normal),
+    m_mutex(mutex), m_progress(progress), m_inc_amt(inc_amt) {}
+
+  void operator()() {
+
+    Vector2i image_size(m_point_image.cols(), m_point_image.rows());
+    Vector3 data_normal;
+
+    m_levels.resize(m_opt.num_lod_levels);
+    for ( int k = 0; k < m_opt.num_lod_levels; k++ ) {
+
+      int step      = m_opt.step_size << k;
+      int tile_size = m_opt.tile_size >> k;
+      BBox2i grid_box(0, 0, image_size.x()/step, image_size.y()/step);
+
+      // The vertices of this tile, and the ones just around it for the normals
+      Vector2i begin = elem_quot(m_tile_origin, 1 << k);
+      BBox2i range(begin, begin + Vector2i(tile_size + 1, tile_size + 1));
+      range.crop(grid_box);
+      BBox2i halo = range;
+      halo.expand(1);
+      halo.crop(grid_box);
+
+      m_levels[k] = new osg::Geode();
+      if ( range.width() < 2 || range.height() < 2 )
+        continue; // no triangles at this level
+
+      ImageView<Vector3> grid = crop(subsample(m_point_image, step), halo);
+      m_levels[k]->addDrawable( build_geometry( grid, range - halo.min(), halo.min(),
+                                                step, image_size, m_opt.enable_lighting,
+                                                m_has_texture, data_normal ) );
+    }
 
-          // Adding top point ...
-          if ( (vertices->at(pointing_index)[0] != 0) &&
-               (vertices->at(pointing_index)[1] != 0) &&
-               (vertices->at(pointing_index)[2] != 0) ) {
+    Mutex::Lock lock(m_mutex);
+    m_data_normal += data_normal;
+    m_progress.report_incremental_progress(m_inc_amt);
+  }
+};
 
-            dui->push_back( pointing_index );
-          } else {
-            // If there's a drop out here... we switch adding direction.
-            add_direction_down = true;
-          }
-        }
-      }
+// ---------------------------------------------------------
+// BUILD TILED MESH
+//
+// Builds the mesh as tiles, in parallel. With more than one level of
+// detail, each tile is a PagedLOD node which has the coarsest level
+// inline and loads the finer ones from their own files, written here,
+// as the viewer gets closer.
+// ---------------------------------------------------------
+osg::Node* build_tiled_mesh( ImageViewRef<Vector3> const& point_image,
+                             Options& opt ) {
+
+  osg::Group* tiles = new osg::Group();
+  tiles->setName( "Tiled Mesh" );
 
-      geometry->addPrimitiveSet(dui);
+  Vector2i image_size(point_image.cols(), point_image.rows());
+  std::string tex_file = prepare_texture(image_size, opt);
 
+  int num_rows = point_image.rows()/opt.step_size;
+  int num_cols = point_image.cols()/opt.step_size;
+  std::vector<Vector2i> tile_origins;
+  for ( int r = 0; r + 1 < num_rows; r += opt.tile_size )
+    for ( int c = 0; c + 1 < num_cols; c += opt.tile_size )
+      tile_origins.push_back( Vector2i(c, r) );
+
+  vw_out() << "\t--> Building " << tile_origins.size() << " tiles with "
+           << opt.num_lod_levels << " level(s) of detail.\n";
+
+  std::vector< std::vector< osg::ref_ptr<osg::Geode> > > levels(tile_origins.size());
+  Vector3 data_normal;
+  {
+    TerminalProgressCallback progress("asp", "\tTiles:      ");
+    FifoWorkQueue queue( vw_settings().default_num_threads() );
+    Mutex mutex;
+    double inc_amt = 1.0 / std::max(size_t(1), tile_origins.size());
+    for ( size_t i = 0; i < tile_origins.size(); i++ ) {
+      boost::shared_ptr<MeshTileTask>
+        task( new MeshTileTask( point_image, tile_origins[i], opt, !tex_file.empty(),
+                                levels[i], data_normal, mutex, progress, inc_amt ) );
+      queue.add_task( task );
     }
+    queue.join_all();
+    progress.report_finished();
   }
 
-  ////////////////////////////////////////////////
-  /// Adding texture to the DTM
-  if (tex_file.size()){
+  if ( tex_file.empty() ) {
+    opt.dataNormal = osg::Vec3f( data_normal[0], data_normal[1], data_normal[2] );
+    opt.dataNormal.normalize();
+  } else {
+    // On the group, so that the paged tiles also get it, without
+    // saving the texture in each of their files.
+    attach_texture( tex_file, tiles->getOrCreateStateSet() );
+  }
 
-    vw_out() << "Attaching texture data\n";
+  std::string tile_prefix = opt.output_prefix + "-tile-";
+  int num_levels = opt.num_lod_levels;
+  for ( size_t i = 0; i < levels.size(); i++ ) {
 
-    osg::Image* textureImage = osgDB::readImageFile(tex_file.c_str());
+    if ( num_levels == 1 ) {
+      tiles->addChild( levels[i][0].get() );
+      continue;
+    }
 
-    if ( textureImage ) {
-      if ( textureImage->valid() ){
-        osg::Texture2D* texture = new osg::Texture2D;
-        texture->setImage(textureImage);
-        osg::StateSet* stateset = geometry->getOrCreateStateSet();
-        stateset->setTextureAttributeAndModes(0,texture,osg::StateAttribute::ON);
-      } else {
-        vw_out() << "Failed to open texture data in " << tex_file << std::endl;
-      }
-    } else {
-      vw_out() << "Failed to open texture data in " << tex_file << std::endl;
+    osg::Geode* coarsest = levels[i][num_levels - 1].get();
+    osg::BoundingSphere bs = coarsest->getBound();
+
+    // Level k is shown at distances from 3 * radius * 2^(k-1) to
+    // 3 * radius * 2^k, with no lower limit for the finest level and
+    // no upper limit for the coarsest.
+    osg::PagedLOD* lod = new osg::PagedLOD();
+    lod->setCenterMode( osg::LOD::USER_DEFINED_CENTER );
+    lod->setCenter( bs.center() );
+    lod->setRadius( bs.radius() );
+    lod->setRangeMode( osg::LOD::DISTANCE_FROM_EYE_POINT );
+    lod->addChild( coarsest, 3.0*bs.radius()*(1 << (num_levels - 2)), FLT_MAX );
+
+    for ( int k = num_levels - 2; k >= 0; k-- ) {
+      std::ostringstream os;
+      os << tile_prefix << i << "-" << k << "." << opt.output_file_type;
+      postprocess_mesh( levels[i][k].get(), opt, false );
+      osgDB::writeNodeFile( *levels[i][k].get(), os.str(),
+                            new osgDB::Options("Compressor=zlib") );
+
+      // Paged files are looked up relative to the root file
+      float min_range = (k == 0) ? 0.0 : 3.0*bs.radius()*(1 << (k - 1));
+      float max_range = 3.0*bs.radius()*(1 << k);
+      int child = lod->getNumFileNames();
+      lod->setFileName( child, fs::path(os.str()).filename().string() );
+      lod->setRange( child, min_range, max_range );
     }
+
+    tiles->addChild( lod );
   }
 
-  mesh->addDrawable( geometry );
-
-  return mesh;
+  if ( num_levels > 1 )
+    vw_out() << "Wrote the finer levels of detail with prefix: " << tile_prefix << "\n";
 
+  return tiles;
 }
 
 // MAIN
@@ -441,6 +662,10 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("use-delaunay", "Uses the delaunay triangulator to create a surface from the point cloud. This is not recommended for point clouds with serious noise issues.")
     ("step,s", po::value(&opt.step_size)->default_value(10),
      "Step size for mesher, sets the polygons size per point")
+    ("tile-size", po::value(&opt.tile_size)->default_value(0),
+     "If positive, build the mesh in parallel as tiles of this many steps on each side. The tiles share their boundary vertices.")
+    ("num-lod-levels", po::value(&opt.num_lod_levels)->default_value(1),
+     "With --tile-size, the number of levels of detail. Each level doubles the step. If more than one, each tile is paged, and its finer levels are saved in separate files. The tile size must be a multiple of 2^(num-lod-levels - 1).")
     ("output-prefix,o", po::value(&opt.output_prefix),
      "Specify the output prefix.")
     ("output-filetype,t",
@@ -479,6 +704,21 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     opt.output_prefix =
       asp::prefix_from_pointcloud_filename( opt.pointcloud_filename );
 
+  if ( opt.step_size < 1 )
+    vw_throw( ArgumentErr() << "The step size must be positive.\n"
+              << usage << general_options );
+  if ( opt.tile_size < 0 )
+    vw_throw( ArgumentErr() << "The tile size must be non-negative.\n"
+              << usage << general_options );
+  if ( opt.num_lod_levels < 1 || opt.num_lod_levels > 16 )
+    vw_throw( ArgumentErr() << "The number of levels of detail must be between 1 and 16.\n"
+              << usage << general_options );
+  if ( opt.num_lod_levels > 1 &&
+       ( opt.tile_size == 0 || opt.tile_size % (1 << (opt.num_lod_levels - 1)) != 0 ) )
+    vw_throw( ArgumentErr() << "With more than one level of detail, the tile size must be "
+              << "a positive multiple of 2^(num-lod-levels - 1).\n"
+              << usage << general_options );
+
   // Create the output directory
   vw::create_out_dir(opt.output_prefix);
 
@@ -512,6 +752,8 @@ int main( int argc, char *argv[] ){
 
     // Loading point cloud
     ImageViewRef<Vector3> point_image;
+    asp::PointCloudStats cloud_stats;
+    bool have_cloud_stats = false;
     if (num_channels == 1 && has_georef) {
       // The input is a DEM. Convert it to a point cloud.
       DiskImageView<double> dem(input_file);
@@ -521,6 +763,7 @@ int main( int argc, char *argv[] ){
     }else if (num_channels >= 3){
       // The input DEM is a point cloud
       point_image = asp::read_asp_point_cloud<3>(input_file);
+      have_cloud_stats = asp::read_point_cloud_stats(input_file, cloud_stats);
     }else{
       vw_throw( ArgumentErr() << "The input must be a point cloud or a DEM.\n");
     }
@@ -528,7 +771,8 @@ int main( int argc, char *argv[] ){
     // Centering Option (helpful if you are experiencing round-off error...)
     if (opt.center) {
       bool is_geodetic = false; // raw xyz values
-      BBox3 bbox = asp::pointcloud_bbox(point_image, is_geodetic);
+      BBox3 bbox = have_cloud_stats ? cloud_stats.bbox :
+        asp::pointcloud_bbox(point_image, is_geodetic);
       vw_out() << "\t--> Centering model around the origin.\n";
       vw_out() << "\t    Initial point image bounding box: " << bbox << "\n";
       Vector3 midpoint = (bbox.max() + bbox.min()) / 2.0;
@@ -538,7 +782,10 @@ int main( int argc, char *argv[] ){
 
     {
       vw_out() << "\nGenerating 3D mesh from point cloud:\n";
-      opt.root->addChild(build_mesh(point_image, opt));
+      if ( opt.tile_size > 0 )
+        opt.root->addChild(build_tiled_mesh(point_image, opt));
+      else
+        opt.root->addChild(build_mesh(point_image, opt));
 
       if ( !opt.texture_file_name.empty() ) {
         // Turning off lighting and other likes
@@ -559,28 +806,7 @@ int main( int argc, char *argv[] ){
       }
     }
 
-    if ( opt.smooth_mesh ) {
-      vw_out() << "Smoothing data\n";
-      osgUtil::SmoothingVisitor sv;
-      opt.root->accept(sv);
-    }
-
-    if ( opt.simplify_mesh ) {
-      if ( opt.simplify_percent == 0.0 )
-        opt.simplify_percent = 1.0;
-
-      vw_out() << "Simplifying data\n";
-      osgUtil::Simplifier simple;
-      simple.setSmoothing( opt.smooth_mesh );
-      simple.setSampleRatio( opt.simplify_percent );
-      opt.root->accept(simple);
-    }
-
-    {
-      vw_out() << "Optimizing data\n";
-      osgUtil::Optimizer optimizer;
-      optimizer.optimize( opt.root.get() );
-    }
+    postprocess_mesh( opt.root.get(), opt, true );
 
     {
       std::ostringstream os;
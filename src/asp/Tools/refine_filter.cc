@@ -0,0 +1,781 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file refine_filter.cc
+///
+
+#include <asp/Tools/stereo.h>
+#include <asp/Tools/refine_filter.h>
+#include <vw/Stereo/PreFilter.h>
+#include <vw/Stereo/CostFunctions.h>
+#include <vw/Stereo/SubpixelView.h>
+#include <vw/Stereo/EMSubpixelCorrelatorView.h>
+#include <vw/Stereo/DisparityMap.h>
+#include <vw/Stereo/Algorithms.h>
+#include <vw/Image/BlobIndex.h>
+#include <vw/Image/ErodeView.h>
+#include <asp/Core/LocalHomography.h>
+#include <asp/Core/ThreadedEdgeMask.h>
+#include <asp/Core/Trace.h>
+#include <asp/Core/TilePool.h>
+#include <asp/Sessions/StereoSession.h>
+
+using namespace vw;
+using namespace vw::stereo;
+using namespace asp;
+using namespace std;
+
+namespace vw {
+  template<> struct PixelFormatID<PixelMask<Vector<float, 5> > >   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
+}
+
+template <class Image1T, class Image2T>
+ImageViewRef<PixelMask<Vector2f> >
+refine_disparity(Image1T const& left_image,
+                 Image2T const& right_image,
+                 ImageViewRef< PixelMask<Vector2f> > const& integer_disp,
+                 ASPGlobalOptions const& opt, bool verbose){
+
+  ImageViewRef<PixelMask<Vector2f> > refined_disp = integer_disp;
+
+  PrefilterModeType prefilter_mode = 
+    static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode);
+
+  if ((stereo_settings().subpixel_mode == 0) || (stereo_settings().subpixel_mode > 5)) {
+    // Do nothing (includes SGM specific subpixel modes)
+    if (verbose)
+      vw_out() << "\t--> Skipping subpixel mode.\n";
+  }
+  if (stereo_settings().subpixel_mode == 1 && stereo_settings().subpixel_in_corr) {
+    // The parabola fit was done in stereo_corr
+    if (verbose)
+      vw_out() << "\t--> Subpixel refinement was done during correlation.\n";
+  }
+  if (stereo_settings().subpixel_mode == 1 && !stereo_settings().subpixel_in_corr) {
+    // Parabola
+    
+    if (verbose) {
+      vw_out() << "\t--> Using parabola subpixel mode.\n";
+      if (stereo_settings().pre_filter_mode == 2)
+        vw_out() << "\t--> Using LOG pre-processing filter with "
+                 << stereo_settings().slogW << " sigma blur.\n";
+      else if (stereo_settings().pre_filter_mode == 1)
+        vw_out() << "\t--> Using Subtracted Mean pre-processing filter with "
+                 << stereo_settings().slogW << " sigma blur.\n";
+      else
+        vw_out() << "\t--> NO preprocessing" << endl;
+    } 
+    
+    refined_disp = parabola_subpixel( integer_disp,
+                                      left_image, right_image,
+                                      prefilter_mode, stereo_settings().slogW,
+                                      stereo_settings().subpixel_kernel );
+    
+  } // End parabola cases
+  if (stereo_settings().subpixel_mode == 2) {
+    // Bayes EM
+    if (verbose){
+      vw_out() << "\t--> Using affine adaptive subpixel mode\n";
+      vw_out() << "\t--> Forcing use of LOG filter with "
+               << stereo_settings().slogW << " sigma blur.\n";
+    }
+    refined_disp =
+      bayes_em_subpixel( integer_disp,
+                         left_image, right_image,
+                         prefilter_mode, stereo_settings().slogW,
+                         stereo_settings().subpixel_kernel,
+                         stereo_settings().subpixel_max_levels );
+
+  } // End Bayes EM cases
+  if (stereo_settings().subpixel_mode == 3) {
+    // Fast affine
+    if (verbose){
+      vw_out() << "\t--> Using affine subpixel mode\n";
+      vw_out() << "\t--> Forcing use of LOG filter with "
+               << stereo_settings().slogW << " sigma blur.\n";
+    }
+    refined_disp =
+      affine_subpixel( integer_disp,
+                       left_image, right_image,
+                       prefilter_mode, stereo_settings().slogW,
+                       stereo_settings().subpixel_kernel,
+                       stereo_settings().subpixel_max_levels );
+
+  } // End Fast affine cases
+  if (stereo_settings().subpixel_mode == 4) {
+    // Lucas-Kanade
+    if (verbose){
+      vw_out() << "\t--> Using Lucas-Kanade subpixel mode\n";
+      vw_out() << "\t--> Forcing use of LOG filter with "
+               << stereo_settings().slogW << " sigma blur.\n";
+    }
+    refined_disp =
+      lk_subpixel( integer_disp,
+                   left_image, right_image,
+                   prefilter_mode, stereo_settings().slogW,
+                   stereo_settings().subpixel_kernel,
+                   stereo_settings().subpixel_max_levels );
+
+  } // End Lucas-Kanade cases
+  if (stereo_settings().subpixel_mode == 5) {
+    // Affine and Bayes subpixel refinement always use the LogPreprocessingFilter...
+    if (verbose){
+      vw_out() << "\t--> Using EM Subpixel mode "
+               << stereo_settings().subpixel_mode << endl;
+      vw_out() << "\t--> Mode 3 does internal preprocessing;"
+               << " settings will be ignored. " << endl;
+    }
+
+    typedef stereo::EMSubpixelCorrelatorView<float32> EMCorrelator;
+    EMCorrelator em_correlator(channels_to_planes(left_image),
+                               channels_to_planes(right_image),
+                               pixel_cast<PixelMask<Vector2f> >(integer_disp), -1);
+    em_correlator.set_em_iter_max   (stereo_settings().subpixel_em_iter       );
+    em_correlator.set_inner_iter_max(stereo_settings().subpixel_affine_iter   );
+    em_correlator.set_kernel_size   (stereo_settings().subpixel_kernel        );
+    em_correlator.set_pyramid_levels(stereo_settings().subpixel_pyramid_levels);
+
+    DiskImageResourceOpenEXR em_disparity_map_rsrc(opt.out_prefix + "-F6.exr", em_correlator.format());
+
+    block_write_image(em_disparity_map_rsrc, em_correlator,
+                      TerminalProgressCallback("asp", "\t--> EM Refinement :"));
+
+    DiskImageResource *em_disparity_map_rsrc_2 =
+      DiskImageResourceOpenEXR::construct_open(opt.out_prefix + "-F6.exr");
+    DiskImageView<PixelMask<Vector<float, 5> > > em_disparity_disk_image(em_disparity_map_rsrc_2);
+
+    ImageViewRef<Vector<float, 3> > disparity_uncertainty =
+      per_pixel_filter(em_disparity_disk_image,
+                       EMCorrelator::ExtractUncertaintyFunctor());
+    ImageViewRef<float> spectral_uncertainty =
+      per_pixel_filter(disparity_uncertainty,
+                       EMCorrelator::SpectralRadiusUncertaintyFunctor());
+    write_image(opt.out_prefix+"-US.tif", spectral_uncertainty);
+    write_image(opt.out_prefix+"-U.tif", disparity_uncertainty);
+
+    refined_disp =
+      per_pixel_filter(em_disparity_disk_image,
+                       EMCorrelator::ExtractDisparityFunctor());
+  } // End EM subpixel cases 
+  if ((stereo_settings().subpixel_mode < 0) || (stereo_settings().subpixel_mode > 5)){
+    if (verbose) {
+      vw_out() << "\t--> Invalid Subpixel mode selection: " << stereo_settings().subpixel_mode << endl;
+      vw_out() << "\t--> Doing nothing\n";
+    }
+  }
+
+  return refined_disp;
+}
+
+// Perform refinement in each tile. If using local homography,
+// apply the local homography transform for the given tile
+// to the right image before doing refinement in that tile.
+template <class Image1T, class Image2T, class SeedDispT>
+class PerTileRfne: public ImageViewBase<PerTileRfne<Image1T, Image2T, SeedDispT> >{
+  Image1T              m_left_image;
+  Image2T              m_right_image;
+  ImageViewRef<uint8>  m_right_mask;
+  SeedDispT            m_integer_disp;
+  SeedDispT            m_sub_disp;
+  ImageView<Matrix3x3> m_local_hom;
+  ASPGlobalOptions const&       m_opt;
+  Vector2              m_upscale_factor;
+
+public:
+  PerTileRfne( ImageViewBase<Image1T>   const& left_image,
+               ImageViewBase<Image2T>   const& right_image,
+               ImageViewRef <uint8>     const& right_mask,
+               ImageViewBase<SeedDispT> const& integer_disp,
+               ImageViewBase<SeedDispT> const& sub_disp,
+               ImageView    <Matrix3x3> const& local_hom,
+               ASPGlobalOptions const& opt):
+    m_left_image(left_image.impl()), m_right_image(right_image.impl()),
+    m_right_mask(right_mask),
+    m_integer_disp( integer_disp.impl() ), m_sub_disp( sub_disp.impl() ),
+    m_local_hom(local_hom), m_opt(opt){
+
+    m_upscale_factor = Vector2(double(m_left_image.impl().cols()) / m_sub_disp.cols(),
+                               double(m_left_image.impl().rows()) / m_sub_disp.rows());
+  }
+
+  /// The box of the transformed right image which refining the given
+  /// tile can read. That is the tile shifted by its disparities, grown
+  /// by the subpixel kernel at the coarsest pyramid level, by the
+  /// prefilter blur, and by a few pixels for the motion of the refiners.
+  BBox2i rfne_right_box(BBox2i const& bbox) const {
+    ImageView<PixelMask<Vector2f> > tile_disp = crop(m_integer_disp, bbox);
+    BBox2f range = stereo::get_disparity_range(tile_disp);
+    if (range.empty())
+      range = BBox2f(0, 0, 0, 0);
+
+    BBox2i right_box(bbox.min() + Vector2i(floor(range.min().x()), floor(range.min().y())),
+                     bbox.max() + Vector2i(ceil (range.max().x()), ceil (range.max().y())));
+    Vector2i kernel = stereo_settings().subpixel_kernel;
+    int scale  = 1 << stereo_settings().subpixel_max_levels;
+    int margin = (std::max(kernel[0], kernel[1])/2 + 2) * scale
+                 + int(ceil(3.0 * stereo_settings().slogW)) + 4;
+    right_box.expand(margin);
+    return right_box;
+  }
+
+  // Image View interface
+  typedef PixelMask<Vector2f>                  pixel_type;
+  typedef pixel_type                           result_type;
+  typedef ProceduralPixelAccessor<PerTileRfne> pixel_accessor;
+
+  inline int32 cols  () const { return m_left_image.cols(); }
+  inline int32 rows  () const { return m_left_image.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "PerTileRfne::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    // The local homographies are per correlation tile. A larger tile,
+    // as when refining as part of triangulation, is done in pieces.
+    bool use_local_hom = (stereo_settings().seed_mode > 0 &&
+                          stereo_settings().use_local_homography);
+    int ts = ASPGlobalOptions::corr_tile_size();
+    BBox2i corr_tile(ts*(bbox.min().x()/ts), ts*(bbox.min().y()/ts), ts, ts);
+    if (use_local_hom && !corr_tile.contains(bbox)) {
+      ImageView<pixel_type> pieces(bbox.width(), bbox.height());
+      for (int y = corr_tile.min().y(); y < bbox.max().y(); y += ts) {
+        for (int x = corr_tile.min().x(); x < bbox.max().x(); x += ts) {
+          BBox2i piece(x, y, ts, ts);
+          piece.crop(bbox);
+          crop(pieces, piece - bbox.min()) = crop(prerasterize(piece), piece);
+        }
+      }
+      return prerasterize_type(pieces, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    asp::ScopedTrace trace("subpixel_refinement", bbox);
+    trace.count("pixels", double(bbox.width())*bbox.height());
+
+    ImageView<pixel_type> tile_disparity;
+    bool verbose = false;
+    if (use_local_hom){
+
+      Matrix<double>  lowres_hom = m_local_hom(bbox.min().x()/ts, bbox.min().y()/ts);
+      Vector3 upscale( m_upscale_factor[0],     m_upscale_factor[1],     1 );
+      Vector3 dnscale( 1.0/m_upscale_factor[0], 1.0/m_upscale_factor[1], 1 );
+      Matrix<double>  fullres_hom = diagonal_matrix(upscale)*lowres_hom*diagonal_matrix(dnscale);
+
+      // Must transform the right image by the local disparity
+      // to be in the same conditions as for stereo correlation.
+      // Only the part of it seen by this tile is warped, once, into
+      // a buffer, and the rest of the image frame reads as zero.
+      BBox2i right_box = rfne_right_box(bbox);
+      right_box.crop(bounding_box(m_left_image.impl()));
+      asp::ScratchImage< PixelGray<float> > right_buf(right_box.width(), right_box.height());
+      warp_by_homography(m_right_image.impl(), m_right_mask, fullres_hom,
+                         right_box, *right_buf);
+      ImageViewRef< PixelGray<float> > right_trans_img
+        = crop(edge_extend(*right_buf, ZeroEdgeExtension()),
+               -right_box.min().x(), -right_box.min().y(),
+               m_left_image.impl().cols(), m_left_image.impl().rows());
+
+
+      tile_disparity = crop(refine_disparity(m_left_image, right_trans_img,
+                                             m_integer_disp, m_opt, verbose), bbox);
+
+      // Must undo the local homography transform
+      bool do_round = false; // don't round floating point disparities
+      tile_disparity = transform_disparities(do_round, bbox, inverse(fullres_hom),
+                                             tile_disparity);
+
+    }else{
+      tile_disparity = crop(refine_disparity(m_left_image, m_right_image,
+                                             m_integer_disp, m_opt, verbose), bbox);
+    }
+    
+    prerasterize_type disparity = prerasterize_type(tile_disparity,
+                                                    -bbox.min().x(), -bbox.min().y(),
+                                                    cols(), rows() );
+    return disparity;
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+template <class Image1T, class Image2T, class SeedDispT>
+PerTileRfne<Image1T, Image2T, SeedDispT>
+per_tile_rfne( ImageViewBase<Image1T  > const& left,
+               ImageViewBase<Image2T  > const& right,
+               ImageViewRef<uint8     > const& right_mask,
+               ImageViewBase<SeedDispT> const& integer_disp,
+               ImageViewBase<SeedDispT> const& sub_disp,
+               ImageView<Matrix3x3    > const& local_hom,
+               ASPGlobalOptions const& opt) {
+  typedef PerTileRfne<Image1T, Image2T, SeedDispT> return_type;
+  return return_type( left.impl(), right.impl(), right_mask,
+                      integer_disp.impl(), sub_disp.impl(), local_hom, opt );
+}
+
+// Sum over the box [c0, c1) x [r0, r1) of an integral image with
+// one more column and row than the image it was made from.
+inline double box_sum(std::vector<double> const& integral, int stride,
+                      int c0, int r0, int c1, int r1) {
+  return integral[r1*stride + c1] - integral[r0*stride + c1]
+       - integral[r1*stride + c0] + integral[r0*stride + c0];
+}
+
+// Make the integral image of the given values.
+void make_integral(std::vector<double> const& vals, int cols, int rows,
+                   std::vector<double> & integral) {
+  int stride = cols + 1;
+  integral.assign(stride*(rows + 1), 0.0);
+  for (int row = 0; row < rows; row++) {
+    double row_sum = 0.0;
+    double       * out  = &integral[(row + 1)*stride + 1];
+    double const * prev = &integral[row*stride + 1];
+    double const * in   = &vals[row*cols];
+    for (int col = 0; col < cols; col++) {
+      row_sum += in[col];
+      out[col] = prev[col] + row_sum;
+    }
+  }
+}
+
+/// The standard deviation of the image values in a square window
+/// of the given size around each pixel, with the window cropped to
+/// the image. Found with integral images, so the cost per pixel does
+/// not depend on the window size.
+void box_texture_measure(ImageView<float> const& img, int kernel_size,
+                         ImageView<float> & texture) {
+
+  int cols = img.cols(), rows = img.rows(), stride = cols + 1;
+  int half = kernel_size/2;
+  std::vector<double> vals(cols*rows), vals2(cols*rows), sum, sum2;
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      double v = img(col, row);
+      vals [row*cols + col] = v;
+      vals2[row*cols + col] = v*v;
+    }
+  }
+  make_integral(vals,  cols, rows, sum );
+  make_integral(vals2, cols, rows, sum2);
+
+  texture.set_size(cols, rows);
+  for (int row = 0; row < rows; row++) {
+    int r0 = std::max(row - half, 0), r1 = std::min(row + half + 1, rows);
+    for (int col = 0; col < cols; col++) {
+      int c0 = std::max(col - half, 0), c1 = std::min(col + half + 1, cols);
+      double n    = double(c1 - c0)*(r1 - r0);
+      double mean = box_sum(sum, stride, c0, r0, c1, r1)/n;
+      double var  = box_sum(sum2, stride, c0, r0, c1, r1)/n - mean*mean;
+      texture(col, row) = sqrt(std::max(var, 0.0));
+    }
+  }
+}
+
+/// Replace each valid disparity with the mean of the valid ones in a
+/// square window around it. The window has the given maximum size
+/// where there is no texture, and shrinks linearly as the texture
+/// grows, with the disparity left unchanged where the texture reaches
+/// texture_max or the window would be smaller than 3 pixels. The means
+/// are found with integral images, so large windows cost no more.
+void box_texture_preserving_filter(ImageView< PixelMask<Vector2f> > const& disp,
+                                   ImageView<float> const& texture,
+                                   float texture_max, int max_kernel_size,
+                                   ImageView< PixelMask<Vector2f> > & out) {
+
+  int cols = disp.cols(), rows = disp.rows(), stride = cols + 1;
+  std::vector<double> count(cols*rows), dx(cols*rows), dy(cols*rows);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      PixelMask<Vector2f> const& pix = disp(col, row);
+      int k = row*cols + col;
+      count[k] = is_valid(pix);
+      dx[k]    = is_valid(pix) ? pix.child()[0] : 0.0;
+      dy[k]    = is_valid(pix) ? pix.child()[1] : 0.0;
+    }
+  }
+  std::vector<double> count_sum, dx_sum, dy_sum;
+  make_integral(count, cols, rows, count_sum);
+  make_integral(dx,    cols, rows, dx_sum   );
+  make_integral(dy,    cols, rows, dy_sum   );
+
+  out = copy(disp);
+  if (!(texture_max > 0))
+    return;
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      if (!is_valid(disp(col, row)))
+        continue;
+      float t = texture(col, row);
+      if (t >= texture_max)
+        continue;
+      int half = int(round(max_kernel_size*(1.0 - t/texture_max)))/2;
+      if (half < 1)
+        continue;
+      int r0 = std::max(row - half, 0), r1 = std::min(row + half + 1, rows);
+      int c0 = std::max(col - half, 0), c1 = std::min(col + half + 1, cols);
+      double n = box_sum(count_sum, stride, c0, r0, c1, r1); // includes this pixel
+      out(col, row).child()[0] = box_sum(dx_sum, stride, c0, r0, c1, r1)/n;
+      out(col, row).child()[1] = box_sum(dy_sum, stride, c0, r0, c1, r1)/n;
+    }
+  }
+}
+
+/// Apply a set of smoothing filters to the subpixel disparity results.
+template <class ImageT, class DispImageT>
+class TextureAwareDisparityFilter: public ImageViewBase<TextureAwareDisparityFilter<ImageT, DispImageT> >{
+  ImageT     m_img;
+  DispImageT m_disp_img;
+  
+  int   m_median_filter_size;     ///< Step 1: Apply a median filter of this size
+  int   m_texture_smooth_range;   ///< Step 2: Compute texture measure of input image with this kernel size
+  float m_texture_max;            ///< Step 3: Perform texture-aware smoothing of the disparity.  m_texture_max
+  int   m_max_smooth_kernel_size; ///<         smooths more pixels, and the smooth_kernel_size increases the smoothing intensity.
+  
+public:
+  TextureAwareDisparityFilter( ImageViewBase<ImageT    > const& img,
+                               ImageViewBase<DispImageT> const& disp_img,
+                               int   median_filter_size,
+                               int   texture_smooth_range,
+                               float texture_max,
+                               int   max_smooth_kernel_size):
+    m_img(img.impl()), m_disp_img(disp_img.impl()),
+    m_median_filter_size(median_filter_size),
+    m_texture_smooth_range(texture_smooth_range),
+    m_texture_max(texture_max),
+    m_max_smooth_kernel_size(max_smooth_kernel_size)
+     {}
+
+  // Image View interface
+  typedef typename DispImageT::pixel_type pixel_type;
+  typedef pixel_type                      result_type;
+  typedef ProceduralPixelAccessor<TextureAwareDisparityFilter> pixel_accessor;
+
+  inline int32 cols  () const { return m_disp_img.cols(); }
+  inline int32 rows  () const { return m_disp_img.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "TextureAwareDisparityFilter::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    // Figure out the largest kernel expansion we need to support the filtering
+    int max_half_kernel = m_texture_smooth_range;
+    if (m_max_smooth_kernel_size > max_half_kernel)
+      max_half_kernel = m_max_smooth_kernel_size;
+    max_half_kernel += m_median_filter_size; // Don't forget we apply two kernels in succession
+    max_half_kernel /= 2;
+
+    // Rasterize both input image regions
+    BBox2i bbox2 = bbox;
+    bbox2.expand(max_half_kernel);
+    bbox2.crop(bounding_box(m_img)); // Restrict to valid input area
+    // The image tile and its texture are only read here, so their
+    // buffers are reused from tile to tile.
+    asp::ScratchImage<typename ImageT::pixel_type> input_tile(bbox2.width(), bbox2.height());
+    vw::rasterize(crop(m_img, bbox2), *input_tile);
+    ImageView<pixel_type> input_disp_tile = crop(m_disp_img, bbox2);
+
+    asp::ScratchImage<float> texture_image(bbox2.width(), bbox2.height());
+    box_texture_measure(select_channel(*input_tile, 0), m_texture_smooth_range, *texture_image);
+
+
+    ImageView<pixel_type > disp_tile_median;
+    vw::stereo::disparity_median_filter(input_disp_tile, disp_tile_median, m_median_filter_size);
+    
+    ImageView<pixel_type > disp_tile_filtered;
+    box_texture_preserving_filter(disp_tile_median, *texture_image,
+                                  m_texture_max, m_max_smooth_kernel_size, disp_tile_filtered);
+
+    // Fake the bounds on the returned image region
+    return prerasterize_type(disp_tile_filtered,
+                             -bbox2.min().x(), -bbox2.min().y(),
+                             cols(), rows() );
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+template <class ImageT, class DispImageT>
+TextureAwareDisparityFilter<ImageT, DispImageT>
+texture_aware_disparity_filter( ImageViewBase<ImageT    > const& img,
+                                ImageViewBase<DispImageT> const& disp_img,
+                                int   median_filter_size,
+                                int   texture_smooth_range,
+                                float texture_max,
+                                int   max_smooth_kernel_size) {
+  typedef TextureAwareDisparityFilter<ImageT, DispImageT> return_type;
+  return return_type(img.impl(), disp_img.impl(), median_filter_size, 
+                     texture_smooth_range, texture_max, max_smooth_kernel_size);
+}
+
+
+// Erode blobs from given image by iterating through tiles, biasing
+// each tile by a factor of blob size, removing blobs in the tile,
+// then shrinking the tile back. The bias is necessary to help avoid
+// fragmenting (and then unnecessarily removing) blobs.
+template <class ImageT>
+class PerTileErode: public ImageViewBase<PerTileErode<ImageT> >{
+  ImageT m_img;
+public:
+  PerTileErode( ImageViewBase<ImageT>   const& img):
+    m_img(img.impl()){}
+
+  // Image View interface
+  typedef typename ImageT::pixel_type pixel_type;
+  typedef pixel_type                  result_type;
+  typedef ProceduralPixelAccessor<PerTileErode> pixel_accessor;
+
+  inline int32 cols  () const { return m_img.cols(); }
+  inline int32 rows  () const { return m_img.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "PerTileErode::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    int area = stereo_settings().erode_max_size;
+
+    // We look a beyond the current tile, to avoid cutting blobs
+    // if possible. Skinny blobs will be cut though.
+    int bias = 2*int(ceil(sqrt(double(area))));
+
+    BBox2i bbox2 = bbox;
+    bbox2.expand(bias);
+    bbox2.crop(bounding_box(m_img));
+    asp::ScratchImage<pixel_type> tile_img(bbox2.width(), bbox2.height());
+    vw::rasterize(crop(m_img, bbox2), *tile_img);
+
+    int tile_size = max(bbox2.width(), bbox2.height()); // don't subsplit
+    BlobIndexThreaded smallBlobIndex(*tile_img, area, tile_size);
+    ImageView<pixel_type> clean_tile_img = applyErodeView(*tile_img,
+                                                          smallBlobIndex);
+    return prerasterize_type(clean_tile_img,
+                             -bbox2.min().x(), -bbox2.min().y(),
+                             cols(), rows() );
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+// Run several cleanup passes with desired cleanup mode.
+template <class ViewT>
+struct MultipleDisparityCleanUp {
+  typedef ImageViewRef< typename ViewT::pixel_type > result_type;
+
+  inline result_type operator()( ImageViewBase<ViewT> const& input, int N) {
+
+    result_type out = input;
+    for (int i = 0; i < N; i++){
+      int mode = stereo_settings().filter_mode;
+      if (mode == 1){
+        out = stereo::disparity_cleanup_using_mean
+          (out.impl(),
+           stereo_settings().rm_half_kernel.x(),
+           stereo_settings().rm_half_kernel.y(),
+           stereo_settings().max_mean_diff);
+      }else if (mode == 2){
+        out = stereo::disparity_cleanup_using_thresh
+          (out.impl(),
+           stereo_settings().rm_half_kernel.x(),
+           stereo_settings().rm_half_kernel.y(),
+           stereo_settings().rm_threshold,
+           stereo_settings().rm_min_matches/100.0);
+      }else
+        vw_throw( ArgumentErr() << "\nExpecting value of 1 or 2 for filter-mode. "
+                  << "Got: " << mode << "\n" );
+    }
+
+    return out;
+  }
+};
+
+namespace asp {
+
+DispImageRef refined_disparity(ASPGlobalOptions const& opt, bool verbose) {
+
+  ImageViewRef<PixelGray<float>    > left_image, right_image;
+  ImageViewRef<uint8               > left_mask,  right_mask;
+  ImageViewRef<PixelMask<Vector2f> > integer_disp;
+  ImageViewRef<PixelMask<Vector2f> > sub_disp;
+  ImageView<Matrix3x3> local_hom;
+  string left_image_file  = opt.out_prefix+"-L.tif";
+  string right_image_file = opt.out_prefix+"-R.tif";
+  string left_mask_file   = opt.out_prefix+"-lMask.tif";
+  string right_mask_file  = opt.out_prefix+"-rMask.tif";
+
+  try {
+    left_image   = DiskImageView< PixelGray<float> >(left_image_file );
+    right_image  = DiskImageView< PixelGray<float> >(right_image_file);
+    left_mask    = DiskImageView<uint8>(left_mask_file );
+    right_mask   = DiskImageView<uint8>(right_mask_file);
+
+    // Read the correct type of correlation file (float for SGM/MGM, otherwise integer)
+    std::string disp_file = opt.out_prefix + "-D.tif";
+    boost::shared_ptr<DiskImageResource> rsrc(DiskImageResourcePtr(disp_file));
+    ChannelTypeEnum disp_data_type = rsrc->channel_type();
+    if (disp_data_type == VW_CHANNEL_INT32)
+      integer_disp = pixel_cast<PixelMask<Vector2f> >(
+                      DiskImageView< PixelMask<Vector2i> >(disp_file));
+    else // File on disk is float
+      integer_disp = DiskImageView< PixelMask<Vector2f> >(disp_file);
+    
+    if ( stereo_settings().seed_mode > 0 &&
+         stereo_settings().use_local_homography ){
+      sub_disp = DiskImageView<PixelMask<Vector2f> >(opt.out_prefix+"-D_sub.tif");
+
+      string local_hom_file = opt.out_prefix + "-local_hom.txt";
+      read_local_homographies(local_hom_file, local_hom);
+    }
+
+  } catch (IOErr const& e) {
+    vw_throw( ArgumentErr() << "\nUnable to start at refinement stage -- could not read input files.\n" 
+                            << e.what() << "\nExiting.\n\n" );
+  }
+
+  bool skip_img_norm = asp::skip_image_normalization(opt);
+  if (skip_img_norm && stereo_settings().subpixel_mode == 2){
+    // Images were not normalized in pre-processing. Must do so now
+    // as bayes_em_subpixel assumes them to be normalized.
+    ImageViewRef< PixelMask< PixelGray<float> > > Limg
+      = copy_mask(left_image, create_mask(left_mask));
+    ImageViewRef< PixelMask< PixelGray<float> > > Rimg
+      = copy_mask(right_image, create_mask(right_mask));
+
+    Vector<float32> left_stats, right_stats;
+    string left_stats_file  = opt.out_prefix+"-lStats.tif";
+    string right_stats_file = opt.out_prefix+"-rStats.tif";
+    vw_out() << "Reading: " << left_stats_file << ' ' << right_stats_file << endl;
+    read_vector(left_stats,  left_stats_file );
+    read_vector(right_stats, right_stats_file);
+    normalize_images(stereo_settings().force_use_entire_range,
+                     stereo_settings().individually_normalize,
+                     false, // Use std stretch
+                     left_stats, right_stats, Limg, Rimg);
+    left_image  = apply_mask(Limg);
+    right_image = apply_mask(Rimg);
+  }
+
+  // The whole goal of this block it to go through the motions of
+  // refining disparity solely for the purpose of printing
+  // the relevant messages.
+  if (verbose) {
+    ImageView<PixelGray<float>    > left_dummy(1, 1), right_dummy(1, 1);
+    ImageView<PixelMask<Vector2f> > dummy_disp(1, 1);
+    refine_disparity(left_dummy, right_dummy, dummy_disp, opt, verbose);
+  }
+
+  return per_tile_rfne(left_image, right_image, right_mask,
+                       integer_disp, sub_disp, local_hom, opt);
+}
+
+DispImageRef disparity_cleanup(DispImageRef const& disparity, int num_passes) {
+  return MultipleDisparityCleanUp<DispImageRef>()(disparity, num_passes);
+}
+
+DispImageRef per_tile_erode(DispImageRef const& disparity) {
+  return PerTileErode<DispImageRef>(disparity);
+}
+
+DispImageRef tile_local_filtered_disparity(DispImageRef const& disparity,
+                                           ASPGlobalOptions const& opt) {
+
+  // Applying additional clipping from the edge. We make new
+  // mask files to avoid a weird and tricky segfault due to ownership issues.
+  DiskImageView<vw::uint8> left_mask ( opt.out_prefix+"-lMask.tif" );
+  DiskImageView<vw::uint8> right_mask( opt.out_prefix+"-rMask.tif" );
+  int32 mask_buffer = stereo_settings().mask_buffer_size;
+  if (mask_buffer < 0) // If Unset, set to the subpixel kernel size.
+    mask_buffer = max( stereo_settings().subpixel_kernel );
+
+  // If the user wants to do no filtering at all, that amounts
+  // to doing no passes.
+  int num_passes = stereo_settings().rm_cleanup_passes;
+  if (stereo_settings().filter_mode == 0)
+    num_passes = 0;
+
+  DispImageRef filtered_disparity;
+  if (num_passes >= 1) {
+    // Apply an outlier removal filter
+    filtered_disparity = disparity_cleanup(disparity, num_passes);
+  } else {
+    DiskImageView<PixelGray<float> > left_disk_image(opt.out_prefix+"-L.tif");
+    filtered_disparity
+      = texture_aware_disparity_filter(left_disk_image, disparity,
+                                       stereo_settings().median_filter_size,
+                                       stereo_settings().disp_smooth_size+2, // Compute texture a little larger than smooth radius
+                                       stereo_settings().disp_smooth_texture,
+                                       stereo_settings().disp_smooth_size);
+  }
+
+  return stereo::disparity_mask
+    (filtered_disparity,
+     apply_mask(asp::threaded_edge_mask(left_mask, 0,mask_buffer,1024)),
+     apply_mask(asp::threaded_edge_mask(right_mask,0,mask_buffer,1024)));
+}
+
+void check_fused_filtering_options() {
+  if (stereo_settings().mask_flatfield)
+    vw_throw( ArgumentErr() << "Cannot use --mask-flatfield with --fuse-rfne-fltr-tri.\n" );
+  if (stereo_settings().enable_fill_holes)
+    vw_throw( ArgumentErr() << "Cannot use --enable-fill-holes with --fuse-rfne-fltr-tri, "
+              << "as hole-filling needs the entire disparity. Use the hole-filling "
+              << "in point2dem instead.\n" );
+}
+
+DispImageRef fused_filtered_disparity(ASPGlobalOptions const& opt) {
+
+  check_fused_filtering_options();
+
+  bool verbose = false;
+  DispImageRef disparity
+    = tile_local_filtered_disparity(refined_disparity(opt, verbose), opt);
+
+  // Small blob removal works per tile, so it can be done as well
+  if (stereo_settings().erode_max_size > 0)
+    disparity = per_tile_erode(disparity);
+
+  return disparity;
+}
+
+} // end namespace asp
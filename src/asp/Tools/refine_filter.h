@@ -0,0 +1,68 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file refine_filter.h
+///
+/// Subpixel refinement and filtering of the disparity. These are
+/// shared by stereo_rfne and stereo_fltr, which write their results
+/// to disk, and by stereo_tri, which can instead chain them in memory
+/// with triangulation, one tile at a time (--fuse-rfne-fltr-tri).
+
+#ifndef __ASP_TOOLS_REFINE_FILTER_H__
+#define __ASP_TOOLS_REFINE_FILTER_H__
+
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/Vector.h>
+
+namespace asp {
+
+  class ASPGlobalOptions;
+
+  typedef vw::ImageViewRef< vw::PixelMask<vw::Vector2f> > DispImageRef;
+
+  /// Load L.tif, R.tif, the masks, and D.tif, and return the lazily
+  /// refined disparity, without cropping to the transformed crop
+  /// window. The options must outlive the returned view.
+  DispImageRef refined_disparity(ASPGlobalOptions const& opt, bool verbose);
+
+  /// Run this many passes of outlier removal, using the method in
+  /// stereo_settings().filter_mode.
+  DispImageRef disparity_cleanup(DispImageRef const& disparity, int num_passes);
+
+  /// Erode small blobs one tile at a time.
+  DispImageRef per_tile_erode(DispImageRef const& disparity);
+
+  /// The part of filtering which needs only a neighborhood of each
+  /// tile: outlier removal (or texture-aware smoothing if no cleanup
+  /// passes are done) and masking at the image edges. It excludes
+  /// blob erosion, hole filling, and flat-field masking.
+  DispImageRef tile_local_filtered_disparity(DispImageRef const& disparity,
+                                             ASPGlobalOptions const& opt);
+
+  /// Check that the filtering options can be applied one tile at a
+  /// time. Throws otherwise.
+  void check_fused_filtering_options();
+
+  /// The refined and filtered disparity, as if read from F.tif, but
+  /// computed in memory from D.tif.
+  DispImageRef fused_filtered_disparity(ASPGlobalOptions const& opt);
+
+} // end namespace asp
+
+#endif//__ASP_TOOLS_REFINE_FILTER_H__
@@ -32,6 +32,9 @@
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+#include <boost/noncopyable.hpp>
 #include <xercesc/util/PlatformUtils.hpp>
 
 
@@ -179,6 +182,63 @@ void load_pairs_from_file(std::string const& path,
 }
 
 /// Generates the set of GDC/pixel pairs that will be fed into the solver.
+// Project into the camera the test points with a given x index, which
+// are evenly spaced through the x/y/z -1 <> 1 range.
+class PointPairSliceTask: public vw::Task, private boost::noncopyable {
+  int m_x, m_num_pts;
+  camera::CameraModel const* m_cam;
+  cartography::Datum m_datum;
+  Vector3 m_llh_scale, m_llh_offset;
+  Vector2 m_uv_scale,  m_uv_offset;
+  Vector<double> & m_normalized_geodetics;
+  Vector<double> & m_normalized_pixels;
+public:
+  PointPairSliceTask(int x, int num_pts, camera::CameraModel const* cam,
+                     cartography::Datum const& datum,
+                     Vector3 const& llh_scale, Vector3 const& llh_offset,
+                     Vector2 const& uv_scale,  Vector2 const& uv_offset,
+                     Vector<double> & normalized_geodetics,
+                     Vector<double> & normalized_pixels):
+    m_x(x), m_num_pts(num_pts), m_cam(cam), m_datum(datum),
+    m_llh_scale(llh_scale), m_llh_offset(llh_offset),
+    m_uv_scale(uv_scale), m_uv_offset(uv_offset),
+    m_normalized_geodetics(normalized_geodetics),
+    m_normalized_pixels(normalized_pixels) {}
+
+  void operator()() {
+    int count = m_x*m_num_pts*m_num_pts;
+    for (int y = 0; y < m_num_pts; y++){
+      for (int z = 0; z < m_num_pts; z++){
+
+        // Test points are evenly spaced through the x/y/z -1 <> 1 range
+        Vector3 U( m_x/(m_num_pts - 1.0),
+                   y/(m_num_pts - 1.0),
+                   z/(m_num_pts - 1.0) );
+        U = 2.0*U - Vector3(1, 1, 1); // in the box [-1, 1]^3.
+
+        // Linear conversion from x/y/z to lat/lon/height
+        Vector3 G   = elem_prod(U, m_llh_scale) + m_llh_offset; // geodetic
+
+        // Convert from geodetic to geocentric coordinates
+        Vector3 P   = m_datum.geodetic_to_cartesian(G); // xyz
+
+        // Project the GCC coordinate into the DG camera model
+        Vector2 pxg = m_cam->point_to_pixel(P);
+
+        // Normalize the pixel to -1 <> 1 range
+        Vector2 pxn = elem_quot(pxg - m_uv_offset, m_uv_scale);
+
+        subvector(m_normalized_geodetics, RPCModel::GEODETIC_COORD_SIZE*count,
+                  RPCModel::GEODETIC_COORD_SIZE) = U;
+        subvector(m_normalized_pixels,    RPCModel::IMAGE_COORD_SIZE   *count,
+                  RPCModel::IMAGE_COORD_SIZE   ) = pxn;
+        count++;
+
+      } // End z loop
+    } // End y loop
+  }
+};
+
 void generate_point_pairs(RPC_gen_Options opt,
                           Vector<double> &normalized_geodetics,
                           Vector<double> &normalized_pixels,
@@ -244,46 +304,18 @@ void generate_point_pairs(RPC_gen_Options opt,
       normalized_pixels[i] = 0.0; 
     }
     
-    // Loop through all test points and generate the "correct" pairs / training data
-    //  using the trusted DG camera model.
-    int count = 0;
-    for (int x = 0; x < num_pts; x++){
-      for (int y = 0; y < num_pts; y++){
-        for (int z = 0; z < num_pts; z++){
-
-          // Test points are evenly spaced through the x/y/z -1 <> 1 range
-          Vector3 U( x/(num_pts - 1.0),
-                     y/(num_pts - 1.0),
-                     z/(num_pts - 1.0) );
-                  U = 2.0*U - Vector3(1, 1, 1); // in the box [-1, 1]^3.
-
-          // Linear conversion from x/y/z to lat/lon/height
-          Vector3 G   = elem_prod(U, llh_scale) + llh_offset; // geodetic
-
-          // Convert from geodetic to geocentric coordinates
-          Vector3 P   = cam_rpc->datum().geodetic_to_cartesian(G); // xyz
-
-          // Project the GCC coordinate into the DG camera model
-          Vector2 pxg = cam_dg->point_to_pixel(P);
-          //Vector2 pxg = cam_rpc->point_to_pixel(P); // DEBUG -> Try fitting to RPC!
-
-          // Normalize the pixel to -1 <> 1 range
-          Vector2 pxn = elem_quot(pxg - uv_offset, uv_scale);
-
-          // It is a useful exercise to compare DG and RPC cameras
-          //Vector2 pxr = cam_rpc->point_to_pixel(P);
-          //std::cout << U << ' ' << P << ' ' << pxg << ' ' << pxr  << ' '
-          //          << norm_2(pxg-pxr)<< std::endl;
-
-          subvector(normalized_geodetics, RPCModel::GEODETIC_COORD_SIZE*count,
-                    RPCModel::GEODETIC_COORD_SIZE) = U;
-          subvector(normalized_pixels,    RPCModel::IMAGE_COORD_SIZE   *count,
-                    RPCModel::IMAGE_COORD_SIZE   ) = pxn;
-          count++;
-
-        } // End z loop
-      } // End y loop
-    } // End x loop
+    // Generate the "correct" pairs / training data using the trusted
+    // DG camera model, one x slice of the test points per task. The
+    // slices write to disjoint parts of the arrays.
+    vw::FifoWorkQueue queue(vw_settings().default_num_threads());
+    for (int x = 0; x < num_pts; x++) {
+      boost::shared_ptr<PointPairSliceTask>
+        task(new PointPairSliceTask(x, num_pts, cam_dg.get(), cam_rpc->datum(),
+                                    llh_scale, llh_offset, uv_scale, uv_offset,
+                                    normalized_geodetics, normalized_pixels));
+      queue.add_task(task);
+    }
+    queue.join_all();
 
 }
 
@@ -35,11 +35,13 @@
 #include <vw/Image/AntiAliasing.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/IsisIO/IsisCameraModel.h>
 #include <asp/Core/BundleAdjustUtils.h>
+#include <asp/Core/Checkpoint.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Camera/RPCModelGen.h>
 #include <ceres/ceres.h>
@@ -344,6 +346,151 @@ namespace vw { namespace camera {
       return true;
     }
     
+    // The tables or the RPC model are cached to disk if the cache
+    // directory is set, with the key found from the camera, its
+    // adjustments, and the DEM, see approx_camera_cache_file().
+    static std::string cache_magic() { return "ASP_APPROX_CAMERA_1"; }
+
+    template <class T>
+    static void write_raw(std::ofstream & ofs, T const& val) {
+      ofs.write(reinterpret_cast<const char*>(&val), sizeof(T));
+    }
+    template <class T>
+    static void read_raw(std::ifstream & ifs, T & val) {
+      ifs.read(reinterpret_cast<char*>(&val), sizeof(T));
+    }
+
+    void write_cache(std::string const& cache_file) const {
+
+      // Write to a temporary file first, so that another process never
+      // sees a partially written file
+      fs::path tmp = fs::path(cache_file).parent_path()
+        / fs::unique_path(fs::path(cache_file).filename().string() + "-%%%%%%%%");
+      std::ofstream ofs(tmp.string().c_str(), std::ios::binary);
+      if (!ofs.good()) {
+        vw_out(WarningMessage) << "Could not write: " << tmp.string() << std::endl;
+        return;
+      }
+
+      std::string magic = cache_magic();
+      ofs.write(magic.c_str(), magic.size());
+      write_raw(ofs, m_use_rpc_approximation);
+      write_raw(ofs, m_model_is_valid);
+      write_raw(ofs, m_crop_box);
+
+      if (m_use_rpc_approximation) {
+        bool has_rpc = (m_rpc_model.get() != NULL);
+        write_raw(ofs, has_rpc);
+        if (has_rpc) {
+          write_raw(ofs, m_rpc_model->line_num_coeff());
+          write_raw(ofs, m_rpc_model->line_den_coeff());
+          write_raw(ofs, m_rpc_model->sample_num_coeff());
+          write_raw(ofs, m_rpc_model->sample_den_coeff());
+          write_raw(ofs, m_rpc_model->xy_offset());
+          write_raw(ofs, m_rpc_model->xy_scale());
+          write_raw(ofs, m_rpc_model->lonlatheight_offset());
+          write_raw(ofs, m_rpc_model->lonlatheight_scale());
+        }
+      } else {
+        write_raw(ofs, m_approx_table_gridx);
+        write_raw(ofs, m_approx_table_gridy);
+        write_raw(ofs, m_begX); write_raw(ofs, m_endX);
+        write_raw(ofs, m_begY); write_raw(ofs, m_endY);
+        write_raw(ofs, m_mean_dir);
+        int numx = m_point_to_pix_mat.cols(), numy = m_point_to_pix_mat.rows();
+        write_raw(ofs, numx);
+        write_raw(ofs, numy);
+        for (int x = 0; x < numx; x++) {
+          for (int y = 0; y < numy; y++) {
+            write_raw(ofs, m_pixel_to_vec_mat(x, y));
+            write_raw(ofs, m_point_to_pix_mat(x, y));
+          }
+        }
+      }
+
+      ofs.close();
+      if (!ofs.good()) {
+        vw_out(WarningMessage) << "Could not write: " << tmp.string() << std::endl;
+        fs::remove(tmp);
+        return;
+      }
+      fs::rename(tmp, cache_file);
+      vw_out() << "Wrote: " << cache_file << std::endl;
+    }
+
+    bool read_cache(std::string const& cache_file) {
+
+      std::ifstream ifs(cache_file.c_str(), std::ios::binary);
+      if (!ifs.good())
+        return false;
+
+      std::string magic = cache_magic();
+      std::vector<char> buf(magic.size());
+      ifs.read(&buf[0], buf.size());
+      bool use_rpc = false;
+      read_raw(ifs, use_rpc);
+      if (!ifs.good() || std::string(buf.begin(), buf.end()) != magic ||
+          use_rpc != m_use_rpc_approximation)
+        return false;
+
+      bool model_is_valid = false;
+      BBox2 crop_box;
+      read_raw(ifs, model_is_valid);
+      read_raw(ifs, crop_box);
+
+      if (use_rpc) {
+        bool has_rpc = false;
+        read_raw(ifs, has_rpc);
+        boost::shared_ptr<asp::RPCModel> rpc_model;
+        if (has_rpc) {
+          asp::RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
+          Vector2 xy_offset, xy_scale;
+          Vector3 llh_offset, llh_scale;
+          read_raw(ifs, line_num); read_raw(ifs, line_den);
+          read_raw(ifs, samp_num); read_raw(ifs, samp_den);
+          read_raw(ifs, xy_offset); read_raw(ifs, xy_scale);
+          read_raw(ifs, llh_offset); read_raw(ifs, llh_scale);
+          rpc_model = boost::shared_ptr<asp::RPCModel>
+            (new asp::RPCModel(m_geo.datum(), line_num, line_den, samp_num, samp_den,
+                               xy_offset, xy_scale, llh_offset, llh_scale));
+        }
+        if (!ifs.good())
+          return false;
+        m_rpc_model = rpc_model;
+      } else {
+        double gridx = 0, gridy = 0;
+        int begX = 0, endX = 0, begY = 0, endY = 0, numx = 0, numy = 0;
+        Vector3 mean_dir;
+        read_raw(ifs, gridx); read_raw(ifs, gridy);
+        read_raw(ifs, begX); read_raw(ifs, endX);
+        read_raw(ifs, begY); read_raw(ifs, endY);
+        read_raw(ifs, mean_dir);
+        read_raw(ifs, numx); read_raw(ifs, numy);
+        if (!ifs.good() || numx < 0 || numy < 0)
+          return false;
+        ImageView< PixelMask<Vector3> > pixel_to_vec_mat(numx, numy);
+        ImageView< PixelMask<Vector2> > point_to_pix_mat(numx, numy);
+        for (int x = 0; x < numx; x++) {
+          for (int y = 0; y < numy; y++) {
+            read_raw(ifs, pixel_to_vec_mat(x, y));
+            read_raw(ifs, point_to_pix_mat(x, y));
+          }
+        }
+        if (!ifs.good())
+          return false;
+        m_approx_table_gridx = gridx; m_approx_table_gridy = gridy;
+        m_begX = begX; m_endX = endX; m_begY = begY; m_endY = endY;
+        m_mean_dir = mean_dir;
+        m_pixel_to_vec_mat = pixel_to_vec_mat;
+        m_point_to_pix_mat = point_to_pix_mat;
+        m_compute_mean = false;
+      }
+
+      m_model_is_valid = model_is_valid;
+      m_crop_box = crop_box;
+      return true;
+    }
+
     void comp_entries_in_table() const{
       for (int x = m_begX; x <= m_endX; x++) {
 	for (int y = m_begY; y <= m_endY; y++) {
@@ -413,7 +560,8 @@ namespace vw { namespace camera {
 		      double nodata_val,
 		      bool use_rpc_approximation, bool use_semi_approx,
                       double rpc_penalty_weight,
-		      vw::Mutex &camera_mutex):
+		      vw::Mutex &camera_mutex,
+		      std::string const& cache_file = ""):
       m_exact_camera(exact_camera), m_img_bbox(img_bbox), m_geo(geo),
       m_use_rpc_approximation(use_rpc_approximation),
       m_use_semi_approx(use_semi_approx),
@@ -466,6 +614,11 @@ namespace vw { namespace camera {
 
       if (m_use_semi_approx)
         return;
+
+      if (cache_file != "" && read_cache(cache_file)) {
+        vw_out() << "Read: " << cache_file << std::endl;
+        return;
+      }
       
       // Bypass everything if doing RPC
       if (m_use_rpc_approximation) {
@@ -489,6 +642,8 @@ namespace vw { namespace camera {
         m_crop_box.crop(m_img_bbox);
 #endif
 
+        if (cache_file != "")
+          write_cache(cache_file);
         return;
       }
       
@@ -571,6 +726,8 @@ namespace vw { namespace camera {
 	}
       }
 #endif
+      if (cache_file != "")
+        write_cache(cache_file);
       return;
     }
 
@@ -876,7 +1033,7 @@ void compute_image_stats(ImageT const& I, double & mean, double & stdev){
 // Find the points on a given DEM that are shadowed by other points of
 // the DEM.  Start marching from the point on the DEM on a ray towards
 // the sun in small increments, until hitting the maximum DEM height.
-bool isInShadow(int col, int row, Vector3 & sunPos,
+bool isInShadow(int col, int row, Vector3 const& sunPos,
 		ImageView<double> const& dem, double max_dem_height,
 		double gridx, double gridy,
 		cartography::GeoReference const& geo){
@@ -938,7 +1095,7 @@ bool isInShadow(int col, int row, Vector3 & sunPos,
   return false;
 }
 
-void areInShadow(Vector3 & sunPos, ImageView<double> const& dem,
+void areInShadow(Vector3 const& sunPos, ImageView<double> const& dem,
 		 double gridx, double gridy,
 		 cartography::GeoReference const& geo,
 		 ImageView<float> & shadow){
@@ -966,26 +1123,28 @@ struct Options : public vw::cartography::GdalWriteOptions {
   std::string input_dems_str, out_prefix, stereo_session_string, bundle_adjust_prefix;
   std::vector<std::string> input_dems, input_images, input_cameras;
   std::string shadow_thresholds, max_valid_image_vals, skip_images_str, image_exposure_prefix,
-    model_coeffs_prefix, model_coeffs;
+    model_coeffs_prefix, model_coeffs, approx_camera_cache_dir, query_tile_list;
   std::vector<float> shadow_threshold_vec, max_valid_image_vals_vec;
   std::vector<double> image_exposures_vec;
   std::vector<double> model_coeffs_vec;
   std::vector< std::set<int> > skip_images;
 
   int max_iterations, max_coarse_iterations, reflectance_type, coarse_levels, blending_dist,
-    blending_power;
-  bool float_albedo, float_exposure, float_cameras, float_all_cameras, model_shadows,
+    blending_power, multigrid_cycles, multigrid_smoothing_iterations, checkpoint_interval;
+  bool resume, float_albedo, float_exposure, float_cameras, float_all_cameras, model_shadows,
     save_computed_intensity_only,
     save_dem_with_nodata, use_approx_camera_models, use_rpc_approximation, use_semi_approx, crop_input_images,
     use_blending_weights,
-    float_dem_at_boundary, fix_dem, float_reflectance_model, query, save_sparingly;
+    float_dem_at_boundary, fix_dem, float_reflectance_model, query, save_sparingly,
+    float32_weights, stream_cropped_images;
   double smoothness_weight, init_dem_height, nodata_val, initial_dem_constraint_weight,
     albedo_constraint_weight, camera_position_step_size, rpc_penalty_weight, unreliable_intensity_threshold;
   vw::BBox2 crop_win;
 
   Options():max_iterations(0), max_coarse_iterations(0), reflectance_type(0),
 	    coarse_levels(0), blending_dist(10), blending_power(2),
-            float_albedo(false), float_exposure(false), float_cameras(false),
+            multigrid_cycles(0), multigrid_smoothing_iterations(0),
+            checkpoint_interval(0), resume(false), float_albedo(false), float_exposure(false), float_cameras(false),
             float_all_cameras(false),
 	    model_shadows(false),
 	    save_computed_intensity_only(false),
@@ -996,6 +1155,7 @@ struct Options : public vw::cartography::GdalWriteOptions {
 	    crop_input_images(false), use_blending_weights(false),
             float_dem_at_boundary(false), fix_dem(false),
             float_reflectance_model(false), query(false), save_sparingly(false),
+            float32_weights(false), stream_cropped_images(false),
 	    smoothness_weight(0), initial_dem_constraint_weight(0.0),
 	    albedo_constraint_weight(0.0),
 	    camera_position_step_size(1.0), rpc_penalty_weight(0.0),
@@ -1003,6 +1163,51 @@ struct Options : public vw::cartography::GdalWriteOptions {
 	    crop_win(BBox2i(0, 0, 0, 0)){}
 };
 
+// Continue a 64-bit FNV-1a hash with the given bytes
+vw::uint64 approx_camera_hash(vw::uint64 hash, const void* data, size_t num_bytes) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < num_bytes; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// The file in --approx-camera-cache-dir having the approximate model
+// of the given camera around the given DEM, or an empty string if
+// there is no cache. The key has everything the approximation depends
+// on. A camera file is identified by its path, size, and modification
+// time, as ISIS cubes can be large.
+std::string approx_camera_cache_file(Options const& opt, int image_iter,
+                                     AdjustedCameraModel const& adj_cam,
+                                     BBox2i const& img_bbox,
+                                     ImageView<double> const& dem,
+                                     GeoReference const& geo){
+  if (opt.approx_camera_cache_dir == "")
+    return "";
+
+  std::ostringstream settings;
+  settings.precision(17);
+  std::string camera_file = opt.input_cameras[image_iter];
+  settings << fs::absolute(camera_file).string() << ' '
+           << fs::file_size(camera_file) << ' ' << fs::last_write_time(camera_file) << ' '
+           << adj_cam.translation() << ' ' << adj_cam.rotation() << ' '
+           << adj_cam.pixel_offset() << ' ' << adj_cam.scale() << ' '
+           << img_bbox << ' ' << geo.transform() << ' ' << geo.datum().semi_major_axis() << ' '
+           << geo.datum().semi_minor_axis() << ' ' << geo.overall_proj4_str() << ' '
+           << opt.use_rpc_approximation << ' ' << opt.rpc_penalty_weight << ' '
+           << dem.cols() << ' ' << dem.rows();
+
+  std::string str = settings.str();
+  vw::uint64 hash = approx_camera_hash(14695981039346656037ULL, str.c_str(), str.size());
+  if (dem.cols() > 0 && dem.rows() > 0) 
+    hash = approx_camera_hash(hash, &dem(0, 0), sizeof(double)*dem.cols()*dem.rows());
+
+  std::ostringstream key;
+  key << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return opt.approx_camera_cache_dir + "/" + key.str() + ".approx";
+}
+
 struct GlobalParams{
   int reflectanceType;
   // Two parameters used in the formula for the Lunar-Lambertian
@@ -1423,81 +1628,41 @@ double ComputeReflectance(Vector3 const& cameraPosition,
   return input_img_reflectance;
 }
 
-bool computeReflectanceAndIntensity(double left_h, double center_h, double right_h,
-				    double bottom_h, double top_h,
-				    int col, int row,
-				    ImageView<double> const& dem,
-				    cartography::GeoReference const& geo,
-				    bool model_shadows,
-				    double max_dem_height,
-				    double gridx, double gridy,
-				    ModelParams const& model_params,
-				    GlobalParams const& global_params,
-				    BBox2i const& crop_box,
-				    MaskedImgT const & image,
-				    DoubleImgT const & blend_weight,
-				    CameraModel const* camera,
-				    PixelMask<double> & reflectance,
-				    PixelMask<double> & intensity,
-				    double            & weight,
-                                    const double * coeffs) {
-
-  // Set output values
-  reflectance = 0.0; reflectance.invalidate();
-  intensity   = 0.0; intensity.invalidate();
-  weight      = 0.0;
-  
-  if (col >= dem.cols() - 1 || row >= dem.rows() - 1) return false;
-  if (crop_box.empty()) return false;
-    
-  // TODO: Investigate various ways of finding the normal.
-
-  // The xyz position at the center grid point
-  Vector2 lonlat = geo.pixel_to_lonlat(Vector2(col, row));
-  double h = center_h;
-  Vector3 lonlat3 = Vector3(lonlat(0), lonlat(1), h);
-  Vector3 base = geo.datum().geodetic_to_cartesian(lonlat3);
-
-  // The xyz position at the left grid point
-  lonlat = geo.pixel_to_lonlat(Vector2(col-1, row));
-  h = left_h;
-  lonlat3 = Vector3(lonlat(0), lonlat(1), h);
-  Vector3 left = geo.datum().geodetic_to_cartesian(lonlat3);
-
-  // The xyz position at the right grid point
-  lonlat = geo.pixel_to_lonlat(Vector2(col+1, row));
-  h = right_h;
-  lonlat3 = Vector3(lonlat(0), lonlat(1), h);
-  Vector3 right = geo.datum().geodetic_to_cartesian(lonlat3);
-
-  // The xyz position at the bottom grid point
-  lonlat = geo.pixel_to_lonlat(Vector2(col, row+1));
-  h = bottom_h;
-  lonlat3 = Vector3(lonlat(0), lonlat(1), h);
-  Vector3 bottom = geo.datum().geodetic_to_cartesian(lonlat3);
-
-  // The xyz position at the top grid point
-  lonlat = geo.pixel_to_lonlat(Vector2(col, row-1));
-  h = top_h;
-  lonlat3 = Vector3(lonlat(0), lonlat(1), h);
-  Vector3 top = geo.datum().geodetic_to_cartesian(lonlat3);
+// The xyz position of a DEM grid point with given lon, lat, and height
+inline Vector3 demPointToXyz(cartography::GeoReference const& geo,
+                             Vector2 const& lonlat, double h) {
+  return geo.datum().geodetic_to_cartesian(Vector3(lonlat(0), lonlat(1), h));
+}
 
-#if 0
-  // two-point normal
-  Vector3 dx = right - base;
-  Vector3 dy = bottom - base;
-#else
-  // four-point normal (centered)
+// The normal at a grid point given the xyz positions of its left, right,
+// bottom, and top neighbors (four-point centered normal).
+inline Vector3 stencilNormal(Vector3 const& left, Vector3 const& right,
+                             Vector3 const& bottom, Vector3 const& top) {
   Vector3 dx = right - left;
   Vector3 dy = bottom - top;
-#endif
-  Vector3 normal = -normalize(cross_prod(dx, dy)); // so normal points up
+  return -normalize(cross_prod(dx, dy)); // so normal points up
+}
+
+// Project a DEM point into a camera, and find the image intensity and
+// blending weight there. The camera position is needed only for
+// reflectance models other than Lambertian. Return false if the
+// point does not project into the valid part of the image.
+bool projectAndSampleImage(Vector3 const& base,
+                           GlobalParams const& global_params,
+                           BBox2i const& crop_box,
+                           MaskedImgT const & image,
+                           DoubleImgT const & blend_weight,
+                           CameraModel const* camera,
+                           Vector3           & cameraPosition,
+                           PixelMask<double> & intensity,
+                           double            & weight) {
+
+  intensity = 0.0; intensity.invalidate();
+  weight    = 0.0;
 
   // Update the camera position for the given pixel (camera position
   // is pixel-dependent for for linescan cameras.
-  ModelParams local_model_params = model_params;
   Vector2 pix;
-  Vector3 cameraPosition;
   try {
     pix = camera->point_to_pixel(base);
     
@@ -1507,19 +1672,8 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
     }
     
   } catch(...){
-    reflectance = 0.0; reflectance.invalidate();
-    intensity   = 0.0; intensity.invalidate();
-    weight      = 0.0;
     return false;
   }
-  
-  double phase_angle;
-  reflectance = ComputeReflectance(cameraPosition,
-				   normal, base, local_model_params,
-				   global_params, phase_angle,
-                                   coeffs);
-  reflectance.validate();
-
 
   // Since our image is cropped
   pix -= crop_box.min();
@@ -1527,9 +1681,6 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
   // Check for out of range
   if (pix[0] < 0 || pix[0] >= image.cols()-1 ||
       pix[1] < 0 || pix[1] >= image.rows()-1) {
-    reflectance = 0.0; reflectance.invalidate();
-    intensity   = 0.0; intensity.invalidate();
-    weight      = 0.0;
     return false;
   }
 
@@ -1547,17 +1698,66 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
     weight = 1.0;
 
   if (!is_valid(intensity)) {
-    reflectance = 0.0; reflectance.invalidate();
-    intensity   = 0.0; intensity.invalidate();
-    weight      = 0.0;
+    intensity = 0.0; intensity.invalidate();
+    weight    = 0.0;
     return false;
   }
 
+  return true;
+}
+
+bool computeReflectanceAndIntensity(double left_h, double center_h, double right_h,
+				    double bottom_h, double top_h,
+				    int col, int row,
+				    ImageView<double> const& dem,
+				    cartography::GeoReference const& geo,
+				    bool model_shadows,
+				    ImageView<float> const& shadow,
+				    double gridx, double gridy,
+				    ModelParams const& model_params,
+				    GlobalParams const& global_params,
+				    BBox2i const& crop_box,
+				    MaskedImgT const & image,
+				    DoubleImgT const & blend_weight,
+				    CameraModel const* camera,
+				    PixelMask<double> & reflectance,
+				    PixelMask<double> & intensity,
+				    double            & weight,
+                                    const double * coeffs) {
+
+  // Set output values
+  reflectance = 0.0; reflectance.invalidate();
+  intensity   = 0.0; intensity.invalidate();
+  weight      = 0.0;
+  
+  if (col >= dem.cols() - 1 || row >= dem.rows() - 1) return false;
+  if (crop_box.empty()) return false;
+    
+  // TODO: Investigate various ways of finding the normal.
+
+  // The xyz positions at the center grid point and its neighbors
+  Vector3 base   = demPointToXyz(geo, geo.pixel_to_lonlat(Vector2(col,   row  )), center_h);
+  Vector3 left   = demPointToXyz(geo, geo.pixel_to_lonlat(Vector2(col-1, row  )), left_h);
+  Vector3 right  = demPointToXyz(geo, geo.pixel_to_lonlat(Vector2(col+1, row  )), right_h);
+  Vector3 bottom = demPointToXyz(geo, geo.pixel_to_lonlat(Vector2(col,   row+1)), bottom_h);
+  Vector3 top    = demPointToXyz(geo, geo.pixel_to_lonlat(Vector2(col,   row-1)), top_h);
+  Vector3 normal = stencilNormal(left, right, bottom, top);
+
+  Vector3 cameraPosition;
+  if (!projectAndSampleImage(base, global_params, crop_box, image, blend_weight, camera,
+                             cameraPosition, intensity, weight))
+    return false;
+
+  double phase_angle;
+  reflectance = ComputeReflectance(cameraPosition,
+				   normal, base, model_params,
+				   global_params, phase_angle,
+                                   coeffs);
+  reflectance.validate();
 
   if (model_shadows) {
-    bool inShadow = isInShadow(col, row, local_model_params.sunPosition,
-			       dem, max_dem_height, gridx, gridy,
-			       geo);
+    // The shadows are found beforehand for the whole DEM, see computeShadows()
+    bool inShadow = (shadow(col, row) > 0);
 
     if (inShadow) {
       // The reflectance is valid, it is just zero
@@ -1572,7 +1772,7 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
 void computeReflectanceAndIntensity(ImageView<double> const& dem,
 				    cartography::GeoReference const& geo,
 				    bool model_shadows,
-				    double & max_dem_height, // alias
+				    ImageView<float> const& shadow,
 				    double gridx, double gridy,
 				    ModelParams const& model_params,
 				    GlobalParams const& global_params,
@@ -1585,19 +1785,9 @@ void computeReflectanceAndIntensity(ImageView<double> const& dem,
 				    ImageView< double            > & weight,
                                     const double * coeffs) {
 
-  // Update max_dem_height
-  max_dem_height = -std::numeric_limits<double>::max();
-  if (model_shadows) {
-    for (int col = 0; col < dem.cols(); col++) {
-      for (int row = 0; row < dem.rows(); row++) {
-        if (dem(col, row) > max_dem_height) {
-          max_dem_height = dem(col, row);
-        }
-      }
-    }
-    vw_out() << "Maximum DEM height: " << max_dem_height << std::endl;
-  }
-  
+  if (model_shadows && (shadow.cols() != dem.cols() || shadow.rows() != dem.rows()))
+    vw_throw( ArgumentErr() << "The shadow map and the DEM have different sizes.\n" );
+
   // Init the reflectance and intensity as invalid
   reflectance.set_size(dem.cols(), dem.rows());
   intensity.set_size(dem.cols(), dem.rows());
@@ -1616,7 +1806,7 @@ void computeReflectanceAndIntensity(ImageView<double> const& dem,
 				     dem(col+1, row),
 				     dem(col, row+1), dem(col, row-1),
 				     col, row, dem,  geo,
-				     model_shadows, max_dem_height,
+				     model_shadows, shadow,
 				     gridx, gridy,
 				     model_params, global_params,
 				     crop_box, image, blend_weight, camera,
@@ -1651,6 +1841,88 @@ void interp_image(ImageView<double> const& coarse_image, double scale,
   }
 }
 
+// Restrict an image to a grid coarser by the given factor, the same
+// way the initial coarse levels are created.
+ImageView<double> restrict_image(ImageView<double> const& fine_image, double sub_scale){
+  return pixel_cast<double>(vw::resample_aa(pixel_cast< PixelMask<double> >(fine_image),
+                                            sub_scale));
+}
+
+// Add to a fine image the change of a coarse image from its value
+// when it was restricted from the fine one. Unless the boundary
+// floats, the fine image boundary is kept as it is.
+void add_coarse_correction(ImageView<double> const& coarse_image,
+                           ImageView<double> const& restricted_image,
+                           double scale, bool change_boundary,
+                           ImageView<double> & fine_image){
+
+  if (coarse_image.cols() != restricted_image.cols() ||
+      coarse_image.rows() != restricted_image.rows())
+    vw_throw( LogicErr() << "The coarse and restricted images have different sizes.\n" );
+
+  ImageView<double> correction = copy(coarse_image - restricted_image);
+  ImageView<double> fine_correction(fine_image.cols(), fine_image.rows());
+  interp_image(correction, scale, fine_correction);
+
+  for (int col = 0; col < fine_image.cols(); col++) {
+    for (int row = 0; row < fine_image.rows(); row++) {
+      if (!change_boundary &&
+          (col == 0 || col == fine_image.cols() - 1 ||
+           row == 0 || row == fine_image.rows() - 1)) continue;
+      fine_image(col, row) += fine_correction(col, row);
+    }
+  }
+}
+
+// Find the shadows on a DEM for one sun position, to be run in a thread
+class ShadowTask: public vw::Task, private boost::noncopyable {
+  Vector3 m_sun_pos;
+  ImageView<double>         const& m_dem;
+  cartography::GeoReference const& m_geo;
+  double m_gridx, m_gridy;
+  ImageView<float> & m_shadow;
+public:
+  ShadowTask(Vector3 const& sun_pos, ImageView<double> const& dem,
+             cartography::GeoReference const& geo, double gridx, double gridy,
+             ImageView<float> & shadow):
+    m_sun_pos(sun_pos), m_dem(dem), m_geo(geo), m_gridx(gridx), m_gridy(gridy),
+    m_shadow(shadow) {}
+  void operator()() {
+    areInShadow(m_sun_pos, m_dem, m_gridx, m_gridy, m_geo, m_shadow);
+  }
+};
+
+// Find which DEM pixels are in shadow in each image. The shadows
+// depend only on the DEM and the sun position, so they are found once
+// per DEM update rather than each time a residual is evaluated, with
+// one thread per DEM and image. Existing shadow images are reused, as
+// the cost functions keep references to them.
+void computeShadows(Options const& opt,
+                    std::vector< ImageView<double> > const& dems,
+                    std::vector<cartography::GeoReference> const& geo,
+                    std::vector<ModelParams> const& model_params,
+                    double gridx, double gridy,
+                    std::vector< std::vector< ImageView<float> > > & shadows){
+
+  int num_dems   = dems.size();
+  int num_images = model_params.size();
+  shadows.resize(num_dems);
+
+  FifoWorkQueue queue(opt.num_threads);
+  for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
+    shadows[dem_iter].resize(num_images);
+    for (int image_iter = 0; image_iter < num_images; image_iter++) {
+      if (opt.skip_images[dem_iter].find(image_iter) != opt.skip_images[dem_iter].end())
+        continue;
+      boost::shared_ptr<ShadowTask>
+        task(new ShadowTask(model_params[image_iter].sunPosition, dems[dem_iter],
+                            geo[dem_iter], gridx, gridy, shadows[dem_iter][image_iter]));
+      queue.add_task(task);
+    }
+  }
+  queue.join_all();
+}
+
 // A function to invoke at every iteration of ceres.
 // We need a lot of global variables to do something useful.
 int                                            g_iter = -1;
@@ -1668,13 +1940,77 @@ double                                       * g_dem_nodata_val;
 float                                        * g_img_nodata_val;
 std::vector<double>                          * g_exposures;
 std::vector<double>                          * g_adjustments;
-std::vector<double>                          * g_max_dem_height;
+std::vector< std::vector< ImageView<float> > > * g_shadows;
 double                                       * g_gridx;
 double                                       * g_gridy;
 int                                            g_level = -1;
 bool                                           g_final_iter = false;
 double                                       * g_coeffs; 
 
+// For checkpoints. The solution at all levels is saved, as the
+// multigrid cycles need the coarser ones too.
+int                                            g_visit = -1;
+int                                            g_prev_iters = 0;
+std::vector< std::vector< ImageView<double> > > * g_all_dems;
+std::vector< std::vector< ImageView<double> > > * g_all_albedos;
+std::vector< std::vector< ImageView<double> > > * g_restricted_dems;
+std::vector< std::vector< ImageView<double> > > * g_restricted_albedos;
+
+/// Save an image in a checkpoint, with its dimensions.
+void set_checkpoint_image(asp::SolverCheckpoint & checkpoint, std::string const& name,
+                          ImageView<double> const& image) {
+  checkpoint.set_counter(name + "-cols", image.cols());
+  checkpoint.set_counter(name + "-rows", image.rows());
+  checkpoint.set_block(name, image.data(), size_t(image.cols())*image.rows());
+}
+
+void get_checkpoint_image(asp::SolverCheckpoint const& checkpoint, std::string const& name,
+                          ImageView<double> & image) {
+  image.set_size(checkpoint.counter(name + "-cols"), checkpoint.counter(name + "-rows"));
+  if (image.cols() > 0 && image.rows() > 0)
+    checkpoint.get_block(name, image.data(), size_t(image.cols())*image.rows());
+}
+
+/// Visit all the images that are saved in checkpoints, with their names.
+template <class CheckpointT, class ImagesT, class FunctorT>
+void for_checkpoint_images(CheckpointT & checkpoint, ImagesT * all_images,
+                           std::string const& tag, FunctorT func) {
+  for (size_t level = 0; level < all_images->size(); level++) {
+    for (size_t dem_iter = 0; dem_iter < (*all_images)[level].size(); dem_iter++) {
+      std::ostringstream os;
+      os << tag << "-" << level << "-" << dem_iter;
+      func(checkpoint, os.str(), (*all_images)[level][dem_iter]);
+    }
+  }
+}
+
+void write_sfs_checkpoint() {
+  asp::SolverCheckpoint checkpoint;
+  checkpoint.set_counter("visit", g_visit);
+  checkpoint.set_counter("iteration", g_iter);
+  for_checkpoint_images(checkpoint, g_all_dems,           "dem",        set_checkpoint_image);
+  for_checkpoint_images(checkpoint, g_all_albedos,        "albedo",     set_checkpoint_image);
+  for_checkpoint_images(checkpoint, g_restricted_dems,    "rdem",       set_checkpoint_image);
+  for_checkpoint_images(checkpoint, g_restricted_albedos, "ralbedo",    set_checkpoint_image);
+  checkpoint.set_block("exposures", &(*g_exposures)[0], g_exposures->size());
+  checkpoint.set_block("adjustments", &(*g_adjustments)[0], g_adjustments->size());
+  checkpoint.set_block("coeffs", g_coeffs, g_num_model_coeffs);
+
+  std::string checkpoint_file = asp::checkpoint_file_name(g_opt->out_prefix);
+  vw_out() << "Writing: " << checkpoint_file << std::endl;
+  checkpoint.write(checkpoint_file);
+}
+
+void read_sfs_checkpoint(asp::SolverCheckpoint const& checkpoint) {
+  for_checkpoint_images(checkpoint, g_all_dems,           "dem",        get_checkpoint_image);
+  for_checkpoint_images(checkpoint, g_all_albedos,        "albedo",     get_checkpoint_image);
+  for_checkpoint_images(checkpoint, g_restricted_dems,    "rdem",       get_checkpoint_image);
+  for_checkpoint_images(checkpoint, g_restricted_albedos, "ralbedo",    get_checkpoint_image);
+  checkpoint.get_block("exposures", &(*g_exposures)[0], g_exposures->size());
+  checkpoint.get_block("adjustments", &(*g_adjustments)[0], g_adjustments->size());
+  checkpoint.get_block("coeffs", g_coeffs, g_num_model_coeffs);
+}
+
 // When floating the camera position and orientation, multiply the
 // position variables by this factor times
 // opt.camera_position_step_size to give it a greater range in
@@ -1692,6 +2028,16 @@ public:
     vw_out() << "Finished iteration: " << g_iter << std::endl;
     callTop();
 
+    if (!g_final_iter && g_opt->checkpoint_interval > 0 && g_iter > 0 &&
+        g_iter % g_opt->checkpoint_interval == 0)
+      write_sfs_checkpoint();
+
+    // The DEM changed, so the shadows for the next iteration must be
+    // found again. That was already done for the final results.
+    if (g_opt->model_shadows && !g_final_iter)
+      computeShadows(*g_opt, *g_dem, *g_geo, *g_model_params, *g_gridx, *g_gridy,
+                     *g_shadows);
+
     std::string exposure_file = exposure_file_name(g_opt->out_prefix);
     vw_out() << "Writing: " << exposure_file << std::endl;
     std::ofstream exf(exposure_file.c_str());
@@ -1837,7 +2183,7 @@ public:
         // Compute reflectance and intensity with optimized DEM
         computeReflectanceAndIntensity((*g_dem)[dem_iter], (*g_geo)[dem_iter],
                                        g_opt->model_shadows,
-                                       (*g_max_dem_height)[dem_iter],
+                                       (*g_shadows)[dem_iter][image_iter],
                                        *g_gridx, *g_gridy,
                                        (*g_model_params)[image_iter],
                                        *g_global_params,
@@ -1981,7 +2327,7 @@ public:
                             cartography::GeoReference         const & m_geo,            // alias
                             bool                                      m_model_shadows,
                             double                                    m_camera_position_step_size,
-                            double                            const & m_max_dem_height, // alias
+                            ImageView<float>                  const & m_shadow,         // alias
                             double                                    m_gridx,
                             double                                    m_gridy,
                             GlobalParams                      const & m_global_params,  // alias
@@ -2024,7 +2370,7 @@ public:
 	computeReflectanceAndIntensity(left[0], center[0], right[0],
 				       bottom[0], top[0],
 				       m_col, m_row,  m_dem, m_geo,
-				       m_model_shadows, m_max_dem_height,
+				       m_model_shadows, m_shadow,
 				       m_gridx, m_gridy,
 				       m_model_params,  m_global_params,
 				       m_crop_box, m_image, m_blend_weight, &adj_cam_copy,
@@ -2052,63 +2398,160 @@ public:
     return true;
   }
 
+// The data of one image for IntensityError. These are aliases to the
+// quantities which live for the whole optimization.
+struct IntensityTerm {
+  ImageView<float>               const* shadow; // updated by the callback
+  ModelParams                    const* model_params;
+  BBox2i                                crop_box;
+  MaskedImgT                     const* image;
+  DoubleImgT                     const* blend_weight;
+  boost::shared_ptr<CameraModel> const* camera;
+};
+
 // Discrepancy between measured and computed intensity.
 // sum_i | I_i - albedo * exposures[i] * reflectance_i |^2
-struct IntensityError {
+// There is one residual block for each image seeing a DEM pixel. The
+// parameters are the exposure of the image, the DEM heights at the
+// center pixel and its four neighbors, the albedo, the camera
+// adjustments, and the reflectance model coefficients.
+// Differentiating numerically all of the parameters would project into
+// the camera for each, but only the center height and the camera
+// adjustments move the projected pixel. Hence only those are
+// differentiated with full evaluations. The neighbor heights and
+// coefficients change just the reflectance, and the residual is
+// linear in the exposure and albedo. The step sizes are the ones
+// ceres::NumericDiffCostFunction would use.
+class IntensityError: public ceres::SizedCostFunction<1, 1, 1, 1, 1, 1, 1, 1, 6,
+                                                      g_num_model_coeffs> {
+public:
   IntensityError(int col, int row,
 		 ImageView<double> const& dem,
 		 cartography::GeoReference const& geo,
 		 bool model_shadows,
 		 double camera_position_step_size,
-		 double const& max_dem_height, // note: this is an alias
 		 double gridx, double gridy,
 		 GlobalParams const& global_params,
-		 ModelParams const& model_params,
-		 BBox2i const& crop_box,
-		 MaskedImgT const& image,
-		 DoubleImgT const& blend_weight,
-		 boost::shared_ptr<CameraModel> const& camera):
+                 IntensityTerm const& term):
     m_col(col), m_row(row), m_dem(dem), m_geo(geo),
     m_model_shadows(model_shadows),
     m_camera_position_step_size(camera_position_step_size),
-    m_max_dem_height(max_dem_height),
     m_gridx(gridx), m_gridy(gridy),
     m_global_params(global_params),
-    m_model_params(model_params),
-    m_crop_box(crop_box),
-    m_image(image), m_blend_weight(blend_weight),
-    m_camera(camera) {}
+    m_term(term) {
+
+    // These do not change during optimization
+    m_lonlat[CENTER] = geo.pixel_to_lonlat(Vector2(col,   row  ));
+    m_lonlat[LEFT]   = geo.pixel_to_lonlat(Vector2(col-1, row  ));
+    m_lonlat[RIGHT]  = geo.pixel_to_lonlat(Vector2(col+1, row  ));
+    m_lonlat[BOTTOM] = geo.pixel_to_lonlat(Vector2(col,   row+1));
+    m_lonlat[TOP]    = geo.pixel_to_lonlat(Vector2(col,   row-1));
+  }
 
-  // See SmoothnessError() for the definitions of bottom, top, etc.
-  template <typename F>
-  bool operator()(const F* const exposure,
-		  const F* const left,
-		  const F* const center,
-		  const F* const right,
-		  const F* const bottom,
-		  const F* const top,
-		  const F* const albedo,
-		  const F* const adjustments, // camera adjustments
-		  const F* const coeffs, // Lunar lambertian model coeffs
-                  F* residuals) const {
+  // The parameter blocks, in the order they are added to the problem
+  enum { EXPOSURE_BLOCK = 0, HEIGHTS_BLOCK = 1, ALBEDO_BLOCK = 6,
+         ADJ_BLOCK = 7, COEFFS_BLOCK = 8 };
+
+  virtual bool Evaluate(double const* const* parameters,
+                        double* residuals,
+                        double** jacobians) const {
+
+    double heights[NUM_HEIGHTS];
+    heights[LEFT]   = parameters[HEIGHTS_BLOCK + 0][0];
+    heights[CENTER] = parameters[HEIGHTS_BLOCK + 1][0];
+    heights[RIGHT]  = parameters[HEIGHTS_BLOCK + 2][0];
+    heights[BOTTOM] = parameters[HEIGHTS_BLOCK + 3][0];
+    heights[TOP]    = parameters[HEIGHTS_BLOCK + 4][0];
+    double exposure = parameters[EXPOSURE_BLOCK][0];
+    double albedo   = parameters[ALBEDO_BLOCK][0];
+    double const* adjustments = parameters[ADJ_BLOCK];
+    double const* coeffs      = parameters[COEFFS_BLOCK];
+
+    // Default residual. Using here 0 rather than some big number tuned out to
+    // work better than the alternative.
+    residuals[0] = 0.0;
+    Vector3 normal = computeNormal(heights);
+    Projection proj;
+    project(heights[CENTER], adjustments, proj);
+    double reflectance = 0.0;
+    if (proj.valid) {
+      reflectance  = computeReflectance(proj, normal, coeffs);
+      residuals[0] = proj.weight*(proj.intensity - albedo*exposure*reflectance);
+    }
 
-    return calc_residual(exposure, left, center, right, bottom,  top, albedo,
-                         adjustments,  // camera adjustments
-                         coeffs,  // Lunar lambertian model coeffs
-                         m_col, m_row,  
-                         m_dem,  // alias
-                         m_geo,  // alias
-                         m_model_shadows,  
-                         m_camera_position_step_size,  
-                         m_max_dem_height,  // alias
-                         m_gridx, m_gridy,  
-                         m_global_params,  // alias
-                         m_model_params,  // alias
-                         m_crop_box,  
-                         m_image,  // alias
-                         m_blend_weight,  // alias
-                         m_camera,  // alias
-                         residuals);
+    if (jacobians == NULL)
+      return true;
+
+    // The exposure and albedo
+    if (jacobians[EXPOSURE_BLOCK] != NULL)
+      jacobians[EXPOSURE_BLOCK][0] = proj.valid ? -proj.weight*albedo*reflectance : 0.0;
+    if (jacobians[ALBEDO_BLOCK] != NULL)
+      jacobians[ALBEDO_BLOCK][0] = proj.valid ? -proj.weight*exposure*reflectance : 0.0;
+
+    // The neighbor heights change only the normal
+    const int neighbors[] = {LEFT, RIGHT, BOTTOM, TOP};
+    const int blocks[]    = {0,    2,     3,      4};
+    for (int k = 0; k < 4; k++) {
+      double * jac = jacobians[HEIGHTS_BLOCK + blocks[k]];
+      if (jac == NULL)
+        continue;
+      int n = neighbors[k];
+      double h = step_size(heights[n]);
+      double v[2];
+      for (int s = 0; s < 2; s++) {
+        double perturbed[NUM_HEIGHTS];
+        std::copy(heights, heights + NUM_HEIGHTS, perturbed);
+        perturbed[n] += (s == 0) ? h : -h;
+        v[s] = reflectance_residual(proj, computeNormal(perturbed), coeffs, exposure, albedo);
+      }
+      jac[0] = (v[0] - v[1])/(2*h);
+    }
+
+    // The center height moves the projected point
+    if (jacobians[HEIGHTS_BLOCK + 1] != NULL) {
+      double h = step_size(heights[CENTER]);
+      double v[2];
+      for (int s = 0; s < 2; s++) {
+        Projection curr;
+        project(heights[CENTER] + ((s == 0) ? h : -h), adjustments, curr);
+        v[s] = reflectance_residual(curr, normal, coeffs, exposure, albedo);
+      }
+      jacobians[HEIGHTS_BLOCK + 1][0] = (v[0] - v[1])/(2*h);
+    }
+
+    // The camera adjustments
+    if (jacobians[ADJ_BLOCK] != NULL) {
+      for (int c = 0; c < 6; c++) {
+        double h = step_size(adjustments[c]);
+        double v[2];
+        for (int s = 0; s < 2; s++) {
+          double perturbed[6];
+          std::copy(adjustments, adjustments + 6, perturbed);
+          perturbed[c] += (s == 0) ? h : -h;
+          Projection curr;
+          project(heights[CENTER], perturbed, curr);
+          v[s] = reflectance_residual(curr, normal, coeffs, exposure, albedo);
+        }
+        jacobians[ADJ_BLOCK][c] = (v[0] - v[1])/(2*h);
+      }
+    }
+
+    // The reflectance model coefficients
+    if (jacobians[COEFFS_BLOCK] != NULL) {
+      for (size_t c = 0; c < g_num_model_coeffs; c++) {
+        double h = step_size(coeffs[c]);
+        double v[2];
+        for (int s = 0; s < 2; s++) {
+          double perturbed[g_num_model_coeffs];
+          std::copy(coeffs, coeffs + g_num_model_coeffs, perturbed);
+          perturbed[c] += (s == 0) ? h : -h;
+          v[s] = reflectance_residual(proj, normal, perturbed, exposure, albedo);
+        }
+        jacobians[COEFFS_BLOCK][c] = (v[0] - v[1])/(2*h);
+      }
+    }
+
+    return true;
   }
 
   // Factory to hide the construction of the CostFunction object from
@@ -2118,23 +2561,117 @@ struct IntensityError {
 				     vw::cartography::GeoReference const& geo,
 				     bool model_shadows,
 				     double camera_position_step_size,
-				     double const& max_dem_height, // alias
 				     double gridx, double gridy,
 				     GlobalParams const& global_params,
-				     ModelParams const& model_params,
-				     BBox2i const& crop_box,
-				     MaskedImgT const& image,
-				     DoubleImgT const& blend_weight,
-				     boost::shared_ptr<CameraModel> const& camera){
-    return (new ceres::NumericDiffCostFunction<IntensityError,
-	    ceres::CENTRAL, 1, 1, 1, 1, 1, 1, 1, 1, 6, g_num_model_coeffs>
-	    (new IntensityError(col, row, dem, geo,
-				model_shadows,
-				camera_position_step_size,
-				max_dem_height,
-				gridx, gridy,
-				global_params, model_params,
-				crop_box, image, blend_weight, camera)));
+                                     IntensityTerm const& term){
+    return new IntensityError(col, row, dem, geo,
+                              model_shadows,
+                              camera_position_step_size,
+                              gridx, gridy,
+                              global_params, term);
+  }
+
+private:
+
+  enum { CENTER = 0, LEFT, RIGHT, BOTTOM, TOP, NUM_HEIGHTS };
+
+  // What depends on the camera and on the center height
+  struct Projection {
+    bool    valid;
+    Vector3 base, cameraPosition;
+    double  intensity, weight;
+  };
+
+  // The step ceres::NumericDiffCostFunction uses by default
+  static double step_size(double x) {
+    const double relative_step_size = 1e-6;
+    double h = std::abs(x) * relative_step_size;
+    return (h == 0.0) ? relative_step_size : h;
+  }
+
+  void project(double center_h, double const* adjustments, Projection & proj) const {
+
+    IntensityTerm const& term = m_term;
+    proj.valid = false;
+    if (m_col >= m_dem.cols() - 1 || m_row >= m_dem.rows() - 1) return;
+    if (term.crop_box.empty()) return;
+
+    try{
+      AdjustedCameraModel * adj_cam
+	= dynamic_cast<AdjustedCameraModel*>(term.camera->get());
+      if (adj_cam == NULL)
+	vw_throw( ArgumentErr() << "Expecting adjusted camera.\n");
+
+      // We create a copy of this camera to avoid issues when using
+      // multiple threads. We copy just the adjustment parameters,
+      // the pointer to the underlying ISIS camera is shared.
+      AdjustedCameraModel adj_cam_copy = *adj_cam;
+
+      // Apply current adjustments to the camera
+      Vector3 axis_angle;
+      Vector3 translation;
+      for (int param_iter = 0; param_iter < 3; param_iter++) {
+	translation[param_iter]
+	  = (g_position_scale_factor*m_camera_position_step_size)*adjustments[param_iter];
+	axis_angle[param_iter] = adjustments[3 + param_iter];
+      }
+      adj_cam_copy.set_translation(translation);
+      adj_cam_copy.set_axis_angle_rotation(axis_angle);
+
+      proj.base = demPointToXyz(m_geo, m_lonlat[CENTER], center_h);
+      PixelMask<double> intensity;
+      if (!projectAndSampleImage(proj.base, m_global_params, term.crop_box, *term.image,
+                                 *term.blend_weight, &adj_cam_copy, proj.cameraPosition,
+                                 intensity, proj.weight))
+        return;
+      proj.intensity = intensity.child();
+
+      if (g_opt->unreliable_intensity_threshold > 0){
+        if (proj.intensity <= g_opt->unreliable_intensity_threshold &&
+            proj.intensity >= 0) {
+          proj.weight *=
+          pow(proj.intensity/g_opt->unreliable_intensity_threshold, 2.0);
+        }
+      }
+      
+    } catch (const camera::PointToPixelErr& e) {
+      // To be able to handle robustly DEMs that extend beyond the camera,
+      // always return true when we fail to project, but with zero residual.
+      // This needs more study.
+      return;
+    }
+
+    proj.valid = true;
+  }
+
+  Vector3 computeNormal(double const* heights) const {
+    return stencilNormal(demPointToXyz(m_geo, m_lonlat[LEFT],   heights[LEFT]),
+                         demPointToXyz(m_geo, m_lonlat[RIGHT],  heights[RIGHT]),
+                         demPointToXyz(m_geo, m_lonlat[BOTTOM], heights[BOTTOM]),
+                         demPointToXyz(m_geo, m_lonlat[TOP],    heights[TOP]));
+  }
+
+  double computeReflectance(Projection const& proj, Vector3 const& normal,
+                            double const* coeffs) const {
+
+    IntensityTerm const& term = m_term;
+    if (m_model_shadows && (*term.shadow)(m_col, m_row) > 0) {
+      // The reflectance is valid, it is just zero
+      return 0.0;
+    }
+
+    double phase_angle;
+    return ComputeReflectance(proj.cameraPosition, normal, proj.base,
+                              *term.model_params, m_global_params, phase_angle,
+                              coeffs);
+  }
+
+  double reflectance_residual(Projection const& proj, Vector3 const& normal,
+                              double const* coeffs, double exposure, double albedo) const {
+    if (!proj.valid)
+      return 0.0;
+    double reflectance = computeReflectance(proj, normal, coeffs);
+    return proj.weight*(proj.intensity - albedo*exposure*reflectance);
   }
 
   int m_col, m_row;
@@ -2142,14 +2679,10 @@ struct IntensityError {
   cartography::GeoReference         const & m_geo;            // alias
   bool                                      m_model_shadows;
   double                                    m_camera_position_step_size;
-  double                            const & m_max_dem_height; // alias
   double                                    m_gridx, m_gridy;
   GlobalParams                      const & m_global_params;  // alias
-  ModelParams                       const & m_model_params;   // alias
-  BBox2i                                    m_crop_box;
-  MaskedImgT                        const & m_image;          // alias
-  DoubleImgT                        const & m_blend_weight;   // alias
-  boost::shared_ptr<CameraModel>    const & m_camera;         // alias
+  IntensityTerm                             m_term;
+  Vector2                                   m_lonlat[NUM_HEIGHTS];
 };
 
 // A variation of IntensityError where albedo, dem, and model params are fixed.
@@ -2161,7 +2694,7 @@ struct IntensityErrorFixedMost {
                           cartography::GeoReference const& geo,
                           bool model_shadows,
                           double camera_position_step_size,
-                          double const& max_dem_height, // note: this is an alias
+                          ImageView<float> const& shadow, // note: this is an alias
                           double gridx, double gridy,
                           GlobalParams const& global_params,
                           ModelParams const& model_params,
@@ -2174,7 +2707,7 @@ struct IntensityErrorFixedMost {
     m_geo(geo),
     m_model_shadows(model_shadows),
     m_camera_position_step_size(camera_position_step_size),
-    m_max_dem_height(max_dem_height),
+    m_shadow(shadow),
     m_gridx(gridx), m_gridy(gridy),
     m_global_params(global_params),
     m_model_params(model_params),
@@ -2202,7 +2735,7 @@ struct IntensityErrorFixedMost {
                          m_geo,  // alias
                          m_model_shadows,  
                          m_camera_position_step_size,  
-                         m_max_dem_height,  // alias
+                         m_shadow,  // alias
                          m_gridx, m_gridy,  
                          m_global_params,  // alias
                          m_model_params,  // alias
@@ -2222,7 +2755,7 @@ struct IntensityErrorFixedMost {
                                      vw::cartography::GeoReference const& geo,
 				     bool model_shadows,
 				     double camera_position_step_size,
-				     double const& max_dem_height, // alias
+				     ImageView<float> const& shadow, // alias
 				     double gridx, double gridy,
 				     GlobalParams const& global_params,
 				     ModelParams const& model_params,
@@ -2235,7 +2768,7 @@ struct IntensityErrorFixedMost {
 	    (new IntensityErrorFixedMost(col, row, dem, albedo, coeffs, geo,
 				model_shadows,
 				camera_position_step_size,
-				max_dem_height,
+				shadow,
 				gridx, gridy,
 				global_params, model_params,
 				crop_box, image, blend_weight, camera)));
@@ -2248,7 +2781,7 @@ struct IntensityErrorFixedMost {
   cartography::GeoReference         const & m_geo;            // alias
   bool                                      m_model_shadows;
   double                                    m_camera_position_step_size;
-  double                            const & m_max_dem_height; // alias
+  ImageView<float>                  const & m_shadow;         // alias
   double                                    m_gridx, m_gridy;
   GlobalParams                      const & m_global_params;  // alias
   ModelParams                       const & m_model_params;   // alias
@@ -2422,6 +2955,105 @@ void compute_grid_sizes_in_meters(ImageView<double> const& dem,
   if (!gridy_vec.empty()) gridy = gridy_vec[gridy_vec.size()/2];
 }
 
+// Read a list of DEM tiles, one per line, as min_col min_row max_col max_row.
+std::vector<BBox2i> read_tile_list(std::string const& tile_list_file){
+  std::ifstream ifs(tile_list_file.c_str());
+  if (!ifs.good())
+    vw_throw( ArgumentErr() << "Cannot open file: " << tile_list_file << ".\n" );
+  std::vector<BBox2i> tiles;
+  int min_col, min_row, max_col, max_row;
+  while (ifs >> min_col >> min_row >> max_col >> max_row)
+    tiles.push_back(BBox2i(min_col, min_row, max_col - min_col, max_row - min_row));
+  return tiles;
+}
+
+// For each DEM tile, find the images which see at least a part of it
+// with the sun above the horizon. Each camera is evaluated only on a
+// sparse grid of DEM points, with the spacing a fraction of the
+// tile size, and each tile is grown by one spacing when looking up
+// these samples, so that images much smaller than a tile are not missed.
+void find_tile_images(Options const& opt,
+                      ImageView<double> const& dem,
+                      cartography::GeoReference const& geo,
+                      std::vector< boost::shared_ptr<CameraModel> > const& cameras,
+                      std::vector<BBox2i> const& image_boxes,
+                      std::vector<BBox2i> const& tiles,
+                      std::vector< std::vector<int> > & tile_images){
+
+  int num_images = cameras.size();
+  tile_images.clear();
+  tile_images.resize(tiles.size());
+
+  int min_tile_size = std::max(dem.cols(), dem.rows());
+  for (size_t tile_iter = 0; tile_iter < tiles.size(); tile_iter++)
+    min_tile_size = std::min(min_tile_size,
+                             std::min(tiles[tile_iter].width(), tiles[tile_iter].height()));
+  int spacing = std::max(1, min_tile_size/4);
+
+  // The samples include the last row and column of the DEM
+  int num_cols = (dem.cols() - 1)/spacing + 2;
+  int num_rows = (dem.rows() - 1)/spacing + 2;
+  ImageView<Vector3> samples(num_cols, num_rows);
+  for (int i = 0; i < num_cols; i++) {
+    for (int j = 0; j < num_rows; j++) {
+      int col = std::min(i*spacing, dem.cols() - 1);
+      int row = std::min(j*spacing, dem.rows() - 1);
+      Vector2 lonlat = geo.pixel_to_lonlat(Vector2(col, row));
+      samples(i, j) = geo.datum().geodetic_to_cartesian
+        (Vector3(lonlat[0], lonlat[1], dem(col, row)));
+    }
+  }
+
+  ImageView<unsigned char> seen(num_cols, num_rows);
+  for (int image_iter = 0; image_iter < num_images; image_iter++) {
+
+    if (opt.skip_images[0].find(image_iter) != opt.skip_images[0].end()) continue;
+
+    IsisCameraModel* icam
+      = dynamic_cast<IsisCameraModel*>(get_isis_cam(cameras[image_iter]).get());
+    if (icam == NULL)
+      vw_throw( ArgumentErr() << "Expecting an ISIS camera model.\n" );
+    Vector3 sunPos = icam->sun_position();
+
+    // A sample is usable if the sun is above its local horizon and it
+    // projects into the image
+    bool any_seen = false;
+    for (int i = 0; i < num_cols; i++) {
+      for (int j = 0; j < num_rows; j++) {
+        seen(i, j) = 0;
+        Vector3 xyz = samples(i, j);
+        if (dot_prod(sunPos - xyz, xyz) <= 0)
+          continue;
+        try {
+          Vector2 pix = cameras[image_iter]->point_to_pixel(xyz);
+          if (image_boxes[image_iter].contains(pix)) {
+            seen(i, j) = 1;
+            any_seen = true;
+          }
+        }catch(...){}
+      }
+    }
+    if (!any_seen)
+      continue;
+
+    for (size_t tile_iter = 0; tile_iter < tiles.size(); tile_iter++) {
+      BBox2i const& tile = tiles[tile_iter];
+      int beg_i = std::max(0, tile.min().x()/spacing - 1);
+      int beg_j = std::max(0, tile.min().y()/spacing - 1);
+      int end_i = std::min(num_cols - 1, tile.max().x()/spacing + 1);
+      int end_j = std::min(num_rows - 1, tile.max().y()/spacing + 1);
+      bool found = false;
+      for (int i = beg_i; i <= end_i && !found; i++) {
+        for (int j = beg_j; j <= end_j && !found; j++) {
+          found = (seen(i, j) != 0);
+        }
+      }
+      if (found)
+        tile_images[tile_iter].push_back(image_iter);
+    }
+  }
+}
+
 ImageView<double> comp_blending_weights(MaskedImgT const& img,
                                         double blending_dist,
                                         double blending_power){
@@ -2493,16 +3125,26 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Use RPC approximations for the camera models instead of approximate tabulated camera models (invoke with --use-approx-camera-models).")
     ("rpc-penalty-weight", po::value(&opt.rpc_penalty_weight)->default_value(0.1),
      "The RPC penalty weight to use to keep the higher-order RPC coefficients small, if the RPC model approximation is used. Higher penalty weight results in smaller such coefficients.")
+    ("approx-camera-cache-dir", po::value(&opt.approx_camera_cache_dir)->default_value(""),
+     "Save the approximate camera models in this directory, and read them from there when sfs is invoked again with the same cameras, adjustments, and DEM, such as in a re-run of parallel_sfs.")
     ("use-semi-approx",   po::bool_switch(&opt.use_semi_approx)->default_value(false)->implicit_value(true),
      "This is an undocumented experiment.")
     ("coarse-levels", po::value(&opt.coarse_levels)->default_value(0),
      "Solve the problem on a grid coarser than the original by a factor of 2 to this power, then refine the solution on finer grids.")
     ("max-coarse-iterations", po::value(&opt.max_coarse_iterations)->default_value(50),
      "How many iterations to do at levels of resolution coarser than the final result.")
+    ("multigrid-cycles", po::value(&opt.multigrid_cycles)->default_value(0),
+     "With --coarse-levels, after the solution is refined from the coarsest to the finest grid, do this many multigrid V-cycles. Each one goes down to the coarsest grid and back, correcting each finer grid with the change found on the coarser one, rather than replacing it. The iterations at the finest level are done after the cycles.")
+    ("multigrid-smoothing-iterations", po::value(&opt.multigrid_smoothing_iterations)->default_value(5),
+     "How many iterations to do at each level of a multigrid V-cycle before going to a coarser grid and after coming back from it. The coarsest grid uses --max-coarse-iterations.")
     ("crop-input-images",   po::bool_switch(&opt.crop_input_images)->default_value(false)->implicit_value(true),
      "Crop the images to a region that was computed to be large enough, and keep them fully in memory, for speed.")
     ("use-blending-weights", po::bool_switch(&opt.use_blending_weights)->default_value(false)->implicit_value(true),
      "Give less weight to image pixels close to no-data or boundary values. Enabled only when crop-input-images is true, for performance reasons.")
+    ("float32-weights",   po::bool_switch(&opt.float32_weights)->default_value(false)->implicit_value(true),
+     "Keep the blending weights in memory in single precision, to be able to use more images.")
+    ("stream-cropped-images",   po::bool_switch(&opt.stream_cropped_images)->default_value(false)->implicit_value(true),
+     "With --crop-input-images, read the cropped images from disk as needed, rather than keeping them fully in memory. This is slower but uses less memory.")
     ("blending-dist", po::value(&opt.blending_dist)->default_value(10),
      "Over how many pixels to blend.")
     ("blending-power", po::value(&opt.blending_power)->default_value(2),
@@ -2527,6 +3169,12 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Allow the coefficients of the reflectance model to float (not recommended).")
     ("query",   po::bool_switch(&opt.query)->default_value(false)->implicit_value(true),
      "Print some info and exit. Invoked from parallel_sfs.")
+    ("query-tile-list", po::value(&opt.query_tile_list)->default_value(""),
+     "With --query, read a list of DEM tiles, one per line, as min_col min_row max_col max_row, and print for each tile the indices of the images which see it with the sun above the horizon. Invoked from parallel_sfs.")
+    ("checkpoint-interval", po::value(&opt.checkpoint_interval)->default_value(0),
+     "Every this many iterations, save the DEMs and albedos at all levels, the exposures, adjustments, and reflectance model coefficients, and how far the solver got, to <output prefix>-checkpoint.bin, so that the run can be continued with --resume if interrupted. Set to 0 to not save checkpoints.")
+    ("resume",   po::bool_switch(&opt.resume)->default_value(false)->implicit_value(true),
+     "Continue from the checkpoint saved with --checkpoint-interval by an interrupted run with the same inputs and options.")
     ("save-sparingly",   po::bool_switch(&opt.save_sparingly)->default_value(false)->implicit_value(true),
      "Avoid saving any results except the adjustments and the DEM, as that's a lot of files.")
     ("camera-position-step-size", po::value(&opt.camera_position_step_size)->default_value(1.0),
@@ -2710,6 +3358,11 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     vw_throw(ArgumentErr() << "Expecting the number of levels to be non-negative.\n");
   }
 
+  if (opt.multigrid_cycles < 0 || opt.multigrid_smoothing_iterations < 0) {
+    vw_throw(ArgumentErr() << "Expecting the number of multigrid cycles and smoothing "
+             << "iterations to be non-negative.\n");
+  }
+
   // Need this to be able to load adjusted camera models. That will happen
   // in the stereo session.
   asp::stereo_settings().bundle_adjust_prefix = opt.bundle_adjust_prefix;
@@ -2757,6 +3410,7 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
       vw_out(WarningMessage) << "Using 0 coarse levels.\n";
       opt.coarse_levels = 0;
     }
+    opt.multigrid_cycles = 0;
 
     if (opt.use_approx_camera_models || opt.use_rpc_approximation || opt.crop_input_images) {
       vw_out(WarningMessage) << "Not using approximate camera models or cropping input images.\n";
@@ -2775,6 +3429,14 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     vw_throw( ArgumentErr()
               << "Using cropped input images implies using an approximate camera model.\n" );
   }
+
+  if (opt.stream_cropped_images && !opt.crop_input_images) {
+    vw_throw( ArgumentErr()
+              << "The option --stream-cropped-images needs --crop-input-images.\n" );
+  }
+
+  if (opt.approx_camera_cache_dir != "" && opt.use_approx_camera_models)
+    fs::create_directories(opt.approx_camera_cache_dir);
   
 }
 
@@ -2813,22 +3475,14 @@ void run_sfs_level(// Fixed inputs
   g_gridx = &gridx;
   g_gridy = &gridy;
 
-  std::vector<double> max_dem_height(num_dems, -std::numeric_limits<double>::max());
-  if (opt.model_shadows) {
-    // Find the max DEM height
-    for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) { 
-      double curr_max_dem_height = -std::numeric_limits<double>::max();
-      for (int col = 0; col < dems[dem_iter].cols(); col++) {
-        for (int row = 0; row < dems[dem_iter].rows(); row++) {
-          if (dems[dem_iter](col, row) > curr_max_dem_height) {
-            curr_max_dem_height = dems[dem_iter](col, row);
-          }
-        }
-      }
-      max_dem_height[dem_iter] = curr_max_dem_height;
-    }
-  }
-  g_max_dem_height = &max_dem_height;
+  // The cost functions keep references to these, and the callback
+  // updates them after each iteration.
+  std::vector< std::vector< ImageView<float> > > shadows;
+  if (opt.model_shadows)
+    computeShadows(opt, dems, geo, model_params, gridx, gridy, shadows);
+  else
+    shadows.resize(num_dems, std::vector< ImageView<float> >(num_images));
+  g_shadows = &shadows;
 
   // See if a given image is used in at least one clip or skipped in
   // all of them
@@ -2854,7 +3508,8 @@ void run_sfs_level(// Fixed inputs
     for (int col = 1; col < dems[dem_iter].cols()-1; col++) {
       for (int row = 1; row < dems[dem_iter].rows()-1; row++) {
 
-        // Intensity error for each image
+        // Intensity error for all images, with one residual block when
+        // the heights, albedo, or model are floated
         for (int image_iter = 0; image_iter < num_images; image_iter++) {
 
           if (opt.skip_images[dem_iter].find(image_iter) != opt.skip_images[dem_iter].end()) {
@@ -2863,17 +3518,19 @@ void run_sfs_level(// Fixed inputs
         
           ceres::LossFunction* loss_function_img = NULL;
           if (!fix_most) {
+            IntensityTerm term;
+            term.shadow       = &shadows[dem_iter][image_iter];
+            term.model_params = &model_params[image_iter];
+            term.crop_box     = crop_boxes[dem_iter][image_iter];
+            term.image        = &masked_images[dem_iter][image_iter];
+            term.blend_weight = &blend_weights[dem_iter][image_iter];
+            term.camera       = &cameras[dem_iter][image_iter];
             ceres::CostFunction* cost_function_img =
               IntensityError::Create(col, row, dems[dem_iter], geo[dem_iter],
                                      opt.model_shadows,
                                      opt.camera_position_step_size,
-                                     max_dem_height[dem_iter],
                                      gridx, gridy,
-                                     global_params, model_params[image_iter],
-                                     crop_boxes[dem_iter][image_iter],
-                                     masked_images[dem_iter][image_iter],
-                                     blend_weights[dem_iter][image_iter],
-                                     cameras[dem_iter][image_iter]);
+                                     global_params, term);
             problem.AddResidualBlock(cost_function_img, loss_function_img,
                                      &exposures[image_iter],      // exposure
                                      &dems[dem_iter](col-1, row),            // left
@@ -2894,7 +3551,7 @@ void run_sfs_level(// Fixed inputs
                                               geo[dem_iter],
                                               opt.model_shadows,
                                               opt.camera_position_step_size,
-                                              max_dem_height[dem_iter],
+                                              shadows[dem_iter][image_iter],
                                               gridx, gridy,
                                               global_params, model_params[image_iter],
                                               crop_boxes[dem_iter][image_iter],
@@ -3037,16 +3694,12 @@ void run_sfs_level(// Fixed inputs
     }
   }
   
-  if (opt.num_threads > 1 && !opt.use_approx_camera_models) {
-    vw_out() << "Using exact ISIS camera models. Can run with only a single thread.\n";
-    opt.num_threads = 1;
-  }
   vw_out() << "Using: " << opt.num_threads << " threads.\n";
 
   ceres::Solver::Options options;
   options.gradient_tolerance = 1e-16;
   options.function_tolerance = 1e-16;
-  options.max_num_iterations = num_iterations;
+  options.max_num_iterations = std::max(0, num_iterations - g_prev_iters);
   options.minimizer_progress_to_stdout = 1;
   options.num_threads = opt.num_threads;
   options.linear_solver_type = ceres::SPARSE_SCHUR;
@@ -3067,7 +3720,7 @@ void run_sfs_level(// Fixed inputs
   g_masked_images  = &masked_images;
   g_blend_weights  = &blend_weights;
   g_cameras        = &cameras;
-  g_iter           = -1; // reset the iterations for each level
+  g_iter           = g_prev_iters - 1; // reset the iterations for each level
   g_final_iter     = false;
 
   // Solve the problem if asked to do iterations. Otherwise
@@ -3196,7 +3849,7 @@ int main(int argc, char* argv[]) {
 
     // This must be done before the DEM is cropped. This stats is
     // queried from parallel_sfs.
-    if (opt.query) {
+    if (opt.query && opt.query_tile_list == "") {
       vw_out() << "dem_cols, " << dems[0][0].cols() << std::endl;
       vw_out() << "dem_rows, " << dems[0][0].rows() << std::endl;
       return 0;
@@ -3332,6 +3985,22 @@ int main(int argc, char* argv[]) {
 	crop_boxes[0][dem_iter].push_back(bounding_box(DiskImageView<float>(img_file)));
       }
     }
+
+    // Find which images see each tile. Invoked from parallel_sfs.
+    if (opt.query) {
+      std::vector<BBox2i> tiles = read_tile_list(opt.query_tile_list);
+      std::vector< std::vector<int> > tile_images;
+      find_tile_images(opt, dems[0][0], geos[0][0], cameras[0], crop_boxes[0][0],
+                       tiles, tile_images);
+      vw_out() << "num_images, " << num_images << std::endl;
+      for (size_t tile_iter = 0; tile_iter < tiles.size(); tile_iter++) {
+        vw_out() << "tile_images_" << tile_iter << ",";
+        for (size_t k = 0; k < tile_images[tile_iter].size(); k++)
+          vw_out() << " " << tile_images[tile_iter][k];
+        vw_out() << std::endl;
+      }
+      return 0;
+    }
     
     // Ensure that no two threads can access an ISIS camera at the same time.
     // Declare the lock here, as we want it to live until the end of the program. 
@@ -3363,10 +4032,13 @@ int main(int argc, char* argv[]) {
           BBox2i img_bbox = crop_boxes[0][dem_iter][image_iter];
           Stopwatch sw;
           sw.start();
+          std::string cache_file
+            = approx_camera_cache_file(opt, image_iter, adj_cam, img_bbox,
+                                       dems[0][dem_iter], geos[0][dem_iter]);
           boost::shared_ptr<CameraModel> apcam
             (new ApproxCameraModel(adj_cam, exact_cam, img_bbox, dems[0][dem_iter], geos[0][dem_iter],
                                    dem_nodata_val, opt.use_rpc_approximation, opt.use_semi_approx,
-                                   opt.rpc_penalty_weight, camera_mutex));
+                                   opt.rpc_penalty_weight, camera_mutex, cache_file));
           sw.stop();
           vw_out() << "Approximate model generation time: " << sw.elapsed_seconds()
                    << " s." << std::endl;
@@ -3523,20 +4195,38 @@ int main(int argc, char* argv[]) {
         if (opt.crop_input_images) {
           // Make a copy in memory for faster access
           if (!crop_boxes[0][dem_iter][image_iter].empty()) {
-            ImageView<float> cropped_img = 
-              crop(DiskImageView<float>(img_file), crop_boxes[0][dem_iter][image_iter]);
-            masked_images_vec[0][dem_iter][image_iter]
-              = create_pixel_range_mask2(cropped_img,
-					 std::max(img_nodata_val, shadow_thresh),
-					 opt.max_valid_image_vals_vec[image_iter]
-					 );
+            if (opt.stream_cropped_images) {
+              masked_images_vec[0][dem_iter][image_iter]
+                = create_pixel_range_mask2(crop(DiskImageView<float>(img_file),
+                                                crop_boxes[0][dem_iter][image_iter]),
+                                           std::max(img_nodata_val, shadow_thresh),
+                                           opt.max_valid_image_vals_vec[image_iter]
+                                           );
+            }else{
+              ImageView<float> cropped_img = 
+                crop(DiskImageView<float>(img_file), crop_boxes[0][dem_iter][image_iter]);
+              masked_images_vec[0][dem_iter][image_iter]
+                = create_pixel_range_mask2(cropped_img,
+                                           std::max(img_nodata_val, shadow_thresh),
+                                           opt.max_valid_image_vals_vec[image_iter]
+                                           );
+            }
             
             // Compute blending weights only when using an approx camera model and
             // cropping the images. Otherwise the weights are too huge.
-            if (opt.use_blending_weights)
-              blend_weights_vec[0][dem_iter][image_iter]
-                = comp_blending_weights(masked_images_vec[0][dem_iter][image_iter],
-                                        opt.blending_dist, opt.blending_power);
+            if (opt.use_blending_weights) {
+              if (opt.float32_weights) {
+                ImageView<float> weights
+                  = pixel_cast<float>(comp_blending_weights
+                                      (masked_images_vec[0][dem_iter][image_iter],
+                                       opt.blending_dist, opt.blending_power));
+                blend_weights_vec[0][dem_iter][image_iter] = pixel_cast<double>(weights);
+              }else{
+                blend_weights_vec[0][dem_iter][image_iter]
+                  = comp_blending_weights(masked_images_vec[0][dem_iter][image_iter],
+                                          opt.blending_dist, opt.blending_power);
+              }
+            }
           }
         }else{
           masked_images_vec[0][dem_iter][image_iter]
@@ -3575,22 +4265,11 @@ int main(int argc, char* argv[]) {
     g_gridx = &gridx;
     g_gridy = &gridy;
 
-    // Find the max DEM height
-    std::vector<double> max_dem_height(num_dems, -std::numeric_limits<double>::max());
-    if (opt.model_shadows) {
-      for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
-        double curr_max_dem_height = -std::numeric_limits<double>::max();
-        for (int col = 0; col < dems[0][dem_iter].cols(); col++) {
-          for (int row = 0; row < dems[0][dem_iter].rows(); row++) {
-            if (dems[0][dem_iter](col, row) > curr_max_dem_height) {
-              curr_max_dem_height = dems[0][dem_iter](col, row);
-            }
-          }
-        }
-        max_dem_height[dem_iter] = curr_max_dem_height;
-      }
-    }
-    g_max_dem_height = &max_dem_height;
+    std::vector< std::vector< ImageView<float> > > shadows;
+    if (opt.model_shadows)
+      computeShadows(opt, dems[0], geos[0], model_params, gridx, gridy, shadows);
+    else
+      shadows.resize(num_dems, std::vector< ImageView<float> >(num_images));
     
     // Initial albedo. This will be updated later.
     double initial_albedo = 1.0;
@@ -3622,7 +4301,7 @@ int main(int argc, char* argv[]) {
 	  ImageView< PixelMask<double> > reflectance, intensity;
 	  ImageView<double> weight;
 	  computeReflectanceAndIntensity(dems[0][dem_iter], geos[0][dem_iter],
-					 opt.model_shadows, max_dem_height[dem_iter],
+					 opt.model_shadows, shadows[dem_iter][image_iter],
 					 gridx, gridy,
 					 model_params[image_iter],
 					 global_params,
@@ -3785,7 +4464,7 @@ int main(int argc, char* argv[]) {
                Vector2i(tile_size, tile_size), sub_threads), img_nodata_val),
              has_img_georef, img_georef, has_img_nodata, img_nodata_val, opt, tpc);
           // Read it right back
-          if (opt.crop_input_images) {
+          if (opt.crop_input_images && !opt.stream_cropped_images) {
             // Read it fully in memory, as we cropped it before
             ImageView<float> memory_img = copy(DiskImageView<float>(sub_image));
             masked_images_vec[level][dem_iter][image_iter]
@@ -3815,24 +4494,139 @@ int main(int argc, char* argv[]) {
                  Vector2i(tile_size, tile_size), sub_threads), dem_nodata_val),
                has_img_georef, img_georef, has_img_nodata, dem_nodata_val, opt, tpc);
 
-            ImageView<double> memory_weight = copy(DiskImageView<double>(sub_weight));
-            blend_weights_vec[level][dem_iter][image_iter] = memory_weight;
+            if (opt.float32_weights) {
+              ImageView<float> memory_weight = copy(DiskImageView<float>(sub_weight));
+              blend_weights_vec[level][dem_iter][image_iter] = pixel_cast<double>(memory_weight);
+            }else{
+              ImageView<double> memory_weight = copy(DiskImageView<double>(sub_weight));
+              blend_weights_vec[level][dem_iter][image_iter] = memory_weight;
+            }
           }
         
         }
       }
     }
     
-    // Start going from the coarsest to the finest level
-    for (int level = levels; level >= 0; level--) {
+    // Start going from the coarsest to the finest level. Each coarse
+    // solution is interpolated to be the initial guess at the next
+    // finer level. Then, if desired, do multigrid V-cycles, where the
+    // solution at a level is restricted to be the initial guess at the
+    // next coarser level, and the change found there is interpolated
+    // and added back, rather than replacing the finer solution. The
+    // finest level is solved with all its iterations at the end.
+    enum Transition { NO_TRANSITION, INTERPOLATE, RESTRICT, CORRECT };
+    std::vector<int> visit_levels, visit_iterations, visit_transitions;
+    int num_cycles = (levels > 0) ? opt.multigrid_cycles : 0;
+    for (int level = levels; level >= 1; level--) {
+      visit_levels.push_back(level);
+      visit_iterations.push_back(opt.max_coarse_iterations);
+      visit_transitions.push_back(level == levels ? NO_TRANSITION : INTERPOLATE);
+    }
+    if (num_cycles > 0) {
+      visit_levels.push_back(0);
+      visit_iterations.push_back(opt.multigrid_smoothing_iterations);
+      visit_transitions.push_back(INTERPOLATE);
+    }
+    for (int cycle = 0; cycle < num_cycles; cycle++) {
+      for (int level = 1; level <= levels; level++) {
+        visit_levels.push_back(level);
+        visit_iterations.push_back(level == levels ?
+                                   opt.max_coarse_iterations :
+                                   opt.multigrid_smoothing_iterations);
+        visit_transitions.push_back(RESTRICT);
+      }
+      for (int level = levels - 1; level >= 0; level--) {
+        visit_levels.push_back(level);
+        visit_iterations.push_back(opt.multigrid_smoothing_iterations);
+        visit_transitions.push_back(CORRECT);
+      }
+    }
+    visit_levels.push_back(0);
+    visit_iterations.push_back(opt.max_iterations);
+    if (num_cycles > 0)
+      visit_transitions.push_back(NO_TRANSITION);
+    else
+      visit_transitions.push_back(levels > 0 ? INTERPOLATE : NO_TRANSITION);
 
+    // The restricted solutions, to find the coarse-level corrections
+    std::vector< std::vector< ImageView<double> > >
+      restricted_dems(levels+1), restricted_albedos(levels+1);
+    for (int level = 0; level <= levels; level++) {
+      restricted_dems   [level].resize(num_dems);
+      restricted_albedos[level].resize(num_dems);
+    }
+
+    g_all_dems           = &dems;
+    g_all_albedos        = &albedos;
+    g_restricted_dems    = &restricted_dems;
+    g_restricted_albedos = &restricted_albedos;
+
+    // Continue where an interrupted run saved its checkpoint
+    int start_visit = 0, start_iters = 0;
+    std::string checkpoint_file = asp::checkpoint_file_name(opt.out_prefix);
+    if (opt.resume) {
+      if (!fs::exists(checkpoint_file)) {
+        vw_out(WarningMessage) << "Cannot find checkpoint: " << checkpoint_file
+                               << ". Starting from the beginning.\n";
+      } else {
+        vw_out() << "Reading: " << checkpoint_file << std::endl;
+        asp::SolverCheckpoint checkpoint;
+        checkpoint.read(checkpoint_file);
+        start_visit = checkpoint.counter("visit");
+        start_iters = checkpoint.counter("iteration");
+        if (start_visit < 0 || start_visit >= int(visit_levels.size()))
+          vw_throw(ArgumentErr() << "The checkpoint " << checkpoint_file
+                   << " does not match the levels and cycles of this run.\n");
+        read_sfs_checkpoint(checkpoint);
+        vw_out() << "Resuming at level " << visit_levels[start_visit]
+                 << ", iteration " << start_iters << ".\n";
+      }
+    }
+    
+    for (int visit = start_visit; visit < int(visit_levels.size()); visit++) {
+
+      int level = visit_levels[visit];
       g_level = level;
+      g_visit = visit;
+      int num_iterations = visit_iterations[visit];
 
-      int num_iterations;
-      if (level == 0)
-        num_iterations = opt.max_iterations;
-      else
-        num_iterations = opt.max_coarse_iterations;
+      // The resumed visit continues from the checkpointed solution
+      bool resume_visit = (visit == start_visit && start_iters > 0);
+      g_prev_iters = resume_visit ? start_iters : 0;
+      
+      // Move the solution from the previously visited level to this one
+      for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
+        if (resume_visit) {
+          // Already done before the checkpoint
+        }else if (visit_transitions[visit] == INTERPOLATE) {
+          // TODO: Study this. Discarding the coarse DEM and exposure so
+          // keeping only the cameras seem to work better.
+          // Note that we overwrite dems[level] by resampling the coarser
+          // dems[level+1], but we keep orig_dems[level] from the beginning.
+          if (!opt.fix_dem)
+            interp_image(dems[level+1][dem_iter],    sub_scale, dems[level][dem_iter]);
+          if (opt.float_albedo)
+            interp_image(albedos[level+1][dem_iter], sub_scale, albedos[level][dem_iter]);
+        }else if (visit_transitions[visit] == RESTRICT) {
+          if (!opt.fix_dem) {
+            restricted_dems[level][dem_iter] = restrict_image(dems[level-1][dem_iter], sub_scale);
+            dems[level][dem_iter] = copy(restricted_dems[level][dem_iter]);
+          }
+          if (opt.float_albedo) {
+            restricted_albedos[level][dem_iter]
+              = restrict_image(albedos[level-1][dem_iter], sub_scale);
+            albedos[level][dem_iter] = copy(restricted_albedos[level][dem_iter]);
+          }
+        }else if (visit_transitions[visit] == CORRECT) {
+          if (!opt.fix_dem)
+            add_coarse_correction(dems[level+1][dem_iter], restricted_dems[level+1][dem_iter],
+                                  sub_scale, opt.float_dem_at_boundary, dems[level][dem_iter]);
+          if (opt.float_albedo)
+            add_coarse_correction(albedos[level+1][dem_iter],
+                                  restricted_albedos[level+1][dem_iter],
+                                  sub_scale, true, albedos[level][dem_iter]);
+        }
+      }
 
       // Scale the cameras
       for (int image_iter = 0; image_iter < num_images; image_iter++) {
@@ -3861,19 +4655,6 @@ int main(int argc, char* argv[]) {
                     opt.image_exposures_vec,
                     adjustments, opt.model_coeffs_vec);
 
-      // TODO: Study this. Discarding the coarse DEM and exposure so
-      // keeping only the cameras seem to work better.
-      // Note that we overwrite dems[level-1] by resampling the coarser
-      // dems[level], but we keep orig_dems[level-1] from the beginning.
-      if (level > 0) {
-        for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
-          if (!opt.fix_dem)
-            interp_image(dems[level][dem_iter],    sub_scale, dems[level-1][dem_iter]);
-          if (opt.float_albedo)
-            interp_image(albedos[level][dem_iter], sub_scale, albedos[level-1][dem_iter]);
-        }
-      }
-      
     }
 
   } ASP_STANDARD_CATCHES;
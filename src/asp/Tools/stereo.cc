@@ -557,16 +557,35 @@ namespace asp {
     const bool dem_provided = !opt.input_dem.empty();
 
     // Seed mode valid values
-    if (stereo_settings().seed_mode > 3){
+    if (stereo_settings().seed_mode > 4){
       vw_throw(ArgumentErr() << "Invalid value for seed-mode: " << stereo_settings().seed_mode << ".\n");
     }
 
+    // Correlation algorithm valid values. All run on the CPU.
+    if (stereo_settings().stereo_algorithm < 0 || stereo_settings().stereo_algorithm > 3){
+      vw_throw(ArgumentErr() << "Invalid value for stereo-algorithm: "
+               << stereo_settings().stereo_algorithm << ". Use 0 (local search window), "
+               << "1 (SGM), 2 (MGM), or 3 (MGM on the final level only).\n");
+    }
+
     // Local homography needs D_sub
     if (stereo_settings().seed_mode == 0 &&
         stereo_settings().use_local_homography){
       vw_throw( ArgumentErr() << "Cannot use local homography without computing low-resolution disparity.\n");
     }
 
+    // Subpixel refinement during correlation is only done for the
+    // parabola fit after block matching, in the original image frame.
+    if (stereo_settings().subpixel_in_corr) {
+      if (stereo_settings().subpixel_mode != 1 ||
+          stereo_settings().stereo_algorithm != vw::stereo::CORRELATION_WINDOW)
+        vw_throw( ArgumentErr() << "The option subpixel-in-corr requires subpixel-mode 1 "
+                  << "and stereo-algorithm 0.\n");
+      if (stereo_settings().use_local_homography)
+        vw_throw( ArgumentErr() << "The option subpixel-in-corr cannot be used "
+                  << "with use-local-homography.\n");
+    }
+
     // D_sub from DEM needs a positive disparity_estimation_dem_error
     if (stereo_settings().seed_mode == 2 &&
         stereo_settings().disparity_estimation_dem_error <= 0.0){
@@ -579,10 +598,20 @@ namespace asp {
       vw_throw( ArgumentErr() << "For seed-mode 2, an input DEM must be provided.\n" );
     }
 
+    // D_sub from a prior run needs its point cloud
+    if (stereo_settings().seed_mode == 4 &&
+        stereo_settings().prior_point_cloud.empty()){
+      vw_throw( ArgumentErr() << "For seed-mode 4, the point cloud of a prior run must be provided "
+                << "with prior-point-cloud.\n" );
+    }
+
     // D_sub from DEM does not work with map-projected images
     if (dem_provided && stereo_settings().seed_mode == 2)
       vw_throw( NoImplErr() << "Computation of low-resolution disparity from "
                 << "DEM is not implemented for map-projected images.\n");
+    if (dem_provided && stereo_settings().seed_mode == 4)
+      vw_throw( NoImplErr() << "Computation of low-resolution disparity from "
+                << "a prior point cloud is not implemented for map-projected images.\n");
 
     // Must use map-projected images if input DEM is provided
     GeoReference georef1, georef2;
@@ -771,10 +800,101 @@ namespace asp {
     // images, if feasible.
     return(!crop_left && !crop_right                    &&
            stereo_settings().skip_image_normalization   &&
+           !stereo_settings().wv_correct                &&
            stereo_settings().alignment_method == "none" &&
            stereo_settings().cost_mode == 2             &&
            has_tif_or_ntf_extension(opt.in_file1)       &&
            has_tif_or_ntf_extension(opt.in_file2));
   } // End function skip_image_normalization
 
+  int sgm_max_tile_size(){
+
+    // Per pixel and disparity, SGM keeps an 8-bit cost and a 16-bit
+    // accumulated cost, and MGM keeps one more accumulated cost. The
+    // ranges of neighboring pixels are merged, so allow for twice
+    // the number of disparities from the search buffer.
+    Vector2i buffer = stereo_settings().sgm_search_buffer;
+    double num_disp = 2.0 * (2*buffer[0] + 1) * (2*buffer[1] + 1);
+    double bytes_per_disp = 3.0;
+    if (stereo_settings().stereo_algorithm > vw::stereo::CORRELATION_SGM)
+      bytes_per_disp += 2.0;
+
+    double limit = double(stereo_settings().corr_memory_limit_mb) * 1024.0 * 1024.0;
+    int padded_size = int(floor(sqrt(limit / (num_disp * bytes_per_disp))));
+    int tile_size   = padded_size - 2*stereo_settings().sgm_collar_size;
+
+    const int granularity = 256;
+    tile_size = granularity * (tile_size / granularity);
+    return std::max(granularity, tile_size);
+  }
+
+  double corr_tile_memory_mb(int tile_size){
+
+    // The search range is known only after the low-resolution
+    // disparity is found, so if not set, assume a modest one.
+    BBox2i range = stereo_settings().search_range;
+    double range_w = 256, range_h = 256;
+    if (!range.empty() && range.width() > 0 && range.height() > 0) {
+      range_w = range.width();
+      range_h = range.height();
+    }
+
+    bool use_sgm = (stereo_settings().stereo_algorithm > vw::stereo::CORRELATION_WINDOW);
+    double collar = use_sgm ? stereo_settings().sgm_collar_size : 0;
+    Vector2i kernel  = stereo_settings().corr_kernel;
+    double left_w  = tile_size + 2*collar + kernel[0];
+    double left_h  = tile_size + 2*collar + kernel[1];
+
+    // The left and right images, with their masks, at 5 bytes per
+    // pixel. With the coarser pyramid levels this grows by a third.
+    double bytes = (4.0/3.0) * 5.0 * (left_w*left_h + (left_w + range_w)*(left_h + range_h));
+
+    double pixels = (tile_size + 2*collar) * (tile_size + 2*collar);
+    if (use_sgm) {
+      // The cost buffers, as in sgm_max_tile_size()
+      Vector2i buffer = stereo_settings().sgm_search_buffer;
+      double num_disp = 2.0 * (2*buffer[0] + 1) * (2*buffer[1] + 1);
+      double bytes_per_disp = 3.0;
+      if (stereo_settings().stereo_algorithm > vw::stereo::CORRELATION_SGM)
+        bytes_per_disp += 2.0;
+      bytes += pixels * num_disp * bytes_per_disp;
+    } else {
+      // The current and best costs, for each pixel
+      bytes += pixels * 8.0;
+    }
+
+    // The disparity, its filtered copies, and the left-right check
+    bytes += pixels * 4.0 * sizeof(PixelMask<Vector2f>);
+
+    return bytes / (1024.0 * 1024.0);
+  }
+
+  double rfne_tile_memory_mb(){
+
+    // Each tile is refined with both images cropped around it, at the
+    // pyramid levels of the subpixel mode, and the disparity.
+    int    ts     = ASPGlobalOptions::rfne_tile_size();
+    Vector2i kernel = stereo_settings().subpixel_kernel;
+    double w = ts + 2*kernel[0], h = ts + 2*kernel[1];
+    double bytes = (4.0/3.0) * w * h * (2*sizeof(float) + 2*sizeof(PixelMask<Vector2f>));
+    return bytes / (1024.0 * 1024.0);
+  }
+
+  double tri_tile_memory_mb(){
+    // The disparity and the output point and error, per pixel
+    int ts = ASPGlobalOptions::tri_tile_size();
+    double bytes = double(ts) * ts * (sizeof(PixelMask<Vector2f>) + 6*sizeof(double));
+    return bytes / (1024.0 * 1024.0);
+  }
+
+  int max_corr_tile_size(){
+    const int granularity = 256, max_size = 16384;
+    double limit = stereo_settings().corr_memory_limit_mb;
+    int tile_size = granularity;
+    while (tile_size + granularity <= max_size &&
+           corr_tile_memory_mb(tile_size + granularity) <= limit)
+      tile_size += granularity;
+    return tile_size;
+  }
+
 } // end namespace asp
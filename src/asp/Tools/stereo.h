@@ -93,6 +93,27 @@ namespace asp {
 
   bool skip_image_normalization(ASPGlobalOptions const& opt);
 
+  /// An estimate of the largest SGM/MGM correlation tile size, not
+  /// counting the collar, for which the cost buffers fit within
+  /// --corr-memory-limit-mb. At full resolution each pixel searches only
+  /// around the disparity from the previous level, expanded by
+  /// --sgm-search-buffer, so the search range of the whole image
+  /// does not matter. The result is rounded down to a multiple of 256.
+  int sgm_max_tile_size();
+
+  /// Estimates of the memory, in MB, used by one thread while it
+  /// processes a tile of correlation of the given size, of refinement,
+  /// or of triangulation. The correlation estimate accounts for the
+  /// search range, the kernel, and the SGM/MGM cost buffers. When the
+  /// search range is not known yet, 256 pixels along each axis is assumed.
+  double corr_tile_memory_mb(int tile_size);
+  double rfne_tile_memory_mb();
+  double tri_tile_memory_mb();
+
+  /// The largest correlation tile size, a multiple of 256 and no less
+  /// than 256, whose estimated memory fits within --corr-memory-limit-mb.
+  int max_corr_tile_size();
+
 } // end namespace vw
 
 #endif//__ASP_STEREO_H__
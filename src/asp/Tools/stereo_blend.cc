@@ -256,20 +256,41 @@ bool get_roi_from_tile(std::string const& tile_path, Position pos,
 }
 
 /// Load the desired portion of a disparity tile and associated image weights.
+/// The weights in the ROI depend only on the extent of the valid data in
+/// the rows and columns through it, so only those are read from disk,
+/// rather than the whole tile. For the corner neighbors that is just two
+/// thin strips.
 bool load_image_and_weights(std::string const& file_path, BBox2i const& roi,
                             DispImageType & image, WeightsType & weights) {
   // Verify image exists
   if (file_path == "")
     return false;
     
-  // Load the image from disk
-  DispImageType full_image = DiskImageType(file_path);
+  DiskImageType full_image(file_path);
+
+  // The validity of the pixels in the rows and columns through the ROI.
+  // The other pixels are left invalid, which does not change the weights.
+  ImageView< PixelMask<unsigned char> > mask(full_image.cols(), full_image.rows());
+  BBox2i strips[2] = {BBox2i(0, roi.min().y(), full_image.cols(), roi.height()),
+                      BBox2i(roi.min().x(), 0, roi.width(), full_image.rows())};
+  for (int s = 0; s < 2; s++) {
+    BBox2i const& box = strips[s];
+    DispImageType strip = crop(full_image, box);
+    for (int col = 0; col < strip.cols(); col++) {
+      for (int row = 0; row < strip.rows(); row++) {
+        if (is_valid(strip(col, row)))
+          mask(col + box.min().x(), row + box.min().y()) = PixelMask<unsigned char>(1);
+      }
+    }
+
+    // Extract the desired portion of the image from the first strip
+    if (s == 0)
+      image = crop(strip, roi.min().x() - box.min().x(), roi.min().y() - box.min().y(),
+                   roi.width(), roi.height());
+  }
   
   // Compute the desired weights
-  centerline_weights(full_image, weights, roi);
-  
-  // Extract the desired portion of the full image
-  image = crop(full_image, roi);
+  centerline_weights(mask, weights, roi);
   
   return true;
 }
@@ -594,9 +615,11 @@ void stereo_blending( ASPGlobalOptions const& opt ) {
 
   string rd_file = opt.out_prefix + "-RD.tif";
   vw_out() << "Writing: " << rd_file << "\n";
-  vw::cartography::block_write_gdal_image(rd_file, output,
+  vw::cartography::block_write_gdal_image(rd_file,
+                                          round_disparity(output,
+                                                          stereo_settings().disparity_rounding_error),
                                           has_left_georef, left_georef,
-                                          has_nodata, nodata, opt,
+                                          has_nodata, nodata, float_write_options(opt),
                                           TerminalProgressCallback("asp", "\t--> Blending :") );
 }
 
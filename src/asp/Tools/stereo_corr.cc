@@ -28,9 +28,14 @@
 #include <vw/Stereo/CorrelationView.h>
 #include <vw/Stereo/CostFunctions.h>
 #include <vw/Stereo/DisparityMap.h>
+#include <vw/Stereo/SubpixelView.h>
 #include <asp/Tools/stereo.h>
 #include <asp/Core/DemDisparity.h>
 #include <asp/Core/LocalHomography.h>
+#include <asp/Core/SparseCorrelation.h>
+#include <asp/Core/ImageStatistics.h>
+#include <asp/Core/Trace.h>
+#include <asp/Camera/CachedProjectionModel.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Sessions/StereoSessionPinhole.h>
 #include <xercesc/util/PlatformUtils.hpp>
@@ -38,6 +43,13 @@
 #include <asp/Core/InterestPointMatching.h>
 #include <vw/Stereo/StereoModel.h>
 
+#include <set>
+#include <algorithm>
+#include <limits>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
 using namespace vw;
 using namespace vw::stereo;
 using namespace asp;
@@ -104,6 +116,42 @@ void read_search_range_from_dsub(ASPGlobalOptions & opt){
 
 
 /// Produces the low-resolution disparity file D_sub
+/// Projecting the DEM points into the right camera is most of the
+/// work of finding the low-resolution disparity from a DEM, as for
+/// linescan cameras each projection needs a solver. Interpolate instead
+/// in a lattice of exact projections over the DEM, with the cells
+/// where that is not accurate enough falling back to the camera.
+boost::shared_ptr<camera::CameraModel>
+dem_projection_model(boost::shared_ptr<camera::CameraModel> camera_model) {
+
+  std::string dem_file = stereo_settings().disparity_estimation_dem;
+  cartography::GeoReference dem_georef;
+  if (dem_file == "" || !cartography::read_georeference(dem_georef, dem_file))
+    return camera_model; // produce_dem_disparity() will complain
+
+  DiskImageView<float> dem(dem_file);
+  double nodata = -std::numeric_limits<float>::max();
+  boost::shared_ptr<DiskImageResource> rsrc(DiskImageResourcePtr(dem_file));
+  if (rsrc->has_nodata_read())
+    nodata = rsrc->nodata_read();
+
+  // The heights of the DEM, from a sample, widened by the DEM error,
+  // as the points projected may be off the DEM by that much.
+  std::vector<float> heights;
+  int step = stats_sample_step(dem.cols(), dem.rows(), 1.0e+5);
+  sample_valid_values(create_mask(dem, nodata), step, 0, heights);
+  if (heights.empty())
+    return camera_model;
+  double dem_error = std::max(stereo_settings().disparity_estimation_dem_error, 0.0);
+  Vector2 height_range(sample_quantile(heights, 0.0) - dem_error,
+                       sample_quantile(heights, 1.0) + dem_error);
+
+  BBox2 lonlat_box = dem_georef.pixel_to_lonlat_bbox(BBox2(0, 0, dem.cols(), dem.rows()));
+  return boost::shared_ptr<camera::CameraModel>
+    (new asp::CachedProjectionModel(camera_model, dem_georef.datum(), lonlat_box,
+                                    height_range, Vector3i(64, 64, 3), 0.01));
+}
+
 void produce_lowres_disparity( ASPGlobalOptions & opt ) {
 
   // Set up handles to read the input images
@@ -146,14 +194,14 @@ void produce_lowres_disparity( ASPGlobalOptions & opt ) {
     SemiGlobalMatcher::SgmSubpixelMode sgm_subpixel_mode = get_sgm_subpixel_mode();
     Vector2i sgm_search_buffer = stereo_settings().sgm_search_buffer;;
 
+    // If we can process the entire image in one tile, don't use a collar.
+    int collar_size = stereo_settings().sgm_collar_size;
+    if ((opt.raster_tile_size[0] > left_sub.cols()) &&
+        (opt.raster_tile_size[1] > left_sub.rows())   )
+      collar_size = 0;
+
     if (stereo_settings().rm_quantile_multiple <= 0.0)
     {
-      // If we can process the entire image in one tile, don't use a collar.
-      int collar_size = stereo_settings().sgm_collar_size;
-      if ((opt.raster_tile_size[0] > left_sub.cols()) &&
-          (opt.raster_tile_size[1] > left_sub.rows())   )
-        collar_size = 0;
-    
       // Warning: A giant function call approaches!
       // TODO: Why the extra filtering step here? PyramidCorrelationView already performs 1-3 iterations of outlier removal.
       std::string d_sub_file = opt.out_prefix + "-D_sub.tif";
@@ -197,8 +245,10 @@ void produce_lowres_disparity( ASPGlobalOptions & opt ) {
     }
     else { // Use quantile based filtering - This filter needs to be profiled to improve its speed.
     
-      // Compute image correlation using the PyramidCorrelationView class
-      ImageView< PixelMask<Vector2f> > disp_image = vw::stereo::pyramid_correlate( 
+      // Compute image correlation using the PyramidCorrelationView class.
+      // The filter needs the entire image in memory, but it is
+      // computed in tiles in parallel, same as in the case above.
+      ImageView< PixelMask<Vector2f> > disp_image = block_rasterize(vw::stereo::pyramid_correlate( 
                   left_sub, right_sub,
                   left_mask_sub, right_mask_sub,
                   vw::stereo::PREFILTER_LOG, stereo_settings().slogW,
@@ -209,11 +259,11 @@ void produce_lowres_disparity( ASPGlobalOptions & opt ) {
                   rm_half_kernel,
                   stereo_settings().corr_max_levels,
                   static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
-                  0, // No collar here, the entire image is written at once.
-                  sgm_subpixel_mode, sgm_search_buffer, stereo_settings().corr_memory_limit_mb,
+                  collar_size, sgm_subpixel_mode, sgm_search_buffer,
+                  stereo_settings().corr_memory_limit_mb,
                   0, // Don't combine blob filtering with quantile filtering
                   stereo_settings().stereo_debug
-              );
+              ), opt.raster_tile_size, vw_settings().default_num_threads());
 
       std::string d_sub_file = opt.out_prefix + "-D_sub.tif";
       vw_out() << "Writing: " << d_sub_file << std::endl;
@@ -232,9 +282,56 @@ void produce_lowres_disparity( ASPGlobalOptions & opt ) {
     // Use a DEM to get the low-res disparity
     boost::shared_ptr<camera::CameraModel> left_camera_model, right_camera_model;
     opt.session->camera_models(left_camera_model, right_camera_model);
+    right_camera_model = dem_projection_model(right_camera_model);
     produce_dem_disparity(opt, left_camera_model, right_camera_model, opt.session->name());
+  }else if ( stereo_settings().seed_mode == 4 ) {
+    // Project the cloud of a prior run to get the low-res disparity
+    boost::shared_ptr<camera::CameraModel> left_camera_model, right_camera_model;
+    opt.session->camera_models(left_camera_model, right_camera_model);
+    produce_prior_cloud_disparity(opt, left_camera_model, right_camera_model,
+                                  opt.session->name());
   }else if ( stereo_settings().seed_mode == 3 ) {
-    // D_sub is already generated by now by sparse_disp
+    // Match templates from the full-resolution images at a sparse
+    // set of points. If the sparse_disp script made D_sub and
+    // D_sub_spread after the aligned images, keep those, unless this
+    // run was asked to compute the low-res disparity.
+    std::string d_sub_file  = opt.out_prefix + "-D_sub.tif";
+    std::string spread_file = opt.out_prefix + "-D_sub_spread.tif";
+    std::string left_file   = opt.out_prefix + "-L.tif";
+    if (!stereo_settings().compute_low_res_disparity_only &&
+        fs::exists(d_sub_file) && fs::exists(spread_file) &&
+        fs::last_write_time(d_sub_file)  >= fs::last_write_time(left_file) &&
+        fs::last_write_time(spread_file) >= fs::last_write_time(left_file)) {
+      vw_out() << "\t--> Using the low-resolution disparity from sparse_disp: "
+               << d_sub_file << "\n";
+      read_search_range_from_dsub(opt);
+      return;
+    }
+
+    DiskImageView<float> left_img (left_file),
+                         right_img(opt.out_prefix + "-R.tif");
+    ImageViewRef<float> left  = apply_mask(copy_mask(left_img,  create_mask(Lmask, 0)));
+    ImageViewRef<float> right = apply_mask(copy_mask(right_img, create_mask(Rmask, 0)));
+
+    asp::SparseDispOptions sparse_opt;
+    sparse_opt.template_size = stereo_settings().sparse_disp_template_size;
+    sparse_opt.spacing       = stereo_settings().sparse_disp_spacing;
+    sparse_opt.search_range  = Vector2i(std::min(stereo_settings().sparse_disp_search_range[0], left.cols()/4),
+                                        std::min(stereo_settings().sparse_disp_search_range[1], left.rows()/4));
+    sparse_opt.min_score     = stereo_settings().sparse_disp_min_score;
+    sparse_opt.num_threads   = vw_settings().default_num_threads();
+
+    ImageView<PixelMask<Vector2f> > sub_disp;
+    ImageView<PixelMask<Vector2i> > sub_spread;
+    asp::sparse_disparity(left, right, sparse_opt, Vector2i(left_sub.cols(), left_sub.rows()),
+                          sub_disp, sub_spread);
+
+    vw_out() << "Writing: " << d_sub_file << std::endl;
+    vw::cartography::block_write_gdal_image(d_sub_file, sub_disp, opt,
+                                            TerminalProgressCallback("asp", "\t--> Low-resolution disparity:"));
+    vw_out() << "Writing: " << spread_file << std::endl;
+    vw::cartography::block_write_gdal_image(spread_file, sub_spread, opt,
+                                            TerminalProgressCallback("asp", "\t--> Low-resolution disparity spread:"));
   }
 
   read_search_range_from_dsub(opt); // TODO: We already call this when needed!
@@ -470,6 +567,12 @@ double compute_ip(ASPGlobalOptions & opt, std::string & match_filename) {
   ImageView<float> left_image  = DiskImageView<float>(left_rsrc);
   ImageView<float> right_image = DiskImageView<float>(right_rsrc);
 
+  // The keys of the interest points of these images in --ip-cache-dir
+  std::string cache_key1 = asp::ip_cache_key(left_image_path, "", stereo_settings().ip_per_tile,
+                                             left_nodata_value);
+  std::string cache_key2 = asp::ip_cache_key(right_image_path, "", stereo_settings().ip_per_tile,
+                                             right_nodata_value);
+
   // No interest point operations have been performed before
   vw_out() << "\t    * Locating Interest Points\n";
 
@@ -500,7 +603,10 @@ double compute_ip(ASPGlobalOptions & opt, std::string & match_filename) {
                                    stereo_settings().ip_per_tile,
                                    datum, match_filename, epipolar_threshold,
                                    stereo_settings().ip_uniqueness_thresh,
-                                   left_nodata_value, right_nodata_value);
+                                   left_nodata_value, right_nodata_value,
+                                   TransformRef(TranslateTransform(0,0)),
+                                   TransformRef(TranslateTransform(0,0)),
+                                   true, cache_key1, cache_key2);
   } // End nadir epipolar full image case
   else {
     // In all other cases, run a more general IP matcher.
@@ -514,7 +620,8 @@ double compute_ip(ASPGlobalOptions & opt, std::string & match_filename) {
     success = asp::homography_ip_matching(left_image, right_image,
                                           stereo_settings().ip_per_tile,
                                           match_filename, inlier_threshold,
-                                          left_nodata_value, right_nodata_value);
+                                          left_nodata_value, right_nodata_value,
+                                          cache_key1, cache_key2);
   }
 
   if (!success)
@@ -762,7 +869,9 @@ void lowres_correlation( ASPGlobalOptions & opt ) {
   }else if (stereo_settings().seed_mode == 2){
     // Do nothing as we will compute the search range based on D_sub
   }else if (stereo_settings().seed_mode == 3){
-    // Do nothing as low-res disparity (D_sub) is already provided by sparse_disp
+    // Do nothing as we will compute the search range based on D_sub
+  }else if (stereo_settings().seed_mode == 4){
+    // Do nothing as we will compute the search range based on D_sub
   } else { // Regular seed mode
 
     // If there is no match file for the input images, gather some IP from the
@@ -831,20 +940,46 @@ void lowres_correlation( ASPGlobalOptions & opt ) {
   }
 
   // Create the local homographies based on D_sub
-  if (stereo_settings().seed_mode > 0 && stereo_settings().use_local_homography){
-    string local_hom_file = opt.out_prefix + "-local_hom.txt";
-    try {
-      ImageView<Matrix3x3> local_hom;
-      read_local_homographies(local_hom_file, local_hom);
-    } catch (vw::IOErr const& e) {
-      create_local_homographies(opt);
-    }
-  }
+  if (stereo_settings().seed_mode > 0 && stereo_settings().use_local_homography)
+    create_local_homographies(opt);
 
   vw_out() << "\n[ " << current_posix_time_string() << " ] : LOW-RESOLUTION CORRELATION FINISHED \n";
 } // End lowres_correlation
 
 
+/// The range of the valid disparities in the image. If the quantile
+/// is positive, this fraction of the valid disparities is ignored at
+/// each end of the range along each axis, so that a few outliers in
+/// D_sub do not inflate the search range of a whole tile.
+template <class ImageT>
+BBox2f robust_disparity_range(ImageViewBase<ImageT> const& disp, double quantile) {
+
+  if (quantile <= 0)
+    return stereo::get_disparity_range(disp);
+
+  ImageView<typename ImageT::pixel_type> disp_img = disp.impl();
+  std::vector<float> dx, dy;
+  for (int row = 0; row < disp_img.rows(); row++) {
+    for (int col = 0; col < disp_img.cols(); col++) {
+      if (!is_valid(disp_img(col, row)))
+        continue;
+      dx.push_back(disp_img(col, row).child()[0]);
+      dy.push_back(disp_img(col, row).child()[1]);
+    }
+  }
+  if (dx.empty())
+    return stereo::get_disparity_range(disp_img);
+
+  size_t n  = dx.size();
+  size_t lo = size_t(floor(quantile*(n-1)));
+  size_t hi = std::max(lo, size_t(ceil((1.0-quantile)*(n-1))));
+  BBox2f range;
+  std::nth_element(dx.begin(), dx.begin() + lo, dx.end()); range.min()[0] = dx[lo];
+  std::nth_element(dx.begin(), dx.begin() + hi, dx.end()); range.max()[0] = dx[hi];
+  std::nth_element(dy.begin(), dy.begin() + lo, dy.end()); range.min()[1] = dy[lo];
+  std::nth_element(dy.begin(), dy.begin() + hi, dy.end()); range.max()[1] = dy[hi];
+  return range;
+}
 
 /// This correlator takes a low resolution disparity image as an input
 /// so that it may narrow its search range for each tile that is processed.
@@ -865,6 +1000,10 @@ class SeededCorrelatorView : public ImageViewBase<SeededCorrelatorView> {
   int      m_corr_timeout;
   double   m_seconds_per_op;
 
+  // If not empty, the search range of each tile is appended to this file
+  std::string m_search_range_file;
+  boost::shared_ptr<vw::Mutex> m_mutex; // Protects writing to that file
+
 public:
 
   // Set these input types here instead of making them template arguments
@@ -883,16 +1022,25 @@ public:
                         ImageView<Matrix3x3>  const& local_hom,
                         Vector2i const& kernel_size,
                         stereo::CostFunctionType cost_mode,
-                        int corr_timeout, double seconds_per_op) :
+                        int corr_timeout, double seconds_per_op,
+                        std::string const& search_range_file = "") :
     m_left_image(left_image.impl()), m_right_image(right_image.impl()),
     m_left_mask (left_mask.impl ()), m_right_mask (right_mask.impl ()),
     m_sub_disp(sub_disp.impl()), m_sub_disp_spread(sub_disp_spread.impl()),
     m_local_hom(local_hom),
     m_kernel_size(kernel_size),  m_cost_mode(cost_mode),
-    m_corr_timeout(corr_timeout), m_seconds_per_op(seconds_per_op){
+    m_corr_timeout(corr_timeout), m_seconds_per_op(seconds_per_op),
+    m_search_range_file(search_range_file), m_mutex(new vw::Mutex){
     m_upscale_factor[0] = double(m_left_image.cols()) / m_sub_disp.cols();
     m_upscale_factor[1] = double(m_left_image.rows()) / m_sub_disp.rows();
     m_seed_bbox = bounding_box( m_sub_disp );
+
+    // Start a new file, with the columns described in the first line
+    if (!m_search_range_file.empty()) {
+      std::ofstream ofs(m_search_range_file.c_str());
+      ofs << "# tile_min_x tile_min_y tile_max_x tile_max_y "
+          << "search_min_x search_min_y search_max_x search_max_y\n";
+    }
   }
 
   // Image View interface
@@ -911,20 +1059,17 @@ public:
     return pixel_type();
   }
 
-  /// Does the work
   typedef CropView<ImageView<pixel_type> > prerasterize_type;
-  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
 
-    bool use_local_homography = stereo_settings().use_local_homography;
-
-    Matrix<double> lowres_hom  = math::identity_matrix<3>();
-    Matrix<double> fullres_hom = math::identity_matrix<3>();
-    ImageViewRef<InputPixelType> right_trans_img;
-    ImageViewRef<vw::uint8     > right_trans_mask;
+  /// The full-resolution search range of a tile, found from D_sub
+  /// unless the seed mode is 0. Also find the low-resolution local
+  /// homography of the tile, if used.
+  BBox2f tile_search_range(BBox2i const& bbox, double quantile,
+                           Matrix<double> & lowres_hom) const {
 
+    bool use_local_homography = stereo_settings().use_local_homography;
     bool do_round = true; // round integer disparities after transform
 
-    // User strategies
     BBox2f local_search_range;
     if ( stereo_settings().seed_mode > 0 ) {
 
@@ -938,13 +1083,13 @@ public:
       DispSeedImageType disparity_in_box = crop( m_sub_disp, seed_bbox );
 
       if (!use_local_homography){
-        local_search_range = stereo::get_disparity_range( disparity_in_box );
+        local_search_range = robust_disparity_range( disparity_in_box, quantile );
       }else{ // use local homography
         int ts = ASPGlobalOptions::corr_tile_size();
         lowres_hom = m_local_hom(bbox.min().x()/ts, bbox.min().y()/ts);
-        local_search_range = stereo::get_disparity_range
+        local_search_range = robust_disparity_range
           (transform_disparities(do_round, seed_bbox,
-			     lowres_hom, disparity_in_box));
+			     lowres_hom, disparity_in_box), quantile);
       }
 
       bool has_sub_disp_spread = ( m_sub_disp_spread.cols() != 0 &&
@@ -961,7 +1106,7 @@ public:
         SpreadImageType spread_in_box = crop( m_sub_disp_spread, seed_bbox );
 
         if (!use_local_homography){
-          BBox2f spread = stereo::get_disparity_range( spread_in_box );
+          BBox2f spread = robust_disparity_range( spread_in_box, quantile );
           local_search_range.min() -= spread.max();
           local_search_range.max() += spread.max();
         }else{
@@ -969,29 +1114,14 @@ public:
                                                                disparity_in_box + spread_in_box);
           DispSeedImageType lower_disp = transform_disparities(do_round, seed_bbox, lowres_hom,
                                                                disparity_in_box - spread_in_box);
-          BBox2f upper_range = stereo::get_disparity_range(upper_disp);
-          BBox2f lower_range = stereo::get_disparity_range(lower_disp);
+          BBox2f upper_range = robust_disparity_range(upper_disp, quantile);
+          BBox2f lower_range = robust_disparity_range(lower_disp, quantile);
 
           local_search_range = upper_range;
           local_search_range.grow(lower_range);
         } //endif use_local_homography
       } //endif has_sub_disp_spread
 
-      if (use_local_homography){
-        Vector3 upscale(     m_upscale_factor[0],     m_upscale_factor[1], 1 );
-        Vector3 dnscale( 1.0/m_upscale_factor[0], 1.0/m_upscale_factor[1], 1 );
-        fullres_hom = diagonal_matrix(upscale)*lowres_hom*diagonal_matrix(dnscale);
-
-        ImageViewRef< PixelMask<InputPixelType> >
-          right_trans_masked_img
-          = transform (copy_mask( m_right_image.impl(),
-			          create_mask(m_right_mask.impl()) ),
-	               HomographyTransform(fullres_hom),
-	               m_left_image.impl().cols(), m_left_image.impl().rows());
-        right_trans_img  = apply_mask(right_trans_masked_img);
-        right_trans_mask = channel_cast_rescale<uint8>(select_channel(right_trans_masked_img, 1));
-      } //endif use_local_homography
-
       local_search_range = grow_bbox_to_int(local_search_range);
       // Expand local_search_range by 1. This is necessary since
       // m_sub_disp is integer-valued, and perhaps the search
@@ -1019,52 +1149,205 @@ public:
       VW_OUT(DebugMessage,"stereo") << "Searching with " << stereo_settings().search_range << "\n";
     }
 
+    return local_search_range;
+  }
+
+  /// Correlate a tile with the given images and search range
+  template <class LeftT, class RightT, class LeftMaskT, class RightMaskT>
+  prerasterize_type correlate(LeftT const& left, RightT const& right,
+                              LeftMaskT const& left_mask, RightMaskT const& right_mask,
+                              BBox2i const& bbox, BBox2f const& search_range,
+                              int corr_timeout, int max_levels) const {
+
     SemiGlobalMatcher::SgmSubpixelMode sgm_subpixel_mode = get_sgm_subpixel_mode();
     Vector2i sgm_search_buffer = stereo_settings().sgm_search_buffer;
-
-    // Now we are ready to actually perform correlation
     const int rm_half_kernel = 5; // Filter kernel size used by CorrelationView
-    if (use_local_homography){
-      typedef vw::stereo::PyramidCorrelationView<ImageType, ImageViewRef<InputPixelType>, 
-                                                 MaskType,  ImageViewRef<vw::uint8     > > CorrView;
-      CorrView corr_view( m_left_image,   right_trans_img,
-                          m_left_mask,    right_trans_mask,
-                          static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode),
-                          stereo_settings().slogW,
-                          local_search_range,
-                          m_kernel_size,  m_cost_mode,
-                          m_corr_timeout, m_seconds_per_op,
-                          stereo_settings().xcorr_threshold,
-                          stereo_settings().min_xcorr_level,
-                          rm_half_kernel,
-                          stereo_settings().corr_max_levels,
-                          static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
-                          stereo_settings().sgm_collar_size,
-                          sgm_subpixel_mode, sgm_search_buffer, stereo_settings().corr_memory_limit_mb,
-                          stereo_settings().corr_blob_filter_area,
-                          stereo_settings().stereo_debug );
-      return corr_view.prerasterize(bbox);
-    }else{
-      typedef vw::stereo::PyramidCorrelationView<ImageType, ImageType, MaskType, MaskType > CorrView;
-      CorrView corr_view( m_left_image,   m_right_image,
-                          m_left_mask,    m_right_mask,
-                          static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode),
-                          stereo_settings().slogW,
-                          local_search_range,
-                          m_kernel_size,  m_cost_mode,
-                          m_corr_timeout, m_seconds_per_op,
-                          stereo_settings().xcorr_threshold,
-                          stereo_settings().min_xcorr_level,
-                          rm_half_kernel,
-                          stereo_settings().corr_max_levels,
-                          static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
-                          stereo_settings().sgm_collar_size,
-                          sgm_subpixel_mode, sgm_search_buffer, stereo_settings().corr_memory_limit_mb,
-                          stereo_settings().corr_blob_filter_area,
-                          stereo_settings().stereo_debug );
-      return corr_view.prerasterize(bbox);
+
+    typedef vw::stereo::PyramidCorrelationView<LeftT, RightT, LeftMaskT, RightMaskT> CorrView;
+    CorrView corr_view( left,      right,
+                        left_mask, right_mask,
+                        static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode),
+                        stereo_settings().slogW,
+                        search_range,
+                        m_kernel_size,  m_cost_mode,
+                        corr_timeout, m_seconds_per_op,
+                        stereo_settings().xcorr_threshold,
+                        stereo_settings().min_xcorr_level,
+                        rm_half_kernel,
+                        max_levels,
+                        static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
+                        stereo_settings().sgm_collar_size,
+                        sgm_subpixel_mode, sgm_search_buffer, stereo_settings().corr_memory_limit_mb,
+                        stereo_settings().corr_blob_filter_area,
+                        stereo_settings().stereo_debug );
+    return corr_view.prerasterize(bbox);
+  }
+
+  /// Correlate a tile of the images subsampled by the given factor,
+  /// and scale the disparity back to full resolution, each subsampled
+  /// pixel covering factor x factor pixels.
+  prerasterize_type correlate_subsampled(ImageViewRef<InputPixelType> const& right_image,
+                                         ImageViewRef<vw::uint8>      const& right_mask,
+                                         BBox2i const& bbox, BBox2f const& search_range,
+                                         int corr_timeout, int factor) const {
+
+    ImageViewRef<InputPixelType> left_sub  = subsample(m_left_image, factor);
+    ImageViewRef<InputPixelType> right_sub = subsample(right_image,  factor);
+    ImageViewRef<vw::uint8> left_mask_sub  = subsample(m_left_mask, factor);
+    ImageViewRef<vw::uint8> right_mask_sub = subsample(right_mask,  factor);
+
+    BBox2i sub_bbox(bbox.min()/factor, (bbox.max() + Vector2i(factor - 1, factor - 1))/factor);
+    sub_bbox.crop(bounding_box(left_sub));
+    BBox2f sub_range(floor(search_range.min()/double(factor)),
+                     ceil (search_range.max()/double(factor)));
+
+    // The pyramid has one level less for each halving of the images
+    int max_levels = stereo_settings().corr_max_levels;
+    for (int f = factor; f > 1 && max_levels > 0; f /= 2)
+      max_levels--;
+
+    prerasterize_type sub_disp = correlate(left_sub, right_sub, left_mask_sub, right_mask_sub,
+                                           sub_bbox, sub_range, corr_timeout, max_levels);
+
+    ImageView<pixel_type> tile(bbox.width(), bbox.height());
+    for (int row = 0; row < bbox.height(); row++) {
+      for (int col = 0; col < bbox.width(); col++) {
+        Vector2i pix = (bbox.min() + Vector2i(col, row))/factor;
+        pixel_type disp;
+        if (sub_bbox.contains(pix))
+          disp = sub_disp(pix.x(), pix.y());
+        if (is_valid(disp))
+          disp.child() *= factor;
+        else
+          invalidate(disp);
+        tile(col, row) = disp;
+      }
     }
-    
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  /// Correlate a tile at full resolution for the first attempt, and
+  /// after that with the images subsampled by 2 for each further one.
+  prerasterize_type correlate_attempt(int attempt, BBox2i const& bbox,
+                                      BBox2f const& search_range, double quantile,
+                                      ImageViewRef<InputPixelType> const& right_trans_img,
+                                      ImageViewRef<vw::uint8>      const& right_trans_mask,
+                                      int corr_timeout) const {
+
+    bool use_local_homography = stereo_settings().use_local_homography;
+    if (attempt == 0) {
+      int max_levels = stereo_settings().corr_max_levels;
+      if (use_local_homography)
+        return correlate(m_left_image, right_trans_img, m_left_mask, right_trans_mask,
+                         bbox, search_range, corr_timeout, max_levels);
+      return correlate(m_left_image, m_right_image, m_left_mask, m_right_mask,
+                       bbox, search_range, corr_timeout, max_levels);
+    }
+
+    // Leave out more of the outliers of D_sub from the search range
+    Matrix<double> hom = math::identity_matrix<3>();
+    BBox2f sub_range = tile_search_range(bbox, std::max(quantile, 0.05), hom);
+    int factor = 1 << attempt;
+    vw_out(WarningMessage) << "No disparity was found in tile " << bbox
+                           << ", so likely correlation timed out. Trying again "
+                           << "with the images subsampled by " << factor << ".\n";
+    if (use_local_homography)
+      return correlate_subsampled(right_trans_img, right_trans_mask,
+                                  bbox, sub_range, corr_timeout, factor);
+    return correlate_subsampled(m_right_image, m_right_mask,
+                                bbox, sub_range, corr_timeout, factor);
+  }
+
+  /// If no disparity at all was found, as when correlation timed out
+  static bool all_invalid(prerasterize_type const& disp, BBox2i const& bbox) {
+    for (int row = bbox.min().y(); row < bbox.max().y(); row++)
+      for (int col = bbox.min().x(); col < bbox.max().x(); col++)
+        if (is_valid(disp(col, row)))
+          return false;
+    return true;
+  }
+
+  /// If the mask has any valid pixels in the box
+  static bool has_valid_pixels(MaskType const& mask, BBox2i const& bbox) {
+    ImageView<vw::uint8> mask_tile = crop(mask, bbox);
+    for (int row = 0; row < mask_tile.rows(); row++)
+      for (int col = 0; col < mask_tile.cols(); col++)
+        if (mask_tile(col, row) > 0)
+          return true;
+    return false;
+  }
+
+  /// Does the work
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    asp::ScopedTrace trace("correlation", bbox);
+    trace.count("pixels", double(bbox.width())*bbox.height());
+
+    bool use_local_homography = stereo_settings().use_local_homography;
+    double quantile = stereo_settings().corr_search_quantile;
+
+    Matrix<double> lowres_hom  = math::identity_matrix<3>();
+    Matrix<double> fullres_hom = math::identity_matrix<3>();
+    ImageViewRef<InputPixelType> right_trans_img;
+    ImageViewRef<vw::uint8     > right_trans_mask;
+
+    // User strategies
+    BBox2f local_search_range = tile_search_range(bbox, quantile, lowres_hom);
+
+    if (stereo_settings().seed_mode > 0 && use_local_homography){
+      Vector3 upscale(     m_upscale_factor[0],     m_upscale_factor[1], 1 );
+      Vector3 dnscale( 1.0/m_upscale_factor[0], 1.0/m_upscale_factor[1], 1 );
+      fullres_hom = diagonal_matrix(upscale)*lowres_hom*diagonal_matrix(dnscale);
+
+      ImageViewRef< PixelMask<InputPixelType> >
+        right_trans_masked_img
+        = transform (copy_mask( m_right_image.impl(),
+			          create_mask(m_right_mask.impl()) ),
+	               HomographyTransform(fullres_hom),
+	               m_left_image.impl().cols(), m_left_image.impl().rows());
+      right_trans_img  = apply_mask(right_trans_masked_img);
+      right_trans_mask = channel_cast_rescale<uint8>(select_channel(right_trans_masked_img, 1));
+    } //endif use_local_homography
+
+    // The cost of a tile grows with its search range
+    trace.count("search_range_area",
+                double(local_search_range.width())*local_search_range.height());
+
+    if (!m_search_range_file.empty()) {
+      vw::Mutex::Lock lock(*m_mutex);
+      std::ofstream ofs(m_search_range_file.c_str(), std::ios::app);
+      ofs << bbox.min().x() << " " << bbox.min().y() << " "
+          << bbox.max().x() << " " << bbox.max().y() << " "
+          << local_search_range.min().x() << " " << local_search_range.min().y() << " "
+          << local_search_range.max().x() << " " << local_search_range.max().y() << "\n";
+    }
+
+    // With the fallback, the tile gets half of the time, and if it
+    // times out, it is correlated again with the images subsampled by
+    // 2 and then by 4, with the outliers of D_sub left out of the
+    // search range, each with a quarter of the time. These are much
+    // cheaper, so the tile is done in the time, with lower quality
+    // rather than with no disparity.
+    bool fallback = (stereo_settings().corr_timeout_fallback && m_corr_timeout > 0);
+    const int num_attempts = fallback ? 3 : 1;
+    for (int attempt = 0; attempt < num_attempts; attempt++) {
+
+      int corr_timeout = m_corr_timeout;
+      if (fallback)
+        corr_timeout = std::max(1, attempt == 0 ? m_corr_timeout/2 : m_corr_timeout/4);
+
+      prerasterize_type disp = correlate_attempt(attempt, bbox, local_search_range, quantile,
+                                                 right_trans_img, right_trans_mask,
+                                                 corr_timeout);
+      // A tile with no disparity over valid pixels is presumed to
+      // have timed out
+      if (attempt + 1 == num_attempts || !all_invalid(disp, bbox) ||
+          !has_valid_pixels(m_left_mask, bbox))
+        return disp;
+    }
+
+    return prerasterize_type(ImageView<pixel_type>(bbox.width(), bbox.height()),
+                             -bbox.min().x(), -bbox.min().y(), cols(), rows());
   } // End function prerasterize_helper
 
   template <class DestT>
@@ -1074,6 +1357,123 @@ public:
 }; // End class SeededCorrelatorView
 
 
+/// Saves each tile of the input disparity view to its own file once it
+/// is computed and records it in a manifest, with one line per tile
+/// having the tile bounding box. Tiles already in the manifest are read
+/// back from disk instead of being computed again. This allows resuming
+/// an interrupted correlation.
+template <class ImageT>
+class ResumableDisparityView : public ImageViewBase< ResumableDisparityView<ImageT> > {
+  ImageT      m_img;
+  std::string m_manifest, m_tile_dir;
+  std::set< std::vector<int> > m_done_tiles; // Read only once computation starts
+  boost::shared_ptr<vw::Mutex> m_mutex;      // Protects writing to the manifest
+
+  static std::vector<int> tile_key(BBox2i const& bbox) {
+    std::vector<int> key(4);
+    key[0] = bbox.min().x(); key[1] = bbox.min().y();
+    key[2] = bbox.max().x(); key[3] = bbox.max().y();
+    return key;
+  }
+
+  std::string tile_file(BBox2i const& bbox) const {
+    std::ostringstream os;
+    os << m_tile_dir << "/tile_" << bbox.min().x() << "_" << bbox.min().y() << "_"
+       << bbox.width() << "_" << bbox.height() << ".tif";
+    return os.str();
+  }
+
+  // The first line of the manifest identifies the image, so that the
+  // saved tiles are not reused for a different one.
+  std::string manifest_header() const {
+    std::ostringstream os;
+    os << "# " << m_img.cols() << " " << m_img.rows() << " " << stereo_settings().trans_crop_win;
+    return os.str();
+  }
+
+public:
+  typedef typename ImageT::pixel_type pixel_type;
+  typedef pixel_type result_type;
+  typedef ProceduralPixelAccessor<ResumableDisparityView> pixel_accessor;
+
+  ResumableDisparityView(ImageT const& img, std::string const& manifest,
+                         std::string const& tile_dir):
+    m_img(img), m_manifest(manifest), m_tile_dir(tile_dir), m_mutex(new vw::Mutex) {
+
+    // Load the list of finished tiles, if the manifest is for this image
+    std::ifstream ifs(m_manifest.c_str());
+    std::string line;
+    if (ifs && std::getline(ifs, line) && line == manifest_header()) {
+      int x0, y0, x1, y1;
+      while (ifs >> x0 >> y0 >> x1 >> y1) {
+        BBox2i bbox(Vector2i(x0, y0), Vector2i(x1, y1));
+        if (fs::exists(tile_file(bbox)))
+          m_done_tiles.insert(tile_key(bbox));
+      }
+    }
+    ifs.close();
+    if (!m_done_tiles.empty())
+      vw_out() << "Reusing " << m_done_tiles.size() << " finished tiles listed in: "
+               << m_manifest << "\n";
+
+    // Start a new manifest with the tiles which can be reused
+    fs::create_directories(m_tile_dir);
+    std::ofstream ofs(m_manifest.c_str());
+    ofs << manifest_header() << "\n";
+    for (std::set< std::vector<int> >::const_iterator it = m_done_tiles.begin();
+         it != m_done_tiles.end(); it++)
+      ofs << (*it)[0] << " " << (*it)[1] << " " << (*it)[2] << " " << (*it)[3] << "\n";
+  }
+
+  inline int32 cols  () const { return m_img.cols(); }
+  inline int32 rows  () const { return m_img.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()(double /*i*/, double /*j*/, int32 /*p*/ = 0) const {
+    vw_throw(NoImplErr() << "ResumableDisparityView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    std::string file = tile_file(bbox);
+    ImageView<pixel_type> tile;
+    if (m_done_tiles.find(tile_key(bbox)) != m_done_tiles.end()) {
+      tile = DiskImageView<pixel_type>(file);
+    } else {
+      tile = crop(m_img, bbox);
+
+      // Write to a temporary file first, so that an interruption does
+      // not leave behind a partially written tile.
+      std::string tmp_file = file + ".tmp.tif";
+      vw::write_image(tmp_file, tile);
+      fs::rename(tmp_file, file);
+
+      vw::Mutex::Lock lock(*m_mutex);
+      std::ofstream ofs(m_manifest.c_str(), std::ios::app);
+      ofs << bbox.min().x() << " " << bbox.min().y() << " "
+          << bbox.max().x() << " " << bbox.max().y() << "\n";
+    }
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+template <class ImageT>
+ResumableDisparityView<ImageT> resumable_disparity(ImageT const& img,
+                                                   std::string const& manifest,
+                                                   std::string const& tile_dir){
+  return ResumableDisparityView<ImageT>(img, manifest, tile_dir);
+}
+
 /// Main stereo correlation function, called after parsing input arguments.
 void stereo_correlation( ASPGlobalOptions& opt ) {
 
@@ -1125,8 +1525,9 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
   if ( stereo_settings().seed_mode > 0 )
     sub_disp = DiskImageView<PixelMask<Vector2f> >(dsub_file);
   ImageViewRef<PixelMask<Vector2i> > sub_disp_spread;
-  if ( stereo_settings().seed_mode == 2 ||  stereo_settings().seed_mode == 3 ){
-    // D_sub_spread is mandatory for seed_mode 2 and 3.
+  if ( stereo_settings().seed_mode == 2 || stereo_settings().seed_mode == 3 ||
+       stereo_settings().seed_mode == 4 ){
+    // D_sub_spread is mandatory for seed_mode 2, 3, and 4.
     sub_disp_spread = DiskImageView<PixelMask<Vector2i> >(spread_file);
   }else if ( stereo_settings().seed_mode == 1 ){
     // D_sub_spread is optional for seed_mode 1, we use it only if it is provided.
@@ -1152,13 +1553,32 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
   if (corr_timeout > 0)
     seconds_per_op = calc_seconds_per_op(cost_mode, left_disk_image, right_disk_image, kernel_size);
 
+  string search_range_file;
+  if (stereo_settings().corr_save_search_ranges)
+    search_range_file = opt.out_prefix + "-corr-search-ranges.txt";
+
   // Set up the reference to the stereo disparity code
   // - Processing is limited to trans_crop_win for use with parallel_stereo.
   ImageViewRef<PixelMask<Vector2f> > fullres_disparity =
-    crop(SeededCorrelatorView( left_disk_image, right_disk_image, Lmask, Rmask,
-                               sub_disp, sub_disp_spread, local_hom, kernel_size, 
-                               cost_mode, corr_timeout, seconds_per_op ), 
-         trans_crop_win);
+    SeededCorrelatorView( left_disk_image, right_disk_image, Lmask, Rmask,
+                          sub_disp, sub_disp_spread, local_hom, kernel_size, 
+                          cost_mode, corr_timeout, seconds_per_op,
+                          search_range_file );
+
+  // Fit the parabola to each tile right after it is correlated, while
+  // the image tiles it needs are still in the cache. Then stereo_rfne
+  // need not read the images and D.tif again.
+  bool subpixel_in_corr = stereo_settings().subpixel_in_corr;
+  if (subpixel_in_corr) {
+    vw_out() << "\t--> Using parabola subpixel mode during correlation.\n";
+    PrefilterModeType prefilter_mode =
+      static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode);
+    fullres_disparity = parabola_subpixel(fullres_disparity,
+                                          left_disk_image, right_disk_image,
+                                          prefilter_mode, stereo_settings().slogW,
+                                          stereo_settings().subpixel_kernel);
+  }
+  fullres_disparity = crop(fullres_disparity, trans_crop_win);
 
   // With SGM, we must do the entire image chunk as one tile. Otherwise,
   // if it gets done in smaller tiles, there will be artifacts at tile boundaries.
@@ -1194,6 +1614,13 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
   bool   has_nodata      = false;
   double nodata          = -32768.0;
 
+  // When resuming is enabled, each finished tile is saved separately,
+  // as a partially written D.tif cannot be read back.
+  string manifest_file = opt.out_prefix + "-D-manifest.txt";
+  string tile_dir      = opt.out_prefix + "-D-tiles";
+  if (stereo_settings().corr_resume)
+    fullres_disparity = resumable_disparity(fullres_disparity, manifest_file, tile_dir);
+
   string d_file = opt.out_prefix + "-D.tif";
   vw_out() << "Writing: " << d_file << "\n";
   if (stereo_settings().stereo_algorithm > vw::stereo::CORRELATION_WINDOW) {
@@ -1209,6 +1636,14 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
 			        has_nodata, nodata, opt,
 			        TerminalProgressCallback("asp", "\t--> Correlation :") );
 			        
+  } else if (subpixel_in_corr) {
+    // Write what stereo_rfne would have written to RD.tif
+    vw::cartography::block_write_gdal_image(d_file,
+              round_disparity(fullres_disparity,
+                              stereo_settings().disparity_rounding_error),
+			        has_left_georef, left_georef,
+			        has_nodata, nodata, float_write_options(opt),
+			        TerminalProgressCallback("asp", "\t--> Correlation :") );
   } else {
     // Otherwise cast back to integer results to save on storage space.
     vw::cartography::block_write_gdal_image(d_file, 
@@ -1218,12 +1653,51 @@ void stereo_correlation( ASPGlobalOptions& opt ) {
 			        TerminalProgressCallback("asp", "\t--> Correlation :") );
   }
 
+  // The saved tiles are no longer needed once D.tif is complete
+  if (stereo_settings().corr_resume) {
+    fs::remove_all(tile_dir);
+    fs::remove(manifest_file);
+  }
+
   vw_out() << "\n[ " << current_posix_time_string() << " ] : CORRELATION FINISHED \n";
 
 } // End function stereo_correlation
 
+/// The correlation kernels are Vision Workbench templates instantiated
+/// in this file. On x86_64 a second build of this program,
+/// stereo_corr_avx2, has them compiled for AVX2 and FMA. If the CPU
+/// supports those and that build is installed next to this one, or in
+/// the libexec directory, switch to it. It cannot be linked into the
+/// same executable, as the two sets of template instances would clash.
+void switch_to_avx2_build(char* argv[]) {
+#if defined(__x86_64__) && !defined(ASP_STEREO_CORR_AVX2)
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("fma"))
+    return;
+
+  fs::path self(argv[0]);
+  if (!self.has_parent_path())
+    return; // found in the PATH, so its location is not known
+
+  const char * name = "stereo_corr_avx2";
+  std::vector<fs::path> candidates;
+  candidates.push_back(self.parent_path() / name);
+  candidates.push_back(self.parent_path() / ".." / "libexec" / name);
+  for (size_t i = 0; i < candidates.size(); i++) {
+    if (!fs::exists(candidates[i]))
+      continue;
+    std::string path = candidates[i].string();
+    execv(path.c_str(), argv);
+    // If execv() returns, it failed, so keep running this build
+    return;
+  }
+#endif
+}
+
 int main(int argc, char* argv[]) {
 
+  switch_to_avx2_build(argv);
+
   //try {
     xercesc::XMLPlatformUtils::Initialize();
 
@@ -194,6 +194,8 @@ int main(int argc, char** argv) {
       for (size_t i = 0; i < images.size(); i++) {
         vw::gui::imageData img;
         img.read(images[i], opt_vec[0], stereo_settings().use_georef);
+        if (!img.isPoly())
+          img.img.load(); // pyramids are otherwise built on first use
       }
       return 0;
     }
@@ -21,6 +21,7 @@
 /// This program is to allow python access to stereo settings.
 
 #include <asp/Tools/stereo.h>
+#include <vw/Core/Settings.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <asp/Sessions/StereoSession.h>
@@ -32,6 +33,17 @@ using namespace asp;
 using namespace std;
 namespace fs = boost::filesystem;
 
+namespace {
+  // Print the names of the options in a group, on one line
+  void print_option_names(std::string const& key,
+                          boost::program_options::options_description const& desc) {
+    vw_out() << key;
+    for (size_t i = 0; i < desc.options().size(); i++)
+      vw_out() << "," << desc.options()[i]->long_name();
+    vw_out() << endl;
+  }
+}
+
 int main( int argc, char* argv[] ) {
 
   try {
@@ -125,6 +137,31 @@ int main( int argc, char* argv[] ) {
       vw_out() << "collar_size," << 0 << endl;
     else
       vw_out() << "collar_size," << stereo_settings().sgm_collar_size << endl;
+    vw_out() << "sgm_max_tile_size," << asp::sgm_max_tile_size() << endl;
+
+    // Used by parallel_stereo to fit the tile sizes and the number of
+    // processes and threads to --memory-limit
+    vw_out() << "corr_max_tile_size," << asp::max_corr_tile_size() << endl;
+    vw_out() << "corr_tile_memory_mb,"
+             << asp::corr_tile_memory_mb(stereo_settings().corr_tile_size_ovr) << endl;
+    vw_out() << "rfne_tile_memory_mb," << asp::rfne_tile_memory_mb() << endl;
+    vw_out() << "tri_tile_memory_mb,"  << asp::tri_tile_memory_mb()  << endl;
+    vw_out() << "cache_size_mb,"
+             << vw_settings().system_cache_size() / (1024.0 * 1024.0) << endl;
+
+    vw_out() << "fuse_rfne_fltr_tri," << stereo_settings().fuse_rfne_fltr_tri << endl;
+    vw_out() << "direct_dem_spacing,"    << stereo_settings().direct_dem_spacing    << endl;
+    vw_out() << "direct_dem_errorimage," << stereo_settings().direct_dem_errorimage << endl;
+    vw_out() << "subpixel_in_corr,"   << stereo_settings().subpixel_in_corr   << endl;
+    vw_out() << "quick_look,"         << stereo_settings().quick_look         << endl;
+
+    // The options which affect each stage, so that stereo can tell if
+    // a stage must be redone when it is run again
+    print_option_names("pprc_options", PreProcessingDescription());
+    print_option_names("corr_options", CorrelationDescription());
+    print_option_names("rfne_options", SubpixelDescription());
+    print_option_names("fltr_options", FilteringDescription());
+    print_option_names("tri_options",  TriangulationDescription());
 
     // This block of code should be in its own executable but I am
     // reluctant to create one just for it. This functionality will be
@@ -26,6 +26,7 @@
 #include <vw/Math/Functors.h>
 #include <asp/Tools/stereo.h>
 #include <asp/Core/ThreadedEdgeMask.h>
+#include <asp/Core/ImageStatistics.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <xercesc/util/PlatformUtils.hpp>
@@ -56,6 +57,13 @@ inline mask_above_threshold( ImageViewBase<ImageT> const& image, double threshol
                                                         MaskAboveThreshold(threshold) );
 }
 
+/// Otsu's optimal threshold of a set of pixel values.
+double values_optimal_threshold(std::vector<float> const& values) {
+  ImageView<float> img(values.size(), 1);
+  std::copy(values.begin(), values.end(), img.data());
+  return optimal_threshold(img);
+}
+
 struct BlobHolder {
   // This object will ensure that the current BlobIndexThreaded object
   // is not de-allocated while still being used to fill holes in a
@@ -248,19 +256,29 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
       vw_throw( ArgumentErr() << "\nCannot set both nodata-pixel-percentage and "
                               << "nodata-optimal-threshold-factor at the same time.\n");
     }
-    if ( !isnan(nodata_factor) ){
-      // Find the black pixels threshold using Otsu's optimal threshold method.
-      left_threshold  = nodata_factor*optimal_threshold(left_image );
-      right_threshold = nodata_factor*optimal_threshold(right_image);
-    }
-    if ( !isnan(nodata_fraction) ){
-      // Declare a fixed proportion of low-value pixels to be no-data.
-      math::CDFAccumulator< PixelGray<float> > left_cdf (1024, 1024),
-                                               right_cdf(1024, 1024);
-      for_each_pixel(left_image,  left_cdf );
-      for_each_pixel(right_image, right_cdf);
-      left_threshold  = left_cdf.quantile (nodata_fraction);
-      right_threshold = right_cdf.quantile(nodata_fraction);
+    if ( !isnan(nodata_factor) || !isnan(nodata_fraction) ){
+      // Both thresholds are found from pixels sampled on a grid
+      double num_samples = stats_sample_count(stereo_settings().stats_quantile_error);
+      std::vector<float> left_values, right_values;
+      sample_valid_values(left_image,
+                          stats_sample_step(left_image.cols(), left_image.rows(), num_samples),
+                          0, left_values);
+      sample_valid_values(right_image,
+                          stats_sample_step(right_image.cols(), right_image.rows(), num_samples),
+                          0, right_values);
+      if (left_values.empty() || right_values.empty())
+        vw_throw( ArgumentErr() << "\nCannot find no-data thresholds for empty images.\n");
+
+      if ( !isnan(nodata_factor) ){
+        // Find the black pixels threshold using Otsu's optimal threshold method.
+        left_threshold  = nodata_factor*values_optimal_threshold(left_values );
+        right_threshold = nodata_factor*values_optimal_threshold(right_values);
+      }
+      if ( !isnan(nodata_fraction) ){
+        // Declare a fixed proportion of low-value pixels to be no-data.
+        left_threshold  = sample_quantile(left_values,  nodata_fraction);
+        right_threshold = sample_quantile(right_values, nodata_fraction);
+      }
     }
 
     // The blob holders must not go out of scope while masks are being written.
@@ -24,11 +24,19 @@
 #include <vw/Stereo/StereoView.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <vw/InterestPoint/InterestData.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 
 #include <asp/Camera/RPCModel.h>
 #include <asp/Tools/stereo.h>
 #include <asp/Tools/jitter_adjust.h>
 #include <asp/Tools/ccd_adjust.h>
+#include <asp/Tools/refine_filter.h>
+#include <asp/Core/Trace.h>
+#include <asp/Core/TilePool.h>
+#include <asp/Core/PointCloudStats.h>
+#include <asp/Core/DemSplatter.h>
+#include <asp/Core/PointUtils.h>
 
 // We must have the implementations of all sessions for triangulation
 #include <asp/Sessions/StereoSessionFactory.h>
@@ -40,6 +48,8 @@
 #include <asp/Sessions/StereoSessionSpot.h>
 #include <asp/Sessions/StereoSessionASTER.h>
 #include <xercesc/util/PlatformUtils.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/math/special_functions/fpclassify.hpp>
 #include <ctime>
 
 using namespace vw;
@@ -65,6 +75,7 @@ class StereoTXAndErrorView : public ImageViewBase<StereoTXAndErrorView<Disparity
   vector<TXT>  m_transforms; // e.g., map-projection or homography to undo
   StereoModelT m_stereo_model;
   bool         m_is_map_projected;
+  bool         m_parallel_pairs; // Read and de-warp the pairs of a tile in parallel
   typedef typename DisparityImageT::pixel_type DPixelT;
 
 public:
@@ -77,11 +88,12 @@ public:
   StereoTXAndErrorView( vector<DisparityImageT> const& disparity_maps,
                         vector<TXT>             const& transforms,
                         StereoModelT            const& stereo_model,
-                        bool is_map_projected) :
+                        bool is_map_projected, bool parallel_pairs) :
     m_disparity_maps(disparity_maps),
     m_transforms(transforms),
     m_stereo_model(stereo_model),
-    m_is_map_projected(is_map_projected) {
+    m_is_map_projected(is_map_projected),
+    m_parallel_pairs(parallel_pairs) {
 
     // Sanity check
     for (int p = 1; p < (int)m_disparity_maps.size(); p++){
@@ -105,16 +117,8 @@ public:
     int num_disp = m_disparity_maps.size();
     vector<Vector2> pixVec(num_disp + 1);
     pixVec[0] = m_transforms[0].reverse(Vector2(i,j)); // De-warp "left" pixel
-    for (int c = 0; c < num_disp; c++){
-      Vector2 pix;
-      DPixelT disp = m_disparity_maps[c](i,j,p); // Disparity value at this pixel
-      if (is_valid(disp)) // De-warp the "right" pixel
-        pix = m_transforms[c+1].reverse( Vector2(i,j) + stereo::DispHelper(disp) );
-      else // Insert flag values
-        pix = Vector2(std::numeric_limits<double>::quiet_NaN(),
-                      std::numeric_limits<double>::quiet_NaN());
-      pixVec[c+1] = pix;
-    }
+    for (int c = 0; c < num_disp; c++)
+      pixVec[c+1] = right_pixel(m_transforms[c+1], Vector2(i,j), m_disparity_maps[c](i,j,p));
 
     // Compute the location of the 3D point observed by each input pixel
     Vector3 errorVec;
@@ -124,74 +128,129 @@ public:
     return result; // Contains location and error vector
   }
 
-  typedef StereoTXAndErrorView<ImageViewRef<DPixelT>, TXT, StereoModelT> prerasterize_type;
+  /// Triangulate the whole box at once. The disparities are read into
+  /// memory first, and the right pixels of each pair are de-warped for
+  /// the whole box, before the points are triangulated. With several
+  /// pairs, the pairs are done at the same time, so that the reads of
+  /// their disparities overlap.
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return PreRasterHelper( bbox, m_transforms );
-  }
-  template <class DestT>
-  inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
-    vw::rasterize( prerasterize(bbox), dest, bbox );
-  }
 
-private:
+    asp::ScopedTrace trace("triangulation", bbox);
+    trace.count("pixels", double(bbox.width())*bbox.height());
 
-  /// RPC Map Transform needs to be explicitly copied and told to cache for performance.
-  template <class T>
-  prerasterize_type PreRasterHelper( BBox2i const& bbox, vector<T> const& transforms) const {
-
-    // Code for NON-MAP-PROJECTED session types.
-    if (m_is_map_projected == false) {
-      // We explicitly bring in-memory the disparities for the current box
-      // to speed up processing later, and then we pretend this is the entire
-      // image by virtually enlarging it using a CropView.
-      vector< ImageViewRef<DPixelT> > disparity_cropviews;
-      for (int p = 0; p < (int)m_disparity_maps.size(); p++){
-        ImageView<DPixelT> clip( crop( m_disparity_maps[p], bbox ) );
-        ImageViewRef<DPixelT> cropview_clip = crop(clip, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
-        disparity_cropviews.push_back(cropview_clip);
+    int num_disp = m_disparity_maps.size();
+    vector<TXT> transforms = m_transforms;
+    if (m_is_map_projected) {
+      if (transforms.size() != m_disparity_maps.size() + 1){
+        vw_throw( ArgumentErr() << "In multi-view triangulation, "
+                  << "the number of disparities must be one less "
+                  << "than the number of images." );
       }
 
-      return prerasterize_type(disparity_cropviews, transforms, m_stereo_model, m_is_map_projected);
+      // This is to help any transforms (right now just Map2CamTrans)
+      // that must cache their side data. Normally this would happen if
+      // we were using a TransformView. Copies are made of the
+      // transforms so we are not having a race condition with setting
+      // the cache in both transforms while the other threads want to do the same.
+      transforms[0].reverse_bbox(bbox); // As a side effect this call makes transforms create a local cache we want later
     }
 
-    // Code for MAP-PROJECTED session types.
-
-    // This is to help any transforms (right now just Map2CamTrans)
-    // that must cache their side data. Normally this would happen if
-    // we were using a TransformView. Copies are made of the
-    // transforms so we are not having a race condition with setting
-    // the cache in both transforms while the other threads want to do the same.
-    vector<T> transforms_copy = transforms;
-    transforms_copy[0].reverse_bbox(bbox); // As a side effect this call makes transforms_copy create a local cache we want later
+    // The buffers of the right pixels are reused from tile to tile
+    vector< boost::shared_ptr< asp::ScratchImage<Vector2> > > right_bufs(num_disp);
+    vector< ImageView<Vector2>* > right_pixels(num_disp);
+    for (int c = 0; c < num_disp; c++) {
+      right_bufs[c].reset(new asp::ScratchImage<Vector2>(bbox.width(), bbox.height()));
+      right_pixels[c] = &(**right_bufs[c]);
+    }
+    if (m_parallel_pairs && num_disp > 1) {
+      FifoWorkQueue queue(num_disp);
+      for (int c = 0; c < num_disp; c++)
+        queue.add_task(boost::shared_ptr<Task>
+                       (new PairPixelsTask(m_disparity_maps[c], transforms[c+1], bbox,
+                                           m_is_map_projected, *right_pixels[c])));
+      queue.join_all();
+    }else{
+      for (int c = 0; c < num_disp; c++)
+        PairPixelsTask(m_disparity_maps[c], transforms[c+1], bbox,
+                       m_is_map_projected, *right_pixels[c])();
+    }
 
-    if (transforms_copy.size() != m_disparity_maps.size() + 1){
-      vw_throw( ArgumentErr() << "In multi-view triangulation, "
-                << "the number of disparities must be one less "
-                << "than the number of images." );
+    vector<Vector2> pixVec(num_disp + 1);
+    Vector3 errorVec;
+    ImageView<pixel_type> tile(bbox.width(), bbox.height());
+    for (int row = 0; row < bbox.height(); row++) {
+      for (int col = 0; col < bbox.width(); col++) {
+        Vector2 pix(bbox.min().x() + col, bbox.min().y() + row);
+        pixVec[0] = transforms[0].reverse(pix); // De-warp "left" pixel
+        for (int c = 0; c < num_disp; c++)
+          pixVec[c+1] = (*right_pixels[c])(col, row);
+
+        errorVec = Vector3();
+        pixel_type & result = tile(col, row);
+        subvector(result,0,3) = m_stereo_model(pixVec, errorVec);
+        subvector(result,3,3) = errorVec;
+      }
     }
 
-    vector< ImageViewRef<DPixelT> > disparity_cropviews;
-    for (int p = 0; p < (int)m_disparity_maps.size(); p++){
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+  template <class DestT>
+  inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+    vw::rasterize( prerasterize(bbox), dest, bbox );
+  }
+
+private:
 
-      // We explicitly bring in-memory the disparities for the current
-      // box to speed up processing later, and then we pretend this is
-      // the entire image by virtually enlarging it using a CropView.
-      ImageView<DPixelT> clip( crop( m_disparity_maps[p], bbox ) );
-      ImageViewRef<DPixelT> cropview_clip = crop(clip, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
-      disparity_cropviews.push_back(cropview_clip);
+  /// De-warp the "right" pixel in the given image for the given left
+  /// pixel and disparity, or return NaN if the disparity is invalid.
+  static Vector2 right_pixel(TXT const& transform, Vector2 const& pix, DPixelT const& disp) {
+    if (is_valid(disp))
+      return transform.reverse(pix + stereo::DispHelper(disp));
+    return Vector2(std::numeric_limits<double>::quiet_NaN(), // Insert flag values
+                   std::numeric_limits<double>::quiet_NaN());
+  }
 
-      // Work out what spots in the right image we'll be touching.
-      BBox2i disparity_range = stereo::get_disparity_range(clip);
-      disparity_range.max() += Vector2i(1,1);
-      BBox2i right_bbox = bbox + disparity_range.min();
-      right_bbox.max() += disparity_range.size();
+  /// Bring in memory the disparity of one pair for the given box, and
+  /// de-warp the right pixel for each of its pixels. Each pair has its
+  /// own copy of the transform.
+  class PairPixelsTask : public Task, private boost::noncopyable {
+    DisparityImageT const& m_disparity;
+    TXT                  & m_transform;
+    BBox2i                 m_bbox;
+    bool                   m_is_map_projected;
+    ImageView<Vector2>   & m_right_pixels;
+  public:
+    PairPixelsTask(DisparityImageT const& disparity, TXT & transform, BBox2i const& bbox,
+                   bool is_map_projected, ImageView<Vector2> & right_pixels):
+      m_disparity(disparity), m_transform(transform), m_bbox(bbox),
+      m_is_map_projected(is_map_projected), m_right_pixels(right_pixels) {}
+
+    virtual void operator()() {
+      asp::ScratchImage<DPixelT> clip_buf(m_bbox.width(), m_bbox.height());
+      ImageView<DPixelT> & clip = *clip_buf;
+      vw::rasterize(crop(m_disparity, m_bbox), clip);
+
+      if (m_is_map_projected) {
+        // Work out what spots in the right image we'll be touching.
+        BBox2i disparity_range = stereo::get_disparity_range(clip);
+        disparity_range.max() += Vector2i(1,1);
+        BBox2i right_bbox = m_bbox + disparity_range.min();
+        right_bbox.max() += disparity_range.size();
+
+        // Also cache the data for subsequent transforms
+        m_transform.reverse_bbox(right_bbox); // As a side effect this call makes transforms create a local cache we want later
+      }
 
-      // Also cache the data for subsequent transforms
-      transforms_copy[p+1].reverse_bbox(right_bbox); // As a side effect this call makes transforms_copy create a local cache we want later
+      m_right_pixels.set_size(clip.cols(), clip.rows());
+      for (int row = 0; row < clip.rows(); row++) {
+        for (int col = 0; col < clip.cols(); col++) {
+          Vector2 pix(m_bbox.min().x() + col, m_bbox.min().y() + row);
+          m_right_pixels(col, row) = right_pixel(m_transform, pix, clip(col, row));
+        }
+      }
     }
-
-    return prerasterize_type(disparity_cropviews, transforms_copy, m_stereo_model, m_is_map_projected);
-  } // End function PreRasterHelper() DGMapRPC version
+  };
 
 }; // End class StereoTXAndErrorView
 
@@ -201,13 +260,169 @@ StereoTXAndErrorView<DisparityT, TXT, StereoModelT>
 stereo_error_triangulate( vector<DisparityT> const& disparities,
                           vector<TXT>        const& transforms,
                           StereoModelT       const& model,
-                          bool is_map_projected ) {
+                          bool is_map_projected, bool parallel_pairs ) {
 
   typedef StereoTXAndErrorView<DisparityT, TXT, StereoModelT> result_type;
-  return result_type( disparities, transforms, model, is_map_projected );
+  return result_type( disparities, transforms, model, is_map_projected, parallel_pairs );
 }
 
-// Take a given disparity and make it between the original unaligned images
+/// Undo the alignment of the left and right images. For pinhole
+/// cameras with epipolar alignment the transforms are of another type
+/// than the ones passed in, and there is no base pointer for all
+/// transforms, so both kinds are kept.
+template <class TXT>
+struct DispMatchAlignment {
+  TXT const& left_trans;
+  TXT const& right_trans;
+  asp::PinholeCamTrans const& left_trans2;
+  asp::PinholeCamTrans const& right_trans2;
+  bool usePinholeEpipolar;
+
+  DispMatchAlignment(TXT const& left, TXT const& right,
+                     asp::PinholeCamTrans const& left2, asp::PinholeCamTrans const& right2,
+                     bool use_pinhole):
+    left_trans(left), right_trans(right), left_trans2(left2), right_trans2(right2),
+    usePinholeEpipolar(use_pinhole){}
+
+  Vector2 left_forward(Vector2 const& pix) const {
+    return usePinholeEpipolar ? left_trans2.forward(pix) : left_trans.forward(pix);
+  }
+  Vector2 left_reverse(Vector2 const& pix) const {
+    return usePinholeEpipolar ? left_trans2.reverse(pix) : left_trans.reverse(pix);
+  }
+  Vector2 right_reverse(Vector2 const& pix) const {
+    return usePinholeEpipolar ? right_trans2.reverse(pix) : right_trans.reverse(pix);
+  }
+};
+
+/// The disparity between the original unaligned images, computed one
+/// tile of the left image at a time. Each aligned disparity pixel is
+/// moved to the left image pixel it comes from, and the result is
+/// averaged over the neighbors of that pixel. A tile needs only the
+/// aligned disparities which land within a pixel of it, found by
+/// mapping the tile to the aligned domain.
+template <class DisparityT, class TXT>
+class UnalignDisparityView: public ImageViewBase< UnalignDisparityView<DisparityT, TXT> > {
+  typedef typename DisparityT::pixel_type DispPixelT;
+
+  DisparityT           m_disp;
+  TXT                  m_left_trans, m_right_trans;
+  asp::PinholeCamTrans m_left_trans2, m_right_trans2;
+  bool                 m_use_pinhole_epipolar;
+  Vector2i             m_size;
+
+public:
+  UnalignDisparityView(DisparityT const& disp, TXT const& left_trans, TXT const& right_trans,
+                       asp::PinholeCamTrans const& left_trans2,
+                       asp::PinholeCamTrans const& right_trans2,
+                       bool use_pinhole_epipolar, Vector2i const& size):
+    m_disp(disp), m_left_trans(left_trans), m_right_trans(right_trans),
+    m_left_trans2(left_trans2), m_right_trans2(right_trans2),
+    m_use_pinhole_epipolar(use_pinhole_epipolar), m_size(size) {}
+
+  typedef DispPixelT pixel_type;
+  typedef pixel_type result_type;
+  typedef ProceduralPixelAccessor<UnalignDisparityView> pixel_accessor;
+
+  inline int32 cols  () const { return m_size[0]; }
+  inline int32 rows  () const { return m_size[1]; }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "UnalignDisparityView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    // Copies of the transforms, as some of them cache data
+    TXT left_trans = m_left_trans, right_trans = m_right_trans;
+    asp::PinholeCamTrans left_trans2 = m_left_trans2, right_trans2 = m_right_trans2;
+    DispMatchAlignment<TXT> align(left_trans, right_trans, left_trans2, right_trans2,
+                                  m_use_pinhole_epipolar);
+
+    ImageView<pixel_type> tile(bbox.width(), bbox.height());
+    asp::ScratchImage<int> count_buf(bbox.width(), bbox.height());
+    ImageView<int> & count = *count_buf;
+    for (int col = 0; col < tile.cols(); col++) {
+      for (int row = 0; row < tile.rows(); row++) {
+        tile(col, row) = pixel_type();
+        tile(col, row).invalidate();
+        count(col, row) = 0;
+      }
+    }
+
+    // The aligned pixels which can land within a pixel of this tile,
+    // with some slack for the rounding.
+    BBox2i left_box = bbox;
+    left_box.expand(2);
+    BBox2 aligned_box = m_use_pinhole_epipolar ?
+      left_trans2.forward_bbox(left_box) : left_trans.forward_bbox(left_box);
+    BBox2i disp_box(floor(aligned_box.min().x()), floor(aligned_box.min().y()), 0, 0);
+    disp_box.max() = Vector2i(ceil(aligned_box.max().x()), ceil(aligned_box.max().y()));
+    disp_box.expand(2);
+    disp_box.crop(bounding_box(m_disp));
+    if (disp_box.empty())
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+
+    asp::ScratchImage<DispPixelT> disp_buf(disp_box.width(), disp_box.height());
+    ImageView<DispPixelT> & disp = *disp_buf;
+    vw::rasterize(crop(m_disp, disp_box), disp);
+
+    // Same order as over the whole disparity, so the sums are the same
+    for (int col = 0; col < disp.cols(); col++) {
+      for (int row = 0; row < disp.rows(); row++) {
+
+        DispPixelT dpix = disp(col, row);
+        if (!is_valid(dpix))
+          continue;
+
+        // De-warp left and right pixels to be in the camera coordinate system
+        Vector2 pix = Vector2(col, row) + disp_box.min();
+        Vector2 left_pix  = align.left_reverse(pix);
+        Vector2 right_pix = align.right_reverse(pix + stereo::DispHelper(dpix));
+        Vector2 dir = right_pix - left_pix; // disparity value
+
+        // This averaging is useful in filling tiny holes and avoiding staircasing.
+        // TODO: Use some weights. The closer contribution should have more weight.
+        for (int icol = -1; icol <= 1; icol++) {
+          for (int irow = -1; irow <= 1; irow++) {
+            int lcol = round(left_pix[0]) + icol - bbox.min().x();
+            int lrow = round(left_pix[1]) + irow - bbox.min().y();
+            if (lcol < 0 || lcol >= tile.cols())  continue;
+            if (lrow < 0 || lrow >= tile.rows())  continue;
+            if (!is_valid(tile(lcol, lrow))) tile(lcol, lrow).validate();
+            tile(lcol, lrow).child() += dir;
+            count(lcol, lrow)++;
+          }
+        }
+      }
+    }
+
+    for (int col = 0; col < tile.cols(); col++) {
+      for (int row = 0; row < tile.rows(); row++) {
+        if (count(col, row ) == 0) {
+          tile(col, row).invalidate();
+        } else{
+          tile(col, row) /= double(count(col, row));
+        }
+      }
+    }
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+// Take a given disparity and make it between the original unaligned images.
+// The tiles of the result are computed in parallel as they are written.
 template <class DisparityT, class TXT>
 void unalign_disparity(vector<ASPGlobalOptions> const& opt_vec,
                                vector<DisparityT> const& disparities,
@@ -218,10 +433,6 @@ void unalign_disparity(vector<ASPGlobalOptions> const& opt_vec,
                vw::ArgumentErr() << "Expecting two images and one disparity.\n" );
   DisparityT const& disp = disparities[0]; // pull the disparity
 
-  // Transforms to compensate for alignment
-  TXT left_trans  = transforms[0];
-  TXT right_trans = transforms[1];
-
   // Since all our code is templated, and for pinhole cameras
   // there can be more than one type of transform, and there is no base
   // pointer for all transforms, need to do this kludge.
@@ -240,86 +451,234 @@ void unalign_disparity(vector<ASPGlobalOptions> const& opt_vec,
     pinPtr->pinhole_cam_trans(left_trans2, right_trans2);
   }
 
-  std::string left_file = opt_vec[0].in_file1;
-  std::string right_file = opt_vec[0].in_file2;
-  std::string prefix = opt_vec[0].out_prefix;
+  DiskImageView<float> left_img(opt_vec[0].in_file1);
+  UnalignDisparityView<DisparityT, TXT>
+    unaligned_disp(disp, transforms[0], transforms[1], left_trans2, right_trans2,
+                   usePinholeEpipolar, Vector2i(left_img.cols(), left_img.rows()));
 
+  vw_out() << "Unwarping the disparity.\n";
+  vw_out() << "Writing: " << disp_file << std::endl;
+
+  cartography::GeoReference left_georef;
+  bool   has_left_georef = false;
+  bool   has_nodata      = false;
+  double nodata          = -32768.0;
+  if ( (opt_vec[0].session->name() == "isis") || (opt_vec[0].session->name() == "isismapisis")){
+    // ISIS does not support multi-threading
+    vw::cartography::write_gdal_image(disp_file, unaligned_disp,
+                                      has_left_georef, left_georef,
+                                      has_nodata, nodata, opt_vec[0],
+                                      TerminalProgressCallback("asp", "\t--> Undist disp:") );
+  }else{
+    vw::cartography::block_write_gdal_image(disp_file, unaligned_disp,
+                                            has_left_georef, left_georef,
+                                            has_nodata, nodata, opt_vec[0],
+                                            TerminalProgressCallback("asp", "\t--> Undist disp:") );
+  }
+}
+
+/// The ways in which matches are pulled from the disparity.
+enum DispMatchPass {
+  DISP_MATCH_BIN_CENTERS, // Disparity at the center of each bin
+  DISP_MATCH_LEFT_GRID,   // Left pixels at integer multiples of the bin length
+  DISP_MATCH_RIGHT_GRID   // Right pixels at integer multiples of the bin length
+};
+
+/// Pull the matches of a range of columns, which are columns of bins for
+/// the first two passes and columns of the disparity for the last one.
+/// The matches are kept in the order they are found, so that the result
+/// does not depend on the number of threads.
+template <class DisparityT, class TXT>
+class DispMatchTask: public Task, private boost::noncopyable {
   typedef typename DisparityT::pixel_type DispPixelT;
 
-  DiskImageView<float> left_img(left_file);
-  ImageView<DispPixelT> unaligned_disp(left_img.cols(), left_img.rows());
-  ImageView<int> count(left_img.cols(), left_img.rows());
-  for (int col = 0; col < left_img.cols(); col++) {
-    for (int row = 0; row < left_img.rows(); row++) {
-      unaligned_disp(col, row) = DispPixelT();
-      unaligned_disp(col, row).invalidate();
-      count(col, row) = 0; 
+  DisparityT                 const& m_disp;
+  DispMatchAlignment<TXT>    const& m_align;
+  DispMatchPass                     m_pass;
+  double                            m_bin_len;
+  Vector2i                          m_num_bins;  // For the first two passes
+  Vector2i                          m_img_size;  // Of the left image, for the second pass
+  int                               m_beg, m_end;
+  std::vector<Vector2>            & m_left_pix;
+  std::vector<Vector2>            & m_right_pix;
+  vw::TerminalProgressCallback    & m_tpc;
+  double                            m_inc_amount;
+  vw::Mutex                       & m_mutex;
+
+  void bin_centers() {
+    for (int binx = m_beg; binx < m_end; binx++) {
+
+      // Pick the disparity at the center of the bin
+      int posx = round( (binx+0.5)*m_bin_len );
+
+      for (int biny = 0; biny < m_num_bins[1]; biny++) {
+
+        int posy = round( (biny+0.5)*m_bin_len );
+
+        if (posx >= m_disp.cols() || posy >= m_disp.rows())
+          continue;
+        DispPixelT dpix = m_disp(posx, posy);
+        if (!is_valid(dpix))
+          continue;
+
+        // De-warp left and right pixels to be in the camera coordinate system
+        m_left_pix.push_back (m_align.left_reverse (Vector2(posx, posy)));
+        m_right_pix.push_back(m_align.right_reverse(Vector2(posx, posy) +
+                                                    stereo::DispHelper(dpix)));
+      }
+      report();
     }
   }
-  
-  vw_out() << "Unwarping the disparity.\n";
-  
-  vw::TerminalProgressCallback tpc("asp", "\t--> ");
-  double inc_amount = 1.0 / double(disp.cols());
-  tpc.report_progress(0);
-
-  // TODO: This is too slow. Needs to be multi-threaded.
-  for (int col = 0; col < disp.cols(); col++) {
-    for (int row = 0; row < disp.rows(); row++) {
-      
-      DispPixelT dpix = disp(col, row);
-      if (!is_valid(dpix))
-        continue;
-
-      // De-warp left and right pixels to be in the camera coordinate system
-      Vector2 left_pix, right_pix;
-      if (!usePinholeEpipolar) {
-        left_pix  = left_trans.reverse ( Vector2(col, row) );
-        right_pix = right_trans.reverse( Vector2(col, row) + stereo::DispHelper(dpix) );
-      }else{
-        left_pix  = left_trans2.reverse ( Vector2(col, row) );
-        right_pix = right_trans2.reverse( Vector2(col, row) + stereo::DispHelper(dpix) );
-      }
-      Vector2 dir = right_pix - left_pix; // disparity value
-
-      // This averaging is useful in filling tiny holes and avoiding staircasing.
-      // TODO: Use some weights. The closer contribution should have more weight.
-      for (int icol = -1; icol <= 1; icol++) {
-        for (int irow = -1; irow <= 1; irow++) {
-          int lcol = round(left_pix[0]) + icol;
-          int lrow = round(left_pix[1]) + irow;
-          if (lcol < 0 || lcol >= left_img.cols())  continue;
-          if (lrow < 0 || lrow >= left_img.rows())  continue;
-          if (!is_valid(unaligned_disp(lcol, lrow))) unaligned_disp(lcol, lrow).validate();
-          unaligned_disp(lcol, lrow).child() += dir;
-          count(lcol, lrow)++;
-        }
+
+  void left_grid() {
+    int bin_len = m_bin_len;
+    for (int binx = m_beg; binx < m_end; binx++) {
+
+      int posx = binx*bin_len; // integer multiple of bin length
+
+      for (int biny = 0; biny <= m_num_bins[1]; biny++) {
+
+        int posy = biny*bin_len; // integer multiple of bin length
+
+        if (posx >= m_img_size[0] || posy >= m_img_size[1])
+          continue;
+
+        // Make the left pixel go to the disparity domain. Find the corresponding
+        // right pixel. And make that one go to the right image domain.
+        Vector2 left_pix(posx, posy);
+        Vector2 trans_left_pix = round(m_align.left_forward(left_pix));
+        if (trans_left_pix[0] < 0 || trans_left_pix[0] >= m_disp.cols()) continue;
+        if (trans_left_pix[1] < 0 || trans_left_pix[1] >= m_disp.rows()) continue;
+        DispPixelT dpix = m_disp(trans_left_pix[0], trans_left_pix[1]);
+        if (!is_valid(dpix))
+          continue;
+
+        m_left_pix.push_back(left_pix);
+        m_right_pix.push_back(m_align.right_reverse(trans_left_pix +
+                                                    stereo::DispHelper(dpix)));
       }
+      report();
     }
-
-    tpc.report_incremental_progress( inc_amount );
   }
-  tpc.report_finished();
-
-  for (int col = 0; col < unaligned_disp.cols(); col++) {
-    for (int row = 0; row < unaligned_disp.rows(); row++) {
-      if (count(col, row ) == 0) {
-        unaligned_disp(col, row).invalidate();
-      } else{
-        unaligned_disp(col, row) /= double(count(col, row));
+
+  // This needs to examine every disparity, so the strip of columns is
+  // read in memory first.
+  void right_grid() {
+    int bin_len = m_bin_len;
+    BBox2i strip(m_beg, 0, m_end - m_beg, m_disp.rows());
+    ImageView<DispPixelT> disp_strip = crop(m_disp, strip);
+
+    for (int col = m_beg; col < m_end; col++) {
+      for (int row = 0; row < disp_strip.rows(); row++) {
+
+        DispPixelT dpix = disp_strip(col - m_beg, row);
+        if (!is_valid(dpix))
+          continue;
+
+        // Compute the left and right pixels.
+        Vector2 trans_left_pix(col, row);
+        Vector2 right_pix = m_align.right_reverse(trans_left_pix + stereo::DispHelper(dpix));
+
+        // If the right pixel is a multiple of the bin size, keep it.
+        right_pix = round(right_pix); // very important
+        if ( int(right_pix[0]) % bin_len != 0 ) continue;
+        if ( int(right_pix[1]) % bin_len != 0 ) continue;
+
+        m_left_pix.push_back(m_align.left_reverse(trans_left_pix));
+        m_right_pix.push_back(right_pix);
       }
     }
+    report();
   }
-  vw_out() << "Writing: " << disp_file << std::endl;
 
-  cartography::GeoReference left_georef;
-  bool   has_left_georef = false;
-  bool   has_nodata      = false;
-  double nodata          = -32768.0;
-  vw::cartography::block_write_gdal_image(disp_file, unaligned_disp,
-					  has_left_georef, left_georef,
-					  has_nodata, nodata, opt_vec[0],
-					  TerminalProgressCallback("asp", "\t--> Undist disp:") );
+  void report() {
+    vw::Mutex::Lock lock(m_mutex);
+    m_tpc.report_incremental_progress(m_inc_amount);
+  }
+
+public:
+  DispMatchTask(DisparityT const& disp, DispMatchAlignment<TXT> const& align,
+                DispMatchPass pass, double bin_len, Vector2i const& num_bins,
+                Vector2i const& img_size, int beg, int end,
+                std::vector<Vector2> & left_pix, std::vector<Vector2> & right_pix,
+                vw::TerminalProgressCallback & tpc, double inc_amount, vw::Mutex & mutex):
+    m_disp(disp), m_align(align), m_pass(pass), m_bin_len(bin_len), m_num_bins(num_bins),
+    m_img_size(img_size), m_beg(beg), m_end(end), m_left_pix(left_pix), m_right_pix(right_pix),
+    m_tpc(tpc), m_inc_amount(inc_amount), m_mutex(mutex){}
+
+  virtual void operator()(){
+    if (m_pass == DISP_MATCH_BIN_CENTERS)
+      bin_centers();
+    else if (m_pass == DISP_MATCH_LEFT_GRID)
+      left_grid();
+    else
+      right_grid();
+  }
+};
+
+/// Run the tasks of a pass over the given column ranges, and append
+/// their matches, in order, to the output.
+template <class DisparityT, class TXT>
+void run_disp_match_pass(DisparityT const& disp, DispMatchAlignment<TXT> const& align,
+                         DispMatchPass pass, double bin_len, Vector2i const& num_bins,
+                         Vector2i const& img_size, std::vector<int> const& col_breaks,
+                         int num_threads,
+                         std::vector<Vector2> & left_pix, std::vector<Vector2> & right_pix,
+                         vw::TerminalProgressCallback & tpc, double inc_amount) {
+
+  int num_tasks = int(col_breaks.size()) - 1;
+  std::vector< std::vector<Vector2> > task_left(num_tasks), task_right(num_tasks);
+  vw::Mutex mutex;
+  vw::FifoWorkQueue queue(num_threads);
+  for (int t = 0; t < num_tasks; t++) {
+    typedef DispMatchTask<DisparityT, TXT> TaskT;
+    boost::shared_ptr<TaskT> task(new TaskT(disp, align, pass, bin_len, num_bins, img_size,
+                                            col_breaks[t], col_breaks[t+1],
+                                            task_left[t], task_right[t],
+                                            tpc, inc_amount, mutex));
+    queue.add_task(task);
+  }
+  queue.join_all();
+
+  for (int t = 0; t < num_tasks; t++) {
+    left_pix.insert (left_pix.end(),  task_left[t].begin(),  task_left[t].end());
+    right_pix.insert(right_pix.end(), task_right[t].begin(), task_right[t].end());
+  }
+}
+
+/// Split [0, len) into consecutive ranges of the given size.
+std::vector<int> disp_match_breaks(int len, int range_len) {
+  range_len = std::max(range_len, 1);
+  std::vector<int> breaks;
+  for (int beg = 0; beg < len; beg += range_len)
+    breaks.push_back(beg);
+  breaks.push_back(len);
+  return breaks;
+}
+
+/// Add the matches which were not added already. Need this to not
+/// insert an ip twice, as then bundle_adjust will wipe both copies.
+/// This is clumsy, but we can't use a set since there is no ordering
+/// for pairs.
+void add_new_disp_matches(std::vector<Vector2> const& left_pix,
+                          std::vector<Vector2> const& right_pix,
+                          std::map<double, double> & left_done,
+                          std::map<double, double> & right_done,
+                          std::vector<vw::ip::InterestPoint> & left_ip,
+                          std::vector<vw::ip::InterestPoint> & right_ip) {
+  for (size_t it_ip = 0; it_ip < left_pix.size(); it_ip++) {
+    Vector2 const& lpix = left_pix[it_ip];
+    Vector2 const& rpix = right_pix[it_ip];
+    std::map<double, double>::iterator it;
+    it = left_done.find(lpix.x());
+    if (it != left_done.end() && it->second == lpix.y()) continue;
+    it = right_done.find(rpix.x());
+    if (it != right_done.end() && it->second == rpix.y()) continue;
+    left_done[lpix.x()]  = lpix.y();
+    right_done[rpix.x()] = rpix.y();
+    left_ip.push_back (ip::InterestPoint(lpix.x(), lpix.y()));
+    right_ip.push_back(ip::InterestPoint(rpix.x(), rpix.y()));
+  }
 }
 
 /// Bin the disparities, and from each bin get a disparity value.
@@ -328,6 +687,7 @@ void unalign_disparity(vector<ASPGlobalOptions> const& opt_vec,
 /// When gen_triplets is true, and there are many overlapping images,
 /// try hard to have many IP with the property that each such IP is seen
 /// in more than two images. This helps with bundle adjustment.
+/// The columns of bins, or of the disparity, are sampled in parallel.
 template <class DisparityT, class TXT>
 void compute_matches_from_disp(vector<ASPGlobalOptions> const& opt_vec,
                                vector<DisparityT> const& disparities,
@@ -362,7 +722,14 @@ void compute_matches_from_disp(vector<ASPGlobalOptions> const& opt_vec,
       vw_throw(ArgumentErr() << "Expected a pinhole camera.\n");
     pinPtr->pinhole_cam_trans(left_trans2, right_trans2);
   }
-  
+  DispMatchAlignment<TXT> align(left_trans, right_trans, left_trans2, right_trans2,
+                                usePinholeEpipolar);
+
+  // ISIS is not thread-safe
+  int num_threads = vw_settings().default_num_threads();
+  if (opt_vec[0].session->name() == "isis" || opt_vec[0].session->name() == "isismapisis")
+    num_threads = 1;
+
   std::vector<vw::ip::InterestPoint> left_ip, right_ip;
 
   if (!gen_triplets) {
@@ -381,39 +748,16 @@ void compute_matches_from_disp(vector<ASPGlobalOptions> const& opt_vec,
     double inc_amount = 1.0 / double(lenx);
     tpc.report_progress(0);
 
-    for (int binx = 0; binx < lenx; binx++) {
-
-      // Pick the disparity at the center of the bin
-      int posx = round( (binx+0.5)*bin_len );
-
-      for (int biny = 0; biny < leny; biny++) {
-
-        int posy = round( (biny+0.5)*bin_len );
-
-        if (posx >= disp.cols() || posy >= disp.rows()) 
-          continue;
-        typedef typename DisparityT::pixel_type DispPixelT;
-        DispPixelT dpix = disp(posx, posy);
-        if (!is_valid(dpix))
-          continue;
-
-        // De-warp left and right pixels to be in the camera coordinate system
-        Vector2 left_pix, right_pix;
-        if (!usePinholeEpipolar) {
-          left_pix  = left_trans.reverse ( Vector2(posx, posy) );
-          right_pix = right_trans.reverse( Vector2(posx, posy) + stereo::DispHelper(dpix) );
-        }else{
-          left_pix  = left_trans2.reverse ( Vector2(posx, posy) );
-          right_pix = right_trans2.reverse( Vector2(posx, posy) + stereo::DispHelper(dpix) );
-        }
-
-        left_ip.push_back(ip::InterestPoint(left_pix.x(), left_pix.y()));
-        right_ip.push_back(ip::InterestPoint(right_pix.x(), right_pix.y()));
-      }
+    std::vector<Vector2> left_pix, right_pix;
+    run_disp_match_pass(disp, align, DISP_MATCH_BIN_CENTERS, bin_len, Vector2i(lenx, leny),
+                        Vector2i(disp.cols(), disp.rows()), disp_match_breaks(lenx, 1),
+                        num_threads, left_pix, right_pix, tpc, inc_amount);
+    tpc.report_finished();
 
-      tpc.report_incremental_progress( inc_amount );
+    for (size_t it_ip = 0; it_ip < left_pix.size(); it_ip++) {
+      left_ip.push_back (ip::InterestPoint(left_pix[it_ip].x(),  left_pix[it_ip].y()));
+      right_ip.push_back(ip::InterestPoint(right_pix[it_ip].x(), right_pix[it_ip].y()));
     }
-    tpc.report_finished();
 
   } else{
 
@@ -447,68 +791,20 @@ void compute_matches_from_disp(vector<ASPGlobalOptions> const& opt_vec,
       double inc_amount = 1.0 / double(lenx);
       tpc.report_progress(0);
 
-      for (int binx = 0; binx <= lenx; binx++) {
-
-        int posx = binx*bin_len; // integer multiple of bin length
-
-        for (int biny = 0; biny <= leny; biny++) {
-
-          int posy = biny*bin_len; // integer multiple of bin length
-
-          if (posx >= left_img.cols() || posy >= left_img.rows()) 
-            continue;
-
-          Vector2 left_pix(posx, posy);
-          Vector2 trans_left_pix, trans_right_pix, right_pix;
-        
-          typedef typename DisparityT::pixel_type DispPixelT;
-
-          // Make the left pixel go to the disparity domain. Find the corresponding
-          // right pixel. And make that one go to the right image domain.
-          if (!usePinholeEpipolar) {
-            trans_left_pix = round(left_trans.forward(left_pix));
-            if (trans_left_pix[0] < 0 || trans_left_pix[0] >= disp.cols()) continue;
-            if (trans_left_pix[1] < 0 || trans_left_pix[1] >= disp.rows()) continue;
-            DispPixelT dpix = disp(trans_left_pix[0], trans_left_pix[1]);
-            if (!is_valid(dpix))
-              continue;
-            trans_right_pix = trans_left_pix + stereo::DispHelper(dpix);
-            right_pix = right_trans.reverse(trans_right_pix);
-          }else{
-            trans_left_pix = round(left_trans2.forward(left_pix));
-            if (trans_left_pix[0] < 0 || trans_left_pix[0] >= disp.cols()) continue;
-            if (trans_left_pix[1] < 0 || trans_left_pix[1] >= disp.rows()) continue;
-            DispPixelT dpix = disp(trans_left_pix[0], trans_left_pix[1]);
-            if (!is_valid(dpix))
-              continue;
-            trans_right_pix = trans_left_pix + stereo::DispHelper(dpix);
-            right_pix = right_trans2.reverse(trans_right_pix);
-          }
-
-          // Add this ip unless found already. This is clumsy, but we
-          // can't use a set since there is no ordering for pairs.
-          std::map<double, double>::iterator it;
-          it = left_done.find(left_pix.x());
-          if (it != left_done.end() && it->second == left_pix.y()) continue; 
-          it = right_done.find(right_pix.x());
-          if (it != right_done.end() && it->second == right_pix.y()) continue; 
-          left_done[left_pix.x()] = left_pix.y();
-          right_done[right_pix.x()] = right_pix.y();
-          ip::InterestPoint lip(left_pix.x(), left_pix.y());
-          ip::InterestPoint rip(right_pix.x(), right_pix.y());
-          left_ip.push_back(lip); 
-          right_ip.push_back(rip);
-        }
-        
-        tpc.report_incremental_progress( inc_amount );
-      }
+      std::vector<Vector2> left_pix, right_pix;
+      run_disp_match_pass(disp, align, DISP_MATCH_LEFT_GRID, bin_len, Vector2i(lenx, leny),
+                          Vector2i(left_img.cols(), left_img.rows()),
+                          disp_match_breaks(lenx + 1, 1),
+                          num_threads, left_pix, right_pix, tpc, inc_amount);
       tpc.report_finished();
+
+      add_new_disp_matches(left_pix, right_pix, left_done, right_done, left_ip, right_ip);
     }
     
     // Now create ip in predictable location for the right image.This is hard,
-    // as the disparity goes from left to right, so we need to examine every disparity.
-    typedef typename DisparityT::pixel_type DispPixelT;
-    ImageView<DispPixelT> disp_copy = copy(disp);
+    // as the disparity goes from left to right, so we need to examine every
+    // disparity. This is done in strips of columns which are read in memory,
+    // rather than copying all of the disparity.
     {
       DiskImageView<float> right_img(opt_vec[0].in_file2);
     
@@ -516,58 +812,24 @@ void compute_matches_from_disp(vector<ASPGlobalOptions> const& opt_vec,
       int bin_len = round(sqrt(num_pixels/std::min(double(max_num_matches), num_pixels)));
       VW_ASSERT( bin_len >= 1, vw::ArgumentErr() << "Expecting bin_len >= 1.\n" );
 
+      // Strips of about four million pixels
+      int strip_width = std::max(1, int(4000000 / std::max(disp.rows(), 1)));
+      std::vector<int> breaks = disp_match_breaks(disp.cols(), strip_width);
+
       // Iterate over disparity.
 
-      vw_out() << "Doing a second pass. This will be very slow.\n";
+      vw_out() << "Doing a second pass. This will be slow.\n";
       vw::TerminalProgressCallback tpc("asp", "\t--> ");
-      double inc_amount = 1.0 / double(disp_copy.cols());
+      double inc_amount = 1.0 / double(breaks.size() - 1);
       tpc.report_progress(0);
 
-      for (int col = 0; col < disp_copy.cols(); col++) {
-        for (int row = 0; row < disp_copy.rows(); row++) {
-
-          Vector2 trans_left_pix(col, row);
-          Vector2 left_pix, trans_right_pix, right_pix;
-
-          DispPixelT dpix = disp_copy(trans_left_pix[0], trans_left_pix[1]);
-          if (!is_valid(dpix))
-            continue;
-          
-          // Compute the left and right pixels. 
-          if (!usePinholeEpipolar) {
-            left_pix        = left_trans.reverse(trans_left_pix);
-            trans_right_pix = trans_left_pix + stereo::DispHelper(dpix);
-            right_pix       = right_trans.reverse(trans_right_pix);
-          }else{
-            left_pix        = left_trans2.reverse(trans_left_pix);
-            trans_right_pix = trans_left_pix + stereo::DispHelper(dpix);
-            right_pix       = right_trans2.reverse(trans_right_pix);
-          }
-
-          // If the right pixel is a multiple of the bin size, keep
-          // it.
-          right_pix = round(right_pix); // very important
-          if ( int(right_pix[0]) % bin_len != 0 ) continue;
-          if ( int(right_pix[1]) % bin_len != 0 ) continue;
-
-          // Add this ip unless found already. This is clumsy, but we
-          // can't use a set since there is no ordering for pairs.
-          std::map<double, double>::iterator it;
-          it = left_done.find(left_pix.x());
-          if (it != left_done.end() && it->second == left_pix.y()) continue; 
-          it = right_done.find(right_pix.x());
-          if (it != right_done.end() && it->second == right_pix.y()) continue; 
-          left_done[left_pix.x()] = left_pix.y();
-          right_done[right_pix.x()] = right_pix.y();
-          ip::InterestPoint lip(left_pix.x(), left_pix.y());
-          ip::InterestPoint rip(right_pix.x(), right_pix.y());
-          left_ip.push_back(lip); 
-          right_ip.push_back(rip);
-        }
-        
-        tpc.report_incremental_progress( inc_amount );
-      }
+      std::vector<Vector2> left_pix, right_pix;
+      run_disp_match_pass(disp, align, DISP_MATCH_RIGHT_GRID, bin_len, Vector2i(),
+                          Vector2i(right_img.cols(), right_img.rows()), breaks,
+                          num_threads, left_pix, right_pix, tpc, inc_amount);
       tpc.report_finished();
+
+      add_new_disp_matches(left_pix, right_pix, left_done, right_done, left_ip, right_ip);
     }
 
     
@@ -584,23 +846,6 @@ namespace asp{
 
   // TODO: Move some of these functions to a class or something!
 
-  // ImageView operator that takes the last three elements of a vector
-  // (the error part) and replaces them with the norm of that 3-vector.
-  struct PointAndErrorNorm : public ReturnFixedType<Vector4> {
-    Vector4 operator() (Vector6 const& pt) const {
-      Vector4 result;
-      subvector(result,0,3) = subvector(pt,0,3);
-      result[3] = norm_2(subvector(pt,3,3));
-      return result;
-    }
-  };
-  template <class ImageT>
-  UnaryPerPixelView<ImageT, PointAndErrorNorm>
-  inline point_and_error_norm( ImageViewBase<ImageT> const& image ) {
-    return UnaryPerPixelView<ImageT, PointAndErrorNorm>( image.impl(),
-                                                         PointAndErrorNorm() );
-  }
-
   template <class ImageT>
   void save_point_cloud(Vector3 const& shift, ImageT const& point_cloud,
                         string const& point_cloud_file,
@@ -613,24 +858,242 @@ namespace asp{
     bool has_nodata = false;
     double nodata = -std::numeric_limits<float>::max(); // smallest float
 
+    // The statistics of the cloud are found as it is written, and
+    // saved in its header, for point2dem and others to use.
+    boost::shared_ptr<asp::PointCloudStatsCollector> stats(new asp::PointCloudStatsCollector);
+    asp::PointCloudStatsView<ImageT> cloud_with_stats(point_cloud, stats);
+
     // TODO: Replace this with with a function call!
     if ( (opt.session->name() == "isis") || (opt.session->name() == "isismapisis")){
       // ISIS does not support multi-threading
       asp::write_approx_gdal_image
         ( point_cloud_file, shift,
           stereo_settings().point_cloud_rounding_error,
-          point_cloud,
+          cloud_with_stats,
           has_georef, georef, has_nodata, nodata,
-          opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
+          float_write_options(opt), TerminalProgressCallback("asp", "\t--> Triangulating: "));
     }else{
       asp::block_write_approx_gdal_image
         ( point_cloud_file, shift,
           stereo_settings().point_cloud_rounding_error,
-          point_cloud,
+          cloud_with_stats,
           has_georef, georef, has_nodata, nodata,
-          opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
+          float_write_options(opt), TerminalProgressCallback("asp", "\t--> Triangulating: "));
     }
 
+    asp::PointCloudStats cloud_stats = stats->stats();
+    if (shift != Vector3())
+      cloud_stats.rounding_error
+        = asp::get_rounding_error(shift, stereo_settings().point_cloud_rounding_error);
+    asp::write_point_cloud_stats(point_cloud_file, cloud_stats);
+
+  }
+
+  /// Triangulate a block of the cloud, project its points, and add
+  /// them to the DEM.
+  template <class ImageT>
+  class DirectDemTask : public Task, private boost::noncopyable {
+    ImageT const& m_cloud;
+    BBox2i        m_bbox;
+    cartography::GeoReference const& m_georef;
+    double        m_lon_center;
+    asp::DemSplatter & m_splatter;
+    vw::TerminalProgressCallback & m_tpc;
+    double                         m_inc_amount;
+    vw::Mutex                    & m_mutex;
+  public:
+    DirectDemTask(ImageT const& cloud, BBox2i const& bbox,
+                  cartography::GeoReference const& georef, double lon_center,
+                  asp::DemSplatter & splatter,
+                  vw::TerminalProgressCallback & tpc, double inc_amount, vw::Mutex & mutex):
+      m_cloud(cloud), m_bbox(bbox), m_georef(georef), m_lon_center(lon_center),
+      m_splatter(splatter), m_tpc(tpc), m_inc_amount(inc_amount), m_mutex(mutex) {}
+
+    virtual void operator()() {
+      ImageView<Vector4> block = crop(m_cloud, m_bbox);
+      ImageView<Vector3> points(block.cols(), block.rows());
+      for (int row = 0; row < block.rows(); row++)
+        for (int col = 0; col < block.cols(); col++)
+          points(col, row) = subvector(block(col, row), 0, 3);
+      asp::cartesian_to_projected(points, m_georef, m_lon_center, Vector3());
+
+      vector<Vector3> proj_points;
+      vector<double>  errors;
+      proj_points.reserve(points.cols()*points.rows());
+      errors.reserve(points.cols()*points.rows());
+      for (int row = 0; row < points.rows(); row++) {
+        for (int col = 0; col < points.cols(); col++) {
+          if (boost::math::isnan(points(col, row)[2]))
+            continue;
+          proj_points.push_back(points(col, row));
+          errors.push_back(block(col, row)[3]);
+        }
+      }
+      m_splatter.add_points(proj_points, errors);
+
+      vw::Mutex::Lock lock(m_mutex);
+      m_tpc.report_incremental_progress(m_inc_amount);
+    }
+  };
+
+  /// Instead of writing the point cloud, grid its points into a DEM as
+  /// they are triangulated, and write that. The cloud has the points
+  /// followed by the norm of the triangulation error.
+  template <class ImageT>
+  void save_direct_dem(ImageT const& point_cloud, Vector3 const& cloud_center,
+                       string const& output_prefix, ASPGlobalOptions const& opt){
+
+    cartography::Datum datum = opt.session->get_georef().datum();
+    cartography::GeoReference georef(datum);
+    if (stereo_settings().direct_dem_t_srs != "")
+      asp::set_srs_string(stereo_settings().direct_dem_t_srs, true, datum, georef);
+
+    // Keep the longitudes of the points in one branch, with the cut
+    // away from the cloud.
+    double lon_center = 0;
+    if (cloud_center != Vector3() && std::abs(atan2(cloud_center[1], cloud_center[0])) > M_PI/2)
+      lon_center = 180;
+    georef.set_lon_center(lon_center < 100);
+
+    bool with_errors = stereo_settings().direct_dem_errorimage;
+    asp::DemSplatter splatter(stereo_settings().direct_dem_spacing, 1.0, with_errors);
+
+    // ISIS does not support multi-threading
+    int num_threads = vw_settings().default_num_threads();
+    if (opt.session->name() == "isis" || opt.session->name() == "isismapisis")
+      num_threads = 1;
+
+    Vector2i ts = opt.raster_tile_size;
+    vector<BBox2i> blocks = subdivide_bbox(point_cloud, ts[0], ts[1]);
+    vw_out() << "\t--> Triangulating into a DEM with spacing "
+             << stereo_settings().direct_dem_spacing << ".\n";
+    TerminalProgressCallback tpc("asp", "\t--> Triangulating: ");
+    double inc_amount = 1.0 / std::max(blocks.size(), size_t(1));
+    vw::Mutex mutex;
+    FifoWorkQueue queue(num_threads);
+    for (size_t b = 0; b < blocks.size(); b++)
+      queue.add_task(boost::shared_ptr<Task>
+                     (new DirectDemTask<ImageT>(point_cloud, blocks[b], georef,
+                                                lon_center, splatter,
+                                                tpc, inc_amount, mutex)));
+    queue.join_all();
+    tpc.report_finished();
+
+    double nodata = -std::numeric_limits<float>::max(); // smallest float
+    splatter.write(output_prefix + "-DEM.tif",
+                   with_errors ? output_prefix + "-IntersectionErr.tif" : "",
+                   georef, nodata, opt, TerminalProgressCallback("asp", "\t--> Writing: "));
+  }
+
+  /// Make a coarse DEM from the low-resolution disparity D_sub, for
+  /// a quick look at what stereo would produce. The pixels of L_sub
+  /// and R_sub are scaled to L.tif and R.tif pixels and triangulated
+  /// as usual, with no full-resolution disparity. The DEM spacing, if
+  /// not set, is the median distance between neighboring points.
+  template <class TXT, class StereoModelT>
+  void quick_look_dem(string const& output_prefix, vector<TXT> & transforms,
+                      StereoModelT const& stereo_model,
+                      stereo::UniverseRadiusFunc const& universe_radius_func,
+                      ASPGlobalOptions const& opt){
+
+    if (transforms.size() != 2)
+      vw_throw(ArgumentErr() << "The quick-look DEM can be made only from one stereo pair.\n");
+
+    string sub_disp_file = opt.out_prefix + "-D_sub.tif";
+    vw_out() << "\t--> Triangulating the low-resolution disparity: " << sub_disp_file << "\n";
+    ImageView<PixelMask<Vector2f> > sub_disp = DiskImageView<PixelMask<Vector2f> >(sub_disp_file);
+    Vector2 left_scale
+      = elem_quot(Vector2(file_image_size(opt.out_prefix + "-L_sub.tif")),
+                  Vector2(file_image_size(opt.out_prefix + "-L.tif")));
+    Vector2 right_scale
+      = elem_quot(Vector2(file_image_size(opt.out_prefix + "-R_sub.tif")),
+                  Vector2(file_image_size(opt.out_prefix + "-R.tif")));
+
+    // The points, in the layout of D_sub, so that the spacing can be
+    // found from the neighbors, and the errors.
+    ImageView<Vector3> points(sub_disp.cols(), sub_disp.rows());
+    ImageView<double>  errors(sub_disp.cols(), sub_disp.rows());
+    vector<Vector2> pixVec(2);
+    Vector3 cloud_center;
+    int num_valid = 0;
+    for (int row = 0; row < sub_disp.rows(); row++) {
+      for (int col = 0; col < sub_disp.cols(); col++) {
+        points(col, row) = Vector3();
+        errors(col, row) = 0;
+        if (!is_valid(sub_disp(col, row)))
+          continue;
+        Vector2 left_pix (col, row);
+        Vector2 right_pix = left_pix + Vector2(sub_disp(col, row).child());
+        pixVec[0] = transforms[0].reverse(elem_quot(left_pix,  left_scale));
+        pixVec[1] = transforms[1].reverse(elem_quot(right_pix, right_scale));
+
+        Vector6 pt;
+        Vector3 errorVec;
+        subvector(pt, 0, 3) = stereo_model(pixVec, errorVec);
+        subvector(pt, 3, 3) = errorVec;
+        pt = universe_radius_func(pt);
+        Vector3 xyz = subvector(pt, 0, 3);
+        if (xyz == Vector3())
+          continue;
+        points(col, row) = xyz;
+        errors(col, row) = norm_2(errorVec);
+        cloud_center += xyz;
+        num_valid++;
+      }
+    }
+    if (num_valid == 0)
+      vw_throw(ArgumentErr() << "No points could be triangulated from: " << sub_disp_file << "\n");
+    cloud_center /= num_valid;
+
+    cartography::Datum datum = opt.session->get_georef().datum();
+    cartography::GeoReference georef(datum);
+    if (stereo_settings().direct_dem_t_srs != "")
+      asp::set_srs_string(stereo_settings().direct_dem_t_srs, true, datum, georef);
+    double lon_center = 0;
+    if (std::abs(atan2(cloud_center[1], cloud_center[0])) > M_PI/2)
+      lon_center = 180;
+    georef.set_lon_center(lon_center < 100);
+    asp::cartesian_to_projected(points, georef, lon_center, Vector3());
+
+    double spacing = stereo_settings().direct_dem_spacing;
+    if (spacing <= 0) {
+      vector<double> dists;
+      for (int row = 0; row < points.rows(); row++) {
+        for (int col = 0; col + 1 < points.cols(); col++) {
+          Vector3 const& P = points(col, row), Q = points(col + 1, row);
+          if (boost::math::isnan(P[2]) || boost::math::isnan(Q[2]))
+            continue;
+          dists.push_back(norm_2(subvector(P - Q, 0, 2)));
+        }
+      }
+      if (!dists.empty()) {
+        std::nth_element(dists.begin(), dists.begin() + dists.size()/2, dists.end());
+        spacing = dists[dists.size()/2];
+      }
+      if (!(spacing > 0))
+        vw_throw(ArgumentErr() << "Could not find the quick-look DEM spacing. "
+                 << "Set it with --direct-dem-spacing.\n");
+    }
+    vw_out() << "\t--> Quick-look DEM spacing: " << spacing << "\n";
+
+    bool with_errors = stereo_settings().direct_dem_errorimage;
+    asp::DemSplatter splatter(spacing, 1.0, with_errors);
+    vector<Vector3> proj_points;
+    vector<double>  proj_errors;
+    for (int row = 0; row < points.rows(); row++) {
+      for (int col = 0; col < points.cols(); col++) {
+        if (boost::math::isnan(points(col, row)[2]))
+          continue;
+        proj_points.push_back(points(col, row));
+        proj_errors.push_back(errors(col, row));
+      }
+    }
+    splatter.add_points(proj_points, proj_errors);
+
+    double nodata = -std::numeric_limits<float>::max(); // smallest float
+    splatter.write(output_prefix + "-QuickLook-DEM.tif",
+                   with_errors ? output_prefix + "-QuickLook-IntersectionErr.tif" : "",
+                   georef, nodata, opt, TerminalProgressCallback("asp", "\t--> Writing: "));
   }
 
   Vector3 find_approx_points_median(vector<Vector3> const& points){
@@ -656,8 +1119,8 @@ namespace asp{
     return median;
   }
 
-  Vector3 find_point_cloud_center(Vector2i const& tile_size,
-                                  ImageViewRef<Vector6> const& point_cloud){
+  Vector3 find_point_cloud_center_from_tiles(Vector2i const& tile_size,
+                                             ImageViewRef<Vector6> const& point_cloud){
 
     // Compute the point cloud in a tile around the center of the
     // cloud. Find the median of all the points in that cloud.  That
@@ -712,6 +1175,48 @@ namespace asp{
     return find_approx_points_median(points);
   }
 
+  Vector3 find_point_cloud_center(Vector2i const& tile_size,
+                                  ImageViewRef<Vector6> const& point_cloud){
+
+    // Triangulate small patches on a grid over the area having points,
+    // and find the median of all those points. That will be the cloud
+    // center. This needs much less triangulation than whole tiles. If
+    // too few points are found, use the tiles around the cloud center.
+
+    const int num_patches = 16, patch_size = 8;
+    BBox2i area = bounding_box(point_cloud);
+    area.crop(stereo_settings().trans_crop_win);
+    if (area.empty())
+      return Vector3();
+
+    vector<Vector3> points;
+    for (int i = 0; i < num_patches; i++){
+      for (int j = 0; j < num_patches; j++){
+        int x = area.min().x() + int((i + 0.5)*area.width ()/num_patches) - patch_size/2;
+        int y = area.min().y() + int((j + 0.5)*area.height()/num_patches) - patch_size/2;
+        BBox2i box(x, y, patch_size, patch_size);
+        box.crop(area);
+        if (box.empty())
+          continue;
+
+        ImageView<Vector6> cropped_cloud = crop(point_cloud, box);
+        for (int px = 0; px < cropped_cloud.cols(); px++){
+          for (int py = 0; py < cropped_cloud.rows(); py++){
+            Vector3 xyz = subvector(cropped_cloud(px, py), 0, 3);
+            if (xyz == Vector3())
+              continue;
+            points.push_back(xyz);
+          }
+        }
+      }
+    }
+
+    if (points.size() > 100)
+      return find_approx_points_median(points);
+
+    return find_point_cloud_center_from_tiles(tile_size, point_cloud);
+  }
+
   bool read_point(string const& file, Vector3 & point){
 
     point = Vector3();
@@ -801,9 +1306,25 @@ void stereo_triangulation( string          const& output_prefix,
                              << "Will not be able to filter triangulated points by radius.\n";
     } // End try/catch
 
+    // The quick look needs only the low-resolution disparity
+    if (stereo_settings().quick_look) {
+      std::vector<const vw::camera::CameraModel *> camera_ptrs;
+      for (int c = 0; c < (int)cameras.size(); c++)
+        camera_ptrs.push_back(cameras[c].get());
+      double angle_tol = vw::stereo::StereoModel::robust_1_minus_cos(stereo_settings().min_triangulation_angle*M_PI/180);
+      StereoModelT stereo_model(camera_ptrs, stereo_settings().use_least_squares, angle_tol);
+      quick_look_dem(output_prefix, transforms, stereo_model, universe_radius_func, opt_vec[0]);
+      return;
+    }
+
+    // In fused mode, refinement and filtering are done here, on each
+    // tile as it is triangulated, rather than read from F.tif.
     vector<PVImageT> disparity_maps;
     for (int p = 0; p < (int)opt_vec.size(); p++){
-      disparity_maps.push_back(opt_vec[p].session->pre_pointcloud_hook(opt_vec[p].out_prefix+"-F.tif"));
+      if (stereo_settings().fuse_rfne_fltr_tri)
+        disparity_maps.push_back(asp::fused_filtered_disparity(opt_vec[p]));
+      else
+        disparity_maps.push_back(opt_vec[p].session->pre_pointcloud_hook(opt_vec[p].out_prefix+"-F.tif"));
     }
 
     std::string unalign_disp = asp::unwarped_disp_file(output_prefix,
@@ -902,13 +1423,25 @@ void stereo_triangulation( string          const& output_prefix,
     StereoModelT stereo_model( camera_ptrs, stereo_settings().use_least_squares,
                                angle_tol);
 
-    // Apply radius function and stereo model in one go
+    // Apply radius function and stereo model in one go. The cloud
+    // keeps its type all the way to the writer, so that each tile is
+    // triangulated from disparities read in memory. Wrapped into an
+    // ImageViewRef and then into further views, it would be evaluated
+    // one pixel at a time through virtual calls instead.
     vw_out() << "\t--> Generating a 3D point cloud." << endl;
-    ImageViewRef<Vector6> point_cloud = per_pixel_filter
+    typedef StereoTXAndErrorView<PVImageT, typename SessionT::tx_type, StereoModelT> TriViewT;
+    typedef UnaryPerPixelView<TriViewT, stereo::UniverseRadiusFunc> CloudViewT;
+    // ISIS does not support multi-threading
+    bool parallel_pairs = (opt_vec[0].session->name() != "isis" &&
+                           opt_vec[0].session->name() != "isismapisis");
+    CloudViewT typed_point_cloud = per_pixel_filter
       (stereo_error_triangulate
-       (disparity_maps, transforms, stereo_model, is_map_projected),
+       (disparity_maps, transforms, stereo_model, is_map_projected, parallel_pairs),
        universe_radius_func);
 
+    // For the code which only pulls whole boxes from it
+    ImageViewRef<Vector6> point_cloud = typed_point_cloud;
+
     // If we crop the left and right images, at each run we must
     // recompute the cloud center, as the cropping windows may have changed.
     bool crop_left  = (stereo_settings().left_image_crop_win  != BBox2i(0, 0, 0, 0));
@@ -934,18 +1467,21 @@ void stereo_triangulation( string          const& output_prefix,
     // so force rasterization in that box only using crop().
     BBox2i cbox = stereo_settings().trans_crop_win;
     string point_cloud_file = output_prefix + "-PC.tif";
-    if (stereo_settings().compute_error_vector){
+    if (stereo_settings().direct_dem_spacing > 0){
+      save_direct_dem(crop(point_and_error_norm(typed_point_cloud), cbox),
+                      cloud_center, output_prefix, opt_vec[0]);
+    }else if (stereo_settings().compute_error_vector){
 
       if (num_cams > 2)
         vw_out(WarningMessage) << "For more than two cameras, the error "
                                << "vector between rays is not meaningful. "
                                << "Setting it to (err_len, 0, 0)." << endl;
 
-      ImageViewRef<Vector6> crop_pc = crop(point_cloud, cbox);
-      save_point_cloud(cloud_center, crop_pc, point_cloud_file, opt_vec[0]);
+      save_point_cloud(cloud_center, crop(typed_point_cloud, cbox),
+                       point_cloud_file, opt_vec[0]);
     }else{
-      ImageViewRef<Vector4> crop_pc = crop(point_and_error_norm(point_cloud), cbox);
-      save_point_cloud(cloud_center, crop_pc, point_cloud_file, opt_vec[0]);
+      save_point_cloud(cloud_center, crop(point_and_error_norm(typed_point_cloud), cbox),
+                       point_cloud_file, opt_vec[0]);
     } // End if/else
 
     // Must print this at the end, as it contains statistics on the number of rejected points.
@@ -982,15 +1518,24 @@ int main( int argc, char* argv[] ) {
                        output_prefix);
     }
 
-    // Keep only those stereo pairs for which filtered disparity exists
+    // Keep only those stereo pairs for which filtered disparity
+    // exists, or the unrefined disparity, if refinement and filtering
+    // are to be done here.
+    std::string disp_suffix = "-F.tif";
+    if (stereo_settings().fuse_rfne_fltr_tri) {
+      disp_suffix = "-D.tif";
+      asp::check_fused_filtering_options();
+    }
+    if (stereo_settings().quick_look)
+      disp_suffix = "-D_sub.tif";
     vector<ASPGlobalOptions> opt_vec_new;
     for (int p = 0; p < (int)opt_vec.size(); p++){
-      if (fs::exists(opt_vec[p].out_prefix+"-F.tif"))
+      if (fs::exists(opt_vec[p].out_prefix + disp_suffix))
         opt_vec_new.push_back(opt_vec[p]);
     }
     opt_vec = opt_vec_new;
     if (opt_vec.empty())
-      vw_throw( ArgumentErr() << "No valid F.tif files found.\n" );
+      vw_throw( ArgumentErr() << "No valid " << disp_suffix.substr(1) << " files found.\n" );
 
     // Triangulation uses small tiles.
     //---------------------------------------------------------
@@ -18,6 +18,8 @@
 /// \file tif_mosaic.cc
 ///
 
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO.h>
 #include <vw/Image.h>
 #include <vw/Cartography.h>
@@ -33,6 +35,7 @@ using namespace vw;
 namespace po = boost::program_options;
 
 #include <limits>
+#include <boost/noncopyable.hpp>
 
 namespace vw {
   template<> struct PixelFormatID<Vector<uint16, 1> >   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_1_CHANNEL; };
@@ -83,56 +86,92 @@ struct ImageData{
   }
 };
 
+// The transform from the pixels of one image to the pixels of the
+// next one, found by interest point matching in their overlap.
+Matrix3x3 seam_transform(ImageData const& data0, ImageData const& data1){
+
+  // The intersection of the image regions in the common
+  // destination domain.
+  BBox2 intersection_box = data0.dst_box;
+  intersection_box.crop(data1.dst_box);
+
+  // Pull into first image's pixel domain
+  BBox2 box0 = data0.transform.reverse_bbox(intersection_box);
+  DiskImageView<float> img0(data0.src_file);
+  box0.crop(bounding_box(img0));
+  ImageViewRef<float> crop0 = crop(img0, box0);
+
+  // Pull into second image's pixel domain
+  BBox2 box1 = data1.transform.reverse_bbox(intersection_box);
+  DiskImageView<float> img1(data1.src_file);
+  box1.crop(bounding_box(img1));
+  ImageViewRef<float> crop1 = crop(img1, box1);
+
+  // The transform from cropped image0 to cropped image1
+  int ip_per_tile = 0; // auto-determination
+  Matrix3x3 T = asp::translation_ip_matching(crop0, crop1,
+                                             ip_per_tile,
+                                             data0.nodata_value,
+                                             data1.nodata_value);
+  T = inverse(T); // originally it was going from image1 to image0
+
+  // The transform from image0 to cropped image0
+  Matrix3x3 T0;
+  T0.set_identity();
+  T0(0, 2) = -box0.min().x();
+  T0(1, 2) = -box0.min().y();
+
+  // The transform from cropped image1 to image1
+  Matrix3x3 T1;
+  T1.set_identity();
+  T1(0, 2) = box1.min().x();
+  T1(1, 2) = box1.min().y();
+
+  // The transform from image0 to image 1
+  return T1*T*T0;
+}
+
+// Find the transform across one seam.
+class SeamTask: public vw::Task, private boost::noncopyable {
+  ImageData const& m_data0;
+  ImageData const& m_data1;
+  Matrix3x3      & m_transform;
+public:
+  SeamTask(ImageData const& data0, ImageData const& data1, Matrix3x3 & transform):
+    m_data0(data0), m_data1(data1), m_transform(transform){}
+  virtual void operator()(){
+    m_transform = seam_transform(m_data0, m_data1);
+  }
+};
+
 // Fix seams by finding interest point matches and adjusting the
 // transforms so that they map points from one image on top of
 // matches from another image. We count on the fact
 // that each image overlaps with the next one.
+// The matching is done for all seams in parallel, using the input
+// transforms to find the overlaps, as the corrections are small
+// compared to them. The corrections are then chained in order.
 void fix_seams_using_ip(std::vector<ImageData> & img_data){
 
-  for (int img_index = 0; img_index < int(img_data.size())-1; img_index++) {
-
-    // The intersection of the image regions in the common
-    // destination domain.
-    BBox2 intersection_box = img_data[img_index].dst_box;
-    intersection_box.crop(img_data[img_index+1].dst_box);
-
-    // Pull into first image's pixel domain
-    BBox2 box0 = img_data[img_index].transform.reverse_bbox(intersection_box);
-    DiskImageView<float> img0(img_data[img_index].src_file);
-    box0.crop(bounding_box(img0));
-    ImageViewRef<float> crop0 = crop(img0, box0);
-
-    // Pull into second image's pixel domain
-    BBox2 box1 = img_data[img_index+1].transform.reverse_bbox(intersection_box);
-    DiskImageView<float> img1(img_data[img_index+1].src_file);
-    box1.crop(bounding_box(img1));
-    ImageViewRef<float> crop1 = crop(img1, box1);
-
-    // The transform from cropped image0 to cropped image1
-    int ip_per_tile = 0; // auto-determination
-    Matrix3x3 T = asp::translation_ip_matching(crop0, crop1,
-                                               ip_per_tile,
-                                               img_data[img_index].nodata_value,
-                                               img_data[img_index+1].nodata_value);
-    T = inverse(T); // originally it was going from image1 to image0
-
-    // The transform from image0 to cropped image0
-    Matrix3x3 T0;
-    T0.set_identity();
-    T0(0, 2) = -box0.min().x();
-    T0(1, 2) = -box0.min().y();
-
-    // The transform from cropped image1 to image1
-    Matrix3x3 T1;
-    T1.set_identity();
-    T1(0, 2) = box1.min().x();
-    T1(1, 2) = box1.min().y();
-
-    // The transform from image0 to image 1
-    T = T1*T*T0;
+  int num_seams = int(img_data.size()) - 1;
+  if (num_seams <= 0)
+    return;
+
+  std::vector<Matrix3x3> seam_transforms(num_seams);
+  {
+    FifoWorkQueue queue(std::min(num_seams, int(vw_settings().default_num_threads())));
+    for (int img_index = 0; img_index < num_seams; img_index++) {
+      boost::shared_ptr<Task> task(new SeamTask(img_data[img_index], img_data[img_index+1],
+                                                seam_transforms[img_index]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
+  for (int img_index = 0; img_index < num_seams; img_index++) {
 
     // The transform from image1 to image 0
-    Matrix3x3 TI = inverse(T);
+    Matrix3x3 TI = inverse(seam_transforms[img_index]);
 
     Matrix3x3 N = affine2mat(img_data[img_index].transform)*TI;
     Matrix3x3 N0 = affine2mat(img_data[img_index+1].transform);
@@ -293,6 +332,7 @@ public:
     std::vector<BBox2i>  src_vec(m_img_data.size());  // Effective area of image tile
     std::vector<InterpT> crop_vec(m_img_data.size(),
                                   InterpT(ImageT())); // Image data but expanded a bit for interpolation's sake
+    std::vector<int>     active;  // The images which intersect the tile, the top one first
     int extra = BilinearInterpolation::pixel_buffer;
     // Loop through the input images
     for (int k = 0; k < (int)m_img_data.size(); k++){
@@ -313,6 +353,7 @@ public:
                 (crop(edge_extend(m_img_data[k].src_img, ConstantEdgeExtension()),
                       box),
                  m_img_data[k].nodata_value));
+      active.insert(active.begin(), k);
     }
 
     ImageView<pixel_type> tile(bbox.width(), bbox.height());
@@ -334,7 +375,8 @@ public:
         // See which src image we end up in. Start from the later
         // images, as those are on top. Stop when we find an image
         // with a valid pixel at given location.
-        for (int k = (int)m_img_data.size()-1; k >= 0; k--){
+        for (size_t a = 0; a < active.size(); a++){
+          int k = active[a];
           Vector2 src_pix = m_img_data[k].transform.reverse(dst_pix);
           if (!src_vec[k].contains(src_pix))
             continue;
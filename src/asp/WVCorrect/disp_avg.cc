@@ -21,91 +21,252 @@
 #pragma warning(disable:4996)
 #endif
 
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO/DiskImageView.h>
+#include <vw/FileIO/DiskImageResource.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Manipulation.h>
 #include <vw/Stereo/DisparityMap.h>
+#include <asp/Core/Macros.h>
+#include <asp/Core/Common.h>
+#include <boost/noncopyable.hpp>
+#include <algorithm>
+#include <fstream>
+#include <map>
 
 using namespace vw;
 using namespace std;
+namespace po = boost::program_options;
 
 // Average the rows in a given disparity image. Save them to disk as
 // two text files (x and y values), with as many entries as there
 // were columns in the disparity.
+//
+// The image is read in strips of columns, in parallel, and each
+// strip is read a block of rows at a time, so only a few blocks are
+// in memory. With the median or trimmed mean, each column keeps a
+// histogram of its values rather than the values themselves.
 
-int main( int argc, char *argv[] ){
+struct Options : vw::cartography::GdalWriteOptions {
+  std::string in_file, outx, outy, method;
+  int    row_start, num_rows, col_start, num_cols;
+  double trim_fraction, bin_size;
+};
+
+void handle_arguments(int argc, char *argv[], Options& opt) {
+  po::options_description general_options("");
+  general_options.add_options()
+    ("method", po::value(&opt.method)->default_value("mean"),
+     "How to combine the values in a column: mean, median, or trimmed-mean.")
+    ("trim-fraction", po::value(&opt.trim_fraction)->default_value(0.1),
+     "With the trimmed mean, the fraction of the values in a column to "
+     "discard at each end.")
+    ("bin-size", po::value(&opt.bin_size)->default_value(0.01),
+     "With the median or trimmed mean, the width, in pixels, of the "
+     "histogram bins of the column values.");
+  general_options.add(vw::cartography::GdalWriteOptionsDescription(opt));
+
+  po::options_description positional("");
+  positional.add_options()
+    ("disp",      po::value(&opt.in_file),                      "The disparity.")
+    ("outdx",     po::value(&opt.outx),                         "The output x values.")
+    ("outdy",     po::value(&opt.outy),                         "The output y values.")
+    ("row-start", po::value(&opt.row_start)->default_value(0),  "The first row.")
+    ("num-rows",  po::value(&opt.num_rows)->default_value(-1),  "The number of rows.")
+    ("col-start", po::value(&opt.col_start)->default_value(0),  "The first column.")
+    ("num-cols",  po::value(&opt.num_cols)->default_value(-1),  "The number of columns.");
+
+  po::positional_options_description positional_desc;
+  positional_desc.add("disp",      1);
+  positional_desc.add("outdx",     1);
+  positional_desc.add("outdy",     1);
+  positional_desc.add("row-start", 1);
+  positional_desc.add("num-rows",  1);
+  positional_desc.add("col-start", 1);
+  positional_desc.add("num-cols",  1);
+
+  std::string usage("[options] disp.tif outdx.txt outdy.txt [row_start] [num_rows] "
+                    "[col_start] [num_cols]");
+  bool allow_unregistered = false;
+  std::vector<std::string> unregistered;
+  po::variables_map vm =
+    asp::check_command_line(argc, argv, opt, general_options, general_options,
+                            positional, positional_desc, usage,
+                            allow_unregistered, unregistered);
+
+  if (opt.in_file.empty() || opt.outx.empty() || opt.outy.empty())
+    vw_throw(ArgumentErr() << "Missing input or output files.\n"
+             << usage << general_options);
+  if (opt.method != "mean" && opt.method != "median" && opt.method != "trimmed-mean")
+    vw_throw(ArgumentErr() << "Unknown method: " << opt.method << ".\n");
+  if (opt.trim_fraction < 0 || opt.trim_fraction >= 0.5)
+    vw_throw(ArgumentErr() << "The trim fraction must be at least 0 and less than 0.5.\n");
+  if (opt.bin_size <= 0)
+    vw_throw(ArgumentErr() << "The bin size must be positive.\n");
+}
 
-  // TODO: Use Boost program options.
+// The values seen in one column. The sum is exact. The histogram,
+// kept only for the median and trimmed mean, has the counts of the
+// values in [k*bin_size, (k+1)*bin_size) at bin k.
+struct ColumnSketch {
+  double sum;
+  int64  count;
+  std::map<int, int64> hist;
+  ColumnSketch(): sum(0), count(0) {}
 
-  // TODO: No need for outdx.txt and outdy.txt, just save with with same prefix.
-  if (argc <= 3) {
-    vw_out() << "Usage: disp_avg disp.tif outdx.txt outdy.txt [row_start] [num_rows] [col_start] [num_cols]\n";
-    return 1;
+  void add(double val, double bin_size, bool robust) {
+    sum += val;
+    count++;
+    if (robust)
+      hist[(int)floor(val/bin_size)]++;
   }
 
-  std::string in_file = argv[1], outx = argv[2], outy = argv[3];
-
-  std::cout << "Reading: " << in_file << std::endl;
-  DiskImageView < PixelMask<Vector2f> > D(in_file);
-
-  int cols = D.cols(), rows = D.rows();
-  std::cout << "Number of cols and rows is " << cols << ' ' << rows << std::endl;
-
-  // Handle optional row ROI arguments.
-  // - No col ROI since we want the entire column range.
-  int row_start = 0;
-  int row_stop  = rows;
-  int col_start = 0;
-  int col_stop  = cols;
-  if (argc > 4) row_start = atoi(argv[4]);
-  if (argc > 5) row_stop  = row_start + atoi(argv[5]);
-  if (argc > 6) col_start = atoi(argv[6]);
-  if (argc > 7) col_stop  = col_start + atoi(argv[7]);
-
-  // TODO: Add a progress bar.
-  vector<double> Dx(cols, 0), Dy(cols, 0); // Always full sized, even if crop is used.
-  for (int col = col_start; col < col_stop; col++){
-    if (col%100 == 0){
-      std::cout << "column " << col << std::endl;
+  double mean() const { return count > 0 ? sum/count : 0; }
+
+  // The median, placed within its bin as if the values in it were
+  // spread evenly.
+  double median(double bin_size) const {
+    if (count == 0)
+      return 0;
+    double half = 0.5*count, below = 0;
+    for (std::map<int, int64>::const_iterator it = hist.begin(); it != hist.end(); it++) {
+      if (below + it->second >= half)
+        return (it->first + (half - below)/it->second)*bin_size;
+      below += it->second;
     }
-    vector<double> px, py;
-    for (int row = row_start; row < row_stop; row++){
-      PixelMask<Vector2f> p = D(col, row);
-      if (! is_valid(p)) continue;
-      px.push_back(p.child()[0]);
-      py.push_back(p.child()[1]);
+    return 0; // not reached
+  }
+
+  // The mean of the values left when the given fraction of them is
+  // discarded at each end, with each value at the center of its bin.
+  double trimmed_mean(double bin_size, double trim_fraction) const {
+    double lo = trim_fraction*count, hi = count - lo;
+    if (hi - lo <= 0)
+      return median(bin_size);
+    double below = 0, wsum = 0;
+    for (std::map<int, int64>::const_iterator it = hist.begin(); it != hist.end(); it++) {
+      double b = std::max(below, lo), e = std::min(below + it->second, hi);
+      if (e > b)
+        wsum += (e - b)*(it->first + 0.5)*bin_size;
+      below += it->second;
     }
-    std::sort(px.begin(), px.end());
-    std::sort(py.begin(), py.end());
-    int len = px.size();
-    int num_valid = 0;
-    Dx[col] = 0;
-    Dy[col] = 0;
-    for (int k = 0; k < len; k++){
-      num_valid++;
-      Dx[col] += px[k];
-      Dy[col] += py[k];
+    return wsum/(hi - lo);
+  }
+};
+
+// Combine the values in each column of a strip of columns, reading a
+// block of rows at a time.
+class ColumnStripTask : public Task, private boost::noncopyable {
+  DiskImageView< PixelMask<Vector2f> > m_disp;
+  BBox2i           m_strip;
+  int              m_block_rows;
+  Options const&   m_opt;
+  vector<double> & m_Dx, & m_Dy;
+  int            & m_num_done;
+  int              m_num_strips;
+  Mutex          & m_mutex;
+  ProgressCallback const& m_progress;
+public:
+  ColumnStripTask(DiskImageView< PixelMask<Vector2f> > const& disp, BBox2i const& strip,
+                  int block_rows, Options const& opt, vector<double> & Dx, vector<double> & Dy,
+                  int & num_done, int num_strips, Mutex & mutex,
+                  ProgressCallback const& progress):
+    m_disp(disp), m_strip(strip), m_block_rows(block_rows), m_opt(opt), m_Dx(Dx), m_Dy(Dy),
+    m_num_done(num_done), m_num_strips(num_strips), m_mutex(mutex), m_progress(progress) {}
+
+  virtual void operator()() {
+    bool robust = (m_opt.method != "mean");
+    vector<ColumnSketch> sx(m_strip.width()), sy(m_strip.width());
+    for (int row = m_strip.min().y(); row < m_strip.max().y(); row += m_block_rows) {
+      int num_rows = std::min(m_block_rows, m_strip.max().y() - row);
+      ImageView< PixelMask<Vector2f> > block
+        = crop(m_disp, BBox2i(m_strip.min().x(), row, m_strip.width(), num_rows));
+      for (int r = 0; r < block.rows(); r++) {
+        for (int c = 0; c < block.cols(); c++) {
+          PixelMask<Vector2f> const& p = block(c, r);
+          if (!is_valid(p))
+            continue;
+          sx[c].add(p.child()[0], m_opt.bin_size, robust);
+          sy[c].add(p.child()[1], m_opt.bin_size, robust);
+        }
+      }
     }
 
-    if (num_valid > 0){
-      Dx[col] /= num_valid;
-      Dy[col] /= num_valid;
+    // Each strip has its own columns, so no lock is needed here
+    for (int c = 0; c < m_strip.width(); c++) {
+      int col = m_strip.min().x() + c;
+      if (m_opt.method == "median") {
+        m_Dx[col] = sx[c].median(m_opt.bin_size);
+        m_Dy[col] = sy[c].median(m_opt.bin_size);
+      } else if (m_opt.method == "trimmed-mean") {
+        m_Dx[col] = sx[c].trimmed_mean(m_opt.bin_size, m_opt.trim_fraction);
+        m_Dy[col] = sy[c].trimmed_mean(m_opt.bin_size, m_opt.trim_fraction);
+      } else {
+        m_Dx[col] = sx[c].mean();
+        m_Dy[col] = sy[c].mean();
+      }
     }
+
+    Mutex::Lock lock(m_mutex);
+    m_num_done++;
+    m_progress.report_fractional_progress(m_num_done, m_num_strips);
   }
+};
+
+void write_column_values(std::string const& file, int col_start, int col_stop,
+                         vector<double> const& vals) {
+  ofstream out(file.c_str());
+  out.precision(16);
+  vw_out() << "Writing: " << file << "\n";
+  out << col_start << std::endl << col_stop << std::endl; // Column crop on header lines
+  for (size_t col = 0; col < vals.size(); col++)
+    out << vals[col] << std::endl;
+}
+
+int main( int argc, char *argv[] ){
+
+  Options opt;
+  try {
+    handle_arguments(argc, argv, opt);
+
+    vw_out() << "Reading: " << opt.in_file << "\n";
+    DiskImageView < PixelMask<Vector2f> > D(opt.in_file);
+
+    int cols = D.cols(), rows = D.rows();
+    vw_out() << "Number of cols and rows is " << cols << ' ' << rows << "\n";
+
+    // Handle optional ROI arguments
+    int row_stop = (opt.num_rows < 0) ? rows : opt.row_start + opt.num_rows;
+    int col_stop = (opt.num_cols < 0) ? cols : opt.col_start + opt.num_cols;
+    BBox2i roi(opt.col_start, opt.row_start, col_stop - opt.col_start, row_stop - opt.row_start);
+    roi.crop(bounding_box(D));
+
+    // The strips and the blocks in them follow the blocks of the file
+    Vector2i block_size = vw::DiskImageResourcePtr(opt.in_file)->block_read_size();
+    int num_threads = vw_settings().default_num_threads();
+    int strip_cols = std::max(block_size.x(), 256);
+    strip_cols = std::max(1, std::min(strip_cols, (roi.width() + num_threads - 1)/num_threads));
+    int block_rows = std::max(block_size.y(), 256);
+
+    vector<double> Dx(cols, 0), Dy(cols, 0); // Always full sized, even if crop is used.
+    TerminalProgressCallback tpc("asp", "\t--> Columns: ");
+    Mutex mutex;
+    int num_done = 0;
+    int num_strips = roi.empty() ? 0 : (roi.width() + strip_cols - 1)/strip_cols;
+    FifoWorkQueue queue(num_threads);
+    for (int col = roi.min().x(); col < roi.max().x(); col += strip_cols) {
+      BBox2i strip(col, roi.min().y(), std::min(strip_cols, roi.max().x() - col), roi.height());
+      queue.add_task(boost::shared_ptr<Task>
+                     (new ColumnStripTask(D, strip, block_rows, opt, Dx, Dy,
+                                          num_done, num_strips, mutex, tpc)));
+    }
+    queue.join_all();
+    tpc.report_finished();
+
+    write_column_values(opt.outx, opt.col_start, col_stop, Dx);
+    write_column_values(opt.outy, opt.col_start, col_stop, Dy);
 
-  // Write dx file
-  ofstream dx(outx.c_str());
-  dx.precision(16);
-  std::cout << "Writing: " << outx << std::endl;
-  dx << col_start << std::endl << col_stop << std::endl; // Column crop on header lines
-  for (int col = 0; col < cols; col++) 
-    dx << Dx[col] << std::endl;
-
-  // Write dy file
-  ofstream dy(outy.c_str());
-  dy.precision(16);
-  std::cout << "Writing: " << outy << std::endl;
-  dy << col_start << std::endl << col_stop << std::endl; // Column crop on header lines
-  for (int col = 0; col < cols; col++) 
-    dy << Dy[col] << std::endl;
+  } ASP_STANDARD_CATCHES;
 
   return 0;
 }
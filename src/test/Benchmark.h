@@ -0,0 +1,91 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+// Timing of small kernels, for the Bench*.cxx programs built and run
+// with 'make bench'. These are not run by 'make check'.
+//
+// A benchmark is a functor timed over enough calls to last a while.
+// The time per call is printed, and, if the environment variable
+// ASP_BENCHMARK_OUT is set, appended to that file as a line
+//   <name> <nanoseconds per call> <number of calls>
+// so that runs of different releases can be compared.
+
+#ifndef __ASP_TESTS_BENCHMARK_H__
+#define __ASP_TESTS_BENCHMARK_H__
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+namespace vw {
+namespace test {
+
+  /// Keeps the results of the timed calls, so that they are not
+  /// optimized away.
+  inline volatile double& benchmark_sink() {
+    static volatile double sink = 0;
+    return sink;
+  }
+
+  /// Call func() once to warm the caches, then time it, doubling the
+  /// number of calls until they last at least min_seconds. Return the
+  /// time per call, in seconds. ASP_BENCHMARK_MIN_SECONDS, if set,
+  /// overrides min_seconds.
+  template <class FuncT>
+  double benchmark(std::string const& name, FuncT & func, double min_seconds = 0.5) {
+    namespace pt = boost::posix_time;
+
+    const char* env_sec = getenv("ASP_BENCHMARK_MIN_SECONDS");
+    if (env_sec != NULL)
+      min_seconds = atof(env_sec);
+
+    func();
+
+    long long num_calls = 1;
+    double elapsed = 0;
+    while (1) {
+      pt::ptime start = pt::microsec_clock::universal_time();
+      for (long long i = 0; i < num_calls; i++)
+        func();
+      elapsed = (pt::microsec_clock::universal_time() - start).total_microseconds()*1e-6;
+      if (elapsed >= min_seconds || num_calls >= (1LL << 40))
+        break;
+      num_calls *= 2;
+    }
+
+    double per_call = elapsed/num_calls;
+    std::cout << "Benchmark " << std::left << std::setw(40) << name << std::right
+              << std::setw(14) << std::fixed << std::setprecision(1) << per_call*1e9
+              << " ns/call   (" << num_calls << " calls)" << std::endl;
+
+    const char* out_file = getenv("ASP_BENCHMARK_OUT");
+    if (out_file != NULL && out_file[0] != '\0') {
+      std::ofstream ofs(out_file, std::ios::app);
+      ofs << name << " " << std::fixed << std::setprecision(1) << per_call*1e9
+          << " " << num_calls << "\n";
+    }
+
+    return per_call;
+  }
+
+}} // namespace vw::test
+
+#endif